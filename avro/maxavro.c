@@ -17,6 +17,8 @@
 #include "maxavro.h"
 #include <maxscale/log_manager.h>
 #include <errno.h>
+#include <math.h>
+#include <stdio.h>
 
 /** Maximum byte size of an integer value */
 #define MAX_INTEGER_SIZE 10
@@ -25,6 +27,43 @@
 #define encode_long(n) ((n << 1) ^ (n >> 63))
 #define more_bytes(b) (b & 0x80)
 
+size_t maxavro_read_raw(MAXAVRO_FILE *file, void *dest, size_t size);
+long maxavro_tell(MAXAVRO_FILE *file);
+bool maxavro_seek(MAXAVRO_FILE *file, long pos);
+
+/**
+ * @brief Read raw bytes
+ *
+ * The bytes are read from the data block if one is loaded into memory and
+ * from the file otherwise. Reading past the end of a decompressed block is an
+ * error as the block is always complete.
+ * @param file File to read from
+ * @param dest Destination where the bytes are copied
+ * @param size Number of bytes to read
+ * @return Number of bytes read
+ */
+size_t maxavro_read_bytes(MAXAVRO_FILE *file, void *dest, size_t size)
+{
+    if (file->buffer_ptr == NULL)
+    {
+        return maxavro_read_raw(file, dest, size);
+    }
+
+    size_t avail = file->buffer_end - file->buffer_ptr;
+
+    if (size > avail)
+    {
+        MXS_ERROR("Value at record %lu extends past the end of the data block in '%s'.",
+                  file->records_read, file->filename);
+        file->last_error = MAXAVRO_ERR_IO;
+        size = avail;
+    }
+
+    memcpy(dest, file->buffer_ptr, size);
+    file->buffer_ptr += size;
+    return size;
+}
+
 /**
  * @brief Read an Avro integer
  *
@@ -48,7 +87,7 @@ bool maxavro_read_integer(MAXAVRO_FILE* file, uint64_t *dest)
             file->last_error = MAXAVRO_ERR_VALUE_OVERFLOW;
             return false;
         }
-        size_t rdsz = fread(&byte, sizeof(byte), 1, file->file);
+        size_t rdsz = maxavro_read_bytes(file, &byte, sizeof(byte));
         if (rdsz != sizeof(byte))
         {
             if (rdsz != 0)
@@ -113,7 +152,7 @@ char* maxavro_read_string(MAXAVRO_FILE* file, size_t* size)
         key = malloc(len + 1);
         if (key)
         {
-            size_t nread = fread(key, 1, len, file->file);
+            size_t nread = maxavro_read_bytes(file, key, len);
             if (nread == len)
             {
                 key[len] = '\0';
@@ -150,7 +189,19 @@ bool maxavro_skip_string(MAXAVRO_FILE* file)
 
     if (maxavro_read_integer(file, &len))
     {
-        if (fseek(file->file, len, SEEK_CUR) != 0)
+        if (file->buffer_ptr)
+        {
+            if (len > (uint64_t)(file->buffer_end - file->buffer_ptr))
+            {
+                file->last_error = MAXAVRO_ERR_IO;
+            }
+            else
+            {
+                file->buffer_ptr += len;
+                return true;
+            }
+        }
+        else if (!maxavro_seek(file, maxavro_tell(file) + len))
         {
             file->last_error = MAXAVRO_ERR_IO;
         }
@@ -187,7 +238,7 @@ uint64_t avro_length_string(const char* str)
  */
 bool maxavro_read_float(MAXAVRO_FILE* file, float *dest)
 {
-    size_t nread = fread(dest, 1, sizeof(*dest), file->file);
+    size_t nread = maxavro_read_bytes(file, dest, sizeof(*dest));
     if (nread != sizeof(*dest) && nread != 0)
     {
         file->last_error = MAXAVRO_ERR_IO;
@@ -218,7 +269,7 @@ uint64_t avro_length_float(float val)
  */
 bool maxavro_read_double(MAXAVRO_FILE* file, double *dest)
 {
-    size_t nread = fread(dest, 1, sizeof(*dest), file->file);
+    size_t nread = maxavro_read_bytes(file, dest, sizeof(*dest));
     if (nread != sizeof(*dest) && nread != 0)
     {
         file->last_error = MAXAVRO_ERR_IO;
@@ -326,3 +377,281 @@ uint64_t avro_map_length(MAXAVRO_MAP* map)
     len += avro_length_integer(0);
     return len;
 }
+
+/**
+ * @brief Append data to text
+ *
+ * @param text Text to append to
+ * @param data Data to append
+ * @param len Length of @p data
+ * @return True if the data was appended, false if memory allocation failed
+ */
+bool maxavro_text_append(MAXAVRO_TEXT *text, const char *data, size_t len)
+{
+    if (text->len + len > text->size)
+    {
+        size_t new_size = text->size ? text->size : 1024;
+
+        while (new_size < text->len + len)
+        {
+            new_size *= 2;
+        }
+
+        char *new_data = realloc(text->data, new_size);
+
+        if (new_data == NULL)
+        {
+            return false;
+        }
+
+        text->data = new_data;
+        text->size = new_size;
+    }
+
+    memcpy(text->data + text->len, data, len);
+    text->len += len;
+    return true;
+}
+
+/**
+ * @brief Free the memory of text
+ *
+ * @param text Text to free, it is left empty
+ */
+void maxavro_text_free(MAXAVRO_TEXT *text)
+{
+    free(text->data);
+    text->data = NULL;
+    text->len = 0;
+    text->size = 0;
+}
+
+/**
+ * @brief Append an integer to text as JSON
+ *
+ * @param text Text to append to
+ * @param value Value to append
+ * @return True if the value was appended, false if memory allocation failed
+ */
+bool maxavro_text_append_integer(MAXAVRO_TEXT *text, int64_t value)
+{
+    char buf[24];
+    char *ptr = buf + sizeof(buf);
+    uint64_t u = value < 0 ? -(uint64_t)value : (uint64_t)value;
+
+    do
+    {
+        *--ptr = '0' + u % 10;
+        u /= 10;
+    }
+    while (u);
+
+    if (value < 0)
+    {
+        *--ptr = '-';
+    }
+
+    return maxavro_text_append(text, ptr, buf + sizeof(buf) - ptr);
+}
+
+/**
+ * @brief Append a floating point value to text as JSON
+ *
+ * The value is formatted the same way as jansson formats reals: there is
+ * always a dot or an exponent and the exponent has no plus sign or leading
+ * zeros.
+ *
+ * @param text Text to append to
+ * @param value Value to append
+ * @return True if the value was appended, false if it is not finite or memory
+ * allocation failed
+ */
+bool maxavro_text_append_double(MAXAVRO_TEXT *text, double value)
+{
+    if (!isfinite(value))
+    {
+        return false;
+    }
+
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf) - 2, "%.17g", value);
+
+    if (len < 0 || len >= (int)sizeof(buf) - 2)
+    {
+        return false;
+    }
+
+    char *comma = strchr(buf, ',');
+
+    if (comma)
+    {
+        /** Decimal comma of the locale */
+        *comma = '.';
+    }
+
+    char *exp = strchr(buf, 'e');
+
+    if (exp)
+    {
+        char *start = exp + 1;
+
+        if (*start == '-')
+        {
+            start++;
+        }
+
+        char *end = start;
+
+        while (*end == '+' || *end == '0')
+        {
+            end++;
+        }
+
+        memmove(start, end, buf + len + 1 - end);
+        len -= end - start;
+    }
+    else if (strchr(buf, '.') == NULL)
+    {
+        buf[len++] = '.';
+        buf[len++] = '0';
+    }
+
+    return maxavro_text_append(text, buf, len);
+}
+
+/**
+ * @brief Get the length of a UTF-8 sequence
+ *
+ * @param ptr Start of the sequence, the first byte is not ASCII
+ * @param end End of the string
+ * @return Length of the sequence or 0 if it is not valid UTF-8
+ */
+static size_t utf8_length(const uint8_t *ptr, const uint8_t *end)
+{
+    uint8_t c = *ptr;
+    uint32_t codepoint;
+    size_t len;
+
+    if (c >= 0xc2 && c <= 0xdf)
+    {
+        len = 2;
+        codepoint = c & 0x1f;
+    }
+    else if (c >= 0xe0 && c <= 0xef)
+    {
+        len = 3;
+        codepoint = c & 0x0f;
+    }
+    else if (c >= 0xf0 && c <= 0xf4)
+    {
+        len = 4;
+        codepoint = c & 0x07;
+    }
+    else
+    {
+        return 0;
+    }
+
+    if ((size_t)(end - ptr) < len)
+    {
+        return 0;
+    }
+
+    for (size_t i = 1; i < len; i++)
+    {
+        if ((ptr[i] & 0xc0) != 0x80)
+        {
+            return 0;
+        }
+        codepoint = (codepoint << 6) | (ptr[i] & 0x3f);
+    }
+
+    /** Overlong encodings, surrogates and too large values */
+    if ((len == 3 && codepoint < 0x800) || (len == 4 && codepoint < 0x10000) ||
+        (codepoint >= 0xd800 && codepoint <= 0xdfff) || codepoint > 0x10ffff)
+    {
+        return 0;
+    }
+
+    return len;
+}
+
+/**
+ * @brief Append a string to text as JSON
+ *
+ * The string is escaped the same way as jansson escapes strings. Bytes that
+ * are not valid UTF-8 are replaced with U+FFFD.
+ *
+ * @param text Text to append to
+ * @param str String to append
+ * @param len Length of @p str
+ * @return True if the string was appended, false if memory allocation failed
+ */
+bool maxavro_text_append_string(MAXAVRO_TEXT *text, const char *str, size_t len)
+{
+    const uint8_t *ptr = (const uint8_t*)str;
+    const uint8_t *end = ptr + len;
+    const uint8_t *run = ptr;
+    bool ok = maxavro_text_append(text, "\"", 1);
+
+    while (ok && ptr < end)
+    {
+        uint8_t c = *ptr;
+        size_t n;
+
+        if (c >= 0x20 && c != '"' && c != '\\' && c < 0x80)
+        {
+            ptr++;
+            continue;
+        }
+        else if (c >= 0x80 && (n = utf8_length(ptr, end)) > 0)
+        {
+            ptr += n;
+            continue;
+        }
+
+        char seq[8];
+
+        switch (c)
+        {
+        case '"':
+            strcpy(seq, "\\\"");
+            break;
+        case '\\':
+            strcpy(seq, "\\\\");
+            break;
+        case '\b':
+            strcpy(seq, "\\b");
+            break;
+        case '\f':
+            strcpy(seq, "\\f");
+            break;
+        case '\n':
+            strcpy(seq, "\\n");
+            break;
+        case '\r':
+            strcpy(seq, "\\r");
+            break;
+        case '\t':
+            strcpy(seq, "\\t");
+            break;
+        default:
+            if (c < 0x20)
+            {
+                snprintf(seq, sizeof(seq), "\\u%04X", c);
+            }
+            else
+            {
+                strcpy(seq, "\\uFFFD");
+            }
+            break;
+        }
+
+        ok = maxavro_text_append(text, (const char*)run, ptr - run) &&
+             maxavro_text_append(text, seq, strlen(seq));
+        run = ++ptr;
+    }
+
+    return ok && maxavro_text_append(text, (const char*)run, ptr - run) &&
+           maxavro_text_append(text, "\"", 1);
+}
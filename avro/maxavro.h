@@ -47,6 +47,8 @@ typedef struct
     char *name;
     void *extra;
     enum maxavro_value_type type;
+    char *json_key; /*< The name as a JSON object key followed by the colon */
+    size_t json_key_len;
 } MAXAVRO_SCHEMA_FIELD;
 
 typedef struct
@@ -60,7 +62,16 @@ enum maxavro_error
     MAXAVRO_ERR_NONE,
     MAXAVRO_ERR_IO,
     MAXAVRO_ERR_MEMORY,
-    MAXAVRO_ERR_VALUE_OVERFLOW
+    MAXAVRO_ERR_VALUE_OVERFLOW,
+    MAXAVRO_ERR_CODEC
+};
+
+/** The compression codecs of the data blocks */
+enum maxavro_codec
+{
+    MAXAVRO_CODEC_NULL,
+    MAXAVRO_CODEC_DEFLATE,
+    MAXAVRO_CODEC_SNAPPY
 };
 
 typedef struct
@@ -86,6 +97,32 @@ typedef struct
                          * to know when to read it and when not to.  */
     enum maxavro_error last_error; /*< Last error */
     uint8_t sync[SYNC_MARKER_SIZE];
+    enum maxavro_codec codec; /*< Compression codec of the data blocks */
+
+    /** The file mapped into memory. If the file could not be mapped, it is
+     * read with @c file. */
+    uint8_t *map;
+    size_t map_size; /*< Size of the mapping */
+    long map_pos; /*< Current offset in the mapped file */
+
+    /** The data of the current block. If @c buffer_ptr is NULL, the values are
+     * read directly from the file. For a mapped file, the data of an
+     * uncompressed block is read directly from the mapping. */
+    const uint8_t *buffer_ptr; /*< Read position in the data */
+    const uint8_t *buffer_end; /*< End of the data */
+    uint8_t *buffer; /*< Decompressed data */
+    size_t buffer_size;
+    uint8_t *zbuffer; /*< The compressed data of the current block */
+    size_t zbuffer_size;
+
+    /** Offsets of the complete data blocks found by maxavro_index_blocks() */
+    long *blocks;
+    size_t n_blocks;
+    size_t blocks_size; /*< Allocated size of @c blocks */
+    long blocks_end; /*< Offset where the indexing of the blocks continues */
+
+    /** Whether the current block was given with maxavro_record_load_block() */
+    bool block_in_memory;
 } MAXAVRO_FILE;
 
 /** A record field value */
@@ -115,6 +152,46 @@ typedef struct
     MAXAVRO_FILE *avrofile; /*< The current open file */
 } MAXAVRO_DATABLOCK;
 
+/** Comparisons of the record filter conditions */
+enum maxavro_compare
+{
+    MAXAVRO_CMP_EQ,
+    MAXAVRO_CMP_NE,
+    MAXAVRO_CMP_LT,
+    MAXAVRO_CMP_LE,
+    MAXAVRO_CMP_GT,
+    MAXAVRO_CMP_GE
+};
+
+/** A condition on the value of a field */
+typedef struct
+{
+    size_t field; /*< Index of the field in the schema */
+    enum maxavro_compare op;
+    int64_t integer; /*< Value of an integer, bool or enum field */
+    double real; /*< Value of a float or double field */
+    char *string; /*< Value of a string or bytes field */
+    size_t string_len;
+} MAXAVRO_CONDITION;
+
+/** Selects the records and the fields of a file that are read */
+typedef struct
+{
+    MAXAVRO_SCHEMA *schema; /*< The schema the filter was created for */
+    bool *columns; /*< The fields that are read, NULL for all fields */
+    MAXAVRO_CONDITION *conditions; /*< A record is read if all are true */
+    size_t n_conditions;
+    size_t end_field; /*< Index after the last field with a condition */
+} MAXAVRO_FILTER;
+
+/** Text that JSON is appended to */
+typedef struct
+{
+    char *data;
+    size_t len; /*< Length of the text */
+    size_t size; /*< Allocated size of @c data */
+} MAXAVRO_TEXT;
+
 typedef struct avro_map_value
 {
     char* key;
@@ -138,22 +215,38 @@ bool maxavro_datablock_add_float(MAXAVRO_DATABLOCK *file, float val);
 bool maxavro_datablock_add_double(MAXAVRO_DATABLOCK *file, double val);
 
 /** Reading primitives */
+size_t maxavro_read_bytes(MAXAVRO_FILE *file, void *dest, size_t size);
 bool maxavro_read_integer(MAXAVRO_FILE *file, uint64_t *val);
 char* maxavro_read_string(MAXAVRO_FILE *file, size_t *size);
 bool maxavro_skip_string(MAXAVRO_FILE* file);
 bool maxavro_read_float(MAXAVRO_FILE *file, float *dest);
 bool maxavro_read_double(MAXAVRO_FILE *file, double *dest);
 
+/** Appending to text */
+bool maxavro_text_append(MAXAVRO_TEXT *text, const char *data, size_t len);
+void maxavro_text_free(MAXAVRO_TEXT *text);
+
 /** Reading complex types */
 MAXAVRO_MAP* maxavro_map_read(MAXAVRO_FILE *file);
 void maxavro_map_free(MAXAVRO_MAP *value);
 
 /** Reading and seeking records */
 json_t* maxavro_record_read_json(MAXAVRO_FILE *file);
+bool maxavro_record_read_json_text(MAXAVRO_FILE *file, MAXAVRO_TEXT *dest, uint64_t *integers,
+                                   MAXAVRO_FILTER *filter);
 GWBUF* maxavro_record_read_binary(MAXAVRO_FILE *file);
 bool maxavro_record_seek(MAXAVRO_FILE *file, uint64_t offset);
 bool maxavro_record_set_pos(MAXAVRO_FILE *file, long pos);
 bool maxavro_next_block(MAXAVRO_FILE *file);
+size_t maxavro_index_blocks(MAXAVRO_FILE *file);
+
+/** Reading blocks that are in memory */
+size_t maxavro_datablock_length(const uint8_t *ptr, const uint8_t *end, uint64_t *records);
+long maxavro_next_block_pos(MAXAVRO_FILE *file);
+bool maxavro_record_load_block(MAXAVRO_FILE *file, const uint8_t *data, size_t len);
+bool maxavro_record_skip_block(MAXAVRO_FILE *file, const uint8_t *data, size_t len);
+bool maxavro_record_enter_block(MAXAVRO_FILE *file);
+GWBUF* maxavro_record_copy_block(MAXAVRO_FILE *file);
 
 /** File operations */
 MAXAVRO_FILE* maxavro_file_open(const char* filename);
@@ -164,6 +257,13 @@ GWBUF* maxavro_file_binary_header(MAXAVRO_FILE *file);
 enum maxavro_error maxavro_get_error(MAXAVRO_FILE *file);
 const char* maxavro_get_error_string(MAXAVRO_FILE *file);
 
+/** Record filters */
+MAXAVRO_FILTER* maxavro_filter_alloc(MAXAVRO_SCHEMA *schema);
+bool maxavro_filter_add_column(MAXAVRO_FILTER *filter, const char *name);
+bool maxavro_filter_add_condition(MAXAVRO_FILTER *filter, const char *name,
+                                  enum maxavro_compare op, const char *value);
+void maxavro_filter_free(MAXAVRO_FILTER *filter);
+
 /** Schema creation */
 MAXAVRO_SCHEMA* maxavro_schema_alloc(const char* json);
 void maxavro_schema_free(MAXAVRO_SCHEMA* schema);
@@ -14,29 +14,177 @@
 #include "maxavro.h"
 #include <errno.h>
 #include <string.h>
+#include <zlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <maxscale/log_manager.h>
+#include <maxscale/crc32.h>
 
-static bool maxavro_read_sync(FILE *file, uint8_t* sync)
+#ifdef HAVE_SNAPPY
+#include <snappy-c.h>
+#endif
+
+/** Size of the CRC32 checksum that follows the data of a snappy block */
+#define SNAPPY_CHECKSUM_SIZE 4
+
+/**
+ * @brief Map a file into memory
+ *
+ * If the file can't be mapped, it is read with stdio.
+ *
+ * @param file File to map, positioned after the file magic
+ */
+static void maxavro_map_file(MAXAVRO_FILE *file)
+{
+    struct stat st;
+    int fd = fileno(file->file);
+
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+        if (map != MAP_FAILED)
+        {
+            file->map = map;
+            file->map_size = st.st_size;
+            file->map_pos = ftell(file->file);
+        }
+    }
+}
+
+/**
+ * @brief Make sure that the mapping covers the start of a file
+ *
+ * The Avro files are appended to while they are read. If the mapping does not
+ * cover the requested part of the file, the mapping is grown to the current
+ * size of the file.
+ *
+ * @param file Mapped file
+ * @param size Number of bytes from the start of the file
+ * @return True if the mapping covers @c size bytes
+ */
+static bool maxavro_map_covers(MAXAVRO_FILE *file, size_t size)
+{
+    struct stat st;
+
+    if (size > file->map_size && fstat(fileno(file->file), &st) == 0 &&
+        st.st_size > file->map_size)
+    {
+        void *map = mremap(file->map, file->map_size, st.st_size, MREMAP_MAYMOVE);
+
+        if (map != MAP_FAILED)
+        {
+            file->map = map;
+            file->map_size = st.st_size;
+        }
+        else
+        {
+            char err[MXS_STRERROR_BUFLEN];
+            MXS_ERROR("Failed to grow the mapping of '%s': %d, %s", file->filename,
+                      errno, strerror_r(errno, err, sizeof(err)));
+        }
+    }
+
+    return size <= file->map_size;
+}
+
+/**
+ * @brief Read raw bytes from the current position of the file
+ *
+ * @param file File to read from
+ * @param dest Destination where the bytes are copied
+ * @param size Number of bytes to read
+ * @return Number of bytes read, less than @c size at the end of the file
+ */
+size_t maxavro_read_raw(MAXAVRO_FILE *file, void *dest, size_t size)
+{
+    if (file->map == NULL)
+    {
+        return fread(dest, 1, size, file->file);
+    }
+
+    if (!maxavro_map_covers(file, file->map_pos + size))
+    {
+        size = file->map_pos < file->map_size ? file->map_size - file->map_pos : 0;
+    }
+
+    memcpy(dest, file->map + file->map_pos, size);
+    file->map_pos += size;
+    return size;
+}
+
+/**
+ * @brief Get the current position of the file
+ *
+ * @param file File to check
+ * @return The current offset or -1 on error
+ */
+long maxavro_tell(MAXAVRO_FILE *file)
+{
+    return file->map ? file->map_pos : ftell(file->file);
+}
+
+/**
+ * @brief Set the position of the file
+ *
+ * @param file File to seek
+ * @param pos The new offset from the start of the file
+ * @return True if the position was set
+ */
+bool maxavro_seek(MAXAVRO_FILE *file, long pos)
+{
+    if (file->map)
+    {
+        file->map_pos = pos;
+        return true;
+    }
+
+    return fseek(file->file, pos, SEEK_SET) == 0;
+}
+
+/**
+ * @brief Check whether a short read was caused by a read error
+ *
+ * @param file File to check
+ * @return True if reading the file failed
+ */
+static bool maxavro_read_failed(MAXAVRO_FILE *file)
+{
+    return file->map == NULL && ferror(file->file);
+}
+
+/**
+ * @brief Clear the end of file condition of a short read
+ *
+ * A later read can then see the data written after the short read.
+ *
+ * @param file File to clear
+ */
+static void maxavro_clear_eof(MAXAVRO_FILE *file)
+{
+    if (file->map == NULL)
+    {
+        clearerr(file->file);
+    }
+}
+
+static bool maxavro_read_sync(MAXAVRO_FILE *file, uint8_t* sync)
 {
     bool rval = true;
 
-    if (fread(sync, 1, SYNC_MARKER_SIZE, file) != SYNC_MARKER_SIZE)
+    if (maxavro_read_raw(file, sync, SYNC_MARKER_SIZE) != SYNC_MARKER_SIZE)
     {
         rval = false;
 
-        if (ferror(file))
+        if (maxavro_read_failed(file))
         {
             char err[MXS_STRERROR_BUFLEN];
             MXS_ERROR("Failed to read file sync marker: %d, %s", errno,
                       strerror_r(errno, err, sizeof(err)));
         }
-        else if (feof(file))
-        {
-            MXS_ERROR("Short read when reading file sync marker.");
-        }
         else
         {
-            MXS_ERROR("Unspecified error when reading file sync marker.");
+            MXS_ERROR("Short read when reading file sync marker.");
         }
     }
 
@@ -46,25 +194,26 @@ static bool maxavro_read_sync(FILE *file, uint8_t* sync)
 bool maxavro_verify_block(MAXAVRO_FILE *file)
 {
     char sync[SYNC_MARKER_SIZE];
-    int rc = fread(sync, 1, SYNC_MARKER_SIZE, file->file);
+    int rc = maxavro_read_raw(file, sync, SYNC_MARKER_SIZE);
     if (rc != SYNC_MARKER_SIZE)
     {
-        if (ferror(file->file))
+        if (maxavro_read_failed(file))
         {
             char err[MXS_STRERROR_BUFLEN];
             MXS_ERROR("Failed to read file: %d %s", errno, strerror_r(errno, err, sizeof(err)));
         }
-        else if (rc > 0 || !feof(file->file))
+        else if (rc > 0)
         {
             MXS_ERROR("Short read when reading sync marker. Read %d bytes instead of %d",
                       rc, SYNC_MARKER_SIZE);
         }
+        maxavro_clear_eof(file);
         return false;
     }
 
     if (memcmp(file->sync, sync, SYNC_MARKER_SIZE))
     {
-        long pos = ftell(file->file);
+        long pos = maxavro_tell(file);
         long expected = file->data_start_pos + file->block_size + SYNC_MARKER_SIZE;
         if (pos != expected)
         {
@@ -84,17 +233,271 @@ bool maxavro_verify_block(MAXAVRO_FILE *file)
     return true;
 }
 
+/**
+ * @brief Make sure a buffer can hold a number of bytes
+ *
+ * @param buffer The buffer to grow
+ * @param size Current size of the buffer, updated if the buffer is grown
+ * @param needed The number of bytes the buffer must hold
+ * @return True if the buffer is large enough
+ */
+static bool reserve_buffer(uint8_t **buffer, size_t *size, size_t needed)
+{
+    if (needed > *size)
+    {
+        size_t new_size = *size ? *size : 4096;
+
+        while (new_size < needed)
+        {
+            new_size *= 2;
+        }
+
+        uint8_t *new_buffer = realloc(*buffer, new_size);
+
+        if (new_buffer == NULL)
+        {
+            return false;
+        }
+
+        *buffer = new_buffer;
+        *size = new_size;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Decompress a deflate block
+ *
+ * The deflate codec of Avro stores raw deflate data without the zlib header
+ * or checksum.
+ *
+ * @param file File to decompress into
+ * @param src The compressed data
+ * @param len Length of the compressed data
+ * @param out Length of the decompressed data
+ * @return True if the block was decompressed into @c buffer
+ */
+static bool inflate_block(MAXAVRO_FILE *file, const uint8_t *src, size_t len, size_t *out)
+{
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+
+    if (inflateInit2(&strm, -MAX_WBITS) != Z_OK)
+    {
+        return false;
+    }
+
+    strm.next_in = (Bytef*)src;
+    strm.avail_in = len;
+    size_t total = 0;
+    int rc = Z_OK;
+
+    while (rc == Z_OK)
+    {
+        if (total == file->buffer_size &&
+            !reserve_buffer(&file->buffer, &file->buffer_size, total + len * 2 + 1))
+        {
+            file->last_error = MAXAVRO_ERR_MEMORY;
+            break;
+        }
+
+        strm.next_out = file->buffer + total;
+        strm.avail_out = file->buffer_size - total;
+        rc = inflate(&strm, Z_NO_FLUSH);
+        total = file->buffer_size - strm.avail_out;
+    }
+
+    inflateEnd(&strm);
+    *out = total;
+    return rc == Z_STREAM_END;
+}
+
+#ifdef HAVE_SNAPPY
+/**
+ * @brief Decompress a snappy block
+ *
+ * The snappy codec of Avro stores the snappy compressed data followed by the
+ * big-endian CRC32 checksum of the uncompressed data.
+ *
+ * @param file File to decompress into
+ * @param data The compressed data
+ * @param len Length of the compressed data, including the checksum
+ * @param out Length of the decompressed data
+ * @return True if the block was decompressed into @c buffer
+ */
+static bool snappy_block(MAXAVRO_FILE *file, const uint8_t *data, size_t len, size_t *out)
+{
+    if (len < SNAPPY_CHECKSUM_SIZE)
+    {
+        return false;
+    }
+
+    const char *src = (const char*)data;
+    size_t src_len = len - SNAPPY_CHECKSUM_SIZE;
+    size_t dest_len;
+
+    if (snappy_uncompressed_length(src, src_len, &dest_len) != SNAPPY_OK)
+    {
+        return false;
+    }
+
+    if (!reserve_buffer(&file->buffer, &file->buffer_size, dest_len))
+    {
+        file->last_error = MAXAVRO_ERR_MEMORY;
+        return false;
+    }
+
+    if (snappy_uncompress(src, src_len, (char*)file->buffer, &dest_len) != SNAPPY_OK)
+    {
+        return false;
+    }
+
+    const uint8_t *crc = data + src_len;
+    uint32_t expected = ((uint32_t)crc[0] << 24) | ((uint32_t)crc[1] << 16) |
+                        ((uint32_t)crc[2] << 8) | crc[3];
+
+    if (mxs_crc32(0, file->buffer, dest_len) != expected)
+    {
+        MXS_ERROR("Checksum mismatch in snappy data block.");
+        return false;
+    }
+
+    *out = dest_len;
+    return true;
+}
+#endif
+
+/**
+ * @brief Prepare the data of a block for reading
+ *
+ * @param file  File whose block is decoded
+ * @param data  The data of the block, must stay valid while the block is read
+ *              if the block is not compressed
+ * @param bytes Length of the data
+ * @return True if the records of the block can be read
+ */
+static bool decode_block(MAXAVRO_FILE *file, const uint8_t *data, uint64_t bytes)
+{
+    size_t len = 0;
+    bool rval = false;
+
+    switch (file->codec)
+    {
+    case MAXAVRO_CODEC_NULL:
+        file->buffer_ptr = data;
+        file->buffer_end = data + bytes;
+        return true;
+
+    case MAXAVRO_CODEC_DEFLATE:
+        rval = inflate_block(file, data, bytes, &len);
+        break;
+
+#ifdef HAVE_SNAPPY
+    case MAXAVRO_CODEC_SNAPPY:
+        rval = snappy_block(file, data, bytes, &len);
+        break;
+#endif
+
+    default:
+        ss_dassert(false);
+        break;
+    }
+
+    if (rval)
+    {
+        file->buffer_ptr = file->buffer;
+        file->buffer_end = file->buffer + len;
+    }
+    else
+    {
+        MXS_ERROR("Failed to decompress data block at offset %ld of '%s'.",
+                  file->block_start_pos, file->filename);
+
+        if (file->last_error == MAXAVRO_ERR_NONE)
+        {
+            file->last_error = MAXAVRO_ERR_CODEC;
+        }
+    }
+
+    return rval;
+}
+
+/**
+ * @brief Load a whole data block into memory
+ *
+ * The values of the block are then read from memory. The data of an
+ * uncompressed block is read directly from the mapping of the file and that of
+ * a compressed block is decompressed into @c buffer. If the block has not been
+ * completely written, the file is positioned back to the start of the block so
+ * that it can be read again once the rest of the block has been written.
+ *
+ * @param file File positioned at the start of the block data
+ * @param bytes Size of the block data
+ * @return True if the block was loaded
+ */
+static bool load_block(MAXAVRO_FILE *file, uint64_t bytes)
+{
+    const uint8_t *data;
+    long pos = maxavro_tell(file);
+
+    if (file->map)
+    {
+        /** The sync marker must be there as well so that verifying the block
+         * never moves the mapping from under the loaded data */
+        if (!maxavro_map_covers(file, pos + bytes + SYNC_MARKER_SIZE))
+        {
+            maxavro_seek(file, file->block_start_pos);
+            return false;
+        }
+
+        data = file->map + pos;
+        maxavro_seek(file, pos + bytes);
+    }
+    else
+    {
+        if (!reserve_buffer(&file->zbuffer, &file->zbuffer_size, bytes))
+        {
+            file->last_error = MAXAVRO_ERR_MEMORY;
+            return false;
+        }
+
+        if (fread(file->zbuffer, 1, bytes, file->file) != bytes)
+        {
+            if (ferror(file->file))
+            {
+                char err[MXS_STRERROR_BUFLEN];
+                MXS_ERROR("Failed to read data block: %d, %s", errno,
+                          strerror_r(errno, err, sizeof(err)));
+                file->last_error = MAXAVRO_ERR_IO;
+            }
+            else
+            {
+                clearerr(file->file);
+                fseek(file->file, file->block_start_pos, SEEK_SET);
+            }
+            return false;
+        }
+
+        data = file->zbuffer;
+    }
+
+    return decode_block(file, data, bytes);
+}
+
 bool maxavro_read_datablock_start(MAXAVRO_FILE* file)
 {
     /** The actual start of the binary block */
-    file->block_start_pos = ftell(file->file);
+    file->block_start_pos = maxavro_tell(file);
     file->metadata_read = false;
+    file->block_in_memory = false;
+    file->buffer_ptr = NULL;
     uint64_t records, bytes;
     bool rval = maxavro_read_integer(file, &records) && maxavro_read_integer(file, &bytes);
 
     if (rval)
     {
-        long pos = ftell(file->file);
+        long pos = maxavro_tell(file);
 
         if (pos == -1)
         {
@@ -103,6 +506,10 @@ bool maxavro_read_datablock_start(MAXAVRO_FILE* file)
             MXS_ERROR("Failed to read datablock start: %d, %s", errno,
                       strerror_r(errno, err, sizeof(err)));
         }
+        else if ((file->map || file->codec != MAXAVRO_CODEC_NULL) && !load_block(file, bytes))
+        {
+            rval = false;
+        }
         else
         {
             file->block_size = bytes;
@@ -117,20 +524,53 @@ bool maxavro_read_datablock_start(MAXAVRO_FILE* file)
     {
         MXS_ERROR("Failed to read data block start.");
     }
-    else if (feof(file->file))
+    else
     {
-        clearerr(file->file);
+        maxavro_clear_eof(file);
     }
     return rval;
 }
 
+/**
+ * @brief Set the codec of the file from the header metadata
+ *
+ * @param file File to set
+ * @param codec Name of the codec
+ * @return True if the codec is supported
+ */
+static bool set_codec(MAXAVRO_FILE* file, const char* codec)
+{
+    if (strcmp(codec, "null") == 0)
+    {
+        file->codec = MAXAVRO_CODEC_NULL;
+    }
+    else if (strcmp(codec, "deflate") == 0)
+    {
+        file->codec = MAXAVRO_CODEC_DEFLATE;
+    }
+#ifdef HAVE_SNAPPY
+    else if (strcmp(codec, "snappy") == 0)
+    {
+        file->codec = MAXAVRO_CODEC_SNAPPY;
+    }
+#endif
+    else
+    {
+        MXS_ERROR("Unsupported Avro codec '%s' in '%s'.", codec, file->filename);
+        return false;
+    }
+
+    return true;
+}
+
 /** The header metadata is encoded as an Avro map with @c bytes encoded
  * key-value pairs. A @c bytes value is written as a length encoded string
  * where the length of the value is stored as a @c long followed by the
- * actual data. */
+ * actual data. The codec of the data blocks is also read from the header. */
 static char* read_schema(MAXAVRO_FILE* file)
 {
     char *rval = NULL;
+    bool codec_ok = true;
     MAXAVRO_MAP* head = maxavro_map_read(file);
     MAXAVRO_MAP* map = head;
 
@@ -138,8 +578,12 @@ static char* read_schema(MAXAVRO_FILE* file)
     {
         if (strcmp(map->key, "avro.schema") == 0)
         {
+            free(rval);
             rval = strdup(map->value);
-            break;
+        }
+        else if (strcmp(map->key, "avro.codec") == 0)
+        {
+            codec_ok = set_codec(file, map->value);
         }
         map = map->next;
     }
@@ -148,6 +592,11 @@ static char* read_schema(MAXAVRO_FILE* file)
     {
         MXS_ERROR("No schema found from Avro header.");
     }
+    else if (!codec_ok)
+    {
+        free(rval);
+        rval = NULL;
+    }
 
     maxavro_map_free(head);
     return rval;
@@ -197,6 +646,8 @@ MAXAVRO_FILE* maxavro_file_open(const char* filename)
         avrofile->file = file;
         avrofile->filename = my_filename;
         avrofile->last_error = MAXAVRO_ERR_NONE;
+        avrofile->codec = MAXAVRO_CODEC_NULL;
+        maxavro_map_file(avrofile);
 
         char *schema = read_schema(avrofile);
 
@@ -205,10 +656,11 @@ MAXAVRO_FILE* maxavro_file_open(const char* filename)
             avrofile->schema = maxavro_schema_alloc(schema);
 
             if (avrofile->schema &&
-                maxavro_read_sync(file, avrofile->sync) &&
+                maxavro_read_sync(avrofile, avrofile->sync) &&
                 maxavro_read_datablock_start(avrofile))
             {
                 avrofile->header_end_pos = avrofile->block_start_pos;
+                avrofile->blocks_end = avrofile->header_end_pos;
             }
             else
             {
@@ -231,6 +683,18 @@ MAXAVRO_FILE* maxavro_file_open(const char* filename)
     if (error)
     {
         fclose(file);
+
+        if (avrofile)
+        {
+            if (avrofile->map)
+            {
+                munmap(avrofile->map, avrofile->map_size);
+            }
+
+            free(avrofile->buffer);
+            free(avrofile->zbuffer);
+        }
+
         free(avrofile);
         free(my_filename);
         avrofile = NULL;
@@ -267,6 +731,9 @@ const char* maxavro_get_error_string(MAXAVRO_FILE *file)
     case MAXAVRO_ERR_VALUE_OVERFLOW:
         return "MAXAVRO_ERR_VALUE_OVERFLOW";
 
+    case MAXAVRO_ERR_CODEC:
+        return "MAXAVRO_ERR_CODEC";
+
     case MAXAVRO_ERR_NONE:
         return "MAXAVRO_ERR_NONE";
 
@@ -283,13 +750,263 @@ void maxavro_file_close(MAXAVRO_FILE *file)
 {
     if (file)
     {
+        if (file->map)
+        {
+            munmap(file->map, file->map_size);
+        }
+
         fclose(file->file);
         free(file->filename);
         maxavro_schema_free(file->schema);
+        free(file->buffer);
+        free(file->zbuffer);
+        free(file->blocks);
         free(file);
     }
 }
 
+/**
+ * @brief Decode an Avro long from memory
+ *
+ * @param ptr Start of the encoded value
+ * @param end End of the readable memory
+ * @param dest Destination where the value is stored
+ * @return Length of the encoded value or 0 if the value is not complete
+ */
+static size_t decode_long(const uint8_t *ptr, const uint8_t *end, uint64_t *dest)
+{
+    uint64_t val = 0;
+
+    for (size_t i = 0; i < 10 && ptr + i < end; i++)
+    {
+        val |= (uint64_t)(ptr[i] & 0x7f) << (i * 7);
+
+        if ((ptr[i] & 0x80) == 0)
+        {
+            *dest = (val >> 1) ^ -(val & 1);
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Index the data blocks of a file
+ *
+ * This finds the offsets of the complete data blocks that are not yet in the
+ * index. Only the block headers and the sync markers are read, so indexing a
+ * block costs the same regardless of its size or codec. Only mapped files are
+ * indexed.
+ *
+ * @param file File to index
+ * @return Number of blocks in @c blocks
+ */
+size_t maxavro_index_blocks(MAXAVRO_FILE *file)
+{
+    if (file->map == NULL)
+    {
+        return 0;
+    }
+
+    /** Pick up the blocks written since the mapping was last grown */
+    maxavro_map_covers(file, file->map_size + 1);
+
+    const uint8_t *end = file->map + file->map_size;
+    long pos = file->blocks_end;
+
+    while (pos < file->map_size)
+    {
+        const uint8_t *ptr = file->map + pos;
+        uint64_t records, bytes;
+        size_t len1 = decode_long(ptr, end, &records);
+        size_t len2 = len1 ? decode_long(ptr + len1, end, &bytes) : 0;
+
+        if (len2 == 0 || bytes > file->map_size ||
+            pos + len1 + len2 + bytes + SYNC_MARKER_SIZE > file->map_size)
+        {
+            /** The rest of the file is not yet written */
+            break;
+        }
+
+        long next = pos + len1 + len2 + bytes + SYNC_MARKER_SIZE;
+
+        if (memcmp(file->map + next - SYNC_MARKER_SIZE, file->sync, SYNC_MARKER_SIZE) != 0)
+        {
+            MXS_ERROR("Sync marker mismatch at offset %ld of '%s' when indexing data blocks.",
+                      next - SYNC_MARKER_SIZE, file->filename);
+            break;
+        }
+
+        if (file->n_blocks == file->blocks_size)
+        {
+            size_t new_size = file->blocks_size ? file->blocks_size * 2 : 1024;
+            long *blocks = realloc(file->blocks, new_size * sizeof(long));
+
+            if (blocks == NULL)
+            {
+                break;
+            }
+
+            file->blocks = blocks;
+            file->blocks_size = new_size;
+        }
+
+        file->blocks[file->n_blocks++] = pos;
+        pos = next;
+    }
+
+    file->blocks_end = pos;
+    return file->n_blocks;
+}
+
+/**
+ * @brief Get the length of a data block in memory
+ *
+ * @param ptr Start of the block
+ * @param end End of the readable memory
+ * @param records Set to the number of records in the block
+ * @return Length of the block with its header and sync marker or 0 if the
+ * block is not complete
+ */
+size_t maxavro_datablock_length(const uint8_t *ptr, const uint8_t *end, uint64_t *records)
+{
+    uint64_t bytes;
+    size_t len1 = decode_long(ptr, end, records);
+    size_t len2 = len1 ? decode_long(ptr + len1, end, &bytes) : 0;
+
+    if (len2 == 0 || bytes > (uint64_t)(end - ptr) ||
+        len1 + len2 + bytes + SYNC_MARKER_SIZE > (uint64_t)(end - ptr))
+    {
+        return 0;
+    }
+
+    return len1 + len2 + bytes + SYNC_MARKER_SIZE;
+}
+
+/**
+ * @brief Get the offset of the next block whose records are read
+ *
+ * @param file File to check
+ * @return Offset of the block that follows the current one, or that of the
+ * current block if none of its records have been read or the file is between
+ * blocks
+ */
+long maxavro_next_block_pos(MAXAVRO_FILE *file)
+{
+    return file->metadata_read && file->records_read_from_block > 0 ?
+           file->data_start_pos + file->block_size + SYNC_MARKER_SIZE :
+           file->block_start_pos;
+}
+
+/**
+ * @brief Move to a block that is given in memory
+ *
+ * The rest of the current block is skipped and @c data is taken to be the
+ * block at maxavro_next_block_pos().
+ *
+ * @param file File to move
+ * @param data The block with its header and sync marker
+ * @param len  Length of the block
+ * @param records Set to the number of records in the block
+ * @param bytes Set to the length of the data of the block
+ * @return Length of the header of the block or 0 if @c data is not a block of
+ * the file
+ */
+static size_t enter_memory_block(MAXAVRO_FILE *file, const uint8_t *data, size_t len,
+                                 uint64_t *records, uint64_t *bytes)
+{
+    const uint8_t *end = data + len;
+    size_t len1 = decode_long(data, end, records);
+    size_t len2 = len1 ? decode_long(data + len1, end, bytes) : 0;
+
+    if (file->last_error != MAXAVRO_ERR_NONE || len2 == 0 ||
+        len1 + len2 + *bytes + SYNC_MARKER_SIZE != len ||
+        memcmp(end - SYNC_MARKER_SIZE, file->sync, SYNC_MARKER_SIZE) != 0)
+    {
+        return 0;
+    }
+
+    long pos = maxavro_next_block_pos(file);
+
+    if (file->metadata_read && file->records_read_from_block > 0)
+    {
+        /** Account for the current block like maxavro_next_block() does */
+        file->records_read += file->records_in_block - file->records_read_from_block;
+        file->blocks_read++;
+        file->bytes_read += file->block_size;
+    }
+
+    file->block_start_pos = pos;
+    file->data_start_pos = pos + len1 + len2;
+    file->block_size = *bytes;
+    file->records_in_block = *records;
+    file->records_read_from_block = 0;
+    file->buffer_ptr = NULL;
+    file->metadata_read = false;
+    file->block_in_memory = false;
+    return len1 + len2;
+}
+
+/**
+ * @brief Read the records of the next block from memory
+ *
+ * The records are then read as if the block had been read from the file. If
+ * the block is not compressed, the data must stay valid until the next block
+ * is read.
+ *
+ * @param file File to read
+ * @param data The block with its header and sync marker
+ * @param len  Length of the block
+ * @return True if the block was loaded
+ */
+bool maxavro_record_load_block(MAXAVRO_FILE *file, const uint8_t *data, size_t len)
+{
+    uint64_t records, bytes;
+    size_t hdr_len = enter_memory_block(file, data, len, &records, &bytes);
+
+    if (hdr_len == 0 || !decode_block(file, data + hdr_len, bytes))
+    {
+        return false;
+    }
+
+    /** The file position is where it would be had the block been read from it */
+    maxavro_seek(file, file->data_start_pos + bytes);
+    file->metadata_read = true;
+    file->block_in_memory = true;
+    return true;
+}
+
+/**
+ * @brief Skip the next block that was sent from memory
+ *
+ * The file is moved past the block as if it had been read with
+ * maxavro_record_read_binary().
+ *
+ * @param file File to move
+ * @param data The block with its header and sync marker
+ * @param len  Length of the block
+ * @return True if the file was moved past the block
+ */
+bool maxavro_record_skip_block(MAXAVRO_FILE *file, const uint8_t *data, size_t len)
+{
+    uint64_t records, bytes;
+
+    if (enter_memory_block(file, data, len, &records, &bytes) == 0)
+    {
+        return false;
+    }
+
+    /** The file is left at the start of the next block */
+    file->records_read += records;
+    file->records_read_from_block = records;
+    file->blocks_read++;
+    file->bytes_read += bytes;
+    file->block_start_pos += len;
+    maxavro_seek(file, file->block_start_pos);
+    return true;
+}
+
 /**
  * @brief Read binary Avro header
  *
@@ -304,25 +1021,21 @@ GWBUF* maxavro_file_binary_header(MAXAVRO_FILE *file)
     long pos = file->header_end_pos;
     GWBUF *rval = NULL;
 
-    if (fseek(file->file, 0, SEEK_SET) == 0)
+    if (maxavro_seek(file, 0))
     {
         if ((rval = gwbuf_alloc(pos)))
         {
-            if (fread(GWBUF_DATA(rval), 1, pos, file->file) != pos)
+            if (maxavro_read_raw(file, GWBUF_DATA(rval), pos) != pos)
             {
-                if (ferror(file->file))
+                if (maxavro_read_failed(file))
                 {
                     char err[MXS_STRERROR_BUFLEN];
                     MXS_ERROR("Failed to read binary header: %d, %s", errno,
                               strerror_r(errno, err, sizeof(err)));
                 }
-                else if (feof(file->file))
-                {
-                    MXS_ERROR("Short read when reading binary header.");
-                }
                 else
                 {
-                    MXS_ERROR("Unspecified error when reading binary header.");
+                    MXS_ERROR("Short read when reading binary header.");
                 }
                 gwbuf_free(rval);
                 rval = NULL;
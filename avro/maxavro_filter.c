@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file maxavro_filter.c - Selecting the records and the fields that are read
+ *
+ * A filter is created for the schema of one file. The conditions are
+ * evaluated on the Avro data of a record before it is converted.
+ */
+
+#include "maxavro.h"
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <maxscale/log_manager.h>
+
+/**
+ * @brief Find a field of a schema
+ *
+ * @param schema Schema to search
+ * @param name Name of the field
+ * @return Index of the field or -1 if the schema has no such field
+ */
+static int find_field(MAXAVRO_SCHEMA *schema, const char *name)
+{
+    for (size_t i = 0; i < schema->num_fields; i++)
+    {
+        if (strcmp(schema->fields[i].name, name) == 0)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Create a filter that reads all records and fields
+ *
+ * @param schema Schema of the file the filter is used with
+ * @return New filter or NULL if memory allocation failed
+ */
+MAXAVRO_FILTER* maxavro_filter_alloc(MAXAVRO_SCHEMA *schema)
+{
+    MAXAVRO_FILTER *filter = calloc(1, sizeof(MAXAVRO_FILTER));
+
+    if (filter)
+    {
+        filter->schema = schema;
+    }
+
+    return filter;
+}
+
+/**
+ * @brief Add a field to the fields that are read
+ *
+ * Once a field is added, only the added fields are read.
+ *
+ * @param filter Filter to modify
+ * @param name Name of the field
+ * @return True if the field was added, false if the schema has no such field
+ * or memory allocation failed
+ */
+bool maxavro_filter_add_column(MAXAVRO_FILTER *filter, const char *name)
+{
+    int field = find_field(filter->schema, name);
+
+    if (field < 0)
+    {
+        return false;
+    }
+
+    if (filter->columns == NULL &&
+        (filter->columns = calloc(filter->schema->num_fields, sizeof(bool))) == NULL)
+    {
+        return false;
+    }
+
+    filter->columns[field] = true;
+    return true;
+}
+
+/**
+ * @brief Parse the value of a condition
+ *
+ * @param cond Condition to store the value in
+ * @param field The field of the condition
+ * @param value The value as text
+ * @return True if the value is valid for the field
+ */
+static bool parse_value(MAXAVRO_CONDITION *cond, MAXAVRO_SCHEMA_FIELD *field, const char *value)
+{
+    char *end;
+    errno = 0;
+
+    switch (field->type)
+    {
+    case MAXAVRO_TYPE_BOOL:
+        if (strcasecmp(value, "true") == 0 || strcmp(value, "1") == 0)
+        {
+            cond->integer = 1;
+        }
+        else if (strcasecmp(value, "false") == 0 || strcmp(value, "0") == 0)
+        {
+            cond->integer = 0;
+        }
+        else
+        {
+            return false;
+        }
+        return cond->op == MAXAVRO_CMP_EQ || cond->op == MAXAVRO_CMP_NE;
+
+    case MAXAVRO_TYPE_INT:
+    case MAXAVRO_TYPE_LONG:
+        cond->integer = strtoll(value, &end, 10);
+        return *value && *end == '\0' && errno == 0;
+
+    case MAXAVRO_TYPE_ENUM:
+        {
+            /** The enum values are compared by their index */
+            json_t *arr = field->extra;
+
+            for (size_t i = 0; i < json_array_size(arr); i++)
+            {
+                if (strcmp(json_string_value(json_array_get(arr, i)), value) == 0)
+                {
+                    cond->integer = i;
+                    return cond->op == MAXAVRO_CMP_EQ || cond->op == MAXAVRO_CMP_NE;
+                }
+            }
+        }
+        return false;
+
+    case MAXAVRO_TYPE_FLOAT:
+    case MAXAVRO_TYPE_DOUBLE:
+        cond->real = strtod(value, &end);
+        return *value && *end == '\0' && errno == 0;
+
+    case MAXAVRO_TYPE_STRING:
+    case MAXAVRO_TYPE_BYTES:
+        cond->string_len = strlen(value);
+        return (cond->string = strdup(value)) != NULL;
+
+    default:
+        return false;
+    }
+}
+
+/**
+ * @brief Add a condition that a record must fulfill
+ *
+ * Integer and floating point fields are compared numerically, string and bytes
+ * fields byte by byte. Bool and enum fields can only be compared for
+ * equality; bools are given as true or false and enums as the symbol.
+ *
+ * @param filter Filter to modify
+ * @param name Name of the field
+ * @param op Comparison
+ * @param value The value the field is compared to
+ * @return True if the condition was added, false if the schema has no such
+ * field, the value or the comparison is not valid for it or memory
+ * allocation failed
+ */
+bool maxavro_filter_add_condition(MAXAVRO_FILTER *filter, const char *name,
+                                  enum maxavro_compare op, const char *value)
+{
+    int field = find_field(filter->schema, name);
+
+    if (field < 0)
+    {
+        return false;
+    }
+
+    MAXAVRO_CONDITION *conditions = realloc(filter->conditions,
+                                            sizeof(MAXAVRO_CONDITION) * (filter->n_conditions + 1));
+
+    if (conditions == NULL)
+    {
+        return false;
+    }
+
+    filter->conditions = conditions;
+    MAXAVRO_CONDITION *cond = &conditions[filter->n_conditions];
+    memset(cond, 0, sizeof(*cond));
+    cond->field = field;
+    cond->op = op;
+
+    if (!parse_value(cond, &filter->schema->fields[field], value))
+    {
+        free(cond->string);
+        return false;
+    }
+
+    filter->n_conditions++;
+
+    if ((size_t)field + 1 > filter->end_field)
+    {
+        filter->end_field = field + 1;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Free a filter
+ *
+ * @param filter Filter to free
+ */
+void maxavro_filter_free(MAXAVRO_FILTER *filter)
+{
+    if (filter)
+    {
+        for (size_t i = 0; i < filter->n_conditions; i++)
+        {
+            free(filter->conditions[i].string);
+        }
+
+        free(filter->conditions);
+        free(filter->columns);
+        free(filter);
+    }
+}
@@ -20,7 +20,13 @@
 
 bool maxavro_read_datablock_start(MAXAVRO_FILE *file);
 bool maxavro_verify_block(MAXAVRO_FILE *file);
+size_t maxavro_read_raw(MAXAVRO_FILE *file, void *dest, size_t size);
+long maxavro_tell(MAXAVRO_FILE *file);
+bool maxavro_seek(MAXAVRO_FILE *file, long pos);
 const char* type_to_string(enum maxavro_value_type type);
+bool maxavro_text_append_integer(MAXAVRO_TEXT *text, int64_t value);
+bool maxavro_text_append_double(MAXAVRO_TEXT *text, double value);
+bool maxavro_text_append_string(MAXAVRO_TEXT *text, const char *str, size_t len);
 
 /**
  * @brief Read a single value from a file
@@ -38,7 +44,7 @@ static json_t* read_and_pack_value(MAXAVRO_FILE *file, MAXAVRO_SCHEMA_FIELD *fie
     case MAXAVRO_TYPE_BOOL:
         {
             int i = 0;
-            if (fread(&i, 1, 1, file->file) == 1)
+            if (maxavro_read_bytes(file, &i, 1) == 1)
             {
                 value = json_pack("b", i);
             }
@@ -116,6 +122,56 @@ static json_t* read_and_pack_value(MAXAVRO_FILE *file, MAXAVRO_SCHEMA_FIELD *fie
     return value;
 }
 
+/**
+ * @brief Read a record and convert in into JSON
+ *
+ * @param file File to read from
+ * @return JSON value or NULL if an error occurred. The caller must call
+ * json_decref() on the returned value to free the allocated memory.
+ */
+json_t* maxavro_record_read_json(MAXAVRO_FILE *file)
+{
+    if (!file->metadata_read && !maxavro_read_datablock_start(file))
+    {
+        return NULL;
+    }
+
+    json_t* object = NULL;
+
+    if (file->records_read_from_block < file->records_in_block)
+    {
+        object = json_object();
+
+        if (object)
+        {
+            for (size_t i = 0; i < file->schema->num_fields; i++)
+            {
+                json_t* value = read_and_pack_value(file, &file->schema->fields[i]);
+                if (value)
+                {
+                    json_object_set_new(object, file->schema->fields[i].name, value);
+                }
+                else
+                {
+                    long pos = maxavro_tell(file);
+                    MXS_ERROR("Failed to read field value '%s', type '%s' at "
+                              "file offset %ld, record number %lu.",
+                              file->schema->fields[i].name,
+                              type_to_string(file->schema->fields[i].type),
+                              pos, file->records_read);
+                    json_decref(object);
+                    return NULL;
+                }
+            }
+        }
+
+        file->records_read_from_block++;
+        file->records_read++;
+    }
+
+    return object;
+}
+
 static void skip_value(MAXAVRO_FILE *file, enum maxavro_value_type type)
 {
     switch (type)
@@ -129,7 +185,20 @@ static void skip_value(MAXAVRO_FILE *file, enum maxavro_value_type type)
         }
         break;
 
+    case MAXAVRO_TYPE_BOOL:
+        {
+            uint8_t b;
+            maxavro_read_bytes(file, &b, 1);
+        }
+        break;
+
     case MAXAVRO_TYPE_FLOAT:
+        {
+            float f = 0;
+            maxavro_read_float(file, &f);
+        }
+        break;
+
     case MAXAVRO_TYPE_DOUBLE:
         {
             double d = 0;
@@ -151,53 +220,440 @@ static void skip_value(MAXAVRO_FILE *file, enum maxavro_value_type type)
 }
 
 /**
- * @brief Read a record and convert in into JSON
+ * @brief Check the result of a comparison
+ *
+ * @param cmp Negative, zero or positive as the value is less than, equal to
+ * or greater than the value of the condition
+ * @param op Comparison of the condition
+ * @return True if the condition is true
+ */
+static bool compare_result(int cmp, enum maxavro_compare op)
+{
+    switch (op)
+    {
+    case MAXAVRO_CMP_EQ:
+        return cmp == 0;
+    case MAXAVRO_CMP_NE:
+        return cmp != 0;
+    case MAXAVRO_CMP_LT:
+        return cmp < 0;
+    case MAXAVRO_CMP_LE:
+        return cmp <= 0;
+    case MAXAVRO_CMP_GT:
+        return cmp > 0;
+    case MAXAVRO_CMP_GE:
+        return cmp >= 0;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Read a value and check the conditions on it
  *
  * @param file File to read from
- * @return JSON value or NULL if an error occurred. The caller must call
- * json_decref() on the returned value to free the allocated memory.
+ * @param filter Filter with the conditions
+ * @param index Index of the field
+ * @param match Set to false if a condition on the field is false
+ * @return True if the value was read, false if an error occurred
  */
-json_t* maxavro_record_read_json(MAXAVRO_FILE *file)
+static bool read_and_check_value(MAXAVRO_FILE *file, MAXAVRO_FILTER *filter, size_t index, bool *match)
 {
-    if (!file->metadata_read && !maxavro_read_datablock_start(file))
+    MAXAVRO_SCHEMA_FIELD *field = &file->schema->fields[index];
+    int64_t integer = 0;
+    double real = 0;
+    const char *str = NULL;
+    char *str_copy = NULL;
+    uint64_t len = 0;
+
+    switch (field->type)
     {
-        return NULL;
+    case MAXAVRO_TYPE_BOOL:
+        {
+            uint8_t b = 0;
+            if (maxavro_read_bytes(file, &b, 1) != 1)
+            {
+                return false;
+            }
+            integer = b != 0;
+        }
+        break;
+
+    case MAXAVRO_TYPE_INT:
+    case MAXAVRO_TYPE_LONG:
+    case MAXAVRO_TYPE_ENUM:
+        {
+            uint64_t val;
+            if (!maxavro_read_integer(file, &val))
+            {
+                return false;
+            }
+            integer = (int64_t)val;
+        }
+        break;
+
+    case MAXAVRO_TYPE_FLOAT:
+        {
+            float f;
+            if (!maxavro_read_float(file, &f))
+            {
+                return false;
+            }
+            real = f;
+        }
+        break;
+
+    case MAXAVRO_TYPE_DOUBLE:
+        if (!maxavro_read_double(file, &real))
+        {
+            return false;
+        }
+        break;
+
+    case MAXAVRO_TYPE_STRING:
+    case MAXAVRO_TYPE_BYTES:
+        if (file->buffer_ptr)
+        {
+            /** Compare the string in the data block */
+            if (!maxavro_read_integer(file, &len) ||
+                len > (uint64_t)(file->buffer_end - file->buffer_ptr))
+            {
+                return false;
+            }
+            str = (const char*)file->buffer_ptr;
+            file->buffer_ptr += len;
+        }
+        else
+        {
+            size_t size;
+            if ((str = str_copy = maxavro_read_string(file, &size)) == NULL)
+            {
+                return false;
+            }
+            len = size;
+        }
+        break;
+
+    default:
+        return false;
     }
 
-    json_t* object = NULL;
+    for (size_t i = 0; i < filter->n_conditions && *match; i++)
+    {
+        MAXAVRO_CONDITION *cond = &filter->conditions[i];
 
-    if (file->records_read_from_block < file->records_in_block)
+        if (cond->field == index)
+        {
+            int cmp;
+
+            switch (field->type)
+            {
+            case MAXAVRO_TYPE_FLOAT:
+            case MAXAVRO_TYPE_DOUBLE:
+                cmp = real < cond->real ? -1 : real > cond->real ? 1 : 0;
+                break;
+
+            case MAXAVRO_TYPE_STRING:
+            case MAXAVRO_TYPE_BYTES:
+                cmp = memcmp(str, cond->string, MXS_MIN(len, cond->string_len));
+
+                if (cmp == 0)
+                {
+                    cmp = len < cond->string_len ? -1 : len > cond->string_len ? 1 : 0;
+                }
+                break;
+
+            default:
+                cmp = integer < cond->integer ? -1 : integer > cond->integer ? 1 : 0;
+                break;
+            }
+
+            *match = compare_result(cmp, cond->op);
+        }
+    }
+
+    free(str_copy);
+    return true;
+}
+
+/**
+ * @brief Check if the next record fulfills the conditions of a filter
+ *
+ * The fields up to the last one with a condition are read, after which the
+ * read position is returned to the start of the record.
+ *
+ * @param file File to read from
+ * @param filter Filter with the conditions
+ * @param match Set to true if all conditions are true
+ * @return True if the record was read, false if an error occurred
+ */
+static bool record_matches(MAXAVRO_FILE *file, MAXAVRO_FILTER *filter, bool *match)
+{
+    const uint8_t *start_ptr = file->buffer_ptr;
+    long start_pos = start_ptr ? 0 : maxavro_tell(file);
+    bool ok = true;
+    *match = true;
+
+    for (size_t i = 0; ok && *match && i < filter->end_field; i++)
     {
-        object = json_object();
+        bool checked = false;
 
-        if (object)
+        for (size_t j = 0; j < filter->n_conditions && !checked; j++)
         {
-            for (size_t i = 0; i < file->schema->num_fields; i++)
+            checked = filter->conditions[j].field == i;
+        }
+
+        if (checked)
+        {
+            ok = read_and_check_value(file, filter, i, match);
+        }
+        else
+        {
+            skip_value(file, file->schema->fields[i].type);
+            ok = file->last_error == MAXAVRO_ERR_NONE;
+        }
+    }
+
+    if (start_ptr)
+    {
+        file->buffer_ptr = start_ptr;
+    }
+    else
+    {
+        maxavro_seek(file, start_pos);
+    }
+
+    return ok;
+}
+
+/**
+ * @brief Read a single value from a file and append it to text as JSON
+ *
+ * @param file File to read from
+ * @param field Field of the value
+ * @param dest Text to append to
+ * @param integer If not NULL, the value of an integer or enum field is stored here
+ * @return True if the value was read and appended, false if an error occurred
+ */
+static bool read_and_write_value(MAXAVRO_FILE *file, MAXAVRO_SCHEMA_FIELD *field,
+                                 MAXAVRO_TEXT *dest, uint64_t *integer)
+{
+    bool rval = false;
+
+    switch (field->type)
+    {
+    case MAXAVRO_TYPE_BOOL:
+        {
+            uint8_t b = 0;
+            if (maxavro_read_bytes(file, &b, 1) == 1)
             {
-                json_t* value = read_and_pack_value(file, &file->schema->fields[i]);
-                if (value)
+                rval = b ? maxavro_text_append(dest, "true", 4) :
+                       maxavro_text_append(dest, "false", 5);
+            }
+        }
+        break;
+
+    case MAXAVRO_TYPE_INT:
+    case MAXAVRO_TYPE_LONG:
+        {
+            uint64_t val = 0;
+            if (maxavro_read_integer(file, &val))
+            {
+                if (integer)
                 {
-                    json_object_set_new(object, file->schema->fields[i].name, value);
+                    *integer = val;
+                }
+                rval = maxavro_text_append_integer(dest, (int64_t)val);
+            }
+        }
+        break;
+
+    case MAXAVRO_TYPE_ENUM:
+        {
+            uint64_t val = 0;
+            json_t *arr = field->extra;
+            ss_dassert(arr);
+            ss_dassert(json_is_array(arr));
+
+            if (maxavro_read_integer(file, &val) && val < json_array_size(arr))
+            {
+                json_t *symbol = json_array_get(arr, val);
+                ss_dassert(json_is_string(symbol));
+
+                if (integer)
+                {
+                    *integer = val;
+                }
+                rval = maxavro_text_append_string(dest, json_string_value(symbol),
+                                                  json_string_length(symbol));
+            }
+        }
+        break;
+
+    case MAXAVRO_TYPE_FLOAT:
+        {
+            float f = 0;
+            if (maxavro_read_float(file, &f))
+            {
+                rval = maxavro_text_append_double(dest, f);
+            }
+        }
+        break;
+
+    case MAXAVRO_TYPE_DOUBLE:
+        {
+            double d = 0;
+            if (maxavro_read_double(file, &d))
+            {
+                rval = maxavro_text_append_double(dest, d);
+            }
+        }
+        break;
+
+    case MAXAVRO_TYPE_BYTES:
+    case MAXAVRO_TYPE_STRING:
+        if (file->buffer_ptr)
+        {
+            /** Escape the string directly from the data block */
+            uint64_t len;
+            if (maxavro_read_integer(file, &len))
+            {
+                if (len <= (uint64_t)(file->buffer_end - file->buffer_ptr))
+                {
+                    rval = maxavro_text_append_string(dest, (const char*)file->buffer_ptr, len);
+                    file->buffer_ptr += len;
                 }
                 else
                 {
-                    long pos = ftell(file->file);
-                    MXS_ERROR("Failed to read field value '%s', type '%s' at "
-                              "file offset %ld, record number %lu.",
-                              file->schema->fields[i].name,
-                              type_to_string(file->schema->fields[i].type),
-                              pos, file->records_read);
-                    json_decref(object);
-                    return NULL;
+                    file->last_error = MAXAVRO_ERR_IO;
                 }
             }
         }
+        else
+        {
+            size_t len;
+            char *str = maxavro_read_string(file, &len);
+            if (str)
+            {
+                rval = maxavro_text_append_string(dest, str, len);
+                free(str);
+            }
+        }
+        break;
 
-        file->records_read_from_block++;
-        file->records_read++;
+    default:
+        MXS_ERROR("Unimplemented type: %d", field->type);
+        break;
     }
 
-    return object;
+    return rval;
+}
+
+/**
+ * @brief Read a record and append it to text as one line of JSON
+ *
+ * The record is encoded directly from the data block without creating JSON
+ * objects. The text is the same that json_dumps() with JSON_PRESERVE_ORDER
+ * gives for the value returned by maxavro_record_read_json(), followed by a
+ * newline.
+ *
+ * @param file File to read from
+ * @param dest Text to append to, on error it is left as it was
+ * @param integers If not NULL, an array of as many values as the schema has
+ * fields where the values of the integer and enum fields are stored. The
+ * values are stored also for the fields the filter does not select.
+ * @param filter If not NULL, the filter that selects the fields that are
+ * converted. If the record does not fulfill the conditions of the filter, the
+ * record is read but nothing is appended to @p dest.
+ * @return True if a record was read, false if there are no more records in the
+ * block or an error occurred
+ */
+bool maxavro_record_read_json_text(MAXAVRO_FILE *file, MAXAVRO_TEXT *dest, uint64_t *integers,
+                                   MAXAVRO_FILTER *filter)
+{
+    if (!file->metadata_read && !maxavro_read_datablock_start(file))
+    {
+        return false;
+    }
+
+    if (file->records_read_from_block >= file->records_in_block)
+    {
+        return false;
+    }
+
+    size_t start = dest->len;
+    bool match = true;
+
+    if (filter && filter->n_conditions > 0 && !record_matches(file, filter, &match))
+    {
+        MXS_ERROR("Failed to read record number %lu of '%s'.", file->records_read, file->filename);
+        return false;
+    }
+
+    bool *columns = filter ? filter->columns : NULL;
+    bool ok = !match || maxavro_text_append(dest, "{", 1);
+    bool first = true;
+
+    for (size_t i = 0; ok && i < file->schema->num_fields; i++)
+    {
+        MAXAVRO_SCHEMA_FIELD *field = &file->schema->fields[i];
+
+        if (!match || (columns && !columns[i]))
+        {
+            /** The integers are read even if the fields are not converted */
+            if (integers && (field->type == MAXAVRO_TYPE_INT || field->type == MAXAVRO_TYPE_LONG ||
+                             field->type == MAXAVRO_TYPE_ENUM))
+            {
+                ok = maxavro_read_integer(file, &integers[i]);
+            }
+            else
+            {
+                skip_value(file, field->type);
+                ok = file->last_error == MAXAVRO_ERR_NONE;
+            }
+
+            if (!ok)
+            {
+                MXS_ERROR("Failed to read field value '%s', type '%s' at "
+                          "record number %lu of '%s'.", field->name,
+                          type_to_string(field->type), file->records_read, file->filename);
+                dest->len = start;
+                return false;
+            }
+        }
+        else if ((!first && !maxavro_text_append(dest, ", ", 2)) ||
+                 !maxavro_text_append(dest, field->json_key, field->json_key_len))
+        {
+            ok = false;
+        }
+        else if (!read_and_write_value(file, field, dest, integers ? &integers[i] : NULL))
+        {
+            long pos = maxavro_tell(file);
+            MXS_ERROR("Failed to read field value '%s', type '%s' at "
+                      "file offset %ld, record number %lu.",
+                      field->name, type_to_string(field->type),
+                      pos, file->records_read);
+            dest->len = start;
+            return false;
+        }
+        else
+        {
+            first = false;
+        }
+    }
+
+    if (!ok || (match && !maxavro_text_append(dest, "}\n", 2)))
+    {
+        MXS_ERROR("Memory allocation failed when converting record %lu of '%s' to JSON.",
+                  file->records_read, file->filename);
+        file->last_error = MAXAVRO_ERR_MEMORY;
+        dest->len = start;
+        return false;
+    }
+
+    file->records_read_from_block++;
+    file->records_read++;
+    return true;
 }
 
 static void skip_record(MAXAVRO_FILE *file)
@@ -224,15 +680,29 @@ bool maxavro_next_block(MAXAVRO_FILE *file)
         if (file->records_read_from_block < file->records_in_block)
         {
             file->records_read += file->records_in_block - file->records_read_from_block;
-            long curr_pos = ftell(file->file);
-            long offset = (long) file->block_size - (curr_pos - file->data_start_pos);
 
-            if (offset > 0)
+            /** A block loaded into memory has already been read from the file */
+            if (file->buffer_ptr == NULL)
             {
-                fseek(file->file, offset, SEEK_CUR);
+                long curr_pos = maxavro_tell(file);
+                long offset = (long) file->block_size - (curr_pos - file->data_start_pos);
+
+                if (offset > 0)
+                {
+                    maxavro_seek(file, curr_pos + offset);
+                }
             }
         }
 
+        if (file->block_in_memory)
+        {
+            /** The sync marker was checked when the block was loaded */
+            maxavro_seek(file, file->data_start_pos + file->block_size + SYNC_MARKER_SIZE);
+            file->blocks_read++;
+            file->bytes_read += file->block_size;
+            return maxavro_read_datablock_start(file);
+        }
+
         return maxavro_verify_block(file) && maxavro_read_datablock_start(file);
     }
     return false;
@@ -269,7 +739,6 @@ bool maxavro_record_seek(MAXAVRO_FILE *file, uint64_t offset)
         {
             /** Skip full blocks that don't have the position we want */
             offset -= file->records_in_block;
-            fseek(file->file, file->block_size, SEEK_CUR);
             maxavro_next_block(file);
         }
 
@@ -297,10 +766,68 @@ bool maxavro_record_seek(MAXAVRO_FILE *file, uint64_t offset)
  */
 bool maxavro_record_set_pos(MAXAVRO_FILE *file, long pos)
 {
-    fseek(file->file, pos - SYNC_MARKER_SIZE, SEEK_SET);
+    maxavro_seek(file, pos - SYNC_MARKER_SIZE);
     return maxavro_verify_block(file) && maxavro_read_datablock_start(file);
 }
 
+/**
+ * @brief Make the next block the current one
+ *
+ * Nothing is done if no records have been read from the current block.
+ *
+ * @param file File to read from
+ * @return True if the file is at the start of a block, false at the end of the
+ * file or on error
+ */
+bool maxavro_record_enter_block(MAXAVRO_FILE *file)
+{
+    if (file->metadata_read && file->records_read_from_block > 0)
+    {
+        return maxavro_next_block(file);
+    }
+
+    return file->metadata_read || maxavro_read_datablock_start(file);
+}
+
+/**
+ * @brief Copy the current block in native Avro format
+ *
+ * The position of the file is not changed.
+ *
+ * @param file File whose current block is copied
+ * @return The block with its header and sync marker or NULL on error
+ */
+GWBUF* maxavro_record_copy_block(MAXAVRO_FILE *file)
+{
+    if (!file->metadata_read)
+    {
+        return NULL;
+    }
+
+    long pos = maxavro_tell(file);
+    long data_size = (file->data_start_pos - file->block_start_pos) + file->block_size;
+    GWBUF *rval = gwbuf_alloc(data_size + SYNC_MARKER_SIZE);
+
+    if (rval)
+    {
+        maxavro_seek(file, file->block_start_pos);
+
+        if (maxavro_read_raw(file, GWBUF_DATA(rval), data_size) == data_size)
+        {
+            memcpy(((uint8_t*) GWBUF_DATA(rval)) + data_size, file->sync, sizeof(file->sync));
+        }
+        else
+        {
+            gwbuf_free(rval);
+            rval = NULL;
+        }
+
+        maxavro_seek(file, pos);
+    }
+
+    return rval;
+}
+
 /**
  * @brief Read native Avro data
  *
@@ -328,16 +855,16 @@ GWBUF* maxavro_record_read_binary(MAXAVRO_FILE *file)
 
         if (rval)
         {
-            fseek(file->file, file->block_start_pos, SEEK_SET);
+            maxavro_seek(file, file->block_start_pos);
 
-            if (fread(GWBUF_DATA(rval), 1, data_size, file->file) == data_size)
+            if (maxavro_read_raw(file, GWBUF_DATA(rval), data_size) == data_size)
             {
                 memcpy(((uint8_t*) GWBUF_DATA(rval)) + data_size, file->sync, sizeof(file->sync));
                 maxavro_next_block(file);
             }
             else
             {
-                if (ferror(file->file))
+                if (file->map == NULL && ferror(file->file))
                 {
                     char err[MXS_STRERROR_BUFLEN];
                     MXS_ERROR("Failed to read %ld bytes: %d, %s", data_size, errno,
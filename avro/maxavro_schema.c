@@ -17,6 +17,8 @@
 #include <maxscale/debug.h>
 #include <maxscale/log_manager.h>
 
+bool maxavro_text_append_string(MAXAVRO_TEXT *text, const char *str, size_t len);
+
 static const MAXAVRO_SCHEMA_FIELD types[MAXAVRO_TYPE_MAX] =
 {
     {"int", NULL, MAXAVRO_TYPE_INT},
@@ -109,6 +111,44 @@ static enum maxavro_value_type unpack_to_type(json_t *object,
     return rval;
 }
 
+static void maxavro_schema_field_free(MAXAVRO_SCHEMA_FIELD *field)
+{
+    if (field)
+    {
+        free(field->name);
+        free(field->json_key);
+        if (field->type == MAXAVRO_TYPE_ENUM)
+        {
+            json_decref((json_t*)field->extra);
+        }
+    }
+}
+
+/**
+ * @brief Form the JSON object key of a field
+ *
+ * The key is formed once so that the records can be converted to JSON text
+ * without escaping the field names for each record.
+ *
+ * @param field Field whose name is set
+ * @return True if the key was formed, false if memory allocation failed
+ */
+static bool set_json_key(MAXAVRO_SCHEMA_FIELD *field)
+{
+    MAXAVRO_TEXT key = {NULL, 0, 0};
+
+    if (maxavro_text_append_string(&key, field->name, strlen(field->name)) &&
+        maxavro_text_append(&key, ": ", 2))
+    {
+        field->json_key = key.data;
+        field->json_key_len = key.len;
+        return true;
+    }
+
+    maxavro_text_free(&key);
+    return false;
+}
+
 /**
  * @brief Create a new Avro schema from JSON
  * @param json JSON from which the schema is created from
@@ -143,7 +183,21 @@ MAXAVRO_SCHEMA* maxavro_schema_alloc(const char* json)
                     if (object && json_unpack(object, "{s:s s:o}", "name", &key, "type", &value_obj) == 0)
                     {
                         rval->fields[i].name = strdup(key);
+                        rval->fields[i].extra = NULL;
+                        rval->fields[i].json_key = NULL;
                         rval->fields[i].type = unpack_to_type(value_obj, &rval->fields[i]);
+
+                        if (rval->fields[i].name == NULL || !set_json_key(&rval->fields[i]))
+                        {
+                            MXS_ERROR("Memory allocation failed.");
+                            error = true;
+
+                            for (int j = 0; j <= i; j++)
+                            {
+                                maxavro_schema_field_free(&rval->fields[j]);
+                            }
+                            break;
+                        }
                     }
                     else
                     {
@@ -152,7 +206,7 @@ MAXAVRO_SCHEMA* maxavro_schema_alloc(const char* json)
 
                         for (int j = 0; j < i; j++)
                         {
-                            free(rval->fields[j].name);
+                            maxavro_schema_field_free(&rval->fields[j]);
                         }
                         break;
                     }
@@ -186,18 +240,6 @@ MAXAVRO_SCHEMA* maxavro_schema_alloc(const char* json)
     return rval;
 }
 
-static void maxavro_schema_field_free(MAXAVRO_SCHEMA_FIELD *field)
-{
-    if (field)
-    {
-        free(field->name);
-        if (field->type == MAXAVRO_TYPE_ENUM)
-        {
-            json_decref((json_t*)field->extra);
-        }
-    }
-}
-
 /**
  * Free a MAXAVRO_SCHEMA object
  * @param schema Schema to free
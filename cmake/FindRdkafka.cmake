@@ -0,0 +1,14 @@
+# This CMake file locates the librdkafka Kafka client library
+#
+# The following variables are set:
+# RDKAFKA_FOUND - If the librdkafka library was found
+# RDKAFKA_LIBRARIES - Path to the library
+# RDKAFKA_INCLUDE_DIR - Path to librdkafka headers
+
+find_path(RDKAFKA_INCLUDE_DIR librdkafka/rdkafka.h)
+find_library(RDKAFKA_LIBRARIES rdkafka)
+
+if (RDKAFKA_INCLUDE_DIR AND RDKAFKA_LIBRARIES)
+  message(STATUS "Found librdkafka libraries: ${RDKAFKA_LIBRARIES}")
+  set(RDKAFKA_FOUND TRUE)
+endif()
@@ -0,0 +1,14 @@
+# This CMake file locates the snappy compression library
+#
+# The following variables are set:
+# SNAPPY_FOUND - If the snappy library was found
+# SNAPPY_LIBRARIES - Path to the library
+# SNAPPY_INCLUDE_DIR - Path to snappy headers
+
+find_path(SNAPPY_INCLUDE_DIR snappy-c.h)
+find_library(SNAPPY_LIBRARIES snappy)
+
+if (SNAPPY_INCLUDE_DIR AND SNAPPY_LIBRARIES)
+  message(STATUS "Found snappy libraries: ${SNAPPY_LIBRARIES}")
+  set(SNAPPY_FOUND TRUE)
+endif()
@@ -63,5 +63,8 @@ set(PACKAGE_NAME "maxscale" CACHE STRING "Name of the generated package")
 # Which component to build (core, experimental, devel)
 set(TARGET_COMPONENT "core" CACHE STRING "Which component to build (core, experimental, devel, all)")
 
+# Add static tracepoints (USDT) for perf and bpftrace, requires sys/sdt.h
+set(WITH_USDT TRUE CACHE BOOL "Add static tracepoints (USDT)")
+
 # Enable AddressSanitizer: https://github.com/google/sanitizers/wiki/AddressSanitizer
 set(WITH_ASAN FALSE CACHE BOOL "Enable AddressSanitizer")
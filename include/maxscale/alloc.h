@@ -18,38 +18,51 @@
 
 MXS_BEGIN_DECLS
 
+/*
+ * The allocations are accounted to a tag, which is the module name of the
+ * source file that makes the allocation. It is defined with MXS_MODULE_NAME
+ * before any header is included, see log_manager.h. Files compiled into
+ * maxscale-common have no module name and their allocations are accounted
+ * to "core". A file can define MXS_ALLOC_TAG before including this header
+ * to use some other tag.
+ */
+#if !defined(MXS_MODULE_NAME)
+#define MXS_MODULE_NAME NULL
+#endif
+
+#if !defined(MXS_ALLOC_TAG)
+#define MXS_ALLOC_TAG MXS_MODULE_NAME
+#endif
+
 /*
  * NOTE: Do not use these functions directly, use the macros below.
  */
 
-// "caller" arg temporarily disabled so that existing code
-// using the previous version of mxs_alloc etc. will continue
-// to compile.
-void *mxs_malloc(size_t size/*, const char *caller*/);
-void *mxs_calloc(size_t nmemb, size_t size/*, const char *caller*/);
-void *mxs_realloc(void *ptr, size_t size/*, const char *caller*/);
-void mxs_free(void *ptr/*, const char *caller*/);
+void *mxs_malloc(size_t size, const char *tag);
+void *mxs_calloc(size_t nmemb, size_t size, const char *tag);
+void *mxs_realloc(void *ptr, size_t size, const char *tag);
+void mxs_free(void *ptr, const char *tag);
 
-char *mxs_strdup(const char *s/*, const char *caller*/);
-char *mxs_strndup(const char *s, size_t n/*, const char *caller*/);
+char *mxs_strdup(const char *s, const char *tag);
+char *mxs_strndup(const char *s, size_t n, const char *tag);
 
-char *mxs_strdup_a(const char *s/*, const char *caller*/);
-char *mxs_strndup_a(const char *s, size_t n/*, const char *caller*/);
+char *mxs_strdup_a(const char *s, const char *tag);
+char *mxs_strndup_a(const char *s, size_t n, const char *tag);
 
 
 /*
  * NOTE: USE these macros instead of the functions above.
  */
-#define MXS_MALLOC(size)         mxs_malloc(size/*, __func__*/)
-#define MXS_CALLOC(nmemb, size)  mxs_calloc(nmemb, size/*, __func__*/)
-#define MXS_REALLOC(ptr, size)   mxs_realloc(ptr, size/*, __func__*/)
-#define MXS_FREE(ptr)            mxs_free(ptr/*, __func__*/)
+#define MXS_MALLOC(size)         mxs_malloc(size, MXS_ALLOC_TAG)
+#define MXS_CALLOC(nmemb, size)  mxs_calloc(nmemb, size, MXS_ALLOC_TAG)
+#define MXS_REALLOC(ptr, size)   mxs_realloc(ptr, size, MXS_ALLOC_TAG)
+#define MXS_FREE(ptr)            mxs_free(ptr, MXS_ALLOC_TAG)
 
-#define MXS_STRDUP(s)            mxs_strdup(s/*, __func__*/)
-#define MXS_STRNDUP(s, n)        mxs_strndup(s, n/*, __func__*/)
+#define MXS_STRDUP(s)            mxs_strdup(s, MXS_ALLOC_TAG)
+#define MXS_STRNDUP(s, n)        mxs_strndup(s, n, MXS_ALLOC_TAG)
 
-#define MXS_STRDUP_A(s)          mxs_strdup_a(s/*, __func__*/)
-#define MXS_STRNDUP_A(s, n)      mxs_strndup_a(s, n/*, __func__*/)
+#define MXS_STRDUP_A(s)          mxs_strdup_a(s, MXS_ALLOC_TAG)
+#define MXS_STRNDUP_A(s, n)      mxs_strndup_a(s, n, MXS_ALLOC_TAG)
 
 
 /**
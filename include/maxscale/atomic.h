@@ -36,6 +36,41 @@ int      atomic_add(int *variable, int value);
 int64_t  atomic_add_int64(int64_t *variable, int64_t value);
 uint64_t atomic_add_uint64(uint64_t *variable, int64_t value);
 
+/**
+ * @brief Atomically replace a pointer
+ *
+ * @param variable Pointer to the variable to modify
+ * @param value    The new value
+ * @return         The value of variable before the exchange
+ */
+void* atomic_exchange_ptr(void **variable, void *value);
+
+/**
+ * @brief Atomic compare-and-swap of a pointer
+ *
+ * The new value is stored only if the variable contains @c *old_value. If the
+ * values differ, the current value of the variable is stored in @c old_value.
+ *
+ * @param variable  Pointer to the variable to modify
+ * @param old_value Pointer to the expected value
+ * @param new_value The value to store
+ * @return          True if the new value was stored
+ */
+bool atomic_cas_ptr(void **variable, void **old_value, void *new_value);
+
+/**
+ * @brief Atomic compare-and-swap of an integer
+ *
+ * The new value is stored only if the variable contains @c *old_value. If the
+ * values differ, the current value of the variable is stored in @c old_value.
+ *
+ * @param variable  Pointer to the variable to modify
+ * @param old_value Pointer to the expected value
+ * @param new_value The value to store
+ * @return          True if the new value was stored
+ */
+bool atomic_cas_int(int *variable, int *old_value, int new_value);
+
 /**
  * @brief Impose a full memory barrier
  *
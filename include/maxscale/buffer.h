@@ -85,7 +85,10 @@ typedef enum
  */
 typedef enum
 {
-    GWBUF_PARSING_INFO
+    GWBUF_PARSING_INFO,
+    GWBUF_SQL_COPY,     /*< Copy of the SQL of a statement that spans buffers */
+    GWBUF_QC_CACHE,     /*< Cached classification of the statement */
+    GWBUF_TRACE         /*< Trace of a sampled statement, see trace.h */
 } bufobj_id_t;
 
 typedef struct buffer_object_st buffer_object_t;
@@ -109,6 +112,8 @@ typedef struct
     int              refcount; /*< Reference count on the buffer */
     buffer_object_t *bufobj;   /*< List of objects referred to by GWBUF */
     gwbuf_info_t     info;     /*< Info bits */
+    int              size_class; /*< Allocation size class of the data */
+    BUF_PROPERTY    *properties; /*< Buffer properties, shared by all clones */
 } SHARED_BUF;
 
 /**
@@ -118,10 +123,16 @@ typedef struct
  * or written to a descriptor. The use of linked lists of buffers with
  * flexible data pointers is designed to minimise the need for data to
  * be copied within the gateway.
+ *
+ * A buffer is owned by the thread that allocated it and only the owner may
+ * modify it, its hints or its properties. No locks are taken. The data can
+ * be shared with clones owned by the same thread. A buffer that is handed to
+ * another thread must first be passed through gwbuf_transfer.
+ *
+ * The structure is kept within one cache line.
  */
 typedef struct gwbuf
 {
-    SPINLOCK        gwbuf_lock;
     struct gwbuf    *next;  /*< Next buffer in a linked chain of buffers */
     struct gwbuf    *tail;  /*< Last buffer in a linked chain of buffers */
     void            *start; /*< Start of the valid data */
@@ -129,7 +140,6 @@ typedef struct gwbuf
     SHARED_BUF      *sbuf;  /*< The shared buffer with the real data */
     gwbuf_type_t    gwbuf_type; /*< buffer's data type information */
     HINT            *hint;  /*< Hint data for this buffer */
-    BUF_PROPERTY    *properties; /*< Buffer properties */
     struct server   *server; /*< The target server where the buffer is executed */
 } GWBUF;
 
@@ -213,6 +223,20 @@ extern void gwbuf_free(GWBUF *buf);
  */
 extern GWBUF *gwbuf_clone(GWBUF *buf);
 
+/**
+ * @brief Prepare a buffer for use by another thread
+ *
+ * Buffers whose data is shared with clones are replaced with private
+ * copies so that the receiving thread becomes the only owner of all the
+ * data in the chain. Buffers that are not shared are kept as they are.
+ *
+ * @param buf Buffer chain to transfer, the caller must no longer use it
+ *
+ * @return Buffer chain owned only by the receiver, or NULL if memory
+ *         allocation failed in which case @c buf is freed
+ */
+extern GWBUF *gwbuf_transfer(GWBUF *buf);
+
 /**
  * Compare two GWBUFs. Two GWBUFs are considered identical if their
  * content is identical, irrespective of whether one is segmented and
@@ -321,6 +345,18 @@ extern size_t gwbuf_copy_data(const GWBUF *buffer, size_t offset, size_t bytes,
  */
 extern GWBUF *gwbuf_split(GWBUF **buf, size_t length);
 
+/**
+ * @brief Get buffer allocation statistics
+ *
+ * Buffers are allocated from per-thread caches of fixed size classes. Data
+ * areas larger than the largest size class are not cached and they are not
+ * included in the statistics.
+ *
+ * @param n_cached    Number of allocations satisfied from the caches
+ * @param n_allocated Number of allocations done with the system allocator
+ */
+extern void gwbuf_get_alloc_stats(int64_t *n_cached, int64_t *n_allocated);
+
 /**
  * Set given type to all buffers on the list.
  * *
@@ -330,7 +366,8 @@ extern GWBUF *gwbuf_split(GWBUF **buf, size_t length);
 extern void gwbuf_set_type(GWBUF *head, gwbuf_type_t type);
 
 /**
- * Add a property to a buffer.
+ * Add a property to a buffer. The properties are shared by all clones
+ * of the buffer.
  *
  * @param buf    The buffer to add the property to
  * @param name   The property name
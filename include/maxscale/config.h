@@ -59,6 +59,11 @@ typedef struct
 {
     bool          config_check;                        /**< Only check config */
     int           n_threads;                           /**< Number of polling threads */
+    int           n_threads_max;                       /**< Maximum number of active polling threads,
+                                                        *   0 for n_threads */
+    int           n_threads_initial;                   /**< Number of active polling threads at startup */
+    bool          threads_auto;                        /**< Adjust the number of active polling threads
+                                                        *   to the load */
     char          *version_string;                     /**< The version string of embedded db library */
     char          release_string[_RELEASE_STR_LENGTH]; /**< The release name string of the system */
     char          sysname[_UTSNAME_SYSNAME_LENGTH];    /**< The OS name of the system */
@@ -75,12 +80,42 @@ typedef struct
     bool          skip_permission_checks;              /**< Skip service and monitor permission checks */
     char          qc_name[PATH_MAX];                   /**< The name of the query classifier to load */
     char*         qc_args;                             /**< Arguments for the query classifier */
+    int           qc_cache_size;                       /**< Classifications cached per thread */
+    int           qc_large_statement_size;             /**< Size above which a statement is classified by
+                                                        *   its first keyword */
     int           query_retries;                       /**< Number of times a interrupted query is retried */
     time_t        query_retry_timeout;                 /**< Timeout for query retries */
     char*         local_address;                       /**< Local address to use when connecting */
     time_t        users_refresh_time;                  /**< How often the users can be refreshed */
+    bool          reuseport;                           /**< Use one SO_REUSEPORT listener socket per thread */
+    bool          least_loaded_placement;              /**< Place new sessions on the least loaded thread */
+    int           thread_migration_threshold;          /**< Load imbalance in percents that moves sessions */
+    int           slow_event_threshold;                /**< Event duration in milliseconds that is slow */
+    int           *thread_cpus;                        /**< CPUs the polling threads are bound to or NULL */
+    int           n_thread_cpus;                       /**< Number of CPUs in thread_cpus */
+    int           query_trace_interval;                /**< Trace one in this many statements, 0 for none */
+    int           slow_query_time;                     /**< Statements slower than this, in milliseconds, are
+                                                        *   logged, 0 for none */
+    int           slow_query_log_rate;                 /**< Maximum slow statements logged per second */
+    bool          memory_accounting;                   /**< Account allocations to their modules */
+    int           writeq_high_water;                   /**< Client write queue size that stops reading the
+                                                        *   backends, 0 for no limit */
+    int           writeq_low_water;                    /**< Client write queue size that resumes reading */
+    bool          poll_io_uring;                       /**< Poll the descriptors with io_uring instead of
+                                                        *   epoll */
+    char*         hot_restart_socket;                  /**< Unix socket the listeners are handed over on */
+    int           hot_restart_drain_timeout;           /**< Seconds the sessions are drained after a hot
+                                                        *   restart, 0 for no limit */
 } MXS_CONFIG;
 
+/**
+ * @brief Get the CPU a polling thread is bound to
+ *
+ * @param thread_id The polling thread
+ * @return The CPU or -1 if the threads are not bound to CPUs
+ */
+int config_thread_cpu(int thread_id);
+
 /**
  * @brief Get global MaxScale configuration
  *
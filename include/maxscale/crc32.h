@@ -0,0 +1,48 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file crc32.h CRC32 checksums of the binlog events and the Avro blocks
+ */
+
+#include <maxscale/cdefs.h>
+#include <stddef.h>
+#include <stdint.h>
+
+MXS_BEGIN_DECLS
+
+/**
+ * @brief Calculate the CRC32 checksum of a buffer
+ *
+ * The checksum is the same as the one calculated by the crc32() function of
+ * zlib and the calls can be chained the same way: the first call is given
+ * zero as the initial checksum. The checksum is calculated with the carry-less
+ * multiplication instructions on x86-64 and with the CRC32 instructions on
+ * ARMv8 if the processor supports them.
+ *
+ * @param crc The checksum of the preceding data or zero
+ * @param buf The data
+ * @param len Length of the data
+ * @return The checksum
+ */
+uint32_t mxs_crc32(uint32_t crc, const uint8_t *buf, size_t len);
+
+/**
+ * @brief Get the name of the CRC32 implementation in use
+ *
+ * @return "pclmul", "armv8" or "zlib"
+ */
+const char* mxs_crc32_implementation(void);
+
+MXS_END_DECLS
@@ -76,34 +76,23 @@ typedef struct dcbstats
     int     n_buffered;     /*< Number of buffered writes */
     int     n_high_water;   /*< Number of crosses of high water mark */
     int     n_low_water;    /*< Number of crosses of low water mark */
+    int64_t n_spliced;      /*< Number of bytes forwarded with splice() */
+    int     n_corked;       /*< Number of times partial frames were held back */
 } DCBSTATS;
 
 #define DCBSTATS_INIT {0}
 
 /**
- * The data structure that is embedded witin a DCB and manages the complex memory
- * management issues of a DCB.
- *
- * The DCB structures are used as the user data within the polling loop. This means that
- * polling threads may aschronously wake up and access these structures. It is not possible
- * to simple remove the DCB from the epoll system and then free the data, as every thread
- * that is currently running an epoll call must wake up and re-issue the epoll_wait system
- * call, the is the only way we can be sure that no polling thread is pending a wakeup or
- * processing an event that will access the DCB.
- *
- * We solve this issue by making the dcb_free routine merely mark a DCB as a zombie and
- * place it on a special zombie list. Before placing the DCB on the zombie list we create
- * a bitmask with a bit set in it for each active polling thread. Each thread will call
- * a routine to process the zombie list at the end of the polling loop. This routine
- * will clear the bit value that corresponds to the calling thread. Once the bitmask
- * is completely cleared the DCB can finally be freed and removed from the zombie list.
+ * The state of the forwarding of the data of a DCB to another DCB with splice()
  */
-typedef struct
+typedef struct dcb_splice
 {
-    struct dcb      *next;          /*< Next pointer for the zombie list */
-} DCBMM;
-
-#define DCBMM_INIT { NULL }
+    int         pipe[2];    /*< The pipe the data is moved through, -1 if not open */
+    size_t      pending;    /*< Bytes in the pipe that are not yet written */
+    bool        blocked;    /*< Reading stopped because the destination was full */
+    bool        failed;     /*< splice() is not supported for the descriptors */
+    struct dcb  *dest;      /*< The DCB the data is written to */
+} DCB_SPLICE;
 
 /* DCB states */
 typedef enum
@@ -179,72 +168,88 @@ typedef enum
  * It is important to hold the state information here such that any thread within the
  * gateway may be selected to execute the required actions when a network event occurs.
  *
- * Note that the first few fields (up to and including "entry_is_ready") must
- * precisely match the LIST_ENTRY structure defined in the list manager.
+ * The fields that are used when the events of the DCB are processed come first
+ * so that they share as few cache lines as possible. The fields that are only
+ * used when the DCB is created, closed or pooled, or by the diagnostics, follow
+ * them. The state of the forwarding with splice() is allocated on first use.
  */
 typedef struct dcb
 {
     skygw_chk_t     dcb_chk_top;
+    int             fd;             /**< The descriptor */
+    dcb_state_t     state;          /**< Current descriptor state */
+    dcb_role_t      dcb_role;
+    int             flags;          /**< DCB flags */
     bool            dcb_errhandle_called; /*< this can be called only once */
     bool            dcb_is_zombie;  /**< Whether the DCB is in the zombie list */
     bool            draining_flag;  /**< Set while write queue is drained */
     bool            drain_called_while_busy; /**< Set as described */
-    dcb_role_t      dcb_role;
-    DCBEVENTQ       evq;            /**< The event queue for this DCB */
-    int             fd;             /**< The descriptor */
-    dcb_state_t     state;          /**< Current descriptor state */
+    bool            write_batched;  /**< Set while the DCB is in the thread's write batch */
+    bool            corked;         /**< Whether partial frames are held back with TCP_CORK */
+    bool            throttled;       /**< Whether the DCB is not polled for incoming data */
+    bool            was_persistent;  /**< Whether this DCB was in the persistent pool */
     SSL_STATE       ssl_state;      /**< Current state of SSL if in use */
-    int             flags;          /**< DCB flags */
-    char            *remote;        /**< Address of remote end */
-    char            *user;          /**< User name for connection */
-    struct sockaddr_storage ip;     /**< remote IPv4/IPv6 address */
-    char            *protoname;     /**< Name of the protocol */
     void            *protocol;      /**< The protocol specific state */
-    size_t           protocol_packet_length; /**< How long the protocol specific packet is */
-    size_t           protocol_bytes_processed; /**< How many bytes of a packet have been read */
     struct session  *session;       /**< The owning session */
-    struct servlistener *listener;  /**< For a client DCB, the listener data */
-    MXS_PROTOCOL    func;           /**< The protocol functions for this descriptor */
-    MXS_AUTHENTICATOR authfunc;     /**< The authenticator functions for this descriptor */
-    int             writeqlen;      /**< Current number of byes in the write queue */
     GWBUF           *writeq;        /**< Write Data Queue */
-    GWBUF           *delayq;        /**< Delay Backend Write Data Queue */
     GWBUF           *dcb_readqueue; /**< read queue for storing incomplete reads */
-    GWBUF           *dcb_fakequeue; /**< Fake event queue for generated events */
-
-    DCBSTATS        stats;          /**< DCB related statistics */
-    struct dcb      *nextpersistent;   /**< Next DCB in the persistent pool for SERVER */
-    time_t          persistentstart;   /**< Time when DCB placed in persistent pool */
-    struct service  *service;       /**< The related service */
-    void            *data;          /**< Specific client data, shared between DCBs of this session */
-    void            *authenticator_data; /**< The authenticator data for this DCB */
-    DCBMM           memdata;        /**< The data related to DCB memory management */
-    DCB_CALLBACK    *callbacks;     /**< The list of callbacks for the DCB */
-    long            last_read;      /*< Last time the DCB received data */
+    int             writeqlen;      /**< Current number of byes in the write queue */
     int             high_water;     /**< High water mark */
     int             low_water;      /**< Low water mark */
-    struct server   *server;        /**< The associated backend server */
+    long            last_read;      /*< Last time the DCB received data */
     SSL*            ssl;            /*< SSL struct for connection */
-    bool            ssl_read_want_read;    /*< Flag */
-    bool            ssl_read_want_write;    /*< Flag */
-    bool            ssl_write_want_read;    /*< Flag */
-    bool            ssl_write_want_write;    /*< Flag */
-    bool            was_persistent;  /**< Whether this DCB was in the persistent pool */
     struct
     {
         int id; /**< The owning thread's ID */
         struct dcb *next; /**< Next DCB in owning thread's list */
         struct dcb *tail; /**< Last DCB in owning thread's list */
     } thread;
+    struct
+    {
+        long        deadline; /**< Heartbeat when the timer expires, 0 if not set */
+        int         slot;     /**< The timer wheel slot of the DCB */
+        struct dcb *next;     /**< Next DCB in the same timer wheel slot */
+        struct dcb *prev;     /**< Previous DCB in the same timer wheel slot */
+    } timer;
+    DCBEVENTQ       evq;            /**< The event queue for this DCB */
+    MXS_PROTOCOL    func;           /**< The protocol functions for this descriptor */
+    DCBSTATS        stats;          /**< DCB related statistics */
+    GWBUF           *delayq;        /**< Delay Backend Write Data Queue */
+    GWBUF           *dcb_fakequeue; /**< Fake event queue for generated events */
+    size_t           protocol_packet_length; /**< How long the protocol specific packet is */
+    size_t           protocol_bytes_processed; /**< How many bytes of a packet have been read */
+    bool            ssl_read_want_read;    /*< Flag */
+    bool            ssl_read_want_write;    /*< Flag */
+    bool            ssl_write_want_read;    /*< Flag */
+    bool            ssl_write_want_write;    /*< Flag */
+    bool            ssl_ktls_send;  /*< The kernel encrypts the written data */
+    DCB_SPLICE      *splice;        /**< Forwarding of the data with splice(), NULL until used */
+    struct dcb      *splice_src;    /**< The DCB whose data is forwarded to this DCB */
+
+    /** The fields below are rarely used */
+    void            *data;          /**< Specific client data, shared between DCBs of this session */
+    void            *authenticator_data; /**< The authenticator data for this DCB */
+    struct server   *server;        /**< The associated backend server */
+    struct service  *service;       /**< The related service */
+    struct servlistener *listener;  /**< For a client DCB, the listener data */
+    int             *thread_fds;    /**< Per-thread SO_REUSEPORT listener sockets or NULL */
+    char            *remote;        /**< Address of remote end */
+    char            *user;          /**< User name for connection */
+    char            *protoname;     /**< Name of the protocol */
+    DCB_CALLBACK    *callbacks;     /**< The list of callbacks for the DCB */
+    struct dcb      *nextpersistent;   /**< Next DCB in the persistent pool for SERVER */
+    time_t          persistentstart;   /**< Time when DCB placed in persistent pool */
+    MXS_AUTHENTICATOR authfunc;     /**< The authenticator functions for this descriptor */
+    struct sockaddr_storage ip;     /**< remote IPv4/IPv6 address */
     skygw_chk_t     dcb_chk_tail;
 } DCB;
 
 #define DCB_INIT {.dcb_chk_top = CHK_NUM_DCB, \
     .evq = DCBEVENTQ_INIT, .ip = {0}, .func = {0}, .authfunc = {0}, \
-    .stats = {0}, .memdata = DCBMM_INIT, \
+    .stats = {0}, \
     .fd = DCBFD_CLOSED, .stats = DCBSTATS_INIT, .ssl_state = SSL_HANDSHAKE_UNKNOWN, \
     .state = DCB_STATE_ALLOC, .dcb_chk_tail = CHK_NUM_DCB, \
-    .authenticator_data = NULL, .thread = {0}}
+    .authenticator_data = NULL, .thread = {0}, .timer = {0}, .splice = NULL}
 
 /**
  * The DCB usage filer used for returning DCB's in use for a certain reason
@@ -265,7 +270,7 @@ typedef enum
 #define DCB_ISZOMBIE(x)                 ((x)->state == DCB_STATE_ZOMBIE)
 #define DCB_WRITEQLEN(x)                (x)->writeqlen
 #define DCB_SET_LOW_WATER(x, lo)        (x)->low_water = (lo);
-#define DCB_SET_HIGH_WATER(x, hi)       (x)->low_water = (hi);
+#define DCB_SET_HIGH_WATER(x, hi)       (x)->high_water = (hi);
 #define DCB_BELOW_LOW_WATER(x)          ((x)->low_water && (x)->writeqlen < (x)->low_water)
 #define DCB_ABOVE_HIGH_WATER(x)         ((x)->high_water && (x)->writeqlen > (x)->high_water)
 
@@ -287,17 +292,64 @@ DCB *dcb_connect(struct server *, struct session *, const char *);
 DCB *dcb_clone(DCB *);
 int dcb_read(DCB *, GWBUF **, int);
 int dcb_drain_writeq(DCB *);
-void dcb_close(DCB *);
 
 /**
- * @brief Process zombie DCBs
+ * @brief Check whether the data of a DCB can be forwarded with dcb_splice
+ *
+ * @param dcb  The DCB to read from
+ * @param dest The DCB to write to
+ * @return True if neither DCB uses SSL and splice() has not failed for them
+ */
+bool dcb_can_splice(const DCB *dcb, const DCB *dest);
+
+/**
+ * @brief Forward the available data of a DCB to another DCB with splice()
+ *
+ * The data is moved from one socket to the other through a pipe without
+ * copying it to user space. Data written to @c dest with dcb_write is
+ * never reordered with the forwarded data. When @c dest cannot take more
+ * data, the reading stops and is resumed with a fake read event on @c dcb
+ * once @c dest has been drained.
+ *
+ * @param dcb  The DCB to read from
+ * @param dest The DCB to write to
+ * @return Number of bytes read or -1 on a read error
+ */
+int dcb_splice(DCB *dcb, DCB *dest);
+
+/**
+ * @brief Start batching writes on the current thread
  *
- * This should only be called from a polling thread in poll.c when no events
- * are being processed.
+ * Until the matching dcb_write_batch_end call, dcb_write only appends the data
+ * to the write queue of a DCB that is being polled. This allows several
+ * packets that are routed one by one to be sent to the network with one
+ * write. Batches can be nested.
+ */
+void dcb_write_batch_begin();
+
+/**
+ * @brief End batching writes on the current thread
  *
- * @param threadid Thread ID of the poll thread
+ * When the outermost batch ends, the write queues of all DCBs that were written
+ * to during the batch are drained.
  */
-void dcb_process_zombies(int threadid);
+void dcb_write_batch_end();
+
+/**
+ * @brief Hold back the partial frames written to a DCB
+ *
+ * While a DCB is corked, the kernel only sends full frames and the rest of the
+ * data is sent when the DCB is uncorked or at the latest after 200 milliseconds.
+ * A router that knows that more of a reply is coming corks the client
+ * DCB so that a reply that is read from the backend in small pieces reaches
+ * the client in full frames. Only TCP sockets can be corked.
+ *
+ * @param dcb  The DCB
+ * @param cork True to hold back partial frames, false to send them immediately
+ */
+void dcb_set_cork(DCB *dcb, bool cork);
+void dcb_close(DCB *);
+
 
 /**
  * Add a DCB to the owner's list
@@ -324,14 +376,49 @@ int dcb_count_by_usage(DCB_USAGE);          /* Return counts of DCBs */
 int dcb_persistent_clean_count(DCB *, int, bool);      /* Clean persistent and return count */
 void dcb_hangup_foreach (struct server* server);
 size_t dcb_get_session_id(DCB* dcb);
+
+/**
+ * @brief Get the memory used by a DCB
+ *
+ * @param dcb The DCB
+ * @return The size of the DCB, its side allocations, strings and queued data
+ *         in bytes. The protocol state is not included.
+ */
+size_t dcb_memory_usage(const DCB *dcb);
 char *dcb_role_name(DCB *);                  /* Return the name of a role */
 int dcb_accept_SSL(DCB* dcb);
 int dcb_connect_SSL(DCB* dcb);
 int dcb_listen(DCB *listener, const char *config, const char *protocol_name);
+
+/**
+ * @brief Stop listening on the per-thread sockets of a listener
+ *
+ * The connections that the kernel has queued on them are refused and the new
+ * ones go to the other SO_REUSEPORT sockets of the address. The shared socket
+ * @c listener->fd is not touched. The descriptors stay open until the
+ * listener is closed.
+ *
+ * @param listener Listener DCB
+ */
+void dcb_listen_shutdown_thread_sockets(DCB *listener);
 void dcb_append_readqueue(DCB *dcb, GWBUF *buffer);
-void dcb_enable_session_timeouts();
 void dcb_process_idle_sessions(int thr);
 
+/**
+ * @brief Move idle sessions to another thread
+ *
+ * A session is idle when none of its DCBs have pending data and the client
+ * has not sent anything for at least a second. All DCBs of an idle session
+ * are moved to the target thread. This must only be called by the thread
+ * @c thr from its polling loop.
+ *
+ * @param thr    The calling thread that owns the sessions
+ * @param target The thread where the sessions are moved
+ * @param max    Maximum number of sessions to move
+ * @return Number of sessions that were moved
+ */
+int dcb_migrate_idle_sessions(int thr, int target, int max);
+
 /**
  * @brief Call a function for each connected DCB
  *
@@ -365,6 +452,8 @@ DCB* dcb_get_current();
 #define DCBF_CLONE              0x0001  /*< DCB is a clone */
 #define DCBF_HUNG               0x0002  /*< Hangup has been dispatched */
 #define DCBF_REPLIED    0x0004  /*< DCB was written to */
+#define DCBF_REUSABLE           0x0008  /*< DCB can be pooled while its session is open */
+#define DCBF_PREWARM            0x0010  /*< DCB is pooled once it has authenticated */
 
 #define DCB_IS_CLONE(d) ((d)->flags & DCBF_CLONE)
 #define DCB_REPLIED(d) ((d)->flags & DCBF_REPLIED)
@@ -192,6 +192,31 @@ typedef struct mxs_filter_object
      */
     void     (*destroyInstance)(MXS_FILTER *instance);
 
+    /**
+     * @brief Create the data of a filter instance for a polling thread
+     *
+     * This optional function is called once for each polling thread after the
+     * instance has been created. The returned data is only accessed by the
+     * thread in question and can be looked up with
+     * filter_def_get_thread_instance() without any locking.
+     *
+     * @param instance  Filter instance
+     * @param thread_id ID of the polling thread
+     *
+     * @return The data of the thread or NULL on error
+     */
+    void    *(*createThreadInstance)(MXS_FILTER *instance, int thread_id);
+
+    /**
+     * @brief Destroy the data of a filter instance for a polling thread
+     *
+     * Called before destroyInstance for the data returned by createThreadInstance.
+     *
+     * @param instance        Filter instance
+     * @param thread_instance The data of the thread
+     */
+    void     (*destroyThreadInstance)(MXS_FILTER *instance, void *thread_instance);
+
 } MXS_FILTER_OBJECT;
 
 /**
@@ -199,7 +224,7 @@ typedef struct mxs_filter_object
  * is changed these values must be updated in line with the rules in the
  * file modinfo.h.
  */
-#define MXS_FILTER_VERSION  {2, 2, 0}
+#define MXS_FILTER_VERSION  {2, 4, 0}
 
 /**
  * MXS_FILTER_DEF represents a filter definition from the configuration file.
@@ -244,6 +269,30 @@ const char* filter_def_get_module_name(const MXS_FILTER_DEF* filter_def);
  */
 MXS_FILTER* filter_def_get_instance(const MXS_FILTER_DEF* filter_def);
 
+/**
+ * Get the data of the filter instance for the calling thread.
+ *
+ * @param filter_def  A filter definition.
+ *
+ * @return The data created by the createThreadInstance entry point of the
+ *         filter for the calling polling thread, NULL if the filter does not
+ *         have the entry point or if the caller is not a polling thread.
+ */
+void* filter_def_get_thread_instance(const MXS_FILTER_DEF* filter_def);
+
+/**
+ * Get the data of the filter instance for a particular thread.
+ *
+ * The data of the thread must not be modified by other threads. This is
+ * intended for aggregating the data in the diagnostics.
+ *
+ * @param filter_def  A filter definition.
+ * @param thread_id   ID of the polling thread, less than config_threadcount().
+ *
+ * @return The data of the thread or NULL if the filter does not have any.
+ */
+void* filter_def_get_thread_instance_of(const MXS_FILTER_DEF* filter_def, int thread_id);
+
 void dprintAllFilters(DCB *);
 void dprintFilter(DCB *, const MXS_FILTER_DEF *);
 void dListFilters(DCB *);
@@ -258,10 +307,20 @@ void dListFilters(DCB *);
  *       and 0x800000000000, that is, bits 32 to 47.
  */
 
-/*
 typedef enum filter_capability
 {
+    FCAP_TYPE_NO_REPLIES       = 0x000100000000, /**< The filter does not process replies */
+    FCAP_TYPE_COM_QUERY        = 0x000200000001, /**< The filter processes COM_QUERY, implies RCAP_TYPE_STMT_INPUT */
+    FCAP_TYPE_COM_STMT_PREPARE = 0x000400000001, /**< The filter processes COM_STMT_PREPARE, implies RCAP_TYPE_STMT_INPUT */
+    FCAP_TYPE_COM_STMT_EXECUTE = 0x000800000001, /**< The filter processes COM_STMT_EXECUTE, implies RCAP_TYPE_STMT_INPUT */
+    FCAP_TYPE_COM_INIT_DB      = 0x001000000001, /**< The filter processes COM_INIT_DB, implies RCAP_TYPE_STMT_INPUT */
 } filter_capability_t;
-*/
+
+/**
+ * The command capabilities. If a filter declares none of them, all packets
+ * are routed through it. Otherwise only the packets of the declared commands
+ * are, and the rest are passed directly to the next element of the chain.
+ */
+#define FCAP_TYPE_COMMANDS 0x001e00000000
 
 MXS_END_DECLS
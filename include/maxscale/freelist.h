@@ -0,0 +1,97 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file freelist.h  Per-thread free lists for fixed size objects
+ *
+ * A free list keeps objects that were released by a polling thread so that
+ * the next allocation of the same thread can reuse them without going through
+ * the system allocator. Each polling thread has its own list which means no
+ * locking is needed. Threads that are not polling threads always use the
+ * system allocator.
+ *
+ * An object can be released by a different thread than the one that
+ * allocated it.
+ */
+
+#include <maxscale/cdefs.h>
+
+MXS_BEGIN_DECLS
+
+/** Default number of objects each thread keeps for reuse */
+#define MXS_FREELIST_DEFAULT_MAX 256
+
+typedef struct mxs_freelist MXS_FREELIST;
+
+/**
+ * @brief Create a new free list
+ *
+ * The free list must be created after the configuration has been read as the
+ * number of threads is needed.
+ *
+ * @param size Size of the objects in bytes
+ * @param max  Maximum number of free objects each thread keeps
+ *
+ * @return New free list or NULL on memory allocation failure
+ */
+MXS_FREELIST* mxs_freelist_create(size_t size, int max);
+
+/**
+ * @brief Destroy a free list
+ *
+ * All objects in the list are freed. The objects that are still in use must
+ * be freed with MXS_FREE.
+ *
+ * @param list List to destroy
+ */
+void mxs_freelist_destroy(MXS_FREELIST *list);
+
+/**
+ * @brief Allocate an object
+ *
+ * The contents of the returned memory are undefined.
+ *
+ * @param list Free list to allocate from
+ *
+ * @return An object or NULL on memory allocation failure
+ */
+void* mxs_freelist_alloc(MXS_FREELIST *list);
+
+/**
+ * @brief Release an object
+ *
+ * @param list Free list where the object is stored
+ * @param ptr  Object to release, may be NULL
+ */
+void mxs_freelist_free(MXS_FREELIST *list, void *ptr);
+
+/**
+ * @brief Get the number of allocations that reused a free object
+ *
+ * @param list Free list to inspect
+ *
+ * @return Number of allocations served from the free lists
+ */
+int64_t mxs_freelist_reused(const MXS_FREELIST *list);
+
+/**
+ * @brief Get the number of allocations done with the system allocator
+ *
+ * @param list Free list to inspect
+ *
+ * @return Number of allocations that had to use the system allocator
+ */
+int64_t mxs_freelist_allocated(const MXS_FREELIST *list);
+
+MXS_END_DECLS
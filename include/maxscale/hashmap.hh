@@ -0,0 +1,405 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <maxscale/cppdefs.hh>
+#include <stdint.h>
+#include <maxscale/spinlock.hh>
+
+namespace maxscale
+{
+
+/**
+ * @class HashMap hashmap.hh <maxscale/hashmap.hh>
+ *
+ * The class HashMap is an open addressing hash map that is optimized for
+ * tables that are read far more often than they are modified.
+ *
+ * The hash and equality functors are template parameters so that they are
+ * inlined into the probe loop. Modifications are serialized with a spinlock
+ * and announced with a sequence counter. Lookups take no locks at all, they
+ * copy the entry they find and retry if a modification happened meanwhile.
+ * When the map grows, the old slot array is kept until the map is destroyed
+ * so that a concurrent lookup never touches freed memory.
+ *
+ * As lookups can observe a slot that is being modified, both @c Key and
+ * @c Value must be plain data that can be copied at any time and @c Equal
+ * must not follow pointers in the key. For instance, a key consisting of
+ * a pointer to a static string and an integer is fine, as long as the
+ * pointers themselves are compared.
+ *
+ * @code{.cpp}
+ *
+ *   struct Hash
+ *   {
+ *       size_t operator()(int key) const { return key; }
+ *   };
+ *
+ *   struct Equal
+ *   {
+ *       bool operator()(int lhs, int rhs) const { return lhs == rhs; }
+ *   };
+ *
+ *   HashMap<int, SERVER*, Hash, Equal> servers;
+ * @endcode
+ */
+template<class Key, class Value, class Hash, class Equal>
+class HashMap
+{
+public:
+    /**
+     * Creates a hash map.
+     *
+     * @param capacity  The expected number of entries.
+     *
+     * @throws std::bad_alloc
+     */
+    HashMap(size_t capacity = 16)
+        : m_table(NULL)
+        , m_retired(NULL)
+        , m_size(0)
+        , m_used(0)
+        , m_seq(0)
+    {
+        size_t n = MIN_CAPACITY;
+
+        while (n < capacity * 2)
+        {
+            n *= 2;
+        }
+
+        m_table = create_table(n);
+    }
+
+    ~HashMap()
+    {
+        destroy_table(m_table);
+
+        while (m_retired)
+        {
+            Table* next = m_retired->next;
+            destroy_table(m_retired);
+            m_retired = next;
+        }
+    }
+
+    /**
+     * Finds an entry. This does not take any locks and is safe to call while
+     * other threads modify the map.
+     *
+     * @param key    The key to look for.
+     * @param value  If not NULL, the value of the entry is copied here.
+     *
+     * @return True if the key was found.
+     */
+    bool find(const Key& key, Value* value) const
+    {
+        uint64_t hash = hash_of(key);
+
+        while (true)
+        {
+            uint32_t seq = __atomic_load_n(&m_seq, __ATOMIC_ACQUIRE);
+
+            if (seq & 1)
+            {
+                // A modification is in progress.
+                continue;
+            }
+
+            const Table* table = __atomic_load_n(&m_table, __ATOMIC_ACQUIRE);
+            const Slot* slot = find_slot(table, key, hash);
+            Value found = Value();
+
+            if (slot)
+            {
+                found = slot->value;
+            }
+
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+            if (__atomic_load_n(&m_seq, __ATOMIC_RELAXED) == seq)
+            {
+                if (slot && value)
+                {
+                    *value = found;
+                }
+
+                return slot != NULL;
+            }
+        }
+    }
+
+    /**
+     * Adds an entry if the key is not in the map.
+     *
+     * @param key    The key of the entry.
+     * @param value  The value of the entry.
+     *
+     * @return True if the entry was added, false if the key already existed.
+     *
+     * @throws std::bad_alloc
+     */
+    bool insert(const Key& key, const Value& value)
+    {
+        uint64_t hash = hash_of(key);
+        SpinLockGuard guard(m_lock);
+
+        if (find_slot(m_table, key, hash))
+        {
+            return false;
+        }
+
+        if ((m_used + 1) * 4 > (m_table->mask + 1) * 3)
+        {
+            rebuild();
+        }
+
+        size_t i = hash & m_table->mask;
+
+        while (m_table->slots[i].hash > DELETED)
+        {
+            i = (i + 1) & m_table->mask;
+        }
+
+        Slot* slot = &m_table->slots[i];
+
+        if (slot->hash == EMPTY)
+        {
+            ++m_used;
+        }
+
+        write_begin();
+        slot->key = key;
+        slot->value = value;
+        slot->hash = hash;
+        write_end();
+
+        __atomic_add_fetch(&m_size, 1, __ATOMIC_RELAXED);
+        return true;
+    }
+
+    /**
+     * Removes an entry.
+     *
+     * @param key  The key of the entry.
+     *
+     * @return True if the entry was removed, false if it was not found.
+     */
+    bool erase(const Key& key)
+    {
+        uint64_t hash = hash_of(key);
+        SpinLockGuard guard(m_lock);
+        Slot* slot = const_cast<Slot*>(find_slot(m_table, key, hash));
+
+        if (!slot)
+        {
+            return false;
+        }
+
+        size_t next = (slot - m_table->slots + 1) & m_table->mask;
+
+        write_begin();
+
+        if (m_table->slots[next].hash == EMPTY)
+        {
+            // The slot does not continue a probe sequence.
+            slot->hash = EMPTY;
+            --m_used;
+        }
+        else
+        {
+            slot->hash = DELETED;
+        }
+
+        write_end();
+
+        __atomic_sub_fetch(&m_size, 1, __ATOMIC_RELAXED);
+        return true;
+    }
+
+    /**
+     * Calls a function for each entry. The map is locked for modifications
+     * during the call.
+     *
+     * @param func  A functor called as func(const Key&, Value&).
+     */
+    template<class Function>
+    void for_each(Function& func)
+    {
+        SpinLockGuard guard(m_lock);
+
+        for (size_t i = 0; i <= m_table->mask; i++)
+        {
+            Slot& slot = m_table->slots[i];
+
+            if (slot.hash > DELETED)
+            {
+                func(slot.key, slot.value);
+            }
+        }
+    }
+
+    /**
+     * @return The number of entries.
+     */
+    size_t size() const
+    {
+        return __atomic_load_n(&m_size, __ATOMIC_RELAXED);
+    }
+
+private:
+    HashMap(const HashMap&) /* = delete */;
+    HashMap& operator = (const HashMap&) /* = delete */;
+
+    enum
+    {
+        EMPTY = 0,       /**< The hash of an empty slot */
+        DELETED = 1,     /**< The hash of a slot whose entry has been removed */
+        MIN_CAPACITY = 8
+    };
+
+    struct Slot
+    {
+        uint64_t hash;
+        Key      key;
+        Value    value;
+    };
+
+    struct Table
+    {
+        size_t mask;
+        Slot*  slots;
+        Table* next;
+    };
+
+    static Table* create_table(size_t capacity)
+    {
+        Table* table = new Table;
+
+        try
+        {
+            table->slots = new Slot[capacity]();
+        }
+        catch (const std::bad_alloc&)
+        {
+            delete table;
+            throw;
+        }
+
+        table->mask = capacity - 1;
+        table->next = NULL;
+        return table;
+    }
+
+    static void destroy_table(Table* table)
+    {
+        delete [] table->slots;
+        delete table;
+    }
+
+    static uint64_t hash_of(const Key& key)
+    {
+        uint64_t hash = Hash()(key);
+
+        // Mix the bits so that weak hashes are spread over the whole table.
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 33;
+
+        return hash > DELETED ? hash : hash + DELETED + 1;
+    }
+
+    static const Slot* find_slot(const Table* table, const Key& key, uint64_t hash)
+    {
+        size_t i = hash & table->mask;
+
+        for (size_t n = 0; n <= table->mask; n++, i = (i + 1) & table->mask)
+        {
+            const Slot* slot = &table->slots[i];
+            uint64_t slot_hash = slot->hash;
+
+            if (slot_hash == EMPTY)
+            {
+                break;
+            }
+
+            if (slot_hash == hash && Equal()(slot->key, key))
+            {
+                return slot;
+            }
+        }
+
+        return NULL;
+    }
+
+    /**
+     * Moves the entries into a new slot array, dropping the removed entries.
+     * The old array is retired and freed when the map is destroyed.
+     */
+    void rebuild()
+    {
+        size_t capacity = m_table->mask + 1;
+
+        while ((m_size + 1) * 2 > capacity)
+        {
+            capacity *= 2;
+        }
+
+        Table* table = create_table(capacity);
+
+        for (size_t i = 0; i <= m_table->mask; i++)
+        {
+            const Slot& slot = m_table->slots[i];
+
+            if (slot.hash > DELETED)
+            {
+                size_t j = slot.hash & table->mask;
+
+                while (table->slots[j].hash != EMPTY)
+                {
+                    j = (j + 1) & table->mask;
+                }
+
+                table->slots[j] = slot;
+            }
+        }
+
+        m_used = m_size;
+
+        write_begin();
+        m_table->next = m_retired;
+        m_retired = m_table;
+        __atomic_store_n(&m_table, table, __ATOMIC_RELEASE);
+        write_end();
+    }
+
+    void write_begin()
+    {
+        __atomic_store_n(&m_seq, m_seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+
+    void write_end()
+    {
+        __atomic_store_n(&m_seq, m_seq + 1, __ATOMIC_RELEASE);
+    }
+
+    Table*   m_table;   /**< The current slot array */
+    Table*   m_retired; /**< Slot arrays replaced by a rebuild */
+    size_t   m_size;    /**< Number of entries */
+    size_t   m_used;    /**< Number of slots that are not empty */
+    uint32_t m_seq;     /**< Odd while a modification is in progress */
+    SpinLock m_lock;    /**< Serializes modifications */
+};
+
+}
@@ -23,16 +23,17 @@
 MXS_BEGIN_DECLS
 
 /**
- * The entries within a hashtable.
+ * The slots of a hashtable.
  *
- * A NULL value for key indicates an empty entry.
- * The next pointer is the overflow chain for this hashentry.
+ * The entries are stored directly in an open addressing array. A NULL key
+ * indicates an empty slot, a deleted entry leaves a marker key in its slot
+ * until the table is rebuilt.
  */
 typedef struct hashentry
 {
-    void *key;              /**< The value of the key or NULL if empty entry */
+    void *key;              /**< The value of the key, NULL or the deleted marker */
     void *value;            /**< The value associated with key */
-    struct hashentry *next; /**< The overflow chain */
+    unsigned int hash;      /**< The hash of the key */
 } HASHENTRIES;
 
 /**
@@ -42,8 +43,8 @@ typedef struct hashentry
 typedef struct hashiterator
 {
     struct hashtable *table; /**< The hashtable the iterator refers to */
-    int chain;               /**< The current chain we are walking */
-    int depth;               /**< The current depth down the chain */
+    int chain;               /**< The next slot to examine */
+    int depth;               /**< Unused, kept for compatibility */
 } HASHITERATOR;
 
 /**
@@ -74,8 +75,9 @@ typedef struct hashtable
 #if defined(SS_DEBUG)
     skygw_chk_t ht_chk_top;
 #endif
-    int hashsize;                 /**< The number of HASHENTRIES */
-    HASHENTRIES **entries;        /**< The entries themselves */
+    int hashsize;                 /**< The size given when the table was created */
+    int capacity;                 /**< The number of slots, a power of two */
+    HASHENTRIES *entries;         /**< The slots themselves */
     HASHHASHFN hashfn;            /**< The hash function */
     HASHCMPFN cmpfn;              /**< The key comparison function */
     HASHCOPYFN kcopyfn;           /**< Optional key copy function */
@@ -87,6 +89,7 @@ typedef struct hashtable
     int writelock;                /**< The table is locked by a writer */
     bool ht_isflat;               /**< Indicates whether hashtable is in stack or heap */
     int n_elements;               /**< Number of added elements */
+    int n_deleted;                /**< Number of slots with the deleted marker */
 #if defined(SS_DEBUG)
     skygw_chk_t ht_chk_tail;
 #endif
@@ -0,0 +1,134 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file histogram.h - Log-linear histograms of latencies
+ *
+ * The values are stored in buckets whose width doubles with every power of
+ * two. Each power of two is split into HISTOGRAM_SUB_BUCKETS buckets, which
+ * keeps the relative error of a recorded value below 1/HISTOGRAM_SUB_BUCKETS.
+ * Values up to UINT32_MAX are tracked, larger values are recorded in the last
+ * bucket.
+ *
+ * A histogram is updated with histogram_add() by only one thread, or with
+ * histogram_add_atomic() by any number of threads. Other threads may read it
+ * but the values they see can be slightly out of date.
+ */
+
+#include <maxscale/cdefs.h>
+
+MXS_BEGIN_DECLS
+
+#define HISTOGRAM_SUB_BITS    4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_N_BUCKETS   ((32 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+typedef struct histogram
+{
+    uint64_t count;                         /**< Number of recorded values */
+    uint64_t max;                           /**< Largest recorded value */
+    uint32_t buckets[HISTOGRAM_N_BUCKETS];  /**< Number of values in each bucket */
+} HISTOGRAM;
+
+/**
+ * @brief Get the bucket of a value
+ *
+ * @param value Value to look up
+ * @return Index of the bucket
+ */
+static inline int histogram_bucket(uint64_t value)
+{
+    if (value > UINT32_MAX)
+    {
+        value = UINT32_MAX;
+    }
+
+    if (value < HISTOGRAM_SUB_BUCKETS)
+    {
+        return value;
+    }
+
+    int shift = 63 - __builtin_clzll(value) - HISTOGRAM_SUB_BITS;
+
+    return (shift + 1) * HISTOGRAM_SUB_BUCKETS + ((value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+/**
+ * @brief Record a value
+ *
+ * @param hist  Histogram to update
+ * @param value Value to record
+ */
+static inline void histogram_add(HISTOGRAM *hist, uint64_t value)
+{
+    hist->buckets[histogram_bucket(value)]++;
+    hist->count++;
+
+    if (value > hist->max)
+    {
+        hist->max = value;
+    }
+}
+
+/**
+ * @brief Record a value in a histogram that is shared by several threads
+ *
+ * No locks are taken, the counters are updated with atomic operations.
+ *
+ * @param hist  Histogram to update
+ * @param value Value to record
+ */
+static inline void histogram_add_atomic(HISTOGRAM *hist, uint64_t value)
+{
+    __atomic_add_fetch(&hist->buckets[histogram_bucket(value)], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&hist->count, 1, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+
+    while (value > max &&
+           !__atomic_compare_exchange_n(&hist->max, &max, value, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+/**
+ * @brief Get the largest value that is stored in a bucket
+ *
+ * @param bucket Index of the bucket
+ * @return The highest value that maps to the bucket
+ */
+uint64_t histogram_bucket_max(int bucket);
+
+/**
+ * @brief Get a percentile of the recorded values
+ *
+ * The returned value is the highest value of the bucket that contains the
+ * percentile, limited to the largest recorded value.
+ *
+ * @param hist       Histogram to inspect
+ * @param percentile Percentile between 0 and 100
+ * @return Value at the percentile or 0 if no values have been recorded
+ */
+uint64_t histogram_percentile(const HISTOGRAM *hist, double percentile);
+
+/**
+ * @brief Add the values of one histogram to another
+ *
+ * @param dest Histogram to update
+ * @param src  Histogram whose values are added
+ */
+void histogram_merge(HISTOGRAM *dest, const HISTOGRAM *src);
+
+MXS_END_DECLS
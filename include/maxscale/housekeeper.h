@@ -17,6 +17,8 @@
  */
 
 #include <maxscale/cdefs.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <time.h>
 #include <maxscale/dcb.h>
 #include <maxscale/hk_heartbeat.h>
@@ -30,7 +32,7 @@ typedef enum
 } HKTASK_TYPE;
 
 /**
- * The housekeeper task list
+ * A housekeeper task
  */
 typedef struct hktask
 {
@@ -40,7 +42,19 @@ typedef struct hktask
     int frequency;            /*< How often to call the tasks (seconds) */
     time_t nextdue;           /*< When the task should be next run */
     HKTASK_TYPE type;         /*< The task type */
-    struct hktask *next;      /*< Next task in the list */
+    struct hktask *next;      /*< Next task in the list of all tasks */
+    int64_t due_ms;           /*< When the task should be next run, monotonic milliseconds */
+    int heap_index;           /*< Position in the schedule, -1 if not scheduled */
+    struct hktask *work_next; /*< Next task in the queue of the workers */
+    bool queued;              /*< The task is waiting for a worker */
+    bool running;             /*< A worker is running the task */
+    bool removed;             /*< The task has been removed while queued or running */
+    bool free_when_done;      /*< The worker frees the task when it completes */
+    pthread_t runner;         /*< The worker running the task */
+    uint64_t n_runs;          /*< How many times the task has been run */
+    uint64_t n_skipped;       /*< Runs skipped because the previous run had not completed */
+    uint64_t total_us;        /*< Total run time in microseconds */
+    uint64_t max_us;          /*< Longest run time in microseconds */
 } HKTASK;
 
 /**
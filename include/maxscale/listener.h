@@ -42,6 +42,10 @@ typedef struct servlistener
     char *auth_options;         /**< Authenticator options */
     void *auth_instance;        /**< Authenticator instance created in MXS_AUTHENTICATOR::initialize() */
     SSL_LISTENER *ssl;          /**< Structure of SSL data or NULL */
+    bool compression;           /**< Offer the compressed protocol to clients */
+    int backlog;                /**< Length of the accept queue, 0 for the kernel maximum */
+    int defer_accept;           /**< TCP_DEFER_ACCEPT timeout in seconds, 0 if disabled */
+    int fastopen;               /**< TCP_FASTOPEN queue length, 0 if disabled */
     struct dcb *listener;       /**< The DCB for the listener */
     struct users *users;        /**< The user data for this listener */
     struct service* service;    /**< The service which used by this listener */
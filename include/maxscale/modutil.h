@@ -21,6 +21,7 @@
 #include <maxscale/dcb.h>
 #include <string.h>
 #include <maxscale/pcre2.h>
+#include <maxscale/server.h>
 
 MXS_BEGIN_DECLS
 
@@ -38,6 +39,36 @@ extern int      modutil_is_SQL_prepare(GWBUF *);
 extern int      modutil_extract_SQL(GWBUF *, char **, int *);
 extern int      modutil_MySQL_Query(GWBUF *, char **, int *, int *);
 extern char*    modutil_get_SQL(GWBUF *);
+
+/**
+ * @brief Get a read-only view of the SQL in a statement
+ *
+ * When the statement is in one buffer, @c sql points into the buffer and
+ * nothing is copied. When it spans several buffers, the SQL is copied once
+ * and the copy is cached in the buffer, so repeated calls, for example by
+ * each filter in a chain, do not copy it again. The returned string is only
+ * null terminated when it was copied.
+ *
+ * @param buf    A COM_QUERY, COM_STMT_PREPARE or COM_INIT_DB packet
+ * @param sql    Pointer where the start of the SQL is stored
+ * @param length Pointer where the length of the SQL is stored
+ * @return True if the buffer contains a complete statement, false otherwise
+ */
+bool            modutil_get_SQL_view(GWBUF *buf, const char **sql, size_t *length);
+
+/**
+ * @brief Get a read-only view of the SQL in a COM_QUERY
+ *
+ * Like modutil_get_SQL_view() but only accepts COM_QUERY packets, for callers
+ * that act on executed statements and must ignore prepared statements and
+ * changes of the default database.
+ *
+ * @param buf    A COM_QUERY packet
+ * @param sql    Pointer where the start of the SQL is stored
+ * @param length Pointer where the length of the SQL is stored
+ * @return True if the buffer contains a complete COM_QUERY, false otherwise
+ */
+bool            modutil_get_query_view(GWBUF *buf, const char **sql, size_t *length);
 extern GWBUF*   modutil_replace_SQL(GWBUF *, char *);
 extern char*    modutil_get_query(GWBUF* buf);
 extern int      modutil_send_mysql_err_packet(DCB *, int, int, int, const char *, const char *);
@@ -55,6 +86,21 @@ GWBUF*          modutil_create_mysql_err_msg(int             packet_number,
                                              const char      *msg);
 
 int modutil_count_signal_packets(GWBUF*, int, int, int*);
+
+/**
+ * @brief Find the complete MySQL packets in a buffer chain
+ *
+ * The chain is scanned once. Packets inside one buffer are found by reading
+ * the headers directly and only packets that span buffers are reassembled.
+ *
+ * @param buffer    Buffer chain to scan
+ * @param offsets   Array where the offsets of the complete packets are
+ *                  stored, NULL to only count them
+ * @param n_offsets Size of @c offsets, the scan stops when it is full
+ * @param length    If not NULL, the length of the found packets is stored here
+ * @return Number of complete packets found
+ */
+int modutil_scan_packets(GWBUF* buffer, size_t* offsets, int n_offsets, size_t* length);
 mxs_pcre2_result_t modutil_mysql_wildcard_match(const char* pattern, const char* string);
 
 /**
@@ -81,8 +127,177 @@ char* strnchr_esc(char* ptr, char c, int len);
 char* strnchr_esc_mysql(char* ptr, char c, int len);
 bool is_mysql_statement_end(const char* start, int len);
 bool is_mysql_sp_end(const char* start, int len);
+char* find_mysql_statement_end(char* start, int len);
 char* modutil_get_canonical(GWBUF* querybuf);
 
+/**
+ * @brief Calculate a digest of the canonical form of a statement
+ *
+ * The statement is tokenized in one pass and the tokens are hashed without
+ * creating the canonical string. Literal values are replaced with a
+ * placeholder and the comments and whitespace are ignored, so statements
+ * that differ only in them have the same digest. Executable comments are
+ * hashed like normal SQL.
+ *
+ * @param querybuf A COM_QUERY or COM_STMT_PREPARE packet, need not be contiguous
+ * @param digest   The digest is stored here
+ * @return True if the buffer contained a statement and a digest was calculated
+ */
+bool modutil_get_canonical_digest(GWBUF* querybuf, uint64_t* digest);
+
+/** Number of bytes at the start of a reply packet that are inspected: the
+ * header and the longest OK packet prefix that contains the status flags */
+#define MODUTIL_REPLY_PEEK_LEN (4 + 21)
+
+/**
+ * The replies that are expected from a server
+ *
+ * The commands that have been sent to a server are kept in FIFO order. The
+ * replies are followed while they are read so that it is known when the
+ * reply to the oldest command is complete. This allows several commands to
+ * be pipelined to one server.
+ */
+typedef struct
+{
+    uint8_t  *commands;    /**< Circular buffer of commands that expect a reply */
+    int       size;        /**< Size of @c commands */
+    int       head;        /**< Index of the oldest command */
+    int       count;       /**< Number of commands that expect a reply */
+    int       state;       /**< State of the reply to the oldest command */
+    int       eof_left;    /**< EOF packets left before the reply is complete */
+    uint32_t  packet_left; /**< Bytes of the current packet left after the peeked part */
+    bool      continued;   /**< Whether the current packet continues a large packet */
+    int       peek_len;    /**< Number of bytes in @c peek */
+    uint8_t   peek[MODUTIL_REPLY_PEEK_LEN]; /**< Start of the current packet */
+    uint64_t  rows;        /**< Rows of result sets read so far, never reset */
+} MXS_REPLY_QUEUE;
+
+/**
+ * @brief Add a command that was sent to a server
+ *
+ * Commands that do not generate a reply, like COM_STMT_CLOSE, are ignored.
+ *
+ * @param queue   The reply queue
+ * @param command The command byte of the packet that was sent
+ * @return False on memory allocation failure
+ */
+bool modutil_reply_queue_push(MXS_REPLY_QUEUE *queue, uint8_t command);
+
+/**
+ * @brief Follow the replies read from a server
+ *
+ * The buffer can contain any part of the reply stream, the state is kept
+ * between calls. The oldest command is removed from the queue when its
+ * reply is complete.
+ *
+ * @param queue The reply queue
+ * @param reply Data read from the server
+ * @return Number of replies that were completed by this data
+ */
+int modutil_reply_queue_process(MXS_REPLY_QUEUE *queue, GWBUF *reply);
+
+/**
+ * @brief Follow the replies up to the next packet that can be an OK packet
+ *
+ * Like modutil_reply_queue_process() but stops at the start of the first
+ * packet for which modutil_reply_queue_expects_ok() is true. The caller can
+ * then inspect that packet before processing it.
+ *
+ * @param queue The reply queue
+ * @param reply Data read from the server
+ * @return Number of bytes processed, less than the length of @c reply if
+ *         the processing stopped at a packet that can be an OK packet
+ */
+size_t modutil_reply_queue_process_to_ok(MXS_REPLY_QUEUE *queue, GWBUF *reply);
+
+/**
+ * @brief Check whether the next packet can be an OK packet
+ *
+ * An OK packet is only sent as the first packet of a reply or of the next
+ * result of a multi-result reply. The reply to a COM_STMT_PREPARE starts
+ * with a packet that looks like an OK packet, but it is not one.
+ *
+ * @param queue The reply queue
+ * @return True if the next packet starts a reply and that packet is an OK
+ *         packet if its first byte is 0x00
+ */
+bool modutil_reply_queue_expects_ok(const MXS_REPLY_QUEUE *queue);
+
+/**
+ * @brief Free the memory used by a reply queue
+ *
+ * The queue is empty and can be reused after this call.
+ *
+ * @param queue The reply queue
+ */
+void modutil_reply_queue_free(MXS_REPLY_QUEUE *queue);
+
+/** The session state information that is taken from OK packets */
+typedef struct mxs_session_track
+{
+    const char **variables;  /**< Names of the wanted system variables */
+    char       **values;     /**< Values of the variables, NULL if a variable was not sent */
+    int        n_variables;  /**< Number of wanted variables */
+    char       *schema;      /**< The new default database or NULL if it was not sent */
+    char       *trx_state;   /**< The transaction state or NULL if it was not sent */
+} MXS_SESSION_TRACK;
+
+/**
+ * @brief Remove the session state information from an OK packet
+ *
+ * When the session state is tracked, the info string of an OK packet is
+ * length-encoded and followed by the session state information. This converts
+ * the packet into the format of a client that does not track the session state,
+ * optionally taking the value of one system variable first. A packet that is
+ * already in that format is returned as it is.
+ *
+ * @param packet   A complete OK packet of a connection that tracks the session state
+ * @param variable Name of a system variable whose value is wanted, or NULL
+ * @param value    If the variable is found, its value is stored here and the old
+ *                 value is freed. The caller must free the value.
+ * @return The converted packet
+ */
+GWBUF* modutil_ok_remove_session_state(GWBUF *packet, const char *variable, char **value);
+
+/**
+ * @brief Take the session state information from an OK packet
+ *
+ * Like modutil_ok_remove_session_state() but stores the values of several
+ * system variables, the default database and the transaction state that
+ * the server sent. A value that is found replaces the old one in @c track,
+ * which is freed. The caller must free the values.
+ *
+ * The transaction state is only sent by servers that have
+ * session_track_transaction_info enabled. Its first character is @c T in an
+ * explicit transaction, @c I in an implicit one and @c _ otherwise.
+ *
+ * @param packet A complete OK packet of a connection that tracks the session state
+ * @param track  The wanted variables and the found values
+ * @return The converted packet
+ */
+GWBUF* modutil_ok_take_session_state(GWBUF *packet, MXS_SESSION_TRACK *track);
+
+/**
+ * @brief Answer a query that only reads cached global variables of a server
+ *
+ * The queries that are answered are of the forms
+ *
+ *   SELECT @@[scope.]variable [[AS] alias], ... [LIMIT n]
+ *   SHOW [scope] VARIABLES LIKE 'variable'
+ *
+ * where each variable is cached in the server by its monitor. The session
+ * values are the global values of the server. This is only true for a
+ * session that has not changed them, it is up to the caller to know that.
+ * The variables set from the character set of the client handshake are only
+ * answered if the client uses the default collation of the server.
+ *
+ * @param client The client DCB, the result set is written to it
+ * @param server The server whose variables are used
+ * @param query  A complete packet sent by the client
+ * @return True if the query was answered, false if it must be routed
+ */
+bool modutil_answer_variable_query(DCB *client, SERVER *server, GWBUF *query);
+
 // TODO: Move modutil out of the core
 const char* STRPACKETTYPE(int p);
 
@@ -68,6 +68,9 @@ typedef struct mxs_monitor_object
 /** Monitor's poll frequency */
 #define MXS_MON_BASE_INTERVAL_MS 100
 
+/** The maximum number of threads that probe the servers of one monitor */
+#define MXS_MON_PROBE_THREADS_MAX 32
+
 #define MXS_MONITOR_RUNNING 1
 #define MXS_MONITOR_STOPPING 2
 #define MXS_MONITOR_STOPPED 3
@@ -127,6 +130,18 @@ typedef enum
     NEW_NDB_EVENT     = (1 << 21), /**< new_ndb */
 } mxs_monitor_event_t;
 
+/**
+ * A status variable of a server
+ */
+typedef struct mxs_mon_status_var
+{
+    char *name;                   /**< Name of the variable as returned by the server */
+    char *value;                  /**< Value of the variable */
+} MXS_MON_STATUS_VAR;
+
+/** The status variables that the load metrics are sampled from, for mon_fetch_status() */
+#define MXS_MON_LOAD_METRICS_STATUS "Threads_running", "Questions", "Innodb_row_lock_current_waits"
+
 /**
  * The linked list of servers that are being monitored by the monitor module.
  */
@@ -138,6 +153,12 @@ typedef struct monitor_servers
     int mon_err_count;
     unsigned int mon_prev_status;
     unsigned int pending_status;  /**< Pending Status flag bitmap */
+    MXS_MON_STATUS_VAR *status_vars; /**< Status variables fetched by mon_fetch_status() */
+    int n_status_vars;            /**< Number of variables in status_vars */
+    uint64_t status_round;        /**< The monitoring round status_vars were fetched in */
+    int64_t questions;            /**< Questions at the previous load metrics sample */
+    int64_t questions_time;       /**< When Questions was sampled in milliseconds,
+                                   * 0 if it has not been sampled */
     struct monitor_servers *next; /**< The next server in the list */
 } MXS_MONITOR_SERVERS;
 
@@ -167,9 +188,18 @@ struct mxs_monitor
     void *handle;                 /**< Handle returned from startMonitor */
     size_t interval;              /**< The monitor interval */
     bool created_online;          /**< Whether this monitor was created at runtime */
+    bool load_metrics;            /**< Whether the load metrics of the servers are sampled */
+    char *server_variables;       /**< Comma-separated list of the global variables that
+                                   * are cached in the servers, NULL if none */
+    int journal_max_age;          /**< How old a journal can be to be loaded in seconds,
+                                   * 0 if the journal is not used */
+    uint64_t journal_hash;        /**< Hash of the topology in the last written journal */
+    uint64_t round;               /**< Number of the monitoring round, incremented when
+                                   * the servers are locked at its start */
     volatile bool server_pending_changes;
     /**< Are there any pending changes to a server?
        * If yes, the next monitor loop starts early.  */
+    struct mxs_monitor_probes *probes; /**< The threads that probe the servers */
     struct mxs_monitor *next;     /**< Next monitor in the linked list */
 };
 
@@ -243,6 +273,94 @@ void mon_process_state_changes(MXS_MONITOR *monitor, const char *script, uint64_
  */
 void mon_hangup_failed_servers(MXS_MONITOR *monitor);
 
+/**
+ * @brief Probe all the servers of a monitor in parallel
+ *
+ * The function is called for each server from a pool of threads, so that one
+ * slow or unreachable server does not delay the probing of the others. The
+ * pool has one thread per server, up to MXS_MON_PROBE_THREADS_MAX threads, and
+ * the threads have called mysql_thread_init(). The probes of different servers
+ * must not modify shared data without locking.
+ *
+ * @param monitor Monitor object
+ * @param probe   Function that probes one server
+ */
+void mon_probe_servers(MXS_MONITOR *monitor, void (*probe)(MXS_MONITOR*, MXS_MONITOR_SERVERS*));
+
+/**
+ * @brief Fetch status variables of a server for the current monitoring round
+ *
+ * All the variables are read with one SHOW GLOBAL STATUS query so that a
+ * monitor and the core functions it calls do not each query the server
+ * separately. The values replace the ones fetched before and they are only
+ * returned by mon_get_status() during the current round.
+ *
+ * @param monitor Monitor object
+ * @param db      Server to query, it must be connected
+ * @param names   NULL terminated list of variable names, they are used in the
+ *                query as such and must not need quoting
+ * @return True if the query succeeded, false if it failed and the error was logged
+ */
+bool mon_fetch_status(MXS_MONITOR *monitor, MXS_MONITOR_SERVERS *db, const char * const *names);
+
+/**
+ * @brief Get a status variable fetched with mon_fetch_status()
+ *
+ * @param monitor Monitor object
+ * @param db      The server
+ * @param name    Name of the variable, compared case-insensitively
+ * @return The value or NULL if the variable was not fetched in this round or
+ *         the server does not have it
+ */
+const char* mon_get_status(const MXS_MONITOR *monitor, const MXS_MONITOR_SERVERS *db,
+                           const char *name);
+
+/**
+ * @brief Sample the load metrics of a server
+ *
+ * Reads Threads_running, Questions and Innodb_row_lock_current_waits from the
+ * server and stores them in its load metrics. The queries per second are
+ * calculated from the change of Questions since the previous sample. If the
+ * monitor already fetched MXS_MON_LOAD_METRICS_STATUS in this round with
+ * mon_fetch_status(), the server is not queried again. Does nothing unless the
+ * load_metrics parameter of the monitor is enabled.
+ *
+ * @param monitor Monitor object
+ * @param db      Server to sample, it must be connected
+ */
+void mon_update_load_metrics(MXS_MONITOR *monitor, MXS_MONITOR_SERVERS *db);
+
+/**
+ * @brief Clear the load metrics of a server that could not be sampled
+ *
+ * @param db Server whose metrics are cleared
+ */
+void mon_reset_load_metrics(MXS_MONITOR_SERVERS *db);
+
+/**
+ * @brief Set the global variables that are cached in the servers
+ *
+ * The monitor must be stopped when the list is changed.
+ *
+ * @param monitor Monitor object
+ * @param value   Comma-separated list of variable names, empty for none
+ * @return True if the list was valid and was set
+ */
+bool mon_set_server_variables(MXS_MONITOR *monitor, const char *value);
+
+/**
+ * @brief Read the cached global variables of a server
+ *
+ * Reads the variables in the server_variables parameter of the monitor with
+ * one SHOW GLOBAL VARIABLES and stores them in the server, replacing the
+ * earlier values. If collation_server is one of them, the ID of the collation
+ * is also looked up. Does nothing unless the parameter is set.
+ *
+ * @param monitor Monitor object
+ * @param db      Server to read, it must be connected
+ */
+void mon_update_server_variables(MXS_MONITOR *monitor, MXS_MONITOR_SERVERS *db);
+
 /**
  * @brief Report query errors
  *
@@ -0,0 +1,77 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file mysql_async.h - Non-blocking queries to the backend servers
+ *
+ * The queries are executed by the polling threads without a client session.
+ * The connections are opened and read with the non-blocking API of the
+ * connector, so a polling thread keeps processing the events of its other
+ * connections while the query runs. The connections are pooled in each
+ * polling thread and reused by the later queries with the same server and
+ * user.
+ */
+
+#include <maxscale/cdefs.h>
+#include <stdint.h>
+#include <mysql.h>
+#include <maxscale/server.h>
+
+MXS_BEGIN_DECLS
+
+/** The default timeout of a query in seconds */
+#define MXS_ASYNC_DEFAULT_TIMEOUT 10
+
+/** The outcome of a query */
+typedef struct mxs_async_result
+{
+    SERVER       *server;        /**< The server the query was executed on */
+    MYSQL_RES    *result;        /**< The result set or NULL if there is none, freed after
+                                  *   the callback returns */
+    uint64_t     affected_rows;  /**< Rows affected by a statement without a result set */
+    unsigned int errnum;         /**< Error number, 0 if the query succeeded */
+    const char   *errmsg;        /**< Error message, empty if the query succeeded */
+} MXS_ASYNC_RESULT;
+
+/**
+ * Called in the polling thread that executed the query when it has completed
+ *
+ * @param result The outcome of the query, only valid during the call
+ * @param data   The data given to mxs_async_query
+ */
+typedef void (*mxs_async_cb)(const MXS_ASYNC_RESULT *result, void *data);
+
+/**
+ * @brief Execute a query on a server without blocking
+ *
+ * When called from a polling thread, the query is executed by that thread.
+ * Otherwise the query is handed to one of the polling threads. The callback
+ * is called exactly once, also when the query fails or times out, unless this
+ * function returns false. It is never called before this function returns and
+ * it may start new queries.
+ *
+ * @param server   The server
+ * @param user     The user to connect as
+ * @param password The password of the user in plain text
+ * @param sql      The statement to execute
+ * @param timeout  Timeout in seconds for connecting and executing the query,
+ *                 0 for MXS_ASYNC_DEFAULT_TIMEOUT
+ * @param cb       Function called with the outcome of the query
+ * @param data     Data passed to @c cb
+ * @return True if the query was started, false on memory allocation failure
+ */
+bool mxs_async_query(SERVER *server, const char *user, const char *password,
+                     const char *sql, int timeout, mxs_async_cb cb, void *data);
+
+MXS_END_DECLS
@@ -91,4 +91,32 @@ int poll_remove_dcb(DCB *);
  */
 void poll_add_epollin_event_to_dcb(DCB* dcb, GWBUF* buf);
 
+/**
+ * Call a function in the calling polling thread after a delay.
+ *
+ * The call can't be cancelled. If the data refers to a session, the
+ * caller should hold a reference to it until the function is called.
+ *
+ * @param delay_ms Delay in milliseconds
+ * @param func     Function to call
+ * @param data     Argument for the function
+ * @return True if the call was scheduled, false if the calling thread is not a
+ *         polling thread or memory allocation failed
+ */
+bool poll_add_delayed_call(int delay_ms, void (*func)(void *data), void *data);
+
+/**
+ * Call a function in a polling thread.
+ *
+ * This can be called from any thread. The function is called after the
+ * events of the current poll cycle of the target thread have been processed,
+ * even if the target is the calling thread.
+ *
+ * @param thread The polling thread to call the function in
+ * @param func   Function to call
+ * @param data   Argument for the function
+ * @return True if the call was queued, false if memory allocation failed
+ */
+bool poll_call_in_thread(int thread, void (*func)(void *data), void *data);
+
 MXS_END_DECLS
@@ -0,0 +1,53 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file probes.h - Static tracepoints
+ *
+ * The probes are USDT probes of the provider @c maxscale that perf, bpftrace
+ * and SystemTap can attach to, for example:
+ *
+ * @verbatim
+ * bpftrace -e 'usdt:/usr/bin/maxscale:maxscale:session_route_query { @[arg0] = count(); }'
+ * @endverbatim
+ *
+ * An inactive probe is a single nop instruction. The arguments are still
+ * evaluated, so only values that are at hand are passed to the probes.
+ * The probes are compiled in when MaxScale is built with WITH_USDT and
+ * sys/sdt.h is available, otherwise they generate no code.
+ */
+
+#include <maxscale/cdefs.h>
+
+#if defined(MXS_WITH_USDT)
+
+#include <sys/sdt.h>
+
+#define MXS_PROBE0(name) DTRACE_PROBE(maxscale, name)
+#define MXS_PROBE1(name, a1) DTRACE_PROBE1(maxscale, name, a1)
+#define MXS_PROBE2(name, a1, a2) DTRACE_PROBE2(maxscale, name, a1, a2)
+#define MXS_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(maxscale, name, a1, a2, a3)
+#define MXS_PROBE4(name, a1, a2, a3, a4) DTRACE_PROBE4(maxscale, name, a1, a2, a3, a4)
+
+#else
+
+/** The arguments are referenced so that variables used only by probes do not
+ * cause warnings, the compiler removes them. */
+#define MXS_PROBE0(name) do {} while (0)
+#define MXS_PROBE1(name, a1) do { (void)(a1); } while (0)
+#define MXS_PROBE2(name, a1, a2) do { (void)(a1); (void)(a2); } while (0)
+#define MXS_PROBE3(name, a1, a2, a3) do { (void)(a1); (void)(a2); (void)(a3); } while (0)
+#define MXS_PROBE4(name, a1, a2, a3, a4) do { (void)(a1); (void)(a2); (void)(a3); (void)(a4); } while (0)
+
+#endif
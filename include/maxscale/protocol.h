@@ -47,6 +47,7 @@ struct session;
  *      auth_default    Default authenticator name
  *      connlimit       Maximum connection limit
  *      established     Whether connection is fully established
+ *      free_protocol   Free the protocol object, MXS_FREE is used if NULL
  * @endverbatim
  *
  * This forms the "module object" for protocol modules within the gateway.
@@ -69,6 +70,7 @@ typedef struct mxs_protocol
     char   *(*auth_default)();
     int32_t (*connlimit)(struct dcb *, int limit);
     bool    (*established)(struct dcb *);
+    void    (*free_protocol)(void *);
 } MXS_PROTOCOL;
 
 /**
@@ -76,6 +78,6 @@ typedef struct mxs_protocol
  * the MXS_PROTOCOL structure is changed. See the rules defined in modinfo.h
  * that define how these numbers should change.
  */
-#define MXS_PROTOCOL_VERSION      {1, 1, 0}
+#define MXS_PROTOCOL_VERSION      {1, 2, 0}
 
 MXS_END_DECLS
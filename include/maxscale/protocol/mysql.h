@@ -75,6 +75,10 @@ MXS_BEGIN_DECLS
 #define MYSQL_EOF_PACKET_LEN 9
 #define MYSQL_OK_PACKET_MIN_LEN 11
 #define MYSQL_ERR_PACKET_MIN_LEN 9
+#define MYSQL_COMPRESSED_HEADER_LEN 7
+
+/** Payloads shorter than this are sent uncompressed, as the MySQL client library does */
+#define MYSQL_MIN_COMPRESS_LENGTH 50
 
 /**
  * Offsets and sizes of various parts of the client packet. If the offset is
@@ -265,6 +269,16 @@ typedef enum
 #define MXS_MARIA_CAP_COM_MULTI            (1 << 1)
 #define MXS_MARIA_CAP_STMT_BULK_OPERATIONS (1 << 2)
 
+/**
+ * The MariaDB 10.2 array binding command. It executes a prepared statement
+ * with several rows of parameters and is only sent by clients that were
+ * advertised MXS_MARIA_CAP_STMT_BULK_OPERATIONS. Older connectors don't
+ * define it in enum_server_command.
+ */
+#define MXS_COM_STMT_BULK_EXECUTE 0xfa
+
+struct z_stream_s;
+
 typedef enum enum_server_command mysql_server_cmd_t;
 
 static const mysql_server_cmd_t MYSQL_COM_UNDEFINED = (mysql_server_cmd_t) - 1;
@@ -287,27 +301,41 @@ typedef struct server_command_st
  *
  * Protocol carries information from client side to backend side, such as
  * MySQL session command information and history of earlier session commands.
+ * The fields that are used by every packet come first.
  */
 typedef struct
 {
 #if defined(SS_DEBUG)
     skygw_chk_t            protocol_chk_top;
 #endif
-    int                    fd;                           /*< The socket descriptor */
     struct dcb*            owner_dcb;                    /*< The DCB of the socket we are running on */
     mysql_server_cmd_t     current_command;              /*< Current command being executed */
-    server_command_t       protocol_command;             /*< session command list */
-    server_command_t*      protocol_cmd_history;         /*< session command history */
     mxs_auth_state_t       protocol_auth_state;          /*< Authentication status */
     mysql_protocol_state_t protocol_state;               /*< Protocol struct status */
-    uint8_t                scramble[MYSQL_SCRAMBLE_LEN]; /*< server scramble, created or received */
+    bool                   ignore_reply;                 /*< If the reply should be discarded */
+    uint8_t                reset_replies;                /*< Replies to discard before the reply
+                                                          *  to the last reset command */
+    bool                   compress;                     /*< Whether the compressed protocol is in use */
+    uint8_t                compress_seq;                 /*< Next compressed packet sequence number */
+    bool                   large_query;                  /*< Whether the next packet continues a
+                                                          *  packet of 16MB */
+    int                    n_ps_pending;                 /*< Number of COM_STMT_PREPAREs waiting for
+                                                          *  their replies */
+    GWBUF*                 stored_query;                 /*< Temporarily stored queries */
+    GWBUF*                 ps_pending;                   /*< The COM_STMT_PREPARE waiting for its reply */
+    server_command_t       protocol_command;             /*< session command list */
+    server_command_t*      protocol_cmd_history;         /*< session command history */
+    /** The fields below are only used by the handshake or with compression */
+    int                    fd;                           /*< The socket descriptor */
     uint32_t               server_capabilities;          /*< server capabilities, created or received */
     uint32_t               client_capabilities;          /*< client capabilities, created or received */
     uint32_t               extra_capabilities;           /*< MariaDB 10.2 capabilities */
-    unsigned long          tid;                          /*< MySQL Thread ID, in handshake */
     unsigned int           charset;                      /*< MySQL character set at connect time */
-    bool                   ignore_reply;                 /*< If the reply should be discarded */
-    GWBUF*                 stored_query;                 /*< Temporarily stored queries */
+    unsigned long          tid;                          /*< MySQL Thread ID, in handshake */
+    uint8_t                scramble[MYSQL_SCRAMBLE_LEN]; /*< server scramble, created or received */
+    GWBUF*                 compress_readq;               /*< Incomplete compressed packets */
+    struct z_stream_s*     deflater;                     /*< Compression stream, created on first use */
+    struct z_stream_s*     inflater;                     /*< Decompression stream, created on first use */
 #if defined(SS_DEBUG)
     skygw_chk_t            protocol_chk_tail;
 #endif
@@ -320,6 +348,13 @@ typedef struct
 #define MYSQL_REPLY_LOCAL_INFILE      0xfb
 #define MYSQL_REPLY_AUTHSWITCHREQUEST 0xfe /**< Only sent during authentication */
 
+/** Offset of the statement ID in the binary protocol commands and in the
+ * reply to COM_STMT_PREPARE */
+#define MYSQL_PS_ID_OFFSET            (MYSQL_HEADER_LEN + 1)
+#define MYSQL_PS_ID_SIZE              4
+/** Payload length of the OK reply to COM_STMT_PREPARE */
+#define MYSQL_PS_OK_PAYLOAD_LEN       12
+
 static inline mysql_server_cmd_t MYSQL_GET_COMMAND(const uint8_t* header)
 {
     return (mysql_server_cmd_t)header[4];
@@ -373,6 +408,7 @@ MYSQL_session* mysql_session_alloc();
 
 MySQLProtocol* mysql_protocol_init(DCB* dcb, int fd);
 void           mysql_protocol_done (DCB* dcb);
+void           mysql_protocol_free(void *protocol);
 const char *gw_mysql_protocol_state2string(int state);
 int        mysql_send_com_quit(DCB* dcb, int packet_number, GWBUF* buf);
 GWBUF*     mysql_create_com_quit(GWBUF* bufparam, int packet_number);
@@ -442,4 +478,61 @@ bool mxs_mysql_is_ok_packet(GWBUF *buffer);
 /** Check for result set */
 bool mxs_mysql_is_result_set(GWBUF *buffer);
 
+/**
+ * @brief Check whether the compressed protocol is used with a backend server
+ *
+ * @param dcb Backend DCB whose server handshake has been read
+ * @return True if both MaxScale and the server want to use compression
+ */
+bool mysql_backend_compression(DCB *dcb);
+
+/**
+ * @brief Read plain MySQL packets from a DCB
+ *
+ * If the compressed protocol is in use, the complete compressed packets that
+ * were read are decompressed and incomplete ones are stored in the protocol.
+ * Otherwise this is the same as dcb_read(). Routers and filters only ever
+ * see the plain packets.
+ *
+ * @param dcb      DCB to read from
+ * @param head     Pointer where the read data is appended
+ * @param maxbytes Maximum number of bytes to read, 0 for no limit
+ * @return Number of bytes read or -1 on error
+ */
+int mysql_dcb_read(DCB *dcb, GWBUF **head, int maxbytes);
+
+/**
+ * @brief Write plain MySQL packets to a DCB
+ *
+ * If the compressed protocol is in use, the packets are compressed before
+ * they are written. Otherwise this is the same as dcb_write().
+ *
+ * @param dcb    DCB to write to
+ * @param buffer Buffer with the MySQL packets to write
+ * @return 1 on success, 0 on error
+ */
+int mysql_dcb_write(DCB *dcb, GWBUF *buffer);
+
+/**
+ * @brief Compress MySQL packets
+ *
+ * @param proto  Protocol of the connection
+ * @param buffer Buffer with the plain packets, freed by this function
+ * @return Buffer with the compressed packets or NULL on error
+ */
+GWBUF* mysql_compress(MySQLProtocol *proto, GWBUF *buffer);
+
+/**
+ * @brief Decompress MySQL packets
+ *
+ * The data after the last complete compressed packet is stored in the protocol
+ * and prepended to the data given on the next call.
+ *
+ * @param proto  Protocol of the connection
+ * @param buffer Buffer with compressed data, replaced with the plain packets
+ *               or NULL if no compressed packet was complete
+ * @return False if the data could not be decompressed
+ */
+bool mysql_decompress(MySQLProtocol *proto, GWBUF **buffer);
+
 MXS_END_DECLS
@@ -0,0 +1,44 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file qsbr.h Deferred freeing of the memory shared by the polling threads
+ *
+ * An object that the polling threads read without a lock is first unlinked so
+ * that no new reader can find it and then given to mxs_qsbr_defer(). The object
+ * is freed once every polling thread has passed a quiescent state, the end of a
+ * poll cycle or a wait for events. A polling thread must not keep a pointer to
+ * such an object from one poll cycle to the next.
+ *
+ * Only the polling threads are covered. Other threads must not read the objects
+ * without a lock.
+ */
+
+#include <maxscale/cdefs.h>
+
+MXS_BEGIN_DECLS
+
+/**
+ * @brief Free an object once no polling thread can refer to it
+ *
+ * The function is called in the calling polling thread after all polling
+ * threads have passed a quiescent state. If the caller is not a polling thread,
+ * the function is called in one of the polling threads.
+ *
+ * @param func Function that frees the object
+ * @param data The object
+ */
+void mxs_qsbr_defer(void (*func)(void *data), void *data);
+
+MXS_END_DECLS
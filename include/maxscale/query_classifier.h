@@ -17,6 +17,8 @@
 
 MXS_BEGIN_DECLS
 
+struct session;
+
 #define QUERY_CLASSIFIER_VERSION {1, 1, 0}
 
 /**
@@ -564,6 +566,98 @@ void qc_get_function_info(GWBUF* stmt, const QC_FUNCTION_INFO** infos, size_t* n
  */
 char* qc_get_canonical(GWBUF* stmt);
 
+/**
+ * Returns a 64-bit digest of the statement in its canonical form.
+ *
+ * Statements that have the same canonical form have the same digest. The
+ * digest is calculated in one pass without creating the canonical string
+ * and without parsing the statement, so the query classifier need not be
+ * loaded. Statements that differ only in whitespace also have the same
+ * digest, unlike with qc_get_canonical.
+ *
+ * @param stmt    A buffer containing a COM_QUERY or COM_STMT_PREPARE packet.
+ * @param digest  On return, the digest of the statement.
+ *
+ * @return True, if the buffer contained a statement.
+ */
+bool qc_get_canonical_digest(GWBUF* stmt, uint64_t* digest);
+
+/**
+ * Returns the statistics of the classification cache.
+ *
+ * The classifications made by the polling threads are cached per thread,
+ * keyed by the canonical digest of the statement. Statements that differ only
+ * in their literals are classified only once, unless the classification
+ * depends on the literals. The size of the cache is set with the
+ * @c query_classifier_cache_size parameter.
+ *
+ * @param n_hits    On return, the number of statements whose classification
+ *                  was found in the caches.
+ * @param n_misses  On return, the number of statements that were parsed.
+ */
+void qc_get_cache_stats(int64_t* n_hits, int64_t* n_misses);
+
+/**
+ * Stores a prepared statement of a session.
+ *
+ * A binary protocol COM_STMT_EXECUTE refers to the statement only by its ID.
+ * The statement is stored so that the classification of the COM_STMT_PREPARE
+ * can be found again when the statement is executed. Since the parsing
+ * information is attached to the stored buffer, the statement is parsed at
+ * most once for the lifetime of the statement.
+ *
+ * The MySQL client protocol stores the statements once the server has replied
+ * with the ID and removes them when the client closes them.
+ *
+ * @param session  The session that prepared the statement.
+ * @param id       The ID of the statement as the client knows it.
+ * @param stmt     A buffer containing a COM_STMT_PREPARE packet. A clone
+ *                 is stored, the caller still owns @c stmt.
+ *
+ * @return True if the statement was stored, false if a memory allocation
+ *         failed.
+ */
+bool qc_ps_store(struct session* session, uint32_t id, GWBUF* stmt);
+
+/**
+ * Returns a stored prepared statement.
+ *
+ * @param session  The session that prepared the statement.
+ * @param id       The ID of the statement.
+ *
+ * @return The COM_STMT_PREPARE packet of the statement or NULL if no statement
+ *         with that ID is stored. The buffer is owned by the session and remains
+ *         valid until the statement is removed.
+ */
+GWBUF* qc_ps_lookup(struct session* session, uint32_t id);
+
+/**
+ * Returns the stored prepared statement a binary protocol command refers to.
+ *
+ * @param session  The session that prepared the statement.
+ * @param cmd      A buffer containing a COM_STMT_EXECUTE, COM_STMT_SEND_LONG_DATA,
+ *                 COM_STMT_RESET, COM_STMT_FETCH or COM_STMT_CLOSE packet.
+ *
+ * @return The COM_STMT_PREPARE packet of the statement or NULL if @c cmd does
+ *         not refer to a stored statement.
+ */
+GWBUF* qc_ps_lookup_by_command(struct session* session, GWBUF* cmd);
+
+/**
+ * Removes a stored prepared statement.
+ *
+ * @param session  The session that prepared the statement.
+ * @param id       The ID of the statement.
+ */
+void qc_ps_remove(struct session* session, uint32_t id);
+
+/**
+ * Removes all stored prepared statements of a session.
+ *
+ * @param session  The session whose statements are removed.
+ */
+void qc_ps_free(struct session* session);
+
 /**
  * Returns the name of the created table.
  *
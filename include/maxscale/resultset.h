@@ -67,8 +67,23 @@ typedef struct resultset
     RESULT_COLUMN *column;  /*< Linked list of column definitions */
     RESULT_ROW_CB fetchrow; /*< Fetch a row for the result set */
     void *userdata;         /*< User data for the fetch row call */
+    bool exhausted;         /*< The fetch row call has returned NULL */
+    int where_col;          /*< Only rows with where_value in this column, -1 for all */
+    char *where_value;      /*< The value of where_col */
+    int order_col;          /*< Column the rows are ordered by, -1 for none */
+    bool order_desc;        /*< Order in descending order */
+    int limit;              /*< Maximum number of rows, -1 for no limit */
+    int n_rows;             /*< Number of rows returned so far */
+    RESULT_ROW **sorted;    /*< The ordered rows */
+    int n_sorted;           /*< Number of ordered rows */
+    int next_sorted;        /*< The next ordered row to return */
+    bool started;           /*< The column definitions have been streamed */
+    uint8_t seqno;          /*< The next packet sequence number when streaming */
 } RESULTSET;
 
+/** The number of rows streamed in one chunk */
+#define RESULTSET_CHUNK_ROWS 256
+
 extern RESULTSET *resultset_create(RESULT_ROW_CB, void *);
 extern void resultset_free(RESULTSET *);
 extern int resultset_add_column(RESULTSET *, const char *, int, RESULT_COL_TYPE);
@@ -79,4 +94,73 @@ extern int resultset_row_set(RESULT_ROW *, int, const char *);
 extern void resultset_stream_mysql(RESULTSET *, DCB *);
 extern void resultset_stream_json(RESULTSET *, DCB *);
 
+/**
+ * @brief Find a column of a result set
+ *
+ * @param set  The result set
+ * @param name Name of the column, compared case insensitively
+ *
+ * @return The index of the column or -1 if there is no such column
+ */
+extern int resultset_column_index(RESULTSET *set, const char *name);
+
+/**
+ * @brief Only return the rows that have a value in a column
+ *
+ * @param set   The result set
+ * @param col   Index of the column
+ * @param value The value the column must have
+ *
+ * @return True on success, false on memory allocation failure
+ */
+extern bool resultset_set_where(RESULTSET *set, int col, const char *value);
+
+/**
+ * @brief Return the rows ordered by a column
+ *
+ * Columns whose values are all numbers are compared as numbers. All the
+ * rows are read before the first one is returned, but with a limit only
+ * that many rows are kept.
+ *
+ * @param set  The result set
+ * @param col  Index of the column
+ * @param desc Whether the order is descending
+ */
+extern void resultset_set_order(RESULTSET *set, int col, bool desc);
+
+/**
+ * @brief Limit the number of rows that are returned
+ *
+ * @param set   The result set
+ * @param limit Maximum number of rows
+ */
+extern void resultset_set_limit(RESULTSET *set, int limit);
+
+/**
+ * @brief Get the next row of a result set
+ *
+ * The WHERE, ORDER BY and LIMIT settings of the result set are applied.
+ *
+ * @param set The result set
+ *
+ * @return The next row, or NULL when there are no more rows
+ */
+extern RESULT_ROW *resultset_next_row(RESULTSET *set);
+
+/**
+ * @brief Stream the next chunk of a result set to a MySQL client
+ *
+ * The column definitions are sent with the first chunk and the final EOF
+ * packet with the last one. Each chunk is written to the DCB with one
+ * write so that a large result set can be sent in parts from the event
+ * loop without blocking the other connections of the thread.
+ *
+ * @param set      The result set
+ * @param dcb      The client DCB
+ * @param max_rows Maximum number of rows in the chunk
+ *
+ * @return True if the whole result set has been sent
+ */
+extern bool resultset_stream_mysql_chunk(RESULTSET *set, DCB *dcb, int max_rows);
+
 MXS_END_DECLS
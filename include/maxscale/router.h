@@ -72,6 +72,8 @@ typedef enum error_action
  *                  or make a request for a new backend connection
  *  getCapabilities Called to obtain the capabilities of the router
  *  destroyInstance Called for destroying a router instance
+ *  createThreadInstance  Called to create the data of the instance for a thread
+ *  destroyThreadInstance Called to destroy the data of the instance for a thread
  *
  * @endverbatim
  *
@@ -197,6 +199,32 @@ typedef struct mxs_router_object
      * @param instance Router instance
      */
     void     (*destroyInstance)(MXS_ROUTER *instance);
+
+    /**
+     * @brief Create the data of a router instance for a polling thread
+     *
+     * This optional function is called once for each polling thread after the
+     * instance has been created. The returned data is only accessed by the
+     * thread in question and can be looked up with service_get_thread_instance()
+     * without any locking. The diagnostics can aggregate the data of all threads
+     * with service_get_thread_instance_of().
+     *
+     * @param instance  Router instance
+     * @param thread_id ID of the polling thread
+     *
+     * @return The data of the thread or NULL on error
+     */
+    void    *(*createThreadInstance)(MXS_ROUTER *instance, int thread_id);
+
+    /**
+     * @brief Destroy the data of a router instance for a polling thread
+     *
+     * Called before destroyInstance for the data returned by createThreadInstance.
+     *
+     * @param instance        Router instance
+     * @param thread_instance The data of the thread
+     */
+    void     (*destroyThreadInstance)(MXS_ROUTER *instance, void *thread_instance);
 } MXS_ROUTER_OBJECT;
 
 /**
@@ -204,7 +232,7 @@ typedef struct mxs_router_object
  * must update these versions numbers in accordance with the rules in
  * modinfo.h.
  */
-#define MXS_ROUTER_VERSION  { 2, 0, 0 }
+#define MXS_ROUTER_VERSION  { 2, 1, 0 }
 
 /**
  * Specifies capabilities specific for routers. Common capabilities
@@ -220,6 +248,8 @@ typedef enum router_capability
     RCAP_TYPE_NO_RSESSION   = 0x00010000, /**< Router does not use router sessions */
     RCAP_TYPE_NO_USERS_INIT = 0x00020000, /**< Prevent the loading of authenticator
                                              users when the service is started */
+    RCAP_TYPE_PASSTHROUGH   = 0x00040000, /**< Replies can be forwarded to the client
+                                             without passing them to the router */
 } mxs_router_capability_t;
 
 typedef enum
@@ -31,7 +31,8 @@ typedef enum routing_capability
 {
     /**< Statements are delivered one per buffer. */
     RCAP_TYPE_STMT_INPUT           = 0x0001, /* 0b0000000000000001 */
-    /**< Each delivered buffer is contiguous; implies RCAP_TYPE_STMT_INPUT. */
+    /**< Each delivered buffer is contiguous, except the continuation packets of
+         packets larger than 16MB; implies RCAP_TYPE_STMT_INPUT. */
     RCAP_TYPE_CONTIGUOUS_INPUT     = 0x0003, /* 0b0000000000000011 */
     /**< The transaction state and autocommit mode of the session are tracked;
          implies RCAP_TYPE_CONTIGUOUS_INPUT and RCAP_TYPE_STMT_INPUT. */
@@ -42,6 +43,8 @@ typedef enum routing_capability
     RCAP_TYPE_CONTIGUOUS_OUTPUT     = 0x0030, /* 0b0000000000110000 */
     /** Result sets are delivered in one buffer; implies RCAP_TYPE_STMT_OUTPUT. */
     RCAP_TYPE_RESULTSET_OUTPUT      = 0x0050, /* 0b0000000001110000 */
+    /** The backends send session state information in the OK packets. */
+    RCAP_TYPE_SESSION_STATE_TRACKING = 0x0100, /* 0b0000000100000000 */
 
 } mxs_routing_capability_t;
 
@@ -20,6 +20,7 @@
 
 #include <maxscale/cdefs.h>
 #include <maxscale/dcb.h>
+#include <maxscale/histogram.h>
 #include <maxscale/resultset.h>
 
 MXS_BEGIN_DECLS
@@ -27,7 +28,9 @@ MXS_BEGIN_DECLS
 #define MAX_SERVER_NAME_LEN 1024
 #define MAX_SERVER_MONUSER_LEN 512
 #define MAX_SERVER_MONPW_LEN 512
+#define MAX_SERVER_GTID_POS_LEN 512 /**< Maximum length of the GTID position of a server */
 #define MAX_NUM_SLAVES 128 /**< Maximum number of slaves under a single server*/
+#define MXS_SERVER_LOAD_MAX 100 /**< Load score of a server that should not be used */
 
 /**
  * The server parameters used for weighting routing decissions
@@ -51,8 +54,54 @@ typedef struct
     int n_persistent;     /**< Current persistent pool */
     uint64_t n_new_conn;  /**< Times the current pool was empty */
     uint64_t n_from_pool; /**< Times when a connection was available from the pool */
+    uint64_t n_prewarmed; /**< Connections opened to refill the pool */
+    int64_t response_time; /**< Moving average of the response time in microseconds */
+    HISTOGRAM response_times; /**< Response times in microseconds */
+    int n_queued;         /**< Operations waiting for a free slot */
+    uint64_t n_queued_total; /**< Operations that had to wait for a free slot */
+    uint64_t n_queue_timeouts; /**< Operations that waited too long and were rejected */
+    uint64_t queue_wait_time; /**< Total time the admitted operations waited, in milliseconds */
 } SERVER_STATS;
 
+/**
+ * An operation that waits for a free slot on a server whose number of
+ * concurrent operations is limited
+ *
+ * The waiter is owned by the caller and must stay valid until its admit
+ * function has been called or it has been removed with server_cancel_op().
+ */
+typedef struct server_waiter
+{
+    struct server_waiter *next;  /**< Next waiter in the queue */
+    int      thread;             /**< Polling thread where @c admit is called */
+    uint64_t queued;             /**< When the waiter was queued, in milliseconds */
+    void   (*admit)(void *data); /**< Called when a slot is handed over to the waiter */
+    void    *data;               /**< Argument for @c admit */
+} SERVER_WAITER;
+
+/**
+ * The load metrics that the monitor samples from the server, each one is
+ * MXS_LOAD_METRIC_UNDEFINED if it has not been sampled
+ */
+typedef struct
+{
+    int threads_running;  /**< Threads_running, without the monitor's own thread */
+    int qps;              /**< Queries per second, from the delta of Questions */
+    int row_lock_waits;   /**< Innodb_row_lock_current_waits */
+    int cpu;              /**< CPU usage in percent, if the server reports it */
+} SERVER_LOAD_METRICS;
+
+#define MXS_LOAD_METRIC_UNDEFINED -1
+
+/**
+ * A global variable of a server, read by the monitor
+ */
+typedef struct
+{
+    char *name;  /**< Name of the variable */
+    char *value; /**< Value of the variable */
+} SERVER_VARIABLE;
+
 /**
  * The SERVER structure defines a backend server. Each server has a name
  * or IP address for the server, a port that the server listens on and
@@ -68,6 +117,7 @@ typedef struct server
     char           *unique_name;   /**< Unique name for the server */
     char           name[MAX_SERVER_NAME_LEN]; /**< Server name/IP address*/
     unsigned short port;           /**< Port to listen on */
+    char           *socket;        /**< Unix domain socket of a server on the same host, or NULL */
     char           *protocol;      /**< Protocol module to use */
     char           *authenticator; /**< Authenticator module name */
     void           *auth_instance; /**< Authenticator instance */
@@ -83,16 +133,33 @@ typedef struct server
     char           *server_string; /**< Server version string, i.e. MySQL server version */
     long           node_id;        /**< Node id, server_id for M/S or local_index for Galera */
     int            rlag;           /**< Replication Lag for Master / Slave replication */
+    int            rlag_ms;        /**< Replication Lag in milliseconds */
+    int            load_score;     /**< Load from 0 to MXS_SERVER_LOAD_MAX, set by the monitor */
+    SERVER_LOAD_METRICS load_metrics; /**< Load metrics sampled by the monitor */
+    char           gtid_pos[MAX_SERVER_GTID_POS_LEN]; /**< gtid_current_pos of the server, set by
+                                                       * the monitor, empty if not known */
     unsigned long  node_ts;        /**< Last timestamp set from M/S monitor module */
     SERVER_PARAM   *parameters;    /**< Parameters of a server that may be used to weight routing decisions */
+    SERVER_VARIABLE *variables;    /**< Global variables read by the monitor, protected by lock */
+    int            n_variables;    /**< Number of cached variables */
+    int            collation_id;   /**< ID of the collation_server collation, 0 if not known */
     long           master_id;      /**< Master server id of this node */
     int            depth;          /**< Replication level in the tree */
     long           slaves[MAX_NUM_SLAVES]; /**< Slaves of this node */
     bool           master_err_is_logged; /*< If node failed, this indicates whether it is logged */
     DCB            **persistent;    /**< List of unused persistent connections to the server */
     long           persistpoolmax; /**< Maximum size of persistent connections pool */
+    long           persistpoolmin; /**< Number of connections kept in each thread's pool */
     long           persistmaxtime; /**< Maximum number of seconds connection can live */
     int            persistmax;     /**< Maximum pool size actually achieved since startup */
+    bool           compression;    /**< Use the compressed protocol if the server supports it */
+    int            max_concurrent_queries; /**< Maximum number of concurrent operations,
+                                            * zero for no limit */
+    int            max_queue_time; /**< Milliseconds an operation may wait for a free slot,
+                                    * zero for no limit */
+    SPINLOCK       queue_lock;     /**< Protects the queue of waiting operations */
+    SERVER_WAITER  *queue_head;    /**< The oldest waiting operation */
+    SERVER_WAITER  *queue_tail;    /**< The newest waiting operation */
     uint8_t        charset;        /**< Default server character set */
     bool           is_active;      /**< Server is active and has not been "destroyed" */
     bool           created_online; /**< Whether this server was created after startup */
@@ -200,6 +267,42 @@ enum
     (SERVER_RUNNING|SERVER_SLAVE_OF_EXTERNAL_MASTER)) == \
     (SERVER_RUNNING|SERVER_SLAVE_OF_EXTERNAL_MASTER))
 
+/** server is too loaded to be given any more work if others are available */
+#define SERVER_IS_OVERLOADED(server) ((server)->load_score >= MXS_SERVER_LOAD_MAX)
+
+/**
+ * The state of one server in a server snapshot
+ */
+typedef struct mxs_server_snapshot_entry
+{
+    SERVER        *server;     /**< The server, only for identifying the entry */
+    unsigned int  status;      /**< Status flag bitmap of the server */
+    int           rlag;        /**< Replication lag in seconds */
+    int           rlag_ms;     /**< Replication lag in milliseconds */
+    int           load_score;  /**< Load score set by the monitor */
+    SERVER_LOAD_METRICS load_metrics; /**< Load metrics sampled by the monitor */
+    long          node_id;     /**< Node id, server_id for M/S or local_index for Galera */
+    long          master_id;   /**< Master server id of this node */
+    int           depth;       /**< Replication level in the tree */
+} MXS_SERVER_SNAPSHOT_ENTRY;
+
+/**
+ * An immutable snapshot of the state of all servers
+ *
+ * The monitors publish a new snapshot at the end of each monitoring round.
+ * Readers see the state of each server as its monitor left it at the end of a
+ * round, never a half-updated one. A snapshot must be released with
+ * server_snapshot_release() after use and it must not be used after that.
+ */
+typedef struct mxs_server_snapshot
+{
+    int64_t                   version;      /**< Incremented on every change */
+    int                       n_servers;    /**< Number of servers */
+    MXS_SERVER_SNAPSHOT_ENTRY *servers;     /**< The servers in server list order */
+    int64_t                   retire_epoch; /**< Epoch in which the snapshot was replaced */
+    struct mxs_server_snapshot *next_retired; /**< Next replaced snapshot */
+} MXS_SERVER_SNAPSHOT;
+
 /**
  * @brief Allocate a new server
  *
@@ -272,6 +375,18 @@ bool server_remove_parameter(SERVER *server, const char *name);
  */
 bool server_is_mxs_service(const SERVER *server);
 
+/**
+ * @brief Add a response time sample to a server
+ *
+ * The average is exponentially weighted, the weight of a new sample is 1/8.
+ * The sample is also recorded in the response time histogram of the server.
+ * The function may be called concurrently from several threads.
+ *
+ * @param server Server that replied
+ * @param usecs  Time in microseconds the server took to reply
+ */
+void server_add_response_time(SERVER *server, int64_t usecs);
+
 extern int server_free(SERVER *server);
 extern SERVER *server_find_by_unique_name(const char *name);
 extern SERVER *server_find(const char *servname, unsigned short port);
@@ -291,6 +406,210 @@ extern bool server_set_version_string(SERVER* server, const char* string);
 extern void server_set_status(SERVER *server, int bit);
 extern void server_clear_status(SERVER *server, int bit);
 
+/**
+ * @brief Get the server status version
+ *
+ * The version changes whenever the status of a server or the set of servers
+ * used by a service changes. Routers can compare it to a stored value to know
+ * when a cached view of the eligible servers must be rebuilt.
+ *
+ * @return The current server status version
+ */
+extern int server_status_version();
+
+/**
+ * @brief Signal a change in the status of the servers
+ *
+ * Increments the value returned by server_status_version().
+ */
+extern void server_status_changed();
+
+/**
+ * @brief Set the load score of a server
+ *
+ * The score is clamped between 0 and MXS_SERVER_LOAD_MAX. If the server
+ * becomes or stops being overloaded, the server status version changes.
+ *
+ * @param server The server
+ * @param score  The new load score
+ */
+extern void server_set_load_score(SERVER *server, int score);
+
+/**
+ * @brief Clear the load metrics of a server
+ *
+ * All metrics are set to MXS_LOAD_METRIC_UNDEFINED.
+ *
+ * @param server The server
+ */
+extern void server_clear_load_metrics(SERVER *server);
+
+/**
+ * @brief Replace the cached global variables of a server
+ *
+ * The server takes the ownership of the variables and their strings.
+ *
+ * @param server       The server
+ * @param variables    The variables, allocated with MXS_MALLOC, NULL for none
+ * @param n_variables  Number of variables
+ * @param collation_id ID of the collation in collation_server, 0 if not known
+ */
+extern void server_set_variables(SERVER *server, SERVER_VARIABLE *variables, int n_variables,
+                                 int collation_id);
+
+/**
+ * @brief Get the value of a cached global variable of a server
+ *
+ * @param server The server
+ * @param name   Name of the variable, compared case insensitively
+ * @param dest   Where the value is copied
+ * @param size   Size of @c dest
+ * @return True if the variable is cached and its value fits into @c dest
+ */
+extern bool server_get_variable(SERVER *server, const char *name, char *dest, size_t size);
+
+/**
+ * @brief Get the collation ID of the cached collation_server variable
+ *
+ * @param server The server
+ * @return The ID or 0 if not known
+ */
+extern int server_get_collation_id(SERVER *server);
+
+/**
+ * @brief Start an operation on a server
+ *
+ * The operation is counted even if the server would have no free slots.
+ *
+ * @param server The server
+ */
+extern void server_start_op(SERVER *server);
+
+/**
+ * @brief Reserve a slot for an operation on a server
+ *
+ * If the server limits the number of concurrent operations and has no free
+ * slots or other operations are already waiting, the waiter is queued. The
+ * waiters are admitted in the order they were queued by calling their admit
+ * function in their polling thread. The slot that was handed over is then
+ * owned by the waiter and it is released with server_end_op().
+ *
+ * @param server The server
+ * @param waiter The waiter to queue if no slot is free, its @c thread,
+ *               @c admit and @c data must be set
+ * @return True if a slot was reserved, false if the waiter was queued
+ */
+extern bool server_reserve_op(SERVER *server, SERVER_WAITER *waiter);
+
+/**
+ * @brief End an operation on a server
+ *
+ * The slot of the operation is handed over to the oldest waiter, if any.
+ *
+ * @param server The server
+ */
+extern void server_end_op(SERVER *server);
+
+/**
+ * @brief Remove a waiter from the queue of a server
+ *
+ * @param server    The server
+ * @param waiter    The waiter
+ * @param timed_out Whether the waiter is removed because it waited too long
+ * @return True if the waiter was removed, false if a slot has already been
+ *         handed over to it and its admit function is yet to be called
+ */
+extern bool server_cancel_op(SERVER *server, SERVER_WAITER *waiter, bool timed_out);
+
+/**
+ * @brief Set the GTID position of a server
+ *
+ * A position that does not fit in MAX_SERVER_GTID_POS_LEN is not stored.
+ *
+ * @param server   The server
+ * @param gtid_pos The gtid_current_pos of the server, NULL if not known
+ */
+extern void server_set_gtid_pos(SERVER *server, const char *gtid_pos);
+
+/**
+ * @brief Check whether a server has replicated a GTID
+ *
+ * The server has replicated a GTID list if its GTID position has, for each
+ * replication domain in the list, a sequence number at least as large.
+ *
+ * @param server The server
+ * @param gtid   A GTID list in the form domain-server_id-sequence[,...]
+ * @return True if the GTID position of the server is known and has reached @c gtid
+ */
+extern bool server_gtid_pos_reached(SERVER *server, const char *gtid);
+
+/**
+ * @brief Publish a new server snapshot
+ *
+ * The given servers are copied from their current state. The other servers
+ * keep the state they had in the previous snapshot, so the servers that are
+ * being updated by other monitors are not copied half-updated. If nothing
+ * changed, the previous snapshot stays current.
+ *
+ * The caller must hold the locks of the given servers.
+ *
+ * @param servers   The servers whose state is up to date
+ * @param n_servers Number of servers
+ */
+extern void server_snapshot_publish(SERVER * const *servers, int n_servers);
+
+/**
+ * @brief Get the current server snapshot
+ *
+ * No locks are taken. The snapshot stays valid until it is released, even if
+ * a new snapshot is published in the meantime. A thread can hold several
+ * snapshots at the same time.
+ *
+ * @return The current snapshot or NULL if none has been published yet
+ */
+extern const MXS_SERVER_SNAPSHOT* server_snapshot_acquire();
+
+/**
+ * @brief Release a server snapshot
+ *
+ * @param snapshot Snapshot returned by server_snapshot_acquire(), can be NULL
+ */
+extern void server_snapshot_release(const MXS_SERVER_SNAPSHOT *snapshot);
+
+/**
+ * @brief Find a server in a snapshot
+ *
+ * @param snapshot The snapshot
+ * @param server   The server to find
+ * @return The entry of the server or NULL if the snapshot does not have it
+ */
+extern const MXS_SERVER_SNAPSHOT_ENTRY* server_snapshot_find(const MXS_SERVER_SNAPSHOT *snapshot,
+                                                              const SERVER *server);
+
+/**
+ * @brief Get the state of a server from a snapshot
+ *
+ * The returned entry can be used with the SERVER_IS_ macros in place of the
+ * server.
+ *
+ * @param snapshot The snapshot, can be NULL
+ * @param server   The server
+ * @return The state of the server in the snapshot or its current state if
+ * there is no snapshot or the snapshot does not have the server
+ */
+extern MXS_SERVER_SNAPSHOT_ENTRY server_snapshot_state(const MXS_SERVER_SNAPSHOT *snapshot,
+                                                       SERVER *server);
+
+/**
+ * @brief Get the version of the current server snapshot
+ *
+ * This can be used to check whether the snapshot has changed without
+ * acquiring it.
+ *
+ * @return The version of the current snapshot, 0 if none has been published
+ */
+extern int64_t server_snapshot_version();
+
 extern void printServer(const SERVER *);
 extern void printAllServers();
 extern void dprintAllServers(DCB *);
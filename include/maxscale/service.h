@@ -27,8 +27,10 @@
 #include <maxscale/listener.h>
 #include <maxscale/filter.h>
 #include <maxscale/hashtable.h>
+#include <maxscale/histogram.h>
 #include <maxscale/resultset.h>
 #include <maxscale/config.h>
+#include <maxscale/statistics.h>
 #include <maxscale/queuemanager.h>
 #include <openssl/crypto.h>
 #include <openssl/ssl.h>
@@ -49,8 +51,9 @@ typedef struct
 {
     time_t started;         /**< The time when the service was started */
     int    n_failed_starts; /**< Number of times this service has failed to start */
-    int    n_sessions;      /**< Number of sessions created on service since start */
-    int    n_current;       /**< Current number of sessions */
+    ts_stats_t n_sessions;  /**< Number of sessions created on service since start */
+    ts_stats_t n_current;   /**< Current number of sessions */
+    HISTOGRAM response_times; /**< Response times in microseconds */
 } SERVICE_STATS;
 
 /**
@@ -127,6 +130,7 @@ typedef struct service
     char **routerOptions;              /**< Router specific option strings */
     struct mxs_router_object *router;  /**< The router we are using */
     void *router_instance;             /**< The router instance for this service */
+    void **router_thread_instances;    /**< The data of the router instance for each thread */
     char *version_string;              /**< version string for this service listeners */
     SERVER_REF *dbref;                 /**< server references */
     int         n_dbref;               /**< Number of server references */
@@ -275,6 +279,38 @@ int   service_refresh_users(SERVICE *service);
  */
 void service_print_users(DCB *, const SERVICE *);
 
+/**
+ * @brief Add a response time sample to a service
+ *
+ * The function may be called concurrently from several threads.
+ *
+ * @param service Service whose session got the reply
+ * @param usecs   Time in microseconds it took to get the complete reply
+ */
+void service_add_response_time(SERVICE *service, int64_t usecs);
+
+/**
+ * @brief Get the data of the router instance for the calling thread
+ *
+ * @param service The service
+ * @return The data created by the createThreadInstance entry point of the
+ *         router for the calling polling thread, NULL if the router does not
+ *         have the entry point or if the caller is not a polling thread
+ */
+void* service_get_thread_instance(const SERVICE *service);
+
+/**
+ * @brief Get the data of the router instance for a particular thread
+ *
+ * The data of the thread must not be modified by other threads. This is
+ * intended for aggregating the data in the diagnostics.
+ *
+ * @param service   The service
+ * @param thread_id ID of the polling thread, less than config_threadcount()
+ * @return The data of the thread or NULL if the router does not have any
+ */
+void* service_get_thread_instance_of(const SERVICE *service, int thread_id);
+
 void       dprintAllServices(DCB *dcb);
 void       dprintService(DCB *dcb, SERVICE *service);
 void       dListServices(DCB *dcb);
@@ -23,6 +23,7 @@
 #include <maxscale/atomic.h>
 #include <maxscale/buffer.h>
 #include <maxscale/log_manager.h>
+#include <maxscale/probes.h>
 #include <maxscale/resultset.h>
 #include <maxscale/spinlock.h>
 
@@ -79,17 +80,6 @@ typedef struct
     time_t          connect;        /**< Time when the session was started */
 } MXS_SESSION_STATS;
 
-/**
- * Structure used to track the filter instances and sessions of the filters
- * that are in use within a session.
- */
-typedef struct
-{
-    struct mxs_filter_def *filter;
-    void *instance;
-    void *session;
-} SESSION_FILTER;
-
 /**
  * The downstream element in the filter chain. This may refer to
  * another filter or to a router.
@@ -113,6 +103,22 @@ typedef struct mxs_upstream
     int32_t (*error)(void *instance, void *session, void *);
 } MXS_UPSTREAM;
 
+/**
+ * Structure used to track the filter instances and sessions of the filters
+ * that are in use within a session.
+ */
+typedef struct
+{
+    struct mxs_filter_def *filter;
+    void *instance;
+    void *session;
+    uint64_t       commands;  /**< Commands routed through the filter, 0 for all */
+    bool           continued; /**< The previous packet continues in the next one */
+    bool           routed;    /**< The previous packet was routed through the filter */
+    MXS_DOWNSTREAM down;      /**< The filter, if the commands are limited */
+    MXS_DOWNSTREAM bypass;    /**< The element after the filter */
+} SESSION_FILTER;
+
 /**
  * The session status block
  *
@@ -146,17 +152,33 @@ typedef struct session
         const struct server *target; /**< Where the statement was sent */
     } stmt;  /**< Current statement being executed */
     bool qualifies_for_pooling; /**< Whether this session qualifies for the connection pool */
+    struct hashtable *ps_infos; /**< Prepared statements of the session, see qc_ps_store() */
+    bool registered;            /**< Whether the session is in the session registry */
+    struct session *registry_next; /**< Next session in the same registry bucket */
+    struct mxs_session_trace *trace; /**< Statement tracing state, NULL if not traced */
     skygw_chk_t     ses_chk_tail;
 } MXS_SESSION;
 
+/**
+ * Route the incoming data to the first element in the pipeline of filters
+ * and routers. This is the session_route_query probe point.
+ *
+ * @param sess The session
+ * @param buf  The data to route
+ * @return The return value of the routeQuery entry point
+ */
+static inline int mxs_session_route_query(MXS_SESSION *sess, GWBUF *buf)
+{
+    MXS_PROBE2(session_route_query, sess->ses_id, GWBUF_LENGTH(buf));
+    return sess->head.routeQuery(sess->head.instance, sess->head.session, buf);
+}
+
 /**
  * A convenience macro that can be used by the protocol modules to route
  * the incoming data to the first element in the pipeline of filters and
  * routers.
  */
-#define MXS_SESSION_ROUTE_QUERY(sess, buf)                          \
-    ((sess)->head.routeQuery)((sess)->head.instance,            \
-                              (sess)->head.session, (buf))
+#define MXS_SESSION_ROUTE_QUERY(sess, buf) mxs_session_route_query(sess, buf)
 /**
  * A convenience macro that can be used by the router modules to route
  * the replies to the first element in the pipeline of filters and
@@ -326,9 +348,33 @@ static inline bool session_set_autocommit(MXS_SESSION* ses, bool autocommit)
 MXS_SESSION* session_get_by_id(int id);
 
 /**
- * @brief Release a session reference
+ * @brief Call a function for each session
+ *
+ * The sessions are visited in the order of the session registry. The function
+ * is called while the registry is locked so it must not create or free
+ * sessions.
+ *
+ * @param func Function to call, iteration stops if it returns false
+ * @param data User data passed to the function
+ * @return True if all sessions were visited
+ */
+bool session_foreach(bool (*func)(MXS_SESSION *session, void *data), void *data);
+
+/**
+ * @brief Get a session reference
+ *
+ * This creates an additional reference to a session which allows it to live
+ * as long as it is needed.
+ *
+ * @param session Session reference to get
+ * @return Reference to a MXS_SESSION
  *
- * This function is public only because the tee-filter uses it.
+ * @note The caller must free the session reference by calling session_put_ref
+ */
+MXS_SESSION* session_get_ref(MXS_SESSION *session);
+
+/**
+ * @brief Release a session reference
  *
  * @param session Session reference to release
  */
@@ -17,49 +17,46 @@
  *
  * Spinlock implementation for MaxScale.
  *
- * Spinlocks are cheap locks that can be used to protect short code blocks, they are
- * generally wasteful as any blocked threads will spin, consuming CPU cycles, waiting
- * for the lock to be released. However they are useful in that they do not involve
- * system calls and are light weight when the expected wait time for a lock is low.
+ * Spinlocks are cheap locks that can be used to protect short code blocks. An
+ * uncontended acquisition is a single atomic operation. A contended acquisition
+ * first spins for a while, the number of spins adapting to how long the lock
+ * has recently been held, and then parks the thread on a futex so that a
+ * preempted lock holder does not cause the waiters to burn whole timeslices.
+ *
+ * Every lock counts its acquisitions, its contended acquisitions and the total
+ * time spent waiting for it. Long lived locks can be registered with a name,
+ * the statistics of the registered locks are shown by maxadmin and maxinfo.
  */
 
 #include <maxscale/cdefs.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <maxscale/debug.h>
 
 MXS_BEGIN_DECLS
 
+/**
+ * The lock statistics are always collected, this only enables the output of
+ * the statistics of individual locks in the binlog and avro router diagnostics.
+ */
 #define SPINLOCK_PROFILE 0
 
 /**
  * The spinlock structure.
  *
- * In normal builds the structure merely contains a lock value which
- * is 0 if the spinlock is not taken and greater than zero if it is held.
- *
- * In builds with the SPINLOCK_PROFILE option set this structure also holds
- * a number of profile related fields that count the number of spins, number
- * of waiting threads and the number of times the lock has been acquired.
+ * The lock value is 0 if the spinlock is not taken, 1 if it is held and 2
+ * if it is held and there may be threads parked waiting for it.
  */
 typedef struct spinlock
 {
     int lock;              /*< Is the lock held? */
-#if SPINLOCK_PROFILE
-    uint64_t spins;        /*< Number of spins on this lock */
-    uint64_t maxspins;     /*< Max no of spins to acquire lock */
+    int spins;             /*< Adaptive estimate of the spins needed to acquire the lock */
     uint64_t acquired;     /*< No. of times lock was acquired */
-    uint64_t waiting;      /*< No. of threads acquiring this lock */
-    uint64_t max_waiting;  /*< Max no of threads waiting for lock */
     uint64_t contended;    /*< No. of times acquire was contended */
-    THREAD owner;          /*< Last owner of this lock */
-#endif
+    uint64_t wait_ns;      /*< Total time spent waiting for the lock in nanoseconds */
 } SPINLOCK;
 
-#if SPINLOCK_PROFILE
-#define SPINLOCK_INIT { 0, 0, 0, 0, 0, 0, 0, 0 }
-#else
-#define SPINLOCK_INIT { 0 }
-#endif
+#define SPINLOCK_INIT { 0, 0, 0, 0, 0 }
 
 /**
  * Debugging macro for testing the state of a spinlock.
@@ -98,8 +95,7 @@ extern bool spinlock_acquire_nowait(const SPINLOCK *lock);
 extern void spinlock_release(const SPINLOCK *lock);
 
 /**
- * Report statistics on a spinlock. This only has an effect if the
- * spinlock code has been compiled with the SPINLOCK_PROFILE option set.
+ * Report statistics on a spinlock.
  *
  * NB A callback function is used to return the data rather than
  * merely printing to a DCB in order to avoid a dependency on the DCB
@@ -112,4 +108,23 @@ extern void spinlock_release(const SPINLOCK *lock);
  */
 extern void spinlock_stats(const SPINLOCK *lock, void (*reporter)(void *, char *, int), void *hdl);
 
+/**
+ * Register a long lived spinlock for reporting. Registering the same lock
+ * again has no effect. A registered lock must not be freed.
+ *
+ * @param lock The spinlock to register
+ * @param name The name of the lock, must be a string literal
+ */
+extern void spinlock_register(SPINLOCK *lock, const char *name);
+
+/**
+ * Call a function for each registered spinlock.
+ *
+ * @param func Function called with the name of the lock, the lock and @c data,
+ *             returning false stops the iteration
+ * @param data User data passed to the function
+ */
+extern void spinlock_foreach_registered(bool (*func)(const char *name, const SPINLOCK *lock, void *data),
+                                        void *data);
+
 MXS_END_DECLS
@@ -0,0 +1,230 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file spsc_ring.h A single producer, single consumer ring buffer
+ *
+ * The ring holds variable length records. One thread reserves and commits the
+ * records and one other thread reads and consumes them, neither side takes a
+ * lock or waits for the other. A record is never split at the end of the ring,
+ * the rest of the ring is skipped instead.
+ *
+ * The usual pattern is one ring for each polling thread, allocated with
+ * mxs_spsc_rings_alloc(), and a consumer thread, started with
+ * mxs_spsc_consumer_start(), that drains all of them. The polling threads find
+ * their own ring with mxs_spsc_rings_get(). The consumer thread sleeps while
+ * the rings are empty and a commit wakes it up.
+ */
+
+#include <maxscale/cdefs.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+MXS_BEGIN_DECLS
+
+/** The records start at multiples of this */
+#define MXS_SPSC_RING_ALIGN 8
+
+/** The smallest size of a ring */
+#define MXS_SPSC_RING_MIN_SIZE 4096
+
+/** The thread that drains a set of rings */
+typedef struct mxs_spsc_consumer MXS_SPSC_CONSUMER;
+
+typedef struct mxs_spsc_ring
+{
+    char     *data;      /*< The buffer */
+    uint64_t mask;       /*< Size of the buffer minus one, the size is a power of two */
+    uint64_t head;       /*< Bytes committed in total, updated by the producer */
+    uint64_t pending;    /*< Start of the reserved record, producer only */
+    uint64_t n_records;  /*< Records committed in total, updated by the producer */
+    MXS_SPSC_CONSUMER *consumer; /*< The consumer thread to wake up, or NULL */
+    char     pad[16];    /*< Keeps the tail in a cache line of its own */
+    uint64_t tail;       /*< Bytes consumed in total, updated by the consumer */
+    char     pad2[56];   /*< Keeps the next ring off the cache line of the tail */
+} MXS_SPSC_RING;
+
+/**
+ * @brief Initialize a ring
+ *
+ * @param ring The ring
+ * @param size Minimum size of the ring in bytes, rounded up to a power of two
+ * @return True if the buffer of the ring was allocated
+ */
+bool mxs_spsc_ring_init(MXS_SPSC_RING *ring, size_t size);
+
+/**
+ * @brief Free the buffer of a ring
+ *
+ * @param ring The ring
+ */
+void mxs_spsc_ring_destroy(MXS_SPSC_RING *ring);
+
+/**
+ * @brief Allocate a ring for each polling thread
+ *
+ * @param n_rings Number of rings, usually config_threadcount()
+ * @param size    Minimum size of each ring in bytes
+ * @return The rings or NULL if memory allocation failed
+ */
+MXS_SPSC_RING* mxs_spsc_rings_alloc(int n_rings, size_t size);
+
+/**
+ * @brief Free rings allocated with mxs_spsc_rings_alloc()
+ *
+ * @param rings   The rings, may be NULL
+ * @param n_rings Number of rings
+ */
+void mxs_spsc_rings_free(MXS_SPSC_RING *rings, int n_rings);
+
+/**
+ * @brief Get the ring of the calling polling thread
+ *
+ * @param rings   Rings allocated with mxs_spsc_rings_alloc()
+ * @param n_rings Number of rings
+ * @return The ring of the thread or NULL if the caller is not a polling thread
+ *         that has a ring
+ */
+MXS_SPSC_RING* mxs_spsc_rings_get(MXS_SPSC_RING *rings, int n_rings);
+
+/**
+ * @brief Reserve space for a record
+ *
+ * Called by the producer. The record is not visible to the consumer until it
+ * is committed and only one record can be reserved at a time.
+ *
+ * @param ring The ring
+ * @param len  Maximum length of the record
+ * @return The record, aligned to MXS_SPSC_RING_ALIGN bytes, or NULL if the ring
+ *         does not have enough free space
+ */
+void* mxs_spsc_ring_reserve(MXS_SPSC_RING *ring, size_t len);
+
+/**
+ * @brief Make the reserved record visible to the consumer
+ *
+ * If the consumer thread of the ring is sleeping, it is woken up.
+ *
+ * @param ring The ring
+ * @param len  Actual length of the record, at most the reserved length
+ * @return Number of bytes in use after the commit
+ */
+size_t mxs_spsc_ring_commit(MXS_SPSC_RING *ring, size_t len);
+
+/**
+ * @brief Get the oldest record
+ *
+ * Called by the consumer. The record stays in the ring until it is consumed.
+ *
+ * @param ring The ring
+ * @param len  The length of the record is stored here
+ * @return The record or NULL if the ring is empty
+ */
+void* mxs_spsc_ring_peek(MXS_SPSC_RING *ring, size_t *len);
+
+/**
+ * @brief Remove the record returned by mxs_spsc_ring_peek()
+ *
+ * @param ring The ring
+ */
+void mxs_spsc_ring_consume(MXS_SPSC_RING *ring);
+
+/**
+ * @brief Get the number of bytes in use
+ *
+ * @param ring The ring
+ * @return Bytes taken by the committed records that have not been consumed
+ */
+size_t mxs_spsc_ring_used(MXS_SPSC_RING *ring);
+
+/**
+ * @brief Check whether all committed records have been consumed
+ *
+ * @param ring The ring
+ * @return True if the ring is empty
+ */
+bool mxs_spsc_ring_is_empty(MXS_SPSC_RING *ring);
+
+/**
+ * Called by a consumer thread for each of its rings in turn
+ *
+ * @param ring The ring to drain
+ * @param data The data given to mxs_spsc_consumer_start()
+ * @return Number of records processed, the ring is drained again right away
+ *         if this is not zero
+ */
+typedef uint64_t (*mxs_spsc_drain_cb)(MXS_SPSC_RING *ring, void *data);
+
+/**
+ * Called by a consumer thread after it has drained all of its rings
+ *
+ * @param consumer The consumer
+ * @param data     The data given to mxs_spsc_consumer_start()
+ * @return The longest time in milliseconds the thread may sleep before it
+ *         drains the rings again, or -1 to sleep until it is woken up
+ */
+typedef int (*mxs_spsc_flush_cb)(MXS_SPSC_CONSUMER *consumer, void *data);
+
+/**
+ * @brief Start a thread that drains a set of rings
+ *
+ * The thread calls @c drain for each ring and then @c flush, and repeats this
+ * until the rings are empty. It then sleeps until a record is committed, the
+ * thread is woken up with mxs_spsc_consumer_wake(), the file descriptor given
+ * to mxs_spsc_consumer_watch() becomes readable or the time returned by
+ * @c flush has passed.
+ *
+ * @param rings   The rings, only one consumer may drain them
+ * @param n_rings Number of rings
+ * @param drain   Drains one ring
+ * @param flush   Called after each round over the rings, may be NULL
+ * @param data    Passed to the callbacks
+ * @return The consumer or NULL if the thread could not be started
+ */
+MXS_SPSC_CONSUMER* mxs_spsc_consumer_start(MXS_SPSC_RING *rings, int n_rings,
+                                           mxs_spsc_drain_cb drain, mxs_spsc_flush_cb flush,
+                                           void *data);
+
+/**
+ * @brief Wake up a consumer thread
+ *
+ * Used when the callbacks have work to do that is not in the rings, for
+ * instance when a log file should be reopened.
+ *
+ * @param consumer The consumer
+ */
+void mxs_spsc_consumer_wake(MXS_SPSC_CONSUMER *consumer);
+
+/**
+ * @brief Wake up a consumer thread also when a file descriptor is readable
+ *
+ * Only called from the callbacks of the consumer.
+ *
+ * @param consumer The consumer
+ * @param fd       The file descriptor or -1 to stop watching it
+ */
+void mxs_spsc_consumer_watch(MXS_SPSC_CONSUMER *consumer, int fd);
+
+/**
+ * @brief Stop a consumer thread
+ *
+ * The thread drains the rings once more before it stops. The producers must
+ * not commit records any more.
+ *
+ * @param consumer The consumer, may be NULL
+ */
+void mxs_spsc_consumer_stop(MXS_SPSC_CONSUMER *consumer);
+
+MXS_END_DECLS
@@ -20,6 +20,7 @@
 
 #include <maxscale/cdefs.h>
 #include <maxscale/protocol.h>
+#include <maxscale/spinlock.h>
 #include <openssl/crypto.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
@@ -66,6 +67,12 @@ typedef struct ssl_listener
     char *ssl_ca_cert;                  /*< SSL CA certificate */
     bool ssl_init_done;                 /*< If SSL has already been initialized for this service */
     bool ssl_verify_peer_certificate;   /*< Enable peer certificate verification */
+    bool ssl_ktls;                      /*< Offload the encryption to the kernel */
+    SSL_SESSION *session;               /*< Session that connections to a server resume */
+    SPINLOCK session_lock;              /*< Protects session */
+    uint64_t n_full_handshakes;         /*< Number of full handshakes */
+    uint64_t n_resumed_handshakes;      /*< Number of handshakes that resumed a session */
+    uint64_t n_ktls_connections;        /*< Number of connections encrypted by the kernel */
     struct ssl_listener
         *next;          /*< Next SSL configuration, currently used to store obsolete configurations */
 } SSL_LISTENER;
@@ -78,4 +85,35 @@ bool ssl_required_but_not_negotiated(struct dcb *dcb);
 const char* ssl_method_type_to_string(ssl_method_type_t method_type);
 void write_ssl_config(int fd, SSL_LISTENER* ssl);
 
+/**
+ * @brief Count a completed handshake of a connection
+ *
+ * @param ssl The SSL configuration of the connection
+ * @param con The connection
+ */
+void ssl_count_handshake(SSL_LISTENER *ssl, SSL *con);
+
+/**
+ * @brief Set the session that a connection to a server resumes
+ *
+ * Does nothing if no session has been stored for the server yet.
+ *
+ * @param ssl The SSL configuration of the server
+ * @param con The connection, before the handshake
+ */
+void ssl_set_client_session(SSL_LISTENER *ssl, SSL *con);
+
+/**
+ * @brief Check whether the kernel encrypts the data written to a connection
+ *
+ * With kernel TLS, the application data can be written to the socket as-is
+ * once the handshake is done. Counts the connection if the kernel does the
+ * encryption.
+ *
+ * @param ssl The SSL configuration of the connection
+ * @param con The connection, after the handshake
+ * @return True if plain writes to the socket are encrypted by the kernel
+ */
+bool ssl_kernel_tls_send(SSL_LISTENER *ssl, SSL *con);
+
 MXS_END_DECLS
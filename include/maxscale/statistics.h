@@ -35,6 +35,10 @@ enum ts_stats_type
 /**
  * @brief Allocate a new statistics object
  *
+ * The object has one cache line for each polling thread and one that the
+ * other threads share. It can be allocated once the number of threads is
+ * known, also while the configuration is being loaded.
+ *
  * @return New statistics object or NULL if memory allocation failed
  */
 ts_stats_t ts_stats_alloc();
@@ -57,6 +61,26 @@ void ts_stats_free(ts_stats_t stats);
  */
 int64_t ts_stats_get(ts_stats_t stats, enum ts_stats_type type);
 
+/**
+ * @brief Get the sum of the values of all threads
+ *
+ * @param stats Statistics to read
+ * @return Sum of the values
+ */
+int64_t ts_stats_sum(ts_stats_t stats);
+
+/**
+ * @brief Add to the value of the calling thread
+ *
+ * This is the sharded counter of the hot paths: a polling thread changes the
+ * value in its own cache line without atomic operations, the other threads
+ * change the shared line atomically. The total is read with ts_stats_sum().
+ *
+ * @param stats Statistics to add to
+ * @param value Value to add, can be negative
+ */
+void ts_stats_add(ts_stats_t stats, int64_t value);
+
 /**
  * @brief Increment thread statistics by one
  *
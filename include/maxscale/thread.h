@@ -36,4 +36,16 @@ extern THREAD *thread_start(THREAD *thd, void (*entry)(void *), void *arg);
 extern void thread_wait(THREAD thd);
 extern void thread_millisleep(int ms);
 
+/**
+ * Call a function for each item of an array using a bounded number of
+ * threads. The function returns once all the calls have returned. If no
+ * threads can be started, the calls are made by the calling thread.
+ *
+ * @param entry       The function to call
+ * @param items       The items to pass to the function
+ * @param n_items     Number of items
+ * @param max_threads Maximum number of threads to use
+ */
+extern void thread_run_parallel(void (*entry)(void *), void **items, int n_items, int max_threads);
+
 MXS_END_DECLS
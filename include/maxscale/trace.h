@@ -0,0 +1,55 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file trace.h Sampled tracing of statements
+ *
+ * When the global parameter @c query_trace_interval is set, one in every
+ * that many statements is traced on its way through the filters and the
+ * router to the backend and back to the client. The trace is attached to
+ * the buffer of the statement, so a router can mark the points that only it
+ * knows about. Marking a buffer that is not traced costs nothing more than
+ * looking up the buffer object.
+ */
+
+#include <maxscale/cdefs.h>
+#include <maxscale/buffer.h>
+
+MXS_BEGIN_DECLS
+
+/**
+ * The points of a trace that are common to all statements
+ */
+typedef enum
+{
+    MXS_TRACE_ROUTER,        /**< The statement reached the router */
+    MXS_TRACE_ROUTED,        /**< The router chose the target of the statement */
+    MXS_TRACE_BACKEND_WRITE, /**< The statement was written to a backend */
+    MXS_TRACE_FIRST_REPLY,   /**< The first bytes of the reply were read */
+    MXS_TRACE_LAST_REPLY,    /**< The last bytes of the reply were written to the client */
+    MXS_TRACE_N_POINTS
+} mxs_trace_point_t;
+
+/**
+ * Mark a point in the trace of a statement
+ *
+ * Only the first time a point is marked is recorded. Does nothing if the
+ * statement is not traced.
+ *
+ * @param buf   The buffer of the statement
+ * @param point The point that was reached
+ */
+void mxs_trace_mark(GWBUF *buf, mxs_trace_point_t point);
+
+MXS_END_DECLS
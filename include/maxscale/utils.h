@@ -21,6 +21,7 @@
 #include <math.h>
 #include <stdlib.h>
 #include <netinet/in.h>
+#include <sys/un.h>
 
 MXS_BEGIN_DECLS
 
@@ -69,6 +70,23 @@ void utils_end();
 int open_network_socket(enum mxs_socket_type type, struct sockaddr_storage *addr,
                         const char *host, uint16_t port);
 
+/**
+ * @brief Create a Unix domain socket and a socket configuration
+ *
+ * The Unix domain socket counterpart of open_network_socket(). The socket is
+ * non-blocking and @c addr can be given to either bind() or connect().
+ *
+ * @param type Type of the socket, either MXS_SOCKET_LISTENER for a listener
+ *             socket or MXS_SOCKET_NETWORK for a connection socket
+ * @param addr Pointer to a struct sockaddr_un where the socket configuration
+ *             is stored
+ * @param path The path of the socket
+ *
+ * @return The opened socket or -1 on failure
+ */
+int open_unix_socket(enum mxs_socket_type type, struct sockaddr_un *addr,
+                     const char *path);
+
 int setnonblocking(int fd);
 char  *gw_strend(register const char *s);
 static char gw_randomchar();
@@ -136,4 +154,18 @@ bool mxs_mkdir_all(const char *path, int mask);
 
 long get_processor_count();
 
+/**
+ * @brief Get the time of the monotonic clock in milliseconds
+ *
+ * @return Milliseconds since an unspecified point in the past
+ */
+uint64_t mxs_clock_ms();
+
+/**
+ * @brief Get the time of the monotonic clock in microseconds
+ *
+ * @return Microseconds since an unspecified point in the past
+ */
+uint64_t mxs_clock_us();
+
 MXS_END_DECLS
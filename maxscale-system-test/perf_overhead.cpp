@@ -0,0 +1,399 @@
+/**
+ * @file perf_overhead.cpp Measure the overhead MaxScale adds to the queries and fail if it is over budget
+ *
+ * - create a sysbench style table directly on the master
+ * - run each workload directly against the master to get the baseline
+ * - run the same workloads through readconnroute, readwritesplit, readwritesplit with the cache,
+ *   dbfwfilter and masking filters, and schemarouter
+ * - compute the added latency per query and the CPU time of MaxScale per 1000 queries per second
+ * - store the results as JSON and check them against the budgets
+ *
+ * The budgets are read from the environment:
+ *
+ * - perf_max_overhead_us: latency in microseconds that MaxScale may add to a query (default 500)
+ * - perf_max_cpu_per_1k_qps: fraction of a core that MaxScale may use per 1000 queries per
+ *   second (default 0.25)
+ * - perf_max_overhead_us_<service> and perf_max_cpu_per_1k_qps_<service> override the budgets
+ *   of one service, where service is readconnroute, readwritesplit, cache, dbfw, masking or
+ *   schemarouter
+ * - perf_threads and perf_duration set the number of client threads (default 16) and the
+ *   duration of each run in seconds (default 30)
+ * - perf_results is the file the JSON results are written to (default perf_overhead.json)
+ *
+ * The cache rules do not match the workload table, so the cost of the cache on the query path is
+ * measured instead of the speed of cache hits.
+ */
+
+#include "testconnections.h"
+#include "fw_copy_rules.h"
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+/** Rows in the workload table */
+const int table_rows = 10000;
+
+/** Resolution and range of the latency histogram */
+const int bucket_us = 10;
+const int n_buckets = 10000;
+
+struct Workload
+{
+    const char *name;
+    int queries;                                /**< Queries per transaction */
+    void (*run)(MYSQL *conn, unsigned *seed);   /**< Execute one transaction */
+};
+
+struct Service
+{
+    const char *name;   /**< Name used in the results and the budget variables */
+    int port;           /**< Port of the MaxScale listener */
+};
+
+struct Result
+{
+    long queries = 0;
+    long errors = 0;
+    double elapsed = 0;
+    double qps = 0;
+    double avg_us = 0;
+    double p99_us = 0;
+    double cpu_seconds = 0;
+};
+
+void query(MYSQL *conn, const char *sql)
+{
+    if (mysql_query(conn, sql) == 0)
+    {
+        MYSQL_RES *res = mysql_store_result(conn);
+
+        if (res)
+        {
+            mysql_free_result(res);
+        }
+    }
+}
+
+int random_id(unsigned *seed)
+{
+    return 1 + rand_r(seed) % table_rows;
+}
+
+void point_select(MYSQL *conn, unsigned *seed)
+{
+    char sql[128];
+    sprintf(sql, "SELECT c FROM test.perf_sbtest WHERE id = %d", random_id(seed));
+    query(conn, sql);
+}
+
+void range_select(MYSQL *conn, unsigned *seed)
+{
+    char sql[128];
+    int id = random_id(seed);
+    sprintf(sql, "SELECT c FROM test.perf_sbtest WHERE id BETWEEN %d AND %d", id, id + 99);
+    query(conn, sql);
+}
+
+void read_write(MYSQL *conn, unsigned *seed)
+{
+    char sql[128];
+    int id = random_id(seed);
+    query(conn, "BEGIN");
+    sprintf(sql, "SELECT c FROM test.perf_sbtest WHERE id = %d", id);
+    query(conn, sql);
+    sprintf(sql, "UPDATE test.perf_sbtest SET k = k + 1 WHERE id = %d", id);
+    query(conn, sql);
+    query(conn, "COMMIT");
+}
+
+const Workload workloads[] =
+{
+    {"point_select", 1, point_select},
+    {"range_select", 1, range_select},
+    {"read_write", 4, read_write}
+};
+
+double budget(const char *name, const char *service, double def)
+{
+    std::string var = std::string(name) + "_" + service;
+    const char *value = getenv(var.c_str());
+
+    if (value == NULL)
+    {
+        value = getenv(name);
+    }
+
+    return value ? atof(value) : def;
+}
+
+int env_int(const char *name, int def)
+{
+    const char *value = getenv(name);
+    return value ? atoi(value) : def;
+}
+
+/**
+ * Get the CPU time MaxScale has used
+ *
+ * @return CPU time in seconds or -1 on error
+ */
+double maxscale_cpu(TestConnections& test)
+{
+    double rval = -1;
+    char *out = test.ssh_maxscale_output(false, "cat /proc/$(pidof maxscale)/stat | cut -d ' ' -f 14,15;"
+                                         "getconf CLK_TCK");
+    long utime, stime, ticks;
+
+    if (out && sscanf(out, "%ld %ld %ld", &utime, &stime, &ticks) == 3 && ticks > 0)
+    {
+        rval = (double)(utime + stime) / ticks;
+    }
+
+    free(out);
+    return rval;
+}
+
+/**
+ * Run a workload with a number of threads
+ *
+ * @param test     The test
+ * @param workload The workload
+ * @param ip       Address to connect to
+ * @param port     Port to connect to
+ * @param user     User name
+ * @param password Password
+ * @param maxscale Whether the CPU time of MaxScale is measured
+ * @return The result of the run
+ */
+Result run(TestConnections& test, const Workload& workload, const char *ip, int port,
+           const char *user, const char *password, bool maxscale)
+{
+    int n_threads = env_int("perf_threads", test.smoke ? 4 : 16);
+    int duration = env_int("perf_duration", test.smoke ? 5 : 30);
+    std::vector<std::thread> threads;
+    std::vector<std::vector<long>> buckets(n_threads, std::vector<long>(n_buckets + 1));
+    std::vector<double> total_us(n_threads);
+    std::vector<long> counts(n_threads);
+    std::atomic<long> errors(0);
+    std::atomic<bool> running(true);
+    Result result;
+
+    double cpu_start = maxscale ? maxscale_cpu(test) : 0;
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        threads.emplace_back([&, i]()
+        {
+            MYSQL *conn = open_conn(port, ip, user, password, false);
+            unsigned seed = i + 1;
+
+            if (conn == NULL || mysql_errno(conn))
+            {
+                errors++;
+                mysql_close(conn);
+                return;
+            }
+
+            while (running)
+            {
+                auto begin = std::chrono::steady_clock::now();
+                workload.run(conn, &seed);
+                auto end = std::chrono::steady_clock::now();
+
+                if (mysql_errno(conn))
+                {
+                    errors++;
+                    continue;
+                }
+
+                double us = std::chrono::duration<double, std::micro>(end - begin).count() / workload.queries;
+                int bucket = us / bucket_us;
+                buckets[i][bucket < n_buckets ? bucket : n_buckets] += workload.queries;
+                total_us[i] += us * workload.queries;
+                counts[i] += workload.queries;
+            }
+
+            mysql_close(conn);
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::seconds(duration));
+    running = false;
+
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (maxscale)
+    {
+        double cpu_end = maxscale_cpu(test);
+        result.cpu_seconds = cpu_start >= 0 && cpu_end >= 0 ? cpu_end - cpu_start : -1;
+    }
+
+    double sum = 0;
+    std::vector<long> merged(n_buckets + 1);
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        result.queries += counts[i];
+        sum += total_us[i];
+
+        for (int b = 0; b <= n_buckets; b++)
+        {
+            merged[b] += buckets[i][b];
+        }
+    }
+
+    result.errors = errors;
+    result.elapsed = elapsed;
+    result.qps = result.queries / elapsed;
+    result.avg_us = result.queries ? sum / result.queries : 0;
+
+    long seen = 0;
+
+    for (int b = 0; b <= n_buckets; b++)
+    {
+        seen += merged[b];
+
+        if (seen >= result.queries * 0.99)
+        {
+            result.p99_us = (b + 1) * bucket_us;
+            break;
+        }
+    }
+
+    test.tprintf("%s on %s:%d: %.0f qps, avg %.1f us, p99 %.0f us, %ld errors\n",
+                 workload.name, ip, port, result.qps, result.avg_us, result.p99_us, result.errors);
+    return result;
+}
+
+void prepare_table(TestConnections& test)
+{
+    MYSQL *conn = test.repl->nodes[0];
+    std::string sql = "INSERT INTO test.perf_sbtest VALUES ";
+
+    execute_query(conn, "DROP TABLE IF EXISTS test.perf_sbtest");
+    test.try_query(conn, "CREATE TABLE test.perf_sbtest (id INT PRIMARY KEY, k INT NOT NULL, "
+                   "c CHAR(120) NOT NULL, pad CHAR(60) NOT NULL)");
+
+    for (int i = 1; i <= table_rows; i++)
+    {
+        char row[256];
+        sprintf(row, "%s(%d, %d, '%0120d', '%060d')", i % 1000 == 1 ? "" : ", ", i, i % 1000, i, i);
+        sql += row;
+
+        if (i % 1000 == 0 || i == table_rows)
+        {
+            test.try_query(conn, "%s", sql.c_str());
+            sql = "INSERT INTO test.perf_sbtest VALUES ";
+        }
+    }
+
+    test.repl->sync_slaves();
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    TestConnections::skip_maxscale_start(true);
+    TestConnections test(argc, argv);
+
+    test.stop_maxscale();
+    test.copy_to_maxscale("./performance/perf_cache_rules.json", "~/");
+    test.copy_to_maxscale("./performance/perf_masking_rules.json", "~/");
+    copy_rules(&test, (char *)"perf_fw_rules", "./performance");
+    test.start_maxscale();
+    sleep(5);
+
+    const Service services[] =
+    {
+        {"readconnroute", test.readconn_master_port},
+        {"readwritesplit", test.rwsplit_port},
+        {"cache", 4016},
+        {"dbfw", 4017},
+        {"masking", 4018},
+        {"schemarouter", 4010}
+    };
+
+    test.set_timeout(300);
+    test.repl->connect();
+    prepare_table(test);
+    test.stop_timeout();
+
+    std::string json = "{\n  \"workloads\": [";
+    const char *wsep = "";
+
+    for (const Workload& w : workloads)
+    {
+        Result base = run(test, w, test.repl->IP[0], test.repl->port[0],
+                          test.repl->user_name, test.repl->password, false);
+        test.add_result(base.queries == 0, "No queries were executed directly on the backend\n");
+
+        char buf[1024];
+        sprintf(buf, "%s\n    {\n      \"name\": \"%s\",\n      \"baseline\": {\"qps\": %.1f, \"avg_us\": %.1f,"
+                " \"p99_us\": %.0f},\n      \"services\": [", wsep, w.name, base.qps, base.avg_us, base.p99_us);
+        json += buf;
+        wsep = ",";
+        const char *ssep = "";
+
+        for (const Service& s : services)
+        {
+            Result res = run(test, w, test.maxscale_IP, s.port,
+                             test.maxscale_user, test.maxscale_password, true);
+            double overhead_us = res.avg_us - base.avg_us;
+            double cpu_per_1k = res.cpu_seconds >= 0 && res.qps > 0 ?
+                                res.cpu_seconds / res.elapsed / (res.qps / 1000) : -1;
+            double max_overhead = budget("perf_max_overhead_us", s.name, 500);
+            double max_cpu = budget("perf_max_cpu_per_1k_qps", s.name, 0.25);
+
+            sprintf(buf, "%s\n        {\"service\": \"%s\", \"qps\": %.1f, \"avg_us\": %.1f, \"p99_us\": %.0f,"
+                    " \"errors\": %ld, \"overhead_us\": %.1f, \"cpu_per_1k_qps\": %.4f,"
+                    " \"max_overhead_us\": %.1f, \"max_cpu_per_1k_qps\": %.4f}",
+                    ssep, s.name, res.qps, res.avg_us, res.p99_us, res.errors, overhead_us,
+                    cpu_per_1k, max_overhead, max_cpu);
+            json += buf;
+            ssep = ",";
+
+            test.add_result(res.queries == 0, "%s: no queries were executed through %s\n", w.name, s.name);
+            test.add_result(res.errors > 0, "%s: %ld queries failed through %s\n", w.name, res.errors, s.name);
+            test.add_result(overhead_us > max_overhead, "%s: %s adds %.1f us per query, the budget is %.1f us\n",
+                            w.name, s.name, overhead_us, max_overhead);
+            test.add_result(cpu_per_1k > max_cpu, "%s: %s uses %.4f cores per 1000 qps, the budget is %.4f\n",
+                            w.name, s.name, cpu_per_1k, max_cpu);
+        }
+
+        json += "\n      ]\n    }";
+    }
+
+    json += "\n  ]\n}\n";
+
+    const char *path = getenv("perf_results") ? getenv("perf_results") : "perf_overhead.json";
+    FILE *file = fopen(path, "w");
+
+    if (file)
+    {
+        fputs(json.c_str(), file);
+        fclose(file);
+        test.tprintf("Results written to %s\n", path);
+    }
+    else
+    {
+        test.add_result(true, "Failed to write results to %s\n", path);
+    }
+
+    execute_query(test.repl->nodes[0], "DROP TABLE test.perf_sbtest");
+    test.repl->close_connections();
+    test.check_maxscale_alive();
+    return test.global_result;
+}
@@ -52,6 +52,25 @@ static inline bool qc_info_was_parsed(qc_parse_result_t status)
 /**
  * Contains information about a particular query.
  */
+/**
+ * A block of the memory of a QC_SQLITE_INFO. The strings and arrays of the
+ * information are allocated from blocks that all are released at once when
+ * the information is freed.
+ */
+typedef struct qc_sqlite_block
+{
+    struct qc_sqlite_block* next;    // The previous, full block.
+    size_t size;                     // The size of data.
+    size_t used;                     // The used bytes of data.
+    char data[];                     // The memory.
+} QC_SQLITE_BLOCK;
+
+enum
+{
+    QC_SQLITE_BLOCK_SIZE = 1024,     // The size of the block allocated with the information.
+    QC_SQLITE_ALIGNMENT  = sizeof(void*)
+};
+
 typedef struct qc_sqlite_info
 {
     qc_parse_result_t status;        // The validity of the information in this structure.
@@ -85,6 +104,7 @@ typedef struct qc_sqlite_info
     size_t function_infos_len;       // The used entries in function_infos.
     size_t function_infos_capacity;  // The capacity of the function_infos array.
     bool initializing;               // Whether we are initializing sqlite3.
+    QC_SQLITE_BLOCK* blocks;         // The memory of the strings and arrays, the current block first.
 } QC_SQLITE_INFO;
 
 typedef enum qc_log_level
@@ -114,6 +134,7 @@ static thread_local struct
     bool initialized;
     sqlite3* db;      // Thread specific database handle.
     QC_SQLITE_INFO* info;
+    QC_SQLITE_INFO* spare; // A freed info that is reused by the next parse.
 } this_thread;
 
 /**
@@ -129,12 +150,15 @@ typedef enum qc_token_position
 
 static void buffer_object_free(void* data);
 static char** copy_string_array(char** strings, int* pn);
-static void enlarge_string_array(size_t n, size_t len, char*** ppzStrings, size_t* pCapacity);
+static void enlarge_string_array(QC_SQLITE_INFO* info,
+                                 size_t n, size_t len, char*** ppzStrings, size_t* pCapacity);
 static bool ensure_query_is_parsed(GWBUF* query, uint32_t collect);
-static void free_field_infos(QC_FIELD_INFO* infos, size_t n_infos);
-static void free_string_array(char** sa);
 static QC_SQLITE_INFO* get_query_info(GWBUF* query, uint32_t collect);
 static QC_SQLITE_INFO* info_alloc(uint32_t collect);
+static void* info_alloc_memory(QC_SQLITE_INFO* info, size_t size);
+static void* info_realloc_memory(QC_SQLITE_INFO* info, void* ptr, size_t old_size, size_t size);
+static char* info_strdup(QC_SQLITE_INFO* info, const char* s);
+static char* info_strndup(QC_SQLITE_INFO* info, const char* s, size_t len);
 static void info_finish(QC_SQLITE_INFO* info);
 static void info_free(QC_SQLITE_INFO* info);
 static QC_SQLITE_INFO* info_init(QC_SQLITE_INFO* info, uint32_t collect);
@@ -257,13 +281,16 @@ static char** copy_string_array(char** strings, int* pn)
     return ss;
 }
 
-static void enlarge_string_array(size_t n, size_t len, char*** ppzStrings, size_t* pCapacity)
+static void enlarge_string_array(QC_SQLITE_INFO* info,
+                                 size_t n, size_t len, char*** ppzStrings, size_t* pCapacity)
 {
     if (len + n >= *pCapacity)
     {
         int capacity = *pCapacity ? *pCapacity * 2 : 4;
 
-        *ppzStrings = (char**) MXS_REALLOC(*ppzStrings, capacity * sizeof(char**));
+        *ppzStrings = (char**) info_realloc_memory(info, *ppzStrings,
+                                                   *pCapacity * sizeof(char*),
+                                                   capacity * sizeof(char*));
         MXS_ABORT_IF_NULL(*ppzStrings);
         *pCapacity = capacity;
     }
@@ -281,83 +308,162 @@ static bool ensure_query_is_parsed(GWBUF* query, uint32_t collect)
     return parsed;
 }
 
-static void free_field_infos(QC_FIELD_INFO* infos, size_t n_infos)
+static QC_SQLITE_INFO* get_query_info(GWBUF* query, uint32_t collect)
 {
-    if (infos)
-    {
-        for (int i = 0; i < n_infos; ++i)
-        {
-            MXS_FREE(infos[i].database);
-            MXS_FREE(infos[i].table);
-            MXS_FREE(infos[i].column);
-        }
+    QC_SQLITE_INFO* info = NULL;
 
-        MXS_FREE(infos);
+    if (ensure_query_is_parsed(query, collect))
+    {
+        info = (QC_SQLITE_INFO*) gwbuf_get_buffer_object_data(query, GWBUF_PARSING_INFO);
+        ss_dassert(info);
     }
+
+    return info;
 }
 
-static void free_function_infos(QC_FUNCTION_INFO* infos, size_t n_infos)
+static QC_SQLITE_INFO* info_alloc(uint32_t collect)
 {
-    if (infos)
+    QC_SQLITE_INFO* info = this_thread.spare;
+    QC_SQLITE_BLOCK* block;
+
+    if (info)
     {
-        for (int i = 0; i < n_infos; ++i)
-        {
-            MXS_FREE(infos[i].name);
-        }
+        this_thread.spare = NULL;
+        block = info->blocks;
+    }
+    else
+    {
+        // The first block is allocated together with the information.
+        info = MXS_MALLOC(sizeof(*info) + sizeof(QC_SQLITE_BLOCK) + QC_SQLITE_BLOCK_SIZE);
+        MXS_ABORT_IF_NULL(info);
 
-        MXS_FREE(infos);
+        block = (QC_SQLITE_BLOCK*)(info + 1);
+        block->next = NULL;
+        block->size = QC_SQLITE_BLOCK_SIZE;
     }
+
+    block->used = 0;
+
+    info_init(info, collect);
+    info->blocks = block;
+
+    return info;
 }
 
-static void free_string_array(char** sa)
+/**
+ * Allocates memory that is released when the information is freed.
+ *
+ * @param info  The information that owns the memory.
+ * @param size  The number of bytes needed.
+ *
+ * @return The memory or NULL if an allocation failed.
+ */
+static void* info_alloc_memory(QC_SQLITE_INFO* info, size_t size)
 {
-    if (sa)
+    size = (size + QC_SQLITE_ALIGNMENT - 1) & ~(QC_SQLITE_ALIGNMENT - 1);
+
+    QC_SQLITE_BLOCK* block = info->blocks;
+
+    if (block->size - block->used < size)
     {
-        char** s = sa;
+        size_t block_size = block->size * 2;
 
-        while (*s)
+        while (block_size < size)
         {
-            free(*s);
-            ++s;
+            block_size *= 2;
         }
 
-        free(sa);
+        block = MXS_MALLOC(sizeof(QC_SQLITE_BLOCK) + block_size);
+
+        if (!block)
+        {
+            return NULL;
+        }
+
+        block->next = info->blocks;
+        block->size = block_size;
+        block->used = 0;
+        info->blocks = block;
     }
+
+    void* ptr = block->data + block->used;
+    block->used += size;
+
+    return ptr;
 }
 
-static QC_SQLITE_INFO* get_query_info(GWBUF* query, uint32_t collect)
+/**
+ * Enlarges memory allocated with info_alloc_memory(). The latest allocation
+ * is extended in place, if possible.
+ *
+ * @param info      The information that owns the memory.
+ * @param ptr       The memory to enlarge, or NULL.
+ * @param old_size  The size @c ptr was allocated with.
+ * @param size      The new size.
+ *
+ * @return The memory or NULL if an allocation failed, in which case @c ptr
+ *         remains valid.
+ */
+static void* info_realloc_memory(QC_SQLITE_INFO* info, void* ptr, size_t old_size, size_t size)
 {
-    QC_SQLITE_INFO* info = NULL;
+    QC_SQLITE_BLOCK* block = info->blocks;
+    size_t aligned_old_size = (old_size + QC_SQLITE_ALIGNMENT - 1) & ~(QC_SQLITE_ALIGNMENT - 1);
+    size_t aligned_size = (size + QC_SQLITE_ALIGNMENT - 1) & ~(QC_SQLITE_ALIGNMENT - 1);
 
-    if (ensure_query_is_parsed(query, collect))
+    if (ptr &&
+        (char*)ptr + aligned_old_size == block->data + block->used &&
+        block->used - aligned_old_size + aligned_size <= block->size)
     {
-        info = (QC_SQLITE_INFO*) gwbuf_get_buffer_object_data(query, GWBUF_PARSING_INFO);
-        ss_dassert(info);
+        block->used = block->used - aligned_old_size + aligned_size;
+        return ptr;
     }
 
-    return info;
+    void* rval = info_alloc_memory(info, size);
+
+    if (rval && ptr)
+    {
+        memcpy(rval, ptr, old_size);
+    }
+
+    return rval;
 }
 
-static QC_SQLITE_INFO* info_alloc(uint32_t collect)
+static char* info_strndup(QC_SQLITE_INFO* info, const char* s, size_t len)
 {
-    QC_SQLITE_INFO* info = MXS_MALLOC(sizeof(*info));
-    MXS_ABORT_IF_NULL(info);
+    char* rval = info_alloc_memory(info, len + 1);
 
-    info_init(info, collect);
+    if (rval)
+    {
+        memcpy(rval, s, len);
+        rval[len] = 0;
+    }
 
-    return info;
+    return rval;
+}
+
+static char* info_strdup(QC_SQLITE_INFO* info, const char* s)
+{
+    return info_strndup(info, s, strlen(s));
 }
 
 static void info_finish(QC_SQLITE_INFO* info)
 {
-    free_string_array(info->table_names);
-    free_string_array(info->table_fullnames);
-    free(info->created_table_name);
-    free_string_array(info->database_names);
-    free(info->prepare_name);
     gwbuf_free(info->preparable_stmt);
-    free_field_infos(info->field_infos, info->field_infos_len);
-    free_function_infos(info->function_infos, info->function_infos_len);
+    info->preparable_stmt = NULL;
+
+    // All but the first block, which was allocated together with the
+    // information, are freed.
+    QC_SQLITE_BLOCK* block = info->blocks;
+
+    while (block->next)
+    {
+        QC_SQLITE_BLOCK* next = block->next;
+        MXS_FREE(block);
+        block = next;
+    }
+
+    block->used = 0;
+    info->blocks = block;
 }
 
 static void info_free(QC_SQLITE_INFO* info)
@@ -365,7 +471,17 @@ static void info_free(QC_SQLITE_INFO* info)
     if (info)
     {
         info_finish(info);
-        free(info);
+
+        // The information of a thread is kept for the next parse, whichever
+        // thread it was allocated by.
+        if (this_thread.initialized && !this_thread.spare)
+        {
+            this_thread.spare = info;
+        }
+        else
+        {
+            MXS_FREE(info);
+        }
     }
 }
 
@@ -753,7 +869,9 @@ static void update_field_info(QC_SQLITE_INFO* info,
             else
             {
                 size_t capacity = info->field_infos_capacity ? 2 * info->field_infos_capacity : 8;
-                field_infos = MXS_REALLOC(info->field_infos, capacity * sizeof(QC_FIELD_INFO));
+                field_infos = info_realloc_memory(info, info->field_infos,
+                                                  info->field_infos_capacity * sizeof(QC_FIELD_INFO),
+                                                  capacity * sizeof(QC_FIELD_INFO));
 
                 if (field_infos)
                 {
@@ -771,10 +889,10 @@ static void update_field_info(QC_SQLITE_INFO* info,
     // If field_infos is NULL, then the field was found and has already been noted.
     if (field_infos)
     {
-        item.database = item.database ? MXS_STRDUP(item.database) : NULL;
-        item.table = item.table ? MXS_STRDUP(item.table) : NULL;
+        item.database = item.database ? info_strdup(info, item.database) : NULL;
+        item.table = item.table ? info_strdup(info, item.table) : NULL;
         ss_dassert(item.column);
-        item.column = MXS_STRDUP(item.column);
+        item.column = info_strdup(info, item.column);
 
         // We are happy if we at least could dup the column.
 
@@ -822,7 +940,9 @@ static void update_function_info(QC_SQLITE_INFO* info,
         else
         {
             size_t capacity = info->function_infos_capacity ? 2 * info->function_infos_capacity : 8;
-            function_infos = MXS_REALLOC(info->function_infos, capacity * sizeof(QC_FUNCTION_INFO));
+            function_infos = info_realloc_memory(info, info->function_infos,
+                                                 info->function_infos_capacity * sizeof(QC_FUNCTION_INFO),
+                                                 capacity * sizeof(QC_FUNCTION_INFO));
 
             if (function_infos)
             {
@@ -840,7 +960,7 @@ static void update_function_info(QC_SQLITE_INFO* info,
     if (function_infos)
     {
         ss_dassert(item.name);
-        item.name = MXS_STRDUP(item.name);
+        item.name = info_strdup(info, item.name);
 
         if (item.name)
         {
@@ -1288,11 +1408,11 @@ static void update_field_infos_from_select_compound(QC_SQLITE_INFO* info,
 
 static void update_database_names(QC_SQLITE_INFO* info, const char* zDatabase)
 {
-    char* zCopy = MXS_STRDUP(zDatabase);
+    char* zCopy = info_strdup(info, zDatabase);
     MXS_ABORT_IF_NULL(zCopy);
     exposed_sqlite3Dequote(zCopy);
 
-    enlarge_string_array(1, info->database_names_len,
+    enlarge_string_array(info, 1, info->database_names_len,
                          &info->database_names, &info->database_names_capacity);
     info->database_names[info->database_names_len++] = zCopy;
     info->database_names[info->database_names_len] = NULL;
@@ -1302,18 +1422,19 @@ static void update_names(QC_SQLITE_INFO* info, const char* zDatabase, const char
 {
     if ((info->collect & QC_COLLECT_TABLES) && !(info->collected & QC_COLLECT_TABLES))
     {
-        char* zCopy = MXS_STRDUP(zTable);
+        char* zCopy = info_strdup(info, zTable);
         MXS_ABORT_IF_NULL(zCopy);
         // TODO: Is this call really needed. Check also sqlite3Dequote.
         exposed_sqlite3Dequote(zCopy);
 
-        enlarge_string_array(1, info->table_names_len, &info->table_names, &info->table_names_capacity);
+        enlarge_string_array(info, 1, info->table_names_len,
+                             &info->table_names, &info->table_names_capacity);
         info->table_names[info->table_names_len++] = zCopy;
         info->table_names[info->table_names_len] = NULL;
 
         if (zDatabase)
         {
-            zCopy = MXS_MALLOC(strlen(zDatabase) + 1 + strlen(zTable) + 1);
+            zCopy = info_alloc_memory(info, strlen(zDatabase) + 1 + strlen(zTable) + 1);
             MXS_ABORT_IF_NULL(zCopy);
 
             strcpy(zCopy, zDatabase);
@@ -1321,13 +1442,9 @@ static void update_names(QC_SQLITE_INFO* info, const char* zDatabase, const char
             strcat(zCopy, zTable);
             exposed_sqlite3Dequote(zCopy);
         }
-        else
-        {
-            zCopy = MXS_STRDUP(zCopy);
-            MXS_ABORT_IF_NULL(zCopy);
-        }
+        // Otherwise the full name is the name, and the string is shared.
 
-        enlarge_string_array(1, info->table_fullnames_len,
+        enlarge_string_array(info, 1, info->table_fullnames_len,
                              &info->table_fullnames, &info->table_fullnames_capacity);
         info->table_fullnames[info->table_fullnames_len++] = zCopy;
         info->table_fullnames[info->table_fullnames_len] = NULL;
@@ -1831,7 +1948,7 @@ void mxs_sqlite3StartTable(Parse *pParse,   /* Parser context */
             // this information already.
             if (!info->created_table_name)
             {
-                info->created_table_name = MXS_STRDUP(info->table_names[0]);
+                info->created_table_name = info_strdup(info, info->table_names[0]);
                 MXS_ABORT_IF_NULL(info->created_table_name);
             }
             else
@@ -2012,12 +2129,7 @@ void maxscaleDeallocate(Parse* pParse, Token* pName)
     // this information already.
     if (!info->prepare_name)
     {
-        info->prepare_name = MXS_MALLOC(pName->n + 1);
-        if (info->prepare_name)
-        {
-            memcpy(info->prepare_name, pName->z, pName->n);
-            info->prepare_name[pName->n] = 0;
-        }
+        info->prepare_name = info_strndup(info, pName->z, pName->n);
     }
     else
     {
@@ -2065,12 +2177,7 @@ void maxscaleExecute(Parse* pParse, Token* pName)
     // this information already.
     if (!info->prepare_name)
     {
-        info->prepare_name = MXS_MALLOC(pName->n + 1);
-        if (info->prepare_name)
-        {
-            memcpy(info->prepare_name, pName->z, pName->n);
-            info->prepare_name[pName->n] = 0;
-        }
+        info->prepare_name = info_strndup(info, pName->z, pName->n);
     }
     else
     {
@@ -2445,12 +2552,7 @@ void maxscalePrepare(Parse* pParse, Token* pName, Token* pStmt)
     // this information already.
     if (!info->prepare_name)
     {
-        info->prepare_name = MXS_MALLOC(pName->n + 1);
-        if (info->prepare_name)
-        {
-            memcpy(info->prepare_name, pName->z, pName->n);
-            info->prepare_name[pName->n] = 0;
-        }
+        info->prepare_name = info_strndup(info, pName->z, pName->n);
 
         size_t preparable_stmt_len = pStmt->n - 2;
         size_t payload_len = 1 + preparable_stmt_len;
@@ -3147,6 +3249,9 @@ static void qc_sqlite_thread_end(void)
 
     this_thread.db = NULL;
     this_thread.initialized = false;
+
+    MXS_FREE(this_thread.spare);
+    this_thread.spare = NULL;
 }
 
 static int32_t qc_sqlite_parse(GWBUF* query, uint32_t collect, int32_t* result)
@@ -0,0 +1,412 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <malloc.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <maxscale/paths.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/modutil.h>
+#include <maxscale/protocol/mysql.h>
+#include <maxscale/query_classifier.h>
+#include "testreader.hh"
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::ifstream;
+using std::istream;
+using std::string;
+using std::vector;
+
+namespace
+{
+
+char USAGE[] =
+    "usage: qc_bench [-c classifier] [-A args] [-t threads] [-r rounds] [-m collect] [-q] file...\n\n"
+    "-c    the classifier, default qc_sqlite\n"
+    "-A    arguments for the classifier\n"
+    "-t    the number of threads, default 1\n"
+    "-r    how many times each thread classifies the statements, default 1\n"
+    "-m    what to collect: 'essentials', 'all' or a sum of 1 (tables),\n"
+    "      2 (databases), 4 (fields) and 8 (functions), default essentials\n"
+    "-q    the files are query logs of qlafilter instead of test files\n\n"
+    "Each thread classifies all the statements in the files. The throughput is\n"
+    "the number of statements classified per second by all threads together.\n"
+    "The latency is the time of qc_parse and of freeing the parsing information.\n"
+    "The memory per parse is the growth of the heap per parsed statement.\n";
+
+struct Config
+{
+    int n_threads;
+    int n_rounds;
+    uint32_t collect;
+} config = { 1,                    // n_threads
+             1,                    // n_rounds
+             QC_COLLECT_ESSENTIALS // collect
+};
+
+/** The statements of the corpus */
+vector<string> statements;
+
+struct ThreadData
+{
+    pthread_t tid;
+    bool ok;
+    vector<uint64_t> latencies; /*< Nanoseconds per statement */
+};
+
+uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+bool parse_collect(const char* zCollect, uint32_t* pCollect)
+{
+    bool rv = true;
+
+    if (strcmp(zCollect, "essentials") == 0)
+    {
+        *pCollect = QC_COLLECT_ESSENTIALS;
+    }
+    else if (strcmp(zCollect, "all") == 0)
+    {
+        *pCollect = QC_COLLECT_ALL;
+    }
+    else
+    {
+        char* zEnd;
+        long collect = strtol(zCollect, &zEnd, 0);
+
+        rv = *zEnd == 0 && collect >= 0 && (collect & ~QC_COLLECT_ALL) == 0;
+        *pCollect = collect;
+    }
+
+    return rv;
+}
+
+/**
+ * Reads the statements of a test file.
+ */
+bool read_test_file(istream& in)
+{
+    maxscale::TestReader reader(in);
+    maxscale::TestReader::result_t result;
+    string stmt;
+
+    while ((result = reader.get_statement(stmt)) == maxscale::TestReader::RESULT_STMT)
+    {
+        statements.push_back(stmt);
+    }
+
+    return result == maxscale::TestReader::RESULT_EOF;
+}
+
+/**
+ * Reads the statements of a query log. The first line is the header that
+ * names the fields, of which the query is the last one.
+ */
+bool read_qla_log(istream& in)
+{
+    string line;
+
+    if (!getline(in, line))
+    {
+        return false;
+    }
+
+    size_t n_fields = std::count(line.begin(), line.end(), ',');
+
+    const string query("Query");
+
+    if (line.length() < query.length() ||
+        line.compare(line.length() - query.length(), query.length(), query) != 0)
+    {
+        cerr << "error: The query is not the last field of the log." << endl;
+        return false;
+    }
+
+    while (getline(in, line))
+    {
+        size_t pos = 0;
+
+        for (size_t i = 0; i < n_fields && pos != string::npos; ++i)
+        {
+            pos = line.find(',', pos);
+
+            if (pos != string::npos)
+            {
+                ++pos;
+            }
+        }
+
+        if (pos != string::npos && pos < line.length())
+        {
+            statements.push_back(line.substr(pos));
+        }
+    }
+
+    return true;
+}
+
+bool classify(ThreadData* pData)
+{
+    for (int round = 0; round < config.n_rounds; ++round)
+    {
+        for (vector<string>::const_iterator i = statements.begin(); i != statements.end(); ++i)
+        {
+            GWBUF* pStmt = modutil_create_query(i->c_str());
+
+            if (!pStmt)
+            {
+                return false;
+            }
+
+            uint64_t start = now_ns();
+            qc_parse(pStmt, config.collect);
+            gwbuf_free(pStmt);
+            pData->latencies.push_back(now_ns() - start);
+        }
+    }
+
+    return true;
+}
+
+void* thread_main(void* pArg)
+{
+    ThreadData* pData = static_cast<ThreadData*>(pArg);
+
+    if (qc_thread_init(QC_INIT_BOTH))
+    {
+        pData->ok = classify(pData);
+        qc_thread_end(QC_INIT_BOTH);
+    }
+    else
+    {
+        cerr << "error: Could not initialize the classifier in a thread." << endl;
+    }
+
+    return NULL;
+}
+
+/**
+ * Measures how much the heap grows per parsed statement. The buffers are
+ * kept until all statements have been parsed, so that the memory of the
+ * parsing information is not reused. The main thread was initialized by
+ * qc_process_init().
+ */
+double measure_memory()
+{
+    vector<GWBUF*> stmts;
+    stmts.reserve(statements.size());
+
+    for (vector<string>::const_iterator i = statements.begin(); i != statements.end(); ++i)
+    {
+        stmts.push_back(modutil_create_query(i->c_str()));
+    }
+
+    struct mallinfo before = mallinfo();
+
+    for (vector<GWBUF*>::iterator i = stmts.begin(); i != stmts.end(); ++i)
+    {
+        qc_parse(*i, config.collect);
+    }
+
+    struct mallinfo after = mallinfo();
+
+    for (vector<GWBUF*>::iterator i = stmts.begin(); i != stmts.end(); ++i)
+    {
+        gwbuf_free(*i);
+    }
+
+    return (double)(after.uordblks - before.uordblks) / stmts.size();
+}
+
+int run()
+{
+    vector<ThreadData> threads(config.n_threads);
+
+    for (vector<ThreadData>::iterator i = threads.begin(); i != threads.end(); ++i)
+    {
+        i->ok = false;
+        i->latencies.reserve(statements.size() * config.n_rounds);
+    }
+
+    uint64_t start = now_ns();
+
+    for (vector<ThreadData>::iterator i = threads.begin(); i != threads.end(); ++i)
+    {
+        if (pthread_create(&i->tid, NULL, thread_main, &*i) != 0)
+        {
+            cerr << "error: Could not create a thread." << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    vector<uint64_t> latencies;
+    bool ok = true;
+
+    for (vector<ThreadData>::iterator i = threads.begin(); i != threads.end(); ++i)
+    {
+        pthread_join(i->tid, NULL);
+        ok = ok && i->ok;
+        latencies.insert(latencies.end(), i->latencies.begin(), i->latencies.end());
+    }
+
+    uint64_t duration = now_ns() - start;
+
+    if (!ok || latencies.empty())
+    {
+        cerr << "error: The classification failed." << endl;
+        return EXIT_FAILURE;
+    }
+
+    double bytes_per_parse = measure_memory();
+
+    std::sort(latencies.begin(), latencies.end());
+
+    uint64_t total = 0;
+
+    for (vector<uint64_t>::const_iterator i = latencies.begin(); i != latencies.end(); ++i)
+    {
+        total += *i;
+    }
+
+    double qps = latencies.size() * 1000000000.0 / duration;
+
+    cout << std::fixed << std::setprecision(1)
+         << "Statements        : " << statements.size() << endl
+         << "Threads           : " << config.n_threads << endl
+         << "Classifications   : " << latencies.size() << endl
+         << "Throughput (qps)  : " << qps << endl
+         << "Per thread (qps)  : " << qps / config.n_threads << endl
+         << "Mean latency (us) : " << total / 1000.0 / latencies.size() << endl
+         << "p50 latency (us)  : " << latencies[latencies.size() / 2] / 1000.0 << endl
+         << "p99 latency (us)  : " << latencies[latencies.size() * 99 / 100] / 1000.0 << endl
+         << "Max latency (us)  : " << latencies.back() / 1000.0 << endl
+         << "Memory/parse (B)  : " << bytes_per_parse << endl;
+
+    return EXIT_SUCCESS;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    int rc = EXIT_SUCCESS;
+
+    const char* zClassifier = "qc_sqlite";
+    const char* zClassifierArgs = NULL;
+    bool qla_log = false;
+
+    int c;
+    while ((c = getopt(argc, argv, "c:A:t:r:m:q")) != -1)
+    {
+        switch (c)
+        {
+        case 'c':
+            zClassifier = optarg;
+            break;
+
+        case 'A':
+            zClassifierArgs = optarg;
+            break;
+
+        case 't':
+            config.n_threads = atoi(optarg);
+            break;
+
+        case 'r':
+            config.n_rounds = atoi(optarg);
+            break;
+
+        case 'm':
+            if (!parse_collect(optarg, &config.collect))
+            {
+                rc = EXIT_FAILURE;
+            }
+            break;
+
+        case 'q':
+            qla_log = true;
+            break;
+
+        default:
+            rc = EXIT_FAILURE;
+            break;
+        };
+    }
+
+    if (rc != EXIT_SUCCESS || optind == argc || config.n_threads <= 0 || config.n_rounds <= 0)
+    {
+        cout << USAGE << endl;
+        return EXIT_FAILURE;
+    }
+
+    maxscale::TestReader::init();
+
+    for (int i = optind; i < argc; ++i)
+    {
+        ifstream in(argv[i]);
+
+        if (!in || !(qla_log ? read_qla_log(in) : read_test_file(in)))
+        {
+            cerr << "error: Could not read " << argv[i] << "." << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (statements.empty())
+    {
+        cerr << "error: No statements were found." << endl;
+        return EXIT_FAILURE;
+    }
+
+    rc = EXIT_FAILURE;
+
+    string libdir = string("../") + zClassifier;
+
+    set_libdir(strdup(libdir.c_str()));
+    set_datadir(strdup("/tmp"));
+    set_langdir(strdup("."));
+    set_process_datadir(strdup("/tmp"));
+
+    if (mxs_log_init(NULL, ".", MXS_LOG_TARGET_DEFAULT))
+    {
+        if (qc_setup(zClassifier, zClassifierArgs) && qc_process_init(QC_INIT_BOTH))
+        {
+            rc = run();
+            qc_process_end(QC_INIT_BOTH);
+        }
+        else
+        {
+            cerr << "error: Could not load or initialize " << zClassifier << "." << endl;
+        }
+
+        mxs_log_finish();
+    }
+    else
+    {
+        cerr << "error: Could not initialize log." << endl;
+    }
+
+    return rc;
+}
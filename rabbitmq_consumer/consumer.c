@@ -11,6 +11,20 @@
  * Public License.
  */
 
+/**
+ * The main thread reads the messages from the broker and hands them over to
+ * a number of worker threads, each of which has a database connection of its
+ * own. A worker collects the messages into batches and writes each batch
+ * with a few multi-row statements in one transaction. The messages are only
+ * acknowledged once the batch that contains them has been committed, so a
+ * message is never lost if the consumer or the database fails.
+ *
+ * All messages of one query are handled by the same worker, which keeps the
+ * counting of the queries free of races between the workers. The reply to a
+ * query is handled by the worker that handled the query so that the reply is
+ * never written before the query.
+ */
+
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -21,11 +35,32 @@
 #include <amqp.h>
 #include <amqp_framing.h>
 #include <mysql.h>
+#include <pthread.h>
 #include <signal.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 
+/** Default number of worker threads */
+#define DEFAULT_WORKERS 4
+
+/** Default number of messages written with one transaction */
+#define DEFAULT_BATCH_SIZE 500
+
+/** Default time a message waits for its batch to fill up, in milliseconds */
+#define DEFAULT_BATCH_TIMEOUT 100
+
+/** Message bytes after which a batch is written even if it is not full */
+#define BATCH_MAX_BYTES (512 * 1024)
+
+/** Number of recent queries for which the worker is remembered */
+#define ROUTE_TABLE_SIZE 65536
+
+/** How long the main thread waits for a frame before it sends the
+ * acknowledgements of the committed batches, in microseconds */
+#define FRAME_WAIT_TIME 5000
+
 typedef struct delivery_t
 {
     uint64_t dtag;
@@ -38,18 +73,58 @@ typedef struct consumer_t
     char *hostname, *vhost, *user, *passwd, *queue, *dbserver, *dbname, *dbuser, *dbpasswd;
     DELIVERY* query_stack;
     int port, dbport;
+    int workers, batch_size, batch_timeout, prefetch;
 } CONSUMER;
 
+typedef enum
+{
+    MSG_QUERY,
+    MSG_REPLY
+} msg_type_t;
+
+/** A message that waits to be written into the database */
+typedef struct message_t
+{
+    uint64_t dtag;          /* The delivery tag */
+    msg_type_t type;        /* Whether the message is a query or a reply */
+    char *tag;              /* The correlation ID of the query and the reply */
+    char *text;             /* The query or the reply */
+    unsigned long date;     /* When the message was sent, as a UNIX timestamp */
+    uint64_t received;      /* When the message was received in microseconds */
+    int ok;                 /* Whether the message was written */
+    struct message_t *next;
+} MESSAGE;
+
+/** A worker thread and the messages that wait for it */
+typedef struct worker_t
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    MESSAGE *head, *tail;   /* The messages that wait for the worker */
+    int count;              /* Number of waiting messages */
+    size_t bytes;           /* Length of the waiting messages */
+    int stop;               /* Write the waiting messages and exit */
+    MYSQL db;               /* Connection of the worker */
+} WORKER;
+
 static int all_ok;
 static FILE* out_fd;
 static CONSUMER* c_inst;
 static char* DB_DATABASE = "CREATE DATABASE IF NOT EXISTS %s;";
 static char* DB_TABLE =
     "CREATE TABLE IF NOT EXISTS pairs (tag VARCHAR(64) PRIMARY KEY NOT NULL, query VARCHAR(2048), reply VARCHAR(2048), date_in DATETIME NOT NULL, date_out DATETIME DEFAULT NULL, counter INT DEFAULT 1)";
-static char* DB_INSERT = "INSERT INTO pairs(tag, query, date_in) VALUES ('%s','%s',FROM_UNIXTIME(%s))";
-static char* DB_UPDATE = "UPDATE pairs SET reply='%s', date_out=FROM_UNIXTIME(%s) WHERE tag='%s'";
-static char* DB_INCREMENT =
-    "UPDATE pairs SET counter = counter+1, date_out=FROM_UNIXTIME(%s) WHERE query='%s'";
+
+/** The processed messages that wait for an acknowledgement */
+static pthread_mutex_t done_lock = PTHREAD_MUTEX_INITIALIZER;
+static MESSAGE *done_head = NULL;
+
+/** Which worker handled a recent query, indexed by the hash of the tag */
+static struct
+{
+    uint64_t hash;
+    int worker;
+} route_table[ROUTE_TABLE_SIZE];
 
 void sighndl(int signum)
 {
@@ -114,6 +189,22 @@ int handler(void* user, const char* section, const char* name,
         {
             out_fd = fopen(value, "ab");
         }
+        else if (strcmp(name, "workers") == 0)
+        {
+            c_inst->workers = atoi(value);
+        }
+        else if (strcmp(name, "batch_size") == 0)
+        {
+            c_inst->batch_size = atoi(value);
+        }
+        else if (strcmp(name, "batch_timeout") == 0)
+        {
+            c_inst->batch_timeout = atoi(value);
+        }
+        else if (strcmp(name, "prefetch") == 0)
+        {
+            c_inst->prefetch = atoi(value);
+        }
 
     }
 
@@ -179,9 +270,8 @@ int connectToServer(MYSQL* server)
     {
         fprintf(stderr, "\33[31;1mError\33[0m: Could not send query MySQL server: %s\n", mysql_error(server));
     }
-    memset(qstr, 0, bsz);
-    sprintf(qstr, "USE %s;", c_inst->dbname);
-    if (mysql_query(server, qstr))
+    /** The database is kept if the connection is reconnected */
+    if (mysql_select_db(server, c_inst->dbname))
     {
         fprintf(stderr, "\33[31;1mError\33[0m: Could not send query MySQL server: %s\n", mysql_error(server));
     }
@@ -197,91 +287,579 @@ int connectToServer(MYSQL* server)
     return 1;
 }
 
-int sendMessage(MYSQL* server, amqp_message_t* msg)
+static uint64_t timeNow()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static uint64_t hashString(const char *str)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (const char *p = str; *p; p++)
+    {
+        hash ^= (unsigned char)*p;
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+/** A statement that is being built */
+typedef struct sqlbuf_t
+{
+    char *data;
+    size_t len, size;
+    int ok;
+} SQLBUF;
+
+static int sqlReserve(SQLBUF *buf, size_t len)
+{
+    if (buf->ok && buf->len + len + 1 > buf->size)
+    {
+        size_t size = buf->size ? buf->size : 1024;
+
+        while (buf->len + len + 1 > size)
+        {
+            size *= 2;
+        }
+
+        char *data = realloc(buf->data, size);
+
+        if (data)
+        {
+            buf->data = data;
+            buf->size = size;
+        }
+        else
+        {
+            fprintf(stderr, "Fatal Error: Cannot allocate enough memory.\n");
+            buf->ok = 0;
+        }
+    }
+
+    return buf->ok;
+}
+
+static void sqlAppend(SQLBUF *buf, const char *str)
 {
-    int buffsz = (int)((msg->body.len + 1) * 2 + 1) +
-                 (int)((msg->properties.correlation_id.len + 1) * 2 + 1) +
-                 strlen(DB_INSERT),
-                 rval = 0;
-    char* saved;
-    char *qstr = calloc(buffsz, sizeof(char)),
-          *rawmsg = calloc((msg->body.len + 1), sizeof(char)),
-           *clnmsg = calloc(((msg->body.len + 1) * 2 + 1), sizeof(char)),
-            *rawdate = calloc((msg->body.len + 1), sizeof(char)),
-             *clndate = calloc(((msg->body.len + 1) * 2 + 1), sizeof(char)),
-              *rawtag = calloc((msg->properties.correlation_id.len + 1), sizeof(char)),
-               *clntag = calloc(((msg->properties.correlation_id.len + 1) * 2 + 1), sizeof(char));
+    size_t len = strlen(str);
 
+    if (sqlReserve(buf, len))
+    {
+        memcpy(buf->data + buf->len, str, len + 1);
+        buf->len += len;
+    }
+}
 
+static void sqlAppendNumber(SQLBUF *buf, const char *fmt, unsigned long value)
+{
+    char num[64];
+    snprintf(num, sizeof(num), fmt, value);
+    sqlAppend(buf, num);
+}
+
+static void sqlAppendString(SQLBUF *buf, MYSQL *server, const char *str)
+{
+    size_t len = strlen(str);
 
-    sprintf(qstr, "%.*s", (int)msg->body.len, (char *)msg->body.bytes);
-    fprintf(out_fd, "Received: %s\n", qstr);
-    char *ptr = strtok_r(qstr, "|", &saved);
-    sprintf(rawdate, "%s", ptr);
-    ptr = strtok_r(NULL, "\n\0", &saved);
-    if (ptr == NULL)
+    if (sqlReserve(buf, len * 2 + 2))
     {
-        fprintf(out_fd, "Message content not valid.\n");
-        rval = 1;
-        goto cleanup;
+        buf->data[buf->len++] = '\'';
+        buf->len += mysql_real_escape_string(server, buf->data + buf->len, str, len);
+        buf->data[buf->len++] = '\'';
+        buf->data[buf->len] = '\0';
     }
-    sprintf(rawmsg, "%s", ptr);
-    sprintf(rawtag, "%.*s", (int)msg->properties.correlation_id.len,
-            (char *)msg->properties.correlation_id.bytes);
-    memset(qstr, 0, buffsz);
+}
 
-    mysql_real_escape_string(server, clnmsg, rawmsg, strnlen(rawmsg, msg->body.len + 1));
-    mysql_real_escape_string(server, clndate, rawdate, strnlen(rawdate, msg->body.len + 1));
-    mysql_real_escape_string(server, clntag, rawtag, strnlen(rawtag, msg->properties.correlation_id.len + 1));
+/**
+ * Start the next row of a derived table built with UNION ALL
+ *
+ * @param buf   The statement
+ * @param start The start of the statement, used for the first row
+ */
+static void sqlNextRow(SQLBUF *buf, const char *start)
+{
+    sqlAppend(buf, buf->len ? " UNION ALL SELECT " : start);
+}
 
-    if (strncmp(msg->properties.message_id.bytes,
-                "query", msg->properties.message_id.len) == 0)
+static int sendStatement(MYSQL *server, SQLBUF *buf)
+{
+    if (buf->len == 0)
     {
+        return 1;
+    }
 
-        sprintf(qstr, DB_INCREMENT, clndate, clnmsg);
-        rval = mysql_query(server, qstr);
+    if (!buf->ok)
+    {
+        return 0;
+    }
+
+    if (mysql_real_query(server, buf->data, buf->len))
+    {
+        fprintf(stderr, "Could not send query to SQL server:%s\n", mysql_error(server));
+        return 0;
+    }
+
+    return 1;
+}
 
-        if (mysql_affected_rows(server) == 0)
+static int compareQueries(const void *a, const void *b)
+{
+    const MESSAGE *l = *(const MESSAGE**)a;
+    const MESSAGE *r = *(const MESSAGE**)b;
+    int rval = strcmp(l->text, r->text);
+
+    return rval ? rval : l->dtag < r->dtag ? -1 : l->dtag > r->dtag;
+}
+
+/**
+ * Write a batch of messages in one transaction
+ *
+ * The repeated queries of the batch are counted in memory. The counters of
+ * the queries that are already in the table are incremented with one
+ * statement and the new queries are inserted with another one, after which
+ * the replies are stored with a third statement.
+ *
+ * @param server   The database connection
+ * @param messages The messages in the order they were received
+ * @param n        Number of messages
+ * @return 1 if the batch was committed, 0 on error
+ */
+int writeBatch(MYSQL* server, MESSAGE** messages, int n)
+{
+    MESSAGE *queries[n];
+    int n_queries = 0;
+    SQLBUF update = {NULL, 0, 0, 1};
+    SQLBUF insert = {NULL, 0, 0, 1};
+    SQLBUF reply = {NULL, 0, 0, 1};
+
+    for (int i = 0; i < n; i++)
+    {
+        if (messages[i]->type == MSG_QUERY)
+        {
+            queries[n_queries++] = messages[i];
+        }
+        else
         {
-            memset(qstr, 0, buffsz);
-            sprintf(qstr, DB_INSERT, clntag, clnmsg, clndate);
-            rval = mysql_query(server, qstr);
+            sqlNextRow(&reply, "UPDATE pairs p JOIN (SELECT ");
+            sqlAppendString(&reply, server, messages[i]->tag);
+            sqlAppend(&reply, " AS tag, ");
+            sqlAppendString(&reply, server, messages[i]->text);
+            sqlAppendNumber(&reply, " AS reply, FROM_UNIXTIME(%lu) AS date_out", messages[i]->date);
+        }
+    }
+
+    qsort(queries, n_queries, sizeof(MESSAGE*), compareQueries);
+
+    for (int i = 0; i < n_queries;)
+    {
+        /** The first message of a query gives the tag of the row */
+        MESSAGE *first = queries[i];
+        unsigned long last_date = first->date;
+        int count = 0;
+
+        for (; i < n_queries && strcmp(queries[i]->text, first->text) == 0; i++)
+        {
+            if (queries[i]->date > last_date)
+            {
+                last_date = queries[i]->date;
+            }
+            count++;
         }
 
+        sqlNextRow(&update, "UPDATE pairs p JOIN (SELECT ");
+        sqlAppendString(&update, server, first->text);
+        sqlAppendNumber(&update, " AS query, %lu AS n, ", count);
+        sqlAppendNumber(&update, "FROM_UNIXTIME(%lu) AS date_out", last_date);
+
+        sqlNextRow(&insert, "INSERT IGNORE INTO pairs (tag, query, date_in, date_out, counter) "
+                   "SELECT b.tag, b.query, b.date_in, b.date_out, b.n FROM (SELECT ");
+        sqlAppendString(&insert, server, first->tag);
+        sqlAppend(&insert, " AS tag, ");
+        sqlAppendString(&insert, server, first->text);
+        sqlAppendNumber(&insert, " AS query, FROM_UNIXTIME(%lu) AS date_in, ", first->date);
+
+        if (count > 1)
+        {
+            sqlAppendNumber(&insert, "FROM_UNIXTIME(%lu) AS date_out, ", last_date);
+        }
+        else
+        {
+            sqlAppend(&insert, "NULL AS date_out, ");
+        }
+
+        sqlAppendNumber(&insert, "%lu AS n", count);
     }
-    else if (strncmp(msg->properties.message_id.bytes,
-                     "reply", msg->properties.message_id.len) == 0)
+
+    if (update.len)
     {
+        sqlAppend(&update, ") b ON p.query = b.query SET p.counter = p.counter + b.n, "
+                  "p.date_out = b.date_out");
+        sqlAppend(&insert, ") b WHERE NOT EXISTS (SELECT 1 FROM pairs p WHERE p.query = b.query)");
+    }
 
-        sprintf(qstr, DB_UPDATE, clnmsg, clndate, clntag);
-        rval = mysql_query(server, qstr);
+    if (reply.len)
+    {
+        sqlAppend(&reply, ") b ON p.tag = b.tag SET p.reply = b.reply, p.date_out = b.date_out");
+    }
+
+    int rval = 0;
 
+    if (mysql_query(server, "START TRANSACTION"))
+    {
+        fprintf(stderr, "Could not send query to SQL server:%s\n", mysql_error(server));
+    }
+    else if (sendStatement(server, &update) && sendStatement(server, &insert) &&
+             sendStatement(server, &reply))
+    {
+        if (mysql_commit(server))
+        {
+            fprintf(stderr, "Could not commit to SQL server:%s\n", mysql_error(server));
+        }
+        else
+        {
+            rval = 1;
+        }
+    }
+
+    if (!rval)
+    {
+        mysql_rollback(server);
+    }
+
+    free(update.data);
+    free(insert.data);
+    free(reply.data);
+    return rval;
+}
+
+/**
+ * Write messages and hand them back to the main thread for acknowledgement
+ *
+ * A batch that fails twice, the second time on a reconnected connection, is
+ * written one message at a time so that only the messages that can't be
+ * written are rejected.
+ *
+ * @param worker   The worker
+ * @param messages The messages
+ * @param n        Number of messages
+ */
+void writeMessages(WORKER* worker, MESSAGE** messages, int n)
+{
+    if (writeBatch(&worker->db, messages, n) || writeBatch(&worker->db, messages, n))
+    {
+        for (int i = 0; i < n; i++)
+        {
+            messages[i]->ok = 1;
+        }
     }
     else
     {
-        rval = 1;
-        goto cleanup;
+        for (int i = 0; i < n; i++)
+        {
+            messages[i]->ok = n > 1 && writeBatch(&worker->db, &messages[i], 1);
+        }
     }
 
+    pthread_mutex_lock(&done_lock);
 
-    if (rval)
+    for (int i = 0; i < n; i++)
     {
-        fprintf(stderr, "Could not send query to SQL server:%s\n", mysql_error(server));
-        goto cleanup;
+        messages[i]->next = done_head;
+        done_head = messages[i];
     }
 
-cleanup:
-    free(qstr);
-    free(rawmsg);
-    free(clnmsg);
-    free(rawdate);
-    free(clndate);
-    free(rawtag);
-    free(clntag);
+    pthread_mutex_unlock(&done_lock);
+}
+
+void* workerMain(void* data)
+{
+    WORKER *worker = (WORKER*)data;
+    MESSAGE **batch = malloc(c_inst->batch_size * sizeof(MESSAGE*));
+
+    if (batch == NULL)
+    {
+        fprintf(stderr, "Fatal Error: Cannot allocate enough memory.\n");
+        all_ok = 0;
+        return NULL;
+    }
+
+    mysql_thread_init();
+    pthread_mutex_lock(&worker->lock);
+
+    while (1)
+    {
+        while (!worker->stop && (worker->count == 0 ||
+                                 (worker->count < c_inst->batch_size && worker->bytes < BATCH_MAX_BYTES &&
+                                  timeNow() < worker->head->received + c_inst->batch_timeout * 1000)))
+        {
+            if (worker->count == 0)
+            {
+                pthread_cond_wait(&worker->cond, &worker->lock);
+            }
+            else
+            {
+                uint64_t deadline = worker->head->received + c_inst->batch_timeout * 1000;
+                struct timespec ts = {deadline / 1000000, (deadline % 1000000) * 1000};
+                pthread_cond_timedwait(&worker->cond, &worker->lock, &ts);
+            }
+        }
+
+        if (worker->count == 0)
+        {
+            break;
+        }
+
+        int n = 0;
+
+        while (worker->head && n < c_inst->batch_size)
+        {
+            MESSAGE *msg = worker->head;
+            worker->head = msg->next;
+            worker->count--;
+            worker->bytes -= strlen(msg->text);
+            batch[n++] = msg;
+        }
+
+        if (worker->head == NULL)
+        {
+            worker->tail = NULL;
+        }
+
+        pthread_mutex_unlock(&worker->lock);
+        writeMessages(worker, batch, n);
+        pthread_mutex_lock(&worker->lock);
+    }
+
+    pthread_mutex_unlock(&worker->lock);
+    mysql_thread_end();
+    free(batch);
+    return NULL;
+}
+
+void freeMessage(MESSAGE* msg)
+{
+    free(msg->tag);
+    free(msg->text);
+    free(msg);
+}
+
+/**
+ * Parse a message of the RabbitMQ filter
+ *
+ * The body of a message consists of the UNIX timestamp of the message, a
+ * pipe character and the query or the reply.
+ *
+ * @param msg  The message
+ * @param dtag The delivery tag of the message
+ * @return The message or NULL if the message is malformed
+ */
+MESSAGE* parseMessage(amqp_message_t* msg, uint64_t dtag)
+{
+    const char *body = msg->body.bytes;
+    size_t len = msg->body.len;
+    const char *sep = memchr(body, '|', len);
+    const amqp_bytes_t *id = &msg->properties.message_id;
+    MESSAGE *rval = NULL;
+
+    if (sep == NULL || sep == body || sep + 1 == body + len || sep[1] == '\n')
+    {
+        return NULL;
+    }
+
+    unsigned long date = 0;
+
+    for (const char *p = body; p < sep; p++)
+    {
+        if (*p < '0' || *p > '9')
+        {
+            return NULL;
+        }
+        date = date * 10 + *p - '0';
+    }
+
+    const char *text = sep + 1;
+    const char *end = memchr(text, '\n', body + len - text);
+    size_t text_len = end ? end - text : body + len - text;
+
+    if ((msg->properties._flags & AMQP_BASIC_MESSAGE_ID_FLAG) &&
+        (msg->properties._flags & AMQP_BASIC_CORRELATION_ID_FLAG) &&
+        (rval = calloc(1, sizeof(MESSAGE))))
+    {
+        if (id->len == strlen("query") && memcmp(id->bytes, "query", id->len) == 0)
+        {
+            rval->type = MSG_QUERY;
+        }
+        else if (id->len == strlen("reply") && memcmp(id->bytes, "reply", id->len) == 0)
+        {
+            rval->type = MSG_REPLY;
+        }
+        else
+        {
+            free(rval);
+            return NULL;
+        }
+
+        rval->dtag = dtag;
+        rval->date = date;
+        rval->received = timeNow();
+        rval->tag = strndup(msg->properties.correlation_id.bytes, msg->properties.correlation_id.len);
+        rval->text = strndup(text, text_len);
+
+        if (rval->tag == NULL || rval->text == NULL)
+        {
+            fprintf(stderr, "Fatal Error: Cannot allocate enough memory.\n");
+            freeMessage(rval);
+            rval = NULL;
+        }
+    }
 
     return rval;
 }
 
+/**
+ * Hand a message over to a worker
+ *
+ * A query goes to the worker chosen by the query text so that the same query
+ * is always counted by the same worker. A reply goes to the worker that got
+ * the query, if the query was recent enough to be remembered.
+ *
+ * @param workers The workers
+ * @param msg     The message
+ */
+void dispatchMessage(WORKER* workers, MESSAGE* msg)
+{
+    uint64_t taghash = hashString(msg->tag);
+    int slot = taghash % ROUTE_TABLE_SIZE;
+    int index;
+
+    if (msg->type == MSG_QUERY)
+    {
+        index = hashString(msg->text) % c_inst->workers;
+        route_table[slot].hash = taghash;
+        route_table[slot].worker = index;
+    }
+    else if (route_table[slot].hash == taghash)
+    {
+        index = route_table[slot].worker;
+    }
+    else
+    {
+        index = taghash % c_inst->workers;
+    }
+
+    WORKER *worker = &workers[index];
+
+    pthread_mutex_lock(&worker->lock);
+
+    if (worker->tail)
+    {
+        worker->tail->next = msg;
+    }
+    else
+    {
+        worker->head = msg;
+    }
+
+    worker->tail = msg;
+    worker->count++;
+    worker->bytes += strlen(msg->text);
+
+    if (worker->count == 1 || worker->count == c_inst->batch_size || worker->bytes >= BATCH_MAX_BYTES)
+    {
+        pthread_cond_signal(&worker->cond);
+    }
+
+    pthread_mutex_unlock(&worker->lock);
+}
+
+/** The state of the deliveries that are not yet acknowledged */
+enum
+{
+    ACK_PENDING = 0,
+    ACK_DONE,
+    ACK_REJECT
+};
+
+static uint8_t* ack_state = NULL;
+static int ack_size = 0;
+static uint64_t next_ack = 1;
+
+/**
+ * Acknowledge the deliveries that are done
+ *
+ * The delivery tags of a channel are consecutive and there are at most
+ * prefetch unacknowledged deliveries, so the deliveries that are done are
+ * acknowledged with one acknowledgement up to the first one that is not.
+ *
+ * @param conn    The broker connection
+ * @param channel The channel
+ * @param dtag    The delivery that is done
+ * @param ok      Whether the delivery is acknowledged or rejected
+ */
+void deliveryDone(amqp_connection_state_t conn, int channel, uint64_t dtag, int ok)
+{
+    uint64_t last = 0;
+
+    ack_state[dtag % ack_size] = ok ? ACK_DONE : ACK_REJECT;
+
+    while (ack_state[next_ack % ack_size] != ACK_PENDING)
+    {
+        if (ack_state[next_ack % ack_size] == ACK_REJECT)
+        {
+            if (last)
+            {
+                amqp_basic_ack(conn, channel, last, 1);
+                last = 0;
+            }
+            amqp_basic_reject(conn, channel, next_ack, 0);
+        }
+        else
+        {
+            last = next_ack;
+        }
+
+        ack_state[next_ack % ack_size] = ACK_PENDING;
+        next_ack++;
+    }
+
+    if (last)
+    {
+        amqp_basic_ack(conn, channel, last, 1);
+    }
+}
+
+/**
+ * Acknowledge the messages that the workers have written
+ *
+ * @param conn    The broker connection
+ * @param channel The channel
+ */
+void processDone(amqp_connection_state_t conn, int channel)
+{
+    pthread_mutex_lock(&done_lock);
+    MESSAGE *msg = done_head;
+    done_head = NULL;
+    pthread_mutex_unlock(&done_lock);
+
+    while (msg)
+    {
+        MESSAGE *next = msg->next;
+
+        if (!msg->ok)
+        {
+            fprintf(stderr, "\33[31;1mError\33[0m: Could not store message: %s\n", msg->text);
+        }
+
+        deliveryDone(conn, channel, msg->dtag, msg->ok);
+        freeMessage(msg);
+        msg = next;
+    }
+}
+
 int sendToServer(MYSQL* server, amqp_message_t* a, amqp_message_t* b)
 {
 
@@ -392,16 +970,39 @@ int sendToServer(MYSQL* server, amqp_message_t* a, amqp_message_t* b)
     free(qstr);
     return 1;
 }
+/**
+ * Stop the workers after they have written the messages they have
+ *
+ * @param workers   The workers
+ * @param n_workers Number of started workers
+ */
+void stopWorkers(WORKER* workers, int n_workers)
+{
+    for (int i = 0; i < n_workers; i++)
+    {
+        pthread_mutex_lock(&workers[i].lock);
+        workers[i].stop = 1;
+        pthread_cond_signal(&workers[i].cond);
+        pthread_mutex_unlock(&workers[i].lock);
+    }
+
+    for (int i = 0; i < n_workers; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        mysql_close(&workers[i].db);
+    }
+}
+
 int main(int argc, char** argv)
 {
     int channel = 1, status = AMQP_STATUS_OK, cnfnlen;
     amqp_socket_t *socket = NULL;
     amqp_connection_state_t conn;
     amqp_rpc_reply_t ret;
-    amqp_message_t *reply = NULL;
     amqp_frame_t frame;
     struct timeval timeout;
-    MYSQL db_inst;
+    WORKER *workers = NULL;
+    int n_workers = 0;
     char ch, *cnfname = NULL, *cnfpath = NULL;
     static const char* fname = "consumer.cnf";
     const char* default_path = "@CMAKE_INSTALL_PREFIX@/etc";
@@ -453,8 +1054,8 @@ int main(int argc, char** argv)
 
     strcat(cnfname, fname);
 
-    timeout.tv_sec = 1;
-    timeout.tv_usec = 0;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = FRAME_WAIT_TIME;
     all_ok = 1;
     out_fd = NULL;
 
@@ -489,7 +1090,65 @@ int main(int argc, char** argv)
         goto fatal_error;
     }
 
-    connectToServer(&db_inst);
+    if (c_inst->workers <= 0)
+    {
+        c_inst->workers = DEFAULT_WORKERS;
+    }
+
+    if (c_inst->batch_size <= 0)
+    {
+        c_inst->batch_size = DEFAULT_BATCH_SIZE;
+    }
+
+    if (c_inst->batch_timeout <= 0)
+    {
+        c_inst->batch_timeout = DEFAULT_BATCH_TIMEOUT;
+    }
+
+    if (c_inst->prefetch <= 0)
+    {
+        c_inst->prefetch = c_inst->workers * c_inst->batch_size * 2;
+    }
+
+    if (c_inst->prefetch > 65535)
+    {
+        c_inst->prefetch = 65535;
+    }
+
+    /** The delivery tags of at most prefetch messages are unacknowledged */
+    ack_size = c_inst->prefetch * 2;
+
+    if ((workers = calloc(c_inst->workers, sizeof(WORKER))) == NULL ||
+        (ack_state = calloc(ack_size, sizeof(uint8_t))) == NULL)
+    {
+        fprintf(stderr, "Fatal Error: Cannot allocate enough memory.\n");
+        goto fatal_error;
+    }
+
+    mysql_library_init(0, NULL, NULL);
+
+    /** The connections are opened before the threads are started as
+     * mysql_init is not thread-safe */
+    for (n_workers = 0; n_workers < c_inst->workers; n_workers++)
+    {
+        WORKER *worker = &workers[n_workers];
+
+        if (!connectToServer(&worker->db))
+        {
+            mysql_close(&worker->db);
+            goto fatal_error;
+        }
+
+        pthread_mutex_init(&worker->lock, NULL);
+        pthread_cond_init(&worker->cond, NULL);
+
+        if (pthread_create(&worker->thread, NULL, workerMain, worker))
+        {
+            fprintf(stderr, "Fatal Error: Cannot start worker thread.\n");
+            mysql_close(&worker->db);
+            goto fatal_error;
+        }
+    }
 
     if ((conn = amqp_new_connection()) == NULL ||
         (socket = amqp_tcp_socket_new(conn)) == NULL)
@@ -521,50 +1180,68 @@ int main(int argc, char** argv)
         goto error;
     }
 
-    reply = malloc(sizeof(amqp_message_t));
-    if (!reply)
+    /** The broker keeps enough messages in flight to fill the batches of
+     * all workers while the previous batches are being written */
+    if (amqp_basic_qos(conn, channel, 0, c_inst->prefetch, 0) == NULL)
     {
-        fprintf(stderr, "Error: Cannot allocate enough memory.\n");
+        fprintf(stderr, "\33[31;1mRabbitMQ Error\33[0m: Cannot set prefetch count.\n");
         goto error;
     }
+
     amqp_basic_consume(conn, channel, amqp_cstring_bytes(c_inst->queue), amqp_empty_bytes, 0, 0, 0,
                        amqp_empty_table);
 
     while (all_ok)
     {
+        processDone(conn, channel);
 
         status = amqp_simple_wait_frame_noblock(conn, &frame, &timeout);
 
         /**No frames to read from server, possibly out of messages*/
         if (status == AMQP_STATUS_TIMEOUT)
         {
-            sleep(timeout.tv_sec);
             continue;
         }
 
+        if (status != AMQP_STATUS_OK)
+        {
+            fprintf(stderr, "\33[31;1mRabbitMQ Error\33[0m: Failed to read from server: %s\n",
+                    amqp_error_string2(status));
+            all_ok = 0;
+            goto error;
+        }
+
         if (frame.payload.method.id == AMQP_BASIC_DELIVER_METHOD)
         {
 
             amqp_basic_deliver_t* decoded = (amqp_basic_deliver_t*)frame.payload.method.decoded;
+            uint64_t dtag = decoded->delivery_tag;
+            amqp_message_t reply;
+            MESSAGE *msg;
 
-            amqp_read_message(conn, channel, reply, 0);
+            ret = amqp_read_message(conn, channel, &reply, 0);
 
-            if (sendMessage(&db_inst, reply))
+            if (ret.reply_type != AMQP_RESPONSE_NORMAL)
             {
+                fprintf(stderr, "\33[31;1mRabbitMQ Error\33[0m: Cannot read message.\n");
+                all_ok = 0;
+                goto error;
+            }
 
-                fprintf(stderr, "\33[31;1mRabbitMQ Error\33[0m: Received malformed message.\n");
-                amqp_basic_reject(conn, channel, decoded->delivery_tag, 0);
-                amqp_destroy_message(reply);
-
+            if ((msg = parseMessage(&reply, dtag)))
+            {
+                fprintf(out_fd, "Received: %s\n", msg->text);
+                dispatchMessage(workers, msg);
             }
             else
             {
-
-                amqp_basic_ack(conn, channel, decoded->delivery_tag, 0);
-                amqp_destroy_message(reply);
-
+                fprintf(stderr, "\33[31;1mRabbitMQ Error\33[0m: Received malformed message.\n");
+                deliveryDone(conn, channel, dtag, 0);
             }
 
+            amqp_destroy_message(&reply);
+            amqp_maybe_release_buffers(conn);
+
         }
         else
         {
@@ -579,7 +1256,13 @@ int main(int argc, char** argv)
     fprintf(out_fd, "Shutting down...\n");
 error:
 
-    mysql_close(&db_inst);
+    stopWorkers(workers, n_workers);
+    n_workers = 0;
+
+    /** The messages that were written before the shutdown are acknowledged,
+     * the rest are redelivered when the channel is closed */
+    processDone(conn, channel);
+
     mysql_library_end();
     if (c_inst && c_inst->query_stack)
     {
@@ -599,6 +1282,10 @@ error:
     amqp_destroy_connection(conn);
 fatal_error:
 
+    stopWorkers(workers, n_workers);
+    free(workers);
+    free(ack_state);
+
     if (out_fd)
     {
         fclose(out_fd);
@@ -11,9 +11,178 @@
  * Public License.
  */
 
-#include <maxscale/alloc.h>
+#include "maxscale/alloc.h"
+
+#include <dlfcn.h>
+#include <inttypes.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <maxscale/log_manager.h>
+#include <maxscale/platform.h>
+
+/**
+ * The accounted allocations of one tag in one thread. Only the owning
+ * thread updates the counters so they need no atomic read-modify-write,
+ * relaxed stores are enough for the readers to see whole values.
+ */
+typedef struct
+{
+    int64_t n_allocs;  /**< Number of allocations */
+    int64_t n_frees;   /**< Number of frees */
+    int64_t allocated; /**< Bytes allocated */
+    int64_t freed;     /**< Bytes freed */
+} ALLOC_COUNTERS;
+
+/** Number of tag lookups cached by each thread */
+#define ALLOC_TAG_CACHE_SIZE 16
+
+typedef struct alloc_thread
+{
+    ALLOC_COUNTERS counters[MXS_ALLOC_MAX_TAGS];
+    struct
+    {
+        const char *tag;
+        int         id;
+    } cache[ALLOC_TAG_CACHE_SIZE]; /**< Tag pointers that have been looked up */
+    struct alloc_thread *next;
+} ALLOC_THREAD;
+
+static bool alloc_accounting = false;
+
+/** The names of the tags, the first one is used when there is no tag and
+ * the last one when all the others are in use */
+static const char *alloc_tags[MXS_ALLOC_MAX_TAGS] =
+{
+    "core", [MXS_ALLOC_MAX_TAGS - 1] = "other"
+};
+static int alloc_n_tags = 1;
+static pthread_mutex_t alloc_tag_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** The counters of all threads, they are kept when the thread exits */
+static ALLOC_THREAD *alloc_threads = NULL;
+static thread_local ALLOC_THREAD *alloc_this_thread = NULL;
+
+void mxs_alloc_set_accounting(bool enabled)
+{
+    alloc_accounting = enabled;
+}
+
+/**
+ * The counters of this thread. The memory is allocated directly with
+ * calloc so that it is not accounted itself.
+ */
+static ALLOC_THREAD* alloc_thread()
+{
+    ALLOC_THREAD *thr = alloc_this_thread;
+
+    if (thr == NULL && (thr = calloc(1, sizeof(ALLOC_THREAD))))
+    {
+        thr->next = __atomic_load_n(&alloc_threads, __ATOMIC_RELAXED);
+
+        while (!__atomic_compare_exchange_n(&alloc_threads, &thr->next, thr, false,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        {
+            ;
+        }
+
+        alloc_this_thread = thr;
+    }
+
+    return thr;
+}
+
+/**
+ * Find the index of a tag. Each source file passes the same pointer so
+ * the lookups by name are only done the first time a thread sees it.
+ */
+static int alloc_tag_id(ALLOC_THREAD *thr, const char *tag)
+{
+    if (tag == NULL)
+    {
+        return 0;
+    }
+
+    uintptr_t key = (uintptr_t)tag;
+    int slot = ((key >> 3) ^ (key >> 11)) % ALLOC_TAG_CACHE_SIZE;
+
+    if (thr->cache[slot].tag == tag)
+    {
+        return thr->cache[slot].id;
+    }
+
+    int id = -1;
+    pthread_mutex_lock(&alloc_tag_lock);
+
+    for (int i = 0; i < alloc_n_tags; i++)
+    {
+        if (strcmp(alloc_tags[i], tag) == 0)
+        {
+            id = i;
+            break;
+        }
+    }
+
+    if (id == -1)
+    {
+        char *name;
+
+        if (alloc_n_tags < MXS_ALLOC_MAX_TAGS - 1 && (name = strdup(tag)))
+        {
+            id = alloc_n_tags;
+            alloc_tags[id] = name;
+            __atomic_store_n(&alloc_n_tags, id + 1, __ATOMIC_RELEASE);
+        }
+        else
+        {
+            id = MXS_ALLOC_MAX_TAGS - 1;
+        }
+    }
+
+    pthread_mutex_unlock(&alloc_tag_lock);
+
+    thr->cache[slot].tag = tag;
+    thr->cache[slot].id = id;
+    return id;
+}
+
+static inline void alloc_count(int64_t *counter, int64_t value)
+{
+    __atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+/**
+ * Account an allocation. The size is that of the block the allocator
+ * handed out, so that the frees can be accounted without a header.
+ */
+static void alloc_account(const char *tag, void *ptr)
+{
+    ALLOC_THREAD *thr = alloc_thread();
+
+    if (thr)
+    {
+        ALLOC_COUNTERS *counters = &thr->counters[alloc_tag_id(thr, tag)];
+        alloc_count(&counters->n_allocs, 1);
+        alloc_count(&counters->allocated, malloc_usable_size(ptr));
+    }
+}
+
+/**
+ * Account a free. It is accounted to the tag of the freeing code, which
+ * usually but not always is that of the allocating code.
+ */
+static void alloc_account_free(const char *tag, size_t size)
+{
+    ALLOC_THREAD *thr = alloc_thread();
+
+    if (thr)
+    {
+        ALLOC_COUNTERS *counters = &thr->counters[alloc_tag_id(thr, tag)];
+        alloc_count(&counters->n_frees, 1);
+        alloc_count(&counters->freed, size);
+    }
+}
 
 /**
  * @brief Allocates memory; behaves exactly like `malloc`.
@@ -24,18 +193,21 @@
  *       and `mxs_free`.
  *
  * @param size The amount of memory to allocate.
- * @param caller The name of the function calling this function.
+ * @param tag The allocation tag, NULL for core.
  * @return A pointer to the allocated memory.
  */
-void *mxs_malloc(size_t size/*, const char *caller*/)
+void *mxs_malloc(size_t size, const char *tag)
 {
     void *ptr = malloc(size);
 
     if (!ptr)
     {
-        //MXS_OOM_MESSAGE(caller);
         MXS_OOM();
     }
+    else if (alloc_accounting)
+    {
+        alloc_account(tag, ptr);
+    }
 
     return ptr;
 }
@@ -50,18 +222,21 @@ void *mxs_malloc(size_t size/*, const char *caller*/)
  *
  * @param nmemb The number of elements.
  * @param size The size of each element.
- * @param caller The name of the function calling this function.
+ * @param tag The allocation tag, NULL for core.
  * @return A pointer to the allocated memory.
  */
-void *mxs_calloc(size_t nmemb, size_t size/*, const char *caller*/)
+void *mxs_calloc(size_t nmemb, size_t size, const char *tag)
 {
     void *ptr = calloc(nmemb, size);
 
     if (!ptr)
     {
-        //MXS_OOM_MESSAGE(caller);
         MXS_OOM();
     }
+    else if (alloc_accounting)
+    {
+        alloc_account(tag, ptr);
+    }
 
     return ptr;
 }
@@ -78,18 +253,29 @@ void *mxs_calloc(size_t nmemb, size_t size/*, const char *caller*/)
  *            `mxs_calloc`, `mxs_realloc`, `mxs_strdup`, `mxs_strndup`
               or or their `_a` equivalents.
  * @param size What size the memory block should be changed to.
- * @param caller The name of the function calling this function.
+ * @param tag The allocation tag, NULL for core.
  * @return A pointer to the allocated memory.
  */
-void *mxs_realloc(void *ptr, size_t size/*, const char *caller*/)
+void *mxs_realloc(void *ptr, size_t size, const char *tag)
 {
+    bool accounting = alloc_accounting;
+    size_t old_size = accounting && ptr ? malloc_usable_size(ptr) : 0;
+
     ptr = realloc(ptr, size);
 
     if (!ptr)
     {
-        //MXS_OOM_MESSAGE(caller);
         MXS_OOM();
     }
+    else if (accounting)
+    {
+        if (old_size)
+        {
+            alloc_account_free(tag, old_size);
+        }
+
+        alloc_account(tag, ptr);
+    }
 
     return ptr;
 }
@@ -102,18 +288,21 @@ void *mxs_realloc(void *ptr, size_t size/*, const char *caller*/)
  * @note The returned pointer can be passed to `mxs_realloc` and `mxs_free`.
  *
  * @param s1 The string to be duplicated.
- * @param caller The name of the function calling this function.
+ * @param tag The allocation tag, NULL for core.
  * @return A copy of the string.
  */
-char *mxs_strdup(const char *s1/*, const char *caller*/)
+char *mxs_strdup(const char *s1, const char *tag)
 {
     char *s2 = strdup(s1);
 
     if (!s2)
     {
-        //MXS_OOM_MESSAGE(caller);
         MXS_OOM();
     }
+    else if (alloc_accounting)
+    {
+        alloc_account(tag, s2);
+    }
 
     return s2;
 }
@@ -127,18 +316,21 @@ char *mxs_strdup(const char *s1/*, const char *caller*/)
  *
  * @param s1 The string to be duplicated.
  * @param n At most n bytes should be copied.
- * @param caller The name of the function calling this function.
+ * @param tag The allocation tag, NULL for core.
  * @return A copy of the string.
  */
-char *mxs_strndup(const char *s1, size_t n/*, const char *caller*/)
+char *mxs_strndup(const char *s1, size_t n, const char *tag)
 {
     char *s2 = strndup(s1, n);
 
     if (!s2)
     {
-        //MXS_OOM_MESSAGE(caller);
         MXS_OOM();
     }
+    else if (alloc_accounting)
+    {
+        alloc_account(tag, s2);
+    }
 
     return s2;
 }
@@ -153,10 +345,15 @@ char *mxs_strndup(const char *s1, size_t n/*, const char *caller*/)
  *       their `_a` equivalents.
  *
  * @param ptr Pointer to the memory to be freed.
- * @param caller The name of the function calling this function.
+ * @param tag The allocation tag, NULL for core.
  */
-void mxs_free(void *ptr/*, const char *caller*/)
+void mxs_free(void *ptr, const char *tag)
 {
+    if (alloc_accounting && ptr)
+    {
+        alloc_account_free(tag, malloc_usable_size(ptr));
+    }
+
     free(ptr);
 }
 
@@ -173,12 +370,12 @@ void mxs_free(void *ptr/*, const char *caller*/)
  * @note The returned pointer can be passed to `mxs_realloc` and `mxs_free`.
  *
  * @param s1 The string to be duplicated.
- * @param caller The name of the function calling this function.
+ * @param tag The allocation tag, NULL for core.
  * @return A copy of the string.
  */
-char *mxs_strdup_a(const char *s1/*, const char *caller*/)
+char *mxs_strdup_a(const char *s1, const char *tag)
 {
-    char *s2 = mxs_strdup(s1/*, caller*/);
+    char *s2 = mxs_strdup(s1, tag);
 
     if (!s2)
     {
@@ -202,12 +399,12 @@ char *mxs_strdup_a(const char *s1/*, const char *caller*/)
  *
  * @param s1 The string to be duplicated.
  * @param n At most n bytes should be copied.
- * @param caller The name of the function calling this function.
+ * @param tag The allocation tag, NULL for core.
  * @return A copy of the string.
  */
-char *mxs_strndup_a(const char *s1, size_t n/*, const char *caller*/)
+char *mxs_strndup_a(const char *s1, size_t n, const char *tag)
 {
-    char *s2 = mxs_strndup(s1, n/*, caller*/);
+    char *s2 = mxs_strndup(s1, n, tag);
 
     if (!s2)
     {
@@ -216,3 +413,192 @@ char *mxs_strndup_a(const char *s1, size_t n/*, const char *caller*/)
 
     return s2;
 }
+
+/** Sum the counters of a tag over all threads */
+static void alloc_sum(int id, ALLOC_COUNTERS *sum)
+{
+    memset(sum, 0, sizeof(*sum));
+
+    for (ALLOC_THREAD *thr = __atomic_load_n(&alloc_threads, __ATOMIC_ACQUIRE); thr; thr = thr->next)
+    {
+        ALLOC_COUNTERS *counters = &thr->counters[id];
+        sum->n_allocs += __atomic_load_n(&counters->n_allocs, __ATOMIC_RELAXED);
+        sum->n_frees += __atomic_load_n(&counters->n_frees, __ATOMIC_RELAXED);
+        sum->allocated += __atomic_load_n(&counters->allocated, __ATOMIC_RELAXED);
+        sum->freed += __atomic_load_n(&counters->freed, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * The tag of a row of the memory list, the "other" tag is only listed
+ * if something has been accounted to it
+ *
+ * @return The tag index or -1 when there are no more rows
+ */
+static int alloc_row_tag(int rowno, ALLOC_COUNTERS *sum)
+{
+    int n_tags = __atomic_load_n(&alloc_n_tags, __ATOMIC_ACQUIRE);
+    int id = rowno < n_tags ? rowno : rowno == n_tags ? MXS_ALLOC_MAX_TAGS - 1 : -1;
+
+    if (id != -1)
+    {
+        alloc_sum(id, sum);
+
+        if (id == MXS_ALLOC_MAX_TAGS - 1 && sum->n_allocs == 0 && sum->n_frees == 0)
+        {
+            id = -1;
+        }
+    }
+
+    return id;
+}
+
+/*
+ * The statistics of jemalloc and tcmalloc are read through their own
+ * interfaces if either one is linked in or preloaded.
+ */
+typedef int (*MALLCTL)(const char *name, void *oldp, size_t *oldlenp, void *newp, size_t newlen);
+typedef int (*TCMALLOC_PROPERTY)(const char *name, size_t *value);
+
+static int64_t allocator_stat(const char *jemalloc_name, const char *tcmalloc_name, bool resident)
+{
+    MALLCTL mallctl = (MALLCTL)dlsym(RTLD_DEFAULT, "mallctl");
+    TCMALLOC_PROPERTY tc_property;
+    size_t value;
+
+    if (mallctl)
+    {
+        /** The statistics of jemalloc are only refreshed when the epoch changes */
+        uint64_t epoch = 1;
+        size_t len = sizeof(epoch);
+        mallctl("epoch", &epoch, &len, &epoch, len);
+
+        len = sizeof(value);
+        return mallctl(jemalloc_name, &value, &len, NULL, 0) == 0 ? (int64_t)value : -1;
+    }
+    else if ((tc_property = (TCMALLOC_PROPERTY)dlsym(RTLD_DEFAULT, "MallocExtension_GetNumericProperty")))
+    {
+        return tc_property(tcmalloc_name, &value) ? (int64_t)value : -1;
+    }
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+#else
+    struct mallinfo info = mallinfo();
+#endif
+    return (int64_t)(resident ? info.arena : info.uordblks) + (int64_t)info.hblkhd;
+}
+
+const char* mxs_allocator_name()
+{
+    if (dlsym(RTLD_DEFAULT, "mallctl"))
+    {
+        return "jemalloc";
+    }
+    else if (dlsym(RTLD_DEFAULT, "MallocExtension_GetNumericProperty"))
+    {
+        return "tcmalloc";
+    }
+
+    return "glibc";
+}
+
+int64_t mxs_allocator_allocated()
+{
+    return allocator_stat("stats.allocated", "generic.current_allocated_bytes", false);
+}
+
+int64_t mxs_allocator_resident()
+{
+    return allocator_stat("stats.resident", "generic.heap_size", true);
+}
+
+/**
+ * Provide a row to the result set that defines the accounted memory
+ *
+ * @param set   The result set
+ * @param data  The index of the row to send
+ * @return The next row or NULL
+ */
+static RESULT_ROW* memoryRowCallback(RESULTSET *set, void *data)
+{
+    int *rowno = (int*)data;
+    ALLOC_COUNTERS sum;
+    int id = alloc_row_tag(*rowno, &sum);
+
+    if (id == -1)
+    {
+        MXS_FREE(data);
+        return NULL;
+    }
+
+    (*rowno)++;
+
+    char buf[30];
+    RESULT_ROW *row = resultset_make_row(set);
+
+    resultset_row_set(row, 0, alloc_tags[id]);
+    snprintf(buf, sizeof(buf), "%" PRId64, sum.n_allocs);
+    resultset_row_set(row, 1, buf);
+    snprintf(buf, sizeof(buf), "%" PRId64, sum.n_frees);
+    resultset_row_set(row, 2, buf);
+    snprintf(buf, sizeof(buf), "%" PRId64, sum.allocated);
+    resultset_row_set(row, 3, buf);
+    snprintf(buf, sizeof(buf), "%" PRId64, sum.freed);
+    resultset_row_set(row, 4, buf);
+    snprintf(buf, sizeof(buf), "%" PRId64, sum.allocated - sum.freed);
+    resultset_row_set(row, 5, buf);
+
+    return row;
+}
+
+RESULTSET* memoryGetList()
+{
+    RESULTSET *set;
+    int *data;
+
+    if ((data = (int*)MXS_MALLOC(sizeof(int))) == NULL)
+    {
+        return NULL;
+    }
+
+    *data = 0;
+
+    if ((set = resultset_create(memoryRowCallback, data)) == NULL)
+    {
+        MXS_FREE(data);
+        return NULL;
+    }
+
+    resultset_add_column(set, "Tag", 20, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Allocations", 20, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Frees", 20, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Allocated bytes", 20, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Freed bytes", 20, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "In use bytes", 20, COL_TYPE_VARCHAR);
+
+    return set;
+}
+
+void dprintMemory(DCB *dcb)
+{
+    dcb_printf(dcb, "Memory allocator:                   %s\n", mxs_allocator_name());
+    dcb_printf(dcb, "Allocated bytes:                    %" PRId64 "\n", mxs_allocator_allocated());
+    dcb_printf(dcb, "Resident bytes:                     %" PRId64 "\n", mxs_allocator_resident());
+    dcb_printf(dcb, "Memory accounting:                  %s\n\n", alloc_accounting ? "Enabled" : "Disabled");
+
+    dcb_printf(dcb, "%-20s | %14s | %14s | %16s | %16s | %16s\n",
+               "Tag", "Allocations", "Frees", "Allocated bytes", "Freed bytes", "In use bytes");
+    dcb_printf(dcb, "---------------------+----------------+----------------+"
+               "------------------+------------------+-----------------\n");
+
+    ALLOC_COUNTERS sum;
+    int id;
+
+    for (int rowno = 0; (id = alloc_row_tag(rowno, &sum)) != -1; rowno++)
+    {
+        dcb_printf(dcb, "%-20s | %14" PRId64 " | %14" PRId64 " | %16" PRId64 " | %16" PRId64 " | %16" PRId64 "\n",
+                   alloc_tags[id], sum.n_allocs, sum.n_frees, sum.allocated, sum.freed,
+                   sum.allocated - sum.freed);
+    }
+}
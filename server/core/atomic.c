@@ -31,3 +31,20 @@ uint64_t atomic_add_uint64(uint64_t *variable, int64_t value)
 {
     return __sync_fetch_and_add(variable, value);
 }
+
+void* atomic_exchange_ptr(void **variable, void *value)
+{
+    return __atomic_exchange_n(variable, value, __ATOMIC_ACQ_REL);
+}
+
+bool atomic_cas_ptr(void **variable, void **old_value, void *new_value)
+{
+    return __atomic_compare_exchange_n(variable, old_value, new_value, false,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+bool atomic_cas_int(int *variable, int *old_value, int new_value)
+{
+    return __atomic_compare_exchange_n(variable, old_value, new_value, false,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
@@ -19,8 +19,11 @@
 #include <maxscale/debug.h>
 #include <maxscale/spinlock.h>
 #include <maxscale/hint.h>
+#include <maxscale/limits.h>
 #include <maxscale/log_manager.h>
 
+#include "maxscale/poll.h"
+
 #if defined(BUFFER_TRACE)
 #include <maxscale/hashtable.h>
 #include <execinfo.h>
@@ -28,6 +31,74 @@
 static HASHTABLE *buffer_hashtable = NULL;
 #endif
 
+/**
+ * Buffer memory is allocated in size classes. Each polling thread keeps a
+ * magazine of free allocations for each class. Full magazines are flushed
+ * into a shared depot and empty magazines are refilled from it. Threads
+ * that are not polling threads use the depot directly.
+ */
+typedef struct
+{
+    size_t size;     /*< Size of one allocation */
+    int    magazine; /*< Maximum number of free allocations per thread */
+    int    depot;    /*< Maximum number of free allocations in the depot */
+} BUFFER_CLASS;
+
+/** Allocation classes. The first one is for the GWBUF structures and the rest
+ * for the SHARED_BUF structures together with their data. */
+static const BUFFER_CLASS buffer_classes[] =
+{
+    {sizeof(GWBUF),               128, 2048},
+    {sizeof(SHARED_BUF) + 64,     128, 2048},
+    {sizeof(SHARED_BUF) + 512,    64,  1024},
+    {sizeof(SHARED_BUF) + 4096,   32,  256},
+    {sizeof(SHARED_BUF) + 16384,  8,   64},
+    {sizeof(SHARED_BUF) + 65536,  4,   16}
+};
+
+#define BUFFER_CLASS_NONE   -1
+#define BUFFER_CLASS_HEADER 0
+#define BUFFER_CLASS_DATA   1
+#define N_BUFFER_CLASSES    (int)(sizeof(buffer_classes) / sizeof(buffer_classes[0]))
+
+typedef struct buffer_node
+{
+    struct buffer_node *next;
+} BUFFER_NODE;
+
+typedef struct
+{
+    BUFFER_NODE *head;        /*< Free allocations */
+    int          count;       /*< Number of free allocations */
+    int64_t      n_cached;    /*< Allocations satisfied from the cache */
+    int64_t      n_allocated; /*< Allocations done with the system allocator */
+} BUFFER_MAGAZINE;
+
+typedef struct
+{
+    BUFFER_MAGAZINE classes[N_BUFFER_CLASSES];
+} BUFFER_CACHE;
+
+typedef struct
+{
+    SPINLOCK     lock;
+    BUFFER_NODE *head;
+    int          count;
+    int64_t      n_cached;    /*< Depot allocations by non-polling threads */
+    int64_t      n_allocated; /*< System allocations by non-polling threads */
+} BUFFER_DEPOT;
+
+#define BUFFER_DEPOT_INIT {SPINLOCK_INIT, NULL, 0, 0, 0}
+
+static BUFFER_DEPOT buffer_depots[N_BUFFER_CLASSES] =
+{
+    BUFFER_DEPOT_INIT, BUFFER_DEPOT_INIT, BUFFER_DEPOT_INIT,
+    BUFFER_DEPOT_INIT, BUFFER_DEPOT_INIT, BUFFER_DEPOT_INIT
+};
+
+static BUFFER_CACHE *buffer_caches[MXS_MAX_THREADS];
+static thread_local BUFFER_CACHE *thread_cache = NULL;
+
 static void gwbuf_free_one(GWBUF *buf);
 static buffer_object_t* gwbuf_remove_buffer_object(GWBUF*           buf,
                                                    buffer_object_t* bufobj);
@@ -39,12 +110,280 @@ static int bcmpfn (void *key1, void *key2);
 static void gwbuf_remove_from_hashtable(GWBUF *buf);
 #endif
 
+/**
+ * Get the buffer cache of the calling thread
+ *
+ * @return The cache or NULL if the calling thread is not a polling thread
+ */
+static inline BUFFER_CACHE* buffer_get_cache()
+{
+    if (thread_cache == NULL && poll_thread && current_thread_id < MXS_MAX_THREADS)
+    {
+        thread_cache = (BUFFER_CACHE*)MXS_CALLOC(1, sizeof(BUFFER_CACHE));
+        buffer_caches[current_thread_id] = thread_cache;
+    }
+
+    return thread_cache;
+}
+
+/**
+ * Move free allocations from the depot into an empty magazine
+ *
+ * @param mag Magazine to refill
+ * @param cls Allocation class of the magazine
+ */
+static void buffer_refill(BUFFER_MAGAZINE *mag, int cls)
+{
+    BUFFER_DEPOT *depot = &buffer_depots[cls];
+
+    if (depot->head)
+    {
+        int n = buffer_classes[cls].magazine / 2;
+
+        spinlock_acquire(&depot->lock);
+
+        while (depot->head && n-- > 0)
+        {
+            BUFFER_NODE *node = depot->head;
+            depot->head = node->next;
+            depot->count--;
+            node->next = mag->head;
+            mag->head = node;
+            mag->count++;
+        }
+
+        spinlock_release(&depot->lock);
+    }
+}
+
+/**
+ * Move half of a full magazine into the depot
+ *
+ * The allocations that do not fit into the depot are freed.
+ *
+ * @param mag Magazine to flush
+ * @param cls Allocation class of the magazine
+ */
+static void buffer_flush(BUFFER_MAGAZINE *mag, int cls)
+{
+    BUFFER_DEPOT *depot = &buffer_depots[cls];
+    BUFFER_NODE *excess = NULL;
+    int n = buffer_classes[cls].magazine / 2;
+
+    spinlock_acquire(&depot->lock);
+
+    while (mag->head && n-- > 0)
+    {
+        BUFFER_NODE *node = mag->head;
+        mag->head = node->next;
+        mag->count--;
+
+        if (depot->count < buffer_classes[cls].depot)
+        {
+            node->next = depot->head;
+            depot->head = node;
+            depot->count++;
+        }
+        else
+        {
+            node->next = excess;
+            excess = node;
+        }
+    }
+
+    spinlock_release(&depot->lock);
+
+    while (excess)
+    {
+        BUFFER_NODE *node = excess;
+        excess = node->next;
+        MXS_FREE(node);
+    }
+}
+
+/**
+ * Allocate memory of an allocation class
+ *
+ * @param cls Allocation class
+ * @return Allocated memory or NULL on memory allocation failure
+ */
+static void* buffer_class_alloc(int cls)
+{
+    BUFFER_CACHE *cache = buffer_get_cache();
+    BUFFER_NODE *node;
+
+    if (cache)
+    {
+        BUFFER_MAGAZINE *mag = &cache->classes[cls];
+
+        if (mag->head == NULL)
+        {
+            buffer_refill(mag, cls);
+        }
+
+        if ((node = mag->head))
+        {
+            mag->head = node->next;
+            mag->count--;
+            mag->n_cached++;
+        }
+        else
+        {
+            mag->n_allocated++;
+        }
+    }
+    else
+    {
+        BUFFER_DEPOT *depot = &buffer_depots[cls];
+        spinlock_acquire(&depot->lock);
+
+        if ((node = depot->head))
+        {
+            depot->head = node->next;
+            depot->count--;
+            depot->n_cached++;
+        }
+        else
+        {
+            depot->n_allocated++;
+        }
+
+        spinlock_release(&depot->lock);
+    }
+
+    return node ? (void*)node : MXS_MALLOC(buffer_classes[cls].size);
+}
+
+/**
+ * Free memory of an allocation class
+ *
+ * @param cls Allocation class
+ * @param ptr Memory allocated with buffer_class_alloc
+ */
+static void buffer_class_free(int cls, void *ptr)
+{
+    BUFFER_CACHE *cache = buffer_get_cache();
+    BUFFER_NODE *node = (BUFFER_NODE*)ptr;
+
+    if (cache)
+    {
+        BUFFER_MAGAZINE *mag = &cache->classes[cls];
+
+        if (mag->count >= buffer_classes[cls].magazine)
+        {
+            buffer_flush(mag, cls);
+        }
+
+        node->next = mag->head;
+        mag->head = node;
+        mag->count++;
+    }
+    else
+    {
+        BUFFER_DEPOT *depot = &buffer_depots[cls];
+        spinlock_acquire(&depot->lock);
+
+        if (depot->count < buffer_classes[cls].depot)
+        {
+            node->next = depot->head;
+            depot->head = node;
+            depot->count++;
+            node = NULL;
+        }
+
+        spinlock_release(&depot->lock);
+        MXS_FREE(node);
+    }
+}
+
+/**
+ * Allocate a shared buffer with room for size bytes of data
+ *
+ * The data is stored right after the SHARED_BUF structure.
+ *
+ * @param size Size of the data area
+ * @return New shared buffer or NULL on memory allocation failure
+ */
+static SHARED_BUF* buffer_sbuf_alloc(unsigned int size)
+{
+    int cls = BUFFER_CLASS_NONE;
+    SHARED_BUF *sbuf;
+
+    for (int i = BUFFER_CLASS_DATA; i < N_BUFFER_CLASSES; i++)
+    {
+        if (sizeof(SHARED_BUF) + size <= buffer_classes[i].size)
+        {
+            cls = i;
+            break;
+        }
+    }
+
+    if (cls == BUFFER_CLASS_NONE)
+    {
+        sbuf = (SHARED_BUF*)MXS_MALLOC(sizeof(SHARED_BUF) + size);
+    }
+    else
+    {
+        sbuf = (SHARED_BUF*)buffer_class_alloc(cls);
+    }
+
+    if (sbuf)
+    {
+        sbuf->data = (unsigned char*)(sbuf + 1);
+        sbuf->size_class = cls;
+    }
+
+    return sbuf;
+}
+
+static void buffer_sbuf_free(SHARED_BUF *sbuf)
+{
+    if (sbuf->size_class == BUFFER_CLASS_NONE)
+    {
+        MXS_FREE(sbuf);
+    }
+    else
+    {
+        buffer_class_free(sbuf->size_class, sbuf);
+    }
+}
+
+void gwbuf_get_alloc_stats(int64_t *n_cached, int64_t *n_allocated)
+{
+    int64_t cached = 0;
+    int64_t allocated = 0;
+
+    for (int i = 0; i < N_BUFFER_CLASSES; i++)
+    {
+        spinlock_acquire(&buffer_depots[i].lock);
+        cached += buffer_depots[i].n_cached;
+        allocated += buffer_depots[i].n_allocated;
+        spinlock_release(&buffer_depots[i].lock);
+    }
+
+    for (int i = 0; i < MXS_MAX_THREADS; i++)
+    {
+        BUFFER_CACHE *cache = buffer_caches[i];
+
+        if (cache)
+        {
+            for (int j = 0; j < N_BUFFER_CLASSES; j++)
+            {
+                cached += cache->classes[j].n_cached;
+                allocated += cache->classes[j].n_allocated;
+            }
+        }
+    }
+
+    *n_cached = cached;
+    *n_allocated = allocated;
+}
+
 /**
  * Allocate a new gateway buffer structure of size bytes.
  *
- * For now we allocate memory directly from malloc for buffer the management
- * structure and the actual data buffer itself. We may swap at a future date
- * to a more efficient mechanism.
+ * The buffer structure and the shared buffer with its data are allocated
+ * from the per-thread buffer caches.
  *
  * @param       size The size in bytes of the data area required
  * @return      Pointer to the buffer structure or NULL if memory could not
@@ -57,39 +396,30 @@ gwbuf_alloc(unsigned int size)
     SHARED_BUF *sbuf;
 
     /* Allocate the buffer header */
-    if ((rval = (GWBUF *)MXS_MALLOC(sizeof(GWBUF))) == NULL)
+    if ((rval = (GWBUF *)buffer_class_alloc(BUFFER_CLASS_HEADER)) == NULL)
     {
         goto retblock;
     }
 
-    /* Allocate the shared data buffer */
-    if ((sbuf = (SHARED_BUF *)MXS_MALLOC(sizeof(SHARED_BUF))) == NULL)
+    /* Allocate the shared data buffer and the space for the actual data */
+    if ((sbuf = buffer_sbuf_alloc(size)) == NULL)
     {
-        MXS_FREE(rval);
-        rval = NULL;
-        goto retblock;
-    }
-
-    /* Allocate the space for the actual data */
-    if ((sbuf->data = (unsigned char *)MXS_MALLOC(size)) == NULL)
-    {
-        MXS_FREE(rval);
-        MXS_FREE(sbuf);
+        buffer_class_free(BUFFER_CLASS_HEADER, rval);
         rval = NULL;
         goto retblock;
     }
     sbuf->refcount = 1;
     sbuf->info = GWBUF_INFO_NONE;
     sbuf->bufobj = NULL;
+    sbuf->properties = NULL;
 
-    spinlock_init(&rval->gwbuf_lock);
     rval->start = sbuf->data;
     rval->end = (void *)((char *)rval->start + size);
     rval->sbuf = sbuf;
     rval->next = NULL;
     rval->tail = rval;
     rval->hint = NULL;
-    rval->properties = NULL;
+    rval->server = NULL;
     rval->gwbuf_type = GWBUF_TYPE_UNDEFINED;
     CHK_GWBUF(rval);
 retblock:
@@ -264,18 +594,18 @@ gwbuf_free_one(GWBUF *buf)
             bo = gwbuf_remove_buffer_object(buf, bo);
         }
 
-        MXS_FREE(buf->sbuf->data);
-        MXS_FREE(buf->sbuf);
-    }
+        while (buf->sbuf->properties)
+        {
+            prop = buf->sbuf->properties;
+            buf->sbuf->properties = prop->next;
+            MXS_FREE(prop->name);
+            MXS_FREE(prop->value);
+            MXS_FREE(prop);
+        }
 
-    while (buf->properties)
-    {
-        prop = buf->properties;
-        buf->properties = prop->next;
-        MXS_FREE(prop->name);
-        MXS_FREE(prop->value);
-        MXS_FREE(prop);
+        buffer_sbuf_free(buf->sbuf);
     }
+
     /** Release the hint */
     while (buf->hint)
     {
@@ -286,7 +616,7 @@ gwbuf_free_one(GWBUF *buf)
 #if defined(BUFFER_TRACE)
     gwbuf_remove_from_hashtable(buf);
 #endif
-    MXS_FREE(buf);
+    buffer_class_free(BUFFER_CLASS_HEADER, buf);
 }
 
 /**
@@ -304,11 +634,13 @@ gwbuf_clone_one(GWBUF *buf)
 {
     GWBUF *rval;
 
-    if ((rval = (GWBUF *)MXS_CALLOC(1, sizeof(GWBUF))) == NULL)
+    if ((rval = (GWBUF *)buffer_class_alloc(BUFFER_CLASS_HEADER)) == NULL)
     {
         return NULL;
     }
 
+    memset(rval, 0, sizeof(GWBUF));
+
     atomic_add(&buf->sbuf->refcount, 1);
     rval->sbuf = buf->sbuf;
     rval->start = buf->start;
@@ -355,6 +687,58 @@ GWBUF* gwbuf_clone(GWBUF* buf)
 }
 
 
+/**
+ * Replace a shared buffer with a private copy
+ *
+ * @param buf Buffer to copy, freed on success
+ * @return The private copy or NULL on memory allocation failure
+ */
+static GWBUF* gwbuf_transfer_one(GWBUF *buf)
+{
+    GWBUF *rval = gwbuf_alloc_and_load(GWBUF_LENGTH(buf), GWBUF_DATA(buf));
+
+    if (rval)
+    {
+        rval->gwbuf_type = buf->gwbuf_type;
+        rval->server = buf->server;
+        rval->hint = buf->hint;
+        buf->hint = NULL;
+
+        for (BUF_PROPERTY *prop = buf->sbuf->properties; prop; prop = prop->next)
+        {
+            gwbuf_add_property(rval, prop->name, prop->value);
+        }
+    }
+
+    gwbuf_free_one(buf);
+    return rval;
+}
+
+GWBUF* gwbuf_transfer(GWBUF *buf)
+{
+    GWBUF *rval = NULL;
+
+    while (buf)
+    {
+        GWBUF *next = buf->next;
+        buf->next = NULL;
+        buf->tail = buf;
+
+        if (atomic_add(&buf->sbuf->refcount, 0) > 1 &&
+            (buf = gwbuf_transfer_one(buf)) == NULL)
+        {
+            gwbuf_free(next);
+            gwbuf_free(rval);
+            return NULL;
+        }
+
+        rval = gwbuf_append(rval, buf);
+        buf = next;
+    }
+
+    return rval;
+}
+
 static GWBUF *gwbuf_clone_portion(GWBUF *buf,
                                   size_t start_offset,
                                   size_t length)
@@ -364,7 +748,7 @@ static GWBUF *gwbuf_clone_portion(GWBUF *buf,
     CHK_GWBUF(buf);
     ss_dassert(start_offset + length <= GWBUF_LENGTH(buf));
 
-    if ((clonebuf = (GWBUF *)MXS_MALLOC(sizeof(GWBUF))) == NULL)
+    if ((clonebuf = (GWBUF *)buffer_class_alloc(BUFFER_CLASS_HEADER)) == NULL)
     {
         return NULL;
     }
@@ -374,7 +758,7 @@ static GWBUF *gwbuf_clone_portion(GWBUF *buf,
     clonebuf->start = (void *)((char*)buf->start + start_offset);
     clonebuf->end = (void *)((char *)clonebuf->start + length);
     clonebuf->gwbuf_type = buf->gwbuf_type; /*< clone the type for now */
-    clonebuf->properties = NULL;
+    clonebuf->server = buf->server;
     clonebuf->hint = NULL;
     clonebuf->next = NULL;
     clonebuf->tail = clonebuf;
@@ -670,8 +1054,6 @@ void gwbuf_add_buffer_object(GWBUF* buf,
     newb->bo_data = data;
     newb->bo_donefun_fp = donefun_fp;
     newb->bo_next = NULL;
-    /** Lock */
-    spinlock_acquire(&buf->gwbuf_lock);
     p_b = &buf->sbuf->bufobj;
     /** Search the end of the list and add there */
     while (*p_b != NULL)
@@ -679,10 +1061,12 @@ void gwbuf_add_buffer_object(GWBUF* buf,
         p_b = &(*p_b)->bo_next;
     }
     *p_b = newb;
-    /** Set flag */
-    buf->sbuf->info |= GWBUF_INFO_PARSED;
-    /** Unlock */
-    spinlock_release(&buf->gwbuf_lock);
+
+    if (id == GWBUF_PARSING_INFO)
+    {
+        /** Set flag */
+        buf->sbuf->info |= GWBUF_INFO_PARSED;
+    }
 }
 
 void* gwbuf_get_buffer_object_data(GWBUF* buf, bufobj_id_t id)
@@ -690,16 +1074,13 @@ void* gwbuf_get_buffer_object_data(GWBUF* buf, bufobj_id_t id)
     buffer_object_t* bo;
 
     CHK_GWBUF(buf);
-    /** Lock */
-    spinlock_acquire(&buf->gwbuf_lock);
     bo = buf->sbuf->bufobj;
 
     while (bo != NULL && bo->bo_id != id)
     {
         bo = bo->bo_next;
     }
-    /** Unlock */
-    spinlock_release(&buf->gwbuf_lock);
+
     if (bo)
     {
         return bo->bo_data;
@@ -739,10 +1120,8 @@ gwbuf_add_property(GWBUF *buf, char *name, char *value)
 
     prop->name = name;
     prop->value = value;
-    spinlock_acquire(&buf->gwbuf_lock);
-    prop->next = buf->properties;
-    buf->properties = prop;
-    spinlock_release(&buf->gwbuf_lock);
+    prop->next = buf->sbuf->properties;
+    buf->sbuf->properties = prop;
     return true;
 }
 
@@ -751,13 +1130,12 @@ gwbuf_get_property(GWBUF *buf, char *name)
 {
     BUF_PROPERTY *prop;
 
-    spinlock_acquire(&buf->gwbuf_lock);
-    prop = buf->properties;
+    prop = buf->sbuf->properties;
     while (prop && strcmp(prop->name, name) != 0)
     {
         prop = prop->next;
     }
-    spinlock_release(&buf->gwbuf_lock);
+
     if (prop)
     {
         return prop->value;
@@ -803,7 +1181,6 @@ gwbuf_add_hint(GWBUF *buf, HINT *hint)
 {
     HINT *ptr;
 
-    spinlock_acquire(&buf->gwbuf_lock);
     if (buf->hint)
     {
         ptr = buf->hint;
@@ -817,7 +1194,6 @@ gwbuf_add_hint(GWBUF *buf, HINT *hint)
     {
         buf->hint = hint;
     }
-    spinlock_release(&buf->gwbuf_lock);
 }
 
 size_t gwbuf_copy_data(const GWBUF *buffer, size_t offset, size_t bytes, uint8_t* dest)
@@ -51,6 +51,7 @@
 #include <fcntl.h>
 #include <glob.h>
 #include <net/if.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -67,6 +68,7 @@
 #include <maxscale/utils.h>
 #include <maxscale/paths.h>
 
+#include "maxscale/alloc.h"
 #include "maxscale/config.h"
 #include "maxscale/filter.h"
 #include "maxscale/service.h"
@@ -89,8 +91,10 @@ static char *config_get_value(MXS_CONFIG_PARAMETER *, const char *);
 static char *config_get_password(MXS_CONFIG_PARAMETER *);
 static const char* config_get_value_string(const MXS_CONFIG_PARAMETER *params, const char *name);
 static int handle_global_item(const char *, const char *);
+static bool config_parse_cpu_list(const char *value, int **cpus, int *n);
 static int handle_feedback_item(const char *, const char *);
 static void global_defaults();
+static void config_threads_max_apply();
 static void feedback_defaults();
 static bool check_config_objects(CONFIG_CONTEXT *context);
 static int maxscale_getline(char** dest, int* size, FILE* file);
@@ -155,6 +159,11 @@ static const char *listener_params[] =
     "ssl_version",
     "ssl_cert_verify_depth",
     "ssl_verify_peer_certificate",
+    "ssl_ktls",
+    "compression",
+    "listen_backlog",
+    "tcp_defer_accept",
+    "tcp_fastopen",
     NULL
 };
 
@@ -172,6 +181,9 @@ static const char *monitor_params[] =
     "backend_connect_timeout",
     "backend_read_timeout",
     "backend_write_timeout",
+    "load_metrics",
+    "server_variables",
+    "journal_max_age",
     NULL
 };
 
@@ -194,6 +206,11 @@ static const char *server_params[] =
     "monitorpw",
     "persistpoolmax",
     "persistmaxtime",
+    "persistpoolmin",
+    "max_concurrent_queries",
+    "max_queue_time",
+    "compression",
+    "socket",
     "ssl_cert",
     "ssl_ca_cert",
     "ssl",
@@ -201,6 +218,7 @@ static const char *server_params[] =
     "ssl_version",
     "ssl_cert_verify_depth",
     "ssl_verify_peer_certificate",
+    "ssl_ktls",
     NULL
 };
 
@@ -681,6 +699,8 @@ config_load_and_process(const char* filename, bool (*process_config)(CONFIG_CONT
 
             if (rval)
             {
+                config_threads_max_apply();
+
                 if (!check_config_objects(ccontext.next) || !process_config(ccontext.next))
                 {
                     rval = false;
@@ -702,6 +722,30 @@ config_load_and_process(const char* filename, bool (*process_config)(CONFIG_CONT
     return rval;
 }
 
+/**
+ * Size the polling threads for the maximum number of active threads
+ *
+ * All per-thread structures are allocated for threads_max threads and that
+ * many polling threads are started. Only the number of threads given with
+ * the threads parameter are used at startup, the rest are activated at
+ * runtime.
+ */
+static void config_threads_max_apply()
+{
+    gateway.n_threads_initial = gateway.n_threads;
+
+    if (gateway.n_threads_max > gateway.n_threads)
+    {
+        gateway.n_threads = gateway.n_threads_max;
+    }
+    else if (gateway.n_threads_max > 0 && gateway.n_threads_max < gateway.n_threads)
+    {
+        MXS_WARNING("Value of 'threads_max' is %d, which is smaller than 'threads': %d. "
+                    "The number of threads can not be increased at runtime.",
+                    gateway.n_threads_max, gateway.n_threads);
+    }
+}
+
 /**
  * @brief Load the configuration file for the MaxScale
  *
@@ -772,6 +816,13 @@ process_config_context(CONFIG_CONTEXT *context)
     }
     hashtable_memory_fns(monitorhash, hashtable_item_strdup, NULL, hashtable_item_free, NULL);
 
+    if (gateway.writeq_high_water && gateway.writeq_low_water >= gateway.writeq_high_water)
+    {
+        MXS_ERROR("The value of 'writeq_low_water' must be smaller than "
+                  "the value of 'writeq_high_water'.");
+        error_count++;
+    }
+
     /**
      * Process the data and create the services and servers defined
      * in the data.
@@ -1131,6 +1182,111 @@ config_threadcount()
     return gateway.n_threads;
 }
 
+int config_thread_cpu(int thread_id)
+{
+    return gateway.n_thread_cpus ? gateway.thread_cpus[thread_id % gateway.n_thread_cpus] : -1;
+}
+
+/**
+ * @brief Parse a list of CPUs
+ *
+ * The list is either 'auto', which uses all CPUs the process may run on, or a
+ * comma-separated list of CPU numbers and ranges such as '0-7,16-23'.
+ *
+ * @param value The list to parse
+ * @param cpus  Where the allocated array of CPUs is stored
+ * @param n     Where the number of CPUs is stored
+ * @return True if the list was valid
+ */
+static bool config_parse_cpu_list(const char *value, int **cpus, int *n)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    if (strcmp(value, "auto") == 0)
+    {
+        if (sched_getaffinity(0, sizeof(set), &set) != 0)
+        {
+            return false;
+        }
+    }
+    else
+    {
+        const char *ptr = value;
+
+        while (*ptr)
+        {
+            char *end;
+            long first = strtol(ptr, &end, 10);
+            long last = first;
+
+            if (end == ptr)
+            {
+                return false;
+            }
+
+            if (*end == '-')
+            {
+                ptr = end + 1;
+                last = strtol(ptr, &end, 10);
+
+                if (end == ptr)
+                {
+                    return false;
+                }
+            }
+
+            if (first < 0 || last < first || last >= CPU_SETSIZE)
+            {
+                return false;
+            }
+
+            for (long i = first; i <= last; i++)
+            {
+                CPU_SET(i, &set);
+            }
+
+            ptr = end;
+
+            if (*ptr == ',')
+            {
+                ptr++;
+            }
+            else if (*ptr)
+            {
+                return false;
+            }
+        }
+    }
+
+    int count = CPU_COUNT(&set);
+
+    if (count == 0)
+    {
+        return false;
+    }
+
+    int *rval = MXS_MALLOC(count * sizeof(int));
+
+    if (rval == NULL)
+    {
+        return false;
+    }
+
+    for (int i = 0, j = 0; i < CPU_SETSIZE && j < count; i++)
+    {
+        if (CPU_ISSET(i, &set))
+        {
+            rval[j++] = i;
+        }
+    }
+
+    MXS_FREE(*cpus);
+    *cpus = rval;
+    *n = count;
+    return true;
+}
+
 /**
  * Return the number of non-blocking polls to be done before a blocking poll
  * is issued.
@@ -1307,6 +1463,34 @@ handle_global_item(const char *name, const char *value)
     {
         gateway.qc_args = MXS_STRDUP_A(value);
     }
+    else if (strcmp(name, "query_classifier_cache_size") == 0)
+    {
+        char* endptr;
+        int intval = strtol(value, &endptr, 0);
+        if (*endptr == '\0' && intval >= 0)
+        {
+            gateway.qc_cache_size = intval;
+        }
+        else
+        {
+            MXS_ERROR("Invalid value for 'query_classifier_cache_size': %s", value);
+            return 0;
+        }
+    }
+    else if (strcmp(name, "query_classifier_large_statement_size") == 0)
+    {
+        char* endptr;
+        int intval = strtol(value, &endptr, 0);
+        if (*endptr == '\0' && intval >= 0)
+        {
+            gateway.qc_large_statement_size = intval;
+        }
+        else
+        {
+            MXS_ERROR("Invalid value for 'query_classifier_large_statement_size': %s", value);
+            return 0;
+        }
+    }
     else if (strcmp(name, "query_retries") == 0)
     {
         char* endptr;
@@ -1405,6 +1589,202 @@ handle_global_item(const char *name, const char *value)
     {
         gateway.local_address = MXS_STRDUP_A(value);
     }
+    else if (strcmp(name, "reuseport") == 0)
+    {
+        gateway.reuseport = config_truth_value((char*)value);
+    }
+    else if (strcmp(name, "thread_placement") == 0)
+    {
+        if (strcmp(value, "least_loaded") == 0)
+        {
+            gateway.least_loaded_placement = true;
+        }
+        else if (strcmp(value, "round_robin") == 0)
+        {
+            gateway.least_loaded_placement = false;
+        }
+        else
+        {
+            MXS_ERROR("Invalid value for 'thread_placement': %s. Expected "
+                      "'round_robin' or 'least_loaded'.", value);
+            return 0;
+        }
+    }
+    else if (strcmp(name, "poll_backend") == 0)
+    {
+        if (strcmp(value, "io_uring") == 0)
+        {
+            gateway.poll_io_uring = true;
+        }
+        else if (strcmp(value, "epoll") == 0)
+        {
+            gateway.poll_io_uring = false;
+    gateway.hot_restart_socket = NULL;
+    gateway.hot_restart_drain_timeout = 0;
+        }
+        else
+        {
+            MXS_ERROR("Invalid value for 'poll_backend': %s. Expected "
+                      "'epoll' or 'io_uring'.", value);
+            return 0;
+        }
+    }
+    else if (strcmp(name, "hot_restart_socket") == 0)
+    {
+        gateway.hot_restart_socket = MXS_STRDUP_A(value);
+    }
+    else if (strcmp(name, "hot_restart_drain_timeout") == 0)
+    {
+        char* endptr;
+        int intval = strtol(value, &endptr, 0);
+        if (*endptr == '\0' && intval >= 0)
+        {
+            gateway.hot_restart_drain_timeout = intval;
+        }
+        else
+        {
+            MXS_ERROR("Invalid value for 'hot_restart_drain_timeout': %s", value);
+            return 0;
+        }
+    }
+    else if (strcmp(name, "threads_cpu_affinity") == 0)
+    {
+        if (!config_parse_cpu_list(value, &gateway.thread_cpus, &gateway.n_thread_cpus))
+        {
+            MXS_ERROR("Invalid value for 'threads_cpu_affinity': %s. Expected 'auto' "
+                      "or a list of CPUs, for example '0-7,16-23'.", value);
+            return 0;
+        }
+    }
+    else if (strcmp(name, "threads_max") == 0)
+    {
+        char* endptr;
+        int intval = strtol(value, &endptr, 0);
+        if (*endptr == '\0' && intval >= 0)
+        {
+            if (intval > MXS_MAX_THREADS)
+            {
+                MXS_WARNING("Value of 'threads_max' is %d, which is greater than the "
+                            "hard maximum of %d. The value is adjusted down accordingly.",
+                            intval, MXS_MAX_THREADS);
+                intval = MXS_MAX_THREADS;
+            }
+
+            gateway.n_threads_max = intval;
+        }
+        else
+        {
+            MXS_ERROR("Invalid value for 'threads_max': %s", value);
+            return 0;
+        }
+    }
+    else if (strcmp(name, "threads_auto") == 0)
+    {
+        gateway.threads_auto = config_truth_value((char*)value);
+    }
+    else if (strcmp(name, "thread_migration_threshold") == 0)
+    {
+        char* endptr;
+        int intval = strtol(value, &endptr, 0);
+        if (*endptr == '\0' && intval >= 0)
+        {
+            gateway.thread_migration_threshold = intval;
+        }
+        else
+        {
+            MXS_ERROR("Invalid value for 'thread_migration_threshold': %s", value);
+            return 0;
+        }
+    }
+    else if (strcmp(name, "slow_event_threshold") == 0)
+    {
+        char* endptr;
+        int intval = strtol(value, &endptr, 0);
+        if (*endptr == '\0' && intval > 0)
+        {
+            gateway.slow_event_threshold = intval;
+        }
+        else
+        {
+            MXS_ERROR("Invalid value for 'slow_event_threshold': %s", value);
+            return 0;
+        }
+    }
+    else if (strcmp(name, "query_trace_interval") == 0)
+    {
+        char* endptr;
+        int intval = strtol(value, &endptr, 0);
+        if (*endptr == '\0' && intval >= 0)
+        {
+            gateway.query_trace_interval = intval;
+        }
+        else
+        {
+            MXS_ERROR("Invalid value for 'query_trace_interval': %s", value);
+            return 0;
+        }
+    }
+    else if (strcmp(name, "slow_query_time") == 0)
+    {
+        char* endptr;
+        int intval = strtol(value, &endptr, 0);
+        if (*endptr == '\0' && intval >= 0)
+        {
+            gateway.slow_query_time = intval;
+        }
+        else
+        {
+            MXS_ERROR("Invalid value for 'slow_query_time': %s", value);
+            return 0;
+        }
+    }
+    else if (strcmp(name, "slow_query_log_rate") == 0)
+    {
+        char* endptr;
+        int intval = strtol(value, &endptr, 0);
+        if (*endptr == '\0' && intval > 0)
+        {
+            gateway.slow_query_log_rate = intval;
+        }
+        else
+        {
+            MXS_ERROR("Invalid value for 'slow_query_log_rate': %s", value);
+            return 0;
+        }
+    }
+    else if (strcmp(name, "writeq_high_water") == 0)
+    {
+        char* endptr;
+        int intval = strtol(value, &endptr, 0);
+        if (*endptr == '\0' && intval >= 0)
+        {
+            gateway.writeq_high_water = intval;
+        }
+        else
+        {
+            MXS_ERROR("Invalid value for 'writeq_high_water': %s", value);
+            return 0;
+        }
+    }
+    else if (strcmp(name, "writeq_low_water") == 0)
+    {
+        char* endptr;
+        int intval = strtol(value, &endptr, 0);
+        if (*endptr == '\0' && intval > 0)
+        {
+            gateway.writeq_low_water = intval;
+        }
+        else
+        {
+            MXS_ERROR("Invalid value for 'writeq_low_water': %s", value);
+            return 0;
+        }
+    }
+    else if (strcmp(name, "memory_accounting") == 0)
+    {
+        gateway.memory_accounting = config_truth_value(value);
+        mxs_alloc_set_accounting(gateway.memory_accounting);
+    }
     else if (strcmp(name, "users_refresh_time") == 0)
     {
         char* endptr;
@@ -1473,6 +1853,10 @@ free_ssl_structure(SSL_LISTENER *ssl)
 {
     if (ssl)
     {
+        if (ssl->session)
+        {
+            SSL_SESSION_free(ssl->session);
+        }
         SSL_CTX_free(ssl->ctx);
         MXS_FREE(ssl->ssl_key);
         MXS_FREE(ssl->ssl_cert);
@@ -1511,6 +1895,7 @@ SSL_LISTENER* make_ssl_structure(CONFIG_CONTEXT *obj, bool require_cert, int *er
             ssl_ca_cert = config_get_value(obj->parameters, "ssl_ca_cert");
             ssl_version = config_get_value(obj->parameters, "ssl_version");
             char* ssl_verify_peer_certificate = config_get_value(obj->parameters, "ssl_verify_peer_certificate");
+            char* ssl_ktls = config_get_value(obj->parameters, "ssl_ktls");
             ssl_cert_verify_depth = config_get_value(obj->parameters, "ssl_cert_verify_depth");
             new_ssl->ssl_init_done = false;
             new_ssl->ssl_cert_verify_depth = 9; // Default of 9 as per Linux man page
@@ -1547,6 +1932,21 @@ SSL_LISTENER* make_ssl_structure(CONFIG_CONTEXT *obj, bool require_cert, int *er
                 }
             }
 
+            if (ssl_ktls)
+            {
+                int rv = config_truth_value(ssl_ktls);
+                if (rv == -1)
+                {
+                    MXS_ERROR("Invalid parameter value for 'ssl_ktls' for '%s': %s",
+                              obj->object, ssl_ktls);
+                    local_errors++;
+                }
+                else
+                {
+                    new_ssl->ssl_ktls = rv;
+                }
+            }
+
             listener_set_certificates(new_ssl, ssl_cert, ssl_key, ssl_ca_cert);
 
             if (require_cert)
@@ -1657,6 +2057,9 @@ global_defaults()
     uint8_t mac_addr[6] = "";
     struct utsname uname_data;
     gateway.n_threads = DEFAULT_NTHREADS;
+    gateway.n_threads_max = 0;
+    gateway.n_threads_initial = DEFAULT_NTHREADS;
+    gateway.threads_auto = false;
     gateway.n_nbpoll = DEFAULT_NBPOLLS;
     gateway.pollsleep = DEFAULT_POLLSLEEP;
     gateway.auth_conn_timeout = DEFAULT_AUTH_CONNECT_TIMEOUT;
@@ -1665,6 +2068,21 @@ global_defaults()
     gateway.skip_permission_checks = false;
     gateway.query_retries = DEFAULT_QUERY_RETRIES;
     gateway.query_retry_timeout = DEFAULT_QUERY_RETRY_TIMEOUT;
+    gateway.reuseport = false;
+    gateway.least_loaded_placement = false;
+    gateway.thread_migration_threshold = 0;
+    gateway.slow_event_threshold = DEFAULT_SLOW_EVENT_THRESHOLD;
+    gateway.thread_cpus = NULL;
+    gateway.n_thread_cpus = 0;
+    gateway.query_trace_interval = 0;
+    gateway.slow_query_time = 0;
+    gateway.slow_query_log_rate = DEFAULT_SLOW_QUERY_LOG_RATE;
+    gateway.memory_accounting = false;
+    gateway.writeq_high_water = DEFAULT_WRITEQ_HIGH_WATER;
+    gateway.writeq_low_water = DEFAULT_WRITEQ_LOW_WATER;
+    gateway.poll_io_uring = false;
+    gateway.qc_cache_size = DEFAULT_QC_CACHE_SIZE;
+    gateway.qc_large_statement_size = 0;
 
     if (version_string != NULL)
     {
@@ -2849,6 +3267,85 @@ int create_new_server(CONFIG_CONTEXT *obj)
             }
         }
 
+        const char *poolmin = config_get_value_string(obj->parameters, "persistpoolmin");
+        if (poolmin)
+        {
+            long int persistpoolmin = strtol(poolmin, &endptr, 0);
+            if (*endptr != '\0' || persistpoolmin < 0)
+            {
+                MXS_ERROR("Invalid value for 'persistpoolmin' for server %s: %s",
+                          server->unique_name, poolmin);
+                error_count++;
+            }
+            else
+            {
+                server->persistpoolmin = persistpoolmin;
+            }
+        }
+
+        const char *max_queries = config_get_value_string(obj->parameters, "max_concurrent_queries");
+        if (*max_queries)
+        {
+            long int max_concurrent_queries = strtol(max_queries, &endptr, 0);
+            if (*endptr != '\0' || max_concurrent_queries < 0 || max_concurrent_queries > INT_MAX)
+            {
+                MXS_ERROR("Invalid value for 'max_concurrent_queries' for server %s: %s",
+                          server->unique_name, max_queries);
+                error_count++;
+            }
+            else
+            {
+                server->max_concurrent_queries = max_concurrent_queries;
+            }
+        }
+
+        const char *queue_time = config_get_value_string(obj->parameters, "max_queue_time");
+        if (*queue_time)
+        {
+            long int max_queue_time = strtol(queue_time, &endptr, 0);
+            if (*endptr != '\0' || max_queue_time < 0 || max_queue_time > INT_MAX)
+            {
+                MXS_ERROR("Invalid value for 'max_queue_time' for server %s: %s",
+                          server->unique_name, queue_time);
+                error_count++;
+            }
+            else
+            {
+                server->max_queue_time = max_queue_time;
+            }
+        }
+
+        const char *compression = config_get_value_string(obj->parameters, "compression");
+        if (*compression)
+        {
+            int truth = config_truth_value(compression);
+            if (truth == -1)
+            {
+                MXS_ERROR("Invalid value for 'compression' for server %s: %s",
+                          server->unique_name, compression);
+                error_count++;
+            }
+            else
+            {
+                server->compression = truth;
+            }
+        }
+
+        const char *socket = config_get_value_string(obj->parameters, "socket");
+        if (*socket)
+        {
+            if (strlen(socket) >= sizeof(((struct sockaddr_un*)0)->sun_path))
+            {
+                MXS_ERROR("The value of 'socket' for server %s is too long: %s",
+                          server->unique_name, socket);
+                error_count++;
+            }
+            else if ((server->socket = MXS_STRDUP(socket)) == NULL)
+            {
+                error_count++;
+            }
+        }
+
         MXS_CONFIG_PARAMETER *params = obj->parameters;
 
         server->server_ssl = make_ssl_structure(obj, false, &error_count);
@@ -3074,6 +3571,46 @@ int create_new_monitor(CONFIG_CONTEXT *context, CONFIG_CONTEXT *obj, HASHTABLE*
             }
         }
 
+        char *load_metrics = config_get_value(obj->parameters, "load_metrics");
+        if (load_metrics && obj->element)
+        {
+            int truth = config_truth_value(load_metrics);
+            if (truth == -1)
+            {
+                MXS_ERROR("Invalid value for 'load_metrics' parameter for monitor '%s': %s",
+                          obj->object, load_metrics);
+                error_count++;
+            }
+            else
+            {
+                ((MXS_MONITOR*)obj->element)->load_metrics = truth;
+            }
+        }
+
+        char *server_variables = config_get_value(obj->parameters, "server_variables");
+        if (server_variables && obj->element &&
+            !mon_set_server_variables((MXS_MONITOR*)obj->element, server_variables))
+        {
+            error_count++;
+        }
+
+        char *journal_max_age = config_get_value(obj->parameters, "journal_max_age");
+        if (journal_max_age && obj->element)
+        {
+            char *endptr;
+            long age = strtol(journal_max_age, &endptr, 10);
+            if (*journal_max_age == '\0' || *endptr != '\0' || age < 0 || age > INT_MAX)
+            {
+                MXS_ERROR("Invalid value for 'journal_max_age' parameter for monitor '%s': %s",
+                          obj->object, journal_max_age);
+                error_count++;
+            }
+            else
+            {
+                ((MXS_MONITOR*)obj->element)->journal_max_age = age;
+            }
+        }
+
         if (servers)
         {
             /* get the servers to monitor */
@@ -3126,6 +3663,35 @@ int create_new_monitor(CONFIG_CONTEXT *context, CONFIG_CONTEXT *obj, HASHTABLE*
     return error_count;
 }
 
+/**
+ * @brief Get a non-negative integer parameter of a listener
+ *
+ * @param obj   Listener configuration context
+ * @param name  Name of the parameter
+ * @param value Where the value is stored, unchanged if the parameter is not defined
+ * @return False if the value is not a non-negative integer
+ */
+static bool get_listener_count(CONFIG_CONTEXT *obj, const char *name, int *value)
+{
+    const char *str = config_get_value_string(obj->parameters, name);
+
+    if (*str)
+    {
+        char *end;
+        long rval = strtol(str, &end, 10);
+
+        if (*end != '\0' || rval < 0 || rval > INT_MAX)
+        {
+            MXS_ERROR("Invalid value for '%s' for listener '%s': %s", name, obj->object, str);
+            return false;
+        }
+
+        *value = rval;
+    }
+
+    return true;
+}
+
 /**
  * Create a new listener for a service
  * @param obj Listener configuration context
@@ -3142,8 +3708,25 @@ int create_new_listener(CONFIG_CONTEXT *obj)
     char *socket = config_get_value(obj->parameters, "socket");
     char *authenticator = config_get_value(obj->parameters, "authenticator");
     char *authenticator_options = config_get_value(obj->parameters, "authenticator_options");
+    const char *compression = config_get_value_string(obj->parameters, "compression");
+    int use_compression = *compression ? config_truth_value(compression) : 0;
+    int backlog = 0;
+    int defer_accept = 0;
+    int fastopen = 0;
 
-    if (service_name && protocol && (socket || port))
+    if (!get_listener_count(obj, "listen_backlog", &backlog) ||
+        !get_listener_count(obj, "tcp_defer_accept", &defer_accept) ||
+        !get_listener_count(obj, "tcp_fastopen", &fastopen))
+    {
+        error_count++;
+    }
+    else if (use_compression == -1)
+    {
+        MXS_ERROR("Invalid value for 'compression' for listener '%s': %s",
+                  obj->object, compression);
+        error_count++;
+    }
+    else if (service_name && protocol && (socket || port))
     {
         SERVICE *service = service_find(service_name);
         if (service)
@@ -3159,8 +3742,16 @@ int create_new_listener(CONFIG_CONTEXT *obj)
                 }
                 else
                 {
-                    serviceCreateListener(service, obj->object, protocol, socket, 0,
-                                          authenticator, authenticator_options, ssl_info);
+                    SERV_LISTENER *listener = serviceCreateListener(service, obj->object, protocol, socket, 0,
+                                                                    authenticator, authenticator_options,
+                                                                    ssl_info);
+                    if (listener)
+                    {
+                        listener->compression = use_compression;
+                        listener->backlog = backlog;
+                        listener->defer_accept = defer_accept;
+                        listener->fastopen = fastopen;
+                    }
                 }
             }
 
@@ -3176,8 +3767,16 @@ int create_new_listener(CONFIG_CONTEXT *obj)
                 }
                 else
                 {
-                    serviceCreateListener(service, obj->object, protocol, address, atoi(port),
-                                          authenticator, authenticator_options, ssl_info);
+                    SERV_LISTENER *listener = serviceCreateListener(service, obj->object, protocol, address, atoi(port),
+                                                                    authenticator, authenticator_options,
+                                                                    ssl_info);
+                    if (listener)
+                    {
+                        listener->compression = use_compression;
+                        listener->backlog = backlog;
+                        listener->defer_accept = defer_accept;
+                        listener->fastopen = fastopen;
+                    }
                 }
             }
 
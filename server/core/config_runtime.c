@@ -329,6 +329,39 @@ bool runtime_alter_server(SERVER *server, char *key, char *value)
             valid = false;
         }
     }
+    else if (strcmp(key, "persistpoolmin") == 0)
+    {
+        if (is_valid_integer(value))
+        {
+            server->persistpoolmin = atoi(value);
+        }
+        else
+        {
+            valid = false;
+        }
+    }
+    else if (strcmp(key, "max_concurrent_queries") == 0)
+    {
+        if (is_valid_integer(value))
+        {
+            server->max_concurrent_queries = atoi(value);
+        }
+        else
+        {
+            valid = false;
+        }
+    }
+    else if (strcmp(key, "max_queue_time") == 0)
+    {
+        if (is_valid_integer(value))
+        {
+            server->max_queue_time = atoi(value);
+        }
+        else
+        {
+            valid = false;
+        }
+    }
     else
     {
         if (!server_remove_parameter(server, key) && !value[0])
@@ -457,6 +490,32 @@ bool runtime_alter_monitor(MXS_MONITOR *monitor, char *key, char *value)
             monitorSetNetworkTimeout(monitor, MONITOR_READ_TIMEOUT, ival);
         }
     }
+    else if (strcmp(key, "load_metrics") == 0)
+    {
+        int truth = config_truth_value(value);
+        if (truth != -1)
+        {
+            valid = true;
+            monitor->load_metrics = truth;
+        }
+    }
+    else if (strcmp(key, "server_variables") == 0)
+    {
+        /** The monitor reads the list while it is running */
+        monitorStop(monitor);
+        valid = mon_set_server_variables(monitor, value);
+        monitorStart(monitor, monitor->parameters);
+    }
+    else if (strcmp(key, "journal_max_age") == 0)
+    {
+        char *endptr;
+        long age = strtol(value, &endptr, 10);
+        if (*value && *endptr == '\0' && age >= 0 && age <= INT_MAX)
+        {
+            valid = true;
+            monitor->journal_max_age = age;
+        }
+    }
     else
     {
         /** We're modifying module specific parameters and we need to stop the monitor */
@@ -0,0 +1,273 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file crc32.c - CRC32 checksums with the instructions of the processor
+ *
+ * The binlog events and the Avro blocks use the CRC32 of zlib, the polynomial
+ * 0x04C11DB7 in the bit-reflected form. The CRC32 instruction of SSE4.2
+ * calculates CRC32C, a checksum with a different polynomial, and cannot be
+ * used. On x86-64 the data is instead folded with the carry-less
+ * multiplication instruction PCLMULQDQ as described in the paper "Fast CRC
+ * Computation for Generic Polynomials Using PCLMULQDQ Instruction" by Intel.
+ * ARMv8 has instructions for the polynomial of zlib.
+ *
+ * The implementation is selected when the first checksum is calculated. The
+ * crc32() function of zlib is used if the processor has neither of the
+ * instructions.
+ */
+
+#include <maxscale/crc32.h>
+#include <string.h>
+#include <zlib.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CRC32_PCLMUL
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define CRC32_ARMV8
+#endif
+
+typedef uint32_t (*crc32_func_t)(uint32_t crc, const uint8_t *buf, size_t len);
+
+static uint32_t crc32_resolve(uint32_t crc, const uint8_t *buf, size_t len);
+
+/** The selected implementation, resolved by the first call */
+static crc32_func_t crc32_func = crc32_resolve;
+static const char *crc32_name = "zlib";
+
+static uint32_t crc32_zlib(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    /** The length is an unsigned int in the interface of zlib */
+    while (len > UINT32_MAX)
+    {
+        crc = crc32(crc, buf, UINT32_MAX);
+        buf += UINT32_MAX;
+        len -= UINT32_MAX;
+    }
+
+    return crc32(crc, buf, len);
+}
+
+#ifdef CRC32_PCLMUL
+
+/** The shortest data that is folded, shorter data is given to zlib */
+#define CRC32_FOLD_MIN_LEN 64
+
+/**
+ * @brief Fold the data into a checksum
+ *
+ * The constants are the bit-reflected powers of x modulo the polynomial and
+ * the Barrett reduction constants given at the end of the paper by Intel.
+ *
+ * @param crc The inverted checksum of the preceding data
+ * @param buf The data
+ * @param len Length of the data, at least 64 bytes and a multiple of 16
+ * @return The inverted checksum
+ */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_fold(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    static const uint64_t k1k2[] __attribute__((aligned(16))) = { 0x0154442bd4, 0x01c6e41596 };
+    static const uint64_t k3k4[] __attribute__((aligned(16))) = { 0x01751997d0, 0x00ccaa009e };
+    static const uint64_t k5k0[] __attribute__((aligned(16))) = { 0x0163cd6124, 0x0000000000 };
+    static const uint64_t poly[] __attribute__((aligned(16))) = { 0x01db710641, 0x01f7011641 };
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128((const __m128i*)(buf + 0x00));
+    x2 = _mm_loadu_si128((const __m128i*)(buf + 0x10));
+    x3 = _mm_loadu_si128((const __m128i*)(buf + 0x20));
+    x4 = _mm_loadu_si128((const __m128i*)(buf + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+    x0 = _mm_load_si128((const __m128i*)k1k2);
+
+    buf += 64;
+    len -= 64;
+
+    /** Fold four 128-bit lanes in parallel */
+    while (len >= 64)
+    {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+        y5 = _mm_loadu_si128((const __m128i*)(buf + 0x00));
+        y6 = _mm_loadu_si128((const __m128i*)(buf + 0x10));
+        y7 = _mm_loadu_si128((const __m128i*)(buf + 0x20));
+        y8 = _mm_loadu_si128((const __m128i*)(buf + 0x30));
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+        buf += 64;
+        len -= 64;
+    }
+
+    /** Fold the lanes into one */
+    x0 = _mm_load_si128((const __m128i*)k3k4);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    /** Fold the remaining 16 byte blocks */
+    while (len >= 16)
+    {
+        x2 = _mm_loadu_si128((const __m128i*)buf);
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+        buf += 16;
+        len -= 16;
+    }
+
+    /** Fold 128 bits into 64 bits */
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+
+    x0 = _mm_loadl_epi64((const __m128i*)k5k0);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    /** Barrett reduction into 32 bits */
+    x0 = _mm_load_si128((const __m128i*)poly);
+
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return _mm_extract_epi32(x1, 1);
+}
+
+static uint32_t crc32_pclmul(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    if (len >= CRC32_FOLD_MIN_LEN)
+    {
+        size_t folded = len & ~(size_t)15;
+        crc = ~crc32_fold(~crc, buf, folded);
+        buf += folded;
+        len -= folded;
+    }
+
+    return len ? crc32_zlib(crc, buf, len) : crc;
+}
+
+#endif
+
+#ifdef CRC32_ARMV8
+
+__attribute__((target("+crc")))
+static uint32_t crc32_armv8(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    crc = ~crc;
+
+    while (len > 0 && ((uintptr_t)buf & 7))
+    {
+        crc = __crc32b(crc, *buf++);
+        len--;
+    }
+
+    while (len >= 8)
+    {
+        uint64_t value;
+        memcpy(&value, buf, sizeof(value));
+        crc = __crc32d(crc, value);
+        buf += 8;
+        len -= 8;
+    }
+
+    while (len > 0)
+    {
+        crc = __crc32b(crc, *buf++);
+        len--;
+    }
+
+    return ~crc;
+}
+
+#endif
+
+/**
+ * @brief Select the implementation and calculate the first checksum
+ *
+ * The threads that calculate a checksum at the same time all select the same
+ * implementation so the function pointer needs no locking.
+ */
+static uint32_t crc32_resolve(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    crc32_func_t func = crc32_zlib;
+
+#if defined(CRC32_PCLMUL)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1"))
+    {
+        func = crc32_pclmul;
+        crc32_name = "pclmul";
+    }
+#elif defined(CRC32_ARMV8)
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32)
+    {
+        func = crc32_armv8;
+        crc32_name = "armv8";
+    }
+#endif
+
+    crc32_func = func;
+    return func(crc, buf, len);
+}
+
+uint32_t mxs_crc32(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    return crc32_func(crc, buf, len);
+}
+
+const char* mxs_crc32_implementation()
+{
+    if (crc32_func == crc32_resolve)
+    {
+        /** Resolve the implementation */
+        mxs_crc32(0, NULL, 0);
+    }
+
+    return crc32_name;
+}
@@ -66,6 +66,8 @@
 #include <maxscale/dcb.h>
 
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -89,37 +91,91 @@
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <maxscale/alloc.h>
+#include <maxscale/freelist.h>
 #include <maxscale/utils.h>
 #include <maxscale/platform.h>
+#include <maxscale/probes.h>
 
 #include "maxscale/session.h"
 #include "maxscale/modules.h"
+#include "maxscale/poll.h"
 #include "maxscale/queuemanager.h"
+#include "maxscale/trace.h"
+#include "maxscale/hot_restart.h"
+#include "maxscale/qsbr.h"
 
 /* A DCB with null values, used for initialization */
 static DCB dcb_initialized = DCB_INIT;
 
 static  DCB           **all_dcbs;
 static  SPINLOCK       *all_dcbs_lock;
-static  DCB           **zombies;
-static  int            *nzombies;
-static  int             maxzombies = 0;
-static  SPINLOCK        zombiespin = SPINLOCK_INIT;
+static  MXS_FREELIST   *dcb_freelist = NULL;
 
-/** Variables for session timeout checks */
-bool check_timeouts = false;
-thread_local long next_timeout_check = 0;
+/** Number of slots in the timer wheel of a thread */
+#define DCB_TIMER_SLOTS 512
+
+/** Heartbeats per timer wheel slot, the timers expire with the resolution of a second */
+#define DCB_TIMER_RESOLUTION 10
+
+/** The most persistent connections closed by one timer wheel slot */
+#define DCB_TIMER_MAX_POOL_CLEANUPS 16
+
+/**
+ * The timers of the DCBs of one thread
+ *
+ * A DCB with a timer is in the slot of its deadline. The slots are processed
+ * once a second and a slot holds the timers of every DCB_TIMER_SLOTS seconds, the
+ * timers that expire on a later round are left in the slot. The timer of a
+ * client DCB is not updated when the client sends data: once the timer expires,
+ * the timer is set again from the time of the last read if the client was not
+ * idle for long enough.
+ */
+typedef struct dcb_timer_wheel
+{
+    DCB  *slots[DCB_TIMER_SLOTS]; /*< The DCBs with a timer in each slot */
+    long  tick;                   /*< The next slot to process, in seconds */
+} DCB_TIMER_WHEEL;
+
+static DCB_TIMER_WHEEL *timer_wheels;
+
+/** Maximum number of buffers written with one writev call */
+#define DCB_MAX_IOVEC IOV_MAX
+
+/** Buffer used to combine small buffers into one TLS record */
+static thread_local uint8_t ssl_write_buffer[SSL3_RT_MAX_PLAIN_LENGTH];
+
+/** Size of the per-thread buffer that sockets are read into */
+#define DCB_READ_BUFFER_SIZE (64 * 1024)
+
+/** Reads of at least this size take over the read buffer instead of copying it */
+#define DCB_READ_HANDOVER_SIZE (DCB_READ_BUFFER_SIZE / 2)
+
+/** The per-thread read buffer */
+static thread_local GWBUF *read_buffer = NULL;
+
+/** The DCBs whose write queues are drained at the end of the current write batch */
+static thread_local struct
+{
+    DCB **dcbs;     /**< DCBs that were written to */
+    int   count;    /**< Number of DCBs in @c dcbs */
+    int   size;     /**< Size of @c dcbs */
+    int   depth;    /**< Nesting depth of the batch, zero if no batch is active */
+} write_batch;
+
+/** True while a connection is opened to refill the persistent pool */
+static thread_local bool dcb_prewarming = false;
 
 void dcb_global_init()
 {
     int nthreads = config_threadcount();
 
-    if ((zombies = MXS_CALLOC(nthreads, sizeof(DCB*))) == NULL ||
-        (all_dcbs = MXS_CALLOC(nthreads, sizeof(DCB*))) == NULL ||
+    if ((all_dcbs = MXS_CALLOC(nthreads, sizeof(DCB*))) == NULL ||
         (all_dcbs_lock = MXS_CALLOC(nthreads, sizeof(SPINLOCK))) == NULL ||
-        (nzombies = MXS_CALLOC(nthreads, sizeof(int))) == NULL)
+        (timer_wheels = MXS_CALLOC(nthreads, sizeof(DCB_TIMER_WHEEL))) == NULL ||
+        (dcb_freelist = mxs_freelist_create(sizeof(DCB), MXS_FREELIST_DEFAULT_MAX)) == NULL)
     {
         MXS_OOM();
         raise(SIGABRT);
@@ -128,6 +184,7 @@ void dcb_global_init()
     for (int i = 0; i < nthreads; i++)
     {
         spinlock_init(&all_dcbs_lock[i]);
+        spinlock_register(&all_dcbs_lock[i], "dcb list");
     }
 }
 
@@ -137,29 +194,53 @@ static void dcb_call_callback(DCB *dcb, DCB_REASON reason);
 static int  dcb_null_write(DCB *dcb, GWBUF *buf);
 static int  dcb_null_auth(DCB *dcb, SERVER *server, MXS_SESSION *session, GWBUF *buf);
 static inline DCB * dcb_find_in_list(DCB *dcb);
-static inline void dcb_process_victim_queue(int threadid);
+static void dcb_reclaim(void *data);
 static void dcb_stop_polling_and_shutdown (DCB *dcb);
 static bool dcb_maybe_add_persistent(DCB *);
 static inline bool dcb_write_parameter_check(DCB *dcb, GWBUF *queue);
-static int dcb_bytes_readable(DCB *dcb);
-static int dcb_read_no_bytes_available(DCB *dcb, int nreadtotal);
 static int dcb_create_SSL(DCB* dcb, SSL_LISTENER *ssl);
 static int dcb_read_SSL(DCB *dcb, GWBUF **head);
-static GWBUF *dcb_basic_read(DCB *dcb, int bytesavailable, int maxbytes, int nreadtotal, int *nsingleread);
+static GWBUF *dcb_basic_read(DCB *dcb, int bufsize, int *nsingleread);
 static GWBUF *dcb_basic_read_SSL(DCB *dcb, int *nsingleread);
 static void dcb_log_write_failure(DCB *dcb, GWBUF *queue, int eno);
 static inline void dcb_write_tidy_up(DCB *dcb, bool below_water);
+static bool dcb_write_batch_add(DCB *dcb);
+static void dcb_prewarm_persistent(SERVER *server, MXS_SESSION *session, const char *protocol);
 static int gw_write(DCB *dcb, GWBUF *writeq, bool *stop_writing);
 static int gw_write_SSL(DCB *dcb, GWBUF *writeq, bool *stop_writing);
 static int dcb_log_errors_SSL (DCB *dcb, const char *called_by, int ret);
 static int dcb_accept_one_connection(DCB *listener, struct sockaddr *client_conn);
-static int dcb_listen_create_socket_inet(const char *host, uint16_t port);
+static int dcb_listen_create_socket_inet(const char *host, uint16_t port, bool reuseport);
+static bool dcb_listen_create_thread_sockets(DCB *listener, const char *host, uint16_t port);
+static int dcb_listen_socket(DCB *listener, int listener_socket, bool inet);
+static void dcb_listen_set_incoming_cpu(int fd, int thread_id);
+static void dcb_close_thread_sockets(DCB *listener);
+static void dcb_timer_set(DCB *dcb, long deadline);
+static void dcb_timer_clear(DCB *dcb);
+static void dcb_timer_set_idle(DCB *dcb);
 static int dcb_listen_create_socket_unix(const char *path);
 static int dcb_set_socket_option(int sockfd, int level, int optname, void *optval, socklen_t optlen);
 static void dcb_add_to_all_list(DCB *dcb);
 static DCB *dcb_find_free();
 static GWBUF *dcb_grab_writeq(DCB *dcb, bool first_time);
 static void dcb_remove_from_list(DCB *dcb);
+static int upstream_throttle_callback(DCB *dcb, DCB_REASON reason, void *userdata);
+static bool dcb_splice_flush(DCB *dest);
+static void dcb_splice_resume(DCB *dest);
+static void dcb_splice_stop(DCB *dcb);
+
+/**
+ * Record the arrival of the reply to a traced statement
+ *
+ * @param dcb The DCB that was read from
+ */
+static inline void dcb_trace_read(DCB *dcb)
+{
+    if (dcb->dcb_role == DCB_ROLE_BACKEND_HANDLER && dcb->session && dcb->session->trace)
+    {
+        session_trace_backend_read(dcb->session);
+    }
+}
 
 size_t dcb_get_session_id(
     DCB *dcb)
@@ -167,6 +248,41 @@ size_t dcb_get_session_id(
     return (dcb && dcb->session) ? dcb->session->ses_id : 0;
 }
 
+size_t dcb_memory_usage(const DCB *dcb)
+{
+    size_t size = sizeof(DCB);
+
+    if (dcb->splice)
+    {
+        size += sizeof(DCB_SPLICE);
+    }
+
+    if (dcb->thread_fds)
+    {
+        size += config_threadcount() * sizeof(int);
+    }
+
+    const char *strings[] = {dcb->remote, dcb->user, dcb->protoname};
+
+    for (size_t i = 0; i < sizeof(strings) / sizeof(strings[0]); i++)
+    {
+        if (strings[i])
+        {
+            size += strlen(strings[i]) + 1;
+        }
+    }
+
+    for (DCB_CALLBACK *cb = dcb->callbacks; cb; cb = cb->next)
+    {
+        size += sizeof(*cb);
+    }
+
+    size += gwbuf_length(dcb->writeq) + gwbuf_length(dcb->delayq) +
+            gwbuf_length(dcb->dcb_readqueue) + gwbuf_length(dcb->dcb_fakequeue);
+
+    return size;
+}
+
 /**
  * @brief Initialize a DCB
  *
@@ -206,7 +322,16 @@ dcb_alloc(dcb_role_t role, SERV_LISTENER *listener)
 {
     DCB *newdcb;
 
-    if ((newdcb = (DCB *)MXS_MALLOC(sizeof(*newdcb))) == NULL)
+    if (dcb_freelist)
+    {
+        newdcb = (DCB*)mxs_freelist_alloc(dcb_freelist);
+    }
+    else
+    {
+        newdcb = (DCB*)MXS_MALLOC(sizeof(*newdcb));
+    }
+
+    if (newdcb == NULL)
     {
         return NULL;
     }
@@ -296,9 +421,6 @@ dcb_clone(DCB *orig)
 /**
  * Free a DCB and remove it from the chain of all DCBs
  *
- * NB This is called with the caller holding the zombie queue
- * spinlock
- *
  * @param dcb The DCB to free
  */
 static void
@@ -358,7 +480,14 @@ dcb_free_all_memory(DCB *dcb)
 
     if (dcb->protocol && (!DCB_IS_CLONE(dcb)))
     {
-        MXS_FREE(dcb->protocol);
+        if (dcb->func.free_protocol)
+        {
+            dcb->func.free_protocol(dcb->protocol);
+        }
+        else
+        {
+            MXS_FREE(dcb->protocol);
+        }
     }
     if (dcb->data && dcb->authfunc.free && !DCB_IS_CLONE(dcb))
     {
@@ -416,161 +545,149 @@ dcb_free_all_memory(DCB *dcb)
         SSL_free(dcb->ssl);
     }
 
-    /* We never free the actual DCB, it is available for reuse*/
-    MXS_FREE(dcb);
+    MXS_FREE(dcb->thread_fds);
+    MXS_FREE(dcb->splice);
 
-}
-
-/**
- * Process the DCB zombie queue
- *
- * This routine is called by each of the polling threads with
- * the thread id of the polling thread. It must clear the bit in
- * the memdata bitmask for the polling thread that calls it. If the
- * operation of clearing this bit means that no bits are set in
- * the memdata.bitmask then the DCB is no longer able to be
- * referenced and it can be finally removed.
- *
- * @param       threadid        The thread ID of the caller
- */
-void dcb_process_zombies(int threadid)
-{
-    if (zombies[threadid])
+    /** The memory is kept in the thread's free list for the next DCB */
+    if (dcb_freelist)
+    {
+        mxs_freelist_free(dcb_freelist, dcb);
+    }
+    else
     {
-        dcb_process_victim_queue(threadid);
+        MXS_FREE(dcb);
     }
 }
 
 /**
- * Process the victim queue, selected from the list of zombies
+ * Close and free a DCB that no thread can refer to
  *
- * These are the DCBs that are not in use by any thread.  The corresponding
- * file descriptor is closed, the DCB marked as disconnected and the DCB
- * itself is finally freed.
+ * This is called for a closed DCB once every polling thread has passed a
+ * quiescent state after the DCB was closed. A DCB that is still polling is
+ * either taken into the persistent pool or shut down, and in the latter case
+ * the DCB is freed after another grace period so that the events that were
+ * already read for it are processed first. Otherwise the file descriptor is
+ * closed, the DCB marked as disconnected and the DCB itself is finally freed.
  *
- * @param       listofdcb       The first victim DCB
+ * @param data The DCB to reclaim
  */
-static inline void
-dcb_process_victim_queue(int threadid)
+static void dcb_reclaim(void *data)
 {
-    /** Grab the zombie queue to a local queue. This allows us to add back DCBs
-     * that should not yet be closed. */
-    DCB *dcblist = zombies[threadid];
-    zombies[threadid] = NULL;
+    DCB *dcb = (DCB*)data;
 
-    while (dcblist)
+    if (poll_thread && dcb->thread.id != current_thread_id)
     {
-        DCB *dcb = dcblist;
+        /** The thread-specific data of the DCB is handled by its owner */
+        if (!poll_call_in_thread(dcb->thread.id, dcb_reclaim, dcb))
+        {
+            mxs_qsbr_defer(dcb_reclaim, dcb);
+        }
+        return;
+    }
 
-        if (dcb->state == DCB_STATE_POLLING  || dcb->state == DCB_STATE_LISTENING)
+    if (dcb->state == DCB_STATE_POLLING  || dcb->state == DCB_STATE_LISTENING)
+    {
+        if (dcb->state == DCB_STATE_LISTENING)
+        {
+            MXS_ERROR("%lu [%s] Error : Removing DCB %p but was in state %s "
+                      "which is not expected for a call to dcb_close, although it"
+                      "should be processed correctly. ",
+                      pthread_self(),
+                      __func__,
+                      dcb,
+                      STRDCBSTATE(dcb->state));
+        }
+        else
         {
-            if (dcb->state == DCB_STATE_LISTENING)
+            if (0 == dcb->persistentstart && dcb_maybe_add_persistent(dcb))
             {
-                MXS_ERROR("%lu [%s] Error : Removing DCB %p but was in state %s "
-                          "which is not expected for a call to dcb_close, although it"
-                          "should be processed correctly. ",
-                          pthread_self(),
-                          __func__,
-                          dcb,
-                          STRDCBSTATE(dcb->state));
+                /* Have taken DCB into persistent pool, no further killing */
             }
             else
             {
-                if (0 == dcb->persistentstart && dcb_maybe_add_persistent(dcb))
-                {
-                    /* Have taken DCB into persistent pool, no further killing */
-                    dcblist = dcblist->memdata.next;
-                }
-                else
-                {
-                    /** The DCB is still polling. Shut it down and process it later. */
-                    dcb_stop_polling_and_shutdown(dcb);
-                    DCB *newzombie = dcblist;
-                    dcblist = dcblist->memdata.next;
-                    newzombie->memdata.next = zombies[threadid];
-                    zombies[threadid] = newzombie;
-                }
-
-                /** Nothing to do here but to process the next DCB */
-                continue;
+                /** The DCB is still polling. Shut it down and process it later. */
+                dcb_stop_polling_and_shutdown(dcb);
+                mxs_qsbr_defer(dcb_reclaim, dcb);
             }
-        }
 
-        nzombies[threadid]--;
+            return;
+        }
+    }
 
-        /*
-         * Into the final close logic, so if DCB is for backend server, we
-         * must decrement the number of current connections.
-         */
-        if (DCB_ROLE_CLIENT_HANDLER == dcb->dcb_role)
+    /*
+     * Into the final close logic, so if DCB is for backend server, we
+     * must decrement the number of current connections.
+     */
+    if (DCB_ROLE_CLIENT_HANDLER == dcb->dcb_role)
+    {
+        if (dcb->service)
         {
-            if (dcb->service)
+            if (dcb->protocol)
             {
-                if (dcb->protocol)
+                QUEUE_ENTRY conn_waiting;
+                if (mxs_dequeue(dcb->service->queued_connections, &conn_waiting))
                 {
-                    QUEUE_ENTRY conn_waiting;
-                    if (mxs_dequeue(dcb->service->queued_connections, &conn_waiting))
-                    {
-                        DCB *waiting_dcb = (DCB *)conn_waiting.queued_object;
-                        waiting_dcb->state = DCB_STATE_WAITING;
-                        poll_fake_read_event(waiting_dcb);
-                    }
-                    else
-                    {
-                        atomic_add(&dcb->service->client_count, -1);
-                    }
+                    DCB *waiting_dcb = (DCB *)conn_waiting.queued_object;
+                    waiting_dcb->state = DCB_STATE_WAITING;
+                    poll_fake_read_event(waiting_dcb);
+                }
+                else
+                {
+                    atomic_add(&dcb->service->client_count, -1);
                 }
-            }
-            else
-            {
-                MXS_ERROR("Closing client handler DCB, but it has no related service");
             }
         }
-        if (dcb->server && 0 == dcb->persistentstart)
+        else
         {
-            atomic_add(&dcb->server->stats.n_current, -1);
+            MXS_ERROR("Closing client handler DCB, but it has no related service");
         }
+    }
+    if (dcb->server && 0 == dcb->persistentstart)
+    {
+        atomic_add(&dcb->server->stats.n_current, -1);
+    }
 
-        if (dcb->fd > 0)
-        {
-            /*<
-             * Close file descriptor and move to clean-up phase.
-             */
-            if (close(dcb->fd) < 0)
-            {
-                int eno = errno;
-                errno = 0;
-                char errbuf[MXS_STRERROR_BUFLEN];
-                MXS_ERROR("%lu [dcb_process_victim_queue] Error : Failed to close "
-                          "socket %d on dcb %p due error %d, %s.",
-                          pthread_self(),
-                          dcb->fd,
-                          dcb,
-                          eno,
-                          strerror_r(eno, errbuf, sizeof(errbuf)));
-            }
-            else
-            {
-                dcb->fd = DCBFD_CLOSED;
+    if (dcb->thread_fds)
+    {
+        dcb_close_thread_sockets(dcb);
+    }
 
-                MXS_DEBUG("%lu [dcb_process_victim_queue] Closed socket "
-                          "%d on dcb %p.",
-                          pthread_self(),
-                          dcb->fd,
-                          dcb);
-            }
+    if (dcb->fd > 0)
+    {
+        /*<
+         * Close file descriptor and move to clean-up phase.
+         */
+        if (close(dcb->fd) < 0)
+        {
+            int eno = errno;
+            errno = 0;
+            char errbuf[MXS_STRERROR_BUFLEN];
+            MXS_ERROR("%lu [dcb_reclaim] Error : Failed to close "
+                      "socket %d on dcb %p due error %d, %s.",
+                      pthread_self(),
+                      dcb->fd,
+                      dcb,
+                      eno,
+                      strerror_r(eno, errbuf, sizeof(errbuf)));
         }
+        else
+        {
+            dcb->fd = DCBFD_CLOSED;
 
-        /** Move to the next DCB before freeing the previous one */
-        dcblist = dcblist->memdata.next;
-
-        /** After these calls, the DCB should be treated as if it were freed.
-         * Whether it is actually freed depends on the type of the DCB and how
-         * many DCBs are linked to it via the MXS_SESSION object. */
-        dcb->state = DCB_STATE_DISCONNECTED;
-        dcb_remove_from_list(dcb);
-        dcb_final_free(dcb);
+            MXS_DEBUG("%lu [dcb_reclaim] Closed socket "
+                      "%d on dcb %p.",
+                      pthread_self(),
+                      dcb->fd,
+                      dcb);
+        }
     }
+
+    /** After these calls, the DCB should be treated as if it were freed.
+     * Whether it is actually freed depends on the type of the DCB and how
+     * many DCBs are linked to it via the MXS_SESSION object. */
+    dcb->state = DCB_STATE_DISCONNECTED;
+    dcb_remove_from_list(dcb);
+    dcb_final_free(dcb);
 }
 
 /**
@@ -613,7 +730,7 @@ dcb_connect(SERVER *server, MXS_SESSION *session, const char *protocol)
     const char  *user;
 
     user = session_get_user(session);
-    if (user && strlen(user))
+    if (user && strlen(user) && !dcb_prewarming)
     {
         MXS_DEBUG("%lu [dcb_connect] Looking for persistent connection DCB "
                   "user %s protocol %s\n", pthread_self(), user, protocol);
@@ -636,8 +753,16 @@ dcb_connect(SERVER *server, MXS_SESSION *session, const char *protocol)
                       pthread_self(), dcb);
             dcb->persistentstart = 0;
             dcb->was_persistent = true;
+            dcb->flags &= ~(DCBF_REUSABLE | DCBF_PREWARM);
             dcb->last_read = hkheartbeat;
             atomic_add_uint64(&server->stats.n_from_pool, 1);
+
+            if (DCB_ABOVE_HIGH_WATER(session->client_dcb))
+            {
+                poll_throttle_dcb(dcb, true);
+            }
+
+            dcb_prewarm_persistent(server, session, protocol);
             return dcb;
         }
         else
@@ -753,6 +878,9 @@ dcb_connect(SERVER *server, MXS_SESSION *session, const char *protocol)
         return NULL;
     }
 
+    /** A connection opened while the client is slow is not read from either */
+    dcb->throttled = DCB_ABOVE_HIGH_WATER(session->client_dcb);
+
     /**
      * Add the dcb in the poll set
      */
@@ -770,9 +898,43 @@ dcb_connect(SERVER *server, MXS_SESSION *session, const char *protocol)
     atomic_add(&server->stats.n_connections, 1);
     atomic_add(&server->stats.n_current, 1);
 
+    dcb_prewarm_persistent(server, session, protocol);
+
     return dcb;
 }
 
+/**
+ * Refill the persistent pool of the current thread
+ *
+ * If the pool has fewer than @c persistpoolmin connections, one extra
+ * connection is opened with the credentials of the session. The protocol
+ * module puts the connection into the pool once the authentication is
+ * complete and it is later reset with COM_CHANGE_USER when it is used.
+ *
+ * @param server   The server that was connected to
+ * @param session  The session the connection was made for
+ * @param protocol The protocol module to use
+ */
+static void dcb_prewarm_persistent(SERVER *server, MXS_SESSION *session, const char *protocol)
+{
+    int id = session->client_dcb->thread.id;
+
+    if (server->persistpoolmin > 0 && !dcb_prewarming &&
+        server->stats.n_persistent < server->persistpoolmax &&
+        dcb_persistent_clean_count(server->persistent[id], id, false) < server->persistpoolmin)
+    {
+        dcb_prewarming = true;
+        DCB *dcb = dcb_connect(server, session, protocol);
+        dcb_prewarming = false;
+
+        if (dcb)
+        {
+            dcb->flags |= DCBF_PREWARM | DCBF_REUSABLE;
+            atomic_add_uint64(&server->stats.n_prewarmed, 1);
+        }
+    }
+}
+
 /**
  * General purpose read routine to read data from a socket in the
  * Descriptor Control Block and append it to a linked list of buffers.
@@ -824,191 +986,154 @@ int dcb_read(DCB   *dcb,
 
     while (0 == maxbytes || nreadtotal < maxbytes)
     {
-        int bytes_available;
+        GWBUF *buffer;
+        int bufsize = DCB_READ_BUFFER_SIZE;
 
-        bytes_available = dcb_bytes_readable(dcb);
-        if (bytes_available <= 0)
+        if (maxbytes)
         {
-            return bytes_available < 0 ? -1 :
-                   /** Handle closed client socket */
-                   dcb_read_no_bytes_available(dcb, nreadtotal);
+            bufsize = MXS_MIN(bufsize, maxbytes - nreadtotal);
         }
-        else
+
+        buffer = dcb_basic_read(dcb, bufsize, &nsingleread);
+
+        if (buffer)
         {
-            GWBUF *buffer;
             dcb->last_read = hkheartbeat;
+            dcb_trace_read(dcb);
+            nreadtotal += nsingleread;
+            /* <editor-fold defaultstate="collapsed" desc=" Debug Logging "> */
+            MXS_DEBUG("%lu [dcb_read] Read %d bytes from dcb %p in state %s "
+                      "fd %d.",
+                      pthread_self(),
+                      nsingleread,
+                      dcb,
+                      STRDCBSTATE(dcb->state),
+                      dcb->fd);
+            /* </editor-fold> */
+            /*< Assign the target server for the gwbuf */
+            buffer->server = dcb->server;
+            /*< Append read data to the gwbuf */
+            *head = gwbuf_append(*head, buffer);
 
-            buffer = dcb_basic_read(dcb, bytes_available, maxbytes, nreadtotal, &nsingleread);
-            if (buffer)
-            {
-                nreadtotal += nsingleread;
-                /* <editor-fold defaultstate="collapsed" desc=" Debug Logging "> */
-                MXS_DEBUG("%lu [dcb_read] Read %d bytes from dcb %p in state %s "
-                          "fd %d.",
-                          pthread_self(),
-                          nsingleread,
-                          dcb,
-                          STRDCBSTATE(dcb->state),
-                          dcb->fd);
-                /* </editor-fold> */
-                /*< Assign the target server for the gwbuf */
-                buffer->server = dcb->server;
-                /*< Append read data to the gwbuf */
-                *head = gwbuf_append(*head, buffer);
-            }
-            else
+            if (nsingleread < bufsize)
             {
+                /** The socket has been drained */
                 break;
             }
         }
+        else if (nsingleread < 0 && nreadtotal == 0 &&
+                 DCB_ROLE_CLIENT_HANDLER == dcb->dcb_role)
+        {
+            return -1;
+        }
+        else
+        {
+            break;
+        }
     } /*< while (0 == maxbytes || nreadtotal < maxbytes) */
 
     return nreadtotal;
 }
 
 /**
- * Find the number of bytes available for the DCB's socket
+ * Basic read function to carry out a single read operation on the DCB socket.
  *
- * @param dcb       The DCB to read from
- * @return          -1 on error, otherwise the total number of bytes available
+ * The data is read into the thread's read buffer. Small reads are copied into
+ * a buffer of the exact size and the read buffer is reused. Large reads take
+ * over the whole read buffer to avoid the copy and a new one is allocated
+ * for the next read.
+ *
+ * @param dcb               The DCB to read from
+ * @param bufsize           Maximum number of bytes to read
+ * @param nsingleread       Set to the number of bytes read, 0 if no data was
+ *                          available and -1 on error
+ * @return                  GWBUF* buffer containing new data, or null.
  */
-static int
-dcb_bytes_readable(DCB *dcb)
+static GWBUF *
+dcb_basic_read(DCB *dcb, int bufsize, int *nsingleread)
 {
-    int bytesavailable;
+    GWBUF *buffer = NULL;
+    bool oom = false;
+
+    ss_dassert(bufsize <= DCB_READ_BUFFER_SIZE);
+
+    if (read_buffer == NULL && (read_buffer = gwbuf_alloc(DCB_READ_BUFFER_SIZE)) == NULL)
+    {
+        oom = true;
+    }
+    else
+    {
+        *nsingleread = read(dcb->fd, GWBUF_DATA(read_buffer), bufsize);
+        dcb->stats.n_reads++;
+
+        if (*nsingleread >= DCB_READ_HANDOVER_SIZE)
+        {
+            buffer = read_buffer;
+            read_buffer = NULL;
+            buffer->end = (char*)buffer->start + *nsingleread;
+        }
+        else if (*nsingleread > 0)
+        {
+            buffer = gwbuf_alloc_and_load(*nsingleread, GWBUF_DATA(read_buffer));
+            oom = buffer == NULL;
+        }
+        else if (*nsingleread < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                *nsingleread = 0;
+            }
+            else if (errno != ECONNRESET)
+            {
+                char errbuf[MXS_STRERROR_BUFLEN];
+                /* <editor-fold defaultstate="collapsed" desc=" Error Logging "> */
+                MXS_ERROR("%lu [dcb_read] Error : Read failed, dcb %p in state "
+                          "%s fd %d, due %d, %s.",
+                          pthread_self(),
+                          dcb,
+                          STRDCBSTATE(dcb->state),
+                          dcb->fd,
+                          errno,
+                          strerror_r(errno, errbuf, sizeof(errbuf)));
+                /* </editor-fold> */
+            }
+        }
+    }
 
-    if (-1 == ioctl(dcb->fd, FIONREAD, &bytesavailable))
+    if (oom)
     {
+        /*<
+         * This is a fatal error which should cause shutdown.
+         * Todo shutdown if memory allocation fails.
+         */
         char errbuf[MXS_STRERROR_BUFLEN];
         /* <editor-fold defaultstate="collapsed" desc=" Error Logging "> */
-        MXS_ERROR("%lu [dcb_read] Error : ioctl FIONREAD for dcb %p in "
-                  "state %s fd %d failed due error %d, %s.",
+        MXS_ERROR("%lu [dcb_read] Error : Failed to allocate read buffer "
+                  "for dcb %p fd %d, due %d, %s.",
                   pthread_self(),
                   dcb,
-                  STRDCBSTATE(dcb->state),
                   dcb->fd,
                   errno,
                   strerror_r(errno, errbuf, sizeof(errbuf)));
         /* </editor-fold> */
-        return -1;
-    }
-    else
-    {
-        return bytesavailable;
+        *nsingleread = -1;
     }
+
+    return buffer;
 }
 
 /**
- * Determine the return code needed when read has run out of data
+ * General purpose read routine to read data from a socket through the SSL
+ * structure lined with this DCB and append it to a linked list of buffers.
+ * The list may be empty, in which case *head == NULL. The SSL structure should
+ * be initialized and the SSL handshake should be done.
  *
- * @param dcb           The DCB to read from
- * @param nreadtotal    Number of bytes that have been read
- * @return              -1 on error, 0 for conditions not treated as error
+ * @param dcb   The DCB to read from
+ * @param head  Pointer to linked list to append data to
+ * @return      -1 on error, otherwise the total number of bytes read
  */
 static int
-dcb_read_no_bytes_available(DCB *dcb, int nreadtotal)
-{
-    /** Handle closed client socket */
-    if (nreadtotal == 0 && DCB_ROLE_CLIENT_HANDLER == dcb->dcb_role)
-    {
-        char c;
-        int l_errno = 0;
-        long r = -1;
-
-        /* try to read 1 byte, without consuming the socket buffer */
-        r = recv(dcb->fd, &c, sizeof(char), MSG_PEEK);
-        l_errno = errno;
-
-        if (r <= 0 &&
-            l_errno != EAGAIN &&
-            l_errno != EWOULDBLOCK &&
-            l_errno != 0)
-        {
-            return -1;
-        }
-    }
-    return nreadtotal;
-}
-
-/**
- * Basic read function to carry out a single read operation on the DCB socket.
- *
- * @param dcb               The DCB to read from
- * @param bytesavailable    Pointer to linked list to append data to
- * @param maxbytes          Maximum bytes to read (0 = no limit)
- * @param nreadtotal        Total number of bytes already read
- * @param nsingleread       To be set as the number of bytes read this time
- * @return                  GWBUF* buffer containing new data, or null.
- */
-static GWBUF *
-dcb_basic_read(DCB *dcb, int bytesavailable, int maxbytes, int nreadtotal, int *nsingleread)
-{
-    GWBUF *buffer;
-
-    int bufsize = MXS_MIN(bytesavailable, MXS_MAX_NW_READ_BUFFER_SIZE);
-    if (maxbytes)
-    {
-        bufsize = MXS_MIN(bufsize, maxbytes - nreadtotal);
-    }
-
-    if ((buffer = gwbuf_alloc(bufsize)) == NULL)
-    {
-        /*<
-         * This is a fatal error which should cause shutdown.
-         * Todo shutdown if memory allocation fails.
-         */
-        char errbuf[MXS_STRERROR_BUFLEN];
-        /* <editor-fold defaultstate="collapsed" desc=" Error Logging "> */
-        MXS_ERROR("%lu [dcb_read] Error : Failed to allocate read buffer "
-                  "for dcb %p fd %d, due %d, %s.",
-                  pthread_self(),
-                  dcb,
-                  dcb->fd,
-                  errno,
-                  strerror_r(errno, errbuf, sizeof(errbuf)));
-        /* </editor-fold> */
-        *nsingleread = -1;
-    }
-    else
-    {
-        *nsingleread = read(dcb->fd, GWBUF_DATA(buffer), bufsize);
-        dcb->stats.n_reads++;
-
-        if (*nsingleread <= 0)
-        {
-            if (errno != 0 && errno != EAGAIN && errno != EWOULDBLOCK)
-            {
-                char errbuf[MXS_STRERROR_BUFLEN];
-                /* <editor-fold defaultstate="collapsed" desc=" Error Logging "> */
-                MXS_ERROR("%lu [dcb_read] Error : Read failed, dcb %p in state "
-                          "%s fd %d, due %d, %s.",
-                          pthread_self(),
-                          dcb,
-                          STRDCBSTATE(dcb->state),
-                          dcb->fd,
-                          errno,
-                          strerror_r(errno, errbuf, sizeof(errbuf)));
-                /* </editor-fold> */
-            }
-            gwbuf_free(buffer);
-            buffer = NULL;
-        }
-    }
-    return buffer;
-}
-
-/**
- * General purpose read routine to read data from a socket through the SSL
- * structure lined with this DCB and append it to a linked list of buffers.
- * The list may be empty, in which case *head == NULL. The SSL structure should
- * be initialized and the SSL handshake should be done.
- *
- * @param dcb   The DCB to read from
- * @param head  Pointer to linked list to append data to
- * @return      -1 on error, otherwise the total number of bytes read
- */
-static int
-dcb_read_SSL(DCB *dcb, GWBUF **head)
+dcb_read_SSL(DCB *dcb, GWBUF **head)
 {
     GWBUF *buffer;
     int nsingleread = 0, nreadtotal = 0;
@@ -1032,6 +1157,7 @@ dcb_read_SSL(DCB *dcb, GWBUF **head)
     buffer = dcb_basic_read_SSL(dcb, &nsingleread);
     if (buffer)
     {
+        dcb_trace_read(dcb);
         nreadtotal += nsingleread;
         *head = gwbuf_append(*head, buffer);
 
@@ -1222,6 +1348,11 @@ dcb_write(DCB *dcb, GWBUF *queue)
         return 0;
     }
 
+    if (dcb->dcb_role == DCB_ROLE_BACKEND_HANDLER && queue->sbuf->bufobj)
+    {
+        session_trace_backend_write(queue, dcb->server);
+    }
+
     empty_queue = (dcb->writeq == NULL);
     /*
      * Add our data to the write queue.  If the queue already had data,
@@ -1229,10 +1360,13 @@ dcb_write(DCB *dcb, GWBUF *queue)
      * If it did not already have data, we call the drain write queue
      * function immediately to attempt to write the data.
      */
-    dcb->writeqlen += gwbuf_length(queue);
+    unsigned int len = gwbuf_length(queue);
+    dcb->writeqlen += len;
     dcb->writeq = gwbuf_append(dcb->writeq, queue);
     dcb->stats.n_buffered++;
 
+    MXS_PROBE3(dcb_write, dcb->fd, len, dcb->writeqlen);
+
     MXS_DEBUG("%lu [dcb_write] Append to writequeue. %d writes "
               "buffered for dcb %p in state %s fd %d",
               pthread_self(),
@@ -1240,7 +1374,7 @@ dcb_write(DCB *dcb, GWBUF *queue)
               dcb,
               STRDCBSTATE(dcb->state),
               dcb->fd);
-    if (empty_queue)
+    if (empty_queue && !dcb_write_batch_add(dcb))
     {
         dcb_drain_writeq(dcb);
     }
@@ -1249,6 +1383,108 @@ dcb_write(DCB *dcb, GWBUF *queue)
     return 1;
 }
 
+/**
+ * Add a DCB to the write batch of the current thread
+ *
+ * @param dcb The DCB that was written to
+ * @return True if the write queue is drained when the batch ends, false if
+ *         it should be drained immediately
+ */
+static bool
+dcb_write_batch_add(DCB *dcb)
+{
+    if (write_batch.depth == 0 || dcb->state != DCB_STATE_POLLING)
+    {
+        return false;
+    }
+
+    if (!dcb->write_batched)
+    {
+        if (write_batch.count == write_batch.size)
+        {
+            int size = write_batch.size ? write_batch.size * 2 : 16;
+            DCB **dcbs = MXS_REALLOC(write_batch.dcbs, size * sizeof(DCB*));
+
+            if (dcbs == NULL)
+            {
+                return false;
+            }
+
+            write_batch.dcbs = dcbs;
+            write_batch.size = size;
+        }
+
+        write_batch.dcbs[write_batch.count++] = dcb;
+        dcb->write_batched = true;
+    }
+
+    return true;
+}
+
+void
+dcb_write_batch_begin()
+{
+    write_batch.depth++;
+}
+
+void
+dcb_write_batch_end()
+{
+    ss_dassert(write_batch.depth > 0);
+
+    if (--write_batch.depth == 0)
+    {
+        /** Closed DCBs stay in the zombie list until the events of this
+         * thread have been processed so all the pointers are still valid */
+        for (int i = 0; i < write_batch.count; i++)
+        {
+            DCB *dcb = write_batch.dcbs[i];
+            dcb->write_batched = false;
+
+            if (dcb->writeq && dcb->state == DCB_STATE_POLLING)
+            {
+                dcb_drain_writeq(dcb);
+            }
+        }
+
+        write_batch.count = 0;
+    }
+}
+
+void
+dcb_set_cork(DCB *dcb, bool cork)
+{
+    if (dcb->corked == cork || dcb->fd == DCBFD_CLOSED ||
+        (dcb->ip.ss_family != AF_INET && dcb->ip.ss_family != AF_INET6))
+    {
+        return;
+    }
+
+    if (!cork && dcb->writeq && !dcb->write_batched && dcb->state == DCB_STATE_POLLING)
+    {
+        /** Let the buffered data leave with the last frame */
+        dcb_drain_writeq(dcb);
+    }
+
+    int value = cork;
+
+    if (setsockopt(dcb->fd, IPPROTO_TCP, TCP_CORK, &value, sizeof(value)) == 0)
+    {
+        dcb->corked = cork;
+
+        if (cork)
+        {
+            dcb->stats.n_corked++;
+        }
+    }
+    else
+    {
+        char errbuf[MXS_STRERROR_BUFLEN];
+        MXS_WARNING("Failed to %s socket %d: %d, %s", cork ? "cork" : "uncork",
+                    dcb->fd, errno, strerror_r(errno, errbuf, sizeof(errbuf)));
+    }
+}
+
 /**
  * Check the parameters for dcb_write
  *
@@ -1425,10 +1661,17 @@ dcb_drain_writeq(DCB *dcb)
      * callback does not mean that a non-empty queue has been drained, or even
      * that the queue is presently empty.
      */
+    if (dcb->splice_src && !dcb_splice_flush(dcb))
+    {
+        /** The forwarded data in the pipe must be written first */
+        return 0;
+    }
+
     local_writeq = dcb_grab_writeq(dcb, true);
     if (NULL == local_writeq)
     {
         dcb_call_callback(dcb, DCB_REASON_DRAINED);
+        dcb_splice_resume(dcb);
         return 0;
     }
     above_water = (dcb->low_water && gwbuf_length(local_writeq) > dcb->low_water);
@@ -1441,8 +1684,11 @@ dcb_drain_writeq(DCB *dcb)
         {
             bool stop_writing = false;
             int written;
-            /* The value put into written will be >= 0 */
-            if (dcb->ssl)
+            /**
+             * The value put into written will be >= 0. With kernel TLS the
+             * kernel encrypts the data so it is written like plain data.
+             */
+            if (dcb->ssl && !dcb->ssl_ktls_send)
             {
                 written = gw_write_SSL(dcb, local_writeq, &stop_writing);
             }
@@ -1488,6 +1734,7 @@ dcb_drain_writeq(DCB *dcb)
     while ((local_writeq = dcb_grab_writeq(dcb, false)) != NULL);
     /* The write queue has drained, potentially need to call a callback function */
     dcb_call_callback(dcb, DCB_REASON_DRAINED);
+    dcb_splice_resume(dcb);
 
 wrap_up:
 
@@ -1499,6 +1746,8 @@ wrap_up:
     {
         dcb->writeqlen -= total_written;
 
+        MXS_PROBE3(dcb_drain_writeq, dcb->fd, total_written, dcb->writeqlen);
+
         /* Check if the draining has taken us from above water to below water */
         if (above_water && dcb->writeqlen < dcb->low_water)
         {
@@ -1510,6 +1759,200 @@ wrap_up:
     return total_written;
 }
 
+/** The largest number of bytes moved with one splice() call */
+#define DCB_SPLICE_SIZE (64 * 1024)
+
+bool dcb_can_splice(const DCB *dcb, const DCB *dest)
+{
+    return dcb->ssl == NULL && dest->ssl == NULL && (dcb->splice == NULL || !dcb->splice->failed) &&
+           dest->state == DCB_STATE_POLLING;
+}
+
+int dcb_splice(DCB *dcb, DCB *dest)
+{
+    if (dcb->splice == NULL)
+    {
+        /** Most DCBs never forward data, the state is allocated on demand */
+        if ((dcb->splice = (DCB_SPLICE*)MXS_CALLOC(1, sizeof(DCB_SPLICE))) == NULL)
+        {
+            return -1;
+        }
+
+        dcb->splice->pipe[0] = dcb->splice->pipe[1] = -1;
+    }
+
+    DCB_SPLICE *splice_state = dcb->splice;
+
+    if (splice_state->pipe[0] == -1)
+    {
+        if (pipe2(splice_state->pipe, O_NONBLOCK | O_CLOEXEC) != 0)
+        {
+            MXS_ERROR("Failed to create a pipe for forwarding data: %d, %s",
+                      errno, mxs_strerror(errno));
+            splice_state->pipe[0] = splice_state->pipe[1] = -1;
+            splice_state->failed = true;
+            /** The data is read normally */
+            poll_fake_read_event(dcb);
+            return 0;
+        }
+
+        MXS_DEBUG("Forwarding the data of DCB %p to DCB %p with splice().", dcb, dest);
+    }
+
+    if (splice_state->dest != dest)
+    {
+        if (splice_state->dest)
+        {
+            splice_state->dest->splice_src = NULL;
+        }
+        splice_state->dest = dest;
+        dest->splice_src = dcb;
+    }
+
+    if (dest->writeq || !dcb_splice_flush(dest))
+    {
+        /** Resumed when the destination has been drained */
+        splice_state->blocked = true;
+        return 0;
+    }
+
+    int total = 0;
+
+    while (true)
+    {
+        ssize_t n = splice(dcb->fd, NULL, splice_state->pipe[1], NULL, DCB_SPLICE_SIZE,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+        if (n < 0)
+        {
+            if (errno == EINVAL && total == 0 && dcb->stats.n_spliced == 0)
+            {
+                /** The descriptors do not support splice(), read normally */
+                splice_state->failed = true;
+                poll_fake_read_event(dcb);
+                return 0;
+            }
+            else if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                MXS_ERROR("Read from DCB %p in state %s fd %d failed: %d, %s",
+                          dcb, STRDCBSTATE(dcb->state), dcb->fd, errno, mxs_strerror(errno));
+                return -1;
+            }
+            break;
+        }
+        else if (n == 0)
+        {
+            /** The hangup is handled when the hangup event is processed */
+            break;
+        }
+
+        splice_state->pending = n;
+        dcb->stats.n_reads++;
+        dcb->stats.n_spliced += n;
+        total += n;
+
+        if (!dcb_splice_flush(dest))
+        {
+            splice_state->blocked = true;
+            break;
+        }
+    }
+
+    if (total)
+    {
+        dcb->last_read = hkheartbeat;
+    }
+
+    return total;
+}
+
+/**
+ * Write the forwarded data in the pipe to the destination DCB
+ *
+ * @param dest The destination DCB
+ * @return True if the pipe is empty
+ */
+static bool dcb_splice_flush(DCB *dest)
+{
+    DCB_SPLICE *splice_state = dest->splice_src->splice;
+
+    while (splice_state->pending > 0)
+    {
+        ssize_t n = splice(splice_state->pipe[0], NULL, dest->fd, NULL, splice_state->pending,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+        if (n < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                /** The error is handled when the error or hangup event of
+                 * the destination is processed */
+                MXS_INFO("Write to DCB %p in state %s fd %d failed: %d, %s",
+                         dest, STRDCBSTATE(dest->state), dest->fd, errno, mxs_strerror(errno));
+            }
+            return false;
+        }
+
+        splice_state->pending -= n;
+        dest->stats.n_writes++;
+        dest->stats.n_spliced += n;
+    }
+
+    return true;
+}
+
+/**
+ * Resume the forwarding to a DCB whose write queue has been drained
+ *
+ * @param dest The destination DCB
+ */
+static void dcb_splice_resume(DCB *dest)
+{
+    DCB *dcb = dest->splice_src;
+
+    if (dcb && dcb->splice->blocked && dest->writeq == NULL && dcb->splice->pending == 0)
+    {
+        dcb->splice->blocked = false;
+        poll_fake_read_event(dcb);
+    }
+}
+
+/**
+ * Stop the forwarding of data from or to a DCB
+ *
+ * Data that is still in the pipe is discarded.
+ *
+ * @param dcb The DCB that is closed
+ */
+static void dcb_splice_stop(DCB *dcb)
+{
+    DCB_SPLICE *splice_state = dcb->splice;
+
+    if (splice_state)
+    {
+        if (splice_state->pipe[0] != -1)
+        {
+            close(splice_state->pipe[0]);
+            close(splice_state->pipe[1]);
+            splice_state->pipe[0] = splice_state->pipe[1] = -1;
+            splice_state->pending = 0;
+            splice_state->blocked = false;
+        }
+
+        if (splice_state->dest)
+        {
+            splice_state->dest->splice_src = NULL;
+            splice_state->dest = NULL;
+        }
+    }
+
+    if (dcb->splice_src)
+    {
+        dcb->splice_src->splice->dest = NULL;
+        dcb->splice_src = NULL;
+    }
+}
+
 /**
  * @brief If draining is not already under way, extracts the write queue
  *
@@ -1623,6 +2066,14 @@ dcb_close(DCB *dcb)
     }
     else if (!dcb->dcb_is_zombie)
     {
+        if (dcb->write_batched && dcb->writeq && dcb->state == DCB_STATE_POLLING)
+        {
+            /** Send what was written before the DCB was closed */
+            dcb_drain_writeq(dcb);
+        }
+
+        dcb_splice_stop(dcb);
+
         if (DCB_ROLE_BACKEND_HANDLER == dcb->dcb_role && 0 == dcb->persistentstart
             && dcb->server && DCB_STATE_POLLING == dcb->state)
         {
@@ -1635,22 +2086,16 @@ dcb_close(DCB *dcb)
             }
         }
         /*<
-         * Add closing dcb to the top of the list, setting zombie marker
+         * Set the zombie marker, the DCB is reclaimed once no thread can
+         * refer to it
          */
-        int owner = dcb->thread.id;
         dcb->dcb_is_zombie = true;
-        dcb->memdata.next = zombies[owner];
-        zombies[owner] = dcb;
-        nzombies[owner]++;
-        if (nzombies[owner] > maxzombies)
-        {
-            maxzombies = nzombies[owner];
-        }
+        mxs_qsbr_defer(dcb_reclaim, dcb);
     }
     else
     {
-        /** DCBs in the zombie queue can still receive events which means that
-         * a DCB can be closed multiple times while it's in the zombie queue. */
+        /** Zombie DCBs can still receive events which means that a DCB can
+         * be closed multiple times before it is reclaimed. */
     }
 }
 
@@ -1669,7 +2114,7 @@ dcb_maybe_add_persistent(DCB *dcb)
         && strlen(dcb->user)
         && dcb->server
         && dcb->session
-        && session_valid_for_pool(dcb->session)
+        && (session_valid_for_pool(dcb->session) || (dcb->flags & DCBF_REUSABLE))
         && dcb->server->persistpoolmax
         && (dcb->server->status & SERVER_RUNNING)
         && !dcb->dcb_errhandle_called
@@ -1684,6 +2129,7 @@ dcb_maybe_add_persistent(DCB *dcb)
         dcb->was_persistent = false;
         dcb->dcb_is_zombie = false;
         dcb->persistentstart = time(NULL);
+        poll_throttle_dcb(dcb, false);
         if (dcb->session)
             /*<
              * Terminate client session.
@@ -1718,7 +2164,12 @@ dcb_maybe_add_persistent(DCB *dcb)
         dcb->server->persistent[dcb->thread.id] = dcb;
         atomic_add(&dcb->server->stats.n_persistent, 1);
         atomic_add(&dcb->server->stats.n_current, -1);
-        return true;
+
+        /** The connection is closed once it has been in the pool for too long */
+        spinlock_acquire(&all_dcbs_lock[dcb->thread.id]);
+        dcb_timer_set(dcb, hkheartbeat + (dcb->server->persistmaxtime + 1) * 10);
+        spinlock_release(&all_dcbs_lock[dcb->thread.id]);
+        return true;
     }
     else if (dcb->dcb_role == DCB_ROLE_BACKEND_HANDLER && dcb->server)
     {
@@ -1868,6 +2319,7 @@ dprintOneDCB(DCB *pdcb, DCB *dcb)
         dcb_printf(pdcb, "\tQueued write data:  %d\n",
                    gwbuf_length(dcb->writeq));
     }
+    dcb_printf(pdcb, "\tMemory usage:       %lu bytes\n", dcb_memory_usage(dcb));
     char *statusname = server_status(dcb->server);
     if (statusname)
     {
@@ -1887,6 +2339,14 @@ dprintOneDCB(DCB *pdcb, DCB *dcb)
     dcb_printf(pdcb, "\t\tNo. of Accepts:           %d\n", dcb->stats.n_accepts);
     dcb_printf(pdcb, "\t\tNo. of High Water Events: %d\n", dcb->stats.n_high_water);
     dcb_printf(pdcb, "\t\tNo. of Low Water Events:  %d\n", dcb->stats.n_low_water);
+    if (dcb->stats.n_spliced)
+    {
+        dcb_printf(pdcb, "\t\tNo. of Spliced Bytes:     %ld\n", dcb->stats.n_spliced);
+    }
+    if (dcb->stats.n_corked)
+    {
+        dcb_printf(pdcb, "\t\tNo. of Corked Replies:    %d\n", dcb->stats.n_corked);
+    }
     if (dcb->flags & DCBF_CLONE)
     {
         dcb_printf(pdcb, "\t\tDCB is a clone.\n");
@@ -1918,13 +2378,24 @@ void dprintAllDCBs(DCB *pdcb)
     dcb_foreach(dprint_all_dcbs_cb, pdcb);
 }
 
+typedef struct dlist_dcbs
+{
+    DCB    *pdcb;   /**< The DCB the list is printed to */
+    int    n_dcbs;  /**< Number of listed DCBs */
+    size_t memory;  /**< Total memory used by the listed DCBs */
+} DLIST_DCBS;
+
 static bool dlist_dcbs_cb(DCB *dcb, void *data)
 {
-    DCB *pdcb = (DCB*)data;
-    dcb_printf(pdcb, " %-16p | %-26s | %-18s | %s\n",
+    DLIST_DCBS *list = (DLIST_DCBS*)data;
+    size_t memory = dcb_memory_usage(dcb);
+
+    dcb_printf(list->pdcb, " %-16p | %-26s | %-18s | %-8lu | %s\n",
                dcb, gw_dcb_state2string(dcb->state),
                ((dcb->session && dcb->session->service) ? dcb->session->service->name : ""),
-               (dcb->remote ? dcb->remote : ""));
+               memory, (dcb->remote ? dcb->remote : ""));
+    list->n_dcbs++;
+    list->memory += memory;
     return true;
 }
 
@@ -1936,13 +2407,17 @@ static bool dlist_dcbs_cb(DCB *dcb, void *data)
 void
 dListDCBs(DCB *pdcb)
 {
+    DLIST_DCBS list = {pdcb, 0, 0};
+
     dcb_printf(pdcb, "Descriptor Control Blocks\n");
-    dcb_printf(pdcb, "------------------+----------------------------+--------------------+----------\n");
-    dcb_printf(pdcb, " %-16s | %-26s | %-18s | %s\n",
-               "DCB", "State", "Service", "Remote");
-    dcb_printf(pdcb, "------------------+----------------------------+--------------------+----------\n");
-    dcb_foreach(dlist_dcbs_cb, pdcb);
-    dcb_printf(pdcb, "------------------+----------------------------+--------------------+----------\n\n");
+    dcb_printf(pdcb, "------------------+----------------------------+--------------------+----------+----------\n");
+    dcb_printf(pdcb, " %-16s | %-26s | %-18s | %-8s | %s\n",
+               "DCB", "State", "Service", "Bytes", "Remote");
+    dcb_printf(pdcb, "------------------+----------------------------+--------------------+----------+----------\n");
+    dcb_foreach(dlist_dcbs_cb, &list);
+    dcb_printf(pdcb, "------------------+----------------------------+--------------------+----------+----------\n");
+    dcb_printf(pdcb, "Memory used by %d DCBs: %lu bytes, %lu bytes per DCB\n\n", list.n_dcbs,
+               list.memory, list.n_dcbs ? list.memory / list.n_dcbs : 0);
 }
 
 static bool dlist_clients_cb(DCB *dcb, void *data)
@@ -2022,6 +2497,7 @@ dprintDCB(DCB *pdcb, DCB *dcb)
     {
         dcb_printf(pdcb, "\tDelayed write data: %d\n", gwbuf_length(dcb->delayq));
     }
+    dcb_printf(pdcb, "\tMemory usage:       %lu bytes\n", dcb_memory_usage(dcb));
     char *statusname = server_status(dcb->server);
     if (statusname)
     {
@@ -2152,7 +2628,7 @@ void dcb_hashtable_stats(
     dcb_printf(dcb,
                "\tAverage chain length:        %.1f\n",
                (hashsize == 0 ? (float)hashsize : (float)total / hashsize));
-    dcb_printf(dcb, "\tLongest chain length:        %d\n", longest);
+    dcb_printf(dcb, "\tLongest probe length:        %d\n", longest);
 }
 
 /**
@@ -2160,6 +2636,10 @@ void dcb_hashtable_stats(
  * linked from the DCB. All communication is encrypted and done via the SSL
  * structure. Data is written from the DCB write queue.
  *
+ * If the first buffer is smaller than the maximum TLS record size, it is
+ * combined with the buffers that follow it so that each SSL_write produces
+ * a full record instead of one record per buffer.
+ *
  * @param dcb           The DCB having an SSL connection
  * @param writeq        A buffer list containing the data to be written
  * @param stop_writing  Set to true if the caller should stop writing, false otherwise
@@ -2169,8 +2649,21 @@ static int
 gw_write_SSL(DCB *dcb, GWBUF *writeq, bool *stop_writing)
 {
     int written;
+    void *data = GWBUF_DATA(writeq);
+    int nbytes = GWBUF_LENGTH(writeq);
+
+    if (writeq->next && nbytes < SSL3_RT_MAX_PLAIN_LENGTH)
+    {
+        /**
+         * The SSL contexts use SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER so a retried
+         * write can be done with the same data copied into this buffer again.
+         * The retry is never shorter as data is only appended to the queue.
+         */
+        nbytes = gwbuf_copy_data(writeq, 0, sizeof(ssl_write_buffer), ssl_write_buffer);
+        data = ssl_write_buffer;
+    }
 
-    written = SSL_write(dcb->ssl, GWBUF_DATA(writeq), GWBUF_LENGTH(writeq));
+    written = SSL_write(dcb->ssl, data, nbytes);
 
     *stop_writing = false;
     switch ((SSL_get_error(dcb->ssl, written)))
@@ -2225,6 +2718,9 @@ gw_write_SSL(DCB *dcb, GWBUF *writeq, bool *stop_writing)
 /**
  * Write data to a DCB. The data is taken from the DCB's write queue.
  *
+ * Up to DCB_MAX_IOVEC buffers of the queue are written with one writev call.
+ * The caller consumes the written bytes which can end in the middle of a buffer.
+ *
  * @param dcb           The DCB to write buffer
  * @param writeq        A buffer list containing the data to be written
  * @param stop_writing  Set to true if the caller should stop writing, false otherwise
@@ -2235,15 +2731,25 @@ gw_write(DCB *dcb, GWBUF *writeq, bool *stop_writing)
 {
     int written = 0;
     int fd = dcb->fd;
-    size_t nbytes = GWBUF_LENGTH(writeq);
-    void *buf = GWBUF_DATA(writeq);
+    struct iovec iov[DCB_MAX_IOVEC];
+    int iovcnt = 0;
     int saved_errno;
 
+    for (GWBUF *buf = writeq; buf && iovcnt < DCB_MAX_IOVEC; buf = buf->next)
+    {
+        if (GWBUF_LENGTH(buf) > 0)
+        {
+            iov[iovcnt].iov_base = GWBUF_DATA(buf);
+            iov[iovcnt].iov_len = GWBUF_LENGTH(buf);
+            iovcnt++;
+        }
+    }
+
     errno = 0;
 
     if (fd > 0)
     {
-        written = write(fd, buf, nbytes);
+        written = writev(fd, iov, iovcnt);
     }
 
     saved_errno = errno;
@@ -2463,6 +2969,47 @@ dcb_hangup_foreach(struct server* server)
     }
 }
 
+/**
+ * Stop or resume reading the backends of a session when the write queue of
+ * its client crosses the high or the low water mark. This keeps the data of
+ * a large result from piling up in MaxScale when the client reads it slowly.
+ *
+ * @param dcb      The client DCB
+ * @param reason   DCB_REASON_HIGH_WATER or DCB_REASON_LOW_WATER
+ * @param userdata Not used
+ * @return Always 0
+ */
+static int upstream_throttle_callback(DCB *dcb, DCB_REASON reason, void *userdata)
+{
+    MXS_SESSION *session = dcb->session;
+    bool throttle = reason == DCB_REASON_HIGH_WATER;
+    int thr = dcb->thread.id;
+
+    if (session == NULL || session->state == SESSION_STATE_DUMMY)
+    {
+        return 0;
+    }
+
+    /** The backends of a session are owned by the thread of its client */
+    spinlock_acquire(&all_dcbs_lock[thr]);
+
+    for (DCB *backend = all_dcbs[thr]; backend; backend = backend->thread.next)
+    {
+        if (backend->session == session && backend->dcb_role == DCB_ROLE_BACKEND_HANDLER &&
+            poll_throttle_dcb(backend, throttle))
+        {
+            MXS_INFO("%s reading from '%s' for session %lu, %d bytes queued for the client.",
+                     throttle ? "Stopped" : "Resumed",
+                     backend->server ? backend->server->unique_name : "backend",
+                     session->ses_id, dcb->writeqlen);
+        }
+    }
+
+    spinlock_release(&all_dcbs_lock[thr]);
+
+    return 0;
+}
+
 /**
  * Null protocol write routine used for cloned dcb's. It merely consumes
  * buffers written on the cloned DCB and sets the DCB_REPLIED flag.
@@ -2529,7 +3076,8 @@ dcb_persistent_clean_count(DCB *dcb, int id, bool cleanall)
                 || count >= server->persistpoolmax
                 || persistentdcb->server == NULL
                 || !(persistentdcb->server->status & SERVER_RUNNING)
-                || (time(NULL) - persistentdcb->persistentstart) > server->persistmaxtime)
+                || (count >= server->persistpoolmin
+                    && (time(NULL) - persistentdcb->persistentstart) > server->persistmaxtime))
             {
                 /* Remove from persistent pool */
                 if (previousdcb)
@@ -2690,6 +3238,8 @@ int dcb_accept_SSL(DCB* dcb)
     {
     case SSL_ERROR_NONE:
         MXS_DEBUG("SSL_accept done for %s@%s", user, remote);
+        ssl_count_handshake(dcb->listener->ssl, dcb->ssl);
+        dcb->ssl_ktls_send = ssl_kernel_tls_send(dcb->listener->ssl, dcb->ssl);
         dcb->ssl_state = SSL_ESTABLISHED;
         dcb->ssl_read_want_write = false;
         return 1;
@@ -2758,12 +3308,21 @@ int dcb_connect_SSL(DCB* dcb)
         ss_dassert((NULL != dcb->server) && (NULL != dcb->server->server_ssl));
         return -1;
     }
+
+    if (dcb->ssl_state != SSL_HANDSHAKE_REQUIRED)
+    {
+        /** The first attempt of the handshake resumes the previous session */
+        ssl_set_client_session(dcb->server->server_ssl, dcb->ssl);
+    }
+
     dcb->ssl_state = SSL_HANDSHAKE_REQUIRED;
     ssl_rval = SSL_connect(dcb->ssl);
     switch (SSL_get_error(dcb->ssl, ssl_rval))
     {
     case SSL_ERROR_NONE:
         MXS_DEBUG("SSL_connect done for %s", dcb->remote);
+        ssl_count_handshake(dcb->server->server_ssl, dcb->ssl);
+        dcb->ssl_ktls_send = ssl_kernel_tls_send(dcb->server->server_ssl, dcb->ssl);
         dcb->ssl_state = SSL_ESTABLISHED;
         dcb->ssl_read_want_write = false;
         return_code = 1;
@@ -2838,10 +3397,7 @@ dcb_accept(DCB *listener)
     DCB *client_dcb = NULL;
     MXS_PROTOCOL *protocol_funcs = &listener->func;
     int c_sock;
-    int sendbuf;
     struct sockaddr_storage client_conn;
-    socklen_t optlen = sizeof(sendbuf);
-    char errbuf[MXS_STRERROR_BUFLEN];
 
     if ((c_sock = dcb_accept_one_connection(listener, (struct sockaddr *)&client_conn)) >= 0)
     {
@@ -2849,23 +3405,18 @@ dcb_accept(DCB *listener)
         MXS_DEBUG("%lu [gw_MySQLAccept] Accepted fd %d.",
                   pthread_self(),
                   c_sock);
-        /* set nonblocking  */
-        sendbuf = MXS_CLIENT_SO_SNDBUF;
-
-        if (setsockopt(c_sock, SOL_SOCKET, SO_SNDBUF, &sendbuf, optlen) != 0)
-        {
-            MXS_ERROR("Failed to set socket options. Error %d: %s",
-                      errno, strerror_r(errno, errbuf, sizeof(errbuf)));
-        }
-
-        sendbuf = MXS_CLIENT_SO_RCVBUF;
 
-        if (setsockopt(c_sock, SOL_SOCKET, SO_RCVBUF, &sendbuf, optlen) != 0)
+        /**
+         * The socket is already non-blocking. TCP connections inherit the
+         * buffer sizes of the listener socket, Unix domain sockets do not.
+         */
+        if (client_conn.ss_family == AF_UNIX)
         {
-            MXS_ERROR("Failed to set socket options. Error %d: %s",
-                      errno, strerror_r(errno, errbuf, sizeof(errbuf)));
+            int sendbuf = MXS_CLIENT_SO_SNDBUF;
+            int recvbuf = MXS_CLIENT_SO_RCVBUF;
+            dcb_set_socket_option(c_sock, SOL_SOCKET, SO_SNDBUF, &sendbuf, sizeof(sendbuf));
+            dcb_set_socket_option(c_sock, SOL_SOCKET, SO_RCVBUF, &recvbuf, sizeof(recvbuf));
         }
-        setnonblocking(c_sock);
 
         client_dcb = dcb_alloc(DCB_ROLE_CLIENT_HANDLER, listener->listener);
 
@@ -2883,6 +3434,17 @@ dcb_accept(DCB *listener)
             client_dcb->session = session_set_dummy(client_dcb);
             client_dcb->fd = c_sock;
 
+            MXS_CONFIG *config = config_get_global_options();
+
+            if (config->writeq_high_water)
+            {
+                /** Stop reading the backends while the client is slow */
+                client_dcb->high_water = config->writeq_high_water;
+                client_dcb->low_water = config->writeq_low_water;
+                dcb_add_callback(client_dcb, DCB_REASON_HIGH_WATER, upstream_throttle_callback, NULL);
+                dcb_add_callback(client_dcb, DCB_REASON_LOW_WATER, upstream_throttle_callback, NULL);
+            }
+
             // get client address
             if (client_conn.ss_family == AF_UNIX)
             {
@@ -2968,8 +3530,8 @@ dcb_accept(DCB *listener)
  * @brief Accept a new client connection, given listener, return file descriptor
  *
  * Up to 10 retries will be attempted in case of non-permanent errors.  Calls
- * the accept function and analyses the return, logging any errors and making
- * an appropriate return.
+ * the accept4 function and analyses the return, logging any errors and making
+ * an appropriate return. The new socket is non-blocking and closed on exec.
  *
  * @param dcb Listener DCB that has detected new connection request
  * @return -1 for failure, or a file descriptor for the new connection
@@ -2978,6 +3540,8 @@ static int
 dcb_accept_one_connection(DCB *listener, struct sockaddr *client_conn)
 {
     int c_sock;
+    /** With per-thread listener sockets, accept only from our own socket */
+    int listener_fd = listener->thread_fds ? listener->thread_fds[current_thread_id] : listener->fd;
 
     /* Try up to 10 times to get a file descriptor by use of accept */
     for (int i = 0; i < 10; i++)
@@ -2986,9 +3550,10 @@ dcb_accept_one_connection(DCB *listener, struct sockaddr *client_conn)
         int eno = 0;
 
         /* new connection from client */
-        c_sock = accept(listener->fd,
-                        client_conn,
-                        &client_len);
+        c_sock = accept4(listener_fd,
+                         client_conn,
+                         &client_len,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
         eno = errno;
         errno = 0;
 
@@ -3078,15 +3643,27 @@ int dcb_listen(DCB *listener, const char *config, const char *protocol_name)
         port = atoi(port_str);
     }
 
-    int listener_socket = -1;
+    int listener_socket = hot_restart_take_socket(config);
+    bool reuseport = false;
 
-    if (strchr(host, '/'))
+    if (listener_socket != -1)
+    {
+        /** The socket is already bound, it was taken over from the old process */
+#ifdef SO_REUSEPORT
+        reuseport = port > 0 && !strchr(host, '/') &&
+                    config_get_global_options()->reuseport && config_threadcount() > 1;
+#endif
+    }
+    else if (strchr(host, '/'))
     {
         listener_socket = dcb_listen_create_socket_unix(host);
     }
     else if (port > 0)
     {
-        listener_socket = dcb_listen_create_socket_inet(host, port);
+#ifdef SO_REUSEPORT
+        reuseport = config_get_global_options()->reuseport && config_threadcount() > 1;
+#endif
+        listener_socket = dcb_listen_create_socket_inet(host, port, reuseport);
 
         if (listener_socket == -1 && strcmp(host, "::") == 0)
         {
@@ -3094,7 +3671,7 @@ int dcb_listen(DCB *listener, const char *config, const char *protocol_name)
             MXS_WARNING("Failed to bind on default IPv6 host '::', attempting "
                         "to bind on IPv4 version '0.0.0.0'");
             strcpy(host, "0.0.0.0");
-            listener_socket = dcb_listen_create_socket_inet(host, port);
+            listener_socket = dcb_listen_create_socket_inet(host, port, reuseport);
         }
     }
     else
@@ -3109,14 +3686,7 @@ int dcb_listen(DCB *listener, const char *config, const char *protocol_name)
         return -1;
     }
 
-    /**
-     * The use of INT_MAX for backlog length in listen() allows the end-user to
-     * control the backlog length with the net.ipv4.tcp_max_syn_backlog kernel
-     * option since the parameter is silently truncated to the configured value.
-     *
-     * @see man 2 listen
-     */
-    if (listen(listener_socket, INT_MAX) != 0)
+    if (dcb_listen_socket(listener, listener_socket, port > 0 && !strchr(host, '/')) != 0)
     {
         MXS_ERROR("Failed to start listening on '[%s]:%u' with protocol '%s': %d, %s",
                   host, port, protocol_name, errno, mxs_strerror(errno));
@@ -3129,6 +3699,12 @@ int dcb_listen(DCB *listener, const char *config, const char *protocol_name)
     // assign listener_socket to dcb
     listener->fd = listener_socket;
 
+    if (reuseport && !dcb_listen_create_thread_sockets(listener, host, port))
+    {
+        MXS_WARNING("Failed to create per-thread listener sockets for '[%s]:%u', "
+                    "all threads will share one listener socket.", host, port);
+    }
+
     // add listening socket to poll structure
     if (poll_add_dcb(listener) != 0)
     {
@@ -3142,17 +3718,29 @@ int dcb_listen(DCB *listener, const char *config, const char *protocol_name)
 /**
  * @brief Create a network listener socket
  *
- * @param host The network address to listen on
- * @param port The port to listen on
- * @return     The opened socket or -1 on error
+ * @param host      The network address to listen on
+ * @param port      The port to listen on
+ * @param reuseport Whether SO_REUSEPORT should be enabled on the socket
+ * @return          The opened socket or -1 on error
  */
-static int dcb_listen_create_socket_inet(const char *host, uint16_t port)
+static int dcb_listen_create_socket_inet(const char *host, uint16_t port, bool reuseport)
 {
     struct sockaddr_storage server_address = {};
     int listener_socket = open_network_socket(MXS_SOCKET_LISTENER, &server_address, host, port);
 
     if (listener_socket != -1)
     {
+#ifdef SO_REUSEPORT
+        int one = 1;
+
+        if (reuseport &&
+            dcb_set_socket_option(listener_socket, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0)
+        {
+            close(listener_socket);
+            return -1;
+        }
+#endif
+
         if (bind(listener_socket, (struct sockaddr*)&server_address, sizeof(server_address)) < 0)
         {
             MXS_ERROR("Failed to bind on '%s:%u': %d, %s",
@@ -3165,6 +3753,172 @@ static int dcb_listen_create_socket_inet(const char *host, uint16_t port)
     return listener_socket;
 }
 
+/**
+ * @brief Set the options of a listener socket and start listening on it
+ *
+ * The buffer sizes of the client connections are set on the listener socket
+ * as the accepted TCP connections inherit them. Without a configured backlog,
+ * INT_MAX is used which allows the end-user to control the backlog length with
+ * the net.core.somaxconn kernel option since the parameter is silently
+ * truncated to the configured value.
+ *
+ * @see man 2 listen
+ *
+ * @param listener        Listener DCB
+ * @param listener_socket The bound socket
+ * @param inet            Whether the socket is a TCP socket
+ * @return 0 on success, -1 if listen() failed
+ */
+static int dcb_listen_socket(DCB *listener, int listener_socket, bool inet)
+{
+    SERV_LISTENER *port = listener->listener;
+    int backlog = port && port->backlog ? port->backlog : INT_MAX;
+
+    if (inet)
+    {
+        int sendbuf = MXS_CLIENT_SO_SNDBUF;
+        int recvbuf = MXS_CLIENT_SO_RCVBUF;
+        dcb_set_socket_option(listener_socket, SOL_SOCKET, SO_SNDBUF, &sendbuf, sizeof(sendbuf));
+        dcb_set_socket_option(listener_socket, SOL_SOCKET, SO_RCVBUF, &recvbuf, sizeof(recvbuf));
+
+        if (port && port->defer_accept)
+        {
+            dcb_set_socket_option(listener_socket, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+                                  &port->defer_accept, sizeof(port->defer_accept));
+        }
+
+        if (port && port->fastopen)
+        {
+#ifdef TCP_FASTOPEN
+            dcb_set_socket_option(listener_socket, IPPROTO_TCP, TCP_FASTOPEN,
+                                  &port->fastopen, sizeof(port->fastopen));
+#else
+            MXS_WARNING("TCP_FASTOPEN is not supported, 'tcp_fastopen' is ignored.");
+#endif
+        }
+    }
+
+    return listen(listener_socket, backlog);
+}
+
+/**
+ * @brief Steer the connections of a per-thread listener socket to its thread
+ *
+ * With SO_INCOMING_CPU, the kernel prefers the SO_REUSEPORT socket whose CPU
+ * matches the CPU that received the connection. Does nothing unless the
+ * polling threads are bound to CPUs.
+ *
+ * @param fd        Listener socket of the thread
+ * @param thread_id The polling thread
+ */
+static void dcb_listen_set_incoming_cpu(int fd, int thread_id)
+{
+#ifdef SO_INCOMING_CPU
+    int cpu = config_thread_cpu(thread_id);
+
+    if (cpu >= 0)
+    {
+        dcb_set_socket_option(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu));
+    }
+#endif
+}
+
+/**
+ * @brief Create one SO_REUSEPORT listener socket for each polling thread
+ *
+ * The socket already stored in @c listener->fd is used as the socket of the
+ * first thread. The kernel distributes new connections between the sockets
+ * so that each thread only accepts connections from its own socket.
+ *
+ * @param listener Listener DCB with an open and listening socket
+ * @param host     The network address to listen on
+ * @param port     The port to listen on
+ * @return         True if all sockets were created, false on error
+ */
+static bool dcb_listen_create_thread_sockets(DCB *listener, const char *host, uint16_t port)
+{
+    int nthr = config_threadcount();
+
+    if ((listener->thread_fds = MXS_MALLOC(nthr * sizeof(int))) == NULL)
+    {
+        return false;
+    }
+
+    listener->thread_fds[0] = listener->fd;
+    dcb_listen_set_incoming_cpu(listener->fd, 0);
+
+    for (int i = 1; i < nthr; i++)
+    {
+        int fd = dcb_listen_create_socket_inet(host, port, true);
+
+        if (fd != -1)
+        {
+            dcb_listen_set_incoming_cpu(fd, i);
+        }
+
+        if (fd != -1 && dcb_listen_socket(listener, fd, true) != 0)
+        {
+            MXS_ERROR("Failed to start listening on '[%s]:%u': %d, %s",
+                      host, port, errno, mxs_strerror(errno));
+            close(fd);
+            fd = -1;
+        }
+
+        if (fd == -1)
+        {
+            /** Fall back to a single shared socket */
+            for (int j = 1; j < i; j++)
+            {
+                close(listener->thread_fds[j]);
+            }
+
+            MXS_FREE(listener->thread_fds);
+            listener->thread_fds = NULL;
+            return false;
+        }
+
+        listener->thread_fds[i] = fd;
+    }
+
+    MXS_INFO("Created %d SO_REUSEPORT listener sockets for '[%s]:%u'.", nthr, host, port);
+    return true;
+}
+
+void dcb_listen_shutdown_thread_sockets(DCB *listener)
+{
+    if (listener->thread_fds)
+    {
+        for (int i = 1; i < config_threadcount(); i++)
+        {
+            shutdown(listener->thread_fds[i], SHUT_RDWR);
+        }
+    }
+}
+
+/**
+ * @brief Close the per-thread listener sockets
+ *
+ * The first socket is the same as @c listener->fd and is closed by the caller.
+ *
+ * @param listener Listener DCB
+ */
+static void dcb_close_thread_sockets(DCB *listener)
+{
+    int nthr = config_threadcount();
+
+    for (int i = 1; i < nthr; i++)
+    {
+        if (close(listener->thread_fds[i]) < 0)
+        {
+            MXS_ERROR("Failed to close listener socket %d on dcb %p: %d, %s",
+                      listener->thread_fds[i], listener, errno, mxs_strerror(errno));
+        }
+    }
+
+    MXS_FREE(listener->thread_fds);
+    listener->thread_fds = NULL;
+}
+
 /**
  * @brief Create a Unix domain socket
  *
@@ -3338,6 +4092,11 @@ void dcb_add_to_list(DCB *dcb)
             all_dcbs[dcb->thread.id]->thread.tail = dcb;
         }
 
+        if (dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER)
+        {
+            dcb_timer_set_idle(dcb);
+        }
+
         spinlock_release(&all_dcbs_lock[dcb->thread.id]);
     }
 }
@@ -3351,6 +4110,8 @@ static void dcb_remove_from_list(DCB *dcb)
 {
     spinlock_acquire(&all_dcbs_lock[dcb->thread.id]);
 
+    dcb_timer_clear(dcb);
+
     if (dcb == all_dcbs[dcb->thread.id])
     {
         DCB *tail = all_dcbs[dcb->thread.id]->thread.tail;
@@ -3391,11 +4152,139 @@ static void dcb_remove_from_list(DCB *dcb)
 }
 
 /**
- * Enable the timing out of idle connections.
+ * Set the timer of a DCB
+ *
+ * The caller must hold the lock of the DCB list of the owning thread.
+ *
+ * @param dcb      DCB whose timer is set
+ * @param deadline Heartbeat when the timer expires
+ */
+static void dcb_timer_set(DCB *dcb, long deadline)
+{
+    DCB_TIMER_WHEEL *wheel = &timer_wheels[dcb->thread.id];
+
+    dcb_timer_clear(dcb);
+
+    /** A timer that has already expired is processed on the next slot */
+    long tick = MXS_MAX((deadline + DCB_TIMER_RESOLUTION - 1) / DCB_TIMER_RESOLUTION, wheel->tick);
+    int slot = tick % DCB_TIMER_SLOTS;
+
+    dcb->timer.deadline = deadline;
+    dcb->timer.slot = slot;
+    dcb->timer.prev = NULL;
+    dcb->timer.next = wheel->slots[slot];
+
+    if (dcb->timer.next)
+    {
+        dcb->timer.next->timer.prev = dcb;
+    }
+
+    wheel->slots[slot] = dcb;
+}
+
+/**
+ * Clear the timer of a DCB
+ *
+ * The caller must hold the lock of the DCB list of the owning thread.
+ *
+ * @param dcb DCB whose timer is cleared
+ */
+static void dcb_timer_clear(DCB *dcb)
+{
+    if (dcb->timer.deadline)
+    {
+        DCB_TIMER_WHEEL *wheel = &timer_wheels[dcb->thread.id];
+
+        if (dcb->timer.prev)
+        {
+            dcb->timer.prev->timer.next = dcb->timer.next;
+        }
+        else
+        {
+            wheel->slots[dcb->timer.slot] = dcb->timer.next;
+        }
+
+        if (dcb->timer.next)
+        {
+            dcb->timer.next->timer.prev = dcb->timer.prev;
+        }
+
+        dcb->timer.deadline = 0;
+        dcb->timer.next = NULL;
+        dcb->timer.prev = NULL;
+    }
+}
+
+/**
+ * Set the idle timeout of a client DCB
+ *
+ * The timer expires when the client has been idle for longer than the
+ * connection timeout of the service, counted from the last read.
+ *
+ * @param dcb Client DCB
+ */
+static void dcb_timer_set_idle(DCB *dcb)
+{
+    SERVICE *service = dcb->listener ? dcb->listener->service : NULL;
+
+    if (service && service->conn_idle_timeout)
+    {
+        dcb_timer_set(dcb, dcb->last_read + service->conn_idle_timeout * 10 + 1);
+    }
+    else
+    {
+        dcb_timer_clear(dcb);
+    }
+}
+
+/**
+ * Handle an expired timer
+ *
+ * A client that has been idle for too long is disconnected. The pools of the
+ * pooled backend connections whose timer expired are collected into @c pools
+ * so that they can be cleaned without holding the DCB list lock.
+ *
+ * @param dcb    DCB whose timer expired, the timer is no longer set
+ * @param pools  Pooled DCBs whose pools are to be cleaned
+ * @param npools Number of DCBs in @c pools
  */
-void dcb_enable_session_timeouts()
+static void dcb_timer_expire(DCB *dcb, DCB **pools, int *npools)
 {
-    check_timeouts = true;
+    if (dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER)
+    {
+        ss_dassert(dcb->listener);
+        SERVICE *service = dcb->listener->service;
+        int64_t idle = hkheartbeat - dcb->last_read;
+        int64_t timeout = service->conn_idle_timeout * 10;
+
+        if (service->conn_idle_timeout && dcb->state == DCB_STATE_POLLING && idle > timeout)
+        {
+            MXS_WARNING("Timing out '%s'@%s, idle for %.1f seconds",
+                        dcb->user ? dcb->user : "<unknown>",
+                        dcb->remote ? dcb->remote : "<unknown>",
+                        (float)idle / 10.f);
+            poll_fake_hangup_event(dcb);
+
+            /** The DCB is removed from the wheel when it is closed */
+            dcb_timer_set(dcb, hkheartbeat + DCB_TIMER_RESOLUTION);
+        }
+        else
+        {
+            /** The client has sent data since the timer was set */
+            dcb_timer_set_idle(dcb);
+        }
+    }
+    else if (dcb->persistentstart > 0 && dcb->server)
+    {
+        if (*npools < DCB_TIMER_MAX_POOL_CLEANUPS)
+        {
+            pools[(*npools)++] = dcb;
+        }
+        else
+        {
+            dcb_timer_set(dcb, hkheartbeat + DCB_TIMER_RESOLUTION);
+        }
+    }
 }
 
 /**
@@ -3403,39 +4292,232 @@ void dcb_enable_session_timeouts()
  *
  * If the time since a session last sent data is greater than the set value in the
  * service, it is disconnected. The connection timeout is disabled by default.
+ * The pooled backend connections that have been in the pool for longer than
+ * persistmaxtime are closed.
+ *
+ * Only the timers in the slots of the seconds that have passed since the
+ * previous call are processed.
  */
 void dcb_process_idle_sessions(int thr)
 {
-    if (check_timeouts && hkheartbeat >= next_timeout_check)
+    DCB_TIMER_WHEEL *wheel = &timer_wheels[thr];
+    long now = hkheartbeat / DCB_TIMER_RESOLUTION;
+
+    if (wheel->tick > now)
     {
-        /** Because the resolution of the timeout is one second, we only need to
-         * check for it once per second. One heartbeat is 100 milliseconds. */
-        next_timeout_check = hkheartbeat + 10;
+        return;
+    }
 
-        for (DCB *dcb = all_dcbs[thr]; dcb; dcb = dcb->thread.next)
+    DCB *pools[DCB_TIMER_MAX_POOL_CLEANUPS];
+    int npools = 0;
+
+    spinlock_acquire(&all_dcbs_lock[thr]);
+
+    if (now - wheel->tick >= DCB_TIMER_SLOTS)
+    {
+        /** Every slot is processed once even if the thread has fallen behind */
+        wheel->tick = now - DCB_TIMER_SLOTS + 1;
+    }
+
+    while (wheel->tick <= now)
+    {
+        /** The tick is advanced first so that the timers set again from
+         * this slot go into the following slots */
+        int slot = wheel->tick++ % DCB_TIMER_SLOTS;
+        DCB *dcb = wheel->slots[slot];
+        wheel->slots[slot] = NULL;
+
+        while (dcb)
+        {
+            DCB *next = dcb->timer.next;
+            long deadline = dcb->timer.deadline;
+
+            dcb->timer.deadline = 0;
+            dcb->timer.next = NULL;
+            dcb->timer.prev = NULL;
+
+            if (deadline > hkheartbeat)
+            {
+                /** Expires on a later round of the wheel */
+                dcb_timer_set(dcb, deadline);
+            }
+            else
+            {
+                dcb_timer_expire(dcb, pools, &npools);
+            }
+
+            dcb = next;
+        }
+    }
+
+    spinlock_release(&all_dcbs_lock[thr]);
+
+    for (int i = 0; i < npools; i++)
+    {
+        /** The DCBs of the pool that have expired are closed, the ones that
+         * are kept to fill the minimum size of the pool are checked again later */
+        dcb_persistent_clean_count(pools[i], thr, false);
+    }
+
+    if (npools)
+    {
+        spinlock_acquire(&all_dcbs_lock[thr]);
+
+        for (int i = 0; i < npools; i++)
         {
-            if (dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER)
+            if (pools[i]->persistentstart > 0)
             {
-                ss_dassert(dcb->listener);
-                SERVICE *service = dcb->listener->service;
+                dcb_timer_set(pools[i], hkheartbeat + (pools[i]->server->persistmaxtime + 1) * 10);
+            }
+        }
+
+        spinlock_release(&all_dcbs_lock[thr]);
+    }
+}
+
+/** Minimum time in heartbeats a session must be idle before it can be moved */
+#define DCB_MIGRATE_MIN_IDLE 10
+
+/**
+ * Check whether a DCB can be moved to another thread
+ *
+ * @param dcb DCB to check
+ * @return True if the DCB has no pending work
+ */
+static bool dcb_is_movable(DCB *dcb)
+{
+    return dcb->state == DCB_STATE_POLLING &&
+           dcb->fd > 0 &&
+           !dcb->dcb_is_zombie &&
+           !DCB_IS_CLONE(dcb) &&
+           !DCB_POLL_BUSY(dcb) &&
+           !dcb->draining_flag &&
+           dcb->persistentstart == 0 &&
+           dcb->ssl_state != SSL_HANDSHAKE_REQUIRED &&
+           dcb->writeq == NULL &&
+           dcb->delayq == NULL &&
+           dcb->dcb_readqueue == NULL &&
+           dcb->dcb_fakequeue == NULL;
+}
+
+/**
+ * Check whether all DCBs of a session owned by a thread are idle
+ *
+ * @param thr     The owning thread
+ * @param session The session to check
+ * @return True if the session can be moved
+ */
+static bool dcb_session_is_idle(int thr, MXS_SESSION *session)
+{
+    DCB *client = session->client_dcb;
+
+    if (session->state != SESSION_STATE_ROUTER_READY || client == NULL ||
+        hkheartbeat - client->last_read < DCB_MIGRATE_MIN_IDLE)
+    {
+        return false;
+    }
+
+    for (DCB *dcb = all_dcbs[thr]; dcb; dcb = dcb->thread.next)
+    {
+        if (dcb->session == session && !dcb_is_movable(dcb))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Change the owner of DCBs in the per-thread DCB lists
+ *
+ * @param dcbs  The DCBs
+ * @param n     Number of DCBs
+ * @param owner The new owner
+ */
+static void dcb_set_owner(DCB **dcbs, int n, int owner)
+{
+    for (int i = 0; i < n; i++)
+    {
+        dcb_remove_from_list(dcbs[i]);
+        dcbs[i]->thread.id = owner;
+        dcb_add_to_list(dcbs[i]);
+    }
+}
+
+/**
+ * Move the DCBs of a session to another thread. Either all of the DCBs are
+ * moved or none of them is, so that the session is never served by two threads.
+ *
+ * @param thr     The current owner of the session
+ * @param target  The new owner of the session
+ * @param session The session to move
+ * @return True if the session was moved
+ */
+static bool dcb_move_session(int thr, int target, MXS_SESSION *session)
+{
+    int n = 0;
+
+    for (DCB *dcb = all_dcbs[thr]; dcb; dcb = dcb->thread.next)
+    {
+        if (dcb->session == session)
+        {
+            n++;
+        }
+    }
+
+    DCB *dcbs[n];
+    int i = 0;
+
+    for (DCB *dcb = all_dcbs[thr]; dcb && i < n; dcb = dcb->thread.next)
+    {
+        if (dcb->session == session)
+        {
+            dcbs[i++] = dcb;
+        }
+    }
+
+    /** The DCBs must be in the new owner's list before the new owner can
+     * receive events for them */
+    dcb_set_owner(dcbs, n, target);
 
-                if (service->conn_idle_timeout && dcb->state == DCB_STATE_POLLING)
+    if (!poll_move_dcbs(dcbs, n, thr, target))
+    {
+        dcb_set_owner(dcbs, n, thr);
+        return false;
+    }
+
+    return true;
+}
+
+int dcb_migrate_idle_sessions(int thr, int target, int max)
+{
+    int moved = 0;
+    bool restart = true;
+
+    while (restart && moved < max)
+    {
+        restart = false;
+
+        for (DCB *dcb = all_dcbs[thr]; dcb; dcb = dcb->thread.next)
+        {
+            if (dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER && dcb->session &&
+                dcb->session->client_dcb == dcb &&
+                dcb_is_movable(dcb) && dcb_session_is_idle(thr, dcb->session))
+            {
+                if (dcb_move_session(thr, target, dcb->session))
                 {
-                    int64_t idle = hkheartbeat - dcb->last_read;
-                    int64_t timeout = service->conn_idle_timeout * 10;
+                    moved++;
 
-                    if (idle > timeout)
-                    {
-                        MXS_WARNING("Timing out '%s'@%s, idle for %.1f seconds",
-                                    dcb->user ? dcb->user : "<unknown>",
-                                    dcb->remote ? dcb->remote : "<unknown>",
-                                    (float)idle / 10.f);
-                        poll_fake_hangup_event(dcb);
-                    }
+                    /** Moving the session modified the list, start from the beginning */
+                    restart = true;
                 }
+                break;
             }
         }
     }
+
+    return moved;
 }
 
 bool dcb_foreach(bool(*func)(DCB *, void *), void *data)
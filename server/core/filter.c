@@ -35,6 +35,7 @@
 
 #include "maxscale/config.h"
 #include "maxscale/modules.h"
+#include "maxscale/poll.h"
 
 static SPINLOCK filter_spin = SPINLOCK_INIT;    /**< Protects the list of all filters */
 static MXS_FILTER_DEF *allFilters = NULL;           /**< The list of all filters */
@@ -68,12 +69,14 @@ filter_alloc(const char *name, const char *module)
     filter->name = my_name;
     filter->module = my_module;
     filter->filter = NULL;
+    filter->thread_instances = NULL;
     filter->options = NULL;
     filter->obj = NULL;
     filter->parameters = NULL;
 
     spinlock_init(&filter->spin);
 
+    spinlock_register(&filter_spin, "filters");
     spinlock_acquire(&filter_spin);
     filter->next = allFilters;
     allFilters = filter;
@@ -169,6 +172,76 @@ MXS_FILTER* filter_def_get_instance(const MXS_FILTER_DEF* filter_def)
     return filter_def->filter;
 }
 
+void* filter_def_get_thread_instance(const MXS_FILTER_DEF* filter_def)
+{
+    return filter_def->thread_instances && poll_thread ?
+           filter_def->thread_instances[current_thread_id] : NULL;
+}
+
+void* filter_def_get_thread_instance_of(const MXS_FILTER_DEF* filter_def, int thread_id)
+{
+    ss_dassert(thread_id >= 0 && thread_id < config_threadcount());
+    return filter_def->thread_instances ? filter_def->thread_instances[thread_id] : NULL;
+}
+
+/**
+ * Create the data of the filter instance for each polling thread
+ *
+ * @param filter_def  The filter definition whose instance has been created
+ * @return True if the filter has no thread-specific data or if the data of
+ *         all threads was created
+ */
+static bool filter_create_thread_instances(MXS_FILTER_DEF *filter_def)
+{
+    if (filter_def->obj->createThreadInstance == NULL)
+    {
+        return true;
+    }
+
+    int n_threads = config_threadcount();
+
+    if ((filter_def->thread_instances = MXS_CALLOC(n_threads, sizeof(void*))) == NULL)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        if ((filter_def->thread_instances[i] =
+                 filter_def->obj->createThreadInstance(filter_def->filter, i)) == NULL)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Destroy the data of the filter instance for each polling thread
+ *
+ * @param filter_def  The filter definition
+ */
+void filter_destroy_thread_instances(MXS_FILTER_DEF *filter_def)
+{
+    if (filter_def->thread_instances)
+    {
+        int n_threads = config_threadcount();
+
+        for (int i = 0; i < n_threads; i++)
+        {
+            if (filter_def->thread_instances[i] && filter_def->obj->destroyThreadInstance)
+            {
+                filter_def->obj->destroyThreadInstance(filter_def->filter,
+                                                       filter_def->thread_instances[i]);
+            }
+        }
+
+        MXS_FREE(filter_def->thread_instances);
+        filter_def->thread_instances = NULL;
+    }
+}
+
 /**
  * Check a parameter to see if it is a standard filter parameter
  *
@@ -386,7 +459,24 @@ bool filter_load(MXS_FILTER_DEF* filter)
                                                                     filter->options,
                                                                     filter->parameters)))
                 {
-                    rval = true;
+                    if (filter_create_thread_instances(filter))
+                    {
+                        filter->capabilities = filter->obj->getCapabilities(filter->filter);
+                        rval = true;
+                    }
+                    else
+                    {
+                        MXS_ERROR("Failed to create the thread-specific data of filter '%s'.",
+                                  filter->name);
+                        filter_destroy_thread_instances(filter);
+
+                        if (filter->obj->destroyInstance)
+                        {
+                            filter->obj->destroyInstance(filter->filter);
+                        }
+
+                        filter->filter = NULL;
+                    }
                 }
                 else
                 {
@@ -459,6 +549,16 @@ filter_upstream(MXS_FILTER_DEF *filter, void *fsession, MXS_UPSTREAM *upstream)
         return upstream;
     }
 
+    /*
+     * A filter that declares it does not process the replies is left out
+     * of the chain but it is still told what is upstream of it.
+     */
+    if (filter->capabilities & FCAP_TYPE_NO_REPLIES)
+    {
+        filter->obj->setUpstream(filter->filter, fsession, upstream);
+        return upstream;
+    }
+
     if (filter->obj->clientReply != NULL)
     {
         if ((me = (MXS_UPSTREAM *)MXS_CALLOC(1, sizeof(MXS_UPSTREAM))) == NULL)
@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file freelist.c  Per-thread free lists for fixed size objects
+ */
+
+#include <maxscale/freelist.h>
+
+#include <maxscale/alloc.h>
+#include <maxscale/config.h>
+#include <maxscale/debug.h>
+
+#include "maxscale/poll.h"
+
+typedef struct freelist_node
+{
+    struct freelist_node *next;
+} FREELIST_NODE;
+
+/**
+ * The free objects of one thread. Aligned to a cache line so that the
+ * threads do not share cache lines when updating their lists.
+ */
+typedef struct
+{
+    FREELIST_NODE *head;        /**< First free object */
+    int            count;       /**< Number of free objects */
+    int64_t        n_reused;    /**< Allocations served from the list */
+    int64_t        n_allocated; /**< Allocations done with the system allocator */
+} __attribute__((aligned(64))) FREELIST_THREAD;
+
+struct mxs_freelist
+{
+    size_t           size;      /**< Size of one object */
+    int              max;       /**< Maximum number of free objects per thread */
+    int              n_threads; /**< Number of polling threads */
+    FREELIST_THREAD *threads;   /**< Per-thread free objects */
+};
+
+/**
+ * Get the free objects of the calling thread
+ *
+ * @param list Free list
+ * @return The calling thread's free objects or NULL if the calling thread
+ * is not a polling thread
+ */
+static inline FREELIST_THREAD* freelist_get_thread(const MXS_FREELIST *list)
+{
+    FREELIST_THREAD *rval = NULL;
+
+    if (poll_thread && current_thread_id < list->n_threads)
+    {
+        rval = &list->threads[current_thread_id];
+    }
+
+    return rval;
+}
+
+MXS_FREELIST* mxs_freelist_create(size_t size, int max)
+{
+    MXS_FREELIST *list = (MXS_FREELIST*)MXS_MALLOC(sizeof(MXS_FREELIST));
+    int n_threads = config_threadcount();
+
+    if (list)
+    {
+        list->size = size < sizeof(FREELIST_NODE) ? sizeof(FREELIST_NODE) : size;
+        list->max = max;
+        list->n_threads = n_threads;
+
+        if ((list->threads = (FREELIST_THREAD*)MXS_CALLOC(n_threads, sizeof(FREELIST_THREAD))) == NULL)
+        {
+            MXS_FREE(list);
+            list = NULL;
+        }
+    }
+
+    return list;
+}
+
+void mxs_freelist_destroy(MXS_FREELIST *list)
+{
+    if (list)
+    {
+        for (int i = 0; i < list->n_threads; i++)
+        {
+            FREELIST_NODE *node = list->threads[i].head;
+
+            while (node)
+            {
+                FREELIST_NODE *next = node->next;
+                MXS_FREE(node);
+                node = next;
+            }
+        }
+
+        MXS_FREE(list->threads);
+        MXS_FREE(list);
+    }
+}
+
+void* mxs_freelist_alloc(MXS_FREELIST *list)
+{
+    FREELIST_THREAD *thr = freelist_get_thread(list);
+    void *rval;
+
+    if (thr && thr->head)
+    {
+        rval = thr->head;
+        thr->head = thr->head->next;
+        thr->count--;
+        thr->n_reused++;
+    }
+    else
+    {
+        rval = MXS_MALLOC(list->size);
+
+        if (thr)
+        {
+            thr->n_allocated++;
+        }
+    }
+
+    return rval;
+}
+
+void mxs_freelist_free(MXS_FREELIST *list, void *ptr)
+{
+    if (ptr)
+    {
+        FREELIST_THREAD *thr = freelist_get_thread(list);
+
+        if (thr && thr->count < list->max)
+        {
+            FREELIST_NODE *node = (FREELIST_NODE*)ptr;
+            node->next = thr->head;
+            thr->head = node;
+            thr->count++;
+        }
+        else
+        {
+            MXS_FREE(ptr);
+        }
+    }
+}
+
+int64_t mxs_freelist_reused(const MXS_FREELIST *list)
+{
+    int64_t rval = 0;
+
+    for (int i = 0; i < list->n_threads; i++)
+    {
+        rval += list->threads[i].n_reused;
+    }
+
+    return rval;
+}
+
+int64_t mxs_freelist_allocated(const MXS_FREELIST *list)
+{
+    int64_t rval = 0;
+
+    for (int i = 0; i < list->n_threads; i++)
+    {
+        rval += list->threads[i].n_allocated;
+    }
+
+    return rval;
+}
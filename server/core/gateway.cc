@@ -70,11 +70,13 @@
 #include <maxscale/random_jkiss.h>
 
 #include "maxscale/config.h"
+#include "maxscale/hot_restart.h"
 #include "maxscale/maxscale.h"
 #include "maxscale/modules.h"
 #include "maxscale/monitor.h"
 #include "maxscale/poll.h"
 #include "maxscale/service.h"
+#include "maxscale/session.h"
 #include "maxscale/statistics.h"
 
 #define STRING_BUFFER_SIZE 1024
@@ -151,6 +153,7 @@ static void log_flush_shutdown(void);
 static void log_flush_cb(void* arg);
 static int write_pid_file(); /* write MaxScale pidfile */
 static void unlink_pidfile(void); /* remove pidfile */
+static void release_pidfile(void); /* hand the pidfile to a new process */
 static void unlock_pidfile();
 static bool file_write_header(FILE* outfile);
 static bool file_write_footer(FILE* outfile);
@@ -1952,8 +1955,12 @@ int main(int argc, char **argv)
 
     if (!cnf->config_check)
     {
+        /** A process that hands over its listeners releases its PID file */
+        bool taken_over = cnf->hot_restart_socket &&
+                          hot_restart_receive(cnf->hot_restart_socket);
+
         /** Check if a MaxScale process is already running */
-        if (pid_file_exists())
+        if (!taken_over && pid_file_exists())
         {
             /** There is a process with the PID of the maxscale.pid file running.
              * Assuming that this is an already running MaxScale process, we
@@ -1980,6 +1987,13 @@ int main(int argc, char **argv)
 
     dcb_global_init();
 
+    if (!session_global_init())
+    {
+        MXS_OOM();
+        rc = MAXSCALE_INTERNALERROR;
+        goto return_main;
+    }
+
     /* Initialize the internal query classifier. The plugin will be initialized
      * via the module initialization below.
      */
@@ -2019,6 +2033,15 @@ int main(int argc, char **argv)
         goto return_main;
     }
 
+    /** The listeners that were removed from the configuration are closed */
+    hot_restart_close_unused();
+
+    if (cnf->hot_restart_socket && !hot_restart_start(cnf->hot_restart_socket, release_pidfile))
+    {
+        MXS_WARNING("Hot restart is disabled, a new MaxScale process can't "
+                    "take over the listeners of this one.");
+    }
+
     /*<
      * Start periodic log flusher thread.
      */
@@ -2084,6 +2107,11 @@ int main(int argc, char **argv)
      */
     hkfinish();
 
+    /*<
+     * Stop waiting for a new process.
+     */
+    hot_restart_finish();
+
     /*<
      * Wait server threads' completion.
      */
@@ -2206,6 +2234,18 @@ static void log_flush_cb(void* arg)
     MXS_NOTICE("Finished MaxScale log flusher.");
 }
 
+/**
+ * Unlock the PID file without removing it, called when a new process takes
+ * over the listeners of this one
+ */
+static void release_pidfile()
+{
+    unlock_pidfile();
+    pidfd = PIDFD_CLOSED;
+    /** The PID file now belongs to the new process */
+    pidfile[0] = '\0';
+}
+
 static void unlock_pidfile()
 {
     if (pidfd != PIDFD_CLOSED)
@@ -29,13 +29,18 @@
  * a hash function and optional functions to call make copies of the key
  * and value and to free them.
  *
- * The hashtable is arrange as a set of linked lists, the number of linked
- * lists being the hashsize as requested by the user. Entries are hashed by
- * calling the hash function that is passed in by the user, this is used as
- * an index into the array of linked lists, usign modulo hashsize.
+ * The entries are stored in an open addressing table of slots whose size is
+ * a power of two. Entries are hashed by calling the hash function that is
+ * passed in by the user, the hash is mixed and used as the index of the first
+ * slot to probe. Collisions are resolved with linear probing, so a lookup
+ * walks a contiguous run of slots instead of following a list of separately
+ * allocated entries. The hash of each entry is stored in its slot and the
+ * key comparison function that is passed into the hash table creation routine
+ * is only called for entries with a matching hash.
  *
- * The linked lists are searched using the key comparison function that is
- * passed into the hash table creation routine.
+ * Deleting an entry leaves a marker in its slot so that the probe sequences
+ * of other entries are not broken. The table is rebuilt, growing it when
+ * needed, whenever an addition would fill more than three quarters of it.
  *
  * By default the hash table keeps the original pointers that are passed in
  * for the keys and values, however two functions can be supplied to copy these
@@ -58,6 +63,7 @@
  *                                      it's possible to copy and free different data types via
  *                                      kcopyfn/kfreefn, vcopyfn/vfreefn
  * 06/02/2015   Mark Riddoch            Addition of hashtable_save and hashtable_load
+ * 14/10/2026                           Open addressing instead of chained buckets
  *
  * @endverbatim
  */
@@ -97,12 +103,128 @@ nullfn(void *data)
 {
 }
 
+/** Marker key for slots whose entry has been deleted */
+static char hashtable_deleted_key;
+#define HASHTABLE_DELETED ((void*)&hashtable_deleted_key)
+
+/** The initial number of slots is limited, the table grows on demand */
+#define HASHTABLE_MIN_CAPACITY 8
+#define HASHTABLE_MAX_INITIAL_CAPACITY 4096
+
+/**
+ * Check whether a slot holds a live entry
+ *
+ * @param entry The slot
+ * @return True if the slot is neither empty nor deleted
+ */
+static inline bool
+hashtable_slot_used(const HASHENTRIES *entry)
+{
+    return entry->key != NULL && entry->key != HASHTABLE_DELETED;
+}
+
+/**
+ * Calculate the first slot to probe for a hash
+ *
+ * The user supplied hash functions are often weak in the low bits so the
+ * hash is mixed before the table size mask is applied.
+ *
+ * @param table The hash table
+ * @param hash  The hash of the key
+ * @return The index of the home slot of the hash
+ */
+static inline unsigned int
+hashtable_home_slot(const HASHTABLE *table, unsigned int hash)
+{
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3b;
+    hash ^= hash >> 16;
+    return hash & (table->capacity - 1);
+}
+
+/**
+ * Find the slot of a key, the caller must hold a lock on the table
+ *
+ * @param table The hash table
+ * @param key   The key to look for
+ * @param hash  The hash of the key
+ * @return The slot index or -1 if the key is not in the table
+ */
+static int
+hashtable_find_slot(HASHTABLE *table, const void *key, unsigned int hash)
+{
+    unsigned int mask = table->capacity - 1;
+    unsigned int i = hashtable_home_slot(table, hash);
+
+    for (int n = 0; n < table->capacity; n++, i = (i + 1) & mask)
+    {
+        HASHENTRIES *entry = &table->entries[i];
+
+        if (entry->key == NULL)
+        {
+            break;
+        }
+
+        if (entry->key != HASHTABLE_DELETED && entry->hash == hash &&
+            table->cmpfn(key, entry->key) == 0)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Rebuild the table into a new array of slots, dropping the deleted markers.
+ * The caller must hold the write lock.
+ *
+ * @param table    The hash table
+ * @param capacity The new number of slots, a power of two
+ * @return True on success, false if memory allocation failed
+ */
+static bool
+hashtable_rebuild(HASHTABLE *table, int capacity)
+{
+    HASHENTRIES *entries = (HASHENTRIES *)MXS_CALLOC(capacity, sizeof(HASHENTRIES));
+
+    if (entries == NULL)
+    {
+        return false;
+    }
+
+    HASHENTRIES *old_entries = table->entries;
+    int old_capacity = table->capacity;
+    unsigned int mask = capacity - 1;
+
+    table->entries = entries;
+    table->capacity = capacity;
+
+    for (int i = 0; i < old_capacity; i++)
+    {
+        if (hashtable_slot_used(&old_entries[i]))
+        {
+            unsigned int j = hashtable_home_slot(table, old_entries[i].hash);
+
+            while (entries[j].key)
+            {
+                j = (j + 1) & mask;
+            }
+
+            entries[j] = old_entries[i];
+        }
+    }
+
+    table->n_deleted = 0;
+    MXS_FREE(old_entries);
+    return true;
+}
+
 /**
  * Allocate a new hash table.
  *
- * The hashtable must have a size of at least one, however to be of any
- * practical use a larger size sould be chosen as the size relates to the number
- * of has buckets in the table.
+ * The size is a hint of the expected number of entries, the table grows
+ * as entries are added.
  *
  * @param size          The size of the hash table, msut be > 0
  * @param hashfn        The user supplied hash function
@@ -159,13 +281,23 @@ hashtable_alloc_real(HASHTABLE* target,
     rval->n_readers = 0;
     rval->writelock = 0;
     rval->n_elements = 0;
+    rval->n_deleted = 0;
+    rval->capacity = HASHTABLE_MIN_CAPACITY;
+
+    while (rval->capacity < rval->hashsize && rval->capacity < HASHTABLE_MAX_INITIAL_CAPACITY)
+    {
+        rval->capacity *= 2;
+    }
+
     spinlock_init(&rval->spin);
-    if ((rval->entries = (HASHENTRIES **)MXS_CALLOC(rval->hashsize, sizeof(HASHENTRIES *))) == NULL)
+    if ((rval->entries = (HASHENTRIES *)MXS_CALLOC(rval->capacity, sizeof(HASHENTRIES))) == NULL)
     {
-        MXS_FREE(rval);
+        if (!rval->ht_isflat)
+        {
+            MXS_FREE(rval);
+        }
         return NULL;
     }
-    memset(rval->entries, 0, rval->hashsize * sizeof(HASHENTRIES *));
 
     return rval;
 }
@@ -178,25 +310,20 @@ hashtable_alloc_real(HASHTABLE* target,
 void
 hashtable_free(HASHTABLE *table)
 {
-    int i;
-    HASHENTRIES *entry, *ptr;
-
     if (table == NULL)
     {
         return;
     }
 
     hashtable_write_lock(table);
-    for (i = 0; i < table->hashsize; i++)
+    for (int i = 0; i < table->capacity; i++)
     {
-        entry = table->entries[i];
-        while (entry)
+        HASHENTRIES *entry = &table->entries[i];
+
+        if (hashtable_slot_used(entry))
         {
-            ptr = entry->next;
             table->kfreefn(entry->key);
             table->vfreefn(entry->value);
-            MXS_FREE(entry);
-            entry = ptr;
         }
     }
     MXS_FREE(table->entries);
@@ -255,74 +382,96 @@ hashtable_memory_fns(HASHTABLE  *table,
 int
 hashtable_add(HASHTABLE *table, void *key, void *value)
 {
-    unsigned int            hashkey;
-    HASHENTRIES     *entry;
-
     if (table == NULL || key == NULL || value == NULL)
     {
         return 0;
     }
 
-    if (table->hashsize <= 0)
-    {
-        return 0;
-    }
-    else
-    {
-        hashkey = table->hashfn(key) % table->hashsize;
-    }
+    unsigned int hash = table->hashfn(key);
     hashtable_write_lock(table);
-    entry = table->entries[hashkey % table->hashsize];
-    while (entry && table->cmpfn(key, entry->key) != 0)
-    {
-        entry = entry->next;
-    }
-    if (entry && table->cmpfn(key, entry->key) == 0)
-    {
-        /* Duplicate key value */
-        hashtable_write_unlock(table);
-        return 0;
-    }
-    else
+
+    if ((table->n_elements + table->n_deleted + 1) * 4 > table->capacity * 3)
     {
-        HASHENTRIES *ptr = (HASHENTRIES *)MXS_MALLOC(sizeof(HASHENTRIES));
-        if (ptr == NULL)
+        int capacity = table->capacity;
+
+        while ((table->n_elements + 1) * 2 > capacity)
+        {
+            capacity *= 2;
+        }
+
+        if (!hashtable_rebuild(table, capacity))
         {
             hashtable_write_unlock(table);
             return 0;
         }
+    }
+
+    unsigned int mask = table->capacity - 1;
+    unsigned int i = hashtable_home_slot(table, hash);
+    HASHENTRIES *target = NULL;
 
-        /* copy the key */
-        ptr->key = table->kcopyfn(key);
+    for (int n = 0; n < table->capacity; n++, i = (i + 1) & mask)
+    {
+        HASHENTRIES *entry = &table->entries[i];
 
-        /* check succesfull key copy */
-        if (ptr->key  == NULL)
+        if (entry->key == NULL)
         {
-            MXS_FREE(ptr);
+            if (target == NULL)
+            {
+                target = entry;
+            }
+            break;
+        }
+        else if (entry->key == HASHTABLE_DELETED)
+        {
+            /** Reuse the first deleted slot but keep looking for a duplicate */
+            if (target == NULL)
+            {
+                target = entry;
+            }
+        }
+        else if (entry->hash == hash && table->cmpfn(key, entry->key) == 0)
+        {
+            /* Duplicate key value */
             hashtable_write_unlock(table);
-
             return 0;
         }
+    }
 
-        /* copy the value */
-        ptr->value = table->vcopyfn(value);
+    ss_dassert(target);
 
-        /* check succesfull value copy */
-        if  (ptr->value == NULL)
-        {
-            /* remove the key ! */
-            table->kfreefn(ptr->key);
-            MXS_FREE(ptr);
+    /* copy the key */
+    void *new_key = table->kcopyfn(key);
 
-            /* value not copied, return */
-            hashtable_write_unlock(table);
+    /* check succesfull key copy */
+    if (new_key == NULL)
+    {
+        hashtable_write_unlock(table);
+        return 0;
+    }
 
-            return 0;
-        }
+    /* copy the value */
+    void *new_value = table->vcopyfn(value);
+
+    /* check succesfull value copy */
+    if (new_value == NULL)
+    {
+        /* remove the key ! */
+        table->kfreefn(new_key);
 
-        ptr->next = table->entries[hashkey % table->hashsize];
-        table->entries[hashkey % table->hashsize] = ptr;
+        /* value not copied, return */
+        hashtable_write_unlock(table);
+        return 0;
+    }
+
+    if (target->key == HASHTABLE_DELETED)
+    {
+        table->n_deleted--;
     }
+
+    target->key = new_key;
+    target->value = new_value;
+    target->hash = hash;
     table->n_elements++;
     hashtable_write_unlock(table);
 
@@ -339,66 +488,40 @@ hashtable_add(HASHTABLE *table, void *key, void *value)
 int
 hashtable_delete(HASHTABLE *table, void *key)
 {
-    unsigned int hashkey;
-    HASHENTRIES *entry, *ptr;
-
     if (table == NULL || key == NULL)
     {
         return 0;
     }
 
-    hashkey = table->hashfn(key) % table->hashsize;
+    unsigned int hash = table->hashfn(key);
     hashtable_write_lock(table);
-    entry = table->entries[hashkey % table->hashsize];
-    while (entry && entry->key && table->cmpfn(key, entry->key) != 0)
-    {
-        entry = entry->next;
-    }
-    if (entry == NULL)
+    int i = hashtable_find_slot(table, key, hash);
+
+    if (i == -1)
     {
         /* Not found */
         hashtable_write_unlock(table);
         return 0;
     }
 
-    if (entry == table->entries[hashkey % table->hashsize])
-    {
-        /* We are removing from the first entry */
-        table->entries[hashkey % table->hashsize] = entry->next;
-        table->kfreefn(entry->key);
-        table->vfreefn(entry->value);
+    HASHENTRIES *entry = &table->entries[i];
+    table->kfreefn(entry->key);
+    table->vfreefn(entry->value);
+    entry->value = NULL;
 
-        if (entry->next != NULL)
-        {
-            entry->key = entry->next->key;
-            entry->value = entry->next->value;
-        }
-        else
-        {
-            entry->key = NULL;
-            entry->value = NULL;
-        }
-        MXS_FREE(entry);
+    /** The slot can be emptied if it does not continue a probe sequence */
+    if (table->entries[(i + 1) & (table->capacity - 1)].key == NULL)
+    {
+        entry->key = NULL;
     }
     else
     {
-        ptr = table->entries[hashkey % table->hashsize];
-        while (ptr && ptr->next != entry)
-        {
-            ptr = ptr->next;
-        }
-        if (ptr == NULL)
-        {
-            hashtable_write_unlock(table);
-            return 0;       /* This should never happen */
-        }
-        ptr->next = entry->next;
-        table->kfreefn(entry->key);
-        table->vfreefn(entry->value);
-        MXS_FREE(entry);
+        entry->key = HASHTABLE_DELETED;
+        table->n_deleted++;
     }
+
     table->n_elements--;
-    assert(table->n_elements >= 0);
+    ss_dassert(table->n_elements >= 0);
     hashtable_write_unlock(table);
     return 1;
 }
@@ -413,30 +536,57 @@ hashtable_delete(HASHTABLE *table, void *key)
 void *
 hashtable_fetch(HASHTABLE *table, void *key)
 {
-    unsigned int hashkey;
-    HASHENTRIES *entry;
+    void *rval = NULL;
 
-    if (table == NULL || key == NULL || 0 == table->hashsize)
+    if (table == NULL || key == NULL)
     {
         return NULL;
     }
 
-    hashkey = table->hashfn(key) % table->hashsize;
+    unsigned int hash = table->hashfn(key);
     hashtable_read_lock(table);
-    entry = table->entries[hashkey % table->hashsize];
-    while (entry && entry->key && table->cmpfn(key, entry->key) != 0)
-    {
-        entry = entry->next;
-    }
-    if (entry == NULL)
+    int i = hashtable_find_slot(table, key, hash);
+
+    if (i != -1)
     {
-        hashtable_read_unlock(table);
-        return NULL;
+        rval = table->entries[i].value;
     }
-    else
+
+    hashtable_read_unlock(table);
+    return rval;
+}
+
+/**
+ * Calculate the probe statistics of a table, the caller must hold a lock
+ *
+ * @param table   The hash table
+ * @param total   The number of entries
+ * @param probes  The sum of the probe lengths of all entries
+ * @param longest The longest probe length
+ */
+static void
+hashtable_probe_stats(HASHTABLE *table, int *total, long *probes, int *longest)
+{
+    unsigned int mask = table->capacity - 1;
+
+    *total = 0;
+    *probes = 0;
+    *longest = 0;
+
+    for (int i = 0; i < table->capacity; i++)
     {
-        hashtable_read_unlock(table);
-        return entry->value;
+        if (hashtable_slot_used(&table->entries[i]))
+        {
+            int len = ((i - hashtable_home_slot(table, table->entries[i].hash)) & mask) + 1;
+
+            *total += 1;
+            *probes += len;
+
+            if (len > *longest)
+            {
+                *longest = len;
+            }
+        }
     }
 }
 
@@ -448,37 +598,21 @@ hashtable_fetch(HASHTABLE *table, void *key)
 void
 hashtable_stats(HASHTABLE *table)
 {
-    int total, longest, i, j;
-    HASHENTRIES *entries;
+    int total, longest;
+    long probes;
 
     if (table == NULL)
     {
         return;
     }
 
-    printf("Hashtable: %p, size %d\n", table, table->hashsize);
-    total = 0;
-    longest = 0;
     hashtable_read_lock(table);
-    for (i = 0; i < table->hashsize; i++)
-    {
-        j = 0;
-        entries = table->entries[i];
-        while (entries)
-        {
-            j++;
-            entries = entries->next;
-        }
-        total += j;
-        if (j > longest)
-        {
-            longest = j;
-        }
-    }
+    printf("Hashtable: %p, size %d, slots %d\n", table, table->hashsize, table->capacity);
+    hashtable_probe_stats(table, &total, &probes, &longest);
     hashtable_read_unlock(table);
     printf("\tNo. of entries:       %d\n", total);
-    printf("\tAverage chain length: %.1f\n", (float)total / table->hashsize);
-    printf("\tLongest chain length: %d\n", longest);
+    printf("\tAverage probe length: %.1f\n", total ? (float)probes / total : 0.0);
+    printf("\tLongest probe length: %d\n", longest);
 }
 
 /**
@@ -495,7 +629,7 @@ hashtable_stats(HASHTABLE *table)
  *          <description>
  *
  * @param longest - <usage>
- *          <description>
+ *          The longest probe sequence
  *
  * @return void
  *
@@ -507,9 +641,7 @@ void hashtable_get_stats(void* table,
                          int*  longest)
 {
     HASHTABLE* ht;
-    HASHENTRIES* entries;
-    int i;
-    int j;
+    long probes;
 
     *nelems = 0;
     *longest = 0;
@@ -520,22 +652,7 @@ void hashtable_get_stats(void* table,
         ht = (HASHTABLE *)table;
         CHK_HASHTABLE(ht);
         hashtable_read_lock(ht);
-
-        for (i = 0; i < ht->hashsize; i++)
-        {
-            j = 0;
-            entries = ht->entries[i];
-            while (entries)
-            {
-                j++;
-                entries = entries->next;
-            }
-            *nelems += j;
-            if (j > *longest)
-            {
-                *longest = j;
-            }
-        }
+        hashtable_probe_stats(ht, nelems, &probes, longest);
         *hashsize = ht->hashsize;
         hashtable_read_unlock(ht);
     }
@@ -656,7 +773,7 @@ hashtable_iterator(HASHTABLE *table)
     {
         rval->table = table;
         rval->chain = 0;
-        rval->depth = -1;
+        rval->depth = 0;
     }
     return rval;
 }
@@ -670,40 +787,26 @@ hashtable_iterator(HASHTABLE *table)
 void *
 hashtable_next(HASHITERATOR *iter)
 {
-    int i;
-    HASHENTRIES *entries;
+    void *key = NULL;
 
     if (iter == NULL)
     {
         return NULL;
     }
 
-    iter->depth++;
-    while (iter->chain < iter->table->hashsize)
+    hashtable_read_lock(iter->table);
+    while (key == NULL && iter->chain < iter->table->capacity)
     {
-        hashtable_read_lock(iter->table);
-        if ((entries = iter->table->entries[iter->chain]) != NULL)
-        {
-            i = 0;
-            while (entries && i < iter->depth)
-            {
-                entries = entries->next;
-                i++;
-            }
-            hashtable_read_unlock(iter->table);
-            if (entries)
-            {
-                return entries->key;
-            }
-        }
-        else
+        HASHENTRIES *entry = &iter->table->entries[iter->chain++];
+
+        if (hashtable_slot_used(entry))
         {
-            hashtable_read_unlock(iter->table);
+            key = entry->key;
         }
-        iter->depth = 0;
-        iter->chain++;
     }
-    return NULL;
+    hashtable_read_unlock(iter->table);
+
+    return key;
 }
 
 /**
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file histogram.c - Log-linear histograms of latencies
+ */
+
+#include <maxscale/histogram.h>
+
+#include <math.h>
+
+uint64_t histogram_bucket_max(int bucket)
+{
+    if (bucket < HISTOGRAM_SUB_BUCKETS)
+    {
+        return bucket;
+    }
+
+    int shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+    uint64_t sub = bucket % HISTOGRAM_SUB_BUCKETS;
+
+    return ((HISTOGRAM_SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+uint64_t histogram_percentile(const HISTOGRAM *hist, double percentile)
+{
+    uint64_t count = hist->count;
+    uint64_t rval = 0;
+
+    if (count > 0)
+    {
+        uint64_t target = (uint64_t)ceil(count * percentile / 100.0);
+        uint64_t total = 0;
+
+        if (target == 0)
+        {
+            target = 1;
+        }
+
+        for (int i = 0; i < HISTOGRAM_N_BUCKETS; i++)
+        {
+            total += hist->buckets[i];
+
+            if (total >= target)
+            {
+                rval = histogram_bucket_max(i);
+                break;
+            }
+        }
+
+        if (rval > hist->max)
+        {
+            rval = hist->max;
+        }
+    }
+
+    return rval;
+}
+
+void histogram_merge(HISTOGRAM *dest, const HISTOGRAM *src)
+{
+    for (int i = 0; i < HISTOGRAM_N_BUCKETS; i++)
+    {
+        dest->buckets[i] += src->buckets[i];
+    }
+
+    dest->count += src->count;
+
+    if (src->max > dest->max)
+    {
+        dest->max = src->max;
+    }
+}
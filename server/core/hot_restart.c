@@ -0,0 +1,535 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file hot_restart.c - Handing the listener sockets to a new process
+ *
+ * The processes talk over a SOCK_SEQPACKET Unix socket. The old process sends
+ * one message for each listener with the address of the listener as a null
+ * terminated string and the socket as SCM_RIGHTS ancillary data, followed by
+ * an empty string. The new process acknowledges the sockets, after which the
+ * old process stops its listeners and releases its PID file before it tells
+ * the new process that it is done.
+ *
+ * The old process keeps serving its sessions until the clients disconnect or
+ * hot_restart_drain_timeout seconds have passed, and then stops itself with
+ * SIGTERM.
+ */
+
+#include "maxscale/hot_restart.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <maxscale/alloc.h>
+#include <maxscale/config.h>
+#include <maxscale/dcb.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/poll.h>
+#include <maxscale/thread.h>
+
+#include "maxscale/service.h"
+#include "maxscale/session.h"
+
+/** Messages of the new process and of the old one after the sockets */
+#define HOT_RESTART_ACK  'A'
+#define HOT_RESTART_DONE 'D'
+
+/** Seconds one process waits for a message of the other */
+#define HOT_RESTART_TIMEOUT 10
+
+/** A socket taken over from the old process */
+typedef struct hot_restart_socket
+{
+    char *bind; /**< The address of the listener */
+    int  fd;    /**< The socket, -1 once a listener has taken it */
+} HOT_RESTART_SOCKET;
+
+static HOT_RESTART_SOCKET *sockets = NULL;
+static int n_sockets = 0;
+
+static int listen_fd = -1;
+static THREAD hot_restart_thr;
+static bool hot_restart_running = false;
+static volatile bool hot_restart_stop = false;
+static void (*hot_restart_release)(void) = NULL;
+
+/**
+ * Fill the address of a Unix socket
+ *
+ * @param addr The address
+ * @param path The path of the socket
+ * @return False if the path is too long
+ */
+static bool socket_address(struct sockaddr_un *addr, const char *path)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+
+    if (strlen(path) >= sizeof(addr->sun_path))
+    {
+        MXS_ERROR("The hot restart socket path '%s' is too long.", path);
+        return false;
+    }
+
+    strcpy(addr->sun_path, path);
+    return true;
+}
+
+/**
+ * Set the timeouts of the messages of the other process
+ *
+ * @param fd The connected socket
+ */
+static void set_timeouts(int fd)
+{
+    struct timeval tv = {HOT_RESTART_TIMEOUT, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/**
+ * Send a message
+ *
+ * @param fd   The connected socket
+ * @param data The message
+ * @param len  Length of the message
+ * @param sock Socket sent with the message or -1 for none
+ * @return True if the message was sent
+ */
+static bool send_message(int fd, const void *data, size_t len, int sock)
+{
+    struct iovec iov = {(void*)data, len};
+    struct msghdr msg = {};
+    char control[CMSG_SPACE(sizeof(int))] = {};
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (sock != -1)
+    {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &sock, sizeof(int));
+    }
+
+    return sendmsg(fd, &msg, MSG_NOSIGNAL) == (ssize_t)len;
+}
+
+/**
+ * Receive a message
+ *
+ * @param fd   The connected socket
+ * @param data Buffer for the message
+ * @param size Size of @c data
+ * @param sock The socket sent with the message is stored here, -1 if none
+ * @return Length of the message or -1 on error
+ */
+static ssize_t receive_message(int fd, void *data, size_t size, int *sock)
+{
+    struct iovec iov = {data, size};
+    struct msghdr msg = {};
+    char control[CMSG_SPACE(sizeof(int))] = {};
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t len = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    *sock = -1;
+
+    if (len > 0)
+    {
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+                cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+            {
+                memcpy(sock, CMSG_DATA(cmsg), sizeof(int));
+            }
+        }
+    }
+
+    return len;
+}
+
+/**
+ * Close the sockets taken over from the old process
+ */
+static void free_sockets()
+{
+    for (int i = 0; i < n_sockets; i++)
+    {
+        if (sockets[i].fd != -1)
+        {
+            close(sockets[i].fd);
+        }
+
+        MXS_FREE(sockets[i].bind);
+    }
+
+    MXS_FREE(sockets);
+    sockets = NULL;
+    n_sockets = 0;
+}
+
+/**
+ * Store a socket taken over from the old process
+ *
+ * @param bind The address of the listener
+ * @param fd   The socket
+ * @return True on success
+ */
+static bool add_socket(const char *bind, int fd)
+{
+    HOT_RESTART_SOCKET *tmp = MXS_REALLOC(sockets, (n_sockets + 1) * sizeof(*sockets));
+    char *str = MXS_STRDUP(bind);
+
+    if (tmp == NULL || str == NULL)
+    {
+        if (tmp)
+        {
+            sockets = tmp;
+        }
+
+        MXS_FREE(str);
+        return false;
+    }
+
+    sockets = tmp;
+    sockets[n_sockets].bind = str;
+    sockets[n_sockets].fd = fd;
+    n_sockets++;
+    return true;
+}
+
+bool hot_restart_receive(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (!socket_address(&addr, path) || (fd = socket(AF_UNIX, SOCK_SEQPACKET, 0)) == -1)
+    {
+        return false;
+    }
+
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1)
+    {
+        /** No MaxScale process waits for a new one */
+        close(fd);
+        return false;
+    }
+
+    set_timeouts(fd);
+
+    char bind[PATH_MAX + 32];
+    bool ok = false;
+    ssize_t len;
+    int sock;
+
+    while ((len = receive_message(fd, bind, sizeof(bind) - 1, &sock)) > 0)
+    {
+        bind[len] = '\0';
+
+        if (*bind == '\0')
+        {
+            /** All sockets were sent */
+            if (sock != -1)
+            {
+                close(sock);
+            }
+
+            ok = true;
+            break;
+        }
+
+        if (sock == -1 || !add_socket(bind, sock))
+        {
+            MXS_ERROR("Failed to receive the listener socket of '%s' from the "
+                      "MaxScale process at '%s'.", bind, path);
+
+            if (sock != -1)
+            {
+                close(sock);
+            }
+            break;
+        }
+    }
+
+    char ack = HOT_RESTART_ACK;
+    char done = 0;
+
+    if (ok && send_message(fd, &ack, sizeof(ack), -1) &&
+        receive_message(fd, &done, sizeof(done), &sock) == sizeof(done) && done == HOT_RESTART_DONE)
+    {
+        MXS_NOTICE("Took over %d listener sockets from the MaxScale process at '%s'.",
+                   n_sockets, path);
+    }
+    else
+    {
+        MXS_ERROR("Failed to take over the listener sockets from the MaxScale "
+                  "process at '%s', starting normally.", path);
+        free_sockets();
+        ok = false;
+    }
+
+    close(fd);
+    return ok;
+}
+
+int hot_restart_take_socket(const char *bind)
+{
+    for (int i = 0; i < n_sockets; i++)
+    {
+        if (sockets[i].fd != -1 && strcmp(sockets[i].bind, bind) == 0)
+        {
+            int fd = sockets[i].fd;
+            sockets[i].fd = -1;
+            return fd;
+        }
+    }
+
+    return -1;
+}
+
+void hot_restart_close_unused()
+{
+    for (int i = 0; i < n_sockets; i++)
+    {
+        if (sockets[i].fd != -1)
+        {
+            MXS_NOTICE("No listener for '%s' in the configuration, closing the "
+                       "socket taken over from the old process.", sockets[i].bind);
+        }
+    }
+
+    free_sockets();
+}
+
+/** Send the socket of one listener */
+static bool send_listener(SERV_LISTENER *port, const char *bind, void *data)
+{
+    int fd = *(int*)data;
+
+    if (!send_message(fd, bind, strlen(bind) + 1, port->listener->fd))
+    {
+        MXS_ERROR("Failed to send the socket of listener '%s' to the new "
+                  "MaxScale process: %d, %s", port->name, errno, mxs_strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+/** Stop one listener after its socket was handed to the new process */
+static bool stop_listener(SERV_LISTENER *port, const char *bind, void *data)
+{
+    if (poll_remove_dcb(port->listener) == 0)
+    {
+        port->listener->session->state = SESSION_STATE_LISTENER_STOPPED;
+        dcb_listen_shutdown_thread_sockets(port->listener);
+        (*(int*)data)++;
+    }
+
+    return true;
+}
+
+/**
+ * Check that the new process is run by the same user
+ *
+ * @param fd The connected socket
+ * @return True if the peer can be given the sockets
+ */
+static bool peer_allowed(int fd)
+{
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0)
+    {
+        return false;
+    }
+    else if (cred.uid != 0 && cred.uid != getuid())
+    {
+        MXS_ERROR("Refusing to hand the listener sockets to process %d of user %d.",
+                  (int)cred.pid, (int)cred.uid);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Hand the listener sockets to a new process
+ *
+ * @param fd The connected socket
+ * @return True if the new process took over the sockets
+ */
+static bool hand_off(int fd)
+{
+    char end = '\0';
+    char ack = 0;
+    char done = HOT_RESTART_DONE;
+    int sock;
+
+    set_timeouts(fd);
+
+    if (!peer_allowed(fd) || !service_foreach_listener(send_listener, &fd) ||
+        !send_message(fd, &end, sizeof(end), -1) ||
+        receive_message(fd, &ack, sizeof(ack), &sock) != sizeof(ack) || ack != HOT_RESTART_ACK)
+    {
+        MXS_ERROR("Failed to hand the listener sockets to a new MaxScale process.");
+        return false;
+    }
+
+    int n_stopped = 0;
+    service_foreach_listener(stop_listener, &n_stopped);
+    hot_restart_release();
+
+    if (!send_message(fd, &done, sizeof(done), -1))
+    {
+        MXS_WARNING("Failed to tell the new MaxScale process that the PID file was released.");
+    }
+
+    MXS_NOTICE("Handed %d listener sockets to a new MaxScale process, draining the "
+               "existing sessions.", n_stopped);
+    return true;
+}
+
+/**
+ * Wait for the clients to disconnect and shut down
+ */
+static void drain()
+{
+    int timeout = config_get_global_options()->hot_restart_drain_timeout;
+    time_t start = time(NULL);
+
+    while (!hot_restart_stop)
+    {
+        int n_clients = dcb_count_by_usage(DCB_USAGE_CLIENT);
+
+        if (n_clients == 0 || (timeout > 0 && time(NULL) - start >= timeout))
+        {
+            MXS_NOTICE("Shutting down after the hot restart, %d clients are still connected.",
+                       n_clients);
+            kill(getpid(), SIGTERM);
+            break;
+        }
+
+        sleep(1);
+    }
+}
+
+/**
+ * The thread that waits for a new process
+ */
+static void hot_restart_main(void *data)
+{
+    bool handed_off = false;
+
+    while (!hot_restart_stop && !handed_off)
+    {
+        struct pollfd pfd = {listen_fd, POLLIN, 0};
+
+        if (poll(&pfd, 1, 1000) > 0)
+        {
+            int fd = accept(listen_fd, NULL, NULL);
+
+            if (fd != -1)
+            {
+                handed_off = hand_off(fd);
+                close(fd);
+            }
+        }
+    }
+
+    close(listen_fd);
+    listen_fd = -1;
+
+    if (handed_off)
+    {
+        drain();
+    }
+}
+
+bool hot_restart_start(const char *path, void (*release_pidfile)(void))
+{
+    struct sockaddr_un addr;
+
+    hot_restart_release = release_pidfile;
+
+    if (!socket_address(&addr, path))
+    {
+        return false;
+    }
+
+    if ((listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) == -1)
+    {
+        MXS_ERROR("Failed to create the hot restart socket: %d, %s", errno, mxs_strerror(errno));
+        return false;
+    }
+
+    /** A new process replaces the socket of the process it took over from */
+    unlink(path);
+    mode_t mask = umask(S_IRWXG | S_IRWXO);
+
+    if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+        listen(listen_fd, 1) == -1)
+    {
+        MXS_ERROR("Failed to listen on the hot restart socket '%s': %d, %s",
+                  path, errno, mxs_strerror(errno));
+        umask(mask);
+        close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+
+    umask(mask);
+
+    if (thread_start(&hot_restart_thr, hot_restart_main, NULL) == NULL)
+    {
+        MXS_ERROR("Failed to start the hot restart thread.");
+        close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+
+    hot_restart_running = true;
+    MXS_NOTICE("Waiting for a new MaxScale process at '%s'.", path);
+    return true;
+}
+
+void hot_restart_finish()
+{
+    if (hot_restart_running)
+    {
+        hot_restart_stop = true;
+        thread_wait(hot_restart_thr);
+        hot_restart_running = false;
+    }
+}
@@ -16,9 +16,9 @@
 #include <maxscale/alloc.h>
 #include <maxscale/atomic.h>
 #include <maxscale/semaphore.h>
-#include <maxscale/spinlock.h>
 #include <maxscale/thread.h>
 #include <maxscale/query_classifier.h>
+#include <maxscale/utils.h>
 
 /**
  * @file housekeeper.c  Provide a mechanism to run periodic tasks
@@ -29,6 +29,13 @@
  * shot task that will only be run once after a specified number of
  * seconds.
  *
+ * The tasks are kept in a binary heap ordered by the time they are next
+ * due, with millisecond precision. The scheduler thread sleeps until the
+ * next task is due and hands it to a small pool of worker threads, so that
+ * a slow task does not delay the others. A task is never run by two workers
+ * at the same time; if a repeated task is still running when it is due
+ * again, that run is skipped.
+ *
  * The housekeeper also maintains a global variable, hkheartbeat, that
  * is incremented every 100ms.
  *
@@ -42,21 +49,51 @@
  * @endverbatim
  */
 
+/** Number of threads running the tasks */
+#define HK_WORKER_THREADS 4
+
+/** Interval of the heartbeat in milliseconds */
+#define HK_HEARTBEAT_MS 100
+
 /**
- * List of all tasks that need to be run
+ * List of all tasks
  */
 static HKTASK *tasks = NULL;
+
+/**
+ * The scheduled tasks, a binary heap ordered by due_ms
+ */
+static HKTASK **schedule = NULL;
+static int schedule_size = 0;
+static int schedule_capacity = 0;
+
+/**
+ * The queue of tasks waiting for a worker
+ */
+static HKTASK *work_head = NULL;
+static HKTASK *work_tail = NULL;
+
 /**
- * Spinlock to protect the tasks list
+ * Mutex protecting all of the above and the state of the tasks
  */
-static SPINLOCK tasklock = SPINLOCK_INIT;
+static pthread_mutex_t hk_lock = PTHREAD_MUTEX_INITIALIZER;
+/** Signaled when the schedule changes, uses the monotonic clock */
+static pthread_cond_t hk_schedule_cond;
+/** Signaled when tasks are queued for the workers */
+static pthread_cond_t hk_work_cond = PTHREAD_COND_INITIALIZER;
+/** Signaled when a task completes */
+static pthread_cond_t hk_done_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t hk_once = PTHREAD_ONCE_INIT;
 
 static bool do_shutdown = 0;
 
 long hkheartbeat = 0; /*< One heartbeat is 100 milliseconds */
 static THREAD hk_thr_handle;
+static THREAD hk_worker_handles[HK_WORKER_THREADS];
+static int hk_n_workers = 0;
 
 static void hkthread(void *);
+static void hkworker(void *);
 
 struct hkinit_result
 {
@@ -64,20 +101,191 @@ struct hkinit_result
     bool ok;
 };
 
+static void hk_init_once()
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&hk_schedule_cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static void schedule_swap(int a, int b)
+{
+    HKTASK *tmp = schedule[a];
+    schedule[a] = schedule[b];
+    schedule[b] = tmp;
+    schedule[a]->heap_index = a;
+    schedule[b]->heap_index = b;
+}
+
+static void schedule_up(int i)
+{
+    while (i > 0 && schedule[(i - 1) / 2]->due_ms > schedule[i]->due_ms)
+    {
+        schedule_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void schedule_down(int i)
+{
+    while (true)
+    {
+        int smallest = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+
+        if (left < schedule_size && schedule[left]->due_ms < schedule[smallest]->due_ms)
+        {
+            smallest = left;
+        }
+
+        if (right < schedule_size && schedule[right]->due_ms < schedule[smallest]->due_ms)
+        {
+            smallest = right;
+        }
+
+        if (smallest == i)
+        {
+            break;
+        }
+
+        schedule_swap(i, smallest);
+        i = smallest;
+    }
+}
+
+/**
+ * Add a task to the schedule. The caller must hold hk_lock.
+ *
+ * @param task  The task to add
+ * @param delay In how many milliseconds the task is due
+ *
+ * @return True if the task was added
+ */
+static bool schedule_add(HKTASK *task, int64_t delay)
+{
+    if (schedule_size == schedule_capacity)
+    {
+        int capacity = schedule_capacity ? 2 * schedule_capacity : 16;
+        HKTASK **tmp = (HKTASK**)MXS_REALLOC(schedule, capacity * sizeof(HKTASK*));
+
+        if (tmp == NULL)
+        {
+            return false;
+        }
+
+        schedule = tmp;
+        schedule_capacity = capacity;
+    }
+
+    task->due_ms = mxs_clock_ms() + delay;
+    task->nextdue = time(0) + delay / 1000;
+    task->heap_index = schedule_size;
+    schedule[schedule_size++] = task;
+    schedule_up(task->heap_index);
+    pthread_cond_signal(&hk_schedule_cond);
+
+    return true;
+}
+
+/**
+ * Remove a task from the schedule. The caller must hold hk_lock.
+ *
+ * @param task The task to remove
+ */
+static void schedule_remove(HKTASK *task)
+{
+    int i = task->heap_index;
+
+    if (i >= 0)
+    {
+        task->heap_index = -1;
+
+        if (--schedule_size > i)
+        {
+            schedule[i] = schedule[schedule_size];
+            schedule[i]->heap_index = i;
+            schedule_up(i);
+            schedule_down(schedule[i]->heap_index);
+        }
+    }
+}
+
+/**
+ * Remove a task from the list of all tasks. The caller must hold hk_lock.
+ *
+ * @param task The task to remove
+ */
+static void tasks_unlink(HKTASK *task)
+{
+    HKTASK **ptr = &tasks;
+
+    while (*ptr && *ptr != task)
+    {
+        ptr = &(*ptr)->next;
+    }
+
+    if (*ptr)
+    {
+        *ptr = task->next;
+    }
+}
+
+static HKTASK* tasks_find(const char *name)
+{
+    HKTASK *ptr = tasks;
+
+    while (ptr && strcmp(ptr->name, name) != 0)
+    {
+        ptr = ptr->next;
+    }
+
+    return ptr;
+}
+
+static void hktask_free(HKTASK *task)
+{
+    MXS_FREE(task->name);
+    MXS_FREE(task);
+}
+
 bool
 hkinit()
 {
     struct hkinit_result res;
     sem_init(&res.sem, 0, 0);
-    res.ok = false;
+    res.ok = true;
 
-    if (thread_start(&hk_thr_handle, hkthread, &res) != NULL)
+    pthread_once(&hk_once, hk_init_once);
+
+    for (int i = 0; i < HK_WORKER_THREADS; i++)
     {
-        sem_wait(&res.sem);
+        if (thread_start(&hk_worker_handles[i], hkworker, &res) != NULL)
+        {
+            sem_wait(&res.sem);
+            hk_n_workers++;
+        }
+        else
+        {
+            MXS_ALERT("Failed to start housekeeper worker thread.");
+            res.ok = false;
+            break;
+        }
     }
-    else
+
+    if (res.ok)
     {
-        MXS_ALERT("Failed to start housekeeper thread.");
+        if (thread_start(&hk_thr_handle, hkthread, &res) != NULL)
+        {
+            sem_wait(&res.sem);
+        }
+        else
+        {
+            MXS_ALERT("Failed to start housekeeper thread.");
+            res.ok = false;
+        }
     }
 
     sem_destroy(&res.sem);
@@ -85,28 +293,17 @@ hkinit()
 }
 
 /**
- * Add a new task to the housekeepers lists of tasks that should be
- * run periodically.
- *
- * The task will be first run frequency seconds after this call is
- * made and will the be executed repeatedly every frequency seconds
- * until the task is removed.
+ * Allocate a task and add it to the schedule.
  *
- * Task names must be unique.
- *
- * @param name          The unique name for this housekeeper task
- * @param taskfn        The function to call for the task
- * @param data          Data to pass to the task function
- * @param frequency     How often to run the task, expressed in seconds
- * @return              Return the time in seconds when the task will be first run
- *                      if the task was added, otherwise 0
+ * @return The time in seconds when the task will be first run
+ *         if the task was added, otherwise 0
  */
-int
-hktask_add(const char *name, void (*taskfn)(void *), void *data, int frequency)
+static int hktask_create(const char *name, void (*taskfn)(void *), void *data,
+                         int frequency, HKTASK_TYPE type, int when, bool unique)
 {
-    HKTASK *task, *ptr;
+    HKTASK *task;
 
-    if ((task = (HKTASK *)MXS_MALLOC(sizeof(HKTASK))) == NULL)
+    if ((task = (HKTASK *)MXS_CALLOC(1, sizeof(HKTASK))) == NULL)
     {
         return 0;
     }
@@ -118,50 +315,56 @@ hktask_add(const char *name, void (*taskfn)(void *), void *data, int frequency)
     task->task = taskfn;
     task->data = data;
     task->frequency = frequency;
-    task->type = HK_REPEATED;
-    task->nextdue = time(0) + frequency;
-    task->next = NULL;
-    spinlock_acquire(&tasklock);
-    ptr = tasks;
-    while (ptr && ptr->next)
-    {
-        if (strcmp(ptr->name, name) == 0)
-        {
-            spinlock_release(&tasklock);
-            MXS_FREE(task->name);
-            MXS_FREE(task);
-            return 0;
-        }
-        ptr = ptr->next;
-    }
-    if (ptr)
-    {
-        if (strcmp(ptr->name, name) == 0)
-        {
-            spinlock_release(&tasklock);
-            MXS_FREE(task->name);
-            MXS_FREE(task);
-            return 0;
-        }
-        ptr->next = task;
-    }
-    else
+    task->type = type;
+    task->heap_index = -1;
+
+    pthread_once(&hk_once, hk_init_once);
+    pthread_mutex_lock(&hk_lock);
+
+    if ((unique && tasks_find(name)) || !schedule_add(task, (int64_t)when * 1000))
     {
-        tasks = task;
+        pthread_mutex_unlock(&hk_lock);
+        hktask_free(task);
+        return 0;
     }
-    spinlock_release(&tasklock);
 
-    return task->nextdue;
+    task->next = tasks;
+    tasks = task;
+    int rval = task->nextdue;
+    pthread_mutex_unlock(&hk_lock);
+
+    return rval;
 }
 
 /**
- * Add a one-shot task to the housekeeper task list
+ * Add a new task to the housekeepers lists of tasks that should be
+ * run periodically.
+ *
+ * The task will be first run frequency seconds after this call is
+ * made and will the be executed repeatedly every frequency seconds
+ * until the task is removed.
  *
  * Task names must be unique.
  *
  * @param name          The unique name for this housekeeper task
  * @param taskfn        The function to call for the task
  * @param data          Data to pass to the task function
+ * @param frequency     How often to run the task, expressed in seconds
+ * @return              Return the time in seconds when the task will be first run
+ *                      if the task was added, otherwise 0
+ */
+int
+hktask_add(const char *name, void (*taskfn)(void *), void *data, int frequency)
+{
+    return hktask_create(name, taskfn, data, frequency, HK_REPEATED, frequency, true);
+}
+
+/**
+ * Add a one-shot task to the housekeeper task list
+ *
+ * @param name          The name for this housekeeper task
+ * @param taskfn        The function to call for the task
+ * @param data          Data to pass to the task function
  * @param when          How many second until the task is executed
  * @return              Return the time in seconds when the task will be first run
  *                      if the task was added, otherwise 0
@@ -170,166 +373,253 @@ hktask_add(const char *name, void (*taskfn)(void *), void *data, int frequency)
 int
 hktask_oneshot(const char *name, void (*taskfn)(void *), void *data, int when)
 {
-    HKTASK *task, *ptr;
-
-    if ((task = (HKTASK *)MXS_MALLOC(sizeof(HKTASK))) == NULL)
-    {
-        return 0;
-    }
-    if ((task->name = MXS_STRDUP(name)) == NULL)
-    {
-        MXS_FREE(task);
-        return 0;
-    }
-    task->task = taskfn;
-    task->data = data;
-    task->frequency = 0;
-    task->type = HK_ONESHOT;
-    task->nextdue = time(0) + when;
-    task->next = NULL;
-    spinlock_acquire(&tasklock);
-    ptr = tasks;
-    while (ptr && ptr->next)
-    {
-        ptr = ptr->next;
-    }
-    if (ptr)
-    {
-        ptr->next = task;
-    }
-    else
-    {
-        tasks = task;
-    }
-    spinlock_release(&tasklock);
-
-    return task->nextdue;
+    return hktask_create(name, taskfn, data, 0, HK_ONESHOT, when, false);
 }
 
 
 /**
  * Remove a named task from the housekeepers task list
  *
+ * If the task is being run by a worker, the call waits until the run has
+ * completed, so that the data of the task can be freed once the call
+ * returns. A task may remove itself, it is then freed once it returns.
+ *
  * @param name          The task name to remove
  * @return              Returns 0 if the task could not be removed
  */
 int
 hktask_remove(const char *name)
 {
-    HKTASK *ptr, *lptr = NULL;
+    pthread_mutex_lock(&hk_lock);
+    HKTASK *task = tasks_find(name);
 
-    spinlock_acquire(&tasklock);
-    ptr = tasks;
-    while (ptr && strcmp(ptr->name, name) != 0)
+    if (task)
     {
-        lptr = ptr;
-        ptr = ptr->next;
-    }
-    if (ptr && lptr)
-    {
-        lptr->next = ptr->next;
-    }
-    else if (ptr)
-    {
-        tasks = ptr->next;
+        tasks_unlink(task);
+        schedule_remove(task);
+        task->removed = true;
+
+        if (task->queued)
+        {
+            HKTASK **ptr = &work_head;
+            HKTASK *prev = NULL;
+
+            while (*ptr != task)
+            {
+                prev = *ptr;
+                ptr = &(*ptr)->work_next;
+            }
+
+            *ptr = task->work_next;
+
+            if (work_tail == task)
+            {
+                work_tail = prev;
+            }
+
+            task->queued = false;
+        }
+
+        if (task->running && pthread_equal(task->runner, pthread_self()))
+        {
+            task->free_when_done = true;
+            task = NULL;
+        }
+        else
+        {
+            while (task->running)
+            {
+                pthread_cond_wait(&hk_done_cond, &hk_lock);
+            }
+        }
     }
-    spinlock_release(&tasklock);
 
-    if (ptr)
+    pthread_mutex_unlock(&hk_lock);
+
+    if (task)
     {
-        MXS_FREE(ptr->name);
-        MXS_FREE(ptr);
+        hktask_free(task);
         return 1;
     }
-    else
-    {
-        return 0;
-    }
+
+    return 0;
 }
 
 
 /**
- * The housekeeper thread implementation.
+ * The housekeeper scheduler thread.
  *
- * This function is responsible for executing the housekeeper tasks.
+ * The thread sleeps until the next task is due or the next heartbeat,
+ * whichever comes first, and hands the due tasks to the workers. The
+ * heartbeat is derived from the monotonic clock so that it does not
+ * drift even if the thread is woken up early or late.
  *
- * The implementation of the callng of the task functions is such that
- * the tasks are called without the tasklock spinlock being held. This
- * allows manipulation of the housekeeper task list during execution of
- * one of the tasks. The resutl is that upon completion of a task the
- * search for tasks to run must restart from the start of the queue.
- * It is vital that the task->nextdue tiem is updated before the task
- * is run.
- *
- * @param       data            Unused, here to satisfy the thread system
+ * @param       data            The result of the initialization
  */
-void
+static void
 hkthread(void *data)
 {
-    HKTASK *ptr;
-    time_t now;
-    void (*taskfn)(void *);
-    void *taskdata;
-    int i;
+    struct hkinit_result* res = (struct hkinit_result*)data;
+    int64_t start = mxs_clock_ms();
+
+    sem_post(&res->sem);
+
+    pthread_mutex_lock(&hk_lock);
+
+    while (!do_shutdown)
+    {
+        int64_t now = mxs_clock_ms();
+        int64_t beats = (now - start) / HK_HEARTBEAT_MS;
+        __atomic_store_n(&hkheartbeat, beats, __ATOMIC_RELAXED);
+
+        while (schedule_size > 0 && schedule[0]->due_ms <= now)
+        {
+            HKTASK *task = schedule[0];
+            schedule_remove(task);
+
+            if (task->queued || task->running)
+            {
+                task->n_skipped++;
+            }
+            else
+            {
+                task->queued = true;
+                task->work_next = NULL;
+
+                if (work_tail)
+                {
+                    work_tail->work_next = task;
+                }
+                else
+                {
+                    work_head = task;
+                }
+
+                work_tail = task;
+                pthread_cond_signal(&hk_work_cond);
+            }
+
+            if (task->type == HK_REPEATED)
+            {
+                int64_t period = task->frequency > 0 ? (int64_t)task->frequency * 1000 : 1000;
 
+                if (!schedule_add(task, period))
+                {
+                    MXS_ERROR("Failed to reschedule housekeeper task '%s'.", task->name);
+                }
+            }
+        }
+
+        int64_t wakeup = start + (beats + 1) * HK_HEARTBEAT_MS;
+
+        if (schedule_size > 0 && schedule[0]->due_ms < wakeup)
+        {
+            wakeup = schedule[0]->due_ms;
+        }
+
+        struct timespec ts;
+        ts.tv_sec = wakeup / 1000;
+        ts.tv_nsec = (wakeup % 1000) * 1000000;
+        pthread_cond_timedwait(&hk_schedule_cond, &hk_lock, &ts);
+    }
+
+    pthread_mutex_unlock(&hk_lock);
+
+    MXS_NOTICE("Housekeeper shutting down.");
+}
+
+/**
+ * A housekeeper worker thread.
+ *
+ * Runs the tasks handed over by the scheduler thread. The tasks are run
+ * without hk_lock being held, so that a task can add and remove tasks,
+ * including itself.
+ *
+ * @param       data            The result of the initialization
+ */
+static void
+hkworker(void *data)
+{
     struct hkinit_result* res = (struct hkinit_result*)data;
-    res->ok = qc_thread_init(QC_INIT_BOTH);
 
-    if (!res->ok)
+    if (!qc_thread_init(QC_INIT_BOTH))
     {
         MXS_ERROR("Could not initialize housekeeper thread.");
+        res->ok = false;
     }
 
     sem_post(&res->sem);
 
-    while (!do_shutdown)
+    pthread_mutex_lock(&hk_lock);
+
+    while (true)
     {
-        for (i = 0; i < 10; i++)
+        while (work_head == NULL && !do_shutdown)
         {
-            thread_millisleep(100);
-            hkheartbeat++;
+            pthread_cond_wait(&hk_work_cond, &hk_lock);
         }
-        now = time(0);
-        spinlock_acquire(&tasklock);
-        ptr = tasks;
-        while (!do_shutdown && ptr)
+
+        if (do_shutdown)
         {
-            if (ptr->nextdue <= now)
-            {
-                ptr->nextdue = now + ptr->frequency;
-                taskfn = ptr->task;
-                taskdata = ptr->data;
-                // We need to copy type and name, in case hktask_remove is called from
-                // the callback. Otherwise we will access freed data.
-                HKTASK_TYPE type = ptr->type;
-                char name[strlen(ptr->name) + 1];
-                strcpy(name, ptr->name);
-                spinlock_release(&tasklock);
-                (*taskfn)(taskdata);
-                if (type == HK_ONESHOT)
-                {
-                    hktask_remove(name);
-                }
-                spinlock_acquire(&tasklock);
-                ptr = tasks;
-            }
-            else
+            break;
+        }
+
+        HKTASK *task = work_head;
+        work_head = task->work_next;
+
+        if (work_head == NULL)
+        {
+            work_tail = NULL;
+        }
+
+        task->queued = false;
+        task->running = true;
+        task->runner = pthread_self();
+        pthread_mutex_unlock(&hk_lock);
+
+        uint64_t started = mxs_clock_us();
+        task->task(task->data);
+        uint64_t elapsed = mxs_clock_us() - started;
+
+        pthread_mutex_lock(&hk_lock);
+        task->running = false;
+        task->n_runs++;
+        task->total_us += elapsed;
+
+        if (elapsed > task->max_us)
+        {
+            task->max_us = elapsed;
+        }
+
+        if (task->removed)
+        {
+            if (task->free_when_done)
             {
-                ptr = ptr->next;
+                hktask_free(task);
             }
         }
-        spinlock_release(&tasklock);
+        else if (task->type == HK_ONESHOT)
+        {
+            tasks_unlink(task);
+            hktask_free(task);
+        }
+
+        pthread_cond_broadcast(&hk_done_cond);
     }
 
+    pthread_mutex_unlock(&hk_lock);
+
     qc_thread_end(QC_INIT_BOTH);
-    MXS_NOTICE("Housekeeper shutting down.");
 }
 
 void
 hkshutdown()
 {
+    pthread_mutex_lock(&hk_lock);
     do_shutdown = true;
-    atomic_synchronize();
+    pthread_cond_broadcast(&hk_schedule_cond);
+    pthread_cond_broadcast(&hk_work_cond);
+    pthread_mutex_unlock(&hk_lock);
 }
 
 void hkfinish()
@@ -338,6 +628,13 @@ void hkfinish()
 
     MXS_NOTICE("Waiting for housekeeper to shut down.");
     thread_wait(hk_thr_handle);
+
+    for (int i = 0; i < hk_n_workers; i++)
+    {
+        thread_wait(hk_worker_handles[i]);
+    }
+
+    hk_n_workers = 0;
     do_shutdown = false;
     MXS_NOTICE("Housekeeper has shut down.");
 }
@@ -345,6 +642,8 @@ void hkfinish()
 /**
  * Show the tasks that are scheduled for the house keeper
  *
+ * The run times are the average and the maximum of the completed runs.
+ *
  * @param pdcb          The DCB to send to output
  */
 void
@@ -354,20 +653,26 @@ hkshow_tasks(DCB *pdcb)
     struct tm tm;
     char buf[40];
 
-    dcb_printf(pdcb, "%-25s | Type     | Frequency | Next Due\n", "Name");
-    dcb_printf(pdcb, "--------------------------+----------+-----------+-------------------------\n");
-    spinlock_acquire(&tasklock);
+    dcb_printf(pdcb, "%-25s | Type     | Frequency | Runs     | Skipped  | Avg ms   | Max ms   | Next Due\n",
+               "Name");
+    dcb_printf(pdcb, "--------------------------+----------+-----------+----------+----------+"
+               "----------+----------+-------------------------\n");
+    pthread_mutex_lock(&hk_lock);
     ptr = tasks;
     while (ptr)
     {
         localtime_r(&ptr->nextdue, &tm);
         asctime_r(&tm, buf);
-        dcb_printf(pdcb, "%-25s | %-8s | %-9d | %s",
+        dcb_printf(pdcb, "%-25s | %-8s | %-9d | %-8lu | %-8lu | %-8.1f | %-8.1f | %s",
                    ptr->name,
                    ptr->type == HK_REPEATED ? "Repeated" : "One-Shot",
                    ptr->frequency,
-                   buf);
+                   (unsigned long)ptr->n_runs,
+                   (unsigned long)ptr->n_skipped,
+                   ptr->n_runs ? (double)ptr->total_us / ptr->n_runs / 1000 : 0.0,
+                   (double)ptr->max_us / 1000,
+                   ptr->queued || ptr->running ? "Running\n" : buf);
         ptr = ptr->next;
     }
-    spinlock_release(&tasklock);
+    pthread_mutex_unlock(&hk_lock);
 }
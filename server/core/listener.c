@@ -39,6 +39,26 @@
 #include <maxscale/alloc.h>
 #include <maxscale/users.h>
 #include <maxscale/service.h>
+#include <openssl/rand.h>
+#include <openssl/hmac.h>
+
+/** How long a session ticket key is used for new tickets, in seconds */
+#define TICKET_KEY_LIFETIME 3600
+
+/**
+ * A key that encrypts the TLS session tickets. The same keys are used by all
+ * listeners, a key is accepted for one lifetime after it has been replaced.
+ */
+typedef struct ticket_key
+{
+    unsigned char name[16];
+    unsigned char aes_key[16];
+    unsigned char hmac_key[16];
+    time_t        created;
+} TICKET_KEY;
+
+static TICKET_KEY ticket_keys[2]; /**< The current and the previous key */
+static SPINLOCK ticket_lock = SPINLOCK_INIT;
 
 static RSA *rsa_512 = NULL;
 static RSA *rsa_1024 = NULL;
@@ -128,6 +148,10 @@ listener_alloc(struct service* service, const char* name, const char *protocol,
     proto->authenticator = my_authenticator;
     proto->auth_options = my_auth_options;
     proto->ssl = ssl;
+    proto->compression = false;
+    proto->backlog = 0;
+    proto->defer_accept = 0;
+    proto->fastopen = 0;
     proto->users = NULL;
     proto->next = NULL;
     proto->auth_instance = auth_instance;
@@ -231,6 +255,130 @@ RSA* create_rsa(int bits)
 #endif
 }
 
+/**
+ * Get the current and the previous session ticket keys, the keys are rotated
+ * if the current one has been used for its lifetime
+ *
+ * @param keys Array of two keys where the keys are copied
+ * @return True if the keys are valid
+ */
+static bool get_ticket_keys(TICKET_KEY *keys)
+{
+    bool rval = true;
+    time_t now = time(NULL);
+    spinlock_acquire(&ticket_lock);
+
+    if (now - ticket_keys[0].created >= TICKET_KEY_LIFETIME)
+    {
+        TICKET_KEY key;
+
+        if (RAND_bytes(key.name, sizeof(key.name)) == 1 &&
+            RAND_bytes(key.aes_key, sizeof(key.aes_key)) == 1 &&
+            RAND_bytes(key.hmac_key, sizeof(key.hmac_key)) == 1)
+        {
+            key.created = now;
+            ticket_keys[1] = ticket_keys[0];
+            ticket_keys[0] = key;
+        }
+        else if (ticket_keys[0].created == 0)
+        {
+            rval = false;
+        }
+    }
+
+    memcpy(keys, ticket_keys, sizeof(ticket_keys));
+    spinlock_release(&ticket_lock);
+    return rval;
+}
+
+/**
+ * The TLS session ticket callback of OpenSSL
+ *
+ * New tickets are encrypted with the current key. Tickets encrypted with the
+ * previous key are accepted and renewed with the current one. With TLS 1.3
+ * the clients use a ticket only once, so every accepted ticket is renewed.
+ *
+ * @return 1 if the ticket key was set, 2 if the ticket should be renewed, 0 if
+ * the ticket is not accepted and -1 on error
+ */
+static int ticket_key_cb(SSL *ssl, unsigned char *key_name, unsigned char *iv,
+                         EVP_CIPHER_CTX *ctx, HMAC_CTX *hctx, int enc)
+{
+    TICKET_KEY keys[2];
+
+    if (!get_ticket_keys(keys))
+    {
+        return -1;
+    }
+
+    if (enc)
+    {
+        memcpy(key_name, keys[0].name, sizeof(keys[0].name));
+
+        if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_128_cbc())) != 1 ||
+            !EVP_EncryptInit_ex(ctx, EVP_aes_128_cbc(), NULL, keys[0].aes_key, iv) ||
+            !HMAC_Init_ex(hctx, keys[0].hmac_key, sizeof(keys[0].hmac_key), EVP_sha256(), NULL))
+        {
+            return -1;
+        }
+
+        return 1;
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        if (keys[i].created && memcmp(key_name, keys[i].name, sizeof(keys[i].name)) == 0)
+        {
+            if (!HMAC_Init_ex(hctx, keys[i].hmac_key, sizeof(keys[i].hmac_key), EVP_sha256(), NULL) ||
+                !EVP_DecryptInit_ex(ctx, EVP_aes_128_cbc(), NULL, keys[i].aes_key, iv))
+            {
+                return -1;
+            }
+
+#ifdef TLS1_3_VERSION
+            if (SSL_version(ssl) == TLS1_3_VERSION)
+            {
+                return 2;
+            }
+#endif
+            return i == 0 ? 1 : 2;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Store a new session of a connection to a server. Connections to the server
+ * resume the latest session.
+ *
+ * @param ssl  The connection
+ * @param sess The new session
+ * @return 1 if the session was stored, 0 if not
+ */
+static int new_session_cb(SSL *ssl, SSL_SESSION *sess)
+{
+    if (SSL_is_server(ssl))
+    {
+        /** The sessions of the clients are cached by OpenSSL */
+        return 0;
+    }
+
+    SSL_LISTENER *ssl_listener = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+
+    spinlock_acquire(&ssl_listener->session_lock);
+    SSL_SESSION *old = ssl_listener->session;
+    ssl_listener->session = sess;
+    spinlock_release(&ssl_listener->session_lock);
+
+    if (old)
+    {
+        SSL_SESSION_free(old);
+    }
+
+    return 1;
+}
+
 /**
  * Initialize the listener's SSL context. This sets up the generated RSA
  * encryption keys, chooses the listener encryption level and configures the
@@ -290,8 +438,43 @@ listener_init_SSL(SSL_LISTENER *ssl_listener)
         /** Disable SSLv3 */
         SSL_CTX_set_options(ssl_listener->ctx, SSL_OP_NO_SSLv3);
 
-        // Disable session cache
-        SSL_CTX_set_session_cache_mode(ssl_listener->ctx, SSL_SESS_CACHE_OFF);
+        /** Small buffers are combined into one record before SSL_write */
+        SSL_CTX_set_mode(ssl_listener->ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+        if (ssl_listener->ssl_ktls)
+        {
+#ifdef SSL_OP_ENABLE_KTLS
+            /**
+             * OpenSSL hands the keys to the kernel after the handshake if the
+             * kernel supports the negotiated cipher. The connections where it
+             * does not are encrypted by OpenSSL.
+             */
+            SSL_CTX_set_options(ssl_listener->ctx, SSL_OP_ENABLE_KTLS);
+#else
+            MXS_WARNING("'ssl_ktls' is enabled but OpenSSL was built without "
+                        "kernel TLS support, the connections are encrypted by OpenSSL.");
+#endif
+        }
+
+        /**
+         * Clients can resume their sessions with a session ID or a ticket and
+         * connections to a server resume the latest session of the server. The
+         * session ID context is unique to this configuration so that a session
+         * is not resumed with another listener that may verify the peer.
+         */
+        unsigned char sid_ctx[SSL_MAX_SID_CTX_LENGTH];
+
+        if (RAND_bytes(sid_ctx, sizeof(sid_ctx)) != 1 ||
+            !SSL_CTX_set_session_id_context(ssl_listener->ctx, sid_ctx, sizeof(sid_ctx)))
+        {
+            MXS_ERROR("Failed to set the SSL session ID context.");
+            return -1;
+        }
+
+        SSL_CTX_set_app_data(ssl_listener->ctx, ssl_listener);
+        SSL_CTX_set_session_cache_mode(ssl_listener->ctx, SSL_SESS_CACHE_BOTH);
+        SSL_CTX_sess_set_new_cb(ssl_listener->ctx, new_session_cb);
+        SSL_CTX_set_tlsext_ticket_key_cb(ssl_listener->ctx, ticket_key_cb);
 
         /** Generate the 512-bit and 1024-bit RSA keys */
         if (rsa_512 == NULL && (rsa_512 = create_rsa(512)) == NULL)
@@ -433,6 +616,26 @@ static bool create_listener_config(const SERV_LISTENER *listener, const char *fi
         dprintf(file, "authenticator_options=%s\n", listener->auth_options);
     }
 
+    if (listener->compression)
+    {
+        dprintf(file, "compression=true\n");
+    }
+
+    if (listener->backlog)
+    {
+        dprintf(file, "listen_backlog=%d\n", listener->backlog);
+    }
+
+    if (listener->defer_accept)
+    {
+        dprintf(file, "tcp_defer_accept=%d\n", listener->defer_accept);
+    }
+
+    if (listener->fastopen)
+    {
+        dprintf(file, "tcp_fastopen=%d\n", listener->fastopen);
+    }
+
     if (listener->ssl)
     {
         write_ssl_config(file, listener->ssl);
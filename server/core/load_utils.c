@@ -34,6 +34,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <dlfcn.h>
+#include <pthread.h>
 #include <maxscale/modinfo.h>
 #include <maxscale/log_manager.h>
 #include <maxscale/version.h>
@@ -58,6 +59,8 @@ typedef struct loaded_module
 } LOADED_MODULE;
 
 static LOADED_MODULE *registered = NULL;
+/** Services are started in parallel, which loads protocols and authenticators */
+static pthread_mutex_t load_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
 
 static LOADED_MODULE *find_module(const char *module);
 static LOADED_MODULE* register_module(const char *module,
@@ -160,7 +163,18 @@ static bool check_module(const MXS_MODULE *mod_info, const char *type, const cha
     return success;
 }
 
+static void *load_module_nolock(const char *module, const char *type);
+
 void *load_module(const char *module, const char *type)
+{
+    pthread_mutex_lock(&load_lock);
+    void *rval = load_module_nolock(module, type);
+    pthread_mutex_unlock(&load_lock);
+
+    return rval;
+}
+
+static void *load_module_nolock(const char *module, const char *type)
 {
     ss_dassert(module && type);
     LOADED_MODULE *mod;
@@ -841,13 +855,16 @@ cleanup:
 
 const MXS_MODULE *get_module(const char *name, const char *type)
 {
+    pthread_mutex_lock(&load_lock);
     LOADED_MODULE *mod = find_module(name);
 
-    if (mod == NULL && load_module(name, type))
+    if (mod == NULL && load_module_nolock(name, type))
     {
         mod = find_module(name);
     }
 
+    pthread_mutex_unlock(&load_lock);
+
     return mod ? mod->info : NULL;
 }
 
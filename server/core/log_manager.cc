@@ -30,17 +30,22 @@
 #include <maxscale/atomic.h>
 #include <maxscale/config.h>
 #include <maxscale/debug.h>
-#include <maxscale/hashtable.h>
+#include <maxscale/hashmap.hh>
 #include <maxscale/platform.h>
 #include <maxscale/session.h>
 #include <maxscale/spinlock.h>
+#include <maxscale/spsc_ring.h>
 #include <maxscale/utils.h>
-#include "maxscale/mlist.h"
+#include "maxscale/skygw_utils.h"
 
 #define MAX_PREFIXLEN 250
 #define MAX_SUFFIXLEN 250
 #define MAX_PATHLEN   512
-#define MAXNBLOCKBUFS 10
+
+/** Size of the log ring buffer of a thread. */
+#define LOG_RING_SIZE     (64 * 1024)
+/** Size of the buffer the file writer collects the messages into. */
+#define LOG_WRITE_BUFSIZE (64 * 1024)
 
 /** for procname */
 #if !defined(_GNU_SOURCE)
@@ -53,13 +58,6 @@ static const char LOGFILE_NAME_SUFFIX[] = ".log";
 extern char *program_invocation_name;
 extern char *program_invocation_short_name;
 
-typedef enum
-{
-    BB_READY = 0x00,
-    BB_FULL,
-    BB_CLEARED
-} blockbuf_state_t;
-
 typedef enum
 {
     FILEWRITER_INIT,
@@ -94,7 +92,6 @@ enum log_flush
 
 #if defined(SS_DEBUG)
 static int write_index;
-static int block_start_index;
 static int prevval;
 static simple_mutex_t msg_mutex;
 #endif
@@ -158,7 +155,6 @@ static logmanager_t* lm;
 static bool flushall_flag;
 static bool flushall_started_flag;
 static bool flushall_done_flag;
-static HASHTABLE* message_stats;
 
 /** This is used to detect if the initialization of the log manager has failed
  * and that it isn't initialized again after a failure has occurred. */
@@ -179,6 +175,9 @@ struct filewriter
     /** fwr_clientmes is for messages to log clients */
     skygw_message_t*   fwr_clientmes;
     skygw_thread_t*    fwr_thread;
+    /** Messages collected from the log rings for one write */
+    char*              fwr_buf;
+    size_t             fwr_buf_used;
 #if defined(SS_DEBUG)
     skygw_chk_t        fwr_chk_tail;
 #endif
@@ -199,21 +198,8 @@ typedef struct lm_message_stats
     size_t   count;    /** How many times the error has been reported within this window. */
 } LM_MESSAGE_STATS;
 
-static const int LM_MESSAGE_HASH_SIZE = 293; /** A prime, and roughly a quarter of current
-                                                 number of MXS_{ERROR|WARNING|NOTICE} calls. */
-
-/**
- * Returns the current time.
- *
- * @return Current monotonic raw time in milliseconds.
- */
-static uint64_t time_monotonic_ms()
-{
-    struct timespec now;
-    clock_gettime(CLOCK_MONOTONIC, &now);
-
-    return now.tv_sec * 1000 + now.tv_nsec / 1000000;
-}
+static const int LM_MESSAGE_HASH_SIZE = 293; /** Roughly a quarter of current number of
+                                                 MXS_{ERROR|WARNING|NOTICE} calls. */
 
 /**
  * Hash-function for lm_message_key.
@@ -254,95 +240,101 @@ int lm_message_key_hash(const void *v)
     return hash;
 }
 
-/**
- * Compares two LM_MESSAGE_KEY structures
- *
- * @param v1 Pointer to a LM_MESSAGE_KEY struct.
- * @param v2 Pointer to a LM_MESSAGE_KEY struct.
- * @return  0 if the structures are equal.
- *         -1 if v1 is less than v2
- *          1 if v1 is greater than v2
- */
-static int lm_message_key_cmp(const void* v1, const void* v2)
+struct LMMessageKeyHash
 {
-    const LM_MESSAGE_KEY* key1 = (const LM_MESSAGE_KEY*)v1;
-    const LM_MESSAGE_KEY* key2 = (const LM_MESSAGE_KEY*)v2;
-
-    int cmp = (int64_t)key1->filename - (int64_t)key2->filename;
+    size_t operator()(const LM_MESSAGE_KEY& key) const
+    {
+        return lm_message_key_hash(&key);
+    }
+};
 
-    if (cmp == 0)
+struct LMMessageKeyEqual
+{
+    bool operator()(const LM_MESSAGE_KEY& lhs, const LM_MESSAGE_KEY& rhs) const
     {
-        cmp = key1->linenumber - key2->linenumber;
+        return lhs.filename == rhs.filename && lhs.linenumber == rhs.linenumber;
     }
+};
 
-    return cmp == 0 ? 0 : (cmp < 0 ? -1 : 1);
-}
+/**
+ * The throttling statistics of each logged message. The lookups are done
+ * without locking the map, the statistics are freed with the map.
+ */
+typedef mxs::HashMap<LM_MESSAGE_KEY, LM_MESSAGE_STATS*, LMMessageKeyHash, LMMessageKeyEqual> LMMessageStats;
+
+static LMMessageStats* message_stats;
 
 /**
- * Clone a LM_MESSAGE_KEY
- *
- * @param v Pointer to a LM_MESSAGE_KEY structure
- * @return A copy of v or NULL if memory allocation fails.
+ * Free the statistics of a message
  */
-static void* lm_message_key_clone(const void* v)
+struct LMMessageStatsFree
 {
-    const LM_MESSAGE_KEY* src = (const LM_MESSAGE_KEY*)v;
-    LM_MESSAGE_KEY* dst = (LM_MESSAGE_KEY*)MXS_MALLOC(sizeof(LM_MESSAGE_KEY));
-
-    if (dst)
+    void operator()(const LM_MESSAGE_KEY& key, LM_MESSAGE_STATS*& stats) const
     {
-        dst->filename = src->filename;
-        dst->linenumber = src->linenumber;
+        MXS_FREE(stats);
     }
-
-    return dst;
-}
+};
 
 /**
- * Clone a LM_MESSAGE_STATS
- *
- * @param v Pointer to a LM_MESSAGE_STATS structure
- * @return A copy of v or NULL if memory allocation fails.
+ * Free the message statistics
  */
-static void* lm_message_stats_clone(const void* v)
+static void lm_message_stats_free()
 {
-    const LM_MESSAGE_STATS* src = (const LM_MESSAGE_STATS*)v;
-    LM_MESSAGE_STATS* dst = (LM_MESSAGE_STATS*)MXS_MALLOC(sizeof(LM_MESSAGE_STATS));
-
-    if (dst)
+    if (message_stats)
     {
-        // Somewhat questionable to copy a lock, but in this context we
-        // know that src is stack allocated and will not be used after this.
-        dst->lock = src->lock;
-        dst->first_ms = src->first_ms;
-        dst->last_ms = src->last_ms;
-        dst->count = src->count;
+        LMMessageStatsFree free_stats;
+        message_stats->for_each(free_stats);
+        delete message_stats;
+        message_stats = NULL;
     }
-
-    return dst;
 }
 
 /**
- * Log client's string is copied to block-sized log buffer, which is passed
- * to file writer thread.
+ * A log message in a log ring. The message follows the header.
  */
-typedef struct blockbuf
+typedef struct log_record
 {
-#if defined(SS_DEBUG)
-    skygw_chk_t    bb_chk_top;
-#endif
-    blockbuf_state_t bb_state; /**State of the block buffer*/
-    simple_mutex_t bb_mutex;    /**< bb_buf_used, bb_isfull */
-    int            bb_refcount; /**< protected by list mutex. #of clients */
-//        int            bb_blankcount; /**< # of blanks used btw strings */
-    size_t         bb_buf_size;
-    size_t         bb_buf_left;
-    size_t         bb_buf_used;
-    char           bb_buf[MAX_LOGSTRLEN];
-#if defined(SS_DEBUG)
-    skygw_chk_t    bb_chk_tail;
-#endif
-} blockbuf_t;
+    uint64_t lr_seqno; /**< Global order of the message */
+} log_record_t;
+
+/**
+ * Each thread that logs writes its messages into a ring buffer of its own,
+ * without any locking. The owning thread is the producer and the file writer
+ * thread the consumer of the ring. If the ring is full, an informational or a
+ * debug message is dropped and counted and the file writer reports the number
+ * of dropped messages. Other messages are put on the overflow list instead.
+ *
+ * The rings are in a list that threads only push to. The file writer removes
+ * the ring of a thread that has exited once the ring has been drained.
+ */
+typedef struct log_ring
+{
+    MXS_SPSC_RING    lr_ring;     /**< The messages */
+    uint64_t         lr_dropped;  /**< Dropped messages, written by the owning thread */
+    uint64_t         lr_reported; /**< Dropped messages reported, written by the file writer */
+    bool             lr_orphaned; /**< The owning thread has exited */
+    struct log_ring* lr_next;
+} log_ring_t;
+
+/**
+ * A message that did not fit into the ring of its thread but is too important
+ * to be dropped. The message follows the header.
+ */
+typedef struct log_overflow
+{
+    struct log_overflow* lo_next;
+    uint64_t             lo_seqno; /**< Global order of the message */
+    size_t               lo_len;   /**< Length of the message */
+} log_overflow_t;
+
+static log_ring_t* log_rings;  /**< The rings of all threads */
+static uint64_t log_seqno;     /**< Sequence number of the next message */
+static SPINLOCK log_overflow_lock = SPINLOCK_INIT;
+static log_overflow_t* log_overflow;                     /**< In the order of the sequence numbers */
+static log_overflow_t** log_overflow_end = &log_overflow; /**< Where the next message is added */
+static pthread_key_t log_ring_key;
+static pthread_once_t log_ring_once = PTHREAD_ONCE_INIT;
+static thread_local log_ring_t* this_ring;
 
 /**
  * logfile object corresponds to physical file(s) where
@@ -364,8 +356,6 @@ struct logfile
     const char*      lf_name_suffix;
     char*            lf_full_file_name; /**< complete log file name */
     char*            lf_full_link_name; /**< complete symlink name */
-    /** list of block-sized log buffers */
-    mlist_t          lf_blockbuf_list;
     size_t           lf_buf_size;
     bool             lf_flushflag;
     bool             lf_rotateflag;
@@ -456,14 +446,11 @@ static int logmanager_write_log(int            priority,
                                 size_t         len,
                                 const char*    str);
 
-static blockbuf_t* blockbuf_init();
-static void blockbuf_node_done(void* bb_data);
-static char* blockbuf_get_writepos(blockbuf_t** p_bb,
-                                   size_t       str_len,
-                                   bool         flush);
-
-static void blockbuf_register(blockbuf_t* bb);
-static void blockbuf_unregister(blockbuf_t* bb);
+static log_record_t* log_ring_reserve(size_t len);
+static void log_ring_commit(log_record_t* rec, size_t len, bool flush);
+static void log_ring_drop();
+static void log_overflow_add(log_overflow_t* ovf, size_t len);
+static void log_rings_drain(filewriter_t* fwr, bool flush);
 static char* add_slash(char* str);
 
 static bool check_file_and_path(const char* filename, bool* writable);
@@ -495,7 +482,6 @@ static bool logmanager_init_nomutex(const char* ident,
     lm->lm_chk_top   = CHK_NUM_LOGMANAGER;
     lm->lm_chk_tail  = CHK_NUM_LOGMANAGER;
     write_index = 0;
-    block_start_index = 0;
     prevval = -1;
     simple_mutex_init(&msg_mutex, "Message mutex");
 #endif
@@ -604,25 +590,22 @@ bool mxs_log_init(const char* ident, const char* logdir, mxs_log_target_t target
     {
         ss_dassert(!message_stats);
 
-        message_stats = hashtable_alloc(LM_MESSAGE_HASH_SIZE,
-                                        lm_message_key_hash,
-                                        lm_message_key_cmp);
-        if (message_stats)
+        try
         {
-            // As entries are added to the hashtable they will be cloned,
-            // so stack allocated keys and values are ok.
-            hashtable_memory_fns(message_stats,
-                                 lm_message_key_clone,
-                                 lm_message_stats_clone,
-                                 hashtable_item_free,
-                                 hashtable_item_free);
+            message_stats = new LMMessageStats(LM_MESSAGE_HASH_SIZE);
+        }
+        catch (const std::bad_alloc&)
+        {
+            message_stats = NULL;
+        }
 
+        if (message_stats)
+        {
             succ = logmanager_init_nomutex(ident, logdir, target, log_config.do_maxlog);
 
             if (!succ)
             {
-                hashtable_free(message_stats);
-                message_stats = NULL;
+                lm_message_stats_free();
             }
         }
     }
@@ -680,8 +663,7 @@ static void logmanager_done_nomutex(void)
     MXS_FREE(lm);
     lm = NULL;
 
-    hashtable_free(message_stats);
-    message_stats = NULL;
+    lm_message_stats_free();
 }
 
 /**
@@ -758,8 +740,8 @@ static int logmanager_write_log(int            priority,
     logfile_t*   lf = NULL;
     char*        wp = NULL;
     int          err = 0;
-    blockbuf_t*  bb = NULL;
-    blockbuf_t*  bb_c = NULL;
+    log_record_t* rec = NULL;
+    log_overflow_t* ovf = NULL;
     size_t       timestamp_len;
     int          i;
 
@@ -830,11 +812,31 @@ static int logmanager_write_log(int            priority,
         simple_mutex_unlock(&msg_mutex);
     }
 #endif
-    /** Book space for log string from buffer */
+    /** Book space for log string from the ring of this thread */
     if (do_maxlog)
     {
         // All messages are now logged to the error log file.
-        wp = blockbuf_get_writepos(&bb, safe_str_len, flush);
+        if ((rec = log_ring_reserve(safe_str_len)) == NULL)
+        {
+            // Only informational and debug messages are ever dropped, the rest
+            // are kept on the heap until the file writer gets to them.
+            if (priority > LOG_NOTICE ||
+                (ovf = (log_overflow_t*)MXS_MALLOC(sizeof(log_overflow_t) + safe_str_len)) == NULL)
+            {
+                // The message is dropped from the log file but it can still go to syslog.
+                log_ring_drop();
+                err = -1;
+            }
+        }
+    }
+
+    if (rec)
+    {
+        wp = (char*)(rec + 1);
+    }
+    else if (ovf)
+    {
+        wp = (char*)(ovf + 1);
     }
     else
     {
@@ -911,9 +913,13 @@ static int logmanager_write_log(int            priority,
     }
     wp[safe_str_len - 1] = '\n';
 
-    if (do_maxlog)
+    if (rec)
+    {
+        log_ring_commit(rec, safe_str_len, flush);
+    }
+    else if (ovf)
     {
-        blockbuf_unregister(bb);
+        log_overflow_add(ovf, safe_str_len);
     }
     else
     {
@@ -924,345 +930,341 @@ static int logmanager_write_log(int            priority,
 }
 
 /**
- * Register writer to a block buffer. When reference counter is non-zero the
- * flusher thread doesn't write the block to disk.
+ * Mark the ring of an exiting thread as orphaned. The file writer frees it
+ * once it has been drained.
  *
- * @param bb    block buffer
+ * @param data The ring of the thread
  */
-static void blockbuf_register(blockbuf_t* bb)
+static void log_ring_orphan(void* data)
 {
-    CHK_BLOCKBUF(bb);
-    ss_dassert(bb->bb_refcount >= 0);
-    atomic_add(&bb->bb_refcount, 1);
+    log_ring_t* ring = (log_ring_t*)data;
+
+    this_ring = NULL;
+    __atomic_store_n(&ring->lr_orphaned, true, __ATOMIC_RELEASE);
+}
+
+static void log_ring_key_init()
+{
+    pthread_key_create(&log_ring_key, log_ring_orphan);
 }
 
 /**
- * Unregister writer from block buffer. If the buffer got filled up and there
- * are no other registered writers anymore, notify the flusher thread.
+ * Get the log ring of the calling thread, creating it if needed.
  *
- * @param bb    block buffer
+ * @return The ring of the thread or NULL if memory allocation failed
  */
-static void blockbuf_unregister(blockbuf_t* bb)
+static log_ring_t* log_ring_get()
 {
-    logfile_t* lf;
+    log_ring_t* ring = this_ring;
 
-    CHK_BLOCKBUF(bb);
-    ss_dassert(bb->bb_refcount >= 1);
-    lf = &lm->lm_logfile;
-    CHK_LOGFILE(lf);
-    /**
-     * if this is the last client in a full buffer, send write request.
-     */
-    if (atomic_add(&bb->bb_refcount, -1) == 1 && bb->bb_state == BB_FULL)
+    if (ring == NULL)
     {
-        skygw_message_send(lf->lf_logmes);
+        pthread_once(&log_ring_once, log_ring_key_init);
+
+        if ((ring = (log_ring_t*)MXS_CALLOC(1, sizeof(log_ring_t))) &&
+            !mxs_spsc_ring_init(&ring->lr_ring, LOG_RING_SIZE))
+        {
+            MXS_FREE(ring);
+            ring = NULL;
+        }
+
+        if (ring)
+        {
+            ring->lr_next = __atomic_load_n(&log_rings, __ATOMIC_RELAXED);
+
+            while (!__atomic_compare_exchange_n(&log_rings, &ring->lr_next, ring, false,
+                                                __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            {
+                ;
+            }
+
+            this_ring = ring;
+            pthread_setspecific(log_ring_key, ring);
+        }
     }
-    ss_dassert(bb->bb_refcount >= 0);
-}
 
+    return ring;
+}
 
 /**
- * @node (write brief function description here)
- *
- * Parameters:
- * @param id - <usage>
- *          <description>
- *
- * @param str_len - <usage>
- *          <description>
- *
- * @return
- *
+ * Reserve space for a message from the ring of the calling thread.
  *
- * @details List mutex now protects both the list and the contents of it.
- * TODO : It should be so that adding and removing nodes of the list is protected
- * by the list mutex. Buffer modifications should be protected by buffer
- * mutex.
+ * @param len The length of the message
  *
+ * @return The record for the message, NULL if the ring does not have enough
+ *         free space
  */
-static char* blockbuf_get_writepos(blockbuf_t** p_bb,
-                                   size_t       str_len,
-                                   bool         flush)
-{
-    logfile_t*     lf;
-    mlist_t*       bb_list;
-    char*          pos = NULL;
-    mlist_node_t*  node;
-    blockbuf_t*    bb;
-#if defined(SS_DEBUG)
-    bool           succ;
-#endif
+static log_record_t* log_ring_reserve(size_t len)
+{
+    log_ring_t* ring = log_ring_get();
 
-    CHK_LOGMANAGER(lm);
-    lf = &lm->lm_logfile;
-    CHK_LOGFILE(lf);
-    bb_list = &lf->lf_blockbuf_list;
+    return ring ? (log_record_t*)mxs_spsc_ring_reserve(&ring->lr_ring, sizeof(log_record_t) + len) : NULL;
+}
 
-    /** Lock list */
-    simple_mutex_lock(&bb_list->mlist_mutex, true);
-    CHK_MLIST(bb_list);
+/**
+ * Count a message dropped by the calling thread. The first dropped message
+ * since the last drain wakes up the file writer.
+ */
+static void log_ring_drop()
+{
+    log_ring_t* ring = this_ring;
 
-    if (bb_list->mlist_nodecount > 0)
+    if (ring)
     {
-        /**
-         * At least block buffer exists on the list.
-         */
-        node = bb_list->mlist_first;
+        uint64_t dropped = ring->lr_dropped + 1;
+        __atomic_store_n(&ring->lr_dropped, dropped, __ATOMIC_RELAXED);
 
-        /** Loop over blockbuf list to find write position */
-        while (true)
+        if (dropped - __atomic_load_n(&ring->lr_reported, __ATOMIC_RELAXED) == 1)
         {
-            CHK_MLIST_NODE(node);
-
-            /** Unlock list */
-            simple_mutex_unlock(&bb_list->mlist_mutex);
-
-            bb = (blockbuf_t *)node->mlnode_data;
-            CHK_BLOCKBUF(bb);
+            skygw_message_send(lm->lm_logmes);
+        }
+    }
+}
 
-            /** Lock buffer */
-            simple_mutex_lock(&bb->bb_mutex, true);
+/**
+ * Add a message that did not fit into the ring of the calling thread to the
+ * overflow list and wake up the file writer.
+ *
+ * @param ovf The message allocated by the caller, the file writer frees it
+ * @param len The length of the message
+ */
+static void log_overflow_add(log_overflow_t* ovf, size_t len)
+{
+    ovf->lo_next = NULL;
+    ovf->lo_len = len;
 
-            if (bb->bb_state == BB_FULL || bb->bb_buf_left < str_len)
-            {
-                /**
-                 * This block buffer is too full.
-                 * Send flush request to file writer thread. This causes
-                 * flushing all buffers, and (eventually) frees buffer space.
-                 */
-                blockbuf_register(bb);
+    /** The sequence number is taken under the lock so that the list stays sorted. */
+    spinlock_acquire(&log_overflow_lock);
+    ovf->lo_seqno = atomic_add_uint64(&log_seqno, 1);
+    *log_overflow_end = ovf;
+    log_overflow_end = &ovf->lo_next;
+    spinlock_release(&log_overflow_lock);
 
-                bb->bb_state = BB_FULL;
+    skygw_message_send(lm->lm_logmes);
+}
 
-                blockbuf_unregister(bb);
+/**
+ * Make a reserved message visible to the file writer.
+ *
+ * The file writer is woken up if the message must be flushed or if the ring
+ * became half full.
+ *
+ * @param rec   The record returned by log_ring_reserve
+ * @param len   The length of the message
+ * @param flush Whether the message should be written to disk immediately
+ */
+static void log_ring_commit(log_record_t* rec, size_t len, bool flush)
+{
+    MXS_SPSC_RING* ring = &this_ring->lr_ring;
+    bool was_half_full = mxs_spsc_ring_used(ring) >= LOG_RING_SIZE / 2;
 
-                /** Unlock buffer */
-                simple_mutex_unlock(&bb->bb_mutex);
+    rec->lr_seqno = atomic_add_uint64(&log_seqno, 1);
+    size_t used = mxs_spsc_ring_commit(ring, sizeof(log_record_t) + len);
 
-                /** Lock list */
-                simple_mutex_lock(&bb_list->mlist_mutex, true);
+    if (flush || (!was_half_full && used >= LOG_RING_SIZE / 2))
+    {
+        skygw_message_send(lm->lm_logmes);
+    }
+}
 
+/**
+ * Get the next message of a ring.
+ *
+ * @param ring  The ring to read
+ * @param limit Only messages with a smaller sequence number are returned
+ * @param len   The length of the message is stored here
+ *
+ * @return The next message or NULL if the ring has no messages
+ */
+static log_record_t* log_ring_peek(log_ring_t* ring, uint64_t limit, size_t* len)
+{
+    size_t size;
+    log_record_t* rec = (log_record_t*)mxs_spsc_ring_peek(&ring->lr_ring, &size);
 
-                /**
-                 * If next node exists move forward. Else check if there is
-                 * space for a new block buffer on the list.
-                 */
-                if (node != bb_list->mlist_last)
-                {
-                    node = node->mlnode_next;
-                    continue;
-                }
-                /**
-                 * All buffers on the list are full.
-                 */
-                if (bb_list->mlist_nodecount < bb_list->mlist_nodecount_max)
-                {
-                    /**
-                     * New node is created
-                     */
-                    if ((bb = blockbuf_init()) == NULL)
-                    {
-                        simple_mutex_unlock(&bb_list->mlist_mutex);
-                        return NULL;
-                    }
+    if (rec && rec->lr_seqno < limit)
+    {
+        *len = size - sizeof(log_record_t);
+        return rec;
+    }
 
-                    CHK_BLOCKBUF(bb);
+    return NULL;
+}
 
-                    /**
-                     * Increase version to odd to mark list update active
-                     * update.
-                     */
-                    bb_list->mlist_versno += 1;
-                    ss_dassert(bb_list->mlist_versno % 2 == 1);
+/**
+ * Free the drained rings of the threads that have exited. Only the file
+ * writer removes rings from the list, the logging threads only push to it.
+ */
+static void log_rings_reap()
+{
+    log_ring_t* prev = NULL;
+    log_ring_t* ring = __atomic_load_n(&log_rings, __ATOMIC_ACQUIRE);
 
-                    ss_debug(succ = ) mlist_add_data_nomutex(bb_list, bb);
-                    ss_dassert(succ);
+    while (ring)
+    {
+        log_ring_t* next = ring->lr_next;
 
-                    /**
-                     * Increase version to even to mark completion of update.
-                     */
-                    bb_list->mlist_versno += 1;
-                    ss_dassert(bb_list->mlist_versno % 2 == 0);
-                }
-                else
-                {
-                    /**
-                     * List and buffers are full.
-                     * Reset to the beginning of the list, and wait until
-                     * there is a block buffer with enough space.
-                     */
-                    simple_mutex_unlock(&bb_list->mlist_mutex);
-                    simple_mutex_lock(&bb_list->mlist_mutex, true);
-
-                    node = bb_list->mlist_first;
-                    continue;
-                }
+        if (__atomic_load_n(&ring->lr_orphaned, __ATOMIC_ACQUIRE) &&
+            mxs_spsc_ring_is_empty(&ring->lr_ring))
+        {
+            log_ring_t* expected = ring;
 
-            }
-            else if (bb->bb_state == BB_CLEARED)
+            if (prev == NULL &&
+                !__atomic_compare_exchange_n(&log_rings, &expected, next, false,
+                                             __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
             {
+                /** New rings were pushed in front of this one. */
+                prev = expected;
 
-                /**
-                 *Move the cleared buffer to the end of the list if it is the first one in the list
-                 */
-
-                simple_mutex_unlock(&bb->bb_mutex);
-                simple_mutex_lock(&bb_list->mlist_mutex, true);
-
-                if (node == bb_list->mlist_first)
-                {
-
-                    if ((bb_list->mlist_nodecount > 1) && (node != bb_list->mlist_last))
-                    {
-                        bb_list->mlist_last->mlnode_next = bb_list->mlist_first;
-                        bb_list->mlist_first = bb_list->mlist_first->mlnode_next;
-                        bb_list->mlist_last->mlnode_next->mlnode_next = NULL;
-                        bb_list->mlist_last = bb_list->mlist_last->mlnode_next;
-                    }
-
-                    ss_dassert(node == bb_list->mlist_last);
-
-                    simple_mutex_unlock(&bb_list->mlist_mutex);
-                    simple_mutex_lock(&bb->bb_mutex, true);
-
-                    bb->bb_state = BB_READY;
-
-                    simple_mutex_unlock(&bb->bb_mutex);
-                    simple_mutex_lock(&bb_list->mlist_mutex, true);
-                    node = bb_list->mlist_first;
-                }
-                else
+                while (prev->lr_next != ring)
                 {
-                    if (node->mlnode_next)
-                    {
-                        node = node->mlnode_next;
-                    }
-                    else
-                    {
-                        node = bb_list->mlist_first;
-                    }
-                    continue;
+                    prev = prev->lr_next;
                 }
-
             }
-            else if (bb->bb_state == BB_READY)
+
+            if (prev)
             {
-                /**
-                 * There is space for new log string.
-                 */
-                break;
+                prev->lr_next = next;
             }
-        } /** while (true) */
-    }
-    else
-    {
-
-        /**
-         * Create the first block buffer to logfile's blockbuf list.
-         */
 
-        if ((bb = blockbuf_init()) == NULL)
+            mxs_spsc_ring_destroy(&ring->lr_ring);
+            MXS_FREE(ring);
+        }
+        else
         {
-            return NULL;
+            prev = ring;
         }
 
-        CHK_BLOCKBUF(bb);
+        ring = next;
+    }
+}
 
-        /** Lock buffer */
-        simple_mutex_lock(&bb->bb_mutex, true);
-        /**
-         * Increase version to odd to mark list update active update.
-         */
-        bb_list->mlist_versno += 1;
-        ss_dassert(bb_list->mlist_versno % 2 == 1);
+/**
+ * Write the collected messages to the log file.
+ *
+ * @param fwr   The file writer
+ * @param flush Whether the file should be flushed to disk
+ */
+static void filewriter_write(filewriter_t* fwr, bool flush)
+{
+    if (fwr->fwr_buf_used)
+    {
+        int err = skygw_file_write(fwr->fwr_file, fwr->fwr_buf, fwr->fwr_buf_used, flush);
 
-        ss_debug(succ = ) mlist_add_data_nomutex(bb_list, bb);
-        ss_dassert(succ);
+        if (err)
+        {
+            // TODO: Log this to syslog.
+            char errbuf[MXS_STRERROR_BUFLEN];
+            LOG_ERROR("MaxScale Log: Error, writing to the log-file %s failed due to %d, %s. "
+                      "Disabling writing to the log.\n",
+                      fwr->fwr_logmgr->lm_logfile.lf_full_file_name, err,
+                      strerror_r(err, errbuf, sizeof(errbuf)));
 
-        /**
-         * Increase version to even to mark completion of update.
-         */
-        bb_list->mlist_versno += 1;
-        ss_dassert(bb_list->mlist_versno % 2 == 0);
+            mxs_log_set_maxlog_enabled(false);
+        }
 
-        /** Unlock list */
-        simple_mutex_unlock(&bb_list->mlist_mutex);
-    } /* if (bb_list->mlist_nodecount > 0) */
+        fwr->fwr_buf_used = 0;
+    }
+}
 
-    ss_dassert(pos == NULL);
-    ss_dassert(!(bb->bb_state == BB_FULL || bb->bb_buf_left < str_len));
-    ss_dassert(bb_list->mlist_nodecount <= bb_list->mlist_nodecount_max);
+/**
+ * Add a message to the write buffer, writing the buffer out if it is full.
+ *
+ * @param fwr  The file writer
+ * @param data The message
+ * @param len  The length of the message
+ */
+static void filewriter_append(filewriter_t* fwr, const char* data, size_t len)
+{
+    if (fwr->fwr_buf_used + len > LOG_WRITE_BUFSIZE)
+    {
+        filewriter_write(fwr, false);
+    }
 
-    /**
-     * Registration to blockbuf adds reference for the write operation.
-     * It indicates that client has allocated space from the buffer,
-     * but not written yet. As long as refcount > 0 buffer can't be
-     * written to disk.
-     */
-    blockbuf_register(bb);
-    *p_bb = bb;
-    /**
-     * At this point list mutex is held and bb points to a node with
-     * enough space available. pos is not yet set.
-     */
-    pos = &bb->bb_buf[bb->bb_buf_used];
-    bb->bb_buf_used += str_len;
-    bb->bb_buf_left -= str_len;
+    memcpy(fwr->fwr_buf + fwr->fwr_buf_used, data, len);
+    fwr->fwr_buf_used += len;
+}
 
-    ss_dassert((pos >= &bb->bb_buf[0]) && (pos <= &bb->bb_buf[MAX_LOGSTRLEN - str_len]));
+/**
+ * Write the messages in the rings of all threads and on the overflow list to
+ * the log file.
+ *
+ * The messages are merged in the order in which they were logged and written
+ * with as few writes as the write buffer allows. Messages logged after the
+ * drain started are left for the next round so that a thread that logs
+ * continuously cannot keep the writer from finishing.
+ *
+ * @param fwr   The file writer
+ * @param flush Whether the file should be flushed to disk
+ */
+static void log_rings_drain(filewriter_t* fwr, bool flush)
+{
+    spinlock_acquire(&log_overflow_lock);
+    log_overflow_t* overflow = log_overflow;
+    log_overflow = NULL;
+    log_overflow_end = &log_overflow;
+    spinlock_release(&log_overflow_lock);
 
-    /** read checkmark */
-    /** TODO: add buffer overflow checkmark
-        chk_val = (int)bb->bb_buf[bb->bb_buf_used-count_len];
-        ss_dassert(chk_val == bb->bb_strcount);
-    */
+    /** Taken after the overflow list, all of its messages are below the limit. */
+    uint64_t limit = __atomic_load_n(&log_seqno, __ATOMIC_ACQUIRE);
 
-    /** TODO : write next checkmark
-        bb->bb_strcount += 1;
-        memcpy(&bb->bb_buf[bb->bb_buf_used], &bb->bb_strcount, count_len);
-        bb->bb_buf_used += count_len;
-        bb->bb_buf_left -= count_len;
-    */
+    while (true)
+    {
+        log_ring_t* next = NULL;
+        log_record_t* next_rec = NULL;
+        size_t next_len = 0;
 
-    /**
-     * If flush flag is set, set buffer full. As a consequence, no-one
-     * can write to it before it is flushed to disk.
-     */
-    bb->bb_state = (flush == true ? BB_FULL : bb->bb_state);
+        for (log_ring_t* ring = __atomic_load_n(&log_rings, __ATOMIC_ACQUIRE); ring; ring = ring->lr_next)
+        {
+            size_t len;
+            log_record_t* rec = log_ring_peek(ring, limit, &len);
 
-    /** Unlock buffer */
-    simple_mutex_unlock(&bb->bb_mutex);
-    return pos;
-}
+            if (rec && (next_rec == NULL || rec->lr_seqno < next_rec->lr_seqno))
+            {
+                next = ring;
+                next_rec = rec;
+                next_len = len;
+            }
+        }
 
-static void blockbuf_node_done(void* bb_data)
-{
-    blockbuf_t* bb = (blockbuf_t *)bb_data;
-    simple_mutex_done(&bb->bb_mutex);
-}
+        if (overflow && (next_rec == NULL || overflow->lo_seqno < next_rec->lr_seqno))
+        {
+            log_overflow_t* ovf = overflow;
+            overflow = ovf->lo_next;
+            filewriter_append(fwr, (const char*)(ovf + 1), ovf->lo_len);
+            MXS_FREE(ovf);
+            continue;
+        }
 
+        if (next == NULL)
+        {
+            break;
+        }
 
-static blockbuf_t* blockbuf_init()
-{
-    blockbuf_t* bb;
+        filewriter_append(fwr, (const char*)(next_rec + 1), next_len);
+        mxs_spsc_ring_consume(&next->lr_ring);
+    }
+
+    uint64_t dropped = 0;
 
-    if ((bb = (blockbuf_t *) MXS_CALLOC(1, sizeof (blockbuf_t))))
+    for (log_ring_t* ring = __atomic_load_n(&log_rings, __ATOMIC_ACQUIRE); ring; ring = ring->lr_next)
     {
-#if defined(SS_DEBUG)
-        bb->bb_chk_top = CHK_NUM_BLOCKBUF;
-        bb->bb_chk_tail = CHK_NUM_BLOCKBUF;
-#endif
-        simple_mutex_init(&bb->bb_mutex, "Blockbuf mutex");
-        bb->bb_buf_left = MAX_LOGSTRLEN;
-        bb->bb_buf_size = MAX_LOGSTRLEN;
-#if defined(SS_LOG_DEBUG)
-        sprintf(bb->bb_buf, "[block:%d]", atomic_add(&block_start_index, 1));
-        bb->bb_buf_used += strlen(bb->bb_buf);
-        bb->bb_buf_left -= strlen(bb->bb_buf);
-#endif
-        CHK_BLOCKBUF(bb);
+        uint64_t n = __atomic_load_n(&ring->lr_dropped, __ATOMIC_RELAXED);
+        dropped += n - ring->lr_reported;
+        __atomic_store_n(&ring->lr_reported, n, __ATOMIC_RELAXED);
     }
-    return bb;
+
+    if (dropped)
+    {
+        char msg[get_timestamp_len() + 200];
+        size_t len = snprint_timestamp(msg, sizeof(msg));
+        len += snprintf(msg + len, sizeof(msg) - len,
+                        "warning: %lu informational or debug messages were dropped "
+                        "because the log could not be written fast enough.\n", dropped);
+        filewriter_append(fwr, msg, MXS_MIN(len, sizeof(msg) - 1));
+    }
+
+    filewriter_write(fwr, flush);
+    log_rings_reap();
 }
 
 /**
@@ -1915,20 +1917,6 @@ static bool logfile_init(logfile_t*    logfile,
     {
         goto return_with_succ;
     }
-    /**
-     * Create a block buffer list for log file. Clients' writes go to buffers
-     * from where separate log flusher thread writes them to disk.
-     */
-    if (mlist_init(&logfile->lf_blockbuf_list,
-                   NULL,
-                   MXS_STRDUP_A("logfile block buffer list"),
-                   blockbuf_node_done,
-                   MAXNBLOCKBUFS) == NULL)
-    {
-        LOG_ERROR("MaxScale Log: Error, Initializing buffers for log files failed.\n");
-        logfile_free_memory(logfile);
-        goto return_with_succ;
-    }
 
     succ = true;
     logfile->lf_state = RUN;
@@ -1970,11 +1958,6 @@ static void logfile_done(logfile_t* lf)
         CHK_LOGFILE(lf);
     /** fallthrough */
     case INIT:
-        /** Test if list is initialized before freeing it */
-        if (lf->lf_blockbuf_list.mlist_versno != 0)
-        {
-            mlist_done(&lf->lf_blockbuf_list);
-        }
         logfile_free_memory(lf);
         lf->lf_state = DONE;
     /** fallthrough */
@@ -2036,7 +2019,8 @@ static bool filewriter_init(logmanager_t* logmanager, filewriter_t* fw, bool wri
 
     logfile_t* lf = logmanager_get_logfile(logmanager);
 
-    if (logfile_open_file(fw, lf, SKYGW_OPEN_APPEND, write_header))
+    if ((fw->fwr_buf = (char*)MXS_MALLOC(LOG_WRITE_BUFSIZE)) &&
+        logfile_open_file(fw, lf, SKYGW_OPEN_APPEND, write_header))
     {
         fw->fwr_state = RUN;
         CHK_FILEWRITER(fw);
@@ -2109,6 +2093,8 @@ static void filewriter_done(filewriter_t* fw, bool write_footer)
             skygw_file_close(fw->fwr_file);
         }
     case INIT:
+        MXS_FREE(fw->fwr_buf);
+        fw->fwr_buf = NULL;
         fw->fwr_logmes = NULL;
         fw->fwr_clientmes = NULL;
         fw->fwr_state = DONE;
@@ -2138,6 +2124,12 @@ static bool thr_flush_file(logmanager_t *lm, filewriter_t *fwr)
     lf->lf_rotateflag = false;
     release_lock(&lf->lf_spinlock);
 
+    if (rotate_logfile && fwr->fwr_file)
+    {
+        // The messages logged before the rotation go to the old file.
+        log_rings_drain(fwr, false);
+    }
+
     // fwr->fwr_file may be NULL if an earlier log-rotation failed.
     if (rotate_logfile || !fwr->fwr_file)
     {
@@ -2160,94 +2152,14 @@ static bool thr_flush_file(logmanager_t *lm, filewriter_t *fwr)
                           lf->lf_full_file_name);
             }
         }
-
-        return true;
     }
 
-    skygw_file_t *file = fwr->fwr_file;
-    /**
-     * get logfile's block buffer list
-     */
-    mlist_t *bb_list = &lf->lf_blockbuf_list;
-#if defined(SS_DEBUG)
-    simple_mutex_lock(&bb_list->mlist_mutex, true);
-    CHK_MLIST(bb_list);
-    simple_mutex_unlock(&bb_list->mlist_mutex);
-#endif
-    mlist_node_t *node = bb_list->mlist_first;
-
-    while (node != NULL)
+    // fwr->fwr_file is NULL if the log file could not be re-opened and the
+    // messages are then kept in the rings, or dropped when the rings fill up.
+    if (fwr->fwr_file)
     {
-        int err = 0;
-
-        CHK_MLIST_NODE(node);
-        blockbuf_t *bb = (blockbuf_t *)node->mlnode_data;
-        CHK_BLOCKBUF(bb);
-
-        /** Lock block buffer */
-        simple_mutex_lock(&bb->bb_mutex, true);
-
-        blockbuf_state_t flush_blockbuf = bb->bb_state;
-
-        if (bb->bb_buf_used != 0 &&
-            ((flush_blockbuf == BB_FULL) || flush_logfile || do_flushall))
-        {
-            /**
-             * buffer is at least half-full
-             * -> write to disk
-             */
-            while (bb->bb_refcount > 0)
-            {
-                simple_mutex_unlock(&bb->bb_mutex);
-                simple_mutex_lock(&bb->bb_mutex, true);
-            }
-            err = skygw_file_write(file,
-                                   (void *)bb->bb_buf,
-                                   bb->bb_buf_used,
-                                   (flush_logfile || do_flushall));
-            if (err)
-            {
-                // TODO: Log this to syslog.
-                char errbuf[MXS_STRERROR_BUFLEN];
-                LOG_ERROR("MaxScale Log: Error, writing to the log-file %s failed due to %d, %s. "
-                          "Disabling writing to the log.\n",
-                          lf->lf_full_file_name, err, strerror_r(err, errbuf, sizeof(errbuf)));
-
-                mxs_log_set_maxlog_enabled(false);
-            }
-            /**
-             * Reset buffer's counters and mark
-             * not full.
-             */
-            bb->bb_buf_left = bb->bb_buf_size;
-            bb->bb_buf_used = 0;
-            memset(bb->bb_buf, 0, bb->bb_buf_size);
-            bb->bb_state = BB_CLEARED;
-#if defined(SS_LOG_DEBUG)
-            sprintf(bb->bb_buf, "[block:%d]", atomic_add(&block_start_index, 1));
-            bb->bb_buf_used += strlen(bb->bb_buf);
-            bb->bb_buf_left -= strlen(bb->bb_buf);
-#endif
-
-        }
-        /** Release lock to block buffer */
-        simple_mutex_unlock(&bb->bb_mutex);
-
-        size_t vn1;
-        size_t vn2;
-        /** Consistent lock-free read on the list */
-        do
-        {
-            while ((vn1 = bb_list->mlist_versno) % 2 != 0)
-            {
-                continue;
-            }
-            node = node->mlnode_next;
-            vn2 = bb_list->mlist_versno;
-        }
-        while (vn1 != vn2 && node);
-
-    } /* while (node != NULL) */
+        log_rings_drain(fwr, flush_logfile || do_flushall);
+    }
 
     /**
      * Writer's exit flag was set after checking it.
@@ -2277,38 +2189,22 @@ static bool thr_flush_file(logmanager_t *lm, filewriter_t *fwr)
  * @return
  *
  *
- * @details Waits until receives wake-up message. Scans through block buffer
- * lists of each logfile object.
- *
- * Block buffer is written to log file if
- * 1. bb_state == true,
- * 2. logfile object's lf_flushflag == true, or
- * 3. skygw_thread_must_exit returns true.
- *
- * Log file is flushed (fsync'd) in cases #2 and #3.
- *
- * Concurrency control : block buffer is accessed by file writer (this) and
- * log clients. File writer reads and sets each logfile object's flushflag
- * with spinlock. Another protected section is when block buffer's metadata is
- * read, and optionally the write operation.
- *
- * When block buffer is marked full, logfile's flushflag is set, other
- * log clients don't try to access buffer(s). There may, however, be
- * active writes, on the block in parallel with file writer operations.
- * Each active write corresponds to bb_refcounter values.
- * On the other hand, file writer doesn't process the block buffer before
- * its refcount is zero.
- *
- * Every log file obj. has its own block buffer (linked) list.
- * List is accessed by log clients, which add nodes if necessary, and
- * by file writer which traverses the list and accesses block buffers
- * included in list nodes.
- * List modifications are protected with version numbers.
- * Before
- modification, version is increased by one to be odd. After the
- * completion, it is increased again to even. List can be read only when
- * version is even and read is consistent only if version hasn't changed
- * during the read.
+ * @details Waits until receives wake-up message and writes the messages in
+ * the log rings of all threads to the log file.
+ *
+ * The writer is woken up when
+ * 1. an error is logged,
+ * 2. the ring of a thread becomes half full or a message is dropped,
+ * 3. the log is flushed or rotated, or
+ * 4. skygw_thread_must_exit returns true.
+ *
+ * Log file is flushed (fsync'd) in cases #1, #3 and #4.
+ *
+ * Concurrency control : each ring has a single producer, the thread that owns
+ * it, and a single consumer, the file writer. The owner publishes a message
+ * by moving the head of the ring and the writer releases space by moving the
+ * tail, so neither takes any locks. The sequence number of each message lets
+ * the writer merge the rings in the order the messages were logged.
  */
 static void* thr_filewriter_fun(void* data)
 {
@@ -2781,36 +2677,49 @@ static message_suppression_t message_status(const char* file, int line)
     if ((t.count != 0) && (t.window_ms != 0) && (t.suppress_ms != 0))
     {
         LM_MESSAGE_KEY key = { file, line };
-        LM_MESSAGE_STATS *value;
-
-        errno = 0;
+        LM_MESSAGE_STATS *value = NULL;
 
-        // Since the hashtable can not be externally locked, the lookup/creation
-        // must be done in a loop to ensure that everything works even if two
-        // threads logs the same message at the very same time.
-        do
+        // Lookups do not lock the map. If two threads log the same message
+        // at the very same time, only one of the inserts succeeds and the
+        // other thread uses the statistics of the winner.
+        if (!message_stats->find(key, &value))
         {
-            value = (LM_MESSAGE_STATS*) hashtable_fetch(message_stats, &key);
+            LM_MESSAGE_STATS* stats = (LM_MESSAGE_STATS*)MXS_MALLOC(sizeof(LM_MESSAGE_STATS));
 
-            if (!value)
+            if (stats)
             {
-                LM_MESSAGE_STATS stats;
-                spinlock_init(&stats.lock);
-                stats.first_ms = time_monotonic_ms();
-                stats.last_ms = 0;
-                stats.count = 0;
-
-                // hashtable_add may fail for two reasons; the key exists
-                // already or it runs out of memory. In the latter case
-                // errno is set.
-                hashtable_add(message_stats, &key, &stats);
+                spinlock_init(&stats->lock);
+                stats->first_ms = mxs_clock_ms();
+                stats->last_ms = 0;
+                stats->count = 0;
+
+                bool inserted = false;
+
+                try
+                {
+                    inserted = message_stats->insert(key, stats);
+                }
+                catch (const std::bad_alloc&)
+                {
+                    // Logging the failure here would recurse, the message
+                    // simply is not throttled.
+                }
+
+                if (inserted)
+                {
+                    value = stats;
+                }
+                else
+                {
+                    MXS_FREE(stats);
+                    message_stats->find(key, &value);
+                }
             }
         }
-        while (!value && (errno == 0));
 
         if (value)
         {
-            uint64_t now_ms = time_monotonic_ms();
+            uint64_t now_ms = mxs_clock_ms();
 
             spinlock_acquire(&value->lock);
 
@@ -0,0 +1,74 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file core/maxscale/alloc.h - The private memory accounting interface
+ */
+
+#include <maxscale/alloc.h>
+#include <maxscale/dcb.h>
+#include <maxscale/resultset.h>
+
+MXS_BEGIN_DECLS
+
+/** Maximum number of allocation tags, the last one collects the rest */
+#define MXS_ALLOC_MAX_TAGS 64
+
+/**
+ * @brief Enable or disable the accounting of allocations
+ *
+ * Memory freed while the accounting is enabled is counted even if it was
+ * allocated before the accounting was enabled.
+ *
+ * @param enabled Whether allocations are accounted
+ */
+void mxs_alloc_set_accounting(bool enabled);
+
+/**
+ * @brief Get the name of the memory allocator
+ *
+ * @return "jemalloc", "tcmalloc" or "glibc"
+ */
+const char* mxs_allocator_name();
+
+/**
+ * @brief Get the number of bytes the allocator has handed out
+ *
+ * @return Allocated bytes or -1 if not known
+ */
+int64_t mxs_allocator_allocated();
+
+/**
+ * @brief Get the number of bytes of memory the allocator holds
+ *
+ * @return Bytes of memory held by the allocator or -1 if not known
+ */
+int64_t mxs_allocator_resident();
+
+/**
+ * @brief Return a resultset with the accounted allocations of each tag
+ *
+ * @return A resultset, or NULL on memory allocation failure
+ */
+RESULTSET* memoryGetList();
+
+/**
+ * @brief Print the memory allocator statistics and the accounted
+ * allocations of each tag
+ *
+ * @param dcb DCB to print to
+ */
+void dprintMemory(DCB *dcb);
+
+MXS_END_DECLS
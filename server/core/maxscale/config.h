@@ -27,6 +27,11 @@ MXS_BEGIN_DECLS
 #define DEFAULT_NTHREADS            1    /**< Default number of polling threads */
 #define DEFAULT_QUERY_RETRIES       0    /**< Number of retries for interrupted queries */
 #define DEFAULT_QUERY_RETRY_TIMEOUT 5    /**< Timeout for query retries */
+#define DEFAULT_SLOW_EVENT_THRESHOLD 100 /**< Default slow event threshold (milliseconds) */
+#define DEFAULT_SLOW_QUERY_LOG_RATE  10  /**< Default maximum slow statements logged per second */
+#define DEFAULT_QC_CACHE_SIZE        1000 /**< Default number of classifications cached per thread */
+#define DEFAULT_WRITEQ_HIGH_WATER    (16 * 1024 * 1024) /**< Default client write queue high water mark */
+#define DEFAULT_WRITEQ_LOW_WATER     (8 * 1024) /**< Default client write queue low water mark */
 
 /**
  * @brief Generate default module parameters
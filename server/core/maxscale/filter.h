@@ -32,7 +32,9 @@ struct mxs_filter_def
     char **options;               /**< The options set for this filter */
     MXS_CONFIG_PARAMETER *parameters; /**< The filter parameters */
     MXS_FILTER* filter;           /**< The runtime filter */
+    void **thread_instances;      /**< The data of the runtime filter for each thread */
     MXS_FILTER_OBJECT *obj;       /**< The "MODULE_OBJECT" for the filter */
+    uint64_t capabilities;        /**< The capabilities of the filter instance */
     SPINLOCK spin;                /**< Spinlock to protect the filter definition */
     struct mxs_filter_def *next;  /**< Next filter in the chain of all filters */
 };
@@ -42,6 +44,7 @@ void filter_add_parameter(MXS_FILTER_DEF *filter_def, const char *name, const ch
 MXS_FILTER_DEF *filter_alloc(const char *name, const char *module_name);
 MXS_DOWNSTREAM *filter_apply(MXS_FILTER_DEF *filter_def, MXS_SESSION *session, MXS_DOWNSTREAM *downstream);
 void filter_free(MXS_FILTER_DEF *filter_def);
+void filter_destroy_thread_instances(MXS_FILTER_DEF *filter_def);
 bool filter_load(MXS_FILTER_DEF *filter_def);
 int filter_standard_parameter(const char *name);
 MXS_UPSTREAM *filter_upstream(MXS_FILTER_DEF *filter_def, void *fsession, MXS_UPSTREAM *upstream);
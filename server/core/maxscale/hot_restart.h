@@ -0,0 +1,77 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file core/maxscale/hot_restart.h - Handing the listener sockets to a new process
+ *
+ * A MaxScale process with the hot_restart_socket parameter waits on that Unix
+ * socket for a new MaxScale process. The new process is sent the listening
+ * sockets, so the connections that are made meanwhile are queued in the
+ * kernel instead of being refused. The old process then stops accepting,
+ * releases its PID file and shuts down once its clients have disconnected.
+ */
+
+#include <maxscale/cdefs.h>
+
+MXS_BEGIN_DECLS
+
+/**
+ * @brief Take the listener sockets of a running MaxScale process
+ *
+ * Called at startup before the PID file is checked. If no process waits on
+ * the socket, MaxScale starts normally.
+ *
+ * @param path The Unix socket of the running process
+ * @return True if the sockets were taken over and the old process released
+ *         its PID file
+ */
+bool hot_restart_receive(const char *path);
+
+/**
+ * @brief Get a socket that was taken over from the old process
+ *
+ * @param bind The address of the listener in the format given to dcb_listen()
+ * @return The listening socket or -1 if none was taken over for the address
+ */
+int hot_restart_take_socket(const char *bind);
+
+/**
+ * @brief Close the sockets that no listener took
+ *
+ * Called once all services are started. The listeners that were removed from
+ * the configuration stop accepting connections when their sockets are closed.
+ */
+void hot_restart_close_unused(void);
+
+/**
+ * @brief Start waiting for a new process
+ *
+ * Once a new process has taken over the listeners, @c release_pidfile is
+ * called and the process is stopped with SIGTERM when its sessions have been
+ * drained.
+ *
+ * @param path            The Unix socket to listen on
+ * @param release_pidfile Function that unlocks the PID file without removing it
+ * @return True if the socket was created
+ */
+bool hot_restart_start(const char *path, void (*release_pidfile)(void));
+
+/**
+ * @brief Stop waiting for a new process
+ *
+ * Called at shutdown once the polling threads have stopped.
+ */
+void hot_restart_finish(void);
+
+MXS_END_DECLS
@@ -0,0 +1,100 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file core/maxscale/metrics.h - Metrics in the OpenMetrics text format
+ *
+ * The metrics are formatted into one growing buffer that is written to the
+ * client in one go. The lists of servers and services are walked without
+ * taking their locks, the objects are never freed while MaxScale runs.
+ */
+
+#include <maxscale/cdefs.h>
+#include <maxscale/buffer.h>
+#include <maxscale/histogram.h>
+
+MXS_BEGIN_DECLS
+
+/** The HTTP content type of the metrics */
+#define METRICS_CONTENT_TYPE "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+/** Maximum length of the labels of one sample */
+#define METRICS_LABELS_LEN 512
+
+typedef struct metrics
+{
+    char   *data;   /**< The formatted metrics */
+    size_t  len;    /**< Length of the data */
+    size_t  size;   /**< Size of the allocated buffer */
+    bool    failed; /**< Memory allocation failed */
+} METRICS;
+
+/**
+ * @brief Start a metric family
+ *
+ * @param metrics The metrics
+ * @param name    Name of the family
+ * @param type    OpenMetrics type, e.g. "counter" or "gauge"
+ * @param help    Description of the family
+ */
+void metrics_family(METRICS *metrics, const char *name, const char *type, const char *help);
+
+/**
+ * @brief Add a label to a label set
+ *
+ * The value is escaped as required by the format.
+ *
+ * @param labels Label set, an empty string for none
+ * @param key    Name of the label
+ * @param value  Value of the label
+ */
+void metrics_label(char labels[METRICS_LABELS_LEN], const char *key, const char *value);
+
+/**
+ * @brief Add a sample
+ *
+ * @param metrics The metrics
+ * @param name    Name of the sample, including a possible suffix like _total
+ * @param labels  Label set of the sample
+ * @param value   Value of the sample
+ */
+void metrics_value(METRICS *metrics, const char *name, const char *labels, double value);
+
+/**
+ * @brief Add the percentiles and the count of a histogram as a summary
+ *
+ * @param metrics The metrics
+ * @param name    Name of the family
+ * @param labels  Label set of the summary
+ * @param hist    The histogram, in microseconds
+ */
+void metrics_summary(METRICS *metrics, const char *name, const char *labels, const HISTOGRAM *hist);
+
+/**
+ * @brief Collect all the metrics of MaxScale
+ *
+ * @return A buffer with the metrics or NULL on memory allocation failure
+ */
+GWBUF* metrics_collect();
+
+/** Add the metrics of the polling system */
+void poll_metrics(METRICS *metrics);
+
+/** Add the metrics of the servers */
+void server_metrics(METRICS *metrics);
+
+/** Add the metrics of the services */
+void service_metrics(METRICS *metrics);
+
+MXS_END_DECLS
@@ -28,6 +28,8 @@ MXS_BEGIN_DECLS
 
 #define MONITOR_DEFAULT_INTERVAL 10000 // in milliseconds
 
+#define DEFAULT_JOURNAL_MAX_AGE 28800 // in seconds
+
 /**
  * Monitor network timeout types
  */
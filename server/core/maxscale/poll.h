@@ -18,12 +18,19 @@
 
 #include <maxscale/poll.h>
 
+#include <maxscale/platform.h>
 #include <maxscale/resultset.h>
 
 MXS_BEGIN_DECLS
 
 #define MAX_EVENTS 1000
 
+/** The ID of the polling thread executing the calling code */
+extern thread_local int current_thread_id;
+
+/** True if the calling thread is a polling thread */
+extern thread_local bool poll_thread;
+
 /**
  * A statistic identifier that can be returned by poll_get_stat
  */
@@ -52,6 +59,26 @@ void            poll_waitevents(void *);
 void            poll_set_maxwait(unsigned int);
 void            poll_set_nonblocking_polls(unsigned int);
 
+/**
+ * @brief Change the number of active polling threads
+ *
+ * The new sessions are placed on the active threads. When the number is
+ * decreased, the threads that are no longer active move their sessions to the
+ * active threads as the sessions become idle. The number can be at most the
+ * number of polling threads, which is the value of threads_max.
+ *
+ * @param n The number of active threads
+ * @return True if the number was valid
+ */
+bool            poll_set_active_threads(int n);
+
+/**
+ * @brief Get the number of active polling threads
+ *
+ * @return The number of threads that new sessions are placed on
+ */
+int             poll_get_active_threads(void);
+
 void            dprintPollStats(DCB *);
 void            dShowThreads(DCB *dcb);
 void            dShowEventQ(DCB *dcb);
@@ -59,7 +86,71 @@ void            dShowEventStats(DCB *dcb);
 
 int64_t         poll_get_stat(POLL_STAT stat);
 RESULTSET       *eventTimesGetList();
+RESULTSET       *eventLatencyGetList();
 
 void            poll_send_message(enum poll_message msg, void *data);
 
+/**
+ * @brief Move DCBs to another thread's epoll instance
+ *
+ * Either all of the DCBs are moved or none of them is. This must only be
+ * called by the thread that owns the DCBs while it is not processing an event
+ * for them. The caller is responsible for updating the owning thread of the
+ * DCBs.
+ *
+ * @param dcbs  The DCBs to move
+ * @param n     Number of DCBs
+ * @param from  The current owner of the DCBs
+ * @param to    The new owner of the DCBs
+ * @return True if the DCBs were moved, false if they are all still polled
+ *         by @c from
+ */
+bool            poll_move_dcbs(DCB **dcbs, int n, int from, int to);
+
+/**
+ * @brief Stop or resume the polling of a DCB for incoming data
+ *
+ * The hangups and the writability of the DCB are still polled. When the
+ * polling is resumed, the data that arrived in the meantime generates an
+ * event.
+ *
+ * @param dcb      The DCB to throttle, owned by the calling thread
+ * @param throttle True to stop polling for incoming data, false to resume it
+ * @return True if the polling was changed
+ */
+bool            poll_throttle_dcb(DCB *dcb, bool throttle);
+
+/**
+ * A descriptor that a polling thread watches without a DCB
+ *
+ * The descriptor is polled for edge triggered readability and writability and
+ * the handler is called with the epoll events in the polling thread.
+ */
+typedef struct poll_watch
+{
+    int  fd;                                                 /*< The watched descriptor */
+    int  thread;                                             /*< The polling thread */
+    void (*handler)(struct poll_watch *watch, uint32_t events); /*< Called for the events */
+} POLL_WATCH;
+
+/**
+ * @brief Start watching a descriptor
+ *
+ * @param watch  The watch, with the descriptor and the handler set
+ * @param thread The polling thread that calls the handler
+ * @return True if the descriptor is watched
+ */
+bool            poll_add_watch(POLL_WATCH *watch, int thread);
+
+/**
+ * @brief Stop watching a descriptor
+ *
+ * The handler may still be called for the events that the polling thread has
+ * already received in its current poll cycle.
+ *
+ * @param watch The watch to remove
+ * @return True if the descriptor is no longer watched
+ */
+bool            poll_remove_watch(POLL_WATCH *watch);
+
 MXS_END_DECLS
@@ -0,0 +1,69 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file core/maxscale/poll_uring.h - The io_uring backend of the polling threads
+ *
+ * The functions have the same semantics as epoll_ctl and epoll_wait, with the
+ * thread ID in place of the epoll descriptor. The events are always edge
+ * triggered.
+ */
+
+#include <maxscale/cdefs.h>
+#include <sys/epoll.h>
+
+MXS_BEGIN_DECLS
+
+/**
+ * @brief Create the io_uring instances of the polling threads
+ *
+ * Checks that the kernel supports the features the backend needs. If it
+ * does not, a warning is logged and the epoll backend should be used.
+ *
+ * @param n_threads Number of polling threads
+ * @return True if the io_uring backend can be used
+ */
+bool poll_uring_init(int n_threads);
+
+/**
+ * @brief Add, modify or remove the descriptor of a polling thread
+ *
+ * @param thread The polling thread
+ * @param op     EPOLL_CTL_ADD, EPOLL_CTL_MOD or EPOLL_CTL_DEL
+ * @param fd     The descriptor
+ * @param ev     The events and data of the descriptor, ignored for EPOLL_CTL_DEL
+ * @return 0 on success, -1 with errno set on error
+ */
+int poll_uring_ctl(int thread, int op, int fd, struct epoll_event *ev);
+
+/**
+ * @brief Wait for the events of a polling thread
+ *
+ * Called only by the polling thread itself.
+ *
+ * @param thread    The polling thread
+ * @param events    Array where the events are stored
+ * @param maxevents Size of @c events
+ * @param timeout   Timeout in milliseconds, 0 to not block and -1 to block until
+ *                  there are events
+ * @return Number of events or -1 with errno set on error
+ */
+int poll_uring_wait(int thread, struct epoll_event *events, int maxevents, int timeout);
+
+/**
+ * @brief Number of io_uring_enter system calls made by all polling threads
+ */
+uint64_t poll_uring_n_syscalls();
+
+MXS_END_DECLS
@@ -0,0 +1,63 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file core/maxscale/qsbr.h - The private interface of the deferred freeing
+ */
+
+#include <maxscale/qsbr.h>
+
+MXS_BEGIN_DECLS
+
+/**
+ * @brief Report a quiescent state of a polling thread
+ *
+ * The thread holds no pointers to the objects given to mxs_qsbr_defer(). The
+ * objects the thread deferred and that no thread can refer to are freed.
+ *
+ * @param thread_id The ID of the calling polling thread
+ */
+void qsbr_quiescent(int thread_id);
+
+/**
+ * @brief Report a quiescent state before a blocking wait for events
+ *
+ * Unlike an offline thread, a thread that waits for events still delays the
+ * freeing of the objects deferred during the wait, as the wait can return
+ * pointers to them. The objects are freed once the thread has handled the
+ * events and called qsbr_quiescent().
+ *
+ * @param thread_id The ID of the calling polling thread
+ */
+void qsbr_blocking(int thread_id);
+
+/**
+ * @brief Mark a polling thread as offline
+ *
+ * An offline thread, for example one that has stopped polling, does not delay
+ * the freeing of the objects. The thread holds no pointers to the objects and
+ * it must not wait for events while it is offline.
+ *
+ * @param thread_id The ID of the calling polling thread
+ */
+void qsbr_offline(int thread_id);
+
+/**
+ * @brief Mark a polling thread as online
+ *
+ * @param thread_id The ID of the calling polling thread
+ */
+void qsbr_online(int thread_id);
+
+MXS_END_DECLS
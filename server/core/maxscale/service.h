@@ -69,6 +69,20 @@ void service_destroy_instances(void);
  */
 int service_launch_all(void);
 
+/**
+ * @brief Call a function for each started listener
+ *
+ * The services and the listener are locked during the call.
+ *
+ * @param func Function called with the listener, the address it was started
+ *             with in the format of dcb_listen() and @c data. Iteration stops
+ *             if it returns false.
+ * @param data User data passed to @c func
+ * @return True if @c func returned true for all listeners
+ */
+bool service_foreach_listener(bool (*func)(SERV_LISTENER *port, const char *bind, void *data),
+                              void *data);
+
 /**
  * Creating and adding new components to services
  */
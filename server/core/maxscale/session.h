@@ -40,6 +40,16 @@ typedef enum
     SESSION_LIST_CONNECTION
 } SESSIONLISTFILTER;
 
+/**
+ * @brief Session system initialization function
+ *
+ * Creates the per-thread free lists of session objects. This must be called
+ * after the configuration has been processed.
+ *
+ * @return True on success, false on memory allocation failure
+ */
+bool session_global_init();
+
 int session_isvalid(MXS_SESSION *);
 int session_reply(void *inst, void *session, GWBUF *data);
 char *session_state(mxs_session_state_t);
@@ -55,17 +65,4 @@ void dprintAllSessions(struct dcb *);
 void dprintSession(struct dcb *, MXS_SESSION *);
 void dListSessions(struct dcb *);
 
-/**
- * @brief Get a session reference
- *
- * This creates an additional reference to a session which allows it to live
- * as long as it is needed.
- *
- * @param session Session reference to get
- * @return Reference to a MXS_SESSION
- *
- * @note The caller must free the session reference by calling session_put_ref
- */
-MXS_SESSION* session_get_ref(MXS_SESSION *sessoin);
-
 MXS_END_DECLS
@@ -0,0 +1,109 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file core/maxscale/trace.h - The private statement tracing interface
+ */
+
+#include <maxscale/trace.h>
+#include <maxscale/dcb.h>
+#include <maxscale/resultset.h>
+#include <maxscale/server.h>
+#include <maxscale/session.h>
+
+MXS_BEGIN_DECLS
+
+/** Number of traced statements that are kept */
+#define MXS_TRACE_RING_SIZE 1024
+
+/** Number of filters of a statement whose timings are recorded */
+#define MXS_TRACE_MAX_FILTERS 8
+
+/**
+ * @brief Start tracing the statements of a session
+ *
+ * Must be called before the filters of the session are set up. The router
+ * at the head and the client at the tail of the chain are wrapped so that
+ * the time the statements reach them is recorded.
+ *
+ * @param session The session
+ *
+ * @return True if the session is traced, false if tracing is disabled or
+ *         memory could not be allocated
+ */
+bool session_trace_start(MXS_SESSION *session);
+
+/**
+ * @brief Wrap the head of the filter chain into a tracing element
+ *
+ * Called after a filter has been added to the head of the chain.
+ *
+ * @param session The session
+ * @param filter  Index of the filter
+ */
+void session_trace_wrap_head(MXS_SESSION *session, int filter);
+
+/**
+ * @brief Wrap the tail of the filter chain into a tracing element
+ *
+ * Called after a filter with an upstream entry point has been added
+ * to the tail of the chain.
+ *
+ * @param session The session
+ * @param filter  Index of the filter
+ */
+void session_trace_wrap_tail(MXS_SESSION *session, int filter);
+
+/**
+ * @brief Stop tracing the statements of a session
+ *
+ * A statement that is being traced is stored into the trace ring.
+ *
+ * @param session The session
+ */
+void session_trace_end(MXS_SESSION *session);
+
+/**
+ * @brief Called when a statement is written to a backend
+ *
+ * Marks the backend write of a traced statement and records the server
+ * it was written to.
+ *
+ * @param buf    The buffer that is written
+ * @param server The server of the backend, can be NULL
+ */
+void session_trace_backend_write(GWBUF *buf, SERVER *server);
+
+/**
+ * @brief Called when data was read from a backend
+ *
+ * @param session The session of the backend
+ */
+void session_trace_backend_read(MXS_SESSION *session);
+
+/**
+ * Return a resultset that has the most recent traced statements in it
+ *
+ * @return A result set
+ */
+RESULTSET *traceGetList();
+
+/**
+ * Print the most recent traced statements to a DCB
+ *
+ * @param dcb The DCB to print to
+ */
+void dprintTraces(DCB *dcb);
+
+MXS_END_DECLS
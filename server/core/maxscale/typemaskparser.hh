@@ -0,0 +1,724 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <maxscale/cppdefs.hh>
+#include <ctype.h>
+#include <strings.h>
+#include <maxscale/modutil.h>
+#include <maxscale/protocol/mysql.h>
+#include <maxscale/query_classifier.h>
+#include "trxboundaryparser.hh"
+
+namespace maxscale
+{
+
+#define TMP_WORD(string_literal) { string_literal, sizeof(string_literal) - 1 }
+
+/**
+ * @class TypeMaskParser
+ *
+ * TypeMaskParser classifies the most common statements by scanning their
+ * tokens, without parsing them. It recognizes plain SELECTs, INSERTs, UPDATEs,
+ * DELETEs and REPLACEs, simple SETs, USE and the transaction boundaries, and
+ * reports the same type mask and operation as the query classifier does.
+ *
+ * Anything that might affect the classification and that cannot be decided
+ * from the tokens alone, e.g. variables, function calls whose side-effects
+ * are not known, sub-selects in writes, SELECT ... INTO, SELECT ... FOR UPDATE,
+ * executable comments and multi-statements, makes the statement ambiguous, in
+ * which case it must be classified by the query classifier.
+ *
+ * Like TrxBoundaryParser, the class is defined in its entirety in the header
+ * to allow for aggressive inlining.
+ */
+class TypeMaskParser
+{
+public:
+    /**
+     * TypeMaskParser is not thread-safe. As a very lightweight class,
+     * the intention is that an instance is created on the stack whenever
+     * a statement needs to be classified.
+     */
+    TypeMaskParser()
+        : m_pSql(NULL)
+        , m_len(0)
+        , m_pI(NULL)
+        , m_pEnd(NULL)
+        , m_pToken(NULL)
+        , m_token_len(0)
+    {
+    }
+
+    /**
+     * Classify a statement.
+     *
+     * @param pSql        SQL statement.
+     * @param len         Length of pSql.
+     * @param pType_mask  On return, the type mask of the statement, if true
+     *                    is returned.
+     * @param pOp         On return, the operation of the statement, if true
+     *                    is returned.
+     *
+     * @return True, if the statement could be classified, false if it must be
+     *         classified by the query classifier.
+     */
+    bool classify(const char* pSql, size_t len, uint32_t* pType_mask, qc_query_op_t* pOp)
+    {
+        m_pSql = pSql;
+        m_len = len;
+        m_pI = m_pSql;
+        m_pEnd = m_pI + m_len;
+
+        return parse(pType_mask, pOp);
+    }
+
+    /**
+     * Classify a statement.
+     *
+     * @param pBuf        A buffer containing a COM_QUERY.
+     * @param pType_mask  On return, the type mask of the statement, if true
+     *                    is returned.
+     * @param pOp         On return, the operation of the statement, if true
+     *                    is returned.
+     *
+     * @return True, if the statement could be classified, false if it must be
+     *         classified by the query classifier.
+     */
+    bool classify(GWBUF* pBuf, uint32_t* pType_mask, qc_query_op_t* pOp)
+    {
+        bool rv = false;
+        const char* pSql;
+        size_t len;
+
+        if (GWBUF_LENGTH(pBuf) > MYSQL_HEADER_LEN &&
+            MYSQL_GET_COMMAND(GWBUF_DATA(pBuf)) == MYSQL_COM_QUERY &&
+            modutil_get_SQL_view(pBuf, &pSql, &len))
+        {
+            rv = classify(pSql, len, pType_mask, pOp);
+        }
+
+        return rv;
+    }
+
+    /**
+     * Classify a statement using its first keyword only. The result is not
+     * exact but it is safe for routing; a statement starting with SELECT,
+     * INSERT, REPLACE, UPDATE or DELETE is reported to be a WRITE, so that it
+     * will be sent to the master. Intended for statements that are too large
+     * to be parsed on a poll thread and that @c classify could not classify.
+     *
+     * @param pBuf        A buffer containing a COM_QUERY.
+     * @param pType_mask  On return, the type mask of the statement, if true
+     *                    is returned.
+     * @param pOp         On return, the operation of the statement, if true
+     *                    is returned.
+     *
+     * @return True, if the statement could be classified, false if it must be
+     *         classified by the query classifier.
+     */
+    bool classify_by_keyword(GWBUF* pBuf, uint32_t* pType_mask, qc_query_op_t* pOp)
+    {
+        bool rv = false;
+        const char* pSql;
+        size_t len;
+
+        if (GWBUF_LENGTH(pBuf) > MYSQL_HEADER_LEN &&
+            MYSQL_GET_COMMAND(GWBUF_DATA(pBuf)) == MYSQL_COM_QUERY &&
+            modutil_get_SQL_view(pBuf, &pSql, &len))
+        {
+            m_pSql = pSql;
+            m_len = len;
+            m_pI = m_pSql;
+            m_pEnd = m_pI + m_len;
+
+            if (next_token() == TK_WORD)
+            {
+                rv = true;
+
+                if (is_word("SELECT"))
+                {
+                    *pOp = QUERY_OP_SELECT;
+                }
+                else if (is_word("INSERT") || is_word("REPLACE"))
+                {
+                    *pOp = QUERY_OP_INSERT;
+                }
+                else if (is_word("UPDATE"))
+                {
+                    *pOp = QUERY_OP_UPDATE;
+                }
+                else if (is_word("DELETE"))
+                {
+                    *pOp = QUERY_OP_DELETE;
+                }
+                else
+                {
+                    rv = false;
+                }
+
+                if (rv)
+                {
+                    *pType_mask = QUERY_TYPE_WRITE;
+                }
+            }
+        }
+
+        return rv;
+    }
+
+private:
+    enum token_t
+    {
+        TK_WORD,        /**< Keyword or identifier */
+        TK_QUOTED_ID,   /**< `identifier` */
+        TK_NUMBER,
+        TK_STRING,
+        TK_USERVAR,     /**< @variable */
+        TK_SYSVAR,      /**< @@variable, @@session.variable, ... */
+        TK_LPAREN,
+        TK_EQ,
+        TK_COMMA,
+        TK_DOT,
+        TK_OTHER,       /**< Operators and other punctuation */
+
+        PARSER_AMBIGUOUS,
+        PARSER_EXHAUSTED,
+    };
+
+    struct word_t
+    {
+        const char* zWord;
+        size_t      len;
+    };
+
+    bool parse(uint32_t* pType_mask, qc_query_op_t* pOp)
+    {
+        bool rv = false;
+
+        if (next_token() == TK_WORD)
+        {
+            if (is_word("SELECT"))
+            {
+                *pType_mask = QUERY_TYPE_READ;
+                *pOp = QUERY_OP_SELECT;
+                rv = parse_select();
+            }
+            else if (is_word("INSERT") || is_word("REPLACE"))
+            {
+                *pType_mask = QUERY_TYPE_WRITE;
+                *pOp = QUERY_OP_INSERT;
+                rv = parse_write();
+            }
+            else if (is_word("UPDATE"))
+            {
+                *pType_mask = QUERY_TYPE_WRITE;
+                *pOp = QUERY_OP_UPDATE;
+                rv = parse_write();
+            }
+            else if (is_word("DELETE"))
+            {
+                *pType_mask = QUERY_TYPE_WRITE;
+                *pOp = QUERY_OP_DELETE;
+                rv = parse_write();
+            }
+            else if (is_word("SET"))
+            {
+                *pOp = QUERY_OP_UNDEFINED;
+                rv = parse_set(pType_mask);
+            }
+            else if (is_word("USE"))
+            {
+                *pType_mask = QUERY_TYPE_SESSION_WRITE;
+                *pOp = QUERY_OP_CHANGE_DB;
+                rv = parse_use();
+            }
+            else if (is_word("BEGIN") || is_word("START") || is_word("COMMIT") || is_word("ROLLBACK"))
+            {
+                // The transaction boundaries are reported by the query classifier
+                // exactly as TrxBoundaryParser reports them.
+                TrxBoundaryParser tbp;
+
+                *pType_mask = tbp.type_mask_of(m_pSql, m_len);
+                *pOp = QUERY_OP_UNDEFINED;
+                rv = *pType_mask != 0;
+            }
+        }
+
+        return rv;
+    }
+
+    bool parse_select()
+    {
+        token_t prev = TK_WORD;
+        token_t prev_prev = TK_WORD;
+        const char* pPrev = m_pToken;
+        size_t prev_len = m_token_len;
+
+        for (;;)
+        {
+            token_t token = next_token();
+
+            switch (token)
+            {
+            case PARSER_EXHAUSTED:
+                return true;
+
+            case PARSER_AMBIGUOUS:
+            case TK_USERVAR:
+            case TK_SYSVAR:
+                return false;
+
+            case TK_WORD:
+                // SELECT ... INTO, SELECT ... FOR UPDATE, SELECT ... LOCK IN SHARE MODE
+                if (is_word("INTO") || is_word("FOR") || is_word("LOCK"))
+                {
+                    return false;
+                }
+                break;
+
+            case TK_LPAREN:
+                if (prev == TK_QUOTED_ID ||
+                    (prev == TK_WORD && (prev_prev == TK_DOT || !is_select_word(pPrev, prev_len))))
+                {
+                    // A stored function or a function that may have side-effects.
+                    return false;
+                }
+                break;
+
+            default:
+                break;
+            }
+
+            prev_prev = prev;
+            prev = token;
+            pPrev = m_pToken;
+            prev_len = m_token_len;
+        }
+    }
+
+    bool parse_write()
+    {
+        for (;;)
+        {
+            token_t token = next_token();
+
+            switch (token)
+            {
+            case PARSER_EXHAUSTED:
+                return true;
+
+            case PARSER_AMBIGUOUS:
+            case TK_USERVAR:
+            case TK_SYSVAR:
+                return false;
+
+            case TK_WORD:
+                // The functions in a write can only add LAST_INSERT_ID() to the
+                // type, but a sub-select changes it.
+                if (is_word("SELECT") || is_word("LAST_INSERT_ID"))
+                {
+                    return false;
+                }
+                break;
+
+            default:
+                break;
+            }
+        }
+    }
+
+    bool parse_set(uint32_t* pType_mask)
+    {
+        uint32_t type_mask = 0;
+        token_t token;
+
+        do
+        {
+            token = next_token();
+
+            if (token == TK_WORD && (is_word("NAMES") || is_word("CHARACTER")))
+            {
+                type_mask |= QUERY_TYPE_GSYSVAR_WRITE;
+
+                // SET NAMES utf8 [COLLATE ...], SET CHARACTER SET utf8
+                while ((token = next_token()) == TK_WORD || token == TK_STRING || token == TK_QUOTED_ID)
+                {
+                    ;
+                }
+
+                continue;
+            }
+
+            bool user_variable = false;
+            bool autocommit = false;
+
+            if (token == TK_WORD && (is_word("GLOBAL") || is_word("SESSION") || is_word("LOCAL")))
+            {
+                token = next_token();
+            }
+
+            if (token == TK_WORD)
+            {
+                if (is_word("TRANSACTION") || is_word("PASSWORD") || is_word("ROLE") ||
+                    is_word("STATEMENT") || is_word("DEFAULT"))
+                {
+                    return false;
+                }
+
+                autocommit = is_word("AUTOCOMMIT");
+            }
+            else if (token == TK_SYSVAR)
+            {
+                // The name is the part after the last dot.
+                const char* pName = m_pToken + m_token_len;
+
+                while (pName > m_pToken && *(pName - 1) != '.' && *(pName - 1) != '@')
+                {
+                    --pName;
+                }
+
+                autocommit = is_word(pName, m_pToken + m_token_len - pName, "AUTOCOMMIT");
+            }
+            else if (token == TK_USERVAR)
+            {
+                user_variable = true;
+            }
+            else
+            {
+                return false;
+            }
+
+            if (next_token() != TK_EQ)
+            {
+                return false;
+            }
+
+            token = next_token();
+
+            if (token != TK_NUMBER && token != TK_STRING && token != TK_WORD)
+            {
+                return false;
+            }
+
+            if (autocommit)
+            {
+                if ((token == TK_NUMBER && is_word("1")) ||
+                    (token == TK_WORD && (is_word("TRUE") || is_word("ON"))))
+                {
+                    type_mask |= (QUERY_TYPE_ENABLE_AUTOCOMMIT | QUERY_TYPE_COMMIT);
+                }
+                else if ((token == TK_NUMBER && is_word("0")) ||
+                         (token == TK_WORD && (is_word("FALSE") || is_word("OFF"))))
+                {
+                    type_mask |= (QUERY_TYPE_DISABLE_AUTOCOMMIT | QUERY_TYPE_BEGIN_TRX);
+                }
+                else
+                {
+                    return false;
+                }
+            }
+
+            type_mask |= user_variable ? QUERY_TYPE_USERVAR_WRITE : QUERY_TYPE_GSYSVAR_WRITE;
+
+            // Anything but a single value, e.g. a function call or an
+            // expression, is left to the query classifier.
+            token = next_token();
+        }
+        while (token == TK_COMMA);
+
+        *pType_mask = type_mask;
+
+        return token == PARSER_EXHAUSTED;
+    }
+
+    bool parse_use()
+    {
+        token_t token = next_token();
+
+        return (token == TK_WORD || token == TK_QUOTED_ID) && next_token() == PARSER_EXHAUSTED;
+    }
+
+    /**
+     * Whether a word may be followed by a parenthesis in a SELECT whose type is
+     * READ, that is, the word is a keyword or one of the builtin functions that
+     * the query classifier knows to be read-only.
+     */
+    static bool is_select_word(const char* pWord, size_t len)
+    {
+        static const word_t words[] =
+        {
+            // Keywords
+            TMP_WORD("ALL"), TMP_WORD("AND"), TMP_WORD("ANY"), TMP_WORD("AS"),
+            TMP_WORD("BETWEEN"), TMP_WORD("BY"), TMP_WORD("CASE"), TMP_WORD("DISTINCT"),
+            TMP_WORD("ELSE"), TMP_WORD("EXISTS"), TMP_WORD("FROM"), TMP_WORD("HAVING"),
+            TMP_WORD("IN"), TMP_WORD("INDEX"), TMP_WORD("IS"), TMP_WORD("JOIN"),
+            TMP_WORD("KEY"), TMP_WORD("LIKE"), TMP_WORD("NOT"), TMP_WORD("ON"),
+            TMP_WORD("OR"), TMP_WORD("SELECT"), TMP_WORD("SOME"), TMP_WORD("THEN"),
+            TMP_WORD("UNION"), TMP_WORD("USING"), TMP_WORD("WHEN"), TMP_WORD("WHERE"),
+            TMP_WORD("XOR"),
+
+            // Read-only functions
+            TMP_WORD("ABS"), TMP_WORD("AVG"), TMP_WORD("CAST"), TMP_WORD("CEIL"),
+            TMP_WORD("CHAR_LENGTH"), TMP_WORD("COALESCE"), TMP_WORD("CONCAT"),
+            TMP_WORD("CONCAT_WS"), TMP_WORD("CONVERT"), TMP_WORD("COUNT"),
+            TMP_WORD("CURDATE"), TMP_WORD("DATE"), TMP_WORD("DATE_FORMAT"),
+            TMP_WORD("FLOOR"), TMP_WORD("FROM_UNIXTIME"), TMP_WORD("GREATEST"),
+            TMP_WORD("GROUP_CONCAT"), TMP_WORD("IF"), TMP_WORD("IFNULL"), TMP_WORD("LEAST"),
+            TMP_WORD("LENGTH"), TMP_WORD("LOWER"), TMP_WORD("MAX"), TMP_WORD("MD5"),
+            TMP_WORD("MIN"), TMP_WORD("NOW"), TMP_WORD("NULLIF"), TMP_WORD("REPLACE"),
+            TMP_WORD("ROUND"), TMP_WORD("SUBSTRING"), TMP_WORD("SUM"), TMP_WORD("TRIM"),
+            TMP_WORD("UNIX_TIMESTAMP"), TMP_WORD("UPPER"),
+        };
+
+        for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++)
+        {
+            if (words[i].len == len && strncasecmp(words[i].zWord, pWord, len) == 0)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    static bool is_word(const char* pToken, size_t len, const char* zWord)
+    {
+        return strlen(zWord) == len && strncasecmp(pToken, zWord, len) == 0;
+    }
+
+    bool is_word(const char* zWord) const
+    {
+        return is_word(m_pToken, m_token_len, zWord);
+    }
+
+    static bool is_word_char(char c)
+    {
+        return isalnum(c) || c == '_' || c == '$' || (c & 0x80);
+    }
+
+    /** Skip whitespace and comments, false if an executable comment is found */
+    bool bypass_whitespace()
+    {
+        while (m_pI < m_pEnd)
+        {
+            char c = *m_pI;
+
+            if (isspace(c))
+            {
+                ++m_pI;
+            }
+            else if (c == '#' ||
+                     (c == '-' && m_pI + 1 < m_pEnd && *(m_pI + 1) == '-' &&
+                      (m_pI + 2 == m_pEnd || isspace(*(m_pI + 2)))))
+            {
+                while (m_pI < m_pEnd && *m_pI != '\n')
+                {
+                    ++m_pI;
+                }
+            }
+            else if (c == '/' && m_pI + 1 < m_pEnd && *(m_pI + 1) == '*')
+            {
+                if (m_pI + 2 < m_pEnd && (*(m_pI + 2) == '!' || *(m_pI + 2) == 'M'))
+                {
+                    // Executable comment, or one that would look like a
+                    // MariaDB executable comment.
+                    return false;
+                }
+
+                m_pI += 2;
+
+                while (m_pI + 1 < m_pEnd && !(*m_pI == '*' && *(m_pI + 1) == '/'))
+                {
+                    ++m_pI;
+                }
+
+                if (m_pI + 1 >= m_pEnd)
+                {
+                    return false;
+                }
+
+                m_pI += 2;
+            }
+            else
+            {
+                break;
+            }
+        }
+
+        return true;
+    }
+
+    /** Skip a quoted string or identifier, false if it is not terminated */
+    bool bypass_quoted(char quote)
+    {
+        ++m_pI;
+
+        while (m_pI < m_pEnd)
+        {
+            char c = *m_pI++;
+
+            if (c == '\\' && quote != '`')
+            {
+                ++m_pI;
+            }
+            else if (c == quote)
+            {
+                if (m_pI < m_pEnd && *m_pI == quote)
+                {
+                    ++m_pI;
+                }
+                else
+                {
+                    return true;
+                }
+            }
+        }
+
+        return false;
+    }
+
+    void bypass_word()
+    {
+        while (m_pI < m_pEnd && is_word_char(*m_pI))
+        {
+            ++m_pI;
+        }
+    }
+
+    token_t next_token()
+    {
+        if (!bypass_whitespace())
+        {
+            return PARSER_AMBIGUOUS;
+        }
+
+        m_pToken = m_pI;
+        m_token_len = 0;
+
+        if (m_pI == m_pEnd)
+        {
+            return PARSER_EXHAUSTED;
+        }
+
+        token_t token = TK_OTHER;
+        char c = *m_pI;
+
+        switch (c)
+        {
+        case ';':
+            ++m_pI;
+
+            // Only a trailing semicolon is accepted.
+            if (!bypass_whitespace() || m_pI != m_pEnd)
+            {
+                return PARSER_AMBIGUOUS;
+            }
+
+            return PARSER_EXHAUSTED;
+
+        case '\'':
+        case '"':
+            token = bypass_quoted(c) ? TK_STRING : PARSER_AMBIGUOUS;
+            break;
+
+        case '`':
+            token = bypass_quoted(c) ? TK_QUOTED_ID : PARSER_AMBIGUOUS;
+            break;
+
+        case '@':
+            ++m_pI;
+
+            if (m_pI < m_pEnd && *m_pI == '@')
+            {
+                ++m_pI;
+
+                while (m_pI < m_pEnd && (is_word_char(*m_pI) || *m_pI == '.'))
+                {
+                    ++m_pI;
+                }
+
+                token = TK_SYSVAR;
+            }
+            else if (m_pI < m_pEnd && is_word_char(*m_pI))
+            {
+                bypass_word();
+                token = TK_USERVAR;
+            }
+            else
+            {
+                // A quoted user variable name
+                token = PARSER_AMBIGUOUS;
+            }
+            break;
+
+        case '(':
+            ++m_pI;
+            token = TK_LPAREN;
+            break;
+
+        case '=':
+            ++m_pI;
+            token = TK_EQ;
+            break;
+
+        case ',':
+            ++m_pI;
+            token = TK_COMMA;
+            break;
+
+        case '.':
+            ++m_pI;
+            token = TK_DOT;
+            break;
+
+        default:
+            if (isdigit(c))
+            {
+                while (m_pI < m_pEnd && (is_word_char(*m_pI) || *m_pI == '.'))
+                {
+                    ++m_pI;
+                }
+
+                token = TK_NUMBER;
+            }
+            else if (is_word_char(c))
+            {
+                bypass_word();
+                token = TK_WORD;
+            }
+            else
+            {
+                ++m_pI;
+            }
+        }
+
+        m_token_len = m_pI - m_pToken;
+
+        return token;
+    }
+
+private:
+    TypeMaskParser(const TypeMaskParser&);
+    TypeMaskParser& operator = (const TypeMaskParser&);
+
+private:
+    const char* m_pSql;
+    size_t      m_len;
+    const char* m_pI;
+    const char* m_pEnd;
+    const char* m_pToken;
+    size_t      m_token_len;
+};
+
+}
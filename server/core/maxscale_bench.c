@@ -0,0 +1,1287 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file maxscale_bench.c - A MySQL protocol load generator
+ *
+ * The connections are driven with the non-blocking API of the MariaDB
+ * Connector-C by a number of threads, each of which handles its share of
+ * the connections with an epoll instance of its own.
+ *
+ * With a request rate, the requests are scheduled at fixed intervals and the
+ * latency of a request is measured from the time it was scheduled, not from
+ * the time it was sent. A request that has to wait for a free connection
+ * because the server cannot keep up is thus charged for the time it waited,
+ * which avoids the coordinated omission of load generators that only send
+ * the next request once the previous one has completed. The time from
+ * sending a request to receiving the whole response is reported separately
+ * as the service time.
+ *
+ * @verbatim
+ * usage: maxscale_bench [options]
+ * @endverbatim
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <mysql.h>
+#include <maxscale/histogram.h>
+#include <maxscale/utils.h>
+
+/** Number of events handled by one epoll_wait call */
+#define BENCH_MAX_EVENTS 256
+
+/** Longest time the threads sleep when they have nothing to do, in milliseconds */
+#define BENCH_MAX_SLEEP 100
+
+/** How long the requests that are still running at the end are waited for, in microseconds */
+#define BENCH_GRACE_TIME 5000000
+
+/** Rows inserted with one statement when the table is created */
+#define BENCH_INSERT_BATCH 1000
+
+/** Maximum length of a generated statement */
+#define BENCH_SQL_LEN 256
+
+/** The percentiles in the summary */
+static const double bench_percentiles[] = {50, 90, 99, 99.9, 99.99, 100};
+
+typedef enum
+{
+    BENCH_POINT,    /**< Primary key lookups */
+    BENCH_PREPARED, /**< Primary key lookups with a prepared statement */
+    BENCH_TRX,      /**< Transactions with a select and an update */
+    BENCH_LARGE,    /**< Large result sets */
+    BENCH_CONNECT,  /**< Connecting and disconnecting */
+    BENCH_QUERY     /**< A query given on the command line */
+} BENCH_WORKLOAD;
+
+static const struct
+{
+    const char     *name;
+    BENCH_WORKLOAD workload;
+} bench_workloads[] =
+{
+    {"point", BENCH_POINT},
+    {"prepared", BENCH_PREPARED},
+    {"trx", BENCH_TRX},
+    {"large", BENCH_LARGE},
+    {"connect", BENCH_CONNECT},
+    {"query", BENCH_QUERY},
+    {NULL}
+};
+
+typedef enum
+{
+    STATE_IDLE,       /**< Waiting for a request */
+    STATE_CONNECTING, /**< Connecting to the server */
+    STATE_PREPARE,    /**< Preparing the statement of the prepared workload */
+    STATE_QUERY,      /**< Sending a statement and reading the response header */
+    STATE_FETCH,      /**< Reading the rows of a result set */
+    STATE_EXECUTE,    /**< Executing the prepared statement */
+    STATE_STMT_FETCH, /**< Reading the rows of the prepared statement */
+    STATE_CLOSING,    /**< Closing the connection */
+    STATE_DEAD        /**< The connection could not be opened */
+} BENCH_STATE;
+
+struct bench_thread;
+
+typedef struct bench_conn
+{
+    struct bench_thread *thread;
+    MYSQL               *mysql;
+    MYSQL_RES           *res;
+    MYSQL_STMT          *stmt;
+    MYSQL_BIND          param;     /**< The parameter of the prepared statement */
+    long long           id;        /**< The value bound to the parameter */
+    BENCH_STATE         state;
+    bool                failed;    /**< The current operation failed */
+    bool                active;    /**< A request is being executed */
+    int                 fd;        /**< The socket registered to epoll or -1 */
+    int                 step;      /**< The statement of the request being executed */
+    uint64_t            intended;  /**< When the request was scheduled */
+    uint64_t            sent;      /**< When the request was sent */
+    char                sql[BENCH_SQL_LEN];
+    struct bench_conn   *next;     /**< The next idle connection */
+} BENCH_CONN;
+
+typedef struct bench_thread
+{
+    pthread_t  tid;
+    int        epfd;
+    BENCH_CONN *conns;
+    int        n_conns;
+    int        n_active;  /**< Number of requests being executed */
+    BENCH_CONN *idle;     /**< Connections that are waiting for a request */
+    double     interval;  /**< Time between requests or 0 for a closed loop */
+    double     next_due;  /**< When the next request is due */
+    unsigned   seed;
+    uint64_t   requests;  /**< Completed requests, read by the main thread */
+    uint64_t   errors;    /**< Failed requests, read by the main thread */
+    uint64_t   backlog;   /**< Requests that were scheduled but never sent */
+    HISTOGRAM  latency;
+    HISTOGRAM  service;
+} BENCH_THREAD;
+
+static struct
+{
+    const char     *host;
+    unsigned int   port;
+    const char     *socket;
+    const char     *user;
+    const char     *password;
+    const char     *database;
+    const char     *table;
+    const char     *query;
+    BENCH_WORKLOAD workload;
+    int            connections;
+    int            threads;
+    double         rate;
+    int            duration;
+    int            warmup;
+    int            interval;
+    long           rows;
+    long           large_rows;
+    bool           histogram;
+} bench_opts =
+{
+    .host = "127.0.0.1",
+    .port = 4006,
+    .user = "maxuser",
+    .password = "maxpwd",
+    .database = "test",
+    .table = "maxscale_bench",
+    .workload = BENCH_POINT,
+    .connections = 16,
+    .threads = 4,
+    .duration = 10,
+    .rows = 100000,
+    .large_rows = 10000
+};
+
+static bool bench_stop = false;         /**< Stop sending new requests */
+static uint64_t bench_start = 0;        /**< When the requests are started */
+static uint64_t bench_record_from = 0;  /**< When the warmup ends */
+static uint64_t bench_end = 0;          /**< When the last request is scheduled */
+static bool bench_error_reported = false;
+
+static void bench_interrupt(int sig)
+{
+    __atomic_store_n(&bench_stop, true, __ATOMIC_RELAXED);
+}
+
+/**
+ * Report the first error, the rest are only counted
+ */
+static void bench_report_error(BENCH_CONN *conn)
+{
+    if (!__atomic_exchange_n(&bench_error_reported, true, __ATOMIC_RELAXED))
+    {
+        const char *msg = conn->stmt && conn->state != STATE_QUERY && conn->state != STATE_FETCH ?
+                          mysql_stmt_error(conn->stmt) : mysql_error(conn->mysql);
+        fprintf(stderr, "Error: %s\n", msg);
+    }
+}
+
+static int bench_statements()
+{
+    switch (bench_opts.workload)
+    {
+    case BENCH_TRX:
+        return 4;
+
+    case BENCH_PREPARED:
+    case BENCH_CONNECT:
+        return 0;
+
+    default:
+        return 1;
+    }
+}
+
+/**
+ * Generate a statement of the workload
+ *
+ * @param conn The connection
+ * @param step Index of the statement in the request
+ */
+static void bench_make_sql(BENCH_CONN *conn, int step)
+{
+    long id = 1 + rand_r(&conn->thread->seed) % bench_opts.rows;
+
+    switch (bench_opts.workload)
+    {
+    case BENCH_POINT:
+        snprintf(conn->sql, sizeof(conn->sql), "SELECT c FROM %s WHERE id = %ld", bench_opts.table, id);
+        break;
+
+    case BENCH_LARGE:
+        snprintf(conn->sql, sizeof(conn->sql), "SELECT id, k, c, pad FROM %s LIMIT %ld",
+                 bench_opts.table, bench_opts.large_rows);
+        break;
+
+    case BENCH_TRX:
+        {
+            static const char *trx[] = {"BEGIN", "SELECT c FROM %s WHERE id = %ld",
+                                        "UPDATE %s SET k = k + 1 WHERE id = %ld", "COMMIT"
+                                       };
+            snprintf(conn->sql, sizeof(conn->sql), trx[step], bench_opts.table, id);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+static const char* bench_sql(BENCH_CONN *conn)
+{
+    return bench_opts.workload == BENCH_QUERY ? bench_opts.query : conn->sql;
+}
+
+/**
+ * Wait for the socket of a connection to become ready
+ *
+ * @param conn   The connection
+ * @param status The status returned by the connector
+ */
+static void bench_wait(BENCH_CONN *conn, int status)
+{
+    struct epoll_event ev;
+    int fd = mysql_get_socket(conn->mysql);
+
+    ev.events = EPOLLONESHOT;
+    ev.data.ptr = conn;
+
+    if (status & MYSQL_WAIT_READ)
+    {
+        ev.events |= EPOLLIN;
+    }
+    if (status & MYSQL_WAIT_WRITE)
+    {
+        ev.events |= EPOLLOUT;
+    }
+    if (status & MYSQL_WAIT_EXCEPT)
+    {
+        ev.events |= EPOLLPRI;
+    }
+
+    /** A closed socket is removed from epoll and its number may be reused */
+    if (fd != conn->fd || epoll_ctl(conn->thread->epfd, EPOLL_CTL_MOD, fd, &ev) == -1)
+    {
+        if (epoll_ctl(conn->thread->epfd, EPOLL_CTL_ADD, fd, &ev) == -1 &&
+            (errno != EEXIST || epoll_ctl(conn->thread->epfd, EPOLL_CTL_MOD, fd, &ev) == -1))
+        {
+            fprintf(stderr, "Failed to add socket to epoll: %d, %s\n", errno, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        conn->fd = fd;
+    }
+}
+
+/**
+ * Convert epoll events to the events of the connector
+ */
+static int bench_ready(uint32_t events)
+{
+    int ready = 0;
+
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+    {
+        ready |= MYSQL_WAIT_READ;
+    }
+    if (events & EPOLLOUT)
+    {
+        ready |= MYSQL_WAIT_WRITE;
+    }
+    if (events & EPOLLPRI)
+    {
+        ready |= MYSQL_WAIT_EXCEPT;
+    }
+
+    return ready;
+}
+
+/**
+ * Start or continue the operation of the current state
+ *
+ * @param conn  The connection
+ * @param ready The events of the socket or 0 to start the operation
+ * @return The events to wait for or 0 if the operation is complete
+ */
+static int bench_op(BENCH_CONN *conn, int ready)
+{
+    int status = 0;
+    int ret = 0;
+
+    switch (conn->state)
+    {
+    case STATE_CONNECTING:
+        {
+            MYSQL *mysql;
+            status = ready ? mysql_real_connect_cont(&mysql, conn->mysql, ready) :
+                     mysql_real_connect_start(&mysql, conn->mysql, bench_opts.host, bench_opts.user,
+                                              bench_opts.password, bench_opts.database,
+                                              bench_opts.port, bench_opts.socket, 0);
+            ret = status == 0 && mysql == NULL;
+        }
+        break;
+
+    case STATE_PREPARE:
+        {
+            char sql[BENCH_SQL_LEN];
+            snprintf(sql, sizeof(sql), "SELECT c FROM %s WHERE id = ?", bench_opts.table);
+            status = ready ? mysql_stmt_prepare_cont(&ret, conn->stmt, ready) :
+                     mysql_stmt_prepare_start(&ret, conn->stmt, sql, strlen(sql));
+        }
+        break;
+
+    case STATE_QUERY:
+        status = ready ? mysql_real_query_cont(&ret, conn->mysql, ready) :
+                 mysql_real_query_start(&ret, conn->mysql, bench_sql(conn), strlen(bench_sql(conn)));
+        break;
+
+    case STATE_FETCH:
+        {
+            MYSQL_ROW row;
+
+            do
+            {
+                status = ready ? mysql_fetch_row_cont(&row, conn->res, ready) :
+                         mysql_fetch_row_start(&row, conn->res);
+                ready = 0;
+            }
+            while (status == 0 && row);
+
+            ret = status == 0 && mysql_errno(conn->mysql);
+        }
+        break;
+
+    case STATE_EXECUTE:
+        status = ready ? mysql_stmt_execute_cont(&ret, conn->stmt, ready) :
+                 mysql_stmt_execute_start(&ret, conn->stmt);
+        break;
+
+    case STATE_STMT_FETCH:
+        do
+        {
+            status = ready ? mysql_stmt_fetch_cont(&ret, conn->stmt, ready) :
+                     mysql_stmt_fetch_start(&ret, conn->stmt);
+            ready = 0;
+        }
+        while (status == 0 && (ret == 0 || ret == MYSQL_DATA_TRUNCATED));
+
+        ret = ret == 1;
+        break;
+
+    case STATE_CLOSING:
+        status = ready ? mysql_close_cont(conn->mysql, ready) : mysql_close_start(conn->mysql);
+        break;
+
+    default:
+        break;
+    }
+
+    conn->failed = ret != 0;
+    return status;
+}
+
+static void bench_idle(BENCH_CONN *conn)
+{
+    conn->state = STATE_IDLE;
+    conn->next = conn->thread->idle;
+    conn->thread->idle = conn;
+}
+
+/**
+ * Open a new connection to the server
+ */
+static void bench_connect(BENCH_CONN *conn)
+{
+    if ((conn->mysql = mysql_init(NULL)) == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    mysql_options(conn->mysql, MYSQL_OPT_NONBLOCK, 0);
+    conn->state = STATE_CONNECTING;
+}
+
+/**
+ * Record a completed request
+ *
+ * @param conn The connection
+ * @param ok   Whether the request succeeded
+ */
+static void bench_done(BENCH_CONN *conn, bool ok)
+{
+    BENCH_THREAD *thread = conn->thread;
+    uint64_t now = mxs_clock_us();
+
+    if (conn->intended >= bench_record_from)
+    {
+        if (ok)
+        {
+            histogram_add(&thread->latency, now - conn->intended);
+            histogram_add(&thread->service, now - conn->sent);
+            __atomic_store_n(&thread->requests, thread->requests + 1, __ATOMIC_RELAXED);
+        }
+        else
+        {
+            __atomic_store_n(&thread->errors, thread->errors + 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    conn->active = false;
+    thread->n_active--;
+}
+
+/**
+ * Handle a failed operation. The connection is closed and opened again.
+ */
+static void bench_fail(BENCH_CONN *conn)
+{
+    bench_report_error(conn);
+
+    if (conn->res)
+    {
+        mysql_free_result(conn->res);
+        conn->res = NULL;
+    }
+
+    if (conn->active)
+    {
+        bench_done(conn, false);
+    }
+
+    if (conn->stmt)
+    {
+        mysql_stmt_close(conn->stmt);
+        conn->stmt = NULL;
+    }
+
+    mysql_close(conn->mysql);
+    conn->mysql = NULL;
+    conn->fd = -1;
+
+    if (bench_opts.workload == BENCH_CONNECT)
+    {
+        bench_idle(conn);
+    }
+    else if (conn->state == STATE_CONNECTING || conn->state == STATE_PREPARE ||
+             __atomic_load_n(&bench_stop, __ATOMIC_RELAXED))
+    {
+        /** Only broken connections are opened again */
+        conn->state = STATE_DEAD;
+    }
+    else
+    {
+        bench_connect(conn);
+    }
+}
+
+/**
+ * Move to the next state after an operation has completed
+ *
+ * @param conn The connection
+ * @return True if there is a new operation to start
+ */
+static bool bench_next(BENCH_CONN *conn)
+{
+    if (conn->failed)
+    {
+        bench_fail(conn);
+        return conn->state == STATE_CONNECTING;
+    }
+
+    switch (conn->state)
+    {
+    case STATE_CONNECTING:
+        if (bench_opts.workload == BENCH_CONNECT)
+        {
+            conn->state = STATE_CLOSING;
+            return true;
+        }
+        else if (bench_opts.workload == BENCH_PREPARED)
+        {
+            if ((conn->stmt = mysql_stmt_init(conn->mysql)) == NULL)
+            {
+                fprintf(stderr, "Out of memory\n");
+                exit(EXIT_FAILURE);
+            }
+            conn->state = STATE_PREPARE;
+            return true;
+        }
+        bench_idle(conn);
+        return false;
+
+    case STATE_PREPARE:
+        memset(&conn->param, 0, sizeof(conn->param));
+        conn->param.buffer_type = MYSQL_TYPE_LONGLONG;
+        conn->param.buffer = &conn->id;
+        mysql_stmt_bind_param(conn->stmt, &conn->param);
+        bench_idle(conn);
+        return false;
+
+    case STATE_QUERY:
+        if ((conn->res = mysql_use_result(conn->mysql)))
+        {
+            conn->state = STATE_FETCH;
+            return true;
+        }
+        else if (mysql_field_count(conn->mysql))
+        {
+            conn->failed = true;
+            return bench_next(conn);
+        }
+        break;
+
+    case STATE_FETCH:
+        mysql_free_result(conn->res);
+        conn->res = NULL;
+        break;
+
+    case STATE_EXECUTE:
+        conn->state = STATE_STMT_FETCH;
+        return true;
+
+    case STATE_STMT_FETCH:
+        mysql_stmt_free_result(conn->stmt);
+        bench_done(conn, true);
+        bench_idle(conn);
+        return false;
+
+    case STATE_CLOSING:
+        conn->mysql = NULL;
+        conn->fd = -1;
+        bench_done(conn, true);
+        bench_idle(conn);
+        return false;
+
+    default:
+        return false;
+    }
+
+    /** A statement of a text protocol request has completed */
+    if (++conn->step < bench_statements())
+    {
+        bench_make_sql(conn, conn->step);
+        conn->state = STATE_QUERY;
+        return true;
+    }
+
+    bench_done(conn, true);
+    bench_idle(conn);
+    return false;
+}
+
+/**
+ * Drive a connection until it has to wait for its socket or a new request
+ *
+ * @param conn  The connection
+ * @param ready The events of the socket or 0 to start a new operation
+ */
+static void bench_run(BENCH_CONN *conn, int ready)
+{
+    do
+    {
+        int status = bench_op(conn, ready);
+        ready = 0;
+
+        if (status)
+        {
+            bench_wait(conn, status);
+            return;
+        }
+    }
+    while (bench_next(conn));
+}
+
+/**
+ * Start a request on an idle connection
+ *
+ * @param conn     The connection
+ * @param intended When the request was scheduled
+ */
+static void bench_request(BENCH_CONN *conn, uint64_t intended)
+{
+    conn->thread->idle = conn->next;
+    conn->thread->n_active++;
+    conn->active = true;
+    conn->intended = intended;
+    conn->sent = mxs_clock_us();
+    conn->step = 0;
+
+    switch (bench_opts.workload)
+    {
+    case BENCH_CONNECT:
+        bench_connect(conn);
+        break;
+
+    case BENCH_PREPARED:
+        conn->id = 1 + rand_r(&conn->thread->seed) % bench_opts.rows;
+        conn->state = STATE_EXECUTE;
+        break;
+
+    default:
+        bench_make_sql(conn, 0);
+        conn->state = STATE_QUERY;
+        break;
+    }
+
+    bench_run(conn, 0);
+}
+
+/**
+ * Start the requests that are due
+ *
+ * @param thread The thread
+ * @param now    The current time
+ * @return Time until the next request is due in milliseconds
+ */
+static int bench_schedule(BENCH_THREAD *thread, uint64_t now)
+{
+    if (thread->interval == 0)
+    {
+        /** A request that fails at once makes its connection idle again */
+        for (int i = 0; i < thread->n_conns && thread->idle; i++)
+        {
+            bench_request(thread->idle, now);
+        }
+        return thread->idle ? 0 : BENCH_MAX_SLEEP;
+    }
+
+    while (thread->idle && thread->next_due <= now)
+    {
+        bench_request(thread->idle, thread->next_due);
+        thread->next_due += thread->interval;
+    }
+
+    if (thread->idle == NULL)
+    {
+        /** The requests that are due wait for a connection to become idle */
+        return BENCH_MAX_SLEEP;
+    }
+
+    uint64_t wait = (uint64_t)(thread->next_due - now + 999) / 1000;
+    return wait < BENCH_MAX_SLEEP ? wait : BENCH_MAX_SLEEP;
+}
+
+static void* bench_thread_main(void *data)
+{
+    BENCH_THREAD *thread = (BENCH_THREAD *)data;
+    struct epoll_event events[BENCH_MAX_EVENTS];
+    bool stopping = false;
+    uint64_t deadline = 0;
+
+    thread->next_due = bench_start;
+
+    while (!stopping || (thread->n_active > 0 && mxs_clock_us() < deadline))
+    {
+        uint64_t now = mxs_clock_us();
+        int timeout = BENCH_MAX_SLEEP;
+
+        if (!stopping && (now >= bench_end || __atomic_load_n(&bench_stop, __ATOMIC_RELAXED)))
+        {
+            stopping = true;
+            deadline = now + BENCH_GRACE_TIME;
+
+            if (thread->interval && thread->next_due < now)
+            {
+                thread->backlog = (now - thread->next_due) / thread->interval;
+            }
+        }
+
+        if (!stopping && now >= bench_start)
+        {
+            timeout = bench_schedule(thread, now);
+        }
+
+        int n = epoll_wait(thread->epfd, events, BENCH_MAX_EVENTS, timeout);
+
+        for (int i = 0; i < n; i++)
+        {
+            bench_run((BENCH_CONN *)events[i].data.ptr, bench_ready(events[i].events));
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Open the connections of a thread
+ *
+ * @param thread The thread
+ * @return Number of connections that were opened
+ */
+static int bench_open(BENCH_THREAD *thread)
+{
+    struct epoll_event events[BENCH_MAX_EVENTS];
+
+    for (int i = 0; i < thread->n_conns; i++)
+    {
+        BENCH_CONN *conn = &thread->conns[i];
+        conn->thread = thread;
+        conn->fd = -1;
+
+        if (bench_opts.workload == BENCH_CONNECT)
+        {
+            bench_idle(conn);
+        }
+        else
+        {
+            bench_connect(conn);
+            bench_run(conn, 0);
+        }
+    }
+
+    while (true)
+    {
+        int n_pending = 0;
+        int n_open = 0;
+
+        for (int i = 0; i < thread->n_conns; i++)
+        {
+            BENCH_STATE state = thread->conns[i].state;
+
+            if (state == STATE_IDLE)
+            {
+                n_open++;
+            }
+            else if (state != STATE_DEAD)
+            {
+                n_pending++;
+            }
+        }
+
+        if (n_pending == 0)
+        {
+            return n_open;
+        }
+
+        int n = epoll_wait(thread->epfd, events, BENCH_MAX_EVENTS, -1);
+
+        for (int i = 0; i < n; i++)
+        {
+            bench_run((BENCH_CONN *)events[i].data.ptr, bench_ready(events[i].events));
+        }
+    }
+}
+
+/**
+ * Connect to the server with the blocking API
+ */
+static MYSQL* bench_connect_blocking()
+{
+    MYSQL *mysql = mysql_init(NULL);
+
+    if (mysql == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+    }
+    else if (mysql_real_connect(mysql, bench_opts.host, bench_opts.user, bench_opts.password,
+                                bench_opts.database, bench_opts.port, bench_opts.socket, 0) == NULL)
+    {
+        fprintf(stderr, "Failed to connect: %s\n", mysql_error(mysql));
+        mysql_close(mysql);
+        mysql = NULL;
+    }
+
+    return mysql;
+}
+
+static bool bench_query(MYSQL *mysql, const char *sql)
+{
+    if (mysql_query(mysql, sql))
+    {
+        fprintf(stderr, "Query failed: %s\n", mysql_error(mysql));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Create and fill the table that the workloads use
+ *
+ * @return True on success
+ */
+static bool bench_prepare()
+{
+    MYSQL *mysql = bench_connect_blocking();
+
+    if (mysql == NULL)
+    {
+        return false;
+    }
+
+    char *sql = malloc(BENCH_INSERT_BATCH * BENCH_SQL_LEN);
+    bool rval = sql != NULL;
+
+    if (rval)
+    {
+        snprintf(sql, BENCH_SQL_LEN, "CREATE TABLE %s (id INT PRIMARY KEY, k INT NOT NULL, "
+                 "c CHAR(120) NOT NULL, pad CHAR(60) NOT NULL)", bench_opts.table);
+        rval = bench_query(mysql, sql);
+    }
+
+    for (long id = 1; rval && id <= bench_opts.rows; id += BENCH_INSERT_BATCH)
+    {
+        int len = sprintf(sql, "INSERT INTO %s VALUES ", bench_opts.table);
+
+        for (long i = id; i < id + BENCH_INSERT_BATCH && i <= bench_opts.rows; i++)
+        {
+            len += sprintf(sql + len, "%s(%ld, %ld, '%0120ld', '%060ld')", i == id ? "" : ", ",
+                           i, i % 1000, i * 7919, i * 104729);
+        }
+
+        rval = bench_query(mysql, sql);
+    }
+
+    if (rval)
+    {
+        printf("Created table %s with %ld rows\n", bench_opts.table, bench_opts.rows);
+    }
+
+    free(sql);
+    mysql_close(mysql);
+    return rval;
+}
+
+static bool bench_cleanup()
+{
+    MYSQL *mysql = bench_connect_blocking();
+    bool rval = false;
+
+    if (mysql)
+    {
+        char sql[BENCH_SQL_LEN];
+        snprintf(sql, sizeof(sql), "DROP TABLE %s", bench_opts.table);
+        rval = bench_query(mysql, sql);
+        mysql_close(mysql);
+    }
+
+    return rval;
+}
+
+static void bench_print_histogram(const char *name, const HISTOGRAM *hist)
+{
+    uint64_t total = 0;
+
+    printf("\n%s distribution\n%12s %12s %12s\n", name, "Value(us)", "Percentile", "Count");
+
+    for (int i = 0; i < HISTOGRAM_N_BUCKETS; i++)
+    {
+        if (hist->buckets[i])
+        {
+            uint64_t value = histogram_bucket_max(i);
+            total += hist->buckets[i];
+            printf("%12" PRIu64 " %12.6f %12" PRIu32 "\n", value < hist->max ? value : hist->max,
+                   100.0 * total / hist->count, hist->buckets[i]);
+        }
+    }
+}
+
+static void bench_report(BENCH_THREAD *threads, uint64_t elapsed)
+{
+    HISTOGRAM latency = {0};
+    HISTOGRAM service = {0};
+    uint64_t errors = 0;
+    uint64_t backlog = 0;
+
+    for (int i = 0; i < bench_opts.threads; i++)
+    {
+        histogram_merge(&latency, &threads[i].latency);
+        histogram_merge(&service, &threads[i].service);
+        errors += threads[i].errors;
+        backlog += threads[i].backlog;
+    }
+
+    printf("\nWorkload:     %s\n", bench_workloads[bench_opts.workload].name);
+    printf("Connections:  %d in %d threads\n", bench_opts.connections, bench_opts.threads);
+
+    if (bench_opts.rate)
+    {
+        printf("Rate:         %.0f requests per second\n", bench_opts.rate);
+    }
+    else
+    {
+        printf("Rate:         unlimited\n");
+    }
+
+    printf("Duration:     %.1f seconds\n", elapsed / 1000000.0);
+    printf("Requests:     %" PRIu64 "\n", latency.count);
+    printf("Errors:       %" PRIu64 "\n", errors);
+    printf("Not sent:     %" PRIu64 "\n", backlog);
+    printf("Throughput:   %.1f requests per second\n",
+           elapsed ? latency.count * 1000000.0 / elapsed : 0.0);
+
+    printf("\n%12s %15s %15s\n", "Percentile", "Latency(us)", "Service(us)");
+
+    for (size_t i = 0; i < sizeof(bench_percentiles) / sizeof(bench_percentiles[0]); i++)
+    {
+        printf("%12g %15" PRIu64 " %15" PRIu64 "\n", bench_percentiles[i],
+               histogram_percentile(&latency, bench_percentiles[i]),
+               histogram_percentile(&service, bench_percentiles[i]));
+    }
+
+    if (bench_opts.histogram)
+    {
+        bench_print_histogram("Latency", &latency);
+        bench_print_histogram("Service time", &service);
+    }
+}
+
+static bool bench_run_load()
+{
+    BENCH_THREAD *threads = calloc(bench_opts.threads, sizeof(BENCH_THREAD));
+    BENCH_CONN *conns = calloc(bench_opts.connections, sizeof(BENCH_CONN));
+    int n_open = 0;
+
+    if (threads == NULL || conns == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return false;
+    }
+
+    for (int i = 0, offset = 0; i < bench_opts.threads; i++)
+    {
+        BENCH_THREAD *thread = &threads[i];
+        thread->conns = conns + offset;
+        thread->n_conns = bench_opts.connections / bench_opts.threads +
+                          (i < bench_opts.connections % bench_opts.threads);
+        thread->interval = bench_opts.rate ? 1000000.0 * bench_opts.threads / bench_opts.rate : 0;
+        thread->seed = time(NULL) + i;
+        offset += thread->n_conns;
+
+        if ((thread->epfd = epoll_create(thread->n_conns + 1)) == -1)
+        {
+            fprintf(stderr, "Failed to create epoll instance: %d, %s\n", errno, strerror(errno));
+            return false;
+        }
+
+        n_open += bench_open(thread);
+    }
+
+    if (n_open == 0)
+    {
+        fprintf(stderr, "None of the %d connections could be opened\n", bench_opts.connections);
+        return false;
+    }
+    else if (n_open < bench_opts.connections)
+    {
+        fprintf(stderr, "Only %d of the %d connections could be opened\n", n_open, bench_opts.connections);
+    }
+
+    bench_error_reported = false;
+    bench_start = mxs_clock_us();
+    bench_record_from = bench_start + bench_opts.warmup * 1000000ULL;
+    bench_end = bench_record_from + bench_opts.duration * 1000000ULL;
+
+    for (int i = 0; i < bench_opts.threads; i++)
+    {
+        if (pthread_create(&threads[i].tid, NULL, bench_thread_main, &threads[i]))
+        {
+            fprintf(stderr, "Failed to start thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    uint64_t prev_requests = 0;
+    uint64_t prev_errors = 0;
+    uint64_t prev_time = bench_record_from;
+    uint64_t now;
+
+    while ((now = mxs_clock_us()) < bench_end && !__atomic_load_n(&bench_stop, __ATOMIC_RELAXED))
+    {
+        usleep(10000);
+
+        if (bench_opts.interval && now >= prev_time + bench_opts.interval * 1000000ULL)
+        {
+            uint64_t requests = 0;
+            uint64_t errors = 0;
+
+            for (int i = 0; i < bench_opts.threads; i++)
+            {
+                requests += __atomic_load_n(&threads[i].requests, __ATOMIC_RELAXED);
+                errors += __atomic_load_n(&threads[i].errors, __ATOMIC_RELAXED);
+            }
+
+            printf("%6.0fs %12.1f requests/s %10.1f errors/s\n",
+                   (now - bench_record_from) / 1000000.0,
+                   (requests - prev_requests) * 1000000.0 / (now - prev_time),
+                   (errors - prev_errors) * 1000000.0 / (now - prev_time));
+            fflush(stdout);
+
+            prev_requests = requests;
+            prev_errors = errors;
+            prev_time = now;
+        }
+    }
+
+    __atomic_store_n(&bench_stop, true, __ATOMIC_RELAXED);
+
+    for (int i = 0; i < bench_opts.threads; i++)
+    {
+        pthread_join(threads[i].tid, NULL);
+    }
+
+    if (now > bench_end)
+    {
+        now = bench_end;
+    }
+
+    bench_report(threads, now > bench_record_from ? now - bench_record_from : 0);
+
+    /** The connections whose requests did not complete are left as they are */
+    for (int i = 0; i < bench_opts.connections; i++)
+    {
+        if (conns[i].mysql && !conns[i].active)
+        {
+            if (conns[i].stmt)
+            {
+                mysql_stmt_close(conns[i].stmt);
+            }
+            mysql_close(conns[i].mysql);
+        }
+    }
+
+    for (int i = 0; i < bench_opts.threads; i++)
+    {
+        close(threads[i].epfd);
+    }
+
+    free(conns);
+    free(threads);
+    return true;
+}
+
+static struct option long_options[] =
+{
+    {"host", required_argument, 0, 'h'},
+    {"port", required_argument, 0, 'P'},
+    {"socket", required_argument, 0, 'S'},
+    {"user", required_argument, 0, 'u'},
+    {"password", required_argument, 0, 'p'},
+    {"database", required_argument, 0, 'D'},
+    {"table", required_argument, 0, 't'},
+    {"workload", required_argument, 0, 'w'},
+    {"query", required_argument, 0, 'q'},
+    {"connections", required_argument, 0, 'c'},
+    {"threads", required_argument, 0, 'T'},
+    {"rate", required_argument, 0, 'r'},
+    {"duration", required_argument, 0, 'd'},
+    {"warmup", required_argument, 0, 'W'},
+    {"interval", required_argument, 0, 'i'},
+    {"rows", required_argument, 0, 'n'},
+    {"large-rows", required_argument, 0, 'l'},
+    {"histogram", no_argument, 0, 'H'},
+    {"prepare", no_argument, 0, 'C'},
+    {"cleanup", no_argument, 0, 'X'},
+    {"help", no_argument, 0, '?'},
+    {0, 0, 0, 0}
+};
+
+static void bench_usage(const char *name)
+{
+    printf("usage: %s [options]\n\n"
+           "  -h, --host=HOST           Host to connect to (default: 127.0.0.1)\n"
+           "  -P, --port=PORT           Port to connect to (default: 4006)\n"
+           "  -S, --socket=PATH         UNIX domain socket to connect to\n"
+           "  -u, --user=USER           User name (default: maxuser)\n"
+           "  -p, --password=PASSWORD   Password (default: maxpwd)\n"
+           "  -D, --database=DATABASE   Default database (default: test)\n"
+           "  -t, --table=TABLE         Table the workloads use (default: maxscale_bench)\n"
+           "  -w, --workload=WORKLOAD   point, prepared, trx, large, connect or query (default: point)\n"
+           "  -q, --query=SQL           The query of the query workload\n"
+           "  -c, --connections=N       Number of connections (default: 16)\n"
+           "  -T, --threads=N           Number of threads (default: 4)\n"
+           "  -r, --rate=N              Requests per second, 0 for unlimited (default: 0)\n"
+           "  -d, --duration=SECONDS    How long the load is measured (default: 10)\n"
+           "  -W, --warmup=SECONDS      How long the load is run before it is measured (default: 0)\n"
+           "  -i, --interval=SECONDS    Print the throughput this often (default: never)\n"
+           "  -n, --rows=N              Number of rows in the table (default: 100000)\n"
+           "  -l, --large-rows=N        Rows read by the large workload (default: 10000)\n"
+           "  -H, --histogram           Print the full latency distributions\n"
+           "      --prepare             Create and fill the table and exit\n"
+           "      --cleanup             Drop the table and exit\n"
+           "  -?, --help                Print this help and exit\n", name);
+}
+
+static long bench_number(const char *arg, long min)
+{
+    char *end;
+    long value = strtol(arg, &end, 10);
+
+    if (*arg == '\0' || *end || value < min)
+    {
+        fprintf(stderr, "Invalid number: %s\n", arg);
+        exit(EXIT_FAILURE);
+    }
+
+    return value;
+}
+
+int main(int argc, char **argv)
+{
+    bool prepare = false;
+    bool cleanup = false;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "h:P:S:u:p:D:t:w:q:c:T:r:d:W:i:n:l:H?",
+                            long_options, NULL)) >= 0)
+    {
+        switch (c)
+        {
+        case 'h':
+            bench_opts.host = optarg;
+            break;
+
+        case 'P':
+            bench_opts.port = bench_number(optarg, 0);
+            break;
+
+        case 'S':
+            bench_opts.socket = optarg;
+            break;
+
+        case 'u':
+            bench_opts.user = optarg;
+            break;
+
+        case 'p':
+            bench_opts.password = optarg;
+            break;
+
+        case 'D':
+            bench_opts.database = optarg;
+            break;
+
+        case 't':
+            bench_opts.table = optarg;
+            break;
+
+        case 'w':
+            {
+                int i;
+                for (i = 0; bench_workloads[i].name && strcmp(bench_workloads[i].name, optarg); i++)
+                {
+                }
+
+                if (bench_workloads[i].name == NULL)
+                {
+                    fprintf(stderr, "Unknown workload: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                bench_opts.workload = bench_workloads[i].workload;
+            }
+            break;
+
+        case 'q':
+            bench_opts.query = optarg;
+            bench_opts.workload = BENCH_QUERY;
+            break;
+
+        case 'c':
+            bench_opts.connections = bench_number(optarg, 1);
+            break;
+
+        case 'T':
+            bench_opts.threads = bench_number(optarg, 1);
+            break;
+
+        case 'r':
+            bench_opts.rate = bench_number(optarg, 0);
+            break;
+
+        case 'd':
+            bench_opts.duration = bench_number(optarg, 1);
+            break;
+
+        case 'W':
+            bench_opts.warmup = bench_number(optarg, 0);
+            break;
+
+        case 'i':
+            bench_opts.interval = bench_number(optarg, 0);
+            break;
+
+        case 'n':
+            bench_opts.rows = bench_number(optarg, 1);
+            break;
+
+        case 'l':
+            bench_opts.large_rows = bench_number(optarg, 1);
+            break;
+
+        case 'H':
+            bench_opts.histogram = true;
+            break;
+
+        case 'C':
+            prepare = true;
+            break;
+
+        case 'X':
+            cleanup = true;
+            break;
+
+        default:
+            bench_usage(argv[0]);
+            return optopt ? EXIT_FAILURE : EXIT_SUCCESS;
+        }
+    }
+
+    if (bench_opts.workload == BENCH_QUERY && bench_opts.query == NULL)
+    {
+        fprintf(stderr, "The query workload needs a query\n");
+        return EXIT_FAILURE;
+    }
+
+    if (bench_opts.threads > bench_opts.connections)
+    {
+        bench_opts.threads = bench_opts.connections;
+    }
+
+    if (mysql_library_init(0, NULL, NULL))
+    {
+        fprintf(stderr, "Failed to initialize the connector\n");
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGINT, bench_interrupt);
+    signal(SIGPIPE, SIG_IGN);
+
+    bool ok;
+
+    if (prepare || cleanup)
+    {
+        ok = (!cleanup || bench_cleanup()) && (!prepare || bench_prepare());
+    }
+    else
+    {
+        ok = bench_run_load();
+    }
+
+    mysql_library_end();
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file metrics.c - Metrics in the OpenMetrics text format
+ */
+
+#include "maxscale/metrics.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <maxscale/alloc.h>
+
+/** Initial size of the metrics buffer, grown by doubling */
+#define METRICS_INITIAL_SIZE (64 * 1024)
+
+/** The quantiles of a summary */
+static const double metrics_quantiles[] = {0.5, 0.95, 0.99};
+
+static void metrics_printf(METRICS *metrics, const char *fmt, ...)
+{
+    while (!metrics->failed)
+    {
+        va_list args;
+        va_start(args, fmt);
+        size_t avail = metrics->size - metrics->len;
+        int n = vsnprintf(metrics->data + metrics->len, avail, fmt, args);
+        va_end(args);
+
+        if (n < 0)
+        {
+            break;
+        }
+        else if ((size_t)n < avail)
+        {
+            metrics->len += n;
+            break;
+        }
+
+        size_t size = metrics->size ? metrics->size * 2 : METRICS_INITIAL_SIZE;
+
+        while (size - metrics->len <= (size_t)n)
+        {
+            size *= 2;
+        }
+
+        char *data = MXS_REALLOC(metrics->data, size);
+
+        if (data)
+        {
+            metrics->data = data;
+            metrics->size = size;
+        }
+        else
+        {
+            metrics->failed = true;
+        }
+    }
+}
+
+void metrics_family(METRICS *metrics, const char *name, const char *type, const char *help)
+{
+    metrics_printf(metrics, "# TYPE %s %s\n# HELP %s %s\n", name, type, name, help);
+}
+
+void metrics_label(char labels[METRICS_LABELS_LEN], const char *key, const char *value)
+{
+    size_t len = strlen(labels);
+    int n = snprintf(labels + len, METRICS_LABELS_LEN - len, "%s%s=\"", len ? "," : "", key);
+
+    if (n < 0 || len + n >= METRICS_LABELS_LEN)
+    {
+        labels[len] = '\0';
+        return;
+    }
+
+    len += n;
+
+    /** Leave room for the escape, the closing quote and the terminator */
+    for (const char *p = value; *p && len < METRICS_LABELS_LEN - 4; p++)
+    {
+        if (*p == '"' || *p == '\\')
+        {
+            labels[len++] = '\\';
+            labels[len++] = *p;
+        }
+        else if (*p == '\n')
+        {
+            labels[len++] = '\\';
+            labels[len++] = 'n';
+        }
+        else
+        {
+            labels[len++] = *p;
+        }
+    }
+
+    labels[len++] = '"';
+    labels[len] = '\0';
+}
+
+void metrics_value(METRICS *metrics, const char *name, const char *labels, double value)
+{
+    if (*labels)
+    {
+        metrics_printf(metrics, "%s{%s} %.17g\n", name, labels, value);
+    }
+    else
+    {
+        metrics_printf(metrics, "%s %.17g\n", name, value);
+    }
+}
+
+void metrics_summary(METRICS *metrics, const char *name, const char *labels, const HISTOGRAM *hist)
+{
+    const char *sep = *labels ? "," : "";
+
+    for (size_t i = 0; i < sizeof(metrics_quantiles) / sizeof(metrics_quantiles[0]); i++)
+    {
+        metrics_printf(metrics, "%s{%s%squantile=\"%g\"} %.17g\n", name, labels, sep,
+                       metrics_quantiles[i],
+                       histogram_percentile(hist, metrics_quantiles[i] * 100) / 1000000.0);
+    }
+
+    char count[strlen(name) + sizeof("_count")];
+    sprintf(count, "%s_count", name);
+    metrics_value(metrics, count, labels, hist->count);
+}
+
+GWBUF* metrics_collect()
+{
+    METRICS metrics = {NULL, 0, 0, false};
+    GWBUF *rval = NULL;
+
+    poll_metrics(&metrics);
+    server_metrics(&metrics);
+    service_metrics(&metrics);
+    metrics_printf(&metrics, "# EOF\n");
+
+    if (!metrics.failed)
+    {
+        rval = gwbuf_alloc_and_load(metrics.len, metrics.data);
+    }
+
+    MXS_FREE(metrics.data);
+    return rval;
+}
@@ -25,12 +25,15 @@
  * @endverbatim
  */
 #include <maxscale/buffer.h>
+#include <ctype.h>
 #include <string.h>
 #include <maxscale/protocol/mysql.h>
 #include <maxscale/alloc.h>
 #include <maxscale/poll.h>
 #include <maxscale/modutil.h>
 #include <maxscale/platform.h>
+#include <maxscale/resultset.h>
+#include <maxscale/server.h>
 #include <strings.h>
 
 /** These are used when converting MySQL wildcards to regular expressions */
@@ -129,6 +132,100 @@ modutil_extract_SQL(GWBUF *buf, char **sql, int *length)
     return 1;
 }
 
+/**
+ * The SQL of a statement that spans several buffers, cached as a buffer
+ * object of the first buffer
+ */
+typedef struct
+{
+    const void *start;  /**< Start of the buffer when the copy was made */
+    size_t      length; /**< Length of the SQL */
+    size_t      size;   /**< Size of the allocated memory */
+    char       *sql;    /**< The null terminated SQL */
+} SQL_COPY;
+
+static void sql_copy_free(void *data)
+{
+    SQL_COPY *copy = (SQL_COPY*)data;
+    MXS_FREE(copy->sql);
+    MXS_FREE(copy);
+}
+
+bool modutil_get_SQL_view(GWBUF *buf, const char **sql, size_t *length)
+{
+    uint8_t header[MYSQL_HEADER_LEN + 1];
+
+    if (gwbuf_copy_data(buf, 0, sizeof(header), header) != sizeof(header) ||
+        (header[MYSQL_HEADER_LEN] != MYSQL_COM_QUERY &&
+         header[MYSQL_HEADER_LEN] != MYSQL_COM_STMT_PREPARE &&
+         header[MYSQL_HEADER_LEN] != MYSQL_COM_INIT_DB))
+    {
+        return false;
+    }
+
+    size_t len = MYSQL_GET_PAYLOAD_LEN(header) - 1;
+
+    if (GWBUF_LENGTH(buf) >= sizeof(header) + len)
+    {
+        /** The common case, the statement is in one contiguous buffer */
+        *sql = (char*)GWBUF_DATA(buf) + sizeof(header);
+        *length = len;
+        return true;
+    }
+
+    SQL_COPY *copy = (SQL_COPY*)gwbuf_get_buffer_object_data(buf, GWBUF_SQL_COPY);
+
+    if (copy == NULL || copy->start != buf->start || copy->length != len)
+    {
+        if (gwbuf_length(buf) < sizeof(header) + len)
+        {
+            /** The statement is not complete */
+            return false;
+        }
+
+        if (copy == NULL)
+        {
+            if ((copy = (SQL_COPY*)MXS_CALLOC(1, sizeof(SQL_COPY))) == NULL)
+            {
+                return false;
+            }
+
+            gwbuf_add_buffer_object(buf, GWBUF_SQL_COPY, copy, sql_copy_free);
+        }
+
+        if (copy->size < len + 1)
+        {
+            /** The buffer was modified after an earlier copy was made */
+            char *newsql = (char*)MXS_REALLOC(copy->sql, len + 1);
+
+            if (newsql == NULL)
+            {
+                return false;
+            }
+
+            copy->sql = newsql;
+            copy->size = len + 1;
+        }
+
+        gwbuf_copy_data(buf, sizeof(header), len, (uint8_t*)copy->sql);
+        copy->sql[len] = '\0';
+        copy->start = buf->start;
+        copy->length = len;
+    }
+
+    *sql = copy->sql;
+    *length = len;
+    return true;
+}
+
+bool modutil_get_query_view(GWBUF *buf, const char **sql, size_t *length)
+{
+    uint8_t cmd;
+
+    return gwbuf_copy_data(buf, MYSQL_HEADER_LEN, 1, &cmd) == 1 && cmd == MYSQL_COM_QUERY &&
+           modutil_get_SQL_view(buf, sql, length);
+}
+
 /**
  * Extract the SQL portion of a COM_QUERY packet
  *
@@ -541,59 +638,115 @@ GWBUF* modutil_get_next_MySQL_packet(GWBUF** p_readbuf)
 }
 
 /**
- * @brief Calculate the length of the complete MySQL packets in the buffer
+ * @brief Find the complete packets in a contiguous block of memory
  *
- * @param buffer Buffer to inspect
- * @return Length of the complete MySQL packets in bytes
+ * This is the inner loop of the packet scans. The packet headers are read
+ * directly from memory and the loop stops at the first packet that does not
+ * fit completely into the block.
+ *
+ * @param data      Start of a packet
+ * @param len       Length of the block
+ * @param base      Offset added to the stored offsets
+ * @param offsets   Array where the packet offsets are stored or NULL
+ * @param n_offsets Size of @c offsets, scanning stops when it is full
+ * @param n         Number of packets found so far, updated
+ * @return Number of bytes in the complete packets that were found
  */
-static size_t get_complete_packets_length(GWBUF *buffer)
+static inline size_t scan_contiguous(const uint8_t *data, size_t len, size_t base,
+                                     size_t *offsets, int n_offsets, int *n)
 {
-    uint8_t packet_len[3];
-    uint32_t buflen = GWBUF_LENGTH(buffer);
-    size_t offset = 0;
-    size_t total = 0;
+    size_t pos = 0;
 
-    while (buffer && gwbuf_copy_data(buffer, offset, 3, packet_len) == 3)
+    while (pos + MYSQL_HEADER_LEN <= len)
     {
-        uint32_t len = gw_mysql_get_byte3(packet_len) + MYSQL_HEADER_LEN;
+        size_t pktlen = gw_mysql_get_byte3(data + pos) + MYSQL_HEADER_LEN;
 
-        if (len < buflen)
+        if (pos + pktlen > len)
         {
-            offset += len;
-            total += len;
-            buflen -= len;
+            break;
         }
-        /** The packet is spread across multiple buffers or a buffer ends with
-         * a complete packet. */
-        else
-        {
-            uint32_t read_len = len;
-
-            while (read_len >= buflen && buffer)
-            {
-                read_len -= buflen;
-                buffer = buffer->next;
-                buflen = buffer ? GWBUF_LENGTH(buffer) : 0;
-            }
 
-            /** Either the buffer ended with a complete packet or the buffer
-             * contains more data than is required. */
-            if (read_len == 0 || (buffer && read_len < buflen))
-            {
-                total += len;
-                offset = read_len;
-                buflen -= read_len;
-            }
-            /** The buffer chain contains at least one incomplete packet */
-            else
+        if (offsets)
+        {
+            if (*n == n_offsets)
             {
-                ss_dassert(!buffer);
                 break;
             }
+
+            offsets[*n] = base + pos;
+        }
+
+        (*n)++;
+        pos += pktlen;
+    }
+
+    return pos;
+}
+
+int modutil_scan_packets(GWBUF *buffer, size_t *offsets, int n_offsets, size_t *length)
+{
+    size_t total = 0;     /**< Offset of the next packet in the chain */
+    size_t buf_start = 0; /**< Offset of the current buffer in the chain */
+    int n = 0;
+
+    while (buffer)
+    {
+        size_t buflen = GWBUF_LENGTH(buffer);
+        size_t pos = total - buf_start;
+
+        pos += scan_contiguous(GWBUF_DATA(buffer) + pos, buflen - pos, total,
+                               offsets, n_offsets, &n);
+        total = buf_start + pos;
+
+        if (offsets && n == n_offsets)
+        {
+            break;
+        }
+        else if (pos == buflen)
+        {
+            buf_start += buflen;
+            buffer = buffer->next;
+            continue;
+        }
+
+        /** The next packet continues in the next buffer */
+        uint8_t header[MYSQL_HEADER_LEN];
+
+        if (gwbuf_copy_data(buffer, pos, MYSQL_HEADER_LEN, header) != MYSQL_HEADER_LEN)
+        {
+            /** Not enough data for a complete header */
+            break;
+        }
+
+        size_t end = total + gw_mysql_get_byte3(header) + MYSQL_HEADER_LEN;
+
+        while (buffer && buf_start + GWBUF_LENGTH(buffer) < end)
+        {
+            buf_start += GWBUF_LENGTH(buffer);
+            buffer = buffer->next;
+        }
+
+        if (buffer == NULL)
+        {
+            /** The last packet is incomplete */
+            break;
+        }
+
+        if (offsets)
+        {
+            offsets[n] = total;
         }
+
+        n++;
+        total = end;
+    }
+
+    if (length)
+    {
+        *length = total;
     }
 
-    return total;
+    return n;
 }
 
 /**
@@ -612,7 +765,8 @@ GWBUF* modutil_get_complete_packets(GWBUF **p_readbuf)
         return NULL;
     }
 
-    size_t total = get_complete_packets_length(*p_readbuf);
+    size_t total = 0;
+    modutil_scan_packets(*p_readbuf, NULL, 0, &total);
     GWBUF* complete = NULL;
 
     if (buflen == total)
@@ -634,6 +788,9 @@ GWBUF* modutil_get_complete_packets(GWBUF **p_readbuf)
     return complete;
 }
 
+/** Number of packet offsets that are looked up at a time */
+#define SIGNAL_SCAN_BATCH 64
+
 /**
  * Count the number of EOF, OK or ERR packets in the buffer. Only complete
  * packets are inspected and the buffer is assumed to only contain whole packets.
@@ -647,43 +804,45 @@ GWBUF* modutil_get_complete_packets(GWBUF **p_readbuf)
 int
 modutil_count_signal_packets(GWBUF *reply, int use_ok,  int n_found, int* more)
 {
-    unsigned char* ptr = (unsigned char*) reply->start;
-    unsigned char* end = (unsigned char*) reply->end;
-    unsigned char* prev = ptr;
-    int pktlen, eof = 0, err = 0;
-    int errlen = 0, eoflen = 0;
-    int iserr = 0, iseof = 0;
+    uint8_t *data = GWBUF_DATA(reply);
+    size_t len = GWBUF_LENGTH(reply);
+    size_t offsets[SIGNAL_SCAN_BATCH];
+    size_t pos = 0;
+    uint8_t *ptr = NULL;
+    int eof = 0, err = 0;
     bool moreresults = false;
-    while (ptr < end)
+    bool done = false;
+
+    while (!done)
     {
-        pktlen = MYSQL_GET_PAYLOAD_LEN(ptr) + 4;
+        int n = 0;
+        size_t scanned = scan_contiguous(data + pos, len - pos, pos, offsets, SIGNAL_SCAN_BATCH, &n);
 
-        if ((iserr = PTR_IS_ERR(ptr)) || (iseof = PTR_IS_EOF(ptr)))
+        for (int i = 0; i < n; i++)
         {
-            if (iserr)
+            ptr = data + offsets[i];
+
+            if (PTR_IS_ERR(ptr))
             {
                 err++;
-                errlen = pktlen;
             }
-            else if (iseof)
+            else if (PTR_IS_EOF(ptr))
             {
                 eof++;
-                eoflen = pktlen;
             }
-        }
 
-        if ((ptr + pktlen) > end || (eof + n_found) >= 2)
-        {
-            moreresults = PTR_EOF_MORE_RESULTS(ptr);
-            ptr = prev;
-            break;
+            if (eof + n_found >= 2)
+            {
+                moreresults = PTR_EOF_MORE_RESULTS(ptr);
+                done = true;
+                break;
+            }
         }
 
-        prev = ptr;
-        ptr += pktlen;
+        pos += scanned;
+        done = done || n < SIGNAL_SCAN_BATCH;
     }
 
-
     /*
      * If there were new EOF/ERR packets found, make sure that they are the last
      * packet in the buffer.
@@ -692,19 +851,14 @@ modutil_count_signal_packets(GWBUF *reply, int use_ok,  int n_found, int* more)
     {
         if (err)
         {
-            ptr -= errlen;
             if (!PTR_IS_ERR(ptr))
             {
                 err = 0;
             }
         }
-        else
+        else if (!PTR_IS_EOF(ptr))
         {
-            ptr -= eoflen;
-            if (!PTR_IS_EOF(ptr))
-            {
-                eof = 0;
-            }
+            eof = 0;
         }
     }
 
@@ -713,154 +867,686 @@ modutil_count_signal_packets(GWBUF *reply, int use_ok,  int n_found, int* more)
     return (eof + err);
 }
 
-/**
- * Create parse error and EPOLLIN event to event queue of the backend DCB.
- * When event is notified the error message is processed as error reply and routed
- * upstream to client.
- *
- * @param backend_dcb   DCB where event is added
- * @param errstr        Plain-text string error
- * @param flags         GWBUF type flags
- */
-void modutil_reply_parse_error(DCB*     backend_dcb,
-                               char*    errstr,
-                               uint32_t flags)
+/** Status flags of OK and EOF packets that affect where a reply ends */
+#define REPLY_STATUS_CURSOR_EXISTS 0x0040
+#define REPLY_STATUS_MORE_RESULTS  0x0008
+
+/** The states of a reply */
+enum
 {
-    CHK_DCB(backend_dcb);
-    modutil_reply_routing_error(backend_dcb, 1064, "42000", errstr, flags);
-}
+    REPLY_START,    /**< Expecting the first packet of a reply or of the next result */
+    REPLY_COLDEF,   /**< Reading the column definitions of a result set */
+    REPLY_ROWS,     /**< Reading the rows of a result set */
+    REPLY_EOF_WAIT  /**< Skipping packets until enough EOF packets are seen */
+};
 
-/**
- * Create authentication error and EPOLLIN event to event queue of the backend DCB.
- * When event is notified the error message is processed as error reply and routed
- * upstream to client.
- *
- * @param backend_dcb   DCB where event is added
- * @param errstr        Plain-text string error
- * @param flags         GWBUF type flags
- */
-void modutil_reply_auth_error(DCB*     backend_dcb,
-                              char*    errstr,
-                              uint32_t flags)
+bool modutil_reply_queue_push(MXS_REPLY_QUEUE *queue, uint8_t command)
 {
-    CHK_DCB(backend_dcb);
-    modutil_reply_routing_error(backend_dcb, 1045, "28000", errstr, flags);
+    if (command == MYSQL_COM_STMT_CLOSE ||
+        command == MYSQL_COM_STMT_SEND_LONG_DATA ||
+        command == MYSQL_COM_QUIT)
+    {
+        /** No reply is sent to these */
+        return true;
+    }
+
+    if (queue->count == queue->size)
+    {
+        int size = queue->size ? queue->size * 2 : 8;
+        uint8_t *commands = (uint8_t*)MXS_MALLOC(size);
+
+        if (commands == NULL)
+        {
+            return false;
+        }
+
+        for (int i = 0; i < queue->count; i++)
+        {
+            commands[i] = queue->commands[(queue->head + i) % queue->size];
+        }
+
+        MXS_FREE(queue->commands);
+        queue->commands = commands;
+        queue->size = size;
+        queue->head = 0;
+    }
+
+    queue->commands[(queue->head + queue->count) % queue->size] = command;
+    queue->count++;
+    return true;
 }
 
+bool modutil_reply_queue_expects_ok(const MXS_REPLY_QUEUE *queue)
+{
+    uint8_t command = queue->count ? queue->commands[queue->head] : MYSQL_COM_QUERY;
 
-/**
- * Create error message and EPOLLIN event to event queue of the backend DCB.
- * When event is notified the message is processed as error reply and routed
- * upstream to client.
- *
- * @param backend_dcb   DCB where event is added
- * @param error         SQL error number
- * @param state         SQL state
- * @param errstr        Plain-text string error
- * @param flags         GWBUF type flags
- */
-static void modutil_reply_routing_error(DCB*     backend_dcb,
-                                        int      error,
-                                        char*    state,
-                                        char*    errstr,
-                                        uint32_t flags)
+    return queue->state == REPLY_START && queue->peek_len == 0 && queue->packet_left == 0 &&
+           !queue->continued && command != MYSQL_COM_STMT_PREPARE && command != MYSQL_COM_STMT_FETCH;
+}
+
+void modutil_reply_queue_free(MXS_REPLY_QUEUE *queue)
 {
-    GWBUF* buf;
-    CHK_DCB(backend_dcb);
+    MXS_FREE(queue->commands);
+    memset(queue, 0, sizeof(*queue));
+}
 
-    buf = modutil_create_mysql_err_msg(1, 0, error, state, errstr);
-    MXS_FREE(errstr);
+/** Read the status flags of an OK packet */
+static uint16_t ok_packet_status(const uint8_t *payload, uint32_t len)
+{
+    const uint8_t *ptr = payload + 1;
+    const uint8_t *end = payload + MXS_MIN(len, MODUTIL_REPLY_PEEK_LEN - MYSQL_HEADER_LEN);
 
-    if (buf == NULL)
+    /** Skip the affected rows and the last insert ID */
+    for (int i = 0; i < 2 && ptr < end; i++)
     {
-        MXS_ERROR("Creating routing error message failed.");
-        return;
+        ptr += *ptr < 0xfb ? 1 : *ptr == 0xfc ? 3 : *ptr == 0xfd ? 4 : 9;
     }
-    /** Set flags that help router to process reply correctly */
-    gwbuf_set_type(buf, flags);
-    /** Create an incoming event for backend DCB */
-    poll_add_epollin_event_to_dcb(backend_dcb, buf);
-    return;
+
+    return ptr + 2 <= end ? gw_mysql_get_byte2(ptr) : 0;
 }
 
 /**
- * Find the first occurrence of a character in a string. This function ignores
- * escaped characters and all characters that are enclosed in single or double quotes.
- * @param ptr Pointer to area of memory to inspect
- * @param c Character to search for
- * @param len Size of the memory area
- * @return Pointer to the first non-escaped, non-quoted occurrence of the character.
- * If the character is not found, NULL is returned.
+ * Process the first bytes of one packet of a reply
+ *
+ * @param queue The reply queue
+ * @param len   Payload length of the packet
+ * @return True if the packet completed the reply
  */
-char* strnchr_esc(char* ptr, char c, int len)
+static bool reply_packet(MXS_REPLY_QUEUE *queue, uint32_t len)
 {
-    char* p = (char*)ptr;
-    char* start = p;
-    bool quoted = false, escaped = false;
-    char qc = 0;
+    const uint8_t *payload = queue->peek + MYSQL_HEADER_LEN;
+    uint8_t command = queue->count ? queue->commands[queue->head] : MYSQL_COM_QUERY;
+    uint8_t type = len ? payload[0] : MYSQL_REPLY_OK;
+    /** A row that starts with 0xfe is always at least nine bytes long */
+    bool is_eof = type == MYSQL_REPLY_EOF && len < MYSQL_EOF_PACKET_LEN;
+    bool done = false;
+
+    if (queue->state == REPLY_START && command == MYSQL_COM_STMT_FETCH)
+    {
+        /** The rows are sent without column definitions */
+        queue->state = REPLY_ROWS;
+    }
 
-    while (p < start + len)
+    switch (queue->state)
     {
-        if (escaped)
+    case REPLY_START:
+        if (type == MYSQL_REPLY_ERR || is_eof)
         {
-            escaped = false;
+            done = true;
         }
-        else if (*p == '\\')
+        else if (type == MYSQL_REPLY_OK)
         {
-            escaped = true;
+            if (command == MYSQL_COM_STMT_PREPARE)
+            {
+                /** The parameter and column definitions are each followed by an EOF */
+                int columns = len >= 7 ? gw_mysql_get_byte2(payload + 5) : 0;
+                int params = len >= 9 ? gw_mysql_get_byte2(payload + 7) : 0;
+                queue->eof_left = (columns > 0) + (params > 0);
+                queue->state = REPLY_EOF_WAIT;
+                done = queue->eof_left == 0;
+            }
+            else
+            {
+                done = (ok_packet_status(payload, len) & REPLY_STATUS_MORE_RESULTS) == 0;
+            }
         }
-        else if ((*p == '\'' || *p  == '"') && !quoted)
+        else if (type == MYSQL_REPLY_LOCAL_INFILE && command == MYSQL_COM_QUERY)
         {
-            quoted = true;
-            qc = *p;
+            /** The server replies with an OK or an ERR once the client has sent the file */
         }
-        else if (quoted && *p == qc)
+        else if (command == MYSQL_COM_QUERY || command == MYSQL_COM_STMT_EXECUTE ||
+                 command == MXS_COM_STMT_BULK_EXECUTE)
         {
-            quoted = false;
+            queue->state = REPLY_COLDEF;
         }
-        else if (*p == c && !escaped && !quoted)
+        else if (command == MYSQL_COM_FIELD_LIST)
         {
-            return p;
+            queue->eof_left = 1;
+            queue->state = REPLY_EOF_WAIT;
         }
-        p++;
-    }
-
-    return NULL;
-}
+        else
+        {
+            /** A reply of one packet, e.g. to COM_STATISTICS */
+            done = true;
+        }
+        break;
 
-/**
- * Find the first occurrence of a character in a string. This function ignores
- * escaped characters and all characters that are enclosed in single or double quotes.
- * MySQL style comment blocks and identifiers in backticks are also ignored.
- * @param ptr Pointer to area of memory to inspect
- * @param c Character to search for
- * @param len Size of the memory area
- * @return Pointer to the first non-escaped, non-quoted occurrence of the character.
- * If the character is not found, NULL is returned.
- */
-char* strnchr_esc_mysql(char* ptr, char c, int len)
-{
-    char* p = (char*) ptr;
-    char* start = p, *end = start + len;
-    bool quoted = false, escaped = false, backtick = false, comment = false;
-    char qc = 0;
+    case REPLY_COLDEF:
+        if (type == MYSQL_REPLY_ERR)
+        {
+            done = true;
+        }
+        else if (is_eof)
+        {
+            /** A result set of an opened cursor has no rows */
+            done = len >= 5 && (gw_mysql_get_byte2(payload + 3) & REPLY_STATUS_CURSOR_EXISTS);
+            queue->state = REPLY_ROWS;
+        }
+        break;
 
-    while (p < end)
-    {
-        if (escaped)
+    case REPLY_ROWS:
+        if (type == MYSQL_REPLY_ERR)
         {
-            escaped = false;
+            done = true;
         }
-        else if ((!comment && !quoted && !backtick) || (comment && *p == '*') ||
-                 (!comment && quoted && *p == qc) || (!comment && backtick && *p == '`'))
+        else if (is_eof)
         {
-            switch (*p)
+            if (len >= 5 && (gw_mysql_get_byte2(payload + 3) & REPLY_STATUS_MORE_RESULTS))
             {
-            case '\\':
-                escaped = true;
-                break;
-
-            case '\'':
+                queue->state = REPLY_START;
+            }
+            else
+            {
+                done = true;
+            }
+        }
+        else
+        {
+            queue->rows++;
+        }
+        break;
+
+    case REPLY_EOF_WAIT:
+        done = type == MYSQL_REPLY_ERR || (is_eof && --queue->eof_left == 0);
+        break;
+
+    default:
+        ss_dassert(false);
+        break;
+    }
+
+    if (done)
+    {
+        queue->state = REPLY_START;
+
+        if (queue->count)
+        {
+            queue->head = (queue->head + 1) % queue->size;
+            queue->count--;
+        }
+    }
+
+    return done;
+}
+
+/**
+ * Follow the replies in a buffer
+ *
+ * @param queue      The reply queue
+ * @param reply      Data read from the server
+ * @param stop_at_ok Stop at the first packet that can be an OK packet
+ * @param processed  If not NULL, the number of bytes processed is stored here
+ * @return Number of replies that were completed
+ */
+static int reply_queue_process(MXS_REPLY_QUEUE *queue, GWBUF *reply,
+                               bool stop_at_ok, size_t *processed)
+{
+    int completed = 0;
+    size_t total = 0;
+    bool stop = false;
+
+    for (GWBUF *buf = reply; buf && !stop; buf = buf->next)
+    {
+        const uint8_t *data = GWBUF_DATA(buf);
+        size_t len = GWBUF_LENGTH(buf);
+
+        while (len > 0)
+        {
+            if (stop_at_ok && modutil_reply_queue_expects_ok(queue))
+            {
+                stop = true;
+                break;
+            }
+
+            if (queue->packet_left)
+            {
+                /** Skip the rest of the current packet */
+                size_t n = MXS_MIN(len, queue->packet_left);
+                data += n;
+                len -= n;
+                total += n;
+                queue->packet_left -= n;
+                continue;
+            }
+
+            /** Collect the header and the start of the payload */
+            int want = MYSQL_HEADER_LEN;
+
+            if (queue->peek_len >= MYSQL_HEADER_LEN)
+            {
+                want += MXS_MIN(gw_mysql_get_byte3(queue->peek), MODUTIL_REPLY_PEEK_LEN - MYSQL_HEADER_LEN);
+            }
+
+            size_t n = MXS_MIN(len, want - queue->peek_len);
+            memcpy(queue->peek + queue->peek_len, data, n);
+            queue->peek_len += n;
+            data += n;
+            len -= n;
+            total += n;
+
+            if (queue->peek_len == want &&
+                (want > MYSQL_HEADER_LEN || gw_mysql_get_byte3(queue->peek) == 0))
+            {
+                uint32_t payload_len = gw_mysql_get_byte3(queue->peek);
+                queue->packet_left = payload_len - (want - MYSQL_HEADER_LEN);
+
+                if (!queue->continued && reply_packet(queue, payload_len))
+                {
+                    completed++;
+                }
+
+                queue->continued = payload_len == GW_MYSQL_MAX_PACKET_LEN;
+                queue->peek_len = 0;
+            }
+        }
+    }
+
+    if (processed)
+    {
+        *processed = total;
+    }
+
+    return completed;
+}
+
+int modutil_reply_queue_process(MXS_REPLY_QUEUE *queue, GWBUF *reply)
+{
+    return reply_queue_process(queue, reply, false, NULL);
+}
+
+size_t modutil_reply_queue_process_to_ok(MXS_REPLY_QUEUE *queue, GWBUF *reply)
+{
+    size_t processed;
+    reply_queue_process(queue, reply, true, &processed);
+    return processed;
+}
+
+/** Server status flag telling that the OK packet has session state information */
+#define SESSION_STATE_CHANGED 0x4000
+
+/** Types of the session state entries */
+#define SESSION_TRACK_SYSTEM_VARIABLES  0
+#define SESSION_TRACK_SCHEMA            1
+#define SESSION_TRACK_TRANSACTION_STATE 5
+
+/**
+ * Read a length-encoded integer
+ *
+ * @param ptr   Pointer to the integer, advanced past it
+ * @param end   End of the data
+ * @param value The value is stored here
+ * @return False if the integer does not fit in the data
+ */
+static bool session_state_leint(const uint8_t **ptr, const uint8_t *end, uint64_t *value)
+{
+    const uint8_t *p = *ptr;
+
+    if (p >= end)
+    {
+        return false;
+    }
+
+    int bytes = *p < 0xfb ? 0 : *p == 0xfc ? 2 : *p == 0xfd ? 3 : *p == 0xfe ? 8 : -1;
+
+    if (bytes < 0 || p + 1 + bytes > end)
+    {
+        return false;
+    }
+
+    if (bytes == 0)
+    {
+        *value = *p;
+    }
+    else
+    {
+        *value = 0;
+
+        for (int i = bytes; i > 0; i--)
+        {
+            *value = (*value << 8) | p[i];
+        }
+    }
+
+    *ptr = p + 1 + bytes;
+    return true;
+}
+
+/**
+ * Read a length-encoded string
+ *
+ * @param ptr Pointer to the string, advanced past it
+ * @param end End of the data
+ * @param str The start of the string is stored here
+ * @param len The length of the string is stored here
+ * @return False if the string does not fit in the data
+ */
+static bool session_state_lestr(const uint8_t **ptr, const uint8_t *end,
+                                const uint8_t **str, uint64_t *len)
+{
+    const uint8_t *p = *ptr;
+
+    if (!session_state_leint(&p, end, len) || *len > (uint64_t)(end - p))
+    {
+        return false;
+    }
+
+    *str = p;
+    *ptr = p + *len;
+    return true;
+}
+
+/**
+ * Replace a string with a copy of a length-encoded string
+ *
+ * The latest value in the session state information is the one that counts.
+ *
+ * @param dest  The string to replace, the old value is freed
+ * @param ptr   Pointer to the length-encoded string, advanced past it
+ * @param end   End of the data
+ */
+static void session_state_store(char **dest, const uint8_t **ptr, const uint8_t *end)
+{
+    const uint8_t *str;
+    uint64_t len;
+
+    if (session_state_lestr(ptr, end, &str, &len))
+    {
+        MXS_FREE(*dest);
+        *dest = MXS_STRNDUP((const char*)str, len);
+    }
+}
+
+/**
+ * Read the wanted values from the session state information
+ *
+ * @param ptr   Start of the session state entries
+ * @param end   End of the entries
+ * @param track The wanted values are stored here
+ */
+static void session_state_read(const uint8_t *ptr, const uint8_t *end, MXS_SESSION_TRACK *track)
+{
+    while (ptr < end)
+    {
+        uint8_t type = *ptr++;
+        const uint8_t *data;
+        uint64_t len;
+
+        if (!session_state_lestr(&ptr, end, &data, &len))
+        {
+            break;
+        }
+
+        const uint8_t *data_end = data + len;
+
+        if (type == SESSION_TRACK_SYSTEM_VARIABLES)
+        {
+            const uint8_t *name;
+            uint64_t name_len;
+
+            if (session_state_lestr(&data, data_end, &name, &name_len))
+            {
+                for (int i = 0; i < track->n_variables; i++)
+                {
+                    if (name_len == strlen(track->variables[i]) &&
+                        memcmp(name, track->variables[i], name_len) == 0)
+                    {
+                        session_state_store(&track->values[i], &data, data_end);
+                        break;
+                    }
+                }
+            }
+        }
+        else if (type == SESSION_TRACK_SCHEMA)
+        {
+            session_state_store(&track->schema, &data, data_end);
+        }
+        else if (type == SESSION_TRACK_TRANSACTION_STATE)
+        {
+            session_state_store(&track->trx_state, &data, data_end);
+        }
+    }
+}
+
+GWBUF* modutil_ok_remove_session_state(GWBUF *packet, const char *variable, char **value)
+{
+    MXS_SESSION_TRACK track = {};
+
+    if (variable && value)
+    {
+        track.variables = &variable;
+        track.values = value;
+        track.n_variables = 1;
+    }
+
+    return modutil_ok_take_session_state(packet, &track);
+}
+
+GWBUF* modutil_ok_take_session_state(GWBUF *packet, MXS_SESSION_TRACK *track)
+{
+    if (packet->next)
+    {
+        GWBUF *contiguous = gwbuf_make_contiguous(packet);
+
+        if (contiguous == NULL)
+        {
+            /** The packet was not freed */
+            return packet;
+        }
+
+        packet = contiguous;
+    }
+
+    uint8_t *data = GWBUF_DATA(packet);
+    const uint8_t *start = data + MYSQL_HEADER_LEN;
+    const uint8_t *end = start + gw_mysql_get_byte3(data);
+    const uint8_t *ptr = start + 1;
+    uint64_t number;
+
+    if ((uint8_t*)end > GWBUF_DATA(packet) + GWBUF_LENGTH(packet) ||
+        *start != MYSQL_REPLY_OK)
+    {
+        return packet;
+    }
+
+    /** The affected rows and the last insert ID are followed by the status and the
+     * warnings. Without the info string there is nothing to remove. */
+    if (!session_state_leint(&ptr, end, &number) ||
+        !session_state_leint(&ptr, end, &number) ||
+        ptr + 4 >= end)
+    {
+        return packet;
+    }
+
+    uint8_t *status_ptr = (uint8_t*)ptr;
+    uint16_t status = gw_mysql_get_byte2(status_ptr);
+    const uint8_t *info_start = ptr + 4;
+    const uint8_t *info;
+    uint64_t info_len;
+
+    ptr = info_start;
+
+    if (!session_state_lestr(&ptr, end, &info, &info_len))
+    {
+        return packet;
+    }
+
+    if (status & SESSION_STATE_CHANGED)
+    {
+        const uint8_t *state;
+        uint64_t state_len;
+
+        if (!session_state_lestr(&ptr, end, &state, &state_len) || ptr != end)
+        {
+            return packet;
+        }
+
+        session_state_read(state, state + state_len, track);
+
+        gw_mysql_set_byte2(status_ptr, status & ~SESSION_STATE_CHANGED);
+    }
+    else if (ptr != end)
+    {
+        /** The info is not a length-encoded string, the packet is already
+         * in the format of a client that does not track the session state */
+        return packet;
+    }
+
+    /** The info string is sent as is, up to the end of the packet */
+    size_t prefix_len = info_start - start;
+    memmove((uint8_t*)info_start, info, info_len);
+    gw_mysql_set_byte3(data, prefix_len + info_len);
+
+    return gwbuf_rtrim(packet, gwbuf_length(packet) - (MYSQL_HEADER_LEN + prefix_len + info_len));
+}
+
+/**
+ * Create parse error and EPOLLIN event to event queue of the backend DCB.
+ * When event is notified the error message is processed as error reply and routed
+ * upstream to client.
+ *
+ * @param backend_dcb   DCB where event is added
+ * @param errstr        Plain-text string error
+ * @param flags         GWBUF type flags
+ */
+void modutil_reply_parse_error(DCB*     backend_dcb,
+                               char*    errstr,
+                               uint32_t flags)
+{
+    CHK_DCB(backend_dcb);
+    modutil_reply_routing_error(backend_dcb, 1064, "42000", errstr, flags);
+}
+
+/**
+ * Create authentication error and EPOLLIN event to event queue of the backend DCB.
+ * When event is notified the error message is processed as error reply and routed
+ * upstream to client.
+ *
+ * @param backend_dcb   DCB where event is added
+ * @param errstr        Plain-text string error
+ * @param flags         GWBUF type flags
+ */
+void modutil_reply_auth_error(DCB*     backend_dcb,
+                              char*    errstr,
+                              uint32_t flags)
+{
+    CHK_DCB(backend_dcb);
+    modutil_reply_routing_error(backend_dcb, 1045, "28000", errstr, flags);
+}
+
+
+/**
+ * Create error message and EPOLLIN event to event queue of the backend DCB.
+ * When event is notified the message is processed as error reply and routed
+ * upstream to client.
+ *
+ * @param backend_dcb   DCB where event is added
+ * @param error         SQL error number
+ * @param state         SQL state
+ * @param errstr        Plain-text string error
+ * @param flags         GWBUF type flags
+ */
+static void modutil_reply_routing_error(DCB*     backend_dcb,
+                                        int      error,
+                                        char*    state,
+                                        char*    errstr,
+                                        uint32_t flags)
+{
+    GWBUF* buf;
+    CHK_DCB(backend_dcb);
+
+    buf = modutil_create_mysql_err_msg(1, 0, error, state, errstr);
+    MXS_FREE(errstr);
+
+    if (buf == NULL)
+    {
+        MXS_ERROR("Creating routing error message failed.");
+        return;
+    }
+    /** Set flags that help router to process reply correctly */
+    gwbuf_set_type(buf, flags);
+    /** Create an incoming event for backend DCB */
+    poll_add_epollin_event_to_dcb(backend_dcb, buf);
+    return;
+}
+
+/**
+ * Find the first occurrence of a character in a string. This function ignores
+ * escaped characters and all characters that are enclosed in single or double quotes.
+ * @param ptr Pointer to area of memory to inspect
+ * @param c Character to search for
+ * @param len Size of the memory area
+ * @return Pointer to the first non-escaped, non-quoted occurrence of the character.
+ * If the character is not found, NULL is returned.
+ */
+char* strnchr_esc(char* ptr, char c, int len)
+{
+    char* p = (char*)ptr;
+    char* start = p;
+    bool quoted = false, escaped = false;
+    char qc = 0;
+
+    while (p < start + len)
+    {
+        if (escaped)
+        {
+            escaped = false;
+        }
+        else if (*p == '\\')
+        {
+            escaped = true;
+        }
+        else if ((*p == '\'' || *p  == '"') && !quoted)
+        {
+            quoted = true;
+            qc = *p;
+        }
+        else if (quoted && *p == qc)
+        {
+            quoted = false;
+        }
+        else if (*p == c && !escaped && !quoted)
+        {
+            return p;
+        }
+        p++;
+    }
+
+    return NULL;
+}
+
+/**
+ * Find the first occurrence of a character in a string. This function ignores
+ * escaped characters and all characters that are enclosed in single or double quotes.
+ * MySQL style comment blocks and identifiers in backticks are also ignored.
+ * @param ptr Pointer to area of memory to inspect
+ * @param c Character to search for
+ * @param len Size of the memory area
+ * @return Pointer to the first non-escaped, non-quoted occurrence of the character.
+ * If the character is not found, NULL is returned.
+ */
+char* strnchr_esc_mysql(char* ptr, char c, int len)
+{
+    char* p = (char*) ptr;
+    char* start = p, *end = start + len;
+    bool quoted = false, escaped = false, backtick = false, comment = false;
+    char qc = 0;
+
+    while (p < end)
+    {
+        if (escaped)
+        {
+            escaped = false;
+        }
+        else if ((!comment && !quoted && !backtick) || (comment && *p == '*') ||
+                 (!comment && quoted && *p == qc) || (!comment && backtick && *p == '`'))
+        {
+            switch (*p)
+            {
+            case '\\':
+                escaped = true;
+                break;
+
+            case '\'':
             case '"':
                 if (!quoted)
                 {
@@ -985,6 +1671,90 @@ bool is_mysql_sp_end(const char* start, int len)
     return ptr < start + len - 3 && strncasecmp(ptr, "end", 3) == 0;
 }
 
+/**
+ * @brief Find the semicolon that ends the first statement of a string
+ *
+ * Semicolons in quoted strings, identifiers in backticks and comments are
+ * ignored. Unlike strnchr_esc_mysql(), comments that run to the end of the
+ * line do not stop the search so statements that follow them are found.
+ *
+ * @param start String containing one or more statements
+ * @param len Length of the string
+ * @return Pointer to the semicolon or NULL if the string has only one statement
+ */
+char* find_mysql_statement_end(char* start, int len)
+{
+    char *ptr = start;
+    char *end = start + len;
+
+    while (ptr < end)
+    {
+        switch (*ptr)
+        {
+        case '\'':
+        case '"':
+        case '`':
+            {
+                char quote = *ptr++;
+
+                while (ptr < end && *ptr != quote)
+                {
+                    if (*ptr == '\\' && quote != '`' && ptr + 1 < end)
+                    {
+                        ptr++;
+                    }
+                    ptr++;
+                }
+            }
+            break;
+
+        case '-':
+            if (ptr + 2 < end && *(ptr + 1) == '-' && isspace(*(ptr + 2)))
+            {
+                while (ptr < end && *ptr != '\n')
+                {
+                    ptr++;
+                }
+            }
+            break;
+
+        case '#':
+            while (ptr < end && *ptr != '\n')
+            {
+                ptr++;
+            }
+            break;
+
+        case '/':
+            if (ptr + 1 < end && *(ptr + 1) == '*')
+            {
+                ptr += 2;
+
+                while (ptr < end && !(*ptr == '*' && ptr + 1 < end && *(ptr + 1) == '/'))
+                {
+                    ptr++;
+                }
+
+                if (ptr < end)
+                {
+                    ptr++;
+                }
+            }
+            break;
+
+        case ';':
+            return ptr;
+
+        default:
+            break;
+        }
+
+        ptr++;
+    }
+
+    return NULL;
+}
+
 /**
  * Create a COM_QUERY packet from a string.
  * @param query Query to create.
@@ -1195,29 +1965,261 @@ char* modutil_get_canonical(GWBUF* querybuf)
             dest = NULL;
             destsize = 0;
 
-            if (remove_mysql_comments((const char**)&src, &srcsize, &dest, &destsize))
+            if (remove_mysql_comments((const char**)&src, &srcsize, &dest, &destsize))
+            {
+                /** Both buffers now contain allocated memory so all we need
+                 * to do is to swap them */
+                if (replace_values((const char**)&dest, &destsize, &src, &srcsize))
+                {
+                    querystr = squeeze_whitespace(src);
+                    MXS_FREE(dest);
+                }
+                else
+                {
+                    MXS_FREE(src);
+                    MXS_FREE(dest);
+                }
+            }
+            else
+            {
+                MXS_FREE(src);
+            }
+        }
+    }
+
+    return querystr;
+}
+
+/** The FNV-1a hash parameters */
+#define DIGEST_FNV_OFFSET 0xcbf29ce484222325ULL
+#define DIGEST_FNV_PRIME  0x100000001b3ULL
+
+/** Token that replaces the literal values */
+#define DIGEST_LITERAL    '?'
+
+/**
+ * Position in a statement that can span several buffers
+ */
+typedef struct
+{
+    GWBUF         *buffer; /**< Current buffer */
+    const uint8_t *ptr;    /**< Current byte */
+    size_t         left;   /**< Number of bytes left in the statement */
+} SQL_CURSOR;
+
+/**
+ * @brief Peek at a byte ahead of the cursor
+ *
+ * @param cursor Cursor to inspect
+ * @param offset Offset from the current byte
+ * @return The byte or -1 if the statement ends before it
+ */
+static inline int cursor_peek(const SQL_CURSOR *cursor, size_t offset)
+{
+    if (offset >= cursor->left)
+    {
+        return -1;
+    }
+
+    GWBUF *buffer = cursor->buffer;
+    const uint8_t *ptr = cursor->ptr;
+
+    while (ptr + offset >= (uint8_t*)buffer->end)
+    {
+        offset -= (uint8_t*)buffer->end - ptr;
+        buffer = buffer->next;
+        ptr = (uint8_t*)buffer->start;
+    }
+
+    return ptr[offset];
+}
+
+static inline void cursor_advance(SQL_CURSOR *cursor)
+{
+    cursor->ptr++;
+    cursor->left--;
+
+    while (cursor->left && cursor->ptr >= (uint8_t*)cursor->buffer->end)
+    {
+        cursor->buffer = cursor->buffer->next;
+        cursor->ptr = (uint8_t*)cursor->buffer->start;
+    }
+}
+
+static inline uint64_t digest_byte(uint64_t hash, uint8_t c)
+{
+    return (hash ^ c) * DIGEST_FNV_PRIME;
+}
+
+/** Tokens are terminated with a zero byte so that whitespace does not matter */
+static inline uint64_t digest_token_end(uint64_t hash)
+{
+    return digest_byte(hash, 0);
+}
+
+static inline bool is_ident_char(int c)
+{
+    return isalnum(c) || c == '_' || c == '$' || c >= 0x80;
+}
+
+static inline bool is_number_char(int c)
+{
+    return isalnum(c) || c == '.';
+}
+
+bool modutil_get_canonical_digest(GWBUF* querybuf, uint64_t* digest)
+{
+    uint8_t header[MYSQL_HEADER_LEN + 1];
+
+    if (gwbuf_copy_data(querybuf, 0, sizeof(header), header) != sizeof(header) ||
+        (header[MYSQL_HEADER_LEN] != MYSQL_COM_QUERY && header[MYSQL_HEADER_LEN] != MYSQL_COM_STMT_PREPARE))
+    {
+        return false;
+    }
+
+    size_t len = MYSQL_GET_PAYLOAD_LEN(header) - 1;
+    size_t offset = sizeof(header);
+    GWBUF *buffer = querybuf;
+
+    while (buffer && offset >= GWBUF_LENGTH(buffer))
+    {
+        offset -= GWBUF_LENGTH(buffer);
+        buffer = buffer->next;
+    }
+
+    SQL_CURSOR cursor = {buffer, buffer ? GWBUF_DATA(buffer) + offset : NULL, 0};
+
+    /** Only the part of the statement that is in the buffer is hashed */
+    size_t available = gwbuf_length(querybuf) - sizeof(header);
+    cursor.left = len < available ? len : available;
+
+    uint64_t hash = DIGEST_FNV_OFFSET;
+    bool after_value = false; /**< Whether the previous token was a value */
+    int c;
+
+    while ((c = cursor_peek(&cursor, 0)) != -1)
+    {
+        if (isspace(c))
+        {
+            cursor_advance(&cursor);
+        }
+        else if (c == '#' || (c == '-' && cursor_peek(&cursor, 1) == '-' &&
+                              (cursor_peek(&cursor, 2) == -1 || isspace(cursor_peek(&cursor, 2)))))
+        {
+            /** Comment until the end of the line */
+            while ((c = cursor_peek(&cursor, 0)) != -1 && c != '\n')
+            {
+                cursor_advance(&cursor);
+            }
+        }
+        else if (c == '/' && cursor_peek(&cursor, 1) == '*' && cursor_peek(&cursor, 2) != '!' &&
+                 !(cursor_peek(&cursor, 2) == 'M' && cursor_peek(&cursor, 3) == '!'))
+        {
+            /** Block comment, executable comments are hashed like normal SQL */
+            cursor_advance(&cursor);
+            cursor_advance(&cursor);
+
+            while ((c = cursor_peek(&cursor, 0)) != -1 &&
+                   !(c == '*' && cursor_peek(&cursor, 1) == '/'))
+            {
+                cursor_advance(&cursor);
+            }
+
+            if (c != -1)
+            {
+                cursor_advance(&cursor);
+                cursor_advance(&cursor);
+            }
+        }
+        else if (c == '\'' || c == '"')
+        {
+            /** A string literal */
+            int quote = c;
+            cursor_advance(&cursor);
+
+            while ((c = cursor_peek(&cursor, 0)) != -1)
             {
-                /** Both buffers now contain allocated memory so all we need
-                 * to do is to swap them */
-                if (replace_values((const char**)&dest, &destsize, &src, &srcsize))
+                cursor_advance(&cursor);
+
+                if (c == '\\' && cursor.left)
                 {
-                    querystr = squeeze_whitespace(src);
-                    MXS_FREE(dest);
+                    cursor_advance(&cursor);
                 }
-                else
+                else if (c == quote)
                 {
-                    MXS_FREE(src);
-                    MXS_FREE(dest);
+                    if (cursor_peek(&cursor, 0) != quote)
+                    {
+                        break;
+                    }
+
+                    /** A doubled quote inside the string */
+                    cursor_advance(&cursor);
                 }
             }
-            else
+
+            hash = digest_token_end(digest_byte(hash, DIGEST_LITERAL));
+            after_value = true;
+        }
+        else if (c == '`')
+        {
+            /** A quoted identifier is hashed as it is */
+            hash = digest_byte(hash, c);
+            cursor_advance(&cursor);
+
+            while ((c = cursor_peek(&cursor, 0)) != -1)
             {
-                MXS_FREE(src);
+                hash = digest_byte(hash, c);
+                cursor_advance(&cursor);
+
+                if (c == '`')
+                {
+                    break;
+                }
+            }
+
+            hash = digest_token_end(hash);
+            after_value = true;
+        }
+        else if (isdigit(c) || (c == '.' && isdigit(cursor_peek(&cursor, 1))) ||
+                 (c == '-' && !after_value && (isdigit(cursor_peek(&cursor, 1)) ||
+                                               cursor_peek(&cursor, 1) == '.')))
+        {
+            /** A numeric literal, including a sign, hexadecimal values and exponents */
+            int prev = c;
+            cursor_advance(&cursor);
+
+            while ((c = cursor_peek(&cursor, 0)) != -1 &&
+                   (is_number_char(c) || ((c == '-' || c == '+') && (prev == 'e' || prev == 'E'))))
+            {
+                prev = c;
+                cursor_advance(&cursor);
+            }
+
+            hash = digest_token_end(digest_byte(hash, DIGEST_LITERAL));
+            after_value = true;
+        }
+        else if (is_ident_char(c))
+        {
+            while ((c = cursor_peek(&cursor, 0)) != -1 && is_ident_char(c))
+            {
+                hash = digest_byte(hash, c);
+                cursor_advance(&cursor);
             }
+
+            hash = digest_token_end(hash);
+            after_value = true;
+        }
+        else
+        {
+            /** Any other character is a token of its own */
+            hash = digest_token_end(digest_byte(hash, c));
+            cursor_advance(&cursor);
+            after_value = c == ')';
         }
     }
 
-    return querystr;
+    *digest = hash;
+    return true;
 }
 
 
@@ -1328,6 +2330,450 @@ char* modutil_MySQL_bypass_whitespace(char* sql, size_t len)
     return i;
 }
 
+/** The most variables answered in one query */
+#define VAR_QUERY_MAX_ITEMS 64
+
+/** The longest value of a variable that is answered */
+#define VAR_QUERY_MAX_VALUE 1024
+
+/**
+ * The variables whose session values are set from the collation of the
+ * client handshake and the variables of the server they then are equal to
+ */
+static const char * const connection_charset_vars[][2] =
+{
+    {"character_set_client",     "character_set_server"},
+    {"character_set_connection", "character_set_server"},
+    {"character_set_results",    "character_set_server"},
+    {"collation_connection",     "collation_server"},
+    {NULL, NULL}
+};
+
+typedef enum
+{
+    VAR_TOKEN_END,
+    VAR_TOKEN_WORD,   /**< Keyword, identifier or number */
+    VAR_TOKEN_QUOTED, /**< Quoted string or identifier */
+    VAR_TOKEN_SYSVAR, /**< @@[scope.]name */
+    VAR_TOKEN_COMMA,
+    VAR_TOKEN_SEMICOLON,
+    VAR_TOKEN_OTHER
+} var_token_type_t;
+
+typedef struct
+{
+    var_token_type_t type;
+    const char      *start;    /**< Start of the token */
+    size_t           len;      /**< Length of the token */
+    const char      *value;    /**< Word, contents of a quoted token or name of a variable */
+    size_t           value_len;
+    bool             global;   /**< Variable with the global scope */
+} VAR_TOKEN;
+
+/** The result of a query that reads variables */
+typedef struct
+{
+    int   n_items;                      /**< Number of columns */
+    char *columns[VAR_QUERY_MAX_ITEMS]; /**< Names of the columns */
+    char *values[VAR_QUERY_MAX_ITEMS];  /**< Values of the columns */
+    bool  done;                         /**< The row has been returned */
+} VAR_RESULT;
+
+static bool var_is_ident(char c)
+{
+    return isalnum(c) || c == '_' || c == '$';
+}
+
+/**
+ * Read the next token of a query
+ *
+ * @param ptr Position in the query, moved after the token
+ * @param end End of the query
+ * @param tok The token
+ */
+static void var_next_token(const char **ptr, const char *end, VAR_TOKEN *tok)
+{
+    const char *p = modutil_MySQL_bypass_whitespace((char*)*ptr, end - *ptr);
+
+    tok->start = p;
+    tok->value = p;
+    tok->global = false;
+
+    if (p == end)
+    {
+        tok->type = VAR_TOKEN_END;
+    }
+    else if (var_is_ident(*p))
+    {
+        while (p < end && var_is_ident(*p))
+        {
+            p++;
+        }
+
+        tok->type = VAR_TOKEN_WORD;
+    }
+    else if (*p == '`' || *p == '\'' || *p == '"')
+    {
+        /** Escaped or doubled quotes are not accepted */
+        char quote = *p++;
+        tok->value = p;
+
+        while (p < end && *p != quote && *p != '\\')
+        {
+            p++;
+        }
+
+        if (p < end && *p == quote && (p + 1 == end || p[1] != quote))
+        {
+            tok->type = VAR_TOKEN_QUOTED;
+            tok->value_len = p++ - tok->value;
+        }
+        else
+        {
+            tok->type = VAR_TOKEN_OTHER;
+        }
+    }
+    else if (end - p > 2 && p[0] == '@' && p[1] == '@')
+    {
+        static const char * const scopes[] = {"session.", "local.", "global.", NULL};
+        p += 2;
+
+        for (int i = 0; scopes[i]; i++)
+        {
+            size_t len = strlen(scopes[i]);
+
+            if ((size_t)(end - p) > len && strncasecmp(p, scopes[i], len) == 0)
+            {
+                tok->global = i == 2;
+                p += len;
+                break;
+            }
+        }
+
+        tok->value = p;
+
+        while (p < end && var_is_ident(*p))
+        {
+            p++;
+        }
+
+        tok->type = p > tok->value ? VAR_TOKEN_SYSVAR : VAR_TOKEN_OTHER;
+    }
+    else
+    {
+        tok->type = *p == ',' ? VAR_TOKEN_COMMA : *p == ';' ? VAR_TOKEN_SEMICOLON : VAR_TOKEN_OTHER;
+        p++;
+    }
+
+    tok->len = p - tok->start;
+
+    if (tok->type != VAR_TOKEN_QUOTED)
+    {
+        tok->value_len = p - tok->value;
+    }
+
+    *ptr = p;
+}
+
+static bool var_token_is(const VAR_TOKEN *tok, const char *word)
+{
+    return tok->type == VAR_TOKEN_WORD && tok->value_len == strlen(word) &&
+           strncasecmp(tok->value, word, tok->value_len) == 0;
+}
+
+/**
+ * Find the value of a variable
+ *
+ * @param server    The server
+ * @param collation Collation ID of the client connection
+ * @param tok       The variable
+ * @return The value or NULL if it is not known
+ */
+static char* var_value(SERVER *server, int collation, const VAR_TOKEN *tok)
+{
+    if (tok->value_len >= VAR_QUERY_MAX_VALUE)
+    {
+        return NULL;
+    }
+
+    char name[tok->value_len + 1];
+    memcpy(name, tok->value, tok->value_len);
+    name[tok->value_len] = '\0';
+
+    const char *lookup = name;
+
+    for (int i = 0; connection_charset_vars[i][0] && !tok->global; i++)
+    {
+        if (strcasecmp(name, connection_charset_vars[i][0]) == 0)
+        {
+            /** The session value is the default of the server only if the
+             * client connected with the default collation of the server */
+            int server_collation = server_get_collation_id(server);
+
+            if (server_collation == 0 || server_collation != collation)
+            {
+                return NULL;
+            }
+
+            lookup = connection_charset_vars[i][1];
+            break;
+        }
+    }
+
+    char value[VAR_QUERY_MAX_VALUE];
+    return server_get_variable(server, lookup, value, sizeof(value)) ? MXS_STRDUP(value) : NULL;
+}
+
+/** Add a column to the result, returns false if the value is not known */
+static bool var_add(VAR_RESULT *res, const char *column, size_t len, char *value)
+{
+    if (value == NULL || res->n_items == VAR_QUERY_MAX_ITEMS)
+    {
+        MXS_FREE(value);
+        return false;
+    }
+
+    res->columns[res->n_items] = MXS_STRNDUP(column, len);
+    res->values[res->n_items] = value;
+
+    return res->columns[res->n_items++] != NULL;
+}
+
+/**
+ * Parse SELECT @@var [[AS] alias], ... [LIMIT n] [;]
+ *
+ * @return True if the query only reads known variables
+ */
+static bool var_parse_select(const char *ptr, const char *end, VAR_RESULT *res,
+                             SERVER *server, int collation)
+{
+    VAR_TOKEN tok;
+
+    do
+    {
+        VAR_TOKEN var;
+        var_next_token(&ptr, end, &var);
+        var_next_token(&ptr, end, &tok);
+
+        if (var.type != VAR_TOKEN_SYSVAR)
+        {
+            return false;
+        }
+
+        /** Without an alias the column is named after the expression */
+        VAR_TOKEN alias = var;
+        alias.value = var.start;
+        alias.value_len = var.len;
+
+        if (var_token_is(&tok, "AS"))
+        {
+            var_next_token(&ptr, end, &alias);
+            var_next_token(&ptr, end, &tok);
+
+            if (alias.type != VAR_TOKEN_WORD && alias.type != VAR_TOKEN_QUOTED)
+            {
+                return false;
+            }
+        }
+        else if ((tok.type == VAR_TOKEN_WORD && !var_token_is(&tok, "LIMIT") &&
+                  !var_token_is(&tok, "FROM")) || tok.type == VAR_TOKEN_QUOTED)
+        {
+            alias = tok;
+            var_next_token(&ptr, end, &tok);
+        }
+
+        if (!var_add(res, alias.value, alias.value_len, var_value(server, collation, &var)))
+        {
+            return false;
+        }
+    }
+    while (tok.type == VAR_TOKEN_COMMA);
+
+    if (var_token_is(&tok, "LIMIT"))
+    {
+        /** LIMIT 0 would return no rows */
+        var_next_token(&ptr, end, &tok);
+
+        if (tok.type != VAR_TOKEN_WORD || strspn(tok.value, "0123456789") < tok.value_len ||
+            strtol(tok.value, NULL, 10) == 0)
+        {
+            return false;
+        }
+
+        var_next_token(&ptr, end, &tok);
+    }
+
+    if (tok.type == VAR_TOKEN_SEMICOLON)
+    {
+        var_next_token(&ptr, end, &tok);
+    }
+
+    return tok.type == VAR_TOKEN_END;
+}
+
+/**
+ * Parse SHOW [GLOBAL|SESSION|LOCAL] VARIABLES LIKE 'name' [;]
+ *
+ * The pattern must not contain wildcards other than the underscore, which
+ * is taken literally as variable names are full of them.
+ *
+ * @return True if the query only reads a known variable
+ */
+static bool var_parse_show(const char *ptr, const char *end, VAR_RESULT *res,
+                           SERVER *server, int collation)
+{
+    VAR_TOKEN tok;
+    bool global = false;
+
+    var_next_token(&ptr, end, &tok);
+
+    if (var_token_is(&tok, "GLOBAL") || var_token_is(&tok, "SESSION") || var_token_is(&tok, "LOCAL"))
+    {
+        global = var_token_is(&tok, "GLOBAL");
+        var_next_token(&ptr, end, &tok);
+    }
+
+    if (!var_token_is(&tok, "VARIABLES"))
+    {
+        return false;
+    }
+
+    VAR_TOKEN pattern;
+    var_next_token(&ptr, end, &tok);
+
+    if (!var_token_is(&tok, "LIKE"))
+    {
+        return false;
+    }
+
+    var_next_token(&ptr, end, &pattern);
+    var_next_token(&ptr, end, &tok);
+
+    if (tok.type == VAR_TOKEN_SEMICOLON)
+    {
+        var_next_token(&ptr, end, &tok);
+    }
+
+    if (tok.type != VAR_TOKEN_END || pattern.type != VAR_TOKEN_QUOTED || *pattern.start == '`' ||
+        pattern.value_len == 0 || memchr(pattern.value, '%', pattern.value_len))
+    {
+        return false;
+    }
+
+    pattern.global = global;
+
+    char name[pattern.value_len + 1];
+
+    for (size_t i = 0; i < pattern.value_len; i++)
+    {
+        name[i] = tolower(pattern.value[i]);
+    }
+
+    name[pattern.value_len] = '\0';
+
+    /** The result has the columns Variable_name and Value and one row */
+    char *value = var_value(server, collation, &pattern);
+
+    if (value == NULL)
+    {
+        return false;
+    }
+
+    if (!var_add(res, "Variable_name", strlen("Variable_name"), MXS_STRDUP(name)))
+    {
+        MXS_FREE(value);
+        return false;
+    }
+
+    return var_add(res, "Value", strlen("Value"), value);
+}
+
+static RESULT_ROW* var_result_row(RESULTSET *set, void *data)
+{
+    VAR_RESULT *res = (VAR_RESULT*)data;
+    RESULT_ROW *row = NULL;
+
+    if (!res->done && (row = resultset_make_row(set)))
+    {
+        for (int i = 0; i < res->n_items; i++)
+        {
+            resultset_row_set(row, i, res->values[i]);
+        }
+
+        res->done = true;
+    }
+
+    return row;
+}
+
+bool modutil_answer_variable_query(DCB *client, SERVER *server, GWBUF *query)
+{
+    const char *sql;
+    size_t len;
+
+    if (!modutil_get_query_view(query, &sql, &len) || !SERVER_IS_RUNNING(server))
+    {
+        return false;
+    }
+
+    const char *end = sql + len;
+
+    /** Executable comments are not skipped like the others */
+    for (const char *p = sql; p + 3 <= end; p++)
+    {
+        if (p[0] == '/' && p[1] == '*' && p[2] == '!')
+        {
+            return false;
+        }
+    }
+
+    MySQLProtocol *proto = (MySQLProtocol*)client->protocol;
+    VAR_RESULT res = {.n_items = 0};
+    VAR_TOKEN tok;
+    bool answered = false;
+
+    var_next_token(&sql, end, &tok);
+
+    if (var_token_is(&tok, "SELECT"))
+    {
+        answered = var_parse_select(sql, end, &res, server, proto->charset);
+    }
+    else if (var_token_is(&tok, "SHOW"))
+    {
+        answered = var_parse_show(sql, end, &res, server, proto->charset);
+    }
+
+    RESULTSET *set = NULL;
+
+    if (answered && (set = resultset_create(var_result_row, &res)))
+    {
+        for (int i = 0; i < res.n_items && answered; i++)
+        {
+            answered = resultset_add_column(set, res.columns[i], VAR_QUERY_MAX_VALUE,
+                                            COL_TYPE_VARCHAR);
+        }
+
+        if (answered)
+        {
+            resultset_stream_mysql(set, client);
+        }
+
+        resultset_free(set);
+    }
+    else
+    {
+        answered = false;
+    }
+
+    for (int i = 0; i < res.n_items; i++)
+    {
+        MXS_FREE(res.columns[i]);
+        MXS_FREE(res.values[i]);
+    }
+
+    return answered;
+}
+
 const char format_str[] = "COM_UNKNOWN(%02x)";
 
 // The message always fits inside the buffer
@@ -1397,6 +2843,8 @@ const char* STRPACKETTYPE(int p)
             return "MYSQL_COM_STMT_FETCH";
         case MYSQL_COM_DAEMON:
             return "MYSQL_COM_DAEMON";
+        case MXS_COM_STMT_BULK_EXECUTE:
+            return "MYSQL_COM_STMT_BULK_EXECUTE";
     }
 
     snprintf(unknow_type, sizeof(unknow_type), format_str, p);
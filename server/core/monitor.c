@@ -29,10 +29,17 @@
  */
 #include <maxscale/monitor.h>
 
+#include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include <maxscale/alloc.h>
 #include <mysqld_error.h>
@@ -42,6 +49,8 @@
 #include <maxscale/pcre2.h>
 #include <maxscale/secrets.h>
 #include <maxscale/spinlock.h>
+#include <maxscale/thread.h>
+#include <maxscale/utils.h>
 
 #include "maxscale/config.h"
 #include "maxscale/externcmd.h"
@@ -52,6 +61,10 @@ static MXS_MONITOR  *allMonitors = NULL;
 static SPINLOCK monLock = SPINLOCK_INIT;
 
 static void monitor_server_free_all(MXS_MONITOR_SERVERS *servers);
+static void mon_probes_free(MXS_MONITOR *monitor);
+static void mon_clear_status(MXS_MONITOR_SERVERS *db);
+static void mon_journal_load(MXS_MONITOR *monitor);
+static void mon_journal_store(MXS_MONITOR *monitor);
 
 /** Server type specific bits */
 static unsigned int server_type_bits = SERVER_MASTER | SERVER_SLAVE |
@@ -106,8 +119,15 @@ monitor_alloc(char *name, char *module)
     mon->interval = MONITOR_DEFAULT_INTERVAL;
     mon->parameters = NULL;
     mon->created_online = false;
+    mon->load_metrics = false;
+    mon->server_variables = NULL;
+    mon->journal_max_age = DEFAULT_JOURNAL_MAX_AGE;
+    mon->journal_hash = 0;
+    mon->round = 0;
     mon->server_pending_changes = false;
+    mon->probes = NULL;
     spinlock_init(&mon->lock);
+    spinlock_register(&monLock, "monitors");
     spinlock_acquire(&monLock);
     mon->next = allMonitors;
     allMonitors = mon;
@@ -128,6 +148,7 @@ monitor_free(MXS_MONITOR *mon)
     MXS_MONITOR *ptr;
 
     mon->module->stopMonitor(mon);
+    mon_probes_free(mon);
     mon->state = MONITOR_STATE_FREED;
     spinlock_acquire(&monLock);
     if (allMonitors == mon)
@@ -151,6 +172,7 @@ monitor_free(MXS_MONITOR *mon)
     monitor_server_free_all(mon->databases);
     MXS_FREE(mon->name);
     MXS_FREE(mon->module_name);
+    MXS_FREE(mon->server_variables);
     MXS_FREE(mon);
 }
 
@@ -165,6 +187,13 @@ monitorStart(MXS_MONITOR *monitor, void* params)
 {
     spinlock_acquire(&monitor->lock);
 
+    if (monitor->state == MONITOR_STATE_ALLOC)
+    {
+        /** Only the first start uses the journal, a restarted monitor
+         * already knows the state of its servers */
+        mon_journal_load(monitor);
+    }
+
     if ((monitor->handle = (*monitor->module->startMonitor)(monitor, params)))
     {
         monitor->state = MONITOR_STATE_RUNNING;
@@ -177,21 +206,69 @@ monitorStart(MXS_MONITOR *monitor, void* params)
     spinlock_release(&monitor->lock);
 }
 
+/** Maximum number of monitors that are started concurrently */
+#define MONITOR_START_THREADS 16
+
+static void monitor_start_one(void *arg)
+{
+    MXS_MONITOR *monitor = (MXS_MONITOR*)arg;
+    uint64_t begin = mxs_clock_us();
+
+    monitorStart(monitor, monitor->parameters);
+
+    MXS_NOTICE("Monitor '%s' started in %.2f seconds.", monitor->name,
+               (mxs_clock_us() - begin) / 1.0e6);
+}
+
 /**
  * Start all monitors
+ *
+ * The monitors are independent of each other so they are started concurrently.
  */
 void monitorStartAll()
 {
     MXS_MONITOR *ptr;
+    int n = 0;
 
     spinlock_acquire(&monLock);
-    ptr = allMonitors;
-    while (ptr)
+
+    for (ptr = allMonitors; ptr; ptr = ptr->next)
     {
-        monitorStart(ptr, ptr->parameters);
-        ptr = ptr->next;
+        n++;
     }
+
+    void **items = n ? MXS_MALLOC(n * sizeof(void*)) : NULL;
+
+    if (items)
+    {
+        int i = 0;
+
+        for (ptr = allMonitors; ptr; ptr = ptr->next)
+        {
+            items[i++] = ptr;
+        }
+    }
+
     spinlock_release(&monLock);
+
+    if (items)
+    {
+        /** The monitors are only added when the configuration is read, so
+         * they can be started without holding the lock */
+        thread_run_parallel(monitor_start_one, items, n, MONITOR_START_THREADS);
+        MXS_FREE(items);
+    }
+    else
+    {
+        spinlock_acquire(&monLock);
+
+        for (ptr = allMonitors; ptr; ptr = ptr->next)
+        {
+            monitorStart(ptr, ptr->parameters);
+        }
+
+        spinlock_release(&monLock);
+    }
 }
 
 /**
@@ -209,6 +286,7 @@ monitorStop(MXS_MONITOR *monitor)
     {
         monitor->state = MONITOR_STATE_STOPPING;
         monitor->module->stopMonitor(monitor);
+        mon_probes_free(monitor);
         monitor->state = MONITOR_STATE_STOPPED;
 
         MXS_MONITOR_SERVERS* db = monitor->databases;
@@ -272,6 +350,11 @@ bool monitorAddServer(MXS_MONITOR *mon, SERVER *server)
         db->mon_prev_status = -1;
         /* pending status is updated by get_replication_tree */
         db->pending_status = 0;
+        db->status_vars = NULL;
+        db->n_status_vars = 0;
+        db->status_round = 0;
+        db->questions = 0;
+        db->questions_time = 0;
 
         monitor_state_t old_state = mon->state;
 
@@ -314,6 +397,7 @@ static void monitor_server_free(MXS_MONITOR_SERVERS *tofree)
         {
             mysql_close(tofree->con);
         }
+        mon_clear_status(tofree);
         MXS_FREE(tofree);
     }
 }
@@ -461,6 +545,8 @@ monitorShow(DCB *dcb, MXS_MONITOR *monitor)
     dcb_printf(dcb, "Connect Timeout:   %i seconds\n", monitor->connect_timeout);
     dcb_printf(dcb, "Read Timeout:      %i seconds\n", monitor->read_timeout);
     dcb_printf(dcb, "Write Timeout:     %i seconds\n", monitor->write_timeout);
+    dcb_printf(dcb, "Load metrics:      %s\n", monitor->load_metrics ? "Yes" : "No");
+    dcb_printf(dcb, "Journal max age:   %d seconds\n", monitor->journal_max_age);
     dcb_printf(dcb, "Monitored servers: ");
 
     const char *sep = "";
@@ -1296,6 +1382,9 @@ static bool create_monitor_config(const MXS_MONITOR *monitor, const char *filena
         dprintf(file, "backend_connect_timeout=%d\n", monitor->connect_timeout);
         dprintf(file, "backend_write_timeout=%d\n", monitor->write_timeout);
         dprintf(file, "backend_read_timeout=%d\n", monitor->read_timeout);
+        dprintf(file, "load_metrics=%s\n", monitor->load_metrics ? "true" : "false");
+        dprintf(file, "server_variables=%s\n", monitor->server_variables ? monitor->server_variables : "");
+        dprintf(file, "journal_max_age=%d\n", monitor->journal_max_age);
     }
 
     if (monitor->databases)
@@ -1367,6 +1456,384 @@ void mon_hangup_failed_servers(MXS_MONITOR *monitor)
     }
 }
 
+/**
+ * Free the status variables of a server
+ *
+ * @param db The server
+ */
+static void mon_clear_status(MXS_MONITOR_SERVERS *db)
+{
+    for (int i = 0; i < db->n_status_vars; i++)
+    {
+        MXS_FREE(db->status_vars[i].name);
+        MXS_FREE(db->status_vars[i].value);
+    }
+
+    MXS_FREE(db->status_vars);
+    db->status_vars = NULL;
+    db->n_status_vars = 0;
+}
+
+bool mon_fetch_status(MXS_MONITOR *monitor, MXS_MONITOR_SERVERS *db, const char * const *names)
+{
+    size_t len = sizeof("SHOW GLOBAL STATUS WHERE Variable_name IN ()");
+    int n_names = 0;
+
+    for (; names[n_names]; n_names++)
+    {
+        len += strlen(names[n_names]) + sizeof("'', ");
+    }
+
+    char query[len];
+    char *ptr = query + sprintf(query, "SHOW GLOBAL STATUS WHERE Variable_name IN (");
+
+    for (int i = 0; i < n_names; i++)
+    {
+        ptr += sprintf(ptr, "%s'%s'", i > 0 ? ", " : "", names[i]);
+    }
+
+    strcpy(ptr, ")");
+
+    mon_clear_status(db);
+
+    MYSQL_RES *result;
+
+    if (mxs_mysql_query(db->con, query) != 0 || (result = mysql_store_result(db->con)) == NULL)
+    {
+        mon_report_query_error(db);
+        return false;
+    }
+
+    bool rval = false;
+
+    if (mysql_num_fields(result) != 2)
+    {
+        MXS_ERROR("Unexpected result for \"%s\" on server '%s'. Expected 2 columns.",
+                  query, db->server->unique_name);
+    }
+    else if ((db->status_vars = MXS_CALLOC(mysql_num_rows(result) + 1, sizeof(MXS_MON_STATUS_VAR))))
+    {
+        MYSQL_ROW row;
+        rval = true;
+
+        while ((row = mysql_fetch_row(result)))
+        {
+            if (row[0] && row[1])
+            {
+                MXS_MON_STATUS_VAR *var = &db->status_vars[db->n_status_vars];
+
+                if ((var->name = MXS_STRDUP(row[0])) == NULL ||
+                    (var->value = MXS_STRDUP(row[1])) == NULL)
+                {
+                    MXS_FREE(var->name);
+                    var->name = NULL;
+                    rval = false;
+                    break;
+                }
+
+                db->n_status_vars++;
+            }
+        }
+    }
+
+    mysql_free_result(result);
+
+    if (rval)
+    {
+        db->status_round = monitor->round;
+    }
+    else
+    {
+        mon_clear_status(db);
+    }
+
+    return rval;
+}
+
+const char* mon_get_status(const MXS_MONITOR *monitor, const MXS_MONITOR_SERVERS *db,
+                           const char *name)
+{
+    if (db->status_round == monitor->round)
+    {
+        for (int i = 0; i < db->n_status_vars; i++)
+        {
+            if (strcasecmp(db->status_vars[i].name, name) == 0)
+            {
+                return db->status_vars[i].value;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+void mon_update_load_metrics(MXS_MONITOR *monitor, MXS_MONITOR_SERVERS *db)
+{
+    if (!monitor->load_metrics)
+    {
+        /** The metrics of a monitor whose sampling was disabled are not left stale */
+        mon_reset_load_metrics(db);
+        return;
+    }
+
+    static const char * const names[] = {MXS_MON_LOAD_METRICS_STATUS, NULL};
+
+    /** Questions exists on all servers, it tells whether the monitor fetched the metrics */
+    if (mon_get_status(monitor, db, "Questions") == NULL &&
+        !mon_fetch_status(monitor, db, names))
+    {
+        mon_reset_load_metrics(db);
+        return;
+    }
+
+    SERVER_LOAD_METRICS metrics = {MXS_LOAD_METRIC_UNDEFINED, MXS_LOAD_METRIC_UNDEFINED,
+                                   MXS_LOAD_METRIC_UNDEFINED, MXS_LOAD_METRIC_UNDEFINED
+                                  };
+    const char *value = mon_get_status(monitor, db, "Questions");
+    int64_t questions = value ? strtoll(value, NULL, 10) : -1;
+
+    if ((value = mon_get_status(monitor, db, "Threads_running")))
+    {
+        /** The thread that runs the monitor's queries is not load */
+        metrics.threads_running = MXS_MAX(atoi(value) - 1, 0);
+    }
+
+    if ((value = mon_get_status(monitor, db, "Innodb_row_lock_current_waits")))
+    {
+        metrics.row_lock_waits = atoi(value);
+    }
+
+    int64_t now = mxs_clock_ms();
+
+    if (questions >= 0)
+    {
+        if (db->questions_time > 0 && now > db->questions_time && questions >= db->questions)
+        {
+            metrics.qps = (questions - db->questions) * 1000 / (now - db->questions_time);
+        }
+        else
+        {
+            /** The first sample or a restarted server, keep the previous rate */
+            metrics.qps = db->server->load_metrics.qps;
+        }
+
+        db->questions = questions;
+        db->questions_time = now;
+    }
+    else
+    {
+        db->questions_time = 0;
+    }
+
+    db->server->load_metrics = metrics;
+}
+
+void mon_reset_load_metrics(MXS_MONITOR_SERVERS *db)
+{
+    db->questions_time = 0;
+    server_clear_load_metrics(db->server);
+}
+
+/** Check that a name only has characters that need no quoting */
+static bool is_variable_name(const char *name, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        if (!isalnum(name[i]) && name[i] != '_')
+        {
+            return false;
+        }
+    }
+
+    return len > 0;
+}
+
+bool mon_set_server_variables(MXS_MONITOR *monitor, const char *value)
+{
+    char *names = MXS_MALLOC(strlen(value) + 1);
+
+    if (names == NULL)
+    {
+        return false;
+    }
+
+    /** The names are stored without the whitespace */
+    char *dest = names;
+    const char *ptr = value;
+
+    while (*ptr)
+    {
+        while (isspace(*ptr))
+        {
+            ptr++;
+        }
+
+        size_t len = strcspn(ptr, ",");
+        size_t end = len;
+
+        while (end > 0 && isspace(ptr[end - 1]))
+        {
+            end--;
+        }
+
+        if (!is_variable_name(ptr, end))
+        {
+            MXS_ERROR("Invalid variable name in 'server_variables' of monitor '%s': %.*s",
+                      monitor->name, (int)len, ptr);
+            MXS_FREE(names);
+            return false;
+        }
+
+        if (dest != names)
+        {
+            *dest++ = ',';
+        }
+
+        memcpy(dest, ptr, end);
+        dest += end;
+        ptr += len;
+
+        if (*ptr == ',')
+        {
+            ptr++;
+        }
+    }
+
+    *dest = '\0';
+
+    if (*names == '\0')
+    {
+        MXS_FREE(names);
+        names = NULL;
+    }
+
+    MXS_FREE(monitor->server_variables);
+    monitor->server_variables = names;
+
+    /** The servers do not keep the variables of the previous list */
+    for (MXS_MONITOR_SERVERS *db = monitor->databases; db; db = db->next)
+    {
+        server_set_variables(db->server, NULL, 0, 0);
+    }
+
+    return true;
+}
+
+/**
+ * Look up the ID of a collation
+ *
+ * @param db   The server
+ * @param name Name of the collation
+ * @return The ID or 0 if it was not found
+ */
+static int mon_get_collation_id(MXS_MONITOR_SERVERS *db, const char *name)
+{
+    if (!is_variable_name(name, strlen(name)))
+    {
+        return 0;
+    }
+
+    char query[strlen(name) + 100];
+    sprintf(query, "SELECT ID FROM information_schema.COLLATIONS WHERE COLLATION_NAME = '%s'", name);
+
+    MYSQL_RES *result;
+    int rval = 0;
+
+    if (mxs_mysql_query(db->con, query) != 0 || (result = mysql_store_result(db->con)) == NULL)
+    {
+        mon_report_query_error(db);
+        return 0;
+    }
+
+    MYSQL_ROW row = mysql_fetch_row(result);
+
+    if (row && row[0])
+    {
+        rval = atoi(row[0]);
+    }
+
+    mysql_free_result(result);
+    return rval;
+}
+
+void mon_update_server_variables(MXS_MONITOR *monitor, MXS_MONITOR_SERVERS *db)
+{
+    const char *names = monitor->server_variables;
+
+    if (names == NULL)
+    {
+        return;
+    }
+
+    int n_names = 1;
+
+    for (const char *ptr = names; *ptr; ptr++)
+    {
+        if (*ptr == ',')
+        {
+            n_names++;
+        }
+    }
+
+    char query[sizeof("SHOW GLOBAL VARIABLES WHERE Variable_name IN ()") + strlen(names) + n_names * 4];
+    char *ptr = query + sprintf(query, "SHOW GLOBAL VARIABLES WHERE Variable_name IN (");
+
+    for (const char *name = names; *name;)
+    {
+        size_t len = strcspn(name, ",");
+        ptr += sprintf(ptr, "%s'%.*s'", name != names ? ", " : "", (int)len, name);
+        name += name[len] ? len + 1 : len;
+    }
+
+    strcpy(ptr, ")");
+
+    MYSQL_RES *result;
+
+    if (mxs_mysql_query(db->con, query) != 0 || (result = mysql_store_result(db->con)) == NULL)
+    {
+        mon_report_query_error(db);
+        server_set_variables(db->server, NULL, 0, 0);
+        return;
+    }
+
+    SERVER_VARIABLE *vars = NULL;
+    int n_vars = 0;
+    const char *collation = NULL;
+
+    if (mysql_num_fields(result) == 2 &&
+        (vars = MXS_CALLOC(mysql_num_rows(result) + 1, sizeof(SERVER_VARIABLE))))
+    {
+        MYSQL_ROW row;
+
+        while ((row = mysql_fetch_row(result)))
+        {
+            if (row[0] && row[1])
+            {
+                SERVER_VARIABLE *var = &vars[n_vars];
+
+                if ((var->name = MXS_STRDUP(row[0])) == NULL ||
+                    (var->value = MXS_STRDUP(row[1])) == NULL)
+                {
+                    MXS_FREE(var->name);
+                    break;
+                }
+
+                if (strcasecmp(var->name, "collation_server") == 0)
+                {
+                    collation = var->value;
+                }
+
+                n_vars++;
+            }
+        }
+    }
+
+    mysql_free_result(result);
+
+    int collation_id = collation ? mon_get_collation_id(db, collation) : 0;
+    server_set_variables(db->server, vars, n_vars, collation_id);
+}
+
 void mon_report_query_error(MXS_MONITOR_SERVERS* db)
 {
     MXS_ERROR("Failed to execute query on server '%s' ([%s]:%d): %s",
@@ -1382,6 +1849,8 @@ void mon_report_query_error(MXS_MONITOR_SERVERS* db)
 void lock_monitor_servers(MXS_MONITOR *monitor)
 {
     MXS_MONITOR_SERVERS *ptr = monitor->databases;
+    monitor->round++;
+
     while (ptr)
     {
         spinlock_acquire(&ptr->server->lock);
@@ -1390,12 +1859,32 @@ void lock_monitor_servers(MXS_MONITOR *monitor)
 }
 /**
   * Release locks on all servers monitored by this monitor. There should
-  * only be max 1 monitor per server.
+  * only be max 1 monitor per server. The state of the servers is published
+  * in a new server snapshot before the locks are released.
   * @param monitor The target monitor
   */
 void release_monitor_servers(MXS_MONITOR *monitor)
 {
     MXS_MONITOR_SERVERS *ptr = monitor->databases;
+    int n_servers = 0;
+
+    for (ptr = monitor->databases; ptr; ptr = ptr->next)
+    {
+        n_servers++;
+    }
+
+    SERVER *servers[n_servers + 1];
+    n_servers = 0;
+
+    for (ptr = monitor->databases; ptr; ptr = ptr->next)
+    {
+        servers[n_servers++] = ptr->server;
+    }
+
+    mon_journal_store(monitor);
+    server_snapshot_publish(servers, n_servers);
+
+    ptr = monitor->databases;
     while (ptr)
     {
         spinlock_release(&ptr->server->lock);
@@ -1436,10 +1925,13 @@ void servers_status_current_to_pending(MXS_MONITOR *monitor)
 
 void mon_process_state_changes(MXS_MONITOR *monitor, const char *script, uint64_t events)
 {
+    bool changed = false;
+
     for (MXS_MONITOR_SERVERS *ptr = monitor->databases; ptr; ptr = ptr->next)
     {
         if (mon_status_changed(ptr))
         {
+            changed = true;
             mon_log_state_change(ptr);
 
             if (script && (events & mon_get_event_type(ptr)))
@@ -1448,4 +1940,405 @@ void mon_process_state_changes(MXS_MONITOR *monitor, const char *script, uint64_
             }
         }
     }
+
+    if (changed)
+    {
+        server_status_changed();
+    }
+}
+
+/**
+ * The threads that probe the servers of a monitor. The monitor thread hands
+ * out a round of probes and waits until all of them are done.
+ */
+typedef struct mxs_monitor_probes
+{
+    MXS_MONITOR         *monitor;
+    pthread_mutex_t     lock;
+    pthread_cond_t      work_cond;  /**< Signalled when a round starts or on shutdown */
+    pthread_cond_t      done_cond;  /**< Signalled when the last probe of a round is done */
+    void (*probe)(MXS_MONITOR*, MXS_MONITOR_SERVERS*); /**< The probe of the current round */
+    MXS_MONITOR_SERVERS *next;      /**< The next server to probe in this round */
+    int                 pending;    /**< Probes of this round that are not done */
+    bool                shutdown;
+    int                 n_threads;
+    THREAD              threads[MXS_MON_PROBE_THREADS_MAX];
+} MXS_MONITOR_PROBES;
+
+/**
+ * The main loop of a probing thread
+ *
+ * @param arg The probing threads of the monitor
+ */
+static void mon_probe_main(void *arg)
+{
+    MXS_MONITOR_PROBES *probes = (MXS_MONITOR_PROBES*)arg;
+    bool thread_init = mysql_thread_init() == 0;
+
+    if (!thread_init)
+    {
+        MXS_ERROR("mysql_thread_init failed in a probing thread of monitor '%s'.",
+                  probes->monitor->name);
+    }
+
+    pthread_mutex_lock(&probes->lock);
+
+    while (!probes->shutdown)
+    {
+        MXS_MONITOR_SERVERS *db = probes->next;
+
+        if (db == NULL || !thread_init)
+        {
+            pthread_cond_wait(&probes->work_cond, &probes->lock);
+            continue;
+        }
+
+        probes->next = db->next;
+        pthread_mutex_unlock(&probes->lock);
+
+        probes->probe(probes->monitor, db);
+
+        pthread_mutex_lock(&probes->lock);
+
+        if (--probes->pending == 0)
+        {
+            pthread_cond_signal(&probes->done_cond);
+        }
+    }
+
+    pthread_mutex_unlock(&probes->lock);
+
+    if (thread_init)
+    {
+        mysql_thread_end();
+    }
+}
+
+/**
+ * Stop the probing threads of a monitor. To be called once the monitor
+ * thread has stopped.
+ *
+ * @param monitor Monitor object
+ */
+static void mon_probes_free(MXS_MONITOR *monitor)
+{
+    MXS_MONITOR_PROBES *probes = monitor->probes;
+
+    if (probes)
+    {
+        pthread_mutex_lock(&probes->lock);
+        probes->shutdown = true;
+        pthread_cond_broadcast(&probes->work_cond);
+        pthread_mutex_unlock(&probes->lock);
+
+        for (int i = 0; i < probes->n_threads; i++)
+        {
+            thread_wait(probes->threads[i]);
+        }
+
+        pthread_mutex_destroy(&probes->lock);
+        pthread_cond_destroy(&probes->work_cond);
+        pthread_cond_destroy(&probes->done_cond);
+        MXS_FREE(probes);
+        monitor->probes = NULL;
+    }
+}
+
+void mon_probe_servers(MXS_MONITOR *monitor, void (*probe)(MXS_MONITOR*, MXS_MONITOR_SERVERS*))
+{
+    int n_servers = 0;
+
+    for (MXS_MONITOR_SERVERS *db = monitor->databases; db; db = db->next)
+    {
+        n_servers++;
+    }
+
+    if (monitor->probes == NULL && n_servers > 1 &&
+        (monitor->probes = MXS_CALLOC(1, sizeof(MXS_MONITOR_PROBES))))
+    {
+        monitor->probes->monitor = monitor;
+        pthread_mutex_init(&monitor->probes->lock, NULL);
+        pthread_cond_init(&monitor->probes->work_cond, NULL);
+        pthread_cond_init(&monitor->probes->done_cond, NULL);
+    }
+
+    MXS_MONITOR_PROBES *probes = monitor->probes;
+
+    /** Servers can be added at runtime, start more threads if needed */
+    while (probes && probes->n_threads < MXS_MIN(n_servers, MXS_MON_PROBE_THREADS_MAX))
+    {
+        if (thread_start(&probes->threads[probes->n_threads], mon_probe_main, probes) == NULL)
+        {
+            MXS_ERROR("Failed to start a probing thread for monitor '%s'.", monitor->name);
+            break;
+        }
+
+        probes->n_threads++;
+    }
+
+    if (probes == NULL || probes->n_threads == 0)
+    {
+        /** Probe the servers one by one */
+        for (MXS_MONITOR_SERVERS *db = monitor->databases; db; db = db->next)
+        {
+            probe(monitor, db);
+        }
+
+        return;
+    }
+
+    pthread_mutex_lock(&probes->lock);
+    probes->probe = probe;
+    probes->next = monitor->databases;
+    probes->pending = n_servers;
+    pthread_cond_broadcast(&probes->work_cond);
+
+    while (probes->pending > 0)
+    {
+        pthread_cond_wait(&probes->done_cond, &probes->lock);
+    }
+
+    pthread_mutex_unlock(&probes->lock);
+}
+
+/**
+ * The journal of a monitor
+ *
+ * The journal holds the last known state of the servers of a monitor so that
+ * the routers can use the servers as soon as MaxScale has started instead of
+ * waiting for the first monitoring round. It is rewritten whenever the
+ * topology changes and the first round after the load confirms or corrects
+ * the state it held.
+ *
+ * The journal is a text file with one line per server:
+ *
+ *     <status> <node_id> <master_id> <depth> <rlag> <rlag_ms> <server name>
+ *
+ * preceded by a line with the version of the format and the time when the
+ * journal was written.
+ */
+
+/** The version of the journal format */
+#define MON_JOURNAL_VERSION 1
+
+/** The status bits that are stored in the journal, maintenance is never stored */
+#define MON_JOURNAL_STATUS (SERVER_RUNNING | SERVER_MASTER | SERVER_SLAVE | SERVER_JOINED | \
+                            SERVER_NDB | SERVER_SLAVE_OF_EXTERNAL_MASTER | \
+                            SERVER_STALE_STATUS | SERVER_STALE_SLAVE | SERVER_RELAY_MASTER)
+
+/**
+ * Get the path of the journal of a monitor
+ *
+ * @param monitor The monitor
+ * @param path    Buffer of PATH_MAX bytes where the path is stored
+ * @param tmp     Whether the path of the temporary file is wanted
+ */
+static void mon_journal_path(const MXS_MONITOR *monitor, char *path, bool tmp)
+{
+    snprintf(path, PATH_MAX, "%s/%s/monitor.journal%s", get_datadir(), monitor->name,
+             tmp ? ".tmp" : "");
+}
+
+/**
+ * Hash the parts of the server state that make up the topology
+ *
+ * The replication lag is not included, it changes on every round.
+ *
+ * @param monitor The monitor
+ * @return The hash of the topology
+ */
+static uint64_t mon_journal_hash(const MXS_MONITOR *monitor)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (MXS_MONITOR_SERVERS *db = monitor->databases; db; db = db->next)
+    {
+        int64_t values[] =
+        {
+            db->server->status & MON_JOURNAL_STATUS, db->server->node_id,
+            db->server->master_id, db->server->depth
+        };
+        const unsigned char *bytes = (const unsigned char*)values;
+
+        for (size_t i = 0; i < sizeof(values); i++)
+        {
+            hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+        }
+    }
+
+    return hash;
+}
+
+/**
+ * Write the journal of a monitor if the topology has changed
+ *
+ * The journal is written to a temporary file that is then renamed over the old
+ * journal so that a crash never leaves a partial journal behind. The
+ * caller must hold the locks of the servers.
+ *
+ * @param monitor The monitor
+ */
+static void mon_journal_store(MXS_MONITOR *monitor)
+{
+    uint64_t hash = mon_journal_hash(monitor);
+
+    if (monitor->journal_max_age == 0 || monitor->databases == NULL ||
+        hash == monitor->journal_hash)
+    {
+        return;
+    }
+
+    char path[PATH_MAX + 1];
+    char tmp[PATH_MAX + 1];
+    char errbuf[MXS_STRERROR_BUFLEN];
+
+    mon_journal_path(monitor, path, false);
+    mon_journal_path(monitor, tmp, true);
+
+    char *dir = strrchr(tmp, '/');
+    *dir = '\0';
+    bool have_dir = mxs_mkdir_all(tmp, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
+    *dir = '/';
+
+    if (!have_dir)
+    {
+        /** The error is logged by mxs_mkdir_all */
+        monitor->journal_hash = hash;
+        return;
+    }
+
+    FILE *file = fopen(tmp, "w");
+
+    if (file == NULL)
+    {
+        MXS_ERROR("Failed to open journal file '%s' of monitor '%s': %d, %s", tmp,
+                  monitor->name, errno, strerror_r(errno, errbuf, sizeof(errbuf)));
+        monitor->journal_hash = hash;
+        return;
+    }
+
+    fprintf(file, "%d %ld\n", MON_JOURNAL_VERSION, (long)time(NULL));
+
+    for (MXS_MONITOR_SERVERS *db = monitor->databases; db; db = db->next)
+    {
+        SERVER *server = db->server;
+        fprintf(file, "%u %ld %ld %d %d %d %s\n", server->status & MON_JOURNAL_STATUS,
+                server->node_id, server->master_id, server->depth, server->rlag,
+                server->rlag_ms, server->unique_name);
+    }
+
+    bool ok = !ferror(file);
+
+    if (fclose(file) != 0 || !ok || rename(tmp, path) != 0)
+    {
+        MXS_ERROR("Failed to write journal file '%s' of monitor '%s': %d, %s", path,
+                  monitor->name, errno, strerror_r(errno, errbuf, sizeof(errbuf)));
+        unlink(tmp);
+    }
+
+    /** A failed write is not retried until the topology changes again */
+    monitor->journal_hash = hash;
+}
+
+/**
+ * Load the journal of a monitor
+ *
+ * The servers of the monitor get the state stored in the journal unless the
+ * journal is older than journal_max_age. Servers that are not in the journal
+ * and the servers in maintenance are not changed.
+ *
+ * @param monitor The monitor
+ */
+static void mon_journal_load(MXS_MONITOR *monitor)
+{
+    if (monitor->journal_max_age == 0 || monitor->databases == NULL)
+    {
+        return;
+    }
+
+    char path[PATH_MAX + 1];
+    mon_journal_path(monitor, path, false);
+
+    FILE *file = fopen(path, "r");
+
+    if (file == NULL)
+    {
+        if (errno != ENOENT)
+        {
+            char errbuf[MXS_STRERROR_BUFLEN];
+            MXS_ERROR("Failed to open journal file '%s' of monitor '%s': %d, %s", path,
+                      monitor->name, errno, strerror_r(errno, errbuf, sizeof(errbuf)));
+        }
+        return;
+    }
+
+    int version;
+    long written;
+
+    if (fscanf(file, "%d %ld\n", &version, &written) != 2 || version != MON_JOURNAL_VERSION)
+    {
+        MXS_WARNING("Journal file '%s' of monitor '%s' is not valid, ignoring it.",
+                    path, monitor->name);
+        fclose(file);
+        return;
+    }
+
+    long age = (long)time(NULL) - written;
+
+    if (age > monitor->journal_max_age)
+    {
+        MXS_NOTICE("Journal file '%s' of monitor '%s' is %ld seconds old, ignoring it.",
+                   path, monitor->name, age);
+        fclose(file);
+        return;
+    }
+
+    lock_monitor_servers(monitor);
+
+    char line[PATH_MAX + 256];
+    int n_loaded = 0;
+
+    while (fgets(line, sizeof(line), file))
+    {
+        unsigned int status;
+        long node_id, master_id;
+        int depth, rlag, rlag_ms, name_start;
+
+        line[strcspn(line, "\n")] = '\0';
+
+        if (sscanf(line, "%u %ld %ld %d %d %d %n", &status, &node_id, &master_id, &depth,
+                   &rlag, &rlag_ms, &name_start) != 6)
+        {
+            continue;
+        }
+
+        for (MXS_MONITOR_SERVERS *db = monitor->databases; db; db = db->next)
+        {
+            SERVER *server = db->server;
+
+            if (strcmp(server->unique_name, line + name_start) == 0 && !SERVER_IN_MAINT(server))
+            {
+                server->status = (server->status & ~MON_JOURNAL_STATUS) |
+                                 (status & MON_JOURNAL_STATUS);
+                server->status_pending = server->status;
+                server->node_id = node_id;
+                server->master_id = master_id;
+                server->depth = depth;
+                server->rlag = rlag;
+                server->rlag_ms = rlag_ms;
+                n_loaded++;
+                break;
+            }
+        }
+    }
+
+    fclose(file);
+
+    /** The state that was loaded does not need to be written again */
+    monitor->journal_hash = mon_journal_hash(monitor);
+    server_status_changed();
+    release_monitor_servers(monitor);
+
+    MXS_NOTICE("Loaded the state of %d servers of monitor '%s' from a journal written "
+               "%ld seconds ago.", n_loaded, monitor->name, age);
 }
@@ -0,0 +1,583 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file mysql_async.c - Non-blocking queries to the backend servers
+ *
+ * A query is executed in one polling thread from start to end. The connector
+ * is used in its non-blocking mode: each step returns the events the
+ * connector waits for, the socket of the connection is watched by the
+ * polling thread and the step is continued when the events arrive.
+ *
+ * All the state is thread-specific so no locking is needed. A connection
+ * that is no longer used is freed only after the current poll cycle as the
+ * thread may still have events for it.
+ */
+
+#include <maxscale/mysql_async.h>
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <errmsg.h>
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/config.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/platform.h>
+#include <maxscale/utils.h>
+#include "maxscale/poll.h"
+
+/** Seconds after which an unused connection is closed */
+#define ASYNC_IDLE_TIMEOUT 60
+
+/** Maximum number of unused connections kept by a thread */
+#define ASYNC_MAX_IDLE 16
+
+/** How often the timeouts are checked, in milliseconds */
+#define ASYNC_TICK_INTERVAL 1000
+
+typedef enum
+{
+    ASYNC_CONNECTING, /*< Connecting and authenticating */
+    ASYNC_QUERYING,   /*< Sending the query and reading the response */
+    ASYNC_STORING,    /*< Reading the result set */
+    ASYNC_IDLE,       /*< Waiting for the next query */
+    ASYNC_CLOSED      /*< Waiting to be freed */
+} async_state_t;
+
+struct async_conn;
+
+typedef struct async_query
+{
+    SERVER              *server;
+    char                *user;
+    char                *password;
+    char                *sql;
+    int                 timeout;   /*< Timeout in seconds */
+    mxs_async_cb        cb;
+    void                *data;
+    uint64_t            deadline;  /*< When the query times out, in milliseconds */
+    bool                retried;   /*< Whether the query was retried on a new connection */
+    struct async_conn   *conn;     /*< The connection executing the query */
+    struct async_query  *next;     /*< The next active query of the thread */
+} ASYNC_QUERY;
+
+typedef struct async_conn
+{
+    POLL_WATCH          watch;      /*< The watch of the socket, must be the first member */
+    MYSQL               *mysql;
+    SERVER              *server;
+    char                *user;
+    async_state_t       state;
+    int                 wait;       /*< The MYSQL_WAIT_ events the connector waits for */
+    bool                watched;    /*< Whether the socket is watched */
+    bool                reused;     /*< Whether the connection was taken from the pool */
+    bool                aborted;    /*< Whether an operation was interrupted */
+    uint64_t            idle_since; /*< When the connection became unused, in milliseconds */
+    ASYNC_QUERY         *query;     /*< The query being executed */
+    struct async_conn   *next;      /*< The next unused connection of the thread */
+} ASYNC_CONN;
+
+static thread_local ASYNC_CONN *idle_conns = NULL;
+static thread_local int n_idle_conns = 0;
+static thread_local ASYNC_QUERY *active_queries = NULL;
+static thread_local bool ticking = false;
+static thread_local bool thread_initialized = false;
+static int next_thread = 0;
+
+static void async_advance(ASYNC_CONN *conn, int status);
+static void async_query_start(ASYNC_QUERY *query);
+
+static void async_query_free(ASYNC_QUERY *query)
+{
+    if (query->password)
+    {
+        memset(query->password, 0, strlen(query->password));
+    }
+
+    MXS_FREE(query->user);
+    MXS_FREE(query->password);
+    MXS_FREE(query->sql);
+    MXS_FREE(query);
+}
+
+static void async_conn_free(void *data)
+{
+    ASYNC_CONN *conn = (ASYNC_CONN*)data;
+
+    if (conn->aborted)
+    {
+        /** The connector must not wait for the interrupted operation */
+        shutdown(mysql_get_socket(conn->mysql), SHUT_RDWR);
+    }
+
+    mysql_close(conn->mysql);
+    MXS_FREE(conn->user);
+    MXS_FREE(conn);
+}
+
+static void async_unwatch(ASYNC_CONN *conn)
+{
+    if (conn->watched)
+    {
+        poll_remove_watch(&conn->watch);
+        conn->watched = false;
+    }
+}
+
+/**
+ * @brief Close a connection after the current poll cycle
+ */
+static void async_conn_close(ASYNC_CONN *conn)
+{
+    async_unwatch(conn);
+    conn->state = ASYNC_CLOSED;
+    conn->query = NULL;
+
+    if (!poll_call_in_thread(current_thread_id, async_conn_free, conn))
+    {
+        async_conn_free(conn);
+    }
+}
+
+/**
+ * @brief Call the callback of a query and free it
+ */
+static void async_query_complete(ASYNC_QUERY *query, MYSQL_RES *res, uint64_t affected_rows,
+                                 unsigned int errnum, const char *errmsg)
+{
+    for (ASYNC_QUERY **link = &active_queries; *link; link = &(*link)->next)
+    {
+        if (*link == query)
+        {
+            *link = query->next;
+            break;
+        }
+    }
+
+    MXS_ASYNC_RESULT result;
+    result.server = query->server;
+    result.result = res;
+    result.affected_rows = affected_rows;
+    result.errnum = errnum;
+    result.errmsg = errmsg;
+
+    query->cb(&result, query->data);
+
+    if (res)
+    {
+        mysql_free_result(res);
+    }
+
+    async_query_free(query);
+}
+
+/**
+ * @brief Put a connection into the pool of the thread
+ */
+static void async_conn_release(ASYNC_CONN *conn)
+{
+    conn->query = NULL;
+
+    if (n_idle_conns < ASYNC_MAX_IDLE)
+    {
+        async_unwatch(conn);
+        conn->state = ASYNC_IDLE;
+        conn->idle_since = mxs_clock_ms();
+        conn->next = idle_conns;
+        idle_conns = conn;
+        n_idle_conns++;
+    }
+    else
+    {
+        async_conn_close(conn);
+    }
+}
+
+/**
+ * @brief Take an unused connection to a server from the pool of the thread
+ */
+static ASYNC_CONN* async_conn_take(SERVER *server, const char *user)
+{
+    for (ASYNC_CONN **link = &idle_conns; *link; link = &(*link)->next)
+    {
+        ASYNC_CONN *conn = *link;
+
+        if (conn->server == server && strcmp(conn->user, user) == 0)
+        {
+            *link = conn->next;
+            conn->next = NULL;
+            n_idle_conns--;
+            return conn;
+        }
+    }
+
+    return NULL;
+}
+
+static ASYNC_CONN* async_conn_create(ASYNC_QUERY *query)
+{
+    ASYNC_CONN *conn = MXS_CALLOC(1, sizeof(ASYNC_CONN));
+    char *user = MXS_STRDUP(query->user);
+
+    if (conn == NULL || user == NULL || (conn->mysql = mysql_init(NULL)) == NULL)
+    {
+        MXS_FREE(conn);
+        MXS_FREE(user);
+        return NULL;
+    }
+
+    mysql_options(conn->mysql, MYSQL_OPT_NONBLOCK, 0);
+    mysql_optionsv(conn->mysql, MYSQL_INIT_COMMAND, "SET SQL_MODE=''");
+
+    SSL_LISTENER *listener = query->server->server_ssl;
+
+    if (listener)
+    {
+        mysql_ssl_set(conn->mysql, listener->ssl_key, listener->ssl_cert, listener->ssl_ca_cert, NULL, NULL);
+    }
+
+    const char *local_address = config_get_global_options()->local_address;
+
+    if (local_address && mysql_optionsv(conn->mysql, MYSQL_OPT_BIND, local_address) != 0)
+    {
+        MXS_ERROR("'local_address' specified in configuration file, but could not "
+                  "configure MYSQL handle. MaxScale will try to connect using default "
+                  "address.");
+    }
+
+    conn->server = query->server;
+    conn->user = user;
+    conn->state = ASYNC_CONNECTING;
+    return conn;
+}
+
+/**
+ * @brief End the current query of a connection with the error of the connection
+ *
+ * A query that failed on a connection taken from the pool because the server
+ * had closed it is retried once on a new connection.
+ */
+static void async_conn_fail(ASYNC_CONN *conn, unsigned int errnum, const char *errmsg)
+{
+    ASYNC_QUERY *query = conn->query;
+    char msg[512];
+
+    snprintf(msg, sizeof(msg), "%s", errmsg);
+    bool retry = conn->reused && !query->retried &&
+                 (errnum == CR_SERVER_GONE_ERROR || errnum == CR_SERVER_LOST);
+
+    query->conn = NULL;
+    async_conn_close(conn);
+
+    if (retry)
+    {
+        query->retried = true;
+        async_query_start(query);
+    }
+    else
+    {
+        async_query_complete(query, NULL, 0, errnum, msg);
+    }
+}
+
+/**
+ * @brief Called by the polling thread for the events of a connection
+ */
+static void async_handle_events(POLL_WATCH *watch, uint32_t events)
+{
+    ASYNC_CONN *conn = (ASYNC_CONN*)watch;
+    int status = 0;
+
+    if (events & EPOLLIN)
+    {
+        status |= MYSQL_WAIT_READ;
+    }
+
+    if (events & EPOLLOUT)
+    {
+        status |= MYSQL_WAIT_WRITE;
+    }
+
+    if (events & (EPOLLERR | EPOLLHUP))
+    {
+        status |= MYSQL_WAIT_READ | MYSQL_WAIT_WRITE | MYSQL_WAIT_EXCEPT;
+    }
+
+    /** Events of connections that are unused or closed are stale */
+    if (conn->query && (status & conn->wait))
+    {
+        async_advance(conn, status);
+    }
+}
+
+/**
+ * @brief Wait for the events the connector needs to continue
+ */
+static void async_wait(ASYNC_CONN *conn, int wait)
+{
+    conn->wait = wait | MYSQL_WAIT_EXCEPT;
+
+    if (!conn->watched)
+    {
+        conn->watch.fd = mysql_get_socket(conn->mysql);
+        conn->watch.handler = async_handle_events;
+
+        if (!poll_add_watch(&conn->watch, current_thread_id))
+        {
+            conn->aborted = true;
+            async_conn_fail(conn, CR_SERVER_LOST, "Failed to poll the connection");
+            return;
+        }
+
+        conn->watched = true;
+    }
+}
+
+/**
+ * @brief Start or continue the current step of a query
+ *
+ * @param conn   The connection executing the query
+ * @param status The events that occurred or 0 to start the step
+ */
+static void async_advance(ASYNC_CONN *conn, int status)
+{
+    ASYNC_QUERY *query = conn->query;
+    int wait = 0;
+
+    switch (conn->state)
+    {
+    case ASYNC_CONNECTING:
+        {
+            MYSQL *ret = NULL;
+            wait = status ? mysql_real_connect_cont(&ret, conn->mysql, status) :
+                   query->server->socket ?
+                   mysql_real_connect_start(&ret, conn->mysql, "localhost", query->user,
+                                            query->password, NULL, 0, query->server->socket, 0) :
+                   mysql_real_connect_start(&ret, conn->mysql, query->server->name, query->user,
+                                            query->password, NULL, query->server->port, NULL, 0);
+            if (wait)
+            {
+                break;
+            }
+
+            if (ret == NULL)
+            {
+                async_conn_fail(conn, mysql_errno(conn->mysql), mysql_error(conn->mysql));
+                return;
+            }
+
+            conn->state = ASYNC_QUERYING;
+            status = 0;
+        }
+    /* Fallthrough */
+    case ASYNC_QUERYING:
+        {
+            int err = 0;
+            wait = status ? mysql_real_query_cont(&err, conn->mysql, status) :
+                   mysql_real_query_start(&err, conn->mysql, query->sql, strlen(query->sql));
+            if (wait)
+            {
+                break;
+            }
+
+            if (err)
+            {
+                async_conn_fail(conn, mysql_errno(conn->mysql), mysql_error(conn->mysql));
+                return;
+            }
+
+            conn->state = ASYNC_STORING;
+            status = 0;
+        }
+    /* Fallthrough */
+    case ASYNC_STORING:
+        {
+            MYSQL_RES *res = NULL;
+            wait = status ? mysql_store_result_cont(&res, conn->mysql, status) :
+                   mysql_store_result_start(&res, conn->mysql);
+            if (wait)
+            {
+                break;
+            }
+
+            if (res == NULL && mysql_field_count(conn->mysql) != 0)
+            {
+                async_conn_fail(conn, mysql_errno(conn->mysql), mysql_error(conn->mysql));
+                return;
+            }
+
+            uint64_t affected_rows = res ? 0 : mysql_affected_rows(conn->mysql);
+
+            /** The connection can be used by the queries that the callback starts */
+            query->conn = NULL;
+            async_conn_release(conn);
+            async_query_complete(query, res, affected_rows, 0, "");
+        }
+        return;
+
+    default:
+        ss_dassert(false);
+        return;
+    }
+
+    async_wait(conn, wait);
+}
+
+/**
+ * @brief Time out the queries and close the connections unused for too long
+ */
+static void async_tick(void *data)
+{
+    uint64_t now = mxs_clock_ms();
+    ASYNC_QUERY *expired = NULL;
+
+    for (ASYNC_QUERY **link = &active_queries; *link;)
+    {
+        ASYNC_QUERY *query = *link;
+
+        if (query->deadline <= now)
+        {
+            *link = query->next;
+            query->next = expired;
+            expired = query;
+        }
+        else
+        {
+            link = &query->next;
+        }
+    }
+
+    for (ASYNC_CONN **link = &idle_conns; *link;)
+    {
+        ASYNC_CONN *conn = *link;
+
+        if (now - conn->idle_since >= ASYNC_IDLE_TIMEOUT * 1000)
+        {
+            *link = conn->next;
+            n_idle_conns--;
+            async_conn_close(conn);
+        }
+        else
+        {
+            link = &conn->next;
+        }
+    }
+
+    while (expired)
+    {
+        ASYNC_QUERY *query = expired;
+        expired = query->next;
+        query->next = NULL;
+
+        if (query->conn)
+        {
+            query->conn->aborted = true;
+            async_conn_close(query->conn);
+            query->conn = NULL;
+        }
+
+        char msg[200];
+        snprintf(msg, sizeof(msg), "Query to server '%s' timed out after %d seconds",
+                 query->server->unique_name, query->timeout);
+        async_query_complete(query, NULL, 0, CR_SERVER_LOST, msg);
+    }
+
+    ticking = (active_queries || idle_conns) &&
+              poll_add_delayed_call(ASYNC_TICK_INTERVAL, async_tick, NULL);
+}
+
+/**
+ * @brief Start a query in the calling polling thread
+ */
+static void async_query_start(ASYNC_QUERY *query)
+{
+    if (!thread_initialized)
+    {
+        mysql_thread_init();
+        thread_initialized = true;
+    }
+
+    if (!query->retried)
+    {
+        query->next = active_queries;
+        active_queries = query;
+    }
+
+    if (!ticking)
+    {
+        ticking = poll_add_delayed_call(ASYNC_TICK_INTERVAL, async_tick, NULL);
+    }
+
+    ASYNC_CONN *conn = query->retried ? NULL : async_conn_take(query->server, query->user);
+
+    if (conn)
+    {
+        conn->reused = true;
+        conn->state = ASYNC_QUERYING;
+    }
+    else if ((conn = async_conn_create(query)) == NULL)
+    {
+        async_query_complete(query, NULL, 0, CR_OUT_OF_MEMORY, "Failed to create a connection");
+        return;
+    }
+
+    conn->query = query;
+    query->conn = conn;
+    async_advance(conn, 0);
+}
+
+static void async_query_start_cb(void *data)
+{
+    async_query_start((ASYNC_QUERY*)data);
+}
+
+bool mxs_async_query(SERVER *server, const char *user, const char *password,
+                     const char *sql, int timeout, mxs_async_cb cb, void *data)
+{
+    ASYNC_QUERY *query = MXS_CALLOC(1, sizeof(ASYNC_QUERY));
+
+    if (query == NULL ||
+        (query->user = MXS_STRDUP(user)) == NULL ||
+        (query->password = MXS_STRDUP(password)) == NULL ||
+        (query->sql = MXS_STRDUP(sql)) == NULL)
+    {
+        if (query)
+        {
+            async_query_free(query);
+        }
+        return false;
+    }
+
+    query->server = server;
+    query->timeout = timeout > 0 ? timeout : MXS_ASYNC_DEFAULT_TIMEOUT;
+    query->cb = cb;
+    query->data = data;
+    query->deadline = mxs_clock_ms() + (uint64_t)query->timeout * 1000;
+
+    /** Started after the current poll cycle so that the callback is never
+     * called before this function returns */
+    int thread = poll_thread ? current_thread_id :
+                 (int)((unsigned int)atomic_add(&next_thread, 1) % config_threadcount());
+
+    if (!poll_call_in_thread(thread, async_query_start_cb, query))
+    {
+        async_query_free(query);
+        return false;
+    }
+
+    return true;
+}
@@ -165,7 +165,7 @@ MYSQL *mxs_mysql_real_connect(MYSQL *con, SERVER *server, const char *user, cons
 
     MXS_CONFIG* config = config_get_global_options();
 
-    if (config->local_address)
+    if (config->local_address && server->socket == NULL)
     {
         if (mysql_optionsv(con, MYSQL_OPT_BIND, config->local_address) != 0)
         {
@@ -175,7 +175,10 @@ MYSQL *mxs_mysql_real_connect(MYSQL *con, SERVER *server, const char *user, cons
         }
     }
 
-    MYSQL* mysql = mysql_real_connect(con, server->name, user, passwd, NULL, server->port, NULL, 0);
+    /** The connector uses the socket only if the host is localhost */
+    MYSQL* mysql = server->socket ?
+                   mysql_real_connect(con, "localhost", user, passwd, NULL, 0, server->socket, 0) :
+                   mysql_real_connect(con, server->name, user, passwd, NULL, server->port, NULL, 0);
 
     if (mysql)
     {
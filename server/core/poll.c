@@ -22,15 +22,22 @@
 #include <unistd.h>
 
 #include <mysql.h>
+#include <pthread.h>
+#include <sched.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
 
 #include <maxscale/alloc.h>
 #include <maxscale/atomic.h>
 #include <maxscale/config.h>
 #include <maxscale/dcb.h>
+#include <maxscale/histogram.h>
 #include <maxscale/housekeeper.h>
+#include <maxscale/listener.h>
 #include <maxscale/log_manager.h>
 #include <maxscale/platform.h>
+#include <maxscale/probes.h>
 #include <maxscale/query_classifier.h>
 #include <maxscale/resultset.h>
 #include <maxscale/server.h>
@@ -39,7 +46,11 @@
 #include <maxscale/thread.h>
 #include <maxscale/utils.h>
 
+#include "maxscale/config.h"
+#include "maxscale/metrics.h"
 #include "maxscale/poll.h"
+#include "maxscale/poll_uring.h"
+#include "maxscale/qsbr.h"
 
 #define         PROFILE_POLL    0
 
@@ -85,28 +96,64 @@ static thread_local DCB* current_dcb;
  */
 #define MUTEX_EPOLL     0
 
+/**
+ * A node in a per-thread multi-producer, single-consumer queue. Any thread
+ * can push nodes into the queue without locking and the owning thread takes
+ * all of them at once.
+ */
+typedef struct poll_queue_node
+{
+    struct poll_queue_node *next;
+} POLL_QUEUE_NODE;
+
 /** Fake epoll event struct */
 typedef struct fake_event
 {
+    POLL_QUEUE_NODE    node;  /*< Queue node, must be the first member */
     DCB               *dcb;   /*< The DCB where this event was generated */
     GWBUF             *data;  /*< Fake data, placed in the DCB's read queue */
     uint32_t           event; /*< The EPOLL event type */
-    struct fake_event *tail;  /*< The last event */
-    struct fake_event *next;  /*< The next event */
 } fake_event_t;
 
+/** A message sent to a polling thread */
+typedef struct poll_message_item
+{
+    POLL_QUEUE_NODE    node;    /*< Queue node, must be the first member */
+    enum poll_message  msg;     /*< The message */
+    void              *data;    /*< Message data */
+    int               *pending; /*< Number of threads yet to process the message */
+} poll_message_t;
+
+/** A function call that a polling thread executes after a delay */
+typedef struct delayed_call
+{
+    uint64_t             due;             /*< When to call, in microseconds */
+    void               (*func)(void *data);
+    void                *data;
+    struct delayed_call *next;
+} delayed_call_t;
+
+/** A function call that a polling thread was asked to execute */
+typedef struct thread_call
+{
+    POLL_QUEUE_NODE    node;      /*< Queue node, must be the first member */
+    void             (*func)(void *data);
+    void              *data;
+} thread_call_t;
+
 thread_local int current_thread_id; /**< This thread's ID */
+thread_local bool poll_thread = false; /**< Whether this thread is a polling thread */
+thread_local delayed_call_t *delayed_calls = NULL; /**< The delayed calls of this thread,
+                                                    * ordered by the due time */
 static int *epoll_fd;    /*< The epoll file descriptor */
+static bool use_uring = false; /*< Whether io_uring is used instead of epoll */
 static int next_epoll_fd = 0; /*< Which thread handles the next DCB */
-static fake_event_t **fake_events; /*< Thread-specific fake event queue */
-static SPINLOCK      *fake_event_lock;
+static POLL_QUEUE_NODE **fake_events; /*< Thread-specific fake event queue */
+static POLL_QUEUE_NODE **poll_messages; /*< Thread-specific message queue */
+static POLL_QUEUE_NODE **thread_calls; /*< Thread-specific queue of function calls */
+static int *wakeup_fd; /*< Thread-specific eventfd that interrupts epoll_wait */
 static int do_shutdown = 0;  /*< Flag the shutdown of the poll subsystem */
 
-/** Poll cross-thread messaging variables */
-static volatile int     *poll_msg;
-static void    *poll_msg_data = NULL;
-static SPINLOCK poll_msg_lock = SPINLOCK_INIT;
-
 #if MUTEX_EPOLL
 static simple_mutex_t epoll_wait_mutex; /*< serializes calls to epoll_wait */
 #endif
@@ -117,6 +164,92 @@ static void poll_add_event_to_dcb(DCB* dcb, GWBUF* buf, uint32_t ev);
 static bool poll_dcb_session_check(DCB *dcb, const char *);
 static void poll_check_message(void);
 
+/**
+ * Push a node into a queue
+ *
+ * @param queue Queue to push into
+ * @param node  Node to push
+ * @return True if the queue was empty
+ */
+static bool poll_queue_push(POLL_QUEUE_NODE **queue, POLL_QUEUE_NODE *node)
+{
+    POLL_QUEUE_NODE *head = NULL;
+
+    do
+    {
+        node->next = head;
+    }
+    while (!atomic_cas_ptr((void**)queue, (void**)&head, node));
+
+    return head == NULL;
+}
+
+/**
+ * Take all nodes from a queue
+ *
+ * This must only be called by the thread that owns the queue.
+ *
+ * @param queue Queue to empty
+ * @return The nodes in the order they were pushed
+ */
+static POLL_QUEUE_NODE* poll_queue_take(POLL_QUEUE_NODE **queue)
+{
+    POLL_QUEUE_NODE *node = NULL;
+    POLL_QUEUE_NODE *rval = NULL;
+
+    /** A dirty read avoids the atomic operation when the queue is empty */
+    if (*queue)
+    {
+        node = (POLL_QUEUE_NODE*)atomic_exchange_ptr((void**)queue, NULL);
+    }
+
+    /** Nodes are pushed to the head of the list so it needs to be reversed */
+    while (node)
+    {
+        POLL_QUEUE_NODE *next = node->next;
+        node->next = rval;
+        rval = node;
+        node = next;
+    }
+
+    return rval;
+}
+
+/**
+ * Wake up a polling thread that is possibly blocked in epoll_wait
+ *
+ * @param thr Thread to wake up
+ */
+static void poll_wakeup(int thr)
+{
+    if (!poll_thread || thr != current_thread_id)
+    {
+        uint64_t value = 1;
+
+        if (write(wakeup_fd[thr], &value, sizeof(value)) == -1 && errno != EAGAIN)
+        {
+            char errbuf[MXS_STRERROR_BUFLEN];
+            MXS_ERROR("Failed to wake up thread %d: %d, %s", thr, errno,
+                      strerror_r(errno, errbuf, sizeof(errbuf)));
+        }
+    }
+}
+
+/**
+ * Clear the wakeup notification of a thread
+ *
+ * @param thr The calling thread
+ */
+static void poll_clear_wakeup(int thr)
+{
+    uint64_t value;
+
+    while (read(wakeup_fd[thr], &value, sizeof(value)) > 0)
+    {
+        ;
+    }
+}
+
 DCB *eventq = NULL;
 SPINLOCK pollqlock = SPINLOCK_INIT;
 
@@ -136,6 +269,29 @@ static int n_avg_samples;
 /* Thread statistics data */
 static int n_threads;      /*< No. of threads */
 
+/**
+ * The number of active threads. The sessions are placed on the active threads
+ * and the threads above this number move their sessions to the active
+ * threads. All n_threads threads keep running so that the per-thread
+ * structures need not be resized.
+ */
+static int n_active_threads;
+static SPINLOCK active_threads_lock = SPINLOCK_INIT;
+
+/** The number of load samples since the number of active threads was changed */
+static int samples_since_resize = 0;
+
+/**
+ * The load average above which the automatic mode activates a thread and below
+ * which it deactivates one. A load average above one means that the threads
+ * find more than one descriptor ready every time they poll.
+ */
+#define POLL_AUTO_HIGH_LOAD 2.0
+#define POLL_AUTO_LOW_LOAD  1.1
+
+/** The number of load samples between two automatic changes */
+#define POLL_AUTO_SAMPLES   6
+
 /**
  * Internal MaxScale thread states
  */
@@ -159,10 +315,28 @@ typedef struct
     DCB *cur_dcb;       /*< Current DCB being processed */
     uint32_t event;     /*< Current event being processed */
     uint64_t cycle_start; /*< The time when the poll loop was started */
+    int n_clients;      /*< No. of client DCBs owned by the thread */
+    int n_placed;       /*< No. of client DCBs placed since the last load sample */
+    int64_t n_events;   /*< Total number of events processed by the thread */
+    int64_t load;       /*< Smoothed number of events per second */
 } THREAD_DATA;
 
 static THREAD_DATA *thread_data = NULL;    /*< Status of each thread */
 
+/**
+ * The estimated load of one session in events per second, calculated from
+ * the per-thread loads at each load sample. Used when placing new sessions
+ * between two load samples.
+ */
+static int64_t session_load = 1;
+
+/** Incremented at each load sample, used to balance the sessions once per sample */
+static int load_epoch = 0;
+static thread_local int balance_epoch = 0;
+
+/** Maximum number of sessions a thread moves away at one time */
+#define POLL_MAX_MIGRATIONS 16
+
 /**
  * The number of buckets used to gather statistics about how many
  * descriptors where processed on each epoll completion.
@@ -206,6 +380,172 @@ static struct
     ts_stats_t *maxexectime;
 } queueStats;
 
+/**
+ * The DCB roles for which separate event latencies are collected
+ */
+typedef enum
+{
+    LATENCY_CLIENT,
+    LATENCY_BACKEND,
+    LATENCY_LISTENER,
+    LATENCY_INTERNAL,
+    LATENCY_N_ROLES
+} LATENCY_ROLE;
+
+static const char *latency_role_names[LATENCY_N_ROLES] =
+{
+    "client",
+    "backend",
+    "listener",
+    "internal"
+};
+
+/**
+ * The event latencies of one DCB role in one thread, in microseconds. Only
+ * the owning thread updates the values.
+ */
+typedef struct
+{
+    HISTOGRAM queue;    /*< Time from the return of epoll_wait to the start of processing */
+    HISTOGRAM exec;     /*< Time spent processing the event */
+    uint64_t n_slow;    /*< Events whose processing took longer than the threshold */
+} EVENT_LATENCY;
+
+static EVENT_LATENCY (*event_latency)[LATENCY_N_ROLES] = NULL;
+static uint64_t slow_event_threshold = DEFAULT_SLOW_EVENT_THRESHOLD * 1000;
+
+/** The time in microseconds when the current poll cycle started */
+static thread_local uint64_t cycle_start_us = 0;
+
+bool poll_add_delayed_call(int delay_ms, void (*func)(void *data), void *data)
+{
+    delayed_call_t *call;
+
+    if (!poll_thread || (call = MXS_MALLOC(sizeof(*call))) == NULL)
+    {
+        return false;
+    }
+
+    call->due = mxs_clock_us() + (uint64_t)delay_ms * 1000;
+    call->func = func;
+    call->data = data;
+
+    delayed_call_t **link = &delayed_calls;
+
+    while (*link && (*link)->due <= call->due)
+    {
+        link = &(*link)->next;
+    }
+
+    call->next = *link;
+    *link = call;
+    return true;
+}
+
+/**
+ * Execute the delayed calls of this thread that are due
+ */
+static void poll_run_delayed_calls()
+{
+    if (delayed_calls)
+    {
+        uint64_t now = mxs_clock_us();
+
+        while (delayed_calls && delayed_calls->due <= now)
+        {
+            /** Removed before the call so that the function can add new calls */
+            delayed_call_t *call = delayed_calls;
+            delayed_calls = call->next;
+            call->func(call->data);
+            MXS_FREE(call);
+        }
+    }
+}
+
+bool poll_call_in_thread(int thread, void (*func)(void *data), void *data)
+{
+    thread_call_t *call = MXS_MALLOC(sizeof(*call));
+
+    if (call == NULL)
+    {
+        return false;
+    }
+
+    call->func = func;
+    call->data = data;
+
+    if (poll_queue_push(&thread_calls[thread], &call->node))
+    {
+        poll_wakeup(thread);
+    }
+
+    return true;
+}
+
+/**
+ * Execute the function calls that other threads have queued for this thread
+ *
+ * @param thread_id The calling thread
+ */
+static void poll_run_thread_calls(int thread_id)
+{
+    thread_call_t *call = (thread_call_t*)poll_queue_take(&thread_calls[thread_id]);
+
+    while (call)
+    {
+        thread_call_t *next = (thread_call_t*)call->node.next;
+        call->func(call->data);
+        MXS_FREE(call);
+        call = next;
+    }
+}
+
+/**
+ * Limit the time a polling thread blocks so that its delayed calls are not late
+ *
+ * The thread does not block at all if it has queued a function call for itself.
+ *
+ * @param timeout The timeout in milliseconds
+ * @return The timeout limited to the due time of the next delayed call
+ */
+static int poll_delayed_call_timeout(int timeout)
+{
+    if (thread_calls[current_thread_id])
+    {
+        timeout = 0;
+    }
+    else if (delayed_calls)
+    {
+        uint64_t now = mxs_clock_us();
+        int ms = delayed_calls->due > now ? (delayed_calls->due - now + 999) / 1000 : 0;
+
+        if (ms < timeout)
+        {
+            timeout = ms;
+        }
+    }
+
+    return timeout;
+}
+
+static inline LATENCY_ROLE latency_role(const DCB *dcb)
+{
+    switch (dcb->dcb_role)
+    {
+    case DCB_ROLE_CLIENT_HANDLER:
+        return LATENCY_CLIENT;
+
+    case DCB_ROLE_BACKEND_HANDLER:
+        return LATENCY_BACKEND;
+
+    case DCB_ROLE_SERVICE_LISTENER:
+        return LATENCY_LISTENER;
+
+    default:
+        return LATENCY_INTERNAL;
+    }
+}
+
 /**
  * How frequently to call the poll_loadav function used to monitor the load
  * average of the poll subsystem.
@@ -214,6 +554,30 @@ static struct
 /**
  * Periodic function to collect load data for average calculations
  */
+/** Set in the epoll data of the descriptors that are watched without a DCB */
+#define POLL_WATCH_TAG ((uintptr_t)1)
+
+/**
+ * @brief Add, modify or remove a descriptor of a polling thread
+ *
+ * @see epoll_ctl
+ */
+static inline int poll_ctl(int thread, int op, int fd, struct epoll_event *ev)
+{
+    return use_uring ? poll_uring_ctl(thread, op, fd, ev) : epoll_ctl(epoll_fd[thread], op, fd, ev);
+}
+
+/**
+ * @brief Wait for the events of the calling polling thread
+ *
+ * @see epoll_wait
+ */
+static inline int poll_wait(int thread, struct epoll_event *events, int maxevents, int timeout)
+{
+    return use_uring ? poll_uring_wait(thread, events, maxevents, timeout) :
+           epoll_wait(epoll_fd[thread], events, maxevents, timeout);
+}
+
 static void poll_loadav(void *);
 
 /**
@@ -221,6 +585,11 @@ static void poll_loadav(void *);
  */
 static int poll_resolve_error(DCB *, int, bool);
 
+static int poll_least_loaded_thread(void);
+static void poll_balance_sessions(int thread_id);
+static void poll_retire_sessions(int thread_id);
+static void poll_auto_threads(void);
+
 /**
  * Initialise the polling system we are using for the gateway.
  *
@@ -230,13 +599,31 @@ void
 poll_init()
 {
     n_threads = config_threadcount();
+    n_active_threads = MXS_MIN(config_get_global_options()->n_threads_initial, n_threads);
+
+    if (n_active_threads < 1)
+    {
+        n_active_threads = n_threads;
+    }
 
     if (!(epoll_fd = MXS_MALLOC(sizeof(int) * n_threads)))
     {
         return;
     }
 
-    for (int i = 0; i < n_threads; i++)
+    if (config_get_global_options()->poll_io_uring)
+    {
+        if ((use_uring = poll_uring_init(n_threads)))
+        {
+            MXS_NOTICE("Using io_uring for polling the network connections.");
+        }
+        else
+        {
+            MXS_WARNING("Could not use io_uring for polling, using epoll instead.");
+        }
+    }
+
+    for (int i = 0; i < n_threads && !use_uring; i++)
     {
         if ((epoll_fd[i] = epoll_create(MAX_EVENTS)) == -1)
         {
@@ -246,29 +633,35 @@ poll_init()
         }
     }
 
-    if ((fake_events = MXS_CALLOC(n_threads, sizeof(fake_event_t*))) == NULL)
+    if ((fake_events = MXS_CALLOC(n_threads, sizeof(POLL_QUEUE_NODE*))) == NULL ||
+        (poll_messages = MXS_CALLOC(n_threads, sizeof(POLL_QUEUE_NODE*))) == NULL ||
+        (thread_calls = MXS_CALLOC(n_threads, sizeof(POLL_QUEUE_NODE*))) == NULL ||
+        (wakeup_fd = MXS_CALLOC(n_threads, sizeof(int))) == NULL)
     {
         exit(-1);
     }
 
-    if ((fake_event_lock = MXS_CALLOC(n_threads, sizeof(SPINLOCK))) == NULL)
+    for (int i = 0; i < n_threads; i++)
     {
-        exit(-1);
-    }
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = &wakeup_fd[i];
 
-    if ((poll_msg = MXS_CALLOC(n_threads, sizeof(int))) == NULL)
-    {
-        exit(-1);
+        if ((wakeup_fd[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1 ||
+            poll_ctl(i, EPOLL_CTL_ADD, wakeup_fd[i], &ev) == -1)
+        {
+            char errbuf[MXS_STRERROR_BUFLEN];
+            MXS_ERROR("FATAL: Could not create wakeup descriptor: %s",
+                      strerror_r(errno, errbuf, sizeof(errbuf)));
+            exit(-1);
+        }
     }
 
-    for (int i = 0; i < n_threads; i++)
-    {
-        spinlock_init(&fake_event_lock[i]);
-    }
+    spinlock_register(&pollqlock, "poll queue");
 
     memset(&pollStats, 0, sizeof(pollStats));
     memset(&queueStats, 0, sizeof(queueStats));
-    thread_data = (THREAD_DATA *)MXS_MALLOC(n_threads * sizeof(THREAD_DATA));
+    thread_data = (THREAD_DATA *)MXS_CALLOC(n_threads, sizeof(THREAD_DATA));
     if (thread_data)
     {
         for (int i = 0; i < n_threads; i++)
@@ -277,6 +670,15 @@ poll_init()
         }
     }
 
+    event_latency = MXS_CALLOC(n_threads, sizeof(*event_latency));
+
+    int threshold = config_get_global_options()->slow_event_threshold;
+
+    if (threshold > 0)
+    {
+        slow_event_threshold = threshold * 1000;
+    }
+
     if ((pollStats.n_read = ts_stats_alloc()) == NULL ||
         (pollStats.n_write = ts_stats_alloc()) == NULL ||
         (pollStats.n_error = ts_stats_alloc()) == NULL ||
@@ -319,6 +721,28 @@ poll_init()
     max_poll_sleep = config_pollsleep();
 }
 
+/**
+ * Get the events a DCB is polled for
+ *
+ * @param dcb The DCB
+ * @return The epoll events, without EPOLLIN if the DCB is throttled
+ */
+static uint32_t poll_dcb_events(DCB *dcb)
+{
+#ifdef EPOLLRDHUP
+    uint32_t events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLHUP | EPOLLET;
+#else
+    uint32_t events = EPOLLIN | EPOLLOUT | EPOLLHUP | EPOLLET;
+#endif
+
+    if (dcb->throttled)
+    {
+        events &= ~EPOLLIN;
+    }
+
+    return events;
+}
+
 int poll_add_dcb(DCB *dcb)
 {
     int rc = -1;
@@ -328,11 +752,7 @@ int poll_add_dcb(DCB *dcb)
 
     CHK_DCB(dcb);
 
-#ifdef EPOLLRDHUP
-    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLHUP | EPOLLET;
-#else
-    ev.events = EPOLLIN | EPOLLOUT | EPOLLHUP | EPOLLET;
-#endif
+    ev.events = poll_dcb_events(dcb);
     ev.data.ptr = dcb;
 
     /*<
@@ -382,9 +802,23 @@ int poll_add_dcb(DCB *dcb)
     {
         owner = dcb->session->client_dcb->thread.id;
     }
+    else if (dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER &&
+             dcb->listener && dcb->listener->listener &&
+             dcb->listener->listener->thread_fds &&
+             current_thread_id < n_active_threads)
+    {
+        /** The connection was accepted from this thread's own listener
+         * socket, keep it on the same epoll instance */
+        owner = current_thread_id;
+    }
+    else if (dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER &&
+             config_get_global_options()->least_loaded_placement && thread_data)
+    {
+        owner = poll_least_loaded_thread();
+    }
     else
     {
-        owner = (unsigned int)atomic_add(&next_epoll_fd, 1) % n_threads;
+        owner = (unsigned int)atomic_add(&next_epoll_fd, 1) % n_active_threads;
     }
 
     dcb->thread.id = owner;
@@ -400,13 +834,17 @@ int poll_add_dcb(DCB *dcb)
 
         for (int i = 0; i < nthr; i++)
         {
-            if ((rc = epoll_ctl(epoll_fd[i], EPOLL_CTL_ADD, dcb->fd, &ev)))
+            /** With per-thread sockets, each thread only polls its own socket */
+            int fd = dcb->thread_fds ? dcb->thread_fds[i] : dcb->fd;
+
+            if ((rc = poll_ctl(i, EPOLL_CTL_ADD, fd, &ev)))
             {
                 error_num = errno;
                 /** Remove the listener from the previous epoll instances */
                 for (int j = 0; j < i; j++)
                 {
-                    epoll_ctl(epoll_fd[j], EPOLL_CTL_DEL, dcb->fd, &ev);
+                    poll_ctl(j, EPOLL_CTL_DEL,
+                              dcb->thread_fds ? dcb->thread_fds[j] : dcb->fd, &ev);
                 }
                 break;
             }
@@ -414,7 +852,7 @@ int poll_add_dcb(DCB *dcb)
     }
     else
     {
-        if ((rc = epoll_ctl(epoll_fd[owner], EPOLL_CTL_ADD, dcb->fd, &ev)))
+        if ((rc = poll_ctl(owner, EPOLL_CTL_ADD, dcb->fd, &ev)))
         {
             error_num = errno;
         }
@@ -427,6 +865,12 @@ int poll_add_dcb(DCB *dcb)
     }
     if (0 == rc)
     {
+        if (dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER && thread_data)
+        {
+            atomic_add(&thread_data[owner].n_clients, 1);
+            atomic_add(&thread_data[owner].n_placed, 1);
+        }
+
         MXS_DEBUG("%lu [poll_add_dcb] Added dcb %p in state %s to poll set.",
                   pthread_self(),
                   dcb,
@@ -485,7 +929,8 @@ int poll_remove_dcb(DCB *dcb)
 
             for (int i = 0; i < nthr; i++)
             {
-                int tmp_rc = epoll_ctl(epoll_fd[i], EPOLL_CTL_DEL, dcb->fd, &ev);
+                int fd = dcb->thread_fds ? dcb->thread_fds[i] : dcb->fd;
+                int tmp_rc = poll_ctl(i, EPOLL_CTL_DEL, fd, &ev);
                 if (tmp_rc && rc == 0)
                 {
                     /** Even if one of the instances failed to remove it, try
@@ -498,10 +943,14 @@ int poll_remove_dcb(DCB *dcb)
         }
         else
         {
-            if ((rc = epoll_ctl(epoll_fd[dcb->thread.id], EPOLL_CTL_DEL, dcbfd, &ev)))
+            if ((rc = poll_ctl(dcb->thread.id, EPOLL_CTL_DEL, dcbfd, &ev)))
             {
                 error_num = errno;
             }
+            else if (dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER && thread_data)
+            {
+                atomic_add(&thread_data[dcb->thread.id].n_clients, -1);
+            }
         }
         /**
          * The poll_resolve_error function will always
@@ -520,6 +969,141 @@ int poll_remove_dcb(DCB *dcb)
     return rc;
 }
 
+/**
+ * Add or remove the first DCBs of an array to or from an epoll instance
+ *
+ * @param op   EPOLL_CTL_ADD or EPOLL_CTL_DEL
+ * @param thr  The thread whose epoll instance is modified
+ * @param dcbs The DCBs
+ * @param n    Number of DCBs
+ * @return Number of DCBs that were added or removed before the first failure
+ */
+static int poll_ctl_dcbs(int op, int thr, DCB **dcbs, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        struct epoll_event ev;
+        ev.events = poll_dcb_events(dcbs[i]);
+        ev.data.ptr = dcbs[i];
+
+        if (poll_ctl(thr, op, dcbs[i]->fd, &ev) != 0)
+        {
+            MXS_ERROR("Failed to %s DCB %p %s the epoll instance of thread %d: %d, %s",
+                      op == EPOLL_CTL_ADD ? "add" : "remove", dcbs[i],
+                      op == EPOLL_CTL_ADD ? "to" : "from", thr, errno, mxs_strerror(errno));
+            return i;
+        }
+    }
+
+    return n;
+}
+
+bool poll_move_dcbs(DCB **dcbs, int n, int from, int to)
+{
+    for (int i = 0; i < n; i++)
+    {
+        CHK_DCB(dcbs[i]);
+        ss_dassert(dcbs[i]->dcb_role != DCB_ROLE_SERVICE_LISTENER);
+        ss_dassert(dcbs[i]->state == DCB_STATE_POLLING);
+    }
+
+    /** No thread polls the DCBs between the removal and the addition. Adding
+     * a descriptor that is already readable or writable to an edge triggered
+     * epoll instance generates the events so nothing is lost. */
+    int removed = poll_ctl_dcbs(EPOLL_CTL_DEL, from, dcbs, n);
+    int added = removed == n ? poll_ctl_dcbs(EPOLL_CTL_ADD, to, dcbs, n) : 0;
+
+    if (added < n)
+    {
+        /** Put all of them back, a session must only be polled by one thread */
+        if (poll_ctl_dcbs(EPOLL_CTL_DEL, to, dcbs, added) != added ||
+            poll_ctl_dcbs(EPOLL_CTL_ADD, from, dcbs, removed) != removed)
+        {
+            MXS_ALERT("Failed to restore the DCBs of a session to the epoll instance of thread %d.",
+                      from);
+            raise(SIGABRT);
+        }
+        return false;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        if (dcbs[i]->dcb_role == DCB_ROLE_CLIENT_HANDLER && thread_data)
+        {
+            atomic_add(&thread_data[from].n_clients, -1);
+            atomic_add(&thread_data[to].n_clients, 1);
+        }
+    }
+
+    return true;
+}
+
+bool poll_add_watch(POLL_WATCH *watch, int thread)
+{
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLHUP | EPOLLET;
+    /** DCBs are never at odd addresses */
+    ev.data.ptr = (void*)((uintptr_t)watch | POLL_WATCH_TAG);
+    watch->thread = thread;
+
+    if (poll_ctl(thread, EPOLL_CTL_ADD, watch->fd, &ev) != 0)
+    {
+        MXS_ERROR("Failed to add descriptor %d to the epoll instance of thread %d: %d, %s",
+                  watch->fd, thread, errno, mxs_strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+bool poll_remove_watch(POLL_WATCH *watch)
+{
+    struct epoll_event ev;
+
+    if (poll_ctl(watch->thread, EPOLL_CTL_DEL, watch->fd, &ev) != 0)
+    {
+        MXS_ERROR("Failed to remove descriptor %d from the epoll instance of thread %d: %d, %s",
+                  watch->fd, watch->thread, errno, mxs_strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+bool poll_throttle_dcb(DCB *dcb, bool throttle)
+{
+    CHK_DCB(dcb);
+
+    if (dcb->throttled == throttle)
+    {
+        return false;
+    }
+
+    dcb->throttled = throttle;
+
+    if (dcb->state != DCB_STATE_POLLING)
+    {
+        /** The events are set when the DCB is added to the poll set */
+        return true;
+    }
+
+    struct epoll_event ev;
+    ev.events = poll_dcb_events(dcb);
+    ev.data.ptr = dcb;
+
+    /** Modifying the events of an edge triggered descriptor rechecks its
+     * readiness so the data that arrived while it was throttled is not lost */
+    if (poll_ctl(dcb->thread.id, EPOLL_CTL_MOD, dcb->fd, &ev) != 0)
+    {
+        MXS_ERROR("Failed to %s the reading of DCB %p: %d, %s",
+                  throttle ? "stop" : "resume", dcb, errno, mxs_strerror(errno));
+        dcb->throttled = !throttle;
+        return false;
+    }
+
+    return true;
+}
+
 /**
  * Check error returns from epoll_ctl. Most result in a crash since they
  * are "impossible". Adding when already present is assumed non-fatal.
@@ -598,6 +1182,40 @@ poll_resolve_error(DCB *dcb, int errornum, bool adding)
                          *  debugging easier.
                          */
 
+/**
+ * @brief Bind the calling polling thread to its CPU
+ *
+ * Does nothing unless threads_cpu_affinity is configured. The memory that a
+ * bound thread allocates for itself, such as its DCBs, buffers and free
+ * lists, is allocated on the NUMA node of its CPU by the kernel's first-touch
+ * policy.
+ *
+ * @param thread_id The polling thread
+ */
+static void poll_bind_thread(int thread_id)
+{
+    int cpu = config_thread_cpu(thread_id);
+
+    if (cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+
+        int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+        if (rc == 0)
+        {
+            MXS_INFO("Polling thread %d is bound to CPU %d.", thread_id, cpu);
+        }
+        else
+        {
+            MXS_ERROR("Failed to bind polling thread %d to CPU %d: %d, %s",
+                      thread_id, cpu, rc, mxs_strerror(rc));
+        }
+    }
+}
+
 /**
  * The main polling loop
  *
@@ -655,6 +1273,7 @@ poll_waitevents(void *arg)
     struct epoll_event events[MAX_EVENTS];
     int i, nfds, timeout_bias = 1;
     current_thread_id = (intptr_t)arg;
+    poll_thread = true;
     int poll_spins = 0;
 
     int thread_id = current_thread_id;
@@ -664,6 +1283,9 @@ poll_waitevents(void *arg)
         thread_data[thread_id].state = THREAD_IDLE;
     }
 
+    poll_bind_thread(thread_id);
+    qsbr_online(thread_id);
+
     while (1)
     {
         atomic_add(&n_waiting, 1);
@@ -680,7 +1302,7 @@ poll_waitevents(void *arg)
         }
 
         ts_stats_increment(pollStats.n_polls, thread_id);
-        if ((nfds = epoll_wait(epoll_fd[thread_id], events, MAX_EVENTS, 0)) == -1)
+        if ((nfds = poll_wait(thread_id, events, MAX_EVENTS, 0)) == -1)
         {
             atomic_add(&n_waiting, -1);
             int eno = errno;
@@ -707,10 +1329,15 @@ poll_waitevents(void *arg)
                 timeout_bias++;
             }
             ts_stats_increment(pollStats.blockingpolls, thread_id);
-            nfds = epoll_wait(epoll_fd[thread_id],
+
+            /** The objects deferred before the wait need not wait for this
+             * thread, the events returned by the wait are handled like the
+             * events of a non-blocking call */
+            qsbr_blocking(thread_id);
+            nfds = poll_wait(thread_id,
                               events,
                               MAX_EVENTS,
-                              (max_poll_sleep * timeout_bias) / 10);
+                              poll_delayed_call_timeout((max_poll_sleep * timeout_bias) / 10));
             if (nfds == 0)
             {
                 poll_spins = 0;
@@ -771,47 +1398,71 @@ poll_waitevents(void *arg)
         }
 
         thread_data[thread_id].cycle_start = hkheartbeat;
+        cycle_start_us = mxs_clock_us();
 
         /* Process of the queue of waiting requests */
         for (int i = 0; i < nfds; i++)
         {
-            process_pollq(thread_id, &events[i]);
+            if (events[i].data.ptr == &wakeup_fd[thread_id])
+            {
+                poll_clear_wakeup(thread_id);
+            }
+            else if ((uintptr_t)events[i].data.ptr & POLL_WATCH_TAG)
+            {
+                POLL_WATCH *watch = (POLL_WATCH*)((uintptr_t)events[i].data.ptr & ~POLL_WATCH_TAG);
+                watch->handler(watch, events[i].events);
+            }
+            else
+            {
+                process_pollq(thread_id, &events[i]);
+            }
         }
 
-        fake_event_t *event = NULL;
-
-        /** It is very likely that the queue is empty so to avoid hitting the
-         * spinlock every time we receive events, we only do a dirty read. Currently,
-         * only the monitors inject fake events from external threads. */
-        if (fake_events[thread_id])
-        {
-            spinlock_acquire(&fake_event_lock[thread_id]);
-            event = fake_events[thread_id];
-            fake_events[thread_id] = NULL;
-            spinlock_release(&fake_event_lock[thread_id]);
-        }
+        fake_event_t *event = (fake_event_t*)poll_queue_take(&fake_events[thread_id]);
 
         while (event)
         {
-            struct epoll_event ev;
-            event->dcb->dcb_fakequeue = event->data;
-            ev.data.ptr = event->dcb;
-            ev.events = event->event;
-            process_pollq(thread_id, &ev);
+            if (event->dcb->thread.id != thread_id)
+            {
+                /** The DCB was moved to another thread after the event was
+                 * added, pass the event on to the new owner */
+                poll_add_event_to_dcb(event->dcb, event->data, event->event);
+            }
+            else
+            {
+                struct epoll_event ev;
+                event->dcb->dcb_fakequeue = event->data;
+                ev.data.ptr = event->dcb;
+                ev.events = event->event;
+                process_pollq(thread_id, &ev);
+            }
             fake_event_t *tmp = event;
-            event = event->next;
+            event = (fake_event_t*)event->node.next;
             MXS_FREE(tmp);
         }
 
-        dcb_process_idle_sessions(thread_id);
-
+        poll_run_thread_calls(thread_id);
+
+        poll_run_delayed_calls();
+
+        dcb_process_idle_sessions(thread_id);
+
+        if (thread_id < n_active_threads)
+        {
+            poll_balance_sessions(thread_id);
+        }
+        else
+        {
+            poll_retire_sessions(thread_id);
+        }
+
         if (thread_data)
         {
             thread_data[thread_id].state = THREAD_ZPROCESSING;
         }
 
-        /** Process closed DCBs */
-        dcb_process_zombies(thread_id);
+        /** Free the closed DCBs and the other objects that no thread refers to */
+        qsbr_quiescent(thread_id);
 
         poll_check_message();
 
@@ -830,6 +1481,7 @@ poll_waitevents(void *arg)
             {
                 thread_data[thread_id].state = THREAD_STOPPED;
             }
+            qsbr_offline(thread_id);
             return;
         }
         if (thread_data)
@@ -897,8 +1549,14 @@ process_pollq(int thread_id, struct epoll_event *event)
     ss_dassert(dcb->thread.id == thread_id || dcb->dcb_role == DCB_ROLE_SERVICE_LISTENER);
     current_dcb = dcb; // thread local
 
+    /** The DCB may be closed by the handlers */
+    int fd = dcb->fd;
+    MXS_PROBE3(poll_event, thread_id, fd, ev);
+
     /** Calculate event queue statistics */
     uint64_t started = hkheartbeat;
+    uint64_t started_us = mxs_clock_us();
+    LATENCY_ROLE role = latency_role(dcb);
     uint64_t qtime = started - thread_data[thread_id].cycle_start;
 
     if (qtime > N_QUEUE_TIMES)
@@ -918,6 +1576,7 @@ process_pollq(int thread_id, struct epoll_event *event)
         thread_data[thread_id].state = THREAD_PROCESSING;
         thread_data[thread_id].cur_dcb = dcb;
         thread_data[thread_id].event = ev;
+        thread_data[thread_id].n_events++;
     }
 
     /* It isn't obvious that this is impossible */
@@ -1088,6 +1747,21 @@ process_pollq(int thread_id, struct epoll_event *event)
 
     ts_stats_set_max(queueStats.maxexectime, qtime, thread_id);
 
+    if (event_latency)
+    {
+        EVENT_LATENCY *latency = &event_latency[thread_id][role];
+        uint64_t exec_us = mxs_clock_us() - started_us;
+
+        histogram_add(&latency->queue, started_us - cycle_start_us);
+        histogram_add(&latency->exec, exec_us);
+
+        if (exec_us > slow_event_threshold)
+        {
+            latency->n_slow++;
+        }
+    }
+
+    MXS_PROBE2(poll_event_done, thread_id, fd);
     current_dcb = NULL; // thread local
 
     return 1;
@@ -1154,6 +1828,15 @@ dprintPollStats(DCB *dcb)
     int i;
 
     dcb_printf(dcb, "\nPoll Statistics.\n\n");
+    dcb_printf(dcb, "Poll backend:                                  %s\n",
+               use_uring ? "io_uring" : "epoll");
+
+    if (use_uring)
+    {
+        dcb_printf(dcb, "No. of io_uring system calls:                  %" PRIu64 "\n",
+                   poll_uring_n_syscalls());
+    }
+
     dcb_printf(dcb, "No. of epoll cycles:                           %" PRId64 "\n",
                ts_stats_get(pollStats.n_polls, TS_STATS_SUM));
     dcb_printf(dcb, "No. of epoll cycles with wait:                 %" PRId64 "\n",
@@ -1181,6 +1864,16 @@ dprintPollStats(DCB *dcb)
     dcb_printf(dcb, "Maximum event queue length:                    %" PRId64 "\n",
                ts_stats_get(pollStats.evq_max, TS_STATS_MAX));
 
+    int64_t n_cached, n_allocated;
+    gwbuf_get_alloc_stats(&n_cached, &n_allocated);
+    dcb_printf(dcb, "No. of buffer allocations from caches:         %" PRId64 "\n", n_cached);
+    dcb_printf(dcb, "No. of buffer allocations from the system:     %" PRId64 "\n", n_allocated);
+
+    int64_t n_hits, n_misses;
+    qc_get_cache_stats(&n_hits, &n_misses);
+    dcb_printf(dcb, "No. of classifications found in the caches:    %" PRId64 "\n", n_hits);
+    dcb_printf(dcb, "No. of classifications done by parsing:        %" PRId64 "\n", n_misses);
+
     dcb_printf(dcb, "No of poll completions with descriptors\n");
     dcb_printf(dcb, "\tNo. of descriptors\tNo. of poll completions.\n");
     for (i = 0; i < MAXNFDS - 1; i++)
@@ -1267,6 +1960,8 @@ dShowThreads(DCB *dcb)
     dcb_printf(dcb, "Polling Threads.\n\n");
     dcb_printf(dcb, "Historic Thread Load Average: %.2f.\n", load_average);
     dcb_printf(dcb, "Current Thread Load Average: %.2f.\n", current_avg);
+    dcb_printf(dcb, "Active Threads: %d of %d%s.\n", n_active_threads, n_threads,
+               config_get_global_options()->threads_auto ? ", adjusted automatically" : "");
 
     /* Average all the samples to get the 15 minute average */
     for (i = 0; i < n_avg_samples; i++)
@@ -1411,6 +2106,225 @@ poll_loadav(void *data)
     {
         next_sample = 0;
     }
+
+    if (thread_data)
+    {
+        static int64_t *last_events = NULL;
+
+        if (last_events == NULL &&
+            (last_events = (int64_t*)MXS_CALLOC(n_threads, sizeof(int64_t))) == NULL)
+        {
+            return;
+        }
+
+        int64_t total_load = 0;
+        int64_t total_clients = 0;
+
+        for (int i = 0; i < n_threads; i++)
+        {
+            int64_t events = thread_data[i].n_events;
+            int64_t rate = (events - last_events[i]) / POLL_LOAD_FREQ;
+            last_events[i] = events;
+
+            /** Exponentially weighted moving average of the event rate */
+            thread_data[i].load = (thread_data[i].load + rate) / 2;
+            thread_data[i].n_placed = 0;
+            total_load += thread_data[i].load;
+            total_clients += thread_data[i].n_clients;
+        }
+
+        session_load = total_clients ? total_load / total_clients : 0;
+
+        if (session_load < 1)
+        {
+            session_load = 1;
+        }
+
+        atomic_add(&load_epoch, 1);
+    }
+
+    samples_since_resize++;
+
+    if (config_get_global_options()->threads_auto)
+    {
+        poll_auto_threads();
+    }
+}
+
+/**
+ * Adjust the number of active threads to the load
+ *
+ * A thread is activated when the load average shows that the threads have
+ * a backlog of ready descriptors and deactivated when they do not. The number
+ * is changed by one at a time and at most once in POLL_AUTO_SAMPLES samples.
+ */
+static void
+poll_auto_threads()
+{
+    if (samples_since_resize < POLL_AUTO_SAMPLES)
+    {
+        return;
+    }
+
+    int active = n_active_threads;
+
+    if (current_avg > POLL_AUTO_HIGH_LOAD && active < n_threads)
+    {
+        poll_set_active_threads(active + 1);
+    }
+    else if (current_avg < POLL_AUTO_LOW_LOAD && active > 1)
+    {
+        poll_set_active_threads(active - 1);
+    }
+}
+
+bool
+poll_set_active_threads(int n)
+{
+    if (n < 1 || n > n_threads)
+    {
+        return false;
+    }
+
+    spinlock_acquire(&active_threads_lock);
+    int old = n_active_threads;
+    n_active_threads = n;
+    spinlock_release(&active_threads_lock);
+
+    if (old != n)
+    {
+        samples_since_resize = 0;
+        MXS_NOTICE("Number of active polling threads changed from %d to %d.", old, n);
+
+        /** Wake up the retiring threads so that they start moving their sessions */
+        for (int i = n; i < old; i++)
+        {
+            poll_wakeup(i);
+        }
+    }
+
+    return true;
+}
+
+int
+poll_get_active_threads()
+{
+    return n_active_threads;
+}
+
+/**
+ * Find the thread with the lowest estimated load
+ *
+ * The estimate is the load measured at the last sample plus the expected load
+ * of the sessions placed on the thread since then. This keeps connection bursts
+ * from all landing on the same thread.
+ *
+ * @return The ID of the least loaded thread
+ */
+static int
+poll_least_loaded_thread()
+{
+    int best = 0;
+    int64_t best_load = INT64_MAX;
+    int active = n_active_threads;
+
+    for (int i = 0; i < active; i++)
+    {
+        int64_t load = thread_data[i].load + thread_data[i].n_placed * session_load;
+
+        if (load < best_load ||
+            (load == best_load && thread_data[i].n_clients < thread_data[best].n_clients))
+        {
+            best = i;
+            best_load = load;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * Move idle sessions away from an overloaded thread
+ *
+ * This is done at most once per load sample by each thread. If the load of
+ * the calling thread exceeds the load of the least loaded thread by more than
+ * the configured threshold, idle sessions are moved to the least loaded thread.
+ *
+ * @param thread_id The ID of the calling thread
+ */
+static void
+poll_balance_sessions(int thread_id)
+{
+    int threshold = config_get_global_options()->thread_migration_threshold;
+
+    if (threshold <= 0 || thread_data == NULL || balance_epoch == load_epoch)
+    {
+        return;
+    }
+
+    balance_epoch = load_epoch;
+
+    int target = poll_least_loaded_thread();
+    int64_t own_load = thread_data[thread_id].load;
+    int64_t target_load = thread_data[target].load +
+                          thread_data[target].n_placed * session_load;
+
+    if (target == thread_id ||
+        own_load - target_load < 2 * session_load ||
+        own_load * 100 <= target_load * (100 + threshold))
+    {
+        return;
+    }
+
+    /** Move half of the difference so that the two threads end up even */
+    int64_t n_move = (own_load - target_load) / (2 * session_load);
+
+    if (n_move > POLL_MAX_MIGRATIONS)
+    {
+        n_move = POLL_MAX_MIGRATIONS;
+    }
+
+    int moved = dcb_migrate_idle_sessions(thread_id, target, n_move);
+
+    if (moved > 0)
+    {
+        /** Account for the moved load so that other threads see the change
+         * before the next sample is taken */
+        atomic_add_int64(&thread_data[thread_id].load, -moved * session_load);
+        atomic_add(&thread_data[target].n_placed, moved);
+
+        MXS_INFO("Moved %d idle sessions from thread %d to thread %d.",
+                 moved, thread_id, target);
+    }
+}
+
+/**
+ * Move the sessions of an inactive thread to the active threads
+ *
+ * The idle sessions of the thread are moved to the least loaded active thread
+ * every poll cycle. The sessions that are processing a statement are moved
+ * once they are idle.
+ *
+ * @param thread_id The ID of the calling thread, an inactive thread
+ */
+static void
+poll_retire_sessions(int thread_id)
+{
+    if (thread_data == NULL || thread_data[thread_id].n_clients == 0)
+    {
+        return;
+    }
+
+    int target = poll_least_loaded_thread();
+    int moved = dcb_migrate_idle_sessions(thread_id, target, POLL_MAX_MIGRATIONS);
+
+    if (moved > 0)
+    {
+        atomic_add(&thread_data[target].n_placed, moved);
+
+        MXS_INFO("Moved %d sessions from inactive thread %d to thread %d.",
+                 moved, thread_id, target);
+    }
 }
 
 void poll_add_epollin_event_to_dcb(DCB*   dcb,
@@ -1432,30 +2346,25 @@ static void poll_add_event_to_dcb(DCB*       dcb,
 
     if (event)
     {
-        event->data = buf;
-        event->dcb = dcb;
-        event->event = ev;
-        event->next = NULL;
-        event->tail = event;
-
         int thr = dcb->thread.id;
 
-        /** It is possible that a housekeeper or a monitor thread inserts a fake
-         * event into the thread's event queue which is why the operation needs
-         * to be protected by a spinlock */
-        spinlock_acquire(&fake_event_lock[thr]);
-
-        if (fake_events[thr])
+        if (buf && (!poll_thread || thr != current_thread_id))
         {
-            fake_events[thr]->tail->next = event;
-            fake_events[thr]->tail = event;
+            /** The buffer is handed over to the thread that owns the DCB */
+            buf = gwbuf_transfer(buf);
         }
-        else
+
+        event->data = buf;
+        event->dcb = dcb;
+        event->event = ev;
+
+        /** Fake events can be added by any thread, including the housekeeper
+         * and the monitors. The owning thread only needs to be woken up if
+         * the queue was empty as otherwise a wakeup is already pending. */
+        if (poll_queue_push(&fake_events[thr], &event->node))
         {
-            fake_events[thr] = event;
+            poll_wakeup(thr);
         }
-
-        spinlock_release(&fake_event_lock[thr]);
     }
 }
 
@@ -1513,6 +2422,40 @@ dShowEventStats(DCB *pdcb)
     }
     dcb_printf(pdcb, " > %2d00ms      | %-10d | %-10d\n", N_QUEUE_TIMES,
                queueStats.qtimes[N_QUEUE_TIMES], queueStats.exectimes[N_QUEUE_TIMES]);
+
+    if (event_latency)
+    {
+        dcb_printf(pdcb, "\nEvent latencies in microseconds (slow events take over %" PRIu64 "ms).\n",
+                   slow_event_threshold / 1000);
+        dcb_printf(pdcb, "                    |        |            Queued          |"
+                   "           Executed         |\n");
+        dcb_printf(pdcb, " Thread | Role      | Events | p50    | p99    | p99.9  |"
+                   " p50    | p99    | p99.9  | Slow\n");
+        dcb_printf(pdcb, "--------+-----------+--------+--------+--------+--------+"
+                   "--------+--------+--------+-------\n");
+
+        for (i = 0; i < n_threads; i++)
+        {
+            for (int j = 0; j < LATENCY_N_ROLES; j++)
+            {
+                EVENT_LATENCY *latency = &event_latency[i][j];
+
+                if (latency->exec.count)
+                {
+                    dcb_printf(pdcb, " %-6d | %-9s | %-6" PRIu64 " | %-6" PRIu64 " | %-6" PRIu64
+                               " | %-6" PRIu64 " | %-6" PRIu64 " | %-6" PRIu64 " | %-6" PRIu64
+                               " | %" PRIu64 "\n", i, latency_role_names[j], latency->exec.count,
+                               histogram_percentile(&latency->queue, 50),
+                               histogram_percentile(&latency->queue, 99),
+                               histogram_percentile(&latency->queue, 99.9),
+                               histogram_percentile(&latency->exec, 50),
+                               histogram_percentile(&latency->exec, 99),
+                               histogram_percentile(&latency->exec, 99.9),
+                               latency->n_slow);
+                }
+            }
+        }
+    }
 }
 
 /**
@@ -1624,45 +2567,252 @@ eventTimesGetList()
     return set;
 }
 
-void poll_send_message(enum poll_message msg, void *data)
+/**
+ * Provide a row to the result set that defines the event latencies of one
+ * DCB role in one thread
+ *
+ * @param set   The result set
+ * @param data  The index of the row to send
+ * @return The next row or NULL
+ */
+static RESULT_ROW *
+eventLatencyRowCallback(RESULTSET *set, void *data)
 {
-    spinlock_acquire(&poll_msg_lock);
-    int nthr = config_threadcount();
-    poll_msg_data = data;
+    int *rowno = (int *)data;
+    char buf[40];
+    RESULT_ROW *row;
 
-    for (int i = 0; i < nthr; i++)
+    if (*rowno >= n_threads * LATENCY_N_ROLES)
     {
-        poll_msg[i] |= msg;
+        MXS_FREE(data);
+        return NULL;
     }
 
-    /** Handle this thread's message */
-    poll_check_message();
+    int thr = *rowno / LATENCY_N_ROLES;
+    int role = *rowno % LATENCY_N_ROLES;
+    EVENT_LATENCY *latency = &event_latency[thr][role];
+    uint64_t values[] =
+    {
+        latency->exec.count,
+        histogram_percentile(&latency->queue, 50),
+        histogram_percentile(&latency->queue, 99),
+        histogram_percentile(&latency->queue, 99.9),
+        latency->queue.max,
+        histogram_percentile(&latency->exec, 50),
+        histogram_percentile(&latency->exec, 99),
+        histogram_percentile(&latency->exec, 99.9),
+        latency->exec.max,
+        latency->n_slow
+    };
 
-    for (int i = 0; i < nthr; i++)
+    row = resultset_make_row(set);
+    snprintf(buf, sizeof(buf), "%d", thr);
+    resultset_row_set(row, 0, buf);
+    resultset_row_set(row, 1, latency_role_names[role]);
+
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+    {
+        snprintf(buf, sizeof(buf), "%" PRIu64, values[i]);
+        resultset_row_set(row, i + 2, buf);
+    }
+
+    (*rowno)++;
+    return row;
+}
+
+/**
+ * Return a result set with the event latency percentiles of each thread
+ * and DCB role. The times are in microseconds.
+ *
+ * @return A Result set
+ */
+RESULTSET *
+eventLatencyGetList()
+{
+    RESULTSET *set;
+    int *data;
+
+    if (event_latency == NULL || (data = (int *)MXS_MALLOC(sizeof(int))) == NULL)
+    {
+        return NULL;
+    }
+    *data = 0;
+    if ((set = resultset_create(eventLatencyRowCallback, data)) == NULL)
     {
-        if (i != current_thread_id)
+        MXS_FREE(data);
+        return NULL;
+    }
+    resultset_add_column(set, "Thread", 6, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Role", 10, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Events", 20, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Queue p50", 12, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Queue p99", 12, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Queue p99.9", 12, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Queue max", 12, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Exec p50", 12, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Exec p99", 12, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Exec p99.9", 12, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Exec max", 12, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Slow events", 20, COL_TYPE_VARCHAR);
+
+    return set;
+}
+
+void poll_metrics(METRICS *metrics)
+{
+    static const struct
+    {
+        const char *name;
+        const char *type;
+        const char *help;
+        POLL_STAT   stat;
+        double      scale;
+    } stats[] =
+    {
+        {"maxscale_poll_reads", "counter", "Read events", POLL_STAT_READ, 1},
+        {"maxscale_poll_writes", "counter", "Write events", POLL_STAT_WRITE, 1},
+        {"maxscale_poll_errors", "counter", "Error events", POLL_STAT_ERROR, 1},
+        {"maxscale_poll_hangups", "counter", "Hangup events", POLL_STAT_HANGUP, 1},
+        {"maxscale_poll_accepts", "counter", "Accept events", POLL_STAT_ACCEPT, 1},
+        {"maxscale_event_queue_length", "gauge", "Average event queue length", POLL_STAT_EVQ_LEN, 1},
+        {"maxscale_event_queue_length_max", "gauge", "Maximum event queue length", POLL_STAT_EVQ_MAX, 1},
+        {"maxscale_event_queue_time_max_seconds", "gauge", "Maximum event queue time",
+         POLL_STAT_MAX_QTIME, 0.1},
+        {"maxscale_event_exec_time_max_seconds", "gauge", "Maximum event execution time",
+         POLL_STAT_MAX_EXECTIME, 0.1},
+    };
+    char name[100];
+
+    for (size_t i = 0; i < sizeof(stats) / sizeof(stats[0]); i++)
+    {
+        bool counter = strcmp(stats[i].type, "counter") == 0;
+
+        metrics_family(metrics, stats[i].name, stats[i].type, stats[i].help);
+        snprintf(name, sizeof(name), "%s%s", stats[i].name, counter ? "_total" : "");
+        metrics_value(metrics, name, "", poll_get_stat(stats[i].stat) * stats[i].scale);
+    }
+
+    if (event_latency == NULL)
+    {
+        return;
+    }
+
+    const char *families[] = {"maxscale_event_queue_seconds", "maxscale_event_exec_seconds"};
+    const char *help[] =
+    {
+        "Time from the return of epoll_wait to the start of the processing of an event",
+        "Time spent processing an event"
+    };
+
+    for (int f = 0; f < 2; f++)
+    {
+        metrics_family(metrics, families[f], "summary", help[f]);
+
+        for (int thr = 0; thr < n_threads; thr++)
         {
-            while (poll_msg[i] & msg)
+            for (int role = 0; role < LATENCY_N_ROLES; role++)
             {
-                thread_millisleep(1);
+                EVENT_LATENCY *latency = &event_latency[thr][role];
+                char labels[METRICS_LABELS_LEN] = "";
+                char thread[20];
+
+                snprintf(thread, sizeof(thread), "%d", thr);
+                metrics_label(labels, "thread", thread);
+                metrics_label(labels, "role", latency_role_names[role]);
+                metrics_summary(metrics, families[f], labels, f == 0 ? &latency->queue : &latency->exec);
             }
         }
     }
 
-    poll_msg_data = NULL;
-    spinlock_release(&poll_msg_lock);
+    metrics_family(metrics, "maxscale_slow_events", "counter", "Events whose processing was slow");
+
+    for (int thr = 0; thr < n_threads; thr++)
+    {
+        for (int role = 0; role < LATENCY_N_ROLES; role++)
+        {
+            char labels[METRICS_LABELS_LEN] = "";
+            char thread[20];
+
+            snprintf(thread, sizeof(thread), "%d", thr);
+            metrics_label(labels, "thread", thread);
+            metrics_label(labels, "role", latency_role_names[role]);
+            metrics_value(metrics, "maxscale_slow_events_total", labels, event_latency[thr][role].n_slow);
+        }
+    }
 }
 
-static void poll_check_message()
+/**
+ * Handle a message in the calling polling thread
+ *
+ * @param msg  The message
+ * @param data Message data
+ */
+static void poll_handle_message(enum poll_message msg, void *data)
 {
     int thread_id = current_thread_id;
 
-    if (poll_msg[thread_id] & POLL_MSG_CLEAN_PERSISTENT)
+    if (msg == POLL_MSG_CLEAN_PERSISTENT)
     {
-        SERVER *server = (SERVER*)poll_msg_data;
+        SERVER *server = (SERVER*)data;
         dcb_persistent_clean_count(server->persistent[thread_id], thread_id, false);
-        atomic_synchronize();
-        poll_msg[thread_id] &= ~POLL_MSG_CLEAN_PERSISTENT;
+    }
+}
+
+void poll_send_message(enum poll_message msg, void *data)
+{
+    int nthr = config_threadcount();
+    poll_message_t *messages = (poll_message_t*)MXS_CALLOC(nthr, sizeof(poll_message_t));
+    MXS_ABORT_IF_NULL(messages);
+    int pending = 0;
+
+    for (int i = 0; i < nthr; i++)
+    {
+        /** A polling thread handles its own message directly */
+        if (!poll_thread || i != current_thread_id)
+        {
+            messages[i].msg = msg;
+            messages[i].data = data;
+            messages[i].pending = &pending;
+            atomic_add(&pending, 1);
+
+            if (poll_queue_push(&poll_messages[i], &messages[i].node))
+            {
+                poll_wakeup(i);
+            }
+        }
+    }
+
+    if (poll_thread)
+    {
+        poll_handle_message(msg, data);
+    }
+
+    while (atomic_add(&pending, 0) > 0)
+    {
+        /** Process messages sent to this thread while waiting so that two
+         * threads sending messages at the same time do not wait for each other */
+        if (poll_thread)
+        {
+            poll_check_message();
+        }
+
+        thread_millisleep(1);
+    }
+
+    MXS_FREE(messages);
+}
+
+static void poll_check_message()
+{
+    poll_message_t *item = (poll_message_t*)poll_queue_take(&poll_messages[current_thread_id]);
+
+    while (item)
+    {
+        /** The sender frees the message once all threads have processed it */
+        poll_message_t *next = (poll_message_t*)item->node.next;
+        poll_handle_message(item->msg, item->data);
+        atomic_add(item->pending, -1);
+        item = next;
     }
 }
 
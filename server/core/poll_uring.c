@@ -0,0 +1,669 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file poll_uring.c - Polling of the descriptors with io_uring
+ *
+ * Each polling thread has its own io_uring instance. A descriptor is polled
+ * with a multishot poll request that posts a completion every time the
+ * descriptor becomes readable or writable, which gives the same edge
+ * triggered events that the epoll backend uses. The completions are converted
+ * into epoll events so that the processing of the events is the same for both
+ * backends.
+ *
+ * The requests that a polling thread makes for its own descriptors are
+ * submitted in the same system call that waits for the next events and the
+ * completions are read from the shared memory of the ring, so that a busy
+ * thread makes far fewer system calls than with epoll. The requests of other
+ * threads and the removals of descriptors are submitted immediately as the
+ * descriptor may be closed right after it has been removed.
+ *
+ * The user data of a poll request contains the descriptor and a generation
+ * number that is changed each time the descriptor is added, modified or
+ * removed. The completions of the requests of an older generation are ignored.
+ */
+
+#include "maxscale/poll_uring.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/spinlock.h>
+#include "maxscale/poll.h"
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#if defined(IORING_POLL_ADD_MULTI) && defined(IORING_FEAT_EXT_ARG) && defined(__NR_io_uring_setup)
+#define HAVE_IO_URING 1
+#endif
+
+#ifdef HAVE_IO_URING
+
+/** Size of the submission queue of a thread */
+#define URING_SQ_ENTRIES 256
+
+/** Size of the completion queue of a thread */
+#define URING_CQ_ENTRIES 4096
+
+/** Initial number of descriptors in the slot table of a thread */
+#define URING_INITIAL_SLOTS 1024
+
+/** The user data of the requests whose completions are ignored */
+#define URING_IGNORE UINT64_MAX
+
+/** The kernel features the backend relies on */
+#define URING_FEATURES (IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG)
+
+/** A descriptor polled by a thread */
+typedef struct uring_slot
+{
+    void     *ptr;    /*< The data of the epoll events */
+    uint32_t events;  /*< The polled events */
+    uint32_t gen;     /*< Generation of the current poll request */
+    bool     active;  /*< Whether the descriptor is polled */
+} URING_SLOT;
+
+/** The io_uring instance of a polling thread */
+typedef struct poll_uring
+{
+    SPINLOCK            lock;       /*< Protects the queues and the slots */
+    int                 fd;         /*< The io_uring descriptor */
+    void                *ring;      /*< The mapped submission and completion queues */
+    size_t              ring_size;
+    struct io_uring_sqe *sqes;      /*< The submission queue entries */
+    size_t              sqes_size;
+    unsigned            *sq_head;
+    unsigned            *sq_tail;
+    unsigned            *sq_mask;
+    unsigned            *sq_flags;
+    unsigned            *sq_array;
+    unsigned            sq_entries;
+    unsigned            sq_local_tail; /*< Tail of the queued but unsubmitted entries */
+    unsigned            *cq_head;
+    unsigned            *cq_tail;
+    unsigned            *cq_mask;
+    struct io_uring_cqe *cqes;
+    URING_SLOT          *slots;     /*< The descriptors, indexed by the descriptor */
+    int                 n_slots;
+    int                 n_rearmed;  /*< Number of poll requests that ended and were renewed */
+} POLL_URING;
+
+static POLL_URING *rings = NULL;
+static int n_rings = 0;
+static uint64_t n_syscalls = 0;
+
+static int uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(POLL_URING *ring, unsigned to_submit, unsigned min_complete,
+                       unsigned flags, void *arg, size_t argsz)
+{
+    atomic_add_uint64(&n_syscalls, 1);
+    return (int)syscall(__NR_io_uring_enter, ring->fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+/**
+ * @brief Number of queued requests that the kernel has not yet consumed
+ */
+static inline unsigned uring_pending(POLL_URING *ring)
+{
+    return ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Submit the queued requests without waiting for completions
+ */
+static int uring_submit(POLL_URING *ring)
+{
+    unsigned to_submit = uring_pending(ring);
+    int rc = 0;
+
+    if (to_submit > 0)
+    {
+        while ((rc = uring_enter(ring, to_submit, 0, 0, NULL, 0)) == -1 && errno == EINTR)
+        {
+            ;
+        }
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Get a free submission queue entry, the ring must be locked
+ *
+ * @return The entry or NULL if the queue is full and could not be submitted
+ */
+static struct io_uring_sqe* uring_get_sqe(POLL_URING *ring)
+{
+    if (uring_pending(ring) >= ring->sq_entries)
+    {
+        uring_submit(ring);
+
+        if (uring_pending(ring) >= ring->sq_entries)
+        {
+            return NULL;
+        }
+    }
+
+    struct io_uring_sqe *sqe = &ring->sqes[ring->sq_local_tail & *ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+/**
+ * @brief Make the filled submission queue entry visible to the kernel
+ */
+static inline void uring_queue_sqe(POLL_URING *ring)
+{
+    ring->sq_local_tail++;
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t uring_user_data(int fd, uint32_t gen)
+{
+    return ((uint64_t)fd << 32) | gen;
+}
+
+/**
+ * @brief Queue the poll request of a descriptor
+ */
+static bool uring_arm(POLL_URING *ring, int fd, URING_SLOT *slot)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+
+    if (sqe)
+    {
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fd;
+        sqe->len = IORING_POLL_ADD_MULTI;
+        sqe->poll32_events = slot->events;
+        sqe->user_data = uring_user_data(fd, slot->gen);
+        uring_queue_sqe(ring);
+    }
+
+    return sqe != NULL;
+}
+
+/**
+ * @brief Queue the cancellation of the current poll request of a descriptor
+ */
+static bool uring_cancel(POLL_URING *ring, int fd, URING_SLOT *slot)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+
+    if (sqe)
+    {
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = uring_user_data(fd, slot->gen);
+        sqe->user_data = URING_IGNORE;
+        uring_queue_sqe(ring);
+    }
+
+    return sqe != NULL;
+}
+
+/**
+ * @brief Get the slot of a descriptor, growing the table if needed
+ */
+static URING_SLOT* uring_get_slot(POLL_URING *ring, int fd)
+{
+    if (fd >= ring->n_slots)
+    {
+        int n = ring->n_slots ? ring->n_slots : URING_INITIAL_SLOTS;
+
+        while (n <= fd)
+        {
+            n *= 2;
+        }
+
+        URING_SLOT *slots = MXS_REALLOC(ring->slots, n * sizeof(URING_SLOT));
+
+        if (slots == NULL)
+        {
+            return NULL;
+        }
+
+        memset(slots + ring->n_slots, 0, (n - ring->n_slots) * sizeof(URING_SLOT));
+        ring->slots = slots;
+        ring->n_slots = n;
+    }
+
+    return &ring->slots[fd];
+}
+
+static int uring_ctl(POLL_URING *ring, int op, int fd, struct epoll_event *ev, bool defer)
+{
+    int rc = -1;
+    int err = 0;
+
+    spinlock_acquire(&ring->lock);
+
+    URING_SLOT *slot = fd >= 0 ? uring_get_slot(ring, fd) : NULL;
+
+    if (slot == NULL)
+    {
+        err = fd >= 0 ? ENOMEM : EBADF;
+    }
+    else if (op == EPOLL_CTL_ADD && slot->active)
+    {
+        err = EEXIST;
+    }
+    else if (op != EPOLL_CTL_ADD && !slot->active)
+    {
+        err = ENOENT;
+    }
+    else if (op != EPOLL_CTL_ADD && !uring_cancel(ring, fd, slot))
+    {
+        err = ENOMEM;
+    }
+    else
+    {
+        /** The completions of the previous request of the descriptor are ignored */
+        slot->gen++;
+
+        if (op == EPOLL_CTL_DEL)
+        {
+            slot->active = false;
+            slot->ptr = NULL;
+            rc = 0;
+        }
+        else
+        {
+            slot->ptr = ev->data.ptr;
+            slot->events = ev->events & ~EPOLLET;
+            slot->active = true;
+
+            if (uring_arm(ring, fd, slot))
+            {
+                rc = 0;
+            }
+            else
+            {
+                slot->active = false;
+                err = ENOMEM;
+            }
+        }
+    }
+
+    /** A removed descriptor stays open as long as it is polled */
+    if ((!defer || op == EPOLL_CTL_DEL) && uring_submit(ring) == -1 && rc == 0)
+    {
+        rc = -1;
+        err = errno;
+    }
+
+    spinlock_release(&ring->lock);
+
+    if (rc != 0)
+    {
+        errno = err;
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Convert the available completions into epoll events
+ */
+static int uring_reap(POLL_URING *ring, struct epoll_event *events, int maxevents)
+{
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    int n = 0;
+
+    if (head == tail)
+    {
+        return 0;
+    }
+
+    spinlock_acquire(&ring->lock);
+
+    while (head != tail && n < maxevents)
+    {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        head++;
+
+        if (cqe->user_data == URING_IGNORE)
+        {
+            continue;
+        }
+
+        int fd = (int)(cqe->user_data >> 32);
+        URING_SLOT *slot = fd < ring->n_slots ? &ring->slots[fd] : NULL;
+
+        if (slot == NULL || !slot->active || slot->gen != (uint32_t)cqe->user_data)
+        {
+            /** The descriptor was removed or modified after the event */
+            continue;
+        }
+
+        uint32_t ev = 0;
+
+        if (cqe->res > 0)
+        {
+            ev = cqe->res;
+        }
+        else if (cqe->res < 0 && cqe->res != -ECANCELED)
+        {
+            MXS_ERROR("Polling of descriptor %d failed: %d, %s", fd, -cqe->res, mxs_strerror(-cqe->res));
+            ev = EPOLLERR;
+        }
+
+        /** A multishot request ends if the completions overflow or if the
+         * thread that submitted it exits, the descriptor is polled again */
+        if (!(cqe->flags & IORING_CQE_F_MORE) && ev != EPOLLERR)
+        {
+            ring->n_rearmed++;
+
+            if (!uring_arm(ring, fd, slot))
+            {
+                MXS_ERROR("Failed to renew the polling of descriptor %d.", fd);
+                ev |= EPOLLERR;
+            }
+        }
+
+        if (ev)
+        {
+            if (n > 0 && events[n - 1].data.ptr == slot->ptr)
+            {
+                events[n - 1].events |= ev;
+            }
+            else
+            {
+                events[n].events = ev;
+                events[n].data.ptr = slot->ptr;
+                n++;
+            }
+        }
+    }
+
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    spinlock_release(&ring->lock);
+
+    return n;
+}
+
+static int uring_wait(POLL_URING *ring, struct epoll_event *events, int maxevents, int timeout)
+{
+    int n = uring_reap(ring, events, maxevents);
+    bool overflow = __atomic_load_n(ring->sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW;
+
+    if (n > 0 || (timeout == 0 && !overflow))
+    {
+        /** The renewed and deferred requests are submitted before the events
+         * are processed, the processing may close the descriptors */
+        if (uring_pending(ring) > 0)
+        {
+            spinlock_acquire(&ring->lock);
+            uring_submit(ring);
+            spinlock_release(&ring->lock);
+        }
+
+        return n;
+    }
+
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask_sz = _NSIG / 8;
+
+    if (timeout > 0)
+    {
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+    }
+
+    spinlock_acquire(&ring->lock);
+    unsigned to_submit = uring_pending(ring);
+    spinlock_release(&ring->lock);
+
+    /** Other threads may submit requests while this one waits, they only
+     * submit the entries they have queued themselves */
+    if (uring_enter(ring, to_submit, timeout == 0 ? 0 : 1,
+                    IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg)) == -1 &&
+        errno != ETIME && errno != EINTR && errno != EBUSY)
+    {
+        return -1;
+    }
+
+    return uring_reap(ring, events, maxevents);
+}
+
+static void uring_free(POLL_URING *ring)
+{
+    if (ring->sqes)
+    {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+
+    if (ring->ring)
+    {
+        munmap(ring->ring, ring->ring_size);
+    }
+
+    if (ring->fd != -1)
+    {
+        close(ring->fd);
+    }
+
+    MXS_FREE(ring->slots);
+}
+
+static bool uring_create(POLL_URING *ring)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = URING_CQ_ENTRIES;
+
+    spinlock_init(&ring->lock);
+
+    if ((ring->fd = uring_setup(URING_SQ_ENTRIES, &p)) == -1)
+    {
+        MXS_WARNING("Failed to create an io_uring instance: %d, %s", errno, mxs_strerror(errno));
+        return false;
+    }
+
+    if ((p.features & URING_FEATURES) != URING_FEATURES)
+    {
+        MXS_WARNING("The kernel does not support the io_uring features that are needed, "
+                    "kernel 5.13 or newer is required.");
+        return false;
+    }
+
+    /** The completion queue is in the same mapping as the submission queue */
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->ring_size = sq_size > cq_size ? sq_size : cq_size;
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    void *ptr = mmap(NULL, ring->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     ring->fd, IORING_OFF_SQ_RING);
+
+    if (ptr == MAP_FAILED)
+    {
+        MXS_WARNING("Failed to map the io_uring queues: %d, %s", errno, mxs_strerror(errno));
+        return false;
+    }
+
+    ring->ring = ptr;
+    ptr = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+               ring->fd, IORING_OFF_SQES);
+
+    if (ptr == MAP_FAILED)
+    {
+        MXS_WARNING("Failed to map the io_uring queues: %d, %s", errno, mxs_strerror(errno));
+        return false;
+    }
+
+    char *base = ring->ring;
+    ring->sqes = ptr;
+    ring->sq_head = (unsigned*)(base + p.sq_off.head);
+    ring->sq_tail = (unsigned*)(base + p.sq_off.tail);
+    ring->sq_mask = (unsigned*)(base + p.sq_off.ring_mask);
+    ring->sq_flags = (unsigned*)(base + p.sq_off.flags);
+    ring->sq_array = (unsigned*)(base + p.sq_off.array);
+    ring->sq_entries = p.sq_entries;
+    ring->sq_local_tail = *ring->sq_tail;
+    ring->cq_head = (unsigned*)(base + p.cq_off.head);
+    ring->cq_tail = (unsigned*)(base + p.cq_off.tail);
+    ring->cq_mask = (unsigned*)(base + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(base + p.cq_off.cqes);
+
+    /** Each queue entry is always submitted from the same index */
+    for (unsigned i = 0; i < p.sq_entries; i++)
+    {
+        ring->sq_array[i] = i;
+    }
+
+    return uring_get_slot(ring, 0) != NULL;
+}
+
+/**
+ * @brief Check that multishot polling works with an eventfd
+ *
+ * Some kernels and seccomp profiles accept the requests but do not support
+ * them, e.g. by completing the poll request with an error.
+ */
+static bool uring_probe(POLL_URING *ring)
+{
+    bool rval = false;
+    int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (efd != -1)
+    {
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = &efd;
+        uint64_t value = 1;
+
+        if (uring_ctl(ring, EPOLL_CTL_ADD, efd, &ev, false) == 0)
+        {
+            if (write(efd, &value, sizeof(value)) == sizeof(value))
+            {
+                struct epoll_event out;
+                memset(&out, 0, sizeof(out));
+
+                rval = uring_wait(ring, &out, 1, 1000) == 1 && out.data.ptr == &efd &&
+                       out.events == EPOLLIN && ring->n_rearmed == 0;
+            }
+
+            uring_ctl(ring, EPOLL_CTL_DEL, efd, NULL, false);
+        }
+
+        close(efd);
+    }
+
+    return rval;
+}
+
+bool poll_uring_init(int n_threads)
+{
+    POLL_URING *new_rings = MXS_CALLOC(n_threads, sizeof(POLL_URING));
+
+    if (new_rings == NULL)
+    {
+        return false;
+    }
+
+    int n = 0;
+    bool ok = true;
+
+    for (; n < n_threads && ok; n++)
+    {
+        new_rings[n].fd = -1;
+        ok = uring_create(&new_rings[n]);
+    }
+
+    if (ok && !uring_probe(&new_rings[0]))
+    {
+        MXS_WARNING("The kernel does not support multishot polling with io_uring.");
+        ok = false;
+    }
+
+    if (!ok)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            uring_free(&new_rings[i]);
+        }
+
+        MXS_FREE(new_rings);
+        return false;
+    }
+
+    rings = new_rings;
+    n_rings = n_threads;
+    return true;
+}
+
+int poll_uring_ctl(int thread, int op, int fd, struct epoll_event *ev)
+{
+    ss_dassert(thread >= 0 && thread < n_rings);
+    bool defer = poll_thread && current_thread_id == thread;
+    return uring_ctl(&rings[thread], op, fd, ev, defer);
+}
+
+int poll_uring_wait(int thread, struct epoll_event *events, int maxevents, int timeout)
+{
+    ss_dassert(thread >= 0 && thread < n_rings);
+    return uring_wait(&rings[thread], events, maxevents, timeout);
+}
+
+uint64_t poll_uring_n_syscalls()
+{
+    return n_syscalls;
+}
+
+#else /* HAVE_IO_URING */
+
+bool poll_uring_init(int n_threads)
+{
+    MXS_WARNING("MaxScale was built without io_uring support.");
+    return false;
+}
+
+int poll_uring_ctl(int thread, int op, int fd, struct epoll_event *ev)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+int poll_uring_wait(int thread, struct epoll_event *events, int maxevents, int timeout)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+uint64_t poll_uring_n_syscalls()
+{
+    return 0;
+}
+
+#endif /* HAVE_IO_URING */
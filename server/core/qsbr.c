@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file qsbr.c - Quiescent-state-based reclamation for the polling threads
+ *
+ * A global epoch is advanced every time an object is deferred and the object
+ * is tagged with the new epoch. Each polling thread records the epoch it has
+ * seen when it passes a quiescent state. An object can be freed once every
+ * online thread has recorded an epoch at least as large as the one of the
+ * object: the object was unlinked before its epoch was taken so a thread that
+ * has seen the epoch can no longer find it.
+ *
+ * A thread that blocks waiting for events is not offline. The epoll instance
+ * of the thread can return pointers to any object that is still registered
+ * in it when the wait starts, also to one that another thread removes and
+ * defers during the wait. Before blocking, the thread records the current
+ * epoch as if it passed a quiescent state, and it keeps that epoch until the
+ * next qsbr_quiescent() at the end of the poll cycle that handles the events.
+ * An object deferred during the wait is therefore freed only after every
+ * thread that was blocked has handled the events of its wait. Only a thread
+ * that no longer polls, for example one that has stopped, goes offline.
+ *
+ * The objects are kept in a queue of the thread that deferred them and freed
+ * in batches by the same thread, so the objects can be freed with the
+ * thread-specific structures of that thread. The objects deferred by other
+ * threads are queued by the first polling thread that passes a quiescent state.
+ */
+
+#include "maxscale/qsbr.h"
+
+#include <string.h>
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/limits.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/spinlock.h>
+
+#include "maxscale/poll.h"
+
+/** Size of the queue of a thread when the first object is deferred */
+#define QSBR_INITIAL_SIZE 64
+
+typedef struct qsbr_deferred
+{
+    void     (*func)(void *data); /*< The function that frees the object */
+    void     *data;               /*< The object */
+    uint64_t epoch;               /*< The epoch after the object was unlinked */
+} QSBR_DEFERRED;
+
+typedef struct qsbr_thread
+{
+    uint64_t      epoch; /*< The latest epoch seen by the thread, 0 if the thread is offline */
+    QSBR_DEFERRED *items; /*< The objects deferred by the thread, oldest first */
+    size_t        head;  /*< The oldest object in @c items */
+    size_t        tail;  /*< One past the newest object in @c items */
+    size_t        size;  /*< Allocated size of @c items */
+} __attribute__((aligned(64))) QSBR_THREAD;
+
+typedef struct qsbr_orphan
+{
+    QSBR_DEFERRED      item;
+    struct qsbr_orphan *next;
+} QSBR_ORPHAN;
+
+static QSBR_THREAD qsbr_threads[MXS_MAX_THREADS];
+static int qsbr_n_threads = 0; /*< One past the largest ID of a thread that has been online */
+static uint64_t qsbr_epoch = 1;
+
+/** The objects deferred by threads that are not polling threads */
+static QSBR_ORPHAN *qsbr_orphans = NULL;
+static SPINLOCK qsbr_orphan_lock = SPINLOCK_INIT;
+
+/**
+ * @brief Add an object to the queue of a thread
+ *
+ * @param thread The queue of the thread
+ * @param item   The object
+ * @return True if the object was queued, false if memory allocation failed
+ */
+static bool qsbr_push(QSBR_THREAD *thread, const QSBR_DEFERRED *item)
+{
+    if (thread->tail == thread->size)
+    {
+        if (thread->head > 0)
+        {
+            size_t n = thread->tail - thread->head;
+            memmove(thread->items, thread->items + thread->head, n * sizeof(QSBR_DEFERRED));
+            thread->head = 0;
+            thread->tail = n;
+        }
+        else
+        {
+            size_t size = thread->size ? thread->size * 2 : QSBR_INITIAL_SIZE;
+            QSBR_DEFERRED *items = MXS_REALLOC(thread->items, size * sizeof(QSBR_DEFERRED));
+
+            if (items == NULL)
+            {
+                return false;
+            }
+
+            thread->items = items;
+            thread->size = size;
+        }
+    }
+
+    thread->items[thread->tail++] = *item;
+    return true;
+}
+
+void mxs_qsbr_defer(void (*func)(void *data), void *data)
+{
+    QSBR_DEFERRED item = {func, data, 0};
+
+    /** The full barrier of the increment orders the unlinking of the object
+     * before the epoch that the threads see */
+    item.epoch = atomic_add_uint64(&qsbr_epoch, 1) + 1;
+
+    if (poll_thread)
+    {
+        if (!qsbr_push(&qsbr_threads[current_thread_id], &item))
+        {
+            /** The object cannot be freed safely, it is leaked */
+            MXS_OOM();
+        }
+    }
+    else
+    {
+        QSBR_ORPHAN *orphan = MXS_MALLOC(sizeof(QSBR_ORPHAN));
+
+        if (orphan)
+        {
+            orphan->item = item;
+            spinlock_acquire(&qsbr_orphan_lock);
+            orphan->next = qsbr_orphans;
+            qsbr_orphans = orphan;
+            spinlock_release(&qsbr_orphan_lock);
+        }
+    }
+}
+
+/**
+ * @brief Move the objects deferred by other threads to the queue of a thread
+ *
+ * @param thread The queue of the calling polling thread
+ */
+static void qsbr_adopt_orphans(QSBR_THREAD *thread)
+{
+    spinlock_acquire(&qsbr_orphan_lock);
+    QSBR_ORPHAN *orphan = qsbr_orphans;
+    qsbr_orphans = NULL;
+    spinlock_release(&qsbr_orphan_lock);
+
+    while (orphan)
+    {
+        QSBR_ORPHAN *next = orphan->next;
+
+        if (!qsbr_push(thread, &orphan->item))
+        {
+            MXS_OOM();
+        }
+
+        MXS_FREE(orphan);
+        orphan = next;
+    }
+}
+
+/**
+ * @brief Get the oldest epoch that an online thread may still refer to
+ *
+ * @return The smallest epoch seen by the online threads
+ */
+static uint64_t qsbr_min_epoch()
+{
+    uint64_t min = UINT64_MAX;
+
+    atomic_synchronize();
+    int n_threads = qsbr_n_threads;
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        uint64_t epoch = qsbr_threads[i].epoch;
+
+        if (epoch != 0 && epoch < min)
+        {
+            min = epoch;
+        }
+    }
+
+    return min;
+}
+
+void qsbr_quiescent(int thread_id)
+{
+    QSBR_THREAD *thread = &qsbr_threads[thread_id];
+
+    /** The reads of the previous poll cycle complete before the new epoch is seen */
+    atomic_synchronize();
+    qsbr_online(thread_id);
+
+    if (qsbr_orphans)
+    {
+        qsbr_adopt_orphans(thread);
+    }
+
+    if (thread->head < thread->tail)
+    {
+        uint64_t min = qsbr_min_epoch();
+
+        /** The functions can defer more objects, they have a newer epoch */
+        while (thread->head < thread->tail && thread->items[thread->head].epoch <= min)
+        {
+            QSBR_DEFERRED item = thread->items[thread->head++];
+            item.func(item.data);
+        }
+
+        if (thread->head == thread->tail)
+        {
+            thread->head = thread->tail = 0;
+        }
+    }
+}
+
+void qsbr_blocking(int thread_id)
+{
+    /** The reads of the previous poll cycle complete before the new epoch is seen */
+    atomic_synchronize();
+    qsbr_threads[thread_id].epoch = qsbr_epoch;
+    atomic_synchronize();
+}
+
+void qsbr_offline(int thread_id)
+{
+    atomic_synchronize();
+    qsbr_threads[thread_id].epoch = 0;
+}
+
+void qsbr_online(int thread_id)
+{
+    if (thread_id >= qsbr_n_threads)
+    {
+        int n_threads = qsbr_n_threads;
+
+        while (n_threads <= thread_id &&
+               !atomic_cas_int(&qsbr_n_threads, &n_threads, thread_id + 1))
+        {
+            ;
+        }
+    }
+
+    qsbr_threads[thread_id].epoch = qsbr_epoch;
+
+    /** The epoch must be visible before the thread reads any shared objects */
+    atomic_synchronize();
+}
@@ -12,15 +12,24 @@
  */
 
 #include "maxscale/query_classifier.h"
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/config.h>
+#include <maxscale/hashtable.h>
+#include <maxscale/limits.h>
 #include <maxscale/log_manager.h>
 #include <maxscale/modutil.h>
-#include <maxscale/alloc.h>
 #include <maxscale/platform.h>
 #include <maxscale/pcre2.h>
+#include <maxscale/probes.h>
+#include <maxscale/protocol/mysql.h>
+#include <maxscale/session.h>
 #include <maxscale/utils.h>
 #include "maxscale/trxboundaryparser.hh"
+#include "maxscale/typemaskparser.hh"
 
 #include "../core/maxscale/modules.h"
+#include "../core/maxscale/poll.h"
 
 //#define QC_TRACE_ENABLED
 #undef QC_TRACE_ENABLED
@@ -39,10 +48,681 @@ struct type_name_info
 
 static const char DEFAULT_QC_NAME[] = "qc_sqlite";
 static const char QC_TRX_PARSE_USING[] = "QC_TRX_PARSE_USING";
+static const char QC_TYPE_MASK_PARSE_USING[] = "QC_TYPE_MASK_PARSE_USING";
 
 static QUERY_CLASSIFIER* classifier;
 
 static qc_trx_parse_using_t qc_trx_parse_using = QC_TRX_PARSE_USING_PARSER;
+static bool qc_type_mask_parse_using_parser = true;
+static size_t qc_large_statement_size = 0;
+
+/**
+ * Types whose presence means that the classification depends on the literals
+ * of the statement, e.g. "SET autocommit=0" and "SET autocommit=1".
+ */
+static const uint32_t QC_CACHE_LITERAL_TYPES = QUERY_TYPE_ENABLE_AUTOCOMMIT |
+                                               QUERY_TYPE_DISABLE_AUTOCOMMIT |
+                                               QUERY_TYPE_PREPARE_NAMED_STMT;
+
+/**
+ * The classification of all statements that have the same canonical form.
+ *
+ * An entry is referred to by the cache of the thread that created it and by
+ * the buffers that were classified using it. The buffers may outlive the
+ * presence of the entry in the cache, so the entry is reference counted.
+ */
+typedef struct qc_cache_entry
+{
+    int                    refcount;
+    uint64_t               key;                /**< Canonical digest of the statement */
+    bool                   cacheable;          /**< False, if the literals affect the result */
+    int32_t                parse_result;
+    uint32_t               type_mask;
+    int32_t                op;
+    char*                  created_table_name;
+    bool                   is_drop_table;
+    bool                   has_clause;
+    char**                 table_names;
+    int                    n_table_names;
+    char**                 full_table_names;
+    int                    n_full_table_names;
+    char**                 database_names;
+    int                    n_database_names;
+    QC_FIELD_INFO*         field_infos;
+    uint32_t               n_field_infos;
+    QC_FUNCTION_INFO*      function_infos;
+    uint32_t               n_function_infos;
+    struct qc_cache_entry* hnext;              /**< Next entry in the same bucket */
+    struct qc_cache_entry* prev;               /**< More recently used entry */
+    struct qc_cache_entry* next;               /**< Less recently used entry */
+} QC_CACHE_ENTRY;
+
+/** A per-thread LRU cache of classifications */
+typedef struct
+{
+    QC_CACHE_ENTRY** buckets;
+    size_t           n_buckets; /**< Always a power of two */
+    size_t           size;      /**< Number of entries in the cache */
+    size_t           max_size;  /**< Maximum number of entries */
+    QC_CACHE_ENTRY*  head;      /**< The most recently used entry */
+    QC_CACHE_ENTRY*  tail;      /**< The least recently used entry */
+} QC_CACHE;
+
+typedef struct
+{
+    int64_t n_hits;   /**< Statements whose classification was found in the cache */
+    int64_t n_misses; /**< Statements that had to be parsed */
+} QC_CACHE_STATS;
+
+static thread_local QC_CACHE* qc_thread_cache = NULL;
+static QC_CACHE_STATS qc_cache_stats[MXS_MAX_THREADS];
+
+static void qc_free_names(char** names, int n_names)
+{
+    if (names)
+    {
+        for (int i = 0; i < n_names; i++)
+        {
+            MXS_FREE(names[i]);
+        }
+
+        MXS_FREE(names);
+    }
+}
+
+static char** qc_copy_names(char** names, int n_names, int* sizep)
+{
+    char** rval = NULL;
+    *sizep = 0;
+
+    if (n_names > 0 && (rval = (char**)MXS_MALLOC(n_names * sizeof(char*))))
+    {
+        for (int i = 0; i < n_names; i++)
+        {
+            if ((rval[i] = MXS_STRDUP(names[i])) == NULL)
+            {
+                qc_free_names(rval, i);
+                return NULL;
+            }
+        }
+
+        *sizep = n_names;
+    }
+
+    return rval;
+}
+
+static void qc_cache_entry_free(QC_CACHE_ENTRY* entry)
+{
+    MXS_FREE(entry->created_table_name);
+    qc_free_names(entry->table_names, entry->n_table_names);
+    qc_free_names(entry->full_table_names, entry->n_full_table_names);
+    qc_free_names(entry->database_names, entry->n_database_names);
+
+    for (uint32_t i = 0; i < entry->n_field_infos; i++)
+    {
+        MXS_FREE(entry->field_infos[i].database);
+        MXS_FREE(entry->field_infos[i].table);
+        MXS_FREE(entry->field_infos[i].column);
+    }
+
+    for (uint32_t i = 0; i < entry->n_function_infos; i++)
+    {
+        MXS_FREE(entry->function_infos[i].name);
+    }
+
+    MXS_FREE(entry->field_infos);
+    MXS_FREE(entry->function_infos);
+    MXS_FREE(entry);
+}
+
+/**
+ * Release a reference to an entry. Also used as the buffer object cleanup
+ * function as the buffer may be freed by a thread other than the one that
+ * owns the cache.
+ */
+static void qc_cache_entry_release(void* data)
+{
+    QC_CACHE_ENTRY* entry = (QC_CACHE_ENTRY*)data;
+
+    if (atomic_add(&entry->refcount, -1) == 1)
+    {
+        qc_cache_entry_free(entry);
+    }
+}
+
+static char* qc_strdup_null(const char* str)
+{
+    return str ? MXS_STRDUP(str) : NULL;
+}
+
+static bool qc_cache_copy_infos(QC_CACHE_ENTRY* entry,
+                                const QC_FIELD_INFO* field_infos, uint32_t n_field_infos,
+                                const QC_FUNCTION_INFO* function_infos, uint32_t n_function_infos)
+{
+    if (n_field_infos > 0)
+    {
+        entry->field_infos = (QC_FIELD_INFO*)MXS_CALLOC(n_field_infos, sizeof(QC_FIELD_INFO));
+
+        if (entry->field_infos == NULL)
+        {
+            return false;
+        }
+
+        entry->n_field_infos = n_field_infos;
+
+        for (uint32_t i = 0; i < n_field_infos; i++)
+        {
+            QC_FIELD_INFO* info = &entry->field_infos[i];
+
+            info->database = qc_strdup_null(field_infos[i].database);
+            info->table = qc_strdup_null(field_infos[i].table);
+            info->column = qc_strdup_null(field_infos[i].column);
+            info->usage = field_infos[i].usage;
+
+            if ((field_infos[i].database && !info->database) ||
+                (field_infos[i].table && !info->table) ||
+                (field_infos[i].column && !info->column))
+            {
+                return false;
+            }
+        }
+    }
+
+    if (n_function_infos > 0)
+    {
+        entry->function_infos = (QC_FUNCTION_INFO*)MXS_CALLOC(n_function_infos, sizeof(QC_FUNCTION_INFO));
+
+        if (entry->function_infos == NULL)
+        {
+            return false;
+        }
+
+        entry->n_function_infos = n_function_infos;
+
+        for (uint32_t i = 0; i < n_function_infos; i++)
+        {
+            entry->function_infos[i].usage = function_infos[i].usage;
+
+            if (function_infos[i].name &&
+                (entry->function_infos[i].name = MXS_STRDUP(function_infos[i].name)) == NULL)
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Classify a statement completely with the plugin
+ *
+ * @param query The statement
+ * @param key   The cache key of the statement
+ *
+ * @return A new entry with one reference or NULL if memory allocation failed
+ */
+static QC_CACHE_ENTRY* qc_cache_entry_create(GWBUF* query, uint64_t key)
+{
+    QC_CACHE_ENTRY* entry = (QC_CACHE_ENTRY*)MXS_CALLOC(1, sizeof(QC_CACHE_ENTRY));
+
+    if (entry)
+    {
+        entry->refcount = 1;
+        entry->key = key;
+        entry->parse_result = QC_QUERY_INVALID;
+        entry->type_mask = QUERY_TYPE_UNKNOWN;
+        entry->op = QUERY_OP_UNDEFINED;
+
+        int32_t is_drop_table = 0;
+        int32_t has_clause = 0;
+        const QC_FIELD_INFO* field_infos = NULL;
+        uint32_t n_field_infos = 0;
+        const QC_FUNCTION_INFO* function_infos = NULL;
+        uint32_t n_function_infos = 0;
+
+        bool ok = classifier->qc_parse(query, QC_COLLECT_ALL, &entry->parse_result) == QC_RESULT_OK &&
+                  classifier->qc_get_type_mask(query, &entry->type_mask) == QC_RESULT_OK &&
+                  classifier->qc_get_operation(query, &entry->op) == QC_RESULT_OK &&
+                  classifier->qc_get_created_table_name(query, &entry->created_table_name) == QC_RESULT_OK &&
+                  classifier->qc_is_drop_table_query(query, &is_drop_table) == QC_RESULT_OK &&
+                  classifier->qc_query_has_clause(query, &has_clause) == QC_RESULT_OK &&
+                  classifier->qc_get_table_names(query, false, &entry->table_names,
+                                                 &entry->n_table_names) == QC_RESULT_OK &&
+                  classifier->qc_get_table_names(query, true, &entry->full_table_names,
+                                                 &entry->n_full_table_names) == QC_RESULT_OK &&
+                  classifier->qc_get_database_names(query, &entry->database_names,
+                                                    &entry->n_database_names) == QC_RESULT_OK &&
+                  classifier->qc_get_field_info(query, &field_infos, &n_field_infos) == QC_RESULT_OK &&
+                  classifier->qc_get_function_info(query, &function_infos, &n_function_infos) == QC_RESULT_OK &&
+                  qc_cache_copy_infos(entry, field_infos, n_field_infos, function_infos, n_function_infos);
+
+        entry->is_drop_table = is_drop_table != 0;
+        entry->has_clause = has_clause != 0;
+
+        /** Only completely parsed statements whose classification does not depend
+         * on the literals can be reused for other statements of the same form */
+        entry->cacheable = ok && entry->parse_result == QC_QUERY_PARSED &&
+                           (entry->type_mask & QC_CACHE_LITERAL_TYPES) == 0;
+    }
+
+    return entry;
+}
+
+/**
+ * Get the cache of the calling thread
+ *
+ * @return The cache or NULL if the calling thread is not a polling thread or
+ *         if the cache is disabled
+ */
+static inline QC_CACHE* qc_get_cache()
+{
+    if (qc_thread_cache == NULL && poll_thread && current_thread_id < MXS_MAX_THREADS)
+    {
+        int max_size = config_get_global_options()->qc_cache_size;
+
+        if (max_size > 0)
+        {
+            size_t n_buckets = 1;
+
+            while (n_buckets < (size_t)max_size)
+            {
+                n_buckets <<= 1;
+            }
+
+            QC_CACHE* cache = (QC_CACHE*)MXS_CALLOC(1, sizeof(QC_CACHE));
+            QC_CACHE_ENTRY** buckets = (QC_CACHE_ENTRY**)MXS_CALLOC(n_buckets, sizeof(QC_CACHE_ENTRY*));
+
+            if (cache && buckets)
+            {
+                cache->buckets = buckets;
+                cache->n_buckets = n_buckets;
+                cache->max_size = max_size;
+                qc_thread_cache = cache;
+            }
+            else
+            {
+                MXS_FREE(cache);
+                MXS_FREE(buckets);
+            }
+        }
+    }
+
+    return qc_thread_cache;
+}
+
+static void qc_cache_unlink(QC_CACHE* cache, QC_CACHE_ENTRY* entry)
+{
+    if (entry->prev)
+    {
+        entry->prev->next = entry->next;
+    }
+    else
+    {
+        cache->head = entry->next;
+    }
+
+    if (entry->next)
+    {
+        entry->next->prev = entry->prev;
+    }
+    else
+    {
+        cache->tail = entry->prev;
+    }
+
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+static void qc_cache_push_front(QC_CACHE* cache, QC_CACHE_ENTRY* entry)
+{
+    entry->prev = NULL;
+    entry->next = cache->head;
+
+    if (cache->head)
+    {
+        cache->head->prev = entry;
+    }
+    else
+    {
+        cache->tail = entry;
+    }
+
+    cache->head = entry;
+}
+
+static void qc_cache_remove(QC_CACHE* cache, QC_CACHE_ENTRY* entry)
+{
+    QC_CACHE_ENTRY** pp = &cache->buckets[entry->key & (cache->n_buckets - 1)];
+
+    while (*pp != entry)
+    {
+        pp = &(*pp)->hnext;
+    }
+
+    *pp = entry->hnext;
+    qc_cache_unlink(cache, entry);
+    cache->size--;
+    qc_cache_entry_release(entry);
+}
+
+static void qc_cache_free(QC_CACHE* cache)
+{
+    while (cache->head)
+    {
+        qc_cache_remove(cache, cache->head);
+    }
+
+    MXS_FREE(cache->buckets);
+    MXS_FREE(cache);
+}
+
+/**
+ * Calculate the cache key of a statement
+ *
+ * @param query The statement
+ * @param key   On return, the key
+ *
+ * @return True if the statement is a complete COM_QUERY or COM_STMT_PREPARE
+ */
+static bool qc_cache_key(GWBUF* query, uint64_t* key)
+{
+    uint8_t header[MYSQL_HEADER_LEN + 1];
+
+    if (gwbuf_copy_data(query, 0, sizeof(header), header) != sizeof(header) ||
+        gwbuf_length(query) < MYSQL_HEADER_LEN + MYSQL_GET_PAYLOAD_LEN(header) ||
+        !modutil_get_canonical_digest(query, key))
+    {
+        return false;
+    }
+
+    /** The same SQL is classified differently when it is prepared */
+    if (MYSQL_GET_COMMAND(header) == MYSQL_COM_STMT_PREPARE)
+    {
+        *key = ~*key;
+    }
+
+    return true;
+}
+
+/**
+ * Get the cached classification of a statement
+ *
+ * The first time a buffer is classified, its canonical digest is looked up
+ * from the cache of the calling thread. If the digest is not found, the
+ * statement is parsed completely and the result is stored in the cache. The
+ * entry is then attached to the buffer so that the subsequent calls with the
+ * same buffer need no lookup. The forms of statements whose classification
+ * depends on the literals are stored as not cacheable and such statements are
+ * classified by the plugin. A buffer that has already been parsed by the
+ * plugin is not looked up as the plugin has the classification at hand.
+ *
+ * @param query The statement
+ *
+ * @return The classification or NULL if the plugin must be used
+ */
+static QC_CACHE_ENTRY* qc_cache_get(GWBUF* query)
+{
+    QC_CACHE_ENTRY* entry = (QC_CACHE_ENTRY*)gwbuf_get_buffer_object_data(query, GWBUF_QC_CACHE);
+
+    if (entry == NULL && !GWBUF_IS_PARSED(query))
+    {
+        QC_CACHE* cache = qc_get_cache();
+        uint64_t key;
+
+        if (cache && qc_cache_key(query, &key))
+        {
+            QC_CACHE_ENTRY** bucket = &cache->buckets[key & (cache->n_buckets - 1)];
+
+            for (entry = *bucket; entry && entry->key != key; entry = entry->hnext)
+            {
+                ;
+            }
+
+            if (entry)
+            {
+                qc_cache_unlink(cache, entry);
+                qc_cache_push_front(cache, entry);
+
+                if (entry->cacheable)
+                {
+                    qc_cache_stats[current_thread_id].n_hits++;
+                    atomic_add(&entry->refcount, 1);
+                }
+                else
+                {
+                    /** The statement is classified by the plugin */
+                    qc_cache_stats[current_thread_id].n_misses++;
+                    entry = NULL;
+                }
+            }
+            else
+            {
+                qc_cache_stats[current_thread_id].n_misses++;
+
+                if ((entry = qc_cache_entry_create(query, key)))
+                {
+                    if (cache->size == cache->max_size)
+                    {
+                        qc_cache_remove(cache, cache->tail);
+                    }
+
+                    entry->hnext = *bucket;
+                    *bucket = entry;
+                    qc_cache_push_front(cache, entry);
+                    cache->size++;
+                    atomic_add(&entry->refcount, 1);
+                }
+            }
+
+            if (entry)
+            {
+                gwbuf_add_buffer_object(query, GWBUF_QC_CACHE, entry, qc_cache_entry_release);
+            }
+        }
+    }
+
+    return entry && entry->cacheable ? entry : NULL;
+}
+
+void qc_get_cache_stats(int64_t* n_hits, int64_t* n_misses)
+{
+    int64_t hits = 0;
+    int64_t misses = 0;
+
+    for (int i = 0; i < MXS_MAX_THREADS; i++)
+    {
+        hits += qc_cache_stats[i].n_hits;
+        misses += qc_cache_stats[i].n_misses;
+    }
+
+    *n_hits = hits;
+    *n_misses = misses;
+}
+
+/** A prepared statement stored in a session */
+typedef struct qc_ps_info
+{
+    uint32_t id;    /*< The ID of the statement, the key of the entry */
+    GWBUF*   stmt;  /*< The COM_STMT_PREPARE packet */
+} QC_PS_INFO;
+
+/** Offset of the statement ID in the binary protocol commands */
+#define QC_PS_ID_OFFSET (MYSQL_HEADER_LEN + 1)
+
+static int qc_ps_id_hash(const void* key)
+{
+    return *(const uint32_t*)key;
+}
+
+static int qc_ps_id_cmp(const void* v1, const void* v2)
+{
+    uint32_t i1 = *(const uint32_t*)v1;
+    uint32_t i2 = *(const uint32_t*)v2;
+
+    return i1 < i2 ? -1 : i1 > i2;
+}
+
+static void qc_ps_info_free(void* data)
+{
+    QC_PS_INFO* info = static_cast<QC_PS_INFO*>(data);
+
+    gwbuf_free(info->stmt);
+    MXS_FREE(info);
+}
+
+bool qc_ps_store(MXS_SESSION* session, uint32_t id, GWBUF* stmt)
+{
+    QC_TRACE();
+    ss_dassert(session);
+
+    if (session->ps_infos == NULL)
+    {
+        session->ps_infos = hashtable_alloc(16, qc_ps_id_hash, qc_ps_id_cmp);
+
+        if (session->ps_infos == NULL)
+        {
+            return false;
+        }
+
+        /** The key is a part of the value */
+        hashtable_memory_fns(session->ps_infos, NULL, NULL, NULL, qc_ps_info_free);
+    }
+
+    QC_PS_INFO* info = (QC_PS_INFO*)MXS_MALLOC(sizeof(*info));
+    GWBUF* clone = gwbuf_clone(stmt);
+
+    if (info == NULL || clone == NULL)
+    {
+        MXS_FREE(info);
+        gwbuf_free(clone);
+        return false;
+    }
+
+    info->id = id;
+    info->stmt = clone;
+
+    /** A server may reuse the ID of a closed statement */
+    hashtable_delete(session->ps_infos, &id);
+
+    if (hashtable_add(session->ps_infos, &info->id, info) == 0)
+    {
+        qc_ps_info_free(info);
+        return false;
+    }
+
+    return true;
+}
+
+GWBUF* qc_ps_lookup(MXS_SESSION* session, uint32_t id)
+{
+    QC_TRACE();
+    GWBUF* stmt = NULL;
+
+    if (session->ps_infos)
+    {
+        QC_PS_INFO* info = (QC_PS_INFO*)hashtable_fetch(session->ps_infos, &id);
+
+        if (info)
+        {
+            stmt = info->stmt;
+        }
+    }
+
+    return stmt;
+}
+
+GWBUF* qc_ps_lookup_by_command(MXS_SESSION* session, GWBUF* cmd)
+{
+    QC_TRACE();
+    uint8_t data[QC_PS_ID_OFFSET + 4];
+    GWBUF* stmt = NULL;
+
+    if (session->ps_infos &&
+        gwbuf_copy_data(cmd, 0, sizeof(data), data) == sizeof(data))
+    {
+        switch (data[MYSQL_HEADER_LEN])
+        {
+        case MYSQL_COM_STMT_EXECUTE:
+        case MXS_COM_STMT_BULK_EXECUTE:
+        case MYSQL_COM_STMT_SEND_LONG_DATA:
+        case MYSQL_COM_STMT_RESET:
+        case MYSQL_COM_STMT_FETCH:
+        case MYSQL_COM_STMT_CLOSE:
+            stmt = qc_ps_lookup(session, gw_mysql_get_byte4(data + QC_PS_ID_OFFSET));
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    return stmt;
+}
+
+void qc_ps_remove(MXS_SESSION* session, uint32_t id)
+{
+    QC_TRACE();
+
+    if (session->ps_infos)
+    {
+        hashtable_delete(session->ps_infos, &id);
+    }
+}
+
+void qc_ps_free(MXS_SESSION* session)
+{
+    QC_TRACE();
+
+    hashtable_free(session->ps_infos);
+    session->ps_infos = NULL;
+}
+
+/**
+ * Classify a statement by scanning its tokens
+ *
+ * The scan is not done if the buffer has already been parsed or classified
+ * using the cache, as then the complete classification is at hand.
+ *
+ * @param query      The statement
+ * @param type_mask  On return, the type mask of the statement
+ * @param op         On return, the operation of the statement
+ *
+ * @return True if the statement was classified, false if the plugin
+ *         or the cache must be used
+ */
+static bool qc_classify_using_parser(GWBUF* query, uint32_t* type_mask, qc_query_op_t* op)
+{
+    maxscale::TypeMaskParser parser;
+
+    return qc_type_mask_parse_using_parser &&
+           !GWBUF_IS_PARSED(query) &&
+           !gwbuf_get_buffer_object_data(query, GWBUF_QC_CACHE) &&
+           parser.classify(query, type_mask, op);
+}
+
+/**
+ * Classify a statement that is too large to be parsed without stalling the
+ * calling thread, using its first keyword only.
+ *
+ * @param query      The statement
+ * @param type_mask  On return, the type mask of the statement
+ * @param op         On return, the operation of the statement
+ *
+ * @return True if the statement was classified, false if the plugin
+ *         must be used
+ */
+static bool qc_classify_large_statement(GWBUF* query, uint32_t* type_mask, qc_query_op_t* op)
+{
+    maxscale::TypeMaskParser parser;
+
+    return qc_large_statement_size > 0 &&
+           !GWBUF_IS_PARSED(query) &&
+           gwbuf_length(query) > MYSQL_HEADER_LEN + 1 + qc_large_statement_size &&
+           parser.classify_by_keyword(query, type_mask, op);
+}
 
 
 bool qc_setup(const char* plugin_name, const char* plugin_args)
@@ -98,6 +778,29 @@ bool qc_process_init(uint32_t kind)
         }
     }
 
+    parse_using = getenv(QC_TYPE_MASK_PARSE_USING);
+
+    if (parse_using)
+    {
+        if (strcmp(parse_using, "QC_TYPE_MASK_PARSE_USING_QC") == 0)
+        {
+            qc_type_mask_parse_using_parser = false;
+            MXS_NOTICE("Statement classification using QC only.");
+        }
+        else if (strcmp(parse_using, "QC_TYPE_MASK_PARSE_USING_PARSER") == 0)
+        {
+            qc_type_mask_parse_using_parser = true;
+            MXS_NOTICE("Statement classification using custom PARSER when possible.");
+        }
+        else
+        {
+            MXS_NOTICE("QC_TYPE_MASK_PARSE_USING set, but the value %s is not known. "
+                       "Parsing using custom PARSER when possible.", parse_using);
+        }
+    }
+
+    qc_large_statement_size = config_get_global_options()->qc_large_statement_size;
+
     bool rc = qc_thread_init(QC_INIT_SELF);
 
     if (rc)
@@ -176,6 +879,12 @@ void qc_thread_end(uint32_t kind)
     {
         classifier->qc_thread_end();
     }
+
+    if ((kind & QC_INIT_SELF) && qc_thread_cache)
+    {
+        qc_cache_free(qc_thread_cache);
+        qc_thread_cache = NULL;
+    }
 }
 
 qc_parse_result_t qc_parse(GWBUF* query, uint32_t collect)
@@ -184,8 +893,18 @@ qc_parse_result_t qc_parse(GWBUF* query, uint32_t collect)
     ss_dassert(classifier);
 
     int32_t result = QC_QUERY_INVALID;
+    QC_CACHE_ENTRY* entry = qc_cache_get(query);
+
+    if (entry)
+    {
+        result = entry->parse_result;
+    }
+    else
+    {
+        classifier->qc_parse(query, collect, &result);
+    }
 
-    classifier->qc_parse(query, collect, &result);
+    MXS_PROBE3(qc_parse, GWBUF_LENGTH(query), result, entry != NULL);
 
     return (qc_parse_result_t)result;
 }
@@ -196,8 +915,21 @@ uint32_t qc_get_type_mask(GWBUF* query)
     ss_dassert(classifier);
 
     uint32_t type_mask = QUERY_TYPE_UNKNOWN;
+    qc_query_op_t op;
 
-    classifier->qc_get_type_mask(query, &type_mask);
+    if (!qc_classify_using_parser(query, &type_mask, &op))
+    {
+        QC_CACHE_ENTRY* entry = qc_cache_get(query);
+
+        if (entry)
+        {
+            type_mask = entry->type_mask;
+        }
+        else if (!qc_classify_large_statement(query, &type_mask, &op))
+        {
+            classifier->qc_get_type_mask(query, &type_mask);
+        }
+    }
 
     return type_mask;
 }
@@ -207,11 +939,31 @@ qc_query_op_t qc_get_operation(GWBUF* query)
     QC_TRACE();
     ss_dassert(classifier);
 
-    int32_t op = QUERY_OP_UNDEFINED;
+    uint32_t type_mask;
+    qc_query_op_t op = QUERY_OP_UNDEFINED;
+
+    if (!qc_classify_using_parser(query, &type_mask, &op))
+    {
+        QC_CACHE_ENTRY* entry = qc_cache_get(query);
+        int32_t plugin_op = QUERY_OP_UNDEFINED;
+
+        if (entry)
+        {
+            plugin_op = entry->op;
+        }
+        else if (qc_classify_large_statement(query, &type_mask, &op))
+        {
+            plugin_op = op;
+        }
+        else
+        {
+            classifier->qc_get_operation(query, &plugin_op);
+        }
 
-    classifier->qc_get_operation(query, &op);
+        op = (qc_query_op_t)plugin_op;
+    }
 
-    return (qc_query_op_t)op;
+    return op;
 }
 
 char* qc_get_created_table_name(GWBUF* query)
@@ -220,8 +972,16 @@ char* qc_get_created_table_name(GWBUF* query)
     ss_dassert(classifier);
 
     char* name = NULL;
+    QC_CACHE_ENTRY* entry = qc_cache_get(query);
 
-    classifier->qc_get_created_table_name(query, &name);
+    if (entry)
+    {
+        name = entry->created_table_name ? MXS_STRDUP(entry->created_table_name) : NULL;
+    }
+    else
+    {
+        classifier->qc_get_created_table_name(query, &name);
+    }
 
     return name;
 }
@@ -232,8 +992,16 @@ bool qc_is_drop_table_query(GWBUF* query)
     ss_dassert(classifier);
 
     int32_t is_drop_table = 0;
+    QC_CACHE_ENTRY* entry = qc_cache_get(query);
 
-    classifier->qc_is_drop_table_query(query, &is_drop_table);
+    if (entry)
+    {
+        is_drop_table = entry->is_drop_table;
+    }
+    else
+    {
+        classifier->qc_is_drop_table_query(query, &is_drop_table);
+    }
 
     return (is_drop_table != 0) ? true : false;
 }
@@ -245,8 +1013,18 @@ char** qc_get_table_names(GWBUF* query, int* tblsize, bool fullnames)
 
     char** names = NULL;
     *tblsize = 0;
+    QC_CACHE_ENTRY* entry = qc_cache_get(query);
 
-    classifier->qc_get_table_names(query, fullnames, &names, tblsize);
+    if (entry)
+    {
+        names = fullnames ?
+            qc_copy_names(entry->full_table_names, entry->n_full_table_names, tblsize) :
+            qc_copy_names(entry->table_names, entry->n_table_names, tblsize);
+    }
+    else
+    {
+        classifier->qc_get_table_names(query, fullnames, &names, tblsize);
+    }
 
     return names;
 }
@@ -275,14 +1053,29 @@ char* qc_get_canonical(GWBUF* query)
     return rval;
 }
 
+bool qc_get_canonical_digest(GWBUF* query, uint64_t* digest)
+{
+    QC_TRACE();
+
+    return modutil_get_canonical_digest(query, digest);
+}
+
 bool qc_query_has_clause(GWBUF* query)
 {
     QC_TRACE();
     ss_dassert(classifier);
 
     int32_t has_clause = 0;
+    QC_CACHE_ENTRY* entry = qc_cache_get(query);
 
-    classifier->qc_query_has_clause(query, &has_clause);
+    if (entry)
+    {
+        has_clause = entry->has_clause;
+    }
+    else
+    {
+        classifier->qc_query_has_clause(query, &has_clause);
+    }
 
     return (has_clause != 0) ? true : false;
 }
@@ -295,8 +1088,17 @@ void qc_get_field_info(GWBUF* query, const QC_FIELD_INFO** infos, size_t* n_info
     *infos = NULL;
 
     uint32_t n = 0;
+    QC_CACHE_ENTRY* entry = qc_cache_get(query);
 
-    classifier->qc_get_field_info(query, infos, &n);
+    if (entry)
+    {
+        *infos = entry->field_infos;
+        n = entry->n_field_infos;
+    }
+    else
+    {
+        classifier->qc_get_field_info(query, infos, &n);
+    }
 
     *n_infos = n;
 }
@@ -309,8 +1111,17 @@ void qc_get_function_info(GWBUF* query, const QC_FUNCTION_INFO** infos, size_t*
     *infos = NULL;
 
     uint32_t n = 0;
+    QC_CACHE_ENTRY* entry = qc_cache_get(query);
 
-    classifier->qc_get_function_info(query, infos, &n);
+    if (entry)
+    {
+        *infos = entry->function_infos;
+        n = entry->n_function_infos;
+    }
+    else
+    {
+        classifier->qc_get_function_info(query, infos, &n);
+    }
 
     *n_infos = n;
 }
@@ -322,8 +1133,16 @@ char** qc_get_database_names(GWBUF* query, int* sizep)
 
     char** names = NULL;
     *sizep = 0;
+    QC_CACHE_ENTRY* entry = qc_cache_get(query);
 
-    classifier->qc_get_database_names(query, &names, sizep);
+    if (entry)
+    {
+        names = qc_copy_names(entry->database_names, entry->n_database_names, sizep);
+    }
+    else
+    {
+        classifier->qc_get_database_names(query, &names, sizep);
+    }
 
     return names;
 }
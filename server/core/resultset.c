@@ -24,6 +24,7 @@
  */
 
 #include <string.h>
+#include <stdlib.h>
 #include <ctype.h>
 #include <maxscale/alloc.h>
 #include <maxscale/resultset.h>
@@ -31,10 +32,12 @@
 #include <maxscale/dcb.h>
 
 
-static int mysql_send_fieldcount(DCB *, int);
-static int mysql_send_columndef(DCB *, const char *, int, int, uint8_t);
-static int mysql_send_eof(DCB *, int);
-static int mysql_send_row(DCB *, RESULT_ROW *, int);
+static int mysql_send_fieldcount(GWBUF **, int);
+static int mysql_send_columndef(GWBUF **, const char *, int, int, uint8_t);
+static int mysql_send_eof(GWBUF **, int);
+static int mysql_send_row(GWBUF **, RESULT_ROW *, int);
+
+static RESULT_ROW *resultset_fetch(RESULTSET *);
 
 
 /**
@@ -55,6 +58,18 @@ resultset_create(RESULT_ROW_CB func, void *data)
         rval->column = NULL;
         rval->userdata = data;
         rval->fetchrow = func;
+        rval->exhausted = false;
+        rval->where_col = -1;
+        rval->where_value = NULL;
+        rval->order_col = -1;
+        rval->order_desc = false;
+        rval->limit = -1;
+        rval->n_rows = 0;
+        rval->sorted = NULL;
+        rval->n_sorted = 0;
+        rval->next_sorted = 0;
+        rval->started = false;
+        rval->seqno = 0;
     }
     return rval;
 }
@@ -71,6 +86,22 @@ resultset_free(RESULTSET *resultset)
 
     if (resultset != NULL)
     {
+        /** The row callbacks free their data when they run out of rows */
+        RESULT_ROW *row;
+
+        while ((row = resultset_fetch(resultset)) != NULL)
+        {
+            resultset_free_row(row);
+        }
+
+        for (int i = resultset->next_sorted; i < resultset->n_sorted; i++)
+        {
+            resultset_free_row(resultset->sorted[i]);
+        }
+
+        MXS_FREE(resultset->sorted);
+        MXS_FREE(resultset->where_value);
+
         col = resultset->column;
         while (col)
         {
@@ -229,6 +260,231 @@ resultset_row_set(RESULT_ROW *row, int col, const char *value)
     return 1;
 }
 
+/**
+ * Fetch the next row from the row callback of a result set
+ *
+ * @param set   The result set
+ * @return      The next row or NULL when the callback has run out of rows
+ */
+static RESULT_ROW *
+resultset_fetch(RESULTSET *set)
+{
+    RESULT_ROW *row = NULL;
+
+    if (!set->exhausted && (row = (*set->fetchrow)(set, set->userdata)) == NULL)
+    {
+        set->exhausted = true;
+    }
+
+    return row;
+}
+
+int
+resultset_column_index(RESULTSET *set, const char *name)
+{
+    int i = 0;
+
+    for (RESULT_COLUMN *col = set->column; col; col = col->next, i++)
+    {
+        if (strcasecmp(col->name, name) == 0)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+bool
+resultset_set_where(RESULTSET *set, int col, const char *value)
+{
+    char *copy = MXS_STRDUP(value);
+
+    if (copy)
+    {
+        MXS_FREE(set->where_value);
+        set->where_value = copy;
+        set->where_col = col;
+    }
+
+    return copy != NULL;
+}
+
+void
+resultset_set_order(RESULTSET *set, int col, bool desc)
+{
+    set->order_col = col;
+    set->order_desc = desc;
+}
+
+void
+resultset_set_limit(RESULTSET *set, int limit)
+{
+    set->limit = limit;
+}
+
+/**
+ * Check whether a row matches the WHERE setting of a result set
+ */
+static bool
+resultset_row_matches(RESULTSET *set, RESULT_ROW *row)
+{
+    return set->where_col < 0 ||
+           (row->cols[set->where_col] && strcmp(row->cols[set->where_col], set->where_value) == 0);
+}
+
+/**
+ * Compare two rows by the ORDER BY column of a result set. Numbers are
+ * compared as numbers and NULL values are smaller than anything else.
+ */
+static int
+resultset_row_compare(const void *a, const void *b, void *data)
+{
+    RESULTSET *set = (RESULTSET *)data;
+    const char *v1 = (*(RESULT_ROW * const *)a)->cols[set->order_col];
+    const char *v2 = (*(RESULT_ROW * const *)b)->cols[set->order_col];
+    int rval;
+
+    if (v1 == NULL || v2 == NULL)
+    {
+        rval = (v1 != NULL) - (v2 != NULL);
+    }
+    else
+    {
+        char *end1, *end2;
+        double d1 = strtod(v1, &end1);
+        double d2 = strtod(v2, &end2);
+
+        if (*v1 && *v2 && *end1 == '\0' && *end2 == '\0')
+        {
+            rval = (d1 > d2) - (d1 < d2);
+        }
+        else
+        {
+            rval = strcmp(v1, v2);
+        }
+    }
+
+    return set->order_desc ? -rval : rval;
+}
+
+/**
+ * Read and order all the matching rows of a result set. With a limit only
+ * the first rows in the order are kept, so that the memory used is bounded
+ * by the limit and not by the size of the result set.
+ */
+static void
+resultset_sort(RESULTSET *set)
+{
+    RESULT_ROW *row;
+    int size = 0;
+
+    while ((row = resultset_fetch(set)) != NULL)
+    {
+        if (!resultset_row_matches(set, row) || set->limit == 0)
+        {
+            resultset_free_row(row);
+            continue;
+        }
+
+        int pos = set->n_sorted;
+
+        if (set->limit > 0)
+        {
+            /** Binary search for the position of the row among the kept rows */
+            int lo = 0, hi = set->n_sorted;
+
+            while (lo < hi)
+            {
+                int mid = (lo + hi) / 2;
+
+                if (resultset_row_compare(&set->sorted[mid], &row, set) <= 0)
+                {
+                    lo = mid + 1;
+                }
+                else
+                {
+                    hi = mid;
+                }
+            }
+
+            pos = lo;
+
+            if (pos >= set->limit)
+            {
+                resultset_free_row(row);
+                continue;
+            }
+            else if (set->n_sorted == set->limit)
+            {
+                resultset_free_row(set->sorted[--set->n_sorted]);
+            }
+        }
+
+        if (set->n_sorted == size)
+        {
+            int new_size = size ? size * 2 : 64;
+            RESULT_ROW **sorted = MXS_REALLOC(set->sorted, new_size * sizeof(RESULT_ROW *));
+
+            if (sorted == NULL)
+            {
+                resultset_free_row(row);
+                continue;
+            }
+
+            set->sorted = sorted;
+            size = new_size;
+        }
+
+        memmove(&set->sorted[pos + 1], &set->sorted[pos], (set->n_sorted - pos) * sizeof(RESULT_ROW *));
+        set->sorted[pos] = row;
+        set->n_sorted++;
+    }
+
+    if (set->limit < 0 && set->n_sorted > 1)
+    {
+        qsort_r(set->sorted, set->n_sorted, sizeof(RESULT_ROW *), resultset_row_compare, set);
+    }
+}
+
+RESULT_ROW *
+resultset_next_row(RESULTSET *set)
+{
+    RESULT_ROW *row = NULL;
+
+    if (set->limit >= 0 && set->n_rows >= set->limit)
+    {
+        return NULL;
+    }
+
+    if (set->order_col >= 0)
+    {
+        if (!set->exhausted)
+        {
+            resultset_sort(set);
+        }
+
+        if (set->next_sorted < set->n_sorted)
+        {
+            row = set->sorted[set->next_sorted++];
+        }
+    }
+    else
+    {
+        while ((row = resultset_fetch(set)) != NULL && !resultset_row_matches(set, row))
+        {
+            resultset_free_row(row);
+        }
+    }
+
+    if (row)
+    {
+        set->n_rows++;
+    }
+
+    return row;
+}
+
 /**
  * Stream a result set using the MySQL protocol for encodign the result
  * set. Each row is retrieved by calling the function passed in the
@@ -240,36 +496,71 @@ resultset_row_set(RESULT_ROW *row, int col, const char *value)
 void
 resultset_stream_mysql(RESULTSET *set, DCB *dcb)
 {
-    RESULT_COLUMN *col;
-    RESULT_ROW *row;
-    uint8_t seqno = 2;
+    while (!resultset_stream_mysql_chunk(set, dcb, RESULTSET_CHUNK_ROWS))
+    {
+        ;
+    }
+}
 
-    mysql_send_fieldcount(dcb, set->n_cols);
+bool
+resultset_stream_mysql_chunk(RESULTSET *set, DCB *dcb, int max_rows)
+{
+    GWBUF *chunk = NULL;
+    RESULT_ROW *row;
+    bool done = true;
 
-    col = set->column;
-    while (col)
+    if (!set->started)
     {
-        mysql_send_columndef(dcb, col->name, col->type, col->len, seqno++);
-        col = col->next;
+        mysql_send_fieldcount(&chunk, set->n_cols);
+        set->seqno = 2;
+
+        for (RESULT_COLUMN *col = set->column; col; col = col->next)
+        {
+            mysql_send_columndef(&chunk, col->name, col->type, col->len, set->seqno++);
+        }
+
+        mysql_send_eof(&chunk, set->seqno++);
+        set->started = true;
     }
-    mysql_send_eof(dcb, seqno++);
-    while ((row = (*set->fetchrow)(set, set->userdata)) != NULL)
+
+    for (int i = 0; i < max_rows; i++)
     {
-        mysql_send_row(dcb, row, seqno++);
+        if ((row = resultset_next_row(set)) == NULL)
+        {
+            break;
+        }
+
+        mysql_send_row(&chunk, row, set->seqno++);
         resultset_free_row(row);
+
+        if (i == max_rows - 1)
+        {
+            done = false;
+        }
+    }
+
+    if (done)
+    {
+        mysql_send_eof(&chunk, set->seqno);
     }
-    mysql_send_eof(dcb, seqno);
+
+    if (chunk)
+    {
+        dcb->func.write(dcb, chunk);
+    }
+
+    return done;
 }
 
 /**
- * Send the field count packet in a response packet sequence.
+ * Add the field count packet to a response packet sequence.
  *
- * @param dcb           DCB of connection to send result set to
+ * @param chunk         The chunk the packet is added to
  * @param count         Number of columns in the result set
  * @return              Non-zero on success
  */
 static int
-mysql_send_fieldcount(DCB *dcb, int count)
+mysql_send_fieldcount(GWBUF **chunk, int count)
 {
     GWBUF *pkt;
     uint8_t *ptr;
@@ -284,14 +575,15 @@ mysql_send_fieldcount(DCB *dcb, int count)
     *ptr++ = 0x00;
     *ptr++ = 0x01;                  // Sequence number in response
     *ptr++ = count;                 // Length of result string
-    return dcb->func.write(dcb, pkt);
+    *chunk = gwbuf_append(*chunk, pkt);
+    return 1;
 }
 
 
 /**
- * Send the column definition packet in a response packet sequence.
+ * Add the column definition packet to a response packet sequence.
  *
- * @param dcb           The DCB of the connection
+ * @param chunk         The chunk the packet is added to
  * @param name          Name of the column
  * @param type          Column type
  * @param len           Column length
@@ -299,7 +591,7 @@ mysql_send_fieldcount(DCB *dcb, int count)
  * @return              Non-zero on success
  */
 static int
-mysql_send_columndef(DCB *dcb, const char *name, int type, int len, uint8_t seqno)
+mysql_send_columndef(GWBUF **chunk, const char *name, int type, int len, uint8_t seqno)
 {
     GWBUF *pkt;
     uint8_t *ptr;
@@ -348,19 +640,20 @@ mysql_send_columndef(DCB *dcb, const char *name, int type, int len, uint8_t seqn
     *ptr++ = 0;
     *ptr++ = 0;
     *ptr++ = 0;
-    return dcb->func.write(dcb, pkt);
+    *chunk = gwbuf_append(*chunk, pkt);
+    return 1;
 }
 
 
 /**
- * Send an EOF packet in a response packet sequence.
+ * Add an EOF packet to a response packet sequence.
  *
- * @param dcb           The client connection
+ * @param chunk         The chunk the packet is added to
  * @param seqno         The sequence number of the EOF packet
  * @return              Non-zero on success
  */
 static int
-mysql_send_eof(DCB *dcb, int seqno)
+mysql_send_eof(GWBUF **chunk, int seqno)
 {
     GWBUF   *pkt;
     uint8_t *ptr;
@@ -379,21 +672,22 @@ mysql_send_eof(DCB *dcb, int seqno)
     *ptr++ = 0x00;
     *ptr++ = 0x02;                          // Autocommit enabled
     *ptr++ = 0x00;
-    return dcb->func.write(dcb, pkt);
+    *chunk = gwbuf_append(*chunk, pkt);
+    return 1;
 }
 
 
 
 /**
- * Send a row packet in a response packet sequence.
+ * Add a row packet to a response packet sequence.
  *
- * @param dcb           The client connection
+ * @param chunk         The chunk the packet is added to
  * @param row           The row to send
  * @param seqno         The sequence number of the EOF packet
  * @return              Non-zero on success
  */
 static int
-mysql_send_row(DCB *dcb, RESULT_ROW *row, int seqno)
+mysql_send_row(GWBUF **chunk, RESULT_ROW *row, int seqno)
 {
     GWBUF *pkt;
     int i, len = 4;
@@ -404,6 +698,11 @@ mysql_send_row(DCB *dcb, RESULT_ROW *row, int seqno)
         if (row->cols[i])
         {
             len += strlen(row->cols[i]);
+
+            if (strlen(row->cols[i]) >= 0xfb)
+            {
+                len += 2;           // Two byte length-encoded length
+            }
         }
         len++;
     }
@@ -423,7 +722,16 @@ mysql_send_row(DCB *dcb, RESULT_ROW *row, int seqno)
         if (row->cols[i])
         {
             len = strlen(row->cols[i]);
-            *ptr++ = len;
+            if (len >= 0xfb)
+            {
+                *ptr++ = 0xfc;
+                *ptr++ = len & 0xff;
+                *ptr++ = (len >> 8) & 0xff;
+            }
+            else
+            {
+                *ptr++ = len;
+            }
             memcpy(ptr, row->cols[i], len);
             ptr += len;
         }
@@ -433,7 +741,8 @@ mysql_send_row(DCB *dcb, RESULT_ROW *row, int seqno)
         }
     }
 
-    return dcb->func.write(dcb, pkt);
+    *chunk = gwbuf_append(*chunk, pkt);
+    return 1;
 }
 
 /**
@@ -479,7 +788,7 @@ resultset_stream_json(RESULTSET *set, DCB *dcb)
     int rowno = 0;
 
     dcb_printf(dcb, "[ ");
-    while ((row = (*set->fetchrow)(set, set->userdata)) != NULL)
+    while ((row = resultset_next_row(set)) != NULL)
     {
         int i = 0;
         if (rowno++ > 0)
@@ -32,12 +32,15 @@
  *
  * @endverbatim
  */
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <time.h>
+#include <maxscale/atomic.h>
 #include <maxscale/service.h>
 #include <maxscale/session.h>
 #include <maxscale/server.h>
@@ -48,7 +51,9 @@
 #include <maxscale/ssl.h>
 #include <maxscale/alloc.h>
 #include <maxscale/paths.h>
+#include <maxscale/utils.h>
 
+#include "maxscale/metrics.h"
 #include "maxscale/monitor.h"
 #include "maxscale/poll.h"
 
@@ -58,6 +63,21 @@
 static SPINLOCK server_spin = SPINLOCK_INIT;
 static SERVER *allServers = NULL;
 
+/** The maximum number of threads that have their own slot for reading snapshots */
+#define SNAPSHOT_READER_SLOTS 256
+
+static MXS_SERVER_SNAPSHOT *current_snapshot = NULL;
+static int64_t snapshot_version = 0;
+static SPINLOCK snapshot_lock = SPINLOCK_INIT; /**< Serializes the publishers */
+static MXS_SERVER_SNAPSHOT *retired_snapshots = NULL;
+static int64_t snapshot_epoch = 1;
+static int64_t snapshot_readers[SNAPSHOT_READER_SLOTS]; /**< Epoch of each reader, 0 if not reading */
+static int snapshot_n_slots = 0;
+static int snapshot_overflow_readers = 0; /**< Readers without a slot */
+static __thread int snapshot_slot = -1;
+static __thread int snapshot_depth = 0;
+static int status_version = 0;
+
 static void spin_reporter(void *, char *, int);
 static void server_parameter_free(SERVER_PARAM *tofree);
 
@@ -125,6 +145,13 @@ SERVER* server_alloc(const char *name, const char *address, unsigned short port,
     server->status_pending = SERVER_RUNNING;
     server->node_id = -1;
     server->rlag = MAX_RLAG_UNDEFINED;
+    server->rlag_ms = MAX_RLAG_UNDEFINED;
+    server->load_score = 0;
+    server_clear_load_metrics(server);
+    server->gtid_pos[0] = '\0';
+    server->variables = NULL;
+    server->n_variables = 0;
+    server->collation_id = 0;
     server->master_id = -1;
     server->depth = -1;
     server->parameters = NULL;
@@ -134,6 +161,14 @@ SERVER* server_alloc(const char *name, const char *address, unsigned short port,
     server->persistmax = 0;
     server->persistmaxtime = 0;
     server->persistpoolmax = 0;
+    server->persistpoolmin = 0;
+    server->compression = false;
+    server->socket = NULL;
+    server->max_concurrent_queries = 0;
+    server->max_queue_time = 0;
+    spinlock_init(&server->queue_lock);
+    server->queue_head = NULL;
+    server->queue_tail = NULL;
     server->monuser[0] = '\0';
     server->monpw[0] = '\0';
     server->is_active = true;
@@ -143,9 +178,12 @@ SERVER* server_alloc(const char *name, const char *address, unsigned short port,
     // Log all warnings once
     memset(&server->log_warning, 1, sizeof(server->log_warning));
 
+    spinlock_register(&server_spin, "servers");
     spinlock_acquire(&server_spin);
     server->next = allServers;
-    allServers = server;
+    /** Published with a release store so that server_metrics() can walk
+     * the list without taking the lock */
+    __atomic_store_n(&allServers, server, __ATOMIC_RELEASE);
     spinlock_release(&server_spin);
 
     return server;
@@ -187,6 +225,8 @@ server_free(SERVER *tofreeserver)
     MXS_FREE(tofreeserver->protocol);
     MXS_FREE(tofreeserver->unique_name);
     MXS_FREE(tofreeserver->server_string);
+    MXS_FREE(tofreeserver->socket);
+    server_set_variables(tofreeserver, NULL, 0, 0);
     server_parameter_free(tofreeserver->parameters);
 
     if (tofreeserver->persistent)
@@ -462,17 +502,52 @@ dprintAllServersJson(DCB *dcb)
             {
                 dcb_printf(dcb, "    \"slaveDelay\": \"%d\",\n", server->rlag);
             }
+            if (server->rlag_ms >= 0)
+            {
+                dcb_printf(dcb, "    \"slaveDelayMs\": \"%d\",\n", server->rlag_ms);
+            }
         }
         if (server->node_ts > 0)
         {
             dcb_printf(dcb, "    \"lastReplHeartbeat\": \"%lu\",\n", server->node_ts);
         }
+        dcb_printf(dcb, "    \"loadScore\": \"%d\",\n", server->load_score);
+        if (server->load_metrics.threads_running >= 0)
+        {
+            dcb_printf(dcb, "    \"threadsRunning\": \"%d\",\n",
+                       server->load_metrics.threads_running);
+        }
+        if (server->load_metrics.qps >= 0)
+        {
+            dcb_printf(dcb, "    \"queriesPerSecond\": \"%d\",\n", server->load_metrics.qps);
+        }
+        if (server->load_metrics.row_lock_waits >= 0)
+        {
+            dcb_printf(dcb, "    \"rowLockWaits\": \"%d\",\n",
+                       server->load_metrics.row_lock_waits);
+        }
+        if (server->load_metrics.cpu >= 0)
+        {
+            dcb_printf(dcb, "    \"cpuUsage\": \"%d\",\n", server->load_metrics.cpu);
+        }
         dcb_printf(dcb, "    \"totalConnections\": \"%d\",\n",
                    server->stats.n_connections);
         dcb_printf(dcb, "    \"currentConnections\": \"%d\",\n",
                    server->stats.n_current);
-        dcb_printf(dcb, "    \"currentOps\": \"%d\"\n",
+        dcb_printf(dcb, "    \"currentOps\": \"%d\",\n",
                    server->stats.n_current_ops);
+        dcb_printf(dcb, "    \"queuedOps\": \"%d\",\n",
+                   server->stats.n_queued);
+        dcb_printf(dcb, "    \"totalQueuedOps\": \"%lu\",\n",
+                   server->stats.n_queued_total);
+        dcb_printf(dcb, "    \"queueTimeouts\": \"%lu\",\n",
+                   server->stats.n_queue_timeouts);
+        dcb_printf(dcb, "    \"responseTimeP50\": \"%lu\",\n",
+                   histogram_percentile(&server->stats.response_times, 50));
+        dcb_printf(dcb, "    \"responseTimeP95\": \"%lu\",\n",
+                   histogram_percentile(&server->stats.response_times, 95));
+        dcb_printf(dcb, "    \"responseTimeP99\": \"%lu\"\n",
+                   histogram_percentile(&server->stats.response_times, 99));
         if (el < len)
         {
             dcb_printf(dcb, "  },\n");
@@ -511,6 +586,10 @@ dprintServer(DCB *dcb, const SERVER *server)
     MXS_FREE(stat);
     dcb_printf(dcb, "\tProtocol:                            %s\n", server->protocol);
     dcb_printf(dcb, "\tPort:                                %d\n", server->port);
+    if (server->socket)
+    {
+        dcb_printf(dcb, "\tSocket:                              %s\n", server->socket);
+    }
     if (server->server_string)
     {
         dcb_printf(dcb, "\tServer Version:                      %s\n", server->server_string);
@@ -541,6 +620,42 @@ dprintServer(DCB *dcb, const SERVER *server)
         {
             dcb_printf(dcb, "\tSlave delay:                         %d\n", server->rlag);
         }
+        if (server->rlag_ms >= 0)
+        {
+            dcb_printf(dcb, "\tSlave delay in milliseconds:         %d\n", server->rlag_ms);
+        }
+    }
+    if (server->load_score > 0)
+    {
+        dcb_printf(dcb, "\tLoad score:                          %d\n", server->load_score);
+    }
+    if (server->load_metrics.threads_running >= 0)
+    {
+        dcb_printf(dcb, "\tThreads running:                     %d\n",
+                   server->load_metrics.threads_running);
+    }
+    if (server->load_metrics.qps >= 0)
+    {
+        dcb_printf(dcb, "\tQueries per second:                  %d\n", server->load_metrics.qps);
+    }
+    if (server->load_metrics.row_lock_waits >= 0)
+    {
+        dcb_printf(dcb, "\tRow lock waits:                      %d\n",
+                   server->load_metrics.row_lock_waits);
+    }
+    if (server->load_metrics.cpu >= 0)
+    {
+        dcb_printf(dcb, "\tCPU usage:                           %d%%\n", server->load_metrics.cpu);
+    }
+    if (server->n_variables > 0)
+    {
+        dcb_printf(dcb, "\tCached global variables:             %d\n", server->n_variables);
+    }
+    if (server->gtid_pos[0])
+    {
+        spinlock_acquire(&server->lock);
+        dcb_printf(dcb, "\tGTID position:                       %s\n", server->gtid_pos);
+        spinlock_release(&server->lock);
     }
     if (server->node_ts > 0)
     {
@@ -566,6 +681,30 @@ dprintServer(DCB *dcb, const SERVER *server)
     dcb_printf(dcb, "\tNumber of connections:               %d\n", server->stats.n_connections);
     dcb_printf(dcb, "\tCurrent no. of conns:                %d\n", server->stats.n_current);
     dcb_printf(dcb, "\tCurrent no. of operations:           %d\n", server->stats.n_current_ops);
+    dcb_printf(dcb, "\tAverage response time (us):          %ld\n", server->stats.response_time);
+    dcb_printf(dcb, "\tResponse time p50/p95/p99 (us):      %lu/%lu/%lu\n",
+               histogram_percentile(&server->stats.response_times, 50),
+               histogram_percentile(&server->stats.response_times, 95),
+               histogram_percentile(&server->stats.response_times, 99));
+    if (server->max_concurrent_queries > 0 || server->stats.n_queued_total > 0)
+    {
+        uint64_t admitted = server->stats.n_queued_total - server->stats.n_queue_timeouts -
+                            server->stats.n_queued;
+        dcb_printf(dcb, "\tMaximum concurrent queries:          %d\n",
+                   server->max_concurrent_queries);
+        dcb_printf(dcb, "\tMaximum queue time (ms):             %d\n", server->max_queue_time);
+        dcb_printf(dcb, "\tCurrently queued operations:         %d\n", server->stats.n_queued);
+        dcb_printf(dcb, "\tTotal queued operations:             %lu\n",
+                   server->stats.n_queued_total);
+        dcb_printf(dcb, "\tQueue timeouts:                      %lu\n",
+                   server->stats.n_queue_timeouts);
+        dcb_printf(dcb, "\tAverage queue wait time (ms):        %lu\n",
+                   admitted ? server->stats.queue_wait_time / admitted : 0);
+    }
+    if (server->compression)
+    {
+        dcb_printf(dcb, "\tCompression:                         enabled\n");
+    }
     if (server->persistpoolmax)
     {
         dcb_printf(dcb, "\tPersistent pool size:                %d\n", server->stats.n_persistent);
@@ -573,8 +712,10 @@ dprintServer(DCB *dcb, const SERVER *server)
         dcb_printf(dcb, "\tPersistent measured pool size:       %d\n", server->stats.n_persistent);
         dcb_printf(dcb, "\tPersistent actual size max:          %d\n", server->persistmax);
         dcb_printf(dcb, "\tPersistent pool size limit:          %ld\n", server->persistpoolmax);
+        dcb_printf(dcb, "\tPersistent pool minimum per thread:  %ld\n", server->persistpoolmin);
         dcb_printf(dcb, "\tPersistent max time (secs):          %ld\n", server->persistmaxtime);
         dcb_printf(dcb, "\tConnections taken from pool:         %lu\n", server->stats.n_from_pool);
+        dcb_printf(dcb, "\tConnections opened to refill pool:   %lu\n", server->stats.n_prewarmed);
         double d =  (double)server->stats.n_from_pool / (double)(server->stats.n_connections + server->stats.n_from_pool + 1);
         dcb_printf(dcb, "\tPool availability:                   %0.2lf%%\n", d * 100.0);
     }
@@ -593,6 +734,9 @@ dprintServer(DCB *dcb, const SERVER *server)
                    l->ssl_key ? l->ssl_key : "null");
         dcb_printf(dcb, "\tSSL CA certificate:                  %s\n",
                    l->ssl_ca_cert ? l->ssl_ca_cert : "null");
+        dcb_printf(dcb, "\tSSL full handshakes:                 %lu\n", l->n_full_handshakes);
+        dcb_printf(dcb, "\tSSL resumed handshakes:              %lu\n", l->n_resumed_handshakes);
+        dcb_printf(dcb, "\tSSL kernel TLS connections:          %lu\n", l->n_ktls_connections);
     }
 }
 
@@ -847,6 +991,97 @@ server_update_credentials(SERVER *server, const char *user, const char *passwd)
 }
 
 
+void server_add_response_time(SERVER *server, int64_t usecs)
+{
+    int64_t average = server->stats.response_time;
+
+    if (average == 0)
+    {
+        /** The first sample; if another thread got there first, the
+         * difference is corrected by the following samples */
+        atomic_add_int64(&server->stats.response_time, usecs);
+    }
+    else
+    {
+        /** The delta is added atomically so that concurrent updates are
+         * never lost, they are only computed from a slightly stale average */
+        atomic_add_int64(&server->stats.response_time, (usecs - average) / 8);
+    }
+
+    histogram_add_atomic(&server->stats.response_times, usecs > 0 ? usecs : 0);
+}
+
+/** The gauges and counters exported for each server */
+static const struct
+{
+    const char *family;
+    const char *sample; /**< Name of the samples, counters have a _total suffix */
+    const char *type;
+    const char *help;
+    size_t      offset; /**< Offset of the int in SERVER_STATS */
+} server_metric_defs[] =
+{
+    {"maxscale_server_connections", "maxscale_server_connections", "gauge",
+     "Current connections to the server", offsetof(SERVER_STATS, n_current)},
+    {"maxscale_server_created_connections", "maxscale_server_created_connections_total", "counter",
+     "Connections created to the server", offsetof(SERVER_STATS, n_connections)},
+    {"maxscale_server_operations", "maxscale_server_operations", "gauge",
+     "Current active operations on the server", offsetof(SERVER_STATS, n_current_ops)},
+    {"maxscale_server_persistent_connections", "maxscale_server_persistent_connections", "gauge",
+     "Connections in the persistent pool", offsetof(SERVER_STATS, n_persistent)},
+};
+
+static void server_metric_labels(const SERVER *server, char labels[METRICS_LABELS_LEN])
+{
+    char port[12];
+    snprintf(port, sizeof(port), "%u", server->port);
+    labels[0] = '\0';
+    metrics_label(labels, "server", server->unique_name);
+    metrics_label(labels, "address", server->name);
+    metrics_label(labels, "port", port);
+}
+
+void server_metrics(METRICS *metrics)
+{
+    SERVER *head = __atomic_load_n(&allServers, __ATOMIC_ACQUIRE);
+    char labels[METRICS_LABELS_LEN];
+
+    metrics_family(metrics, "maxscale_server_up", "gauge", "Whether the server is running");
+
+    for (SERVER *server = next_active_server(head); server;
+         server = next_active_server(server->next))
+    {
+        server_metric_labels(server, labels);
+        metrics_value(metrics, "maxscale_server_up", labels, SERVER_IS_RUNNING(server) ? 1 : 0);
+    }
+
+    for (size_t i = 0; i < sizeof(server_metric_defs) / sizeof(server_metric_defs[0]); i++)
+    {
+        metrics_family(metrics, server_metric_defs[i].family, server_metric_defs[i].type,
+                       server_metric_defs[i].help);
+
+        for (SERVER *server = next_active_server(head); server;
+             server = next_active_server(server->next))
+        {
+            const char *stats = (const char*)&server->stats;
+            server_metric_labels(server, labels);
+            metrics_value(metrics, server_metric_defs[i].sample, labels,
+                          *(const int*)(stats + server_metric_defs[i].offset));
+        }
+    }
+
+    metrics_family(metrics, "maxscale_server_response_time_seconds", "summary",
+                   "Response times of the server");
+
+    for (SERVER *server = next_active_server(head); server;
+         server = next_active_server(server->next))
+    {
+        server_metric_labels(server, labels);
+        metrics_summary(metrics, "maxscale_server_response_time_seconds", labels,
+                        &server->stats.response_times);
+    }
+}
+
 /**
  * Add a server parameter to a server.
  *
@@ -984,6 +1219,21 @@ serverRowCallback(RESULTSET *set, void *data)
         stat = server_status(server);
         resultset_row_set(row, 4, stat);
         MXS_FREE(stat);
+        if ((SERVER_IS_SLAVE(server) || SERVER_IS_RELAY_SERVER(server)) && server->rlag_ms >= 0)
+        {
+            sprintf(buf, "%d", server->rlag_ms);
+            resultset_row_set(row, 5, buf);
+        }
+        else
+        {
+            resultset_row_set(row, 5, "");
+        }
+        sprintf(buf, "%lu", histogram_percentile(&server->stats.response_times, 50));
+        resultset_row_set(row, 6, buf);
+        sprintf(buf, "%lu", histogram_percentile(&server->stats.response_times, 95));
+        resultset_row_set(row, 7, buf);
+        sprintf(buf, "%lu", histogram_percentile(&server->stats.response_times, 99));
+        resultset_row_set(row, 8, buf);
     }
     spinlock_release(&server_spin);
     return row;
@@ -1015,6 +1265,10 @@ serverGetList()
     resultset_add_column(set, "Port", 5, COL_TYPE_VARCHAR);
     resultset_add_column(set, "Connections", 8, COL_TYPE_VARCHAR);
     resultset_add_column(set, "Status", 20, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Slave Delay (ms)", 8, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Response p50 (us)", 8, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Response p95 (us)", 8, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Response p99 (us)", 8, COL_TYPE_VARCHAR);
 
     return set;
 }
@@ -1144,6 +1398,12 @@ static bool create_server_config(const SERVER *server, const char *filename)
     dprintf(file, "protocol=%s\n", server->protocol);
     dprintf(file, "address=%s\n", server->name);
     dprintf(file, "port=%u\n", server->port);
+
+    if (server->socket)
+    {
+        dprintf(file, "socket=%s\n", server->socket);
+    }
+
     dprintf(file, "authenticator=%s\n", server->authenticator);
 
     if (server->auth_options)
@@ -1167,6 +1427,26 @@ static bool create_server_config(const SERVER *server, const char *filename)
         dprintf(file, "persistmaxtime=%ld\n", server->persistmaxtime);
     }
 
+    if (server->persistpoolmin)
+    {
+        dprintf(file, "persistpoolmin=%ld\n", server->persistpoolmin);
+    }
+
+    if (server->max_concurrent_queries)
+    {
+        dprintf(file, "max_concurrent_queries=%d\n", server->max_concurrent_queries);
+    }
+
+    if (server->max_queue_time)
+    {
+        dprintf(file, "max_queue_time=%d\n", server->max_queue_time);
+    }
+
+    if (server->compression)
+    {
+        dprintf(file, "compression=true\n");
+    }
+
     for (SERVER_PARAM *p = server->parameters; p; p = p->next)
     {
         if (p->active)
@@ -1275,6 +1555,8 @@ void server_set_status(SERVER *server, int bit)
     {
         /* Set the bit directly */
         server_set_status_nolock(server, bit);
+        server_snapshot_publish(&server, 1);
+        server_status_changed();
     }
     spinlock_release(&server->lock);
 }
@@ -1302,10 +1584,579 @@ void server_clear_status(SERVER *server, int bit)
     {
         /* Clear bit directly */
         server_clear_status_nolock(server, bit);
+        server_snapshot_publish(&server, 1);
+        server_status_changed();
+    }
+    spinlock_release(&server->lock);
+}
+
+int server_status_version()
+{
+    return status_version;
+}
+
+void server_status_changed()
+{
+    atomic_add(&status_version, 1);
+}
+
+void server_set_load_score(SERVER *server, int score)
+{
+    score = MXS_MIN(MXS_MAX(score, 0), MXS_SERVER_LOAD_MAX);
+    bool was_overloaded = SERVER_IS_OVERLOADED(server);
+    server->load_score = score;
+
+    if (was_overloaded != SERVER_IS_OVERLOADED(server))
+    {
+        server_status_changed();
+    }
+}
+
+void server_clear_load_metrics(SERVER *server)
+{
+    server->load_metrics.threads_running = MXS_LOAD_METRIC_UNDEFINED;
+    server->load_metrics.qps = MXS_LOAD_METRIC_UNDEFINED;
+    server->load_metrics.row_lock_waits = MXS_LOAD_METRIC_UNDEFINED;
+    server->load_metrics.cpu = MXS_LOAD_METRIC_UNDEFINED;
+}
+
+void server_set_variables(SERVER *server, SERVER_VARIABLE *variables, int n_variables,
+                          int collation_id)
+{
+    spinlock_acquire(&server->lock);
+    SERVER_VARIABLE *old = server->variables;
+    int n_old = server->n_variables;
+    server->variables = variables;
+    server->n_variables = n_variables;
+    server->collation_id = collation_id;
+    spinlock_release(&server->lock);
+
+    for (int i = 0; i < n_old; i++)
+    {
+        MXS_FREE(old[i].name);
+        MXS_FREE(old[i].value);
+    }
+
+    MXS_FREE(old);
+}
+
+bool server_get_variable(SERVER *server, const char *name, char *dest, size_t size)
+{
+    bool rval = false;
+
+    spinlock_acquire(&server->lock);
+
+    for (int i = 0; i < server->n_variables; i++)
+    {
+        if (strcasecmp(server->variables[i].name, name) == 0)
+        {
+            rval = (size_t)snprintf(dest, size, "%s", server->variables[i].value) < size;
+            break;
+        }
+    }
+
+    spinlock_release(&server->lock);
+
+    return rval;
+}
+
+int server_get_collation_id(SERVER *server)
+{
+    spinlock_acquire(&server->lock);
+    int rval = server->collation_id;
+    spinlock_release(&server->lock);
+    return rval;
+}
+
+/**
+ * Release the slot of an operation
+ *
+ * @param server The server
+ */
+static void server_release_op(SERVER *server)
+{
+    int prev = atomic_add(&server->stats.n_current_ops, -1);
+    ss_dassert(prev > 0);
+
+    if (prev <= 0)
+    {
+        MXS_ERROR("Negative current operation count in server %s:%u",
+                  server->name, server->port);
+    }
+}
+
+void server_start_op(SERVER *server)
+{
+    atomic_add(&server->stats.n_current_ops, 1);
+}
+
+bool server_reserve_op(SERVER *server, SERVER_WAITER *waiter)
+{
+    if (server->max_concurrent_queries <= 0)
+    {
+        server_start_op(server);
+        return true;
+    }
+
+    bool rval = false;
+
+    spinlock_acquire(&server->queue_lock);
+
+    /** A new operation never overtakes the ones that are already waiting */
+    if (server->queue_head == NULL &&
+        server->stats.n_current_ops < server->max_concurrent_queries)
+    {
+        server_start_op(server);
+        rval = true;
+    }
+    else
+    {
+        waiter->next = NULL;
+        waiter->queued = mxs_clock_ms();
+
+        if (server->queue_tail)
+        {
+            server->queue_tail->next = waiter;
+        }
+        else
+        {
+            server->queue_head = waiter;
+        }
+
+        server->queue_tail = waiter;
+        server->stats.n_queued++;
+        server->stats.n_queued_total++;
+    }
+
+    spinlock_release(&server->queue_lock);
+
+    return rval;
+}
+
+void server_end_op(SERVER *server)
+{
+    /** The queue can be non-empty if the limit was removed at runtime */
+    if (server->max_concurrent_queries <= 0 && server->queue_head == NULL)
+    {
+        server_release_op(server);
+        return;
+    }
+
+    SERVER_WAITER *waiter = NULL;
+
+    spinlock_acquire(&server->queue_lock);
+
+    /** The slot is handed over as it is unless the limit was lowered below
+     * the number of current operations */
+    if (server->queue_head &&
+        (server->max_concurrent_queries <= 0 ||
+         server->stats.n_current_ops <= server->max_concurrent_queries))
+    {
+        waiter = server->queue_head;
+        server->queue_head = waiter->next;
+
+        if (server->queue_head == NULL)
+        {
+            server->queue_tail = NULL;
+        }
+
+        server->stats.n_queued--;
+        server->stats.queue_wait_time += mxs_clock_ms() - waiter->queued;
+    }
+    else
+    {
+        server_release_op(server);
+    }
+
+    spinlock_release(&server->queue_lock);
+
+    if (waiter && !poll_call_in_thread(waiter->thread, waiter->admit, waiter->data))
+    {
+        /** The waiter is admitted when the next operation ends or it times out */
+        spinlock_acquire(&server->queue_lock);
+        waiter->next = server->queue_head;
+        server->queue_head = waiter;
+
+        if (server->queue_tail == NULL)
+        {
+            server->queue_tail = waiter;
+        }
+
+        server->stats.n_queued++;
+        server_release_op(server);
+        spinlock_release(&server->queue_lock);
+    }
+}
+
+bool server_cancel_op(SERVER *server, SERVER_WAITER *waiter, bool timed_out)
+{
+    bool rval = false;
+
+    spinlock_acquire(&server->queue_lock);
+
+    SERVER_WAITER *prev = NULL;
+
+    for (SERVER_WAITER *w = server->queue_head; w; prev = w, w = w->next)
+    {
+        if (w == waiter)
+        {
+            if (prev)
+            {
+                prev->next = waiter->next;
+            }
+            else
+            {
+                server->queue_head = waiter->next;
+            }
+
+            if (server->queue_tail == waiter)
+            {
+                server->queue_tail = prev;
+            }
+
+            server->stats.n_queued--;
+
+            if (timed_out)
+            {
+                server->stats.n_queue_timeouts++;
+            }
+
+            rval = true;
+            break;
+        }
+    }
+
+    spinlock_release(&server->queue_lock);
+
+    return rval;
+}
+
+void server_set_gtid_pos(SERVER *server, const char *gtid_pos)
+{
+    spinlock_acquire(&server->lock);
+
+    if (gtid_pos && strlen(gtid_pos) < sizeof(server->gtid_pos))
+    {
+        strcpy(server->gtid_pos, gtid_pos);
+    }
+    else
+    {
+        server->gtid_pos[0] = '\0';
     }
+
     spinlock_release(&server->lock);
 }
 
+/**
+ * Parse one GTID of a GTID list
+ *
+ * @param ptr    Start of the GTID, advanced past it and the following comma
+ * @param domain The replication domain is stored here
+ * @param seq    The sequence number is stored here
+ * @return False if the GTID is malformed
+ */
+static bool gtid_parse(const char **ptr, unsigned long *domain, unsigned long long *seq)
+{
+    char *end;
+    *domain = strtoul(*ptr, &end, 10);
+
+    if (end == *ptr || *end != '-')
+    {
+        return false;
+    }
+
+    const char *server_id = end + 1;
+    strtoul(server_id, &end, 10);
+
+    if (end == server_id || *end != '-')
+    {
+        return false;
+    }
+
+    const char *sequence = end + 1;
+    *seq = strtoull(sequence, &end, 10);
+
+    if (end == sequence || (*end != ',' && *end != '\0'))
+    {
+        return false;
+    }
+
+    *ptr = *end == ',' ? end + 1 : end;
+    return true;
+}
+
+/**
+ * Check whether a GTID list contains a GTID of a domain with at least the given sequence number
+ */
+static bool gtid_list_reached(const char *list, unsigned long domain, unsigned long long seq)
+{
+    while (*list)
+    {
+        unsigned long list_domain;
+        unsigned long long list_seq;
+
+        if (!gtid_parse(&list, &list_domain, &list_seq))
+        {
+            break;
+        }
+
+        if (list_domain == domain)
+        {
+            return list_seq >= seq;
+        }
+    }
+
+    return false;
+}
+
+bool server_gtid_pos_reached(SERVER *server, const char *gtid)
+{
+    bool rval = *gtid != '\0';
+
+    spinlock_acquire(&server->lock);
+
+    while (rval && *gtid)
+    {
+        unsigned long domain;
+        unsigned long long seq;
+
+        rval = gtid_parse(&gtid, &domain, &seq) && gtid_list_reached(server->gtid_pos, domain, seq);
+    }
+
+    spinlock_release(&server->lock);
+
+    return rval;
+}
+
+/**
+ * Copy the current state of a server into a snapshot entry
+ *
+ * @param entry  The entry to fill
+ * @param server The server
+ */
+static void snapshot_entry_set(MXS_SERVER_SNAPSHOT_ENTRY *entry, SERVER *server)
+{
+    entry->server = server;
+    entry->status = server->status;
+    entry->rlag = server->rlag;
+    entry->rlag_ms = server->rlag_ms;
+    entry->load_score = server->load_score;
+    entry->load_metrics = server->load_metrics;
+    entry->node_id = server->node_id;
+    entry->master_id = server->master_id;
+    entry->depth = server->depth;
+}
+
+/**
+ * Check whether a retired snapshot is still used by a reader
+ *
+ * @param snapshot The retired snapshot
+ * @return True if a reader may still be using the snapshot
+ */
+static bool snapshot_in_use(const MXS_SERVER_SNAPSHOT *snapshot)
+{
+    if (snapshot_overflow_readers > 0)
+    {
+        return true;
+    }
+
+    int n_slots = MXS_MIN(snapshot_n_slots, SNAPSHOT_READER_SLOTS);
+
+    for (int i = 0; i < n_slots; i++)
+    {
+        int64_t epoch = snapshot_readers[i];
+
+        /** A reader that started after the snapshot was replaced reads a newer one */
+        if (epoch != 0 && epoch <= snapshot->retire_epoch)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Free the retired snapshots that no reader uses
+ *
+ * The caller must hold snapshot_lock.
+ */
+static void snapshot_reclaim()
+{
+    atomic_synchronize();
+    MXS_SERVER_SNAPSHOT **prev = &retired_snapshots;
+
+    while (*prev)
+    {
+        MXS_SERVER_SNAPSHOT *snapshot = *prev;
+
+        if (snapshot_in_use(snapshot))
+        {
+            prev = &snapshot->next_retired;
+        }
+        else
+        {
+            *prev = snapshot->next_retired;
+            MXS_FREE(snapshot);
+        }
+    }
+}
+
+void server_snapshot_publish(SERVER * const *servers, int n_servers)
+{
+    spinlock_acquire(&snapshot_lock);
+    spinlock_acquire(&server_spin);
+
+    MXS_SERVER_SNAPSHOT *old = current_snapshot;
+    int n = 0;
+
+    for (SERVER *server = allServers; server; server = server->next)
+    {
+        n++;
+    }
+
+    /** The entries are zeroed so that the snapshots can be compared with memcmp */
+    MXS_SERVER_SNAPSHOT *snapshot = MXS_CALLOC(1, sizeof(MXS_SERVER_SNAPSHOT) +
+                                               n * sizeof(MXS_SERVER_SNAPSHOT_ENTRY));
+
+    if (snapshot == NULL)
+    {
+        spinlock_release(&server_spin);
+        spinlock_release(&snapshot_lock);
+        return;
+    }
+
+    snapshot->servers = (MXS_SERVER_SNAPSHOT_ENTRY*)(snapshot + 1);
+    snapshot->n_servers = n;
+    int i = 0;
+
+    for (SERVER *server = allServers; server; server = server->next, i++)
+    {
+        const MXS_SERVER_SNAPSHOT_ENTRY *prev = NULL;
+        bool fresh = false;
+
+        for (int j = 0; j < n_servers && !fresh; j++)
+        {
+            fresh = servers[j] == server;
+        }
+
+        if (!fresh && old && (prev = server_snapshot_find(old, server)))
+        {
+            snapshot->servers[i] = *prev;
+        }
+        else
+        {
+            snapshot_entry_set(&snapshot->servers[i], server);
+        }
+    }
+
+    spinlock_release(&server_spin);
+
+    if (old && old->n_servers == n &&
+        memcmp(old->servers, snapshot->servers, n * sizeof(MXS_SERVER_SNAPSHOT_ENTRY)) == 0)
+    {
+        /** Nothing changed */
+        MXS_FREE(snapshot);
+    }
+    else
+    {
+        snapshot->version = old ? old->version + 1 : 1;
+        atomic_exchange_ptr((void**)&current_snapshot, snapshot);
+        snapshot_version = snapshot->version;
+
+        if (old)
+        {
+            /** The readers that announce a later epoch see the new snapshot */
+            old->retire_epoch = atomic_add_int64(&snapshot_epoch, 1);
+            old->next_retired = retired_snapshots;
+            retired_snapshots = old;
+        }
+    }
+
+    snapshot_reclaim();
+    spinlock_release(&snapshot_lock);
+}
+
+const MXS_SERVER_SNAPSHOT* server_snapshot_acquire()
+{
+    if (snapshot_depth++ == 0)
+    {
+        if (snapshot_slot == -1)
+        {
+            snapshot_slot = MXS_MIN(atomic_add(&snapshot_n_slots, 1), SNAPSHOT_READER_SLOTS);
+        }
+
+        if (snapshot_slot < SNAPSHOT_READER_SLOTS)
+        {
+            snapshot_readers[snapshot_slot] = snapshot_epoch;
+        }
+        else
+        {
+            atomic_add(&snapshot_overflow_readers, 1);
+        }
+
+        /** The epoch must be visible before the snapshot is read */
+        atomic_synchronize();
+    }
+
+    return *(MXS_SERVER_SNAPSHOT * volatile *)&current_snapshot;
+}
+
+void server_snapshot_release(const MXS_SERVER_SNAPSHOT *snapshot)
+{
+    ss_dassert(snapshot_depth > 0);
+
+    if (--snapshot_depth == 0)
+    {
+        atomic_synchronize();
+
+        if (snapshot_slot < SNAPSHOT_READER_SLOTS)
+        {
+            snapshot_readers[snapshot_slot] = 0;
+        }
+        else
+        {
+            atomic_add(&snapshot_overflow_readers, -1);
+        }
+    }
+}
+
+const MXS_SERVER_SNAPSHOT_ENTRY* server_snapshot_find(const MXS_SERVER_SNAPSHOT *snapshot,
+                                                      const SERVER *server)
+{
+    for (int i = 0; i < snapshot->n_servers; i++)
+    {
+        if (snapshot->servers[i].server == server)
+        {
+            return &snapshot->servers[i];
+        }
+    }
+
+    return NULL;
+}
+
+MXS_SERVER_SNAPSHOT_ENTRY server_snapshot_state(const MXS_SERVER_SNAPSHOT *snapshot, SERVER *server)
+{
+    const MXS_SERVER_SNAPSHOT_ENTRY *entry = snapshot ? server_snapshot_find(snapshot, server) : NULL;
+    MXS_SERVER_SNAPSHOT_ENTRY state;
+
+    if (entry)
+    {
+        state = *entry;
+    }
+    else
+    {
+        snapshot_entry_set(&state, server);
+    }
+
+    return state;
+}
+
+int64_t server_snapshot_version()
+{
+    return snapshot_version;
+}
+
 bool server_is_mxs_service(const SERVER *server)
 {
     bool rval = false;
@@ -48,12 +48,16 @@
 #include <sys/types.h>
 #include <math.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
 #include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
 #include <maxscale/dcb.h>
 #include <maxscale/paths.h>
 #include <maxscale/housekeeper.h>
 #include <maxscale/listener.h>
 #include <maxscale/log_manager.h>
+#include <maxscale/mysql_utils.h>
 #include <maxscale/poll.h>
 #include <maxscale/protocol.h>
 #include <maxscale/queuemanager.h>
@@ -62,13 +66,16 @@
 #include <maxscale/server.h>
 #include <maxscale/session.h>
 #include <maxscale/spinlock.h>
+#include <maxscale/thread.h>
 #include <maxscale/users.h>
 #include <maxscale/utils.h>
 #include <maxscale/version.h>
 
 #include "maxscale/config.h"
 #include "maxscale/filter.h"
+#include "maxscale/metrics.h"
 #include "maxscale/modules.h"
+#include "maxscale/poll.h"
 #include "maxscale/queuemanager.h"
 #include "maxscale/service.h"
 
@@ -112,15 +119,23 @@ SERVICE* service_alloc(const char *name, const char *router)
     char *my_name = MXS_STRDUP(name);
     char *my_router = MXS_STRDUP(router);
     SERVICE *service = (SERVICE *)MXS_CALLOC(1, sizeof(*service));
+    ts_stats_t n_sessions = ts_stats_alloc();
+    ts_stats_t n_current = ts_stats_alloc();
 
-    if (!my_name || !my_router || !service)
+    if (!my_name || !my_router || !service || !n_sessions || !n_current)
     {
         MXS_FREE(my_name);
         MXS_FREE(my_router);
         MXS_FREE(service);
+        ts_stats_free(n_sessions);
+        ts_stats_free(n_current);
         return NULL;
     }
 
+    /** Sessions are counted by the thread that they run in */
+    service->stats.n_sessions = n_sessions;
+    service->stats.n_current = n_current;
+
     if ((service->router = load_module(my_router, MODULE_ROUTER)) == NULL)
     {
         char* home = get_libdir();
@@ -138,6 +153,8 @@ SERVICE* service_alloc(const char *name, const char *router)
                   ldpath ? ldpath : "");
         MXS_FREE(my_name);
         MXS_FREE(my_router);
+        ts_stats_free(n_sessions);
+        ts_stats_free(n_current);
         MXS_FREE(service);
         return NULL;
     }
@@ -166,6 +183,8 @@ SERVICE* service_alloc(const char *name, const char *router)
         {
             MXS_FREE(service->name);
         }
+        ts_stats_free(n_sessions);
+        ts_stats_free(n_current);
         MXS_FREE(service);
         return NULL;
     }
@@ -174,9 +193,12 @@ SERVICE* service_alloc(const char *name, const char *router)
     service->state = SERVICE_STATE_ALLOC;
     spinlock_init(&service->spin);
 
+    spinlock_register(&service_spin, "services");
     spinlock_acquire(&service_spin);
     service->next = allServices;
-    allServices = service;
+    /** Published with a release store so that service_metrics() can walk
+     * the list without taking the lock */
+    __atomic_store_n(&allServices, service, __ATOMIC_RELEASE);
     spinlock_release(&service_spin);
 
     return service;
@@ -224,6 +246,25 @@ static inline void close_port(SERV_LISTENER *port)
     }
 }
 
+/**
+ * Create the address of a listener in the format of dcb_listen()
+ *
+ * @param port The listener
+ * @param dest Where the address is stored
+ * @param size Size of @c dest
+ */
+static void listener_bind_config(const SERV_LISTENER *port, char *dest, size_t size)
+{
+    if (port->address)
+    {
+        snprintf(dest, size, "%s|%d", port->address, port->port);
+    }
+    else
+    {
+        snprintf(dest, size, "::|%d", port->port);
+    }
+}
+
 /**
  * Start an individual port/protocol pair
  *
@@ -305,14 +346,7 @@ serviceStartPort(SERVICE *service, SERV_LISTENER *port)
      * listeners aren't normal DCBs, we can skip that.
      */
 
-    if (port->address)
-    {
-        sprintf(config_bind, "%s|%d", port->address, port->port);
-    }
-    else
-    {
-        sprintf(config_bind, "::|%d", port->port);
-    }
+    listener_bind_config(port, config_bind, sizeof(config_bind));
 
     /** Load the authentication users before before starting the listener */
     if (port->listener->authfunc.loadusers)
@@ -473,6 +507,76 @@ static void free_string_array(char** array)
     }
 }
 
+/**
+ * @brief Create the data of the router instance for each polling thread
+ *
+ * @param service The service whose router instance has been created
+ * @return True if the router has no thread-specific data or if the data of all
+ *         threads was created
+ */
+static bool service_create_thread_instances(SERVICE *service)
+{
+    if (service->router->createThreadInstance == NULL)
+    {
+        return true;
+    }
+
+    int n_threads = config_threadcount();
+
+    if ((service->router_thread_instances = MXS_CALLOC(n_threads, sizeof(void*))) == NULL)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        if ((service->router_thread_instances[i] =
+                 service->router->createThreadInstance(service->router_instance, i)) == NULL)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Destroy the data of the router instance for each polling thread
+ *
+ * @param service The service
+ */
+static void service_destroy_thread_instances(SERVICE *service)
+{
+    if (service->router_thread_instances)
+    {
+        int n_threads = config_threadcount();
+
+        for (int i = 0; i < n_threads; i++)
+        {
+            if (service->router_thread_instances[i] && service->router->destroyThreadInstance)
+            {
+                service->router->destroyThreadInstance(service->router_instance,
+                                                       service->router_thread_instances[i]);
+            }
+        }
+
+        MXS_FREE(service->router_thread_instances);
+        service->router_thread_instances = NULL;
+    }
+}
+
+void* service_get_thread_instance(const SERVICE *service)
+{
+    return service->router_thread_instances && poll_thread ?
+           service->router_thread_instances[current_thread_id] : NULL;
+}
+
+void* service_get_thread_instance_of(const SERVICE *service, int thread_id)
+{
+    ss_dassert(thread_id >= 0 && thread_id < config_threadcount());
+    return service->router_thread_instances ? service->router_thread_instances[thread_id] : NULL;
+}
+
 /**
  * Start a service
  *
@@ -492,7 +596,26 @@ int serviceInitialize(SERVICE *service)
     int listeners = 0;
     char **router_options = copy_string_array(service->routerOptions);
 
-    if ((service->router_instance = service->router->createInstance(service, router_options)))
+    if ((service->router_instance = service->router->createInstance(service, router_options)) == NULL)
+    {
+        MXS_ERROR("%s: Failed to create router instance. Service not started.", service->name);
+        service->state = SERVICE_STATE_FAILED;
+    }
+    else if (!service_create_thread_instances(service))
+    {
+        MXS_ERROR("%s: Failed to create the thread-specific data of the router instance. "
+                  "Service not started.", service->name);
+        service_destroy_thread_instances(service);
+
+        if (service->router->destroyInstance)
+        {
+            service->router->destroyInstance(service->router_instance);
+        }
+
+        service->router_instance = NULL;
+        service->state = SERVICE_STATE_FAILED;
+    }
+    else
     {
         service->capabilities |= service->router->getCapabilities(service->router_instance);
 
@@ -506,11 +629,6 @@ int serviceInitialize(SERVICE *service)
             listeners++;
         }
     }
-    else
-    {
-        MXS_ERROR("%s: Failed to create router instance. Service not started.", service->name);
-        service->state = SERVICE_STATE_FAILED;
-    }
 
     free_string_array(router_options);
 
@@ -621,10 +739,204 @@ bool serviceStartListener(SERVICE *service, const char *name)
     return rval;
 }
 
+/** Maximum number of services that are started concurrently */
+#define SERVICE_START_THREADS 16
+
+/**
+ * The startup state of a service
+ */
+typedef struct
+{
+    SERVICE *service;  /**< The service to start */
+    int      level;    /**< Services of a lower level are started first */
+    int      listeners; /**< Number of listeners started */
+} SERVICE_START;
+
+/** Number of services started so far, for the progress messages */
+static int services_started;
+static int services_total;
+/** The thread that starts the services, it already has a MySQL thread context */
+static pthread_t services_launcher;
+
+static void service_start_one(void *arg)
+{
+    SERVICE_START *start = (SERVICE_START*)arg;
+    SERVICE *service = start->service;
+
+    if (!service->svc_do_shutdown)
+    {
+        /** Loading the users needs a MySQL thread context in the worker threads */
+        bool thread_init = !pthread_equal(pthread_self(), services_launcher) &&
+                           mysql_thread_init() == 0;
+        uint64_t begin = mxs_clock_us();
+        start->listeners = serviceInitialize(service);
+
+        double seconds = (mxs_clock_us() - begin) / 1.0e6;
+        int n = atomic_add(&services_started, 1) + 1;
+
+        MXS_NOTICE("Service '%s' started in %.2f seconds (%d/%d)",
+                   service->name, seconds, n, services_total);
+
+        if (thread_init)
+        {
+            mysql_thread_end();
+        }
+    }
+}
+
+/**
+ * Check whether the parameters of a module refer to a service
+ *
+ * @param name   Name of the module
+ * @param type   Type of the module
+ * @param params The configured parameters of the module
+ * @param target Name of the service
+ *
+ * @return True if one of the service parameters of the module names @c target
+ */
+static bool module_params_use_service(const char *name, const char *type,
+                                      MXS_CONFIG_PARAMETER *params, const char *target)
+{
+    const MXS_MODULE *mod = name ? get_module(name, type) : NULL;
+
+    if (mod)
+    {
+        for (int i = 0; mod->parameters[i].name; i++)
+        {
+            if (mod->parameters[i].type == MXS_MODULE_PARAM_SERVICE)
+            {
+                MXS_CONFIG_PARAMETER *param = config_get_param(params, mod->parameters[i].name);
+
+                if (param && strcmp(param->value, target) == 0)
+                {
+                    return true;
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Check whether a service depends on another service
+ *
+ * A service depends on another one if its router or one of its filters
+ * has a service parameter, e.g. the @c service of the tee filter, that
+ * names the other service.
+ *
+ * @param service The service to check
+ * @param other   The service that could be used by @c service
+ *
+ * @return True if @c service uses @c other
+ */
+static bool service_uses_service(SERVICE *service, SERVICE *other)
+{
+    if (module_params_use_service(service->routerModule, MODULE_ROUTER,
+                                  service->svc_config_param, other->name))
+    {
+        return true;
+    }
+
+    for (int i = 0; i < service->n_filters; i++)
+    {
+        MXS_FILTER_DEF *filter = service->filters[i];
+
+        if (module_params_use_service(filter->module, MODULE_FILTER,
+                                      filter->parameters, other->name))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Assign the start levels of the services
+ *
+ * A service is started after all the services it uses, so its level is one
+ * higher than the highest level of the services it depends on.
+ *
+ * @param starts The services
+ * @param n      Number of services
+ *
+ * @return The number of levels
+ */
+static int service_start_levels(SERVICE_START *starts, int n)
+{
+    bool *uses = MXS_CALLOC(n * n, sizeof(bool));
+    int levels = 1;
+
+    if (uses == NULL)
+    {
+        /** Start everything in one level, the order is then the old one */
+        return levels;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            uses[i * n + j] = i != j && service_uses_service(starts[i].service, starts[j].service);
+        }
+    }
+
+    bool changed = true;
+
+    for (int round = 0; changed && round <= n; round++)
+    {
+        changed = false;
+
+        for (int i = 0; i < n; i++)
+        {
+            for (int j = 0; j < n; j++)
+            {
+                if (uses[i * n + j] && starts[i].level <= starts[j].level)
+                {
+                    starts[i].level = starts[j].level + 1;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    if (changed)
+    {
+        MXS_WARNING("The services refer to each other in a cycle, "
+                    "starting them in the order they are defined in.");
+
+        for (int i = 0; i < n; i++)
+        {
+            starts[i].level = i;
+        }
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        if (starts[i].level + 1 > levels)
+        {
+            levels = starts[i].level + 1;
+        }
+    }
+
+    MXS_FREE(uses);
+    return levels;
+}
+
+/**
+ * Start all the services
+ *
+ * The services that do not depend on each other are started concurrently,
+ * as most of the time needed to start a service is spent waiting for the
+ * backend servers when the users are loaded.
+ *
+ * @return Number of listeners created, 0 if a service failed to start
+ */
 int service_launch_all()
 {
     SERVICE *ptr;
-    int n = 0, i;
+    int n = 0;
     bool error = false;
 
     config_enable_feedback_task();
@@ -637,24 +949,106 @@ int service_launch_all()
 
     MXS_NOTICE("Starting a total of %d services...", num_svc);
 
-    int curr_svc = 1;
-    ptr = allServices;
-    while (ptr && !ptr->svc_do_shutdown)
+    if (num_svc == 0)
     {
-        n += (i = serviceInitialize(ptr));
-        MXS_NOTICE("Service '%s' started (%d/%d)", ptr->name, curr_svc++, num_svc);
+        return 0;
+    }
+
+    SERVICE_START *starts = MXS_CALLOC(num_svc, sizeof(SERVICE_START));
+    void **items = MXS_MALLOC(num_svc * sizeof(void*));
 
-        if (i == 0)
+    if (starts == NULL || items == NULL)
+    {
+        MXS_FREE(starts);
+        MXS_FREE(items);
+        return 0;
+    }
+
+    int i = 0;
+    for (ptr = allServices; ptr; ptr = ptr->next)
+    {
+        starts[i++].service = ptr;
+    }
+
+    services_started = 0;
+    services_total = num_svc;
+    services_launcher = pthread_self();
+
+    uint64_t begin = mxs_clock_us();
+
+    int levels = service_start_levels(starts, num_svc);
+
+    for (int level = 0; level < levels; level++)
+    {
+        int n_items = 0;
+
+        for (i = 0; i < num_svc; i++)
         {
-            MXS_ERROR("Failed to start service '%s'.", ptr->name);
-            error = true;
+            if (starts[i].level == level)
+            {
+                items[n_items++] = &starts[i];
+            }
         }
 
-        ptr = ptr->next;
+        thread_run_parallel(service_start_one, items, n_items, SERVICE_START_THREADS);
     }
+
+    double seconds = (mxs_clock_us() - begin) / 1.0e6;
+
+    for (i = 0; i < num_svc; i++)
+    {
+        if (starts[i].service->svc_do_shutdown)
+        {
+            continue;
+        }
+
+        n += starts[i].listeners;
+
+        if (starts[i].listeners == 0)
+        {
+            MXS_ERROR("Failed to start service '%s'.", starts[i].service->name);
+            error = true;
+        }
+    }
+
+    MXS_NOTICE("Started %d services in %.2f seconds.", services_started, seconds);
+
+    MXS_FREE(starts);
+    MXS_FREE(items);
+
     return error ? 0 : n;
 }
 
+bool service_foreach_listener(bool (*func)(SERV_LISTENER *port, const char *bind, void *data),
+                              void *data)
+{
+    bool rval = true;
+
+    spinlock_acquire(&service_spin);
+
+    for (SERVICE *service = allServices; service && rval; service = service->next)
+    {
+        spinlock_acquire(&service->spin);
+
+        for (SERV_LISTENER *port = service->ports; port && rval; port = port->next)
+        {
+            if (port->listener && port->listener->session &&
+                port->listener->session->state == SESSION_STATE_LISTENER)
+            {
+                char bind[(port->address ? strlen(port->address) : 2) + UINTLEN(port->port) + 2];
+                listener_bind_config(port, bind, sizeof(bind));
+                rval = func(port, bind, data);
+            }
+        }
+
+        spinlock_release(&service->spin);
+    }
+
+    spinlock_release(&service_spin);
+
+    return rval;
+}
+
 bool serviceStop(SERVICE *service)
 {
     SERV_LISTENER *port;
@@ -712,7 +1106,7 @@ void service_free(SERVICE *service)
 {
     SERVICE *ptr;
     SERVER_REF *srv;
-    if (service->stats.n_current)
+    if (ts_stats_sum(service->stats.n_current))
     {
         return;
     }
@@ -753,6 +1147,8 @@ void service_free(SERVICE *service)
 
     config_parameter_free(service->svc_config_param);
     serviceClearRouterOptions(service);
+    ts_stats_free(service->stats.n_sessions);
+    ts_stats_free(service->stats.n_current);
 
     MXS_FREE(service);
 }
@@ -894,6 +1290,7 @@ bool serviceAddBackend(SERVICE *service, SERVER *server)
                 service->dbref = new_ref;
             }
             spinlock_release(&service->spin);
+            server_status_changed();
         }
     }
 
@@ -924,6 +1321,7 @@ void serviceRemoveBackend(SERVICE *service, const SERVER *server)
     }
 
     spinlock_release(&service->spin);
+    server_status_changed();
 }
 /**
  * Test if a server is part of a service
@@ -1138,12 +1536,8 @@ serviceSetTimeout(SERVICE *service, int val)
         return 0;
     }
 
-    /** Enable the session timeout checks if and only if at least one service is
-     * configured with a idle timeout. */
-    if ((service->conn_idle_timeout = val))
-    {
-        dcb_enable_session_timeouts();
-    }
+    /** The timeouts of the clients of the service are set when they connect */
+    service->conn_idle_timeout = val;
 
     return 1;
 }
@@ -1352,8 +1746,8 @@ printService(SERVICE *service)
         printf("\n");
     }
 
-    printf("\tTotal connections:    %d\n", service->stats.n_sessions);
-    printf("\tCurrently connected:  %d\n", service->stats.n_current);
+    printf("\tTotal connections:    %ld\n", ts_stats_sum(service->stats.n_sessions));
+    printf("\tCurrently connected:  %ld\n", ts_stats_sum(service->stats.n_current));
 }
 
 /**
@@ -1463,10 +1857,28 @@ void dprintService(DCB *dcb, SERVICE *service)
                    service->weightby);
     }
 
-    dcb_printf(dcb, "\tTotal connections:                   %d\n",
-               service->stats.n_sessions);
-    dcb_printf(dcb, "\tCurrently connected:                 %d\n",
-               service->stats.n_current);
+    dcb_printf(dcb, "\tTotal connections:                   %ld\n",
+               ts_stats_sum(service->stats.n_sessions));
+    dcb_printf(dcb, "\tCurrently connected:                 %ld\n",
+               ts_stats_sum(service->stats.n_current));
+    dcb_printf(dcb, "\tResponse time p50/p95/p99 (us):      %lu/%lu/%lu\n",
+               histogram_percentile(&service->stats.response_times, 50),
+               histogram_percentile(&service->stats.response_times, 95),
+               histogram_percentile(&service->stats.response_times, 99));
+
+    for (SERV_LISTENER *port = service->ports; port; port = port->next)
+    {
+        if (port->ssl)
+        {
+            dcb_printf(dcb, "\tListener %s SSL handshakes:\n", port->name);
+            dcb_printf(dcb, "\t\tFull:                        %lu\n",
+                       port->ssl->n_full_handshakes);
+            dcb_printf(dcb, "\t\tResumed:                     %lu\n",
+                       port->ssl->n_resumed_handshakes);
+            dcb_printf(dcb, "\t\tKernel TLS:                  %lu\n",
+                       port->ssl->n_ktls_connections);
+        }
+    }
 }
 
 /**
@@ -1492,10 +1904,11 @@ dListServices(DCB *dcb)
     }
     while (service)
     {
-        ss_dassert(service->stats.n_current >= 0);
-        dcb_printf(dcb, "%-25s | %-17s | %6d | %14d | ",
+        int64_t n_current = ts_stats_sum(service->stats.n_current);
+        ss_dassert(n_current >= 0);
+        dcb_printf(dcb, "%-25s | %-17s | %6ld | %14ld | ",
                    service->name, service->routerModule,
-                   service->stats.n_current, service->stats.n_sessions);
+                   n_current, ts_stats_sum(service->stats.n_sessions));
 
         SERVER_REF* server_ref = service->dbref;
         bool first = true;
@@ -1870,6 +2283,8 @@ void service_destroy_instances(void)
     while (svc != NULL)
     {
         ss_dassert(svc->svc_do_shutdown);
+        service_destroy_thread_instances(svc);
+
         /* Call destroyInstance hook for routers */
         if (svc->router->destroyInstance && svc->router_instance)
         {
@@ -1880,6 +2295,8 @@ void service_destroy_instances(void)
             MXS_FILTER_DEF **filters = svc->filters;
             for (int i = 0; i < svc->n_filters; i++)
             {
+                filter_destroy_thread_instances(filters[i]);
+
                 if (filters[i]->obj->destroyInstance && filters[i]->filter)
                 {
                     /* Call destroyInstance hook for filters */
@@ -1907,7 +2324,7 @@ serviceSessionCountAll()
     service = allServices;
     while (service)
     {
-        rval += service->stats.n_current;
+        rval += ts_stats_sum(service->stats.n_current);
         service = service->next;
     }
     spinlock_release(&service_spin);
@@ -2008,6 +2425,72 @@ serviceGetListenerList()
     return set;
 }
 
+void service_add_response_time(SERVICE *service, int64_t usecs)
+{
+    histogram_add_atomic(&service->stats.response_times, usecs > 0 ? usecs : 0);
+}
+
+void service_metrics(METRICS *metrics)
+{
+    SERVICE *head = __atomic_load_n(&allServices, __ATOMIC_ACQUIRE);
+    char labels[METRICS_LABELS_LEN];
+
+    metrics_family(metrics, "maxscale_service_sessions", "gauge", "Current sessions of the service");
+
+    for (SERVICE *service = head; service; service = service->next)
+    {
+        labels[0] = '\0';
+        metrics_label(labels, "service", service->name);
+        metrics_label(labels, "router", service->routerModule);
+        metrics_value(metrics, "maxscale_service_sessions", labels,
+                      ts_stats_sum(service->stats.n_current));
+    }
+
+    metrics_family(metrics, "maxscale_service_created_sessions", "counter",
+                   "Sessions created on the service");
+
+    for (SERVICE *service = head; service; service = service->next)
+    {
+        labels[0] = '\0';
+        metrics_label(labels, "service", service->name);
+        metrics_label(labels, "router", service->routerModule);
+        metrics_value(metrics, "maxscale_service_created_sessions_total", labels,
+                      ts_stats_sum(service->stats.n_sessions));
+    }
+
+    metrics_family(metrics, "maxscale_service_response_time_seconds", "summary",
+                   "Response times of the service");
+
+    for (SERVICE *service = head; service; service = service->next)
+    {
+        labels[0] = '\0';
+        metrics_label(labels, "service", service->name);
+        metrics_label(labels, "router", service->routerModule);
+        metrics_summary(metrics, "maxscale_service_response_time_seconds", labels,
+                        &service->stats.response_times);
+    }
+
+    /** How the router has distributed the connections, the references are
+     * only ever appended to the list so it can be walked without the lock */
+    metrics_family(metrics, "maxscale_service_server_connections", "counter",
+                   "Connections the service has created to the server");
+
+    for (SERVICE *service = head; service; service = service->next)
+    {
+        for (SERVER_REF *ref = service->dbref; ref; ref = ref->next)
+        {
+            if (ref->active)
+            {
+                labels[0] = '\0';
+                metrics_label(labels, "service", service->name);
+                metrics_label(labels, "server", ref->server->unique_name);
+                metrics_value(metrics, "maxscale_service_server_connections_total", labels,
+                              ref->connections);
+            }
+        }
+    }
+}
+
 /**
  * Provide a row to the result set that defines the set of services
  *
@@ -2041,10 +2524,16 @@ serviceRowCallback(RESULTSET *set, void *data)
     row = resultset_make_row(set);
     resultset_row_set(row, 0, service->name);
     resultset_row_set(row, 1, service->routerModule);
-    sprintf(buf, "%d", service->stats.n_current);
+    sprintf(buf, "%ld", ts_stats_sum(service->stats.n_current));
     resultset_row_set(row, 2, buf);
-    sprintf(buf, "%d", service->stats.n_sessions);
+    sprintf(buf, "%ld", ts_stats_sum(service->stats.n_sessions));
     resultset_row_set(row, 3, buf);
+    sprintf(buf, "%lu", histogram_percentile(&service->stats.response_times, 50));
+    resultset_row_set(row, 4, buf);
+    sprintf(buf, "%lu", histogram_percentile(&service->stats.response_times, 95));
+    resultset_row_set(row, 5, buf);
+    sprintf(buf, "%lu", histogram_percentile(&service->stats.response_times, 99));
+    resultset_row_set(row, 6, buf);
     spinlock_release(&service_spin);
     return row;
 }
@@ -2074,6 +2563,9 @@ serviceGetList()
     resultset_add_column(set, "Router Module", 20, COL_TYPE_VARCHAR);
     resultset_add_column(set, "No. Sessions", 10, COL_TYPE_VARCHAR);
     resultset_add_column(set, "Total Sessions", 10, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Response p50 (us)", 8, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Response p95 (us)", 8, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Response p99 (us)", 8, COL_TYPE_VARCHAR);
 
     return set;
 }
@@ -2196,6 +2688,9 @@ void service_update_weights()
     }
 
     spinlock_release(&service_spin);
+
+    /** Routers that cache the server weights need to recompute them */
+    server_status_changed();
 }
 
 bool service_server_in_use(const SERVER *server)
@@ -38,31 +38,108 @@
 #include <maxscale/alloc.h>
 #include <maxscale/atomic.h>
 #include <maxscale/dcb.h>
+#include <maxscale/freelist.h>
 #include <maxscale/housekeeper.h>
 #include <maxscale/log_manager.h>
 #include <maxscale/poll.h>
+#include <maxscale/protocol/mysql.h>
+#include <maxscale/qsbr.h>
+#include <maxscale/query_classifier.h>
 #include <maxscale/router.h>
 #include <maxscale/service.h>
 #include <maxscale/spinlock.h>
 
 #include "maxscale/session.h"
 #include "maxscale/filter.h"
+#include "maxscale/trace.h"
 
 /* A session with null values, used for initialization */
 static MXS_SESSION session_initialized = SESSION_INIT;
+static MXS_FREELIST *session_freelist = NULL;
 
 /** Global session id; updated safely by use of atomic_add */
 static int session_id;
 
 static struct session session_dummy_struct;
 
+/** Number of buckets in the session registry, the IDs are sequential */
+#define SESSION_REGISTRY_SIZE 4096
+
+/**
+ * The registry of all sessions, indexed by the session ID. Each bucket has its
+ * own lock so that sessions created and freed by different threads seldom
+ * wait for each other.
+ */
+static struct
+{
+    SPINLOCK     lock;
+    MXS_SESSION *head;
+} session_registry[SESSION_REGISTRY_SIZE];
+
 static void session_initialize(void *session);
 static int session_setup_filters(MXS_SESSION *session);
+static int32_t session_filter_gate(void *instance, void *session, GWBUF *data);
 static void session_simple_free(MXS_SESSION *session, DCB *dcb);
 static void session_add_to_all_list(MXS_SESSION *session);
 static MXS_SESSION *session_find_free();
 static void session_final_free(MXS_SESSION *session);
 
+bool session_global_init()
+{
+    for (int i = 0; i < SESSION_REGISTRY_SIZE; i++)
+    {
+        spinlock_init(&session_registry[i].lock);
+    }
+
+    session_freelist = mxs_freelist_create(sizeof(MXS_SESSION), MXS_FREELIST_DEFAULT_MAX);
+    return session_freelist != NULL;
+}
+
+/**
+ * @brief Add a session to the session registry
+ *
+ * @param session Session to add
+ */
+static void session_register(MXS_SESSION *session)
+{
+    int bucket = session->ses_id % SESSION_REGISTRY_SIZE;
+
+    spinlock_acquire(&session_registry[bucket].lock);
+    session->registry_next = session_registry[bucket].head;
+    session_registry[bucket].head = session;
+    session->registered = true;
+    spinlock_release(&session_registry[bucket].lock);
+}
+
+/**
+ * @brief Remove a session from the session registry
+ *
+ * Does nothing if the session is not in the registry.
+ *
+ * @param session Session to remove
+ */
+static void session_unregister(MXS_SESSION *session)
+{
+    if (session->registered)
+    {
+        int bucket = session->ses_id % SESSION_REGISTRY_SIZE;
+
+        spinlock_acquire(&session_registry[bucket].lock);
+
+        for (MXS_SESSION **s = &session_registry[bucket].head; *s; s = &(*s)->registry_next)
+        {
+            if (*s == session)
+            {
+                *s = session->registry_next;
+                break;
+            }
+        }
+
+        session->registered = false;
+        spinlock_release(&session_registry[bucket].lock);
+    }
+}
+
 /**
  * @brief Initialize a session
  *
@@ -96,7 +173,16 @@ session_initialize(void *session)
 MXS_SESSION *
 session_alloc(SERVICE *service, DCB *client_dcb)
 {
-    MXS_SESSION *session = (MXS_SESSION *)(MXS_MALLOC(sizeof(*session)));
+    MXS_SESSION *session;
+
+    if (session_freelist)
+    {
+        session = (MXS_SESSION*)mxs_freelist_alloc(session_freelist);
+    }
+    else
+    {
+        session = (MXS_SESSION*)MXS_MALLOC(sizeof(*session));
+    }
 
     if (NULL == session)
     {
@@ -167,6 +253,11 @@ session_alloc(SERVICE *service, DCB *client_dcb)
         session->tail.session = session;
         session->tail.clientReply = session_reply;
 
+        if (SESSION_STATE_TO_BE_FREED != session->state)
+        {
+            session_trace_start(session);
+        }
+
         if (SESSION_STATE_TO_BE_FREED != session->state
             && service->n_filters > 0
             && !session_setup_filters(session))
@@ -206,10 +297,12 @@ session_alloc(SERVICE *service, DCB *client_dcb)
                  session->client_dcb->user,
                  session->client_dcb->remote);
     }
-    atomic_add(&service->stats.n_sessions, 1);
-    atomic_add(&service->stats.n_current, 1);
+    ts_stats_add(service->stats.n_sessions, 1);
+    ts_stats_add(service->stats.n_current, 1);
     CHK_SESSION(session);
 
+    session_register(session);
+
     client_dcb->session = session;
     return SESSION_STATE_TO_BE_FREED == session->state ? NULL : session;
 }
@@ -315,8 +408,9 @@ static void session_free(MXS_SESSION *session)
     CHK_SESSION(session);
     ss_dassert(session->refcount == 0);
 
+    session_unregister(session);
     session->state = SESSION_STATE_TO_BE_FREED;
-    atomic_add(&session->service->stats.n_current, -1);
+    ts_stats_add(session->service->stats.n_current, -1);
 
     if (session->client_dcb)
     {
@@ -363,11 +457,35 @@ static void session_free(MXS_SESSION *session)
     }
 }
 
+/**
+ * Release the memory of a session that no thread refers to
+ *
+ * @param data The session
+ */
+static void session_release(void *data)
+{
+    MXS_SESSION *session = (MXS_SESSION*)data;
+
+    if (session_freelist)
+    {
+        mxs_freelist_free(session_freelist, session);
+    }
+    else
+    {
+        MXS_FREE(session);
+    }
+}
+
 static void
 session_final_free(MXS_SESSION *session)
 {
+    session_unregister(session);
     gwbuf_free(session->stmt.buffer);
-    MXS_FREE(session);
+    qc_ps_free(session);
+    session_trace_end(session);
+
+    /** Other threads may still be reading the unregistered session */
+    mxs_qsbr_defer(session_release, session);
 }
 
 /**
@@ -402,11 +520,45 @@ printSession(MXS_SESSION *session)
     printf("\tRouter Session: %p\n", session->router_session);
 }
 
-bool printAllSessions_cb(DCB *dcb, void *data)
+/**
+ * @brief Check whether a session belongs to a client connection
+ *
+ * @param session Session to check
+ * @return True if the session was created for a client connection
+ */
+static bool session_is_client(MXS_SESSION *session)
 {
-    if (dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER)
+    return session->client_dcb && session->client_dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER;
+}
+
+bool session_foreach(bool (*func)(MXS_SESSION *session, void *data), void *data)
+{
+    bool more = true;
+
+    for (int i = 0; i < SESSION_REGISTRY_SIZE && more; i++)
     {
-        printSession(dcb->session);
+        spinlock_acquire(&session_registry[i].lock);
+
+        for (MXS_SESSION *session = session_registry[i].head; session && more;
+             session = session->registry_next)
+        {
+            if (!func(session, data))
+            {
+                more = false;
+            }
+        }
+
+        spinlock_release(&session_registry[i].lock);
+    }
+
+    return more;
+}
+
+bool printAllSessions_cb(MXS_SESSION *session, void *data)
+{
+    if (session_is_client(session))
+    {
+        printSession(session);
     }
 
     return true;
@@ -421,17 +573,16 @@ bool printAllSessions_cb(DCB *dcb, void *data)
 void
 printAllSessions()
 {
-    dcb_foreach(printAllSessions_cb, NULL);
+    session_foreach(printAllSessions_cb, NULL);
 }
 
 /** Callback for dprintAllSessions */
-bool dprintAllSessions_cb(DCB *dcb, void *data)
+bool dprintAllSessions_cb(MXS_SESSION *session, void *data)
 {
-    if (dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER &&
-        dcb->session->state != SESSION_STATE_DUMMY)
+    if (session_is_client(session))
     {
         DCB *out_dcb = (DCB*)data;
-        dprintSession(out_dcb, dcb->session);
+        dprintSession(out_dcb, session);
     }
     return true;
 }
@@ -447,7 +598,7 @@ bool dprintAllSessions_cb(DCB *dcb, void *data)
 void
 dprintAllSessions(DCB *dcb)
 {
-    dcb_foreach(dprintAllSessions_cb, dcb);
+    session_foreach(dprintAllSessions_cb, dcb);
 }
 
 /**
@@ -500,12 +651,11 @@ dprintSession(DCB *dcb, MXS_SESSION *print_session)
     }
 }
 
-bool dListSessions_cb(DCB *dcb, void *data)
+bool dListSessions_cb(MXS_SESSION *session, void *data)
 {
-    if (dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER)
+    if (session_is_client(session))
     {
         DCB *out_dcb = (DCB*)data;
-        MXS_SESSION *session = dcb->session;
         dcb_printf(out_dcb, "%-16lu | %-15s | %-14s | %s\n", session->ses_id,
                    session->client_dcb && session->client_dcb->remote ?
                    session->client_dcb->remote : "",
@@ -531,7 +681,7 @@ dListSessions(DCB *dcb)
     dcb_printf(dcb, "Session          | Client          | Service        | State\n");
     dcb_printf(dcb, "-----------------+-----------------+----------------+--------------------------\n");
 
-    dcb_foreach(dListSessions_cb, dcb);
+    session_foreach(dListSessions_cb, dcb);
 
     dcb_printf(dcb, "-----------------+-----------------+----------------+--------------------------\n\n");
 }
@@ -603,6 +753,8 @@ session_setup_filters(MXS_SESSION *session)
             MXS_ERROR("Service '%s' contians an unresolved filter.", service->name);
             return 0;
         }
+        MXS_DOWNSTREAM next = session->head;
+
         if ((head = filter_apply(service->filters[i], session,
                                  &session->head)) == NULL)
         {
@@ -617,6 +769,22 @@ session_setup_filters(MXS_SESSION *session)
         session->filters[i].instance = head->instance;
         session->head = *head;
         MXS_FREE(head);
+        session_trace_wrap_head(session, i);
+
+        uint64_t commands = service->filters[i]->capabilities & FCAP_TYPE_COMMANDS;
+
+        if (commands)
+        {
+            /** Route the other commands directly to the next element */
+            SESSION_FILTER *sf = &session->filters[i];
+            sf->commands = commands;
+            sf->down = session->head;
+            sf->bypass = next;
+
+            session->head.instance = sf;
+            session->head.session = session;
+            session->head.routeQuery = session_filter_gate;
+        }
     }
 
     for (i = 0; i < service->n_filters; i++)
@@ -640,12 +808,73 @@ session_setup_filters(MXS_SESSION *session)
         {
             session->tail = *tail;
             MXS_FREE(tail);
+            session_trace_wrap_tail(session, i);
         }
     }
 
     return 1;
 }
 
+/**
+ * Route a packet either through a filter or past it, depending on whether
+ * the filter has declared that it processes the command of the packet.
+ * The continuation packets of a large packet follow the first packet.
+ *
+ * @param instance The SESSION_FILTER of the filter
+ * @param session  The session
+ * @param data     The packet to route
+ * @return The return value of the routeQuery that was called
+ */
+static int32_t session_filter_gate(void *instance, void *session, GWBUF *data)
+{
+    SESSION_FILTER *sf = (SESSION_FILTER*)instance;
+    uint8_t header[MYSQL_HEADER_LEN + 1];
+    size_t n = gwbuf_copy_data(data, 0, sizeof(header), header);
+
+    if (!sf->continued)
+    {
+        uint64_t command = 0;
+
+        if (n == sizeof(header))
+        {
+            switch (MYSQL_GET_COMMAND(header))
+            {
+            case MYSQL_COM_QUERY:
+                command = FCAP_TYPE_COM_QUERY;
+                break;
+
+            case MYSQL_COM_STMT_PREPARE:
+                command = FCAP_TYPE_COM_STMT_PREPARE;
+                break;
+
+            case MYSQL_COM_STMT_EXECUTE:
+                command = FCAP_TYPE_COM_STMT_EXECUTE;
+                break;
+
+            case MYSQL_COM_INIT_DB:
+                command = FCAP_TYPE_COM_INIT_DB;
+                break;
+
+            default:
+                break;
+            }
+
+            sf->routed = sf->commands & command & FCAP_TYPE_COMMANDS;
+        }
+        else
+        {
+            /** Not a complete header, let the filter decide what to do */
+            sf->routed = true;
+        }
+    }
+
+    sf->continued = n >= MYSQL_HEADER_LEN &&
+        MYSQL_GET_PAYLOAD_LEN(header) == GW_MYSQL_MAX_PACKET_LEN;
+
+    MXS_DOWNSTREAM *down = sf->routed ? &sf->down : &sf->bypass;
+    return down->routeQuery(down->instance, down->session, data);
+}
+
 /**
  * Entry point for the final element in the upstream filter, i.e. the writing
  * of the data to the client.
@@ -689,7 +918,7 @@ bool session_route_query(MXS_SESSION* ses, GWBUF* buf)
         goto return_succp;
     }
 
-    if (ses->head.routeQuery(ses->head.instance, ses->head.session, buf) == 1)
+    if (MXS_SESSION_ROUTE_QUERY(ses, buf) == 1)
     {
         succp = true;
     }
@@ -715,47 +944,77 @@ session_get_user(const MXS_SESSION *session)
     return (session && session->client_dcb) ? session->client_dcb->user : NULL;
 }
 
+/**
+ * A row of the session list, copied when the list is created
+ */
+typedef struct
+{
+    char session[20];
+    char *client;
+    char *service;
+    const char *state;
+} SESSIONROW;
+
 /**
  * Callback structure for the session list extraction
  */
 typedef struct
 {
     int index;
-    int current;
+    int n_rows;
+    int max_rows;
     SESSIONLISTFILTER filter;
-    RESULT_ROW *row;
-    RESULTSET *set;
+    SESSIONROW *rows;
 } SESSIONFILTER;
 
-bool dcb_iter_cb(DCB *dcb, void *data)
+/**
+ * @brief Free the rows of the session list
+ *
+ * @param cbdata The session list
+ */
+static void session_list_free(SESSIONFILTER *cbdata)
+{
+    for (int i = 0; i < cbdata->n_rows; i++)
+    {
+        MXS_FREE(cbdata->rows[i].client);
+        MXS_FREE(cbdata->rows[i].service);
+    }
+
+    MXS_FREE(cbdata->rows);
+    MXS_FREE(cbdata);
+}
+
+static bool session_list_cb(MXS_SESSION *list_session, void *data)
 {
     SESSIONFILTER *cbdata = (SESSIONFILTER*)data;
 
-    if (cbdata->current < cbdata->index)
+    if (cbdata->filter == SESSION_LIST_CONNECTION &&
+        list_session->state == SESSION_STATE_LISTENER)
     {
-        if (cbdata->filter == SESSION_LIST_ALL ||
-            (cbdata->filter == SESSION_LIST_CONNECTION &&
-             (dcb->session->state != SESSION_STATE_LISTENER)))
-        {
-            cbdata->current++;
-        }
+        return true;
     }
-    else
+
+    if (cbdata->n_rows == cbdata->max_rows)
     {
-        char buf[20];
-        MXS_SESSION *list_session = dcb->session;
-
-        cbdata->index++;
-        cbdata->row = resultset_make_row(cbdata->set);
-        snprintf(buf, sizeof(buf), "%p", list_session);
-        resultset_row_set(cbdata->row, 0, buf);
-        resultset_row_set(cbdata->row, 1, ((list_session->client_dcb && list_session->client_dcb->remote)
-                                           ? list_session->client_dcb->remote : ""));
-        resultset_row_set(cbdata->row, 2, (list_session->service && list_session->service->name
-                                           ? list_session->service->name : ""));
-        resultset_row_set(cbdata->row, 3, session_state(list_session->state));
-        return false;
+        int max_rows = cbdata->max_rows ? cbdata->max_rows * 2 : 64;
+        SESSIONROW *rows = MXS_REALLOC(cbdata->rows, max_rows * sizeof(SESSIONROW));
+
+        if (rows == NULL)
+        {
+            return false;
+        }
+
+        cbdata->rows = rows;
+        cbdata->max_rows = max_rows;
     }
+
+    SESSIONROW *row = &cbdata->rows[cbdata->n_rows++];
+    snprintf(row->session, sizeof(row->session), "%p", list_session);
+    row->client = MXS_STRDUP((list_session->client_dcb && list_session->client_dcb->remote)
+                             ? list_session->client_dcb->remote : "");
+    row->service = MXS_STRDUP(list_session->service && list_session->service->name
+                              ? list_session->service->name : "");
+    row->state = session_state(list_session->state);
     return true;
 }
 
@@ -772,17 +1031,18 @@ sessionRowCallback(RESULTSET *set, void *data)
     SESSIONFILTER *cbdata = (SESSIONFILTER*)data;
     RESULT_ROW *row = NULL;
 
-    cbdata->current = 0;
-    dcb_foreach(dcb_iter_cb, cbdata);
-
-    if (cbdata->row)
+    if (cbdata->index < cbdata->n_rows)
     {
-        row = cbdata->row;
-        cbdata->row = NULL;
+        SESSIONROW *list_row = &cbdata->rows[cbdata->index++];
+        row = resultset_make_row(set);
+        resultset_row_set(row, 0, list_row->session);
+        resultset_row_set(row, 1, list_row->client ? list_row->client : "");
+        resultset_row_set(row, 2, list_row->service ? list_row->service : "");
+        resultset_row_set(row, 3, list_row->state);
     }
     else
     {
-        MXS_FREE(cbdata);
+        session_list_free(cbdata);
     }
 
     return row;
@@ -791,6 +1051,9 @@ sessionRowCallback(RESULTSET *set, void *data)
 /**
  * Return a resultset that has the current set of sessions in it
  *
+ * The sessions are copied when the result set is created so that sending
+ * the rows does not need to visit the sessions again.
+ *
  * @return A Result set
  */
 /* Lint is not convinced that the new memory for data is always tracked
@@ -806,22 +1069,19 @@ sessionGetList(SESSIONLISTFILTER filter)
     RESULTSET *set;
     SESSIONFILTER *data;
 
-    if ((data = (SESSIONFILTER *)MXS_MALLOC(sizeof(SESSIONFILTER))) == NULL)
+    if ((data = (SESSIONFILTER *)MXS_CALLOC(1, sizeof(SESSIONFILTER))) == NULL)
     {
         return NULL;
     }
-    data->index = 0;
     data->filter = filter;
-    data->current = 0;
-    data->row = NULL;
+    session_foreach(session_list_cb, data);
 
     if ((set = resultset_create(sessionRowCallback, data)) == NULL)
     {
-        MXS_FREE(data);
+        session_list_free(data);
         return NULL;
     }
 
-    data->set = set;
     resultset_add_column(set, "Session", 16, COL_TYPE_VARCHAR);
     resultset_add_column(set, "Client", 15, COL_TYPE_VARCHAR);
     resultset_add_column(set, "Service", 15, COL_TYPE_VARCHAR);
@@ -867,30 +1127,39 @@ const char* session_trx_state_to_string(mxs_session_trx_state_t state)
     return "UNKNOWN";
 }
 
-static bool ses_find_id(DCB *dcb, void *data)
+MXS_SESSION* session_get_by_id(int id)
 {
-    void **params = (void**)data;
-    MXS_SESSION **ses = (MXS_SESSION**)params[0];
-    int *id = (int*)params[1];
-    bool rval = true;
+    MXS_SESSION *rval = NULL;
+    int bucket = (size_t)id % SESSION_REGISTRY_SIZE;
 
-    if (dcb->session->ses_id == *id)
+    spinlock_acquire(&session_registry[bucket].lock);
+
+    for (MXS_SESSION *session = session_registry[bucket].head; session;
+         session = session->registry_next)
     {
-        *ses = session_get_ref(dcb->session);
-        rval = false;
-    }
+        if (session->ses_id == (size_t)id)
+        {
+            /**
+             * A session whose last reference was released is about to be
+             * removed from the registry, it must not be referenced again.
+             */
+            int refs = session->refcount;
 
-    return rval;
-}
+            while (refs > 0 && !atomic_cas_int(&session->refcount, &refs, refs + 1))
+            {
+            }
 
-MXS_SESSION* session_get_by_id(int id)
-{
-    MXS_SESSION *session = NULL;
-    void *params[] = {&session, &id};
+            if (refs > 0)
+            {
+                rval = session;
+            }
+            break;
+        }
+    }
 
-    dcb_foreach(ses_find_id, params);
+    spinlock_release(&session_registry[bucket].lock);
 
-    return session;
+    return rval;
 }
 
 MXS_SESSION* session_get_ref(MXS_SESSION *session)
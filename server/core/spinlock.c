@@ -11,72 +11,137 @@
  * Public License.
  */
 
+
+/**
+ * @file spinlock.c  Adaptive spin-then-park locks
+ *
+ * An uncontended acquisition is a single compare-and-swap. A contended
+ * acquisition spins for a number of iterations that adapts to how long the
+ * lock has recently been held, in the same way as the adaptive mutexes of
+ * glibc, and then parks the thread on a futex. The lock value is 2 while
+ * there may be parked threads so that the release only makes a system call
+ * when someone can be waiting for it.
+ *
+ * The statistics of a lock are updated by the thread holding the lock, so
+ * they cost nothing more than a plain increment on the uncontended path. The
+ * time is only read when the lock is contended.
+ */
+
 #include <maxscale/spinlock.h>
-#include <maxscale/atomic.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 #include <time.h>
+#include <unistd.h>
+#include <maxscale/alloc.h>
 #include <maxscale/debug.h>
 
+/** The upper limit of spins before a waiting thread is parked */
+#define SPINLOCK_MAX_SPINS 1000
+
+/** A registered spinlock */
+typedef struct spinlock_entry
+{
+    SPINLOCK              *lock;
+    const char            *name;
+    struct spinlock_entry *next;
+} SPINLOCK_ENTRY;
+
+/** The registered spinlocks, in registration order */
+static SPINLOCK_ENTRY *registry = NULL;
+static SPINLOCK registry_lock = SPINLOCK_INIT;
+
+static inline void spinlock_pause(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __asm__ __volatile__("pause");
+#endif
+}
+
+static inline uint64_t spinlock_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline bool spinlock_try(SPINLOCK *lock)
+{
+    int expected = 0;
+    return __atomic_compare_exchange_n(&lock->lock, &expected, 1, false,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
 
 void spinlock_init(SPINLOCK *lock)
 {
     lock->lock = 0;
-#if SPINLOCK_PROFILE
     lock->spins = 0;
-    lock->maxspins = 0;
     lock->acquired = 0;
-    lock->waiting = 0;
-    lock->max_waiting = 0;
     lock->contended = 0;
-    lock->owner = 0;
-#endif
+    lock->wait_ns = 0;
 }
 
-void spinlock_acquire(const SPINLOCK *const_lock)
+/**
+ * Acquire a spinlock that another thread holds
+ *
+ * @param lock The spinlock to acquire
+ */
+static void spinlock_acquire_contended(SPINLOCK *lock)
 {
-    SPINLOCK *lock = (SPINLOCK*)const_lock;
-#if SPINLOCK_PROFILE
+    uint64_t start = spinlock_time_ns();
+    int max_spins = MXS_MIN(SPINLOCK_MAX_SPINS, lock->spins * 2 + 10);
     int spins = 0;
+    bool acquired = false;
 
-    atomic_add(&(lock->waiting), 1);
-#endif
-
-    while (__sync_lock_test_and_set(&(lock->lock), 1))
+    while (spins < max_spins)
     {
-#if SPINLOCK_PROFILE
-        atomic_add(&(lock->spins), 1);
         spins++;
-#endif
+        spinlock_pause();
+
+        if (__atomic_load_n(&lock->lock, __ATOMIC_RELAXED) == 0 && spinlock_try(lock))
+        {
+            acquired = true;
+            break;
+        }
     }
 
-#if SPINLOCK_PROFILE
-    if (spins)
+    if (!acquired)
     {
-        lock->contended++;
-        if (lock->maxspins < spins)
+        /** Announce a waiter and park until the holder releases the lock */
+        while (__atomic_exchange_n(&lock->lock, 2, __ATOMIC_ACQUIRE) != 0)
         {
-            lock->maxspins = spins;
+            syscall(SYS_futex, &lock->lock, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
         }
     }
+
+    /** The lock is held so the statistics can be updated without atomics */
+    lock->spins += (spins - lock->spins) / 8;
+    lock->contended++;
+    lock->wait_ns += spinlock_time_ns() - start;
+}
+
+void spinlock_acquire(const SPINLOCK *const_lock)
+{
+    SPINLOCK *lock = (SPINLOCK*)const_lock;
+
+    if (!spinlock_try(lock))
+    {
+        spinlock_acquire_contended(lock);
+    }
+
     lock->acquired++;
-    lock->owner = thread_self();
-    atomic_add(&(lock->waiting), -1);
-#endif
 }
 
 bool
 spinlock_acquire_nowait(const SPINLOCK *const_lock)
 {
     SPINLOCK *lock = (SPINLOCK*)const_lock;
-    if (__sync_lock_test_and_set(&(lock->lock), 1))
+
+    if (!spinlock_try(lock))
     {
         return false;
     }
 
-#if SPINLOCK_PROFILE
     lock->acquired++;
-    lock->owner = thread_self();
-#endif
-
     return true;
 }
 
@@ -84,38 +149,79 @@ void spinlock_release(const SPINLOCK *const_lock)
 {
     SPINLOCK *lock = (SPINLOCK*)const_lock;
     ss_dassert(lock->lock != 0);
-#if SPINLOCK_PROFILE
-    if (lock->waiting > lock->max_waiting)
+
+    if (__atomic_exchange_n(&lock->lock, 0, __ATOMIC_RELEASE) == 2)
     {
-        lock->max_waiting = lock->waiting;
+        syscall(SYS_futex, &lock->lock, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
     }
-#endif
-
-    __sync_lock_release(&lock->lock);
 }
 
 void spinlock_stats(const SPINLOCK *lock, void (*reporter)(void *, char *, int), void *hdl)
 {
-#if SPINLOCK_PROFILE
-    reporter(hdl, "Spinlock acquired", lock->acquired);
-    if (lock->acquired)
+    uint64_t acquired = lock->acquired;
+    uint64_t contended = lock->contended;
+
+    reporter(hdl, "Spinlock acquired", acquired);
+    if (acquired)
     {
-        reporter(hdl, "Total no. of spins", lock->spins);
-        if (lock->acquired)
+        reporter(hdl, "Contended locks", contended);
+        reporter(hdl, "Contention percentage", (contended * 100) / acquired);
+        reporter(hdl, "Total wait time (ms)", lock->wait_ns / 1000000);
+        if (contended)
         {
-            reporter(hdl, "Average no. of spins (overall)", lock->spins / lock->acquired);
+            reporter(hdl, "Average wait when contended (us)", lock->wait_ns / contended / 1000);
         }
-        if (lock->contended)
+        reporter(hdl, "Adaptive spin count", lock->spins);
+    }
+}
+
+void spinlock_register(SPINLOCK *lock, const char *name)
+{
+    SPINLOCK_ENTRY *entry = (SPINLOCK_ENTRY*)MXS_MALLOC(sizeof(SPINLOCK_ENTRY));
+
+    if (entry)
+    {
+        SPINLOCK_ENTRY **tail = &registry;
+        bool found = false;
+
+        entry->lock = lock;
+        entry->name = name;
+        entry->next = NULL;
+
+        spinlock_acquire(&registry_lock);
+
+        while (*tail && !found)
         {
-            reporter(hdl, "Average no. of spins (when contended)", lock->spins / lock->contended);
+            found = (*tail)->lock == lock;
+            tail = &(*tail)->next;
         }
-        reporter(hdl, "Maximum no. of spins", lock->maxspins);
-        reporter(hdl, "Maximim no. of blocked threads", lock->max_waiting);
-        reporter(hdl, "Contended locks", lock->contended);
-        if (lock->acquired)
+
+        if (!found)
         {
-            reporter(hdl, "Contention percentage", (lock->contended * 100) / lock->acquired);
+            *tail = entry;
+        }
+
+        spinlock_release(&registry_lock);
+
+        if (found)
+        {
+            MXS_FREE(entry);
         }
     }
-#endif
+}
+
+void spinlock_foreach_registered(bool (*func)(const char *name, const SPINLOCK *lock, void *data),
+                                 void *data)
+{
+    spinlock_acquire(&registry_lock);
+
+    for (SPINLOCK_ENTRY *entry = registry; entry; entry = entry->next)
+    {
+        if (!func(entry->name, entry->lock, data))
+        {
+            break;
+        }
+    }
+
+    spinlock_release(&registry_lock);
 }
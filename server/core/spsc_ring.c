@@ -0,0 +1,393 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file spsc_ring.c - A single producer, single consumer ring buffer
+ *
+ * The head and the tail count the bytes committed and consumed in total, so the
+ * ring is empty when they are equal and their difference is the space in use.
+ * Each record starts with a header that holds its length. A record that does
+ * not fit at the end of the ring is preceded by a filler record that takes the
+ * rest of the ring; the consumer skips the fillers.
+ *
+ * A consumer thread that finds its rings empty sets its sleeping flag, checks
+ * the heads of the rings once more and waits on an eventfd. A producer that
+ * commits a record checks the flag after it has updated the head, and the one
+ * that clears the flag writes to the eventfd. Both sides issue a full barrier
+ * between the store and the load, so either the consumer sees the new record
+ * or the producer sees the flag and no wakeup is lost.
+ */
+
+#include <maxscale/spsc_ring.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/thread.h>
+
+#include "maxscale/poll.h"
+
+/** The filler at the end of the ring */
+#define RING_RECORD_FILLER 1
+
+typedef struct
+{
+    uint32_t len;   /*< Length of the record following the header */
+    uint32_t flags; /*< RING_RECORD_FILLER for a filler */
+} RING_RECORD;
+
+struct mxs_spsc_consumer
+{
+    MXS_SPSC_RING     *rings;    /*< The rings to drain */
+    int               n_rings;   /*< Number of rings */
+    uint64_t          *heads;    /*< Heads of the rings before the last round */
+    mxs_spsc_drain_cb drain;     /*< Drains one ring */
+    mxs_spsc_flush_cb flush;     /*< Called after each round, may be NULL */
+    void              *data;     /*< Passed to the callbacks */
+    int               wakeup_fd; /*< The eventfd the thread sleeps on */
+    int               watch_fd;  /*< Another descriptor that wakes the thread, or -1 */
+    int               sleeping;  /*< Set while the thread is about to sleep or sleeping */
+    int               stop;      /*< Set when the thread should stop */
+    THREAD            thread;    /*< The consumer thread */
+};
+
+/** Space a record with @c len bytes takes in a ring */
+#define RING_RECORD_SPACE(len) ((sizeof(RING_RECORD) + (len) + MXS_SPSC_RING_ALIGN - 1) & \
+                                ~(uint64_t)(MXS_SPSC_RING_ALIGN - 1))
+
+bool mxs_spsc_ring_init(MXS_SPSC_RING *ring, size_t size)
+{
+    uint64_t ring_size = MXS_SPSC_RING_MIN_SIZE;
+
+    while (ring_size < size)
+    {
+        ring_size *= 2;
+    }
+
+    memset(ring, 0, sizeof(*ring));
+    ring->mask = ring_size - 1;
+    ring->data = MXS_MALLOC(ring_size);
+
+    return ring->data != NULL;
+}
+
+void mxs_spsc_ring_destroy(MXS_SPSC_RING *ring)
+{
+    MXS_FREE(ring->data);
+    ring->data = NULL;
+}
+
+MXS_SPSC_RING* mxs_spsc_rings_alloc(int n_rings, size_t size)
+{
+    MXS_SPSC_RING *rings = MXS_CALLOC(n_rings, sizeof(MXS_SPSC_RING));
+
+    for (int i = 0; rings && i < n_rings; i++)
+    {
+        if (!mxs_spsc_ring_init(&rings[i], size))
+        {
+            mxs_spsc_rings_free(rings, i);
+            rings = NULL;
+        }
+    }
+
+    return rings;
+}
+
+void mxs_spsc_rings_free(MXS_SPSC_RING *rings, int n_rings)
+{
+    for (int i = 0; rings && i < n_rings; i++)
+    {
+        mxs_spsc_ring_destroy(&rings[i]);
+    }
+
+    MXS_FREE(rings);
+}
+
+MXS_SPSC_RING* mxs_spsc_rings_get(MXS_SPSC_RING *rings, int n_rings)
+{
+    return poll_thread && current_thread_id < n_rings ? &rings[current_thread_id] : NULL;
+}
+
+void* mxs_spsc_ring_reserve(MXS_SPSC_RING *ring, size_t len)
+{
+    uint64_t size = ring->mask + 1;
+    uint64_t total = RING_RECORD_SPACE(len);
+    uint64_t head = ring->head;
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    uint64_t offset = head & ring->mask;
+    uint64_t pad = offset + total > size ? size - offset : 0;
+
+    if (total > size || pad + total > size - (head - tail))
+    {
+        return NULL;
+    }
+
+    if (pad)
+    {
+        /** The offsets are aligned so there is always room for the header */
+        RING_RECORD *filler = (RING_RECORD*)(ring->data + offset);
+        filler->len = pad - sizeof(RING_RECORD);
+        filler->flags = RING_RECORD_FILLER;
+        head += pad;
+    }
+
+    ring->pending = head;
+    return ring->data + (head & ring->mask) + sizeof(RING_RECORD);
+}
+
+size_t mxs_spsc_ring_commit(MXS_SPSC_RING *ring, size_t len)
+{
+    RING_RECORD *record = (RING_RECORD*)(ring->data + (ring->pending & ring->mask));
+    uint64_t head = ring->pending + RING_RECORD_SPACE(len);
+
+    record->len = len;
+    record->flags = 0;
+    __atomic_store_n(&ring->n_records, ring->n_records + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+
+    if (ring->consumer)
+    {
+        int sleeping = 1;
+        atomic_synchronize();
+
+        if (__atomic_load_n(&ring->consumer->sleeping, __ATOMIC_RELAXED) &&
+            atomic_cas_int(&ring->consumer->sleeping, &sleeping, 0))
+        {
+            mxs_spsc_consumer_wake(ring->consumer);
+        }
+    }
+
+    return head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+void* mxs_spsc_ring_peek(MXS_SPSC_RING *ring, size_t *len)
+{
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = ring->tail;
+
+    while (tail != head)
+    {
+        RING_RECORD *record = (RING_RECORD*)(ring->data + (tail & ring->mask));
+
+        if ((record->flags & RING_RECORD_FILLER) == 0)
+        {
+            *len = record->len;
+            return record + 1;
+        }
+
+        tail += RING_RECORD_SPACE(record->len);
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+
+    return NULL;
+}
+
+void mxs_spsc_ring_consume(MXS_SPSC_RING *ring)
+{
+    RING_RECORD *record = (RING_RECORD*)(ring->data + (ring->tail & ring->mask));
+    __atomic_store_n(&ring->tail, ring->tail + RING_RECORD_SPACE(record->len), __ATOMIC_RELEASE);
+}
+
+size_t mxs_spsc_ring_used(MXS_SPSC_RING *ring)
+{
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) -
+           __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+bool mxs_spsc_ring_is_empty(MXS_SPSC_RING *ring)
+{
+    return mxs_spsc_ring_used(ring) == 0;
+}
+
+/**
+ * Check whether records have been committed since the last round
+ *
+ * @param consumer The consumer
+ * @return True if the head of a ring has moved
+ */
+static bool spsc_consumer_has_new_records(MXS_SPSC_CONSUMER *consumer)
+{
+    for (int i = 0; i < consumer->n_rings; i++)
+    {
+        if (__atomic_load_n(&consumer->rings[i].head, __ATOMIC_ACQUIRE) != consumer->heads[i])
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Sleep until a record is committed or something else wakes the thread up
+ *
+ * @param consumer   The consumer
+ * @param timeout_ms Longest time to sleep, -1 for no limit
+ */
+static void spsc_consumer_sleep(MXS_SPSC_CONSUMER *consumer, int timeout_ms)
+{
+    __atomic_store_n(&consumer->sleeping, 1, __ATOMIC_RELAXED);
+    atomic_synchronize();
+
+    if (!spsc_consumer_has_new_records(consumer) &&
+        !__atomic_load_n(&consumer->stop, __ATOMIC_ACQUIRE))
+    {
+        struct pollfd fds[2] =
+        {
+            {consumer->wakeup_fd, POLLIN, 0},
+            {consumer->watch_fd, POLLIN, 0}
+        };
+
+        if (poll(fds, 2, timeout_ms) == -1 && errno != EINTR)
+        {
+            char errbuf[MXS_STRERROR_BUFLEN];
+            MXS_ERROR("Failed to wait for records: %d, %s", errno,
+                      strerror_r(errno, errbuf, sizeof(errbuf)));
+            thread_millisleep(timeout_ms < 0 || timeout_ms > 1000 ? 1000 : timeout_ms);
+        }
+    }
+
+    __atomic_store_n(&consumer->sleeping, 0, __ATOMIC_RELAXED);
+
+    uint64_t value;
+
+    while (read(consumer->wakeup_fd, &value, sizeof(value)) > 0)
+    {
+        ;
+    }
+}
+
+/**
+ * The consumer thread
+ *
+ * @param data The consumer
+ */
+static void spsc_consumer_main(void *data)
+{
+    MXS_SPSC_CONSUMER *consumer = (MXS_SPSC_CONSUMER*)data;
+    bool stop = false;
+
+    while (!stop)
+    {
+        stop = __atomic_load_n(&consumer->stop, __ATOMIC_ACQUIRE);
+        uint64_t n_records = 0;
+
+        for (int i = 0; i < consumer->n_rings; i++)
+        {
+            consumer->heads[i] = __atomic_load_n(&consumer->rings[i].head, __ATOMIC_ACQUIRE);
+            n_records += consumer->drain(&consumer->rings[i], consumer->data);
+        }
+
+        int timeout_ms = consumer->flush ? consumer->flush(consumer, consumer->data) : -1;
+
+        if (n_records == 0 && !stop)
+        {
+            spsc_consumer_sleep(consumer, timeout_ms);
+        }
+    }
+}
+
+MXS_SPSC_CONSUMER* mxs_spsc_consumer_start(MXS_SPSC_RING *rings, int n_rings,
+                                           mxs_spsc_drain_cb drain, mxs_spsc_flush_cb flush,
+                                           void *data)
+{
+    MXS_SPSC_CONSUMER *consumer = MXS_CALLOC(1, sizeof(MXS_SPSC_CONSUMER));
+
+    if (consumer && (consumer->heads = MXS_CALLOC(n_rings, sizeof(uint64_t))) == NULL)
+    {
+        MXS_FREE(consumer);
+        consumer = NULL;
+    }
+
+    if (consumer)
+    {
+        consumer->rings = rings;
+        consumer->n_rings = n_rings;
+        consumer->drain = drain;
+        consumer->flush = flush;
+        consumer->data = data;
+        consumer->watch_fd = -1;
+
+        if ((consumer->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+        {
+            char errbuf[MXS_STRERROR_BUFLEN];
+            MXS_ERROR("Failed to create an eventfd for a consumer thread: %d, %s", errno,
+                      strerror_r(errno, errbuf, sizeof(errbuf)));
+        }
+        else
+        {
+            for (int i = 0; i < n_rings; i++)
+            {
+                rings[i].consumer = consumer;
+            }
+
+            if (thread_start(&consumer->thread, spsc_consumer_main, consumer))
+            {
+                return consumer;
+            }
+
+            for (int i = 0; i < n_rings; i++)
+            {
+                rings[i].consumer = NULL;
+            }
+
+            close(consumer->wakeup_fd);
+        }
+
+        MXS_FREE(consumer->heads);
+        MXS_FREE(consumer);
+    }
+
+    return NULL;
+}
+
+void mxs_spsc_consumer_wake(MXS_SPSC_CONSUMER *consumer)
+{
+    uint64_t value = 1;
+
+    if (write(consumer->wakeup_fd, &value, sizeof(value)) == -1 && errno != EAGAIN)
+    {
+        char errbuf[MXS_STRERROR_BUFLEN];
+        MXS_ERROR("Failed to wake up a consumer thread: %d, %s", errno,
+                  strerror_r(errno, errbuf, sizeof(errbuf)));
+    }
+}
+
+void mxs_spsc_consumer_watch(MXS_SPSC_CONSUMER *consumer, int fd)
+{
+    consumer->watch_fd = fd;
+}
+
+void mxs_spsc_consumer_stop(MXS_SPSC_CONSUMER *consumer)
+{
+    if (consumer)
+    {
+        __atomic_store_n(&consumer->stop, 1, __ATOMIC_RELEASE);
+        mxs_spsc_consumer_wake(consumer);
+        thread_wait(consumer->thread);
+
+        for (int i = 0; i < consumer->n_rings; i++)
+        {
+            consumer->rings[i].consumer = NULL;
+        }
+
+        close(consumer->wakeup_fd);
+        MXS_FREE(consumer->heads);
+        MXS_FREE(consumer);
+    }
+}
@@ -32,6 +32,7 @@
 #include <maxscale/dcb.h>
 #include <maxscale/service.h>
 #include <maxscale/log_manager.h>
+#include <maxscale/atomic.h>
 #include <sys/ioctl.h>
 
 /**
@@ -215,6 +216,45 @@ const char* ssl_method_type_to_string(ssl_method_type_t method_type)
     }
 }
 
+void ssl_count_handshake(SSL_LISTENER *ssl, SSL *con)
+{
+    if (SSL_session_reused(con))
+    {
+        atomic_add_uint64(&ssl->n_resumed_handshakes, 1);
+    }
+    else
+    {
+        atomic_add_uint64(&ssl->n_full_handshakes, 1);
+    }
+}
+
+void ssl_set_client_session(SSL_LISTENER *ssl, SSL *con)
+{
+    spinlock_acquire(&ssl->session_lock);
+
+    if (ssl->session)
+    {
+        SSL_set_session(con, ssl->session);
+    }
+
+    spinlock_release(&ssl->session_lock);
+}
+
+bool ssl_kernel_tls_send(SSL_LISTENER *ssl, SSL *con)
+{
+    bool rval = false;
+
+#ifdef SSL_OP_ENABLE_KTLS
+    if (ssl->ssl_ktls && BIO_get_ktls_send(SSL_get_wbio(con)))
+    {
+        atomic_add_uint64(&ssl->n_ktls_connections, 1);
+        rval = true;
+    }
+#endif
+
+    return rval;
+}
+
 void write_ssl_config(int fd, SSL_LISTENER* ssl)
 {
     if (ssl)
@@ -243,6 +283,11 @@ void write_ssl_config(int fd, SSL_LISTENER* ssl)
         dprintf(fd, "ssl_verify_peer_certificate=%s\n",
                 ssl->ssl_verify_peer_certificate ? "true" : "false");
 
+        if (ssl->ssl_ktls)
+        {
+            dprintf(fd, "ssl_ktls=true\n");
+        }
+
         const char *version = NULL;
 
         switch (ssl->ssl_method_type)
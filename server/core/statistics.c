@@ -31,9 +31,11 @@
 #include <maxscale/platform.h>
 #include <maxscale/utils.h>
 
+#include "maxscale/poll.h"
+
 static int thread_count = 0;
 static size_t cache_linesize = 0;
-static size_t stats_size = 0;
+static size_t stats_size = 0;      /**< Size of the lines of the polling threads */
 static bool stats_initialized = false;
 
 static size_t get_cache_line_size()
@@ -57,14 +59,19 @@ static size_t get_cache_line_size()
 
 /**
  * @brief Initialize the statistics gathering
+ *
+ * Objects allocated while the configuration is loaded initialize the
+ * statistics before the MaxScale core does, in which case this does nothing.
  */
 void ts_stats_init()
 {
-    ss_dassert(!stats_initialized);
-    thread_count = config_threadcount();
-    cache_linesize = get_cache_line_size();
-    stats_size = thread_count * cache_linesize;
-    stats_initialized = true;
+    if (!stats_initialized)
+    {
+        thread_count = config_threadcount();
+        cache_linesize = get_cache_line_size();
+        stats_size = thread_count * cache_linesize;
+        stats_initialized = true;
+    }
 }
 
 /**
@@ -82,8 +89,9 @@ void ts_stats_end()
  */
 ts_stats_t ts_stats_alloc()
 {
-    ss_dassert(stats_initialized);
-    return MXS_CALLOC(thread_count, cache_linesize);
+    ts_stats_init();
+    /** The last line is shared by the threads that do not poll */
+    return MXS_CALLOC(thread_count + 1, cache_linesize);
 }
 
 /**
@@ -110,9 +118,9 @@ int64_t ts_stats_sum(ts_stats_t stats)
     ss_dassert(stats_initialized);
     int64_t sum = 0;
 
-    for (size_t i = 0; i < stats_size; i += cache_linesize)
+    for (size_t i = 0; i <= stats_size; i += cache_linesize)
     {
-        sum += *((int64_t*)MXS_PTR(stats, i));
+        sum += __atomic_load_n((int64_t*)MXS_PTR(stats, i), __ATOMIC_RELAXED);
     }
 
     return sum;
@@ -159,9 +167,29 @@ int64_t ts_stats_get(ts_stats_t stats, enum ts_stats_type type)
         }
     }
 
+    if (type == TS_STATS_SUM)
+    {
+        best += __atomic_load_n((int64_t*)MXS_PTR(stats, stats_size), __ATOMIC_RELAXED);
+    }
+
     return type == TS_STATS_AVG ? best / thread_count : best;
 }
 
+void ts_stats_add(ts_stats_t stats, int64_t value)
+{
+    if (poll_thread && current_thread_id < thread_count)
+    {
+        /** Only this thread writes to the line, the store just has to be
+         * atomic for the readers */
+        int64_t *item = (int64_t*)MXS_PTR(stats, current_thread_id * cache_linesize);
+        __atomic_store_n(item, *item + value, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        __atomic_add_fetch((int64_t*)MXS_PTR(stats, stats_size), value, __ATOMIC_RELAXED);
+    }
+}
+
 void ts_stats_increment(ts_stats_t stats, int thread_id)
 {
     ss_dassert(thread_id < thread_count);
@@ -0,0 +1,409 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file maxscale_core_bench.c - Micro-benchmarks of the core hot paths
+ *
+ * Each benchmark is run a number of times and the fastest run is reported.
+ * The results are printed to stdout as tab separated values, one line per
+ * benchmark, so that the output of two builds can be compared with standard
+ * tools.
+ *
+ * @verbatim
+ * usage: maxscale_core_bench [-n iterations] [-r runs] [-t threads] [-b benchmark]
+ * @endverbatim
+ */
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <maxscale/alloc.h>
+#include <maxscale/buffer.h>
+#include <maxscale/config.h>
+#include <maxscale/dcb.h>
+#include <maxscale/hashtable.h>
+#include <maxscale/modutil.h>
+#include <maxscale/utils.h>
+
+#define BENCH_DEFAULT_ITERATIONS 1000000
+#define BENCH_DEFAULT_RUNS       3
+#define BENCH_DEFAULT_THREADS    4
+
+/** Number of packets in the buffer given to modutil_get_complete_packets */
+#define BENCH_N_PACKETS 16
+
+/** Size of the payload written in the DCB round trip */
+#define BENCH_DCB_PAYLOAD 100
+
+static const char *bench_query =
+    "SELECT a.id, b.name FROM t1 AS a JOIN t2 AS b ON a.id = b.id "
+    "WHERE a.value > 100 AND b.name = 'maxscale' OR a.id IN (1, 2, 3) /* comment */";
+
+static int bench_threads = BENCH_DEFAULT_THREADS;
+
+/**
+ * A benchmark function performs @c iterations operations and returns the
+ * number of operations it performed.
+ */
+typedef int64_t (*BENCH_FUNC)(int64_t iterations);
+
+static int64_t bench_gwbuf_alloc_free(int64_t iterations)
+{
+    for (int64_t i = 0; i < iterations; i++)
+    {
+        GWBUF *buf = gwbuf_alloc(BENCH_DCB_PAYLOAD);
+        gwbuf_free(buf);
+    }
+
+    return iterations;
+}
+
+static int64_t bench_gwbuf_clone(int64_t iterations)
+{
+    GWBUF *buf = gwbuf_alloc(BENCH_DCB_PAYLOAD);
+
+    for (int64_t i = 0; i < iterations; i++)
+    {
+        GWBUF *clone = gwbuf_clone(buf);
+        gwbuf_free(clone);
+    }
+
+    gwbuf_free(buf);
+    return iterations;
+}
+
+static int64_t bench_gwbuf_consume(int64_t iterations)
+{
+    for (int64_t i = 0; i < iterations; i++)
+    {
+        GWBUF *head = gwbuf_alloc(64);
+        head = gwbuf_append(head, gwbuf_alloc(64));
+
+        head = gwbuf_consume(head, 40);
+        head = gwbuf_consume(head, 40);
+        head = gwbuf_consume(head, 48);
+        ss_dassert(head == NULL);
+    }
+
+    return iterations;
+}
+
+static int64_t bench_modutil_get_complete_packets(int64_t iterations)
+{
+    GWBUF *packets = NULL;
+
+    for (int i = 0; i < BENCH_N_PACKETS; i++)
+    {
+        packets = gwbuf_append(packets, modutil_create_query(bench_query));
+    }
+
+    size_t len = gwbuf_length(packets);
+    uint8_t *data = MXS_MALLOC(len);
+    MXS_ABORT_IF_NULL(data);
+    gwbuf_copy_data(packets, 0, len, data);
+    gwbuf_free(packets);
+
+    for (int64_t i = 0; i < iterations; i++)
+    {
+        /** Split the data in the middle of a packet like a network read would */
+        GWBUF *readbuf = gwbuf_alloc_and_load(len / 2, data);
+        readbuf = gwbuf_append(readbuf, gwbuf_alloc_and_load(len - len / 2, data + len / 2));
+
+        GWBUF *complete = modutil_get_complete_packets(&readbuf);
+        ss_dassert(complete && readbuf == NULL);
+        gwbuf_free(complete);
+    }
+
+    MXS_FREE(data);
+    return iterations;
+}
+
+static int64_t bench_modutil_get_canonical(int64_t iterations)
+{
+    GWBUF *buf = modutil_create_query(bench_query);
+
+    for (int64_t i = 0; i < iterations; i++)
+    {
+        char *canonical = modutil_get_canonical(buf);
+        ss_dassert(canonical);
+        MXS_FREE(canonical);
+    }
+
+    gwbuf_free(buf);
+    return iterations;
+}
+
+static int64_t bench_modutil_get_canonical_digest(int64_t iterations)
+{
+    GWBUF *buf = modutil_create_query(bench_query);
+    uint64_t digest;
+
+    for (int64_t i = 0; i < iterations; i++)
+    {
+        modutil_get_canonical_digest(buf, &digest);
+    }
+
+    gwbuf_free(buf);
+    return iterations;
+}
+
+static int bench_hash(const void *key)
+{
+    return *(const int*)key * 2654435761u;
+}
+
+static int bench_cmp(const void *v1, const void *v2)
+{
+    return *(const int*)v1 - *(const int*)v2;
+}
+
+typedef struct
+{
+    HASHTABLE *table;
+    int *keys;
+    int64_t count;
+    bool add;
+} BENCH_HASH_ARG;
+
+static void* bench_hashtable_thread(void *data)
+{
+    BENCH_HASH_ARG *arg = (BENCH_HASH_ARG*)data;
+
+    for (int64_t i = 0; i < arg->count; i++)
+    {
+        if (arg->add)
+        {
+            hashtable_add(arg->table, &arg->keys[i], &arg->keys[i]);
+        }
+        else
+        {
+            void *value = hashtable_fetch(arg->table, &arg->keys[i]);
+            ss_dassert(value == &arg->keys[i]);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Run the hashtable operations concurrently in bench_threads threads, each
+ * thread using its own set of keys
+ */
+static int64_t bench_hashtable(int64_t iterations, bool fetch)
+{
+    int64_t per_thread = iterations / bench_threads;
+    int64_t total = per_thread * bench_threads;
+    int *keys = MXS_MALLOC(total * sizeof(int));
+    pthread_t threads[bench_threads];
+    BENCH_HASH_ARG args[bench_threads];
+    HASHTABLE *table = hashtable_alloc(total / 4 + 1, bench_hash, bench_cmp);
+
+    MXS_ABORT_IF_FALSE(keys && table);
+
+    for (int64_t i = 0; i < total; i++)
+    {
+        keys[i] = i;
+    }
+
+    for (int pass = 0; pass < (fetch ? 2 : 1); pass++)
+    {
+        for (int i = 0; i < bench_threads; i++)
+        {
+            args[i].table = table;
+            args[i].keys = keys + i * per_thread;
+            args[i].count = per_thread;
+            args[i].add = pass == 0;
+            pthread_create(&threads[i], NULL, bench_hashtable_thread, &args[i]);
+        }
+
+        for (int i = 0; i < bench_threads; i++)
+        {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+    hashtable_free(table);
+    MXS_FREE(keys);
+
+    return fetch ? total * 2 : total;
+}
+
+static int64_t bench_hashtable_add(int64_t iterations)
+{
+    return bench_hashtable(iterations, false);
+}
+
+static int64_t bench_hashtable_add_fetch(int64_t iterations)
+{
+    return bench_hashtable(iterations, true);
+}
+
+/**
+ * Write a packet with dcb_write into one end of a socket pair and read it
+ * back with dcb_read from the other end
+ */
+static int64_t bench_dcb_round_trip(int64_t iterations)
+{
+    int sv[2];
+    uint8_t payload[BENCH_DCB_PAYLOAD] = "";
+
+    MXS_ABORT_IF_FALSE(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0 &&
+                       fcntl(sv[0], F_SETFL, O_NONBLOCK) == 0 &&
+                       fcntl(sv[1], F_SETFL, O_NONBLOCK) == 0);
+
+    DCB *writer = dcb_alloc(DCB_ROLE_CLIENT_HANDLER, NULL);
+    DCB *reader = dcb_alloc(DCB_ROLE_BACKEND_HANDLER, NULL);
+    MXS_ABORT_IF_FALSE(writer && reader);
+    writer->fd = sv[0];
+    reader->fd = sv[1];
+
+    for (int64_t i = 0; i < iterations; i++)
+    {
+        GWBUF *head = NULL;
+        int total = 0;
+
+        dcb_write(writer, gwbuf_alloc_and_load(sizeof(payload), payload));
+
+        while (total < sizeof(payload))
+        {
+            int rc = dcb_read(reader, &head, 0);
+            MXS_ABORT_IF_TRUE(rc < 0);
+            total += rc;
+        }
+
+        gwbuf_free(head);
+    }
+
+    writer->fd = -1;
+    reader->fd = -1;
+    close(sv[0]);
+    close(sv[1]);
+
+    return iterations;
+}
+
+static struct
+{
+    const char *name;
+    BENCH_FUNC func;
+    int divisor;        /**< Iterations are divided by this for slow benchmarks */
+} benchmarks[] =
+{
+    { "gwbuf_alloc_free", bench_gwbuf_alloc_free, 1 },
+    { "gwbuf_clone_free", bench_gwbuf_clone, 1 },
+    { "gwbuf_consume", bench_gwbuf_consume, 1 },
+    { "modutil_get_complete_packets", bench_modutil_get_complete_packets, 10 },
+    { "modutil_get_canonical", bench_modutil_get_canonical, 10 },
+    { "modutil_get_canonical_digest", bench_modutil_get_canonical_digest, 10 },
+    { "hashtable_add_mt", bench_hashtable_add, 1 },
+    { "hashtable_add_fetch_mt", bench_hashtable_add_fetch, 1 },
+    { "dcb_write_read_loopback", bench_dcb_round_trip, 10 },
+    { NULL, NULL, 0 }
+};
+
+static double bench_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000.0 + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+    int64_t iterations = BENCH_DEFAULT_ITERATIONS;
+    int runs = BENCH_DEFAULT_RUNS;
+    const char *only = NULL;
+    int c;
+
+    while ((c = getopt(argc, argv, "n:r:t:b:")) != -1)
+    {
+        switch (c)
+        {
+        case 'n':
+            iterations = strtoll(optarg, NULL, 10);
+            break;
+
+        case 'r':
+            runs = atoi(optarg);
+            break;
+
+        case 't':
+            bench_threads = atoi(optarg);
+            break;
+
+        case 'b':
+            only = optarg;
+            break;
+
+        default:
+            fprintf(stderr, "usage: %s [-n iterations] [-r runs] [-t threads] [-b benchmark]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (iterations <= 0 || runs <= 0 || bench_threads <= 0)
+    {
+        fprintf(stderr, "The number of iterations, runs and threads must be positive.\n");
+        return EXIT_FAILURE;
+    }
+
+    config_get_global_options()->n_threads = 1;
+    utils_init();
+    dcb_global_init();
+
+    printf("benchmark\toperations\tns_per_op\tops_per_sec\n");
+
+    for (int i = 0; benchmarks[i].name; i++)
+    {
+        if (only && strcmp(only, benchmarks[i].name) != 0)
+        {
+            continue;
+        }
+
+        int64_t n = iterations / benchmarks[i].divisor;
+        double best = 0;
+        int64_t ops = 0;
+
+        if (n == 0)
+        {
+            n = 1;
+        }
+
+        /** Warm up the caches and the allocator before measuring */
+        benchmarks[i].func(n / 10 + 1);
+
+        for (int j = 0; j < runs; j++)
+        {
+            double start = bench_now();
+            int64_t done = benchmarks[i].func(n);
+            double ns = (bench_now() - start) / done;
+
+            if (j == 0 || ns < best)
+            {
+                best = ns;
+                ops = done;
+            }
+        }
+
+        printf("%s\t%" PRId64 "\t%.1f\t%.0f\n", benchmarks[i].name, ops, best, 1000000000.0 / best);
+        fflush(stdout);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#define MXS_ALLOC_TAG "testalloc"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <maxscale/debug.h>
+
+#include "../maxscale/alloc.h"
+
+#define TEST_THREADS 4
+#define TEST_ALLOCS  1000
+
+/**
+ * Find the accounted allocations of a tag
+ *
+ * @param tag    The tag
+ * @param values The allocations, frees, allocated, freed and in use bytes
+ *
+ * @return True if the tag was found
+ */
+static bool
+get_tag(const char *tag, long values[5])
+{
+    RESULTSET *set = memoryGetList();
+    RESULT_ROW *row;
+    bool found = false;
+
+    while ((row = resultset_next_row(set)))
+    {
+        if (strcmp(row->cols[0], tag) == 0)
+        {
+            for (int i = 0; i < 5; i++)
+            {
+                values[i] = strtol(row->cols[i + 1], NULL, 10);
+            }
+            found = true;
+        }
+        resultset_free_row(row);
+    }
+
+    resultset_free(set);
+    return found;
+}
+
+static void* test_alloc(void *arg)
+{
+    for (int i = 0; i < TEST_ALLOCS; i++)
+    {
+        char *s = MXS_STRDUP("accounted");
+        void *p = MXS_MALLOC(100);
+        p = MXS_REALLOC(p, 1000);
+        MXS_FREE(p);
+        MXS_FREE(s);
+    }
+
+    return NULL;
+}
+
+/**
+ * test1    The allocations of all threads are accounted to the tag
+ */
+static int
+test1()
+{
+    long values[5];
+    pthread_t threads[TEST_THREADS];
+
+    ss_dfprintf(stderr, "testalloc : accounting of a tag");
+
+    void *early = MXS_MALLOC(100);
+    mxs_alloc_set_accounting(true);
+
+    for (int i = 0; i < TEST_THREADS; i++)
+    {
+        pthread_create(&threads[i], NULL, test_alloc, NULL);
+    }
+
+    for (int i = 0; i < TEST_THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    ss_info_dassert(get_tag("testalloc", values), "Tag should be listed");
+    ss_info_dassert(values[0] == TEST_THREADS * TEST_ALLOCS * 3, "All allocations should be counted");
+    ss_info_dassert(values[1] == TEST_THREADS * TEST_ALLOCS * 3, "All frees should be counted");
+    ss_info_dassert(values[2] >= TEST_THREADS * TEST_ALLOCS * (100 + 1000), "Allocated bytes should be counted");
+    ss_info_dassert(values[4] == 0, "Nothing should be in use");
+
+    MXS_FREE(early);
+    ss_info_dassert(get_tag("testalloc", values) && values[4] < 0,
+                    "Memory allocated before the accounting should be counted when freed");
+
+    void *core = mxs_malloc(100, NULL);
+    ss_info_dassert(get_tag("core", values) && values[0] > 0, "Core allocations should be counted");
+    mxs_free(core, NULL);
+
+    mxs_alloc_set_accounting(false);
+    ss_dfprintf(stderr, "\t..done\n");
+    return 0;
+}
+
+/**
+ * test2    The allocator statistics are available
+ */
+static int
+test2()
+{
+    ss_dfprintf(stderr, "testalloc : allocator statistics");
+
+    void *p = malloc(1024 * 1024);
+    ss_info_dassert(mxs_allocator_name() != NULL, "Allocator should have a name");
+    ss_info_dassert(mxs_allocator_allocated() > 0, "Allocated bytes should be known");
+    ss_info_dassert(mxs_allocator_resident() > 0, "Resident bytes should be known");
+    free(p);
+
+    ss_dfprintf(stderr, "\t..done\n");
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+
+    result += test1();
+    result += test2();
+
+    exit(result);
+}
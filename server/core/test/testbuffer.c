@@ -32,11 +32,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <maxscale/alloc.h>
 #include <maxscale/buffer.h>
 #include <maxscale/hint.h>
 
+#include "../maxscale/poll.h"
+
 /**
  * Generate predefined test data
  *
@@ -441,6 +444,116 @@ void test_clone()
     gwbuf_free(original);
 }
 
+void test_alloc_cache()
+{
+    const unsigned int sizes[] = {0, 1, 64, 100, 512, 4000, 4096, 10000, 16384, 65536, 100000};
+    const int n_sizes = sizeof(sizes) / sizeof(sizes[0]);
+    GWBUF* buffers[n_sizes];
+    int64_t cached, allocated, prev_cached, prev_allocated;
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        /** The first pass uses the shared depot and the second the thread's own cache */
+        poll_thread = pass == 1;
+        current_thread_id = 0;
+
+        for (int i = 0; i < n_sizes; i++)
+        {
+            buffers[i] = gwbuf_alloc(sizes[i]);
+            ss_dassert(buffers[i]);
+            ss_dassert(GWBUF_LENGTH(buffers[i]) == sizes[i]);
+            memset(GWBUF_DATA(buffers[i]), i, sizes[i]);
+        }
+
+        for (int i = 0; i < n_sizes; i++)
+        {
+            gwbuf_free(buffers[i]);
+        }
+
+        gwbuf_get_alloc_stats(&prev_cached, &prev_allocated);
+
+        for (int i = 0; i < n_sizes; i++)
+        {
+            buffers[i] = gwbuf_alloc(sizes[i]);
+            ss_dassert(buffers[i]);
+            memset(GWBUF_DATA(buffers[i]), i, sizes[i]);
+        }
+
+        GWBUF* clone = gwbuf_clone(buffers[0]);
+        ss_dassert(clone && clone->sbuf == buffers[0]->sbuf);
+        gwbuf_free(clone);
+
+        gwbuf_get_alloc_stats(&cached, &allocated);
+
+        /** Everything except the largest data area is reused */
+        ss_dassert(cached - prev_cached >= n_sizes * 2 - 1);
+
+        for (int i = 0; i < n_sizes; i++)
+        {
+            ss_dassert(GWBUF_LENGTH(buffers[i]) == sizes[i]);
+            gwbuf_free(buffers[i]);
+        }
+    }
+
+    poll_thread = false;
+}
+
+void test_transfer()
+{
+    GWBUF* shared = gwbuf_alloc_and_load(5, "12345");
+    GWBUF* priv = gwbuf_alloc_and_load(3, "678");
+    GWBUF* clone = gwbuf_clone(shared);
+
+    ss_dassert(gwbuf_add_property(clone, "name", "value"));
+    ss_dassert(strcmp(gwbuf_get_property(shared, "name"), "value") == 0);
+
+    SHARED_BUF* priv_sbuf = priv->sbuf;
+    GWBUF* chain = gwbuf_transfer(gwbuf_append(clone, priv));
+
+    ss_dassert(chain && chain->next && chain->next->next == NULL);
+    ss_dassert(chain->tail == chain->next);
+    ss_dassert(chain->sbuf != shared->sbuf);
+    ss_dassert(chain->sbuf->refcount == 1);
+    ss_dassert(shared->sbuf->refcount == 1);
+    ss_dassert(chain->next->sbuf == priv_sbuf);
+    ss_dassert(gwbuf_length(chain) == 8);
+    ss_dassert(memcmp(GWBUF_DATA(chain), "12345", 5) == 0);
+    ss_dassert(strcmp(gwbuf_get_property(chain, "name"), "value") == 0);
+
+    gwbuf_free(chain);
+    gwbuf_free(shared);
+}
+
+void test_header_size()
+{
+    ss_dassert(sizeof(GWBUF) <= 64);
+}
+
+/**
+ * Measure the time it takes to allocate, clone and free a buffer
+ */
+void test_benchmark()
+{
+    const int iterations = 1000000;
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < iterations; i++)
+    {
+        GWBUF* buf = gwbuf_alloc(100);
+        GWBUF* clone = gwbuf_clone(buf);
+        gwbuf_add_hint(clone, hint_create_route(NULL, HINT_ROUTE_TO_MASTER, NULL));
+        gwbuf_free(clone);
+        gwbuf_free(buf);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double ns = (end.tv_sec - start.tv_sec) * 1000000000.0 + (end.tv_nsec - start.tv_nsec);
+    ss_dfprintf(stderr, "\ntestbuffer : alloc, clone, hint and free: %.1f ns/op\n", ns / iterations);
+}
+
 /**
  * test1    Allocate a buffer and do lots of things
  *
@@ -562,6 +675,10 @@ test1()
     test_consume();
     test_compare();
     test_clone();
+    test_alloc_cache();
+    test_transfer();
+    test_header_size();
+    test_benchmark();
 
     return 0;
 }
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include <maxscale/crc32.h>
+#include <maxscale/debug.h>
+
+#define TEST_DATA_LEN 4200
+
+/**
+ * Compare the checksums to the ones calculated by zlib
+ */
+static int
+test1()
+{
+    static uint8_t data[TEST_DATA_LEN];
+
+    for (int i = 0; i < TEST_DATA_LEN; i++)
+    {
+        data[i] = (uint8_t)(i * 31 + (i >> 7));
+    }
+
+    ss_dfprintf(stderr, "testcrc32 : Checksums with the %s implementation",
+                mxs_crc32_implementation());
+
+    ss_info_dassert(mxs_crc32(0, data, 0) == 0, "Checksum of nothing should be zero");
+
+    for (int offset = 0; offset < 16; offset++)
+    {
+        for (int len = 0; len + offset <= TEST_DATA_LEN; len += (len < 300 ? 1 : 97))
+        {
+            uint32_t expected = crc32(0, data + offset, len);
+            ss_info_dassert(mxs_crc32(0, data + offset, len) == expected,
+                            "Checksum should match the one of zlib");
+
+            int half = len / 2;
+            uint32_t chained = mxs_crc32(mxs_crc32(0, data + offset, half),
+                                         data + offset + half, len - half);
+            ss_info_dassert(chained == expected, "Chained checksum should match the one of zlib");
+        }
+    }
+
+    ss_dfprintf(stderr, "\t..done\n");
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+
+    result += test1();
+
+    exit(result);
+}
@@ -33,11 +33,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
 
+#include <maxscale/alloc.h>
+#include <maxscale/buffer.h>
 #include <maxscale/config.h>
 #include <maxscale/dcb.h>
 #include <maxscale/listener.h>
 
+#include "../maxscale/qsbr.h"
+
 /**
  * test1    Allocate a dcb and do lots of other things
  *
@@ -74,8 +81,132 @@ test1()
     dcb_close(clone);
     ss_dfprintf(stderr, "\t..done\nCheck clone no longer valid");
     ss_info_dassert(!dcb_isvalid(clone), "After closing, clone DCB must not be valid");
-    ss_dfprintf(stderr, "\t..done\nProcess the zombies list");
-    dcb_process_zombies(0);
+    ss_dfprintf(stderr, "\t..done\nReclaim the closed DCBs");
+    qsbr_quiescent(0);
+    ss_dfprintf(stderr, "\t..done\n");
+
+    return 0;
+}
+
+/**
+ * test2    Drain a write queue of many small buffers through a socket
+ *
+ * The socket send buffer is smaller than the queue so that some of the
+ * writes are partial and end in the middle of a buffer.
+ */
+static int
+test2()
+{
+    const int n_buffers = 2000;
+    const int buffer_size = 100;
+    const int total = n_buffers * buffer_size;
+    int sv[2];
+    int sndbuf = 4096;
+    int received = 0;
+    uint8_t *data = MXS_MALLOC(total);
+    ss_dassert(data);
+
+    ss_dfprintf(stderr, "testdcb : draining a write queue of %d buffers", n_buffers);
+    ss_info_dassert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0, "Socket pair should be created");
+    ss_info_dassert(fcntl(sv[0], F_SETFL, O_NONBLOCK) == 0, "Socket should be non-blocking");
+    setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+    DCB *dcb = dcb_alloc(DCB_ROLE_CLIENT_HANDLER, NULL);
+    dcb->fd = sv[0];
+
+    for (int i = 0; i < n_buffers; i++)
+    {
+        GWBUF *buf = gwbuf_alloc(buffer_size);
+        memset(GWBUF_DATA(buf), i % 256, buffer_size);
+        dcb->writeq = gwbuf_append(dcb->writeq, buf);
+    }
+
+    dcb->writeqlen = total;
+
+    while (received < total)
+    {
+        dcb_drain_writeq(dcb);
+        int rc = read(sv[1], data + received, total - received);
+        ss_info_dassert(rc > 0, "Read should return data");
+        received += rc;
+    }
+
+    ss_info_dassert(dcb->writeq == NULL, "Write queue should be empty");
+    ss_info_dassert(dcb->writeqlen == 0, "Write queue length should be zero");
+
+    for (int i = 0; i < total; i++)
+    {
+        ss_info_dassert(data[i] == (i / buffer_size) % 256, "Data should be written in order");
+    }
+
+    dcb->fd = -1;
+    close(sv[0]);
+    close(sv[1]);
+    MXS_FREE(data);
+    ss_dfprintf(stderr, "\t..done\n");
+
+    return 0;
+}
+
+/**
+ * test3    Read small and large amounts of data from a socket
+ */
+static int
+test3()
+{
+    const int sizes[] = {10, 1000, 40000, 200000};
+    const int chunk = 50000;
+    int sv[2];
+
+    ss_dfprintf(stderr, "testdcb : reading data from a socket");
+    ss_info_dassert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0, "Socket pair should be created");
+    ss_info_dassert(fcntl(sv[1], F_SETFL, O_NONBLOCK) == 0, "Socket should be non-blocking");
+
+    DCB *dcb = dcb_alloc(DCB_ROLE_BACKEND_HANDLER, NULL);
+    dcb->fd = sv[1];
+
+    for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        uint8_t *data = MXS_MALLOC(sizes[i]);
+        uint8_t *result = MXS_MALLOC(sizes[i]);
+        GWBUF *head = NULL;
+        int total = 0;
+        int written = 0;
+
+        ss_dassert(data && result);
+
+        for (int j = 0; j < sizes[i]; j++)
+        {
+            data[j] = j % 251;
+        }
+
+        while (total < sizes[i])
+        {
+            if (written < sizes[i])
+            {
+                int rc = write(sv[0], data + written, MXS_MIN(sizes[i] - written, chunk));
+                ss_info_dassert(rc > 0, "Write should succeed");
+                written += rc;
+            }
+
+            int rc = dcb_read(dcb, &head, 0);
+            ss_info_dassert(rc >= 0, "Read should not fail");
+            total += rc;
+        }
+
+        ss_info_dassert(dcb_read(dcb, &head, 0) == 0, "No more data should be available");
+        ss_info_dassert(gwbuf_length(head) == sizes[i], "All data should be read");
+        gwbuf_copy_data(head, 0, sizes[i], result);
+        ss_info_dassert(memcmp(data, result, sizes[i]) == 0, "Data should be read in order");
+
+        gwbuf_free(head);
+        MXS_FREE(data);
+        MXS_FREE(result);
+    }
+
+    dcb->fd = -1;
+    close(sv[0]);
+    close(sv[1]);
     ss_dfprintf(stderr, "\t..done\n");
 
     return 0;
@@ -89,6 +220,8 @@ int main(int argc, char **argv)
     dcb_global_init();
 
     result += test1();
+    result += test2();
+    result += test3();
 
     exit(result);
 }
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <maxscale/alloc.h>
+#include <maxscale/config.h>
+#include <maxscale/freelist.h>
+
+#include "../maxscale/poll.h"
+#include "test_utils.h"
+
+#define TEST_MAX_FREE 4
+
+/**
+ * test1    Objects are reused by a polling thread up to the maximum
+ */
+static int
+test1()
+{
+    MXS_FREELIST *list = mxs_freelist_create(64, TEST_MAX_FREE);
+    void *ptrs[TEST_MAX_FREE * 2];
+
+    ss_dfprintf(stderr, "testfreelist : reuse of objects in a polling thread");
+    ss_info_dassert(list, "Free list should be created");
+
+    poll_thread = true;
+    current_thread_id = 0;
+
+    for (int i = 0; i < TEST_MAX_FREE * 2; i++)
+    {
+        ptrs[i] = mxs_freelist_alloc(list);
+        ss_info_dassert(ptrs[i], "Allocation should succeed");
+        memset(ptrs[i], 0xff, 64);
+    }
+
+    ss_info_dassert(mxs_freelist_allocated(list) == TEST_MAX_FREE * 2, "All objects should be new");
+    ss_info_dassert(mxs_freelist_reused(list) == 0, "No objects should be reused");
+
+    for (int i = 0; i < TEST_MAX_FREE * 2; i++)
+    {
+        mxs_freelist_free(list, ptrs[i]);
+    }
+
+    /** Only TEST_MAX_FREE objects are kept, the rest were freed */
+    for (int i = 0; i < TEST_MAX_FREE * 2; i++)
+    {
+        ptrs[i] = mxs_freelist_alloc(list);
+        ss_info_dassert(ptrs[i], "Allocation should succeed");
+    }
+
+    ss_info_dassert(mxs_freelist_reused(list) == TEST_MAX_FREE, "Kept objects should be reused");
+    ss_info_dassert(mxs_freelist_allocated(list) == TEST_MAX_FREE * 3, "Rest should be new");
+
+    for (int i = 0; i < TEST_MAX_FREE * 2; i++)
+    {
+        mxs_freelist_free(list, ptrs[i]);
+    }
+
+    mxs_freelist_free(list, NULL);
+    mxs_freelist_destroy(list);
+    ss_dfprintf(stderr, "\t..done\n");
+    return 0;
+}
+
+/**
+ * test2    Threads that are not polling threads use the system allocator
+ */
+static int
+test2()
+{
+    MXS_FREELIST *list = mxs_freelist_create(sizeof(int), TEST_MAX_FREE);
+    void *ptr;
+
+    ss_dfprintf(stderr, "testfreelist : allocation in a non-polling thread");
+    ss_info_dassert(list, "Free list should be created");
+
+    poll_thread = false;
+
+    ptr = mxs_freelist_alloc(list);
+    ss_info_dassert(ptr, "Allocation should succeed");
+    mxs_freelist_free(list, ptr);
+
+    ptr = mxs_freelist_alloc(list);
+    ss_info_dassert(ptr, "Allocation should succeed");
+    mxs_freelist_free(list, ptr);
+
+    ss_info_dassert(mxs_freelist_reused(list) == 0, "No objects should be reused");
+    ss_info_dassert(mxs_freelist_allocated(list) == 0, "Allocations should not be tracked");
+
+    mxs_freelist_destroy(list);
+    ss_dfprintf(stderr, "\t..done\n");
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+
+    config_get_global_options()->n_threads = 1;
+
+    result += test1();
+    result += test2();
+
+    exit(result);
+}
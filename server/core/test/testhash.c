@@ -180,6 +180,69 @@ static bool do_hashtest(
     return succp;
 }
 
+/**
+ * Add, delete and re-add entries so that the table is filled with deleted
+ * slots and rebuilt several times.
+ *
+ * @param argelems Number of elements
+ * @return True if the test succeeded
+ */
+static bool do_deletetest(int argelems)
+{
+    HASHTABLE* h = hashtable_alloc(4, hfun, cmpfun);
+    int*       val_arr = (int *)MXS_MALLOC(sizeof(int) * argelems);
+    int        i;
+    int        round;
+
+    MXS_ABORT_IF_NULL(h);
+    MXS_ABORT_IF_NULL(val_arr);
+
+    ss_dfprintf(stderr, "testhash : deleting and re-adding %d elements.", argelems);
+
+    for (i = 0; i < argelems; i++)
+    {
+        val_arr[i] = i;
+        ss_info_dassert(hashtable_add(h, &val_arr[i], &val_arr[i]) == 1, "Add failed");
+    }
+
+    ss_info_dassert(hashtable_add(h, &val_arr[0], &val_arr[0]) == 0, "Duplicate key was added");
+
+    for (round = 0; round < 10; round++)
+    {
+        for (i = round % 2; i < argelems; i += 2)
+        {
+            ss_info_dassert(hashtable_delete(h, &val_arr[i]) == 1, "Delete failed");
+            ss_info_dassert(hashtable_fetch(h, &val_arr[i]) == NULL, "Deleted key was found");
+        }
+
+        for (i = (round + 1) % 2; i < argelems; i += 2)
+        {
+            ss_info_dassert(hashtable_fetch(h, &val_arr[i]) == &val_arr[i], "Key was not found");
+        }
+
+        for (i = round % 2; i < argelems; i += 2)
+        {
+            ss_info_dassert(hashtable_add(h, &val_arr[i], &val_arr[i]) == 1, "Re-add failed");
+        }
+
+        ss_info_dassert(hashtable_size(h) == argelems, "Invalid element count");
+    }
+
+    for (i = 0; i < argelems; i++)
+    {
+        ss_info_dassert(hashtable_delete(h, &val_arr[i]) == 1, "Delete failed");
+    }
+
+    ss_info_dassert(hashtable_size(h) == 0, "Table is not empty");
+    ss_info_dassert(hashtable_delete(h, &val_arr[0]) == 0, "Deleted a missing key");
+
+    ss_dfprintf(stderr, "\t..done\n");
+
+    hashtable_free(h);
+    MXS_FREE(val_arr);
+    return true;
+}
+
 /**
  * @node Simple test which creates hashtable and frees it. Size and number of entries
  * sre specified by user and passed as arguments.
@@ -236,6 +299,10 @@ int main(void)
     {
         goto return_rc;
     }
+    if (!do_deletetest(1000))
+    {
+        goto return_rc;
+    }
 
     rc = 0;
 return_rc:
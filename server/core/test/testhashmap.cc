@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <iostream>
+#include <pthread.h>
+#include <time.h>
+#include <maxscale/hashmap.hh>
+#include <maxscale/hashtable.h>
+
+using std::cout;
+using std::endl;
+
+namespace
+{
+
+const int N_ELEMS = 10000;
+const int N_LOOKUPS = 5000000;
+const int N_THREADS = 4;
+
+struct IntHash
+{
+    size_t operator()(int key) const
+    {
+        return key;
+    }
+};
+
+struct IntEqual
+{
+    bool operator()(int lhs, int rhs) const
+    {
+        return lhs == rhs;
+    }
+};
+
+typedef mxs::HashMap<int, int, IntHash, IntEqual> IntMap;
+
+int hfun(const void* key)
+{
+    return *(const int*)key;
+}
+
+int cmpfun(const void* v1, const void* v2)
+{
+    int i1 = *(const int*)v1;
+    int i2 = *(const int*)v2;
+
+    return i1 < i2 ? -1 : (i1 > i2 ? 1 : 0);
+}
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+void test_basic()
+{
+    IntMap map(4);
+
+    for (int i = 0; i < N_ELEMS; i++)
+    {
+        ss_info_dassert(map.insert(i, i * 2), "Insert failed");
+    }
+
+    ss_info_dassert(!map.insert(0, 0), "Duplicate key was inserted");
+    ss_info_dassert(map.size() == (size_t)N_ELEMS, "Invalid size");
+
+    for (int i = 0; i < N_ELEMS; i += 2)
+    {
+        ss_info_dassert(map.erase(i), "Erase failed");
+    }
+
+    ss_info_dassert(!map.erase(0), "Erased a missing key");
+
+    for (int i = 0; i < N_ELEMS; i++)
+    {
+        int value = -1;
+        bool found = map.find(i, &value);
+
+        ss_info_dassert(found == (i % 2 == 1), "Invalid lookup result");
+        ss_info_dassert(!found || value == i * 2, "Invalid value");
+    }
+
+    for (int i = 0; i < N_ELEMS; i += 2)
+    {
+        ss_info_dassert(map.insert(i, i * 2), "Re-insert failed");
+    }
+
+    ss_info_dassert(map.size() == (size_t)N_ELEMS, "Invalid size");
+}
+
+struct Reader
+{
+    IntMap* map;
+    bool*   running;
+    long    lookups;
+};
+
+void* reader_main(void* arg)
+{
+    Reader* reader = static_cast<Reader*>(arg);
+
+    while (__atomic_load_n(reader->running, __ATOMIC_RELAXED))
+    {
+        for (int i = 0; i < N_ELEMS; i++)
+        {
+            int value;
+
+            // The even keys are never modified by the writer.
+            if (i % 2 == 0)
+            {
+                ss_info_dassert(reader->map->find(i, &value) && value == i, "Stable key was not found");
+            }
+            else if (reader->map->find(i, &value))
+            {
+                ss_info_dassert(value == i, "Invalid value");
+            }
+        }
+
+        reader->lookups += N_ELEMS;
+    }
+
+    return NULL;
+}
+
+/**
+ * Readers look up keys while a writer keeps removing and adding entries
+ * and growing the map.
+ */
+void test_concurrent()
+{
+    IntMap map(4);
+    bool running = true;
+    pthread_t threads[N_THREADS];
+    Reader readers[N_THREADS];
+
+    for (int i = 0; i < N_ELEMS; i += 2)
+    {
+        map.insert(i, i);
+    }
+
+    for (int i = 0; i < N_THREADS; i++)
+    {
+        readers[i].map = &map;
+        readers[i].running = &running;
+        readers[i].lookups = 0;
+        pthread_create(&threads[i], NULL, reader_main, &readers[i]);
+    }
+
+    for (int round = 0; round < 20; round++)
+    {
+        for (int i = 1; i < N_ELEMS; i += 2)
+        {
+            map.insert(i, i);
+        }
+
+        for (int i = 1; i < N_ELEMS; i += 2)
+        {
+            map.erase(i);
+        }
+    }
+
+    __atomic_store_n(&running, false, __ATOMIC_RELAXED);
+
+    long lookups = 0;
+
+    for (int i = 0; i < N_THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+        lookups += readers[i].lookups;
+    }
+
+    cout << "Concurrent test: " << lookups << " lookups during modifications" << endl;
+}
+
+/**
+ * Compare the lookup speed of HashMap and HASHTABLE.
+ */
+void test_benchmark()
+{
+    IntMap map(N_ELEMS);
+    HASHTABLE* table = hashtable_alloc(N_ELEMS, hfun, cmpfun);
+    int* keys = new int[N_ELEMS];
+    long found = 0;
+
+    for (int i = 0; i < N_ELEMS; i++)
+    {
+        keys[i] = i;
+        map.insert(i, i);
+        hashtable_add(table, &keys[i], &keys[i]);
+    }
+
+    double start = now();
+
+    for (int i = 0; i < N_LOOKUPS; i++)
+    {
+        int key = (i * 7919) % (N_ELEMS * 2);
+        found += hashtable_fetch(table, &key) != NULL;
+    }
+
+    double table_time = now() - start;
+    start = now();
+
+    for (int i = 0; i < N_LOOKUPS; i++)
+    {
+        int key = (i * 7919) % (N_ELEMS * 2);
+        found -= map.find(key, NULL);
+    }
+
+    double map_time = now() - start;
+
+    ss_info_dassert(found == 0, "HashMap and HASHTABLE disagree");
+
+    cout << N_LOOKUPS << " lookups: HASHTABLE " << table_time << "s, HashMap "
+         << map_time << "s" << endl;
+
+    hashtable_free(table);
+    delete [] keys;
+}
+
+}
+
+int main()
+{
+    test_basic();
+    test_concurrent();
+    test_benchmark();
+    return 0;
+}
@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <maxscale/debug.h>
+
+#include <maxscale/histogram.h>
+
+/**
+ * test1    Every value maps to a bucket whose range contains it
+ */
+static int
+test1()
+{
+    ss_dfprintf(stderr, "testhistogram : bucket ranges");
+
+    for (uint64_t value = 0; value < 100000; value++)
+    {
+        int bucket = histogram_bucket(value);
+        ss_info_dassert(bucket >= 0 && bucket < HISTOGRAM_N_BUCKETS, "Bucket should be valid");
+        ss_info_dassert(histogram_bucket_max(bucket) >= value, "Value should not exceed the bucket");
+        ss_info_dassert(bucket == 0 || histogram_bucket_max(bucket - 1) < value,
+                        "Value should not fit in the previous bucket");
+        ss_info_dassert(value < HISTOGRAM_SUB_BUCKETS ||
+                        histogram_bucket_max(bucket) - value <= value / HISTOGRAM_SUB_BUCKETS,
+                        "Relative error should be bounded");
+    }
+
+    ss_info_dassert(histogram_bucket(UINT32_MAX) == HISTOGRAM_N_BUCKETS - 1,
+                    "Largest value should be in the last bucket");
+    ss_info_dassert(histogram_bucket(UINT64_MAX) == HISTOGRAM_N_BUCKETS - 1,
+                    "Too large values should be in the last bucket");
+    ss_info_dassert(histogram_bucket_max(HISTOGRAM_N_BUCKETS - 1) == UINT32_MAX,
+                    "Last bucket should end at the largest value");
+
+    ss_dfprintf(stderr, "\t..done\n");
+    return 0;
+}
+
+/**
+ * test2    Percentiles and merging
+ */
+static int
+test2()
+{
+    HISTOGRAM *hist = calloc(1, sizeof(HISTOGRAM));
+    HISTOGRAM *other = calloc(1, sizeof(HISTOGRAM));
+
+    ss_dfprintf(stderr, "testhistogram : percentiles");
+    ss_info_dassert(histogram_percentile(hist, 50) == 0, "Empty histogram should return 0");
+
+    for (int i = 1; i <= 1000; i++)
+    {
+        histogram_add(hist, i);
+    }
+
+    uint64_t p50 = histogram_percentile(hist, 50);
+    uint64_t p99 = histogram_percentile(hist, 99);
+    uint64_t p999 = histogram_percentile(hist, 99.9);
+
+    ss_info_dassert(hist->count == 1000 && hist->max == 1000, "Count and maximum should be correct");
+    ss_info_dassert(p50 >= 500 && p50 <= 500 + 500 / HISTOGRAM_SUB_BUCKETS, "p50 should be near 500");
+    ss_info_dassert(p99 >= 990 && p99 <= 1000, "p99 should be near 990");
+    ss_info_dassert(p999 >= 999 && p999 <= 1000, "p99.9 should be limited to the maximum");
+    ss_info_dassert(histogram_percentile(hist, 100) == 1000, "p100 should be the maximum");
+
+    histogram_add(other, 1000000);
+    histogram_merge(hist, other);
+
+    ss_info_dassert(hist->count == 1001, "Merged count should be correct");
+    ss_info_dassert(hist->max == 1000000, "Merged maximum should be correct");
+    ss_info_dassert(histogram_percentile(hist, 100) == 1000000, "p100 should be the merged maximum");
+    ss_info_dassert(histogram_percentile(hist, 50) == p50, "p50 should not change");
+
+    free(hist);
+    free(other);
+    ss_dfprintf(stderr, "\t..done\n");
+    return 0;
+}
+
+#define TEST3_THREADS 4
+#define TEST3_VALUES  100000
+
+static void* test3_add(void *arg)
+{
+    HISTOGRAM *hist = (HISTOGRAM*)arg;
+
+    for (int i = 1; i <= TEST3_VALUES; i++)
+    {
+        histogram_add_atomic(hist, i);
+    }
+
+    return NULL;
+}
+
+/**
+ * test3    Concurrent updates are not lost
+ */
+static int
+test3()
+{
+    HISTOGRAM *hist = calloc(1, sizeof(HISTOGRAM));
+    pthread_t threads[TEST3_THREADS];
+
+    ss_dfprintf(stderr, "testhistogram : concurrent updates");
+
+    for (int i = 0; i < TEST3_THREADS; i++)
+    {
+        pthread_create(&threads[i], NULL, test3_add, hist);
+    }
+
+    for (int i = 0; i < TEST3_THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    uint64_t total = 0;
+
+    for (int i = 0; i < HISTOGRAM_N_BUCKETS; i++)
+    {
+        total += hist->buckets[i];
+    }
+
+    ss_info_dassert(hist->count == TEST3_THREADS * TEST3_VALUES, "Count should include all values");
+    ss_info_dassert(total == hist->count, "Buckets should include all values");
+    ss_info_dassert(hist->max == TEST3_VALUES, "Maximum should be correct");
+
+    free(hist);
+    ss_dfprintf(stderr, "\t..done\n");
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+
+    result += test1();
+    result += test2();
+    result += test3();
+
+    exit(result);
+}
@@ -36,6 +36,9 @@
 #include <maxscale/alloc.h>
 #include <maxscale/modutil.h>
 #include <maxscale/buffer.h>
+#include <maxscale/protocol/mysql.h>
+#include <maxscale/server.h>
+#include <maxscale/spinlock.h>
 
 /**
  * test1    Allocate a service and do lots of other things
@@ -591,6 +594,282 @@ void test_large_packets()
     }
 }
 
+//
+// modutil_scan_packets and modutil_count_signal_packets
+//
+void test_scan_packets()
+{
+    printf("%s\n", __func__);
+    size_t offsets[N_PACKETS];
+    size_t length = 0;
+
+    /** Split the result set at every possible position */
+    for (int split = 1; split < sizeof(resultset); split++)
+    {
+        GWBUF* buffer = gwbuf_append(gwbuf_alloc_and_load(split, resultset),
+                                     gwbuf_alloc_and_load(sizeof(resultset) - split, resultset + split));
+
+        int n = modutil_scan_packets(buffer, offsets, N_PACKETS, &length);
+        ss_info_dassert(n == N_PACKETS, "All packets should be found");
+        ss_info_dassert(length == sizeof(resultset), "Length should be correct");
+
+        for (int i = 0; i < N_PACKETS; i++)
+        {
+            ss_info_dassert(offsets[i] == packets[i].index, "Offset should be correct");
+        }
+
+        ss_info_dassert(modutil_scan_packets(buffer, offsets, 2, &length) == 2,
+                        "Scan should stop when the offsets are full");
+        ss_info_dassert(length == PACKET_3_IDX, "Length should cover the found packets");
+
+        gwbuf_free(buffer);
+
+        /** Leave out the last byte */
+        buffer = gwbuf_alloc_and_load(split - 1, resultset);
+        buffer = gwbuf_append(buffer, gwbuf_alloc_and_load(sizeof(resultset) - split, resultset + split - 1));
+        ss_info_dassert(modutil_scan_packets(buffer, NULL, 0, &length) == N_PACKETS - 1,
+                        "The incomplete packet should not be counted");
+        ss_info_dassert(length == PACKET_5_IDX, "Length should not include the incomplete packet");
+        gwbuf_free(buffer);
+    }
+
+    /** Count the EOF packets of the result set */
+    int more = 0;
+    GWBUF* buffer = gwbuf_alloc_and_load(sizeof(resultset), resultset);
+    ss_info_dassert(modutil_count_signal_packets(buffer, 0, 0, &more) == 2, "Two EOF packets should be found");
+    ss_info_dassert(more == 0, "No more results should be expected");
+    gwbuf_free(buffer);
+
+    buffer = gwbuf_alloc_and_load(sizeof(resultset) - 1, resultset);
+    ss_info_dassert(modutil_count_signal_packets(buffer, 0, 0, &more) == 1,
+                    "The incomplete EOF packet should be ignored");
+    gwbuf_free(buffer);
+}
+
+//
+// modutil_get_canonical_digest
+//
+static uint64_t get_digest(const char* sql)
+{
+    GWBUF* buffer = modutil_create_query(sql);
+    uint64_t digest = 0;
+    ss_info_dassert(modutil_get_canonical_digest(buffer, &digest), "Digest should be calculated");
+    gwbuf_free(buffer);
+    return digest;
+}
+
+void test_canonical_digest()
+{
+    printf("%s\n", __func__);
+    const char* same[] =
+    {
+        "SELECT * FROM t1 WHERE id = 1 AND name = 'a'",
+        "SELECT * FROM t1 WHERE id = 12345 AND name = 'it''s \\'quoted\\''",
+        "SELECT  *\n FROM t1 WHERE id=-0.5e-3 AND name=\"b\" -- comment",
+        "SELECT * /* comment */ FROM t1 WHERE id = 0x1f AND name = '' # comment",
+    };
+
+    uint64_t digest = get_digest(same[0]);
+
+    for (int i = 1; i < sizeof(same) / sizeof(same[0]); i++)
+    {
+        ss_info_dassert(get_digest(same[i]) == digest, "Digests should be equal");
+    }
+
+    ss_info_dassert(get_digest("SELECT * FROM t2 WHERE id = 1 AND name = 'a'") != digest,
+                    "Different table should have a different digest");
+    ss_info_dassert(get_digest("SELECT * FROM t1 WHERE id < 1 AND name = 'a'") != digest,
+                    "Different operator should have a different digest");
+    ss_info_dassert(get_digest("SELECT a FROM t1") != get_digest("SELECT a, FROM t1"),
+                    "Punctuation should change the digest");
+    ss_info_dassert(get_digest("SELECT /*!40101 a */ FROM t1") != get_digest("SELECT FROM t1"),
+                    "Executable comments should be hashed");
+
+    /** A statement split into several buffers has the same digest */
+    GWBUF* query = modutil_create_query(same[1]);
+    size_t len = gwbuf_length(query);
+    uint8_t data[len];
+    gwbuf_copy_data(query, 0, len, data);
+    gwbuf_free(query);
+
+    for (int split = 1; split < len; split++)
+    {
+        GWBUF* buffer = gwbuf_append(gwbuf_alloc_and_load(split, data),
+                                     gwbuf_alloc_and_load(len - split, data + split));
+        uint64_t split_digest = 0;
+        ss_info_dassert(modutil_get_canonical_digest(buffer, &split_digest), "Digest should be calculated");
+        ss_info_dassert(split_digest == digest, "Digest of a split statement should be equal");
+        gwbuf_free(buffer);
+    }
+
+    uint8_t ping[] = {0x01, 0x00, 0x00, 0x00, 0x0e};
+    GWBUF* buffer = gwbuf_alloc_and_load(sizeof(ping), ping);
+    ss_info_dassert(!modutil_get_canonical_digest(buffer, &digest), "COM_PING should not have a digest");
+    gwbuf_free(buffer);
+}
+
+//
+// modutil_get_SQL_view
+//
+void test_sql_view()
+{
+    printf("%s\n", __func__);
+    const char* query = "SELECT * FROM t1 WHERE id = 1";
+    const char* sql;
+    size_t len;
+
+    /** A contiguous statement is not copied */
+    GWBUF* buffer = modutil_create_query(query);
+    ss_info_dassert(modutil_get_SQL_view(buffer, &sql, &len), "View should be created");
+    ss_info_dassert(sql == (char*)GWBUF_DATA(buffer) + 5, "View should point into the buffer");
+    ss_info_dassert(len == strlen(query) && memcmp(sql, query, len) == 0, "SQL should be correct");
+
+    /** A fragmented statement is copied once */
+    size_t total = gwbuf_length(buffer);
+    uint8_t data[total];
+    gwbuf_copy_data(buffer, 0, total, data);
+    gwbuf_free(buffer);
+
+    buffer = gwbuf_append(gwbuf_alloc_and_load(10, data), gwbuf_alloc_and_load(total - 10, data + 10));
+    ss_info_dassert(modutil_get_SQL_view(buffer, &sql, &len), "View should be created");
+    ss_info_dassert(len == strlen(query) && strcmp(sql, query) == 0, "Copied SQL should be correct");
+    ss_info_dassert(!GWBUF_IS_PARSED(buffer), "The copy should not mark the buffer as parsed");
+
+    const char* sql2;
+    size_t len2;
+    ss_info_dassert(modutil_get_SQL_view(buffer, &sql2, &len2), "View should be created");
+    ss_info_dassert(sql2 == sql && len2 == len, "The cached copy should be reused");
+    gwbuf_free(buffer);
+
+    /** An incomplete statement has no view */
+    buffer = gwbuf_alloc_and_load(total - 1, data);
+    ss_info_dassert(!modutil_get_SQL_view(buffer, &sql, &len), "Incomplete statement should have no view");
+    gwbuf_free(buffer);
+
+    uint8_t ping[] = {0x01, 0x00, 0x00, 0x00, 0x0e};
+    buffer = gwbuf_alloc_and_load(sizeof(ping), ping);
+    ss_info_dassert(!modutil_get_SQL_view(buffer, &sql, &len), "COM_PING should have no view");
+    gwbuf_free(buffer);
+
+    /** Only a COM_QUERY has a query view */
+    buffer = modutil_create_query(query);
+    ss_info_dassert(modutil_get_query_view(buffer, &sql, &len), "COM_QUERY should have a query view");
+    GWBUF_DATA(buffer)[4] = MYSQL_COM_STMT_PREPARE;
+    ss_info_dassert(modutil_get_SQL_view(buffer, &sql, &len), "COM_STMT_PREPARE should have a view");
+    ss_info_dassert(!modutil_get_query_view(buffer, &sql, &len),
+                    "COM_STMT_PREPARE should have no query view");
+    gwbuf_free(buffer);
+}
+
+/** Append a packet with the given payload to a reply stream */
+static size_t add_reply_packet(uint8_t *stream, size_t pos, uint8_t seq, const uint8_t *payload, size_t len)
+{
+    gw_mysql_set_byte3(stream + pos, len);
+    stream[pos + 3] = seq;
+    memcpy(stream + pos + MYSQL_HEADER_LEN, payload, len);
+    return pos + MYSQL_HEADER_LEN + len;
+}
+
+void test_reply_queue()
+{
+    printf("%s\n", __func__);
+    uint8_t ok[] = {0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00};
+    uint8_t ok_more[] = {0x00, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x00};
+    uint8_t err[] = {0xff, 0x15, 0x04, '#', '2', '8', '0', '0', '0', 'x'};
+    uint8_t eof[] = {0xfe, 0x00, 0x00, 0x02, 0x00};
+    uint8_t colcount[] = {0x01};
+    uint8_t coldef[] = {0x03, 'd', 'e', 'f', 0x00, 0x00, 0x00, 0x01, 'a', 0x00, 0x0c};
+    uint8_t row[] = {0x01, '1'};
+    uint8_t stream[256];
+    size_t len = 0;
+    size_t starts[5]; /** The packets that start a reply or a result */
+    int n_starts = 0;
+
+    /** COM_PING */
+    starts[n_starts++] = len;
+    len = add_reply_packet(stream, len, 1, ok, sizeof(ok));
+
+    /** COM_QUERY with a result set */
+    starts[n_starts++] = len;
+    len = add_reply_packet(stream, len, 1, colcount, sizeof(colcount));
+    len = add_reply_packet(stream, len, 2, coldef, sizeof(coldef));
+    len = add_reply_packet(stream, len, 3, eof, sizeof(eof));
+    len = add_reply_packet(stream, len, 4, row, sizeof(row));
+    len = add_reply_packet(stream, len, 5, row, sizeof(row));
+    len = add_reply_packet(stream, len, 6, eof, sizeof(eof));
+
+    /** COM_QUERY that fails */
+    starts[n_starts++] = len;
+    len = add_reply_packet(stream, len, 1, err, sizeof(err));
+
+    /** COM_QUERY with two results */
+    starts[n_starts++] = len;
+    len = add_reply_packet(stream, len, 1, ok_more, sizeof(ok_more));
+    starts[n_starts++] = len;
+    len = add_reply_packet(stream, len, 2, ok, sizeof(ok));
+
+    /** The whole stream at once and one byte at a time */
+    for (size_t step = len; step > 0; step = step == len ? 1 : 0)
+    {
+        MXS_REPLY_QUEUE queue = {};
+        int completed = 0;
+
+        ss_dassert(modutil_reply_queue_push(&queue, MYSQL_COM_PING));
+        ss_dassert(modutil_reply_queue_push(&queue, MYSQL_COM_QUERY));
+        ss_dassert(modutil_reply_queue_push(&queue, MYSQL_COM_STMT_CLOSE));
+        ss_dassert(modutil_reply_queue_push(&queue, MYSQL_COM_QUERY));
+        ss_dassert(modutil_reply_queue_push(&queue, MYSQL_COM_QUERY));
+        ss_info_dassert(queue.count == 4, "COM_STMT_CLOSE should not expect a reply");
+
+        for (size_t i = 0; i < len; i += step)
+        {
+            GWBUF *buffer = gwbuf_alloc_and_load(MXS_MIN(step, len - i), stream + i);
+            completed += modutil_reply_queue_process(&queue, buffer);
+            gwbuf_free(buffer);
+
+            ss_info_dassert(i + step < len || completed == 4, "All replies should be complete");
+            ss_info_dassert(i + step >= len || completed < 4, "Replies should not end early");
+        }
+
+        ss_info_dassert(queue.count == 0, "Queue should be empty");
+        ss_info_dassert(queue.rows == 2, "The rows of the result set should be counted");
+        modutil_reply_queue_free(&queue);
+    }
+
+    /** Stop at each packet that can be an OK packet */
+    MXS_REPLY_QUEUE queue = {};
+    int stops = 0;
+
+    ss_dassert(modutil_reply_queue_push(&queue, MYSQL_COM_PING));
+    ss_dassert(modutil_reply_queue_push(&queue, MYSQL_COM_QUERY));
+    ss_dassert(modutil_reply_queue_push(&queue, MYSQL_COM_QUERY));
+    ss_dassert(modutil_reply_queue_push(&queue, MYSQL_COM_QUERY));
+
+    for (size_t i = 0; i < len;)
+    {
+        GWBUF *buffer = gwbuf_alloc_and_load(len - i, stream + i);
+        i += modutil_reply_queue_process_to_ok(&queue, buffer);
+        gwbuf_free(buffer);
+
+        if (i < len)
+        {
+            ss_info_dassert(stops < n_starts && i == starts[stops], "Should stop at the start of a reply");
+            ss_info_dassert(modutil_reply_queue_expects_ok(&queue), "An OK packet should be expected");
+            stops++;
+
+            size_t packet_len = MYSQL_HEADER_LEN + gw_mysql_get_byte3(stream + i);
+            buffer = gwbuf_alloc_and_load(packet_len, stream + i);
+            modutil_reply_queue_process(&queue, buffer);
+            gwbuf_free(buffer);
+            i += packet_len;
+        }
+    }
+
+    ss_info_dassert(stops == n_starts, "All reply starts should be found");
+    ss_info_dassert(queue.count == 0, "Queue should be empty");
+    modutil_reply_queue_free(&queue);
+}
+
 char* bypass_whitespace(char* sql)
 {
     return modutil_MySQL_bypass_whitespace(sql, strlen(sql));
@@ -628,6 +907,162 @@ void test_bypass_whitespace()
     ss_info_dassert(*sql == 'S', "9");
 }
 
+void test_find_mysql_statement_end()
+{
+    char single[] = "SELECT 'a;b', \"c;d\", `e;f` FROM t1 /* ; */";
+    ss_info_dassert(find_mysql_statement_end(single, sizeof(single) - 1) == NULL,
+                    "Quoted and commented semicolons should be ignored");
+
+    char escaped[] = "SELECT 'it\\';s'";
+    ss_info_dassert(find_mysql_statement_end(escaped, sizeof(escaped) - 1) == NULL,
+                    "Escaped quotes should not end the string");
+
+    char multi[] = "SELECT 1; SELECT 2";
+    ss_info_dassert(find_mysql_statement_end(multi, sizeof(multi) - 1) == strchr(multi, ';'),
+                    "Semicolon should end the statement");
+
+    char comment1[] = "SELECT 1 -- comment;\n; SELECT 2";
+    ss_info_dassert(find_mysql_statement_end(comment1, sizeof(comment1) - 1) == strrchr(comment1, ';'),
+                    "Statement after a -- comment should be found");
+
+    char comment2[] = "SELECT 1 # comment;\n; SELECT 2";
+    ss_info_dassert(find_mysql_statement_end(comment2, sizeof(comment2) - 1) == strrchr(comment2, ';'),
+                    "Statement after a # comment should be found");
+
+    char bad[] = "SELECT 'a; SELECT 2";
+    ss_info_dassert(find_mysql_statement_end(bad, sizeof(bad) - 1) == NULL,
+                    "Unterminated quote should hide the semicolon");
+}
+
+void test_session_track()
+{
+    /** An OK packet with autocommit=OFF, the default database and the transaction state */
+    uint8_t ok[] =
+    {
+        0x2c, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x40, 0x00, 0x00, 0x00, 0x23,
+        0x00, 0x0f, 0x0a, 'a', 'u', 't', 'o', 'c', 'o', 'm', 'm', 'i', 't', 0x03, 'O', 'F', 'F',
+        0x01, 0x05, 0x04, 't', 'e', 's', 't',
+        0x05, 0x09, 0x08, 'T', '_', '_', '_', '_', '_', '_', '_'
+    };
+    ss_dassert(sizeof(ok) == MYSQL_HEADER_LEN + 0x2c);
+
+    const char *variables[] = {"last_gtid", "autocommit"};
+    char *values[2] = {};
+    MXS_SESSION_TRACK track = {variables, values, 2, NULL, NULL};
+    GWBUF *buffer = modutil_ok_take_session_state(gwbuf_alloc_and_load(sizeof(ok), ok), &track);
+
+    ss_info_dassert(values[0] == NULL, "A variable that was not sent should not be found");
+    ss_info_dassert(values[1] && strcmp(values[1], "OFF") == 0, "The variable should be found");
+    ss_info_dassert(track.schema && strcmp(track.schema, "test") == 0, "The schema should be found");
+    ss_info_dassert(track.trx_state && strcmp(track.trx_state, "T_______") == 0,
+                    "The transaction state should be found");
+    ss_info_dassert(gwbuf_length(buffer) == MYSQL_HEADER_LEN + 7 &&
+                    GWBUF_DATA(buffer)[0] == 7 && GWBUF_DATA(buffer)[8] == 0,
+                    "The session state should be removed");
+
+    MXS_FREE(values[1]);
+    MXS_FREE(track.schema);
+    MXS_FREE(track.trx_state);
+    gwbuf_free(buffer);
+}
+
+static GWBUF *answer = NULL;
+
+static int answer_write(DCB *dcb, GWBUF *buffer)
+{
+    answer = gwbuf_append(answer, buffer);
+    return 1;
+}
+
+/** Check whether the answer to a query contains a string */
+static bool variable_answer(SERVER *server, DCB *dcb, const char *sql, const char *expected)
+{
+    GWBUF *query = modutil_create_query((char*)sql);
+    bool rval = modutil_answer_variable_query(dcb, server, query);
+    gwbuf_free(query);
+
+    if (answer)
+    {
+        answer = gwbuf_make_contiguous(answer);
+        size_t len = GWBUF_LENGTH(answer);
+        rval = rval && memmem(GWBUF_DATA(answer), len, expected, strlen(expected)) != NULL;
+        gwbuf_free(answer);
+        answer = NULL;
+    }
+
+    return rval;
+}
+
+void test_answer_variable_query()
+{
+    static const char * const vars[][2] =
+    {
+        {"version_comment", "mariadb.org binary distribution"},
+        {"auto_increment_increment", "1"},
+        {"max_allowed_packet", "16777216"},
+        {"character_set_server", "utf8mb4"},
+        {"collation_server", "utf8mb4_general_ci"},
+    };
+    const int n_vars = sizeof(vars) / sizeof(vars[0]);
+    SERVER_VARIABLE *variables = MXS_CALLOC(n_vars, sizeof(SERVER_VARIABLE));
+
+    for (int i = 0; i < n_vars; i++)
+    {
+        variables[i].name = MXS_STRDUP_A(vars[i][0]);
+        variables[i].value = MXS_STRDUP_A(vars[i][1]);
+    }
+
+    SERVER server;
+    memset(&server, 0, sizeof(server));
+    spinlock_init(&server.lock);
+    server.status = SERVER_RUNNING;
+    server_set_variables(&server, variables, n_vars, 45);
+
+    MySQLProtocol proto;
+    memset(&proto, 0, sizeof(proto));
+    proto.charset = 8;
+
+    DCB dcb;
+    memset(&dcb, 0, sizeof(dcb));
+    dcb.protocol = &proto;
+    dcb.func.write = answer_write;
+
+    ss_info_dassert(variable_answer(&server, &dcb, "SELECT @@version_comment LIMIT 1",
+                                    "mariadb.org binary distribution"),
+                    "A cached variable should be answered");
+    ss_info_dassert(variable_answer(&server, &dcb, "/* connector */ SELECT "
+                                    "@@session.auto_increment_increment AS auto_increment_increment, "
+                                    "@@max_allowed_packet `packet`;", "packet"),
+                    "Variables with aliases should be answered");
+    ss_info_dassert(variable_answer(&server, &dcb, "show variables like 'max_allowed_packet'",
+                                    "16777216"),
+                    "SHOW VARIABLES LIKE should be answered");
+    ss_info_dassert(!variable_answer(&server, &dcb, "SHOW VARIABLES LIKE 'max%'", ""),
+                    "SHOW VARIABLES LIKE with a wildcard should not be answered");
+    ss_info_dassert(!variable_answer(&server, &dcb, "SELECT @@version_comment, @@sql_mode", ""),
+                    "A variable that is not cached should not be answered");
+    ss_info_dassert(!variable_answer(&server, &dcb, "SELECT @@version_comment FROM t1", ""),
+                    "A query that reads a table should not be answered");
+    ss_info_dassert(!variable_answer(&server, &dcb, "SELECT @@version_comment LIMIT 0", ""),
+                    "A query that returns no rows should not be answered");
+    ss_info_dassert(!variable_answer(&server, &dcb, "/*!40101 SET NAMES utf8 */ SELECT @@version_comment", ""),
+                    "A query with an executable comment should not be answered");
+    ss_info_dassert(!variable_answer(&server, &dcb, "SELECT @@character_set_client", ""),
+                    "The client charset of another collation should not be answered");
+    ss_info_dassert(variable_answer(&server, &dcb, "SELECT @@global.collation_server", "utf8mb4_general_ci"),
+                    "A global variable should be answered whatever the collation of the client");
+
+    proto.charset = 45;
+    ss_info_dassert(variable_answer(&server, &dcb, "SELECT @@character_set_client", "utf8mb4"),
+                    "The client charset of the default collation should be answered");
+
+    server.status = 0;
+    ss_info_dassert(!variable_answer(&server, &dcb, "SELECT @@version_comment", ""),
+                    "The variables of a server that is down should not be used");
+
+    server_set_variables(&server, NULL, 0, 0);
+}
+
 int main(int argc, char **argv)
 {
     int result = 0;
@@ -641,6 +1076,13 @@ int main(int argc, char **argv)
     test_strnchr_esc();
     test_strnchr_esc_mysql();
     test_large_packets();
+    test_scan_packets();
+    test_canonical_digest();
+    test_sql_view();
+    test_reply_queue();
     test_bypass_whitespace();
+    test_find_mysql_statement_end();
+    test_session_track();
+    test_answer_variable_query();
     exit(result);
 }
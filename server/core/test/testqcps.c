@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * Test the store of the prepared statements of a session
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <maxscale/buffer.h>
+#include <maxscale/modutil.h>
+#include <maxscale/protocol/mysql.h>
+#include <maxscale/query_classifier.h>
+#include <maxscale/session.h>
+
+static GWBUF* create_prepare(const char* sql)
+{
+    GWBUF* buffer = modutil_create_query(sql);
+    ss_dassert(buffer);
+    GWBUF_DATA(buffer)[MYSQL_HEADER_LEN] = MYSQL_COM_STMT_PREPARE;
+    return buffer;
+}
+
+static GWBUF* create_command(uint8_t cmd, uint32_t id)
+{
+    GWBUF* buffer = gwbuf_alloc(MYSQL_PS_ID_OFFSET + MYSQL_PS_ID_SIZE);
+    ss_dassert(buffer);
+    uint8_t* data = GWBUF_DATA(buffer);
+    gw_mysql_set_byte3(data, 1 + MYSQL_PS_ID_SIZE);
+    data[3] = 0;
+    data[MYSQL_HEADER_LEN] = cmd;
+    gw_mysql_set_byte4(data + MYSQL_PS_ID_OFFSET, id);
+    return buffer;
+}
+
+static int test1()
+{
+    MXS_SESSION session;
+    memset(&session, 0, sizeof(session));
+
+    GWBUF* stmt1 = create_prepare("SELECT 1");
+    GWBUF* stmt2 = create_prepare("SELECT 2");
+
+    ss_dfprintf(stderr, "testqcps : Store and look up statements");
+    ss_info_dassert(qc_ps_lookup(&session, 1) == NULL, "Nothing should be stored");
+    ss_info_dassert(qc_ps_store(&session, 1, stmt1), "Storing should succeed");
+    ss_info_dassert(qc_ps_store(&session, 2, stmt2), "Storing should succeed");
+
+    /** The stored buffers are clones, the caller keeps its own */
+    gwbuf_free(stmt1);
+    gwbuf_free(stmt2);
+
+    GWBUF* found = qc_ps_lookup(&session, 1);
+    ss_info_dassert(found && modutil_count_statements(found) == 1, "Statement 1 should be found");
+    ss_info_dassert(strncmp((char*)GWBUF_DATA(found) + MYSQL_HEADER_LEN + 1, "SELECT 1", 8) == 0,
+                    "Statement 1 should be the first statement");
+    ss_info_dassert(qc_ps_lookup(&session, 3) == NULL, "Statement 3 should not be found");
+    ss_dfprintf(stderr, "\t..done\n");
+
+    ss_dfprintf(stderr, "testqcps : Look up statements by binary protocol commands");
+    GWBUF* execute = create_command(MYSQL_COM_STMT_EXECUTE, 2);
+    GWBUF* query = create_command(MYSQL_COM_QUERY, 2);
+    found = qc_ps_lookup_by_command(&session, execute);
+    ss_info_dassert(found && strncmp((char*)GWBUF_DATA(found) + MYSQL_HEADER_LEN + 1, "SELECT 2", 8) == 0,
+                    "The executed statement should be found");
+    ss_info_dassert(qc_ps_lookup_by_command(&session, query) == NULL,
+                    "A COM_QUERY should not refer to a statement");
+    gwbuf_free(execute);
+    gwbuf_free(query);
+    ss_dfprintf(stderr, "\t..done\n");
+
+    ss_dfprintf(stderr, "testqcps : Replace and remove statements");
+    stmt1 = create_prepare("SELECT 3");
+    ss_info_dassert(qc_ps_store(&session, 1, stmt1), "Replacing should succeed");
+    gwbuf_free(stmt1);
+    found = qc_ps_lookup(&session, 1);
+    ss_info_dassert(found && strncmp((char*)GWBUF_DATA(found) + MYSQL_HEADER_LEN + 1, "SELECT 3", 8) == 0,
+                    "The statement should be replaced");
+    qc_ps_remove(&session, 1);
+    ss_info_dassert(qc_ps_lookup(&session, 1) == NULL, "Statement 1 should be removed");
+    ss_info_dassert(qc_ps_lookup(&session, 2) != NULL, "Statement 2 should remain");
+    qc_ps_free(&session);
+    ss_info_dassert(session.ps_infos == NULL, "All statements should be removed");
+    ss_info_dassert(qc_ps_lookup(&session, 2) == NULL, "Statement 2 should be removed");
+    ss_dfprintf(stderr, "\t..done\n");
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+
+    result += test1();
+
+    exit(result);
+}
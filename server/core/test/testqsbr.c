@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <maxscale/debug.h>
+
+#include "../maxscale/qsbr.h"
+
+static int n_freed = 0;
+
+static void count_free(void *data)
+{
+    n_freed++;
+}
+
+/**
+ * test1    Objects are freed only after every online thread is quiescent
+ */
+static int
+test1()
+{
+    ss_dfprintf(stderr, "testqsbr : Free an object with one online thread");
+    mxs_qsbr_defer(count_free, NULL);
+    ss_info_dassert(n_freed == 0, "Object should not be freed before a quiescent state");
+    qsbr_quiescent(0);
+    ss_info_dassert(n_freed == 1, "Object should be freed after a quiescent state");
+    ss_dfprintf(stderr, "\t..done\n");
+
+    ss_dfprintf(stderr, "testqsbr : Free an object with two online threads");
+    qsbr_online(1);
+    mxs_qsbr_defer(count_free, NULL);
+    qsbr_quiescent(0);
+    ss_info_dassert(n_freed == 1, "Object should be kept while a thread can refer to it");
+    qsbr_quiescent(1);
+    qsbr_quiescent(0);
+    ss_info_dassert(n_freed == 2, "Object should be freed once both threads are quiescent");
+    ss_dfprintf(stderr, "\t..done\n");
+
+    ss_dfprintf(stderr, "testqsbr : Free an object with an offline thread");
+    qsbr_offline(1);
+    mxs_qsbr_defer(count_free, NULL);
+    qsbr_quiescent(0);
+    ss_info_dassert(n_freed == 3, "An offline thread should not delay freeing");
+    ss_dfprintf(stderr, "\t..done\n");
+
+    ss_dfprintf(stderr, "testqsbr : Free an object with a thread waiting for events");
+    qsbr_online(1);
+    mxs_qsbr_defer(count_free, NULL);
+    qsbr_blocking(1);
+    qsbr_quiescent(0);
+    ss_info_dassert(n_freed == 4, "An object deferred before the wait should be freed");
+    mxs_qsbr_defer(count_free, NULL);
+    qsbr_quiescent(0);
+    ss_info_dassert(n_freed == 4, "An object deferred during the wait should be kept");
+    qsbr_quiescent(1);
+    qsbr_quiescent(0);
+    ss_info_dassert(n_freed == 5, "Object should be freed once the waiting thread is quiescent");
+    ss_dfprintf(stderr, "\t..done\n");
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+
+    result += test1();
+
+    exit(result);
+}
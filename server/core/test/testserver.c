@@ -32,6 +32,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include <maxscale/alloc.h>
 #include <maxscale/server.h>
@@ -174,6 +175,123 @@ bool test_serialize()
     return true;
 }
 
+bool test_snapshot()
+{
+    SERVER *server1 = server_alloc("snapshot-server1", "127.0.0.1", 9876, "HTTPD", "NullAuthAllow", NULL);
+    SERVER *server2 = server_alloc("snapshot-server2", "127.0.0.1", 9877, "HTTPD", "NullAuthAllow", NULL);
+    TEST(server1 && server2, "Server allocation failed");
+
+    server1->status = SERVER_RUNNING | SERVER_MASTER;
+    server2->status = SERVER_RUNNING | SERVER_SLAVE;
+    server2->rlag_ms = 150;
+    SERVER *both[] = {server1, server2};
+    server_snapshot_publish(both, 2);
+
+    const MXS_SERVER_SNAPSHOT *first = server_snapshot_acquire();
+    TEST(first, "A snapshot should be published");
+    int64_t version = first->version;
+    TEST(version == server_snapshot_version(), "The version of the snapshot should be current");
+
+    const MXS_SERVER_SNAPSHOT_ENTRY *entry = server_snapshot_find(first, server2);
+    TEST(entry && entry->status == (SERVER_RUNNING | SERVER_SLAVE), "Wrong status in the snapshot");
+    TEST(entry->rlag_ms == 150, "Wrong replication lag in the snapshot");
+
+    /** Only the given servers are copied, the others keep their old state */
+    server2->status = SERVER_RUNNING;
+    server_snapshot_publish(&server1, 1);
+    TEST(server_snapshot_version() == version, "Publishing the same state should not change the version");
+
+    server_snapshot_publish(&server2, 1);
+    TEST(server_snapshot_version() == version + 1, "Publishing a new state should change the version");
+
+    const MXS_SERVER_SNAPSHOT *second = server_snapshot_acquire();
+    entry = server_snapshot_find(second, server2);
+    TEST(entry && entry->status == SERVER_RUNNING, "Wrong status in the new snapshot");
+
+    /** The old snapshot stays valid while it is held */
+    server1->status = SERVER_RUNNING;
+    server_snapshot_publish(&server1, 1);
+    entry = server_snapshot_find(first, server2);
+    TEST(entry && entry->status == (SERVER_RUNNING | SERVER_SLAVE), "The held snapshot should not change");
+
+    MXS_SERVER_SNAPSHOT_ENTRY state = server_snapshot_state(second, server1);
+    TEST(SERVER_IS_MASTER(&state), "The state should come from the snapshot");
+    state = server_snapshot_state(NULL, server1);
+    TEST(!SERVER_IS_MASTER(&state), "The state should be the current one without a snapshot");
+
+    server_snapshot_release(second);
+    server_snapshot_release(first);
+
+    return true;
+}
+
+static SERVER *stress_servers[2];
+static bool stress_done = false;
+static bool stress_failed = false;
+
+static void* snapshot_reader(void *data)
+{
+    while (!stress_done)
+    {
+        const MXS_SERVER_SNAPSHOT *snapshot = server_snapshot_acquire();
+        const MXS_SERVER_SNAPSHOT_ENTRY *e1 = server_snapshot_find(snapshot, stress_servers[0]);
+        const MXS_SERVER_SNAPSHOT_ENTRY *e2 = server_snapshot_find(snapshot, stress_servers[1]);
+
+        /** The writer updates both servers before it publishes them */
+        if (e1 == NULL || e2 == NULL || e1->rlag != e1->rlag_ms ||
+            e1->rlag != e2->rlag || e2->rlag != e2->rlag_ms)
+        {
+            stress_failed = true;
+        }
+
+        server_snapshot_release(snapshot);
+    }
+
+    return NULL;
+}
+
+bool test_snapshot_threads()
+{
+    stress_servers[0] = server_alloc("stress-server1", "127.0.0.1", 9876, "HTTPD", "NullAuthAllow", NULL);
+    stress_servers[1] = server_alloc("stress-server2", "127.0.0.1", 9877, "HTTPD", "NullAuthAllow", NULL);
+    TEST(stress_servers[0] && stress_servers[1], "Server allocation failed");
+
+    for (int i = 0; i < 2; i++)
+    {
+        stress_servers[i]->rlag = stress_servers[i]->rlag_ms = 0;
+    }
+
+    server_snapshot_publish(stress_servers, 2);
+
+    pthread_t readers[4];
+
+    for (int i = 0; i < 4; i++)
+    {
+        pthread_create(&readers[i], NULL, snapshot_reader, NULL);
+    }
+
+    for (int n = 1; n <= 20000; n++)
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            stress_servers[i]->rlag = n;
+            stress_servers[i]->rlag_ms = n;
+        }
+
+        server_snapshot_publish(stress_servers, 2);
+    }
+
+    stress_done = true;
+
+    for (int i = 0; i < 4; i++)
+    {
+        pthread_join(readers[i], NULL);
+    }
+
+    TEST(!stress_failed, "A reader saw a half-updated snapshot");
+    return true;
+}
+
 int main(int argc, char **argv)
 {
     int result = 0;
@@ -185,5 +303,15 @@ int main(int argc, char **argv)
         result++;
     }
 
+    if (!test_snapshot())
+    {
+        result++;
+    }
+
+    if (!test_snapshot_threads())
+    {
+        result++;
+    }
+
     exit(result);
 }
@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <maxscale/atomic.h>
+#include <maxscale/debug.h>
+#include <maxscale/spsc_ring.h>
+#include <maxscale/thread.h>
+
+#define N_RECORDS 200000
+
+/** Length of the n:th record, varies so that the fillers are exercised */
+static size_t record_len(uint32_t n)
+{
+    return sizeof(uint32_t) + n % 1000;
+}
+
+/**
+ * test1    Records are read in the order they were committed
+ */
+static int
+test1()
+{
+    MXS_SPSC_RING ring;
+    size_t len;
+
+    ss_dfprintf(stderr, "testspscring : Reserve, commit and consume records");
+    ss_info_dassert(mxs_spsc_ring_init(&ring, 1), "Ring should be allocated");
+    ss_info_dassert(ring.mask + 1 == MXS_SPSC_RING_MIN_SIZE, "Ring should have the minimum size");
+    ss_info_dassert(mxs_spsc_ring_peek(&ring, &len) == NULL, "New ring should be empty");
+
+    char *data = mxs_spsc_ring_reserve(&ring, 100);
+    ss_info_dassert(data, "Space should be reserved");
+    memcpy(data, "hello", 5);
+    mxs_spsc_ring_commit(&ring, 5);
+
+    data = mxs_spsc_ring_peek(&ring, &len);
+    ss_info_dassert(data && len == 5 && memcmp(data, "hello", 5) == 0, "Record should be returned");
+    mxs_spsc_ring_consume(&ring);
+    ss_info_dassert(mxs_spsc_ring_is_empty(&ring), "Ring should be empty after consuming");
+
+    ss_info_dassert(mxs_spsc_ring_reserve(&ring, MXS_SPSC_RING_MIN_SIZE) == NULL,
+                    "A record larger than the ring should not fit");
+
+    int n = 0;
+
+    while (mxs_spsc_ring_reserve(&ring, 1000))
+    {
+        mxs_spsc_ring_commit(&ring, 1000);
+        n++;
+    }
+
+    ss_info_dassert(n > 0 && n < 5, "A full ring should refuse records");
+
+    while (mxs_spsc_ring_peek(&ring, &len))
+    {
+        ss_info_dassert(len == 1000, "Length should be preserved");
+        mxs_spsc_ring_consume(&ring);
+        n--;
+    }
+
+    ss_info_dassert(n == 0, "All records should be consumed");
+    ss_info_dassert(mxs_spsc_ring_reserve(&ring, 1000), "Space should be reserved after wrapping");
+    mxs_spsc_ring_destroy(&ring);
+    ss_dfprintf(stderr, "\t..done\n");
+
+    return 0;
+}
+
+static void* producer(void *data)
+{
+    MXS_SPSC_RING *ring = (MXS_SPSC_RING*)data;
+
+    for (uint32_t n = 0; n < N_RECORDS; n++)
+    {
+        size_t len = record_len(n);
+        uint8_t *record;
+
+        while ((record = mxs_spsc_ring_reserve(ring, len)) == NULL)
+        {
+            ;
+        }
+
+        memcpy(record, &n, sizeof(n));
+        memset(record + sizeof(n), n & 0xff, len - sizeof(n));
+        mxs_spsc_ring_commit(ring, len);
+    }
+
+    return NULL;
+}
+
+/**
+ * test2    A producer and a consumer thread share a ring
+ */
+static int
+test2()
+{
+    MXS_SPSC_RING ring;
+    pthread_t thr;
+
+    ss_dfprintf(stderr, "testspscring : Pass records between two threads");
+    ss_info_dassert(mxs_spsc_ring_init(&ring, 8192), "Ring should be allocated");
+    pthread_create(&thr, NULL, producer, &ring);
+
+    for (uint32_t n = 0; n < N_RECORDS; n++)
+    {
+        uint8_t *record;
+        size_t len;
+        uint32_t value;
+
+        while ((record = mxs_spsc_ring_peek(&ring, &len)) == NULL)
+        {
+            ;
+        }
+
+        memcpy(&value, record, sizeof(value));
+        ss_info_dassert(value == n && len == record_len(n), "Records should be in order");
+        ss_info_dassert(len == sizeof(n) || record[len - 1] == (n & 0xff),
+                        "Record content should be intact");
+        mxs_spsc_ring_consume(&ring);
+    }
+
+    pthread_join(thr, NULL);
+    ss_info_dassert(ring.n_records == N_RECORDS, "Every record should be counted");
+    mxs_spsc_ring_destroy(&ring);
+    ss_dfprintf(stderr, "\t..done\n");
+
+    return 0;
+}
+
+typedef struct
+{
+    int      n_next;    /*< The next record expected by the consumer */
+    int      n_flushed; /*< Calls of the flush callback */
+    bool     in_order;  /*< Whether the records came in the right order */
+} CONSUMER_STATE;
+
+static uint64_t consumer_drain(MXS_SPSC_RING *ring, void *data)
+{
+    CONSUMER_STATE *state = (CONSUMER_STATE*)data;
+    uint64_t n_records = 0;
+    uint8_t *record;
+    size_t len;
+
+    while ((record = mxs_spsc_ring_peek(ring, &len)))
+    {
+        uint32_t value;
+        memcpy(&value, record, sizeof(value));
+        state->in_order = state->in_order && value == (uint32_t)state->n_next && len == record_len(value);
+        mxs_spsc_ring_consume(ring);
+        atomic_add(&state->n_next, 1);
+        n_records++;
+    }
+
+    return n_records;
+}
+
+static int consumer_flush(MXS_SPSC_CONSUMER *consumer, void *data)
+{
+    CONSUMER_STATE *state = (CONSUMER_STATE*)data;
+    atomic_add(&state->n_flushed, 1);
+    return -1;
+}
+
+/** Wait until the consumer has seen @c n records */
+static bool consumer_wait(CONSUMER_STATE *state, int n)
+{
+    for (int i = 0; i < 5000 && atomic_add(&state->n_next, 0) != n; i++)
+    {
+        thread_millisleep(1);
+    }
+
+    return atomic_add(&state->n_next, 0) == n;
+}
+
+/**
+ * test3    A consumer thread wakes up for the records and sleeps in between
+ */
+static int
+test3()
+{
+    MXS_SPSC_RING ring;
+    CONSUMER_STATE state = {0, 0, true};
+    pthread_t thr;
+
+    ss_dfprintf(stderr, "testspscring : Drain a ring with a consumer thread");
+    ss_info_dassert(mxs_spsc_ring_init(&ring, 8192), "Ring should be allocated");
+
+    MXS_SPSC_CONSUMER *consumer = mxs_spsc_consumer_start(&ring, 1, consumer_drain,
+                                                          consumer_flush, &state);
+    ss_info_dassert(consumer, "Consumer should start");
+
+    for (uint32_t n = 0; n < 10; n++)
+    {
+        uint8_t *record = mxs_spsc_ring_reserve(&ring, record_len(n));
+        memcpy(record, &n, sizeof(n));
+        mxs_spsc_ring_commit(&ring, record_len(n));
+        ss_info_dassert(consumer_wait(&state, n + 1), "A sleeping consumer should be woken up");
+    }
+
+    thread_millisleep(50);
+    int n_flushed = atomic_add(&state.n_flushed, 0);
+    thread_millisleep(50);
+    ss_info_dassert(atomic_add(&state.n_flushed, 0) == n_flushed,
+                    "An idle consumer should not poll the ring");
+
+    mxs_spsc_consumer_wake(consumer);
+    for (int i = 0; i < 5000 && atomic_add(&state.n_flushed, 0) == n_flushed; i++)
+    {
+        thread_millisleep(1);
+    }
+    ss_info_dassert(atomic_add(&state.n_flushed, 0) > n_flushed, "Waking up should run the callbacks");
+
+    state.n_next = 0;
+    pthread_create(&thr, NULL, producer, &ring);
+    pthread_join(thr, NULL);
+    mxs_spsc_consumer_stop(consumer);
+
+    ss_info_dassert(state.n_next == N_RECORDS && state.in_order, "Every record should be drained in order");
+    ss_info_dassert(ring.consumer == NULL, "Stopping should detach the ring");
+    mxs_spsc_ring_destroy(&ring);
+    ss_dfprintf(stderr, "\t..done\n");
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+
+    result += test1();
+    result += test2();
+    result += test3();
+
+    exit(result);
+}
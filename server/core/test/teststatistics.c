@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <maxscale/config.h>
+#include <maxscale/statistics.h>
+
+#include "../maxscale/poll.h"
+#include "test_utils.h"
+
+#define TEST_THREADS 4
+
+/**
+ * test1    The values that the polling threads add are summed
+ */
+static int
+test1()
+{
+    ts_stats_t stats = ts_stats_alloc();
+
+    ss_dfprintf(stderr, "teststatistics : sum of the polling threads");
+    ss_info_dassert(stats, "Statistics should be allocated");
+
+    poll_thread = true;
+
+    for (int i = 0; i < TEST_THREADS; i++)
+    {
+        current_thread_id = i;
+        ts_stats_add(stats, i + 1);
+        ts_stats_add(stats, 1);
+    }
+
+    current_thread_id = 0;
+    ts_stats_add(stats, -1);
+
+    ss_info_dassert(ts_stats_sum(stats) == 1 + 2 + 3 + 4 + TEST_THREADS - 1, "Sum should match");
+    ss_info_dassert(ts_stats_get(stats, TS_STATS_SUM) == ts_stats_sum(stats), "Sums should be equal");
+    ss_info_dassert(ts_stats_get(stats, TS_STATS_MAX) == 5, "Maximum should be the last thread");
+
+    ts_stats_free(stats);
+    ss_dfprintf(stderr, "\t..done\n");
+    return 0;
+}
+
+/**
+ * test2    Threads that are not polling threads share one value
+ */
+static int
+test2()
+{
+    ts_stats_t stats = ts_stats_alloc();
+
+    ss_dfprintf(stderr, "teststatistics : values added by other threads");
+    ss_info_dassert(stats, "Statistics should be allocated");
+
+    poll_thread = true;
+    current_thread_id = 1;
+    ts_stats_add(stats, 10);
+
+    poll_thread = false;
+    ts_stats_add(stats, 5);
+    ts_stats_add(stats, -2);
+
+    ss_info_dassert(ts_stats_sum(stats) == 13, "Sum should include the other threads");
+    ss_info_dassert(ts_stats_get(stats, TS_STATS_SUM) == 13, "Sum should include the other threads");
+    ss_info_dassert(ts_stats_get(stats, TS_STATS_MAX) == 10, "Maximum is of the polling threads");
+
+    ts_stats_free(stats);
+    ss_dfprintf(stderr, "\t..done\n");
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+
+    config_get_global_options()->n_threads = TEST_THREADS;
+
+    result += test1();
+    result += test2();
+
+    exit(result);
+}
@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <maxscale/cppdefs.hh>
+#include <iostream>
+#include <string>
+#include <maxscale/modutil.h>
+#include "../maxscale/typemaskparser.hh"
+
+using namespace std;
+
+namespace
+{
+
+struct test_case
+{
+    const char*   zStmt;
+    uint32_t      type_mask;
+    qc_query_op_t op;
+} test_cases[] =
+{
+    { "SELECT 1", QUERY_TYPE_READ, QUERY_OP_SELECT },
+    { "select a, b from t1 where c = 'x' and d in (1, 2, 3)", QUERY_TYPE_READ, QUERY_OP_SELECT },
+    { "SELECT COUNT(*) FROM t1 GROUP BY a HAVING SUM(b) > 0", QUERY_TYPE_READ, QUERY_OP_SELECT },
+    { "SELECT * FROM (SELECT a FROM t1) AS x JOIN t2 USING (a)", QUERY_TYPE_READ, QUERY_OP_SELECT },
+    { "SELECT `count`, 'INTO' FROM `t1` /* FOR UPDATE */", QUERY_TYPE_READ, QUERY_OP_SELECT },
+    { "SELECT a FROM t1 WHERE b = \"it's\" -- comment", QUERY_TYPE_READ, QUERY_OP_SELECT },
+    { "SELECT a FROM t1;", QUERY_TYPE_READ, QUERY_OP_SELECT },
+
+    { "INSERT INTO t1 VALUES (1, 'a'), (2, NOW())", QUERY_TYPE_WRITE, QUERY_OP_INSERT },
+    { "REPLACE INTO t1 SET a = 1", QUERY_TYPE_WRITE, QUERY_OP_INSERT },
+    { "UPDATE t1 SET a = a + 1 WHERE b = 2", QUERY_TYPE_WRITE, QUERY_OP_UPDATE },
+    { "DELETE FROM t1 WHERE a = 1", QUERY_TYPE_WRITE, QUERY_OP_DELETE },
+
+    { "SET NAMES utf8", QUERY_TYPE_GSYSVAR_WRITE, QUERY_OP_UNDEFINED },
+    { "SET CHARACTER SET 'utf8'", QUERY_TYPE_GSYSVAR_WRITE, QUERY_OP_UNDEFINED },
+    { "SET SESSION sql_mode = ''", QUERY_TYPE_GSYSVAR_WRITE, QUERY_OP_UNDEFINED },
+    { "SET @a = 1", QUERY_TYPE_USERVAR_WRITE, QUERY_OP_UNDEFINED },
+    { "SET @a = 1, wait_timeout = 10", QUERY_TYPE_USERVAR_WRITE | QUERY_TYPE_GSYSVAR_WRITE, QUERY_OP_UNDEFINED },
+    {
+        "SET autocommit = 0",
+        QUERY_TYPE_GSYSVAR_WRITE | QUERY_TYPE_BEGIN_TRX | QUERY_TYPE_DISABLE_AUTOCOMMIT,
+        QUERY_OP_UNDEFINED
+    },
+    {
+        "SET @@session.autocommit = ON",
+        QUERY_TYPE_GSYSVAR_WRITE | QUERY_TYPE_COMMIT | QUERY_TYPE_ENABLE_AUTOCOMMIT,
+        QUERY_OP_UNDEFINED
+    },
+
+    { "USE test", QUERY_TYPE_SESSION_WRITE, QUERY_OP_CHANGE_DB },
+
+    { "BEGIN", QUERY_TYPE_BEGIN_TRX, QUERY_OP_UNDEFINED },
+    { "START TRANSACTION READ ONLY", QUERY_TYPE_BEGIN_TRX | QUERY_TYPE_READ, QUERY_OP_UNDEFINED },
+    { "COMMIT", QUERY_TYPE_COMMIT, QUERY_OP_UNDEFINED },
+    { "ROLLBACK", QUERY_TYPE_ROLLBACK, QUERY_OP_UNDEFINED },
+};
+
+const size_t N_TEST_CASES = sizeof(test_cases) / sizeof(test_cases[0]);
+
+/** Statements that must be left to the query classifier */
+const char* ambiguous_cases[] =
+{
+    "SELECT a INTO @a FROM t1",
+    "SELECT a FROM t1 INTO OUTFILE '/tmp/a'",
+    "SELECT a FROM t1 FOR UPDATE",
+    "SELECT a FROM t1 LOCK IN SHARE MODE",
+    "SELECT @a",
+    "SELECT @@identity",
+    "SELECT LAST_INSERT_ID()",
+    "SELECT GET_LOCK('a', 10)",
+    "SELECT db.f(1)",
+    "SELECT `f`(1)",
+    "SELECT /*! SQL_NO_CACHE */ a FROM t1",
+    "SELECT 1; SELECT 2",
+    "SELECT 'unterminated",
+    "INSERT INTO t1 SELECT * FROM t2",
+    "INSERT INTO t1 VALUES (LAST_INSERT_ID())",
+    "UPDATE t1 SET a = @b",
+    "DELETE FROM t1 WHERE a IN (SELECT a FROM t2)",
+    "SET autocommit = 2",
+    "SET a = b + 1",
+    "SET a = f()",
+    "SET TRANSACTION ISOLATION LEVEL READ COMMITTED",
+    "SET PASSWORD = PASSWORD('a')",
+    "SET @a := 1",
+    "USE test; DROP TABLE t1",
+    "START SLAVE",
+    "ROLLBACK TO SAVEPOINT a",
+    "CREATE TABLE t1 (a INT)",
+    "SHOW TABLES",
+    "(SELECT 1)",
+};
+
+const size_t N_AMBIGUOUS_CASES = sizeof(ambiguous_cases) / sizeof(ambiguous_cases[0]);
+
+/** Statements classified by their first keyword, a NULL zStmt is not classified */
+struct keyword_case
+{
+    const char*   zStmt;
+    qc_query_op_t op;
+} keyword_cases[] =
+{
+    { "SELECT a INTO @a FROM t1", QUERY_OP_SELECT },
+    { " /* comment */ select LAST_INSERT_ID()", QUERY_OP_SELECT },
+    { "INSERT INTO t1 SELECT * FROM t2", QUERY_OP_INSERT },
+    { "REPLACE INTO t1 VALUES (@a)", QUERY_OP_INSERT },
+    { "UPDATE t1 SET a = @b", QUERY_OP_UPDATE },
+    { "DELETE FROM t1 WHERE a IN (SELECT a FROM t2)", QUERY_OP_DELETE },
+    { "SET @a = f()", QUERY_OP_UNDEFINED },
+    { "/*! SELECT */ 1", QUERY_OP_UNDEFINED },
+    { "(SELECT 1)", QUERY_OP_UNDEFINED },
+};
+
+const size_t N_KEYWORD_CASES = sizeof(keyword_cases) / sizeof(keyword_cases[0]);
+
+int test(const char* zStmt, bool classified, uint32_t expected_type_mask, qc_query_op_t expected_op)
+{
+    int rc = 0;
+    GWBUF* pBuf = modutil_create_query(zStmt);
+    uint32_t type_mask = 0;
+    qc_query_op_t op = QUERY_OP_UNDEFINED;
+
+    maxscale::TypeMaskParser parser;
+
+    if (parser.classify(pBuf, &type_mask, &op) != classified)
+    {
+        cerr << "\"" << zStmt << "\": expected to be "
+             << (classified ? "classified" : "ambiguous") << "." << endl;
+        rc = 1;
+    }
+    else if (classified && (type_mask != expected_type_mask || op != expected_op))
+    {
+        cerr << "\"" << zStmt << "\": expected " << expected_type_mask << " and " << expected_op
+             << ", but got " << type_mask << " and " << op << "." << endl;
+        rc = 1;
+    }
+
+    gwbuf_free(pBuf);
+
+    return rc;
+}
+
+int test_keyword(const char* zStmt, qc_query_op_t expected_op)
+{
+    int rc = 0;
+    GWBUF* pBuf = modutil_create_query(zStmt);
+    uint32_t type_mask = 0;
+    qc_query_op_t op = QUERY_OP_UNDEFINED;
+    bool classified = expected_op != QUERY_OP_UNDEFINED;
+
+    maxscale::TypeMaskParser parser;
+
+    if (parser.classify_by_keyword(pBuf, &type_mask, &op) != classified)
+    {
+        cerr << "\"" << zStmt << "\": expected to be "
+             << (classified ? "classified" : "not classified") << " by keyword." << endl;
+        rc = 1;
+    }
+    else if (classified && (type_mask != QUERY_TYPE_WRITE || op != expected_op))
+    {
+        cerr << "\"" << zStmt << "\": expected a write and " << expected_op
+             << ", but got " << type_mask << " and " << op << "." << endl;
+        rc = 1;
+    }
+
+    gwbuf_free(pBuf);
+
+    return rc;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    int rc = 0;
+
+    for (size_t i = 0; i < N_TEST_CASES; ++i)
+    {
+        const test_case& tc = test_cases[i];
+
+        rc += test(tc.zStmt, true, tc.type_mask, tc.op);
+
+        // Leading whitespace and comments do not matter.
+        string s = string(" /* comment */\n") + tc.zStmt;
+        rc += test(s.c_str(), true, tc.type_mask, tc.op);
+    }
+
+    for (size_t i = 0; i < N_AMBIGUOUS_CASES; ++i)
+    {
+        rc += test(ambiguous_cases[i], false, 0, QUERY_OP_UNDEFINED);
+    }
+
+    for (size_t i = 0; i < N_KEYWORD_CASES; ++i)
+    {
+        rc += test_keyword(keyword_cases[i].zStmt, keyword_cases[i].op);
+    }
+
+    // Only COM_QUERY packets are classified.
+    GWBUF* pBuf = modutil_create_query("SELECT 1");
+    GWBUF_DATA(pBuf)[MYSQL_HEADER_LEN] = MYSQL_COM_STMT_PREPARE;
+    uint32_t type_mask;
+    qc_query_op_t op;
+    maxscale::TypeMaskParser parser;
+
+    if (parser.classify(pBuf, &type_mask, &op))
+    {
+        cerr << "A COM_STMT_PREPARE was classified." << endl;
+        ++rc;
+    }
+
+    gwbuf_free(pBuf);
+
+    return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -11,6 +11,7 @@
  * Public License.
  */
 #include <maxscale/thread.h>
+#include <maxscale/atomic.h>
 
 /**
  * @file thread.c  - Implementation of thread related operations
@@ -68,3 +69,49 @@ thread_millisleep(int ms)
     req.tv_nsec = (ms % 1000) * 1000000;
     nanosleep(&req, NULL);
 }
+
+/**
+ * The work shared by the threads of thread_run_parallel()
+ */
+typedef struct
+{
+    void (*entry)(void *); /**< The function to call */
+    void **items;          /**< The items to pass to the function */
+    int n_items;           /**< Number of items */
+    int next;              /**< Next item to process */
+} THREAD_BATCH;
+
+static void thread_batch_main(void *arg)
+{
+    THREAD_BATCH *batch = (THREAD_BATCH*)arg;
+    int i;
+
+    while ((i = atomic_add(&batch->next, 1)) < batch->n_items)
+    {
+        batch->entry(batch->items[i]);
+    }
+}
+
+void thread_run_parallel(void (*entry)(void *), void **items, int n_items, int max_threads)
+{
+    THREAD_BATCH batch = {entry, items, n_items, 0};
+    int n_threads = n_items < max_threads ? n_items : max_threads;
+    THREAD threads[n_threads > 0 ? n_threads : 1];
+    int started = 0;
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        if (thread_start(&threads[started], thread_batch_main, &batch))
+        {
+            started++;
+        }
+    }
+
+    /** Whatever the started threads do not process is done here */
+    thread_batch_main(&batch);
+
+    for (int i = 0; i < started; i++)
+    {
+        thread_wait(threads[i]);
+    }
+}
@@ -0,0 +1,732 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file trace.c - Sampled tracing of statements
+ *
+ * A traced session has a tracing element in front of each element of its
+ * filter chain, in both directions. The element at the head of the chain
+ * decides whether a statement is traced and the others record the time the
+ * statement, or its reply, reaches the element they wrap. A session traces
+ * one statement at a time and the trace ends when the next statement
+ * arrives or the session is closed, at which point it is stored into a ring
+ * of the most recent traces.
+ *
+ * When slow statements are logged, every statement of a session is timed
+ * with the same points. A statement whose reply took longer than the
+ * threshold is logged when its trace ends, but only the sampled ones are
+ * stored into the ring.
+ */
+
+#include "maxscale/trace.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/config.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/modutil.h>
+#include <maxscale/platform.h>
+#include <maxscale/server.h>
+#include <maxscale/service.h>
+#include <maxscale/spinlock.h>
+#include <maxscale/utils.h>
+
+#include "maxscale/filter.h"
+
+/** Length of the statement prefix stored in a trace */
+#define TRACE_SQL_LEN 128
+
+/** The value of a point that was not reached */
+#define TRACE_UNSET -1
+
+/** Maximum length of the statement that a slow statement log entry shows */
+#define SLOW_SQL_LEN 2048
+
+/** Length of the user and host of a slow statement */
+#define SLOW_USER_LEN 160
+
+/**
+ * The recorded timings of a statement, in microseconds since the statement
+ * reached the head of the filter chain
+ */
+typedef struct
+{
+    uint64_t    id;                                  /**< Trace ID */
+    size_t      ses_id;                              /**< Session ID */
+    const char *service;                             /**< The service of the session */
+    char        sql[TRACE_SQL_LEN];                  /**< Prefix of the statement */
+    int         n_filters;                           /**< Number of recorded filters */
+    const char *filters[MXS_TRACE_MAX_FILTERS];      /**< Names of the filters */
+    int32_t     filter_query[MXS_TRACE_MAX_FILTERS]; /**< When a filter got the statement */
+    int32_t     filter_reply[MXS_TRACE_MAX_FILTERS]; /**< When a filter got the reply */
+    int32_t     points[MXS_TRACE_N_POINTS];          /**< When the common points were reached */
+} TRACE_RECORD;
+
+/**
+ * A statement being traced. It is referred to by the session and by the
+ * buffer of the statement, whichever is freed last frees the trace.
+ */
+typedef struct mxs_trace
+{
+    int             refcount;
+    bool            sampled;              /**< Whether the trace is stored into the ring */
+    uint64_t        start;                /**< When the statement was received, in microseconds */
+    const char     *backend;              /**< The server the statement was written to */
+    int32_t         client_write;         /**< When the reply was first written to the client */
+    char            user[SLOW_USER_LEN];  /**< The user and the host of the client */
+    TRACE_RECORD    record;
+    char            sql[];                /**< The statement, if slow statements are logged */
+} MXS_TRACE;
+
+struct mxs_session_trace;
+
+/** A tracing element in front of a downstream element */
+typedef struct
+{
+    struct mxs_session_trace *trace;
+    int                       filter; /**< Index of the filter, -1 for the router */
+    MXS_DOWNSTREAM            down;   /**< The wrapped element */
+} TRACE_DOWN;
+
+/** A tracing element in front of an upstream element */
+typedef struct
+{
+    struct mxs_session_trace *trace;
+    int                       filter; /**< Index of the filter, -1 for the client */
+    MXS_UPSTREAM              up;     /**< The wrapped element */
+} TRACE_UP;
+
+/** The tracing state of a session */
+struct mxs_session_trace
+{
+    MXS_SESSION *session;
+    MXS_TRACE   *current; /**< The statement being traced */
+    TRACE_DOWN  *entry;   /**< The element at the head of the chain */
+    int          n_down;
+    int          n_up;
+    TRACE_DOWN  *down;    /**< One element for each filter and one for the router */
+    TRACE_UP    *up;      /**< One element for each filter and one for the client */
+};
+
+/** A stored trace */
+typedef struct
+{
+    uint64_t     seqno;
+    TRACE_RECORD record;
+} TRACE_SLOT;
+
+static TRACE_SLOT trace_ring[MXS_TRACE_RING_SIZE];
+static uint64_t   trace_ring_count;
+static SPINLOCK   trace_ring_lock = SPINLOCK_INIT;
+static uint64_t   trace_id;
+
+static SPINLOCK slow_lock = SPINLOCK_INIT;
+static time_t   slow_second;     /**< The second of the logged slow statements */
+static int      slow_logged;     /**< Slow statements logged during that second */
+static int      slow_suppressed; /**< Slow statements not logged due to the rate limit */
+
+/** Statements since the last traced one */
+static thread_local int trace_counter;
+
+static int32_t trace_elapsed(MXS_TRACE *trace)
+{
+    uint64_t us = mxs_clock_us() - trace->start;
+
+    return us > INT32_MAX ? INT32_MAX : (int32_t)us;
+}
+
+static void trace_set(MXS_TRACE *trace, int32_t *value)
+{
+    if (*value == TRACE_UNSET)
+    {
+        *value = trace_elapsed(trace);
+    }
+}
+
+static void trace_unref(void *data)
+{
+    MXS_TRACE *trace = (MXS_TRACE*)data;
+
+    if (atomic_add(&trace->refcount, -1) == 1)
+    {
+        MXS_FREE(trace);
+    }
+}
+
+static void trace_store(MXS_TRACE *trace)
+{
+    spinlock_acquire(&trace_ring_lock);
+    TRACE_SLOT *slot = &trace_ring[trace_ring_count % MXS_TRACE_RING_SIZE];
+    slot->seqno = trace_ring_count++;
+    slot->record = trace->record;
+    spinlock_release(&trace_ring_lock);
+}
+
+/**
+ * Decide whether the next statement is traced
+ *
+ * @return True if the statement should be traced
+ */
+static bool trace_sample()
+{
+    int interval = config_get_global_options()->query_trace_interval;
+
+    if (interval > 0 && ++trace_counter >= interval)
+    {
+        trace_counter = 0;
+        return true;
+    }
+
+    return false;
+}
+
+static inline bool slow_query_enabled()
+{
+    return config_get_global_options()->slow_query_time > 0;
+}
+
+static MXS_TRACE* trace_begin(struct mxs_session_trace *st, GWBUF *buf, bool sampled)
+{
+    char *sql = NULL;
+    int len = 0;
+    bool is_sql = modutil_is_SQL(buf) && modutil_extract_SQL(buf, &sql, &len);
+    int slow_len = is_sql && slow_query_enabled() ? MXS_MIN(len, SLOW_SQL_LEN) : 0;
+    MXS_TRACE *trace = (MXS_TRACE*)MXS_CALLOC(1, sizeof(MXS_TRACE) + slow_len + 1);
+
+    if (trace)
+    {
+        MXS_SESSION *session = st->session;
+        TRACE_RECORD *rec = &trace->record;
+        DCB *client = session->client_dcb;
+
+        trace->start = mxs_clock_us();
+        trace->refcount = 2;
+        trace->sampled = sampled;
+        trace->client_write = TRACE_UNSET;
+        snprintf(trace->user, sizeof(trace->user), "%s@%s",
+                 client && client->user ? client->user : "",
+                 client && client->remote ? client->remote : "");
+
+        if (slow_len > 0)
+        {
+            memcpy(trace->sql, sql, slow_len);
+        }
+
+        rec->id = atomic_add_uint64(&trace_id, 1) + 1;
+        rec->ses_id = session->ses_id;
+        rec->service = session->service->name;
+        rec->n_filters = MXS_MIN(session->n_filters, MXS_TRACE_MAX_FILTERS);
+
+        for (int i = 0; i < rec->n_filters; i++)
+        {
+            rec->filters[i] = session->filters[i].filter->name;
+            rec->filter_query[i] = TRACE_UNSET;
+            rec->filter_reply[i] = TRACE_UNSET;
+        }
+
+        for (int i = 0; i < MXS_TRACE_N_POINTS; i++)
+        {
+            rec->points[i] = TRACE_UNSET;
+        }
+
+        uint8_t command;
+
+        if (is_sql)
+        {
+            len = MXS_MIN(len, TRACE_SQL_LEN - 1);
+            memcpy(rec->sql, sql, len);
+            rec->sql[len] = '\0';
+        }
+        else if (gwbuf_copy_data(buf, 4, 1, &command) == 1)
+        {
+            snprintf(rec->sql, sizeof(rec->sql), "<command %d>", command);
+        }
+
+        gwbuf_add_buffer_object(buf, GWBUF_TRACE, trace, trace_unref);
+    }
+
+    return trace;
+}
+
+/**
+ * Check whether a slow statement may be logged
+ *
+ * @param suppressed Set to the number of slow statements that were not
+ *                   logged since the last one that was
+ *
+ * @return True if the statement may be logged
+ */
+static bool slow_query_allow(int *suppressed)
+{
+    time_t now = time(NULL);
+    bool rval = false;
+
+    spinlock_acquire(&slow_lock);
+
+    if (now != slow_second)
+    {
+        slow_second = now;
+        slow_logged = 0;
+    }
+
+    if (slow_logged < config_get_global_options()->slow_query_log_rate)
+    {
+        slow_logged++;
+        *suppressed = slow_suppressed;
+        slow_suppressed = 0;
+        rval = true;
+    }
+    else
+    {
+        slow_suppressed++;
+    }
+
+    spinlock_release(&slow_lock);
+
+    return rval;
+}
+
+/** The time between two points, TRACE_UNSET if either was not reached */
+static int32_t trace_span(int32_t from, int32_t to)
+{
+    return from != TRACE_UNSET && to != TRACE_UNSET && to >= from ? to - from : TRACE_UNSET;
+}
+
+/**
+ * The time the statement and its reply spent in the filters
+ *
+ * The reply enters the filter chain when the first filter that gets it,
+ * the one closest to the router, is reached.
+ */
+static int32_t trace_filter_time(MXS_TRACE *trace)
+{
+    TRACE_RECORD *rec = &trace->record;
+    int32_t reply_start = TRACE_UNSET;
+
+    for (int i = 0; i < rec->n_filters; i++)
+    {
+        if (rec->filter_reply[i] != TRACE_UNSET &&
+            (reply_start == TRACE_UNSET || rec->filter_reply[i] < reply_start))
+        {
+            reply_start = rec->filter_reply[i];
+        }
+    }
+
+    int32_t query = rec->points[MXS_TRACE_ROUTER];
+    int32_t reply = trace_span(reply_start, trace->client_write);
+
+    return query == TRACE_UNSET ? TRACE_UNSET : query + (reply == TRACE_UNSET ? 0 : reply);
+}
+
+/**
+ * Log the statement of a trace if it was slow
+ *
+ * @param trace The ended trace
+ */
+static void slow_query_check(MXS_TRACE *trace)
+{
+    int threshold = config_get_global_options()->slow_query_time;
+    TRACE_RECORD *rec = &trace->record;
+    int32_t total = rec->points[MXS_TRACE_LAST_REPLY];
+    int suppressed;
+
+    if (threshold > 0 && total != TRACE_UNSET && total >= (int64_t)threshold * 1000 &&
+        slow_query_allow(&suppressed))
+    {
+        char *canonical = NULL;
+
+        if (*trace->sql)
+        {
+            GWBUF *query = modutil_create_query(trace->sql);
+
+            if (query)
+            {
+                canonical = modutil_get_canonical(query);
+                gwbuf_free(query);
+            }
+        }
+
+        char suppressed_msg[64] = "";
+
+        if (suppressed)
+        {
+            snprintf(suppressed_msg, sizeof(suppressed_msg),
+                     " (%d slow statements not logged)", suppressed);
+        }
+
+        MXS_NOTICE("Slow statement%s: total %d us, classification %d us, filters %d us, "
+                   "backend %d us, client write %d us, session %lu, user %s, service %s, "
+                   "server %s: %s", suppressed_msg, total,
+                   trace_span(rec->points[MXS_TRACE_ROUTER], rec->points[MXS_TRACE_ROUTED]),
+                   trace_filter_time(trace),
+                   trace_span(rec->points[MXS_TRACE_BACKEND_WRITE], rec->points[MXS_TRACE_FIRST_REPLY]),
+                   trace_span(trace->client_write, total),
+                   rec->ses_id, trace->user, rec->service,
+                   trace->backend ? trace->backend : "none",
+                   canonical ? canonical : rec->sql);
+
+        MXS_FREE(canonical);
+    }
+}
+
+static void trace_end_current(struct mxs_session_trace *st)
+{
+    MXS_TRACE *trace = st->current;
+
+    if (trace)
+    {
+        slow_query_check(trace);
+
+        if (trace->sampled)
+        {
+            trace_store(trace);
+        }
+
+        trace_unref(trace);
+        st->current = NULL;
+    }
+}
+
+static int32_t trace_route_query(void *instance, void *session, GWBUF *buf)
+{
+    TRACE_DOWN *down = (TRACE_DOWN*)instance;
+    struct mxs_session_trace *st = down->trace;
+
+    if (down == st->entry)
+    {
+        trace_end_current(st);
+
+        bool sampled = trace_sample();
+
+        if (sampled || slow_query_enabled())
+        {
+            st->current = trace_begin(st, buf, sampled);
+        }
+    }
+
+    MXS_TRACE *trace = st->current;
+
+    if (trace)
+    {
+        if (down->filter < 0)
+        {
+            trace_set(trace, &trace->record.points[MXS_TRACE_ROUTER]);
+        }
+        else if (down->filter < trace->record.n_filters)
+        {
+            trace_set(trace, &trace->record.filter_query[down->filter]);
+        }
+    }
+
+    return down->down.routeQuery(down->down.instance, down->down.session, buf);
+}
+
+static int32_t trace_client_reply(void *instance, void *session, GWBUF *buf)
+{
+    TRACE_UP *up = (TRACE_UP*)instance;
+    MXS_TRACE *trace = up->trace->current;
+
+    if (trace)
+    {
+        if (up->filter < 0)
+        {
+            /** Each write to the client can be the last one */
+            trace->record.points[MXS_TRACE_LAST_REPLY] = trace_elapsed(trace);
+
+            if (trace->client_write == TRACE_UNSET)
+            {
+                trace->client_write = trace->record.points[MXS_TRACE_LAST_REPLY];
+            }
+        }
+        else if (up->filter < trace->record.n_filters)
+        {
+            trace_set(trace, &trace->record.filter_reply[up->filter]);
+        }
+    }
+
+    return up->up.clientReply(up->up.instance, up->up.session, buf);
+}
+
+static int32_t trace_error(void *instance, void *session, void *err)
+{
+    TRACE_UP *up = (TRACE_UP*)instance;
+
+    return up->up.error ? up->up.error(up->up.instance, up->up.session, err) : 0;
+}
+
+bool session_trace_start(MXS_SESSION *session)
+{
+    if (config_get_global_options()->query_trace_interval <= 0 && !slow_query_enabled())
+    {
+        return false;
+    }
+
+    int n = session->service->n_filters + 1;
+    struct mxs_session_trace *st = MXS_CALLOC(1, sizeof(*st) + n * (sizeof(TRACE_DOWN) + sizeof(TRACE_UP)));
+
+    if (st == NULL)
+    {
+        return false;
+    }
+
+    st->session = session;
+    st->down = (TRACE_DOWN*)(st + 1);
+    st->up = (TRACE_UP*)(st->down + n);
+    session->trace = st;
+
+    session_trace_wrap_head(session, -1);
+    session_trace_wrap_tail(session, -1);
+
+    return true;
+}
+
+void session_trace_wrap_head(MXS_SESSION *session, int filter)
+{
+    struct mxs_session_trace *st = session->trace;
+
+    if (st)
+    {
+        TRACE_DOWN *down = &st->down[st->n_down++];
+        down->trace = st;
+        down->filter = filter;
+        down->down = session->head;
+
+        session->head.instance = down;
+        session->head.session = st;
+        session->head.routeQuery = trace_route_query;
+        st->entry = down;
+    }
+}
+
+void session_trace_wrap_tail(MXS_SESSION *session, int filter)
+{
+    struct mxs_session_trace *st = session->trace;
+
+    if (st)
+    {
+        TRACE_UP *up = &st->up[st->n_up++];
+        up->trace = st;
+        up->filter = filter;
+        up->up = session->tail;
+
+        session->tail.instance = up;
+        session->tail.session = st;
+        session->tail.clientReply = trace_client_reply;
+        session->tail.error = trace_error;
+    }
+}
+
+void session_trace_end(MXS_SESSION *session)
+{
+    struct mxs_session_trace *st = session->trace;
+
+    if (st)
+    {
+        trace_end_current(st);
+        session->trace = NULL;
+        MXS_FREE(st);
+    }
+}
+
+void session_trace_backend_read(MXS_SESSION *session)
+{
+    MXS_TRACE *trace = session->trace->current;
+
+    if (trace && trace->record.points[MXS_TRACE_BACKEND_WRITE] != TRACE_UNSET)
+    {
+        trace_set(trace, &trace->record.points[MXS_TRACE_FIRST_REPLY]);
+    }
+}
+
+void session_trace_backend_write(GWBUF *buf, SERVER *server)
+{
+    MXS_TRACE *trace = (MXS_TRACE*)gwbuf_get_buffer_object_data(buf, GWBUF_TRACE);
+
+    if (trace)
+    {
+        trace_set(trace, &trace->record.points[MXS_TRACE_BACKEND_WRITE]);
+
+        if (trace->backend == NULL && server)
+        {
+            trace->backend = server->unique_name;
+        }
+    }
+}
+
+void mxs_trace_mark(GWBUF *buf, mxs_trace_point_t point)
+{
+    MXS_TRACE *trace = (MXS_TRACE*)gwbuf_get_buffer_object_data(buf, GWBUF_TRACE);
+
+    if (trace)
+    {
+        trace_set(trace, &trace->record.points[point]);
+    }
+}
+
+/**
+ * Copy a stored trace
+ *
+ * @param n      Index of the trace, 0 is the most recent one
+ * @param count  Number of traces stored when the listing started
+ * @param record Where to copy the trace
+ *
+ * @return True if the trace still exists
+ */
+static bool trace_get(int n, uint64_t count, TRACE_RECORD *record)
+{
+    bool rval = false;
+
+    if ((uint64_t)n < count && n < MXS_TRACE_RING_SIZE)
+    {
+        uint64_t seqno = count - n - 1;
+
+        spinlock_acquire(&trace_ring_lock);
+        TRACE_SLOT *slot = &trace_ring[seqno % MXS_TRACE_RING_SIZE];
+
+        if (slot->seqno == seqno)
+        {
+            *record = slot->record;
+            rval = true;
+        }
+
+        spinlock_release(&trace_ring_lock);
+    }
+
+    return rval;
+}
+
+static void trace_format_filters(TRACE_RECORD *rec, char *buf, size_t size)
+{
+    size_t len = 0;
+    *buf = '\0';
+
+    for (int i = 0; i < rec->n_filters && len < size; i++)
+    {
+        len += snprintf(buf + len, size - len, "%s%s:%d/%d", i ? ", " : "",
+                        rec->filters[i], rec->filter_query[i], rec->filter_reply[i]);
+    }
+}
+
+/** The state of a trace listing */
+typedef struct
+{
+    int      rowno;
+    uint64_t count;
+} TRACE_LIST;
+
+static RESULT_ROW* traceRowCallback(RESULTSET *set, void *data)
+{
+    TRACE_LIST *list = (TRACE_LIST*)data;
+    TRACE_RECORD rec;
+
+    if (!trace_get(list->rowno, list->count, &rec))
+    {
+        MXS_FREE(list);
+        return NULL;
+    }
+
+    list->rowno++;
+
+    char buf[512];
+    RESULT_ROW *row = resultset_make_row(set);
+    int col = 0;
+
+    snprintf(buf, sizeof(buf), "%" PRIu64, rec.id);
+    resultset_row_set(row, col++, buf);
+    snprintf(buf, sizeof(buf), "%lu", rec.ses_id);
+    resultset_row_set(row, col++, buf);
+    resultset_row_set(row, col++, rec.service);
+    resultset_row_set(row, col++, rec.sql);
+
+    for (int i = 0; i < MXS_TRACE_N_POINTS; i++)
+    {
+        snprintf(buf, sizeof(buf), "%d", rec.points[i]);
+        resultset_row_set(row, col++, buf);
+    }
+
+    trace_format_filters(&rec, buf, sizeof(buf));
+    resultset_row_set(row, col++, buf);
+
+    return row;
+}
+
+RESULTSET* traceGetList()
+{
+    TRACE_LIST *list = (TRACE_LIST*)MXS_MALLOC(sizeof(TRACE_LIST));
+    RESULTSET *set;
+
+    if (list == NULL)
+    {
+        return NULL;
+    }
+
+    list->rowno = 0;
+    spinlock_acquire(&trace_ring_lock);
+    list->count = trace_ring_count;
+    spinlock_release(&trace_ring_lock);
+
+    if ((set = resultset_create(traceRowCallback, list)) == NULL)
+    {
+        MXS_FREE(list);
+        return NULL;
+    }
+
+    resultset_add_column(set, "Id", 10, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Session", 10, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Service", 20, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Statement", TRACE_SQL_LEN, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Router_us", 10, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Routed_us", 10, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Backend_write_us", 10, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "First_reply_us", 10, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Last_reply_us", 10, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Filters", 512, COL_TYPE_VARCHAR);
+
+    return set;
+}
+
+void dprintTraces(DCB *dcb)
+{
+    uint64_t count;
+    TRACE_RECORD rec;
+    char filters[512];
+
+    spinlock_acquire(&trace_ring_lock);
+    count = trace_ring_count;
+    spinlock_release(&trace_ring_lock);
+
+    dcb_printf(dcb, "Traced statements, times in microseconds (-1: not reached)\n\n");
+    dcb_printf(dcb, "%-8s | %-8s | %-20s | %8s | %8s | %8s | %8s | %8s | %s\n",
+               "Id", "Session", "Service", "Router", "Routed", "Backend", "First", "Last", "Statement");
+    dcb_printf(dcb, "---------+----------+----------------------+----------+----------+"
+               "----------+----------+----------+----------\n");
+
+    for (int i = 0; trace_get(i, count, &rec); i++)
+    {
+        dcb_printf(dcb, "%-8" PRIu64 " | %-8lu | %-20s | %8d | %8d | %8d | %8d | %8d | %s\n",
+                   rec.id, rec.ses_id, rec.service,
+                   rec.points[MXS_TRACE_ROUTER], rec.points[MXS_TRACE_ROUTED],
+                   rec.points[MXS_TRACE_BACKEND_WRITE], rec.points[MXS_TRACE_FIRST_REPLY],
+                   rec.points[MXS_TRACE_LAST_REPLY], rec.sql);
+
+        if (rec.n_filters)
+        {
+            trace_format_filters(&rec, filters, sizeof(filters));
+            dcb_printf(dcb, "%-8s   Filters (statement/reply): %s\n", "", filters);
+        }
+    }
+}
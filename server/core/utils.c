@@ -37,6 +37,7 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <netinet/tcp.h>
 #include <openssl/sha.h>
 
@@ -1037,6 +1038,47 @@ int open_network_socket(enum mxs_socket_type type, struct sockaddr_storage *addr
     return so;
 }
 
+int open_unix_socket(enum mxs_socket_type type, struct sockaddr_un *addr, const char *path)
+{
+    ss_dassert(type == MXS_SOCKET_NETWORK || type == MXS_SOCKET_LISTENER);
+    int fd = -1;
+
+    if (strlen(path) > sizeof(addr->sun_path) - 1)
+    {
+        MXS_ERROR("The path %s specified for the UNIX domain socket is too long. "
+                  "The maximum length is %lu.", path, sizeof(addr->sun_path) - 1);
+    }
+    else if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    {
+        MXS_ERROR("Can't create UNIX socket: %d, %s", errno, mxs_strerror(errno));
+    }
+    else
+    {
+        int one = 1;
+
+        if (type == MXS_SOCKET_LISTENER &&
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0)
+        {
+            MXS_ERROR("Failed to set socket option: %d, %s.", errno, mxs_strerror(errno));
+            close(fd);
+            fd = -1;
+        }
+        else if (setnonblocking(fd) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+        else
+        {
+            memset(addr, 0, sizeof(*addr));
+            addr->sun_family = AF_UNIX;
+            strcpy(addr->sun_path, path);
+        }
+    }
+
+    return fd;
+}
+
 /**
  * Return the number of processors available.
  * @return Number of processors or 1 if the required definition of _SC_NPROCESSORS_CONF
@@ -1056,3 +1098,17 @@ long get_processor_count()
 #endif
     return processors;
 }
+
+uint64_t mxs_clock_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+uint64_t mxs_clock_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
@@ -13,8 +13,10 @@
 
 #define MXS_MODULE_NAME "GSSAPIAuth"
 
+#include <inttypes.h>
 #include <maxscale/authenticator.h>
 #include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
 #include <maxscale/dcb.h>
 #include <maxscale/log_manager.h>
 #include <maxscale/protocol/mysql.h>
@@ -82,12 +84,38 @@ static int db_flags = SQLITE_OPEN_READWRITE |
                       SQLITE_OPEN_URI |
                       SQLITE_OPEN_SHAREDCACHE;
 
+/** Default number of cached principals */
+#define GSSAPI_DEFAULT_CACHE_SIZE 1024
+
+/** Number of slots a principal can be stored in */
+#define GSSAPI_CACHE_PROBES 4
+
+/**
+ * A client principal that was allowed to log in as a user from a host to a
+ * database. The key holds the user, the host, the database and the principal,
+ * each terminated by a NUL.
+ */
+typedef struct gssapi_princ
+{
+    uint64_t hash;           /**< Hash of the key, 0 for a free slot */
+    char     *key;           /**< The key */
+    size_t   key_len;        /**< Length of the key */
+    time_t   expires;        /**< When the entry expires */
+} GSSAPI_PRINC;
+
 /** The instance structure for the client side GSSAPI authenticator, created in
  *  gssapi_auth_init() */
 typedef struct gssapi_instance
 {
     char    *principal_name; /**< Service principal name given to the client */
     sqlite3 *handle;         /**< SQLite3 database handle */
+    gssapi_cred_cache_t credentials; /**< The acceptor credentials */
+    int     cache_ttl;       /**< Lifetime of the cached principals, 0 for no caching */
+    int     cache_size;      /**< Number of slots for principals */
+    GSSAPI_PRINC *princs;    /**< The validated principals */
+    SPINLOCK princ_lock;     /**< Protects princs */
+    uint64_t n_princ_hits;   /**< Number of logins validated by the cache */
+    uint64_t n_princ_misses; /**< Number of logins validated by the user database */
 } GSSAPI_INSTANCE;
 
 /**
@@ -106,6 +134,12 @@ void* gssapi_auth_init(char **options)
     if (instance)
     {
         instance->principal_name = NULL;
+        instance->cache_ttl = GSSAPI_DEFAULT_CACHE_TTL;
+        instance->cache_size = GSSAPI_DEFAULT_CACHE_SIZE;
+        instance->princs = NULL;
+        instance->n_princ_hits = 0;
+        instance->n_princ_misses = 0;
+        spinlock_init(&instance->princ_lock);
 
         if (sqlite3_open_v2(GSSAPI_DATABASE_NAME, &instance->handle, db_flags, NULL) != SQLITE_OK)
         {
@@ -136,6 +170,14 @@ void* gssapi_auth_init(char **options)
                     instance->principal_name = MXS_STRDUP_A(ptr);
                 }
             }
+            else if (strncmp(options[i], "cache_ttl=", 10) == 0)
+            {
+                instance->cache_ttl = atoi(options[i] + 10);
+            }
+            else if (strncmp(options[i], "cache_size=", 11) == 0)
+            {
+                instance->cache_size = atoi(options[i] + 11);
+            }
             else
             {
                 MXS_ERROR("Unknown option: %s", options[i]);
@@ -150,6 +192,14 @@ void* gssapi_auth_init(char **options)
             instance->principal_name = MXS_STRDUP_A(default_princ_name);
             MXS_NOTICE("Using default principal name: %s", instance->principal_name);
         }
+
+        gssapi_cred_cache_init(&instance->credentials, instance->cache_ttl);
+
+        if (instance->cache_ttl > 0 && instance->cache_size > 0)
+        {
+            instance->princs = MXS_CALLOC(instance->cache_size, sizeof(GSSAPI_PRINC));
+            MXS_ABORT_IF_NULL(instance->princs);
+        }
     }
 
     return instance;
@@ -313,87 +363,249 @@ bool gssapi_auth_connectssl(DCB *dcb)
     return protocol->client_capabilities & GW_MYSQL_CAPABILITIES_SSL;
 }
 
-static gss_name_t server_name = GSS_C_NO_NAME;
-
 /**
- * @brief Check if the client token is valid
+ * @brief Accept the client token
  *
- * @param token Client token
- * @param len Length of the token
+ * @param cred   The acceptor credentials
+ * @param token  Client token
+ * @param len    Length of the token
  * @param output Pointer where the client principal name is stored
- * @return True if client token is valid
+ * @return The GSSAPI major status
  */
-static bool validate_gssapi_token(char* principal, uint8_t* token, size_t len, char **output)
+static OM_uint32 accept_gssapi_token(gss_cred_id_t cred, uint8_t* token, size_t len, char **output)
 {
     OM_uint32 major = 0, minor = 0;
-    gss_buffer_desc server_buf = {0, 0};
-    gss_cred_id_t credentials;
-
-    server_buf.value = (void*)principal;
-    server_buf.length = strlen(principal) + 1;
-
-    major = gss_import_name(&minor, &server_buf, GSS_C_NT_USER_NAME, &server_name);
-
-    if (GSS_ERROR(major))
-    {
-        report_error(major, minor);
-        return false;
-    }
-
-    major = gss_acquire_cred(&minor, server_name, GSS_C_INDEFINITE,
-                             GSS_C_NO_OID_SET, GSS_C_ACCEPT,
-                             &credentials, NULL, NULL);
-    if (GSS_ERROR(major))
-    {
-        report_error(major, minor);
-        return false;
-    }
 
     do
     {
-
-        gss_ctx_id_t handle = NULL;
+        gss_ctx_id_t handle = GSS_C_NO_CONTEXT;
         gss_buffer_desc in = {0, 0};
         gss_buffer_desc out = {0, 0};
         gss_buffer_desc client_name = {0, 0};
         gss_OID_desc *oid;
-        gss_name_t client;
+        gss_name_t client = GSS_C_NO_NAME;
+        OM_uint32 tmp;
 
         in.value = token;
         in.length = len;
 
-        major = gss_accept_sec_context(&minor, &handle, GSS_C_NO_CREDENTIAL,
+        major = gss_accept_sec_context(&minor, &handle, cred,
                                        &in, GSS_C_NO_CHANNEL_BINDINGS,
                                        &client, &oid, &out,
                                        0, 0, NULL);
+        gss_release_buffer(&tmp, &out);
+        gss_delete_sec_context(&tmp, &handle, GSS_C_NO_BUFFER);
+
         if (GSS_ERROR(major))
         {
-            report_error(major, minor);
-            return false;
+            /** The caller reports the errors caused by the credentials */
+            if (!gssapi_is_cred_error(major))
+            {
+                report_error(major, minor);
+            }
+            return major;
         }
 
         major = gss_display_name(&minor, client, &client_name, NULL);
+        gss_release_name(&tmp, &client);
 
         if (GSS_ERROR(major))
         {
             report_error(major, minor);
-            return false;
+            return major;
         }
 
         char *princ_name = MXS_MALLOC(client_name.length + 1);
 
         if (!princ_name)
         {
-            return false;
+            gss_release_buffer(&tmp, &client_name);
+            return GSS_S_FAILURE;
         }
 
         memcpy(princ_name, (const char*)client_name.value, client_name.length);
         princ_name[client_name.length] = '\0';
+        gss_release_buffer(&tmp, &client_name);
+        MXS_FREE(*output);
         *output = princ_name;
     }
     while (major & GSS_S_CONTINUE_NEEDED);
 
-    return true;
+    return major;
+}
+
+/**
+ * @brief Check if the client token is valid
+ *
+ * The token is always accepted by GSSAPI, as a token can't be used twice, but
+ * the acceptor credentials read from the keytab are shared by the connections.
+ *
+ * @param instance Authenticator instance
+ * @param token    Client token
+ * @param len      Length of the token
+ * @param output   Pointer where the client principal name is stored
+ * @return True if client token is valid
+ */
+static bool validate_gssapi_token(GSSAPI_INSTANCE *instance, uint8_t* token, size_t len, char **output)
+{
+    bool rval = false;
+    bool refresh = false;
+
+    /** Retry once with new credentials if the shared ones have gone stale */
+    for (int i = 0; i < 2 && !rval; i++)
+    {
+        gssapi_cred_t *cred = gssapi_cred_get(&instance->credentials, instance->principal_name,
+                                              GSS_C_ACCEPT, refresh);
+
+        if (cred == NULL)
+        {
+            break;
+        }
+
+        OM_uint32 major = accept_gssapi_token(cred->cred, token, len, output);
+        gssapi_cred_put(cred);
+
+        if (!GSS_ERROR(major))
+        {
+            rval = true;
+        }
+        else if (gssapi_is_cred_error(major) && !refresh)
+        {
+            refresh = true;
+        }
+        else
+        {
+            if (gssapi_is_cred_error(major))
+            {
+                report_error(major, 0);
+            }
+            break;
+        }
+    }
+
+    return rval;
+}
+
+/**
+ * @brief Calculate the hash of a principal cache key
+ *
+ * @param key The key
+ * @param len Length of the key
+ * @return The hash, never 0
+ */
+static uint64_t princ_hash(const char *key, size_t len)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= (uint8_t)key[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash ? hash : 1;
+}
+
+/**
+ * @brief Check whether a login was validated recently
+ *
+ * @param instance Authenticator instance
+ * @param key      The user, host, database and principal
+ * @param len      Length of the key
+ * @return True if the login is in the cache and has not expired
+ */
+static bool princ_cache_find(GSSAPI_INSTANCE *instance, const char *key, size_t len)
+{
+    uint64_t hash = princ_hash(key, len);
+    time_t now = time(NULL);
+    bool rval = false;
+
+    spinlock_acquire(&instance->princ_lock);
+
+    for (int i = 0; i < GSSAPI_CACHE_PROBES && i < instance->cache_size; i++)
+    {
+        GSSAPI_PRINC *princ = &instance->princs[(hash + i) % instance->cache_size];
+
+        if (princ->hash == hash && princ->key_len == len && memcmp(princ->key, key, len) == 0)
+        {
+            rval = princ->expires > now;
+            break;
+        }
+    }
+
+    spinlock_release(&instance->princ_lock);
+    return rval;
+}
+
+/**
+ * @brief Store a validated login
+ *
+ * The login replaces the one that expires first of the slots it can be stored in.
+ *
+ * @param instance Authenticator instance
+ * @param key      The user, host, database and principal
+ * @param len      Length of the key
+ */
+static void princ_cache_add(GSSAPI_INSTANCE *instance, const char *key, size_t len)
+{
+    char *copy = MXS_MALLOC(len);
+
+    if (copy == NULL)
+    {
+        return;
+    }
+
+    memcpy(copy, key, len);
+    uint64_t hash = princ_hash(key, len);
+    GSSAPI_PRINC *victim = NULL;
+
+    spinlock_acquire(&instance->princ_lock);
+
+    for (int i = 0; i < GSSAPI_CACHE_PROBES && i < instance->cache_size; i++)
+    {
+        GSSAPI_PRINC *princ = &instance->princs[(hash + i) % instance->cache_size];
+
+        if (princ->hash == hash && princ->key_len == len && memcmp(princ->key, key, len) == 0)
+        {
+            victim = princ;
+            break;
+        }
+        else if (victim == NULL || princ->expires < victim->expires)
+        {
+            victim = princ;
+        }
+    }
+
+    MXS_FREE(victim->key);
+    victim->hash = hash;
+    victim->key = copy;
+    victim->key_len = len;
+    victim->expires = time(NULL) + instance->cache_ttl;
+
+    spinlock_release(&instance->princ_lock);
+}
+
+/**
+ * @brief Remove all principals from the cache
+ *
+ * @param instance Authenticator instance
+ */
+static void princ_cache_clear(GSSAPI_INSTANCE *instance)
+{
+    if (instance->princs == NULL)
+    {
+        return;
+    }
+
+    spinlock_acquire(&instance->princ_lock);
+
+    for (int i = 0; i < instance->cache_size; i++)
+    {
+        MXS_FREE(instance->princs[i].key);
+        memset(&instance->princs[i], 0, sizeof(GSSAPI_PRINC));
+    }
+
+    spinlock_release(&instance->princ_lock);
 }
 
 /** @brief Callback for sqlite3_exec() */
@@ -413,9 +625,27 @@ static int auth_cb(void *data, int columns, char** rows, char** row_names)
  * @param princ Client principal name
  * @return True if the user has access to the database
  */
-static bool validate_user(gssapi_auth_t *auth, DCB *dcb, MYSQL_session *session, const char *princ)
+static bool validate_user(GSSAPI_INSTANCE *instance, gssapi_auth_t *auth, DCB *dcb,
+                          MYSQL_session *session, const char *princ)
 {
     ss_dassert(princ);
+    size_t key_len = strlen(session->user) + strlen(dcb->remote) + strlen(session->db) +
+                     strlen(princ) + 4;
+    char key[key_len];
+    sprintf(key, "%s%c%s%c%s%c%s", session->user, '\0', dcb->remote, '\0',
+            session->db, '\0', princ);
+
+    if (instance->princs)
+    {
+        if (princ_cache_find(instance, key, key_len))
+        {
+            atomic_add_uint64(&instance->n_princ_hits, 1);
+            return true;
+        }
+
+        atomic_add_uint64(&instance->n_princ_misses, 1);
+    }
+
     size_t len = sizeof(gssapi_auth_query) + strlen(session->user) * 2 +
                  strlen(session->db) * 2 + strlen(dcb->remote) + strlen(princ) * 2;
     char sql[len + 1];
@@ -452,6 +682,11 @@ static bool validate_user(gssapi_auth_t *auth, DCB *dcb, MYSQL_session *session,
         }
     }
 
+    if (rval && instance->princs)
+    {
+        princ_cache_add(instance, key, key_len);
+    }
+
     return rval;
 }
 
@@ -490,8 +725,8 @@ int gssapi_auth_authenticate(DCB *dcb)
         MYSQL_session *ses = (MYSQL_session*)dcb->data;
         char *princ = NULL;
 
-        if (validate_gssapi_token(instance->principal_name, ses->auth_token, ses->auth_token_len, &princ) &&
-            validate_user(auth, dcb, ses, princ))
+        if (validate_gssapi_token(instance, ses->auth_token, ses->auth_token_len, &princ) &&
+            validate_user(instance, auth, dcb, ses, princ))
         {
             rval = MXS_AUTH_SUCCEEDED;
         }
@@ -625,6 +860,8 @@ int gssapi_auth_load_users(SERV_LISTENER *listener)
                     MYSQL_RES *res = mysql_store_result(mysql);
 
                     delete_old_users(inst->handle);
+                    /** The privileges of the cached principals may have changed */
+                    princ_cache_clear(inst);
 
                     if (res)
                     {
@@ -663,6 +900,29 @@ int gssapi_auth_load_users(SERV_LISTENER *listener)
     return rval;
 }
 
+/**
+ * @brief Print the users and the cache statistics
+ *
+ * @param dcb  DCB to print to
+ * @param port Listener
+ */
+void gssapi_auth_diagnostic(DCB *dcb, SERV_LISTENER *port)
+{
+    GSSAPI_INSTANCE *instance = (GSSAPI_INSTANCE*)port->auth_instance;
+
+    users_default_diagnostic(dcb, port);
+
+    if (instance)
+    {
+        dcb_printf(dcb, "GSSAPI credentials acquired: %" PRIu64 "\n",
+                   instance->credentials.n_acquired);
+        dcb_printf(dcb, "GSSAPI credentials reused: %" PRIu64 "\n",
+                   instance->credentials.n_reused);
+        dcb_printf(dcb, "GSSAPI principal cache hits: %" PRIu64 "\n", instance->n_princ_hits);
+        dcb_printf(dcb, "GSSAPI principal cache misses: %" PRIu64 "\n", instance->n_princ_misses);
+    }
+}
+
 /**
  * Module handle entry point
  */
@@ -678,7 +938,7 @@ MXS_MODULE* MXS_CREATE_MODULE()
         gssapi_auth_free_data,           /* Free the client data held in DCB */
         gssapi_auth_free,                /* Free authenticator data */
         gssapi_auth_load_users,          /* Load database users */
-        users_default_diagnostic,        /* Default user diagnostic */
+        gssapi_auth_diagnostic,          /* User and cache diagnostic */
         NULL                             /* No user reauthentication */
     };
 
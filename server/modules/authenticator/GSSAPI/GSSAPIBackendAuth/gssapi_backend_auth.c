@@ -24,6 +24,20 @@
  * @file gssapi_backend_auth.c - GSSAPI backend authenticator
  */
 
+/** The initiator credentials of MaxScale, shared by the backend connections */
+static gssapi_cred_cache_t initiator_credentials;
+
+static int gssapi_backend_process_init()
+{
+    gssapi_cred_cache_init(&initiator_credentials, GSSAPI_DEFAULT_CACHE_TTL);
+    return 0;
+}
+
+static void gssapi_backend_process_finish()
+{
+    gssapi_cred_cache_free(&initiator_credentials);
+}
+
 void* gssapi_backend_auth_alloc(void *instance)
 {
     gssapi_auth_t* rval = MXS_MALLOC(sizeof(gssapi_auth_t));
@@ -77,10 +91,29 @@ static bool send_new_auth_token(DCB *dcb)
         report_error(major, minor);
     }
 
-    /** Request the token for the service */
-    major = gss_init_sec_context(&minor, GSS_C_NO_CREDENTIAL,
-                                 &handle, princ, GSS_C_NO_OID, 0, 0,
-                                 GSS_C_NO_CHANNEL_BINDINGS, &in, NULL, &out, 0, 0);
+    /**
+     * Request the token for the service. A token can only be used once but
+     * the credentials are shared, the negotiation is retried once with new
+     * credentials if the shared ones have gone stale.
+     */
+    for (int i = 0; i < 2; i++)
+    {
+        gssapi_cred_t *cred = gssapi_cred_get(&initiator_credentials, NULL, GSS_C_INITIATE, i > 0);
+
+        major = gss_init_sec_context(&minor, cred ? cred->cred : GSS_C_NO_CREDENTIAL,
+                                     &handle, princ, GSS_C_NO_OID, 0, 0,
+                                     GSS_C_NO_CHANNEL_BINDINGS, &in, NULL, &out, 0, 0);
+        gssapi_cred_put(cred);
+
+        if (!GSS_ERROR(major) || !cred || !gssapi_is_cred_error(major))
+        {
+            break;
+        }
+
+        OM_uint32 tmp;
+        gss_delete_sec_context(&tmp, &handle, GSS_C_NO_BUFFER);
+    }
+
     if (GSS_ERROR(major))
     {
         report_error(major, minor);
@@ -104,6 +137,8 @@ static bool send_new_auth_token(DCB *dcb)
             }
         }
 
+        gss_release_buffer(&minor, &out);
+
         major = gss_delete_sec_context(&minor, &handle, &in);
 
         if (GSS_ERROR(major))
@@ -289,8 +324,8 @@ MXS_MODULE* MXS_CREATE_MODULE()
         "GSSAPI backend authenticator",
         "V1.0.0",
         &MyObject,
-        NULL, /* Process init. */
-        NULL, /* Process finish. */
+        gssapi_backend_process_init, /* Process init. */
+        gssapi_backend_process_finish, /* Process finish. */
         NULL, /* Thread init. */
         NULL, /* Thread finish. */
         { { MXS_END_MODULE_PARAMS} }
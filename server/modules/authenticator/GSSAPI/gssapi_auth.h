@@ -17,7 +17,9 @@
 #include <maxscale/cdefs.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <time.h>
 #include <gssapi.h>
+#include <maxscale/spinlock.h>
 #include <maxscale/sqlite3.h>
 
 MXS_BEGIN_DECLS
@@ -28,6 +30,9 @@ static const char auth_plugin_name[] = "auth_gssapi_client";
 /** This is mainly for testing purposes */
 static const char default_princ_name[] = "mariadb/localhost.localdomain";
 
+/** Default lifetime of the cached credentials and principals in seconds */
+#define GSSAPI_DEFAULT_CACHE_TTL 60
+
 /** GSSAPI authentication states */
 enum gssapi_auth_state
 {
@@ -47,9 +52,75 @@ typedef struct gssapi_auth
     sqlite3 *handle;              /**< SQLite3 database handle */
 } gssapi_auth_t;
 
+/** GSSAPI credentials shared by the connections */
+typedef struct gssapi_cred
+{
+    gss_cred_id_t cred;           /**< The credentials */
+    int refcount;                 /**< Number of users, the cache holds one */
+    time_t expires;               /**< When the cache stops handing them out */
+} gssapi_cred_t;
+
+/**
+ * The credentials of MaxScale, the acceptor credentials read from the keytab
+ * for the client side and the initiator credentials for the backend side.
+ * Acquiring them on each connection reads the keytab or the credential cache
+ * every time.
+ */
+typedef struct gssapi_cred_cache
+{
+    SPINLOCK lock;                /**< Protects cred */
+    gssapi_cred_t *cred;          /**< The current credentials or NULL */
+    int ttl;                      /**< Lifetime of the credentials, 0 to not share them */
+    uint64_t n_acquired;          /**< Number of times the credentials were acquired */
+    uint64_t n_reused;            /**< Number of times the shared credentials were used */
+} gssapi_cred_cache_t;
+
 /** Report GSSAPI errors */
 void report_error(OM_uint32 major, OM_uint32 minor);
 
+/**
+ * @brief Initialize a credential cache
+ *
+ * @param cache Cache to initialize
+ * @param ttl   Lifetime of the credentials in seconds, 0 to acquire them
+ *              for every connection
+ */
+void gssapi_cred_cache_init(gssapi_cred_cache_t *cache, int ttl);
+
+/**
+ * @brief Get the credentials
+ *
+ * @param cache     The cache
+ * @param principal The principal of the credentials, NULL for the default one
+ * @param usage     GSS_C_ACCEPT or GSS_C_INITIATE
+ * @param refresh   Acquire new credentials even if the cached ones have not expired
+ * @return The credentials that must be given to gssapi_cred_put() or NULL on error
+ */
+gssapi_cred_t* gssapi_cred_get(gssapi_cred_cache_t *cache, const char *principal,
+                               gss_cred_usage_t usage, bool refresh);
+
+/**
+ * @brief Release credentials returned by gssapi_cred_get()
+ *
+ * @param cred The credentials
+ */
+void gssapi_cred_put(gssapi_cred_t *cred);
+
+/**
+ * @brief Release the cached credentials
+ *
+ * @param cache The cache
+ */
+void gssapi_cred_cache_free(gssapi_cred_cache_t *cache);
+
+/**
+ * @brief Check whether a GSSAPI error is caused by the credentials
+ *
+ * @param major GSSAPI major error number
+ * @return True if acquiring new credentials may fix the error
+ */
+bool gssapi_is_cred_error(OM_uint32 major);
+
 MXS_END_DECLS
 
 #endif
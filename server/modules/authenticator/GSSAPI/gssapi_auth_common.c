@@ -13,6 +13,7 @@
 
 #include "gssapi_auth.h"
 #include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
 #include <maxscale/log_manager.h>
 
 /**
@@ -46,3 +47,141 @@ void report_error(OM_uint32 major, OM_uint32 minor)
         MXS_ERROR("GSSAPI Minor Error: %s", sbuf);
     }
 }
+
+void gssapi_cred_cache_init(gssapi_cred_cache_t *cache, int ttl)
+{
+    spinlock_init(&cache->lock);
+    cache->cred = NULL;
+    cache->ttl = ttl;
+    cache->n_acquired = 0;
+    cache->n_reused = 0;
+}
+
+/**
+ * @brief Acquire new credentials
+ *
+ * @param principal The principal of the credentials, NULL for the default one
+ * @param usage     GSS_C_ACCEPT or GSS_C_INITIATE
+ * @return The credentials with one reference or NULL on error
+ */
+static gssapi_cred_t* acquire_cred(const char *principal, gss_cred_usage_t usage)
+{
+    OM_uint32 major = 0, minor = 0;
+    gss_name_t name = GSS_C_NO_NAME;
+
+    if (principal)
+    {
+        gss_buffer_desc buf = {0, 0};
+        buf.value = (void*)principal;
+        buf.length = strlen(principal) + 1;
+
+        major = gss_import_name(&minor, &buf, GSS_C_NT_USER_NAME, &name);
+
+        if (GSS_ERROR(major))
+        {
+            report_error(major, minor);
+            return NULL;
+        }
+    }
+
+    gss_cred_id_t handle = GSS_C_NO_CREDENTIAL;
+    major = gss_acquire_cred(&minor, name, GSS_C_INDEFINITE, GSS_C_NO_OID_SET,
+                             usage, &handle, NULL, NULL);
+
+    if (name != GSS_C_NO_NAME)
+    {
+        OM_uint32 tmp;
+        gss_release_name(&tmp, &name);
+    }
+
+    if (GSS_ERROR(major))
+    {
+        report_error(major, minor);
+        return NULL;
+    }
+
+    gssapi_cred_t *cred = MXS_MALLOC(sizeof(gssapi_cred_t));
+
+    if (cred == NULL)
+    {
+        gss_release_cred(&minor, &handle);
+        return NULL;
+    }
+
+    cred->cred = handle;
+    cred->refcount = 1;
+    cred->expires = 0;
+    return cred;
+}
+
+void gssapi_cred_put(gssapi_cred_t *cred)
+{
+    if (cred && atomic_add(&cred->refcount, -1) == 1)
+    {
+        OM_uint32 minor;
+        gss_release_cred(&minor, &cred->cred);
+        MXS_FREE(cred);
+    }
+}
+
+gssapi_cred_t* gssapi_cred_get(gssapi_cred_cache_t *cache, const char *principal,
+                               gss_cred_usage_t usage, bool refresh)
+{
+    if (cache->ttl <= 0)
+    {
+        atomic_add_uint64(&cache->n_acquired, 1);
+        return acquire_cred(principal, usage);
+    }
+
+    time_t now = time(NULL);
+    gssapi_cred_t *old = NULL;
+    gssapi_cred_t *cred = NULL;
+
+    spinlock_acquire(&cache->lock);
+
+    if (cache->cred && (refresh || cache->cred->expires <= now))
+    {
+        old = cache->cred;
+        cache->cred = NULL;
+    }
+    else if (cache->cred)
+    {
+        cred = cache->cred;
+        atomic_add(&cred->refcount, 1);
+        cache->n_reused++;
+    }
+
+    spinlock_release(&cache->lock);
+    gssapi_cred_put(old);
+
+    if (cred == NULL && (cred = acquire_cred(principal, usage)))
+    {
+        /** The keytab is read without holding the lock */
+        cred->expires = now + cache->ttl;
+        atomic_add(&cred->refcount, 1);
+
+        spinlock_acquire(&cache->lock);
+        cache->n_acquired++;
+
+        /** Another thread may have cached credentials meanwhile */
+        old = cache->cred;
+        cache->cred = cred;
+        spinlock_release(&cache->lock);
+        gssapi_cred_put(old);
+    }
+
+    return cred;
+}
+
+void gssapi_cred_cache_free(gssapi_cred_cache_t *cache)
+{
+    gssapi_cred_put(cache->cred);
+    cache->cred = NULL;
+}
+
+bool gssapi_is_cred_error(OM_uint32 major)
+{
+    OM_uint32 routine = GSS_ROUTINE_ERROR(major);
+    return routine == GSS_S_NO_CRED || routine == GSS_S_CREDENTIALS_EXPIRED ||
+           routine == GSS_S_DEFECTIVE_CREDENTIAL;
+}
@@ -32,6 +32,9 @@
 #include <maxscale/mysql_utils.h>
 #include <maxscale/alloc.h>
 #include <maxscale/paths.h>
+#include <maxscale/atomic.h>
+#include <maxscale/hashtable.h>
+#include <maxscale/thread.h>
 
 /** Don't include the root user */
 #define USERS_QUERY_NO_ROOT " AND user.user NOT IN ('root')"
@@ -51,6 +54,7 @@
     ON (u.user = t.user AND u.host = t.host) WHERE u.plugin IN ('', 'mysql_native_password') %s"
 
 static int get_users(SERV_LISTENER *listener, bool skip_local);
+static void add_database(sqlite3 *handle, const char *db);
 static MYSQL *gw_mysql_init(void);
 static int gw_mysql_set_timeouts(MYSQL* handle);
 static char *mysql_format_user_entry(void *data);
@@ -128,106 +132,392 @@ static bool check_password(const char *output, uint8_t *token, size_t token_len,
     return memcmp(final_step, stored_token, stored_token_len) == 0;
 }
 
-/** Callback for check_database() */
-static int database_cb(void *data, int columns, char** rows, char** row_names)
+/**
+ * @brief Match a string against a LIKE pattern
+ *
+ * The pattern is matched like SQLite matches it: '%' matches any sequence of
+ * characters, '_' matches any one character and ASCII letters are compared
+ * case-insensitively.
+ *
+ * @param pattern The pattern
+ * @param str     The string to match
+ *
+ * @return True if the string matches the pattern
+ */
+static bool like_match(const char *pattern, const char *str)
+{
+    const char *star = NULL;
+    const char *resume = NULL;
+
+    while (*str)
+    {
+        if (*pattern == '%')
+        {
+            /** Remember the position so that the wildcard can consume more characters */
+            star = ++pattern;
+            resume = str;
+        }
+        else if (*pattern && (*pattern == '_' || tolower((unsigned char)*pattern) == tolower((unsigned char)*str)))
+        {
+            pattern++;
+            str++;
+        }
+        else if (star)
+        {
+            pattern = star;
+            str = ++resume;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    while (*pattern == '%')
+    {
+        pattern++;
+    }
+
+    return *pattern == '\0';
+}
+
+static size_t index_bucket(const MYSQL_USER_INDEX *index, const char *name)
+{
+    return (unsigned int)hashtable_item_strhash(name) & (index->n_buckets - 1);
+}
+
+static MYSQL_USER_INDEX* acquire_user_index(MYSQL_AUTH *instance)
+{
+    spinlock_acquire(&instance->index_lock);
+    MYSQL_USER_INDEX *index = instance->index;
+
+    if (index)
+    {
+        atomic_add(&index->refcount, 1);
+    }
+
+    spinlock_release(&instance->index_lock);
+    return index;
+}
+
+static void release_user_index(MYSQL_USER_INDEX *index)
+{
+    if (index && atomic_add(&index->refcount, -1) == 1)
+    {
+        for (size_t i = 0; i < index->n_users; i++)
+        {
+            MXS_FREE(index->users[i].user);
+            MXS_FREE(index->users[i].host);
+            MXS_FREE(index->users[i].db);
+            MXS_FREE(index->users[i].password);
+        }
+
+        for (size_t i = 0; i < index->n_dbs; i++)
+        {
+            MXS_FREE(index->dbs[i].name);
+        }
+
+        MXS_FREE(index->users);
+        MXS_FREE(index->user_buckets);
+        MXS_FREE(index->dbs);
+        MXS_FREE(index->db_buckets);
+        MXS_FREE(index);
+    }
+}
+
+/** Rows of the SQLite database read into an index that is being built */
+struct index_rows
+{
+    MYSQL_USER_INDEX *index;
+    size_t users_size;
+    size_t dbs_size;
+    bool error;
+};
+
+/** @brief Callback for the users query of update_user_index() */
+static int index_user_cb(void *data, int columns, char** rows, char** row_names)
 {
-    bool *rval = (bool*)data;
-    *rval = true;
+    struct index_rows *res = (struct index_rows*)data;
+    MYSQL_USER_INDEX *index = res->index;
+
+    if (index->n_users == res->users_size)
+    {
+        size_t size = res->users_size ? res->users_size * 2 : 64;
+        MYSQL_USER_ENTRY *users = MXS_REALLOC(index->users, size * sizeof(MYSQL_USER_ENTRY));
+
+        if (users == NULL)
+        {
+            res->error = true;
+            return 1;
+        }
+
+        index->users = users;
+        res->users_size = size;
+    }
+
+    MYSQL_USER_ENTRY *entry = &index->users[index->n_users];
+    const char *host = rows[1] ? rows[1] : "";
+
+    entry->user = MXS_STRDUP(rows[0] ? rows[0] : "");
+    entry->host = MXS_STRDUP(host);
+    entry->db = rows[2] ? MXS_STRDUP(rows[2]) : NULL;
+    entry->password = MXS_STRDUP(rows[4] ? rows[4] : "");
+    entry->anydb = rows[3] && strcmp(rows[3], "1") == 0;
+    entry->rowid = strtoll(rows[5], NULL, 10);
+    entry->next = NULL;
+
+    if (strcmp(host, "%") == 0)
+    {
+        entry->match = MYSQL_HOST_ANY;
+    }
+    else if (strpbrk(host, "%_"))
+    {
+        entry->match = MYSQL_HOST_PATTERN;
+    }
+    else
+    {
+        entry->match = MYSQL_HOST_EXACT;
+    }
+
+    /** Added before checking so that the entry is freed with the index */
+    index->n_users++;
+
+    if (!entry->user || !entry->host || !entry->password || (rows[2] && !entry->db))
+    {
+        res->error = true;
+        return 1;
+    }
+
     return 0;
 }
 
-static bool check_database(sqlite3 *handle, const char *database)
+/** @brief Callback for the databases query of update_user_index() */
+static int index_db_cb(void *data, int columns, char** rows, char** row_names)
 {
-    bool rval = true;
+    struct index_rows *res = (struct index_rows*)data;
+    MYSQL_USER_INDEX *index = res->index;
 
-    if (*database)
+    if (rows[0] == NULL)
     {
-        rval = false;
-        size_t len = sizeof(mysqlauth_validate_database_query) + strlen(database) + 1;
-        char sql[len];
+        return 0;
+    }
+
+    if (index->n_dbs == res->dbs_size)
+    {
+        size_t size = res->dbs_size ? res->dbs_size * 2 : 64;
+        MYSQL_DB_ENTRY *dbs = MXS_REALLOC(index->dbs, size * sizeof(MYSQL_DB_ENTRY));
+
+        if (dbs == NULL)
+        {
+            res->error = true;
+            return 1;
+        }
+
+        index->dbs = dbs;
+        res->dbs_size = size;
+    }
 
-        sprintf(sql, mysqlauth_validate_database_query, database);
+    MYSQL_DB_ENTRY *entry = &index->dbs[index->n_dbs];
+    entry->rowid = strtoll(rows[1], NULL, 10);
+    entry->next = NULL;
 
-        char *err;
+    if ((entry->name = MXS_STRDUP(rows[0])) == NULL)
+    {
+        res->error = true;
+        return 1;
+    }
 
-        if (sqlite3_exec(handle, sql, database_cb, &rval, &err) != SQLITE_OK)
+    index->n_dbs++;
+    return 0;
+}
+
+bool update_user_index(MYSQL_AUTH *instance)
+{
+    MYSQL_USER_INDEX *index = MXS_CALLOC(1, sizeof(MYSQL_USER_INDEX));
+
+    if (index == NULL)
+    {
+        return false;
+    }
+
+    index->refcount = 1;
+    struct index_rows res = {.index = index};
+    char *err = NULL;
+
+    if (sqlite3_exec(instance->handle, index_users_query, index_user_cb, &res, &err) != SQLITE_OK ||
+        sqlite3_exec(instance->handle, index_databases_query, index_db_cb, &res, &err) != SQLITE_OK)
+    {
+        if (err)
         {
-            MXS_ERROR("Failed to execute auth query: %s", err);
+            MXS_ERROR("Failed to read the users for the user index: %s", err);
             sqlite3_free(err);
-            rval = false;
         }
+
+        release_user_index(index);
+        instance->index_stale = true;
+        return false;
     }
 
-    return rval;
+    size_t n = MXS_MAX(index->n_users, index->n_dbs);
+    index->n_buckets = 16;
+
+    while (index->n_buckets < n * 2)
+    {
+        index->n_buckets *= 2;
+    }
+
+    index->user_buckets = MXS_CALLOC(index->n_buckets, sizeof(MYSQL_USER_ENTRY*));
+    index->db_buckets = MXS_CALLOC(index->n_buckets, sizeof(MYSQL_DB_ENTRY*));
+
+    if (index->user_buckets == NULL || index->db_buckets == NULL)
+    {
+        release_user_index(index);
+        instance->index_stale = true;
+        return false;
+    }
+
+    /** Added in reverse so that the grants of a user stay in the order they were added */
+    for (size_t i = index->n_users; i > 0; i--)
+    {
+        MYSQL_USER_ENTRY *entry = &index->users[i - 1];
+        size_t bucket = index_bucket(index, entry->user);
+        entry->next = index->user_buckets[bucket];
+        index->user_buckets[bucket] = entry;
+    }
+
+    for (size_t i = 0; i < index->n_dbs; i++)
+    {
+        MYSQL_DB_ENTRY *entry = &index->dbs[i];
+        size_t bucket = index_bucket(index, entry->name);
+        entry->next = index->db_buckets[bucket];
+        index->db_buckets[bucket] = entry;
+    }
+
+    spinlock_acquire(&instance->index_lock);
+    MYSQL_USER_INDEX *old = instance->index;
+    instance->index = index;
+    instance->index_stale = false;
+    spinlock_release(&instance->index_lock);
+
+    release_user_index(old);
+    return true;
 }
 
-static bool no_password_required(const char *result, size_t tok_len)
+static bool check_database(const MYSQL_USER_INDEX *index, const char *database)
 {
-    return *result == '\0' && tok_len == 0;
+    if (*database == '\0')
+    {
+        return true;
+    }
+
+    for (MYSQL_DB_ENTRY *entry = index->db_buckets[index_bucket(index, database)];
+         entry; entry = entry->next)
+    {
+        if (strcmp(entry->name, database) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
 }
 
-/** Used to detect empty result sets */
-struct user_query_result
+/**
+ * @brief Find the first grant that matches a client
+ *
+ * @param index    The user index
+ * @param user     User name
+ * @param host     Client address or hostname, NULL to match all hosts
+ * @param database Default database of the client, empty if none
+ *
+ * @return The grant or NULL if none matches
+ */
+static const MYSQL_USER_ENTRY* find_user(const MYSQL_USER_INDEX *index, const char *user,
+                                         const char *host, const char *database)
 {
-    bool ok;
-    char output[SHA_DIGEST_LENGTH * 2 + 1];
-};
+    for (MYSQL_USER_ENTRY *entry = index->user_buckets[index_bucket(index, user)];
+         entry; entry = entry->next)
+    {
+        if (strcmp(entry->user, user) != 0)
+        {
+            continue;
+        }
+
+        if (host && entry->match != MYSQL_HOST_ANY &&
+            strcmp(entry->host, host) != 0 &&
+            !(entry->match == MYSQL_HOST_EXACT ? strcasecmp(entry->host, host) == 0 :
+              like_match(entry->host, host)))
+        {
+            continue;
+        }
+
+        if (entry->anydb || *database == '\0' ||
+            (entry->db && like_match(entry->db, database)))
+        {
+            return entry;
+        }
+    }
 
-/** @brief Callback for sqlite3_exec() */
-static int auth_cb(void *data, int columns, char** rows, char** row_names)
+    return NULL;
+}
+
+/**
+ * @brief Check whether the index has a user name
+ *
+ * @param index The user index
+ * @param user  User name
+ *
+ * @return True if the index has a grant for the user
+ */
+static bool has_user(const MYSQL_USER_INDEX *index, const char *user)
 {
-    struct user_query_result *res = (struct user_query_result*)data;
-    strcpy(res->output, rows[0] ? rows[0] : "");
-    res->ok = true;
-    return 0;
+    for (MYSQL_USER_ENTRY *entry = index->user_buckets[index_bucket(index, user)];
+         entry; entry = entry->next)
+    {
+        if (strcmp(entry->user, user) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool no_password_required(const char *result, size_t tok_len)
+{
+    return *result == '\0' && tok_len == 0;
 }
 
 int validate_mysql_user(MYSQL_AUTH* instance, DCB *dcb, MYSQL_session *session,
                         uint8_t *scramble, size_t scramble_len)
 {
-    sqlite3 *handle = instance->handle;
-    const char* validate_query = instance->lower_case_table_names ?
-        mysqlauth_validate_user_query_lower :
-        mysqlauth_validate_user_query;
-    size_t len = strlen(validate_query) + 1 + strlen(session->user) * 2 +
-                 strlen(session->db) * 2 + MYSQL_HOST_MAXLEN + session->auth_token_len * 4 + 1;
-    char sql[len + 1];
+    MYSQL_USER_INDEX *index = acquire_user_index(instance);
     int rval = MXS_AUTH_FAILED;
-    char *err;
 
-    if (instance->skip_auth)
-    {
-        sprintf(sql, mysqlauth_skip_auth_query, session->user, session->db, session->db);
-    }
-    else
+    if (index == NULL)
     {
-        sprintf(sql, validate_query, session->user, dcb->remote,
-                dcb->remote, session->db, session->db);
+        return rval;
     }
 
-    struct user_query_result res = {};
+    const MYSQL_USER_ENTRY *entry;
 
-    if (sqlite3_exec(handle, sql, auth_cb, &res, &err) != SQLITE_OK)
+    if (instance->skip_auth)
     {
-        MXS_ERROR("Failed to execute auth query: %s", err);
-        sqlite3_free(err);
+        entry = find_user(index, session->user, NULL, session->db);
+    }
+    else
+    {
+        entry = find_user(index, session->user, dcb->remote, session->db);
     }
 
     /** Check for IPv6 mapped IPv4 address */
-    if (!res.ok && strchr(dcb->remote, ':') && strchr(dcb->remote, '.'))
+    if (!entry && strchr(dcb->remote, ':') && strchr(dcb->remote, '.'))
     {
         const char *ipv4 = strrchr(dcb->remote, ':') + 1;
-        sprintf(sql, validate_query, session->user, ipv4, ipv4,
-                session->db, session->db);
-
-        if (sqlite3_exec(handle, sql, auth_cb, &res, &err) != SQLITE_OK)
-        {
-            MXS_ERROR("Failed to execute auth query: %s", err);
-            sqlite3_free(err);
-        }
+        entry = find_user(index, session->user, ipv4, session->db);
     }
 
-    if (!res.ok)
+    if (!entry && has_user(index, session->user))
     {
         /**
          * Try authentication with the hostname instead of the IP. We do this only
@@ -235,27 +525,19 @@ int validate_mysql_user(MYSQL_AUTH* instance, DCB *dcb, MYSQL_session *session,
          */
         char client_hostname[MYSQL_HOST_MAXLEN] = "";
         get_hostname(dcb, client_hostname, sizeof(client_hostname) - 1);
-
-        sprintf(sql, validate_query, session->user, client_hostname,
-                client_hostname, session->db, session->db);
-
-        if (sqlite3_exec(handle, sql, auth_cb, &res, &err) != SQLITE_OK)
-        {
-            MXS_ERROR("Failed to execute auth query: %s", err);
-            sqlite3_free(err);
-        }
+        entry = find_user(index, session->user, client_hostname, session->db);
     }
 
-    if (res.ok)
+    if (entry)
     {
-        /** Found a matching row */
+        /** Found a matching grant */
 
-        if (no_password_required(res.output, session->auth_token_len) ||
-            check_password(res.output, session->auth_token, session->auth_token_len,
+        if (no_password_required(entry->password, session->auth_token_len) ||
+            check_password(entry->password, session->auth_token, session->auth_token_len,
                            scramble, scramble_len, session->client_sha1))
         {
             /** Password is OK, check that the database exists */
-            if (check_database(handle, session->db))
+            if (check_database(index, session->db))
             {
                 rval = MXS_AUTH_SUCCEEDED;
             }
@@ -266,6 +548,7 @@ int validate_mysql_user(MYSQL_AUTH* instance, DCB *dcb, MYSQL_session *session,
         }
     }
 
+    release_user_index(index);
     return rval;
 }
 
@@ -752,65 +1035,204 @@ void commit_sqlite_transaction(sqlite3 *handle)
     }
 }
 
-int get_users_from_server(MYSQL *con, SERVER_REF *server, SERVICE *service, SERV_LISTENER *listener)
+/** The users and databases fetched from one server */
+struct user_fetch
 {
-    if (server->server->server_string == NULL)
+    SERVICE    *service;
+    SERVER_REF *server;
+    const char *user;       /**< Service user */
+    const char *password;   /**< Decrypted password of the service user */
+    MYSQL      *con;        /**< Connection to the server, NULL if connecting failed */
+    MYSQL_RES  *users;      /**< Result of the users query */
+    MYSQL_RES  *dbs;        /**< Result of SHOW DATABASES */
+    THREAD     thread;      /**< Thread that fetches the users */
+    bool       own_thread;  /**< The users are fetched in a thread of their own */
+};
+
+/**
+ * @brief Fetch the users and the databases from a server
+ *
+ * The results are stored in the fetch and are applied to the user database
+ * by the thread that loads the users. Can be run in a separate thread.
+ *
+ * @param data The fetch
+ */
+static void fetch_users(void *data)
+{
+    struct user_fetch *fetch = (struct user_fetch*)data;
+    SERVER *server = fetch->server->server;
+
+    if (fetch->own_thread && mysql_thread_init())
     {
-        const char *server_string = mysql_get_server_info(con);
-        if (!server_set_version_string(server->server, server_string))
-        {
-            return -1;
-        }
+        MXS_ERROR("[%s] mysql_thread_init failed when loading users from server '%s'.",
+                  fetch->service->name, server->unique_name);
+        return;
     }
 
-    char *query = get_new_users_query(server->server->server_string, service->enable_root);
-    MYSQL_AUTH *instance = (MYSQL_AUTH*)listener->auth_instance;
-    bool anon_user = false;
-    int users = 0;
+    MYSQL *con = gw_mysql_init();
 
-    if (query)
+    if (con)
     {
-        if (mxs_mysql_query(con, query) == 0)
+        if (mxs_mysql_real_connect(con, server, fetch->user, fetch->password) == NULL)
+        {
+            MXS_ERROR("Failure loading users data from backend "
+                      "[%s:%i] for service [%s]. MySQL error %i, %s",
+                      server->name, server->port,
+                      fetch->service->name, mysql_errno(con), mysql_error(con));
+            mysql_close(con);
+        }
+        else
         {
-            MYSQL_RES *result = mysql_store_result(con);
+            fetch->con = con;
 
-            if (result)
+            if (server->server_string == NULL)
             {
-                MYSQL_ROW row;
+                server_set_version_string(server, mysql_get_server_info(con));
+            }
+
+            char *query = server->server_string ?
+                          get_new_users_query(server->server_string, fetch->service->enable_root) :
+                          NULL;
 
-                while ((row = mysql_fetch_row(result)))
+            if (query)
+            {
+                if (mxs_mysql_query(con, query) == 0)
+                {
+                    fetch->users = mysql_store_result(con);
+                }
+                else
                 {
-                    if (service->strip_db_esc)
-                    {
-                        strip_escape_chars(row[2]);
-                    }
-
-                    if (strchr(row[1], '/'))
-                    {
-                        merge_netmask(row[1]);
-                    }
-
-                    add_mysql_user(instance->handle, row[0], row[1], row[2],
-                                   row[3] && strcmp(row[3], "Y") == 0, row[4]);
-                    users++;
-
-                    if (row[0] && *row[0] == '\0')
-                    {
-                        /** Empty username is used for the anonymous user. This means
-                         that localhost does not match wildcard host. */
-                        anon_user = true;
-                    }
+                    MXS_ERROR("Failed to load users: %s", mysql_error(con));
                 }
 
-                mysql_free_result(result);
+                MXS_FREE(query);
+            }
+
+            if (mxs_mysql_query(con, "SHOW DATABASES") == 0)
+            {
+                fetch->dbs = mysql_store_result(con);
+            }
+            else
+            {
+                MXS_ERROR("Failed to load list of databases: %s", mysql_error(con));
             }
         }
-        else
+    }
+
+    if (fetch->own_thread)
+    {
+        mysql_thread_end();
+    }
+}
+
+/** The changes to the users and databases in the SQLite database */
+struct user_diff
+{
+    MYSQL_USER_INDEX *index; /**< The users in the database, NULL if they are all replaced */
+    bool *users_seen;        /**< Grants that the servers still have */
+    bool *dbs_seen;          /**< Databases that the servers still have */
+    int  changes;            /**< Number of rows added or removed */
+};
+
+/**
+ * @brief Find a grant that is stored exactly as given
+ *
+ * @return The grant or NULL if the index does not have it
+ */
+static MYSQL_USER_ENTRY* find_stored_user(MYSQL_USER_INDEX *index, const char *user, const char *host,
+                                          const char *db, bool anydb, const char *pw)
+{
+    /** The values are stored like add_mysql_user() stores them */
+    if (pw && *pw == '*')
+    {
+        pw++;
+    }
+
+    for (MYSQL_USER_ENTRY *entry = index->user_buckets[index_bucket(index, user)];
+         entry; entry = entry->next)
+    {
+        if (strcmp(entry->user, user) == 0 &&
+            strcmp(entry->host, host) == 0 &&
+            entry->anydb == anydb &&
+            strcmp(entry->password, pw ? pw : "") == 0 &&
+            (db && *db ? entry->db && strcmp(entry->db, db) == 0 : entry->db == NULL))
         {
-            MXS_ERROR("Failed to load users: %s", mysql_error(con));
+            return entry;
         }
+    }
+
+    return NULL;
+}
+
+static MYSQL_DB_ENTRY* find_stored_database(MYSQL_USER_INDEX *index, const char *db)
+{
+    for (MYSQL_DB_ENTRY *entry = index->db_buckets[index_bucket(index, db)];
+         entry; entry = entry->next)
+    {
+        if (strcmp(entry->name, db) == 0)
+        {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
 
-        MXS_FREE(query);
+/**
+ * @brief Apply the users and databases fetched from one server
+ *
+ * The rows that are already in the user database are only marked as seen,
+ * the others are added.
+ *
+ * @return Number of users the server returned
+ */
+static int apply_users_from_server(struct user_fetch *fetch, MYSQL_AUTH *instance,
+                                   struct user_diff *diff)
+{
+    SERVICE *service = fetch->service;
+    bool anon_user = false;
+    int users = 0;
+
+    if (fetch->users)
+    {
+        MYSQL_ROW row;
+
+        while ((row = mysql_fetch_row(fetch->users)))
+        {
+            if (service->strip_db_esc)
+            {
+                strip_escape_chars(row[2]);
+            }
+
+            if (strchr(row[1], '/'))
+            {
+                merge_netmask(row[1]);
+            }
+
+            bool anydb = row[3] && strcmp(row[3], "Y") == 0;
+            MYSQL_USER_ENTRY *entry = diff->index ?
+                                      find_stored_user(diff->index, row[0], row[1], row[2],
+                                                       anydb, row[4]) : NULL;
+
+            if (entry)
+            {
+                diff->users_seen[entry - diff->index->users] = true;
+            }
+            else
+            {
+                add_mysql_user(instance->handle, row[0], row[1], row[2], anydb, row[4]);
+                diff->changes++;
+            }
+
+            users++;
+
+            if (row[0] && *row[0] == '\0')
+            {
+                /** Empty username is used for the anonymous user. This means
+                 that localhost does not match wildcard host. */
+                anon_user = true;
+            }
+        }
     }
 
     /** Set the parameter if it is not configured by the user */
@@ -819,33 +1241,83 @@ int get_users_from_server(MYSQL *con, SERVER_REF *server, SERVICE *service, SERV
         service->localhost_match_wildcard_host = anon_user ? 0 : 1;
     }
 
-    /** Load the list of databases */
-    if (mxs_mysql_query(con, "SHOW DATABASES") == 0)
+    if (fetch->dbs)
     {
-        MYSQL_RES *result = mysql_store_result(con);
-        if (result)
+        MYSQL_ROW row;
+
+        while ((row = mysql_fetch_row(fetch->dbs)))
         {
-            MYSQL_ROW row;
-            while ((row = mysql_fetch_row(result)))
+            MYSQL_DB_ENTRY *entry = diff->index ? find_stored_database(diff->index, row[0]) : NULL;
+
+            if (entry)
+            {
+                diff->dbs_seen[entry - diff->index->dbs] = true;
+            }
+            else
             {
                 add_database(instance->handle, row[0]);
+                diff->changes++;
             }
-
-            mysql_free_result(result);
         }
     }
-    else
+
+    return users;
+}
+
+/**
+ * @brief Remove the users and databases that no server returned
+ *
+ * @param handle SQLite handle
+ * @param diff   The changes
+ */
+static void delete_unseen_users(sqlite3 *handle, struct user_diff *diff)
+{
+    MYSQL_USER_INDEX *index = diff->index;
+    char sql[sizeof(delete_database_query) + 32];
+    char *err;
+
+    for (size_t i = 0; i < index->n_users; i++)
     {
-        MXS_ERROR("Failed to load list of databases: %s", mysql_error(con));
+        if (!diff->users_seen[i])
+        {
+            sprintf(sql, delete_user_query, (long)index->users[i].rowid);
+
+            if (sqlite3_exec(handle, sql, NULL, NULL, &err) != SQLITE_OK)
+            {
+                MXS_ERROR("Failed to delete user: %s", err);
+                sqlite3_free(err);
+            }
+
+            diff->changes++;
+        }
     }
 
-    return users;
+    for (size_t i = 0; i < index->n_dbs; i++)
+    {
+        if (!diff->dbs_seen[i])
+        {
+            sprintf(sql, delete_database_query, (long)index->dbs[i].rowid);
+
+            if (sqlite3_exec(handle, sql, NULL, NULL, &err) != SQLITE_OK)
+            {
+                MXS_ERROR("Failed to delete database: %s", err);
+                sqlite3_free(err);
+            }
+
+            diff->changes++;
+        }
+    }
 }
 
 /**
  * Load the user/passwd form mysql.user table into the service users' hashtable
  * environment.
  *
+ * If the users are loaded from all servers, they are fetched from the servers
+ * in parallel. Otherwise the servers are tried one at a time until the users
+ * are fetched from one of them. The fetched users are compared with the users
+ * in the user index and only the differences are written into the database.
+ *
  * @param service   The current service
  * @param users     The users table into which to load the users
  * @return          -1 on any error or the number of users inserted
@@ -868,16 +1340,24 @@ static int get_users(SERV_LISTENER *listener, bool skip_local)
         return -1;
     }
 
-    /** Delete the old users */
-    MYSQL_AUTH *instance = (MYSQL_AUTH*)listener->auth_instance;
-    start_sqlite_transaction(instance->handle);
-    delete_mysql_users(instance->handle);
+    int n_servers = 0;
 
-    SERVER_REF *server = service->dbref;
-    int total_users = -1;
-    bool no_active_servers = true;
+    for (SERVER_REF *server = service->dbref; server; server = server->next)
+    {
+        n_servers++;
+    }
 
-    for (server = service->dbref; !service->svc_do_shutdown && server; server = server->next)
+    struct user_fetch *fetches = MXS_CALLOC(n_servers ? n_servers : 1, sizeof(struct user_fetch));
+
+    if (fetches == NULL)
+    {
+        MXS_FREE(dpwd);
+        return -1;
+    }
+
+    int n_fetches = 0;
+
+    for (SERVER_REF *server = service->dbref; server; server = server->next)
     {
         if (!SERVER_REF_IS_ACTIVE(server) || !SERVER_IS_ACTIVE(server->server) ||
             (skip_local && server_is_mxs_service(server->server)))
@@ -885,30 +1365,52 @@ static int get_users(SERV_LISTENER *listener, bool skip_local)
             continue;
         }
 
-        no_active_servers = false;
+        struct user_fetch *fetch = &fetches[n_fetches++];
+        fetch->service = service;
+        fetch->server = server;
+        fetch->user = service_user;
+        fetch->password = dpwd;
+    }
+
+    bool no_active_servers = n_fetches == 0;
+    bool fetched = false;
 
-        MYSQL *con = gw_mysql_init();
-        if (con)
+    if (service->users_from_all && n_fetches > 1)
+    {
+        for (int i = 0; i < n_fetches; i++)
         {
-            if (mxs_mysql_real_connect(con, server->server, service_user, dpwd) == NULL)
+            fetches[i].own_thread = true;
+
+            if (thread_start(&fetches[i].thread, fetch_users, &fetches[i]) == NULL)
             {
-                MXS_ERROR("Failure loading users data from backend "
-                          "[%s:%i] for service [%s]. MySQL error %i, %s",
-                          server->server->name, server->server->port,
-                          service->name, mysql_errno(con), mysql_error(con));
-                mysql_close(con);
+                /** Fetched by this thread once the other fetches are started */
+                fetches[i].own_thread = false;
+            }
+        }
+
+        for (int i = 0; i < n_fetches; i++)
+        {
+            if (fetches[i].own_thread)
+            {
+                thread_wait(fetches[i].thread);
             }
             else
             {
-                /** Successfully connected to a server */
-                int users = get_users_from_server(con, server, service, listener);
+                fetch_users(&fetches[i]);
+            }
 
-                if (users > total_users)
-                {
-                    total_users = users;
-                }
+            fetched = fetched || fetches[i].con;
+        }
+    }
+    else
+    {
+        for (int i = 0; i < n_fetches && !service->svc_do_shutdown; i++)
+        {
+            fetch_users(&fetches[i]);
 
-                mysql_close(con);
+            if (fetches[i].con)
+            {
+                fetched = true;
 
                 if (!service->users_from_all)
                 {
@@ -918,8 +1420,87 @@ static int get_users(SERV_LISTENER *listener, bool skip_local)
         }
     }
 
+    MYSQL_AUTH *instance = (MYSQL_AUTH*)listener->auth_instance;
+    struct user_diff diff = {};
+
+    if (!fetched && !no_active_servers)
+    {
+        /** The stored users are kept until a server can be reached */
+        MXS_FREE(fetches);
+        MXS_FREE(dpwd);
+        MXS_ERROR("Unable to get user data from backend database for service [%s]."
+                  " Failed to connect to any of the backend databases.", service->name);
+        return -1;
+    }
+
+    /** The stored users can only be compared with an index that is up to date */
+    if (!instance->index_stale && (diff.index = acquire_user_index(instance)))
+    {
+        diff.users_seen = MXS_CALLOC(diff.index->n_users + 1, sizeof(bool));
+        diff.dbs_seen = MXS_CALLOC(diff.index->n_dbs + 1, sizeof(bool));
+
+        if (diff.users_seen == NULL || diff.dbs_seen == NULL)
+        {
+            release_user_index(diff.index);
+            diff.index = NULL;
+        }
+    }
+
+    start_sqlite_transaction(instance->handle);
+
+    if (diff.index == NULL)
+    {
+        /** Delete the old users */
+        delete_mysql_users(instance->handle);
+        diff.changes++;
+    }
+
+    int total_users = -1;
+
+    for (int i = 0; i < n_fetches; i++)
+    {
+        if (fetches[i].con)
+        {
+            int users = apply_users_from_server(&fetches[i], instance, &diff);
+
+            if (users > total_users)
+            {
+                total_users = users;
+            }
+        }
+
+        if (fetches[i].users)
+        {
+            mysql_free_result(fetches[i].users);
+        }
+
+        if (fetches[i].dbs)
+        {
+            mysql_free_result(fetches[i].dbs);
+        }
+
+        if (fetches[i].con)
+        {
+            mysql_close(fetches[i].con);
+        }
+    }
+
+    if (diff.index)
+    {
+        delete_unseen_users(instance->handle, &diff);
+        release_user_index(diff.index);
+    }
+
     commit_sqlite_transaction(instance->handle);
 
+    if (diff.changes > 0)
+    {
+        instance->index_stale = true;
+    }
+
+    MXS_FREE(diff.users_seen);
+    MXS_FREE(diff.dbs_seen);
+    MXS_FREE(fetches);
     MXS_FREE(dpwd);
 
     if (no_active_servers)
@@ -927,11 +1508,6 @@ static int get_users(SERV_LISTENER *listener, bool skip_local)
         // This service has no servers or all servers are local MaxScale services
         total_users = 0;
     }
-    else if (server == NULL && total_users == -1)
-    {
-        MXS_ERROR("Unable to get user data from backend database for service [%s]."
-                  " Failed to connect to any of the backend databases.", service->name);
-    }
 
     return total_users;
 }
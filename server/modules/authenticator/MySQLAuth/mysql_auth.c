@@ -30,6 +30,8 @@
 #include <maxscale/protocol/mysql.h>
 #include <maxscale/authenticator.h>
 #include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/housekeeper.h>
 #include <maxscale/poll.h>
 #include <maxscale/paths.h>
 #include <maxscale/secrets.h>
@@ -201,6 +203,10 @@ static void* mysql_auth_init(char **options)
         instance->skip_auth = false;
         instance->lower_case_table_names = false;
         instance->handle = NULL;
+        instance->index = NULL;
+        spinlock_init(&instance->index_lock);
+        instance->index_stale = false;
+        instance->loading = 0;
 
         for (int i = 0; options[i]; i++)
         {
@@ -609,6 +615,7 @@ static bool add_service_user(SERV_LISTENER *port)
                 MYSQL_AUTH *inst = (MYSQL_AUTH*)port->auth_instance;
                 add_mysql_user(inst->handle, user, "%", "", "Y", newpw);
                 add_mysql_user(inst->handle, user, "localhost", "", "Y", newpw);
+                inst->index_stale = true;
                 MXS_FREE(newpw);
                 rval = true;
             }
@@ -628,32 +635,17 @@ static bool add_service_user(SERV_LISTENER *port)
 }
 
 /**
- * @brief Load MySQL authentication users
- *
- * This function loads MySQL users from the backend database.
+ * @brief Load the users from the backend servers
  *
- * @param port Listener definition
- * @return MXS_AUTH_LOADUSERS_OK on success, MXS_AUTH_LOADUSERS_ERROR and
- * MXS_AUTH_LOADUSERS_FATAL on fatal error
+ * @param port       Listener definition
+ * @param skip_local Skip loading of users on local MaxScale services
+ * @return MXS_AUTH_LOADUSERS_OK
  */
-static int mysql_auth_load_users(SERV_LISTENER *port)
+static int load_users_from_backends(SERV_LISTENER *port, bool skip_local)
 {
     int rc = MXS_AUTH_LOADUSERS_OK;
     SERVICE *service = port->listener->service;
     MYSQL_AUTH *instance = (MYSQL_AUTH*)port->auth_instance;
-    bool skip_local = false;
-
-    if (instance->handle == NULL)
-    {
-        skip_local = true;
-        char path[PATH_MAX];
-        get_database_path(port, path, sizeof(path));
-        if (!check_service_permissions(port->service) ||
-            !open_instance_database(path, &instance->handle))
-        {
-            return MXS_AUTH_LOADUSERS_FATAL;
-        }
-    }
 
     int loaded = replace_mysql_users(port, skip_local);
     bool injected = false;
@@ -681,6 +673,12 @@ static int mysql_auth_load_users(SERV_LISTENER *port)
         }
     }
 
+    if ((instance->index == NULL || instance->index_stale) && !update_user_index(instance))
+    {
+        MXS_ERROR("[%s] Failed to build the user index for listener %s, the previously "
+                  "loaded users are used for authentication.", service->name, port->name);
+    }
+
     if (injected)
     {
         MXS_NOTICE("[%s] No users were loaded but 'inject_service_user' is enabled. "
@@ -700,6 +698,107 @@ static int mysql_auth_load_users(SERV_LISTENER *port)
     return rc;
 }
 
+/**
+ * @brief Load the users in the background
+ *
+ * The housekeeper task that replaces the users that were loaded from the
+ * persisted cache at startup with the users of the backend servers.
+ *
+ * @param data The listener
+ */
+static void load_users_task(void *data)
+{
+    SERV_LISTENER *port = (SERV_LISTENER*)data;
+    MYSQL_AUTH *instance = (MYSQL_AUTH*)port->auth_instance;
+
+    if (check_service_permissions(port->service))
+    {
+        load_users_from_backends(port, true);
+    }
+    else
+    {
+        MXS_ERROR("[%s] The service user is missing permissions, the users of listener %s "
+                  "are not loaded from the backend servers. The users in the persisted "
+                  "cache are used for authentication.", port->service->name, port->name);
+    }
+
+    atomic_add(&instance->loading, -1);
+}
+
+/**
+ * @brief Start loading the users from the backend servers in the background
+ *
+ * @param port Listener definition
+ * @return True if the load was started
+ */
+static bool start_background_load(SERV_LISTENER *port)
+{
+    MYSQL_AUTH *instance = (MYSQL_AUTH*)port->auth_instance;
+    char name[strlen(port->service->name) + strlen(port->name) + sizeof("--load-users")];
+    sprintf(name, "%s-%s-load-users", port->service->name, port->name);
+    atomic_add(&instance->loading, 1);
+
+    if (hktask_oneshot(name, load_users_task, port, 0) == 0)
+    {
+        atomic_add(&instance->loading, -1);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Load MySQL authentication users
+ *
+ * This function loads MySQL users from the backend database. At startup, if
+ * the persisted cache has users, they are used at once and the users are
+ * loaded from the backend database in the background.
+ *
+ * @param port Listener definition
+ * @return MXS_AUTH_LOADUSERS_OK on success, MXS_AUTH_LOADUSERS_ERROR and
+ * MXS_AUTH_LOADUSERS_FATAL on fatal error
+ */
+static int mysql_auth_load_users(SERV_LISTENER *port)
+{
+    SERVICE *service = port->listener->service;
+    MYSQL_AUTH *instance = (MYSQL_AUTH*)port->auth_instance;
+
+    if (instance->handle == NULL)
+    {
+        char path[PATH_MAX];
+        get_database_path(port, path, sizeof(path));
+
+        if (!open_instance_database(path, &instance->handle))
+        {
+            return MXS_AUTH_LOADUSERS_FATAL;
+        }
+
+        if (update_user_index(instance) && instance->index->n_users > 0 &&
+            start_background_load(port))
+        {
+            MXS_NOTICE("[%s] Loaded %lu MySQL users for listener %s from the persisted cache, "
+                       "loading the users from the backend servers in the background.",
+                       service->name, instance->index->n_users, port->name);
+            return MXS_AUTH_LOADUSERS_OK;
+        }
+
+        if (!check_service_permissions(port->service))
+        {
+            return MXS_AUTH_LOADUSERS_FATAL;
+        }
+
+        return load_users_from_backends(port, true);
+    }
+
+    if (instance->loading)
+    {
+        /** The users that are being loaded in the background are not older */
+        return MXS_AUTH_LOADUSERS_OK;
+    }
+
+    return load_users_from_backends(port, false);
+}
+
 int mysql_auth_reauthenticate(DCB *dcb, const char *user,
                               uint8_t *token, size_t token_len,
                               uint8_t *scramble, size_t scramble_len,
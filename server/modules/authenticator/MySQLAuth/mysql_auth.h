@@ -61,28 +61,6 @@ static const char databases_create_sql[] =
 static const char pragma_sql[]     = "PRAGMA journal_mode=WAL";
 static const char old_pragma_sql[] = "PRAGMA journal_mode=MEMORY";
 
-/** Query that checks if there's a grant for the user being authenticated */
-static const char mysqlauth_validate_user_query[] =
-    "SELECT password FROM " MYSQLAUTH_USERS_TABLE_NAME
-    " WHERE user = '%s' AND ( '%s' = host OR '%s' LIKE host) AND (anydb = '1' OR '%s' = '' OR '%s' LIKE db)"
-    " LIMIT 1";
-
-/** Query that checks if there's a grant for the user being authenticated */
-static const char mysqlauth_validate_user_query_lower[] =
-    "SELECT password FROM " MYSQLAUTH_USERS_TABLE_NAME
-    " WHERE user = '%s' AND ( '%s' = host OR '%s' LIKE host) AND (anydb = '1' OR '%s' = '' OR LOWER('%s') LIKE LOWER(db))"
-    " LIMIT 1";
-
-/** Query that only checks if there's a matching user */
-static const char mysqlauth_skip_auth_query[] =
-    "SELECT password FROM " MYSQLAUTH_USERS_TABLE_NAME
-    " WHERE user = '%s' AND (anydb = '1' OR '%s' = '' OR '%s' LIKE db)"
-    " LIMIT 1";
-
-/** Query that checks that the database exists */
-static const char mysqlauth_validate_database_query[] =
-    "SELECT * FROM " MYSQLAUTH_DATABASES_TABLE_NAME " WHERE db = '%s' LIMIT 1";
-
 /** Delete query used to clean up the database before loading new users */
 static const char delete_users_query[] = "DELETE FROM " MYSQLAUTH_USERS_TABLE_NAME;
 
@@ -103,6 +81,17 @@ static const char dump_users_query[] =
 static const char dump_databases_query[] =
     "SELECT db FROM " MYSQLAUTH_DATABASES_TABLE_NAME;
 
+/** The users in the order they were added, the first matching grant is used */
+static const char index_users_query[] =
+    "SELECT user, host, db, anydb, password, rowid FROM " MYSQLAUTH_USERS_TABLE_NAME " ORDER BY rowid";
+
+static const char index_databases_query[] =
+    "SELECT db, rowid FROM " MYSQLAUTH_DATABASES_TABLE_NAME;
+
+/** Queries that remove one user or database that no longer exists */
+static const char delete_user_query[] = "DELETE FROM " MYSQLAUTH_USERS_TABLE_NAME " WHERE rowid = %ld";
+static const char delete_database_query[] = "DELETE FROM " MYSQLAUTH_DATABASES_TABLE_NAME " WHERE rowid = %ld";
+
 /** Used for NULL value creation in the INSERT query */
 static const char null_token[] = "NULL";
 
@@ -111,9 +100,65 @@ static int db_flags = SQLITE_OPEN_READWRITE |
                       SQLITE_OPEN_CREATE |
                       SQLITE_OPEN_SHAREDCACHE;
 
+/** How the host of a grant is matched */
+enum mysql_host_match
+{
+    MYSQL_HOST_ANY,     /**< The host is '%', it matches all clients */
+    MYSQL_HOST_EXACT,   /**< The host has no wildcards */
+    MYSQL_HOST_PATTERN  /**< The host is a pattern with wildcards */
+};
+
+/**
+ * A grant in the user index
+ */
+typedef struct mysql_user_entry
+{
+    char *user;                    /**< User name */
+    char *host;                    /**< Host or host pattern */
+    char *db;                      /**< Database pattern, NULL if the grant has none */
+    char *password;                /**< Password hash, empty if the user has no password */
+    enum mysql_host_match match;   /**< How the host is matched */
+    int64_t rowid;                 /**< Row of the grant in the SQLite database */
+    bool anydb;                    /**< Global access to databases */
+    struct mysql_user_entry *next; /**< Next entry in the same bucket */
+} MYSQL_USER_ENTRY;
+
+/**
+ * A database in the user index
+ */
+typedef struct mysql_db_entry
+{
+    char *name;                  /**< Database name */
+    int64_t rowid;               /**< Row of the database in the SQLite database */
+    struct mysql_db_entry *next; /**< Next entry in the same bucket */
+} MYSQL_DB_ENTRY;
+
+/**
+ * An immutable index of the users and databases in the SQLite database
+ *
+ * The index is rebuilt each time the users are loaded and the authentication
+ * is done with it instead of SQL queries. An index that has been replaced is
+ * freed once the last client that uses it releases it.
+ */
+typedef struct mysql_user_index
+{
+    int               refcount;     /**< Number of references to the index */
+    MYSQL_USER_ENTRY  *users;       /**< The grants in the order they were added */
+    size_t            n_users;      /**< Number of grants */
+    MYSQL_USER_ENTRY  **user_buckets; /**< The grants hashed by the user name */
+    MYSQL_DB_ENTRY    *dbs;         /**< The databases */
+    size_t            n_dbs;        /**< Number of databases */
+    MYSQL_DB_ENTRY    **db_buckets; /**< The databases hashed by the name */
+    size_t            n_buckets;    /**< Number of buckets in both tables, a power of two */
+} MYSQL_USER_INDEX;
+
 typedef struct mysql_auth
 {
     sqlite3 *handle;             /**< SQLite3 database handle */
+    MYSQL_USER_INDEX *index;     /**< Index of the users in the database */
+    SPINLOCK index_lock;         /**< Protects the index pointer */
+    bool index_stale;            /**< The database has changed since the index was built */
+    int loading;                 /**< Number of background loads of the users in progress */
     char *cache_dir;             /**< Custom cache directory location */
     bool inject_service_user;    /**< Inject the service user into the list of users */
     bool skip_auth;              /**< Authentication will always be successful */
@@ -185,6 +230,10 @@ bool dbusers_save(sqlite3 *src, const char *filename);
 /**
  * Reload and replace the currently loaded database users
  *
+ * Only the users and databases that have changed since the previous load are
+ * written into the SQLite database. If anything changed, the user index is
+ * marked as stale. If no server can be reached, the stored users are kept.
+ *
  * @param service    The current service
  * @param skip_local Skip loading of users on local MaxScale services
  *
@@ -192,6 +241,19 @@ bool dbusers_save(sqlite3 *src, const char *filename);
  */
 int replace_mysql_users(SERV_LISTENER *listener, bool skip_local);
 
+/**
+ * @brief Rebuild the user index from the SQLite database
+ *
+ * To be called after the users in the database have been changed. If the
+ * index cannot be built, the previous one stays in use and it is marked as
+ * stale.
+ *
+ * @param instance MySQLAuth instance
+ *
+ * @return True if the index was rebuilt
+ */
+bool update_user_index(MYSQL_AUTH *instance);
+
 /**
  * @brief Verify the user has access to the database
  *
@@ -35,6 +35,7 @@ Cache::Cache(const std::string&  name,
     , m_config(*pConfig)
     , m_sRules(sRules)
     , m_sFactory(sFactory)
+    , m_invalidations(0)
 {
 }
 
@@ -82,10 +83,10 @@ bool Cache::Create(const CACHE_CONFIG& config,
     return pFactory != NULL;
 }
 
-void Cache::show(DCB* pDcb) const
+void Cache::show(DCB* pDcb, uint32_t what) const
 {
     bool showed = false;
-    json_t* pInfo = get_info(INFO_ALL);
+    json_t* pInfo = get_info(what);
 
     if (pInfo)
     {
@@ -150,11 +151,74 @@ cache_result_t Cache::get_default_key(const char* zDefault_db,
     return CACHE_RESULT_OK;
 }
 
+cache_result_t Cache::get_key(const char* zDefault_db,
+                              const GWBUF* pQuery,
+                              const uint8_t* pParams,
+                              size_t params_len,
+                              CACHE_KEY* pKey) const
+{
+    CACHE_KEY key;
+
+    cache_result_t result = get_key(zDefault_db, pQuery, &key);
+
+    if (CACHE_RESULT_IS_OK(result))
+    {
+        add_params_to_key(key, pParams, params_len, pKey);
+    }
+
+    return result;
+}
+
+//static
+cache_result_t Cache::get_default_key(const char* zDefault_db,
+                                      const GWBUF* pQuery,
+                                      const uint8_t* pParams,
+                                      size_t params_len,
+                                      CACHE_KEY* pKey)
+{
+    CACHE_KEY key;
+
+    cache_result_t result = get_default_key(zDefault_db, pQuery, &key);
+
+    if (CACHE_RESULT_IS_OK(result))
+    {
+        add_params_to_key(key, pParams, params_len, pKey);
+    }
+
+    return result;
+}
+
+//static
+void Cache::add_params_to_key(const CACHE_KEY& key,
+                              const uint8_t* pParams,
+                              size_t params_len,
+                              CACHE_KEY* pKey)
+{
+    // The command byte separates the key from that of the plain statement.
+    const Bytef command = MYSQL_COM_STMT_EXECUTE;
+
+    uint64_t crc1 = crc32(key.data >> 32, &command, 1);
+    uint64_t crc2 = crc32(key.data & 0xffffffff, &command, 1);
+
+    if (params_len != 0)
+    {
+        crc1 = crc32(crc1, pParams, params_len);
+        crc2 = crc32(crc2, pParams, params_len);
+    }
+
+    pKey->data = (crc1 << 32 | crc2);
+}
+
 bool Cache::should_store(const char* zDefaultDb, const GWBUF* pQuery)
 {
     return m_sRules->should_store(zDefaultDb, pQuery);
 }
 
+bool Cache::should_store(const char* zDefaultDb, const GWBUF* pQuery, CACHE_RULE_STATS** ppStats)
+{
+    return m_sRules->should_store(zDefaultDb, pQuery, ppStats);
+}
+
 bool Cache::should_use(const MXS_SESSION* pSession)
 {
     return m_sRules->should_use(pSession);
@@ -172,6 +236,30 @@ json_t* Cache::do_get_info(uint32_t what) const
 
             json_object_set(pInfo, "rules", pRules); // Increases ref-count of pRules, we ignore failure.
         }
+
+        if (what & INFO_STATISTICS)
+        {
+            json_t* pStatistics = json_object();
+
+            if (pStatistics)
+            {
+                json_t* pRules = m_sRules->stats_json();
+
+                if (pRules)
+                {
+                    json_object_set_new(pStatistics, "rules", pRules);
+                }
+
+                json_t* pStatements = m_digest_stats.get_info();
+
+                if (pStatements)
+                {
+                    json_object_set_new(pStatistics, "top_statements", pStatements);
+                }
+
+                json_object_set_new(pInfo, "statistics", pStatistics);
+            }
+        }
     }
 
     return pInfo;
@@ -16,10 +16,13 @@
 #include <tr1/functional>
 #include <tr1/memory>
 #include <string>
+#include <vector>
+#include <maxscale/atomic.h>
 #include <maxscale/buffer.h>
 #include <maxscale/session.h>
 #include "cachefilter.h"
 #include "cache_storage_api.h"
+#include "cachestats.hh"
 
 class CacheFilterSession;
 class StorageFactory;
@@ -32,7 +35,8 @@ public:
         INFO_RULES   = 0x01, /*< Include information about the rules. */
         INFO_PENDING = 0x02, /*< Include information about any pending items. */
         INFO_STORAGE = 0x04, /*< Include information about the storage. */
-        INFO_ALL     = (INFO_RULES | INFO_PENDING | INFO_STORAGE)
+        INFO_STATISTICS = 0x08, /*< Include the statistics of the rules and statements. */
+        INFO_ALL     = (INFO_RULES | INFO_PENDING | INFO_STORAGE | INFO_STATISTICS)
     };
 
     typedef std::tr1::shared_ptr<CacheRules> SCacheRules;
@@ -40,7 +44,7 @@ public:
 
     virtual ~Cache();
 
-    void show(DCB* pDcb) const;
+    void show(DCB* pDcb, uint32_t what = INFO_ALL) const;
 
     const CACHE_CONFIG& config() const
     {
@@ -59,6 +63,26 @@ public:
      */
     bool should_store(const char* zDefaultDb, const GWBUF* pQuery);
 
+    /**
+     * Returns whether the results of a particular query should be stored.
+     *
+     * @param zDefaultDb  The current default database.
+     * @param pQuery      Buffer containing a SELECT.
+     * @param ppStats     On return, if true is returned, the statistics of
+     *                    the rule due to which the result should be stored.
+     *
+     * @return True of the result should be cached.
+     */
+    bool should_store(const char* zDefaultDb, const GWBUF* pQuery, CACHE_RULE_STATS** ppStats);
+
+    /**
+     * Returns the statistics of the statements served via the cache.
+     */
+    DigestStats& digest_stats()
+    {
+        return m_digest_stats;
+    }
+
     /**
      * Returns whether cached results should be used.
      *
@@ -113,6 +137,40 @@ public:
                                           const GWBUF* pQuery,
                                           CACHE_KEY* pKey);
 
+    /**
+     * Returns a key for an execution of a prepared statement. The key is
+     * the key of the statement text extended with the parameters, so it
+     * takes the current config into account exactly as that key does. The
+     * key differs from that of the same statement executed as a COM_QUERY,
+     * as the response is in a different format.
+     *
+     * @param zDefault_db  The default database when the statement was
+     *                     prepared, can be NULL.
+     * @param pQuery       The prepared statement as a COM_QUERY.
+     * @param pParams      The types and the values of the parameters.
+     * @param params_len   The length of @c pParams.
+     * @param pKey         On output a key.
+     *
+     * @return CACHE_RESULT_OK if a key could be created.
+     */
+    cache_result_t get_key(const char* zDefault_db,
+                           const GWBUF* pQuery,
+                           const uint8_t* pParams,
+                           size_t params_len,
+                           CACHE_KEY* pKey) const;
+
+    /**
+     * Returns a key for an execution of a prepared statement. Does not take
+     * the current config into account.
+     *
+     * @see get_key
+     */
+    static cache_result_t get_default_key(const char* zDefault_db,
+                                          const GWBUF* pQuery,
+                                          const uint8_t* pParams,
+                                          size_t params_len,
+                                          CACHE_KEY* pKey);
+
     /**
      * See @Storage::get_value
      */
@@ -123,13 +181,32 @@ public:
     /**
      * See @Storage::put_value
      */
-    virtual cache_result_t put_value(const CACHE_KEY& key, const GWBUF* pValue) = 0;
+    virtual cache_result_t put_value(const CACHE_KEY& key,
+                                     const std::vector<std::string>& words,
+                                     const GWBUF* pValue) = 0;
 
     /**
      * See @Storage::del_value
      */
     virtual cache_result_t del_value(const CACHE_KEY& key) = 0;
 
+    /**
+     * See @Storage::invalidate
+     */
+    virtual cache_result_t invalidate(const std::vector<std::string>& words) = 0;
+
+    /**
+     * Returns the number of invalidations made so far. A result fetched
+     * from the server should not be stored if an invalidation was made
+     * while the result was being fetched, as it may be stale already.
+     *
+     * @return The number of invalidations.
+     */
+    uint64_t invalidations() const
+    {
+        return atomic_add_uint64(&m_invalidations, 0);
+    }
+
 protected:
     Cache(const std::string&  name,
           const CACHE_CONFIG* pConfig,
@@ -142,13 +219,30 @@ protected:
 
     json_t* do_get_info(uint32_t what) const;
 
+    /**
+     * To be called by @c invalidate() implementations.
+     */
+    void invalidated()
+    {
+        atomic_add_uint64(&m_invalidations, 1);
+    }
+
 private:
     Cache(const Cache&);
     Cache& operator = (const Cache&);
 
+    static void add_params_to_key(const CACHE_KEY& key,
+                                  const uint8_t* pParams,
+                                  size_t params_len,
+                                  CACHE_KEY* pKey);
+
 protected:
     const std::string   m_name;     // The name of the instance; the section name in the config.
     const CACHE_CONFIG& m_config;   // The configuration of the cache instance.
     SCacheRules         m_sRules;   // The rules of the cache instance.
     SStorageFactory     m_sFactory; // The storage factory.
+
+private:
+    mutable uint64_t    m_invalidations; // The number of invalidations.
+    DigestStats         m_digest_stats;  // The statistics of the statements.
 };
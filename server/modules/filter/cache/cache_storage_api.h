@@ -58,6 +58,12 @@ typedef enum cache_thread_model
     CACHE_THREAD_MODEL_MT
 } cache_thread_model_t;
 
+typedef enum cache_invalidate
+{
+    CACHE_INVALIDATE_NEVER,  /*< Entries are only removed due to TTL or eviction. */
+    CACHE_INVALIDATE_CURRENT /*< Entries are invalidated when data they depend on is modified. */
+} cache_invalidate_t;
+
 typedef void* CACHE_STORAGE;
 
 typedef struct cache_key
@@ -86,12 +92,13 @@ bool cache_key_equal_to(const CACHE_KEY* lhs, const CACHE_KEY* rhs);
 
 typedef enum cache_storage_capabilities
 {
-    CACHE_STORAGE_CAP_NONE      = 0x00,
-    CACHE_STORAGE_CAP_ST        = 0x01, /*< Storage can optimize for single thread. */
-    CACHE_STORAGE_CAP_MT        = 0x02, /*< Storage can handle multiple threads. */
-    CACHE_STORAGE_CAP_LRU       = 0x04, /*< Storage capable of LRU eviction. */
-    CACHE_STORAGE_CAP_MAX_COUNT = 0x08, /*< Storage capable of capping number of entries.*/
-    CACHE_STORAGE_CAP_MAX_SIZE  = 0x10, /*< Storage capable of capping size of cache.*/
+    CACHE_STORAGE_CAP_NONE        = 0x00,
+    CACHE_STORAGE_CAP_ST          = 0x01, /*< Storage can optimize for single thread. */
+    CACHE_STORAGE_CAP_MT          = 0x02, /*< Storage can handle multiple threads. */
+    CACHE_STORAGE_CAP_LRU         = 0x04, /*< Storage capable of LRU eviction. */
+    CACHE_STORAGE_CAP_MAX_COUNT   = 0x08, /*< Storage capable of capping number of entries.*/
+    CACHE_STORAGE_CAP_MAX_SIZE    = 0x10, /*< Storage capable of capping size of cache.*/
+    CACHE_STORAGE_CAP_INVALIDATION = 0x20, /*< Storage capable of invalidating entries by word. */
 } cache_storage_capabilities_t;
 
 static inline bool cache_storage_has_cap(uint32_t capabilities, uint32_t mask)
@@ -138,6 +145,13 @@ typedef struct cache_storage_config_t
      * specify 0, unless CACHE_STORAGE_CAP_MAX_SIZE is returned at initialization.
      */
     uint64_t max_size;
+
+    /**
+     * Whether the storage should maintain the information needed for
+     * invalidating entries. The caller should specify CACHE_INVALIDATE_NEVER,
+     * unless CACHE_STORAGE_CAP_INVALIDATION is returned at initialization.
+     */
+    cache_invalidate_t invalidate;
 } CACHE_STORAGE_CONFIG;
 
 typedef struct cache_storage_api
@@ -225,6 +239,10 @@ typedef struct cache_storage_api
      *
      * @param storage    Pointer to a CACHE_STORAGE.
      * @param key        A key generated with get_key.
+     * @param words      The invalidation words of the value, that is, the
+     *                   fully qualified names of the tables the value depends on.
+     *                   Ignored unless the storage was created with invalidation.
+     * @param n_words    The number of words in @c words.
      * @param value      Pointer to GWBUF containing the value to be stored.
      *                   Must be one contiguous buffer.
      *
@@ -234,6 +252,8 @@ typedef struct cache_storage_api
      */
     cache_result_t (*putValue)(CACHE_STORAGE* storage,
                                const CACHE_KEY* key,
+                               const char* const* words,
+                               size_t n_words,
                                const GWBUF* value);
 
     /**
@@ -248,6 +268,21 @@ typedef struct cache_storage_api
     cache_result_t (*delValue)(CACHE_STORAGE* storage,
                                const CACHE_KEY* key);
 
+    /**
+     * Invalidate all values that depend upon any of the provided words.
+     *
+     * @param storage    Pointer to a CACHE_STORAGE.
+     * @param words      The fully qualified names of modified tables.
+     * @param n_words    The number of words in @c words.
+     *
+     * @return CACHE_RESULT_OK if the values were invalidated,
+     *         CACHE_RESULT_OUT_OF_RESOURCES if the storage is incapable of
+     *         invalidating, and CACHE_RESULT_ERROR otherwise.
+     */
+    cache_result_t (*invalidate)(CACHE_STORAGE* storage,
+                                 const char* const* words,
+                                 size_t n_words);
+
     /**
      * Get the head item from the storage. This is only intended for testing and
      * debugging purposes and if the storage is being used by different threads
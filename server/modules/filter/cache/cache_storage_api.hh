@@ -75,13 +75,15 @@ public:
                        uint32_t hard_ttl = 0,
                        uint32_t soft_ttl = 0,
                        uint32_t max_count = 0,
-                       uint64_t max_size = 0)
+                       uint64_t max_size = 0,
+                       cache_invalidate_t invalidate = CACHE_INVALIDATE_NEVER)
     {
         this->thread_model = thread_model;
         this->hard_ttl = hard_ttl;
         this->soft_ttl = soft_ttl;
         this->max_count = max_count;
         this->max_size = max_size;
+        this->invalidate = invalidate;
     }
 
     CacheStorageConfig()
@@ -91,6 +93,7 @@ public:
         soft_ttl = 0;
         max_count = 0;
         max_size = 0;
+        invalidate = CACHE_INVALIDATE_NEVER;
     }
 
     CacheStorageConfig(const CACHE_STORAGE_CONFIG& config)
@@ -100,5 +103,6 @@ public:
         soft_ttl = config.soft_ttl;
         max_count = config.max_count;
         max_size = config.max_size;
+        invalidate = config.invalidate;
     }
 };
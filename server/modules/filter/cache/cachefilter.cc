@@ -38,6 +38,7 @@ void cache_config_finish(CACHE_CONFIG& config)
     MXS_FREE(config.storage);
     MXS_FREE(config.storage_options);
     MXS_FREE(config.storage_argv); // The items need not be freed, they point into storage_options.
+    MXS_FREE(config.snapshot_file);
 
     config.max_resultset_rows = 0;
     config.max_resultset_size = 0;
@@ -51,6 +52,12 @@ void cache_config_finish(CACHE_CONFIG& config)
     config.debug = 0;
     config.thread_model = CACHE_THREAD_MODEL_MT;
     config.selects = CACHE_SELECTS_VERIFY_CACHEABLE;
+    config.invalidate = CACHE_INVALIDATE_NEVER;
+    config.single_flight = false;
+    config.single_flight_timeout = 0;
+    config.stale_while_revalidate = false;
+    config.snapshot_file = NULL;
+    config.snapshot_interval = 0;
 }
 
 /**
@@ -102,6 +109,31 @@ bool cache_command_show(const MODULECMD_ARG* pArgs)
     return true;
 }
 
+/**
+ * Implement "call command cache stats ..."
+ *
+ * @param pArgs  The arguments of the command.
+ *
+ * @return True, if the command was handled.
+ */
+bool cache_command_stats(const MODULECMD_ARG* pArgs)
+{
+    ss_dassert(pArgs->argc == 2);
+    ss_dassert(MODULECMD_GET_TYPE(&pArgs->argv[0].type) == MODULECMD_ARG_OUTPUT);
+    ss_dassert(MODULECMD_GET_TYPE(&pArgs->argv[1].type) == MODULECMD_ARG_FILTER);
+
+    DCB* pDcb = pArgs->argv[0].value.dcb;
+    ss_dassert(pDcb);
+
+    const MXS_FILTER_DEF* pFilterDef = pArgs->argv[1].value.filter;
+    ss_dassert(pFilterDef);
+    CacheFilter* pFilter = reinterpret_cast<CacheFilter*>(filter_def_get_instance(pFilterDef));
+
+    MXS_EXCEPTION_GUARD(pFilter->cache().show(pDcb, Cache::INFO_STATISTICS));
+
+    return true;
+}
+
 int cache_process_init()
 {
     uint32_t jit_available;
@@ -138,6 +170,14 @@ static const MXS_ENUM_VALUE parameter_selects_values[] =
     {NULL}
 };
 
+// Enumeration values for `invalidate`
+static const MXS_ENUM_VALUE parameter_invalidate_values[] =
+{
+    {"never",   CACHE_INVALIDATE_NEVER},
+    {"current", CACHE_INVALIDATE_CURRENT},
+    {NULL}
+};
+
 extern "C" MXS_MODULE* MXS_CREATE_MODULE()
 {
     static modulecmd_arg_type_t show_argv[] =
@@ -149,6 +189,9 @@ extern "C" MXS_MODULE* MXS_CREATE_MODULE()
     modulecmd_register_command(MXS_MODULE_NAME, "show", cache_command_show,
                                MXS_ARRAY_NELEMS(show_argv), show_argv);
 
+    modulecmd_register_command(MXS_MODULE_NAME, "stats", cache_command_stats,
+                               MXS_ARRAY_NELEMS(show_argv), show_argv);
+
     MXS_NOTICE("Initialized cache module %s.\n", VERSION_STRING);
 
     static MXS_MODULE info =
@@ -226,6 +269,37 @@ extern "C" MXS_MODULE* MXS_CREATE_MODULE()
                 MXS_MODULE_OPT_NONE,
                 parameter_selects_values
             },
+            {
+                "invalidate",
+                MXS_MODULE_PARAM_ENUM,
+                CACHE_DEFAULT_INVALIDATE,
+                MXS_MODULE_OPT_NONE,
+                parameter_invalidate_values
+            },
+            {
+                "single_flight",
+                MXS_MODULE_PARAM_BOOL,
+                CACHE_DEFAULT_SINGLE_FLIGHT
+            },
+            {
+                "single_flight_timeout",
+                MXS_MODULE_PARAM_COUNT,
+                CACHE_DEFAULT_SINGLE_FLIGHT_TIMEOUT
+            },
+            {
+                "stale_while_revalidate",
+                MXS_MODULE_PARAM_BOOL,
+                CACHE_DEFAULT_STALE_WHILE_REVALIDATE
+            },
+            {
+                "snapshot_file",
+                MXS_MODULE_PARAM_STRING
+            },
+            {
+                "snapshot_interval",
+                MXS_MODULE_PARAM_COUNT,
+                CACHE_DEFAULT_SNAPSHOT_INTERVAL
+            },
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -325,6 +399,14 @@ bool CacheFilter::process_params(char **pzOptions, MXS_CONFIG_PARAMETER *ppParam
     config.selects = static_cast<cache_selects_t>(config_get_enum(ppParams,
                                                                   "selects",
                                                                   parameter_selects_values));
+    config.invalidate = static_cast<cache_invalidate_t>(config_get_enum(ppParams,
+                                                                        "invalidate",
+                                                                        parameter_invalidate_values));
+    config.single_flight = config_get_bool(ppParams, "single_flight");
+    config.single_flight_timeout = config_get_integer(ppParams, "single_flight_timeout");
+    config.stale_while_revalidate = config_get_bool(ppParams, "stale_while_revalidate");
+    config.snapshot_file = config_copy_string(ppParams, "snapshot_file");
+    config.snapshot_interval = config_get_integer(ppParams, "snapshot_interval");
 
     if (!config.storage)
     {
@@ -398,6 +480,14 @@ bool CacheFilter::process_params(char **pzOptions, MXS_CONFIG_PARAMETER *ppParam
             config.soft_ttl = config.hard_ttl;
         }
 
+        if (config.snapshot_file && (config.thread_model != CACHE_THREAD_MODEL_MT))
+        {
+            MXS_WARNING("The cache can be persisted using 'snapshot_file' only if "
+                        "'cached_data' is 'shared'. Ignoring 'snapshot_file'.");
+            MXS_FREE(config.snapshot_file);
+            config.snapshot_file = NULL;
+        }
+
         if (config.max_resultset_size == 0)
         {
             if (config.max_size != 0)
@@ -58,6 +58,16 @@
 #define CACHE_DEFAULT_SELECTS            "verify_cacheable"
 // Storage
 #define CACHE_DEFAULT_STORAGE            "storage_inmemory"
+// Invalidation
+#define CACHE_DEFAULT_INVALIDATE         "never"
+// Boolean
+#define CACHE_DEFAULT_SINGLE_FLIGHT      "false"
+// Milliseconds
+#define CACHE_DEFAULT_SINGLE_FLIGHT_TIMEOUT "1000"
+// Boolean
+#define CACHE_DEFAULT_STALE_WHILE_REVALIDATE "false"
+// Seconds
+#define CACHE_DEFAULT_SNAPSHOT_INTERVAL  "0"
 
 typedef enum cache_selects
 {
@@ -81,4 +91,10 @@ typedef struct cache_config
     uint32_t debug;                    /**< Debug settings. */
     cache_thread_model_t thread_model; /**< Thread model. */
     cache_selects_t selects;           /**< Assume/verify that selects are cacheable. */
+    cache_invalidate_t invalidate;     /**< Whether modifications invalidate cached results. */
+    bool single_flight;                /**< Whether concurrent misses of a key are coalesced. */
+    uint32_t single_flight_timeout;    /**< How long to wait for a coalesced miss, in ms. */
+    bool stale_while_revalidate;       /**< Whether stale values are returned while being refreshed. */
+    char* snapshot_file;               /**< Name of the file the cache is persisted to. */
+    uint32_t snapshot_interval;        /**< How often the cache is persisted, in seconds. */
 } CACHE_CONFIG;
@@ -14,10 +14,14 @@
 #define MXS_MODULE_NAME "cache"
 #include "cachefiltersession.hh"
 #include <new>
+#include <time.h>
 #include <maxscale/alloc.h>
 #include <maxscale/modutil.h>
 #include <maxscale/mysql_utils.h>
+#include <maxscale/poll.h>
+#include <maxscale/probes.h>
 #include <maxscale/query_classifier.h>
+#include <maxscale/utils.h>
 #include "storage.hh"
 
 namespace
@@ -33,6 +37,9 @@ inline bool cache_max_resultset_size_exceeded(const CACHE_CONFIG& config, uint64
     return config.max_resultset_size == 0 ? false : size > config.max_resultset_size;
 }
 
+// How often a parked query checks whether its result has become available.
+const int SINGLE_FLIGHT_RETRY_INTERVAL = 5;
+
 }
 
 namespace
@@ -139,6 +146,50 @@ bool uses_non_cacheable_variable(GWBUF* pPacket)
 namespace
 {
 
+/**
+ * Get the fully qualified and lower-cased names of the tables a statement
+ * refers to, in the form used as invalidation words.
+ *
+ * @param pStmt       A COM_QUERY packet.
+ * @param zDefaultDb  The default database, can be NULL.
+ * @param pNames      The names are appended to this vector.
+ */
+void get_table_names(GWBUF* pStmt, const char* zDefaultDb, std::vector<std::string>* pNames)
+{
+    int n_tables = 0;
+    char** pzTables = qc_get_table_names(pStmt, &n_tables, true);
+
+    if (pzTables)
+    {
+        for (int i = 0; i < n_tables; ++i)
+        {
+            std::string name;
+
+            if (!strchr(pzTables[i], '.') && zDefaultDb)
+            {
+                name = zDefaultDb;
+                name += '.';
+            }
+
+            name += pzTables[i];
+
+            // Table names may or may not be case sensitive, depending upon the
+            // server. With lower-cased names, the worst case is an unnecessary
+            // invalidation.
+            for (std::string::iterator j = name.begin(); j != name.end(); ++j)
+            {
+                *j = tolower(*j);
+            }
+
+            pNames->push_back(name);
+
+            MXS_FREE(pzTables[i]);
+        }
+
+        MXS_FREE(pzTables);
+    }
+}
+
 bool is_select_statement(GWBUF* pStmt)
 {
     bool is_select = false;
@@ -185,6 +236,16 @@ CacheFilterSession::CacheFilterSession(MXS_SESSION* pSession, Cache* pCache, cha
     , m_zUseDb(NULL)
     , m_refreshing(false)
     , m_is_read_only(true)
+    , m_invalidations(0)
+    , m_pParked(NULL)
+    , m_parked_until(0)
+    , m_closed(false)
+    , m_revalidating(false)
+    , m_pHeld(NULL)
+    , m_pRule_stats(NULL)
+    , m_has_digest(false)
+    , m_digest(0)
+    , m_fetch_started(0)
 {
     m_key.data = 0;
 
@@ -193,6 +254,8 @@ CacheFilterSession::CacheFilterSession(MXS_SESSION* pSession, Cache* pCache, cha
 
 CacheFilterSession::~CacheFilterSession()
 {
+    gwbuf_free(m_pParked);
+    gwbuf_free(m_pHeld);
     MXS_FREE(m_zUseDb);
     MXS_FREE(m_zDefaultDb);
 }
@@ -228,6 +291,15 @@ CacheFilterSession* CacheFilterSession::Create(Cache* pCache, MXS_SESSION* pSess
 
 void CacheFilterSession::close()
 {
+    m_closed = true;
+
+    gwbuf_free(m_pParked);
+    m_pParked = NULL;
+
+    gwbuf_free(m_pHeld);
+    m_pHeld = NULL;
+
+    release_key();
 }
 
 int CacheFilterSession::routeQuery(GWBUF* pPacket)
@@ -239,14 +311,49 @@ int CacheFilterSession::routeQuery(GWBUF* pPacket)
     ss_dassert(GWBUF_LENGTH(pPacket) >= MYSQL_HEADER_LEN + 1);
     ss_dassert(MYSQL_GET_PAYLOAD_LEN(pData) + MYSQL_HEADER_LEN == GWBUF_LENGTH(pPacket));
 
+    if (m_revalidating)
+    {
+        // The server is still busy refreshing a stale value that already has
+        // been returned to the client. The query is routed once the response
+        // to the refresh has been received, so that the responses will not
+        // get mixed up.
+        m_pHeld = gwbuf_append(m_pHeld, pPacket);
+        return 1;
+    }
+
     bool fetch_from_server = true;
 
+    if (m_pParked)
+    {
+        // The client did not wait for the response of the parked query, so
+        // we can't either.
+        GWBUF* pParked = m_pParked;
+        m_pParked = NULL;
+        m_down.routeQuery(pParked);
+    }
+
+    int command = MYSQL_GET_COMMAND(pData);
+
+    if ((command == MYSQL_COM_STMT_SEND_LONG_DATA) || (command == MYSQL_COM_STMT_CLOSE))
+    {
+        // The server does not respond to these, so the handling of the response
+        // to an earlier statement must not be affected.
+        track_statement(pPacket);
+        return m_down.routeQuery(pPacket);
+    }
+
+    // If the response to the previous query was not handled completely.
+    release_key();
+
     reset_response_state();
     m_state = CACHE_IGNORING_RESPONSE;
+    m_tables.clear();
+    m_pRule_stats = NULL;
+    m_has_digest = false;
 
     int rv;
 
-    switch ((int)MYSQL_GET_COMMAND(pData))
+    switch (command)
     {
     case MYSQL_COM_INIT_DB:
         {
@@ -273,90 +380,70 @@ int CacheFilterSession::routeQuery(GWBUF* pPacket)
         break;
 
     case MYSQL_COM_STMT_PREPARE:
-        if (log_decisions())
-        {
-            MXS_NOTICE("MYSQL_COM_STMT_PREPARE, ignoring.");
-        }
+        prepare_statement(pPacket);
         break;
 
     case MYSQL_COM_STMT_EXECUTE:
-        if (log_decisions())
         {
-            MXS_NOTICE("MYSQL_COM_STMT_EXECUTE, ignoring.");
-        }
-        break;
+            PreparedStmt* pStmt = NULL;
+            bool cacheable = get_execute_key(pPacket, &pStmt);
 
-    case MYSQL_COM_QUERY:
-        if (should_consult_cache(pPacket))
-        {
-            if (m_pCache->should_store(m_zDefaultDb, pPacket))
+            if (pStmt)
             {
-                if (m_pCache->should_use(m_pSession))
-                {
-                    GWBUF* pResponse;
-                    cache_result_t result = get_cached_response(pPacket, &pResponse);
+                // The decisions are based upon the prepared statement.
+                GWBUF* pQuery = pStmt->sQuery.get();
+                const char* zDb = pStmt->db.empty() ? NULL : pStmt->db.c_str();
 
-                    if (CACHE_RESULT_IS_OK(result))
+                if (should_consult_cache(pQuery))
+                {
+                    if (!cacheable)
                     {
-                        if (CACHE_RESULT_IS_STALE(result))
-                        {
-                            // The value was found, but it was stale. Now we need to
-                            // figure out whether somebody else is already fetching it.
-
-                            if (m_pCache->must_refresh(m_key, this))
-                            {
-                                // We were the first ones who hit the stale item. It's
-                                // our responsibility now to fetch it.
-                                if (log_decisions())
-                                {
-                                    MXS_NOTICE("Cache data is stale, fetching fresh from server.");
-                                }
-
-                                // As we don't use the response it must be freed.
-                                gwbuf_free(pResponse);
-
-                                m_refreshing = true;
-                                fetch_from_server = true;
-                            }
-                            else
-                            {
-                                // Somebody is already fetching the new value. So, let's
-                                // use the stale value. No point in hitting the server twice.
-                                if (log_decisions())
-                                {
-                                    MXS_NOTICE("Cache data is stale but returning it, fresh "
-                                               "data is being fetched already.");
-                                }
-                                fetch_from_server = false;
-                            }
-                        }
-                        else
+                        if (log_decisions())
                         {
-                            if (log_decisions())
-                            {
-                                MXS_NOTICE("Using fresh data from cache.");
-                            }
-                            fetch_from_server = false;
+                            MXS_NOTICE("MYSQL_COM_STMT_EXECUTE with a cursor or long data, ignoring.");
                         }
                     }
-                    else
+                    else if (m_pCache->should_store(zDb, pQuery, &m_pRule_stats))
                     {
-                        fetch_from_server = true;
+                        if (m_pCache->should_use(m_pSession))
+                        {
+                            fetch_from_server = route_via_cache(pPacket, pQuery, zDb, &rv);
+                        }
                     }
+                }
+                else if (m_pCache->config().invalidate != CACHE_INVALIDATE_NEVER)
+                {
+                    prepare_invalidation(pQuery);
+                }
+
+                // The long data of the parameters is consumed by the execution.
+                pStmt->long_data = false;
+            }
+            else if (log_decisions())
+            {
+                MXS_NOTICE("MYSQL_COM_STMT_EXECUTE of unknown statement, ignoring.");
+            }
+        }
+        break;
+
+    case MYSQL_COM_STMT_RESET:
+        track_statement(pPacket);
+        break;
 
-                    if (fetch_from_server)
+    case MYSQL_COM_QUERY:
+        if (should_consult_cache(pPacket))
+        {
+            if (m_pCache->should_store(m_zDefaultDb, pPacket, &m_pRule_stats))
+            {
+                if (m_pCache->should_use(m_pSession))
+                {
+                    if (CACHE_RESULT_IS_OK(m_pCache->get_key(m_zDefaultDb, pPacket, &m_key)))
                     {
-                        m_state = CACHE_EXPECTING_RESPONSE;
+                        fetch_from_server = route_via_cache(pPacket, pPacket, m_zDefaultDb, &rv);
                     }
                     else
                     {
-                        m_state = CACHE_EXPECTING_NOTHING;
-                        gwbuf_free(pPacket);
-                        DCB *dcb = m_pSession->client_dcb;
-
-                        // TODO: This is not ok. Any filters before this filter, will not
-                        // TODO: see this data.
-                        rv = dcb->func.write(dcb, pResponse);
+                        MXS_ERROR("Could not create cache key.");
                     }
                 }
             }
@@ -365,6 +452,10 @@ int CacheFilterSession::routeQuery(GWBUF* pPacket)
                 m_state = CACHE_IGNORING_RESPONSE;
             }
         }
+        else if (m_pCache->config().invalidate != CACHE_INVALIDATE_NEVER)
+        {
+            prepare_invalidation(pPacket);
+        }
         break;
 
     default:
@@ -374,11 +465,164 @@ int CacheFilterSession::routeQuery(GWBUF* pPacket)
     if (fetch_from_server)
     {
         rv = m_down.routeQuery(pPacket);
+
+        if (m_revalidating)
+        {
+            // The client already got its response.
+            rv = 1;
+        }
     }
 
     return rv;
 }
 
+/**
+ * Route a cacheable statement via the cache. The key of the statement
+ * must be in @c m_key.
+ *
+ * @param pPacket  The packet received from the client.
+ * @param pQuery   The statement as a COM_QUERY; @c pPacket itself, or the
+ *                 prepared statement if @c pPacket is a COM_STMT_EXECUTE.
+ * @param zDb      The default database of the statement, can be NULL.
+ * @param pRv      If false is returned, the value to return to the client.
+ *
+ * @return True, if the packet should be sent to the server. If false is
+ *         returned, the session has taken ownership of the packet.
+ */
+bool CacheFilterSession::route_via_cache(GWBUF* pPacket, GWBUF* pQuery, const char* zDb, int* pRv)
+{
+    bool fetch_from_server = true;
+
+    m_has_digest = modutil_get_canonical_digest(pQuery, &m_digest);
+
+    GWBUF* pResponse;
+    cache_result_t result = m_pCache->get_value(m_key, CACHE_FLAGS_INCLUDE_STALE, &pResponse);
+
+    if (CACHE_RESULT_IS_OK(result))
+    {
+        MXS_PROBE2(cache_hit, m_pSession->ses_id, CACHE_RESULT_IS_STALE(result) ? 1 : 0);
+    }
+    else
+    {
+        MXS_PROBE1(cache_miss, m_pSession->ses_id);
+    }
+
+    if (CACHE_RESULT_IS_OK(result))
+    {
+        if (CACHE_RESULT_IS_STALE(result))
+        {
+            // The value was found, but it was stale. Now we need to
+            // figure out whether somebody else is already fetching it.
+
+            if (m_pCache->must_refresh(m_key, this))
+            {
+                // We were the first ones who hit the stale item. It's
+                // our responsibility now to fetch it.
+                m_refreshing = true;
+                fetch_from_server = true;
+
+                if (m_pCache->config().stale_while_revalidate)
+                {
+                    // The client gets the stale value right away and the
+                    // response to the query is only stored.
+                    if (log_decisions())
+                    {
+                        MXS_NOTICE("Cache data is stale, returning it and "
+                                   "fetching fresh from server.");
+                    }
+
+                    record_hit(pResponse);
+
+                    DCB *dcb = m_pSession->client_dcb;
+
+                    // TODO: This is not ok. Any filters before this filter, will not
+                    // TODO: see this data.
+                    dcb->func.write(dcb, pResponse);
+
+                    m_revalidating = true;
+                }
+                else
+                {
+                    if (log_decisions())
+                    {
+                        MXS_NOTICE("Cache data is stale, fetching fresh from server.");
+                    }
+
+                    // As we don't use the response it must be freed.
+                    gwbuf_free(pResponse);
+                }
+            }
+            else
+            {
+                // Somebody is already fetching the new value. So, let's
+                // use the stale value. No point in hitting the server twice.
+                if (log_decisions())
+                {
+                    MXS_NOTICE("Cache data is stale but returning it, fresh "
+                               "data is being fetched already.");
+                }
+                fetch_from_server = false;
+            }
+        }
+        else
+        {
+            if (log_decisions())
+            {
+                MXS_NOTICE("Using fresh data from cache.");
+            }
+            fetch_from_server = false;
+        }
+    }
+    else if (m_pCache->config().single_flight && CACHE_RESULT_IS_NOT_FOUND(result))
+    {
+        if (m_pCache->must_refresh(m_key, this))
+        {
+            // We were the first ones to miss, other sessions missing
+            // the same will wait for us to fetch the result.
+            m_refreshing = true;
+            fetch_from_server = true;
+        }
+        else if (park(pPacket, pQuery, zDb))
+        {
+            if (log_decisions())
+            {
+                MXS_NOTICE("Cache miss, waiting for the result being fetched already.");
+            }
+
+            fetch_from_server = false;
+            pPacket = NULL;
+            *pRv = 1;
+        }
+        else
+        {
+            fetch_from_server = true;
+        }
+    }
+    else
+    {
+        fetch_from_server = true;
+    }
+
+    if (fetch_from_server)
+    {
+        prepare_fetch(pQuery, zDb);
+    }
+    else if (pPacket)
+    {
+        record_hit(pResponse);
+
+        m_state = CACHE_EXPECTING_NOTHING;
+        gwbuf_free(pPacket);
+        DCB *dcb = m_pSession->client_dcb;
+
+        // TODO: This is not ok. Any filters before this filter, will not
+        // TODO: see this data.
+        *pRv = dcb->func.write(dcb, pResponse);
+    }
+
+    return fetch_from_server;
+}
+
 int CacheFilterSession::clientReply(GWBUF* pData)
 {
     int rv;
@@ -394,7 +638,7 @@ int CacheFilterSession::clientReply(GWBUF* pData)
         m_res.length = gwbuf_length(pData);
     }
 
-    if (m_state != CACHE_IGNORING_RESPONSE)
+    if ((m_state != CACHE_IGNORING_RESPONSE) && m_res.cacheable)
     {
         if (cache_max_resultset_size_exceeded(m_pCache->config(), m_res.length))
         {
@@ -406,7 +650,17 @@ int CacheFilterSession::clientReply(GWBUF* pData)
                            m_pCache->config().max_resultset_size / 1024);
             }
 
-            m_state = CACHE_IGNORING_RESPONSE;
+            record_size_rejected();
+
+            if (m_revalidating)
+            {
+                // The response must still be followed, to know when it ends.
+                m_res.cacheable = false;
+            }
+            else
+            {
+                m_state = CACHE_IGNORING_RESPONSE;
+            }
         }
     }
 
@@ -436,6 +690,14 @@ int CacheFilterSession::clientReply(GWBUF* pData)
         rv = handle_ignoring_response();
         break;
 
+    case CACHE_EXPECTING_UPDATE_RESPONSE:
+        rv = handle_expecting_update_response();
+        break;
+
+    case CACHE_EXPECTING_PREPARE_RESPONSE:
+        rv = handle_expecting_prepare_response();
+        break;
+
     default:
         MXS_ERROR("Internal cache logic broken, unexpected state: %d", m_state);
         ss_dassert(!true);
@@ -444,6 +706,21 @@ int CacheFilterSession::clientReply(GWBUF* pData)
         m_state = CACHE_IGNORING_RESPONSE;
     }
 
+    if ((m_state != CACHE_EXPECTING_RESPONSE) &&
+        (m_state != CACHE_EXPECTING_FIELDS) &&
+        (m_state != CACHE_EXPECTING_ROWS))
+    {
+        // If the result was fetched but not stored, e.g. because it was too
+        // large, others waiting for it must not wait any longer.
+        release_key();
+
+        if (m_revalidating)
+        {
+            m_revalidating = false;
+            route_held();
+        }
+    }
+
     return rv;
 }
 
@@ -654,15 +931,27 @@ int CacheFilterSession::handle_expecting_rows()
                 m_res.offset += packetlen;
                 ++m_res.nRows;
 
-                if (cache_max_resultset_rows_exceeded(m_pCache->config(), m_res.nRows))
+                if (m_res.cacheable &&
+                    cache_max_resultset_rows_exceeded(m_pCache->config(), m_res.nRows))
                 {
                     if (log_decisions())
                     {
                         MXS_NOTICE("Max rows %lu reached, not caching result.", m_res.nRows);
                     }
-                    rv = send_upstream();
-                    m_res.offset = buflen; // To abort the loop.
-                    m_state = CACHE_IGNORING_RESPONSE;
+
+                    record_size_rejected();
+
+                    if (m_revalidating)
+                    {
+                        // The response must still be followed, to know when it ends.
+                        m_res.cacheable = false;
+                    }
+                    else
+                    {
+                        rv = send_upstream();
+                        m_res.offset = buflen; // To abort the loop.
+                        m_state = CACHE_IGNORING_RESPONSE;
+                    }
                 }
             }
         }
@@ -738,6 +1027,90 @@ int CacheFilterSession::handle_ignoring_response()
     return send_upstream();
 }
 
+/**
+ * Called when a response to a modification, or to the end of a transaction
+ * containing modifications, is received from the server.
+ */
+int CacheFilterSession::handle_expecting_update_response()
+{
+    ss_dassert(m_state == CACHE_EXPECTING_UPDATE_RESPONSE);
+    ss_dassert(m_res.pData);
+
+    int rv = 1;
+
+    size_t buflen = m_res.length;
+    ss_dassert(m_res.length == gwbuf_length(m_res.pData));
+
+    if (buflen >= MYSQL_HEADER_LEN + 1) // We need the command byte.
+    {
+        uint8_t command;
+
+        gwbuf_copy_data(m_res.pData, MYSQL_HEADER_LEN, 1, &command);
+
+        if (command == MYSQL_REPLY_OK)
+        {
+            if (log_decisions())
+            {
+                MXS_NOTICE("Modification of %lu table(s) succeeded, invalidating.",
+                           m_modified_tables.size());
+            }
+
+            cache_result_t result = m_pCache->invalidate(m_modified_tables);
+
+            if (!CACHE_RESULT_IS_OK(result))
+            {
+                MXS_ERROR("Could not invalidate cache items.");
+            }
+        }
+
+        // If the modification failed, nothing was changed.
+        m_modified_tables.clear();
+
+        rv = send_upstream();
+        m_state = CACHE_IGNORING_RESPONSE;
+    }
+
+    return rv;
+}
+
+/**
+ * Called when a response to a COM_STMT_PREPARE is received from the server.
+ */
+int CacheFilterSession::handle_expecting_prepare_response()
+{
+    ss_dassert(m_state == CACHE_EXPECTING_PREPARE_RESPONSE);
+    ss_dassert(m_res.pData);
+
+    int rv = 1;
+
+    size_t buflen = m_res.length;
+    ss_dassert(m_res.length == gwbuf_length(m_res.pData));
+
+    // Status, statement id, number of columns and number of parameters.
+    // An error packet is at least as long.
+    uint8_t header[MYSQL_HEADER_LEN + 1 + 4 + 2 + 2];
+
+    if (buflen >= sizeof(header))
+    {
+        gwbuf_copy_data(m_res.pData, 0, sizeof(header), header);
+
+        if (header[MYSQL_HEADER_LEN] == MYSQL_REPLY_OK)
+        {
+            m_preparing.id = gw_mysql_get_byte4(&header[MYSQL_HEADER_LEN + 1]);
+            m_preparing.n_params = gw_mysql_get_byte2(&header[MYSQL_HEADER_LEN + 7]);
+
+            m_stmts[m_preparing.id] = m_preparing;
+        }
+
+        m_preparing.sQuery.reset();
+
+        rv = send_upstream();
+        m_state = CACHE_IGNORING_RESPONSE;
+    }
+
+    return rv;
+}
+
 /**
  * Send data upstream.
  *
@@ -747,7 +1120,18 @@ int CacheFilterSession::send_upstream()
 {
     ss_dassert(m_res.pData != NULL);
 
-    int rv = m_up.clientReply(m_res.pData);
+    int rv = 1;
+
+    if (m_revalidating)
+    {
+        // The client already got the stale value.
+        gwbuf_free(m_res.pData);
+    }
+    else
+    {
+        rv = m_up.clientReply(m_res.pData);
+    }
+
     m_res.pData = NULL;
 
     return rv;
@@ -764,68 +1148,447 @@ void CacheFilterSession::reset_response_state()
     m_res.nFields = 0;
     m_res.nRows = 0;
     m_res.offset = 0;
+    m_res.cacheable = true;
+}
+
+/**
+ * Store the data.
+ *
+ * @param csdata Session data
+ */
+void CacheFilterSession::store_result()
+{
+    ss_dassert(m_res.pData);
+
+    if (m_has_digest)
+    {
+        m_pCache->digest_stats().record_fetch(m_digest, mxs_clock_us() - m_fetch_started);
+    }
+
+    GWBUF *pData = m_res.cacheable ? gwbuf_make_contiguous(m_res.pData) : m_res.pData;
+
+    if (!m_res.cacheable)
+    {
+        // The limits were exceeded while a stale value was being refreshed.
+    }
+    else if (pData && (m_pCache->invalidations() != m_invalidations))
+    {
+        // Something was invalidated while the result was being fetched, so
+        // the result may already be stale.
+        if (log_decisions())
+        {
+            MXS_NOTICE("Invalidation made while the result was fetched, not caching.");
+        }
+
+        m_res.pData = pData;
+    }
+    else if (pData)
+    {
+        m_res.pData = pData;
+
+        cache_result_t result = m_pCache->put_value(m_key, m_tables, m_res.pData);
+
+        if (CACHE_RESULT_IS_OK(result))
+        {
+            if (m_pRule_stats)
+            {
+                atomic_add_uint64(&m_pRule_stats->stores, 1);
+            }
+        }
+        else
+        {
+            MXS_ERROR("Could not store cache item, deleting it.");
+
+            result = m_pCache->del_value(m_key);
+
+            if (!CACHE_RESULT_IS_OK(result) || !CACHE_RESULT_IS_NOT_FOUND(result))
+            {
+                MXS_ERROR("Could not delete cache item.");
+            }
+        }
+    }
+
+    release_key();
+}
+
+/**
+ * Prepare for fetching the result of a SELECT from the server.
+ *
+ * @param pQuery  The SELECT as a COM_QUERY, or NULL if the tables it depends
+ *                upon are known already.
+ * @param zDb     The default database of the SELECT, can be NULL.
+ */
+void CacheFilterSession::prepare_fetch(GWBUF* pQuery, const char* zDb)
+{
+    m_state = CACHE_EXPECTING_RESPONSE;
+
+    if (m_pRule_stats && !m_revalidating)
+    {
+        atomic_add_uint64(&m_pRule_stats->misses, 1);
+    }
+
+    if (m_has_digest)
+    {
+        if (pQuery)
+        {
+            m_pCache->digest_stats().track(m_digest, pQuery);
+        }
+
+        m_fetch_started = mxs_clock_us();
+    }
+
+    if (m_pCache->config().invalidate != CACHE_INVALIDATE_NEVER)
+    {
+        if (pQuery)
+        {
+            get_table_names(pQuery, zDb, &m_tables);
+        }
+
+        m_invalidations = m_pCache->invalidations();
+    }
 }
 
 /**
- * Route a query via the cache.
+ * Record that the result of the current query was served from the cache.
  *
- * @param key A SELECT packet.
- * @param value The result.
- * @return True if the query was satisfied from the query.
+ * @param pResponse  The response served.
  */
-cache_result_t CacheFilterSession::get_cached_response(const GWBUF *pQuery, GWBUF **ppResponse)
+void CacheFilterSession::record_hit(GWBUF* pResponse)
 {
-    cache_result_t result = m_pCache->get_key(m_zDefaultDb, pQuery, &m_key);
+    if (m_pRule_stats)
+    {
+        atomic_add_uint64(&m_pRule_stats->hits, 1);
+        atomic_add_uint64(&m_pRule_stats->bytes_served, gwbuf_length(pResponse));
+    }
+
+    if (m_has_digest)
+    {
+        m_pCache->digest_stats().record_hit(m_digest);
+    }
+}
+
+/**
+ * Record that the result of the current query was too large to be stored.
+ */
+void CacheFilterSession::record_size_rejected()
+{
+    if (m_pRule_stats)
+    {
+        atomic_add_uint64(&m_pRule_stats->size_rejected, 1);
+    }
+}
+
+/**
+ * Let the cache know that this session is no longer fetching the value
+ * of the current key, if it was.
+ */
+void CacheFilterSession::release_key()
+{
+    if (m_refreshing)
+    {
+        m_pCache->refreshed(m_key, this);
+        m_refreshing = false;
+    }
+}
+
+/**
+ * Park a query whose result is being fetched by another session. The query
+ * is retried in this thread until the result is available, the other session
+ * gives up or the single flight timeout expires.
+ *
+ * @param pPacket  The query; owned by the session if true is returned.
+ * @param pQuery   The query as a COM_QUERY.
+ * @param zDb      The default database of the query, can be NULL.
+ *
+ * @return True if the query was parked.
+ */
+bool CacheFilterSession::park(GWBUF* pPacket, GWBUF* pQuery, const char* zDb)
+{
+    bool parked = false;
+
+    session_get_ref(m_pSession);
+
+    if (poll_add_delayed_call(SINGLE_FLIGHT_RETRY_INTERVAL, &CacheFilterSession::retry_parked, this))
+    {
+        ss_dassert(!m_pParked);
+        m_pParked = pPacket;
+        m_parked_until = mxs_clock_ms() + m_pCache->config().single_flight_timeout;
+        parked = true;
+
+        if (m_pCache->config().invalidate != CACHE_INVALIDATE_NEVER)
+        {
+            // The query may be a COM_STMT_EXECUTE, whose statement may be gone
+            // by the time the result is fetched.
+            get_table_names(pQuery, zDb, &m_tables);
+        }
+    }
+    else
+    {
+        session_put_ref(m_pSession);
+    }
+
+    return parked;
+}
+
+/**
+ * Retry a parked query.
+ */
+void CacheFilterSession::retry_parked()
+{
+    GWBUF* pResponse = NULL;
+    cache_result_t result = m_pCache->get_value(m_key, CACHE_FLAGS_INCLUDE_STALE, &pResponse);
 
     if (CACHE_RESULT_IS_OK(result))
     {
-        uint32_t flags = CACHE_FLAGS_INCLUDE_STALE;
+        if (log_decisions())
+        {
+            MXS_NOTICE("Using data fetched by another session.");
+        }
+
+        record_hit(pResponse);
 
-        result = m_pCache->get_value(m_key, flags, ppResponse);
+        gwbuf_free(m_pParked);
+        m_pParked = NULL;
+        m_state = CACHE_EXPECTING_NOTHING;
+
+        DCB *dcb = m_pSession->client_dcb;
+        dcb->func.write(dcb, pResponse);
     }
     else
     {
-        MXS_ERROR("Could not create cache key.");
+        bool fetch = false;
+
+        if (m_pCache->must_refresh(m_key, this))
+        {
+            // The other session gave up, so it is up to us.
+            m_refreshing = true;
+            fetch = true;
+        }
+        else if (mxs_clock_ms() >= m_parked_until)
+        {
+            if (log_decisions())
+            {
+                MXS_NOTICE("Result not fetched by another session in time, fetching from server.");
+            }
+
+            fetch = true;
+        }
+        else
+        {
+            session_get_ref(m_pSession);
+
+            if (!poll_add_delayed_call(SINGLE_FLIGHT_RETRY_INTERVAL,
+                                       &CacheFilterSession::retry_parked, this))
+            {
+                session_put_ref(m_pSession);
+                fetch = true;
+            }
+        }
+
+        if (fetch)
+        {
+            GWBUF* pPacket = m_pParked;
+            m_pParked = NULL;
+
+            prepare_fetch(NULL, NULL);
+            m_down.routeQuery(pPacket);
+        }
     }
+}
+
+/**
+ * Route the queries received while a stale value was being refreshed.
+ */
+void CacheFilterSession::route_held()
+{
+    GWBUF* pHeld = m_pHeld;
+    m_pHeld = NULL;
 
-    return result;
+    GWBUF* pPacket;
+
+    // If a query causes a refresh, the rest must wait for that to finish.
+    while (!m_revalidating && !m_closed && (pPacket = modutil_get_next_MySQL_packet(&pHeld)))
+    {
+        routeQuery(pPacket);
+    }
+
+    ss_dassert(!m_pHeld);
+    m_pHeld = pHeld;
+}
+
+//static
+void CacheFilterSession::retry_parked(void* pData)
+{
+    CacheFilterSession* pThis = static_cast<CacheFilterSession*>(pData);
+    MXS_SESSION* pSession = pThis->m_pSession;
+
+    // The query may have been sent to the server already, if the client
+    // sent another one while waiting.
+    if (!pThis->m_closed && pThis->m_pParked)
+    {
+        pThis->retry_parked();
+    }
+
+    session_put_ref(pSession);
 }
 
 /**
- * Store the data.
+ * Record the statement being prepared, so that its id can be associated
+ * with it once the server responds.
  *
- * @param csdata Session data
+ * @param pPacket  A COM_STMT_PREPARE packet.
  */
-void CacheFilterSession::store_result()
+void CacheFilterSession::prepare_statement(GWBUF* pPacket)
 {
-    ss_dassert(m_res.pData);
+    const char* pSql = reinterpret_cast<const char*>(GWBUF_DATA(pPacket)) + MYSQL_HEADER_LEN + 1;
+    size_t len = GWBUF_LENGTH(pPacket) - (MYSQL_HEADER_LEN + 1);
 
-    GWBUF *pData = gwbuf_make_contiguous(m_res.pData);
+    // The statement is kept as a COM_QUERY, so that it can be classified and
+    // matched against the rules exactly like a statement executed directly.
+    GWBUF* pQuery = modutil_create_query(std::string(pSql, len).c_str());
 
-    if (pData)
+    if (pQuery)
     {
-        m_res.pData = pData;
+        m_preparing.sQuery = std::tr1::shared_ptr<GWBUF>(pQuery, gwbuf_free);
+        m_preparing.db = m_zDefaultDb ? m_zDefaultDb : "";
+        m_preparing.n_params = 0;
+        m_preparing.types.clear();
+        m_preparing.long_data = false;
 
-        cache_result_t result = m_pCache->put_value(m_key, m_res.pData);
+        m_state = CACHE_EXPECTING_PREPARE_RESPONSE;
+    }
+}
 
-        if (!CACHE_RESULT_IS_OK(result))
-        {
-            MXS_ERROR("Could not store cache item, deleting it.");
+/**
+ * Track the state of a prepared statement.
+ *
+ * @param pPacket  A COM_STMT_SEND_LONG_DATA, COM_STMT_RESET or COM_STMT_CLOSE.
+ */
+void CacheFilterSession::track_statement(GWBUF* pPacket)
+{
+    const uint8_t* pData = GWBUF_DATA(pPacket);
 
-            result = m_pCache->del_value(m_key);
+    if (GWBUF_LENGTH(pPacket) >= MYSQL_HEADER_LEN + 1 + 4)
+    {
+        uint32_t id = gw_mysql_get_byte4(pData + MYSQL_HEADER_LEN + 1);
+        PreparedStmts::iterator i = m_stmts.find(id);
 
-            if (!CACHE_RESULT_IS_OK(result) || !CACHE_RESULT_IS_NOT_FOUND(result))
+        if (i != m_stmts.end())
+        {
+            switch (MYSQL_GET_COMMAND(pData))
             {
-                MXS_ERROR("Could not delete cache item.");
+            case MYSQL_COM_STMT_SEND_LONG_DATA:
+                i->second.long_data = true;
+                break;
+
+            case MYSQL_COM_STMT_RESET:
+                i->second.long_data = false;
+                break;
+
+            case MYSQL_COM_STMT_CLOSE:
+                m_stmts.erase(i);
+                break;
+
+            default:
+                ss_dassert(!true);
             }
         }
     }
+}
 
-    if (m_refreshing)
+/**
+ * Get the key of a COM_STMT_EXECUTE, based upon the prepared statement and
+ * the types and values of the parameters.
+ *
+ * @param pPacket  A COM_STMT_EXECUTE packet.
+ * @param ppStmt   On return, the executed statement, or NULL if it is unknown.
+ *
+ * @return True if the result of the execution can be cached, in which
+ *         case the key is in @c m_key.
+ */
+bool CacheFilterSession::get_execute_key(GWBUF* pPacket, PreparedStmt** ppStmt)
+{
+    bool cacheable = false;
+    *ppStmt = NULL;
+
+    const uint8_t* pData = GWBUF_DATA(pPacket);
+    const uint8_t* pEnd = pData + GWBUF_LENGTH(pPacket);
+
+    // Command, statement id, flags and iteration count.
+    const size_t fixed_len = MYSQL_HEADER_LEN + 1 + 4 + 1 + 4;
+
+    if (static_cast<size_t>(GWBUF_LENGTH(pPacket)) >= fixed_len)
     {
-        m_pCache->refreshed(m_key, this);
-        m_refreshing = false;
+        uint32_t id = gw_mysql_get_byte4(pData + MYSQL_HEADER_LEN + 1);
+        uint8_t flags = pData[MYSQL_HEADER_LEN + 5];
+        PreparedStmts::iterator i = m_stmts.find(id);
+
+        if (i != m_stmts.end())
+        {
+            PreparedStmt* pStmt = &i->second;
+            *ppStmt = pStmt;
+
+            const uint8_t* pParams = pData + fixed_len;
+            size_t n_types = 2 * pStmt->n_params;
+            size_t bitmap_len = (pStmt->n_params + 7) / 8;
+            bool valid = true;
+
+            if (pStmt->n_params != 0)
+            {
+                // The types are sent only when they change, so they must be tracked.
+                valid = (static_cast<size_t>(pEnd - pParams) >= bitmap_len + 1);
+
+                if (valid && (pParams[bitmap_len] != 0))
+                {
+                    valid = (static_cast<size_t>(pEnd - pParams) >= bitmap_len + 1 + n_types);
+
+                    if (valid)
+                    {
+                        const uint8_t* pTypes = pParams + bitmap_len + 1;
+                        pStmt->types.assign(pTypes, pTypes + n_types);
+                    }
+                }
+
+                valid = valid && (pStmt->types.size() == n_types);
+            }
+
+            // With a cursor, the rows are fetched separately.
+            if (valid && (flags == 0) && !pStmt->long_data)
+            {
+                std::vector<uint8_t> params(pStmt->types);
+
+                if (pStmt->n_params != 0)
+                {
+                    const uint8_t* pValues = pParams + bitmap_len + 1;
+
+                    if (pParams[bitmap_len] != 0)
+                    {
+                        pValues += n_types;
+                    }
+
+                    params.insert(params.end(), pParams, pParams + bitmap_len);
+                    params.insert(params.end(), pValues, pEnd);
+                }
+
+                const char* zDb = pStmt->db.empty() ? NULL : pStmt->db.c_str();
+
+                cache_result_t result = m_pCache->get_key(zDb, pStmt->sQuery.get(),
+                                                          params.empty() ? NULL : &params.front(),
+                                                          params.size(), &m_key);
+
+                if (CACHE_RESULT_IS_OK(result))
+                {
+                    cacheable = true;
+                }
+                else
+                {
+                    MXS_ERROR("Could not create cache key.");
+                }
+            }
+        }
     }
+
+    return cacheable;
 }
 
 /**
@@ -957,3 +1720,39 @@ bool CacheFilterSession::should_consult_cache(GWBUF* pPacket)
 
     return consult_cache;
 }
+
+/**
+ * Record the tables modified by a statement that is not a SELECT, and arrange
+ * for the cached results depending upon them to be invalidated once the
+ * modification has taken effect, that is, when the statement or the
+ * transaction it is part of has been committed.
+ *
+ * @param pPacket  A COM_QUERY packet.
+ */
+void CacheFilterSession::prepare_invalidation(GWBUF* pPacket)
+{
+    uint32_t type_mask = qc_get_type_mask(pPacket);
+
+    if (qc_query_is_type(type_mask, QUERY_TYPE_ROLLBACK))
+    {
+        // Nothing that was modified in the transaction became visible.
+        m_modified_tables.clear();
+    }
+    else
+    {
+        if (qc_query_is_type(type_mask, QUERY_TYPE_WRITE))
+        {
+            get_table_names(pPacket, m_zDefaultDb, &m_modified_tables);
+        }
+
+        // DDL statements cause an implicit commit.
+        const uint32_t ddl = QUERY_OP_TRUNCATE | QUERY_OP_ALTER | QUERY_OP_CREATE | QUERY_OP_DROP;
+        bool is_ddl = (qc_get_operation(pPacket) & ddl) != 0;
+
+        if (!m_modified_tables.empty() &&
+            (is_ddl || session_trx_is_ending(m_pSession) || !session_trx_is_active(m_pSession)))
+        {
+            m_state = CACHE_EXPECTING_UPDATE_RESPONSE;
+        }
+    }
+}
@@ -13,6 +13,10 @@
  */
 
 #include <maxscale/cppdefs.hh>
+#include <string>
+#include <vector>
+#include <tr1/memory>
+#include <tr1/unordered_map>
 #include <maxscale/buffer.h>
 #include <maxscale/filter.hh>
 #include "cache.hh"
@@ -30,6 +34,8 @@ public:
         CACHE_EXPECTING_NOTHING,      // We are not expecting anything from the server.
         CACHE_EXPECTING_USE_RESPONSE, // A "USE DB" was issued.
         CACHE_IGNORING_RESPONSE,      // We are not interested in the data received from the server.
+        CACHE_EXPECTING_UPDATE_RESPONSE, // A modification has been sent, we need to know if it succeeded.
+        CACHE_EXPECTING_PREPARE_RESPONSE, // A statement is being prepared, we need to know its id.
     };
 
     struct CACHE_RESPONSE_STATE
@@ -40,6 +46,7 @@ public:
         size_t nFields;      /**< How many fields we have received, <= n_totalfields. */
         size_t nRows;        /**< How many rows we have received. */
         size_t offset;       /**< Where we are in the response buffer. */
+        bool   cacheable;    /**< Whether the response may be stored. */
     };
 
     /**
@@ -92,13 +99,13 @@ private:
     int handle_expecting_rows();
     int handle_expecting_use_response();
     int handle_ignoring_response();
+    int handle_expecting_update_response();
+    int handle_expecting_prepare_response();
 
     int send_upstream();
 
     void reset_response_state();
 
-    cache_result_t get_cached_response(const GWBUF *pQuery, GWBUF **ppResponse);
-
     bool log_decisions() const
     {
         return m_pCache->config().debug & CACHE_DEBUG_DECISIONS ? true : false;
@@ -108,6 +115,44 @@ private:
 
     bool should_consult_cache(GWBUF* pPacket);
 
+    void prepare_invalidation(GWBUF* pPacket);
+
+    bool route_via_cache(GWBUF* pPacket, GWBUF* pQuery, const char* zDb, int* pRv);
+
+    void prepare_fetch(GWBUF* pQuery, const char* zDb);
+
+    void release_key();
+
+    bool park(GWBUF* pPacket, GWBUF* pQuery, const char* zDb);
+
+    void retry_parked();
+
+    static void retry_parked(void* pData);
+
+    void route_held();
+
+    void record_hit(GWBUF* pResponse);
+
+    void record_size_rejected();
+
+    struct PreparedStmt
+    {
+        uint32_t                    id;        /**< The id of the statement. */
+        std::tr1::shared_ptr<GWBUF> sQuery;    /**< The statement as a COM_QUERY. */
+        std::string                 db;        /**< The default database when prepared, if any. */
+        uint16_t                    n_params;  /**< The number of parameters. */
+        std::vector<uint8_t>        types;     /**< The types of the parameters bound last. */
+        bool                        long_data; /**< Whether long data has been sent for a parameter. */
+    };
+
+    typedef std::tr1::unordered_map<uint32_t, PreparedStmt> PreparedStmts;
+
+    void prepare_statement(GWBUF* pPacket);
+
+    void track_statement(GWBUF* pPacket);
+
+    bool get_execute_key(GWBUF* pPacket, PreparedStmt** ppStmt);
+
 private:
     CacheFilterSession(MXS_SESSION* pSession, Cache* pCache, char* zDefaultDb);
 
@@ -123,5 +168,19 @@ private:
     char*                 m_zUseDb;      /**< Pending default database. Needs server response. */
     bool                  m_refreshing;  /**< Whether the session is updating a stale cache entry. */
     bool                  m_is_read_only;/**< Whether the current trx has been read-only in pratice. */
+    std::vector<std::string> m_tables;   /**< The tables the pending result depends upon. */
+    uint64_t              m_invalidations; /**< The number of invalidations when the result was requested. */
+    std::vector<std::string> m_modified_tables; /**< The tables modified in the current trx. */
+    GWBUF*                m_pParked;     /**< A query waiting for another session to fetch its result. */
+    uint64_t              m_parked_until;/**< When to stop waiting and fetch the result ourselves. */
+    bool                  m_closed;      /**< Whether the session has been closed. */
+    bool                  m_revalidating;/**< Whether a stale value already returned is being refreshed. */
+    GWBUF*                m_pHeld;       /**< Queries received while revalidating. */
+    PreparedStmts         m_stmts;       /**< The prepared statements of the session. */
+    PreparedStmt          m_preparing;   /**< The statement being prepared. */
+    CACHE_RULE_STATS*     m_pRule_stats; /**< The statistics of the rule matching the current query. */
+    bool                  m_has_digest;  /**< Whether m_digest is valid. */
+    uint64_t              m_digest;      /**< The digest of the current query. */
+    uint64_t              m_fetch_started; /**< When the fetching of the result started, in microseconds. */
 };
 
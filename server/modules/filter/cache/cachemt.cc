@@ -13,6 +13,8 @@
 
 #define MXS_MODULE_NAME "cache"
 #include "cachemt.hh"
+#include <maxscale/housekeeper.h>
+#include "cachesnapshot.hh"
 #include "storage.hh"
 #include "storagefactory.hh"
 
@@ -25,14 +27,54 @@ CacheMT::CacheMT(const std::string&  name,
                  SStorageFactory     sFactory,
                  Storage*            pStorage)
     : CacheSimple(name, pConfig, sRules, sFactory, pStorage)
+    , m_snapshot_loaded(false)
+    , m_snapshot_saving(false)
 {
     spinlock_init(&m_lock_pending);
+    spinlock_init(&m_lock_snapshot);
+
+    if (pConfig->snapshot_file)
+    {
+        if (cache_storage_has_cap(sFactory->storage_capabilities(),
+                                  CACHE_STORAGE_CAP_MAX_COUNT | CACHE_STORAGE_CAP_MAX_SIZE))
+        {
+            MXS_WARNING("The storage '%s' manages its content itself and cannot be "
+                        "persisted using 'snapshot_file'. Ignoring 'snapshot_file'.",
+                        pConfig->storage);
+        }
+        else
+        {
+            // The configuration is freed before the cache is deleted, so
+            // a copy of the path is needed for the final snapshot.
+            m_snapshot_file = pConfig->snapshot_file;
+            m_snapshot_task = "cache_snapshot_" + name;
+
+            // The snapshot is loaded in the background, so that the startup
+            // of MaxScale is not delayed; meanwhile the cache is just colder.
+            std::string load_task = m_snapshot_task + "_load";
+            hktask_oneshot(load_task.c_str(), CacheMT::load_snapshot, this, 0);
+
+            if (pConfig->snapshot_interval != 0)
+            {
+                hktask_add(m_snapshot_task.c_str(), CacheMT::save_snapshot, this,
+                           pConfig->snapshot_interval);
+            }
+        }
+    }
 
     MXS_NOTICE("Created multi threaded cache.");
 }
 
 CacheMT::~CacheMT()
 {
+    if (!m_snapshot_file.empty())
+    {
+        // The housekeeper has been stopped by now, so no task is running.
+        hktask_remove((m_snapshot_task + "_load").c_str());
+        hktask_remove(m_snapshot_task.c_str());
+
+        save_snapshot();
+    }
 }
 
 CacheMT* CacheMT::Create(const std::string& name, const CACHE_CONFIG* pConfig)
@@ -76,6 +118,60 @@ void CacheMT::refreshed(const CACHE_KEY& key,  const CacheFilterSession* pSessio
     do_refreshed(key, pSession);
 }
 
+void CacheMT::load_snapshot()
+{
+    uint64_t n_items;
+
+    if (CacheSnapshot::load(m_snapshot_file, *this, m_pStorage, &n_items))
+    {
+        MXS_NOTICE("Restored %lu items of cache '%s' from '%s'.",
+                   n_items, m_name.c_str(), m_snapshot_file.c_str());
+    }
+
+    SpinLockGuard guard(m_lock_snapshot);
+
+    // Also if the loading failed, as otherwise nothing would ever be saved.
+    m_snapshot_loaded = true;
+}
+
+void CacheMT::save_snapshot()
+{
+    {
+        SpinLockGuard guard(m_lock_snapshot);
+
+        // Saving before the snapshot has been loaded would throw it away.
+        if (!m_snapshot_loaded || m_snapshot_saving)
+        {
+            return;
+        }
+
+        m_snapshot_saving = true;
+    }
+
+    uint64_t n_items;
+
+    if (CacheSnapshot::save(m_snapshot_file, *m_pStorage, &n_items))
+    {
+        MXS_INFO("Saved %lu items of cache '%s' to '%s'.",
+                 n_items, m_name.c_str(), m_snapshot_file.c_str());
+    }
+
+    SpinLockGuard guard(m_lock_snapshot);
+    m_snapshot_saving = false;
+}
+
+// static
+void CacheMT::load_snapshot(void* pData)
+{
+    MXS_EXCEPTION_GUARD(static_cast<CacheMT*>(pData)->load_snapshot());
+}
+
+// static
+void CacheMT::save_snapshot(void* pData)
+{
+    MXS_EXCEPTION_GUARD(static_cast<CacheMT*>(pData)->save_snapshot());
+}
+
 // static
 CacheMT* CacheMT::Create(const std::string&  name,
                          const CACHE_CONFIG* pConfig,
@@ -88,7 +184,8 @@ CacheMT* CacheMT::Create(const std::string&  name,
                                       pConfig->hard_ttl,
                                       pConfig->soft_ttl,
                                       pConfig->max_count,
-                                      pConfig->max_size);
+                                      pConfig->max_size,
+                                      pConfig->invalidate);
 
     int argc = pConfig->storage_argc;
     char** argv = pConfig->storage_argv;
@@ -30,6 +30,12 @@ public:
     void refreshed(const CACHE_KEY& key,  const CacheFilterSession* pSession);
 
 private:
+    void load_snapshot();
+    void save_snapshot();
+
+    static void load_snapshot(void* pData);
+    static void save_snapshot(void* pData);
+
     CacheMT(const std::string&  name,
             const CACHE_CONFIG* pConfig,
             SCacheRules         sRules,
@@ -46,5 +52,10 @@ private:
     CacheMT& operator = (const CacheMT&);
 
 private:
-    mutable SPINLOCK m_lock_pending; // Lock used for protecting 'pending'.
+    mutable SPINLOCK m_lock_pending;  // Lock used for protecting 'pending'.
+    std::string      m_snapshot_file; // The file the cache is persisted to, empty if none.
+    std::string      m_snapshot_task; // The name of the housekeeper task(s) of the snapshot.
+    SPINLOCK         m_lock_snapshot; // Lock used for protecting the fields below.
+    bool             m_snapshot_loaded; // Whether the snapshot has been loaded.
+    bool             m_snapshot_saving; // Whether a snapshot is being saved.
 };
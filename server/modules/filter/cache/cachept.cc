@@ -18,6 +18,7 @@
 #include "cachest.hh"
 #include "storagefactory.hh"
 
+using maxscale::SpinLockGuard;
 using std::tr1::shared_ptr;
 using std::string;
 
@@ -53,11 +54,22 @@ CachePT::CachePT(const std::string&  name,
     : Cache(name, pConfig, sRules, sFactory)
     , m_caches(caches)
 {
+    m_pending.reserve(m_caches.size());
+
+    for (size_t i = 0; i < m_caches.size(); ++i)
+    {
+        m_pending.push_back(new Pending);
+    }
+
     MXS_NOTICE("Created cache per thread.");
 }
 
 CachePT::~CachePT()
 {
+    for (std::vector<Pending*>::iterator i = m_pending.begin(); i != m_pending.end(); ++i)
+    {
+        delete *i;
+    }
 }
 
 // static
@@ -99,7 +111,8 @@ json_t* CachePT::get_info(uint32_t what) const
     {
         if (what & (INFO_PENDING | INFO_STORAGE))
         {
-            what &= ~INFO_RULES; // The rules are the same, we don't want them duplicated.
+            // The rules and the statistics are the same, we don't want them duplicated.
+            what &= ~(INFO_RULES | INFO_STATISTICS);
 
             for (size_t i = 0; i < m_caches.size(); ++i)
             {
@@ -132,9 +145,11 @@ cache_result_t CachePT::get_value(const CACHE_KEY& key, uint32_t flags, GWBUF**
     return thread_cache().get_value(key, flags, ppValue);
 }
 
-cache_result_t CachePT::put_value(const CACHE_KEY& key, const GWBUF* pValue)
+cache_result_t CachePT::put_value(const CACHE_KEY& key,
+                                  const std::vector<std::string>& words,
+                                  const GWBUF* pValue)
 {
-    return thread_cache().put_value(key, pValue);
+    return thread_cache().put_value(key, words, pValue);
 }
 
 cache_result_t CachePT::del_value(const CACHE_KEY& key)
@@ -142,6 +157,32 @@ cache_result_t CachePT::del_value(const CACHE_KEY& key)
     return thread_cache().del_value(key);
 }
 
+cache_result_t CachePT::invalidate(const std::vector<std::string>& words)
+{
+    invalidated();
+
+    cache_result_t result = thread_cache().invalidate(words);
+
+    int current = thread_index();
+
+    for (int i = 0; i < (int)m_pending.size(); ++i)
+    {
+        if (i != current)
+        {
+            // The caches of the other threads must not be accessed from
+            // this thread, so the invalidation is left for their owners.
+            Pending& pending = *m_pending[i];
+
+            SpinLockGuard guard(pending.lock);
+
+            pending.words.insert(pending.words.end(), words.begin(), words.end());
+            pending.has_words = true;
+        }
+    }
+
+    return result;
+}
+
 // static
 CachePT* CachePT::Create(const std::string&  name,
                          const CACHE_CONFIG* pConfig,
@@ -200,5 +241,23 @@ Cache& CachePT::thread_cache()
 {
     int i = thread_index();
     ss_dassert(i < (int)m_caches.size());
-    return *m_caches[i].get();
+
+    Cache& cache = *m_caches[i].get();
+    Pending& pending = *m_pending[i];
+
+    if (pending.has_words)
+    {
+        std::vector<std::string> words;
+
+        {
+            SpinLockGuard guard(pending.lock);
+
+            words.swap(pending.words);
+            pending.has_words = false;
+        }
+
+        cache.invalidate(words);
+    }
+
+    return cache;
 }
@@ -15,6 +15,7 @@
 #include <maxscale/cppdefs.hh>
 #include <tr1/memory>
 #include <vector>
+#include <maxscale/spinlock.hh>
 #include "cache.hh"
 
 class CachePT : public Cache
@@ -34,14 +35,41 @@ public:
 
     cache_result_t get_value(const CACHE_KEY& key, uint32_t flags, GWBUF** ppValue) const;
 
-    cache_result_t put_value(const CACHE_KEY& key, const GWBUF* pValue);
+    cache_result_t put_value(const CACHE_KEY& key,
+                             const std::vector<std::string>& words,
+                             const GWBUF* pValue);
 
     cache_result_t del_value(const CACHE_KEY& key);
 
+    /**
+     * Invalidates the values in the cache of the calling thread immediately
+     * and in the caches of the other threads when they are next accessed.
+     *
+     * @see Cache::invalidate
+     */
+    cache_result_t invalidate(const std::vector<std::string>& words);
+
 private:
     typedef std::tr1::shared_ptr<Cache> SCache;
     typedef std::vector<SCache>         Caches;
 
+    /**
+     * Invalidations made by other threads, to be performed by the thread
+     * owning the cache.
+     */
+    struct Pending
+    {
+        Pending()
+            : has_words(false)
+        {
+            spinlock_init(&lock);
+        }
+
+        SPINLOCK                 lock;      /*< Protects words. */
+        std::vector<std::string> words;     /*< The words to invalidate. */
+        volatile bool            has_words; /*< Whether there are words, checked without locking. */
+    };
+
     CachePT(const std::string&  name,
             const CACHE_CONFIG* pConfig,
             SCacheRules         sRules,
@@ -65,5 +93,6 @@ private:
     CachePT& operator = (const CachePT&);
 
 private:
-    Caches m_caches;
+    Caches                m_caches;  /*< The caches, one per thread. */
+    std::vector<Pending*> m_pending; /*< The pending invalidations, one per thread. */
 };
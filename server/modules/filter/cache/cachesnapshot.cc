@@ -0,0 +1,328 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#define MXS_MODULE_NAME "cache"
+#include "cachesnapshot.hh"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include <maxscale/alloc.h>
+#include "cache.hh"
+#include "storage.hh"
+
+namespace
+{
+
+const char SNAPSHOT_MAGIC[8] = { 'M', 'X', 'S', 'C', 'A', 'C', 'H', 'E' };
+const uint32_t SNAPSHOT_VERSION = 1;
+
+struct SnapshotHeader
+{
+    char     magic[8]; /*< SNAPSHOT_MAGIC */
+    uint32_t version;  /*< SNAPSHOT_VERSION */
+    uint32_t reserved; /*< Always 0. */
+    uint64_t time;     /*< When the snapshot was taken. */
+};
+
+struct SnapshotItem
+{
+    uint64_t key;     /*< The key of the item. */
+    uint32_t time;    /*< When the value was stored. */
+    uint32_t n_words; /*< The number of invalidation words after this. */
+    uint32_t length;  /*< The length of the value after the words. */
+};
+
+void append(std::vector<uint8_t>* pBuffer, const void* pData, size_t len)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(pData);
+
+    pBuffer->insert(pBuffer->end(), p, p + len);
+}
+
+/**
+ * Serialize an item and its value to a buffer.
+ */
+void serialize(std::vector<uint8_t>* pBuffer, const Storage::Item& item, const GWBUF* pValue)
+{
+    SnapshotItem header;
+    memset(&header, 0, sizeof(header));
+
+    header.key = item.key.data;
+    header.time = item.time;
+    header.n_words = item.words.size();
+    header.length = gwbuf_length(const_cast<GWBUF*>(pValue));
+
+    pBuffer->clear();
+    append(pBuffer, &header, sizeof(header));
+
+    for (std::vector<std::string>::const_iterator i = item.words.begin(); i != item.words.end(); ++i)
+    {
+        uint32_t len = i->length();
+
+        append(pBuffer, &len, sizeof(len));
+        append(pBuffer, i->data(), len);
+    }
+
+    for (const GWBUF* pBuf = pValue; pBuf; pBuf = pBuf->next)
+    {
+        append(pBuffer, GWBUF_DATA(pBuf), GWBUF_LENGTH(pBuf));
+    }
+}
+
+/**
+ * Read data from a mapped snapshot.
+ *
+ * @return True, if there was enough data left.
+ */
+bool consume(const uint8_t** ppData, const uint8_t* pEnd, void* pTo, size_t len)
+{
+    bool rv = false;
+
+    if (static_cast<size_t>(pEnd - *ppData) >= len)
+    {
+        memcpy(pTo, *ppData, len);
+        *ppData += len;
+        rv = true;
+    }
+
+    return rv;
+}
+
+}
+
+// static
+bool CacheSnapshot::save(const std::string& path, const Storage& storage, uint64_t* pN_items)
+{
+    std::vector<Storage::Item> items;
+
+    cache_result_t result = storage.get_snapshot_items(&items);
+
+    if (result == CACHE_RESULT_OUT_OF_RESOURCES)
+    {
+        MXS_ERROR("The storage does not support snapshots, '%s' will not be written.", path.c_str());
+        return false;
+    }
+    else if (!CACHE_RESULT_IS_OK(result))
+    {
+        MXS_ERROR("Could not get the items of the storage, '%s' will not be written.", path.c_str());
+        return false;
+    }
+
+    std::string tmp_path = path + ".tmp";
+
+    FILE* pFile = fopen(tmp_path.c_str(), "w");
+
+    if (!pFile)
+    {
+        MXS_ERROR("Could not open '%s' for writing: %s", tmp_path.c_str(), mxs_strerror(errno));
+        return false;
+    }
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.time = time(NULL);
+
+    bool ok = (fwrite(&header, sizeof(header), 1, pFile) == 1);
+
+    uint64_t n_items = 0;
+    std::vector<uint8_t> buffer;
+
+    for (std::vector<Storage::Item>::const_iterator i = items.begin(); ok && (i != items.end()); ++i)
+    {
+        GWBUF* pValue = NULL;
+
+        // The values are peeked one at a time, so the storage is locked only briefly.
+        result = storage.peek_value(i->key, CACHE_FLAGS_INCLUDE_STALE, &pValue);
+
+        if (CACHE_RESULT_IS_OK(result))
+        {
+            serialize(&buffer, *i, pValue);
+            gwbuf_free(pValue);
+
+            ok = (fwrite(&buffer.front(), buffer.size(), 1, pFile) == 1);
+            ++n_items;
+        }
+        // Otherwise the item has been removed or has expired since the items were fetched.
+    }
+
+    if (ok)
+    {
+        ok = (fflush(pFile) == 0) && (fsync(fileno(pFile)) == 0);
+    }
+
+    if (!ok)
+    {
+        MXS_ERROR("Could not write to '%s': %s", tmp_path.c_str(), mxs_strerror(errno));
+    }
+
+    if (fclose(pFile) != 0 && ok)
+    {
+        MXS_ERROR("Could not close '%s': %s", tmp_path.c_str(), mxs_strerror(errno));
+        ok = false;
+    }
+
+    if (ok && (rename(tmp_path.c_str(), path.c_str()) != 0))
+    {
+        MXS_ERROR("Could not rename '%s' to '%s': %s",
+                  tmp_path.c_str(), path.c_str(), mxs_strerror(errno));
+        ok = false;
+    }
+
+    if (ok)
+    {
+        *pN_items = n_items;
+    }
+    else
+    {
+        unlink(tmp_path.c_str());
+    }
+
+    return ok;
+}
+
+// static
+bool CacheSnapshot::load(const std::string& path, const Cache& cache, Storage* pStorage, uint64_t* pN_items)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+
+    if (fd == -1)
+    {
+        if (errno == ENOENT)
+        {
+            MXS_NOTICE("The cache snapshot '%s' does not exist, starting with an empty cache.",
+                       path.c_str());
+        }
+        else
+        {
+            MXS_ERROR("Could not open '%s' for reading: %s", path.c_str(), mxs_strerror(errno));
+        }
+
+        return false;
+    }
+
+    struct stat st;
+    void* pMap = MAP_FAILED;
+
+    if (fstat(fd, &st) == 0)
+    {
+        if (st.st_size != 0)
+        {
+            pMap = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        else
+        {
+            errno = EINVAL;
+        }
+    }
+
+    if (pMap == MAP_FAILED)
+    {
+        MXS_ERROR("Could not map '%s': %s", path.c_str(), mxs_strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    // The mapping remains valid after the descriptor has been closed.
+    close(fd);
+
+    const uint8_t* pData = static_cast<const uint8_t*>(pMap);
+    const uint8_t* pEnd = pData + st.st_size;
+
+    SnapshotHeader header;
+    bool ok = consume(&pData, pEnd, &header, sizeof(header))
+        && (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) == 0)
+        && (header.version == SNAPSHOT_VERSION);
+
+    if (!ok)
+    {
+        MXS_ERROR("'%s' is not a cache snapshot, or is of an unsupported version.", path.c_str());
+    }
+
+    uint64_t invalidations = cache.invalidations();
+    uint64_t n_items = 0;
+
+    while (ok && (pData < pEnd))
+    {
+        if (cache.invalidations() != invalidations)
+        {
+            MXS_NOTICE("The cache was invalidated while '%s' was being loaded, "
+                       "the rest of the snapshot is ignored.", path.c_str());
+            break;
+        }
+
+        SnapshotItem item_header;
+        Storage::Item item;
+
+        ok = consume(&pData, pEnd, &item_header, sizeof(item_header));
+
+        for (uint32_t i = 0; ok && (i < item_header.n_words); ++i)
+        {
+            uint32_t len;
+
+            ok = consume(&pData, pEnd, &len, sizeof(len)) && (static_cast<size_t>(pEnd - pData) >= len);
+
+            if (ok)
+            {
+                item.words.push_back(std::string(reinterpret_cast<const char*>(pData), len));
+                pData += len;
+            }
+        }
+
+        ok = ok && (static_cast<size_t>(pEnd - pData) >= item_header.length);
+
+        if (ok)
+        {
+            item.key.data = item_header.key;
+            item.time = item_header.time;
+
+            GWBUF* pValue = gwbuf_alloc_and_load(item_header.length, pData);
+            pData += item_header.length;
+
+            if (pValue)
+            {
+                cache_result_t result = pStorage->restore_value(item, pValue);
+                gwbuf_free(pValue);
+
+                if (CACHE_RESULT_IS_OK(result))
+                {
+                    ++n_items;
+                }
+                else if (!CACHE_RESULT_IS_NOT_FOUND(result))
+                {
+                    MXS_ERROR("Could not restore an item from '%s', the rest of the "
+                              "snapshot is ignored.", path.c_str());
+                    break;
+                }
+            }
+        }
+        else
+        {
+            MXS_ERROR("The cache snapshot '%s' is truncated or corrupt, the rest of the "
+                      "snapshot is ignored.", path.c_str());
+        }
+    }
+
+    munmap(pMap, st.st_size);
+
+    *pN_items = n_items;
+
+    return ok;
+}
@@ -0,0 +1,69 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <maxscale/cppdefs.hh>
+#include <string>
+
+class Cache;
+class Storage;
+
+/**
+ * CacheSnapshot saves the content of a storage to a file and restores it
+ * from there, so that the cache need not start cold after a restart.
+ *
+ * The file starts with a header, after which come the items, the least
+ * recently used one first, each consisting of the key, the time the value
+ * was stored at, the invalidation words and the value itself. All integers
+ * are in host byte order; a snapshot is not meant to be moved between hosts.
+ */
+class CacheSnapshot
+{
+public:
+    /**
+     * Save the content of a storage to a file. The snapshot is first
+     * written to a temporary file that then is renamed, so an existing
+     * snapshot is replaced only by a complete one. No lock is held while
+     * the file is being written, so concurrent access to the storage is
+     * not blocked.
+     *
+     * @param path      The path of the snapshot file.
+     * @param storage   The storage whose content should be saved.
+     * @param pN_items  On successful return, the number of saved items.
+     *
+     * @return True, if the snapshot could be saved.
+     */
+    static bool save(const std::string& path, const Storage& storage, uint64_t* pN_items);
+
+    /**
+     * Restore the content of a storage from a file. Items that have
+     * expired or that are found in the storage already are ignored. The
+     * loading is stopped if the cache is invalidated meanwhile, as the rest
+     * of the items might then be stale.
+     *
+     * @param path      The path of the snapshot file.
+     * @param cache     The cache the storage belongs to.
+     * @param pStorage  The storage to restore the content to.
+     * @param pN_items  On successful return, the number of restored items.
+     *
+     * @return True, if the snapshot could be loaded, also if the loading was
+     *         stopped due to an invalidation. False, if the file could not
+     *         be opened or is corrupt.
+     */
+    static bool load(const std::string& path, const Cache& cache, Storage* pStorage, uint64_t* pN_items);
+
+private:
+    CacheSnapshot();
+    CacheSnapshot(const CacheSnapshot&);
+    CacheSnapshot& operator = (const CacheSnapshot&);
+};
@@ -92,7 +92,8 @@ CacheST* CacheST::Create(const std::string&  name,
                                       pConfig->hard_ttl,
                                       pConfig->soft_ttl,
                                       pConfig->max_count,
-                                      pConfig->max_size);
+                                      pConfig->max_size,
+                                      pConfig->invalidate);
 
     int argc = pConfig->storage_argc;
     char** argv = pConfig->storage_argv;
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#define MXS_MODULE_NAME "cache"
+#include "cachestats.hh"
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <maxscale/alloc.h>
+#include <maxscale/modutil.h>
+
+using maxscale::SpinLockGuard;
+
+namespace
+{
+
+/**
+ * The reported statement is cut at this length, as there is no point
+ * in keeping huge statements around only for showing them.
+ */
+const size_t MAX_CANONICAL_LENGTH = 256;
+
+struct TopEntry
+{
+    uint64_t    digest;
+    std::string canonical;
+    uint64_t    fetches;
+    uint64_t    fetch_us;
+    uint64_t    hits;
+    uint64_t    saved_us;
+};
+
+bool saved_more(const TopEntry& lhs, const TopEntry& rhs)
+{
+    return lhs.saved_us > rhs.saved_us;
+}
+
+}
+
+DigestStats::DigestStats()
+{
+}
+
+DigestStats::~DigestStats()
+{
+}
+
+void DigestStats::track(uint64_t digest, GWBUF* pQuery)
+{
+    Shard& s = shard(digest);
+
+    {
+        SpinLockGuard guard(s.lock);
+
+        if (s.entries.find(digest) != s.entries.end())
+        {
+            return;
+        }
+    }
+
+    // A new statement. The canonical form is created without holding the lock.
+    char* zCanonical = modutil_get_canonical(pQuery);
+
+    if (zCanonical)
+    {
+        Entry entry;
+        entry.canonical.assign(zCanonical, std::min(strlen(zCanonical), MAX_CANONICAL_LENGTH));
+        entry.fetches = 0;
+        entry.fetch_us = 0;
+        entry.hits = 0;
+        entry.saved_us = 0;
+
+        MXS_FREE(zCanonical);
+
+        SpinLockGuard guard(s.lock);
+
+        // Unless somebody else added it meanwhile.
+        if (s.entries.find(digest) == s.entries.end())
+        {
+            if (s.entries.size() >= N_TRACKED_PER_SHARD)
+            {
+                evict(&s.entries);
+            }
+
+            s.entries.insert(std::make_pair(digest, entry));
+        }
+    }
+}
+
+void DigestStats::record_fetch(uint64_t digest, uint64_t us)
+{
+    Shard& s = shard(digest);
+
+    SpinLockGuard guard(s.lock);
+
+    Entries::iterator i = s.entries.find(digest);
+
+    if (i != s.entries.end())
+    {
+        ++i->second.fetches;
+        i->second.fetch_us += us;
+    }
+}
+
+void DigestStats::record_hit(uint64_t digest)
+{
+    Shard& s = shard(digest);
+
+    SpinLockGuard guard(s.lock);
+
+    Entries::iterator i = s.entries.find(digest);
+
+    // If the statement is not tracked or its result has not been fetched
+    // yet, there is no estimate for the time saved.
+    if ((i != s.entries.end()) && (i->second.fetches != 0))
+    {
+        Entry& entry = i->second;
+
+        ++entry.hits;
+        entry.saved_us += entry.fetch_us / entry.fetches;
+    }
+}
+
+json_t* DigestStats::get_info() const
+{
+    std::vector<TopEntry> entries;
+
+    for (size_t i = 0; i < N_SHARDS; ++i)
+    {
+        Shard& s = m_shards[i];
+
+        SpinLockGuard guard(s.lock);
+
+        for (Entries::const_iterator j = s.entries.begin(); j != s.entries.end(); ++j)
+        {
+            const Entry& entry = j->second;
+            TopEntry top = { j->first, entry.canonical, entry.fetches,
+                             entry.fetch_us, entry.hits, entry.saved_us };
+
+            entries.push_back(top);
+        }
+    }
+
+    size_t n = std::min(entries.size(), static_cast<size_t>(N_TOP));
+
+    std::partial_sort(entries.begin(), entries.begin() + n, entries.end(), saved_more);
+
+    json_t* pArray = json_array();
+
+    if (pArray)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            const TopEntry& top = entries[i];
+            json_t* pEntry = json_object();
+
+            if (pEntry)
+            {
+                char digest[17];
+                sprintf(digest, "%016lx", top.digest);
+
+                json_object_set_new(pEntry, "digest", json_string(digest));
+                json_object_set_new(pEntry, "statement", json_string(top.canonical.c_str()));
+                json_object_set_new(pEntry, "fetches", json_integer(top.fetches));
+                json_object_set_new(pEntry, "mean_fetch_us",
+                                    json_integer(top.fetches ? top.fetch_us / top.fetches : 0));
+                json_object_set_new(pEntry, "hits", json_integer(top.hits));
+                json_object_set_new(pEntry, "saved_us", json_integer(top.saved_us));
+
+                json_array_append_new(pArray, pEntry);
+            }
+        }
+    }
+
+    return pArray;
+}
+
+// static
+void DigestStats::evict(Entries* pEntries)
+{
+    Entries::iterator victim = pEntries->begin();
+
+    for (Entries::iterator i = pEntries->begin(); i != pEntries->end(); ++i)
+    {
+        const Entry& entry = i->second;
+
+        if ((entry.saved_us < victim->second.saved_us) ||
+            ((entry.saved_us == victim->second.saved_us) && (entry.fetches < victim->second.fetches)))
+        {
+            victim = i;
+        }
+    }
+
+    if (victim != pEntries->end())
+    {
+        pEntries->erase(victim);
+    }
+}
@@ -0,0 +1,119 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <maxscale/cppdefs.hh>
+#include <string>
+#include <tr1/unordered_map>
+#include <vector>
+#include <jansson.h>
+#include <maxscale/buffer.h>
+#include <maxscale/spinlock.hh>
+
+/**
+ * DigestStats keeps track of the statements, identified by the digest of
+ * their canonical form, that save the most backend time by being served
+ * from the cache. The time saved by a hit is estimated as the mean time it
+ * has taken to fetch the result of the statement from the server.
+ *
+ * Only a limited number of statements are tracked. When a new statement is
+ * to be tracked and there is no room, the one that so far has saved the
+ * least time is replaced.
+ */
+class DigestStats
+{
+public:
+    enum
+    {
+        N_TRACKED = 256, /*< The number of statements tracked. */
+        N_TOP     = 10,  /*< The number of statements reported. */
+    };
+
+    DigestStats();
+    ~DigestStats();
+
+    /**
+     * Start tracking a statement, unless it is tracked already. To be called
+     * when the result of the statement is about to be fetched, as the
+     * statement itself may no longer be available when the result arrives.
+     *
+     * @param digest  The digest of the statement.
+     * @param pQuery  The statement as a COM_QUERY.
+     */
+    void track(uint64_t digest, GWBUF* pQuery);
+
+    /**
+     * Record that the result of a statement was fetched from the server.
+     *
+     * @param digest  The digest of the statement.
+     * @param us      How long the fetching took, in microseconds.
+     */
+    void record_fetch(uint64_t digest, uint64_t us);
+
+    /**
+     * Record that the result of a statement was served from the cache.
+     *
+     * @param digest  The digest of the statement.
+     */
+    void record_hit(uint64_t digest);
+
+    /**
+     * Returns the statements that have saved the most time.
+     *
+     * @return An array of objects, the one that has saved the most time
+     *         first, or NULL if memory allocation fails.
+     */
+    json_t* get_info() const;
+
+private:
+    struct Entry
+    {
+        std::string canonical; /*< The statement in canonical form, possibly truncated. */
+        uint64_t    fetches;   /*< The number of times the result was fetched. */
+        uint64_t    fetch_us;  /*< The total time spent fetching, in microseconds. */
+        uint64_t    hits;      /*< The number of times the result was served from the cache. */
+        uint64_t    saved_us;  /*< The estimated time saved by the hits, in microseconds. */
+    };
+
+    typedef std::tr1::unordered_map<uint64_t, Entry> Entries;
+
+    struct Shard
+    {
+        Shard()
+        {
+            spinlock_init(&lock);
+        }
+
+        SPINLOCK lock;    /*< Protects entries. */
+        Entries  entries; /*< The tracked statements. */
+    };
+
+    enum
+    {
+        N_SHARDS = 16,
+        N_TRACKED_PER_SHARD = N_TRACKED / N_SHARDS,
+    };
+
+    Shard& shard(uint64_t digest)
+    {
+        return m_shards[digest % N_SHARDS];
+    }
+
+    static void evict(Entries* pEntries);
+
+    DigestStats(const DigestStats&);
+    DigestStats& operator = (const DigestStats&);
+
+private:
+    mutable Shard m_shards[N_SHARDS];
+};
@@ -13,14 +13,16 @@
 
 #define MXS_MODULE_NAME "cache"
 #include "lrustorage.hh"
+#include <maxscale/atomic.h>
 
-LRUStorage::LRUStorage(const CACHE_STORAGE_CONFIG& config, Storage* pStorage)
+LRUStorage::LRUStorage(const CACHE_STORAGE_CONFIG& config, Storage* pStorage, uint64_t* pClock)
     : m_config(config)
     , m_pStorage(pStorage)
     , m_max_count(config.max_count != 0 ? config.max_count : UINT64_MAX)
     , m_max_size(config.max_size != 0 ? config.max_size : UINT64_MAX)
     , m_pHead(NULL)
     , m_pTail(NULL)
+    , m_pClock(pClock)
 {
 }
 
@@ -79,7 +81,9 @@ cache_result_t LRUStorage::do_get_value(const CACHE_KEY& key,
     return access_value(APPROACH_GET, key, flags, ppValue);
 }
 
-cache_result_t LRUStorage::do_put_value(const CACHE_KEY& key, const GWBUF* pvalue)
+cache_result_t LRUStorage::do_put_value(const CACHE_KEY& key,
+                                        const std::vector<std::string>& words,
+                                        const GWBUF* pvalue)
 {
     cache_result_t result = CACHE_RESULT_ERROR;
 
@@ -103,10 +107,36 @@ cache_result_t LRUStorage::do_put_value(const CACHE_KEY& key, const GWBUF* pvalu
     {
         ss_dassert(pNode);
 
-        result = m_pStorage->put_value(key, pvalue);
+        // The invalidation words are maintained here, not by the real storage.
+        static const std::vector<std::string> no_words;
+
+        // If the real storage can tell its size, the space the value actually
+        // takes is used, as it may be less than its length if the storage
+        // e.g. compresses the values.
+        uint64_t size_before;
+        bool real_size = CACHE_RESULT_IS_OK(m_pStorage->get_size(&size_before));
+
+        result = m_pStorage->put_value(key, no_words, pvalue);
 
         if (CACHE_RESULT_IS_OK(result))
         {
+            uint64_t size_after;
+
+            if (real_size && CACHE_RESULT_IS_OK(m_pStorage->get_size(&size_after)))
+            {
+                int64_t stored_size = (int64_t)size_after - (int64_t)size_before;
+
+                if (existed)
+                {
+                    stored_size += pNode->size();
+                }
+
+                if (stored_size >= 0)
+                {
+                    value_size = stored_size;
+                }
+            }
+
             if (existed)
             {
                 ++m_stats.updates;
@@ -119,8 +149,15 @@ cache_result_t LRUStorage::do_put_value(const CACHE_KEY& key, const GWBUF* pvalu
             }
 
             pNode->reset(&i->first, value_size);
+            pNode->set_time(time(NULL));
             m_stats.size += pNode->size();
 
+            if (m_config.invalidate != CACHE_INVALIDATE_NEVER)
+            {
+                remove_words(pNode);
+                add_words(pNode, words);
+            }
+
             move_to_head(pNode);
         }
         else if (!existed)
@@ -162,6 +199,50 @@ cache_result_t LRUStorage::do_del_value(const CACHE_KEY& key)
     return result;
 }
 
+cache_result_t LRUStorage::do_invalidate(const std::vector<std::string>& words)
+{
+    if (m_config.invalidate == CACHE_INVALIDATE_NEVER)
+    {
+        return CACHE_RESULT_OUT_OF_RESOURCES;
+    }
+
+    // The keys are copied, as deleting a value modifies the sets.
+    std::vector<CACHE_KEY> keys;
+
+    for (std::vector<std::string>::const_iterator i = words.begin(); i != words.end(); ++i)
+    {
+        KeysByWord::const_iterator j = m_keys_by_word.find(*i);
+
+        if (j != m_keys_by_word.end())
+        {
+            keys.insert(keys.end(), j->second.begin(), j->second.end());
+        }
+    }
+
+    cache_result_t result = CACHE_RESULT_OK;
+
+    for (std::vector<CACHE_KEY>::const_iterator i = keys.begin(); i != keys.end(); ++i)
+    {
+        // If a value depends on several of the words, it has already been
+        // deleted the second time around.
+        if (m_nodes_by_key.find(*i) != m_nodes_by_key.end())
+        {
+            cache_result_t rv = do_del_value(*i);
+
+            if (CACHE_RESULT_IS_OK(rv) || CACHE_RESULT_IS_NOT_FOUND(rv))
+            {
+                ++m_stats.invalidations;
+            }
+            else
+            {
+                result = rv;
+            }
+        }
+    }
+
+    return result;
+}
+
 cache_result_t LRUStorage::do_get_head(CACHE_KEY* pKey, GWBUF** ppValue) const
 {
     cache_result_t result = CACHE_RESULT_NOT_FOUND;
@@ -225,7 +306,34 @@ cache_result_t LRUStorage::access_value(access_approach_t approach,
 
     if (existed)
     {
-        result = m_pStorage->get_value(key, flags, ppValue);
+        // The real storage checks the TTLs as well, but a restored item
+        // retains the time it was originally stored at, which is known
+        // only here.
+        uint32_t now = time(NULL);
+        uint32_t stored = i->second->time();
+
+        bool is_hard_stale = m_config.hard_ttl == 0 ? false : (now - stored > m_config.hard_ttl);
+        bool is_soft_stale = m_config.soft_ttl == 0 ? false : (now - stored > m_config.soft_ttl);
+        bool include_stale = ((flags & CACHE_FLAGS_INCLUDE_STALE) != 0);
+
+        if (is_hard_stale)
+        {
+            m_pStorage->del_value(key);
+            result = CACHE_RESULT_NOT_FOUND;
+        }
+        else if (is_soft_stale && !include_stale)
+        {
+            result = CACHE_RESULT_NOT_FOUND | CACHE_RESULT_STALE;
+        }
+        else
+        {
+            result = m_pStorage->get_value(key, flags, ppValue);
+
+            if (is_soft_stale && CACHE_RESULT_IS_OK(result))
+            {
+                result |= CACHE_RESULT_STALE;
+            }
+        }
 
         if (CACHE_RESULT_IS_OK(result))
         {
@@ -243,6 +351,12 @@ cache_result_t LRUStorage::access_value(access_approach_t approach,
             if (!CACHE_RESULT_IS_STALE(result))
             {
                 // If it wasn't just stale we'll remove it.
+                ss_dassert(m_stats.size >= i->second->size());
+                ss_dassert(m_stats.items > 0);
+
+                m_stats.size -= i->second->size();
+                --m_stats.items;
+
                 free_node(i);
             }
         }
@@ -255,6 +369,60 @@ cache_result_t LRUStorage::access_value(access_approach_t approach,
     return result;
 }
 
+cache_result_t LRUStorage::do_get_snapshot_items(std::vector<Item>* pItems) const
+{
+    cache_result_t result = CACHE_RESULT_OK;
+
+    try
+    {
+        pItems->reserve(pItems->size() + m_nodes_by_key.size());
+
+        for (const Node* pNode = m_pTail; pNode; pNode = pNode->prev())
+        {
+            Item item;
+            item.key = *pNode->key();
+            item.time = pNode->time();
+            item.words = pNode->words();
+
+            pItems->push_back(item);
+        }
+    }
+    catch (const std::exception& x)
+    {
+        MXS_OOM();
+        result = CACHE_RESULT_OUT_OF_RESOURCES;
+    }
+
+    return result;
+}
+
+cache_result_t LRUStorage::do_restore_value(const Item& item, const GWBUF* pValue)
+{
+    cache_result_t result = CACHE_RESULT_OK;
+
+    uint32_t now = time(NULL);
+
+    if ((m_config.hard_ttl != 0) && (now - item.time > m_config.hard_ttl))
+    {
+        result = CACHE_RESULT_NOT_FOUND;
+    }
+    else if (m_nodes_by_key.find(item.key) == m_nodes_by_key.end())
+    {
+        // If the item exists, it has been stored after the snapshot was taken.
+        result = do_put_value(item.key, item.words, pValue);
+
+        if (CACHE_RESULT_IS_OK(result))
+        {
+            NodesByKey::iterator i = m_nodes_by_key.find(item.key);
+            ss_dassert(i != m_nodes_by_key.end());
+
+            i->second->set_time(item.time);
+        }
+    }
+
+    return result;
+}
+
 /**
  * Free the data associated with the least recently used node,
  * but not the node itself.
@@ -353,6 +521,8 @@ bool LRUStorage::free_node_data(Node* pNode)
             MXS_ERROR("Item in LRU list was not found in storage.");
         }
 
+        remove_words(pNode);
+
         if (i != m_nodes_by_key.end())
         {
             m_nodes_by_key.erase(i);
@@ -397,6 +567,7 @@ void LRUStorage::free_node(Node* pNode) const
  */
 void LRUStorage::free_node(NodesByKey::iterator& i) const
 {
+    remove_words(i->second);
     free_node(i->second); // A Node
     m_nodes_by_key.erase(i);
 }
@@ -444,6 +615,11 @@ void LRUStorage::move_to_head(Node* pNode) const
 
     m_pHead = pNode->prepend(m_pHead);
 
+    if (m_pClock)
+    {
+        pNode->set_stamp(atomic_add_uint64(m_pClock, 1) + 1);
+    }
+
     if (!m_pTail)
     {
         m_pTail = m_pHead;
@@ -456,6 +632,52 @@ void LRUStorage::move_to_head(Node* pNode) const
     ss_dassert(m_pTail->next() == NULL);
 }
 
+/**
+ * Record the invalidation words of a node.
+ *
+ * @param pNode  A node whose key has been set.
+ * @param words  The words the data of the node depends upon.
+ */
+void LRUStorage::add_words(Node* pNode, const std::vector<std::string>& words)
+{
+    ss_dassert(pNode->key());
+    ss_dassert(pNode->words().empty());
+
+    pNode->set_words(words);
+
+    for (std::vector<std::string>::const_iterator i = words.begin(); i != words.end(); ++i)
+    {
+        m_keys_by_word[*i].insert(*pNode->key());
+    }
+}
+
+/**
+ * Remove the invalidation words of a node.
+ *
+ * @param pNode  A node whose key has been set.
+ */
+void LRUStorage::remove_words(Node* pNode) const
+{
+    const std::vector<std::string>& words = pNode->words();
+
+    for (std::vector<std::string>::const_iterator i = words.begin(); i != words.end(); ++i)
+    {
+        KeysByWord::iterator j = m_keys_by_word.find(*i);
+
+        if (j != m_keys_by_word.end())
+        {
+            j->second.erase(*pNode->key());
+
+            if (j->second.empty())
+            {
+                m_keys_by_word.erase(j);
+            }
+        }
+    }
+
+    pNode->clear_words();
+}
+
 cache_result_t LRUStorage::get_existing_node(NodesByKey::iterator& i, const GWBUF* pValue, Node** ppNode)
 {
     cache_result_t result = CACHE_RESULT_OK;
@@ -599,4 +821,5 @@ void LRUStorage::Stats::fill(json_t* pObject) const
     set_integer(pObject, "updates", updates);
     set_integer(pObject, "deletes", deletes);
     set_integer(pObject, "evictions", evictions);
+    set_integer(pObject, "invalidations", invalidations);
 }
@@ -14,6 +14,7 @@
 
 #include <maxscale/cppdefs.hh>
 #include <tr1/unordered_map>
+#include <tr1/unordered_set>
 #include "cachefilter.h"
 #include "cache_storage_api.hh"
 #include "storage.hh"
@@ -28,8 +29,37 @@ public:
      */
     void get_config(CACHE_STORAGE_CONFIG* pConfig);
 
+    /**
+     * The access stamp of the most recently used item. Stamps are only
+     * maintained if a clock was provided when the storage was created.
+     *
+     * @return The stamp of the head, or 0 if the storage is empty.
+     */
+    uint64_t head_stamp() const
+    {
+        return m_pHead ? m_pHead->stamp() : 0;
+    }
+
+    /**
+     * The access stamp of the least recently used item.
+     *
+     * @return The stamp of the tail, or 0 if the storage is empty.
+     */
+    uint64_t tail_stamp() const
+    {
+        return m_pTail ? m_pTail->stamp() : 0;
+    }
+
 protected:
-    LRUStorage(const CACHE_STORAGE_CONFIG& config, Storage* pStorage);
+    /**
+     * Constructor
+     *
+     * @param config    The storage configuration.
+     * @param pStorage  The real storage, owned by the created storage.
+     * @param pClock    If non-NULL, a counter shared between several LRU storages
+     *                  from which the access stamps of the items are taken.
+     */
+    LRUStorage(const CACHE_STORAGE_CONFIG& config, Storage* pStorage, uint64_t* pClock = NULL);
 
     /**
      * @see Storage::get_info
@@ -47,6 +77,7 @@ protected:
      * @see Storage::put_value
      */
     cache_result_t do_put_value(const CACHE_KEY& key,
+                                const std::vector<std::string>& words,
                                 const GWBUF* pValue);
 
     /**
@@ -54,6 +85,11 @@ protected:
      */
     cache_result_t do_del_value(const CACHE_KEY& key);
 
+    /**
+     * @see Storage::invalidate
+     */
+    cache_result_t do_invalidate(const std::vector<std::string>& words);
+
     /**
      * @see Storage::get_head
      */
@@ -76,6 +112,26 @@ protected:
      */
     cache_result_t do_get_items(uint64_t* pItems) const;
 
+    /**
+     * @see Storage::get_snapshot_items
+     */
+    cache_result_t do_get_snapshot_items(std::vector<Item>* pItems) const;
+
+    /**
+     * @see Storage::peek_value
+     */
+    cache_result_t do_peek_value(const CACHE_KEY& key,
+                                 uint32_t flags,
+                                 GWBUF** ppValue) const
+    {
+        return access_value(APPROACH_PEEK, key, flags, ppValue);
+    }
+
+    /**
+     * @see Storage::restore_value
+     */
+    cache_result_t do_restore_value(const Item& item, const GWBUF* pValue);
+
 private:
     LRUStorage(const LRUStorage&);
     LRUStorage& operator = (const LRUStorage&);
@@ -91,13 +147,6 @@ private:
                                 uint32_t flags,
                                 GWBUF** ppValue) const;
 
-    cache_result_t peek_value(const CACHE_KEY& key,
-                              uint32_t flags,
-                              GWBUF** ppValue) const
-    {
-        return access_value(APPROACH_PEEK, key, flags, ppValue);
-    }
-
     /**
      * The Node class is used for maintaining LRU information.
      */
@@ -107,6 +156,8 @@ private:
         Node()
             : m_pKey(NULL)
             , m_size(0)
+            , m_time(0)
+            , m_stamp(0)
             , m_pNext(NULL)
             , m_pPrev(NULL)
         {}
@@ -123,6 +174,34 @@ private:
         {
             return m_size;
         }
+        uint32_t time() const
+        {
+            return m_time;
+        }
+        void set_time(uint32_t time)
+        {
+            m_time = time;
+        }
+        uint64_t stamp() const
+        {
+            return m_stamp;
+        }
+        void set_stamp(uint64_t stamp)
+        {
+            m_stamp = stamp;
+        }
+        const std::vector<std::string>& words() const
+        {
+            return m_words;
+        }
+        void set_words(const std::vector<std::string>& words)
+        {
+            m_words = words;
+        }
+        void clear_words()
+        {
+            m_words.clear();
+        }
         Node* next() const
         {
             return m_pNext;
@@ -200,11 +279,16 @@ private:
     private:
         const CACHE_KEY* m_pKey;  /*< Points at the key stored in nodes_by_key_ below. */
         size_t           m_size;  /*< The size of the data referred to by m_pKey. */
+        uint32_t         m_time;  /*< When the data was stored. */
+        uint64_t         m_stamp; /*< When the node was last moved to the head. */
+        std::vector<std::string> m_words; /*< The invalidation words of the data. */
         Node*            m_pNext; /*< The next node in the LRU list. */
         Node*            m_pPrev; /*< The previous node in the LRU list. */
     };
 
     typedef std::tr1::unordered_map<CACHE_KEY, Node*> NodesByKey;
+    typedef std::tr1::unordered_set<CACHE_KEY> Keys;
+    typedef std::tr1::unordered_map<std::string, Keys> KeysByWord;
 
     Node* vacate_lru();
     Node* vacate_lru(size_t space);
@@ -213,6 +297,8 @@ private:
     void free_node(NodesByKey::iterator& i) const;
     void remove_node(Node* pNode) const;
     void move_to_head(Node* pNode) const;
+    void add_words(Node* pNode, const std::vector<std::string>& words);
+    void remove_words(Node* pNode) const;
 
     cache_result_t get_existing_node(NodesByKey::iterator& i, const GWBUF* pvalue, Node** ppNode);
     cache_result_t get_new_node(const CACHE_KEY& key,
@@ -231,6 +317,7 @@ private:
             , updates(0)
             , deletes(0)
             , evictions(0)
+            , invalidations(0)
         {}
 
         void fill(json_t* pObject) const;
@@ -242,6 +329,7 @@ private:
         uint64_t updates;    /*< How many times an existing key in the cache was updated. */
         uint64_t deletes;    /*< How many times an existing key in the cache was deleted. */
         uint64_t evictions;  /*< How many times an item has been evicted from the cache. */
+        uint64_t invalidations; /*< How many times an item has been invalidated. */
     };
 
     const CACHE_STORAGE_CONFIG m_config;       /*< The configuration. */
@@ -250,6 +338,8 @@ private:
     const uint64_t             m_max_size;     /*< The maximum size of all cached items. */
     mutable Stats              m_stats;        /*< Cache statistics. */
     mutable NodesByKey         m_nodes_by_key; /*< Mapping from cache keys to corresponding Node. */
+    mutable KeysByWord         m_keys_by_word; /*< Mapping from invalidation words to cache keys. */
     mutable Node*              m_pHead;        /*< The node at the LRU list. */
     mutable Node*              m_pTail;        /*< The node at bottom of the LRU list.*/
+    uint64_t*                  m_pClock;       /*< Source of access stamps, or NULL. */
 };
@@ -16,82 +16,343 @@
 
 using maxscale::SpinLockGuard;
 
-LRUStorageMT::LRUStorageMT(const CACHE_STORAGE_CONFIG& config, Storage* pStorage)
-    : LRUStorage(config, pStorage)
+namespace
 {
-    spinlock_init(&m_lock);
 
-    MXS_NOTICE("Created multi threaded LRU storage.");
+/**
+ * Add the integer values of one JSON object to the corresponding values
+ * of another.
+ */
+void add_integers(json_t* pTotal, json_t* pObject)
+{
+    const char* zKey;
+    json_t* pValue;
+
+    json_object_foreach(pObject, zKey, pValue)
+    {
+        if (json_is_integer(pValue))
+        {
+            json_t* pSum = json_object_get(pTotal, zKey);
+            json_int_t sum = json_integer_value(pValue) + (pSum ? json_integer_value(pSum) : 0);
+
+            json_object_set_new(pTotal, zKey, json_integer(sum));
+        }
+    }
+}
+
+}
+
+LRUStorageMT::LRUStorageMT(const CACHE_STORAGE_CONFIG& config, size_t n_shards)
+    : m_config(config)
+    , m_clock(0)
+{
+    m_shards.reserve(n_shards);
 }
 
 LRUStorageMT::~LRUStorageMT()
 {
+    for (std::vector<Shard*>::iterator i = m_shards.begin(); i != m_shards.end(); ++i)
+    {
+        delete (*i)->pStorage;
+        delete *i;
+    }
 }
 
-LRUStorageMT* LRUStorageMT::create(const CACHE_STORAGE_CONFIG& config, Storage* pStorage)
+LRUStorageMT* LRUStorageMT::create(const CACHE_STORAGE_CONFIG& config, const std::vector<Storage*>& storages)
 {
+    size_t n_shards = storages.size();
+
+    ss_dassert(n_shards > 0);
+    ss_dassert((config.max_count == 0) || (config.max_count >= n_shards));
+
     LRUStorageMT* plru_storage = NULL;
 
-    MXS_EXCEPTION_GUARD(plru_storage = new LRUStorageMT(config, pStorage));
+    MXS_EXCEPTION_GUARD(plru_storage = new LRUStorageMT(config, n_shards));
+
+    bool ok = (plru_storage != NULL);
+
+    for (size_t i = 0; i < n_shards; ++i)
+    {
+        LRUStorageST* pStorage = NULL;
+
+        if (ok)
+        {
+            // The limits are divided so that the limits of the shards add
+            // up to those of the whole storage.
+            CACHE_STORAGE_CONFIG shard_config = config;
+            shard_config.max_count = config.max_count / n_shards + (i < config.max_count % n_shards);
+            shard_config.max_size = config.max_size / n_shards + (i < config.max_size % n_shards);
+
+            pStorage = LRUStorageST::create(shard_config, storages[i], &plru_storage->m_clock);
+        }
+
+        if (pStorage)
+        {
+            Shard* pShard = new (std::nothrow) Shard(pStorage);
+
+            if (pShard)
+            {
+                // Space was reserved in the constructor, so this does not throw.
+                plru_storage->m_shards.push_back(pShard);
+            }
+            else
+            {
+                delete pStorage;
+                ok = false;
+            }
+        }
+        else
+        {
+            delete storages[i];
+            ok = false;
+        }
+    }
+
+    if (ok)
+    {
+        MXS_NOTICE("Created multi threaded LRU storage with %lu shards.", n_shards);
+    }
+    else
+    {
+        delete plru_storage;
+        plru_storage = NULL;
+    }
 
     return plru_storage;
 }
 
+void LRUStorageMT::get_config(CACHE_STORAGE_CONFIG* pConfig)
+{
+    *pConfig = m_config;
+}
+
 cache_result_t LRUStorageMT::get_info(uint32_t what,
                                       json_t** ppInfo) const
 {
-    SpinLockGuard guard(m_lock);
+    if (m_shards.size() == 1)
+    {
+        SpinLockGuard guard(m_shards[0]->lock);
+
+        return m_shards[0]->pStorage->get_info(what, ppInfo);
+    }
+
+    cache_result_t result = CACHE_RESULT_OUT_OF_RESOURCES;
+
+    json_t* pLru = json_object();
+    json_t* pShards = json_array();
+
+    if (pLru && pShards)
+    {
+        result = CACHE_RESULT_OK;
+
+        for (size_t i = 0; (i < m_shards.size()) && CACHE_RESULT_IS_OK(result); ++i)
+        {
+            json_t* pShard_info;
+
+            {
+                SpinLockGuard guard(m_shards[i]->lock);
 
-    return LRUStorage::do_get_info(what, ppInfo);
+                result = m_shards[i]->pStorage->get_info(what, &pShard_info);
+            }
+
+            if (CACHE_RESULT_IS_OK(result))
+            {
+                add_integers(pLru, json_object_get(pShard_info, "lru"));
+                json_array_append_new(pShards, pShard_info);
+            }
+        }
+    }
+
+    if (CACHE_RESULT_IS_OK(result) && (*ppInfo = json_object()))
+    {
+        json_object_set_new(*ppInfo, "lru", pLru);
+        json_object_set_new(*ppInfo, "shards", pShards);
+    }
+    else
+    {
+        json_decref(pLru);
+        json_decref(pShards);
+        result = CACHE_RESULT_IS_OK(result) ? CACHE_RESULT_OUT_OF_RESOURCES : result;
+    }
+
+    return result;
 }
 
 cache_result_t LRUStorageMT::get_value(const CACHE_KEY& key,
                                        uint32_t flags,
                                        GWBUF** ppValue) const
 {
-    SpinLockGuard guard(m_lock);
+    Shard& s = shard(key);
+    SpinLockGuard guard(s.lock);
 
-    return do_get_value(key, flags, ppValue);
+    return s.pStorage->get_value(key, flags, ppValue);
 }
 
-cache_result_t LRUStorageMT::put_value(const CACHE_KEY& key, const GWBUF* pValue)
+cache_result_t LRUStorageMT::put_value(const CACHE_KEY& key,
+                                       const std::vector<std::string>& words,
+                                       const GWBUF* pValue)
 {
-    SpinLockGuard guard(m_lock);
+    Shard& s = shard(key);
+    SpinLockGuard guard(s.lock);
 
-    return do_put_value(key, pValue);
+    return s.pStorage->put_value(key, words, pValue);
 }
 
 cache_result_t LRUStorageMT::del_value(const CACHE_KEY& key)
 {
-    SpinLockGuard guard(m_lock);
+    Shard& s = shard(key);
+    SpinLockGuard guard(s.lock);
+
+    return s.pStorage->del_value(key);
+}
+
+cache_result_t LRUStorageMT::invalidate(const std::vector<std::string>& words)
+{
+    cache_result_t result = CACHE_RESULT_OK;
+
+    // The values depending upon a word may be in any shard.
+    for (std::vector<Shard*>::iterator i = m_shards.begin(); i != m_shards.end(); ++i)
+    {
+        SpinLockGuard guard((*i)->lock);
+
+        cache_result_t rv = (*i)->pStorage->invalidate(words);
+
+        if (!CACHE_RESULT_IS_OK(rv))
+        {
+            result = rv;
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Find the shard holding the most or least recently used item.
+ *
+ * @param head  If true, the shard of the most recently used item is returned,
+ *              otherwise the shard of the least recently used item.
+ *
+ * @return The shard, or NULL if all shards are empty.
+ */
+const LRUStorageMT::Shard* LRUStorageMT::head_or_tail_shard(bool head) const
+{
+    const Shard* pFound = NULL;
+    uint64_t found_stamp = 0;
 
-    return do_del_value(key);
+    for (std::vector<Shard*>::const_iterator i = m_shards.begin(); i != m_shards.end(); ++i)
+    {
+        uint64_t stamp;
+
+        {
+            SpinLockGuard guard((*i)->lock);
+
+            stamp = head ? (*i)->pStorage->head_stamp() : (*i)->pStorage->tail_stamp();
+        }
+
+        if (stamp != 0 && (!pFound || (head ? stamp > found_stamp : stamp < found_stamp)))
+        {
+            pFound = *i;
+            found_stamp = stamp;
+        }
+    }
+
+    return pFound;
 }
 
 cache_result_t LRUStorageMT::get_head(CACHE_KEY* pKey, GWBUF** ppHead) const
 {
-    SpinLockGuard guard(m_lock);
+    cache_result_t result = CACHE_RESULT_NOT_FOUND;
+    const Shard* pShard = head_or_tail_shard(true);
+
+    if (pShard)
+    {
+        SpinLockGuard guard(pShard->lock);
 
-    return LRUStorage::do_get_head(pKey, ppHead);
+        result = pShard->pStorage->get_head(pKey, ppHead);
+    }
+
+    return result;
 }
 
 cache_result_t LRUStorageMT::get_tail(CACHE_KEY* pKey, GWBUF** ppTail) const
 {
-    SpinLockGuard guard(m_lock);
+    cache_result_t result = CACHE_RESULT_NOT_FOUND;
+    const Shard* pShard = head_or_tail_shard(false);
+
+    if (pShard)
+    {
+        SpinLockGuard guard(pShard->lock);
 
-    return LRUStorage::do_get_tail(pKey, ppTail);
+        result = pShard->pStorage->get_tail(pKey, ppTail);
+    }
+
+    return result;
 }
 
 cache_result_t LRUStorageMT::get_size(uint64_t* pSize) const
 {
-    SpinLockGuard guard(m_lock);
+    *pSize = 0;
+
+    for (std::vector<Shard*>::const_iterator i = m_shards.begin(); i != m_shards.end(); ++i)
+    {
+        SpinLockGuard guard((*i)->lock);
+        uint64_t size;
 
-    return LRUStorage::do_get_size(pSize);
+        (*i)->pStorage->get_size(&size);
+        *pSize += size;
+    }
+
+    return CACHE_RESULT_OK;
 }
 
 cache_result_t LRUStorageMT::get_items(uint64_t* pItems) const
 {
-    SpinLockGuard guard(m_lock);
+    *pItems = 0;
+
+    for (std::vector<Shard*>::const_iterator i = m_shards.begin(); i != m_shards.end(); ++i)
+    {
+        SpinLockGuard guard((*i)->lock);
+        uint64_t items;
+
+        (*i)->pStorage->get_items(&items);
+        *pItems += items;
+    }
+
+    return CACHE_RESULT_OK;
+}
+
+cache_result_t LRUStorageMT::get_snapshot_items(std::vector<Item>* pItems) const
+{
+    cache_result_t result = CACHE_RESULT_OK;
+
+    // As the limits are applied per shard, it suffices that the items are
+    // in LRU order within each shard.
+    for (std::vector<Shard*>::const_iterator i = m_shards.begin();
+         (i != m_shards.end()) && CACHE_RESULT_IS_OK(result);
+         ++i)
+    {
+        SpinLockGuard guard((*i)->lock);
+
+        result = (*i)->pStorage->get_snapshot_items(pItems);
+    }
+
+    return result;
+}
+
+cache_result_t LRUStorageMT::peek_value(const CACHE_KEY& key,
+                                        uint32_t flags,
+                                        GWBUF** ppValue) const
+{
+    Shard& s = shard(key);
+    SpinLockGuard guard(s.lock);
+
+    return s.pStorage->peek_value(key, flags, ppValue);
+}
+
+cache_result_t LRUStorageMT::restore_value(const Item& item, const GWBUF* pValue)
+{
+    Shard& s = shard(item.key);
+    SpinLockGuard guard(s.lock);
 
-    return LRUStorage::do_get_items(pItems);
+    return s.pStorage->restore_value(item, pValue);
 }
@@ -13,15 +13,34 @@
  */
 
 #include <maxscale/cppdefs.hh>
+#include <vector>
 #include <maxscale/spinlock.hh>
-#include "lrustorage.hh"
+#include "lrustoragest.hh"
 
-class LRUStorageMT : public LRUStorage
+/**
+ * LRUStorageMT is a multi-threaded LRU storage that consists of a number of
+ * independent single-threaded LRU storages, each protected by a lock of its
+ * own. The shard of an item is selected using the hash of its key and the
+ * maximum count and size of the storage are divided between the shards.
+ */
+class LRUStorageMT : public Storage
 {
 public:
     ~LRUStorageMT();
 
-    static LRUStorageMT* create(const CACHE_STORAGE_CONFIG& config, Storage* pstorage);
+    /**
+     * Create a multi-threaded LRU storage.
+     *
+     * @param config    The configuration of the storage as a whole.
+     * @param storages  The real storages, one per shard. Ownership of the
+     *                  storages is transferred to the created storage, also
+     *                  if the creation fails.
+     *
+     * @return A new storage, or NULL if the creation failed.
+     */
+    static LRUStorageMT* create(const CACHE_STORAGE_CONFIG& config, const std::vector<Storage*>& storages);
+
+    void get_config(CACHE_STORAGE_CONFIG* pConfig);
 
     cache_result_t get_info(uint32_t what,
                             json_t** ppInfo) const;
@@ -31,10 +50,13 @@ public:
                              GWBUF** ppValue) const;
 
     cache_result_t put_value(const CACHE_KEY& key,
+                             const std::vector<std::string>& words,
                              const GWBUF* pValue);
 
     cache_result_t del_value(const CACHE_KEY& key);
 
+    cache_result_t invalidate(const std::vector<std::string>& words);
+
     cache_result_t get_head(CACHE_KEY* pKey,
                             GWBUF** ppValue) const;
 
@@ -45,12 +67,41 @@ public:
 
     cache_result_t get_items(uint64_t* pItems) const;
 
+    cache_result_t get_snapshot_items(std::vector<Item>* pItems) const;
+
+    cache_result_t peek_value(const CACHE_KEY& key,
+                              uint32_t flags,
+                              GWBUF** ppValue) const;
+
+    cache_result_t restore_value(const Item& item, const GWBUF* pValue);
+
 private:
-    LRUStorageMT(const CACHE_STORAGE_CONFIG& config, Storage* pStorage);
+    LRUStorageMT(const CACHE_STORAGE_CONFIG& config, size_t n_shards);
 
     LRUStorageMT(const LRUStorageMT&);
     LRUStorageMT& operator = (const LRUStorageMT&);
 
+    struct Shard
+    {
+        Shard(LRUStorageST* pStorage)
+            : pStorage(pStorage)
+        {
+            spinlock_init(&lock);
+        }
+
+        mutable SPINLOCK lock;     /*< Protects pStorage. */
+        LRUStorageST*    pStorage; /*< The LRU storage of this shard. */
+    };
+
+    Shard& shard(const CACHE_KEY& key) const
+    {
+        return *m_shards[std::tr1::hash<CACHE_KEY>()(key) % m_shards.size()];
+    }
+
+    const Shard* head_or_tail_shard(bool head) const;
+
 private:
-    mutable SPINLOCK m_lock;
+    const CACHE_STORAGE_CONFIG m_config; /*< The configuration. */
+    std::vector<Shard*>        m_shards; /*< The shards. */
+    uint64_t                   m_clock;  /*< Source of the access stamps. */
 };
@@ -14,21 +14,25 @@
 #define MXS_MODULE_NAME "cache"
 #include "lrustoragest.hh"
 
-LRUStorageST::LRUStorageST(const CACHE_STORAGE_CONFIG& config, Storage* pStorage)
-    : LRUStorage(config, pStorage)
+LRUStorageST::LRUStorageST(const CACHE_STORAGE_CONFIG& config, Storage* pStorage, uint64_t* pClock)
+    : LRUStorage(config, pStorage, pClock)
 {
-    MXS_NOTICE("Created single threaded LRU storage.");
+    if (!pClock)
+    {
+        MXS_NOTICE("Created single threaded LRU storage.");
+    }
 }
 
 LRUStorageST::~LRUStorageST()
 {
 }
 
-LRUStorageST* LRUStorageST::create(const CACHE_STORAGE_CONFIG& config, Storage* pStorage)
+LRUStorageST* LRUStorageST::create(const CACHE_STORAGE_CONFIG& config, Storage* pStorage,
+                                   uint64_t* pClock)
 {
     LRUStorageST* plru_storage = NULL;
 
-    MXS_EXCEPTION_GUARD(plru_storage = new LRUStorageST(config, pStorage));
+    MXS_EXCEPTION_GUARD(plru_storage = new LRUStorageST(config, pStorage, pClock));
 
     return plru_storage;
 }
@@ -46,9 +50,11 @@ cache_result_t LRUStorageST::get_value(const CACHE_KEY& key,
     return LRUStorage::do_get_value(key, flags, ppValue);
 }
 
-cache_result_t LRUStorageST::put_value(const CACHE_KEY& key, const GWBUF* pValue)
+cache_result_t LRUStorageST::put_value(const CACHE_KEY& key,
+                                       const std::vector<std::string>& words,
+                                       const GWBUF* pValue)
 {
-    return LRUStorage::do_put_value(key, pValue);
+    return LRUStorage::do_put_value(key, words, pValue);
 }
 
 cache_result_t LRUStorageST::del_value(const CACHE_KEY& key)
@@ -56,6 +62,11 @@ cache_result_t LRUStorageST::del_value(const CACHE_KEY& key)
     return LRUStorage::do_del_value(key);
 }
 
+cache_result_t LRUStorageST::invalidate(const std::vector<std::string>& words)
+{
+    return LRUStorage::do_invalidate(words);
+}
+
 cache_result_t LRUStorageST::get_head(CACHE_KEY* pKey, GWBUF** ppValue) const
 {
     return LRUStorage::do_get_head(pKey, ppValue);
@@ -75,3 +86,20 @@ cache_result_t LRUStorageST::get_items(uint64_t* pItems) const
 {
     return LRUStorage::do_get_items(pItems);
 }
+
+cache_result_t LRUStorageST::get_snapshot_items(std::vector<Item>* pItems) const
+{
+    return LRUStorage::do_get_snapshot_items(pItems);
+}
+
+cache_result_t LRUStorageST::peek_value(const CACHE_KEY& key,
+                                        uint32_t flags,
+                                        GWBUF** ppValue) const
+{
+    return LRUStorage::do_peek_value(key, flags, ppValue);
+}
+
+cache_result_t LRUStorageST::restore_value(const Item& item, const GWBUF* pValue)
+{
+    return LRUStorage::do_restore_value(item, pValue);
+}
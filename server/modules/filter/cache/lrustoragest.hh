@@ -20,7 +20,8 @@ class LRUStorageST : public LRUStorage
 public:
     ~LRUStorageST();
 
-    static LRUStorageST* create(const CACHE_STORAGE_CONFIG& config, Storage* pstorage);
+    static LRUStorageST* create(const CACHE_STORAGE_CONFIG& config, Storage* pstorage,
+                                uint64_t* pClock = NULL);
 
     cache_result_t get_info(uint32_t what,
                             json_t** ppInfo) const;
@@ -30,10 +31,13 @@ public:
                              GWBUF** ppValue) const;
 
     cache_result_t put_value(const CACHE_KEY& key,
+                             const std::vector<std::string>& words,
                              const GWBUF* pValue);
 
     cache_result_t del_value(const CACHE_KEY& key);
 
+    cache_result_t invalidate(const std::vector<std::string>& words);
+
     cache_result_t get_head(CACHE_KEY* pKey,
                             GWBUF** ppValue) const;
 
@@ -44,8 +48,16 @@ public:
 
     cache_result_t get_items(uint64_t* pItems) const;
 
+    cache_result_t get_snapshot_items(std::vector<Item>* pItems) const;
+
+    cache_result_t peek_value(const CACHE_KEY& key,
+                              uint32_t flags,
+                              GWBUF** ppValue) const;
+
+    cache_result_t restore_value(const Item& item, const GWBUF* pValue);
+
 private:
-    LRUStorageST(const CACHE_STORAGE_CONFIG& config, Storage* pstorage);
+    LRUStorageST(const CACHE_STORAGE_CONFIG& config, Storage* pstorage, uint64_t* pClock);
 
     LRUStorageST(const LRUStorageST&);
     LRUStorageST& operator = (const LRUStorageST&);
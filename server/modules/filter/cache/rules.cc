@@ -16,6 +16,9 @@
 #include <errno.h>
 #include <stdio.h>
 #include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
 #include <maxscale/alloc.h>
 #include <maxscale/modutil.h>
 #include <maxscale/mysql_utils.h>
@@ -161,6 +164,12 @@ static bool cache_rules_parse_use_element(CACHE_RULES *self, json_t *object, siz
 static pcre2_match_data** alloc_match_datas(int count, pcre2_code* code);
 static void free_match_datas(int count, pcre2_match_data** datas);
 
+static bool cache_rules_compile(CACHE_RULES* self);
+static void cache_rules_index_free(struct cache_rules_index* index);
+static CACHE_RULE* cache_rules_find_store_rule(CACHE_RULES* self, int thread_id,
+                                               const char* default_db, const GWBUF* query);
+static bool cache_rules_find_use_rule(CACHE_RULES* self, int thread_id, const char* account);
+
 /*
  * API begin
  */
@@ -297,6 +306,7 @@ void cache_rules_free(CACHE_RULES *rules)
             json_decref(rules->root);
         }
 
+        cache_rules_index_free(rules->index);
         cache_rule_free(rules->store_rules);
         cache_rule_free(rules->use_rules);
         MXS_FREE(rules);
@@ -324,24 +334,101 @@ void cache_rules_print(const CACHE_RULES *self, DCB *dcb, size_t indent)
 
 bool cache_rules_should_store(CACHE_RULES *self, int thread_id, const char *default_db, const GWBUF* query)
 {
-    bool should_store = false;
+    return cache_rules_get_store_stats(self, thread_id, default_db, query) != NULL;
+}
+
+CACHE_RULE_STATS *cache_rules_get_store_stats(CACHE_RULES *self, int thread_id,
+                                              const char *default_db, const GWBUF* query)
+{
+    CACHE_RULE_STATS *stats = NULL;
 
     CACHE_RULE *rule = self->store_rules;
 
-    if (rule)
+    if (rule && self->index)
     {
-        while (rule && !should_store)
+        rule = cache_rules_find_store_rule(self, thread_id, default_db, query);
+
+        if (rule)
         {
-            should_store = cache_rule_matches(rule, thread_id, default_db, query);
+            stats = &rule->stats;
+        }
+    }
+    else if (rule)
+    {
+        while (rule && !stats)
+        {
+            if (cache_rule_matches(rule, thread_id, default_db, query))
+            {
+                stats = &rule->stats;
+            }
+
             rule = rule->next;
         }
     }
     else
     {
-        should_store = true;
+        stats = &self->stats;
+    }
+
+    return stats;
+}
+
+static json_t *cache_rule_stats_to_json(const char *attribute, const char *op, const char *value,
+                                        const CACHE_RULE_STATS *stats)
+{
+    json_t *object = json_object();
+
+    if (object)
+    {
+        json_object_set_new(object, "attribute", json_string(attribute));
+        json_object_set_new(object, "op", json_string(op));
+        json_object_set_new(object, "value", json_string(value));
+        json_object_set_new(object, "hits", json_integer(stats->hits));
+        json_object_set_new(object, "misses", json_integer(stats->misses));
+        json_object_set_new(object, "stores", json_integer(stats->stores));
+        json_object_set_new(object, "size_rejected",
+                            json_integer(stats->size_rejected));
+        json_object_set_new(object, "bytes_served",
+                            json_integer(stats->bytes_served));
+    }
+
+    return object;
+}
+
+json_t *cache_rules_stats_to_json(const CACHE_RULES *self)
+{
+    json_t *array = json_array();
+
+    if (array)
+    {
+        if (self->store_rules)
+        {
+            for (CACHE_RULE *rule = self->store_rules; rule; rule = rule->next)
+            {
+                json_t *object = cache_rule_stats_to_json(cache_rule_attribute_to_string(rule->attribute),
+                                                          cache_rule_op_to_string(rule->op),
+                                                          rule->value,
+                                                          &rule->stats);
+
+                if (object)
+                {
+                    json_array_append_new(array, object);
+                }
+            }
+        }
+        else
+        {
+            // Without store rules, everything is stored.
+            json_t *object = cache_rule_stats_to_json("*", "*", "*", &self->stats);
+
+            if (object)
+            {
+                json_array_append_new(array, object);
+            }
+        }
     }
 
-    return should_store;
+    return array;
 }
 
 bool cache_rules_should_use(CACHE_RULES *self, int thread_id, const MXS_SESSION *session)
@@ -367,7 +454,12 @@ bool cache_rules_should_use(CACHE_RULES *self, int thread_id, const MXS_SESSION
         char account[strlen(user) + 1 + strlen(host) + 1];
         sprintf(account, "%s@%s", user, host);
 
-        while (rule && !should_use)
+        if (self->index)
+        {
+            should_use = cache_rules_find_use_rule(self, thread_id, account);
+        }
+
+        while (!self->index && rule && !should_use)
         {
             should_use = cache_rule_matches_user(rule, thread_id, account);
             rule = rule->next;
@@ -432,6 +524,18 @@ bool CacheRules::should_store(const char* zDefault_db, const GWBUF* pQuery) cons
     return cache_rules_should_store(m_pRules, get_current_thread_id(), zDefault_db, pQuery);
 }
 
+bool CacheRules::should_store(const char* zDefault_db, const GWBUF* pQuery, CACHE_RULE_STATS** ppStats) const
+{
+    *ppStats = cache_rules_get_store_stats(m_pRules, get_current_thread_id(), zDefault_db, pQuery);
+
+    return *ppStats != NULL;
+}
+
+json_t* CacheRules::stats_json() const
+{
+    return cache_rules_stats_to_json(m_pRules);
+}
+
 bool CacheRules::should_use(const MXS_SESSION* pSession) const
 {
     return cache_rules_should_use(m_pRules, get_current_thread_id(), pSession);
@@ -1891,7 +1995,7 @@ static CACHE_RULES* cache_rules_create_from_json(json_t* root, uint32_t debug)
 
     if (rules)
     {
-        if (cache_rules_parse_json(rules, root))
+        if (cache_rules_parse_json(rules, root) && cache_rules_compile(rules))
         {
             rules->root = root;
         }
@@ -2150,3 +2254,434 @@ static void free_match_datas(int count, pcre2_match_data** datas)
 
     MXS_FREE(datas);
 }
+
+/**
+ * A number of "like" rules of the same attribute combined into one regexp.
+ *
+ * A value that the combined regexp does not match is not matched by any
+ * of the rules, so they need not be evaluated one by one.
+ */
+struct cache_combined_regexp
+{
+    cache_combined_regexp()
+        : code(NULL)
+        , datas(NULL)
+    {
+    }
+
+    ~cache_combined_regexp()
+    {
+        if (code)
+        {
+            free_match_datas(config_threadcount(), datas);
+            pcre2_code_free(code);
+        }
+    }
+
+    bool matches(int thread_id, const char* value, size_t length) const
+    {
+        ss_dassert((thread_id >= 0) && (thread_id < config_threadcount()));
+        return pcre2_match(code, (PCRE2_SPTR)value, length, 0, 0, datas[thread_id], NULL) >= 0;
+    }
+
+    pcre2_code*        code;    // The combined regexp, NULL if the rules were not combined.
+    pcre2_match_data** datas;   // Match data for each thread.
+    std::vector<bool>  members; // Whether the rule at an index is part of the regexp.
+};
+
+/**
+ * The rules compiled for evaluating a statement without going through all
+ * of them one by one.
+ */
+struct cache_rules_index
+{
+    typedef std::unordered_map<std::string, size_t>      Names;
+    typedef std::unordered_map<std::string, CACHE_RULE*> Decisions;
+
+    cache_rules_index()
+        : memoize(false)
+    {
+    }
+
+    std::vector<CACHE_RULE*> store_rules;      // The store rules in order.
+    std::vector<bool>        store_indexed;    // Whether the store rule is in the name sets.
+    Names                    tables;           // Tables of the "=" table rules, by rule index.
+    Names                    qualified_tables; // "db.table" of the "=" table rules, by rule index.
+    cache_combined_regexp    store_query;      // The "like" query rules.
+    std::vector<CACHE_RULE*> use_rules;        // The use rules in order.
+    cache_combined_regexp    use_user;         // The "like" user rules.
+    bool                     memoize;          // Whether the decision depends only on the digest.
+    std::vector<Decisions>   decisions;        // The decisions by digest, for each thread.
+};
+
+/** The number of decisions a thread remembers before it forgets them all. */
+static const size_t CACHE_RULES_MAX_DECISIONS = 10000;
+
+static std::string cache_rules_lower(const char* s)
+{
+    std::string rv(s);
+
+    for (std::string::iterator i = rv.begin(); i != rv.end(); ++i)
+    {
+        *i = tolower(*i);
+    }
+
+    return rv;
+}
+
+/**
+ * Returns whether a regexp can be combined with others. A pattern that refers
+ * to its groups by number, or uses constructs that must be at the start of
+ * the pattern, would change its meaning if placed in an alternation.
+ *
+ * @param pattern  A regexp.
+ *
+ * @return True, if the regexp can be combined.
+ */
+static bool cache_rules_can_combine(const char* pattern)
+{
+    for (const char* p = pattern; *p; ++p)
+    {
+        if (*p == '\\')
+        {
+            ++p;
+
+            if (isdigit(*p) || *p == 'g' || *p == 'k')
+            {
+                return false;
+            }
+            else if (!*p)
+            {
+                break;
+            }
+        }
+        else if ((*p == '(') && ((p[1] == '*') || ((p[1] == '?') && strchr("0123456789+-R&P|", p[2]))))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Combines the "like" rules of an attribute.
+ *
+ * @param rules      The rules.
+ * @param attribute  The attribute whose rules are combined.
+ * @param combined   The regexp object to initialize.
+ *
+ * @return False, if memory allocation failed. It is not an error if the
+ *         rules could not be combined.
+ */
+static bool cache_rules_combine(const std::vector<CACHE_RULE*>& rules,
+                                cache_rule_attribute_t attribute,
+                                cache_combined_regexp* combined)
+{
+    std::string pattern;
+    size_t n = 0;
+
+    combined->members.assign(rules.size(), false);
+
+    for (size_t i = 0; i < rules.size(); ++i)
+    {
+        CACHE_RULE* rule = rules[i];
+
+        if ((rule->attribute == attribute) && (rule->op == CACHE_OP_LIKE) &&
+            cache_rules_can_combine(rule->value))
+        {
+            pattern += (n++ == 0) ? "(?:" : "|(?:";
+            pattern += rule->value;
+            pattern += ")";
+            combined->members[i] = true;
+        }
+    }
+
+    if (n < 2)
+    {
+        // With just one rule there is nothing to gain.
+        combined->members.assign(rules.size(), false);
+        return true;
+    }
+
+    int errcode;
+    PCRE2_SIZE erroffset;
+    pcre2_code* code = pcre2_compile((PCRE2_SPTR)pattern.c_str(), PCRE2_ZERO_TERMINATED, 0,
+                                     &errcode, &erroffset, NULL);
+
+    if (!code)
+    {
+        MXS_INFO("The %lu '%s' rules could not be combined into one regexp, "
+                 "they are evaluated one by one.", n, cache_rule_attribute_to_string(attribute));
+        combined->members.assign(rules.size(), false);
+        return true;
+    }
+
+    pcre2_jit_compile(code, PCRE2_JIT_COMPLETE);
+
+    pcre2_match_data** datas = alloc_match_datas(config_threadcount(), code);
+
+    if (!datas)
+    {
+        MXS_ERROR("PCRE2 match data creation failed. Most likely due to a "
+                  "lack of available memory.");
+        pcre2_code_free(code);
+        return false;
+    }
+
+    combined->code = code;
+    combined->datas = datas;
+    return true;
+}
+
+/**
+ * Compiles the rules. The table names of the "=" table rules are placed in
+ * hash sets and the "like" query and user rules are combined into one regexp
+ * each. If the store rules do not depend on the literals of a statement, the
+ * decisions are remembered by the canonical digest of the statement.
+ *
+ * The rules are not compiled, if their evaluation is logged.
+ *
+ * @param self  The rules object.
+ *
+ * @return False, if memory allocation failed.
+ */
+static bool cache_rules_compile(CACHE_RULES* self)
+{
+    if (self->debug & CACHE_DEBUG_RULES)
+    {
+        return true;
+    }
+
+    bool compiled = false;
+    cache_rules_index* index = NULL;
+
+    try
+    {
+        index = new cache_rules_index;
+        index->memoize = true;
+
+        for (CACHE_RULE* rule = self->store_rules; rule; rule = rule->next)
+        {
+            size_t i = index->store_rules.size();
+            bool indexed = false;
+
+            if ((rule->attribute == CACHE_ATTRIBUTE_TABLE) &&
+                (rule->op == CACHE_OP_EQ) && rule->simple.table)
+            {
+                cache_rules_index::Names& names =
+                    rule->simple.database ? index->qualified_tables : index->tables;
+                std::string name = rule->simple.database ?
+                                   cache_rules_lower(rule->simple.database) + "." : std::string();
+                name += cache_rules_lower(rule->simple.table);
+
+                // The first rule wins.
+                names.insert(std::make_pair(name, i));
+                indexed = true;
+            }
+            else if (rule->attribute == CACHE_ATTRIBUTE_QUERY)
+            {
+                index->memoize = false;
+            }
+
+            index->store_rules.push_back(rule);
+            index->store_indexed.push_back(indexed);
+        }
+
+        for (CACHE_RULE* rule = self->use_rules; rule; rule = rule->next)
+        {
+            index->use_rules.push_back(rule);
+        }
+
+        if (index->memoize)
+        {
+            index->decisions.resize(config_threadcount());
+        }
+
+        compiled = cache_rules_combine(index->store_rules, CACHE_ATTRIBUTE_QUERY, &index->store_query) &&
+                   cache_rules_combine(index->use_rules, CACHE_ATTRIBUTE_USER, &index->use_user);
+    }
+    catch (const std::bad_alloc&)
+    {
+        MXS_OOM();
+    }
+
+    if (compiled)
+    {
+        self->index = index;
+    }
+    else
+    {
+        delete index;
+    }
+
+    return compiled;
+}
+
+static void cache_rules_index_free(cache_rules_index* index)
+{
+    delete index;
+}
+
+/**
+ * Finds the first store rule that matches a statement, using the compiled
+ * rules.
+ *
+ * @param self       The rules object.
+ * @param thread_id  The thread id of the calling thread.
+ * @param default_db The current default db.
+ * @param query      The query.
+ *
+ * @return The first matching rule, or NULL if no rule matches.
+ */
+static CACHE_RULE* cache_rules_evaluate_store(CACHE_RULES* self, int thread_id,
+                                              const char* default_db, const GWBUF* query)
+{
+    cache_rules_index* index = self->index;
+    size_t first = index->store_rules.size();
+
+    if (!index->tables.empty() || !index->qualified_tables.empty())
+    {
+        int n;
+        char** names = qc_get_table_names((GWBUF*)query, &n, true);
+
+        for (int i = 0; i < n; ++i)
+        {
+            std::string name = cache_rules_lower(names[i]);
+            size_t dot = name.find('.');
+            cache_rules_index::Names::const_iterator it;
+
+            it = index->tables.find(dot == std::string::npos ? name : name.substr(dot + 1));
+
+            if ((it != index->tables.end()) && (it->second < first))
+            {
+                first = it->second;
+            }
+
+            bool qualified = dot != std::string::npos;
+
+            if (!qualified && default_db)
+            {
+                name = cache_rules_lower(default_db) + "." + name;
+                qualified = true;
+            }
+
+            if (qualified)
+            {
+                it = index->qualified_tables.find(name);
+
+                if ((it != index->qualified_tables.end()) && (it->second < first))
+                {
+                    first = it->second;
+                }
+            }
+
+            MXS_FREE(names[i]);
+        }
+
+        MXS_FREE(names);
+    }
+
+    bool query_may_match = true;
+
+    if (index->store_query.code)
+    {
+        char* sql;
+        int len;
+
+        // Will succeed, query contains a contiguous COM_QUERY.
+        modutil_extract_SQL((GWBUF*)query, &sql, &len);
+        query_may_match = index->store_query.matches(thread_id, sql, len);
+    }
+
+    // Only the rules before the first matching indexed rule need to be checked.
+    for (size_t i = 0; i < first; ++i)
+    {
+        if (!index->store_indexed[i] &&
+            (query_may_match || !index->store_query.members[i]) &&
+            cache_rule_matches(index->store_rules[i], thread_id, default_db, query))
+        {
+            return index->store_rules[i];
+        }
+    }
+
+    return first < index->store_rules.size() ? index->store_rules[first] : NULL;
+}
+
+/**
+ * Finds the first store rule that matches a statement. If the rules do not
+ * depend on the literals, the result is remembered by the canonical digest
+ * of the statement and the default database.
+ *
+ * @param self       The rules object.
+ * @param thread_id  The thread id of the calling thread.
+ * @param default_db The current default db.
+ * @param query      The query.
+ *
+ * @return The first matching rule, or NULL if no rule matches.
+ */
+static CACHE_RULE* cache_rules_find_store_rule(CACHE_RULES* self, int thread_id,
+                                               const char* default_db, const GWBUF* query)
+{
+    cache_rules_index* index = self->index;
+    uint64_t digest;
+
+    if (!index->memoize || (thread_id < 0) || ((size_t)thread_id >= index->decisions.size()) ||
+        !modutil_get_canonical_digest((GWBUF*)query, &digest))
+    {
+        return cache_rules_evaluate_store(self, thread_id, default_db, query);
+    }
+
+    std::string key((const char*)&digest, sizeof(digest));
+
+    if (default_db)
+    {
+        key += default_db;
+    }
+
+    cache_rules_index::Decisions& decisions = index->decisions[thread_id];
+    cache_rules_index::Decisions::const_iterator it = decisions.find(key);
+
+    if (it != decisions.end())
+    {
+        return it->second;
+    }
+
+    CACHE_RULE* rule = cache_rules_evaluate_store(self, thread_id, default_db, query);
+
+    if (decisions.size() >= CACHE_RULES_MAX_DECISIONS)
+    {
+        decisions.clear();
+    }
+
+    decisions.insert(std::make_pair(key, rule));
+
+    return rule;
+}
+
+/**
+ * Returns whether any use rule matches an account, using the compiled rules.
+ *
+ * @param self       The rules object.
+ * @param thread_id  The thread id of the calling thread.
+ * @param account    The account, "user@host".
+ *
+ * @return True, if a rule matches.
+ */
+static bool cache_rules_find_use_rule(CACHE_RULES* self, int thread_id, const char* account)
+{
+    cache_rules_index* index = self->index;
+    size_t len = strlen(account);
+    bool user_may_match = !index->use_user.code || index->use_user.matches(thread_id, account, len);
+
+    for (size_t i = 0; i < index->use_rules.size(); ++i)
+    {
+        if ((user_may_match || !index->use_user.members[i]) &&
+            cache_rule_matches_user(index->use_rules[i], thread_id, account))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
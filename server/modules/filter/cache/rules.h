@@ -41,6 +41,15 @@ typedef enum cache_rule_op
 } cache_rule_op_t;
 
 
+typedef struct cache_rule_stats
+{
+    uint64_t hits;          // The number of results served from the cache.
+    uint64_t misses;        // The number of results fetched from the server.
+    uint64_t stores;        // The number of results stored to the cache.
+    uint64_t size_rejected; // The number of results too large to be stored.
+    uint64_t bytes_served;  // The number of bytes served from the cache.
+} CACHE_RULE_STATS;
+
 typedef struct cache_rule
 {
     cache_rule_attribute_t attribute; // What attribute is evalued.
@@ -58,6 +67,7 @@ typedef struct cache_rule
         pcre2_match_data **datas;
     } regexp;                         // Regexp data, only for CACHE_OP_[LIKE|UNLIKE].
     uint32_t               debug;     // The debug level.
+    CACHE_RULE_STATS       stats;     // The statistics of statements matching the rule.
     struct cache_rule     *next;
 } CACHE_RULE;
 
@@ -67,6 +77,8 @@ typedef struct cache_rules
     uint32_t    debug;        // The debug level.
     CACHE_RULE *store_rules;  // The rules for when to store data to the cache.
     CACHE_RULE *use_rules;    // The rules for when to use data from the cache.
+    CACHE_RULE_STATS stats;   // The statistics of all statements, if there are no store rules.
+    struct cache_rules_index *index; // The rules compiled for evaluation, NULL if not compiled.
 } CACHE_RULES;
 
 /**
@@ -145,6 +157,31 @@ void cache_rules_print(const CACHE_RULES *rules, DCB* dcb, size_t indent);
  */
 bool cache_rules_should_store(CACHE_RULES *rules, int thread_id, const char *default_db, const GWBUF* query);
 
+/**
+ * Returns the statistics of the store rule that matches a query, that is, of
+ * the rule due to which the result of the query should be stored.
+ *
+ * @param rules      The CACHE_RULES object.
+ * @param thread_id  The thread id of current thread.
+ * @param default_db The current default database, NULL if there is none.
+ * @param query      The query, expected to contain a COM_QUERY.
+ *
+ * @return The statistics of the matching rule, or of all statements if there
+ *         are no store rules. NULL, if the result should not be stored.
+ */
+CACHE_RULE_STATS *cache_rules_get_store_stats(CACHE_RULES *rules, int thread_id,
+                                              const char *default_db, const GWBUF* query);
+
+/**
+ * Returns the statistics of the store rules as a JSON array.
+ *
+ * @param rules  The CACHE_RULES object.
+ *
+ * @return An array with an object per store rule, or NULL if memory
+ *         allocation fails.
+ */
+json_t *cache_rules_stats_to_json(const CACHE_RULES *rules);
+
 /**
  * Returns boolean indicating whether the cache should be used, that is consulted.
  *
@@ -204,6 +241,25 @@ public:
      */
     bool should_store(const char* zDefault_db, const GWBUF* pQuery) const;
 
+    /**
+     * Returns boolean indicating whether the result of the query should be stored.
+     *
+     * @param zdefault_db The current default database, NULL if there is none.
+     * @param pquery      The query, expected to contain a COM_QUERY.
+     * @param ppStats     On return, if true is returned, the statistics of the
+     *                    rule due to which the result should be stored.
+     *
+     * @return True, if the results should be stored.
+     */
+    bool should_store(const char* zDefault_db, const GWBUF* pQuery, CACHE_RULE_STATS** ppStats) const;
+
+    /**
+     * Returns the statistics of the store rules.
+     *
+     * @see cache_rules_stats_to_json
+     */
+    json_t* stats_json() const;
+
     /**
      * Returns boolean indicating whether the cache should be used, that is consulted.
      *
@@ -22,3 +22,18 @@ Storage::Storage()
 Storage::~Storage()
 {
 }
+
+cache_result_t Storage::get_snapshot_items(std::vector<Item>* pItems) const
+{
+    return CACHE_RESULT_OUT_OF_RESOURCES;
+}
+
+cache_result_t Storage::peek_value(const CACHE_KEY& key, uint32_t flags, GWBUF** ppValue) const
+{
+    return get_value(key, flags, ppValue);
+}
+
+cache_result_t Storage::restore_value(const Item& item, const GWBUF* pValue)
+{
+    return CACHE_RESULT_OUT_OF_RESOURCES;
+}
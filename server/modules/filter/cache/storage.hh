@@ -13,6 +13,8 @@
  */
 
 #include <maxscale/cppdefs.hh>
+#include <string>
+#include <vector>
 #include "cache_storage_api.h"
 
 class Storage
@@ -23,6 +25,16 @@ public:
         INFO_ALL = CACHE_STORAGE_INFO_ALL
     };
 
+    /**
+     * The information needed for restoring an item, e.g. from a snapshot.
+     */
+    struct Item
+    {
+        CACHE_KEY                key;   /*< The key of the item. */
+        uint32_t                 time;  /*< When the value of the item was stored. */
+        std::vector<std::string> words; /*< The invalidation words of the item. */
+    };
+
     virtual ~Storage();
 
     /**
@@ -65,13 +77,18 @@ public:
      * Put a value to the cache.
      *
      * @param key     A key generated with get_key.
+     * @param words   The invalidation words of the value; the fully qualified
+     *                names of the tables the value depends on. Ignored unless
+     *                the storage was created with invalidation enabled.
      * @param pValue  Pointer to GWBUF containing the value to be stored.
      *                Must be one contiguous buffer.
      * @return CACHE_RESULT_OK if item was successfully put,
      *         CACHE_RESULT_OUT_OF_RESOURCES if item could not be put, due to
      *         some resource having become exhausted, or some other error code.
      */
-    virtual cache_result_t put_value(const CACHE_KEY& key, const GWBUF* pValue) = 0;
+    virtual cache_result_t put_value(const CACHE_KEY& key,
+                                     const std::vector<std::string>& words,
+                                     const GWBUF* pValue) = 0;
 
     /**
      * Delete a value from the cache.
@@ -84,6 +101,17 @@ public:
      */
     virtual cache_result_t del_value(const CACHE_KEY& key) = 0;
 
+    /**
+     * Invalidate all values that depend upon any of the provided words.
+     *
+     * @param words  The fully qualified names of modified tables.
+     *
+     * @return CACHE_RESULT_OK if the values were invalidated,
+     *         CACHE_RESULT_OUT_OF_RESOURCES if the storage is incapable of
+     *         invalidating, and CACHE_RESULT_ERROR otherwise.
+     */
+    virtual cache_result_t invalidate(const std::vector<std::string>& words) = 0;
+
     /**
      * Get the head item from the storage. This is only intended for testing and
      * debugging purposes and if the storage is being used by different threads
@@ -154,6 +182,48 @@ public:
      */
     virtual cache_result_t get_items(uint64_t* pItems) const = 0;
 
+    /**
+     * Get the items of the storage, the least recently used first, for
+     * taking a snapshot of the storage. The values are fetched separately
+     * using @c peek_value, so items may have been removed by the time
+     * their values are fetched.
+     *
+     * @param pItems  Vector that after a successful return contains the items.
+     *
+     * @return CACHE_RESULT_OK if the items were returned,
+     *         CACHE_RESULT_OUT_OF_RESOURCES if the storage is incapable of
+     *         returning the items, and
+     *         CACHE_RESULT_ERROR otherwise.
+     */
+    virtual cache_result_t get_snapshot_items(std::vector<Item>* pItems) const;
+
+    /**
+     * Get a value from the cache, without affecting the LRU order or the
+     * statistics of the storage.
+     *
+     * @see get_value
+     */
+    virtual cache_result_t peek_value(const CACHE_KEY& key,
+                                      uint32_t flags,
+                                      GWBUF** ppValue) const;
+
+    /**
+     * Restore an item, e.g. from a snapshot. Unlike with @c put_value, the
+     * value is not stored if the key exists already and the item retains
+     * the time it was originally stored at. The restored item becomes the
+     * most recently used one.
+     *
+     * @param item    The item.
+     * @param pValue  The value of the item. Must be one contiguous buffer.
+     *
+     * @return CACHE_RESULT_OK if the item was restored or already existed,
+     *         CACHE_RESULT_NOT_FOUND if the item had already expired,
+     *         CACHE_RESULT_OUT_OF_RESOURCES if the storage is incapable of
+     *         restoring items, and
+     *         CACHE_RESULT_ERROR otherwise.
+     */
+    virtual cache_result_t restore_value(const Item& item, const GWBUF* pValue);
+
 protected:
     Storage();
 
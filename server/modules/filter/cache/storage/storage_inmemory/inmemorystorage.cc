@@ -13,9 +13,13 @@
 
 #define MXS_MODULE_NAME "storage_inmemory"
 #include "inmemorystorage.hh"
+#include <stdlib.h>
+#include <time.h>
+#include <zlib.h>
 #include <maxscale/alloc.h>
 #include <maxscale/modutil.h>
 #include <maxscale/query_classifier.h>
+#include <maxscale/utils.h>
 #include "inmemorystoragest.hh"
 #include "inmemorystoragemt.hh"
 
@@ -32,11 +36,102 @@ const size_t INMEMORY_KEY_LENGTH = 2 * SHA512_DIGEST_LENGTH;
 #error storage_inmemory key is too long.
 #endif
 
+bool get_positive_integer(const char* zKey, const char* zValue, long max, long* pValue)
+{
+    char* zEnd = NULL;
+    long value = zValue ? strtol(zValue, &zEnd, 10) : 0;
+
+    bool rv = zValue && (*zValue != 0) && (*zEnd == 0) && (value > 0) && (value <= max);
+
+    if (rv)
+    {
+        *pValue = value;
+    }
+    else
+    {
+        MXS_ERROR("The value of '%s' must be an integer between 1 and %ld.", zKey, max);
+    }
+
+    return rv;
+}
+
+bool get_settings(int argc, char* argv[], InMemoryStorage::Settings* pSettings)
+{
+    bool ok = true;
+
+    for (int i = 0; i < argc; ++i)
+    {
+        size_t len = strlen(argv[i]);
+        char arg[len + 1];
+        strcpy(arg, argv[i]);
+
+        const char* zValue = NULL;
+        char *zEq = strchr(arg, '=');
+
+        if (zEq)
+        {
+            *zEq = 0;
+            zValue = trim(zEq + 1);
+        }
+
+        const char* zKey = trim(arg);
+        long value;
+
+        if (strcmp(zKey, "compression") == 0)
+        {
+            if (zValue && (strcmp(zValue, "zlib") == 0))
+            {
+                pSettings->compress = true;
+            }
+            else if (zValue && (strcmp(zValue, "none") == 0))
+            {
+                pSettings->compress = false;
+            }
+            else
+            {
+                MXS_ERROR("The value of '%s' must be 'none' or 'zlib'.", zKey);
+                ok = false;
+            }
+        }
+        else if (strcmp(zKey, "compression_threshold") == 0)
+        {
+            if (get_positive_integer(zKey, zValue, UINT32_MAX, &value))
+            {
+                pSettings->compression_threshold = value;
+            }
+            else
+            {
+                ok = false;
+            }
+        }
+        else if (strcmp(zKey, "compression_level") == 0)
+        {
+            if (get_positive_integer(zKey, zValue, Z_BEST_COMPRESSION, &value))
+            {
+                pSettings->compression_level = value;
+            }
+            else
+            {
+                ok = false;
+            }
+        }
+        else
+        {
+            MXS_WARNING("Unknown argument '%s'.", zKey);
+        }
+    }
+
+    return ok;
+}
+
 }
 
-InMemoryStorage::InMemoryStorage(const string& name, const CACHE_STORAGE_CONFIG& config)
+InMemoryStorage::InMemoryStorage(const string& name,
+                                 const CACHE_STORAGE_CONFIG& config,
+                                 const Settings& settings)
     : m_name(name)
     , m_config(config)
+    , m_settings(settings)
 {
 }
 
@@ -69,12 +164,19 @@ InMemoryStorage* InMemoryStorage::Create_instance(const char* zName,
                     "does not enforce such a limit.", (unsigned long)config.max_size);
     }
 
+    Settings settings;
+
+    if (!get_settings(argc, argv, &settings))
+    {
+        return NULL;
+    }
+
     auto_ptr<InMemoryStorage> sStorage;
 
     switch (config.thread_model)
     {
     case CACHE_THREAD_MODEL_ST:
-        sStorage = InMemoryStorageST::Create(zName, config, argc, argv);
+        sStorage = InMemoryStorageST::Create(zName, config, settings);
         break;
 
     default:
@@ -82,7 +184,7 @@ InMemoryStorage* InMemoryStorage::Create_instance(const char* zName,
         MXS_ERROR("Unknown thread model %d, creating multi-thread aware storage.",
                   (int)config.thread_model);
     case CACHE_THREAD_MODEL_MT:
-        sStorage = InMemoryStorageMT::Create(zName, config, argc, argv);
+        sStorage = InMemoryStorageMT::Create(zName, config, settings);
         break;
     }
 
@@ -96,17 +198,19 @@ void InMemoryStorage::get_config(CACHE_STORAGE_CONFIG* pConfig)
     *pConfig = m_config;
 }
 
-cache_result_t InMemoryStorage::get_head(CACHE_KEY* pKey, GWBUF** ppHead) const
+cache_result_t InMemoryStorage::invalidate(const std::vector<std::string>& words)
 {
+    // Invalidation is not supported natively; when enabled, the storage is
+    // decorated with one that is capable of it.
     return CACHE_RESULT_OUT_OF_RESOURCES;
 }
 
-cache_result_t InMemoryStorage::get_tail(CACHE_KEY* pKey, GWBUF** ppHead) const
+cache_result_t InMemoryStorage::get_head(CACHE_KEY* pKey, GWBUF** ppHead) const
 {
     return CACHE_RESULT_OUT_OF_RESOURCES;
 }
 
-cache_result_t InMemoryStorage::get_size(uint64_t* pSize) const
+cache_result_t InMemoryStorage::get_tail(CACHE_KEY* pKey, GWBUF** ppHead) const
 {
     return CACHE_RESULT_OUT_OF_RESOURCES;
 }
@@ -152,14 +256,36 @@ cache_result_t InMemoryStorage::do_get_value(const CACHE_KEY& key, uint32_t flag
         }
         else if (!is_soft_stale || include_stale)
         {
-            size_t length = entry.value.size();
+            size_t length = entry.length;
 
             *ppResult = gwbuf_alloc(length);
 
-            if (*ppResult)
+            if (*ppResult && entry.compressed)
+            {
+                // Decompressed straight into the buffer that is returned.
+                uint64_t start = mxs_clock_us();
+                uLongf out_length = length;
+
+                if ((uncompress(GWBUF_DATA(*ppResult), &out_length,
+                                entry.value.data(), entry.value.size()) != Z_OK) ||
+                    (out_length != length))
+                {
+                    ss_dassert(!true);
+                    MXS_ERROR("Could not decompress cached value.");
+                    gwbuf_free(*ppResult);
+                    *ppResult = NULL;
+                }
+
+                m_stats.decompressions += 1;
+                m_stats.decompression_time += mxs_clock_us() - start;
+            }
+            else if (*ppResult)
             {
                 memcpy(GWBUF_DATA(*ppResult), entry.value.data(), length);
+            }
 
+            if (*ppResult)
+            {
                 result = CACHE_RESULT_OK;
 
                 if (is_soft_stale)
@@ -190,7 +316,33 @@ cache_result_t InMemoryStorage::do_put_value(const CACHE_KEY& key, const GWBUF&
 {
     ss_dassert(GWBUF_IS_CONTIGUOUS(&value));
 
-    size_t size = GWBUF_LENGTH(&value);
+    size_t length = GWBUF_LENGTH(&value);
+    const uint8_t* pData = GWBUF_DATA(&value);
+    size_t size = length;
+
+    Value compressed;
+
+    if (m_settings.compress && (length >= m_settings.compression_threshold))
+    {
+        uint64_t start = mxs_clock_us();
+        uLongf compressed_length = compressBound(length);
+
+        compressed.resize(compressed_length);
+
+        if ((compress2(compressed.data(), &compressed_length, pData, length,
+                       m_settings.compression_level) == Z_OK) &&
+            (compressed_length < length))
+        {
+            pData = compressed.data();
+            size = compressed_length;
+
+            m_stats.compressions += 1;
+            m_stats.compression_in += length;
+            m_stats.compression_out += size;
+        }
+
+        m_stats.compression_time += mxs_clock_us() - start;
+    }
 
     Entries::iterator i = m_entries.find(key);
     Entry* pEntry;
@@ -225,10 +377,10 @@ cache_result_t InMemoryStorage::do_put_value(const CACHE_KEY& key, const GWBUF&
 
     m_stats.size += size;
 
-    const uint8_t* pData = GWBUF_DATA(&value);
-
     copy(pData, pData + size, pEntry->value.begin());
     pEntry->time = time(NULL);
+    pEntry->length = length;
+    pEntry->compressed = (size != length);
 
     return CACHE_RESULT_OK;
 }
@@ -252,6 +404,13 @@ cache_result_t InMemoryStorage::do_del_value(const CACHE_KEY& key)
     return i != m_entries.end() ? CACHE_RESULT_OK : CACHE_RESULT_NOT_FOUND;
 }
 
+cache_result_t InMemoryStorage::do_get_size(uint64_t* pSize) const
+{
+    *pSize = m_stats.size;
+
+    return CACHE_RESULT_OK;
+}
+
 static void set_integer(json_t* pObject, const char* zName, size_t value)
 {
     json_t* pValue = json_integer(value);
@@ -271,4 +430,19 @@ void InMemoryStorage::Stats::fill(json_t* pObject) const
     set_integer(pObject, "misses", misses);
     set_integer(pObject, "updates", updates);
     set_integer(pObject, "deletes", deletes);
+    set_integer(pObject, "compressions", compressions);
+    set_integer(pObject, "compression_time_us", compression_time);
+    set_integer(pObject, "decompressions", decompressions);
+    set_integer(pObject, "decompression_time_us", decompression_time);
+
+    if (compression_out != 0)
+    {
+        json_t* pRatio = json_real((double)compression_in / compression_out);
+
+        if (pRatio)
+        {
+            json_object_set(pObject, "compression_ratio", pRatio);
+            json_decref(pRatio);
+        }
+    }
 }
@@ -22,6 +22,25 @@
 class InMemoryStorage
 {
 public:
+    struct Settings
+    {
+        Settings()
+            : compress(false)
+            , compression_threshold(DEFAULT_COMPRESSION_THRESHOLD)
+            , compression_level(DEFAULT_COMPRESSION_LEVEL)
+        {}
+
+        enum
+        {
+            DEFAULT_COMPRESSION_THRESHOLD = 1024,
+            DEFAULT_COMPRESSION_LEVEL = 1
+        };
+
+        bool     compress;              /*< Whether values should be compressed. */
+        uint32_t compression_threshold; /*< Values shorter than this are not compressed. */
+        int      compression_level;     /*< The zlib compression level. */
+    };
+
     virtual ~InMemoryStorage();
 
     static bool Initialize(uint32_t* pCapabilities);
@@ -33,22 +52,28 @@ public:
     void get_config(CACHE_STORAGE_CONFIG* pConfig);
     virtual cache_result_t get_info(uint32_t what, json_t** ppInfo) const = 0;
     virtual cache_result_t get_value(const CACHE_KEY& key, uint32_t flags, GWBUF** ppResult) = 0;
-    virtual cache_result_t put_value(const CACHE_KEY& key, const GWBUF& value) = 0;
+    virtual cache_result_t put_value(const CACHE_KEY& key,
+                                     const std::vector<std::string>& words,
+                                     const GWBUF& value) = 0;
     virtual cache_result_t del_value(const CACHE_KEY& key) = 0;
 
+    cache_result_t invalidate(const std::vector<std::string>& words);
+
     cache_result_t get_head(CACHE_KEY* pKey, GWBUF** ppHead) const;
     cache_result_t get_tail(CACHE_KEY* pKey, GWBUF** ppHead) const;
-    cache_result_t get_size(uint64_t* pSize) const;
+    virtual cache_result_t get_size(uint64_t* pSize) const = 0;
     cache_result_t get_items(uint64_t* pItems) const;
 
 protected:
     InMemoryStorage(const std::string& name,
-                    const CACHE_STORAGE_CONFIG& config);
+                    const CACHE_STORAGE_CONFIG& config,
+                    const Settings& settings);
 
     cache_result_t do_get_info(uint32_t what, json_t** ppInfo) const;
     cache_result_t do_get_value(const CACHE_KEY& key, uint32_t flags, GWBUF** ppResult);
     cache_result_t do_put_value(const CACHE_KEY& key, const GWBUF& value);
     cache_result_t do_del_value(const CACHE_KEY& key);
+    cache_result_t do_get_size(uint64_t* pSize) const;
 
 private:
     InMemoryStorage(const InMemoryStorage&);
@@ -61,9 +86,13 @@ private:
     {
         Entry()
             : time(0)
+            , length(0)
+            , compressed(false)
         {}
 
         uint32_t time;
+        uint32_t length;     /*< The length of the value, when uncompressed. */
+        bool     compressed; /*< Whether the stored value is compressed. */
         Value    value;
     };
 
@@ -76,22 +105,35 @@ private:
             , misses(0)
             , updates(0)
             , deletes(0)
+            , compressions(0)
+            , compression_in(0)
+            , compression_out(0)
+            , compression_time(0)
+            , decompressions(0)
+            , decompression_time(0)
         {}
 
         void fill(json_t* pObject) const;
 
-        uint64_t size;       /*< The total size of the stored values. */
-        uint64_t items;      /*< The number of stored items. */
-        uint64_t hits;       /*< How many times a key was found in the cache. */
-        uint64_t misses;     /*< How many times a key was not found in the cache. */
-        uint64_t updates;    /*< How many times an existing key in the cache was updated. */
-        uint64_t deletes;    /*< How many times an existing key in the cache was deleted. */
+        uint64_t size;               /*< The total size of the stored values. */
+        uint64_t items;              /*< The number of stored items. */
+        uint64_t hits;               /*< How many times a key was found in the cache. */
+        uint64_t misses;             /*< How many times a key was not found in the cache. */
+        uint64_t updates;            /*< How many times an existing key in the cache was updated. */
+        uint64_t deletes;            /*< How many times an existing key in the cache was deleted. */
+        uint64_t compressions;       /*< How many values have been compressed. */
+        uint64_t compression_in;     /*< The total length of the compressed values, before. */
+        uint64_t compression_out;    /*< The total length of the compressed values, after. */
+        uint64_t compression_time;   /*< Time spent compressing, in microseconds. */
+        uint64_t decompressions;     /*< How many values have been decompressed. */
+        uint64_t decompression_time; /*< Time spent decompressing, in microseconds. */
     };
 
     typedef std::tr1::unordered_map<CACHE_KEY, Entry> Entries;
 
     std::string                m_name;
     const CACHE_STORAGE_CONFIG m_config;
+    const Settings             m_settings;
     Entries                    m_entries;
     Stats                      m_stats;
 };
@@ -18,8 +18,9 @@ using maxscale::SpinLockGuard;
 using std::auto_ptr;
 
 InMemoryStorageMT::InMemoryStorageMT(const std::string& name,
-                                     const CACHE_STORAGE_CONFIG& config)
-    : InMemoryStorage(name, config)
+                                     const CACHE_STORAGE_CONFIG& config,
+                                     const Settings& settings)
+    : InMemoryStorage(name, config, settings)
 {
     spinlock_init(&m_lock);
 }
@@ -30,9 +31,9 @@ InMemoryStorageMT::~InMemoryStorageMT()
 
 auto_ptr<InMemoryStorageMT> InMemoryStorageMT::Create(const std::string& name,
                                                       const CACHE_STORAGE_CONFIG& config,
-                                                      int argc, char* argv[])
+                                                      const Settings& settings)
 {
-    return auto_ptr<InMemoryStorageMT>(new InMemoryStorageMT(name, config));
+    return auto_ptr<InMemoryStorageMT>(new InMemoryStorageMT(name, config, settings));
 }
 
 cache_result_t InMemoryStorageMT::get_info(uint32_t what, json_t** ppInfo) const
@@ -49,7 +50,9 @@ cache_result_t InMemoryStorageMT::get_value(const CACHE_KEY& key, uint32_t flags
     return do_get_value(key, flags, ppResult);
 }
 
-cache_result_t InMemoryStorageMT::put_value(const CACHE_KEY& key, const GWBUF& value)
+cache_result_t InMemoryStorageMT::put_value(const CACHE_KEY& key,
+                                          const std::vector<std::string>& words,
+                                          const GWBUF& value)
 {
     SpinLockGuard guard(m_lock);
 
@@ -62,3 +65,10 @@ cache_result_t InMemoryStorageMT::del_value(const CACHE_KEY& key)
 
     return do_del_value(key);
 }
+
+cache_result_t InMemoryStorageMT::get_size(uint64_t* pSize) const
+{
+    SpinLockGuard guard(m_lock);
+
+    return do_get_size(pSize);
+}
@@ -17,8 +17,9 @@
 using std::auto_ptr;
 
 InMemoryStorageST::InMemoryStorageST(const std::string& name,
-                                     const CACHE_STORAGE_CONFIG& config)
-    : InMemoryStorage(name, config)
+                                     const CACHE_STORAGE_CONFIG& config,
+                                     const Settings& settings)
+    : InMemoryStorage(name, config, settings)
 {
 }
 
@@ -28,9 +29,9 @@ InMemoryStorageST::~InMemoryStorageST()
 
 auto_ptr<InMemoryStorageST> InMemoryStorageST::Create(const std::string& name,
                                                       const CACHE_STORAGE_CONFIG& config,
-                                                      int argc, char* argv[])
+                                                      const Settings& settings)
 {
-    return auto_ptr<InMemoryStorageST>(new InMemoryStorageST(name, config));
+    return auto_ptr<InMemoryStorageST>(new InMemoryStorageST(name, config, settings));
 }
 
 cache_result_t InMemoryStorageST::get_info(uint32_t what, json_t** ppInfo) const
@@ -43,7 +44,9 @@ cache_result_t InMemoryStorageST::get_value(const CACHE_KEY& key, uint32_t flags
     return do_get_value(key, flags, ppResult);
 }
 
-cache_result_t InMemoryStorageST::put_value(const CACHE_KEY& key, const GWBUF& value)
+cache_result_t InMemoryStorageST::put_value(const CACHE_KEY& key,
+                                          const std::vector<std::string>& words,
+                                          const GWBUF& value)
 {
     return do_put_value(key, value);
 }
@@ -52,3 +55,8 @@ cache_result_t InMemoryStorageST::del_value(const CACHE_KEY& key)
 {
     return do_del_value(key);
 }
+
+cache_result_t InMemoryStorageST::get_size(uint64_t* pSize) const
+{
+    return do_get_size(pSize);
+}
@@ -24,15 +24,20 @@ public:
 
     static SInMemoryStorageST Create(const std::string& name,
                                      const CACHE_STORAGE_CONFIG& config,
-                                     int argc, char* argv[]);
+                                     const Settings& settings);
 
     cache_result_t get_info(uint32_t what, json_t** ppInfo) const;
     cache_result_t get_value(const CACHE_KEY& key, uint32_t flags, GWBUF** ppResult);
-    cache_result_t put_value(const CACHE_KEY& key, const GWBUF& pValue);
+    cache_result_t put_value(const CACHE_KEY& key,
+                             const std::vector<std::string>& words,
+                             const GWBUF& value);
     cache_result_t del_value(const CACHE_KEY& key);
+    cache_result_t get_size(uint64_t* pSize) const;
 
 private:
-    InMemoryStorageST(const std::string& name, const CACHE_STORAGE_CONFIG& config);
+    InMemoryStorageST(const std::string& name,
+                      const CACHE_STORAGE_CONFIG& config,
+                      const Settings& settings);
 
 private:
     InMemoryStorageST(const InMemoryStorageST&);
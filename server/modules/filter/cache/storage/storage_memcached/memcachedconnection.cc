@@ -0,0 +1,414 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#define MXS_MODULE_NAME "storage_memcached"
+#include "memcachedconnection.hh"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/utils.h>
+
+using std::string;
+using std::vector;
+
+namespace
+{
+
+const char CRLF[] = "\r\n";
+
+}
+
+MemcachedConnection::MemcachedConnection(int fd, int timeout_ms)
+    : m_fd(fd)
+    , m_timeout(timeout_ms)
+{
+}
+
+MemcachedConnection::~MemcachedConnection()
+{
+    close(m_fd);
+}
+
+//static
+MemcachedConnection* MemcachedConnection::Create(const struct sockaddr* pAddr,
+                                                 socklen_t addrlen,
+                                                 int timeout_ms)
+{
+    MemcachedConnection* pConnection = NULL;
+
+    int fd = socket(pAddr->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (fd != -1)
+    {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        MemcachedConnection connection(fd, timeout_ms);
+        bool connected = false;
+
+        if (connect(fd, pAddr, addrlen) == 0)
+        {
+            connected = true;
+        }
+        else if ((errno == EINPROGRESS) && connection.wait(POLLOUT, connection.deadline()))
+        {
+            int error = 0;
+            socklen_t len = sizeof(error);
+
+            connected = (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) == 0) && (error == 0);
+        }
+
+        if (connected)
+        {
+            pConnection = new (std::nothrow) MemcachedConnection(fd, timeout_ms);
+        }
+
+        if (pConnection)
+        {
+            // Ownership of the socket was transferred.
+            connection.m_fd = -1;
+        }
+    }
+
+    return pConnection;
+}
+
+bool MemcachedConnection::get(const vector<string>& keys, Values* pValues)
+{
+    uint64_t until = deadline();
+
+    string command("get");
+
+    for (vector<string>::const_iterator i = keys.begin(); i != keys.end(); ++i)
+    {
+        command += ' ';
+        command += *i;
+    }
+
+    command += CRLF;
+
+    bool rv = send(command, until);
+    bool end = false;
+
+    while (rv && !end)
+    {
+        string line;
+        rv = read_line(&line, until);
+
+        if (rv)
+        {
+            if (line == "END")
+            {
+                end = true;
+            }
+            else if (line.compare(0, 6, "VALUE ") == 0)
+            {
+                // VALUE <key> <flags> <bytes> [<cas unique>]
+                char key[251];
+                unsigned int flags;
+                unsigned long bytes;
+
+                if (sscanf(line.c_str() + 6, "%250s %u %lu", key, &flags, &bytes) == 3)
+                {
+                    string value;
+                    rv = read_data(bytes, &value, until);
+
+                    if (rv)
+                    {
+                        (*pValues)[key].swap(value);
+                    }
+                }
+                else
+                {
+                    MXS_ERROR("Unexpected response from memcached: %s", line.c_str());
+                    rv = false;
+                }
+            }
+            else
+            {
+                MXS_ERROR("Unexpected response from memcached: %s", line.c_str());
+                rv = false;
+            }
+        }
+    }
+
+    return rv;
+}
+
+bool MemcachedConnection::set(const string& key, uint32_t exptime, const string& value)
+{
+    char header[128];
+    snprintf(header, sizeof(header), " 0 %u %lu noreply\r\n", exptime, (unsigned long)value.length());
+
+    string command("set ");
+    command.reserve(key.length() + strlen(header) + value.length() + 6);
+    command += key;
+    command += header;
+    command += value;
+    command += CRLF;
+
+    return send(command, deadline());
+}
+
+bool MemcachedConnection::add(const string& key, const string& value, bool* pStored)
+{
+    uint64_t until = deadline();
+
+    char header[64];
+    snprintf(header, sizeof(header), " 0 0 %lu\r\n", (unsigned long)value.length());
+
+    string command("add ");
+    command += key;
+    command += header;
+    command += value;
+    command += CRLF;
+
+    bool rv = send(command, until);
+
+    if (rv)
+    {
+        string line;
+        rv = read_line(&line, until);
+
+        if (rv)
+        {
+            if (line == "STORED")
+            {
+                *pStored = true;
+            }
+            else if (line == "NOT_STORED")
+            {
+                *pStored = false;
+            }
+            else
+            {
+                MXS_ERROR("Unexpected response from memcached: %s", line.c_str());
+                rv = false;
+            }
+        }
+    }
+
+    return rv;
+}
+
+bool MemcachedConnection::del(const string& key)
+{
+    string command("delete ");
+    command += key;
+    command += " noreply\r\n";
+
+    return send(command, deadline());
+}
+
+bool MemcachedConnection::incr(const vector<string>& keys)
+{
+    uint64_t until = deadline();
+
+    string command;
+
+    for (vector<string>::const_iterator i = keys.begin(); i != keys.end(); ++i)
+    {
+        command += "incr ";
+        command += *i;
+        command += " 1\r\n";
+    }
+
+    bool rv = send(command, until);
+
+    for (size_t i = 0; rv && (i < keys.size()); ++i)
+    {
+        string line;
+        rv = read_line(&line, until);
+
+        if (rv && (line != "NOT_FOUND") && (line.find_first_not_of("0123456789") != string::npos))
+        {
+            MXS_ERROR("Unexpected response from memcached: %s", line.c_str());
+            rv = false;
+        }
+    }
+
+    return rv;
+}
+
+uint64_t MemcachedConnection::deadline() const
+{
+    return mxs_clock_ms() + m_timeout;
+}
+
+/**
+ * Wait until the socket is ready.
+ *
+ * @param events  The events to wait for.
+ * @param until   The deadline.
+ *
+ * @return True if the socket became ready before the deadline.
+ */
+bool MemcachedConnection::wait(short events, uint64_t until)
+{
+    bool ready = false;
+    bool error = false;
+
+    while (!ready && !error)
+    {
+        uint64_t now = mxs_clock_ms();
+
+        if (now >= until)
+        {
+            error = true;
+        }
+        else
+        {
+            struct pollfd pfd;
+            pfd.fd = m_fd;
+            pfd.events = events;
+            pfd.revents = 0;
+
+            int rc = poll(&pfd, 1, until - now);
+
+            if (rc > 0)
+            {
+                ready = true;
+            }
+            else if ((rc == -1) && (errno != EINTR))
+            {
+                error = true;
+            }
+        }
+    }
+
+    return ready;
+}
+
+bool MemcachedConnection::send(const string& data, uint64_t until)
+{
+    const char* pData = data.data();
+    size_t left = data.length();
+    bool rv = true;
+
+    while (rv && (left != 0))
+    {
+        ssize_t n = ::send(m_fd, pData, left, MSG_NOSIGNAL);
+
+        if (n > 0)
+        {
+            pData += n;
+            left -= n;
+        }
+        else if ((n == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+        {
+            rv = wait(POLLOUT, until);
+        }
+        else if ((n == -1) && (errno == EINTR))
+        {
+        }
+        else
+        {
+            rv = false;
+        }
+    }
+
+    return rv;
+}
+
+/**
+ * Read more data from the server into the buffer.
+ *
+ * @param until  The deadline.
+ *
+ * @return True if some data was read.
+ */
+bool MemcachedConnection::fill(uint64_t until)
+{
+    bool rv = false;
+    bool error = false;
+
+    while (!rv && !error)
+    {
+        char buffer[16 * 1024];
+        ssize_t n = recv(m_fd, buffer, sizeof(buffer), 0);
+
+        if (n > 0)
+        {
+            m_buffer.append(buffer, n);
+            rv = true;
+        }
+        else if ((n == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+        {
+            error = !wait(POLLIN, until);
+        }
+        else if ((n == -1) && (errno == EINTR))
+        {
+        }
+        else
+        {
+            // Closed by the server, or a real error.
+            error = true;
+        }
+    }
+
+    return rv;
+}
+
+bool MemcachedConnection::read_line(string* pLine, uint64_t until)
+{
+    bool rv = true;
+    size_t end;
+
+    while (rv && ((end = m_buffer.find(CRLF)) == string::npos))
+    {
+        rv = fill(until);
+    }
+
+    if (rv)
+    {
+        pLine->assign(m_buffer, 0, end);
+        m_buffer.erase(0, end + 2);
+    }
+
+    return rv;
+}
+
+bool MemcachedConnection::read_data(size_t n, string* pData, uint64_t until)
+{
+    bool rv = true;
+
+    // The data is followed by CRLF.
+    while (rv && (m_buffer.length() < n + 2))
+    {
+        rv = fill(until);
+    }
+
+    if (rv)
+    {
+        if (m_buffer.compare(n, 2, CRLF) == 0)
+        {
+            pData->assign(m_buffer, 0, n);
+            m_buffer.erase(0, n + 2);
+        }
+        else
+        {
+            MXS_ERROR("Value from memcached not terminated as expected.");
+            rv = false;
+        }
+    }
+
+    return rv;
+}
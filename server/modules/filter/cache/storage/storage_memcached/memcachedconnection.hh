@@ -0,0 +1,114 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <maxscale/cppdefs.hh>
+#include <string>
+#include <vector>
+#include <tr1/unordered_map>
+#include <sys/socket.h>
+
+/**
+ * MemcachedConnection is a connection to a memcached server, speaking the
+ * text protocol. The socket is non-blocking and every operation is bounded
+ * by the timeout of the connection; if an operation fails or times out, the
+ * connection is in an unknown state and must be discarded.
+ */
+class MemcachedConnection
+{
+public:
+    typedef std::tr1::unordered_map<std::string, std::string> Values;
+
+    ~MemcachedConnection();
+
+    /**
+     * Connect to a memcached server.
+     *
+     * @param pAddr       The address of the server.
+     * @param addrlen     The length of the address.
+     * @param timeout_ms  The timeout of the connection attempt and of all
+     *                    subsequent operations, in milliseconds.
+     *
+     * @return A new connection, or NULL if the connection could not be made.
+     */
+    static MemcachedConnection* Create(const struct sockaddr* pAddr, socklen_t addrlen, int timeout_ms);
+
+    /**
+     * Get values. All keys are requested using a single command.
+     *
+     * @param keys     The keys.
+     * @param pValues  On successful return, the values that were found.
+     *
+     * @return True if the operation succeeded, false if it failed or timed out.
+     */
+    bool get(const std::vector<std::string>& keys, Values* pValues);
+
+    /**
+     * Set a value. The server is asked not to reply.
+     *
+     * @param key      The key.
+     * @param exptime  The expiration time, 0 for none.
+     * @param value    The value.
+     *
+     * @return True if the command could be sent.
+     */
+    bool set(const std::string& key, uint32_t exptime, const std::string& value);
+
+    /**
+     * Add a value, provided none exists.
+     *
+     * @param key      The key.
+     * @param value    The value.
+     * @param pStored  On successful return, whether the value was stored.
+     *
+     * @return True if the operation succeeded, false if it failed or timed out.
+     */
+    bool add(const std::string& key, const std::string& value, bool* pStored);
+
+    /**
+     * Delete a value. The server is asked not to reply.
+     *
+     * @param key  The key.
+     *
+     * @return True if the command could be sent.
+     */
+    bool del(const std::string& key);
+
+    /**
+     * Increment counters. All commands are sent before any reply is read.
+     *
+     * @param keys  The keys of the counters.
+     *
+     * @return True if the operation succeeded, false if it failed or timed out.
+     *         That a counter did not exist is not an error.
+     */
+    bool incr(const std::vector<std::string>& keys);
+
+private:
+    MemcachedConnection(int fd, int timeout_ms);
+
+    MemcachedConnection(const MemcachedConnection&);
+    MemcachedConnection& operator = (const MemcachedConnection&);
+
+    uint64_t deadline() const;
+    bool wait(short events, uint64_t deadline);
+    bool send(const std::string& data, uint64_t deadline);
+    bool fill(uint64_t deadline);
+    bool read_line(std::string* pLine, uint64_t deadline);
+    bool read_data(size_t n, std::string* pData, uint64_t deadline);
+
+private:
+    int         m_fd;      /*< The socket. */
+    int         m_timeout; /*< The timeout of operations, in milliseconds. */
+    std::string m_buffer;  /*< Data read from the server but not yet consumed. */
+};
@@ -0,0 +1,749 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#define MXS_MODULE_NAME "storage_memcached"
+#include "memcachedstorage.hh"
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <memory>
+#include <maxscale/atomic.h>
+#include <maxscale/spinlock.hh>
+#include <maxscale/utils.h>
+#include "memcachedconnection.hh"
+
+using maxscale::SpinLockGuard;
+using std::auto_ptr;
+using std::string;
+using std::vector;
+
+namespace
+{
+
+const char DEFAULT_SERVER[] = "127.0.0.1:11211";
+const char DEFAULT_PORT[] = "11211";
+const int DEFAULT_TIMEOUT = 100;
+const char DEFAULT_KEY_PREFIX[] = "maxscale";
+
+// The maximum length of a memcached key is 250. The longest key we create is
+// the prefix, ":w:" and 16 hex digits.
+const size_t MAX_KEY_PREFIX_LENGTH = 200;
+
+// How long to wait before trying to connect again, after a failure.
+const uint64_t RETRY_INTERVAL = 1000;
+
+// Expiration times longer than this are interpreted by memcached as absolute
+// Unix times.
+const uint32_t MAX_RELATIVE_EXPTIME = 60 * 60 * 24 * 30;
+
+const char MAGIC[4] = { 'M', 'X', 'S', '1' };
+
+/**
+ * The header of a value stored in memcached. It is followed by the
+ * generations of the words the value depends upon and then by the
+ * value itself.
+ */
+struct Header
+{
+    char     magic[4];
+    uint32_t time;    /*< When the value was stored. */
+    uint32_t n_words; /*< The number of words that follow. */
+};
+
+struct Word
+{
+    uint64_t hash;       /*< The hash of the word. */
+    uint64_t generation; /*< The generation of the word when the value was stored. */
+};
+
+uint64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * FNV-1a; the words are hashed so that the length of the memcached keys
+ * stays bounded, irrespective of the length of the table names.
+ */
+uint64_t hash_word(const string& word)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (string::const_iterator i = word.begin(); i != word.end(); ++i)
+    {
+        hash ^= (uint8_t)*i;
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+bool parse_generation(const string& s, uint64_t* pGeneration)
+{
+    char* zEnd;
+    errno = 0;
+    *pGeneration = strtoull(s.c_str(), &zEnd, 10);
+
+    return !s.empty() && (*zEnd == 0) && (errno == 0);
+}
+
+bool is_valid_key_prefix(const char* zPrefix)
+{
+    size_t len = strlen(zPrefix);
+    bool valid = (len != 0) && (len <= MAX_KEY_PREFIX_LENGTH);
+
+    for (const char* z = zPrefix; valid && *z; ++z)
+    {
+        valid = (*z > ' ') && (*z != 0x7f);
+    }
+
+    return valid;
+}
+
+bool resolve(const char* zServer, struct sockaddr_storage* pAddress, socklen_t* pAddress_len)
+{
+    bool rv = false;
+
+    string host(zServer);
+    string port(DEFAULT_PORT);
+
+    size_t colon = host.rfind(':');
+
+    if ((colon != string::npos) && (host.find(':') == colon))
+    {
+        port = host.substr(colon + 1);
+        host.erase(colon);
+    }
+
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo* pAi = NULL;
+    int rc = getaddrinfo(host.c_str(), port.c_str(), &hints, &pAi);
+
+    if (rc == 0)
+    {
+        ss_dassert(pAi->ai_addrlen <= sizeof(*pAddress));
+        memcpy(pAddress, pAi->ai_addr, pAi->ai_addrlen);
+        *pAddress_len = pAi->ai_addrlen;
+        freeaddrinfo(pAi);
+        rv = true;
+    }
+    else
+    {
+        MXS_ERROR("Could not resolve memcached server '%s': %s", zServer, gai_strerror(rc));
+    }
+
+    return rv;
+}
+
+}
+
+MemcachedStorage::MemcachedStorage(const string& name,
+                                   const CACHE_STORAGE_CONFIG& config,
+                                   const struct sockaddr_storage& address,
+                                   socklen_t address_len,
+                                   const string& server,
+                                   const string& prefix,
+                                   int timeout)
+    : m_name(name)
+    , m_config(config)
+    , m_address(address)
+    , m_address_len(address_len)
+    , m_server(server)
+    , m_prefix(prefix)
+    , m_timeout(timeout)
+    , m_retry_at(0)
+{
+    spinlock_init(&m_lock);
+}
+
+MemcachedStorage::~MemcachedStorage()
+{
+    for (Connections::iterator i = m_connections.begin(); i != m_connections.end(); ++i)
+    {
+        delete *i;
+    }
+}
+
+bool MemcachedStorage::Initialize(uint32_t* pCapabilities)
+{
+    // Memcached evicts values as it sees fit, so the storage must not be
+    // decorated with an LRU storage of our own; that would hide values
+    // stored by other MaxScale instances.
+    *pCapabilities = (CACHE_STORAGE_CAP_MT |
+                      CACHE_STORAGE_CAP_MAX_COUNT |
+                      CACHE_STORAGE_CAP_MAX_SIZE |
+                      CACHE_STORAGE_CAP_INVALIDATION);
+
+    return true;
+}
+
+MemcachedStorage* MemcachedStorage::Create_instance(const char* zName,
+                                                    const CACHE_STORAGE_CONFIG& config,
+                                                    int argc, char* argv[])
+{
+    ss_dassert(zName);
+
+    if (config.max_count != 0)
+    {
+        MXS_WARNING("A maximum item count of %u specified, although 'storage_memcached' "
+                    "does not enforce such a limit; memcached evicts values according "
+                    "to its own memory limit.", (unsigned int)config.max_count);
+    }
+
+    if (config.max_size != 0)
+    {
+        MXS_WARNING("A maximum size of %lu specified, although 'storage_memcached' "
+                    "does not enforce such a limit; memcached evicts values according "
+                    "to its own memory limit.", (unsigned long)config.max_size);
+    }
+
+    string server(DEFAULT_SERVER);
+    string prefix(DEFAULT_KEY_PREFIX);
+    int timeout = DEFAULT_TIMEOUT;
+    bool ok = true;
+
+    for (int i = 0; i < argc; ++i)
+    {
+        size_t len = strlen(argv[i]);
+        char arg[len + 1];
+        strcpy(arg, argv[i]);
+
+        const char* zValue = NULL;
+        char *zEq = strchr(arg, '=');
+
+        if (zEq)
+        {
+            *zEq = 0;
+            zValue = trim(zEq + 1);
+        }
+
+        const char* zKey = trim(arg);
+
+        if (strcmp(zKey, "server") == 0)
+        {
+            if (zValue && *zValue)
+            {
+                server = zValue;
+            }
+            else
+            {
+                MXS_WARNING("No value specified for '%s', using default '%s' instead.",
+                            zKey, DEFAULT_SERVER);
+            }
+        }
+        else if (strcmp(zKey, "timeout") == 0)
+        {
+            char* zEnd = NULL;
+            long value = zValue ? strtol(zValue, &zEnd, 10) : 0;
+
+            if (zValue && (*zEnd == 0) && (value > 0) && (value <= INT32_MAX))
+            {
+                timeout = value;
+            }
+            else
+            {
+                MXS_ERROR("The value of '%s' must be a positive number of milliseconds.", zKey);
+                ok = false;
+            }
+        }
+        else if (strcmp(zKey, "key_prefix") == 0)
+        {
+            if (zValue && is_valid_key_prefix(zValue))
+            {
+                prefix = zValue;
+            }
+            else
+            {
+                MXS_ERROR("The value of '%s' must be a non-empty string of at most %lu "
+                          "characters, without whitespace or control characters.",
+                          zKey, (unsigned long)MAX_KEY_PREFIX_LENGTH);
+                ok = false;
+            }
+        }
+        else
+        {
+            MXS_WARNING("Unknown argument '%s'.", zKey);
+        }
+    }
+
+    MemcachedStorage* pStorage = NULL;
+
+    struct sockaddr_storage address;
+    socklen_t address_len;
+
+    if (ok && resolve(server.c_str(), &address, &address_len))
+    {
+        pStorage = new (std::nothrow) MemcachedStorage(zName, config,
+                                                       address, address_len,
+                                                       server, prefix, timeout);
+
+        if (pStorage)
+        {
+            MXS_NOTICE("Storage module created, using memcached server %s.", server.c_str());
+        }
+    }
+
+    return pStorage;
+}
+
+void MemcachedStorage::get_config(CACHE_STORAGE_CONFIG* pConfig)
+{
+    *pConfig = m_config;
+}
+
+cache_result_t MemcachedStorage::get_info(uint32_t what, json_t** ppInfo) const
+{
+    *ppInfo = json_object();
+
+    if (*ppInfo)
+    {
+        json_t* pServer = json_string(m_server.c_str());
+
+        if (pServer)
+        {
+            json_object_set_new(*ppInfo, "server", pServer);
+        }
+
+        bool available;
+        {
+            SpinLockGuard guard(m_lock);
+            available = (m_retry_at == 0);
+        }
+
+        json_object_set_new(*ppInfo, "available", available ? json_true() : json_false());
+
+        m_stats.fill(*ppInfo);
+    }
+
+    return *ppInfo ? CACHE_RESULT_OK : CACHE_RESULT_OUT_OF_RESOURCES;
+}
+
+cache_result_t MemcachedStorage::get_value(const CACHE_KEY& key, uint32_t flags, GWBUF** ppResult)
+{
+    cache_result_t result = CACHE_RESULT_NOT_FOUND;
+
+    MemcachedConnection* pConnection = get_connection();
+
+    if (pConnection)
+    {
+        vector<string> keys;
+        keys.push_back(value_key(key));
+
+        MemcachedConnection::Values values;
+        bool ok = pConnection->get(keys, &values);
+
+        const string* pValue = NULL;
+        const Header* pHeader = NULL;
+        const Word* pWords = NULL;
+
+        if (ok && !values.empty())
+        {
+            pValue = &values.begin()->second;
+
+            if (pValue->length() >= sizeof(Header))
+            {
+                pHeader = reinterpret_cast<const Header*>(pValue->data());
+                pWords = reinterpret_cast<const Word*>(pValue->data() + sizeof(Header));
+
+                if ((memcmp(pHeader->magic, MAGIC, sizeof(MAGIC)) != 0) ||
+                    (pValue->length() < sizeof(Header) + pHeader->n_words * sizeof(Word)))
+                {
+                    MXS_WARNING("Value of unexpected format found in memcached, ignoring it.");
+                    pHeader = NULL;
+                }
+            }
+        }
+
+        if (pHeader && (pHeader->n_words != 0))
+        {
+            // The value is valid only if the generations of all the words
+            // it depends upon are still what they were when it was stored.
+            keys.clear();
+
+            for (uint32_t i = 0; i < pHeader->n_words; ++i)
+            {
+                keys.push_back(word_key(pWords[i].hash));
+            }
+
+            MemcachedConnection::Values generations;
+            ok = pConnection->get(keys, &generations);
+
+            for (uint32_t i = 0; ok && pHeader && (i < pHeader->n_words); ++i)
+            {
+                MemcachedConnection::Values::const_iterator j = generations.find(keys[i]);
+                uint64_t generation;
+
+                if ((j == generations.end()) ||
+                    !parse_generation(j->second, &generation) ||
+                    (generation != pWords[i].generation))
+                {
+                    pHeader = NULL;
+                }
+            }
+        }
+
+        if (ok && pHeader)
+        {
+            atomic_add_uint64(&m_stats.hits, 1);
+
+            uint32_t now = time(NULL);
+
+            bool is_hard_stale = m_config.hard_ttl == 0 ? false : (now - pHeader->time > m_config.hard_ttl);
+            bool is_soft_stale = m_config.soft_ttl == 0 ? false : (now - pHeader->time > m_config.soft_ttl);
+            bool include_stale = ((flags & CACHE_FLAGS_INCLUDE_STALE) != 0);
+
+            if (is_hard_stale)
+            {
+            }
+            else if (!is_soft_stale || include_stale)
+            {
+                size_t offset = sizeof(Header) + pHeader->n_words * sizeof(Word);
+                size_t length = pValue->length() - offset;
+
+                *ppResult = gwbuf_alloc(length);
+
+                if (*ppResult)
+                {
+                    memcpy(GWBUF_DATA(*ppResult), pValue->data() + offset, length);
+
+                    result = CACHE_RESULT_OK;
+
+                    if (is_soft_stale)
+                    {
+                        result |= CACHE_RESULT_STALE;
+                    }
+                }
+                else
+                {
+                    result = CACHE_RESULT_OUT_OF_RESOURCES;
+                }
+            }
+            else
+            {
+                ss_dassert(is_soft_stale);
+                result |= CACHE_RESULT_STALE;
+            }
+        }
+        else
+        {
+            atomic_add_uint64(&m_stats.misses, 1);
+        }
+
+        put_connection(pConnection, ok);
+    }
+    else
+    {
+        atomic_add_uint64(&m_stats.misses, 1);
+    }
+
+    return result;
+}
+
+cache_result_t MemcachedStorage::put_value(const CACHE_KEY& key,
+                                           const vector<string>& words,
+                                           const GWBUF& value)
+{
+    ss_dassert(GWBUF_IS_CONTIGUOUS(&value));
+
+    cache_result_t result = CACHE_RESULT_ERROR;
+
+    MemcachedConnection* pConnection = get_connection();
+
+    if (pConnection)
+    {
+        vector<Word> current(words.size());
+        vector<string> keys;
+
+        for (size_t i = 0; i < words.size(); ++i)
+        {
+            current[i].hash = hash_word(words[i]);
+            keys.push_back(word_key(current[i].hash));
+        }
+
+        bool ok = true;
+        bool store = true;
+
+        if (!keys.empty())
+        {
+            MemcachedConnection::Values generations;
+            ok = pConnection->get(keys, &generations);
+
+            for (size_t i = 0; ok && store && (i < keys.size()); ++i)
+            {
+                MemcachedConnection::Values::const_iterator j = generations.find(keys[i]);
+
+                if (j != generations.end())
+                {
+                    ok = parse_generation(j->second, &current[i].generation);
+                }
+                else
+                {
+                    // The initial generation is the current time so that a
+                    // generation that has been evicted and is created anew
+                    // can never match the one a stored value depends upon.
+                    char initial[32];
+                    sprintf(initial, "%llu", (unsigned long long)now_us());
+
+                    ok = pConnection->add(keys[i], initial, &store);
+                    current[i].generation = strtoull(initial, NULL, 10);
+                }
+            }
+        }
+
+        if (ok && store)
+        {
+            Header header;
+            memcpy(header.magic, MAGIC, sizeof(MAGIC));
+            header.time = time(NULL);
+            header.n_words = current.size();
+
+            size_t length = GWBUF_LENGTH(&value);
+
+            string data;
+            data.reserve(sizeof(Header) + current.size() * sizeof(Word) + length);
+            data.append(reinterpret_cast<const char*>(&header), sizeof(header));
+
+            if (!current.empty())
+            {
+                data.append(reinterpret_cast<const char*>(&current[0]), current.size() * sizeof(Word));
+            }
+
+            data.append(reinterpret_cast<const char*>(GWBUF_DATA(&value)), length);
+
+            uint32_t exptime = m_config.hard_ttl;
+
+            if (exptime > MAX_RELATIVE_EXPTIME)
+            {
+                exptime += time(NULL);
+            }
+
+            ok = pConnection->set(value_key(key), exptime, data);
+
+            if (ok)
+            {
+                atomic_add_uint64(&m_stats.puts, 1);
+            }
+        }
+
+        // If a generation was created concurrently by someone else, the value
+        // is simply not stored; it will be the next time around.
+        if (ok)
+        {
+            result = CACHE_RESULT_OK;
+        }
+
+        put_connection(pConnection, ok);
+    }
+
+    return result;
+}
+
+cache_result_t MemcachedStorage::del_value(const CACHE_KEY& key)
+{
+    cache_result_t result = CACHE_RESULT_ERROR;
+
+    MemcachedConnection* pConnection = get_connection();
+
+    if (pConnection)
+    {
+        bool ok = pConnection->del(value_key(key));
+
+        if (ok)
+        {
+            atomic_add_uint64(&m_stats.deletes, 1);
+            result = CACHE_RESULT_OK;
+        }
+
+        put_connection(pConnection, ok);
+    }
+
+    return result;
+}
+
+cache_result_t MemcachedStorage::invalidate(const vector<string>& words)
+{
+    cache_result_t result = CACHE_RESULT_ERROR;
+
+    MemcachedConnection* pConnection = get_connection();
+
+    if (pConnection)
+    {
+        vector<string> keys;
+
+        for (vector<string>::const_iterator i = words.begin(); i != words.end(); ++i)
+        {
+            keys.push_back(word_key(hash_word(*i)));
+        }
+
+        // A word whose generation does not exist has no dependent values.
+        bool ok = pConnection->incr(keys);
+
+        if (ok)
+        {
+            atomic_add_uint64(&m_stats.invalidations, 1);
+            result = CACHE_RESULT_OK;
+        }
+        else
+        {
+            MXS_ERROR("Could not invalidate cached values in memcached server %s; "
+                      "stale values may be returned until they expire.", m_server.c_str());
+        }
+
+        put_connection(pConnection, ok);
+    }
+
+    return result;
+}
+
+cache_result_t MemcachedStorage::get_head(CACHE_KEY* pKey, GWBUF** ppHead) const
+{
+    return CACHE_RESULT_OUT_OF_RESOURCES;
+}
+
+cache_result_t MemcachedStorage::get_tail(CACHE_KEY* pKey, GWBUF** ppHead) const
+{
+    return CACHE_RESULT_OUT_OF_RESOURCES;
+}
+
+cache_result_t MemcachedStorage::get_size(uint64_t* pSize) const
+{
+    return CACHE_RESULT_OUT_OF_RESOURCES;
+}
+
+cache_result_t MemcachedStorage::get_items(uint64_t* pItems) const
+{
+    return CACHE_RESULT_OUT_OF_RESOURCES;
+}
+
+/**
+ * Get a connection to the memcached server, either an idle one or a new one.
+ * If connecting has recently failed, no attempt is made until a while has
+ * passed, so that an unavailable server does not slow down every request.
+ *
+ * @return A connection, or NULL if none is available.
+ */
+MemcachedConnection* MemcachedStorage::get_connection()
+{
+    MemcachedConnection* pConnection = NULL;
+    bool connect = true;
+
+    {
+        SpinLockGuard guard(m_lock);
+
+        if (!m_connections.empty())
+        {
+            pConnection = m_connections.back();
+            m_connections.pop_back();
+        }
+        else if ((m_retry_at != 0) && (mxs_clock_ms() < m_retry_at))
+        {
+            connect = false;
+        }
+    }
+
+    if (!pConnection && connect)
+    {
+        pConnection = MemcachedConnection::Create(reinterpret_cast<const struct sockaddr*>(&m_address),
+                                                  m_address_len, m_timeout);
+
+        SpinLockGuard guard(m_lock);
+
+        if (pConnection)
+        {
+            if (m_retry_at != 0)
+            {
+                MXS_NOTICE("Connected to memcached server %s.", m_server.c_str());
+                m_retry_at = 0;
+            }
+        }
+        else
+        {
+            if (m_retry_at == 0)
+            {
+                MXS_ERROR("Could not connect to memcached server %s, the cache will be "
+                          "bypassed until it becomes available.", m_server.c_str());
+            }
+
+            m_retry_at = mxs_clock_ms() + RETRY_INTERVAL;
+        }
+    }
+
+    return pConnection;
+}
+
+/**
+ * Return a connection obtained with @c get_connection.
+ *
+ * @param pConnection  The connection.
+ * @param ok           Whether the last operation succeeded. If not, the
+ *                     state of the connection is unknown and it is closed.
+ */
+void MemcachedStorage::put_connection(MemcachedConnection* pConnection, bool ok)
+{
+    if (ok)
+    {
+        SpinLockGuard guard(m_lock);
+        m_connections.push_back(pConnection);
+    }
+    else
+    {
+        atomic_add_uint64(&m_stats.failures, 1);
+        delete pConnection;
+    }
+}
+
+string MemcachedStorage::value_key(const CACHE_KEY& key) const
+{
+    char buffer[32];
+    sprintf(buffer, ":%016llx", (unsigned long long)key.data);
+
+    return m_prefix + buffer;
+}
+
+string MemcachedStorage::word_key(uint64_t hash) const
+{
+    char buffer[32];
+    sprintf(buffer, ":w:%016llx", (unsigned long long)hash);
+
+    return m_prefix + buffer;
+}
+
+static void set_integer(json_t* pObject, const char* zName, size_t value)
+{
+    json_t* pValue = json_integer(value);
+
+    if (pValue)
+    {
+        json_object_set(pObject, zName, pValue);
+        json_decref(pValue);
+    }
+}
+
+void MemcachedStorage::Stats::fill(json_t* pObject) const
+{
+    set_integer(pObject, "hits", hits);
+    set_integer(pObject, "misses", misses);
+    set_integer(pObject, "puts", puts);
+    set_integer(pObject, "deletes", deletes);
+    set_integer(pObject, "invalidations", invalidations);
+    set_integer(pObject, "failures", failures);
+}
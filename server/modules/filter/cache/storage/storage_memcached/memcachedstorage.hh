@@ -0,0 +1,108 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <maxscale/cppdefs.hh>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <maxscale/spinlock.h>
+#include "../../cache_storage_api.hh"
+
+class MemcachedConnection;
+
+/**
+ * MemcachedStorage stores the cached results in a memcached server that can
+ * be shared by several MaxScale instances. Invalidation is implemented using
+ * generation counters stored in memcached, so an invalidation performed by
+ * one instance is seen by all.
+ */
+class MemcachedStorage
+{
+public:
+    ~MemcachedStorage();
+
+    static bool Initialize(uint32_t* pCapabilities);
+
+    static MemcachedStorage* Create_instance(const char* zName,
+                                             const CACHE_STORAGE_CONFIG& config,
+                                             int argc, char* argv[]);
+
+    void get_config(CACHE_STORAGE_CONFIG* pConfig);
+    cache_result_t get_info(uint32_t what, json_t** ppInfo) const;
+    cache_result_t get_value(const CACHE_KEY& key, uint32_t flags, GWBUF** ppResult);
+    cache_result_t put_value(const CACHE_KEY& key,
+                             const std::vector<std::string>& words,
+                             const GWBUF& value);
+    cache_result_t del_value(const CACHE_KEY& key);
+    cache_result_t invalidate(const std::vector<std::string>& words);
+
+    cache_result_t get_head(CACHE_KEY* pKey, GWBUF** ppHead) const;
+    cache_result_t get_tail(CACHE_KEY* pKey, GWBUF** ppHead) const;
+    cache_result_t get_size(uint64_t* pSize) const;
+    cache_result_t get_items(uint64_t* pItems) const;
+
+private:
+    MemcachedStorage(const std::string& name,
+                     const CACHE_STORAGE_CONFIG& config,
+                     const struct sockaddr_storage& address,
+                     socklen_t address_len,
+                     const std::string& server,
+                     const std::string& prefix,
+                     int timeout);
+
+    MemcachedStorage(const MemcachedStorage&);
+    MemcachedStorage& operator = (const MemcachedStorage&);
+
+    MemcachedConnection* get_connection();
+    void put_connection(MemcachedConnection* pConnection, bool ok);
+
+    std::string value_key(const CACHE_KEY& key) const;
+    std::string word_key(uint64_t hash) const;
+
+private:
+    struct Stats
+    {
+        Stats()
+            : hits(0)
+            , misses(0)
+            , puts(0)
+            , deletes(0)
+            , invalidations(0)
+            , failures(0)
+        {}
+
+        void fill(json_t* pObject) const;
+
+        uint64_t hits;          /*< How many times a key was found in the cache. */
+        uint64_t misses;        /*< How many times a key was not found in the cache. */
+        uint64_t puts;          /*< How many times a value was stored. */
+        uint64_t deletes;       /*< How many times a value was deleted. */
+        uint64_t invalidations; /*< How many times words were invalidated. */
+        uint64_t failures;      /*< How many times an operation failed or timed out. */
+    };
+
+    typedef std::vector<MemcachedConnection*> Connections;
+
+    std::string                m_name;
+    const CACHE_STORAGE_CONFIG m_config;
+    struct sockaddr_storage    m_address;      /*< The address of the memcached server. */
+    socklen_t                  m_address_len;
+    std::string                m_server;       /*< The server as specified by the user. */
+    std::string                m_prefix;       /*< The prefix of all keys. */
+    int                        m_timeout;      /*< The timeout of operations, in milliseconds. */
+    mutable SPINLOCK           m_lock;         /*< Protects the fields below. */
+    Connections                m_connections;  /*< Idle connections. */
+    uint64_t                   m_retry_at;     /*< When to retry after a failure; 0 if available. */
+    mutable Stats              m_stats;
+};
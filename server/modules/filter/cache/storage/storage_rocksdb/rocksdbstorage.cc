@@ -13,12 +13,18 @@
 
 #define MXS_MODULE_NAME "storage_rocksdb"
 #include "rocksdbstorage.hh"
+#include <limits.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <fts.h>
 #include <algorithm>
+#include <chrono>
+#include <rocksdb/cache.h>
 #include <rocksdb/env.h>
+#include <rocksdb/filter_policy.h>
 #include <rocksdb/statistics.h>
+#include <rocksdb/table.h>
+#include <rocksdb/write_batch.h>
 #include <maxscale/alloc.h>
 #include <maxscale/paths.h>
 #include <maxscale/modutil.h>
@@ -38,6 +44,28 @@ namespace
 const size_t ROCKSDB_N_LOW_THREADS = 2;
 const size_t ROCKSDB_N_HIGH_THREADS = 1;
 
+// When this many writes are pending, the writer is woken up right away.
+const size_t ROCKSDB_MAX_PENDING_WRITES = 1024;
+
+bool get_unsigned_integer(const char* zKey, const char* zValue, unsigned long max, unsigned long* pValue)
+{
+    char* zEnd = NULL;
+    unsigned long value = zValue ? strtoul(zValue, &zEnd, 10) : 0;
+
+    bool rv = zValue && (*zValue != 0) && (*zEnd == 0) && (value <= max);
+
+    if (rv)
+    {
+        *pValue = value;
+    }
+    else
+    {
+        MXS_ERROR("The value of '%s' must be an integer between 0 and %lu.", zKey, max);
+    }
+
+    return rv;
+}
+
 /**
  * Deletes a path, irrespective of whether it represents a file, a directory
  * or a directory hierarchy. If the path does not exist, then the path is
@@ -153,17 +181,34 @@ rocksdb::WriteOptions RocksDBStorage::s_write_options;
 //private
 RocksDBStorage::RocksDBStorage(const string& name,
                                const CACHE_STORAGE_CONFIG& config,
+                               const Settings& settings,
                                const string& path,
                                unique_ptr<rocksdb::DBWithTTL>& sDb)
     : m_name(name)
     , m_config(config)
     , m_path(path)
     , m_sDb(std::move(sDb))
+    , m_settings(settings)
+    , m_stop(false)
 {
+    if (m_settings.write_delay != 0)
+    {
+        m_writer = std::thread(&RocksDBStorage::run_writer, this);
+    }
 }
 
 RocksDBStorage::~RocksDBStorage()
 {
+    if (m_writer.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> guard(m_lock_writes);
+            m_stop = true;
+        }
+
+        m_writes_added.notify_one();
+        m_writer.join();
+    }
 }
 
 bool RocksDBStorage::Initialize(uint32_t* pCapabilities)
@@ -187,8 +232,9 @@ RocksDBStorage* RocksDBStorage::Create_instance(const char* zName,
 {
     ss_dassert(zName);
 
-    string storageDirectory = get_cachedir();
-    bool collectStatistics = false;
+    Settings settings;
+    settings.storage_directory = get_cachedir();
+    bool ok = true;
 
     for (int i = 0; i < argc; ++i)
     {
@@ -206,12 +252,13 @@ RocksDBStorage* RocksDBStorage::Create_instance(const char* zName,
         }
 
         const char* zKey = trim(arg);
+        unsigned long value;
 
         if (strcmp(zKey, "cache_directory") == 0)
         {
             if (zValue)
             {
-                storageDirectory = zValue;
+                settings.storage_directory = zValue;
             }
             else
             {
@@ -223,7 +270,40 @@ RocksDBStorage* RocksDBStorage::Create_instance(const char* zName,
         {
             if (zValue)
             {
-                collectStatistics = config_truth_value(zValue);
+                settings.collect_statistics = config_truth_value(zValue);
+            }
+        }
+        else if (strcmp(zKey, "block_cache_size") == 0)
+        {
+            if (get_unsigned_integer(zKey, zValue, ULONG_MAX, &value))
+            {
+                settings.block_cache_size = value;
+            }
+            else
+            {
+                ok = false;
+            }
+        }
+        else if (strcmp(zKey, "bloom_bits_per_key") == 0)
+        {
+            if (get_unsigned_integer(zKey, zValue, 64, &value))
+            {
+                settings.bloom_bits_per_key = value;
+            }
+            else
+            {
+                ok = false;
+            }
+        }
+        else if (strcmp(zKey, "write_delay") == 0)
+        {
+            if (get_unsigned_integer(zKey, zValue, 1000, &value))
+            {
+                settings.write_delay = value;
+            }
+            else
+            {
+                ok = false;
             }
         }
         else
@@ -232,18 +312,24 @@ RocksDBStorage* RocksDBStorage::Create_instance(const char* zName,
         }
     }
 
-    storageDirectory += "/storage_rocksdb";
+    if (!ok)
+    {
+        return NULL;
+    }
+
+    settings.storage_directory += "/storage_rocksdb";
 
-    return Create(zName, config, storageDirectory, collectStatistics);
+    return Create(zName, config, settings);
 }
 
 RocksDBStorage* RocksDBStorage::Create(const char* zName,
                                        const CACHE_STORAGE_CONFIG& config,
-                                       const string& storageDirectory,
-                                       bool collectStatistics)
+                                       const Settings& settings)
 {
     unique_ptr<RocksDBStorage> sStorage;
 
+    const string& storageDirectory = settings.storage_directory;
+
     bool ok = true;
 
     if (mkdir(storageDirectory.c_str(), S_IRWXU) == 0)
@@ -273,11 +359,32 @@ RocksDBStorage* RocksDBStorage::Create(const char* zName,
             options.create_if_missing = true;
             options.error_if_exists = true;
 
-            if (collectStatistics)
+            if (settings.collect_statistics)
             {
                 options.statistics = rocksdb::CreateDBStatistics();
             }
 
+            // The values are only looked up by their keys, so the bloom filter
+            // lets most lookups of absent keys be answered without reading any
+            // data blocks, and the block cache keeps the hot blocks in memory.
+            rocksdb::BlockBasedTableOptions table_options;
+
+            if (settings.bloom_bits_per_key != 0)
+            {
+                table_options.filter_policy.reset(rocksdb::NewBloomFilterPolicy(settings.bloom_bits_per_key));
+            }
+
+            if (settings.block_cache_size != 0)
+            {
+                table_options.block_cache = rocksdb::NewLRUCache(settings.block_cache_size);
+            }
+            else
+            {
+                table_options.no_block_cache = true;
+            }
+
+            options.table_factory.reset(rocksdb::NewBlockBasedTableFactory(table_options));
+
             rocksdb::DBWithTTL* pDb;
             rocksdb::Status status;
 
@@ -287,7 +394,8 @@ RocksDBStorage* RocksDBStorage::Create(const char* zName,
             {
                 unique_ptr<rocksdb::DBWithTTL> sDb(pDb);
 
-                sStorage = unique_ptr<RocksDBStorage>(new RocksDBStorage(zName, config, path, sDb));
+                sStorage = unique_ptr<RocksDBStorage>(new RocksDBStorage(zName, config, settings,
+                                                                         path, sDb));
             }
             else
             {
@@ -342,6 +450,13 @@ cache_result_t RocksDBStorage::get_info(uint32_t what, json_t** ppInfo) const
 
 cache_result_t RocksDBStorage::get_value(const CACHE_KEY& key, uint32_t flags, GWBUF** ppResult)
 {
+    cache_result_t result;
+
+    if (find_write(key, flags, ppResult, &result))
+    {
+        return result;
+    }
+
     // Use the root DB so that we get the value *with* the timestamp at the end.
     rocksdb::DB* pDb = m_sDb->GetRootDB();
     rocksdb::Slice rocksdb_key(reinterpret_cast<const char*>(&key.data), sizeof(key.data));
@@ -349,36 +464,41 @@ cache_result_t RocksDBStorage::get_value(const CACHE_KEY& key, uint32_t flags, G
 
     rocksdb::Status status = pDb->Get(rocksdb::ReadOptions(), rocksdb_key, &value);
 
-    cache_result_t result = CACHE_RESULT_ERROR;
+    result = CACHE_RESULT_ERROR;
 
     switch (status.code())
     {
     case rocksdb::Status::kOk:
         if (value.length() >= RocksDBInternals::TS_LENGTH)
         {
-            rocksdb::Env* pEnv = rocksdb::Env::Default();
-            int64_t now;
+            bool is_hard_stale = false;
+            bool is_soft_stale = false;
 
-            if (!pEnv->GetCurrentTime(&now).ok())
+            // Without a TTL, the timestamp need not be looked at.
+            if ((m_config.hard_ttl != 0) || (m_config.soft_ttl != 0))
             {
-                ss_dassert(!true);
-                now = INT64_MAX;
-            }
+                rocksdb::Env* pEnv = rocksdb::Env::Default();
+                int64_t now;
+
+                if (!pEnv->GetCurrentTime(&now).ok())
+                {
+                    ss_dassert(!true);
+                    now = INT64_MAX;
+                }
+
+                int32_t timestamp = RocksDBInternals::extract_timestamp(value);
 
-            int32_t timestamp = RocksDBInternals::extract_timestamp(value);
+                is_hard_stale = m_config.hard_ttl == 0 ? false : (now - timestamp > m_config.hard_ttl);
+                is_soft_stale = m_config.soft_ttl == 0 ? false : (now - timestamp > m_config.soft_ttl);
+            }
 
-            bool is_hard_stale = m_config.hard_ttl == 0 ? false : (now - timestamp > m_config.hard_ttl);
-            bool is_soft_stale = m_config.soft_ttl == 0 ? false : (now - timestamp > m_config.soft_ttl);
             bool include_stale = ((flags & CACHE_FLAGS_INCLUDE_STALE) != 0);
 
             if (is_hard_stale)
             {
-                status = m_sDb->Delete(Write_options(), rocksdb_key);
-
-                if (!status.ok())
-                {
-                    MXS_WARNING("Failed when deleting stale item from RocksDB.");
-                }
+                // The database was opened with the hard TTL, so the item will be
+                // removed at the next compaction, or replaced when refetched. No
+                // need to block the calling thread by deleting it here.
                 result = CACHE_RESULT_NOT_FOUND;
             }
             else if (!is_soft_stale || include_stale)
@@ -427,10 +547,19 @@ cache_result_t RocksDBStorage::get_value(const CACHE_KEY& key, uint32_t flags, G
     return result;
 }
 
-cache_result_t RocksDBStorage::put_value(const CACHE_KEY& key, const GWBUF& value)
+cache_result_t RocksDBStorage::put_value(const CACHE_KEY& key,
+                                         const std::vector<std::string>& words,
+                                         const GWBUF& value)
 {
     ss_dassert(GWBUF_IS_CONTIGUOUS(&value));
 
+    if (m_writer.joinable())
+    {
+        add_write(key, reinterpret_cast<const char*>(GWBUF_DATA(&value)), GWBUF_LENGTH(&value));
+
+        return CACHE_RESULT_OK;
+    }
+
     rocksdb::Slice rocksdb_key(reinterpret_cast<const char*>(&key.data), sizeof(key.data));
     rocksdb::Slice rocksdb_value((char*)GWBUF_DATA(&value), GWBUF_LENGTH(&value));
 
@@ -441,6 +570,13 @@ cache_result_t RocksDBStorage::put_value(const CACHE_KEY& key, const GWBUF& valu
 
 cache_result_t RocksDBStorage::del_value(const CACHE_KEY& key)
 {
+    if (m_writer.joinable())
+    {
+        add_write(key, NULL, 0);
+
+        return CACHE_RESULT_OK;
+    }
+
     rocksdb::Slice rocksdb_key(reinterpret_cast<const char*>(&key.data), sizeof(key.data));
 
     rocksdb::Status status = m_sDb->Delete(Write_options(), rocksdb_key);
@@ -448,6 +584,11 @@ cache_result_t RocksDBStorage::del_value(const CACHE_KEY& key)
     return status.ok() ? CACHE_RESULT_OK : CACHE_RESULT_ERROR;
 }
 
+cache_result_t RocksDBStorage::invalidate(const std::vector<std::string>& words)
+{
+    return CACHE_RESULT_OUT_OF_RESOURCES;
+}
+
 cache_result_t RocksDBStorage::get_head(CACHE_KEY* pKey, GWBUF** ppHead) const
 {
     return CACHE_RESULT_OUT_OF_RESOURCES;
@@ -467,3 +608,163 @@ cache_result_t RocksDBStorage::get_items(uint64_t* pItems) const
 {
     return CACHE_RESULT_OUT_OF_RESOURCES;
 }
+
+/**
+ * Look up a value among the writes not yet made to the database.
+ *
+ * @param key       The key of the value.
+ * @param flags     The flags of the lookup.
+ * @param ppResult  On return, if the value was found, the value.
+ * @param pResult   On return, if the key was found, the result of the lookup.
+ *
+ * @return True, if there is a pending write of the key.
+ */
+bool RocksDBStorage::find_write(const CACHE_KEY& key, uint32_t flags, GWBUF** ppResult,
+                                cache_result_t* pResult)
+{
+    if (!m_writer.joinable())
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(m_lock_writes);
+
+    auto i = m_writes.find(key.data);
+
+    if (i == m_writes.end())
+    {
+        i = m_writing.find(key.data);
+
+        if (i == m_writing.end())
+        {
+            return false;
+        }
+    }
+
+    const string& value = i->second;
+
+    if (value.empty())
+    {
+        *pResult = CACHE_RESULT_NOT_FOUND;
+    }
+    else
+    {
+        // A pending value is at most write_delay milliseconds old, so it is fresh.
+        *ppResult = gwbuf_alloc_and_load(value.length(), value.data());
+
+        *pResult = *ppResult ? CACHE_RESULT_OK : CACHE_RESULT_OUT_OF_RESOURCES;
+    }
+
+    return true;
+}
+
+/**
+ * Add a write to be made by the writer.
+ *
+ * @param key      The key of the value.
+ * @param pData    The value, or NULL if the value should be deleted.
+ * @param length   The length of the value.
+ */
+void RocksDBStorage::add_write(const CACHE_KEY& key, const char* pData, size_t length)
+{
+    size_t n_writes;
+
+    {
+        std::lock_guard<std::mutex> guard(m_lock_writes);
+
+        string& value = m_writes[key.data];
+
+        if (pData)
+        {
+            value.assign(pData, length);
+        }
+        else
+        {
+            value.clear();
+        }
+
+        n_writes = m_writes.size();
+    }
+
+    // Wake up the writer when it has something to wait for, and when the
+    // writes should be made without waiting any longer.
+    if ((n_writes == 1) || (n_writes == ROCKSDB_MAX_PENDING_WRITES))
+    {
+        m_writes_added.notify_one();
+    }
+}
+
+/**
+ * Make writes to the database as one batch.
+ *
+ * @param writes  The writes to make.
+ */
+void RocksDBStorage::write_batch(const Writes& writes)
+{
+    rocksdb::WriteBatch batch;
+
+    for (auto i = writes.begin(); i != writes.end(); ++i)
+    {
+        rocksdb::Slice rocksdb_key(reinterpret_cast<const char*>(&i->first), sizeof(i->first));
+
+        if (i->second.empty())
+        {
+            batch.Delete(rocksdb_key);
+        }
+        else
+        {
+            batch.Put(rocksdb_key, i->second);
+        }
+    }
+
+    // DBWithTTL adds the timestamps to the values of the batch.
+    rocksdb::Status status = m_sDb->Write(Write_options(), &batch);
+
+    if (!status.ok())
+    {
+        MXS_ERROR("Could not write %lu items to RocksDB database %s: %s",
+                  writes.size(), m_path.c_str(), status.ToString().c_str());
+    }
+}
+
+/**
+ * The main function of the writer thread. Collects writes for at most
+ * write_delay milliseconds and then makes them in one batch, so that the
+ * threads storing values are never blocked by flushes or compactions.
+ */
+void RocksDBStorage::run_writer()
+{
+    std::unique_lock<std::mutex> guard(m_lock_writes);
+
+    while (true)
+    {
+        m_writes_added.wait(guard, [this]()
+        {
+            return m_stop || !m_writes.empty();
+        });
+
+        if (m_writes.empty())
+        {
+            // Stopping, and everything has been written.
+            break;
+        }
+
+        if (!m_stop)
+        {
+            m_writes_added.wait_for(guard, std::chrono::milliseconds(m_settings.write_delay), [this]()
+            {
+                return m_stop || (m_writes.size() >= ROCKSDB_MAX_PENDING_WRITES);
+            });
+        }
+
+        m_writing.swap(m_writes);
+
+        // m_writing is only modified by this thread, so it can be read without
+        // the lock, while the other threads look up values from it.
+        guard.unlock();
+        write_batch(m_writing);
+        guard.lock();
+
+        m_writing.clear();
+    }
+}
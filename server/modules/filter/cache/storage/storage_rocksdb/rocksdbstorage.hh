@@ -13,8 +13,13 @@
  */
 
 #include <maxscale/cppdefs.hh>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 #include <rocksdb/utilities/db_ttl.h>
 #include "../../cache_storage_api.h"
 
@@ -23,6 +28,29 @@ class RocksDBStorage
 public:
     typedef std::unique_ptr<RocksDBStorage> SRocksDBStorage;
 
+    struct Settings
+    {
+        enum
+        {
+            DEFAULT_BLOCK_CACHE_SIZE = 8 * 1024 * 1024,
+            DEFAULT_BLOOM_BITS_PER_KEY = 10,
+            DEFAULT_WRITE_DELAY = 10,
+        };
+
+        Settings()
+            : collect_statistics(false)
+            , block_cache_size(DEFAULT_BLOCK_CACHE_SIZE)
+            , bloom_bits_per_key(DEFAULT_BLOOM_BITS_PER_KEY)
+            , write_delay(DEFAULT_WRITE_DELAY)
+        {}
+
+        std::string storage_directory;  /*< Where the databases are created. */
+        bool        collect_statistics; /*< Whether RocksDB should collect statistics. */
+        size_t      block_cache_size;   /*< The size of the block cache, 0 for none. */
+        uint32_t    bloom_bits_per_key; /*< The bits per key of the bloom filter, 0 for none. */
+        uint32_t    write_delay;        /*< How long writes may be delayed, in milliseconds. */
+    };
+
     static bool Initialize(uint32_t* pCapabilities);
 
     static RocksDBStorage* Create_instance(const char* zName,
@@ -33,8 +61,11 @@ public:
     void get_config(CACHE_STORAGE_CONFIG* pConfig);
     cache_result_t get_info(uint32_t flags, json_t** ppInfo) const;
     cache_result_t get_value(const CACHE_KEY& key, uint32_t flags, GWBUF** ppResult);
-    cache_result_t put_value(const CACHE_KEY& key, const GWBUF& value);
+    cache_result_t put_value(const CACHE_KEY& key,
+                             const std::vector<std::string>& words,
+                             const GWBUF& value);
     cache_result_t del_value(const CACHE_KEY& key);
+    cache_result_t invalidate(const std::vector<std::string>& words);
 
     cache_result_t get_head(CACHE_KEY* pKey, GWBUF** ppHead) const;
     cache_result_t get_tail(CACHE_KEY* pKey, GWBUF** ppHead) const;
@@ -44,6 +75,7 @@ public:
 private:
     RocksDBStorage(const std::string& name,
                    const CACHE_STORAGE_CONFIG& config,
+                   const Settings& settings,
                    const std::string& path,
                    std::unique_ptr<rocksdb::DBWithTTL>& sDb);
 
@@ -52,8 +84,18 @@ private:
 
     static RocksDBStorage* Create(const char* zName,
                                   const CACHE_STORAGE_CONFIG& config,
-                                  const std::string& storage_directory,
-                                  bool collect_statistics);
+                                  const Settings& settings);
+
+    /**
+     * Writes not yet made to the database, by key. An empty value denotes
+     * a deletion, as a stored value, a MySQL response, is never empty.
+     */
+    typedef std::unordered_map<uint64_t, std::string> Writes;
+
+    bool find_write(const CACHE_KEY& key, uint32_t flags, GWBUF** ppResult, cache_result_t* pResult);
+    void add_write(const CACHE_KEY& key, const char* pData, size_t length);
+    void write_batch(const Writes& writes);
+    void run_writer();
 
     static const rocksdb::WriteOptions& Write_options()
     {
@@ -65,6 +107,13 @@ private:
     const CACHE_STORAGE_CONFIG          m_config;
     std::string                         m_path;
     std::unique_ptr<rocksdb::DBWithTTL> m_sDb;
+    const Settings                      m_settings;
+    std::mutex                          m_lock_writes;  // Protects the members below.
+    std::condition_variable             m_writes_added;
+    Writes                              m_writes;       // Writes not yet given to the writer.
+    Writes                              m_writing;      // Writes being made by the writer.
+    bool                                m_stop;         // Whether the writer should stop.
+    std::thread                         m_writer;       // Makes the writes in batches.
 
     static rocksdb::WriteOptions        s_write_options;
 };
@@ -13,6 +13,8 @@
  */
 
 #include <maxscale/cppdefs.hh>
+#include <string>
+#include <vector>
 
 template<class StorageType>
 class StorageModule
@@ -88,6 +90,8 @@ public:
 
     static cache_result_t putValue(CACHE_STORAGE* pCache_storage,
                                    const CACHE_KEY* pKey,
+                                   const char* const* pzWords,
+                                   size_t nWords,
                                    const GWBUF* pValue)
     {
         ss_dassert(pCache_storage);
@@ -98,7 +102,9 @@ public:
 
         StorageType* pStorage = reinterpret_cast<StorageType*>(pCache_storage);
 
-        MXS_EXCEPTION_GUARD(result = pStorage->put_value(*pKey, *pValue));
+        MXS_EXCEPTION_GUARD(result = pStorage->put_value(*pKey,
+                                                         std::vector<std::string>(pzWords, pzWords + nWords),
+                                                         *pValue));
 
         return result;
     }
@@ -117,6 +123,22 @@ public:
         return result;
     }
 
+    static cache_result_t invalidate(CACHE_STORAGE* pCache_storage,
+                                     const char* const* pzWords,
+                                     size_t nWords)
+    {
+        ss_dassert(pCache_storage);
+
+        cache_result_t result = CACHE_RESULT_ERROR;
+
+        StorageType* pStorage = reinterpret_cast<StorageType*>(pCache_storage);
+
+        MXS_EXCEPTION_GUARD(result = pStorage->invalidate(std::vector<std::string>(pzWords,
+                                                                                   pzWords + nWords)));
+
+        return result;
+    }
+
     static cache_result_t getHead(CACHE_STORAGE* pCache_storage,
                                   CACHE_KEY* pKey,
                                   GWBUF** ppHead)
@@ -187,6 +209,7 @@ CACHE_STORAGE_API StorageModule<StorageType>::s_api =
     &StorageModule<StorageType>::getValue,
     &StorageModule<StorageType>::putValue,
     &StorageModule<StorageType>::delValue,
+    &StorageModule<StorageType>::invalidate,
     &StorageModule<StorageType>::getHead,
     &StorageModule<StorageType>::getTail,
     &StorageModule<StorageType>::getSize,
@@ -19,6 +19,7 @@
 #include <maxscale/alloc.h>
 #include <maxscale/paths.h>
 #include <maxscale/log_manager.h>
+#include <maxscale/config.h>
 #include "cachefilter.h"
 #include "lrustoragest.hh"
 #include "lrustoragemt.hh"
@@ -148,7 +149,8 @@ StorageFactory* StorageFactory::Open(const char* zName)
 
 Storage* StorageFactory::createStorage(const char* zName,
                                        const CACHE_STORAGE_CONFIG& config,
-                                       int argc, char* argv[])
+                                       int argc, char* argv[],
+                                       size_t n_shards)
 {
     ss_dassert(m_handle);
     ss_dassert(m_pApi);
@@ -157,14 +159,21 @@ Storage* StorageFactory::createStorage(const char* zName,
 
     uint32_t mask = CACHE_STORAGE_CAP_MAX_COUNT | CACHE_STORAGE_CAP_MAX_SIZE;
 
+    if (config.invalidate != CACHE_INVALIDATE_NEVER)
+    {
+        mask |= CACHE_STORAGE_CAP_INVALIDATION;
+    }
+
     if (!cache_storage_has_cap(m_storage_caps, mask))
     {
         // Since we will wrap the native storage with a LRUStorage, according
         // to the used threading model, the storage itself may be single
-        // threaded. No point in locking twice.
+        // threaded. No point in locking twice. The LRUStorage also takes
+        // care of the invalidation.
         used_config.thread_model = CACHE_THREAD_MODEL_ST;
         used_config.max_count = 0;
         used_config.max_size = 0;
+        used_config.invalidate = CACHE_INVALIDATE_NEVER;
     }
 
     Storage* pStorage = createRawStorage(zName, used_config, argc, argv);
@@ -173,10 +182,10 @@ Storage* StorageFactory::createStorage(const char* zName,
     {
         if (!cache_storage_has_cap(m_storage_caps, mask))
         {
-            // Ok, so the cache cannot handle eviction. Let's decorate the
-            // real storage with a storage than can.
+            // Ok, so the cache cannot handle eviction or invalidation. Let's
+            // decorate the real storage with a storage than can.
 
-            LRUStorage *pLruStorage = NULL;
+            Storage *pLruStorage = NULL;
 
             if (config.thread_model == CACHE_THREAD_MODEL_ST)
             {
@@ -186,7 +195,16 @@ Storage* StorageFactory::createStorage(const char* zName,
             {
                 ss_dassert(config.thread_model == CACHE_THREAD_MODEL_MT);
 
-                pLruStorage = LRUStorageMT::create(config, pStorage);
+                std::vector<Storage*> storages;
+
+                // The real storages are owned by LRUStorageMT, also if its creation fails.
+                if (create_shard_storages(zName, config, used_config, argc, argv, n_shards,
+                                          pStorage, &storages))
+                {
+                    pLruStorage = LRUStorageMT::create(config, storages);
+                }
+
+                pStorage = NULL;
             }
 
             if (pLruStorage)
@@ -205,6 +223,91 @@ Storage* StorageFactory::createStorage(const char* zName,
 }
 
 
+/**
+ * Create the real storages of the shards of a multi-threaded LRU storage.
+ *
+ * A separate single-threaded real storage is created for each shard, provided
+ * the storage can be used in single-threaded mode. Otherwise there is a single
+ * shard.
+ *
+ * @param zName      The name of the storage.
+ * @param config     The configuration of the LRU storage.
+ * @param raw_config The configuration of the real storages.
+ * @param argc       The number of storage arguments.
+ * @param argv       The storage arguments.
+ * @param n_shards   The number of shards, 0 for one per routing thread.
+ * @param pStorage   An already created real storage.
+ * @param pStorages  On successful return, the real storages, including @c pStorage.
+ *
+ * @return True if the storages could be created. If false is returned, all
+ *         storages, including @c pStorage, have been deleted.
+ */
+bool StorageFactory::create_shard_storages(const char* zName,
+                                           const CACHE_STORAGE_CONFIG& config,
+                                           const CACHE_STORAGE_CONFIG& raw_config,
+                                           int argc, char* argv[],
+                                           size_t n_shards,
+                                           Storage* pStorage,
+                                           std::vector<Storage*>* pStorages)
+{
+    if (!cache_storage_has_cap(m_storage_caps, CACHE_STORAGE_CAP_ST))
+    {
+        n_shards = 1;
+    }
+    else if (n_shards == 0)
+    {
+        n_shards = config_threadcount();
+    }
+
+    if ((config.max_count != 0) && (n_shards > config.max_count))
+    {
+        // Each shard must be able to hold at least one item.
+        n_shards = config.max_count;
+    }
+
+    if (n_shards == 0)
+    {
+        n_shards = 1;
+    }
+
+    bool rv = true;
+
+    try
+    {
+        pStorages->reserve(n_shards);
+        pStorages->push_back(pStorage);
+    }
+    catch (const std::exception& x)
+    {
+        MXS_OOM();
+        delete pStorage;
+        rv = false;
+    }
+
+    while (rv && (pStorages->size() < n_shards))
+    {
+        Storage* pShard_storage = createRawStorage(zName, raw_config, argc, argv);
+
+        if (pShard_storage)
+        {
+            // Space was reserved above, so this does not throw.
+            pStorages->push_back(pShard_storage);
+        }
+        else
+        {
+            for (std::vector<Storage*>::iterator i = pStorages->begin(); i != pStorages->end(); ++i)
+            {
+                delete *i;
+            }
+
+            pStorages->clear();
+            rv = false;
+        }
+    }
+
+    return rv;
+}
+
 Storage* StorageFactory::createRawStorage(const char* zName,
                                           const CACHE_STORAGE_CONFIG& config,
                                           int argc, char* argv[])
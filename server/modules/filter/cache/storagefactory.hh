@@ -13,6 +13,7 @@
  */
 
 #include <maxscale/cppdefs.hh>
+#include <vector>
 #include "cache_storage_api.h"
 
 class Storage;
@@ -59,12 +60,15 @@ public:
      * @param config     The storagfe configuration.
      * @argc             Number of items in argv.
      * @argv             Storage specific arguments.
+     * @param n_shards   The number of independently locked parts of a multi
+     *                   threaded LRU storage, 0 for one per routing thread.
      *
      * @return A storage instance or NULL in case of errors.
      */
     Storage* createStorage(const char* zName,
                            const CACHE_STORAGE_CONFIG& config,
-                           int argc = 0, char* argv[] = NULL);
+                           int argc = 0, char* argv[] = NULL,
+                           size_t n_shards = 0);
 
     /**
      * Create raw storage instance.
@@ -88,6 +92,14 @@ public:
 private:
     StorageFactory(void* handle, CACHE_STORAGE_API* pApi, uint32_t capabilities);
 
+    bool create_shard_storages(const char* zName,
+                               const CACHE_STORAGE_CONFIG& config,
+                               const CACHE_STORAGE_CONFIG& raw_config,
+                               int argc, char* argv[],
+                               size_t n_shards,
+                               Storage* pStorage,
+                               std::vector<Storage*>* pStorages);
+
     StorageFactory(const StorageFactory&);
     StorageFactory& operator = (const StorageFactory&);
 
@@ -14,6 +14,26 @@
 #define MXS_MODULE_NAME "cache"
 #include "storagereal.hh"
 
+namespace
+{
+
+/**
+ * Convert words to the representation used in the storage API.
+ *
+ * @param words   A vector of words.
+ * @param pZwords On return, pointers to the strings of @c words.
+ */
+void to_zwords(const std::vector<std::string>& words, std::vector<const char*>* pZwords)
+{
+    pZwords->reserve(words.size());
+
+    for (std::vector<std::string>::const_iterator i = words.begin(); i != words.end(); ++i)
+    {
+        pZwords->push_back(i->c_str());
+    }
+}
+
+}
 
 StorageReal::StorageReal(CACHE_STORAGE_API* pApi, CACHE_STORAGE* pStorage)
     : m_pApi(pApi)
@@ -45,9 +65,14 @@ cache_result_t StorageReal::get_value(const CACHE_KEY& key,
     return m_pApi->getValue(m_pStorage, &key, flags, ppValue);
 }
 
-cache_result_t StorageReal::put_value(const CACHE_KEY& key, const GWBUF* pValue)
+cache_result_t StorageReal::put_value(const CACHE_KEY& key,
+                                      const std::vector<std::string>& words,
+                                      const GWBUF* pValue)
 {
-    return m_pApi->putValue(m_pStorage, &key, pValue);
+    std::vector<const char*> zwords;
+    to_zwords(words, &zwords);
+
+    return m_pApi->putValue(m_pStorage, &key, zwords.empty() ? NULL : &zwords[0], zwords.size(), pValue);
 }
 
 cache_result_t StorageReal::del_value(const CACHE_KEY& key)
@@ -55,6 +80,14 @@ cache_result_t StorageReal::del_value(const CACHE_KEY& key)
     return m_pApi->delValue(m_pStorage, &key);
 }
 
+cache_result_t StorageReal::invalidate(const std::vector<std::string>& words)
+{
+    std::vector<const char*> zwords;
+    to_zwords(words, &zwords);
+
+    return m_pApi->invalidate(m_pStorage, zwords.empty() ? NULL : &zwords[0], zwords.size());
+}
+
 cache_result_t StorageReal::get_head(CACHE_KEY* pKey, GWBUF** ppHead) const
 {
     return m_pApi->getHead(m_pStorage, pKey, ppHead);
@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <maxscale/cppdefs.hh>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <maxscale/alloc.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/paths.h>
+#include <maxscale/utils.h>
+#include "storagefactory.hh"
+#include "testerbench.hh"
+
+using namespace std;
+
+namespace
+{
+
+const char DEFAULT_SIZES[] = "1024:60,16384:30,262144:10";
+
+struct option long_options[] =
+{
+    { "threads",      required_argument, 0, 't' },
+    { "seconds",      required_argument, 0, 's' },
+    { "keys",         required_argument, 0, 'k' },
+    { "distribution", required_argument, 0, 'd' },
+    { "zipf",         required_argument, 0, 'z' },
+    { "sizes",        required_argument, 0, 'v' },
+    { "max-count",    required_argument, 0, 'c' },
+    { "max-size",     required_argument, 0, 'm' },
+    { "thread-model", required_argument, 0, 'T' },
+    { "help",         no_argument,       0, 'h' },
+    { 0, 0, 0, 0 }
+};
+
+void print_usage(const char* zProgram)
+{
+    const TesterBench::Settings settings;
+
+    cout << "usage: " << zProgram << " [options] storage-module [storage-argument...]\n"
+         << "\n"
+         << "Looks up values from the storage and stores the ones that are not found,\n"
+         << "as the cache filter does, and reports the throughput, the hit ratio and\n"
+         << "the memory overhead per item.\n"
+         << "\n"
+         << "options:\n"
+         << "  -t, --threads=N             the number of threads, 0 for #cores + 1 (default "
+         << settings.threads << ")\n"
+         << "  -s, --seconds=N             for how many seconds to run (default " << settings.seconds << ")\n"
+         << "  -k, --keys=N                the number of distinct keys (default " << settings.keys << ")\n"
+         << "  -d, --distribution=D        'uniform' or 'zipf' (default zipf)\n"
+         << "  -z, --zipf=S                the exponent of the Zipf distribution (default "
+         << settings.zipf_s << ")\n"
+         << "  -v, --sizes=SIZE[:WEIGHT],...\n"
+         << "                              the value sizes and their relative weights\n"
+         << "                              (default " << DEFAULT_SIZES << ")\n"
+         << "  -c, --max-count=N           the maximum number of items (default 0, no limit)\n"
+         << "  -m, --max-size=N            the maximum total size of the items (default 0, no limit)\n"
+         << "  -T, --thread-model=M        'mt' or 'st'; with 'st' only one thread can be used\n"
+         << "                              (default mt)\n"
+         << "  -h, --help                  print this help\n"
+         << "\n"
+         << "The storage arguments are passed to the storage module as such, e.g.\n"
+         << "'compression=zlib'." << endl;
+}
+
+int run(const char* zModule, const TesterBench::Settings& settings, const CACHE_STORAGE_CONFIG& config,
+        int argc, char* argv[])
+{
+    int rv = EXIT_FAILURE;
+
+    if (mxs_log_init(NULL, ".", MXS_LOG_TARGET_DEFAULT))
+    {
+        const char FORMAT[] = "../storage/%s";
+        char libdir[sizeof(FORMAT) + strlen(zModule)];
+        sprintf(libdir, FORMAT, zModule);
+
+        set_libdir(MXS_STRDUP_A(libdir));
+
+        StorageFactory* pFactory = StorageFactory::Open(zModule);
+
+        if (pFactory)
+        {
+            cout << "Module      : " << zModule << "\n"
+                 << "Threads     : " << settings.threads << "\n"
+                 << "Seconds     : " << settings.seconds << "\n"
+                 << "Keys        : " << settings.keys << "\n"
+                 << "Distribution: " << (settings.distribution == TesterBench::DISTRIBUTION_ZIPF ?
+                                         "zipf" : "uniform") << "\n"
+                 << "Max-Count   : " << config.max_count << "\n"
+                 << "Max-Size    : " << config.max_size << "\n"
+                 << endl;
+
+            TesterBench tester(&cout, pFactory);
+
+            rv = tester.run(settings, config, argc, argv);
+
+            delete pFactory;
+        }
+        else
+        {
+            cerr << "error: Could not initialize factory " << zModule << "." << endl;
+        }
+
+        mxs_log_finish();
+    }
+    else
+    {
+        cerr << "error: Could not initialize log." << endl;
+    }
+
+    return rv;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    TesterBench::Settings settings;
+    CacheStorageConfig config(CACHE_THREAD_MODEL_MT);
+    const char* zSizes = DEFAULT_SIZES;
+    bool ok = true;
+    int c;
+
+    while (ok && ((c = getopt_long(argc, argv, "+t:s:k:d:z:v:c:m:T:h", long_options, NULL)) != -1))
+    {
+        switch (c)
+        {
+        case 't':
+            settings.threads = atoi(optarg);
+            break;
+
+        case 's':
+            settings.seconds = atoi(optarg);
+            break;
+
+        case 'k':
+            settings.keys = atoi(optarg);
+            break;
+
+        case 'd':
+            if (strcmp(optarg, "uniform") == 0)
+            {
+                settings.distribution = TesterBench::DISTRIBUTION_UNIFORM;
+            }
+            else if (strcmp(optarg, "zipf") == 0)
+            {
+                settings.distribution = TesterBench::DISTRIBUTION_ZIPF;
+            }
+            else
+            {
+                cerr << "error: Unknown distribution '" << optarg << "'." << endl;
+                ok = false;
+            }
+            break;
+
+        case 'z':
+            settings.zipf_s = atof(optarg);
+            break;
+
+        case 'v':
+            zSizes = optarg;
+            break;
+
+        case 'c':
+            config.max_count = atoi(optarg);
+            break;
+
+        case 'm':
+            config.max_size = strtoull(optarg, NULL, 10);
+            break;
+
+        case 'T':
+            if (strcmp(optarg, "mt") == 0)
+            {
+                config.thread_model = CACHE_THREAD_MODEL_MT;
+            }
+            else if (strcmp(optarg, "st") == 0)
+            {
+                config.thread_model = CACHE_THREAD_MODEL_ST;
+            }
+            else
+            {
+                cerr << "error: Unknown thread model '" << optarg << "'." << endl;
+                ok = false;
+            }
+            break;
+
+        default:
+            ok = false;
+        }
+    }
+
+    if (ok && !TesterBench::parse_sizes(zSizes, &settings.sizes))
+    {
+        cerr << "error: Invalid value sizes '" << zSizes << "'." << endl;
+        ok = false;
+    }
+
+    if (settings.threads == 0)
+    {
+        settings.threads = get_processor_count() + 1;
+    }
+
+    if (ok && (config.thread_model == CACHE_THREAD_MODEL_ST) && (settings.threads != 1))
+    {
+        cerr << "error: With the 'st' thread model, only one thread can be used." << endl;
+        ok = false;
+    }
+
+    if (ok && ((optind >= argc) || (settings.keys == 0) || (settings.seconds == 0)))
+    {
+        ok = false;
+    }
+
+    int rv = EXIT_FAILURE;
+
+    if (ok)
+    {
+        const char* zModule = argv[optind];
+
+        rv = run(zModule, settings, config, argc - optind - 1, argv + optind + 1);
+    }
+    else
+    {
+        print_usage(argv[0]);
+    }
+
+    return rv;
+}
@@ -0,0 +1,426 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include "testerbench.hh"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include "storage.hh"
+#include "storagefactory.hh"
+
+using namespace std;
+
+namespace
+{
+
+/**
+ * A xorshift64* generator, so that the threads need not share the state
+ * of random().
+ */
+class Random
+{
+public:
+    Random(uint64_t seed)
+        : m_state(seed ? seed : 0x9e3779b97f4a7c15ULL)
+    {
+    }
+
+    uint64_t next()
+    {
+        m_state ^= m_state >> 12;
+        m_state ^= m_state << 25;
+        m_state ^= m_state >> 27;
+
+        return m_state * 0x2545f4914f6cdd1dULL;
+    }
+
+    /**
+     * @return A value in [0, 1).
+     */
+    double next_double()
+    {
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+private:
+    uint64_t m_state;
+};
+
+/**
+ * The keys and values the tasks use, shared by all of them.
+ */
+struct Workload
+{
+    TesterBench::distribution_t distribution;
+    vector<double>  cdf;     /*< If Zipf, the cumulative probability of each key rank. */
+    vector<uint8_t> classes; /*< The size class of the value of each key. */
+    vector<GWBUF*>  values;  /*< A value of each size class. */
+};
+
+/**
+ * @return The resident set size of the process, in bytes.
+ */
+uint64_t get_rss()
+{
+    uint64_t rss = 0;
+    FILE* pFile = fopen("/proc/self/statm", "r");
+
+    if (pFile)
+    {
+        unsigned long size;
+        unsigned long resident;
+
+        if (fscanf(pFile, "%lu %lu", &size, &resident) == 2)
+        {
+            rss = static_cast<uint64_t>(resident) * sysconf(_SC_PAGESIZE);
+        }
+
+        fclose(pFile);
+    }
+
+    return rss;
+}
+
+bool create_workload(const TesterBench::Settings& settings, Workload* pWorkload)
+{
+    pWorkload->distribution = settings.distribution;
+
+    if (settings.distribution == TesterBench::DISTRIBUTION_ZIPF)
+    {
+        pWorkload->cdf.resize(settings.keys);
+
+        double sum = 0;
+
+        for (size_t i = 0; i < settings.keys; ++i)
+        {
+            sum += 1.0 / pow(static_cast<double>(i + 1), settings.zipf_s);
+            pWorkload->cdf[i] = sum;
+        }
+
+        for (size_t i = 0; i < settings.keys; ++i)
+        {
+            pWorkload->cdf[i] /= sum;
+        }
+    }
+
+    size_t total_weight = 0;
+
+    for (size_t i = 0; i < settings.sizes.size(); ++i)
+    {
+        total_weight += settings.sizes[i].weight;
+
+        GWBUF* pValue = Tester::gwbuf_from_vector(vector<uint8_t>(settings.sizes[i].size, i));
+
+        if (!pValue)
+        {
+            return false;
+        }
+
+        pWorkload->values.push_back(pValue);
+    }
+
+    // The size of the value of a key is fixed, as the result of a particular
+    // statement does not change size arbitrarily either.
+    Random random(1);
+    pWorkload->classes.resize(settings.keys);
+
+    for (size_t i = 0; i < settings.keys; ++i)
+    {
+        size_t w = random.next() % total_weight;
+        size_t c = 0;
+
+        while (w >= settings.sizes[c].weight)
+        {
+            w -= settings.sizes[c].weight;
+            ++c;
+        }
+
+        pWorkload->classes[i] = c;
+    }
+
+    return true;
+}
+
+void free_workload(Workload* pWorkload)
+{
+    for_each(pWorkload->values.begin(), pWorkload->values.end(), gwbuf_free);
+    pWorkload->values.clear();
+}
+
+}
+
+/**
+ * @class TesterBench::BenchTask
+ *
+ * A task that looks up values and stores the ones not found, as the
+ * cache filter does.
+ */
+class TesterBench::BenchTask : public Tester::Task
+{
+public:
+    BenchTask(ostream* pOut, Storage* pStorage, const Workload* pWorkload, uint64_t seed)
+        : Tester::Task(pOut)
+        , m_storage(*pStorage)
+        , m_workload(*pWorkload)
+        , m_random(seed)
+        , m_gets(0)
+        , m_hits(0)
+        , m_puts(0)
+    {
+    }
+
+    int run()
+    {
+        int rv = EXIT_SUCCESS;
+        vector<string> words;
+
+        while (!should_terminate() && (rv == EXIT_SUCCESS))
+        {
+            size_t i = next_key();
+
+            CACHE_KEY key;
+            key.data = i;
+
+            GWBUF* pValue;
+            cache_result_t result = m_storage.get_value(key, 0, &pValue);
+            ++m_gets;
+
+            if (CACHE_RESULT_IS_OK(result))
+            {
+                gwbuf_free(pValue);
+                ++m_hits;
+            }
+            else if (CACHE_RESULT_IS_NOT_FOUND(result))
+            {
+                result = m_storage.put_value(key, words, m_workload.values[m_workload.classes[i]]);
+
+                if (CACHE_RESULT_IS_OK(result))
+                {
+                    ++m_puts;
+                }
+                else
+                {
+                    out() << "error: Could not put value." << endl;
+                    rv = EXIT_FAILURE;
+                }
+            }
+            else
+            {
+                out() << "error: Could not get value." << endl;
+                rv = EXIT_FAILURE;
+            }
+        }
+
+        return rv;
+    }
+
+    uint64_t gets() const
+    {
+        return m_gets;
+    }
+
+    uint64_t hits() const
+    {
+        return m_hits;
+    }
+
+    uint64_t puts() const
+    {
+        return m_puts;
+    }
+
+private:
+    size_t next_key()
+    {
+        size_t n = m_workload.classes.size();
+        size_t i;
+
+        if (m_workload.distribution == DISTRIBUTION_ZIPF)
+        {
+            double u = m_random.next_double();
+
+            i = lower_bound(m_workload.cdf.begin(), m_workload.cdf.end(), u) - m_workload.cdf.begin();
+
+            if (i >= n)
+            {
+                i = n - 1;
+            }
+        }
+        else
+        {
+            i = m_random.next() % n;
+        }
+
+        return i;
+    }
+
+    BenchTask(const BenchTask&);
+    BenchTask& operator = (const BenchTask&);
+
+private:
+    Storage&        m_storage;
+    const Workload& m_workload;
+    Random          m_random;
+    uint64_t        m_gets;
+    uint64_t        m_hits;
+    uint64_t        m_puts;
+};
+
+//
+// class TesterBench
+//
+
+TesterBench::TesterBench(ostream* pOut, StorageFactory* pFactory)
+    : Tester(pOut)
+    , m_factory(*pFactory)
+{
+}
+
+// static
+bool TesterBench::parse_sizes(const char* zSizes, SizeClasses* pSizes)
+{
+    SizeClasses sizes;
+    string s(zSizes);
+    stringstream ss(s);
+    string item;
+
+    while (getline(ss, item, ','))
+    {
+        char* zEnd;
+        SizeClass size_class;
+
+        size_class.size = strtoul(item.c_str(), &zEnd, 10);
+        size_class.weight = 1;
+
+        if (*zEnd == ':')
+        {
+            const char* zWeight = zEnd + 1;
+            size_class.weight = strtoul(zWeight, &zEnd, 10);
+
+            if (zEnd == zWeight)
+            {
+                return false;
+            }
+        }
+
+        if ((*zEnd != 0) || (size_class.size == 0) || (size_class.weight == 0))
+        {
+            return false;
+        }
+
+        sizes.push_back(size_class);
+    }
+
+    // The size class of a key is stored in a byte.
+    if (sizes.empty() || (sizes.size() > UINT8_MAX))
+    {
+        return false;
+    }
+
+    pSizes->swap(sizes);
+
+    return true;
+}
+
+int TesterBench::run(const Settings& settings, const CACHE_STORAGE_CONFIG& config, int argc, char* argv[])
+{
+    int rv = EXIT_FAILURE;
+
+    Workload workload;
+
+    if (create_workload(settings, &workload))
+    {
+        uint64_t rss_before = get_rss();
+
+        Storage* pStorage = m_factory.createStorage("cache_bench", config, argc, argv);
+
+        if (pStorage)
+        {
+            Tasks tasks;
+
+            for (size_t i = 0; i < settings.threads; ++i)
+            {
+                tasks.push_back(new BenchTask(&out(), pStorage, &workload, i + 1));
+            }
+
+            rv = Tester::execute(out(), settings.seconds, tasks);
+
+            uint64_t gets = 0;
+            uint64_t hits = 0;
+            uint64_t puts = 0;
+
+            for (Tasks::iterator i = tasks.begin(); i != tasks.end(); ++i)
+            {
+                BenchTask* pTask = static_cast<BenchTask*>(*i);
+
+                gets += pTask->gets();
+                hits += pTask->hits();
+                puts += pTask->puts();
+            }
+
+            for_each(tasks.begin(), tasks.end(), Task::free);
+
+            double seconds = settings.seconds;
+
+            out() << "\n"
+                  << fixed << setprecision(0)
+                  << "Gets     : " << gets << " (" << gets / seconds << "/s)\n"
+                  << "Puts     : " << puts << " (" << puts / seconds << "/s)\n"
+                  << "Ops      : " << gets + puts << " (" << (gets + puts) / seconds << "/s)\n"
+                  << setprecision(4)
+                  << "Hit ratio: " << (gets ? static_cast<double>(hits) / gets : 0) << "\n";
+
+            uint64_t items;
+            uint64_t size;
+
+            if (CACHE_RESULT_IS_OK(pStorage->get_items(&items)) &&
+                CACHE_RESULT_IS_OK(pStorage->get_size(&size)) &&
+                (items != 0))
+            {
+                uint64_t rss_after = get_rss();
+                int64_t overhead = (static_cast<int64_t>(rss_after) - static_cast<int64_t>(rss_before) -
+                                    static_cast<int64_t>(size)) / static_cast<int64_t>(items);
+
+                // The process may hold on to freed memory, so this is an upper bound.
+                out() << "Items    : " << items << "\n"
+                      << "Size     : " << size << "\n"
+                      << "Overhead : " << overhead << " bytes per item (RSS based)\n";
+            }
+            else
+            {
+                out() << "Overhead : n/a, the storage does not report its items and size\n";
+            }
+
+            out() << endl;
+
+            delete pStorage;
+        }
+        else
+        {
+            out() << "error: Could not create storage." << endl;
+        }
+    }
+    else
+    {
+        out() << "error: Could not create workload." << endl;
+    }
+
+    free_workload(&workload);
+
+    return rv;
+}
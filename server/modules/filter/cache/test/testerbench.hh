@@ -0,0 +1,112 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <maxscale/cppdefs.hh>
+#include <string>
+#include <vector>
+#include "tester.hh"
+
+class Storage;
+class StorageFactory;
+
+/**
+ * TesterBench measures the throughput and hit ratio of a storage, when
+ * accessed the way the cache filter accesses it: a value is looked up and,
+ * if it is not found, it is "fetched" and stored.
+ */
+class TesterBench : public Tester
+{
+public:
+    enum distribution_t
+    {
+        DISTRIBUTION_UNIFORM, /*< Every key is equally likely. */
+        DISTRIBUTION_ZIPF     /*< The probability of the key of rank k is proportional to 1 / k^s. */
+    };
+
+    /**
+     * A value size and how often it occurs, relative to the other sizes.
+     */
+    struct SizeClass
+    {
+        size_t size;
+        size_t weight;
+    };
+
+    typedef std::vector<SizeClass> SizeClasses;
+
+    struct Settings
+    {
+        enum
+        {
+            DEFAULT_THREADS = 4,
+            DEFAULT_SECONDS = 10,
+            DEFAULT_KEYS    = 10000,
+        };
+
+        Settings()
+            : threads(DEFAULT_THREADS)
+            , seconds(DEFAULT_SECONDS)
+            , keys(DEFAULT_KEYS)
+            , distribution(DISTRIBUTION_ZIPF)
+            , zipf_s(0.99)
+        {}
+
+        size_t         threads;       /*< The number of threads. */
+        size_t         seconds;       /*< For how long to run. */
+        size_t         keys;          /*< The number of distinct keys. */
+        distribution_t distribution;  /*< How the keys are accessed. */
+        double         zipf_s;        /*< The exponent of the Zipf distribution. */
+        SizeClasses    sizes;         /*< The sizes of the values. */
+    };
+
+    /**
+     * Parse a value size histogram.
+     *
+     * @param zSizes  A comma separated list of "size:weight" pairs, where the
+     *                weight is optional and defaults to 1.
+     * @param pSizes  On successful return, the size classes.
+     *
+     * @return True, if the histogram could be parsed.
+     */
+    static bool parse_sizes(const char* zSizes, SizeClasses* pSizes);
+
+    /**
+     * Constructor
+     *
+     * @param pOut      Pointer to the stream to be used for (user) output.
+     * @param pFactory  Pointer to factory to be used.
+     */
+    TesterBench(std::ostream* pOut, StorageFactory* pFactory);
+
+    /**
+     * Run the benchmark against a storage and report the results.
+     *
+     * @param settings  What to run.
+     * @param config    The configuration of the storage.
+     * @param argc      The number of storage specific arguments.
+     * @param argv      Storage specific arguments.
+     *
+     * @return EXIT_SUCCESS or EXIT_FAILURE.
+     */
+    int run(const Settings& settings, const CACHE_STORAGE_CONFIG& config, int argc, char* argv[]);
+
+private:
+    class BenchTask;
+
+    TesterBench(const TesterBench&);
+    TesterBench& operator = (const TesterBench&);
+
+private:
+    StorageFactory& m_factory;  /*< The storage factory that is used. */
+};
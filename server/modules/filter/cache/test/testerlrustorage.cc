@@ -12,6 +12,7 @@
  */
 
 #include "testerlrustorage.hh"
+#include <sstream>
 #include "storage.hh"
 #include "storagefactory.hh"
 
@@ -20,6 +21,7 @@ using namespace maxscale;
 
 TesterLRUStorage::TesterLRUStorage(std::ostream* pOut, StorageFactory* pFactory)
     : TesterStorage(pOut, pFactory)
+    , m_n_shards(1)
 {
 }
 
@@ -32,22 +34,37 @@ int TesterLRUStorage::execute(size_t n_threads, size_t n_seconds, const CacheIte
         size += gwbuf_length(i->second);
     }
 
-    int rv1 = test_smoke(cache_items);
-    out() << endl;
-    int rv2 = test_lru(cache_items, size);
-    out() << endl;
-    int rv3 = test_max_count(n_threads, n_seconds, cache_items, size);
-    out() << endl;
-    int rv4 = test_max_size(n_threads, n_seconds, cache_items, size);
-    out() << endl;
-    int rv5 = test_max_count_and_size(n_threads, n_seconds, cache_items, size);
-
-    return combine_rvs(rv1, rv2, rv3, rv4, rv5);
+    int rv = EXIT_SUCCESS;
+    const size_t shard_counts[] = { 1, 4 };
+
+    for (size_t i = 0; i < sizeof(shard_counts) / sizeof(shard_counts[0]); ++i)
+    {
+        m_n_shards = shard_counts[i];
+
+        out() << "Shards: " << m_n_shards << "\n" << endl;
+
+        int rv1 = test_smoke(cache_items);
+        out() << endl;
+        int rv2 = test_lru(cache_items, size);
+        out() << endl;
+        int rv3 = test_max_count(n_threads, n_seconds, cache_items, size);
+        out() << endl;
+        int rv4 = test_max_size(n_threads, n_seconds, cache_items, size);
+        out() << endl;
+        int rv5 = test_max_count_and_size(n_threads, n_seconds, cache_items, size);
+        out() << endl;
+        int rv6 = test_invalidate(cache_items);
+        out() << endl;
+
+        rv = combine_rvs(rv, combine_rvs(rv1, rv2, rv3, rv4, rv5), rv6);
+    }
+
+    return rv;
 }
 
 Storage* TesterLRUStorage::get_storage(const CACHE_STORAGE_CONFIG& config) const
 {
-    return m_factory.createStorage("unspecified", config);
+    return m_factory.createStorage("unspecified", config, 0, NULL, m_n_shards);
 }
 
 int TesterLRUStorage::test_lru(const CacheItems& cache_items, uint64_t size)
@@ -71,7 +88,7 @@ int TesterLRUStorage::test_lru(const CacheItems& cache_items, uint64_t size)
         {
             const CacheItems::value_type& cache_item = cache_items[i];
 
-            result = pStorage->put_value(cache_item.first, cache_item.second);
+            result = pStorage->put_value(cache_item.first, vector<string>(), cache_item.second);
 
             if (result == CACHE_RESULT_OK)
             {
@@ -269,3 +286,98 @@ int TesterLRUStorage::test_max_count_and_size(size_t n_threads, size_t n_seconds
 
     return rv;
 }
+
+int TesterLRUStorage::test_invalidate(const CacheItems& cache_items)
+{
+    int rv = EXIT_FAILURE;
+
+    out() << "LRU invalidate\n" << endl;
+
+    size_t items = cache_items.size() > 100 ? 100 : cache_items.size();
+    const size_t n_tables = 3;
+
+    CacheStorageConfig config(CACHE_THREAD_MODEL_MT);
+    config.invalidate = CACHE_INVALIDATE_CURRENT;
+
+    Storage* pStorage = get_storage(config);
+
+    if (pStorage)
+    {
+        rv = EXIT_SUCCESS;
+
+        // Item i depends upon table i % n_tables.
+        vector<vector<string> > words(n_tables);
+
+        for (size_t i = 0; i < n_tables; ++i)
+        {
+            stringstream ss;
+            ss << "test.t" << i;
+            words[i].push_back(ss.str());
+        }
+
+        for (size_t i = 0; (rv == EXIT_SUCCESS) && (i < items); ++i)
+        {
+            const CacheItems::value_type& cache_item = cache_items[i];
+
+            cache_result_t result = pStorage->put_value(cache_item.first, words[i % n_tables], cache_item.second);
+
+            if (!CACHE_RESULT_IS_OK(result))
+            {
+                out() << "Could not put item." << endl;
+                rv = EXIT_FAILURE;
+            }
+        }
+
+        if (rv == EXIT_SUCCESS)
+        {
+            cache_result_t result = pStorage->invalidate(words[0]);
+
+            if (!CACHE_RESULT_IS_OK(result))
+            {
+                out() << "Could not invalidate." << endl;
+                rv = EXIT_FAILURE;
+            }
+        }
+
+        size_t n_found = 0;
+
+        for (size_t i = 0; (rv == EXIT_SUCCESS) && (i < items); ++i)
+        {
+            const CacheItems::value_type& cache_item = cache_items[i];
+
+            GWBUF* pValue;
+            cache_result_t result = pStorage->get_value(cache_item.first, CACHE_FLAGS_NONE, &pValue);
+
+            if (CACHE_RESULT_IS_OK(result))
+            {
+                gwbuf_free(pValue);
+                ++n_found;
+
+                if (i % n_tables == 0)
+                {
+                    out() << "Invalidated item was found." << endl;
+                    rv = EXIT_FAILURE;
+                }
+            }
+            else if (i % n_tables != 0)
+            {
+                out() << "Item that was not invalidated was not found." << endl;
+                rv = EXIT_FAILURE;
+            }
+        }
+
+        uint64_t n_items;
+        pStorage->get_items(&n_items);
+
+        out() << "Items: " << items << ", found: " << n_found << ", in storage: " << n_items << "." << endl;
+
+        if (n_items != n_found)
+        {
+            rv = EXIT_FAILURE;
+        }
+
+        delete pStorage;
+    }
+
+    return rv;
+}
@@ -46,8 +46,12 @@ private:
                       const CacheItems& cache_items, uint64_t size);
     int test_max_count_and_size(size_t n_threads, size_t n_seconds,
                                 const CacheItems& cache_items, uint64_t size);
+    int test_invalidate(const CacheItems& cache_items);
 
 private:
     TesterLRUStorage(const TesterLRUStorage&);
     TesterLRUStorage& operator = (const TesterLRUStorage&);
+
+private:
+    size_t m_n_shards; /*< The number of shards of multi-threaded storages. */
 };
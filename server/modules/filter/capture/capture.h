@@ -0,0 +1,70 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file capture.h - The file format of the capture filter
+ *
+ * A capture file starts with a CAPTURE_FILE_HEADER that is followed by
+ * records. Each record is a CAPTURE_RECORD followed by @c length bytes of
+ * data. The integers are in the byte order of the host that wrote the file.
+ *
+ * The records of one session are in the order in which they were created,
+ * but the records of different sessions are interleaved in an arbitrary
+ * order. A session that moved to another routing thread can also have its
+ * records out of order, so the reader should order the records of each
+ * session by their timestamps.
+ */
+
+#include <stdint.h>
+
+/** The magic bytes at the start of a capture file */
+#define CAPTURE_MAGIC "MXSCAP"
+
+/** The version of the file format */
+#define CAPTURE_VERSION 1
+
+typedef struct
+{
+    char    magic[6]; /*< CAPTURE_MAGIC without the terminating null */
+    uint8_t version;  /*< CAPTURE_VERSION */
+    uint8_t pad;
+} CAPTURE_FILE_HEADER;
+
+typedef enum
+{
+    /** A session was started. The data is the user name and the default
+     * database, both terminated by a null. */
+    CAPTURE_CONNECT  = 1,
+    /** Data sent by the client. The data consists of complete MySQL packets. */
+    CAPTURE_PACKET   = 2,
+    /** Replies to the client were completed. The data is the number of
+     * completed replies as an uint32_t. */
+    CAPTURE_REPLY    = 3,
+    /** A COM_STMT_PREPARE got an ID. The data is the ID as an uint32_t. */
+    CAPTURE_PREPARED = 4,
+    /** The session was closed */
+    CAPTURE_CLOSE    = 5,
+    /** Records of the session were lost and the capture of the session
+     * was stopped */
+    CAPTURE_DROPPED  = 6
+} capture_record_type_t;
+
+typedef struct
+{
+    uint64_t session;   /*< The session ID */
+    uint64_t timestamp; /*< Microseconds since the epoch */
+    uint32_t length;    /*< Length of the data that follows */
+    uint8_t  type;      /*< A capture_record_type_t */
+    uint8_t  pad[3];
+} CAPTURE_RECORD;
@@ -0,0 +1,695 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file capturefilter.c - Capture the client traffic for replaying it
+ *
+ * The filter records the packets that the clients send, the times at which
+ * the replies to them are completed and the IDs of the prepared statements
+ * into a binary file. The maxscale_replay utility replays the file against
+ * a server with the original concurrency and pacing and compares the
+ * latencies.
+ *
+ * The routing threads never write to the file. Each routing thread copies
+ * the records into a ring buffer of its own from which a writer thread of
+ * the filter instance collects them and writes them with few large writes.
+ * When a buffer is full, the records are dropped and the capture of the
+ * session is stopped, so that a slow disk never delays the clients.
+ */
+
+#define MXS_MODULE_NAME "capturefilter"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/filter.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/modinfo.h>
+#include <maxscale/modutil.h>
+#include <maxscale/platform.h>
+#include <maxscale/protocol/mysql.h>
+#include <maxscale/spsc_ring.h>
+#include "capture.h"
+
+/** Size of the buffer into which the writer thread collects the records */
+#define CAPTURE_WRITE_BUFFER_SIZE (256 * 1024)
+
+/** Bytes at the start of a COM_STMT_PREPARE reply that contain the statement ID */
+#define CAPTURE_PREPARE_PEEK (MYSQL_HEADER_LEN + 5)
+
+/*
+ * The filter entry points
+ */
+static MXS_FILTER *createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *);
+static MXS_FILTER_SESSION *newSession(MXS_FILTER *instance, MXS_SESSION *session);
+static void closeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session);
+static void freeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session);
+static void setDownstream(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, MXS_DOWNSTREAM *downstream);
+static void setUpstream(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, MXS_UPSTREAM *upstream);
+static int routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, GWBUF *queue);
+static int clientReply(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, GWBUF *queue);
+static void diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb);
+static uint64_t getCapabilities(MXS_FILTER* instance);
+
+typedef struct
+{
+    char *name;               /* Filter definition name */
+    char *filename;           /* The capture file */
+    int fd;                   /* The capture file, written only by the writer thread */
+    MXS_SPSC_RING *rings;     /* The record buffers, one per routing thread */
+    int n_rings;              /* Number of record buffers */
+    int sessions;             /* Number of captured sessions */
+    uint64_t records_written; /* Records written by the writer thread */
+    uint64_t records_dropped; /* Records dropped as a buffer was full */
+    uint64_t bytes_written;   /* Bytes written to the capture file */
+    bool write_warning_given; /* To make sure the write error is only logged once */
+    char *buffer;             /* Records collected by the writer thread */
+    size_t len;               /* Length of the collected records */
+    MXS_SPSC_CONSUMER *writer; /* The writer thread */
+} CAPTURE_INSTANCE;
+
+typedef struct
+{
+    MXS_DOWNSTREAM down;
+    MXS_UPSTREAM up;
+    uint64_t ses_id;         /* The session this filter serves */
+    bool active;             /* Whether the session is still captured */
+    bool dropped;            /* A record was dropped, the capture stops */
+    MXS_REPLY_QUEUE replies; /* The replies the client waits for */
+    bool prepare_pending;    /* The next reply is to a COM_STMT_PREPARE */
+    int peek_len;            /* Bytes collected in peek */
+    uint8_t peek[CAPTURE_PREPARE_PEEK]; /* Start of the COM_STMT_PREPARE reply */
+} CAPTURE_SESSION;
+
+static uint64_t writer_drain(MXS_SPSC_RING *ring, void *data);
+static int writer_flush(MXS_SPSC_CONSUMER *consumer, void *data);
+
+/**
+ * The module entry point routine. It is this routine that
+ * must populate the structure that is referred to as the
+ * "module object", this is a structure with the set of
+ * external entry points for this module.
+ *
+ * @return The module object
+ */
+MXS_MODULE* MXS_CREATE_MODULE()
+{
+    static MXS_FILTER_OBJECT MyObject =
+    {
+        createInstance,
+        newSession,
+        closeSession,
+        freeSession,
+        setDownstream,
+        setUpstream,
+        routeQuery,
+        clientReply,
+        diagnostic,
+        getCapabilities,
+        NULL, // No destroyInstance
+    };
+
+    static MXS_MODULE info =
+    {
+        MXS_MODULE_API_FILTER,
+        MXS_MODULE_IN_DEVELOPMENT,
+        MXS_FILTER_VERSION,
+        "A filter that captures the client traffic for replaying it",
+        "V1.0.0",
+        &MyObject,
+        NULL, /* Process init. */
+        NULL, /* Process finish. */
+        NULL, /* Thread init. */
+        NULL, /* Thread finish. */
+        {
+            {
+                "file",
+                MXS_MODULE_PARAM_STRING,
+                NULL,
+                MXS_MODULE_OPT_REQUIRED
+            },
+            {
+                "buffer_size",
+                MXS_MODULE_PARAM_SIZE,
+                "4M"
+            },
+            {MXS_END_MODULE_PARAMS}
+        }
+    };
+
+    return &info;
+}
+
+/**
+ * Get the current time
+ *
+ * @return Microseconds since the epoch
+ */
+static uint64_t capture_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Create an instance of the filter for a particular service
+ * within MaxScale.
+ *
+ * @param name      The name of the instance (as defined in the config file).
+ * @param options   The options for this filter
+ * @param params    The array of name/value pair parameters for the filter
+ *
+ * @return The instance data for this new instance
+ */
+static MXS_FILTER *
+createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
+{
+    CAPTURE_INSTANCE *my_instance = MXS_CALLOC(1, sizeof(CAPTURE_INSTANCE));
+
+    if (my_instance == NULL)
+    {
+        return NULL;
+    }
+
+    bool error = false;
+    my_instance->name = MXS_STRDUP_A(name);
+    my_instance->filename = MXS_STRDUP_A(config_get_string(params, "file"));
+    my_instance->fd = open(my_instance->filename, O_WRONLY | O_CREAT | O_TRUNC, 0660);
+
+    CAPTURE_FILE_HEADER header = {CAPTURE_MAGIC, CAPTURE_VERSION};
+
+    if (my_instance->fd == -1 || write(my_instance->fd, &header, sizeof(header)) != sizeof(header))
+    {
+        char errbuf[MXS_STRERROR_BUFLEN];
+        MXS_ERROR("Failed to open capture file '%s' of filter '%s': %d, %s",
+                  my_instance->filename, name, errno,
+                  strerror_r(errno, errbuf, sizeof(errbuf)));
+        error = true;
+    }
+
+    if (!error)
+    {
+        my_instance->n_rings = config_threadcount();
+
+        if ((my_instance->rings = mxs_spsc_rings_alloc(my_instance->n_rings,
+                                                       config_get_size(params, "buffer_size"))) == NULL)
+        {
+            error = true;
+        }
+
+        if (!error && (my_instance->buffer = MXS_MALLOC(CAPTURE_WRITE_BUFFER_SIZE)) == NULL)
+        {
+            error = true;
+        }
+
+        if (!error && (my_instance->writer = mxs_spsc_consumer_start(my_instance->rings,
+                                                                     my_instance->n_rings,
+                                                                     writer_drain, writer_flush,
+                                                                     my_instance)) == NULL)
+        {
+            MXS_ERROR("Failed to start the writer thread of capture filter '%s'.", name);
+            error = true;
+        }
+    }
+
+    if (error)
+    {
+        if (my_instance->fd != -1)
+        {
+            close(my_instance->fd);
+        }
+
+        mxs_spsc_rings_free(my_instance->rings, my_instance->n_rings);
+        MXS_FREE(my_instance->buffer);
+        MXS_FREE(my_instance->filename);
+        MXS_FREE(my_instance->name);
+        MXS_FREE(my_instance);
+        my_instance = NULL;
+    }
+
+    return (MXS_FILTER *)my_instance;
+}
+
+/**
+ * Make a reserved record visible to the writer thread.
+ * @param   ring   The record buffer
+ * @param   record The record returned by capture_reserve()
+ */
+static void capture_commit(MXS_SPSC_RING *ring, CAPTURE_RECORD *record)
+{
+    mxs_spsc_ring_commit(ring, sizeof(CAPTURE_RECORD) + record->length);
+}
+
+/**
+ * Reserve a record in the buffer of the current thread. If the buffer is
+ * full, the record is dropped and the capture of the session is stopped as
+ * the rest of it could not be replayed.
+ * @param   instance Filter instance
+ * @param   session  Filter session
+ * @param   type     The record type
+ * @param   len      Length of the record data
+ * @param   ring     The buffer of the thread is stored here
+ * @return  The record, with the header filled in, or NULL if it was dropped
+ */
+static CAPTURE_RECORD* capture_reserve(CAPTURE_INSTANCE *instance, CAPTURE_SESSION *session,
+                                       uint8_t type, size_t len, MXS_SPSC_RING **ring)
+{
+    *ring = mxs_spsc_rings_get(instance->rings, instance->n_rings);
+    CAPTURE_RECORD *record = NULL;
+
+    if (session->dropped)
+    {
+        // Tell the reader where the session ends once there is room for it
+        if (*ring && (record = mxs_spsc_ring_reserve(*ring, sizeof(CAPTURE_RECORD))))
+        {
+            record->type = CAPTURE_DROPPED;
+            record->length = 0;
+            record->session = session->ses_id;
+            record->timestamp = capture_now();
+            capture_commit(*ring, record);
+            session->active = false;
+        }
+
+        atomic_add_uint64(&instance->records_dropped, 1);
+        return NULL;
+    }
+
+    if (*ring && (record = mxs_spsc_ring_reserve(*ring, sizeof(CAPTURE_RECORD) + len)))
+    {
+        record->type = type;
+        record->length = len;
+        record->session = session->ses_id;
+        record->timestamp = capture_now();
+    }
+    else
+    {
+        atomic_add_uint64(&instance->records_dropped, 1);
+        session->dropped = true;
+    }
+
+    return record;
+}
+
+/**
+ * Add a record with data that is in contiguous memory.
+ * @param   instance Filter instance
+ * @param   session  Filter session
+ * @param   type     The record type
+ * @param   data     Record data
+ * @param   len      Length of the record data
+ */
+static void capture_add(CAPTURE_INSTANCE *instance, CAPTURE_SESSION *session,
+                        uint8_t type, const void *data, size_t len)
+{
+    MXS_SPSC_RING *ring;
+    CAPTURE_RECORD *record = capture_reserve(instance, session, type, len, &ring);
+
+    if (record)
+    {
+        memcpy(record + 1, data, len);
+        capture_commit(ring, record);
+    }
+}
+
+/**
+ * Associate a new session with this instance of the filter.
+ *
+ * @param instance  The filter instance data
+ * @param session   The session itself
+ * @return Session specific data for this session
+ */
+static MXS_FILTER_SESSION *
+newSession(MXS_FILTER *instance, MXS_SESSION *session)
+{
+    CAPTURE_INSTANCE *my_instance = (CAPTURE_INSTANCE *) instance;
+    CAPTURE_SESSION *my_session = MXS_CALLOC(1, sizeof(CAPTURE_SESSION));
+
+    if (my_session)
+    {
+        MYSQL_session *data = (MYSQL_session*)session->client_dcb->data;
+        size_t user_len = strlen(data->user) + 1;
+        size_t db_len = strlen(data->db) + 1;
+        char connect[user_len + db_len];
+
+        memcpy(connect, data->user, user_len);
+        memcpy(connect + user_len, data->db, db_len);
+
+        my_session->ses_id = session->ses_id;
+        my_session->active = true;
+        atomic_add(&my_instance->sessions, 1);
+
+        capture_add(my_instance, my_session, CAPTURE_CONNECT, connect, sizeof(connect));
+    }
+
+    return (MXS_FILTER_SESSION*)my_session;
+}
+
+/**
+ * Close a session with the filter.
+ *
+ * @param instance  The filter instance data
+ * @param session   The session being closed
+ */
+static void
+closeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session)
+{
+    CAPTURE_SESSION *my_session = (CAPTURE_SESSION *) session;
+
+    if (my_session->active)
+    {
+        capture_add((CAPTURE_INSTANCE*)instance, my_session, CAPTURE_CLOSE, NULL, 0);
+        my_session->active = false;
+    }
+}
+
+/**
+ * Free the memory associated with the session
+ *
+ * @param instance  The filter instance
+ * @param session   The filter session
+ */
+static void
+freeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session)
+{
+    CAPTURE_SESSION *my_session = (CAPTURE_SESSION *) session;
+
+    modutil_reply_queue_free(&my_session->replies);
+    MXS_FREE(my_session);
+}
+
+/**
+ * Set the downstream filter or router to which queries will be
+ * passed from this filter.
+ *
+ * @param instance  The filter instance data
+ * @param session   The filter session
+ * @param downstream    The downstream filter or router.
+ */
+static void
+setDownstream(MXS_FILTER *instance, MXS_FILTER_SESSION *session, MXS_DOWNSTREAM *downstream)
+{
+    CAPTURE_SESSION *my_session = (CAPTURE_SESSION *) session;
+
+    my_session->down = *downstream;
+}
+
+/**
+ * Set the upstream filter or session to which results will be
+ * passed from this filter.
+ *
+ * @param instance  The filter instance data
+ * @param session   The filter session
+ * @param upstream  The upstream filter or session.
+ */
+static void
+setUpstream(MXS_FILTER *instance, MXS_FILTER_SESSION *session, MXS_UPSTREAM *upstream)
+{
+    CAPTURE_SESSION *my_session = (CAPTURE_SESSION *) session;
+
+    my_session->up = *upstream;
+}
+
+/**
+ * The routeQuery entry point. The packets are copied into a record as such
+ * and the commands in them are added to the replies the client waits for.
+ *
+ * @param instance  The filter instance data
+ * @param session   The filter session
+ * @param queue     The query data
+ */
+static int
+routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
+{
+    CAPTURE_INSTANCE *my_instance = (CAPTURE_INSTANCE *) instance;
+    CAPTURE_SESSION *my_session = (CAPTURE_SESSION *) session;
+
+    if (my_session->active)
+    {
+        size_t len = gwbuf_length(queue);
+        MXS_SPSC_RING *ring;
+        CAPTURE_RECORD *record = capture_reserve(my_instance, my_session, CAPTURE_PACKET, len, &ring);
+
+        if (record)
+        {
+            gwbuf_copy_data(queue, 0, len, (uint8_t*)(record + 1));
+            capture_commit(ring, record);
+
+            const uint8_t *data = (const uint8_t*)(record + 1);
+
+            for (size_t offset = 0; offset + MYSQL_HEADER_LEN < len;
+                 offset += MYSQL_HEADER_LEN + gw_mysql_get_byte3(data + offset))
+            {
+                /** Only the first packet of a command gets a reply, the rest
+                 * continue a large packet or are LOAD DATA LOCAL INFILE data */
+                if (data[offset + 3] == 0)
+                {
+                    uint8_t command = data[offset + MYSQL_HEADER_LEN];
+                    int waiting = my_session->replies.count;
+
+                    modutil_reply_queue_push(&my_session->replies, command);
+
+                    /** The ID is only tracked for a prepare that is not
+                     * pipelined behind other commands */
+                    my_session->prepare_pending = command == MYSQL_COM_STMT_PREPARE && waiting == 0;
+                    my_session->peek_len = 0;
+                }
+            }
+        }
+    }
+
+    return my_session->down.routeQuery(my_session->down.instance,
+                                       my_session->down.session, queue);
+}
+
+/**
+ * Collect the start of a COM_STMT_PREPARE reply and record the statement ID
+ *
+ * @param instance  The filter instance data
+ * @param session   The filter session
+ * @param reply     The reply data
+ */
+static void capture_prepare_reply(CAPTURE_INSTANCE *instance, CAPTURE_SESSION *session, GWBUF *reply)
+{
+    session->peek_len += gwbuf_copy_data(reply, 0, sizeof(session->peek) - session->peek_len,
+                                         session->peek + session->peek_len);
+
+    if (session->peek_len == sizeof(session->peek) ||
+        (session->peek_len > MYSQL_HEADER_LEN && session->peek[MYSQL_HEADER_LEN] == MYSQL_REPLY_ERR))
+    {
+        session->prepare_pending = false;
+
+        if (session->peek_len == sizeof(session->peek) &&
+            session->peek[MYSQL_HEADER_LEN] == MYSQL_REPLY_OK)
+        {
+            uint32_t id = gw_mysql_get_byte4(session->peek + MYSQL_HEADER_LEN + 1);
+            capture_add(instance, session, CAPTURE_PREPARED, &id, sizeof(id));
+        }
+    }
+}
+
+/**
+ * The clientReply entry point. The time at which the replies are completed
+ * is recorded so that the latency of the original statements is known.
+ *
+ * @param instance  The filter instance data
+ * @param session   The filter session
+ * @param reply     The reply data
+ */
+static int
+clientReply(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *reply)
+{
+    CAPTURE_INSTANCE *my_instance = (CAPTURE_INSTANCE *) instance;
+    CAPTURE_SESSION *my_session = (CAPTURE_SESSION *) session;
+
+    if (my_session->active)
+    {
+        if (my_session->prepare_pending)
+        {
+            capture_prepare_reply(my_instance, my_session, reply);
+        }
+
+        uint32_t completed = modutil_reply_queue_process(&my_session->replies, reply);
+
+        if (completed > 0)
+        {
+            capture_add(my_instance, my_session, CAPTURE_REPLY, &completed, sizeof(completed));
+        }
+    }
+
+    return my_session->up.clientReply(my_session->up.instance,
+                                      my_session->up.session, reply);
+}
+
+/**
+ * Diagnostics routine
+ *
+ * @param   instance    The filter instance
+ * @param   fsession    Filter session, may be NULL
+ * @param   dcb         The DCB for diagnostic output
+ */
+static void
+diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
+{
+    CAPTURE_INSTANCE *my_instance = (CAPTURE_INSTANCE *) instance;
+    CAPTURE_SESSION *my_session = (CAPTURE_SESSION *) fsession;
+
+    dcb_printf(dcb, "\t\tCapture file               %s\n", my_instance->filename);
+
+    if (my_session)
+    {
+        dcb_printf(dcb, "\t\tSession is captured        %s\n",
+                   my_session->active ? "yes" : "no");
+    }
+
+    dcb_printf(dcb, "\t\tCaptured sessions          %d\n", my_instance->sessions);
+    dcb_printf(dcb, "\t\tRecords written            %" PRIu64 "\n",
+               atomic_add_uint64(&my_instance->records_written, 0));
+    dcb_printf(dcb, "\t\tRecords dropped            %" PRIu64 "\n",
+               atomic_add_uint64(&my_instance->records_dropped, 0));
+    dcb_printf(dcb, "\t\tBytes written              %" PRIu64 "\n",
+               atomic_add_uint64(&my_instance->bytes_written, 0));
+}
+
+/**
+ * Capability routine.
+ *
+ * @return The capabilities of the filter.
+ */
+static uint64_t getCapabilities(MXS_FILTER* instance)
+{
+    return RCAP_TYPE_STMT_INPUT;
+}
+
+/**
+ * Write data to a file, retrying partial writes.
+ * @param   fd   The file
+ * @param   data The data
+ * @param   len  Length of the data
+ * @return  True if all data was written
+ */
+static bool write_all(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t rc = write(fd, data, len);
+
+        if (rc < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+
+        data += rc;
+        len -= rc;
+    }
+
+    return true;
+}
+
+/**
+ * Write collected records to the capture file.
+ * @param   instance Filter instance
+ * @param   data     The records
+ * @param   len      Length of the records
+ */
+static void writer_write(CAPTURE_INSTANCE *instance, const char *data, size_t len)
+{
+    if (len > 0)
+    {
+        if (write_all(instance->fd, data, len))
+        {
+            atomic_add_uint64(&instance->bytes_written, len);
+        }
+        else if (!instance->write_warning_given)
+        {
+            char errbuf[MXS_STRERROR_BUFLEN];
+            MXS_ERROR("capture-filter '%s': Capture file write failed: %d, %s. "
+                      "Suppressing further similar warnings.", instance->name,
+                      errno, strerror_r(errno, errbuf, sizeof(errbuf)));
+            instance->write_warning_given = true;
+        }
+    }
+}
+
+/**
+ * Collect the records of a record buffer into the write buffer.
+ * @param   ring     The record buffer
+ * @param   data     Filter instance
+ * @return  Number of records processed
+ */
+static uint64_t writer_drain(MXS_SPSC_RING *ring, void *data)
+{
+    CAPTURE_INSTANCE *instance = (CAPTURE_INSTANCE*)data;
+    char *buffer = instance->buffer;
+    size_t *len = &instance->len;
+    uint64_t n_records = 0;
+    CAPTURE_RECORD *record;
+    size_t size;
+
+    while ((record = mxs_spsc_ring_peek(ring, &size)))
+    {
+        if (*len + size > CAPTURE_WRITE_BUFFER_SIZE)
+        {
+            writer_write(instance, buffer, *len);
+            *len = 0;
+        }
+
+        if (size > CAPTURE_WRITE_BUFFER_SIZE)
+        {
+            // Large packets are written directly from the record buffer
+            writer_write(instance, (const char*)record, size);
+        }
+        else
+        {
+            memcpy(buffer + *len, record, size);
+            *len += size;
+        }
+
+        mxs_spsc_ring_consume(ring);
+        n_records++;
+    }
+
+    if (n_records > 0)
+    {
+        atomic_add_uint64(&instance->records_written, n_records);
+    }
+
+    return n_records;
+}
+
+/**
+ * Write the records collected from all routing threads. The records are
+ * written with few large writes, so that the routing threads never wait
+ * for the disk.
+ * @param   consumer The writer thread
+ * @param   data     Filter instance
+ * @return  -1, the writer thread only wakes up for new records
+ */
+static int writer_flush(MXS_SPSC_CONSUMER *consumer, void *data)
+{
+    CAPTURE_INSTANCE *instance = (CAPTURE_INSTANCE*)data;
+
+    writer_write(instance, instance->buffer, instance->len);
+    instance->len = 0;
+    return -1;
+}
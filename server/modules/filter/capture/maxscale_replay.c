@@ -0,0 +1,1257 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file maxscale_replay.c - Replay a file written by the capture filter
+ *
+ * Each captured session is replayed by a thread of its own that opens the
+ * connection at the time the original session was started and sends each
+ * command at the time the client sent it, relative to the start of the
+ * replay and divided by the speed. The commands of a session are sent one
+ * at a time: a command is only sent when the reply to the previous one has
+ * been read.
+ *
+ * The connection is opened with the MariaDB Connector-C, after which the
+ * captured packets are written to its socket as such. The IDs of the
+ * prepared statements are replaced with the IDs that the server gave to
+ * the replayed prepares. The replies are followed with the same code
+ * MaxScale uses, so the latency of each statement is known both for the
+ * original and the replayed traffic. The latencies are reported for each
+ * canonical form of the statements.
+ *
+ * @verbatim
+ * usage: maxscale_replay [options] FILE
+ * @endverbatim
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <mysql.h>
+#include <maxscale/buffer.h>
+#include <maxscale/histogram.h>
+#include <maxscale/modutil.h>
+#include <maxscale/utils.h>
+#include "capture.h"
+
+/** Length of a packet header */
+#define REPLAY_HEADER_LEN 4
+
+/** Bytes at the start of a reply that are inspected: the header, the type
+ * and the statement ID of a COM_STMT_PREPARE reply */
+#define REPLAY_PEEK_LEN (REPLAY_HEADER_LEN + 5)
+
+/** Longest time a thread waits without checking for an interrupt, in microseconds */
+#define REPLAY_MAX_SLEEP 100000
+
+/** Stack size of the session threads */
+#define REPLAY_STACK_SIZE (512 * 1024)
+
+/** Length of the statement sample in the report */
+#define REPLAY_SQL_SAMPLE 60
+
+/** Key bit of the commands that are not SQL statements */
+#define REPLAY_KEY_COMMAND (1ULL << 63)
+
+/** A record read from the capture file */
+typedef struct
+{
+    uint64_t       session;   /**< The session ID */
+    uint64_t       timestamp; /**< When the record was created in microseconds */
+    uint64_t       order;     /**< Position in the file */
+    uint32_t       length;    /**< Length of the data */
+    uint8_t        type;      /**< A capture_record_type_t */
+    uint8_t       *data;      /**< The data, in a private mapping of the file */
+} REPLAY_EVENT;
+
+/** A statement that was replayed */
+typedef struct
+{
+    uint64_t       digest;    /**< Digest of the canonical statement */
+    const uint8_t *sql;       /**< The statement text or NULL */
+    uint32_t       sql_len;   /**< Length of the statement text */
+    uint8_t        command;   /**< The command byte */
+    bool           replayed;  /**< Whether the statement was sent */
+    bool           error;     /**< Whether the replay got an error */
+    uint64_t       captured;  /**< When the original was sent */
+    uint64_t       sent;      /**< When the replay was sent */
+    int64_t        original;  /**< Latency of the original, -1 if not known */
+    int64_t        replay;    /**< Latency of the replay, -1 if not known */
+} REPLAY_STMT;
+
+/** A prepared statement of a session */
+typedef struct
+{
+    uint32_t       original;  /**< The captured ID */
+    uint32_t       replay;    /**< The ID the server gave to the replayed prepare */
+    uint64_t       digest;    /**< Digest of the statement */
+    const uint8_t *sql;       /**< The statement text */
+    uint32_t       sql_len;   /**< Length of the statement text */
+} REPLAY_PS;
+
+/** The replay of one captured session */
+typedef struct
+{
+    REPLAY_EVENT   *events;       /**< The records of the session in time order */
+    int             n_events;     /**< Number of records */
+    const char     *user;         /**< The captured user */
+    const char     *db;           /**< The captured default database */
+    MYSQL          *mysql;        /**< The connection */
+    int             fd;           /**< Socket of the connection */
+    bool            broken;       /**< The connection failed */
+    bool            done;         /**< The rest of the session was not captured */
+    MXS_REPLY_QUEUE replies;      /**< The replies the replay waits for */
+    REPLAY_STMT    *stmts;        /**< The statements of the session */
+    int             n_stmts;      /**< Number of statements */
+    int             orig_head;    /**< Oldest statement without an original reply */
+    int             orig_tail;
+    int             replay_head;  /**< Oldest statement without a replayed reply */
+    int             replay_tail;
+    int            *orig_pending; /**< Statements in the order their original replies end */
+    int            *replay_pending; /**< Statements in the order their replayed replies end */
+    REPLAY_PS      *ps;           /**< The prepared statements */
+    int             n_ps;
+    int             ps_size;
+    int             last_prepare; /**< The latest replayed COM_STMT_PREPARE */
+    bool            prepare_ok;   /**< Whether the server gave an ID to it */
+    uint32_t        prepare_id;   /**< The ID the server gave to it */
+    int             peek_len;     /**< Bytes of the current reply in peek */
+    uint8_t         peek[REPLAY_PEEK_LEN]; /**< Start of the current reply */
+} REPLAY_SESSION;
+
+/** The latencies of a canonical statement */
+typedef struct
+{
+    uint64_t       key;       /**< Digest or command of the statements */
+    uint8_t        command;   /**< The command of the statements */
+    const uint8_t *sql;       /**< A sample of the statements */
+    uint32_t       sql_len;
+    uint64_t       count;     /**< Number of replayed statements */
+    uint64_t       errors;    /**< Number of replayed statements that got an error */
+    uint64_t       orig_sum;  /**< Sum of the original latencies */
+    uint64_t       replay_sum; /**< Sum of the replayed latencies */
+    HISTOGRAM      orig;      /**< The original latencies */
+    HISTOGRAM      replay;    /**< The replayed latencies */
+} REPLAY_DIGEST;
+
+static struct
+{
+    const char *host;
+    int         port;
+    const char *socket;
+    const char *user;
+    const char *password;
+    double      speed;
+    int         top;
+} replay_opts =
+{
+    "127.0.0.1", 4006, NULL, NULL, "", 1.0, 20
+};
+
+static bool replay_stop = false;     /**< Stop the replay */
+static uint64_t replay_origin = 0;   /**< When the first captured session was started */
+static uint64_t replay_start = 0;    /**< When the replay was started */
+static bool replay_error_reported = false;
+
+/** The sessions that are running and the statistics they have collected */
+static pthread_mutex_t replay_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t replay_done = PTHREAD_COND_INITIALIZER;
+static int replay_running = 0;
+static REPLAY_STMT *replay_results = NULL;
+static size_t replay_n_results = 0;
+static uint64_t replay_n_skipped = 0;
+static int replay_n_failed = 0;
+static int replay_n_truncated = 0;
+
+static void replay_interrupt(int sig)
+{
+    __atomic_store_n(&replay_stop, true, __ATOMIC_RELAXED);
+}
+
+static bool replay_stopped()
+{
+    return __atomic_load_n(&replay_stop, __ATOMIC_RELAXED);
+}
+
+static uint32_t replay_get3(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16);
+}
+
+static uint32_t replay_get4(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void replay_set4(uint8_t *p, uint32_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+/**
+ * Wait until a point in time of the capture is reached
+ *
+ * @param timestamp Captured timestamp
+ */
+static void replay_sleep_until(uint64_t timestamp)
+{
+    if (replay_opts.speed > 0 && timestamp > replay_origin)
+    {
+        uint64_t when = replay_start + (uint64_t)((timestamp - replay_origin) / replay_opts.speed);
+        uint64_t now;
+
+        while (!replay_stopped() && (now = mxs_clock_us()) < when)
+        {
+            uint64_t left = when - now;
+            usleep(left < REPLAY_MAX_SLEEP ? left : REPLAY_MAX_SLEEP);
+        }
+    }
+}
+
+/**
+ * Report the first error, the rest are only counted
+ */
+static void replay_report_error(REPLAY_SESSION *ses, const char *what)
+{
+    pthread_mutex_lock(&replay_lock);
+
+    if (!replay_error_reported)
+    {
+        fprintf(stderr, "%s (session of '%s'): %s\n", what, ses->user,
+                ses->mysql ? mysql_error(ses->mysql) : strerror(errno));
+        replay_error_reported = true;
+    }
+
+    pthread_mutex_unlock(&replay_lock);
+}
+
+/**
+ * Read replies from the server
+ *
+ * @param ses The session
+ */
+static void replay_read(REPLAY_SESSION *ses)
+{
+    struct pollfd pfd = {ses->fd, POLLIN};
+    uint8_t data[65536];
+
+    if (poll(&pfd, 1, REPLAY_MAX_SLEEP / 1000) <= 0)
+    {
+        return;
+    }
+
+    ssize_t len = read(ses->fd, data, sizeof(data));
+
+    if (len <= 0)
+    {
+        if (len == 0 || (errno != EINTR && errno != EAGAIN))
+        {
+            replay_report_error(ses, "Connection was closed");
+            ses->broken = true;
+        }
+        return;
+    }
+
+    if (ses->peek_len < REPLAY_PEEK_LEN)
+    {
+        int n = REPLAY_PEEK_LEN - ses->peek_len < len ? REPLAY_PEEK_LEN - ses->peek_len : len;
+        memcpy(ses->peek + ses->peek_len, data, n);
+        ses->peek_len += n;
+    }
+
+    GWBUF *buf = gwbuf_alloc_and_load(len, data);
+
+    if (buf == NULL)
+    {
+        ses->broken = true;
+        return;
+    }
+
+    int completed = modutil_reply_queue_process(&ses->replies, buf);
+    gwbuf_free(buf);
+
+    uint64_t now = mxs_clock_us();
+
+    for (int i = 0; i < completed && ses->replay_head < ses->replay_tail; i++)
+    {
+        REPLAY_STMT *stmt = &ses->stmts[ses->replay_pending[ses->replay_head++]];
+        stmt->replay = now - stmt->sent;
+        stmt->error = ses->peek_len > REPLAY_HEADER_LEN && ses->peek[REPLAY_HEADER_LEN] == 0xff;
+
+        if (stmt->command == MYSQL_COM_STMT_PREPARE)
+        {
+            ses->prepare_ok = ses->peek_len == REPLAY_PEEK_LEN && ses->peek[REPLAY_HEADER_LEN] == 0;
+            ses->prepare_id = replay_get4(ses->peek + REPLAY_HEADER_LEN + 1);
+        }
+
+        /** The replies are not pipelined, so the next data starts a new reply */
+        ses->peek_len = 0;
+    }
+}
+
+/**
+ * Wait for the replies to the commands that were sent
+ *
+ * @param ses The session
+ */
+static void replay_wait_idle(REPLAY_SESSION *ses)
+{
+    while (ses->replies.count > 0 && !ses->broken && !replay_stopped())
+    {
+        replay_read(ses);
+    }
+}
+
+/**
+ * Write a packet to the server
+ *
+ * @param ses  The session
+ * @param data The packet
+ * @param len  Length of the packet
+ */
+static void replay_write(REPLAY_SESSION *ses, const uint8_t *data, size_t len)
+{
+    while (len > 0 && !ses->broken)
+    {
+        ssize_t rc = write(ses->fd, data, len);
+
+        if (rc < 0)
+        {
+            if (errno == EAGAIN)
+            {
+                struct pollfd pfd = {ses->fd, POLLOUT};
+                poll(&pfd, 1, REPLAY_MAX_SLEEP / 1000);
+            }
+            else if (errno != EINTR)
+            {
+                replay_report_error(ses, "Write failed");
+                ses->broken = true;
+            }
+            continue;
+        }
+
+        data += rc;
+        len -= rc;
+    }
+}
+
+/**
+ * Find a prepared statement by its captured ID
+ *
+ * @param ses The session
+ * @param id  The captured ID
+ * @return The statement or NULL if it is not known
+ */
+static REPLAY_PS* replay_find_ps(REPLAY_SESSION *ses, uint32_t id)
+{
+    for (int i = ses->n_ps - 1; i >= 0; i--)
+    {
+        if (ses->ps[i].original == id)
+        {
+            return &ses->ps[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Record the ID the server gave to the latest prepare
+ *
+ * @param ses The session
+ * @param id  The captured ID of the statement
+ */
+static void replay_prepared(REPLAY_SESSION *ses, uint32_t id)
+{
+    replay_wait_idle(ses);
+
+    if (ses->prepare_ok && ses->last_prepare >= 0)
+    {
+        if (ses->n_ps == ses->ps_size)
+        {
+            int size = ses->ps_size ? ses->ps_size * 2 : 16;
+            REPLAY_PS *ps = realloc(ses->ps, size * sizeof(REPLAY_PS));
+
+            if (ps == NULL)
+            {
+                return;
+            }
+
+            ses->ps = ps;
+            ses->ps_size = size;
+        }
+
+        REPLAY_STMT *stmt = &ses->stmts[ses->last_prepare];
+        REPLAY_PS *ps = &ses->ps[ses->n_ps++];
+        ps->original = id;
+        ps->replay = ses->prepare_id;
+        ps->digest = stmt->digest;
+        ps->sql = stmt->sql;
+        ps->sql_len = stmt->sql_len;
+        ses->prepare_ok = false;
+    }
+}
+
+/**
+ * Create the statement of a command
+ *
+ * @param ses    The session
+ * @param packet The first packet of the command
+ * @param len    Length of the packet
+ * @return The statement
+ */
+static REPLAY_STMT* replay_new_stmt(REPLAY_SESSION *ses, uint8_t *packet, size_t len)
+{
+    REPLAY_STMT *stmt = &ses->stmts[ses->n_stmts++];
+    uint8_t command = packet[REPLAY_HEADER_LEN];
+
+    memset(stmt, 0, sizeof(*stmt));
+    stmt->command = command;
+    stmt->original = -1;
+    stmt->replay = -1;
+
+    if (command == MYSQL_COM_QUERY || command == MYSQL_COM_STMT_PREPARE)
+    {
+        GWBUF *buf = gwbuf_alloc_and_load(len, packet);
+
+        if (buf)
+        {
+            modutil_get_canonical_digest(buf, &stmt->digest);
+            gwbuf_free(buf);
+        }
+
+        stmt->sql = packet + REPLAY_HEADER_LEN + 1;
+        stmt->sql_len = len - REPLAY_HEADER_LEN - 1;
+    }
+    else if (command == MYSQL_COM_STMT_EXECUTE && len >= REPLAY_HEADER_LEN + 5)
+    {
+        REPLAY_PS *ps = replay_find_ps(ses, replay_get4(packet + REPLAY_HEADER_LEN + 1));
+
+        if (ps)
+        {
+            stmt->digest = ps->digest;
+            stmt->sql = ps->sql;
+            stmt->sql_len = ps->sql_len;
+        }
+    }
+
+    return stmt;
+}
+
+/**
+ * Send the packets of a record
+ *
+ * @param ses The session
+ * @param ev  The record
+ */
+static void replay_packets(REPLAY_SESSION *ses, REPLAY_EVENT *ev)
+{
+    size_t offset = 0;
+
+    while (offset + REPLAY_HEADER_LEN < ev->length && !ses->broken && !replay_stopped())
+    {
+        uint8_t *packet = ev->data + offset;
+        size_t len = REPLAY_HEADER_LEN + replay_get3(packet);
+
+        if (offset + len > ev->length)
+        {
+            len = ev->length - offset;
+        }
+
+        offset += len;
+
+        if (packet[3] != 0)
+        {
+            /** The rest of a large packet or LOAD DATA LOCAL INFILE data */
+            replay_write(ses, packet, len);
+            continue;
+        }
+
+        uint8_t command = packet[REPLAY_HEADER_LEN];
+
+        if (command == MYSQL_COM_QUIT)
+        {
+            /** The connection is closed at the end of the session */
+            continue;
+        }
+
+        REPLAY_STMT *stmt = NULL;
+        bool reply = command != MYSQL_COM_STMT_CLOSE && command != MYSQL_COM_STMT_SEND_LONG_DATA;
+
+        if (reply)
+        {
+            stmt = replay_new_stmt(ses, packet, len);
+            stmt->captured = ev->timestamp;
+            ses->orig_pending[ses->orig_tail++] = stmt - ses->stmts;
+        }
+
+        if (command == MYSQL_COM_CHANGE_USER)
+        {
+            /** The authentication can't be replayed */
+            __atomic_add_fetch(&replay_n_skipped, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        replay_wait_idle(ses);
+        replay_sleep_until(ev->timestamp);
+
+        if ((command == MYSQL_COM_STMT_EXECUTE || command == MYSQL_COM_STMT_CLOSE ||
+             command == MYSQL_COM_STMT_RESET || command == MYSQL_COM_STMT_SEND_LONG_DATA ||
+             command == MYSQL_COM_STMT_FETCH) && len >= REPLAY_HEADER_LEN + 5)
+        {
+            REPLAY_PS *ps = replay_find_ps(ses, replay_get4(packet + REPLAY_HEADER_LEN + 1));
+
+            if (ps)
+            {
+                replay_set4(packet + REPLAY_HEADER_LEN + 1, ps->replay);
+            }
+        }
+
+        if (reply)
+        {
+            if (!modutil_reply_queue_push(&ses->replies, command))
+            {
+                ses->broken = true;
+                break;
+            }
+
+            stmt->replayed = true;
+            stmt->sent = mxs_clock_us();
+            ses->replay_pending[ses->replay_tail++] = stmt - ses->stmts;
+            ses->peek_len = 0;
+
+            if (command == MYSQL_COM_STMT_PREPARE)
+            {
+                ses->last_prepare = stmt - ses->stmts;
+                ses->prepare_ok = false;
+            }
+        }
+
+        replay_write(ses, packet, len);
+    }
+}
+
+/**
+ * Count the commands of a session that get a reply
+ *
+ * @param ses The session
+ * @return Number of commands
+ */
+static int replay_count_stmts(REPLAY_SESSION *ses)
+{
+    int count = 0;
+
+    for (int i = 0; i < ses->n_events; i++)
+    {
+        REPLAY_EVENT *ev = &ses->events[i];
+        size_t offset = 0;
+
+        while (ev->type == CAPTURE_PACKET && offset + REPLAY_HEADER_LEN < ev->length)
+        {
+            const uint8_t *packet = ev->data + offset;
+
+            if (packet[3] == 0)
+            {
+                count++;
+            }
+
+            offset += REPLAY_HEADER_LEN + replay_get3(packet);
+        }
+    }
+
+    return count;
+}
+
+/**
+ * Add the statements of a finished session to the results
+ *
+ * @param ses The session
+ */
+static void replay_collect(REPLAY_SESSION *ses)
+{
+    pthread_mutex_lock(&replay_lock);
+
+    REPLAY_STMT *results = realloc(replay_results, (replay_n_results + ses->n_stmts) * sizeof(REPLAY_STMT));
+
+    if (results)
+    {
+        replay_results = results;
+
+        for (int i = 0; i < ses->n_stmts; i++)
+        {
+            if (ses->stmts[i].replayed)
+            {
+                replay_results[replay_n_results++] = ses->stmts[i];
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&replay_lock);
+}
+
+/**
+ * Replay a session
+ *
+ * @param ses The session
+ */
+static void replay_session(REPLAY_SESSION *ses)
+{
+    int n_stmts = replay_count_stmts(ses);
+    unsigned int local_infile = 1;
+
+    ses->last_prepare = -1;
+    ses->stmts = malloc((n_stmts + 1) * sizeof(REPLAY_STMT));
+    ses->orig_pending = malloc((n_stmts + 1) * sizeof(int));
+    ses->replay_pending = malloc((n_stmts + 1) * sizeof(int));
+
+    if (ses->stmts == NULL || ses->orig_pending == NULL || ses->replay_pending == NULL ||
+        (ses->mysql = mysql_init(NULL)) == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        __atomic_add_fetch(&replay_n_failed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    mysql_options(ses->mysql, MYSQL_OPT_LOCAL_INFILE, &local_infile);
+
+    if (mysql_real_connect(ses->mysql, replay_opts.host, replay_opts.user ? replay_opts.user : ses->user,
+                           replay_opts.password, *ses->db ? ses->db : NULL, replay_opts.port,
+                           replay_opts.socket, CLIENT_MULTI_STATEMENTS | CLIENT_MULTI_RESULTS) == NULL)
+    {
+        replay_report_error(ses, "Failed to connect");
+        __atomic_add_fetch(&replay_n_failed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    ses->fd = mysql_get_socket(ses->mysql);
+
+    for (int i = 1; i < ses->n_events && !ses->broken && !ses->done && !replay_stopped(); i++)
+    {
+        REPLAY_EVENT *ev = &ses->events[i];
+
+        switch (ev->type)
+        {
+        case CAPTURE_PACKET:
+            replay_packets(ses, ev);
+            break;
+
+        case CAPTURE_PREPARED:
+            if (ev->length >= sizeof(uint32_t))
+            {
+                replay_prepared(ses, replay_get4(ev->data));
+            }
+            break;
+
+        case CAPTURE_REPLY:
+            for (uint32_t n = ev->length >= sizeof(uint32_t) ? replay_get4(ev->data) : 0;
+                 n > 0 && ses->orig_head < ses->orig_tail; n--)
+            {
+                REPLAY_STMT *stmt = &ses->stmts[ses->orig_pending[ses->orig_head++]];
+                stmt->original = ev->timestamp - stmt->captured;
+            }
+            break;
+
+        case CAPTURE_DROPPED:
+            __atomic_add_fetch(&replay_n_truncated, 1, __ATOMIC_RELAXED);
+            ses->done = true;
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    replay_wait_idle(ses);
+    replay_collect(ses);
+}
+
+static void* replay_thread_main(void *data)
+{
+    REPLAY_SESSION *ses = (REPLAY_SESSION*)data;
+
+    replay_session(ses);
+
+    if (ses->mysql)
+    {
+        mysql_close(ses->mysql);
+    }
+
+    modutil_reply_queue_free(&ses->replies);
+    free(ses->stmts);
+    free(ses->orig_pending);
+    free(ses->replay_pending);
+    free(ses->ps);
+    mysql_thread_end();
+
+    pthread_mutex_lock(&replay_lock);
+    replay_running--;
+    pthread_cond_signal(&replay_done);
+    pthread_mutex_unlock(&replay_lock);
+    return NULL;
+}
+
+static int replay_compare_events(const void *a, const void *b)
+{
+    const REPLAY_EVENT *l = (const REPLAY_EVENT*)a;
+    const REPLAY_EVENT *r = (const REPLAY_EVENT*)b;
+
+    if (l->session != r->session)
+    {
+        return l->session < r->session ? -1 : 1;
+    }
+    else if (l->timestamp != r->timestamp)
+    {
+        return l->timestamp < r->timestamp ? -1 : 1;
+    }
+
+    return l->order < r->order ? -1 : l->order > r->order;
+}
+
+static int replay_compare_sessions(const void *a, const void *b)
+{
+    const REPLAY_SESSION *l = (const REPLAY_SESSION*)a;
+    const REPLAY_SESSION *r = (const REPLAY_SESSION*)b;
+
+    return l->events[0].timestamp < r->events[0].timestamp ? -1 :
+           l->events[0].timestamp > r->events[0].timestamp;
+}
+
+/**
+ * Check that a record is the start of a session
+ *
+ * @param ev The first record of a session
+ * @return True if the record contains the user and the default database
+ */
+static bool replay_connect_valid(const REPLAY_EVENT *ev)
+{
+    const uint8_t *end = ev->type == CAPTURE_CONNECT ? memchr(ev->data, '\0', ev->length) : NULL;
+
+    return end && memchr(end + 1, '\0', ev->data + ev->length - end - 1);
+}
+
+/**
+ * Read a capture file and split it into sessions
+ *
+ * @param path       The capture file
+ * @param events     The records are stored here
+ * @param sessions   The sessions are stored here in the order they were started
+ * @param n_sessions Number of sessions
+ * @return True on success
+ */
+static bool replay_load(const char *path, REPLAY_EVENT **events,
+                        REPLAY_SESSION **sessions, int *n_sessions)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+
+    if (fd == -1 || fstat(fd, &st) == -1)
+    {
+        fprintf(stderr, "Failed to open '%s': %s\n", path, strerror(errno));
+        return false;
+    }
+
+    size_t size = st.st_size;
+    /** The statement IDs are replaced in place, the file is not modified */
+    uint8_t *data = size ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+
+    CAPTURE_FILE_HEADER header;
+
+    if (data == MAP_FAILED || size < sizeof(header) ||
+        (memcpy(&header, data, sizeof(header)), memcmp(header.magic, CAPTURE_MAGIC, sizeof(header.magic))) ||
+        header.version != CAPTURE_VERSION)
+    {
+        fprintf(stderr, "'%s' is not a capture file\n", path);
+        return false;
+    }
+
+    size_t n_events = 0;
+    size_t events_size = 0;
+    REPLAY_EVENT *ev = NULL;
+    size_t offset = sizeof(header);
+
+    while (offset + sizeof(CAPTURE_RECORD) <= size)
+    {
+        CAPTURE_RECORD record;
+        memcpy(&record, data + offset, sizeof(record));
+
+        if (offset + sizeof(record) + record.length > size)
+        {
+            fprintf(stderr, "The last record of '%s' is incomplete\n", path);
+            break;
+        }
+
+        if (n_events == events_size)
+        {
+            events_size = events_size ? events_size * 2 : 1024;
+
+            if ((ev = realloc(ev, events_size * sizeof(REPLAY_EVENT))) == NULL)
+            {
+                fprintf(stderr, "Out of memory\n");
+                return false;
+            }
+        }
+
+        ev[n_events].session = record.session;
+        ev[n_events].timestamp = record.timestamp;
+        ev[n_events].order = n_events;
+        ev[n_events].length = record.length;
+        ev[n_events].type = record.type;
+        ev[n_events].data = data + offset + sizeof(record);
+        n_events++;
+        offset += sizeof(record) + record.length;
+    }
+
+    qsort(ev, n_events, sizeof(REPLAY_EVENT), replay_compare_events);
+
+    REPLAY_SESSION *ses = NULL;
+    int n = 0;
+    int ses_size = 0;
+    int incomplete = 0;
+
+    for (size_t i = 0; i < n_events;)
+    {
+        size_t end = i;
+
+        while (end < n_events && ev[end].session == ev[i].session)
+        {
+            end++;
+        }
+
+        /** Sessions whose start was not captured can't be replayed */
+        if (replay_connect_valid(&ev[i]))
+        {
+            if (n == ses_size)
+            {
+                ses_size = ses_size ? ses_size * 2 : 16;
+
+                if ((ses = realloc(ses, ses_size * sizeof(REPLAY_SESSION))) == NULL)
+                {
+                    fprintf(stderr, "Out of memory\n");
+                    return false;
+                }
+            }
+
+            memset(&ses[n], 0, sizeof(REPLAY_SESSION));
+            ses[n].events = &ev[i];
+            ses[n].n_events = end - i;
+            ses[n].user = (const char*)ev[i].data;
+            ses[n].db = ses[n].user + strlen(ses[n].user) + 1;
+
+            if (n == 0 || ev[i].timestamp < replay_origin)
+            {
+                replay_origin = ev[i].timestamp;
+            }
+            n++;
+        }
+        else
+        {
+            incomplete++;
+        }
+
+        i = end;
+    }
+
+    if (incomplete)
+    {
+        printf("Skipping %d sessions whose start was not captured\n", incomplete);
+    }
+
+    qsort(ses, n, sizeof(REPLAY_SESSION), replay_compare_sessions);
+
+    *events = ev;
+    *sessions = ses;
+    *n_sessions = n;
+    return true;
+}
+
+/**
+ * Start a thread for each session at the time the session was started
+ *
+ * @param sessions   The sessions in the order they were started
+ * @param n_sessions Number of sessions
+ * @return True if all sessions were started
+ */
+static bool replay_run(REPLAY_SESSION *sessions, int n_sessions)
+{
+    pthread_attr_t attr;
+    bool ok = true;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&attr, REPLAY_STACK_SIZE);
+
+    replay_start = mxs_clock_us();
+
+    for (int i = 0; i < n_sessions && !replay_stopped(); i++)
+    {
+        pthread_t thr;
+
+        replay_sleep_until(sessions[i].events[0].timestamp);
+
+        pthread_mutex_lock(&replay_lock);
+        replay_running++;
+        pthread_mutex_unlock(&replay_lock);
+
+        if (pthread_create(&thr, &attr, replay_thread_main, &sessions[i]) != 0)
+        {
+            fprintf(stderr, "Failed to start a thread: %s\n", strerror(errno));
+            pthread_mutex_lock(&replay_lock);
+            replay_running--;
+            pthread_mutex_unlock(&replay_lock);
+            ok = false;
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&replay_lock);
+
+    while (replay_running > 0)
+    {
+        pthread_cond_wait(&replay_done, &replay_lock);
+    }
+
+    pthread_mutex_unlock(&replay_lock);
+    pthread_attr_destroy(&attr);
+    return ok;
+}
+
+static const char* replay_command_name(uint8_t command)
+{
+    switch (command)
+    {
+    case MYSQL_COM_INIT_DB:
+        return "COM_INIT_DB";
+    case MYSQL_COM_FIELD_LIST:
+        return "COM_FIELD_LIST";
+    case MYSQL_COM_STATISTICS:
+        return "COM_STATISTICS";
+    case MYSQL_COM_PING:
+        return "COM_PING";
+    case MYSQL_COM_STMT_RESET:
+        return "COM_STMT_RESET";
+    case MYSQL_COM_SET_OPTION:
+        return "COM_SET_OPTION";
+    case MYSQL_COM_STMT_FETCH:
+        return "COM_STMT_FETCH";
+    default:
+        return "COM_OTHER";
+    }
+}
+
+static uint64_t replay_key(const REPLAY_STMT *stmt)
+{
+    return stmt->sql ? stmt->digest : REPLAY_KEY_COMMAND | stmt->command;
+}
+
+static int replay_compare_results(const void *a, const void *b)
+{
+    const REPLAY_STMT *l = (const REPLAY_STMT*)a;
+    const REPLAY_STMT *r = (const REPLAY_STMT*)b;
+    uint64_t lkey = replay_key(l);
+    uint64_t rkey = replay_key(r);
+
+    if (lkey != rkey)
+    {
+        return lkey < rkey ? -1 : 1;
+    }
+
+    return l->command < r->command ? -1 : l->command > r->command;
+}
+
+static int replay_compare_digests(const void *a, const void *b)
+{
+    const REPLAY_DIGEST *l = *(const REPLAY_DIGEST**)a;
+    const REPLAY_DIGEST *r = *(const REPLAY_DIGEST**)b;
+
+    return l->replay_sum > r->replay_sum ? -1 : l->replay_sum < r->replay_sum;
+}
+
+/**
+ * Print a statement sample on one line
+ *
+ * @param digest The statements
+ */
+static void replay_print_sql(const REPLAY_DIGEST *digest)
+{
+    if (digest->command == MYSQL_COM_STMT_PREPARE)
+    {
+        printf("PREPARE ");
+    }
+    else if (digest->command == MYSQL_COM_STMT_EXECUTE)
+    {
+        printf("EXECUTE ");
+    }
+
+    if (digest->sql)
+    {
+        for (uint32_t i = 0; i < digest->sql_len && i < REPLAY_SQL_SAMPLE; i++)
+        {
+            char c = digest->sql[i];
+            putchar(c == '\n' || c == '\r' || c == '\t' ? ' ' : c);
+        }
+
+        if (digest->sql_len > REPLAY_SQL_SAMPLE)
+        {
+            printf("...");
+        }
+    }
+    else
+    {
+        printf("%s", digest->command == MYSQL_COM_STMT_EXECUTE ? "<unknown statement>" :
+               replay_command_name(digest->command));
+    }
+
+    putchar('\n');
+}
+
+static double replay_ms(uint64_t us)
+{
+    return us / 1000.0;
+}
+
+/**
+ * Print the latencies of the statements
+ *
+ * @param n_sessions Number of sessions
+ * @param elapsed  Duration of the replay in microseconds
+ * @param original Duration of the capture in microseconds
+ */
+static void replay_report(int n_sessions, uint64_t elapsed, uint64_t original)
+{
+    REPLAY_DIGEST *digests = calloc(replay_n_results ? replay_n_results : 1, sizeof(REPLAY_DIGEST));
+    REPLAY_DIGEST **sorted = calloc(replay_n_results ? replay_n_results : 1, sizeof(REPLAY_DIGEST*));
+    size_t n_digests = 0;
+
+    if (digests == NULL || sorted == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return;
+    }
+
+    qsort(replay_results, replay_n_results, sizeof(REPLAY_STMT), replay_compare_results);
+
+    uint64_t errors = 0;
+
+    for (size_t i = 0; i < replay_n_results; i++)
+    {
+        REPLAY_STMT *stmt = &replay_results[i];
+        REPLAY_DIGEST *d = n_digests ? &digests[n_digests - 1] : NULL;
+
+        if (d == NULL || d->key != replay_key(stmt) || d->command != stmt->command)
+        {
+            d = &digests[n_digests++];
+            d->key = replay_key(stmt);
+            d->command = stmt->command;
+            d->sql = stmt->sql;
+            d->sql_len = stmt->sql_len;
+        }
+
+        if (stmt->replay >= 0 && stmt->original >= 0)
+        {
+            d->count++;
+            d->orig_sum += stmt->original;
+            d->replay_sum += stmt->replay;
+            histogram_add(&d->orig, stmt->original);
+            histogram_add(&d->replay, stmt->replay);
+        }
+
+        if (stmt->error)
+        {
+            d->errors++;
+            errors++;
+        }
+    }
+
+    printf("Sessions: %d, failed to connect: %d, truncated: %d\n",
+           n_sessions, replay_n_failed, replay_n_truncated);
+    printf("Statements: %zu, errors: %" PRIu64 ", skipped: %" PRIu64 "\n",
+           replay_n_results, errors, replay_n_skipped);
+    printf("Duration: original %.3f s, replay %.3f s\n\n",
+           original / 1000000.0, elapsed / 1000000.0);
+
+    for (size_t i = 0; i < n_digests; i++)
+    {
+        sorted[i] = &digests[i];
+    }
+
+    qsort(sorted, n_digests, sizeof(REPLAY_DIGEST*), replay_compare_digests);
+
+    printf("%10s %11s %11s %11s %11s %8s %7s  %s\n", "Count", "Orig avg", "Orig p99",
+           "Replay avg", "Replay p99", "Change", "Errors", "Statement");
+
+    for (size_t i = 0; i < n_digests && (replay_opts.top == 0 || (int)i < replay_opts.top); i++)
+    {
+        REPLAY_DIGEST *d = sorted[i];
+
+        if (d->count == 0)
+        {
+            continue;
+        }
+
+        double orig_avg = (double)d->orig_sum / d->count;
+        double replay_avg = (double)d->replay_sum / d->count;
+
+        printf("%10" PRIu64 " %8.3f ms %8.3f ms %8.3f ms %8.3f ms %+7.1f%% %7" PRIu64 "  ",
+               d->count, orig_avg / 1000, replay_ms(histogram_percentile(&d->orig, 99)),
+               replay_avg / 1000, replay_ms(histogram_percentile(&d->replay, 99)),
+               orig_avg > 0 ? (replay_avg - orig_avg) * 100 / orig_avg : 0.0, d->errors);
+        replay_print_sql(d);
+    }
+
+    free(sorted);
+    free(digests);
+}
+
+static struct option long_options[] =
+{
+    {"host", required_argument, 0, 'h'},
+    {"port", required_argument, 0, 'P'},
+    {"socket", required_argument, 0, 'S'},
+    {"user", required_argument, 0, 'u'},
+    {"password", required_argument, 0, 'p'},
+    {"speed", required_argument, 0, 's'},
+    {"top", required_argument, 0, 'n'},
+    {"help", no_argument, 0, '?'},
+    {0, 0, 0, 0}
+};
+
+static void replay_usage(const char *name)
+{
+    printf("usage: %s [options] FILE\n\n"
+           "  -h, --host=HOST           Host to connect to (default: 127.0.0.1)\n"
+           "  -P, --port=PORT           Port to connect to (default: 4006)\n"
+           "  -S, --socket=PATH         UNIX domain socket to connect to\n"
+           "  -u, --user=USER           Connect all sessions as this user (default: the captured user)\n"
+           "  -p, --password=PASSWORD   Password of the users (default: empty)\n"
+           "  -s, --speed=FACTOR        Replay this many times faster, 0 for no waits (default: 1)\n"
+           "  -n, --top=N               Statements in the report, 0 for all (default: 20)\n"
+           "  -?, --help                Print this help and exit\n", name);
+}
+
+static double replay_number(const char *arg)
+{
+    char *end;
+    double value = strtod(arg, &end);
+
+    if (*arg == '\0' || *end || value < 0)
+    {
+        fprintf(stderr, "Invalid number: %s\n", arg);
+        exit(EXIT_FAILURE);
+    }
+
+    return value;
+}
+
+int main(int argc, char **argv)
+{
+    int c;
+
+    while ((c = getopt_long(argc, argv, "h:P:S:u:p:s:n:?", long_options, NULL)) >= 0)
+    {
+        switch (c)
+        {
+        case 'h':
+            replay_opts.host = optarg;
+            break;
+
+        case 'P':
+            replay_opts.port = (int)replay_number(optarg);
+            break;
+
+        case 'S':
+            replay_opts.socket = optarg;
+            break;
+
+        case 'u':
+            replay_opts.user = optarg;
+            break;
+
+        case 'p':
+            replay_opts.password = optarg;
+            break;
+
+        case 's':
+            replay_opts.speed = replay_number(optarg);
+            break;
+
+        case 'n':
+            replay_opts.top = (int)replay_number(optarg);
+            break;
+
+        default:
+            replay_usage(argv[0]);
+            return optopt ? EXIT_FAILURE : EXIT_SUCCESS;
+        }
+    }
+
+    if (optind != argc - 1)
+    {
+        replay_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    REPLAY_EVENT *events;
+    REPLAY_SESSION *sessions;
+    int n_sessions;
+
+    if (!replay_load(argv[optind], &events, &sessions, &n_sessions))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (mysql_library_init(0, NULL, NULL))
+    {
+        fprintf(stderr, "Failed to initialize the connector\n");
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGINT, replay_interrupt);
+    signal(SIGPIPE, SIG_IGN);
+
+    uint64_t original = 0;
+
+    for (int i = 0; i < n_sessions; i++)
+    {
+        REPLAY_SESSION *ses = &sessions[i];
+        uint64_t end = ses->events[ses->n_events - 1].timestamp - replay_origin;
+
+        if (end > original)
+        {
+            original = end;
+        }
+    }
+
+    bool ok = replay_run(sessions, n_sessions);
+    replay_report(n_sessions, mxs_clock_us() - replay_start, original);
+
+    mysql_library_end();
+    free(replay_results);
+    free(sessions);
+    free(events);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
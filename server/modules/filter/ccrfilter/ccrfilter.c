@@ -23,6 +23,9 @@
 #include <maxscale/query_classifier.h>
 #include <regex.h>
 #include <maxscale/alloc.h>
+#include <maxscale/protocol/mysql.h>
+#include <maxscale/server.h>
+#include <maxscale/service.h>
 
 /**
  * @file ccrfilter.c - a very simple filter designed to send queries to the
@@ -38,6 +41,7 @@
  *      time=<time period>          Seconds to wait before queries are routed to slaves.
  *      match=<regex>               Regex for matching
  *      ignore=<regex>              Regex for ignoring
+ *      gtid=<true|false>           End the time period once the slaves have the write
  *
  * The filter also has two options:
  *     @c case, which makes the regex case-sensitive, and
@@ -54,17 +58,24 @@ static  MXS_FILTER_SESSION *newSession(MXS_FILTER *instance, MXS_SESSION *sessio
 static  void   closeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session);
 static  void   freeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session);
 static  void   setDownstream(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, MXS_DOWNSTREAM *downstream);
+static  void   setUpstream(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, MXS_UPSTREAM *upstream);
 static  int    routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, GWBUF *queue);
+static  int    clientReply(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, GWBUF *reply);
 static  void   diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb);
 static uint64_t getCapabilities(MXS_FILTER* instance);
 
 #define CCR_DEFAULT_TIME "60"
 
+/** The system variable that contains the GTID of the latest transaction */
+#define CCR_LAST_GTID "last_gtid"
+
 typedef struct lagstats
 {
     int n_add_count;  /*< No. of statements diverted based on count */
     int n_add_time;   /*< No. of statements diverted based on time */
     int n_modified;   /*< No. of statements not diverted */
+    int n_add_gtid;   /*< No. of statements routed to a slave that has the write */
+    int n_caught_up;  /*< No. of times all slaves replicated the write before the time ran out */
 } LAGSTATS;
 
 /**
@@ -79,6 +90,8 @@ typedef struct
                       * is done. */
     int count;       /*< Number of hints to add after each operation
                      * that modifies data. */
+    bool gtid;       /*< End the time period once the slaves have replicated
+                      * the GTID of the write */
     LAGSTATS stats;
     regex_t re;      /* Compiled regex text of match */
     regex_t nore;    /* Compiled regex text of ignore */
@@ -89,9 +102,14 @@ typedef struct
  */
 typedef struct
 {
-    MXS_DOWNSTREAM down;              /*< The downstream filter */
-    int            hints_left;        /*< Number of hints left to add to queries*/
-    time_t         last_modification; /*< Time of the last data modifying operation */
+    MXS_DOWNSTREAM  down;              /*< The downstream filter */
+    MXS_UPSTREAM    up;                /*< The upstream filter */
+    MXS_SESSION     *session;          /*< The session */
+    int             hints_left;        /*< Number of hints left to add to queries*/
+    time_t          last_modification; /*< Time of the last data modifying operation */
+    char            *gtid;             /*< GTID of the last write, in GTID mode */
+    MXS_REPLY_QUEUE replies;           /*< Follows the replies to find the OK packets */
+    GWBUF           *residue;          /*< Start of a reply packet that is not complete */
 } CCR_SESSION;
 
 static const MXS_ENUM_VALUE option_values[] =
@@ -119,9 +137,9 @@ MXS_MODULE* MXS_CREATE_MODULE()
         closeSession,
         freeSession,
         setDownstream,
-        NULL,               // No Upstream requirement
+        setUpstream,
         routeQuery,
-        NULL, // No clientReply
+        clientReply,
         diagnostic,
         getCapabilities,
         NULL, // No destroyInstance
@@ -133,7 +151,7 @@ MXS_MODULE* MXS_CREATE_MODULE()
         MXS_MODULE_GA,
         MXS_FILTER_VERSION,
         "A routing hint filter that send queries to the master after data modification",
-        "V1.1.0",
+        "V1.2.0",
         &MyObject,
         NULL, /* Process init. */
         NULL, /* Process finish. */
@@ -144,6 +162,7 @@ MXS_MODULE* MXS_CREATE_MODULE()
             {"time", MXS_MODULE_PARAM_COUNT, CCR_DEFAULT_TIME},
             {"match", MXS_MODULE_PARAM_STRING},
             {"ignore", MXS_MODULE_PARAM_STRING},
+            {"gtid", MXS_MODULE_PARAM_BOOL, "false"},
             {
              "options",
              MXS_MODULE_PARAM_ENUM,
@@ -177,6 +196,7 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
     {
         my_instance->count = config_get_integer(params, "count");
         my_instance->time = config_get_integer(params, "time");
+        my_instance->gtid = config_get_bool(params, "gtid");
         my_instance->stats.n_add_count = 0;
         my_instance->stats.n_add_time = 0;
         my_instance->stats.n_modified = 0;
@@ -214,10 +234,11 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
 static MXS_FILTER_SESSION *
 newSession(MXS_FILTER *instance, MXS_SESSION *session)
 {
-    CCR_SESSION  *my_session = MXS_MALLOC(sizeof(CCR_SESSION));
+    CCR_SESSION  *my_session = MXS_CALLOC(1, sizeof(CCR_SESSION));
 
     if (my_session)
     {
+        my_session->session = session;
         my_session->hints_left = 0;
         my_session->last_modification = 0;
     }
@@ -246,6 +267,11 @@ closeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session)
 static void
 freeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session)
 {
+    CCR_SESSION *my_session = (CCR_SESSION *)session;
+
+    MXS_FREE(my_session->gtid);
+    modutil_reply_queue_free(&my_session->replies);
+    gwbuf_free(my_session->residue);
     MXS_FREE(session);
 }
 
@@ -264,6 +290,78 @@ setDownstream(MXS_FILTER *instance, MXS_FILTER_SESSION *session, MXS_DOWNSTREAM
     my_session->down = *downstream;
 }
 
+/**
+ * Set the upstream component for this filter.
+ *
+ * @param instance  The filter instance data
+ * @param session   The filter session
+ * @param upstream  The upstream filter or client
+ */
+static void
+setUpstream(MXS_FILTER *instance, MXS_FILTER_SESSION *session, MXS_UPSTREAM *upstream)
+{
+    CCR_SESSION *my_session = (CCR_SESSION *)session;
+
+    my_session->up = *upstream;
+}
+
+/**
+ * Route a read that follows a write, in GTID mode
+ *
+ * The read is routed to the least loaded slave that has replicated the write
+ * or to the master if none has. Once all slaves have replicated the write,
+ * the read is routed as if no write had been done.
+ *
+ * @param my_instance The filter instance
+ * @param my_session  The filter session
+ * @param queue       The read
+ */
+static void
+route_by_gtid(CCR_INSTANCE *my_instance, CCR_SESSION *my_session, GWBUF *queue)
+{
+    SERVER *target = NULL;
+    bool all_slaves = true;
+
+    for (SERVER_REF *ref = my_session->session->service->dbref; ref; ref = ref->next)
+    {
+        if (SERVER_REF_IS_ACTIVE(ref) && SERVER_IS_SLAVE(ref->server))
+        {
+            if (server_gtid_pos_reached(ref->server, my_session->gtid))
+            {
+                if (target == NULL || ref->server->load_score < target->load_score)
+                {
+                    target = ref->server;
+                }
+            }
+            else
+            {
+                all_slaves = false;
+            }
+        }
+    }
+
+    if (target && all_slaves)
+    {
+        MXS_INFO("All slaves have replicated GTID %s", my_session->gtid);
+        MXS_FREE(my_session->gtid);
+        my_session->gtid = NULL;
+        my_session->last_modification = 0;
+        my_instance->stats.n_caught_up++;
+    }
+    else if (target)
+    {
+        queue->hint = hint_create_route(queue->hint, HINT_ROUTE_TO_NAMED_SERVER, target->unique_name);
+        my_instance->stats.n_add_gtid++;
+        MXS_INFO("Slave '%s' has replicated GTID %s", target->unique_name, my_session->gtid);
+    }
+    else
+    {
+        queue->hint = hint_create_route(queue->hint, HINT_ROUTE_TO_MASTER, NULL);
+        my_instance->stats.n_add_time++;
+        MXS_INFO("No slave has replicated GTID %s", my_session->gtid);
+    }
+}
+
 /**
  * The routeQuery entry point. This is passed the query buffer
  * to which the filter should be applied. Once applied the
@@ -283,7 +381,8 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
 {
     CCR_INSTANCE *my_instance = (CCR_INSTANCE *)instance;
     CCR_SESSION  *my_session = (CCR_SESSION *)session;
-    char *sql;
+    const char *sql;
+    size_t sql_len;
     regmatch_t limits[] = {{0, 0}};
     time_t now = time(NULL);
 
@@ -295,8 +394,10 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
          */
         if (qc_query_is_type(qc_get_type_mask(queue), QUERY_TYPE_WRITE))
         {
-            if (modutil_extract_SQL(queue, &sql, &limits[0].rm_eo))
+            if (modutil_get_query_view(queue, &sql, &sql_len))
             {
+                limits[0].rm_eo = sql_len;
+
                 if (my_instance->nomatch == NULL ||
                     (my_instance->nomatch && regexec(&my_instance->nore, sql, 0, limits, REG_STARTEND) != 0))
                 {
@@ -309,7 +410,7 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
                             MXS_INFO("Write operation detected, next %d queries routed to master", my_instance->count);
                         }
 
-                        if (my_instance->time)
+                        if (my_instance->time || my_instance->gtid)
                         {
                             my_session->last_modification = now;
                             MXS_INFO("Write operation detected, queries routed to master for %d seconds", my_instance->time);
@@ -327,6 +428,12 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
             my_instance->stats.n_add_count++;
             MXS_INFO("%d queries left", my_instance->time);
         }
+        else if (my_session->gtid &&
+                 (my_instance->time == 0 ||
+                  difftime(now, my_session->last_modification) < my_instance->time))
+        {
+            route_by_gtid(my_instance, my_session, queue);
+        }
         else if (my_instance->time)
         {
             double dt = difftime(now, my_session->last_modification);
@@ -340,11 +447,92 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
         }
     }
 
+    if (my_instance->gtid && GWBUF_DATA(queue)[3] == 0)
+    {
+        /** Only the first packet of a command gets a reply */
+        modutil_reply_queue_push(&my_session->replies, MYSQL_GET_COMMAND(GWBUF_DATA(queue)));
+    }
+
     return my_session->down.routeQuery(my_session->down.instance,
                                        my_session->down.session,
                                        queue);
 }
 
+/**
+ * The clientReply entry point.
+ *
+ * In GTID mode, the GTID of the latest write is taken from the session state
+ * information of the OK packets, which is then removed as the client has not
+ * asked for it.
+ *
+ * @param instance  The filter instance data
+ * @param session   The filter session
+ * @param reply     The reply data
+ */
+static int
+clientReply(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *reply)
+{
+    CCR_INSTANCE *my_instance = (CCR_INSTANCE *)instance;
+    CCR_SESSION  *my_session = (CCR_SESSION *)session;
+    GWBUF *rval = NULL;
+
+    if (!my_instance->gtid)
+    {
+        return my_session->up.clientReply(my_session->up.instance,
+                                          my_session->up.session,
+                                          reply);
+    }
+
+    if (my_session->residue)
+    {
+        reply = gwbuf_append(my_session->residue, reply);
+        my_session->residue = NULL;
+    }
+
+    while (reply)
+    {
+        size_t n = modutil_reply_queue_process_to_ok(&my_session->replies, reply);
+
+        if (n > 0)
+        {
+            /** Packets that can't be OK packets are passed as such */
+            rval = gwbuf_append(rval, gwbuf_split(&reply, n));
+            continue;
+        }
+
+        uint8_t header[MYSQL_HEADER_LEN + 1];
+
+        if (gwbuf_copy_data(reply, 0, sizeof(header), header) != sizeof(header) ||
+            gwbuf_length(reply) < MYSQL_HEADER_LEN + gw_mysql_get_byte3(header))
+        {
+            /** Wait for the rest of the packet */
+            my_session->residue = reply;
+            break;
+        }
+
+        GWBUF *packet = modutil_get_next_MySQL_packet(&reply);
+        modutil_reply_queue_process(&my_session->replies, packet);
+
+        if (header[MYSQL_HEADER_LEN] == MYSQL_REPLY_OK)
+        {
+            char *gtid = NULL;
+            packet = modutil_ok_remove_session_state(packet, CCR_LAST_GTID, &gtid);
+
+            if (gtid)
+            {
+                MXS_FREE(my_session->gtid);
+                my_session->gtid = gtid;
+            }
+        }
+
+        rval = gwbuf_append(rval, packet);
+    }
+
+    return rval ? my_session->up.clientReply(my_session->up.instance,
+                                             my_session->up.session,
+                                             rval) : 1;
+}
+
 /**
  * Diagnostics routine
  *
@@ -363,6 +551,7 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
 
     dcb_printf(dcb, "Configuration:\n\tCount: %d\n", my_instance->count);
     dcb_printf(dcb, "\tTime: %d seconds\n", my_instance->time);
+    dcb_printf(dcb, "\tGTID: %s\n", my_instance->gtid ? "yes" : "no");
 
     if (my_instance->match)
     {
@@ -378,6 +567,13 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
     dcb_printf(dcb, "\tNo. of data modifications: %d\n", my_instance->stats.n_modified);
     dcb_printf(dcb, "\tNo. of hints added based on count: %d\n", my_instance->stats.n_add_count);
     dcb_printf(dcb, "\tNo. of hints added based on time: %d\n",  my_instance->stats.n_add_time);
+
+    if (my_instance->gtid)
+    {
+        dcb_printf(dcb, "\tNo. of hints added based on GTID: %d\n", my_instance->stats.n_add_gtid);
+        dcb_printf(dcb, "\tNo. of writes replicated by all slaves: %d\n",
+                   my_instance->stats.n_caught_up);
+    }
 }
 
 /**
@@ -387,5 +583,18 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
  */
 static uint64_t getCapabilities(MXS_FILTER* instance)
 {
-    return RCAP_TYPE_CONTIGUOUS_INPUT;
+    uint64_t rval = RCAP_TYPE_CONTIGUOUS_INPUT;
+
+    /** The GTIDs of the writes are read from the session state information */
+    if (instance && ((CCR_INSTANCE*)instance)->gtid)
+    {
+        rval |= RCAP_TYPE_SESSION_STATE_TRACKING;
+    }
+    else
+    {
+        /** Without GTIDs only the queries are inspected and the replies are not */
+        rval |= FCAP_TYPE_COM_QUERY | FCAP_TYPE_NO_REPLIES;
+    }
+
+    return rval;
 }
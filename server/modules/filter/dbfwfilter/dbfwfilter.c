@@ -67,11 +67,13 @@
 #include <string.h>
 #include <time.h>
 #include <assert.h>
+#include <ctype.h>
 #include <regex.h>
 #include <stdlib.h>
 
 #include <maxscale/filter.h>
 #include <maxscale/atomic.h>
+#include <maxscale/config.h>
 #include <maxscale/modulecmd.h>
 #include <maxscale/modutil.h>
 #include <maxscale/log_manager.h>
@@ -103,6 +105,8 @@ static void setDownstream(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, MX
 static int routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, GWBUF *queue);
 static void diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb);
 static uint64_t getCapabilities(MXS_FILTER* instance);
+static void *createThreadInstance(MXS_FILTER *instance, int thread_id);
+static void destroyThreadInstance(MXS_FILTER *instance, void *thread_instance);
 
 /**
  * Rule types
@@ -184,8 +188,12 @@ typedef struct queryspeed_t
     int                  limit; /*< Maximum number of queries */
     long                 id;    /*< Unique id of the rule */
     bool                 active; /*< If the rule has been triggered */
+    struct queryspeed_t *next;  /*< Next rule in the list of a session */
 } QUERYSPEED;
 
+/** Generator for the ids of limit_queries rules */
+static int queryspeed_id = 0;
+
 /**
  * A structure used to identify individual rules and to store their contents
  *
@@ -200,6 +208,10 @@ typedef struct rule_t
     qc_query_op_t  on_queries;  /*< Types of queries to inspect */
     int            times_matched; /*< Number of times this rule has been matched */
     TIMERANGE*     active;      /*< List of times when this rule is active */
+    char*          regex;       /*< Source of a regex rule */
+    pcre2_match_data* mdata;    /*< Match data of a regex rule */
+    HASHTABLE*     names;       /*< Case-insensitive set of the names of a column or function rule */
+    bool           combinable;  /*< Regex rule that can be combined with other regex rules */
     struct rule_t *next;
 } RULE;
 
@@ -241,8 +253,51 @@ typedef struct user_t
     RULE_BOOK*  rules_and;      /*< All of these rules must match for the action to trigger */
     RULE_BOOK*  rules_strict_and; /*< rules that skip the rest of the rules if one of them
                                    * fails. This is only for rules paired with 'match strict_all'. */
+    pcre2_code* any_regex;      /*< The combinable regex rules of rules_or as one alternation */
+    pcre2_match_data* any_mdata; /*< Match data of any_regex */
+    bool        cacheable;      /*< Whether the rules only depend on the statement shape */
 } DBFW_USER;
 
+/** Number of decisions each thread caches */
+#define FW_DECISION_CACHE_SIZE 1024
+
+/** Number of matched rules a cached decision can have */
+#define FW_DECISION_MAX_RULES 8
+
+/**
+ * The result of matching a statement of a user against the rules of the user
+ */
+typedef struct fw_decision
+{
+    DBFW_USER*  user;           /*< The user */
+    uint64_t    digest;         /*< Canonical digest of the statement */
+    bool        match;          /*< Whether the rules matched */
+    char*       rulename;       /*< The names of the matched rules */
+    char*       errmsg;         /*< The error message of the matched rule */
+    RULE*       rules[FW_DECISION_MAX_RULES]; /*< The rules that matched */
+    int         n_rules;        /*< Number of rules that matched */
+    struct fw_decision *prev;   /*< The more recently used decision */
+    struct fw_decision *next;   /*< The less recently used decision */
+    struct fw_decision *hnext;  /*< The next decision in the hash bucket */
+} FW_DECISION;
+
+/**
+ * The decisions of a thread, the least recently used one is replaced first
+ */
+typedef struct
+{
+    FW_DECISION  entries[FW_DECISION_CACHE_SIZE];
+    FW_DECISION* buckets[FW_DECISION_CACHE_SIZE];
+    FW_DECISION* head;          /*< The most recently used decision */
+    FW_DECISION* tail;          /*< The least recently used decision */
+    int          n_used;        /*< Number of entries in use */
+} FW_DECISION_CACHE;
+
+thread_local FW_DECISION_CACHE *thr_decisions = NULL;
+
+/** The decision whose matched rules are recorded, NULL if none */
+thread_local FW_DECISION *thr_recording = NULL;
+
 /**
  * The Firewall filter instance.
  */
@@ -254,8 +309,19 @@ typedef struct
     int             idgen;      /*< UID generator */
     char           *rulefile;   /*< Path to the rule file */
     int             rule_version; /*< Latest rule file version, incremented on reload */
+    const MXS_FILTER_DEF *def;  /*< The definition of the filter */
 } FW_INSTANCE;
 
+/**
+ * The statistics of a filter instance for one thread. The threads update their
+ * own counters without atomic operations and the diagnostics sums them.
+ */
+typedef struct
+{
+    uint64_t        decision_hits; /*< Queries whose decision was cached */
+    uint64_t        decision_misses; /*< Cacheable queries whose decision was not cached */
+} FW_THREAD_STATS;
+
 /**
  * The session structure for Firewall filter.
  */
@@ -263,7 +329,8 @@ typedef struct
 {
     MXS_SESSION   *session;      /*< Client session structure */
     char          *errmsg;       /*< Rule specific error message */
-    QUERYSPEED    *query_speed;  /*< How fast the user has executed queries */
+    QUERYSPEED    *query_speed;  /*< How fast the user has executed queries, one for each
+                                  * limit_queries rule that has been checked */
     MXS_DOWNSTREAM down;         /*< Next object in the downstream chain */
     MXS_UPSTREAM   up;           /*< Next object in the upstream chain */
 } FW_SESSION;
@@ -426,6 +493,8 @@ static void dbfw_user_free(void* fval)
     rulebook_free(value->rules_and);
     rulebook_free(value->rules_or);
     rulebook_free(value->rules_strict_and);
+    pcre2_code_free(value->any_regex);
+    pcre2_match_data_free(value->any_mdata);
     MXS_FREE(value->qs_limit);
     MXS_FREE(value->name);
     MXS_FREE(value);
@@ -819,6 +888,8 @@ MXS_MODULE* MXS_CREATE_MODULE()
         diagnostic,
         getCapabilities,
         NULL, // No destroyInstance
+        createThreadInstance,
+        destroyThreadInstance,
     };
 
     static MXS_MODULE info =
@@ -1013,6 +1084,10 @@ bool create_rule(void* scanner, const char* name)
             ruledef->active = NULL;
             ruledef->times_matched = 0;
             ruledef->data = NULL;
+            ruledef->regex = NULL;
+            ruledef->mdata = NULL;
+            ruledef->names = NULL;
+            ruledef->combinable = false;
             rstack->rule = ruledef;
             rval = true;
         }
@@ -1062,6 +1137,9 @@ static void rule_free_all(RULE* rule)
             break;
         }
 
+        hashtable_free(rule->names);
+        pcre2_match_data_free(rule->mdata);
+        MXS_FREE(rule->regex);
         MXS_FREE(rule->name);
         MXS_FREE(rule);
         rule = tmp;
@@ -1300,6 +1378,8 @@ bool define_limit_queries_rule(void* scanner, int max, int timeperiod, int holdo
         qs->limit = max;
         qs->period = timeperiod;
         qs->cooldown = holdoff;
+        qs->id = atomic_add(&queryspeed_id, 1);
+        qs->next = NULL;
         rstack->rule->type = RT_THROTTLE;
         rstack->rule->data = qs;
     }
@@ -1327,6 +1407,11 @@ bool define_regex_rule(void* scanner, char* pattern)
         ss_dassert(rstack);
         rstack->rule->type = RT_REGEX;
         rstack->rule->data = (void*) re;
+
+        if ((rstack->rule->regex = MXS_STRDUP((const char*)start)) == NULL)
+        {
+            return false;
+        }
     }
     else
     {
@@ -1369,6 +1454,8 @@ static bool process_user_templates(HASHTABLE *users, user_template_t *templates,
                 user->rules_and = NULL;
                 user->rules_or = NULL;
                 user->rules_strict_and = NULL;
+                user->any_regex = NULL;
+                user->any_mdata = NULL;
                 user->qs_limit = NULL;
                 spinlock_init(&user->lock);
                 hashtable_add(users, user->name, user);
@@ -1430,6 +1517,206 @@ static bool process_user_templates(HASHTABLE *users, user_template_t *templates,
     return rval;
 }
 
+/**
+ * Case-insensitive hash function for column and function names
+ *
+ * @param data Name
+ * @return Hash of the lowercase name
+ */
+static int name_hash(const void *data)
+{
+    const char *name = (const char*)data;
+    int hash = 0;
+    int c;
+
+    while ((c = tolower(*name++)))
+    {
+        hash = c + (hash << 6) + (hash << 16) - hash;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief Compile a rule for matching
+ *
+ * Regex rules are JIT-compiled and get their own match data so that nothing
+ * needs to be allocated when a query is matched. The names of column and
+ * function rules are stored in a hash set.
+ *
+ * @param rule Rule to compile
+ * @return True on success, false on memory allocation failure
+ */
+static bool compile_rule(RULE *rule)
+{
+    bool rval = true;
+
+    if (rule->type == RT_REGEX)
+    {
+        pcre2_code *re = (pcre2_code*)rule->data;
+        uint32_t backrefs = 0;
+
+        /** The JIT is optional, the interpreter is used if it is not available */
+        pcre2_jit_compile(re, PCRE2_JIT_COMPLETE);
+        pcre2_pattern_info(re, PCRE2_INFO_BACKREFMAX, &backrefs);
+
+        /** Back references would refer to the wrong groups in a combined regex */
+        rule->combinable = rule->regex && backrefs == 0 && rule->active == NULL &&
+                           rule->on_queries == QUERY_OP_UNDEFINED;
+        rval = (rule->mdata = pcre2_match_data_create_from_pattern(re, NULL)) != NULL;
+    }
+    else if (rule->type == RT_COLUMN || rule->type == RT_FUNCTION)
+    {
+        if ((rule->names = hashtable_alloc(16, name_hash, hashtable_item_strcasecmp)))
+        {
+            for (STRLINK *strln = (STRLINK*)rule->data; strln; strln = strln->next)
+            {
+                /** Duplicate names are not added which is fine for a set */
+                hashtable_add(rule->names, strln->value, strln->value);
+            }
+        }
+        else
+        {
+            rval = false;
+        }
+    }
+
+    return rval;
+}
+
+/**
+ * @brief Combine the regex rules of a user's match any rulebook
+ *
+ * The combinable regex rules are joined into one JIT-compiled alternation.
+ * A query that does not match the alternation does not match any of the
+ * rules and they do not need to be evaluated one by one. This also decides
+ * whether the decisions for the user can be cached.
+ *
+ * @param user User whose rules are combined
+ * @return True on success or if there is nothing to combine, false on
+ *         memory allocation failure
+ */
+static bool compile_user(DBFW_USER *user)
+{
+    size_t len = 1;
+    int n_rules = 0;
+    RULE_BOOK *books[] = {user->rules_or, user->rules_and, user->rules_strict_and};
+
+    /**
+     * The decisions can be cached if the rules don't depend on the time, the
+     * rate of the queries or the literal values in the query
+     */
+    user->cacheable = true;
+
+    for (int i = 0; i < sizeof(books) / sizeof(books[0]); i++)
+    {
+        for (RULE_BOOK *rb = books[i]; rb; rb = rb->next)
+        {
+            if (rb->rule->type == RT_REGEX || rb->rule->type == RT_THROTTLE || rb->rule->active)
+            {
+                user->cacheable = false;
+            }
+        }
+    }
+
+    for (RULE_BOOK *rb = user->rules_or; rb; rb = rb->next)
+    {
+        if (rb->rule->combinable)
+        {
+            len += strlen(rb->rule->regex) + sizeof("|(?:)");
+            n_rules++;
+        }
+    }
+
+    if (n_rules < 2)
+    {
+        return true;
+    }
+
+    char *pattern = MXS_MALLOC(len);
+
+    if (pattern == NULL)
+    {
+        return false;
+    }
+
+    char *ptr = pattern;
+
+    for (RULE_BOOK *rb = user->rules_or; rb; rb = rb->next)
+    {
+        if (rb->rule->combinable)
+        {
+            ptr += sprintf(ptr, "%s(?:%s)", ptr == pattern ? "" : "|", rb->rule->regex);
+        }
+    }
+
+    int err;
+    size_t offset;
+    pcre2_code *re = pcre2_compile((PCRE2_SPTR)pattern, PCRE2_ZERO_TERMINATED, 0, &err, &offset, NULL);
+    pcre2_match_data *mdata = NULL;
+
+    if (re)
+    {
+        pcre2_jit_compile(re, PCRE2_JIT_COMPLETE);
+
+        if ((mdata = pcre2_match_data_create_from_pattern(re, NULL)) == NULL)
+        {
+            pcre2_code_free(re);
+            re = NULL;
+        }
+    }
+    else
+    {
+        /** For example duplicate group names in separate rules. The rules
+         * are still valid on their own and are evaluated separately. */
+        MXS_INFO("Could not combine the regex rules of user '%s', the rules "
+                 "are matched one at a time.", user->name);
+    }
+
+    MXS_FREE(pattern);
+    user->any_regex = re;
+    user->any_mdata = mdata;
+
+    return true;
+}
+
+/**
+ * @brief Compile the rules and users for matching
+ *
+ * @param rules List of all rules
+ * @param users The users
+ * @return True on success, false on memory allocation failure
+ */
+static bool compile_rules(RULE *rules, HASHTABLE *users)
+{
+    bool rval = true;
+
+    for (RULE *rule = rules; rule && rval; rule = rule->next)
+    {
+        rval = compile_rule(rule);
+    }
+
+    HASHITERATOR *iter = hashtable_iterator(users);
+
+    if (iter)
+    {
+        void *key;
+
+        while (rval && (key = hashtable_next(iter)))
+        {
+            rval = compile_user((DBFW_USER*)hashtable_fetch(users, key));
+        }
+
+        hashtable_iterator_free(iter);
+    }
+    else
+    {
+        rval = false;
+    }
+
+    return rval;
+}
+
 /**
  * Read a rule file from disk and process it into rule and user definitions
  * @param filename Name of the file
@@ -1464,7 +1751,8 @@ static bool process_rule_file(const char* filename, RULE** rules, HASHTABLE **us
         fclose(file);
         HASHTABLE *new_users = dbfw_userlist_create();
 
-        if (rc == 0 && new_users && process_user_templates(new_users, pstack.templates, pstack.rule))
+        if (rc == 0 && new_users && process_user_templates(new_users, pstack.templates, pstack.rule) &&
+            compile_rules(pstack.rule, new_users))
         {
             *rules = pstack.rule;
             *users = new_users;
@@ -1492,6 +1780,138 @@ static bool process_rule_file(const char* filename, RULE** rules, HASHTABLE **us
     return rc == 0;
 }
 
+/**
+ * @brief Remove all decisions cached by this thread
+ */
+static void decision_cache_clear()
+{
+    if (thr_decisions)
+    {
+        for (int i = 0; i < thr_decisions->n_used; i++)
+        {
+            MXS_FREE(thr_decisions->entries[i].rulename);
+            MXS_FREE(thr_decisions->entries[i].errmsg);
+        }
+
+        memset(thr_decisions, 0, sizeof(*thr_decisions));
+    }
+}
+
+/**
+ * @brief Remove a decision from the list of recently used decisions
+ *
+ * @param decision The decision to remove
+ */
+static void decision_unlink(FW_DECISION *decision)
+{
+    if (decision->prev)
+    {
+        decision->prev->next = decision->next;
+    }
+    else
+    {
+        thr_decisions->head = decision->next;
+    }
+
+    if (decision->next)
+    {
+        decision->next->prev = decision->prev;
+    }
+    else
+    {
+        thr_decisions->tail = decision->prev;
+    }
+}
+
+/**
+ * @brief Make a decision the most recently used one
+ *
+ * @param decision The decision that is not in the list of recently used decisions
+ */
+static void decision_push(FW_DECISION *decision)
+{
+    decision->prev = NULL;
+    decision->next = thr_decisions->head;
+
+    if (thr_decisions->head)
+    {
+        thr_decisions->head->prev = decision;
+    }
+    else
+    {
+        thr_decisions->tail = decision;
+    }
+
+    thr_decisions->head = decision;
+}
+
+/**
+ * @brief Find a cached decision
+ *
+ * @param user   The user
+ * @param digest Canonical digest of the statement
+ * @return The decision or NULL if none is cached
+ */
+static FW_DECISION* decision_find(DBFW_USER *user, uint64_t digest)
+{
+    FW_DECISION *decision = thr_decisions->buckets[digest % FW_DECISION_CACHE_SIZE];
+
+    while (decision && (decision->digest != digest || decision->user != user))
+    {
+        decision = decision->hnext;
+    }
+
+    if (decision && decision != thr_decisions->head)
+    {
+        decision_unlink(decision);
+        decision_push(decision);
+    }
+
+    return decision;
+}
+
+/**
+ * @brief Cache a decision
+ *
+ * The least recently used decision is replaced if the cache is full.
+ *
+ * @param result The decision to cache
+ */
+static void decision_add(const FW_DECISION *result)
+{
+    FW_DECISION *decision;
+
+    if (thr_decisions->n_used < FW_DECISION_CACHE_SIZE)
+    {
+        decision = &thr_decisions->entries[thr_decisions->n_used++];
+    }
+    else
+    {
+        decision = thr_decisions->tail;
+        decision_unlink(decision);
+
+        FW_DECISION **bucket = &thr_decisions->buckets[decision->digest % FW_DECISION_CACHE_SIZE];
+
+        while (*bucket != decision)
+        {
+            bucket = &(*bucket)->hnext;
+        }
+
+        *bucket = decision->hnext;
+        MXS_FREE(decision->rulename);
+        MXS_FREE(decision->errmsg);
+    }
+
+    *decision = *result;
+    decision->rulename = result->rulename ? MXS_STRDUP_A(result->rulename) : NULL;
+    decision->errmsg = result->errmsg ? MXS_STRDUP_A(result->errmsg) : NULL;
+
+    FW_DECISION **bucket = &thr_decisions->buckets[decision->digest % FW_DECISION_CACHE_SIZE];
+    decision->hnext = *bucket;
+    *bucket = decision;
+    decision_push(decision);
+}
+
 /**
  * @brief Replace the rule file used by this thread
  *
@@ -1516,6 +1936,8 @@ bool replace_rules(FW_INSTANCE* instance)
 
     if (process_rule_file(filename, &rules, &users))
     {
+        /** The cached decisions refer to the old rules and users */
+        decision_cache_clear();
         rule_free_all(thr_rules);
         hashtable_free(thr_users);
         thr_rules = rules;
@@ -1558,6 +1980,7 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
     }
 
     spinlock_init(&my_instance->lock);
+    my_instance->def = filter_def_find(name);
     my_instance->action = config_get_enum(params, "action", action_values);
     my_instance->log_match = FW_LOG_NONE;
 
@@ -1634,7 +2057,14 @@ freeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session)
 {
     FW_SESSION *my_session = (FW_SESSION *) session;
     MXS_FREE(my_session->errmsg);
-    MXS_FREE(my_session->query_speed);
+
+    while (my_session->query_speed)
+    {
+        QUERYSPEED *next = my_session->query_speed->next;
+        MXS_FREE(my_session->query_speed);
+        my_session->query_speed = next;
+    }
+
     MXS_FREE(my_session);
 }
 
@@ -1818,6 +2248,18 @@ static char* create_parse_error(FW_INSTANCE* my_instance,
     return msg;
 }
 
+/**
+ * Check a limit_queries rule
+ *
+ * The counters are kept in the session, separately for each rule. A session
+ * is only handled by one thread at a time so no locking or atomic operations
+ * are needed.
+ *
+ * @param my_session Fwfilter session
+ * @param rulebook   The rule to check
+ * @param msg        Set to the error message if the rule matches
+ * @return True if the query matches the rule, i.e. the limit is exceeded
+ */
 bool match_throttle(FW_SESSION* my_session, RULE_BOOK *rulebook, char **msg)
 {
     bool matches = false;
@@ -1826,6 +2268,11 @@ bool match_throttle(FW_SESSION* my_session, RULE_BOOK *rulebook, char **msg)
     time_t time_now = time(NULL);
     char emsg[512];
 
+    while (queryspeed && queryspeed->id != rule_qs->id)
+    {
+        queryspeed = queryspeed->next;
+    }
+
     if (queryspeed == NULL)
     {
         /**No match found*/
@@ -1834,6 +2281,8 @@ bool match_throttle(FW_SESSION* my_session, RULE_BOOK *rulebook, char **msg)
         queryspeed->period = rule_qs->period;
         queryspeed->cooldown = rule_qs->cooldown;
         queryspeed->limit = rule_qs->limit;
+        queryspeed->id = rule_qs->id;
+        queryspeed->next = my_session->query_speed;
         my_session->query_speed = queryspeed;
     }
 
@@ -1888,26 +2337,13 @@ bool match_throttle(FW_SESSION* my_session, RULE_BOOK *rulebook, char **msg)
 
 void match_regex(RULE_BOOK *rulebook, const char *query, bool *matches, char **msg)
 {
-
-    pcre2_match_data *mdata = pcre2_match_data_create_from_pattern(rulebook->rule->data, NULL);
-
-    if (mdata)
+    if (pcre2_match((pcre2_code*)rulebook->rule->data,
+                    (PCRE2_SPTR)query, PCRE2_ZERO_TERMINATED,
+                    0, 0, rulebook->rule->mdata, NULL) > 0)
     {
-        if (pcre2_match((pcre2_code*)rulebook->rule->data,
-                        (PCRE2_SPTR)query, PCRE2_ZERO_TERMINATED,
-                        0, 0, mdata, NULL) > 0)
-        {
-            MXS_NOTICE("rule '%s': regex matched on query", rulebook->rule->name);
-            *matches = true;
-            *msg = MXS_STRDUP_A("Permission denied, query matched regular expression.");
-        }
-
-        pcre2_match_data_free(mdata);
-    }
-    else
-    {
-        MXS_ERROR("Allocation of matching data for PCRE2 failed."
-                  " This is most likely caused by a lack of memory");
+        MXS_NOTICE("rule '%s': regex matched on query", rulebook->rule->name);
+        *matches = true;
+        *msg = MXS_STRDUP_A("Permission denied, query matched regular expression.");
     }
 }
 
@@ -1917,24 +2353,18 @@ void match_column(RULE_BOOK *rulebook, GWBUF *queue, bool *matches, char **msg)
     size_t n_infos;
     qc_get_field_info(queue, &infos, &n_infos);
 
-    for (size_t i = 0; i < n_infos; ++i)
+    for (size_t i = 0; i < n_infos && !*matches; ++i)
     {
-        const char* tok = infos[i].column;
+        const char* name = hashtable_fetch(rulebook->rule->names, (void*)infos[i].column);
 
-        STRLINK* strln = (STRLINK*)rulebook->rule->data;
-        while (strln)
+        if (name)
         {
-            if (strcasecmp(tok, strln->value) == 0)
-            {
-                char emsg[strlen(strln->value) + 100];
-                sprintf(emsg, "Permission denied to column '%s'.", strln->value);
-                MXS_NOTICE("rule '%s': query targets forbidden column: %s",
-                           rulebook->rule->name, strln->value);
-                *msg = MXS_STRDUP_A(emsg);
-                *matches = true;
-                break;
-            }
-            strln = strln->next;
+            char emsg[strlen(name) + 100];
+            sprintf(emsg, "Permission denied to column '%s'.", name);
+            MXS_NOTICE("rule '%s': query targets forbidden column: %s",
+                       rulebook->rule->name, name);
+            *msg = MXS_STRDUP_A(emsg);
+            *matches = true;
         }
     }
 }
@@ -1945,24 +2375,18 @@ void match_function(RULE_BOOK *rulebook, GWBUF *queue, bool *matches, char **msg
     size_t n_infos;
     qc_get_function_info(queue, &infos, &n_infos);
 
-    for (size_t i = 0; i < n_infos; ++i)
+    for (size_t i = 0; i < n_infos && !*matches; ++i)
     {
-        const char* tok = infos[i].name;
+        const char* name = hashtable_fetch(rulebook->rule->names, (void*)infos[i].name);
 
-        STRLINK* strln = (STRLINK*)rulebook->rule->data;
-        while (strln)
+        if (name)
         {
-            if (strcasecmp(tok, strln->value) == 0)
-            {
-                char emsg[strlen(strln->value) + 100];
-                sprintf(emsg, "Permission denied to function '%s'.", strln->value);
-                MXS_NOTICE("rule '%s': query uses forbidden function: %s",
-                           rulebook->rule->name, strln->value);
-                *msg = MXS_STRDUP_A(emsg);
-                *matches = true;
-                break;
-            }
-            strln = strln->next;
+            char emsg[strlen(name) + 100];
+            sprintf(emsg, "Permission denied to function '%s'.", name);
+            MXS_NOTICE("rule '%s': query uses forbidden function: %s",
+                       rulebook->rule->name, name);
+            *msg = MXS_STRDUP_A(emsg);
+            *matches = true;
         }
     }
 }
@@ -2121,6 +2545,16 @@ queryresolved:
     if (matches)
     {
         rulebook->rule->times_matched++;
+
+        if (thr_recording)
+        {
+            if (thr_recording->n_rules < FW_DECISION_MAX_RULES)
+            {
+                thr_recording->rules[thr_recording->n_rules] = rulebook->rule;
+            }
+
+            thr_recording->n_rules++;
+        }
     }
 
     return matches;
@@ -2148,9 +2582,26 @@ bool check_match_any(FW_INSTANCE* my_instance, FW_SESSION* my_session,
 
         if (fullquery)
         {
+            bool skip_regex = false;
+
+            /**
+             * If the combined regex of the user does not match, none of the
+             * combinable regex rules can match and they can be skipped. Queries
+             * that fail to parse are left to rule_matches which rejects them.
+             */
+            if (user->any_regex &&
+                (!(modutil_is_SQL(queue) || modutil_is_SQL_prepare(queue)) ||
+                 qc_parse(queue, QC_COLLECT_ALL) != QC_QUERY_INVALID))
+            {
+                skip_regex = pcre2_match(user->any_regex, (PCRE2_SPTR)fullquery,
+                                         PCRE2_ZERO_TERMINATED, 0, 0,
+                                         user->any_mdata, NULL) <= 0;
+            }
+
             while (rulebook)
             {
-                if (!rule_is_active(rulebook->rule))
+                if (!rule_is_active(rulebook->rule) ||
+                    (skip_regex && rulebook->rule->combinable))
                 {
                     rulebook = rulebook->next;
                     continue;
@@ -2304,6 +2755,82 @@ DBFW_USER* find_user_data(HASHTABLE *hash, const char *name, const char *remote)
     return user;
 }
 
+/**
+ * Check if the query matches the rules of the user
+ *
+ * The decision is cached by the canonical digest of the statement if the
+ * rules of the user only depend on the shape of the statement. The cached
+ * decision is used for the following statements of the user that have the
+ * same digest and parse completely.
+ *
+ * @param my_instance Fwfilter instance
+ * @param my_session Fwfilter session
+ * @param queue The GWBUF containing the query
+ * @param user The user whose rules are checked
+ * @param rulename The names of the matched rules are stored here
+ * @return True if the query matches the rules of the user
+ */
+static bool check_user_rules(FW_INSTANCE* my_instance, FW_SESSION* my_session,
+                             GWBUF *queue, DBFW_USER* user, char** rulename)
+{
+    FW_DECISION result = {.user = user};
+    FW_THREAD_STATS *stats;
+
+    if (user->cacheable && (modutil_is_SQL(queue) || modutil_is_SQL_prepare(queue)) &&
+        qc_parse(queue, QC_COLLECT_ESSENTIALS) == QC_QUERY_PARSED &&
+        modutil_get_canonical_digest(queue, &result.digest) &&
+        (thr_decisions || (thr_decisions = MXS_CALLOC(1, sizeof(FW_DECISION_CACHE)))))
+    {
+        FW_DECISION *decision = decision_find(user, result.digest);
+
+        if (decision)
+        {
+            for (int i = 0; i < decision->n_rules; i++)
+            {
+                decision->rules[i]->times_matched++;
+            }
+
+            MXS_FREE(my_session->errmsg);
+            my_session->errmsg = decision->errmsg ? MXS_STRDUP_A(decision->errmsg) : NULL;
+
+            *rulename = decision->rulename ? MXS_STRDUP_A(decision->rulename) : NULL;
+            if ((stats = filter_def_get_thread_instance(my_instance->def)))
+            {
+                stats->decision_hits++;
+            }
+            return decision->match;
+        }
+
+        /** The error message of an older query must not be cached */
+        MXS_FREE(my_session->errmsg);
+        my_session->errmsg = NULL;
+        thr_recording = &result;
+
+        if ((stats = filter_def_get_thread_instance(my_instance->def)))
+        {
+            stats->decision_misses++;
+        }
+    }
+
+    result.match = check_match_any(my_instance, my_session, queue, user, rulename) ||
+                   check_match_all(my_instance, my_session, queue, user, false, rulename) ||
+                   check_match_all(my_instance, my_session, queue, user, true, rulename);
+
+    if (thr_recording)
+    {
+        thr_recording = NULL;
+
+        if (result.n_rules <= FW_DECISION_MAX_RULES)
+        {
+            result.rulename = *rulename;
+            result.errmsg = my_session->errmsg;
+            decision_add(&result);
+        }
+    }
+
+    return result.match;
+}
+
 static bool command_is_mandatory(const GWBUF *buffer)
 {
     switch (MYSQL_GET_COMMAND((uint8_t*)GWBUF_DATA(buffer)))
@@ -2353,11 +2880,18 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
     }
 
     uint32_t type = 0;
+    GWBUF* prepared = NULL;
 
     if (modutil_is_SQL(queue) || modutil_is_SQL_prepare(queue))
     {
         type = qc_get_type_mask(queue);
     }
+    else if (MYSQL_GET_COMMAND(GWBUF_DATA(queue)) == MYSQL_COM_STMT_EXECUTE)
+    {
+        // An execution is checked against the statement it executes. The
+        // statement was parsed when it was prepared.
+        prepared = qc_ps_lookup_by_command(my_session->session, queue);
+    }
 
     if (modutil_is_SQL(queue) && modutil_count_statements(queue) > 1)
     {
@@ -2370,7 +2904,7 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
     }
     else
     {
-        GWBUF* analyzed_queue = queue;
+        GWBUF* analyzed_queue = prepared ? prepared : queue;
 
         // QUERY_TYPE_PREPARE_STMT need not be handled separately as the
         // information about statements in COM_STMT_PREPARE packets is
@@ -2389,15 +2923,8 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
 
         if (user)
         {
-            bool match = false;
             char* rname = NULL;
-
-            if (check_match_any(my_instance, my_session, analyzed_queue, user, &rname) ||
-                check_match_all(my_instance, my_session, analyzed_queue, user, false, &rname) ||
-                check_match_all(my_instance, my_session, analyzed_queue, user, true, &rname))
-            {
-                match = true;
-            }
+            bool match = check_user_rules(my_instance, my_session, analyzed_queue, user, &rname);
 
             switch (my_instance->action)
             {
@@ -2490,7 +3017,22 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
 {
     FW_INSTANCE *my_instance = (FW_INSTANCE *) instance;
 
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+
+    for (int i = 0; i < config_threadcount(); i++)
+    {
+        const FW_THREAD_STATS *stats = filter_def_get_thread_instance_of(my_instance->def, i);
+
+        if (stats)
+        {
+            hits += stats->decision_hits;
+            misses += stats->decision_misses;
+        }
+    }
+
     dcb_printf(dcb, "Firewall Filter\n");
+    dcb_printf(dcb, "Cached decisions used: %lu, made: %lu\n", hits, misses);
     dcb_printf(dcb, "Rule, Type, Times Matched\n");
 
     for (RULE *rule = thr_rules; rule; rule = rule->next)
@@ -2501,6 +3043,29 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
     }
 }
 
+/**
+ * Create the statistics of a polling thread.
+ *
+ * @param instance  The filter instance
+ * @param thread_id ID of the polling thread
+ * @return The statistics of the thread
+ */
+static void *createThreadInstance(MXS_FILTER *instance, int thread_id)
+{
+    return MXS_CALLOC(1, sizeof(FW_THREAD_STATS));
+}
+
+/**
+ * Free the statistics of a polling thread.
+ *
+ * @param instance        The filter instance
+ * @param thread_instance The statistics of the thread
+ */
+static void destroyThreadInstance(MXS_FILTER *instance, void *thread_instance)
+{
+    MXS_FREE(thread_instance);
+}
+
 /**
  * Capability routine.
  *
@@ -42,15 +42,20 @@ static uint64_t getCapabilities(MXS_FILTER *instance);
 static int32_t clientReply(MXS_FILTER* instance, MXS_FILTER_SESSION *session, GWBUF *reply);
 static bool extract_insert_target(GWBUF *buffer, char* target, int len);
 static GWBUF* create_load_data_command(const char *target);
-static GWBUF* convert_to_stream(GWBUF* buffer, uint8_t packet_num);
 
 /**
  * Instance structure
  */
 typedef struct
 {
-    char *source; /**< Source address to restrict matches */
-    char *user;   /**< User name to restrict matches */
+    char *source;       /**< Source address to restrict matches */
+    char *user;         /**< User name to restrict matches */
+    size_t batch_size;  /**< Bytes of rows collected before they are sent */
+    int flush_timeout;  /**< Milliseconds a stream is kept open, 0 for no limit */
+    bool autocommit;    /**< Stream inserts that are done in autocommit mode */
+    int n_streams;      /**< Number of streams opened */
+    int n_rows;         /**< Number of rows streamed */
+    int n_errors;       /**< Number of streams that failed */
 } DS_INSTANCE;
 
 enum ds_state
@@ -75,8 +80,30 @@ typedef struct
     DCB* client_dcb;     /**< Client DCB */
     enum ds_state state; /**< The current state of the stream */
     char target[MYSQL_TABLE_MAXLEN + MYSQL_DATABASE_MAXLEN + 1]; /**< Current target table */
+    DS_INSTANCE *instance; /**< The filter instance */
+    char *rows;          /**< Rows converted to CSV but not yet sent */
+    size_t rows_len;     /**< Length of the rows */
+    size_t rows_size;    /**< Size of the row buffer */
+    uint64_t stream_seq; /**< Incremented for every opened stream */
+    bool closed;         /**< Whether the session has been closed */
 } DS_SESSION;
 
+/**
+ * A pending flush timeout of a stream
+ */
+typedef struct
+{
+    MXS_SESSION *session; /**< Reference to the session */
+    DS_SESSION *ds;       /**< The filter session */
+    uint64_t seq;         /**< The stream the timeout is for */
+    int thread;           /**< The thread of the session when the timer was set */
+} DS_TIMER;
+
+static int values_to_csv(DS_SESSION *my_session, GWBUF *buffer);
+static int32_t send_rows(DS_SESSION *my_session);
+static int32_t close_stream(DS_SESSION *my_session, GWBUF *queue);
+static void start_flush_timer(DS_SESSION *my_session);
+
 /**
  * The module entry point routine. It is this routine that
  * must populate the structure that is referred to as the
@@ -109,7 +136,7 @@ MXS_MODULE* MXS_CREATE_MODULE()
         MXS_MODULE_EXPERIMENTAL,
         MXS_FILTER_VERSION,
         "Data streaming filter",
-        "1.0.0",
+        "1.1.0",
         &MyObject,
         NULL,
         NULL,
@@ -118,6 +145,9 @@ MXS_MODULE* MXS_CREATE_MODULE()
         {
             {"source", MXS_MODULE_PARAM_STRING},
             {"user", MXS_MODULE_PARAM_STRING},
+            {"batch_size", MXS_MODULE_PARAM_SIZE, "0"},
+            {"flush_timeout", MXS_MODULE_PARAM_COUNT, "0"},
+            {"autocommit", MXS_MODULE_PARAM_BOOL, "false"},
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -140,10 +170,13 @@ void free_instance(DS_INSTANCE *instance)
 }
 
 /**
- * This the SQL command that starts the streaming
+ * This the SQL command that starts the streaming. The strings are enclosed
+ * and escaped the same way as in an SQL statement.
  */
 static const char load_data_template[] = "LOAD DATA LOCAL INFILE 'maxscale.data' "
-                                         "INTO TABLE %s FIELDS TERMINATED BY ',' LINES TERMINATED BY '\\n'";
+                                         "INTO TABLE %s FIELDS TERMINATED BY ',' "
+                                         "OPTIONALLY ENCLOSED BY '\\'' ESCAPED BY '\\\\' "
+                                         "LINES TERMINATED BY '\\n'";
 
 /**
  * Create an instance of the filter for a particular service
@@ -163,6 +196,15 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
     {
         my_instance->source = config_copy_string(params, "source");
         my_instance->user = config_copy_string(params, "user");
+        my_instance->batch_size = config_get_size(params, "batch_size");
+        my_instance->flush_timeout = config_get_integer(params, "flush_timeout");
+        my_instance->autocommit = config_get_bool(params, "autocommit");
+
+        if (my_instance->batch_size > GW_MYSQL_MAX_PACKET_LEN)
+        {
+            /** The rows are sent in one packet */
+            my_instance->batch_size = GW_MYSQL_MAX_PACKET_LEN;
+        }
     }
 
     return (MXS_FILTER *) my_instance;
@@ -187,6 +229,7 @@ newSession(MXS_FILTER *instance, MXS_SESSION *session)
         my_session->state = DS_STREAM_CLOSED;
         my_session->active = true;
         my_session->client_dcb = session->client_dcb;
+        my_session->instance = my_instance;
 
         if (my_instance->source &&
             strcmp(session->client_dcb->remote, my_instance->source) != 0)
@@ -214,6 +257,8 @@ newSession(MXS_FILTER *instance, MXS_SESSION *session)
 static void
 closeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session)
 {
+    DS_SESSION *my_session = (DS_SESSION*) session;
+    my_session->closed = true;
 }
 
 /**
@@ -225,6 +270,9 @@ closeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session)
 static void
 freeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session)
 {
+    DS_SESSION *my_session = (DS_SESSION*) session;
+    gwbuf_free(my_session->queue);
+    MXS_FREE(my_session->rows);
     MXS_FREE(session);
 }
 
@@ -268,177 +316,452 @@ static void setUpstream(MXS_FILTER *instance, MXS_FILTER_SESSION *session, MXS_U
  */
 static int32_t routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
 {
+    DS_INSTANCE *my_instance = (DS_INSTANCE *) instance;
     DS_SESSION *my_session = (DS_SESSION *) session;
+    MXS_SESSION *ses = my_session->client_dcb->session;
     char target[MYSQL_TABLE_MAXLEN + MYSQL_DATABASE_MAXLEN + 1];
-    bool send_ok = false;
-    bool send_error = false;
-    int rc = 0;
+    int rc = 1;
     ss_dassert(GWBUF_IS_CONTIGUOUS(queue));
 
-    if (session_trx_is_active(my_session->client_dcb->session) &&
-        extract_insert_target(queue, target, sizeof(target)))
+    if (my_session->state == DS_REQUEST_SENT || my_session->state == DS_CLOSING_STREAM)
+    {
+        /** Wait for the server, the statement is routed once it has replied */
+        my_session->queue = gwbuf_append(my_session->queue, queue);
+        return 1;
+    }
+
+    size_t mark = my_session->rows_len;
+    int n_rows = 0;
+
+    if (my_session->state == DS_STREAM_OPEN && my_session->rows_len > 0 &&
+        my_session->rows_len + GWBUF_LENGTH(queue) > GW_MYSQL_MAX_PACKET_LEN)
+    {
+        /** The converted rows are never longer than the statement */
+        rc = send_rows(my_session);
+        mark = 0;
+    }
+
+    if (my_session->active &&
+        (session_trx_is_active(ses) || my_instance->autocommit) &&
+        extract_insert_target(queue, target, sizeof(target)) &&
+        (n_rows = values_to_csv(my_session, queue)) > 0)
     {
         switch (my_session->state)
         {
         case DS_STREAM_CLOSED:
-            /** We're opening a new stream */
+            /** We're opening a new stream, the rows are converted again
+             * when the insert is replayed */
+            my_session->rows_len = mark;
             strcpy(my_session->target, target);
             my_session->queue = queue;
             my_session->state = DS_REQUEST_SENT;
             my_session->packet_num = 0;
+            atomic_add(&my_instance->n_streams, 1);
             queue = create_load_data_command(target);
+            rc = my_session->down.routeQuery(my_session->down.instance,
+                                             my_session->down.session, queue);
             break;
 
         case DS_REQUEST_ACCEPTED:
             my_session->state = DS_STREAM_OPEN;
+            my_session->stream_seq++;
+            start_flush_timer(my_session);
         /** Fallthrough */
 
         case DS_STREAM_OPEN:
             if (strcmp(target, my_session->target) == 0)
             {
                 /**
-                 * Stream is open and targets match, convert the insert into
-                 * a data stream
+                 * Stream is open and targets match, the converted rows are
+                 * sent once enough of them have been collected
                  */
-                uint8_t packet_num = ++my_session->packet_num;
-                send_ok = true;
-                queue = convert_to_stream(queue, packet_num);
+                gwbuf_free(queue);
+                atomic_add(&my_instance->n_rows, n_rows);
+
+                if (my_session->rows_len >= my_instance->batch_size)
+                {
+                    rc = send_rows(my_session);
+                }
+
+                /** The OK packet can only hold a one byte row count */
+                mxs_mysql_send_ok(my_session->client_dcb, 1, MXS_MIN(n_rows, 250), NULL);
             }
             else
             {
-                /**
-                 * Target mismatch
-                 *
-                 * TODO: Instead of sending an error, we could just open a new stream
-                 */
-                gwbuf_free(queue);
-                send_error = true;
+                /** Target mismatch, a new stream is opened for the new target */
+                my_session->rows_len = mark;
+                rc = close_stream(my_session, queue);
             }
             break;
 
         default:
             MXS_ERROR("Unexpected state: %d", my_session->state);
             ss_dassert(false);
+            gwbuf_free(queue);
             break;
         }
     }
     else
     {
-        /** Transaction is not active or this is not an insert */
-        bool send_empty = false;
-        uint8_t packet_num;
-        *my_session->target = '\0';
+        /** Transaction is not active or this is not an insert that can be streamed */
+        my_session->rows_len = mark;
 
         switch (my_session->state)
         {
-        case DS_STREAM_OPEN:
-            /** Stream is open, we need to close it */
-            my_session->state = DS_CLOSING_STREAM;
-            send_empty = true;
-            packet_num = ++my_session->packet_num;
-            my_session->queue = queue;
-            break;
-
         case DS_REQUEST_ACCEPTED:
+            /** The insert that opened the stream is no longer streamed */
             my_session->state = DS_STREAM_OPEN;
-            send_ok = true;
+        /** Fallthrough */
+
+        case DS_STREAM_OPEN:
+            /** Stream is open, we need to close it */
+            rc = close_stream(my_session, queue);
             break;
 
         default:
             ss_dassert(my_session->state == DS_STREAM_CLOSED);
+            rc = my_session->down.routeQuery(my_session->down.instance,
+                                             my_session->down.session, queue);
             break;
         }
+    }
+
+    return rc;
+}
+
+/**
+ * Make room for more rows
+ *
+ * @param my_session Filter session
+ * @param len        Number of bytes to add
+ *
+ * @return True if there is room for the bytes
+ */
+static bool reserve_rows(DS_SESSION *my_session, size_t len)
+{
+    if (my_session->rows_len + len > my_session->rows_size)
+    {
+        size_t size = my_session->rows_size ? my_session->rows_size : 1024;
+
+        while (size < my_session->rows_len + len)
+        {
+            size *= 2;
+        }
 
-        if (send_empty)
+        char *rows = MXS_REALLOC(my_session->rows, size);
+
+        if (rows == NULL)
         {
-            char empty_packet[] = {0, 0, 0, packet_num};
-            queue = gwbuf_alloc_and_load(sizeof(empty_packet), &empty_packet[0]);
+            return false;
         }
+
+        my_session->rows = rows;
+        my_session->rows_size = size;
     }
 
-    if (send_ok)
+    return true;
+}
+
+/**
+ * @brief Convert the values of an INSERT into CSV rows
+ *
+ * The rows are appended to the rows of the session. Only values that mean
+ * the same in a LOAD DATA stream are accepted: single-quoted strings, numbers
+ * and NULL. Anything else, for instance function calls or an ON DUPLICATE KEY
+ * UPDATE clause, makes the whole statement unsuitable for streaming.
+ *
+ * @param my_session Filter session
+ * @param buffer     Buffer containing the query
+ *
+ * @return Number of rows or -1 if the values can't be streamed. On error,
+ *         the rows of the session are left partially converted.
+ */
+static int values_to_csv(DS_SESSION *my_session, GWBUF *buffer)
+{
+    char *data = (char*)GWBUF_DATA(buffer);
+    const char *end = (char*)buffer->end;
+    const char *ptr = strnchr_esc_mysql(data + MYSQL_HEADER_LEN + 1, '(',
+                                        GWBUF_LENGTH(buffer) - MYSQL_HEADER_LEN - 1);
+
+    /** The rows take at most twice as much space as the values */
+    if (ptr == NULL || !reserve_rows(my_session, (end - ptr) * 2))
     {
-        rc = mxs_mysql_send_ok(my_session->client_dcb, 1, 0, NULL);
+        return -1;
     }
 
-    if (send_error)
+    char *out = my_session->rows + my_session->rows_len;
+    int n_rows = 0;
+
+    while (true)
     {
-        rc = mysql_send_custom_error(my_session->client_dcb, 1, 0, "Invalid insert target");
+        while (ptr < end && isspace(*ptr))
+        {
+            ptr++;
+        }
+
+        if (ptr >= end || *ptr != '(')
+        {
+            return -1;
+        }
+
+        ptr++;
+
+        /** One row */
+        while (true)
+        {
+            while (ptr < end && isspace(*ptr))
+            {
+                ptr++;
+            }
+
+            if (ptr < end && (*ptr == '\'' || *ptr == '"'))
+            {
+                /** A string, always enclosed in single quotes in the stream */
+                char quote = *ptr++;
+                *out++ = '\'';
+
+                while (true)
+                {
+                    if (ptr >= end)
+                    {
+                        return -1;
+                    }
+                    else if (*ptr == '\\' && ptr + 1 < end)
+                    {
+                        *out++ = *ptr++;
+                    }
+                    else if (*ptr == quote)
+                    {
+                        if (ptr + 1 < end && ptr[1] == quote)
+                        {
+                            /** A doubled quote */
+                            ptr++;
+
+                            if (quote == '\'')
+                            {
+                                *out++ = '\'';
+                            }
+                        }
+                        else
+                        {
+                            break;
+                        }
+                    }
+                    else if (*ptr == '\'')
+                    {
+                        /** A single quote inside a double-quoted string */
+                        *out++ = '\\';
+                    }
+
+                    *out++ = *ptr++;
+                }
+
+                ptr++;
+                *out++ = '\'';
+            }
+            else
+            {
+                const char *start = ptr;
+
+                while (ptr < end && (isalnum(*ptr) || *ptr == '.' || *ptr == '-' || *ptr == '+'))
+                {
+                    ptr++;
+                }
+
+                size_t len = ptr - start;
+
+                if (len == 4 && strncasecmp(start, "NULL", 4) == 0)
+                {
+                    *out++ = '\\';
+                    *out++ = 'N';
+                }
+                else if (len > 0 && (isdigit(*start) || *start == '.' ||
+                                     *start == '-' || *start == '+'))
+                {
+                    memcpy(out, start, len);
+                    out += len;
+                }
+                else
+                {
+                    return -1;
+                }
+            }
+
+            while (ptr < end && isspace(*ptr))
+            {
+                ptr++;
+            }
+
+            if (ptr < end && *ptr == ',')
+            {
+                *out++ = *ptr++;
+            }
+            else if (ptr < end && *ptr == ')')
+            {
+                ptr++;
+                *out++ = '\n';
+                n_rows++;
+                break;
+            }
+            else
+            {
+                return -1;
+            }
+        }
+
+        while (ptr < end && isspace(*ptr))
+        {
+            ptr++;
+        }
+
+        if (ptr < end && *ptr == ',')
+        {
+            ptr++;
+        }
+        else if (ptr == end || *ptr == ';')
+        {
+            break;
+        }
+        else
+        {
+            return -1;
+        }
     }
-    else
+
+    /** Nothing but whitespace may come after the semicolon */
+    while (ptr < end && (*ptr == ';' || isspace(*ptr)))
+    {
+        ptr++;
+    }
+
+    if (ptr < end)
+    {
+        return -1;
+    }
+
+    my_session->rows_len = out - my_session->rows;
+    return n_rows;
+}
+
+/**
+ * @brief Send the collected rows to the server
+ *
+ * @param my_session Filter session
+ *
+ * @return 1 on success, 0 on error
+ */
+static int32_t send_rows(DS_SESSION *my_session)
+{
+    int32_t rc = 1;
+
+    if (my_session->rows_len > 0)
     {
+        uint32_t len = my_session->rows_len;
+        GWBUF *buffer = gwbuf_alloc(len + MYSQL_HEADER_LEN);
+
+        if (buffer == NULL)
+        {
+            return 0;
+        }
+
+        uint8_t *ptr = GWBUF_DATA(buffer);
+        *ptr++ = len;
+        *ptr++ = len >> 8;
+        *ptr++ = len >> 16;
+        *ptr++ = ++my_session->packet_num;
+        memcpy(ptr, my_session->rows, len);
+        my_session->rows_len = 0;
+
         rc = my_session->down.routeQuery(my_session->down.instance,
-                                         my_session->down.session, queue);
+                                         my_session->down.session, buffer);
     }
 
     return rc;
 }
 
 /**
- * Extract inserted values
+ * @brief Send the remaining rows and end the stream
+ *
+ * @param my_session Filter session
+ * @param queue      Statement that is routed once the stream is closed, may be NULL
+ *
+ * @return 1 on success, 0 on error
  */
-static char* get_value(char* data, uint32_t datalen, char** dest, uint32_t* destlen)
+static int32_t close_stream(DS_SESSION *my_session, GWBUF *queue)
 {
-    char *value_start = strnchr_esc_mysql(data, '(', datalen);
+    ss_dassert(my_session->state == DS_STREAM_OPEN);
+    int32_t rc = send_rows(my_session);
 
-    if (value_start)
+    if (rc)
     {
-        value_start++;
-        char *value_end = strnchr_esc_mysql(value_start, ')', datalen - (value_start - data));
+        uint8_t empty_packet[] = {0, 0, 0, ++my_session->packet_num};
+        GWBUF *buffer = gwbuf_alloc_and_load(sizeof(empty_packet), empty_packet);
 
-        if (value_end)
+        if (buffer)
+        {
+            my_session->state = DS_CLOSING_STREAM;
+            my_session->queue = queue;
+            queue = NULL;
+            rc = my_session->down.routeQuery(my_session->down.instance,
+                                             my_session->down.session, buffer);
+        }
+        else
         {
-            *destlen = value_end - value_start;
-            *dest = value_start;
-            return value_end;
+            rc = 0;
         }
     }
 
-    return NULL;
+    gwbuf_free(queue);
+    return rc;
 }
 
 /**
- * @brief Convert an INSERT query into a CSV stream
+ * Close a stream that has been open for longer than the flush timeout
  *
- * @param buffer     Buffer containing the query
- * @param packet_num The current packet sequence number
- *
- * @return The modified buffer
+ * @param data The timer
  */
-static GWBUF* convert_to_stream(GWBUF* buffer, uint8_t packet_num)
+static void flush_timeout(void *data)
 {
-    /** Remove the INSERT INTO ... from the buffer */
-    char *dataptr = (char*)GWBUF_DATA(buffer);
-    char *modptr = strnchr_esc_mysql(dataptr + MYSQL_HEADER_LEN + 1, '(', GWBUF_LENGTH(buffer));
-
-    /** Leave some space for the header so we don't have to allocate a new one */
-    buffer = gwbuf_consume(buffer, (modptr - dataptr) - MYSQL_HEADER_LEN);
-    char* header_start = (char*)GWBUF_DATA(buffer);
-    char* store_end = dataptr = header_start + MYSQL_HEADER_LEN;
-    char* end = buffer->end;
-    char* value;
-    uint32_t valuesize;
-
-    /**
-     * Remove the parentheses from the insert, add newlines between values and
-     * recalculate the packet length
-     */
-    while ((dataptr = get_value(dataptr, end - dataptr, &value, &valuesize)))
+    DS_TIMER *timer = (DS_TIMER*)data;
+    DS_SESSION *my_session = timer->ds;
+
+    /** The stream is left alone if it was moved to another thread */
+    if (!my_session->closed && my_session->stream_seq == timer->seq &&
+        my_session->state == DS_STREAM_OPEN &&
+        timer->session->client_dcb && timer->session->client_dcb->thread.id == timer->thread)
     {
-        memmove(store_end, value, valuesize);
-        store_end += valuesize;
-        *store_end++ = '\n';
+        close_stream(my_session, NULL);
     }
 
-    gwbuf_rtrim(buffer, (char*)buffer->end - store_end);
-    uint32_t len = gwbuf_length(buffer) - MYSQL_HEADER_LEN;
+    session_put_ref(timer->session);
+    MXS_FREE(timer);
+}
+
+/**
+ * Start the flush timeout of a new stream
+ *
+ * @param my_session Filter session
+ */
+static void start_flush_timer(DS_SESSION *my_session)
+{
+    if (my_session->instance->flush_timeout > 0)
+    {
+        DS_TIMER *timer = MXS_MALLOC(sizeof(*timer));
 
-    *header_start++ = len;
-    *header_start++ = len >> 8;
-    *header_start++ = len >> 16;
-    *header_start = packet_num;
+        if (timer)
+        {
+            timer->session = session_get_ref(my_session->client_dcb->session);
+            timer->ds = my_session;
+            timer->seq = my_session->stream_seq;
+            timer->thread = my_session->client_dcb->thread.id;
 
-    return buffer;
+            if (!poll_add_delayed_call(my_session->instance->flush_timeout, flush_timeout, timer))
+            {
+                session_put_ref(timer->session);
+                MXS_FREE(timer);
+            }
+        }
+    }
 }
 
 /**
@@ -453,30 +776,70 @@ static GWBUF* convert_to_stream(GWBUF* buffer, uint8_t packet_num)
  */
 static int32_t clientReply(MXS_FILTER* instance, MXS_FILTER_SESSION *session, GWBUF *reply)
 {
+    DS_INSTANCE *my_instance = (DS_INSTANCE*) instance;
     DS_SESSION *my_session = (DS_SESSION*) session;
     int rc = 1;
 
-    if (my_session->state == DS_CLOSING_STREAM ||
-        (my_session->state == DS_REQUEST_SENT &&
-         !MYSQL_IS_ERROR_PACKET((uint8_t*)GWBUF_DATA(reply))))
+    if (my_session->state == DS_CLOSING_STREAM || my_session->state == DS_REQUEST_SENT)
     {
-        gwbuf_free(reply);
-        ss_dassert(my_session->queue);
-
-        my_session->state = my_session->state == DS_CLOSING_STREAM ?
-                            DS_STREAM_CLOSED : DS_REQUEST_ACCEPTED;
-
+        uint8_t header[MYSQL_HEADER_LEN + 1];
+        bool error = gwbuf_copy_data(reply, 0, sizeof(header), header) == sizeof(header) &&
+                     MYSQL_IS_ERROR_PACKET(header);
         GWBUF* queue = my_session->queue;
         my_session->queue = NULL;
 
-        if (my_session->state == DS_REQUEST_ACCEPTED)
+        if (my_session->state == DS_REQUEST_SENT)
         {
-            /** The request is packet 0 and the response is packet 1 so we'll
-             * have to send the data in packet number 2 */
-            my_session->packet_num++;
+            if (error)
+            {
+                /** The server does not accept the stream, the insert is
+                 * executed as it is and nothing is streamed in this session */
+                MXS_WARNING("Server refused LOAD DATA LOCAL INFILE, disabling "
+                            "insert streaming for the session.");
+                my_session->active = false;
+                my_session->state = DS_STREAM_CLOSED;
+            }
+            else
+            {
+                /** The request is packet 0 and the response is packet 1 so we'll
+                 * have to send the data in packet number 2 */
+                my_session->state = DS_REQUEST_ACCEPTED;
+                my_session->packet_num++;
+            }
+
+            gwbuf_free(reply);
         }
+        else
+        {
+            my_session->state = DS_STREAM_CLOSED;
+
+            if (error)
+            {
+                atomic_add(&my_instance->n_errors, 1);
+                reply = gwbuf_make_contiguous(reply);
+                MXS_ERROR("Streaming of inserts into '%s' failed.", my_session->target);
+            }
 
-        poll_add_epollin_event_to_dcb(my_session->client_dcb, queue);
+            if (error && queue)
+            {
+                /** The rows acknowledged earlier were not stored, the error
+                 * is returned instead of executing the statement. */
+                gwbuf_free(queue);
+                queue = NULL;
+                GWBUF_DATA(reply)[3] = 1;
+                rc = my_session->up.clientReply(my_session->up.instance,
+                                                my_session->up.session, reply);
+            }
+            else
+            {
+                gwbuf_free(reply);
+            }
+        }
+
+        if (queue)
+        {
+            poll_add_epollin_event_to_dcb(my_session->client_dcb, queue);
+        }
     }
     else
     {
@@ -510,6 +873,16 @@ static void diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *
     {
         dcb_printf(dcb, "\t\tReplacement limit to user           %s\n", my_instance->user);
     }
+    dcb_printf(dcb, "\t\tBatch size                          %lu\n", my_instance->batch_size);
+    dcb_printf(dcb, "\t\tFlush timeout                       %d ms\n", my_instance->flush_timeout);
+    dcb_printf(dcb, "\t\tStream autocommit inserts           %s\n",
+               my_instance->autocommit ? "yes" : "no");
+    dcb_printf(dcb, "\t\tStreams opened                      %d\n",
+               atomic_add(&my_instance->n_streams, 0));
+    dcb_printf(dcb, "\t\tRows streamed                       %d\n",
+               atomic_add(&my_instance->n_rows, 0));
+    dcb_printf(dcb, "\t\tFailed streams                      %d\n",
+               atomic_add(&my_instance->n_errors, 0));
 }
 
 /**
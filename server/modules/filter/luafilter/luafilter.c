@@ -34,6 +34,10 @@
  * is defined and valid, the matching entry point function in Lua will be called.
  * The same holds true for session script apart from no calls to createInstance
  * or diagnostic being made for the session script.
+ *
+ * With global_scope=thread, each routing thread has a Lua state of its own for
+ * the global script. Values that must be seen by all threads are stored with
+ * the shared_set, shared_get and shared_add functions.
  */
 
 #define MXS_MODULE_NAME "luafilter"
@@ -46,8 +50,11 @@
 #include <maxscale/alloc.h>
 #include <maxscale/debug.h>
 #include <maxscale/filter.h>
+#include <maxscale/hashtable.h>
 #include <maxscale/log_manager.h>
+#include <maxscale/modulecmd.h>
 #include <maxscale/modutil.h>
+#include <maxscale/platform.h>
 #include <maxscale/query_classifier.h>
 #include <maxscale/session.h>
 #include <maxscale/spinlock.h>
@@ -65,6 +72,22 @@ static int32_t routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, GW
 static int32_t clientReply(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, GWBUF *queue);
 static void diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb);
 static uint64_t getCapabilities(MXS_FILTER *instance);
+static bool lua_show_shared(const MODULECMD_ARG *argv);
+static bool lua_set_shared(const MODULECMD_ARG *argv);
+
+/** Where the global script is executed */
+enum global_scope
+{
+    GLOBAL_SCOPE_INSTANCE, /* One Lua state for the filter instance */
+    GLOBAL_SCOPE_THREAD    /* One Lua state for each routing thread */
+};
+
+static const MXS_ENUM_VALUE global_scope_values[] =
+{
+    {"instance", GLOBAL_SCOPE_INSTANCE},
+    {"thread",   GLOBAL_SCOPE_THREAD},
+    {NULL}
+};
 
 /**
  * The module entry point routine. It is this routine that
@@ -76,6 +99,23 @@ static uint64_t getCapabilities(MXS_FILTER *instance);
  */
 MXS_MODULE* MXS_CREATE_MODULE()
 {
+    modulecmd_arg_type_t args_show[] =
+    {
+        {MODULECMD_ARG_OUTPUT, "DCB where result is written"},
+        {MODULECMD_ARG_FILTER | MODULECMD_ARG_NAME_MATCHES_DOMAIN, "Filter to inspect"}
+    };
+
+    modulecmd_register_command(MXS_MODULE_NAME, "shared", lua_show_shared, 2, args_show);
+
+    modulecmd_arg_type_t args_set[] =
+    {
+        {MODULECMD_ARG_FILTER | MODULECMD_ARG_NAME_MATCHES_DOMAIN, "Filter to modify"},
+        {MODULECMD_ARG_STRING, "Name of the shared value"},
+        {MODULECMD_ARG_STRING | MODULECMD_ARG_OPTIONAL, "New value, removed if not given"}
+    };
+
+    modulecmd_register_command(MXS_MODULE_NAME, "shared/set", lua_set_shared, 3, args_set);
+
     static MXS_FILTER_OBJECT MyObject =
     {
         createInstance,
@@ -97,7 +137,7 @@ MXS_MODULE* MXS_CREATE_MODULE()
         MXS_MODULE_EXPERIMENTAL,
         MXS_FILTER_VERSION,
         "Lua Filter",
-        "V1.0.0",
+        "V1.1.0",
         &MyObject,
         NULL, /* Process init. */
         NULL, /* Process finish. */
@@ -106,6 +146,13 @@ MXS_MODULE* MXS_CREATE_MODULE()
         {
             {"global_script", MXS_MODULE_PARAM_PATH, NULL, MXS_MODULE_OPT_PATH_R_OK},
             {"session_script", MXS_MODULE_PARAM_PATH, NULL, MXS_MODULE_OPT_PATH_R_OK},
+            {
+                "global_scope",
+                MXS_MODULE_PARAM_ENUM,
+                "instance",
+                MXS_MODULE_OPT_NONE,
+                global_scope_values
+            },
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -114,7 +161,12 @@ MXS_MODULE* MXS_CREATE_MODULE()
 }
 
 static int id_pool = 0;
-static GWBUF *current_global_query = NULL;
+
+/** Counter used for assigning the routing threads their global Lua states */
+static int next_thread_slot = 0;
+
+/** Index of the global Lua state of the current thread */
+static thread_local int thread_slot = -1;
 
 /**
  * Push an unique integer to the Lua state's stack
@@ -166,17 +218,317 @@ static int lua_qc_get_operation(lua_State* state)
     return 1;
 }
 
+/**
+ * A Lua state of the global script.
+ */
+typedef struct
+{
+    lua_State* lua_state;
+    GWBUF* current_query;
+    SPINLOCK lock; /* Only contended with global_scope=instance */
+} LUA_GLOBAL;
+
 /**
  * The Lua filter instance.
  */
 typedef struct
 {
-    lua_State* global_lua_state;
+    LUA_GLOBAL* globals; /* The states of the global script */
+    int n_globals;       /* One, or the number of routing threads */
     char* global_script;
     char* session_script;
-    SPINLOCK lock;
+    SPINLOCK shared_lock;
+    HASHTABLE* shared;   /* Values shared by all Lua states */
 } LUA_INSTANCE;
 
+/**
+ * A value shared by all Lua states of an instance.
+ */
+typedef struct
+{
+    bool is_number;
+    lua_Number number;
+    char* string;
+} LUA_SHARED_VALUE;
+
+static void shared_value_free(void* data)
+{
+    LUA_SHARED_VALUE* value = (LUA_SHARED_VALUE*)data;
+
+    if (value)
+    {
+        MXS_FREE(value->string);
+        MXS_FREE(value);
+    }
+}
+
+/**
+ * Store a shared value. The value is removed if @c string is NULL and
+ * @c is_number is false.
+ *
+ * @param instance  The filter instance
+ * @param key       Name of the value
+ * @param is_number Whether the value is a number
+ * @param number    The number
+ * @param string    The string if the value is not a number
+ *
+ * @return False on memory allocation failure
+ */
+static bool shared_store(LUA_INSTANCE* instance, const char* key, bool is_number,
+                         lua_Number number, const char* string)
+{
+    bool rval = true;
+    LUA_SHARED_VALUE* value = NULL;
+
+    if (is_number || string)
+    {
+        if ((value = MXS_CALLOC(1, sizeof(LUA_SHARED_VALUE))) == NULL ||
+            (string && (value->string = MXS_STRDUP(string)) == NULL))
+        {
+            MXS_FREE(value);
+            return false;
+        }
+
+        value->is_number = is_number;
+        value->number = number;
+    }
+
+    spinlock_acquire(&instance->shared_lock);
+    hashtable_delete(instance->shared, (void*)key);
+
+    if (value && !hashtable_add(instance->shared, (void*)key, value))
+    {
+        shared_value_free(value);
+        rval = false;
+    }
+
+    spinlock_release(&instance->shared_lock);
+    return rval;
+}
+
+/**
+ * Lua: shared_set(string, number | string | nil)
+ *
+ * Store a value that is seen by all Lua states of the instance.
+ */
+static int lua_shared_set(lua_State* state)
+{
+    LUA_INSTANCE* instance = (LUA_INSTANCE*)lua_touserdata(state, lua_upvalueindex(1));
+    const char* key = luaL_checkstring(state, 1);
+    bool is_number = lua_type(state, 2) == LUA_TNUMBER;
+    const char* string = is_number || lua_isnil(state, 2) ? NULL : luaL_checkstring(state, 2);
+
+    if (!shared_store(instance, key, is_number, is_number ? lua_tonumber(state, 2) : 0, string))
+    {
+        return luaL_error(state, "Failed to store shared value '%s'", key);
+    }
+
+    return 0;
+}
+
+/**
+ * Lua: (number | string | nil) shared_get(string)
+ *
+ * Get a value stored with shared_set or shared_add.
+ */
+static int lua_shared_get(lua_State* state)
+{
+    LUA_INSTANCE* instance = (LUA_INSTANCE*)lua_touserdata(state, lua_upvalueindex(1));
+    const char* key = luaL_checkstring(state, 1);
+
+    // Pushing a string can raise an error, so the value is copied first
+    bool found = false;
+    bool is_number = false;
+    lua_Number number = 0;
+    char* string = NULL;
+
+    spinlock_acquire(&instance->shared_lock);
+    LUA_SHARED_VALUE* value = hashtable_fetch(instance->shared, (void*)key);
+
+    if (value)
+    {
+        found = true;
+        is_number = value->is_number;
+        number = value->number;
+        string = value->string ? MXS_STRDUP(value->string) : NULL;
+    }
+
+    spinlock_release(&instance->shared_lock);
+
+    if (!found || (!is_number && string == NULL))
+    {
+        lua_pushnil(state);
+    }
+    else if (is_number)
+    {
+        lua_pushnumber(state, number);
+    }
+    else
+    {
+        lua_pushstring(state, string);
+    }
+
+    MXS_FREE(string);
+    return 1;
+}
+
+/**
+ * Lua: number shared_add(string, number)
+ *
+ * Atomically add to a shared number. A missing value is treated as zero.
+ *
+ * @return The new value
+ */
+static int lua_shared_add(lua_State* state)
+{
+    LUA_INSTANCE* instance = (LUA_INSTANCE*)lua_touserdata(state, lua_upvalueindex(1));
+    const char* key = luaL_checkstring(state, 1);
+    lua_Number n = luaL_checknumber(state, 2);
+    lua_Number result = 0;
+    bool ok = true;
+
+    spinlock_acquire(&instance->shared_lock);
+    LUA_SHARED_VALUE* value = hashtable_fetch(instance->shared, (void*)key);
+
+    if (value == NULL)
+    {
+        if ((value = MXS_CALLOC(1, sizeof(LUA_SHARED_VALUE))) &&
+            hashtable_add(instance->shared, (void*)key, value))
+        {
+            value->is_number = true;
+        }
+        else
+        {
+            MXS_FREE(value);
+            value = NULL;
+            ok = false;
+        }
+    }
+    else if (!value->is_number)
+    {
+        value = NULL;
+        ok = false;
+    }
+
+    if (value)
+    {
+        value->number += n;
+        result = value->number;
+    }
+
+    spinlock_release(&instance->shared_lock);
+
+    if (!ok)
+    {
+        return luaL_error(state, "Shared value '%s' is not a number", key);
+    }
+
+    lua_pushnumber(state, result);
+    return 1;
+}
+
+/**
+ * Expose the shared value functions to a Lua state.
+ *
+ * @param instance The filter instance
+ * @param state    The Lua state
+ */
+static void expose_shared_api(LUA_INSTANCE* instance, lua_State* state)
+{
+    lua_pushlightuserdata(state, instance);
+    lua_pushcclosure(state, lua_shared_set, 1);
+    lua_setglobal(state, "shared_set");
+
+    lua_pushlightuserdata(state, instance);
+    lua_pushcclosure(state, lua_shared_get, 1);
+    lua_setglobal(state, "shared_get");
+
+    lua_pushlightuserdata(state, instance);
+    lua_pushcclosure(state, lua_shared_add, 1);
+    lua_setglobal(state, "shared_add");
+}
+
+/**
+ * Get the global Lua state of the calling thread.
+ *
+ * @param instance The filter instance
+ *
+ * @return The state or NULL if there is no global script
+ */
+static LUA_GLOBAL* get_global(LUA_INSTANCE* instance)
+{
+    if (instance->n_globals == 0)
+    {
+        return NULL;
+    }
+
+    if (instance->n_globals == 1)
+    {
+        return &instance->globals[0];
+    }
+
+    if (thread_slot == -1)
+    {
+        thread_slot = atomic_add(&next_thread_slot, 1);
+    }
+
+    // Threads that are not routing threads share the states
+    return &instance->globals[thread_slot % instance->n_globals];
+}
+
+/**
+ * Load the global script into a new Lua state and call its createInstance.
+ *
+ * @param instance The filter instance
+ * @param global   The state to initialize
+ *
+ * @return True on success
+ */
+static bool load_global_script(LUA_INSTANCE* instance, LUA_GLOBAL* global)
+{
+    spinlock_init(&global->lock);
+    global->current_query = NULL;
+
+    if ((global->lua_state = luaL_newstate()) == NULL)
+    {
+        MXS_ERROR("Unable to initialize new Lua state.");
+        return false;
+    }
+
+    luaL_openlibs(global->lua_state);
+    expose_shared_api(instance, global->lua_state);
+
+    if (luaL_dofile(global->lua_state, instance->global_script))
+    {
+        MXS_ERROR("Failed to execute global script at '%s':%s.",
+                  instance->global_script, lua_tostring(global->lua_state, -1));
+        lua_close(global->lua_state);
+        global->lua_state = NULL;
+        return false;
+    }
+
+    lua_getglobal(global->lua_state, "createInstance");
+
+    if (lua_pcall(global->lua_state, 0, 0, 0))
+    {
+        MXS_WARNING("Failed to get global variable 'createInstance':  %s."
+                    " The createInstance entry point will not be called for the global script.",
+                    lua_tostring(global->lua_state, -1));
+        lua_pop(global->lua_state, -1); // Pop the error off the stack
+    }
+
+    /** Expose a part of the query classifier API */
+    lua_pushlightuserdata(global->lua_state, &global->current_query);
+    lua_pushcclosure(global->lua_state, lua_qc_get_type_mask, 1);
+    lua_setglobal(global->lua_state, "lua_qc_get_type_mask");
+
+    lua_pushlightuserdata(global->lua_state, &global->current_query);
+    lua_pushcclosure(global->lua_state, lua_qc_get_operation, 1);
+    lua_setglobal(global->lua_state, "lua_qc_get_operation");
+
+    return true;
+}
+
 /**
  * The session structure for Lua filter.
  */
@@ -209,52 +561,57 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
         return NULL;
     }
 
-    spinlock_init(&my_instance->lock);
+    spinlock_init(&my_instance->shared_lock);
 
     my_instance->global_script = config_copy_string(params, "global_script");
     my_instance->session_script = config_copy_string(params, "session_script");
+    my_instance->shared = hashtable_alloc(16, hashtable_item_strhash, hashtable_item_strcmp);
+
+    if (my_instance->shared == NULL)
+    {
+        MXS_FREE(my_instance->global_script);
+        MXS_FREE(my_instance->session_script);
+        MXS_FREE(my_instance);
+        return NULL;
+    }
+
+    hashtable_memory_fns(my_instance->shared, hashtable_item_strdup, NULL,
+                         hashtable_item_free, shared_value_free);
 
     if (my_instance->global_script)
     {
-        if ((my_instance->global_lua_state = luaL_newstate()))
+        int n_globals = 1;
+
+        if (config_get_enum(params, "global_scope", global_scope_values) == GLOBAL_SCOPE_THREAD)
         {
-            luaL_openlibs(my_instance->global_lua_state);
+            n_globals = config_threadcount();
+        }
 
-            if (luaL_dofile(my_instance->global_lua_state, my_instance->global_script))
+        bool error = (my_instance->globals = MXS_CALLOC(n_globals, sizeof(LUA_GLOBAL))) == NULL;
+
+        for (int i = 0; !error && i < n_globals; i++)
+        {
+            if (load_global_script(my_instance, &my_instance->globals[i]))
             {
-                MXS_ERROR("Failed to execute global script at '%s':%s.",
-                          my_instance->global_script, lua_tostring(my_instance->global_lua_state, -1));
-                MXS_FREE(my_instance->global_script);
-                MXS_FREE(my_instance->session_script);
-                MXS_FREE(my_instance);
-                my_instance = NULL;
+                my_instance->n_globals++;
             }
-            else if (my_instance->global_lua_state)
+            else
             {
-                lua_getglobal(my_instance->global_lua_state, "createInstance");
-
-                if (lua_pcall(my_instance->global_lua_state, 0, 0, 0))
-                {
-                    MXS_WARNING("Failed to get global variable 'createInstance':  %s."
-                                " The createInstance entry point will not be called for the global script.",
-                                lua_tostring(my_instance->global_lua_state, -1));
-                    lua_pop(my_instance->global_lua_state, -1); // Pop the error off the stack
-                }
-
-                /** Expose a part of the query classifier API */
-                lua_pushlightuserdata(my_instance->global_lua_state, &current_global_query);
-                lua_pushcclosure(my_instance->global_lua_state, lua_qc_get_type_mask, 1);
-                lua_setglobal(my_instance->global_lua_state, "lua_qc_get_type_mask");
-
-                lua_pushlightuserdata(my_instance->global_lua_state, &current_global_query);
-                lua_pushcclosure(my_instance->global_lua_state, lua_qc_get_operation, 1);
-                lua_setglobal(my_instance->global_lua_state, "lua_qc_get_operation");
-
+                error = true;
             }
         }
-        else
+
+        if (error)
         {
-            MXS_ERROR("Unable to initialize new Lua state.");
+            for (int i = 0; i < my_instance->n_globals; i++)
+            {
+                lua_close(my_instance->globals[i].lua_state);
+            }
+
+            MXS_FREE(my_instance->globals);
+            hashtable_free(my_instance->shared);
+            MXS_FREE(my_instance->global_script);
+            MXS_FREE(my_instance->session_script);
             MXS_FREE(my_instance);
             my_instance = NULL;
         }
@@ -296,6 +653,7 @@ static MXS_FILTER_SESSION *newSession(MXS_FILTER *instance, MXS_SESSION *session
     {
         my_session->lua_state = luaL_newstate();
         luaL_openlibs(my_session->lua_state);
+        expose_shared_api(my_instance, my_session->lua_state);
 
         if (luaL_dofile(my_session->lua_state, my_instance->session_script))
         {
@@ -336,23 +694,25 @@ static MXS_FILTER_SESSION *newSession(MXS_FILTER *instance, MXS_SESSION *session
         }
     }
 
-    if (my_session && my_instance->global_lua_state)
+    LUA_GLOBAL *global = get_global(my_instance);
+
+    if (my_session && global)
     {
-        spinlock_acquire(&my_instance->lock);
+        spinlock_acquire(&global->lock);
 
-        lua_getglobal(my_instance->global_lua_state, "newSession");
-        lua_pushstring(my_instance->global_lua_state, session->client_dcb->user);
-        lua_pushstring(my_instance->global_lua_state, session->client_dcb->remote);
+        lua_getglobal(global->lua_state, "newSession");
+        lua_pushstring(global->lua_state, session->client_dcb->user);
+        lua_pushstring(global->lua_state, session->client_dcb->remote);
 
-        if (lua_pcall(my_instance->global_lua_state, 2, 0, 0))
+        if (lua_pcall(global->lua_state, 2, 0, 0))
         {
             MXS_WARNING("Failed to get global variable 'newSession': '%s'."
                         " The newSession entry point will not be called for the global script.",
-                        lua_tostring(my_instance->global_lua_state, -1));
-            lua_pop(my_instance->global_lua_state, -1); // Pop the error off the stack
+                        lua_tostring(global->lua_state, -1));
+            lua_pop(global->lua_state, -1); // Pop the error off the stack
         }
 
-        spinlock_release(&my_instance->lock);
+        spinlock_release(&global->lock);
     }
 
     return (MXS_FILTER_SESSION*)my_session;
@@ -388,20 +748,22 @@ static void closeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session)
         spinlock_release(&my_session->lock);
     }
 
-    if (my_instance->global_lua_state)
+    LUA_GLOBAL *global = get_global(my_instance);
+
+    if (global)
     {
-        spinlock_acquire(&my_instance->lock);
+        spinlock_acquire(&global->lock);
 
-        lua_getglobal(my_instance->global_lua_state, "closeSession");
+        lua_getglobal(global->lua_state, "closeSession");
 
-        if (lua_pcall(my_instance->global_lua_state, 0, 0, 0))
+        if (lua_pcall(global->lua_state, 0, 0, 0))
         {
             MXS_WARNING("Failed to get global variable 'closeSession': '%s'."
                         " The closeSession entry point will not be called for the global script.",
-                        lua_tostring(my_instance->global_lua_state, -1));
-            lua_pop(my_instance->global_lua_state, -1);
+                        lua_tostring(global->lua_state, -1));
+            lua_pop(global->lua_state, -1);
         }
-        spinlock_release(&my_instance->lock);
+        spinlock_release(&global->lock);
     }
 }
 
@@ -478,20 +840,22 @@ static int32_t clientReply(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GW
 
         spinlock_release(&my_session->lock);
     }
-    if (my_instance->global_lua_state)
+    LUA_GLOBAL *global = get_global(my_instance);
+
+    if (global)
     {
-        spinlock_acquire(&my_instance->lock);
+        spinlock_acquire(&global->lock);
 
-        lua_getglobal(my_instance->global_lua_state, "clientReply");
+        lua_getglobal(global->lua_state, "clientReply");
 
-        if (lua_pcall(my_instance->global_lua_state, 0, 0, 0))
+        if (lua_pcall(global->lua_state, 0, 0, 0))
         {
             MXS_ERROR("Global scope call to 'clientReply' failed: '%s'.",
-                      lua_tostring(my_session->lua_state, -1));
-            lua_pop(my_instance->global_lua_state, -1);
+                      lua_tostring(global->lua_state, -1));
+            lua_pop(global->lua_state, -1);
         }
 
-        spinlock_release(&my_instance->lock);
+        spinlock_release(&global->lock);
     }
 
     return my_session->up.clientReply(my_session->up.instance,
@@ -564,36 +928,38 @@ static int32_t routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWB
             spinlock_release(&my_session->lock);
         }
 
-        if (my_instance->global_lua_state)
+        LUA_GLOBAL *global = get_global(my_instance);
+
+        if (fullquery && global)
         {
-            spinlock_acquire(&my_instance->lock);
-            current_global_query = queue;
+            spinlock_acquire(&global->lock);
+            global->current_query = queue;
 
-            lua_getglobal(my_instance->global_lua_state, "routeQuery");
+            lua_getglobal(global->lua_state, "routeQuery");
 
-            lua_pushlstring(my_instance->global_lua_state, fullquery, strlen(fullquery));
+            lua_pushlstring(global->lua_state, fullquery, strlen(fullquery));
 
-            if (lua_pcall(my_instance->global_lua_state, 1, 0, 0))
+            if (lua_pcall(global->lua_state, 1, 0, 0))
             {
                 MXS_ERROR("Global scope call to 'routeQuery' failed: '%s'.",
-                          lua_tostring(my_instance->global_lua_state, -1));
-                lua_pop(my_instance->global_lua_state, -1);
+                          lua_tostring(global->lua_state, -1));
+                lua_pop(global->lua_state, -1);
             }
-            else if (lua_gettop(my_instance->global_lua_state))
+            else if (lua_gettop(global->lua_state))
             {
-                if (lua_isstring(my_instance->global_lua_state, -1))
+                if (lua_isstring(global->lua_state, -1))
                 {
                     gwbuf_free(forward);
-                    forward = modutil_create_query(lua_tostring(my_instance->global_lua_state, -1));
+                    forward = modutil_create_query(lua_tostring(global->lua_state, -1));
                 }
-                else if (lua_isboolean(my_instance->global_lua_state, -1))
+                else if (lua_isboolean(global->lua_state, -1))
                 {
-                    route = lua_toboolean(my_instance->global_lua_state, -1);
+                    route = lua_toboolean(global->lua_state, -1);
                 }
             }
 
-            current_global_query = NULL;
-            spinlock_release(&my_instance->lock);
+            global->current_query = NULL;
+            spinlock_release(&global->lock);
         }
 
         MXS_FREE(fullquery);
@@ -629,28 +995,31 @@ static void diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *
 
     if (my_instance)
     {
-        if (my_instance->global_lua_state)
+        // With a state per thread, each state reports its own view
+        for (int i = 0; i < my_instance->n_globals; i++)
         {
-            spinlock_acquire(&my_instance->lock);
+            LUA_GLOBAL *global = &my_instance->globals[i];
+            spinlock_acquire(&global->lock);
 
-            lua_getglobal(my_instance->global_lua_state, "diagnostic");
+            lua_getglobal(global->lua_state, "diagnostic");
 
-            if (lua_pcall(my_instance->global_lua_state, 0, 1, 0) == 0)
+            if (lua_pcall(global->lua_state, 0, 1, 0) == 0)
             {
-                lua_gettop(my_instance->global_lua_state);
-                if (lua_isstring(my_instance->global_lua_state, -1))
+                lua_gettop(global->lua_state);
+                if (lua_isstring(global->lua_state, -1))
                 {
-                    dcb_printf(dcb, "%s", lua_tostring(my_instance->global_lua_state, -1));
+                    dcb_printf(dcb, "%s", lua_tostring(global->lua_state, -1));
                     dcb_printf(dcb, "\n");
                 }
+                lua_pop(global->lua_state, 1);
             }
             else
             {
                 dcb_printf(dcb, "Global scope call to 'diagnostic' failed: '%s'.\n",
-                           lua_tostring(my_instance->global_lua_state, -1));
-                lua_pop(my_instance->global_lua_state, -1);
+                           lua_tostring(global->lua_state, -1));
+                lua_pop(global->lua_state, -1);
             }
-            spinlock_release(&my_instance->lock);
+            spinlock_release(&global->lock);
         }
         if (my_instance->global_script)
         {
@@ -660,6 +1029,10 @@ static void diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *
         {
             dcb_printf(dcb, "Session script: %s\n", my_instance->session_script);
         }
+        if (my_instance->n_globals > 1)
+        {
+            dcb_printf(dcb, "Global script states: %d\n", my_instance->n_globals);
+        }
     }
 }
 
@@ -672,3 +1045,77 @@ static uint64_t getCapabilities(MXS_FILTER *instance)
 {
     return RCAP_TYPE_CONTIGUOUS_INPUT;
 }
+
+/**
+ * Module command for printing the shared values of an instance.
+ *
+ * @param argv The output DCB and the filter
+ *
+ * @return Always true
+ */
+static bool lua_show_shared(const MODULECMD_ARG *argv)
+{
+    DCB *dcb = argv->argv[0].value.dcb;
+    MXS_FILTER_DEF *filter = argv->argv[1].value.filter;
+    LUA_INSTANCE *instance = (LUA_INSTANCE*)filter_def_get_instance(filter);
+
+    spinlock_acquire(&instance->shared_lock);
+    HASHITERATOR *iter = hashtable_iterator(instance->shared);
+
+    if (iter)
+    {
+        char *key;
+
+        while ((key = hashtable_next(iter)))
+        {
+            LUA_SHARED_VALUE *value = hashtable_fetch(instance->shared, key);
+
+            if (value->is_number)
+            {
+                dcb_printf(dcb, "%s: %.14g\n", key, value->number);
+            }
+            else
+            {
+                dcb_printf(dcb, "%s: %s\n", key, value->string);
+            }
+        }
+
+        hashtable_iterator_free(iter);
+    }
+
+    spinlock_release(&instance->shared_lock);
+    return true;
+}
+
+/**
+ * Module command for setting a shared value of an instance. A value that
+ * looks like a number is stored as a number.
+ *
+ * @param argv The filter, the name and the optional value
+ *
+ * @return True if the value was stored
+ */
+static bool lua_set_shared(const MODULECMD_ARG *argv)
+{
+    MXS_FILTER_DEF *filter = argv->argv[0].value.filter;
+    LUA_INSTANCE *instance = (LUA_INSTANCE*)filter_def_get_instance(filter);
+    const char *key = argv->argv[1].value.string;
+    const char *string = modulecmd_arg_is_present(argv, 2) ? argv->argv[2].value.string : NULL;
+    lua_Number number = 0;
+    bool is_number = false;
+
+    if (string && *string)
+    {
+        char *end;
+        number = strtod(string, &end);
+        is_number = *end == '\0';
+    }
+
+    if (!shared_store(instance, key, is_number, number, is_number ? NULL : string))
+    {
+        modulecmd_set_error("Memory allocation failed.");
+        return false;
+    }
+
+    return true;
+}
@@ -65,11 +65,33 @@ int MaskingFilterSession::routeQuery(GWBUF* pPacket)
 
 int MaskingFilterSession::clientReply(GWBUF* pPacket)
 {
-    ss_dassert(GWBUF_IS_CONTIGUOUS(pPacket));
+    uint8_t header[MYSQL_HEADER_LEN + 1];
 
-    ComResponse response(pPacket);
+    // The rows are masked in place and need not be contiguous, but the other
+    // packets are examined using the packet classes.
+    bool examined = (m_state == EXPECTING_RESPONSE) || (m_state == EXPECTING_FIELD) ||
+                    (m_state == EXPECTING_FIELD_EOF) || (m_state == EXPECTING_ROW_EOF);
+
+    if (examined && !GWBUF_IS_CONTIGUOUS(pPacket))
+    {
+        GWBUF* pContiguous = gwbuf_make_contiguous(pPacket);
+
+        if (!pContiguous)
+        {
+            gwbuf_free(pPacket);
+            poll_fake_hangup_event(m_pSession->client_dcb);
+            return 0;
+        }
+
+        pPacket = pContiguous;
+    }
+
+    // A packet continuing a large row can start with any byte.
+    bool continuation = (m_state == EXPECTING_ROW) && m_masker.row_continues();
 
-    if (response.is_err())
+    if (!continuation &&
+        (gwbuf_copy_data(pPacket, 0, sizeof(header), header) == sizeof(header)) &&
+        (header[MYSQL_HEADER_LEN] == ComResponse::ERR_PACKET))
     {
         // If we get an error response, we just abort what we were doing.
         m_state = EXPECTING_NOTHING;
@@ -169,7 +191,11 @@ void MaskingFilterSession::handle_field(GWBUF* pPacket)
 
         if (m_res.append_type_and_rule(column_def.type(), pRule))
         {
-            // All fields have been read.
+            // All fields have been read, so the rule of each column is now known.
+            m_masker.reset(m_res.command() == MYSQL_COM_STMT_EXECUTE,
+                           m_res.types(),
+                           m_res.column_rules(),
+                           m_filter.config().warn_type_mismatch() == Config::WARN_ALWAYS);
             m_state = EXPECTING_FIELD_EOF;
         }
     }
@@ -203,28 +229,19 @@ void MaskingFilterSession::handle_eof(GWBUF* pPacket)
     }
 }
 
-namespace
-{
-
-void warn_of_type_mismatch(const MaskingRules::Rule& rule)
-{
-    MXS_WARNING("The rule targeting \"%s\" matches a column "
-                "that is not of string type.", rule.match().c_str());
-}
-
-}
-
 void MaskingFilterSession::handle_row(GWBUF* pPacket)
 {
-    ComPacket response(pPacket);
+    uint8_t data[ComEOF::PACKET_LEN];
 
-    if ((response.payload_len() == ComEOF::PAYLOAD_LEN) &&
-        (ComResponse(response).type() == ComResponse::EOF_PACKET))
+    if (!m_masker.row_continues() &&
+        (gwbuf_copy_data(pPacket, 0, sizeof(data), data) == sizeof(data)) &&
+        (MYSQL_GET_PAYLOAD_LEN(data) == ComEOF::PAYLOAD_LEN) &&
+        (data[MYSQL_HEADER_LEN] == ComResponse::EOF_PACKET))
     {
-        // EOF after last row.
-        ComEOF eof(response);
+        // EOF after last row. The status follows the type and the warning count.
+        uint16_t status = gw_mysql_get_byte2(&data[MYSQL_HEADER_LEN + 3]);
 
-        if (eof.status() & SERVER_MORE_RESULTS_EXIST)
+        if (status & SERVER_MORE_RESULTS_EXIST)
         {
             m_res.reset_multi();
             m_state = EXPECTING_RESPONSE;
@@ -236,17 +253,7 @@ void MaskingFilterSession::handle_row(GWBUF* pPacket)
     }
     else
     {
-        if (m_res.some_rule_matches())
-        {
-            if (response.payload_len() >= ComPacket::MAX_PAYLOAD_LEN)
-            {
-                handle_large_payload();
-            }
-            else
-            {
-                mask_values(response);
-            }
-        }
+        m_masker.process(pPacket);
     }
 }
 
@@ -264,69 +271,3 @@ void MaskingFilterSession::handle_large_payload()
         m_state = IGNORING_RESPONSE;
     }
 }
-
-void MaskingFilterSession::mask_values(ComPacket& response)
-{
-    switch (m_res.command())
-    {
-    case MYSQL_COM_QUERY:
-        {
-            ComQueryResponse::TextResultsetRow row(response, m_res.types());
-
-            ComQueryResponse::TextResultsetRow::iterator i = row.begin();
-            while (i != row.end())
-            {
-                const MaskingRules::Rule* pRule = m_res.get_rule();
-
-                if (pRule)
-                {
-                    ComQueryResponse::TextResultsetRow::Value value = *i;
-
-                    if (value.is_string())
-                    {
-                        LEncString s = value.as_string();
-                        pRule->rewrite(s);
-                    }
-                    else if (m_filter.config().warn_type_mismatch() == Config::WARN_ALWAYS)
-                    {
-                        warn_of_type_mismatch(*pRule);
-                    }
-                }
-                ++i;
-            }
-        }
-        break;
-
-    case MYSQL_COM_STMT_EXECUTE:
-        {
-            ComQueryResponse::BinaryResultsetRow row(response, m_res.types());
-
-            ComQueryResponse::BinaryResultsetRow::iterator i = row.begin();
-            while (i != row.end())
-            {
-                const MaskingRules::Rule* pRule = m_res.get_rule();
-
-                if (pRule)
-                {
-                    ComQueryResponse::BinaryResultsetRow::Value value = *i;
-
-                    if (value.is_string())
-                    {
-                        LEncString s = value.as_string();
-                        pRule->rewrite(s);
-                    }
-                    else if (m_filter.config().warn_type_mismatch() == Config::WARN_ALWAYS)
-                    {
-                        warn_of_type_mismatch(*pRule);
-                    }
-                }
-                ++i;
-            }
-        }
-        break;
-
-    default:
-        MXS_ERROR("Unexpected request: %d", m_res.command());
-        ss_dassert(!true);
-    }
-}
@@ -17,6 +17,7 @@
 #include <tr1/memory>
 #include <maxscale/buffer.hh>
 #include <maxscale/filter.hh>
+#include "maskingrowmasker.hh"
 #include "maskingrules.hh"
 
 class MaskingFilter;
@@ -59,8 +60,6 @@ private:
     void handle_eof(GWBUF* pPacket);
     void handle_large_payload();
 
-    void mask_values(ComPacket& response);
-
 private:
     typedef std::tr1::shared_ptr<MaskingRules> SMaskingRules;
 
@@ -70,7 +69,6 @@ private:
         ResponseState()
             : m_command(0)
             , m_nTotal_fields(0)
-            , m_index(0)
             , m_multi_result(false)
             , m_some_rule_matches(false)
         {}
@@ -90,7 +88,6 @@ private:
             m_nTotal_fields = 0;
             m_types.clear();
             m_rules.clear();
-            m_index = 0;
             m_multi_result = true;
         }
 
@@ -142,15 +139,9 @@ private:
             return m_types;
         }
 
-        const MaskingRules::Rule* get_rule()
+        const MaskingRowMasker::Rules& column_rules() const
         {
-            ss_dassert(m_nTotal_fields == m_rules.size());
-            ss_dassert(m_index < m_rules.size());
-            const MaskingRules::Rule* pRule = m_rules[m_index++];
-            // The rules will be used repeatedly for each row. Hence, once we hit
-            // the end, we need to continue from the start.
-            m_index = m_index % m_rules.size();
-            return pRule;
+            return m_rules;
         }
 
     private:
@@ -158,8 +149,7 @@ private:
         SMaskingRules                          m_sRules;            /*<! The rules that are used. */
         uint32_t                               m_nTotal_fields;     /*<! The total number of fields. */
         std::vector<enum_field_types>          m_types;             /*<! The column types. */
-        std::vector<const MaskingRules::Rule*> m_rules;             /*<! The rules applied for columns. */
-        size_t                                 m_index;             /*<! Index to the current rule.*/
+        MaskingRowMasker::Rules                m_rules;             /*<! The rules applied for columns. */
         bool                                   m_multi_result;      /*<! Are we processing multi-results. */
         bool                                   m_some_rule_matches; /*<! At least one rule matches. */
     };
@@ -167,4 +157,5 @@ private:
     const MaskingFilter& m_filter;
     state_t              m_state;
     ResponseState        m_res;
+    MaskingRowMasker     m_masker;
 };
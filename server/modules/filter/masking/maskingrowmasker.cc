@@ -0,0 +1,303 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#define MXS_MODULE_NAME "masking"
+#include "maskingrowmasker.hh"
+#include <algorithm>
+#include <maxscale/mysql_utils.h>
+#include <maxscale/protocol/mysql.h>
+#include "mysql.hh"
+
+namespace
+{
+
+/**
+ * The length of a value in a binary resultset row.
+ *
+ * @param type  The type of the column.
+ *
+ * @return The length of the value, or -1 if the value is preceded by its length.
+ *
+ * @see https://dev.mysql.com/doc/internals/en/binary-protocol-value.html
+ */
+int binary_value_len(enum_field_types type)
+{
+    switch (type)
+    {
+    case MYSQL_TYPE_LONGLONG:
+    case MYSQL_TYPE_DOUBLE:
+        return 8;
+
+    case MYSQL_TYPE_LONG:
+    case MYSQL_TYPE_INT24:
+    case MYSQL_TYPE_FLOAT:
+        return 4;
+
+    case MYSQL_TYPE_SHORT:
+    case MYSQL_TYPE_YEAR:
+        return 2;
+
+    case MYSQL_TYPE_TINY:
+        return 1;
+
+    case MYSQL_TYPE_NULL:
+        return 0;
+
+    default:
+        // Strings and the like are length encoded, the temporal types are
+        // preceded by a length byte that is always less than 0xfb.
+        return -1;
+    }
+}
+
+}
+
+MaskingRowMasker::MaskingRowMasker()
+    : m_binary(false)
+    , m_pTypes(NULL)
+    , m_pRules(NULL)
+    , m_warn(false)
+    , m_nColumns(0)
+    , m_continues(false)
+    , m_state(DONE)
+    , m_column(0)
+    , m_pRule(NULL)
+    , m_nLength(0)
+    , m_value_len(0)
+    , m_offset(0)
+{
+}
+
+void MaskingRowMasker::reset(bool binary,
+                             const std::vector<enum_field_types>& types,
+                             const Rules& rules,
+                             bool warn)
+{
+    ss_dassert(types.size() == rules.size());
+
+    m_binary = binary;
+    m_pTypes = &types;
+    m_pRules = &rules;
+    m_warn = warn;
+    m_continues = false;
+    m_state = DONE;
+
+    // The walk of a row can stop after the last column that has a rule.
+    m_nColumns = 0;
+
+    for (size_t i = 0; i < rules.size(); ++i)
+    {
+        if (rules[i])
+        {
+            m_nColumns = i + 1;
+        }
+    }
+}
+
+void MaskingRowMasker::process(GWBUF* pPacket)
+{
+    uint8_t header[MYSQL_HEADER_LEN];
+
+    if (gwbuf_copy_data(pPacket, 0, MYSQL_HEADER_LEN, header) != MYSQL_HEADER_LEN)
+    {
+        ss_dassert(!true);
+        return;
+    }
+
+    if (!m_continues)
+    {
+        start_row();
+    }
+
+    m_continues = (MYSQL_GET_PAYLOAD_LEN(header) == ComPacket::MAX_PAYLOAD_LEN);
+
+    size_t skip = MYSQL_HEADER_LEN;
+
+    for (GWBUF* pBuf = pPacket; pBuf && (m_state != DONE); pBuf = pBuf->next)
+    {
+        uint8_t* pData = GWBUF_DATA(pBuf);
+        size_t len = GWBUF_LENGTH(pBuf);
+
+        if (skip < len)
+        {
+            walk(pData + skip, pData + len);
+            skip = 0;
+        }
+        else
+        {
+            skip -= len;
+        }
+    }
+}
+
+void MaskingRowMasker::start_row()
+{
+    m_column = 0;
+
+    if (m_nColumns == 0)
+    {
+        m_state = DONE;
+    }
+    else if (m_binary)
+    {
+        m_state = ROW_HEADER;
+    }
+    else
+    {
+        start_column();
+    }
+}
+
+void MaskingRowMasker::start_column()
+{
+    while (m_column < m_nColumns)
+    {
+        enum_field_types type = (*m_pTypes)[m_column];
+        const MaskingRules::Rule* pRule = (*m_pRules)[m_column];
+
+        if (m_binary)
+        {
+            // See https://dev.mysql.com/doc/internals/en/binary-protocol-resultset-row.html
+            size_t bit = m_column + 2;
+
+            if (m_nulls[bit / 8] & (1 << (bit % 8)))
+            {
+                ++m_column;
+                continue;
+            }
+        }
+
+        m_pRule = NULL;
+
+        if (pRule)
+        {
+            if (ComQueryResponse::TextResultsetRow::Value::is_string(type))
+            {
+                m_pRule = pRule;
+            }
+            else if (m_warn)
+            {
+                MXS_WARNING("The rule targeting \"%s\" matches a column "
+                            "that is not of string type.", pRule->match().c_str());
+            }
+        }
+
+        int len = m_binary ? binary_value_len(type) : -1;
+
+        if (len == 0)
+        {
+            ++m_column;
+            continue;
+        }
+
+        if (len > 0)
+        {
+            m_state = FIXED;
+            m_value_len = len;
+            m_offset = 0;
+        }
+        else
+        {
+            m_state = LENGTH;
+            m_nLength = 0;
+        }
+
+        return;
+    }
+
+    m_state = DONE;
+}
+
+void MaskingRowMasker::next_column()
+{
+    ++m_column;
+    start_column();
+}
+
+void MaskingRowMasker::walk(uint8_t* pData, uint8_t* pEnd)
+{
+    while ((pData < pEnd) && (m_state != DONE))
+    {
+        switch (m_state)
+        {
+        case ROW_HEADER:
+            ss_dassert(*pData == 0);
+            ++pData;
+            m_nulls.clear();
+            m_state = NULL_BITMAP;
+            break;
+
+        case NULL_BITMAP:
+            {
+                size_t nNull_bytes = (m_pTypes->size() + 7 + 2) / 8;
+                size_t n = std::min<size_t>(nNull_bytes - m_nulls.size(), pEnd - pData);
+
+                m_nulls.insert(m_nulls.end(), pData, pData + n);
+                pData += n;
+
+                if (m_nulls.size() == nNull_bytes)
+                {
+                    start_column();
+                }
+            }
+            break;
+
+        case LENGTH:
+            m_length[m_nLength++] = *pData++;
+
+            if (m_length[0] == 0xfb)
+            {
+                // NULL in a textual row.
+                next_column();
+            }
+            else if (m_nLength == mxs_leint_bytes(m_length))
+            {
+                m_value_len = mxs_leint_value(m_length);
+                m_offset = 0;
+
+                if (m_value_len == 0)
+                {
+                    next_column();
+                }
+                else
+                {
+                    m_state = VALUE;
+                }
+            }
+            break;
+
+        case FIXED:
+        case VALUE:
+            {
+                size_t n = std::min<uint64_t>(m_value_len - m_offset, pEnd - pData);
+
+                if ((m_state == VALUE) && m_pRule)
+                {
+                    m_pRule->rewrite(m_value_len, m_offset, reinterpret_cast<char*>(pData), n);
+                }
+
+                pData += n;
+                m_offset += n;
+
+                if (m_offset == m_value_len)
+                {
+                    next_column();
+                }
+            }
+            break;
+
+        case DONE:
+            break;
+        }
+    }
+}
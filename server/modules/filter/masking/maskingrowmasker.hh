@@ -0,0 +1,104 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <maxscale/cppdefs.hh>
+#include <vector>
+#include <maxscale/buffer.h>
+#include "maskingrules.hh"
+
+/**
+ * @class MaskingRowMasker
+ *
+ * A @c MaskingRowMasker masks the values of resultset rows in place.
+ *
+ * The row packets are walked as they are, without making them contiguous,
+ * so a length encoded value may straddle two buffers of the packet. A row
+ * whose payload is larger than 16MB is delivered in several packets and
+ * the walk simply continues in the following packet.
+ */
+class MaskingRowMasker
+{
+public:
+    typedef std::vector<const MaskingRules::Rule*> Rules;
+
+    MaskingRowMasker();
+
+    /**
+     * Prepare for the rows of a resultset.
+     *
+     * @param binary  True, if the rows are binary resultset rows.
+     * @param types   The types of the columns.
+     * @param rules   The rule of each column, NULL for columns that are not masked.
+     * @param warn    True, if a rule matching a column that is not of string
+     *                type should be warned about.
+     *
+     * @attention The vectors must remain valid until the next call.
+     */
+    void reset(bool binary,
+               const std::vector<enum_field_types>& types,
+               const Rules& rules,
+               bool warn);
+
+    /**
+     * @return True, if the previous packet had a payload of exactly 16MB,
+     *         that is, the next packet continues the same row.
+     */
+    bool row_continues() const
+    {
+        return m_continues;
+    }
+
+    /**
+     * Mask the values of a row packet.
+     *
+     * @param pPacket  A complete row packet, or a packet continuing the row
+     *                 of the previous packet.
+     */
+    void process(GWBUF* pPacket);
+
+private:
+    MaskingRowMasker(const MaskingRowMasker&);
+    MaskingRowMasker& operator = (const MaskingRowMasker&);
+
+    enum state_t
+    {
+        ROW_HEADER,   /*<! The header byte of a binary row. */
+        NULL_BITMAP,  /*<! The NULL bitmap of a binary row. */
+        LENGTH,       /*<! The length of a value. */
+        FIXED,        /*<! A fixed length binary value. */
+        VALUE,        /*<! The bytes of a length encoded value. */
+        DONE          /*<! Nothing more to mask in the row. */
+    };
+
+    void start_row();
+    void start_column();
+    void next_column();
+    void walk(uint8_t* pData, uint8_t* pEnd);
+
+private:
+    bool                                 m_binary;     /*<! Binary or textual rows. */
+    const std::vector<enum_field_types>* m_pTypes;     /*<! The types of the columns. */
+    const Rules*                         m_pRules;     /*<! The rules of the columns. */
+    bool                                 m_warn;       /*<! Warn about type mismatches. */
+    size_t                               m_nColumns;   /*<! Number of columns to walk. */
+    bool                                 m_continues;  /*<! The next packet continues the row. */
+    state_t                              m_state;      /*<! Where in the row we are. */
+    size_t                               m_column;     /*<! The current column. */
+    const MaskingRules::Rule*            m_pRule;      /*<! The rule of the current value. */
+    std::vector<uint8_t>                 m_nulls;      /*<! The NULL bitmap of a binary row. */
+    uint8_t                              m_length[9];  /*<! The length of the current value. */
+    size_t                               m_nLength;    /*<! Bytes of the length read so far. */
+    uint64_t                             m_value_len;  /*<! The length of the current value. */
+    uint64_t                             m_offset;     /*<! Bytes of the value walked so far. */
+};
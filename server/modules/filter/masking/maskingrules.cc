@@ -706,47 +706,42 @@ bool MaskingRules::Rule::matches(const ComQueryResponse::ColumnDef& column_def,
 
 void MaskingRules::Rule::rewrite(LEncString& s) const
 {
-    bool rewritten = false;
+    if (s.length() != 0)
+    {
+        rewrite(s.length(), 0, &*s.begin(), s.length());
+    }
+}
 
-    size_t total_len = s.length();
+void MaskingRules::Rule::rewrite(size_t total_len, size_t offset, char* pData, size_t len) const
+{
+    ss_dassert(offset + len <= total_len);
 
-    if (!m_value.empty())
+    if (!m_value.empty() && (m_value.length() == total_len))
     {
-        if (m_value.length() == total_len)
-        {
-            std::copy(m_value.begin(), m_value.end(), s.begin());
-            rewritten = true;
-        }
+        std::copy(m_value.data() + offset, m_value.data() + offset + len, pData);
     }
-
-    if (!rewritten)
+    else if (!m_fill.empty())
     {
-        if (!m_fill.empty())
-        {
-            LEncString::iterator i = s.begin();
-            size_t len = m_fill.length();
+        size_t fill_len = m_fill.length();
+        size_t i = offset % fill_len;
 
-            while (total_len)
-            {
-                if (total_len < len)
-                {
-                    len = total_len;
-                }
+        while (len)
+        {
+            size_t n = std::min(fill_len - i, len);
 
-                std::copy(m_fill.data(), m_fill.data() + len, i);
+            std::copy(m_fill.data() + i, m_fill.data() + i + n, pData);
 
-                i += len;
-                total_len -= len;
-            }
-        }
-        else
-        {
-            MXS_ERROR("Length of returned value \"%s\" is %u, while length of "
-                      "replacement value \"%s\" is %u, and no 'fill' value specified.",
-                      s.to_string().c_str(), (unsigned)s.length(),
-                      m_value.c_str(), (unsigned)m_value.length());
+            pData += n;
+            len -= n;
+            i = 0;
         }
     }
+    else if (offset == 0)
+    {
+        MXS_ERROR("Length of returned value is %lu, while length of "
+                  "replacement value \"%s\" is %u, and no 'fill' value specified.",
+                  total_len, m_value.c_str(), (unsigned)m_value.length());
+    }
 }
 
 //
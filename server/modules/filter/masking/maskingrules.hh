@@ -142,8 +142,25 @@ public:
                      const char* zUser,
                      const char* zHost) const;
 
+        /**
+         * Mask a value.
+         *
+         * @param s  The value to mask.
+         */
         void rewrite(LEncString& s) const;
 
+        /**
+         * Mask a part of a value. A value that is not contiguous in memory
+         * can be masked piecewise, as the result only depends on the
+         * total length of the value and the position within it.
+         *
+         * @param total_len  The length of the entire value.
+         * @param offset     The offset of @c pData within the value.
+         * @param pData      The part of the value to mask.
+         * @param len        The length of the part.
+         */
+        void rewrite(size_t total_len, size_t offset, char* pData, size_t len) const;
+
     private:
         Rule(const Rule&);
         Rule& operator = (const Rule&);
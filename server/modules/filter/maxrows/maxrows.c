@@ -117,7 +117,7 @@ MXS_MODULE* MXS_CREATE_MODULE()
         MXS_MODULE_IN_DEVELOPMENT,
         MXS_FILTER_VERSION,
         "A filter that is capable of limiting the resultset number of rows.",
-        "V1.0.0",
+        "V1.1.0",
         &object,
         NULL, /* Process init. */
         NULL, /* Process finish. */
@@ -146,6 +146,11 @@ MXS_MODULE* MXS_CREATE_MODULE()
                 MXS_MODULE_OPT_ENUM_UNIQUE,
                 return_option_values
             },
+            {
+                "max_resultset_streaming",
+                MXS_MODULE_PARAM_BOOL,
+                "false"
+            },
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -161,6 +166,7 @@ typedef struct maxrows_config
     uint32_t        max_resultset_size;
     uint32_t                     debug;
     enum maxrows_return_mode  m_return;
+    bool                      streaming;
 } MAXROWS_CONFIG;
 
 typedef struct maxrows_instance
@@ -187,6 +193,11 @@ typedef struct maxrows_response_state
     size_t offset;        /**< Where we are in the response buffer. */
     size_t length;        /**< Buffer size. */
     GWBUF* column_defs;   /**< Buffer with result set columns definitions */
+    size_t n_sent;        /**< Bytes already sent to the client, when streaming. */
+    size_t row_offset;    /**< Where the current row starts in the response buffer. */
+    uint8_t row_seq;      /**< The sequence number of the current row. */
+    size_t limit_offset;  /**< Where the row that hit the limit starts, when streaming. */
+    uint8_t limit_seq;    /**< The sequence number of the row that hit the limit. */
 } MAXROWS_RESPONSE_STATE;
 
 static void maxrows_response_state_reset(MAXROWS_RESPONSE_STATE *state);
@@ -219,8 +230,11 @@ static bool process_params(char **options,
 
 static int send_upstream(MAXROWS_SESSION_DATA *csdata);
 static int send_eof_upstream(MAXROWS_SESSION_DATA *csdata);
-static int send_error_upstream(MAXROWS_SESSION_DATA *csdata);
+static int send_error_upstream(MAXROWS_SESSION_DATA *csdata, uint8_t seq);
 static int send_maxrows_reply_limit(MAXROWS_SESSION_DATA *csdata);
+static int send_stream_upstream(MAXROWS_SESSION_DATA *csdata);
+static int send_stream_limit(MAXROWS_SESSION_DATA *csdata);
+static void check_row_limits(MAXROWS_SESSION_DATA *csdata, size_t row_end);
 
 /* API BEGIN */
 
@@ -251,6 +265,7 @@ static MXS_FILTER *createInstance(const char *name,
                                                      "max_resultset_return",
                                                      return_option_values);
         cinstance->config.debug = config_get_integer(params, "debug");
+        cinstance->config.streaming = config_get_bool(params, "max_resultset_streaming");
     }
 
     return (MXS_FILTER*)cinstance;
@@ -435,7 +450,9 @@ static int clientReply(MXS_FILTER *instance,
         csdata->res.length = gwbuf_length(data);
     }
 
-    if (csdata->state != MAXROWS_IGNORING_RESPONSE)
+    /** When streaming, the size is checked row by row in handle_rows() */
+    if (csdata->state != MAXROWS_IGNORING_RESPONSE &&
+        !csdata->instance->config.streaming)
     {
         if (!csdata->discard_resultset)
         {
@@ -485,6 +502,15 @@ static int clientReply(MXS_FILTER *instance,
         csdata->state = MAXROWS_IGNORING_RESPONSE;
     }
 
+    if (csdata->instance->config.streaming && csdata->res.data &&
+        (csdata->state == MAXROWS_EXPECTING_RESPONSE ||
+         csdata->state == MAXROWS_EXPECTING_FIELDS ||
+         csdata->state == MAXROWS_EXPECTING_ROWS))
+    {
+        /** The response continues, send what has been processed so far */
+        rv = send_stream_upstream(csdata);
+    }
+
     return rv;
 }
 
@@ -504,6 +530,8 @@ static void diagnostics(MXS_FILTER *instance, MXS_FILTER_SESSION *sdata, DCB *dc
     MAXROWS_SESSION_DATA *csdata = (MAXROWS_SESSION_DATA*)sdata;
 
     dcb_printf(dcb, "Maxrows filter is working\n");
+    dcb_printf(dcb, "\tStreaming resultsets: %s\n",
+               cinstance->config.streaming ? "yes" : "no");
 }
 
 /**
@@ -531,6 +559,11 @@ static void maxrows_response_state_reset(MAXROWS_RESPONSE_STATE *state)
     state->n_rows = 0;
     state->offset = 0;
     state->column_defs = NULL;
+    state->n_sent = 0;
+    state->row_offset = 0;
+    state->row_seq = 0;
+    state->limit_offset = 0;
+    state->limit_seq = 0;
 }
 
 /**
@@ -614,7 +647,8 @@ static int handle_expecting_fields(MAXROWS_SESSION_DATA *csdata)
                  * This will be used only by the empty response handler.
                  */
                 if (!csdata->res.column_defs &&
-                    csdata->instance->config.m_return == MAXROWS_RETURN_EMPTY)
+                    csdata->instance->config.m_return == MAXROWS_RETURN_EMPTY &&
+                    !csdata->instance->config.streaming)
                 {
                     csdata->res.column_defs = gwbuf_clone(csdata->res.data);
                 }
@@ -827,6 +861,13 @@ static int handle_rows(MAXROWS_SESSION_DATA *csdata, GWBUF* buffer, size_t extra
 
         if (offset + packetlen <= buflen)
         {
+            if (!pending_large_data)
+            {
+                // Start of a new packet, remember it in case it's the row that hits the limit
+                csdata->res.row_offset = csdata->res.offset + offset - extra_offset;
+                csdata->res.row_seq = header[3];
+            }
+
             /* Check for large packet packet terminator:
              * min is 4 bytes "0x0 0x0 0x0 0xseq_no and
              * max is 1 byte less than EOF_PACKET_LEN
@@ -839,6 +880,7 @@ static int handle_rows(MAXROWS_SESSION_DATA *csdata, GWBUF* buffer, size_t extra
                 // Update offset, number of rows and break
                 offset += packetlen;
                 csdata->res.n_rows++;
+                check_row_limits(csdata, csdata->res.offset + offset - extra_offset);
                 break;
             }
 
@@ -979,20 +1021,7 @@ static int handle_rows(MAXROWS_SESSION_DATA *csdata, GWBUF* buffer, size_t extra
                 }
 
                 // Check for max_resultset_rows limit
-                if (!csdata->discard_resultset)
-                {
-                    if (csdata->res.n_rows > csdata->instance->config.max_resultset_rows)
-                    {
-                        if (csdata->instance->config.debug & MAXROWS_DEBUG_DISCARDING)
-                        {
-                            MXS_INFO("max_resultset_rows %lu reached, not returning the resultset.",
-                                     csdata->res.n_rows);
-                        }
-
-                        // Set the discard indicator
-                        csdata->discard_resultset = true;
-                    }
-                }
+                check_row_limits(csdata, csdata->res.offset + offset - extra_offset);
                 break;
             }
         }
@@ -1008,6 +1037,50 @@ static int handle_rows(MAXROWS_SESSION_DATA *csdata, GWBUF* buffer, size_t extra
     return rv;
 }
 
+/**
+ * Check whether a row makes the resultset exceed the limits
+ *
+ * @param csdata  The maxrows session data
+ * @param row_end Where the row ends in the response buffer
+ */
+static void check_row_limits(MAXROWS_SESSION_DATA *csdata, size_t row_end)
+{
+    if (!csdata->discard_resultset)
+    {
+        if (csdata->res.n_rows > csdata->instance->config.max_resultset_rows)
+        {
+            if (csdata->instance->config.debug & MAXROWS_DEBUG_DISCARDING)
+            {
+                MXS_INFO("max_resultset_rows %lu reached, not returning the resultset.",
+                         csdata->res.n_rows);
+            }
+
+            // Set the discard indicator
+            csdata->discard_resultset = true;
+        }
+        else if (csdata->instance->config.streaming &&
+                 csdata->res.n_sent + row_end > csdata->instance->config.max_resultset_size)
+        {
+            if (csdata->instance->config.debug & MAXROWS_DEBUG_DISCARDING)
+            {
+                MXS_NOTICE("Current size %luB of resultset, at least as much "
+                           "as maximum allowed size %uKiB. Not returning more rows.",
+                           csdata->res.n_sent + row_end,
+                           csdata->instance->config.max_resultset_size / 1024);
+            }
+
+            csdata->discard_resultset = true;
+        }
+
+        if (csdata->discard_resultset && csdata->instance->config.streaming)
+        {
+            // The rows before this one are sent, the rest are discarded
+            csdata->res.limit_offset = csdata->res.row_offset;
+            csdata->res.limit_seq = csdata->res.row_seq;
+        }
+    }
+}
+
 /**
  * Called when all data from the server is ignored.
  *
@@ -1179,9 +1252,10 @@ static int send_ok_upstream(MAXROWS_SESSION_DATA *csdata)
  * a message prefix plus the original SQL input
  *
  * @param   csdata    Session data
+ * @param   seq       Sequence number of the error packet
  * @return            Non-Zero if successful, 0 on errors
  */
-static int send_error_upstream(MAXROWS_SESSION_DATA *csdata)
+static int send_error_upstream(MAXROWS_SESSION_DATA *csdata, uint8_t seq)
 {
     GWBUF *err_pkt;
     uint8_t hdr_err[MYSQL_ERR_PACKET_MIN_LEN];
@@ -1228,8 +1302,7 @@ static int send_error_upstream(MAXROWS_SESSION_DATA *csdata)
 
     /* Set the payload length of the whole error message */
     gw_mysql_set_byte3(&ptr[0], pkt_len);
-    /* Note: sequence id is always 01 (4th byte) */
-    ptr[3] = 1;
+    ptr[3] = seq;
     /* Error indicator */
     ptr[4] = 0xff;
     /* MySQL error code: 2 bytes */
@@ -1265,6 +1338,11 @@ static int send_error_upstream(MAXROWS_SESSION_DATA *csdata)
  */
 static int send_maxrows_reply_limit(MAXROWS_SESSION_DATA *csdata)
 {
+    if (csdata->instance->config.streaming)
+    {
+        return send_stream_limit(csdata);
+    }
+
     switch(csdata->instance->config.m_return)
     {
         case MAXROWS_RETURN_EMPTY:
@@ -1274,7 +1352,7 @@ static int send_maxrows_reply_limit(MAXROWS_SESSION_DATA *csdata)
             return send_ok_upstream(csdata);
             break;
         case MAXROWS_RETURN_ERR:
-            return send_error_upstream(csdata);
+            return send_error_upstream(csdata, 1);
             break;
         default:
             MXS_ERROR("MaxRows config value not expected!");
@@ -1283,3 +1361,130 @@ static int send_maxrows_reply_limit(MAXROWS_SESSION_DATA *csdata)
             break;
     }
 }
+
+/**
+ * Send the part of the response that has been processed so far upstream,
+ * when streaming.
+ *
+ * A row split into several packets is kept until all of it has arrived.
+ * Once a limit has been hit, only the rows before the one that hit it
+ * are sent and everything after it is discarded.
+ *
+ * @param   csdata    Session data
+ * @return            Non-Zero if successful, 0 on errors
+ */
+static int send_stream_upstream(MAXROWS_SESSION_DATA *csdata)
+{
+    int rv = 1;
+    size_t end = csdata->res.offset;
+
+    if (csdata->discard_resultset)
+    {
+        end = csdata->res.limit_offset;
+    }
+    else if (csdata->large_packet)
+    {
+        end = csdata->res.row_offset;
+    }
+
+    ss_dassert(end <= csdata->res.offset);
+
+    if (end > 0)
+    {
+        GWBUF *head = gwbuf_split(&csdata->res.data, end);
+
+        if (head == NULL)
+        {
+            /* Abort client connection */
+            poll_fake_hangup_event(csdata->session->client_dcb);
+            return 0;
+        }
+
+        rv = csdata->up.clientReply(csdata->up.instance,
+                                    csdata->up.session,
+                                    head);
+
+        csdata->res.n_sent += end;
+        csdata->res.offset -= end;
+        csdata->res.length -= end;
+        csdata->res.row_offset -= MXS_MIN(end, csdata->res.row_offset);
+        csdata->res.limit_offset = 0;
+    }
+
+    if (csdata->discard_resultset)
+    {
+        /* Nothing after the limit is sent, keep only what is yet to be processed */
+        GWBUF *processed = gwbuf_split(&csdata->res.data, csdata->res.offset);
+        gwbuf_free(processed);
+        csdata->res.length -= csdata->res.offset;
+        csdata->res.offset = 0;
+        csdata->res.row_offset = 0;
+    }
+
+    return rv;
+}
+
+/**
+ * Terminate a streamed resultset that has hit a limit.
+ *
+ * The rows before the limit have already been sent, so the resultset can't
+ * be replaced. Instead, it is terminated with an EOF packet or, with
+ * max_resultset_return=error, with an error packet.
+ *
+ * @param   csdata    Session data
+ * @return            Non-Zero if successful, 0 on errors
+ */
+static int send_stream_limit(MAXROWS_SESSION_DATA *csdata)
+{
+    if (!csdata->discard_resultset)
+    {
+        /* A malformed response, send it as it is */
+        return send_upstream(csdata);
+    }
+
+    int rv = 1;
+
+    if (csdata->res.limit_offset > 0)
+    {
+        GWBUF *head = gwbuf_split(&csdata->res.data, csdata->res.limit_offset);
+        csdata->res.limit_offset = 0;
+
+        if (head)
+        {
+            rv = csdata->up.clientReply(csdata->up.instance,
+                                        csdata->up.session,
+                                        head);
+        }
+    }
+
+    if (csdata->instance->config.m_return == MAXROWS_RETURN_ERR)
+    {
+        return send_error_upstream(csdata, csdata->res.limit_seq);
+    }
+
+    uint8_t eof[MYSQL_EOF_PACKET_LEN] = {05, 00, 00, csdata->res.limit_seq, 0xfe, 00, 00, 02, 00};
+    GWBUF *packet = gwbuf_alloc_and_load(sizeof(eof), eof);
+
+    gwbuf_free(csdata->res.data);
+    csdata->res.data = NULL;
+
+    if (packet == NULL)
+    {
+        /* Abort client connection */
+        poll_fake_hangup_event(csdata->session->client_dcb);
+        return 0;
+    }
+
+    if (rv)
+    {
+        rv = csdata->up.clientReply(csdata->up.instance,
+                                    csdata->up.session,
+                                    packet);
+    }
+    else
+    {
+        gwbuf_free(packet);
+    }
+
+    return rv;
+}
@@ -24,6 +24,11 @@
  * The filter makes no attempt to deal with queries that do not fit
  * in a single GWBUF or result sets that span multiple GWBUFs.
  *
+ * The routing threads never talk to the RabbitMQ server. Each routing thread
+ * copies its messages into a buffer of its own and a publisher thread of the
+ * filter instance sends them. If the buffer of a thread is full, for instance
+ * because the server cannot be reached, new messages are dropped.
+ *
  * To use a SSL connection the CA certificate, the client certificate and the client public
  * key must be provided.
  * By default this filter uses a TCP connection.
@@ -46,6 +51,9 @@
  *      ssl_CA_cert     Path to the CA certificate in PEM format
  *      ssl_client_cert Path to the client cerificate in PEM format
  *      ssl_client_key  Path to the client public key in PEM format
+ *      buffer_size     Size of the message buffer of each routing thread
+ *      batch_size      Number of messages published from a buffer at a time
+ *      publisher_confirms Whether the broker confirms the published messages
  *
  * The logging trigger levels are:
  *      all     Log everything
@@ -75,13 +83,15 @@
 #include <maxscale/protocol/mysql.h>
 #include <maxscale/log_manager.h>
 #include <maxscale/query_classifier.h>
-#include <maxscale/spinlock.h>
 #include <maxscale/session.h>
-#include <maxscale/housekeeper.h>
 #include <maxscale/alloc.h>
+#include <maxscale/platform.h>
+#include <maxscale/spsc_ring.h>
+
+/** Maximum number of published messages the broker has not yet confirmed */
+#define MQ_CONFIRM_WINDOW 4096
 
 static int uid_gen;
-static int hktask_id = 0;
 /*
  * The filter entry points
  */
@@ -96,15 +106,22 @@ static int clientReply(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, GWBUF
 static void diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb);
 static uint64_t getCapabilities(MXS_FILTER *instance);
 
+/* Types of the records in the message buffers */
+enum mq_record_type
+{
+    MQ_RECORD_QUERY, // A query
+    MQ_RECORD_REPLY  // The reply to a query
+};
+
 /**
- *Structure used to store messages and their properties.
+ * A message in a message buffer. The correlation identifier of the message
+ * and the message itself follow the header.
  */
-typedef struct mqmessage_t
+typedef struct
 {
-    amqp_basic_properties_t *prop;
-    char *msg;
-    struct mqmessage_t *next;
-} mqmessage;
+    uint32_t type;     /* What the record is */
+    uint32_t uid_len;  /* Length of the correlation identifier that starts the content */
+} MQ_RECORD;
 
 /**
  *Logging trigger levels
@@ -170,9 +187,11 @@ typedef struct object_trigger_t
  */
 typedef struct mqstats_t
 {
-    int n_msg; /*< Total number of messages */
-    int n_sent; /*< Number of sent messages */
-    int n_queued; /*< Number of unsent messages */
+    uint64_t n_sent;      /*< Number of published messages */
+    uint64_t n_dropped;   /*< Number of messages dropped as a buffer was full */
+    uint64_t n_confirmed; /*< Number of messages confirmed by the broker */
+    uint64_t n_rejected;  /*< Number of messages rejected by the broker or not
+                           *  confirmed before the connection was lost */
 } MQSTATS;
 
 /**
@@ -202,15 +221,20 @@ typedef struct
     char *ssl_CA_cert;
     char *ssl_client_cert;
     char *ssl_client_key;
+    bool confirms; /**Whether publisher confirms are used*/
+    int batch_size; /**Messages published from a buffer at a time*/
+    /** The connection is only used by the publisher thread */
     amqp_connection_state_t conn; /**The connection object*/
     amqp_socket_t* sock; /**The currently active socket*/
     amqp_channel_t channel; /**The current channel in use*/
     int conn_stat; /**state of the connection to the server*/
     int rconn_intv; /**delay for reconnects, in seconds*/
     time_t last_rconn; /**last reconnect attempt*/
-    SPINLOCK rconn_lock;
-    SPINLOCK msg_lock;
-    mqmessage* messages;
+    uint64_t last_tag; /**Delivery tag of the last message published on the channel*/
+    uint64_t settled_tag; /**Highest delivery tag confirmed or rejected by the broker*/
+    MXS_SPSC_RING *rings; /**The message buffers, one per routing thread*/
+    int n_rings; /**Number of message buffers*/
+    MXS_SPSC_CONSUMER *publisher; /**The publisher thread*/
     enum log_trigger_t trgtype;
     SRC_TRIG* src_trg;
     SHM_TRIG* shm_trg;
@@ -237,7 +261,8 @@ typedef struct
     bool was_query; /**True if the previous routeQuery call had valid content*/
 } MQ_SESSION;
 
-void sendMessage(void* data);
+static uint64_t publisher_drain(MXS_SPSC_RING *ring, void *data);
+static int publisher_flush(MXS_SPSC_CONSUMER *consumer, void *data);
 
 static const MXS_ENUM_VALUE trigger_values[] =
 {
@@ -279,7 +304,7 @@ MXS_MODULE* MXS_CREATE_MODULE()
         MXS_MODULE_ALPHA_RELEASE,
         MXS_FILTER_VERSION,
         "A RabbitMQ query logging filter",
-        "V1.0.2",
+        "V1.1.0",
         &MyObject,
         NULL, /* Process init. */
         NULL, /* Process finish. */
@@ -305,6 +330,9 @@ MXS_MODULE* MXS_CREATE_MODULE()
             {"logging_object", MXS_MODULE_PARAM_STRING},
             {"logging_log_all", MXS_MODULE_PARAM_BOOL, "false"},
             {"logging_strict", MXS_MODULE_PARAM_BOOL, "true"},
+            {"buffer_size", MXS_MODULE_PARAM_SIZE, "1M"},
+            {"batch_size", MXS_MODULE_PARAM_COUNT, "128"},
+            {"publisher_confirms", MXS_MODULE_PARAM_BOOL, "false"},
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -462,6 +490,17 @@ init_conn(MQ_INSTANCE *my_instance)
             goto cleanup;
         }
     }
+
+    if (my_instance->confirms)
+    {
+        amqp_confirm_select(my_instance->conn, my_instance->channel);
+        reply = amqp_get_rpc_reply(my_instance->conn);
+        if (reply.reply_type != AMQP_RESPONSE_NORMAL)
+        {
+            MXS_ERROR("Failed to put the channel into confirm mode.");
+            goto cleanup;
+        }
+    }
     rval = 1;
 
 cleanup:
@@ -524,19 +563,12 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
 
     if (my_instance)
     {
-        spinlock_init(&my_instance->rconn_lock);
-        spinlock_init(&my_instance->msg_lock);
         uid_gen = 0;
 
-        if ((my_instance->conn = amqp_new_connection()) == NULL)
-        {
-            MXS_FREE(my_instance);
-            return NULL;
-        }
-
+        /** The publisher thread connects to the server */
         my_instance->channel = 1;
-        my_instance->last_rconn = time(NULL);
-        my_instance->conn_stat = AMQP_STATUS_OK;
+        my_instance->last_rconn = 0;
+        my_instance->conn_stat = AMQP_STATUS_SOCKET_CLOSED;
         my_instance->rconn_intv = 1;
 
         my_instance->port = config_get_integer(params, "port");
@@ -554,6 +586,13 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
         my_instance->ssl_client_cert = config_copy_string(params, "ssl_client_certificate");
         my_instance->ssl_client_key = config_copy_string(params, "ssl_client_key");
         my_instance->ssl_CA_cert = config_copy_string(params, "ssl_CA_cert");
+        my_instance->confirms = config_get_bool(params, "publisher_confirms");
+        my_instance->batch_size = config_get_integer(params, "batch_size");
+
+        if (my_instance->batch_size < 1)
+        {
+            my_instance->batch_size = 1;
+        }
 
         if (my_instance->trgtype & TRG_SOURCE)
         {
@@ -611,185 +650,319 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
             amqp_set_initialize_ssl_library(0);
         }
 
-        /**Connect to the server*/
-        init_conn(my_instance);
+        bool error = false;
+
+        my_instance->n_rings = config_threadcount();
+
+        if ((my_instance->rings = mxs_spsc_rings_alloc(my_instance->n_rings,
+                                                       config_get_size(params, "buffer_size"))) == NULL)
+        {
+            error = true;
+        }
+
+        if (!error && (my_instance->publisher = mxs_spsc_consumer_start(my_instance->rings,
+                                                                        my_instance->n_rings,
+                                                                        publisher_drain,
+                                                                        publisher_flush,
+                                                                        my_instance)) == NULL)
+        {
+            MXS_ERROR("Failed to start the publisher thread of mqfilter '%s'.", name);
+            error = true;
+        }
 
-        char taskname[512];
-        snprintf(taskname, 511, "mqtask%d", atomic_add(&hktask_id, 1));
-        hktask_add(taskname, sendMessage, (void*)my_instance, 5);
+        if (error)
+        {
+            mxs_spsc_rings_free(my_instance->rings, my_instance->n_rings);
+            MXS_FREE(my_instance);
+            my_instance = NULL;
+        }
     }
 
     return (MXS_FILTER *)my_instance;
 }
 
 /**
- * Declares a persistent, non-exclusive and non-passive queue that
- * auto-deletes after all the messages have been consumed.
- * @param my_session MQ_SESSION instance used to declare the queue
- * @param qname Name of the queue to be declared
- * @return Returns 0 if an error occurred, 1 if successful
+ * Push a new message into the message buffer of the current thread to be
+ * published later by the publisher thread. If the buffer is full, the message
+ * is dropped instead of waiting for the publisher thread.
+ * @param instance Filter instance
+ * @param type Type of the message
+ * @param uid Correlation identifier of the message, may be NULL
+ * @param msg Message content, freed by this function
  */
-int declareQueue(MQ_INSTANCE *my_instance, MQ_SESSION* my_session, char* qname)
+void pushMessage(MQ_INSTANCE *instance, enum mq_record_type type, const char *uid, char *msg)
 {
-    int success = 1;
-    amqp_rpc_reply_t reply;
+    if (uid == NULL)
+    {
+        uid = "";
+    }
 
-    spinlock_acquire(&my_instance->rconn_lock);
+    size_t uid_len = strlen(uid);
+    size_t msg_len = strlen(msg);
+    size_t len = sizeof(MQ_RECORD) + uid_len + msg_len;
+    MXS_SPSC_RING *ring = mxs_spsc_rings_get(instance->rings, instance->n_rings);
+    MQ_RECORD *record = ring ? mxs_spsc_ring_reserve(ring, len) : NULL;
 
-    amqp_queue_declare(my_instance->conn, my_instance->channel,
-                       amqp_cstring_bytes(qname),
-                       0, 1, 0, 1,
-                       amqp_empty_table);
-    reply = amqp_get_rpc_reply(my_instance->conn);
-    if (reply.reply_type != AMQP_RESPONSE_NORMAL)
+    if (record)
     {
-        success = 0;
-        MXS_ERROR("Queue declaration failed.");
+        char *content = (char*)(record + 1);
+        memcpy(content, uid, uid_len);
+        memcpy(content + uid_len, msg, msg_len);
+        record->type = type;
+        record->uid_len = uid_len;
+        mxs_spsc_ring_commit(ring, len);
+    }
+    else
+    {
+        atomic_add_uint64(&instance->stats.n_dropped, 1);
+    }
 
+    MXS_FREE(msg);
+}
+
+/**
+ * Close the connection to the server after an error. The messages that were
+ * published but not yet confirmed are counted as rejected.
+ * @param instance Filter instance
+ * @param err_num The error
+ */
+static void publisher_disconnect(MQ_INSTANCE *instance, int err_num)
+{
+    MXS_ERROR("Lost the connection to the RabbitMQ server [%s]:%d: %s",
+              instance->hostname, instance->port, amqp_error_string2(err_num));
+
+    if (instance->confirms && instance->last_tag > instance->settled_tag)
+    {
+        atomic_add_uint64(&instance->stats.n_rejected, instance->last_tag - instance->settled_tag);
     }
 
-    amqp_queue_bind(my_instance->conn, my_instance->channel,
-                    amqp_cstring_bytes(qname),
-                    amqp_cstring_bytes(my_instance->exchange),
-                    amqp_cstring_bytes(my_session->uid),
-                    amqp_empty_table);
-    reply = amqp_get_rpc_reply(my_instance->conn);
-    if (reply.reply_type != AMQP_RESPONSE_NORMAL)
+    amqp_destroy_connection(instance->conn);
+    instance->conn = NULL;
+    instance->sock = NULL;
+    __atomic_store_n(&instance->conn_stat, err_num, __ATOMIC_RELAXED);
+}
+
+/**
+ * Connect to the server unless there already is a connection or the previous
+ * attempt was made too recently.
+ * @param instance Filter instance
+ * @return True if there is a connection
+ */
+static bool publisher_connect(MQ_INSTANCE *instance)
+{
+    if (instance->conn)
+    {
+        return true;
+    }
+
+    if (difftime(time(NULL), instance->last_rconn) <= instance->rconn_intv)
+    {
+        return false;
+    }
+
+    instance->last_rconn = time(NULL);
+    instance->channel = 1;
+    instance->last_tag = 0;
+    instance->settled_tag = 0;
+
+    if ((instance->conn = amqp_new_connection()) && init_conn(instance))
     {
-        success = 0;
-        MXS_ERROR("Failed to bind queue to exchange.");
+        instance->rconn_intv = 1;
+        __atomic_store_n(&instance->conn_stat, AMQP_STATUS_OK, __ATOMIC_RELAXED);
+        return true;
+    }
 
+    if (instance->conn)
+    {
+        amqp_destroy_connection(instance->conn);
+        instance->conn = NULL;
+        instance->sock = NULL;
     }
-    spinlock_release(&my_instance->rconn_lock);
-    return success;
+
+    instance->rconn_intv += 5;
+    MXS_ERROR("Failed to connect to the RabbitMQ server [%s]:%d, retrying in %d seconds.",
+              instance->hostname, instance->port, instance->rconn_intv);
+    return false;
 }
 
 /**
- * Broadcasts a message on the message stack to the RabbitMQ server
- * and frees the allocated memory if successful. This function is only called by
- * the housekeeper thread.
- * @param data MQfilter instance
+ * Record a confirmation or a rejection of published messages.
+ * @param instance Filter instance
+ * @param tag      Delivery tag of the message
+ * @param multiple Whether all messages up to the tag are meant
+ * @param counter  The statistic to update
  */
-void sendMessage(void* data)
+static void publisher_settle(MQ_INSTANCE *instance, uint64_t tag, bool multiple, uint64_t *counter)
 {
-    MQ_INSTANCE *instance = (MQ_INSTANCE*) data;
-    mqmessage *tmp;
-    int err_num = AMQP_STATUS_OK;
+    // The broker settles the messages of a channel in the order they were published
+    if (tag > instance->settled_tag)
+    {
+        atomic_add_uint64(counter, multiple ? tag - instance->settled_tag : 1);
+        instance->settled_tag = tag;
+    }
+}
+
+/**
+ * Process the confirmations and any other frames the server has sent.
+ * @param instance   Filter instance
+ * @param timeout_ms How long to wait for the first frame
+ */
+static void publisher_read_frames(MQ_INSTANCE *instance, int timeout_ms)
+{
+    struct timeval tv = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+    amqp_frame_t frame;
+    int rc;
 
-    spinlock_acquire(&instance->rconn_lock);
-    if (instance->conn_stat != AMQP_STATUS_OK)
+    while ((rc = amqp_simple_wait_frame_noblock(instance->conn, &frame, &tv)) == AMQP_STATUS_OK)
     {
-        if (difftime(time(NULL), instance->last_rconn) > instance->rconn_intv)
+        if (frame.frame_type == AMQP_FRAME_METHOD)
         {
-            instance->last_rconn = time(NULL);
-
-            if (init_conn(instance))
+            if (frame.payload.method.id == AMQP_BASIC_ACK_METHOD)
             {
-                instance->rconn_intv = 1.0;
-                instance->conn_stat = AMQP_STATUS_OK;
+                amqp_basic_ack_t *ack = (amqp_basic_ack_t*)frame.payload.method.decoded;
+                publisher_settle(instance, ack->delivery_tag, ack->multiple,
+                                 &instance->stats.n_confirmed);
             }
-            else
+            else if (frame.payload.method.id == AMQP_BASIC_NACK_METHOD)
+            {
+                amqp_basic_nack_t *nack = (amqp_basic_nack_t*)frame.payload.method.decoded;
+                publisher_settle(instance, nack->delivery_tag, nack->multiple,
+                                 &instance->stats.n_rejected);
+            }
+            else if (frame.payload.method.id == AMQP_CHANNEL_CLOSE_METHOD ||
+                     frame.payload.method.id == AMQP_CONNECTION_CLOSE_METHOD)
             {
-                instance->rconn_intv += 5.0;
-                MXS_ERROR("Failed to reconnect to the MQRabbit server ");
+                rc = AMQP_STATUS_CONNECTION_CLOSED;
+                break;
             }
         }
-        err_num = instance->conn_stat;
+
+        // Only wait for the first frame
+        tv.tv_sec = 0;
+        tv.tv_usec = 0;
     }
-    spinlock_release(&instance->rconn_lock);
 
-    if (err_num != AMQP_STATUS_OK)
+    if (rc == AMQP_STATUS_TIMEOUT)
+    {
+        amqp_maybe_release_buffers(instance->conn);
+    }
+    else
     {
-        /** No connection to the broker */
-        return;
+        publisher_disconnect(instance, rc);
     }
+}
 
-    spinlock_acquire(&instance->msg_lock);
-    tmp = instance->messages;
+/**
+ * Publish a batch of messages of a message buffer. A message that could not
+ * be published stays in the buffer and is published again after reconnecting.
+ * @param ring     The message buffer
+ * @param data     Filter instance
+ * @return Number of published messages
+ */
+static uint64_t publisher_drain(MXS_SPSC_RING *ring, void *data)
+{
+    MQ_INSTANCE *instance = (MQ_INSTANCE*)data;
+    int n_sent = 0;
+    int limit = instance->batch_size;
+    int err_num = AMQP_STATUS_OK;
+    MQ_RECORD *record;
+    size_t len;
 
-    if (tmp == NULL)
+    if (instance->conn == NULL)
     {
-        spinlock_release(&instance->msg_lock);
-        return;
+        return 0;
     }
 
-    instance->messages = instance->messages->next;
-    spinlock_release(&instance->msg_lock);
+    if (instance->confirms)
+    {
+        uint64_t window = MQ_CONFIRM_WINDOW - (instance->last_tag - instance->settled_tag);
+
+        if (window < (uint64_t)limit)
+        {
+            limit = window;
+        }
+    }
 
-    while (tmp)
+    while (n_sent < limit && (record = mxs_spsc_ring_peek(ring, &len)))
     {
+        char *content = (char*)(record + 1);
+        amqp_basic_properties_t prop;
+        amqp_bytes_t body;
+
+        prop._flags = AMQP_BASIC_CONTENT_TYPE_FLAG |
+                      AMQP_BASIC_DELIVERY_MODE_FLAG |
+                      AMQP_BASIC_MESSAGE_ID_FLAG |
+                      AMQP_BASIC_CORRELATION_ID_FLAG;
+        prop.content_type = amqp_cstring_bytes("text/plain");
+        prop.delivery_mode = AMQP_DELIVERY_PERSISTENT;
+        prop.correlation_id.len = record->uid_len;
+        prop.correlation_id.bytes = content;
+        prop.message_id = amqp_cstring_bytes(record->type == MQ_RECORD_QUERY ? "query" : "reply");
+        body.len = len - sizeof(MQ_RECORD) - record->uid_len;
+        body.bytes = content + record->uid_len;
+
         err_num = amqp_basic_publish(instance->conn, instance->channel,
                                      amqp_cstring_bytes(instance->exchange),
                                      amqp_cstring_bytes(instance->key),
-                                     0, 0, tmp->prop, amqp_cstring_bytes(tmp->msg));
+                                     0, 0, &prop, body);
 
-        spinlock_acquire(&instance->rconn_lock);
-        instance->conn_stat = err_num;
-        spinlock_release(&instance->rconn_lock);
-
-        if (err_num == AMQP_STATUS_OK)
+        if (err_num != AMQP_STATUS_OK)
         {
-            /**Message was sent successfully*/
-            MXS_FREE(tmp->prop);
-            MXS_FREE(tmp->msg);
-            MXS_FREE(tmp);
+            break;
+        }
 
-            atomic_add(&instance->stats.n_sent, 1);
-            atomic_add(&instance->stats.n_queued, -1);
-            spinlock_acquire(&instance->msg_lock);
-            tmp = instance->messages;
+        mxs_spsc_ring_consume(ring);
+        instance->last_tag++;
+        n_sent++;
+    }
 
-            if (tmp == NULL)
-            {
-                spinlock_release(&instance->msg_lock);
-                return;
-            }
+    if (n_sent > 0)
+    {
+        atomic_add_uint64(&instance->stats.n_sent, n_sent);
+    }
 
-            instance->messages = instance->messages->next;
-            spinlock_release(&instance->msg_lock);
-        }
-        else
-        {
-            spinlock_acquire(&instance->msg_lock);
-            tmp->next = instance->messages;
-            instance->messages = tmp;
-            spinlock_release(&instance->msg_lock);
-            return;
-        }
+    if (err_num != AMQP_STATUS_OK)
+    {
+        publisher_disconnect(instance, err_num);
     }
+
+    return n_sent;
 }
 
 /**
- * Push a new message on the stack to be broadcasted later.
- * The message assumes ownership of the memory allocated to the message content and properties.
- * @param prop Message properties
- * @param msg Message content
+ * Called by the publisher thread after it has published the messages of all
+ * routing threads. The publisher thread is the only thread that uses the
+ * connection to the server, so that a slow or unreachable server never
+ * delays the routing threads. It reconnects when it is time to and reads the
+ * publisher confirms, and it wakes up when the server sends something.
+ * @param consumer The publisher thread
+ * @param data     Filter instance
+ * @return How long the publisher thread may sleep
  */
-void pushMessage(MQ_INSTANCE *instance, amqp_basic_properties_t* prop, char* msg)
+static int publisher_flush(MXS_SPSC_CONSUMER *consumer, void *data)
 {
+    MQ_INSTANCE *instance = (MQ_INSTANCE*)data;
+    bool connected = instance->conn != NULL;
 
-    mqmessage* newmsg = MXS_CALLOC(1, sizeof(mqmessage));
-    if (newmsg)
-    {
-        newmsg->msg = msg;
-        newmsg->prop = prop;
-    }
-    else
+    if (publisher_connect(instance))
     {
-        MXS_FREE(prop);
-        MXS_FREE(msg);
-        return;
-    }
+        uint64_t settled_tag = instance->settled_tag;
+        publisher_read_frames(instance, 0);
 
-    spinlock_acquire(&instance->msg_lock);
+        if (instance->conn)
+        {
+            mxs_spsc_consumer_watch(consumer, amqp_get_sockfd(instance->conn));
 
-    newmsg->next = instance->messages;
-    instance->messages = newmsg;
+            // Publish right away what waited for the connection or for room in the window
+            return connected && instance->settled_tag == settled_tag ? -1 : 0;
+        }
+    }
 
-    spinlock_release(&instance->msg_lock);
+    mxs_spsc_consumer_watch(consumer, -1);
 
-    atomic_add(&instance->stats.n_msg, 1);
-    atomic_add(&instance->stats.n_queued, 1);
+    // Sleep until the next connection attempt
+    double wait = instance->rconn_intv + 1 - difftime(time(NULL), instance->last_rconn);
+    return wait > 0 ? wait * 1000 : 0;
 }
 
 /**
@@ -937,13 +1110,12 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
 {
     MQ_SESSION *my_session = (MQ_SESSION *) session;
     MQ_INSTANCE *my_instance = (MQ_INSTANCE *) instance;
-    char *ptr, t_buf[128], *combined, *canon_q;
+    char *ptr, t_buf[128], *combined, *canon_q = NULL;
     const char *sesshost, *sessusr;
     bool success = false, src_ok = false, schema_ok = false, obj_ok = false;
     int length, i, j, dbcount = 0;
     char** sesstbls;
     unsigned int plen = 0;
-    amqp_basic_properties_t *prop;
 
     /**The user is changing databases*/
     if (*((char*) (queue->start + 4)) == 0x02)
@@ -1181,18 +1353,6 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
 
                 my_session->was_query = true;
 
-                if ((prop = MXS_MALLOC(sizeof(amqp_basic_properties_t))))
-                {
-                    prop->_flags = AMQP_BASIC_CONTENT_TYPE_FLAG |
-                                   AMQP_BASIC_DELIVERY_MODE_FLAG |
-                                   AMQP_BASIC_MESSAGE_ID_FLAG |
-                                   AMQP_BASIC_CORRELATION_ID_FLAG;
-                    prop->content_type = amqp_cstring_bytes("text/plain");
-                    prop->delivery_mode = AMQP_DELIVERY_PERSISTENT;
-                    prop->correlation_id = amqp_cstring_bytes(my_session->uid);
-                    prop->message_id = amqp_cstring_bytes("query");
-                }
-
                 if (success)
                 {
 
@@ -1207,13 +1367,14 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
                 memset(t_buf, 0, 128);
                 sprintf(t_buf, "%lu|", (unsigned long) time(NULL));
 
-                int qlen = strnlen(canon_q, length) + strnlen(t_buf, 128);
+                const char *query = canon_q ? canon_q : ptr;
+                int qlen = strnlen(query, length) + strnlen(t_buf, 128);
                 combined = MXS_MALLOC((qlen + 1) * sizeof(char));
                 MXS_ABORT_IF_NULL(combined);
                 strcpy(combined, t_buf);
-                strncat(combined, canon_q, length);
+                strncat(combined, query, length);
 
-                pushMessage(my_instance, prop, combined);
+                pushMessage(my_instance, MQ_RECORD_QUERY, my_session->uid, combined);
                 MXS_FREE(canon_q);
             }
 
@@ -1344,7 +1505,6 @@ static int clientReply(MXS_FILTER* instance, MXS_FILTER_SESSION *session, GWBUF
     MQ_INSTANCE *my_instance = (MQ_INSTANCE *) instance;
     char t_buf[128], *combined;
     unsigned int pkt_len = pktlen(reply->sbuf->data), offset = 0;
-    amqp_basic_properties_t *prop;
 
     if (my_session->was_query)
     {
@@ -1355,18 +1515,6 @@ static int clientReply(MXS_FILTER* instance, MXS_FILTER_SESSION *session, GWBUF
 
         if (pkt_len > 0)
         {
-            if ((prop = MXS_MALLOC(sizeof(amqp_basic_properties_t))))
-            {
-                prop->_flags = AMQP_BASIC_CONTENT_TYPE_FLAG |
-                               AMQP_BASIC_DELIVERY_MODE_FLAG |
-                               AMQP_BASIC_MESSAGE_ID_FLAG |
-                               AMQP_BASIC_CORRELATION_ID_FLAG;
-                prop->content_type = amqp_cstring_bytes("text/plain");
-                prop->delivery_mode = AMQP_DELIVERY_PERSISTENT;
-                prop->correlation_id = amqp_cstring_bytes(my_session->uid);
-                prop->message_id = amqp_cstring_bytes("reply");
-            }
-
             combined = MXS_CALLOC(GWBUF_LENGTH(reply) + 256, sizeof(char));
             MXS_ABORT_IF_NULL(combined);
 
@@ -1452,7 +1600,7 @@ static int clientReply(MXS_FILTER* instance, MXS_FILTER_SESSION *session, GWBUF
             if (packet_ok)
             {
 
-                pushMessage(my_instance, prop, combined);
+                pushMessage(my_instance, MQ_RECORD_REPLY, my_session->uid, combined);
 
                 if (was_last)
                 {
@@ -1495,12 +1643,33 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
                    my_instance->vhost, my_instance->exchange,
                    my_instance->key, my_instance->queue
                   );
-        dcb_printf(dcb, "%-16s%-16s%-16s\n",
-                   "Messages", "Queued", "Sent");
-        dcb_printf(dcb, "%-16d%-16d%-16d\n",
-                   my_instance->stats.n_msg,
-                   my_instance->stats.n_queued,
-                   my_instance->stats.n_sent);
+        uint64_t n_msg = 0;
+
+        for (int i = 0; i < my_instance->n_rings; i++)
+        {
+            n_msg += __atomic_load_n(&my_instance->rings[i].n_records, __ATOMIC_RELAXED);
+        }
+
+        uint64_t n_sent = atomic_add_uint64(&my_instance->stats.n_sent, 0);
+        uint64_t n_dropped = atomic_add_uint64(&my_instance->stats.n_dropped, 0);
+        int conn_stat = __atomic_load_n(&my_instance->conn_stat, __ATOMIC_RELAXED);
+
+        dcb_printf(dcb, "Connection: %s\n\n", conn_stat == AMQP_STATUS_OK ?
+                   "OK" : amqp_error_string2(conn_stat));
+        dcb_printf(dcb, "%-16s%-16s%-16s%-16s\n",
+                   "Messages", "Queued", "Sent", "Dropped");
+        dcb_printf(dcb, "%-16lu%-16lu%-16lu%-16lu\n",
+                   n_msg + n_dropped,
+                   n_msg > n_sent ? n_msg - n_sent : 0,
+                   n_sent, n_dropped);
+
+        if (my_instance->confirms)
+        {
+            dcb_printf(dcb, "%-16s%-16s\n", "Confirmed", "Rejected");
+            dcb_printf(dcb, "%-16lu%-16lu\n",
+                       atomic_add_uint64(&my_instance->stats.n_confirmed, 0),
+                       atomic_add_uint64(&my_instance->stats.n_rejected, 0));
+        }
     }
 }
 
@@ -20,9 +20,11 @@
 #include <maxscale/modutil.h>
 #include <maxscale/log_manager.h>
 #include <string.h>
-#include <regex.h>
 #include <maxscale/hint.h>
 #include <maxscale/alloc.h>
+#include <maxscale/pcre2.h>
+#include <maxscale/platform.h>
+#include <maxscale/server.h>
 #include <maxscale/utils.h>
 #include <netdb.h>
 
@@ -35,10 +37,16 @@
  * Two parameters should be defined in the filter configuration
  *      match=<regular expression>
  *      server=<server to route statement to>
+ * More rules can be defined with numbered parameters, from 01 to 25
+ *      matchXY=<regular expression>
+ *      targetXY=<server, ->master or ->slave>
  * Two optional parameters
  *      source=<source address to limit filter>
  *      user=<username to limit filter>
  *
+ * All rules are compiled into one regular expression that is matched once
+ * against the SQL. The first rule that matches decides the target.
+ *
  * Date         Who             Description
  * 22/01/2015   Mark Riddoch    Written as example based on regex filter
  * @endverbatim
@@ -52,6 +60,16 @@ static void setDownstream(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, MX
 static int routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, GWBUF *queue);
 static void diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb);
 static uint64_t getCapabilities(MXS_FILTER* instance);
+static void thread_finish();
+
+/** Number of numbered match and target parameters */
+#define REGEXHINT_MAX_RULES 25
+
+/** Initial size of the per-thread JIT stack */
+#define REGEXHINT_JIT_STACK_START (32 * 1024)
+
+/** Maximum size of the per-thread JIT stack */
+#define REGEXHINT_JIT_STACK_MAX (512 * 1024)
 
 typedef struct source_host
 {
@@ -60,6 +78,16 @@ typedef struct source_host
     int netmask;
 } REGEXHINT_SOURCE_HOST;
 
+/**
+ * A routing rule
+ */
+typedef struct
+{
+    char *match; /* Regular expression to match */
+    char *target; /* Server to route to, or ->master or ->slave */
+    HINT_TYPE type; /* The type of the routing hint */
+} REGEXHINT_RULE;
+
 /**
  * Instance structure
  */
@@ -67,17 +95,33 @@ typedef struct
 {
     REGEXHINT_SOURCE_HOST *source; /* Source address to restrict matches */
     char *user; /* User name to restrict matches */
-    char *match; /* Regular expression to match */
-    char *server; /* Server to route to */
-    regex_t re; /* Compiled regex text */
+    REGEXHINT_RULE *rules; /* The rules in the order they are matched */
+    int n_rules; /* Number of rules */
+    pcre2_code *re; /* All rules compiled into one regular expression */
 } REGEXHINT_INSTANCE;
 
+/**
+ * The matching state of a thread. It is shared by all filter instances, as a
+ * thread only ever processes one query at a time.
+ */
+typedef struct
+{
+    pcre2_match_context *mcontext; /* Match context with the JIT stack */
+    pcre2_jit_stack *jit_stack; /* The JIT stack of the thread */
+    pcre2_match_data *match_data; /* Matching data used by all the instances */
+} REGEXHINT_THREAD;
+
+static thread_local REGEXHINT_THREAD thr_regexhint;
+
 static bool validate_ip_address(const char *);
 static int check_source_host(REGEXHINT_INSTANCE *,
                              const char *,
                              const struct sockaddr_storage *);
 static REGEXHINT_SOURCE_HOST *set_source_address(const char *);
 static void free_instance(REGEXHINT_INSTANCE *);
+static bool add_rule(REGEXHINT_INSTANCE *, const char *, const char *, uint32_t);
+static bool compile_rules(REGEXHINT_INSTANCE *, uint32_t);
+static int find_rule(REGEXHINT_INSTANCE *, const char *, size_t);
 
 /**
  * The session structuee for this regex filter
@@ -90,14 +134,20 @@ typedef struct
     int active; /* Is filter active */
 } REGEXHINT_SESSION;
 
+/** The PCRE2 syntax is a superset of the extended POSIX syntax */
 static const MXS_ENUM_VALUE option_values[] =
 {
-    {"ignorecase", REG_ICASE},
+    {"ignorecase", PCRE2_CASELESS},
     {"case", 0},
-    {"extended", REG_EXTENDED},
+    {"extended", 0},
     {NULL}
 };
 
+/** The numbered rule parameters */
+#define REGEXHINT_RULE_PARAMS(n) \
+    {"match" #n, MXS_MODULE_PARAM_STRING}, \
+    {"target" #n, MXS_MODULE_PARAM_STRING}
+
 /**
  * The module entry point routine. It is this routine that
  * must populate the structure that is referred to as the
@@ -129,15 +179,15 @@ MXS_MODULE* MXS_CREATE_MODULE()
         MXS_MODULE_GA,
         MXS_FILTER_VERSION,
         "A routing hint filter that uses regular expressions to direct queries",
-        "V1.1.0",
+        "V1.2.0",
         &MyObject,
         NULL, /* Process init. */
         NULL, /* Process finish. */
         NULL, /* Thread init. */
-        NULL, /* Thread finish. */
+        thread_finish, /* Thread finish. */
         {
-            {"match", MXS_MODULE_PARAM_STRING, NULL, MXS_MODULE_OPT_REQUIRED},
-            {"server", MXS_MODULE_PARAM_SERVER, NULL, MXS_MODULE_OPT_REQUIRED},
+            {"match", MXS_MODULE_PARAM_STRING},
+            {"server", MXS_MODULE_PARAM_SERVER},
             {"source", MXS_MODULE_PARAM_STRING},
             {"user", MXS_MODULE_PARAM_STRING},
             {
@@ -147,6 +197,15 @@ MXS_MODULE* MXS_CREATE_MODULE()
                 MXS_MODULE_OPT_NONE,
                 option_values
             },
+            REGEXHINT_RULE_PARAMS(01), REGEXHINT_RULE_PARAMS(02), REGEXHINT_RULE_PARAMS(03),
+            REGEXHINT_RULE_PARAMS(04), REGEXHINT_RULE_PARAMS(05), REGEXHINT_RULE_PARAMS(06),
+            REGEXHINT_RULE_PARAMS(07), REGEXHINT_RULE_PARAMS(08), REGEXHINT_RULE_PARAMS(09),
+            REGEXHINT_RULE_PARAMS(10), REGEXHINT_RULE_PARAMS(11), REGEXHINT_RULE_PARAMS(12),
+            REGEXHINT_RULE_PARAMS(13), REGEXHINT_RULE_PARAMS(14), REGEXHINT_RULE_PARAMS(15),
+            REGEXHINT_RULE_PARAMS(16), REGEXHINT_RULE_PARAMS(17), REGEXHINT_RULE_PARAMS(18),
+            REGEXHINT_RULE_PARAMS(19), REGEXHINT_RULE_PARAMS(20), REGEXHINT_RULE_PARAMS(21),
+            REGEXHINT_RULE_PARAMS(22), REGEXHINT_RULE_PARAMS(23), REGEXHINT_RULE_PARAMS(24),
+            REGEXHINT_RULE_PARAMS(25),
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -186,17 +245,61 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
             }
         }
 
-        my_instance->match = MXS_STRDUP_A(config_get_string(params, "match"));
-        my_instance->server = MXS_STRDUP_A(config_get_string(params, "server"));
         my_instance->user = config_copy_string(params, "user");
         bool error = false;
-        int cflags = config_get_enum(params, "options", option_values);
+        uint32_t cflags = config_get_enum(params, "options", option_values);
+
+        /** The legacy rule is always the first one */
+        const char *match = config_get_string(params, "match");
+        const char *target = config_get_string(params, "server");
+
+        if (*match || *target)
+        {
+            if (!*match || !*target)
+            {
+                MXS_ERROR("Both 'match' and 'server' must be defined if either of them is.");
+                error = true;
+            }
+            else if (!add_rule(my_instance, match, target, cflags))
+            {
+                error = true;
+            }
+        }
+
+        for (int i = 1; i <= REGEXHINT_MAX_RULES && !error; i++)
+        {
+            char match_name[sizeof("matchXY")];
+            char target_name[sizeof("targetXY")];
+            snprintf(match_name, sizeof(match_name), "match%02d", i);
+            snprintf(target_name, sizeof(target_name), "target%02d", i);
+
+            match = config_get_string(params, match_name);
+            target = config_get_string(params, target_name);
+
+            if (*match || *target)
+            {
+                if (!*match || !*target)
+                {
+                    MXS_ERROR("Both '%s' and '%s' must be defined if either of them is.",
+                              match_name, target_name);
+                    error = true;
+                }
+                else if (!add_rule(my_instance, match, target, cflags))
+                {
+                    error = true;
+                }
+            }
+        }
+
+        if (!error && my_instance->n_rules == 0)
+        {
+            MXS_ERROR("No routing rules defined. Define either 'match' and 'server' "
+                      "or at least one pair of 'matchXY' and 'targetXY'.");
+            error = true;
+        }
 
-        if (regcomp(&my_instance->re, my_instance->match, cflags))
+        if (!error && !compile_rules(my_instance, cflags))
         {
-            MXS_ERROR("Invalid regular expression '%s'.", my_instance->match);
-            MXS_FREE(my_instance->match);
-            my_instance->match = NULL;
             error = true;
         }
 
@@ -296,9 +399,8 @@ setDownstream(MXS_FILTER *instance, MXS_FILTER_SESSION *session, MXS_DOWNSTREAM
  * query should normally be passed to the downstream component
  * (filter or router) in the filter chain.
  *
- * If the regular expressed configured in the match parameter of the
- * filter definition matches the SQL text then add the hint
- * "Route to named server" with the name defined in the server parameter
+ * The SQL text is matched against all the rules at once and the hint
+ * of the first rule that matches is added to the query.
  *
  * @param instance  The filter instance data
  * @param session   The filter session
@@ -309,18 +411,21 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
 {
     REGEXHINT_INSTANCE *my_instance = (REGEXHINT_INSTANCE *) instance;
     REGEXHINT_SESSION *my_session = (REGEXHINT_SESSION *) session;
-    char *sql;
-    regmatch_t limits[] = {{0, 0}};
+    const char *sql;
+    size_t sql_len;
 
     if (modutil_is_SQL(queue) && my_session->active)
     {
-        if (modutil_extract_SQL(queue, &sql, &limits[0].rm_eo))
+        if (modutil_get_query_view(queue, &sql, &sql_len))
         {
-            if (regexec(&my_instance->re, sql, 0, limits, REG_STARTEND) == 0)
+            int rule = find_rule(my_instance, sql, sql_len);
+
+            if (rule >= 0)
             {
-                queue->hint = hint_create_route(queue->hint,
-                                                HINT_ROUTE_TO_NAMED_SERVER,
-                                                my_instance->server);
+                REGEXHINT_RULE *r = &my_instance->rules[rule];
+                queue->hint = hint_create_route(queue->hint, r->type,
+                                                r->type == HINT_ROUTE_TO_NAMED_SERVER ?
+                                                r->target : NULL);
                 my_session->n_diverted++;
             }
             else
@@ -350,8 +455,11 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
     REGEXHINT_INSTANCE *my_instance = (REGEXHINT_INSTANCE *) instance;
     REGEXHINT_SESSION *my_session = (REGEXHINT_SESSION *) fsession;
 
-    dcb_printf(dcb, "\t\tMatch and route:           /%s/ -> %s\n",
-               my_instance->match, my_instance->server);
+    for (int i = 0; i < my_instance->n_rules; i++)
+    {
+        dcb_printf(dcb, "\t\tMatch and route:           /%s/ -> %s\n",
+                   my_instance->rules[i].match, my_instance->rules[i].target);
+    }
     if (my_session)
     {
         dcb_printf(dcb, "\t\tNo. of queries diverted by filter: %d\n",
@@ -380,7 +488,7 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
  */
 static uint64_t getCapabilities(MXS_FILTER* instance)
 {
-    return RCAP_TYPE_CONTIGUOUS_INPUT;
+    return RCAP_TYPE_CONTIGUOUS_INPUT | FCAP_TYPE_COM_QUERY;
 }
 
 /**
@@ -597,18 +705,239 @@ static REGEXHINT_SOURCE_HOST *set_source_address(const char *input_host)
  */
 static void free_instance(REGEXHINT_INSTANCE *instance)
 {
-    if (instance->match)
+    for (int i = 0; i < instance->n_rules; i++)
     {
-        regfree(&instance->re);
-        MXS_FREE(instance->match);
+        MXS_FREE(instance->rules[i].match);
+        MXS_FREE(instance->rules[i].target);
     }
 
-    MXS_FREE(instance->server);
-    MXS_FREE(instance->source);
-    MXS_FREE(instance->user);
+    MXS_FREE(instance->rules);
+    pcre2_code_free(instance->re);
     if (instance->source)
     {
         MXS_FREE(instance->source->address);
     }
+    MXS_FREE(instance->source);
+    MXS_FREE(instance->user);
     MXS_FREE(instance);
 }
+
+/**
+ * Add a routing rule to the instance
+ *
+ * The regular expression is compiled on its own to report any errors in it
+ * against the rule that contains it.
+ *
+ * @param instance The filter instance
+ * @param match    The regular expression of the rule
+ * @param target   A server name, "->master" or "->slave"
+ * @param cflags   PCRE2 compilation options
+ *
+ * @return True if the rule was added
+ */
+static bool add_rule(REGEXHINT_INSTANCE *instance, const char *match,
+                     const char *target, uint32_t cflags)
+{
+    HINT_TYPE type;
+
+    if (strcmp(target, "->master") == 0)
+    {
+        type = HINT_ROUTE_TO_MASTER;
+    }
+    else if (strcmp(target, "->slave") == 0)
+    {
+        type = HINT_ROUTE_TO_SLAVE;
+    }
+    else if (server_find_by_unique_name(target))
+    {
+        type = HINT_ROUTE_TO_NAMED_SERVER;
+    }
+    else
+    {
+        MXS_ERROR("The target '%s' of the rule /%s/ is not a server, "
+                  "'->master' or '->slave'.", target, match);
+        return false;
+    }
+
+    int errcode;
+    PCRE2_SIZE erroffset;
+    pcre2_code *re = pcre2_compile((PCRE2_SPTR)match, PCRE2_ZERO_TERMINATED, cflags,
+                                   &errcode, &erroffset, NULL);
+
+    if (re == NULL)
+    {
+        PCRE2_UCHAR errorbuf[120];
+        pcre2_get_error_message(errcode, errorbuf, sizeof(errorbuf));
+        MXS_ERROR("Invalid regular expression '%s' at offset %lu: %s",
+                  match, (unsigned long)erroffset, errorbuf);
+        return false;
+    }
+
+    pcre2_code_free(re);
+
+    REGEXHINT_RULE *rules = MXS_REALLOC(instance->rules,
+                                        (instance->n_rules + 1) * sizeof(REGEXHINT_RULE));
+
+    if (rules == NULL)
+    {
+        return false;
+    }
+
+    instance->rules = rules;
+    rules[instance->n_rules].match = MXS_STRDUP_A(match);
+    rules[instance->n_rules].target = MXS_STRDUP_A(target);
+    rules[instance->n_rules].type = type;
+    instance->n_rules++;
+
+    return true;
+}
+
+/**
+ * Compile all rules into one regular expression
+ *
+ * Each rule is a lookahead over the whole SQL text followed by a mark with
+ * the index of the rule. The alternatives are tried in order so the first
+ * matching rule wins and its index is returned by pcre2_get_mark(). The
+ * branch reset group keeps the numbered back-references of each rule valid.
+ *
+ * @param instance The filter instance
+ * @param cflags   PCRE2 compilation options
+ *
+ * @return True if the rules were compiled
+ */
+static bool compile_rules(REGEXHINT_INSTANCE *instance, uint32_t cflags)
+{
+    const char prefix[] = "(?=[\\s\\S]*?(?:";
+    const char suffix[] = "))(*:";
+    size_t len = sizeof("(?|)");
+
+    for (int i = 0; i < instance->n_rules; i++)
+    {
+        len += sizeof(prefix) + strlen(instance->rules[i].match) + sizeof(suffix) + 16;
+    }
+
+    char *pattern = MXS_MALLOC(len);
+
+    if (pattern == NULL)
+    {
+        return false;
+    }
+
+    char *ptr = pattern;
+    ptr += sprintf(ptr, "(?|");
+
+    for (int i = 0; i < instance->n_rules; i++)
+    {
+        ptr += sprintf(ptr, "%s%s%s%s%d)", i > 0 ? "|" : "", prefix,
+                       instance->rules[i].match, suffix, i);
+    }
+
+    strcpy(ptr, ")");
+
+    int errcode;
+    PCRE2_SIZE erroffset;
+    instance->re = pcre2_compile((PCRE2_SPTR)pattern, PCRE2_ZERO_TERMINATED,
+                                 cflags | PCRE2_ANCHORED | PCRE2_DUPNAMES,
+                                 &errcode, &erroffset, NULL);
+
+    if (instance->re == NULL)
+    {
+        PCRE2_UCHAR errorbuf[120];
+        pcre2_get_error_message(errcode, errorbuf, sizeof(errorbuf));
+        MXS_ERROR("Failed to combine the routing rules into '%s': %s", pattern, errorbuf);
+    }
+    else if (pcre2_jit_compile(instance->re, PCRE2_JIT_COMPLETE) < 0)
+    {
+        MXS_INFO("PCRE2 JIT compilation of the routing rules failed, "
+                 "falling back to normal matching.");
+    }
+
+    MXS_FREE(pattern);
+
+    return instance->re != NULL;
+}
+
+/**
+ * Get the matching state of the current thread
+ *
+ * @return The thread state or NULL on memory allocation failure
+ */
+static REGEXHINT_THREAD* get_thread_data()
+{
+    REGEXHINT_THREAD *thr = &thr_regexhint;
+
+    if (thr->match_data == NULL)
+    {
+        thr->mcontext = pcre2_match_context_create(NULL);
+        thr->jit_stack = pcre2_jit_stack_create(REGEXHINT_JIT_STACK_START,
+                                                REGEXHINT_JIT_STACK_MAX, NULL);
+        /** Only the mark is needed, not the captured substrings */
+        thr->match_data = pcre2_match_data_create(1, NULL);
+
+        if (thr->mcontext && thr->jit_stack && thr->match_data)
+        {
+            pcre2_jit_stack_assign(thr->mcontext, NULL, thr->jit_stack);
+        }
+        else
+        {
+            thread_finish();
+            MXS_ERROR("Failed to allocate PCRE2 matching data.");
+            return NULL;
+        }
+    }
+
+    return thr;
+}
+
+/**
+ * Free the matching state of the current thread
+ */
+static void thread_finish()
+{
+    REGEXHINT_THREAD *thr = &thr_regexhint;
+
+    pcre2_match_data_free(thr->match_data);
+    pcre2_jit_stack_free(thr->jit_stack);
+    pcre2_match_context_free(thr->mcontext);
+
+    thr->match_data = NULL;
+    thr->jit_stack = NULL;
+    thr->mcontext = NULL;
+}
+
+/**
+ * Find the first rule that matches the SQL text
+ *
+ * @param instance The filter instance
+ * @param sql      The SQL text
+ * @param sql_len  The length of the SQL text
+ *
+ * @return The index of the matching rule or -1 if no rule matched
+ */
+static int find_rule(REGEXHINT_INSTANCE *instance, const char *sql, size_t sql_len)
+{
+    REGEXHINT_THREAD *thr = get_thread_data();
+    int rule = -1;
+
+    if (thr)
+    {
+        int rc = pcre2_match(instance->re, (PCRE2_SPTR)sql, sql_len, 0, 0,
+                             thr->match_data, thr->mcontext);
+
+        if (rc >= 0)
+        {
+            PCRE2_SPTR mark = pcre2_get_mark(thr->match_data);
+
+            if (mark)
+            {
+                rule = atoi((const char*)mark);
+            }
+        }
+        else if (rc != PCRE2_ERROR_NOMATCH)
+        {
+            MXS_INFO("Matching the routing rules failed with error code %d.", rc);
+        }
+    }
+
+    return rule;
+}
@@ -36,12 +36,14 @@
 
 #define MXS_MODULE_NAME "qlafilter"
 
+#include <inttypes.h>
 #include <stdio.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <maxscale/filter.h>
 #include <maxscale/modinfo.h>
 #include <maxscale/modutil.h>
+#include <maxscale/query_classifier.h>
 #include <maxscale/utils.h>
 #include <maxscale/log_manager.h>
 #include <time.h>
@@ -50,7 +52,11 @@
 #include <string.h>
 #include <maxscale/atomic.h>
 #include <maxscale/alloc.h>
+#include <maxscale/modulecmd.h>
+#include <maxscale/platform.h>
 #include <maxscale/service.h>
+#include <maxscale/spsc_ring.h>
+#include <unistd.h>
 
 /** Date string buffer size */
 #define QLA_DATE_BUFFER_SIZE 20
@@ -67,11 +73,36 @@ enum log_options
     LOG_DATA_DATE       = (1 << 2),
     LOG_DATA_USER       = (1 << 3),
     LOG_DATA_QUERY      = (1 << 4),
+    LOG_DATA_DIGEST     = (1 << 5),
 };
 
 /** Default values for logged data */
 #define LOG_DATA_DEFAULT "date,user,query"
 
+/** Size of the buffer into which the writer thread collects unified log entries */
+#define QLA_WRITE_BUFFER_SIZE (256 * 1024)
+
+/** Number of session log files the writer thread keeps open */
+#define QLA_FD_CACHE_SIZE 64
+
+/* Flags of the records in the asynchronous log buffers */
+enum record_flags
+{
+    QLA_RECORD_SESSION = (1 << 1), // Entry for the session specific file
+    QLA_RECORD_UNIFIED = (1 << 2), // Entry for the unified file
+    QLA_RECORD_CLOSE   = (1 << 3), // The session has been closed
+};
+
+/**
+ * A record in an asynchronous log buffer. The preformatted log entry follows
+ * the header.
+ */
+typedef struct
+{
+    uint32_t flags;  /* What the record is */
+    uint64_t ses_id; /* The session that created the record */
+} QLA_RECORD;
+
 /*
  * The filter entry points
  */
@@ -84,6 +115,20 @@ static int routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, GWBUF
 static void diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb);
 static uint64_t getCapabilities(MXS_FILTER* instance);
 
+/**
+ * The state of a writer thread.
+ */
+typedef struct
+{
+    char *buffer;     /* Unified log entries not yet written */
+    size_t len;       /* Length of the unified log entries */
+    struct
+    {
+        uint64_t ses_id;
+        int fd;
+    } files[QLA_FD_CACHE_SIZE]; /* The open session log files */
+} QLA_WRITER;
+
 /**
  * A instance structure, the assumption is that the option passed
  * to the filter is simply a base for the filename to which the queries
@@ -110,6 +155,15 @@ typedef struct
     bool flush_writes; /* Flush log file after every write? */
     bool append;    /* Open files in append-mode? */
     bool write_warning_given; /* To make sure some warning are only given once */
+    bool async;     /* Whether a writer thread writes the log files */
+    char *unified_filename; /* Name of the unified log file */
+    MXS_SPSC_RING *rings; /* The asynchronous log buffers, one per routing thread */
+    int n_rings;    /* Number of log buffers */
+    uint64_t records_written; /* Log entries written by the writer thread */
+    uint64_t records_dropped; /* Log entries dropped as a log buffer was full */
+    int rotate;     /* Set when the log files should be reopened */
+    QLA_WRITER writer; /* State of the writer thread */
+    MXS_SPSC_CONSUMER *consumer; /* The writer thread */
 } QLA_INSTANCE;
 
 /**
@@ -132,9 +186,14 @@ typedef struct
     const char *user; /* The client */
 } QLA_SESSION;
 
-static FILE* open_log_file(uint32_t, QLA_INSTANCE *, const char *);
+static FILE* open_log_file(uint32_t, QLA_INSTANCE *, const char *, bool);
 static int write_log_entry(uint32_t, FILE*, QLA_INSTANCE*, QLA_SESSION*, const char*,
-                           const char*, size_t);
+                           uint64_t, const char*, size_t);
+static void enqueue_log_entry(uint32_t, uint32_t, QLA_INSTANCE*, QLA_SESSION*, const char*,
+                              uint64_t, const char*, size_t);
+static uint64_t writer_drain(MXS_SPSC_RING *ring, void *data);
+static int writer_flush_all(MXS_SPSC_CONSUMER *consumer, void *data);
+static bool qla_rotate(const MODULECMD_ARG *argv);
 
 static const MXS_ENUM_VALUE option_values[] =
 {
@@ -158,6 +217,7 @@ static const MXS_ENUM_VALUE log_data_values[] =
     {"date",    LOG_DATA_DATE},
     {"user",    LOG_DATA_USER},
     {"query",   LOG_DATA_QUERY},
+    {"digest",  LOG_DATA_DIGEST},
     {NULL}
 };
 
@@ -171,6 +231,13 @@ static const MXS_ENUM_VALUE log_data_values[] =
  */
 MXS_MODULE* MXS_CREATE_MODULE()
 {
+    modulecmd_arg_type_t args_rotate[] =
+    {
+        {MODULECMD_ARG_FILTER | MODULECMD_ARG_NAME_MATCHES_DOMAIN, "Filter whose log files are reopened"}
+    };
+
+    modulecmd_register_command(MXS_MODULE_NAME, "rotate", qla_rotate, 1, args_rotate);
+
     static MXS_FILTER_OBJECT MyObject =
     {
         createInstance,
@@ -252,6 +319,16 @@ MXS_MODULE* MXS_CREATE_MODULE()
                 MXS_MODULE_PARAM_BOOL,
                 "false"
             },
+            {
+                "async",
+                MXS_MODULE_PARAM_BOOL,
+                "false"
+            },
+            {
+                "async_buffer_size",
+                MXS_MODULE_PARAM_SIZE,
+                "1M"
+            },
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -272,13 +349,14 @@ MXS_MODULE* MXS_CREATE_MODULE()
 static MXS_FILTER *
 createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
 {
-    QLA_INSTANCE *my_instance = (QLA_INSTANCE*) MXS_MALLOC(sizeof(QLA_INSTANCE));
+    QLA_INSTANCE *my_instance = (QLA_INSTANCE*) MXS_CALLOC(1, sizeof(QLA_INSTANCE));
 
     if (my_instance)
     {
         my_instance->sessions = 0;
         my_instance->unified_fp = NULL;
         my_instance->write_warning_given = false;
+        my_instance->async = config_get_bool(params, "async");
         my_instance->name = MXS_STRDUP_A(name);
         my_instance->filebase = MXS_STRDUP_A(config_get_string(params, "filebase"));
         my_instance->flush_writes = config_get_bool(params, "flush");
@@ -323,7 +401,8 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
                 snprintf(filename, namelen, "%s.unified", my_instance->filebase);
                 // Open the file. It is only closed at program exit
                 my_instance->unified_fp = open_log_file(my_instance->log_file_data_flags,
-                                                        my_instance, filename);
+                                                        my_instance, filename,
+                                                        my_instance->append);
 
                 if (my_instance->unified_fp == NULL)
                 {
@@ -334,7 +413,12 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
                               strerror_r(errno, errbuf, sizeof(errbuf)));
                     error = true;
                 }
-                MXS_FREE(filename);
+                else if (my_instance->async)
+                {
+                    // The writer thread bypasses stdio
+                    fflush(my_instance->unified_fp);
+                }
+                my_instance->unified_filename = filename;
             }
             else
             {
@@ -342,8 +426,43 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
             }
         }
 
+        if (!error && my_instance->async)
+        {
+            my_instance->n_rings = config_threadcount();
+
+            if ((my_instance->rings = mxs_spsc_rings_alloc(my_instance->n_rings,
+                                                           config_get_size(params, "async_buffer_size"))) == NULL)
+            {
+                error = true;
+            }
+
+            for (int i = 0; i < QLA_FD_CACHE_SIZE; i++)
+            {
+                my_instance->writer.files[i].fd = -1;
+            }
+
+            if (!error && (my_instance->writer.buffer = MXS_MALLOC(QLA_WRITE_BUFFER_SIZE)) == NULL)
+            {
+                error = true;
+            }
+
+            if (!error && (my_instance->consumer = mxs_spsc_consumer_start(my_instance->rings,
+                                                                           my_instance->n_rings,
+                                                                           writer_drain,
+                                                                           writer_flush_all,
+                                                                           my_instance)) == NULL)
+            {
+                MXS_ERROR("Failed to start the writer thread of qla filter '%s'.", name);
+                error = true;
+            }
+        }
+
         if (error)
         {
+            mxs_spsc_rings_free(my_instance->rings, my_instance->n_rings);
+            MXS_FREE(my_instance->writer.buffer);
+            MXS_FREE(my_instance->unified_filename);
+
             if (my_instance->match)
             {
                 MXS_FREE(my_instance->match);
@@ -423,9 +542,16 @@ newSession(MXS_FILTER *instance, MXS_SESSION *session)
         {
             uint32_t data_flags = (my_instance->log_file_data_flags &
                                    ~LOG_DATA_SESSION); // No point printing "Session"
-            my_session->fp = open_log_file(data_flags, my_instance, my_session->filename);
+            my_session->fp = open_log_file(data_flags, my_instance, my_session->filename,
+                                           my_instance->append);
 
-            if (my_session->fp == NULL)
+            if (my_session->fp && my_instance->async)
+            {
+                // The writer thread opens the file when it has something to write
+                fclose(my_session->fp);
+                my_session->fp = NULL;
+            }
+            else if (my_session->fp == NULL)
             {
                 char errbuf[MXS_STRERROR_BUFLEN];
                 MXS_ERROR("Opening output file for qla "
@@ -452,12 +578,19 @@ newSession(MXS_FILTER *instance, MXS_SESSION *session)
 static void
 closeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session)
 {
+    QLA_INSTANCE *my_instance = (QLA_INSTANCE *) instance;
     QLA_SESSION *my_session = (QLA_SESSION *) session;
 
     if (my_session->active && my_session->fp)
     {
         fclose(my_session->fp);
     }
+    else if (my_session->active && my_instance->async &&
+             (my_instance->log_mode_flags & CONFIG_FILE_SESSION))
+    {
+        // Let the writer thread close the file of the session
+        enqueue_log_entry(QLA_RECORD_CLOSE, 0, my_instance, my_session, NULL, 0, NULL, 0);
+    }
 }
 
 /**
@@ -507,15 +640,18 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
 {
     QLA_INSTANCE *my_instance = (QLA_INSTANCE *) instance;
     QLA_SESSION *my_session = (QLA_SESSION *) session;
-    char *sql;
+    const char *sql;
+    size_t sql_len;
     struct tm t;
     struct timeval tv;
     regmatch_t limits[] = {{0, 0}};
 
     if (my_session->active)
     {
-        if (modutil_extract_SQL(queue, &sql, &limits[0].rm_eo))
+        if (modutil_get_query_view(queue, &sql, &sql_len))
         {
+            limits[0].rm_eo = sql_len;
+
             if ((my_instance->match == NULL ||
                  regexec(&my_instance->re, sql, 0, limits, REG_STARTEND) == 0) &&
                 (my_instance->nomatch == NULL ||
@@ -530,9 +666,31 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
                  * Loop over all the possible log file modes and write to
                  * the enabled files.
                  */
-                int length = limits[0].rm_eo;
+                int length = sql_len;
                 bool write_error = false;
-                if (my_instance->log_mode_flags & CONFIG_FILE_SESSION)
+                uint64_t digest = 0;
+
+                if (my_instance->log_file_data_flags & LOG_DATA_DIGEST)
+                {
+                    qc_get_canonical_digest(queue, &digest);
+                }
+
+                if (my_instance->async)
+                {
+                    if (my_instance->log_mode_flags & CONFIG_FILE_SESSION)
+                    {
+                        uint32_t data_flags = (my_instance->log_file_data_flags &
+                                               ~LOG_DATA_SESSION);
+                        enqueue_log_entry(QLA_RECORD_SESSION, data_flags, my_instance,
+                                          my_session, buffer, digest, sql, length);
+                    }
+                    if (my_instance->log_mode_flags & CONFIG_FILE_UNIFIED)
+                    {
+                        enqueue_log_entry(QLA_RECORD_UNIFIED, my_instance->log_file_data_flags,
+                                          my_instance, my_session, buffer, digest, sql, length);
+                    }
+                }
+                else if (my_instance->log_mode_flags & CONFIG_FILE_SESSION)
                 {
                     // In this case there is no need to write the session
                     // number into the files.
@@ -540,16 +698,16 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
                                            ~LOG_DATA_SESSION);
 
                     if (write_log_entry(data_flags, my_session->fp,
-                                        my_instance, my_session, buffer, sql, length) < 0)
+                                        my_instance, my_session, buffer, digest, sql, length) < 0)
                     {
                         write_error = true;
                     }
                 }
-                if (my_instance->log_mode_flags & CONFIG_FILE_UNIFIED)
+                if (!my_instance->async && (my_instance->log_mode_flags & CONFIG_FILE_UNIFIED))
                 {
                     uint32_t data_flags = my_instance->log_file_data_flags;
                     if (write_log_entry(data_flags, my_instance->unified_fp,
-                                        my_instance, my_session, buffer, sql, length) < 0)
+                                        my_instance, my_session, buffer, digest, sql, length) < 0)
                     {
                         write_error = true;
                     }
@@ -611,6 +769,13 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
         dcb_printf(dcb, "\t\tExclude queries that match     %s\n",
                    my_instance->nomatch);
     }
+    if (my_instance->async)
+    {
+        dcb_printf(dcb, "\t\tLog entries written        %" PRIu64 "\n",
+                   atomic_add_uint64(&my_instance->records_written, 0));
+        dcb_printf(dcb, "\t\tLog entries dropped        %" PRIu64 "\n",
+                   atomic_add_uint64(&my_instance->records_dropped, 0));
+    }
 }
 
 /**
@@ -620,20 +785,23 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
  */
 static uint64_t getCapabilities(MXS_FILTER* instance)
 {
-    return RCAP_TYPE_CONTIGUOUS_INPUT;
+    return RCAP_TYPE_CONTIGUOUS_INPUT | FCAP_TYPE_COM_QUERY |
+        FCAP_TYPE_COM_STMT_PREPARE | FCAP_TYPE_COM_INIT_DB;
 }
 /**
  * Open the log file and print a header if appropriate.
  * @param   data_flags  Data save settings flags
  * @param   instance    The filter instance
  * @param   filename    Target file path
+ * @param   append      Whether to append to an existing file
  * @return  A valid file on success, null otherwise.
  */
-static FILE* open_log_file(uint32_t data_flags, QLA_INSTANCE *instance, const char *filename)
+static FILE* open_log_file(uint32_t data_flags, QLA_INSTANCE *instance, const char *filename,
+                           bool append)
 {
     bool file_existed = false;
     FILE *fp = NULL;
-    if (instance->append == false)
+    if (append == false)
     {
         // Just open the file (possibly overwriting) and then print header.
         fp = fopen(filename, "w");
@@ -661,10 +829,11 @@ static FILE* open_log_file(uint32_t data_flags, QLA_INSTANCE *instance, const ch
         const char SESSION[] = "Session,";
         const char DATE[] = "Date,";
         const char USERHOST[] = "User@Host,";
+        const char DIGEST[] = "Digest,";
         const char QUERY[] = "Query,";
 
         const int headerlen = sizeof(SERVICE) + sizeof(SERVICE) + sizeof(DATE) +
-                              sizeof(USERHOST) + sizeof(QUERY);
+                              sizeof(USERHOST) + sizeof(DIGEST) + sizeof(QUERY);
 
         char print_str[headerlen];
         memset(print_str, '\0', headerlen);
@@ -690,6 +859,11 @@ static FILE* open_log_file(uint32_t data_flags, QLA_INSTANCE *instance, const ch
             strcat(current_pos, USERHOST);
             current_pos += sizeof(USERHOST) - 1;
         }
+        if (instance->log_file_data_flags & LOG_DATA_DIGEST)
+        {
+            strcat(current_pos, DIGEST);
+            current_pos += sizeof(DIGEST) - 1;
+        }
         if (instance->log_file_data_flags & LOG_DATA_QUERY)
         {
             strcat(current_pos, QUERY);
@@ -722,27 +896,20 @@ static FILE* open_log_file(uint32_t data_flags, QLA_INSTANCE *instance, const ch
 }
 
 /**
- * Write an entry to the log file.
- * @param   data_flags    Controls what to write
- * @param   logfile    Target file
- * @param   instance    Filter instance
- * @param   session    Filter session
- * @param   time_string Date entry
- * @param   sql_string SQL-query, not NULL terminated!
+ * Calculate an upper limit for the length of a log entry.
+ * @param   data_flags  Controls what to write
+ * @param   session     Filter session
  * @param   sql_str_len Length of SQL-string
- * @return  The number of characters written, or a negative value on failure
+ * @return  The upper limit, including the terminating null
  */
-static int write_log_entry(uint32_t data_flags, FILE *logfile, QLA_INSTANCE *instance,
-                           QLA_SESSION *session, const char *time_string, const char *sql_string,
-                           size_t sql_str_len)
+static size_t log_entry_max_len(uint32_t data_flags, QLA_SESSION *session, size_t sql_str_len)
 {
-    ss_dassert(logfile != NULL);
     size_t print_len = 0;
 
-    // First calculate an upper limit for the total length. The strlen()-calls
-    // could be removed if the values would be saved into the instance or session
-    // or if we had some reasonable max lengths. (Apparently there are max lengths
-    // but they are much higher than what is typically needed)
+    // The strlen()-calls could be removed if the values would be saved into
+    // the instance or session or if we had some reasonable max lengths.
+    // (Apparently there are max lengths but they are much higher than what
+    // is typically needed)
 
     // The numbers have some extra for delimiters.
     if (data_flags & LOG_DATA_SERVICE)
@@ -761,11 +928,89 @@ static int write_log_entry(uint32_t data_flags, FILE *logfile, QLA_INSTANCE *ins
     {
         print_len += strlen(session->user) + strlen(session->remote) + 2;
     }
+    if (data_flags & LOG_DATA_DIGEST)
+    {
+        print_len += 16 + 1; // A 64bit integer in hexadecimal
+    }
     if (data_flags & LOG_DATA_QUERY)
     {
         print_len += sql_str_len + 1; // Can't use strlen, not null-terminated
     }
 
+    return print_len ? print_len + 1 : 0;
+}
+
+/**
+ * Format a log entry.
+ * @param   data_flags  Controls what to write
+ * @param   session     Filter session
+ * @param   time_string Date entry
+ * @param   digest      Digest of the canonical query
+ * @param   sql_string  SQL-query, not NULL terminated!
+ * @param   sql_str_len Length of SQL-string
+ * @param   dest        Where to write, at least log_entry_max_len() bytes
+ * @return  The length of the entry, which is not null terminated
+ */
+static size_t format_log_entry(uint32_t data_flags, QLA_SESSION *session,
+                               const char *time_string, uint64_t digest,
+                               const char *sql_string, size_t sql_str_len, char *dest)
+{
+    char *current_pos = dest;
+
+    if (data_flags & LOG_DATA_SERVICE)
+    {
+        current_pos += sprintf(current_pos, "%s,", session->service);
+    }
+    if (data_flags & LOG_DATA_SESSION)
+    {
+        current_pos += sprintf(current_pos, "%lu,", session->ses_id);
+    }
+    if (data_flags & LOG_DATA_DATE)
+    {
+        current_pos += sprintf(current_pos, "%s,", time_string);
+    }
+    if (data_flags & LOG_DATA_USER)
+    {
+        current_pos += sprintf(current_pos, "%s@%s,", session->user, session->remote);
+    }
+    if (data_flags & LOG_DATA_DIGEST)
+    {
+        current_pos += sprintf(current_pos, "%016" PRIx64 ",", digest);
+    }
+    if (data_flags & LOG_DATA_QUERY)
+    {
+        memcpy(current_pos, sql_string, sql_str_len); // non-null-terminated string
+        current_pos += sql_str_len;
+        *current_pos++ = ',';
+    }
+    if (current_pos > dest)
+    {
+        // Overwrite the last ','.
+        *(current_pos - 1) = '\n';
+    }
+
+    return current_pos - dest;
+}
+
+/**
+ * Write an entry to the log file.
+ * @param   data_flags    Controls what to write
+ * @param   logfile    Target file
+ * @param   instance    Filter instance
+ * @param   session    Filter session
+ * @param   time_string Date entry
+ * @param   digest Digest of the canonical query
+ * @param   sql_string SQL-query, not NULL terminated!
+ * @param   sql_str_len Length of SQL-string
+ * @return  The number of characters written, or a negative value on failure
+ */
+static int write_log_entry(uint32_t data_flags, FILE *logfile, QLA_INSTANCE *instance,
+                           QLA_SESSION *session, const char *time_string, uint64_t digest,
+                           const char *sql_string, size_t sql_str_len)
+{
+    ss_dassert(logfile != NULL);
+    size_t print_len = log_entry_max_len(data_flags, session, sql_str_len);
+
     if (print_len == 0)
     {
         return 0; // Nothing to print
@@ -775,91 +1020,318 @@ static int write_log_entry(uint32_t data_flags, FILE *logfile, QLA_INSTANCE *ins
     // cause garbled printing if several threads write simultaneously, so we
     // have to first print to a string.
     char *print_str = NULL;
-    if ((print_str = MXS_CALLOC(print_len, sizeof(char))) == NULL)
+    if ((print_str = MXS_MALLOC(print_len)) == NULL)
     {
         return -1;
     }
 
-    bool error = false;
-    char *current_pos = print_str;
-    int rval = 0;
-    if (!error && (data_flags & LOG_DATA_SERVICE))
+    size_t len = format_log_entry(data_flags, session, time_string, digest,
+                                  sql_string, sql_str_len, print_str);
+
+    // Finally, write the log event.
+    int written = fwrite(print_str, 1, len, logfile);
+    MXS_FREE(print_str);
+
+    if ((!instance->flush_writes) || (written <= 0))
+    {
+        return written;
+    }
+    else
     {
-        if ((rval = sprintf(current_pos, "%s,", session->service)) < 0)
+        // Try flushing. If successful, still return the characters written.
+        int rval = fflush(logfile);
+        if (rval >= 0)
         {
-            error = true;
+            return written;
         }
-        else
+        return rval;
+    }
+}
+
+/**
+ * Add an entry to the log buffer of the current thread. If the buffer is
+ * full, the entry is dropped instead of waiting for the writer thread.
+ * @param   flags         The record type
+ * @param   data_flags    Controls what to write
+ * @param   instance      Filter instance
+ * @param   session       Filter session
+ * @param   time_string   Date entry
+ * @param   digest        Digest of the canonical query
+ * @param   sql_string    SQL-query, not NULL terminated!
+ * @param   sql_str_len   Length of SQL-string
+ */
+static void enqueue_log_entry(uint32_t flags, uint32_t data_flags, QLA_INSTANCE *instance,
+                              QLA_SESSION *session, const char *time_string, uint64_t digest,
+                              const char *sql_string, size_t sql_str_len)
+{
+    size_t print_len = log_entry_max_len(data_flags, session, sql_str_len);
+
+    if (print_len == 0 && flags != QLA_RECORD_CLOSE)
+    {
+        return; // Nothing to print
+    }
+
+    MXS_SPSC_RING *ring = mxs_spsc_rings_get(instance->rings, instance->n_rings);
+    QLA_RECORD *record = ring ? mxs_spsc_ring_reserve(ring, sizeof(QLA_RECORD) + print_len) : NULL;
+
+    if (record)
+    {
+        size_t len = print_len ? format_log_entry(data_flags, session, time_string, digest,
+                                                  sql_string, sql_str_len,
+                                                  (char*)(record + 1)) : 0;
+        record->flags = flags;
+        record->ses_id = session->ses_id;
+        mxs_spsc_ring_commit(ring, sizeof(QLA_RECORD) + len);
+    }
+    else
+    {
+        atomic_add_uint64(&instance->records_dropped, 1);
+    }
+}
+
+/**
+ * Write data to a file, retrying partial writes.
+ * @param   fd   The file
+ * @param   data The data
+ * @param   len  Length of the data
+ * @return  True if all data was written
+ */
+static bool write_all(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t rc = write(fd, data, len);
+
+        if (rc < 0)
         {
-            current_pos += rval;
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
         }
+
+        data += rc;
+        len -= rc;
     }
-    if (!error && (data_flags & LOG_DATA_SESSION))
+
+    return true;
+}
+
+/**
+ * Report a write error of the writer thread, only once per instance.
+ * @param   instance Filter instance
+ */
+static void writer_error(QLA_INSTANCE *instance)
+{
+    if (!instance->write_warning_given)
     {
-        if ((rval = sprintf(current_pos, "%lu,", session->ses_id)) < 0)
+        char errbuf[MXS_STRERROR_BUFLEN];
+        MXS_ERROR("qla-filter '%s': Log file write failed: %d, %s. "
+                  "Suppressing further similar warnings.", instance->name,
+                  errno, strerror_r(errno, errbuf, sizeof(errbuf)));
+        instance->write_warning_given = true;
+    }
+}
+
+/**
+ * Write the collected unified log entries.
+ * @param   instance Filter instance
+ * @param   writer   Writer state
+ */
+static void writer_flush(QLA_INSTANCE *instance, QLA_WRITER *writer)
+{
+    if (writer->len > 0)
+    {
+        if (!write_all(fileno(instance->unified_fp), writer->buffer, writer->len))
         {
-            error = true;
+            writer_error(instance);
         }
-        else
+        writer->len = 0;
+    }
+}
+
+/**
+ * Get the log file of a session, opening it if it is not open.
+ * @param   instance Filter instance
+ * @param   writer   Writer state
+ * @param   ses_id   The session
+ * @return  The file descriptor, or -1 on error
+ */
+static int writer_session_file(QLA_INSTANCE *instance, QLA_WRITER *writer, uint64_t ses_id)
+{
+    int slot = ses_id % QLA_FD_CACHE_SIZE;
+
+    if (writer->files[slot].fd != -1 && writer->files[slot].ses_id != ses_id)
+    {
+        close(writer->files[slot].fd);
+        writer->files[slot].fd = -1;
+    }
+
+    if (writer->files[slot].fd == -1)
+    {
+        // The file and its header were created when the session started
+        char filename[strlen(instance->filebase) + 22];
+        sprintf(filename, "%s.%lu", instance->filebase, ses_id);
+        writer->files[slot].fd = open(filename, O_WRONLY | O_APPEND | O_CREAT, 0666);
+        writer->files[slot].ses_id = ses_id;
+    }
+
+    return writer->files[slot].fd;
+}
+
+/**
+ * Close the session log files.
+ * @param   writer   Writer state
+ */
+static void writer_close_files(QLA_WRITER *writer)
+{
+    for (int i = 0; i < QLA_FD_CACHE_SIZE; i++)
+    {
+        if (writer->files[i].fd != -1)
         {
-            current_pos += rval;
+            close(writer->files[i].fd);
+            writer->files[i].fd = -1;
         }
     }
-    if (!error && (data_flags & LOG_DATA_DATE))
+}
+
+/**
+ * Write the records of a log buffer.
+ * @param   ring     The log buffer
+ * @param   data     Filter instance
+ * @return  Number of records processed
+ */
+static uint64_t writer_drain(MXS_SPSC_RING *ring, void *data)
+{
+    QLA_INSTANCE *instance = (QLA_INSTANCE*)data;
+    QLA_WRITER *writer = &instance->writer;
+    uint64_t n_records = 0;
+    QLA_RECORD *record;
+    size_t len;
+
+    while ((record = mxs_spsc_ring_peek(ring, &len)))
     {
-        if ((rval = sprintf(current_pos, "%s,", time_string)) < 0)
+        const char *entry = (const char*)(record + 1);
+        len -= sizeof(QLA_RECORD);
+
+        if (record->flags & QLA_RECORD_UNIFIED)
         {
-            error = true;
+            if (writer->len + len > QLA_WRITE_BUFFER_SIZE)
+            {
+                writer_flush(instance, writer);
+            }
+
+            memcpy(writer->buffer + writer->len, entry, len);
+            writer->len += len;
+            n_records++;
         }
-        else
+        else if (record->flags & QLA_RECORD_SESSION)
+        {
+            int fd = writer_session_file(instance, writer, record->ses_id);
+
+            if (fd == -1 || !write_all(fd, entry, len))
+            {
+                writer_error(instance);
+            }
+            n_records++;
+        }
+        else if (record->flags & QLA_RECORD_CLOSE)
         {
-            current_pos += rval;
+            int slot = record->ses_id % QLA_FD_CACHE_SIZE;
+
+            if (writer->files[slot].fd != -1 && writer->files[slot].ses_id == record->ses_id)
+            {
+                close(writer->files[slot].fd);
+                writer->files[slot].fd = -1;
+            }
         }
+
+        mxs_spsc_ring_consume(ring);
     }
-    if (!error && (data_flags & LOG_DATA_USER))
+
+    if (n_records > 0)
     {
-        if ((rval = sprintf(current_pos, "%s@%s,", session->user, session->remote)) < 0)
+        atomic_add_uint64(&instance->records_written, n_records);
+    }
+
+    return n_records;
+}
+
+/**
+ * Reopen the log files after they have been moved away.
+ * @param   instance Filter instance
+ * @param   writer   Writer state
+ */
+static void writer_rotate(QLA_INSTANCE *instance, QLA_WRITER *writer)
+{
+    writer_close_files(writer);
+
+    if (instance->unified_fp)
+    {
+        writer_flush(instance, writer);
+        FILE *fp = open_log_file(instance->log_file_data_flags, instance,
+                                 instance->unified_filename, true);
+
+        if (fp)
         {
-            error = true;
+            fflush(fp);
+            fclose(instance->unified_fp);
+            instance->unified_fp = fp;
+            MXS_NOTICE("qla-filter '%s': Reopened '%s'.", instance->name,
+                       instance->unified_filename);
         }
         else
         {
-            current_pos += rval;
+            char errbuf[MXS_STRERROR_BUFLEN];
+            MXS_ERROR("qla-filter '%s': Failed to reopen '%s': %d, %s", instance->name,
+                      instance->unified_filename, errno,
+                      strerror_r(errno, errbuf, sizeof(errbuf)));
         }
     }
-    if (!error && (data_flags & LOG_DATA_QUERY))
-    {
-        strncat(current_pos, sql_string, sql_str_len); // non-null-terminated string
-        current_pos += sql_str_len + 1; // +1 to move to the next char after
-    }
-    if (error || current_pos <= print_str)
-    {
-        MXS_FREE(print_str);
-        MXS_ERROR("qlafilter ('%s'): Failed to format log event.", instance->name);
-        return -1;
-    }
-    else
-    {
-        // Overwrite the last ','. The rest is already filled with 0.
-        *(current_pos - 1) = '\n';
-    }
+}
 
-    // Finally, write the log event.
-    int written = fprintf(logfile, "%s", print_str);
-    MXS_FREE(print_str);
+/**
+ * Write the unified log entries collected from all routing threads, and
+ * reopen the log files if requested. Called by the writer thread after it
+ * has drained the log buffers, so that the routing threads never wait for
+ * the disk and the log is written with few large writes.
+ * @param   consumer The writer thread
+ * @param   data     Filter instance
+ * @return  -1, the writer thread only wakes up for new entries
+ */
+static int writer_flush_all(MXS_SPSC_CONSUMER *consumer, void *data)
+{
+    QLA_INSTANCE *instance = (QLA_INSTANCE*)data;
+    int rotate = 1;
 
-    if ((!instance->flush_writes) || (written <= 0))
+    if (atomic_cas_int(&instance->rotate, &rotate, 0))
     {
-        return written;
+        writer_rotate(instance, &instance->writer);
     }
-    else
+
+    writer_flush(instance, &instance->writer);
+    return -1;
+}
+
+/**
+ * Module command for reopening the log files, for instance after they have
+ * been rotated with logrotate.
+ * @param   argv The filter
+ * @return  True if the files will be reopened
+ */
+static bool qla_rotate(const MODULECMD_ARG *argv)
+{
+    MXS_FILTER_DEF *filter = argv->argv[0].value.filter;
+    QLA_INSTANCE *instance = (QLA_INSTANCE*)filter_def_get_instance(filter);
+
+    if (!instance->async)
     {
-        // Try flushing. If successful, still return the characters written.
-        int rval = fflush(logfile);
-        if (rval >= 0)
-        {
-            return written;
-        }
-        return rval;
+        modulecmd_set_error("The log files can only be reopened with async=true.");
+        return false;
     }
+
+    atomic_add(&instance->rotate, 1);
+    mxs_spsc_consumer_wake(instance->consumer);
+    return true;
 }
@@ -14,6 +14,7 @@
 #define MXS_MODULE_NAME "regexfilter"
 
 #include <maxscale/cdefs.h>
+#include <ctype.h>
 #include <string.h>
 #include <stdio.h>
 #include <maxscale/alloc.h>
@@ -23,6 +24,7 @@
 #include <maxscale/log_manager.h>
 #include <maxscale/modinfo.h>
 #include <maxscale/modutil.h>
+#include <maxscale/platform.h>
 #include <maxscale/pcre2.h>
 
 /**
@@ -30,9 +32,11 @@
  * @verbatim
  *
  * A simple regular expression query rewrite filter.
- * Two parameters should be defined in the filter configuration
+ * The rewrite rules are defined either with the parameters
  *      match=<regular expression>
  *      replace=<replacement text>
+ * or in a rules file of match and replace lines, or both
+ *      rules=<path to rules file>
  * Two optional parameters
  *      source=<source address to limit filter>
  *      user=<username to limit filter>
@@ -50,21 +54,40 @@ static void setDownstream(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, MX
 static int routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, GWBUF *queue);
 static void diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb);
 static uint64_t getCapabilities(MXS_FILTER* instance);
+static void thread_finish();
 
-static char *regex_replace(const char *sql, pcre2_code *re, pcre2_match_data *study,
-                           const char *replace);
+/** Initial size of the per-thread JIT stack */
+#define REGEX_JIT_STACK_START (32 * 1024)
+
+/** Maximum size of the per-thread JIT stack */
+#define REGEX_JIT_STACK_MAX (512 * 1024)
+
+/** Literals shorter than this are not worth a prefilter */
+#define REGEX_MIN_LITERAL 2
 
 /**
- * Instance structure
+ * A single match and replace rule
  */
 typedef struct
 {
-    char *source; /*< Source address to restrict matches */
-    char *user; /*< User name to restrict matches */
     char *match; /*< Regular expression to match */
     char *replace; /*< Replacement text */
     pcre2_code *re; /*< Compiled regex text */
-    pcre2_match_data *match_data; /*< Matching data used by the compiled regex */
+    uint32_t ovec_size; /*< Number of ovector pairs the regex needs */
+    char *literal; /*< Text every matching query contains, or NULL */
+    bool caseless; /*< Whether the literal is matched ignoring case */
+} REGEX_RULE;
+
+/**
+ * Instance structure
+ */
+typedef struct
+{
+    char *source; /*< Source address to restrict matches */
+    char *user; /*< User name to restrict matches */
+    REGEX_RULE *rules; /*< The rules, applied in this order */
+    int n_rules; /*< Number of rules */
+    uint32_t ovec_size; /*< Largest ovector any of the rules needs */
     FILE* logfile; /*< Log file */
     bool log_trace; /*< Whether messages should be printed to tracelog */
 } REGEX_INSTANCE;
@@ -81,8 +104,28 @@ typedef struct
     int active; /* Is filter active */
 } REGEX_SESSION;
 
-void log_match(REGEX_INSTANCE* inst, char* re, char* old, char* new);
-void log_nomatch(REGEX_INSTANCE* inst, char* re, char* old);
+/**
+ * The matching state of a thread. It is shared by all filter instances, as a
+ * thread only ever processes one query at a time. The two buffers hold the
+ * output of consecutive rules and are reused from query to query.
+ */
+typedef struct
+{
+    pcre2_match_context *mcontext; /*< Match context with the JIT stack */
+    pcre2_jit_stack *jit_stack; /*< The JIT stack of the thread */
+    pcre2_match_data *match_data; /*< Matching data used by all the rules */
+    uint32_t ovec_size; /*< Number of ovector pairs in match_data */
+    char *buffer[2]; /*< Substitution output buffers */
+    size_t size[2]; /*< Sizes of the output buffers */
+} REGEX_THREAD;
+
+static thread_local REGEX_THREAD thr_regex;
+
+static const char *regex_replace(REGEX_THREAD *thr, const REGEX_RULE *rule,
+                                 const char *sql, int out);
+
+void log_match(REGEX_INSTANCE* inst, char* re, const char* old, const char* new);
+void log_nomatch(REGEX_INSTANCE* inst, char* re, const char* old);
 
 static const MXS_ENUM_VALUE option_values[] =
 {
@@ -122,15 +165,16 @@ MXS_MODULE* MXS_CREATE_MODULE()
         MXS_MODULE_GA,
         MXS_FILTER_VERSION,
         "A query rewrite filter that uses regular expressions to rewrite queries",
-        "V1.1.0",
+        "V1.2.0",
         &MyObject,
         NULL, /* Process init. */
         NULL, /* Process finish. */
         NULL, /* Thread init. */
-        NULL, /* Thread finish. */
+        thread_finish, /* Thread finish. */
         {
-            {"match", MXS_MODULE_PARAM_STRING, NULL, MXS_MODULE_OPT_REQUIRED},
-            {"replace", MXS_MODULE_PARAM_STRING, NULL, MXS_MODULE_OPT_REQUIRED},
+            {"match", MXS_MODULE_PARAM_STRING},
+            {"replace", MXS_MODULE_PARAM_STRING},
+            {"rules", MXS_MODULE_PARAM_PATH, NULL, MXS_MODULE_OPT_PATH_R_OK},
             {"source", MXS_MODULE_PARAM_STRING},
             {"user", MXS_MODULE_PARAM_STRING},
             {"log_trace", MXS_MODULE_PARAM_BOOL, "false"},
@@ -143,6 +187,256 @@ MXS_MODULE* MXS_CREATE_MODULE()
     return &info;
 }
 
+/**
+ * Free the matching state of the current thread.
+ */
+static void thread_finish()
+{
+    if (thr_regex.match_data)
+    {
+        pcre2_match_data_free(thr_regex.match_data);
+    }
+
+    if (thr_regex.mcontext)
+    {
+        pcre2_match_context_free(thr_regex.mcontext);
+    }
+
+    if (thr_regex.jit_stack)
+    {
+        pcre2_jit_stack_free(thr_regex.jit_stack);
+    }
+
+    MXS_FREE(thr_regex.buffer[0]);
+    MXS_FREE(thr_regex.buffer[1]);
+    memset(&thr_regex, 0, sizeof(thr_regex));
+}
+
+/**
+ * Get the matching state of the current thread, creating it on first use.
+ *
+ * @param inst The filter instance that is about to match with it
+ * @return The matching state or NULL if memory allocation failed
+ */
+static REGEX_THREAD* get_thread_data(const REGEX_INSTANCE *inst)
+{
+    REGEX_THREAD *thr = &thr_regex;
+
+    if (thr->mcontext == NULL)
+    {
+        if ((thr->mcontext = pcre2_match_context_create(NULL)) == NULL)
+        {
+            return NULL;
+        }
+
+        /** Without a JIT stack of its own, the JIT uses 32k from the machine stack */
+        if ((thr->jit_stack = pcre2_jit_stack_create(REGEX_JIT_STACK_START,
+                                                     REGEX_JIT_STACK_MAX, NULL)))
+        {
+            pcre2_jit_stack_assign(thr->mcontext, NULL, thr->jit_stack);
+        }
+    }
+
+    if (thr->ovec_size < inst->ovec_size)
+    {
+        pcre2_match_data *match_data = pcre2_match_data_create(inst->ovec_size, NULL);
+
+        if (match_data == NULL)
+        {
+            return NULL;
+        }
+
+        if (thr->match_data)
+        {
+            pcre2_match_data_free(thr->match_data);
+        }
+
+        thr->match_data = match_data;
+        thr->ovec_size = inst->ovec_size;
+    }
+
+    return thr;
+}
+
+/**
+ * Find the longest literal text that every string matching a pattern must
+ * contain. The analysis is conservative: only literals outside of groups are
+ * used and anything it does not fully understand, such as a top level
+ * alternation or inline options, means that no literal is returned.
+ *
+ * @param pattern The regular expression
+ * @return The literal or NULL if the pattern has no usable literal
+ */
+static char* find_literal(const char *pattern)
+{
+    size_t pattern_len = strlen(pattern);
+    char run[pattern_len + 1];
+    char best[pattern_len + 1];
+    size_t run_len = 0;
+    size_t best_len = 0;
+    int depth = 0;
+
+    for (const char *p = pattern; *p; p++)
+    {
+        bool literal = false;
+        char c = *p;
+
+        switch (c)
+        {
+        case '\\':
+            c = *++p;
+
+            if (c == '\0')
+            {
+                return NULL;
+            }
+            else if (strchr("dDwWsShHvVRNbBAzZGK", c))
+            {
+                /** Character types and assertions */
+                c = '\0';
+            }
+            else if (isalnum((unsigned char)c))
+            {
+                const char *from = "ntrfae";
+                const char *to = "\n\t\r\f\a\x1b";
+                const char *escape = strchr(from, c);
+
+                if (escape == NULL)
+                {
+                    /** Escapes with arguments, back references and quoting */
+                    return NULL;
+                }
+
+                c = to[escape - from];
+                literal = true;
+            }
+            else
+            {
+                literal = true;
+            }
+            break;
+
+        case '[':
+            if (*++p == '^')
+            {
+                p++;
+            }
+
+            if (*p == ']')
+            {
+                p++;
+            }
+
+            while (*p && *p != ']')
+            {
+                if (*p == '[' && p[1] == ':')
+                {
+                    /** A POSIX class such as [:alpha:] */
+                    if ((p = strstr(p, ":]")) == NULL)
+                    {
+                        return NULL;
+                    }
+                    p++;
+                }
+                else if (*p == '\\' && p[1])
+                {
+                    p++;
+                }
+
+                p++;
+            }
+
+            if (*p == '\0')
+            {
+                return NULL;
+            }
+            break;
+
+        case '(':
+            if (p[1] == '?' && p[2] != ':')
+            {
+                /** Inline options, assertions and named groups */
+                return NULL;
+            }
+            depth++;
+            break;
+
+        case ')':
+            depth--;
+            break;
+
+        case '|':
+            if (depth == 0)
+            {
+                return NULL;
+            }
+            break;
+
+        case '{':
+            /** Skip over the repetition count of a quantifier */
+            p += strspn(p + 1, "0123456789,") + 1;
+
+            if (*p != '}')
+            {
+                return NULL;
+            }
+            break;
+
+        case '.':
+        case '^':
+        case '$':
+        case '?':
+        case '*':
+        case '+':
+            break;
+
+        default:
+            literal = true;
+            break;
+        }
+
+        if (literal && depth == 0)
+        {
+            run[run_len++] = c;
+
+            if (p[1] == '?' || p[1] == '*' || p[1] == '{')
+            {
+                /** The character is optional */
+                run_len--;
+                literal = false;
+            }
+            else if (p[1] == '+')
+            {
+                /** The character is required but what follows it is not adjacent */
+                literal = false;
+            }
+        }
+
+        if (!literal && run_len > 0)
+        {
+            if (run_len > best_len)
+            {
+                memcpy(best, run, run_len);
+                best_len = run_len;
+            }
+            run_len = 0;
+        }
+    }
+
+    if (run_len > best_len)
+    {
+        memcpy(best, run, run_len);
+        best_len = run_len;
+    }
+
+    if (best_len < REGEX_MIN_LITERAL)
+    {
+        return NULL;
+    }
+
+    best[best_len] = '\0';
+    return MXS_STRDUP(best);
+}
 /**
  * Free a regexfilter instance.
  * @param instance instance to free
@@ -151,24 +445,162 @@ void free_instance(REGEX_INSTANCE *instance)
 {
     if (instance)
     {
-        if (instance->re)
+        for (int i = 0; i < instance->n_rules; i++)
         {
-            pcre2_code_free(instance->re);
+            REGEX_RULE *rule = &instance->rules[i];
+
+            if (rule->re)
+            {
+                pcre2_code_free(rule->re);
+            }
+
+            MXS_FREE(rule->match);
+            MXS_FREE(rule->replace);
+            MXS_FREE(rule->literal);
         }
 
-        if (instance->match_data)
+        if (instance->logfile)
         {
-            pcre2_match_data_free(instance->match_data);
+            fclose(instance->logfile);
         }
 
-        MXS_FREE(instance->match);
-        MXS_FREE(instance->replace);
+        MXS_FREE(instance->rules);
         MXS_FREE(instance->source);
         MXS_FREE(instance->user);
         MXS_FREE(instance);
     }
 }
 
+/**
+ * Compile a rule and append it to the rules of an instance.
+ *
+ * @param inst    The filter instance
+ * @param match   The regular expression
+ * @param replace The replacement text
+ * @param cflags  PCRE2 compilation options
+ * @return True if the rule was added
+ */
+static bool add_rule(REGEX_INSTANCE *inst, const char *match, const char *replace, int cflags)
+{
+    REGEX_RULE *rules = MXS_REALLOC(inst->rules, (inst->n_rules + 1) * sizeof(REGEX_RULE));
+
+    if (rules == NULL)
+    {
+        return false;
+    }
+
+    inst->rules = rules;
+    REGEX_RULE *rule = &rules[inst->n_rules];
+    memset(rule, 0, sizeof(*rule));
+
+    int errnumber;
+    PCRE2_SIZE erroffset;
+
+    if ((rule->re = pcre2_compile((PCRE2_SPTR) match, PCRE2_ZERO_TERMINATED, cflags,
+                                  &errnumber, &erroffset, NULL)) == NULL)
+    {
+        char errbuffer[1024];
+        pcre2_get_error_message(errnumber, (PCRE2_UCHAR*) & errbuffer, sizeof(errbuffer));
+        MXS_ERROR("Compiling regular expression '%s' failed at %lu: %s",
+                  match, erroffset, errbuffer);
+        return false;
+    }
+
+    /** The JIT is optional, the interpreter is used if it is not available */
+    pcre2_jit_compile(rule->re, PCRE2_JIT_COMPLETE);
+
+    uint32_t captures = 0;
+    pcre2_pattern_info(rule->re, PCRE2_INFO_CAPTURECOUNT, &captures);
+    rule->ovec_size = captures + 1;
+    rule->caseless = cflags & PCRE2_CASELESS;
+    rule->literal = find_literal(match);
+    rule->match = MXS_STRDUP(match);
+    rule->replace = MXS_STRDUP(replace);
+    inst->n_rules++;
+
+    if (rule->ovec_size > inst->ovec_size)
+    {
+        inst->ovec_size = rule->ovec_size;
+    }
+
+    return rule->match && rule->replace;
+}
+
+/**
+ * Read the rules from a file. Each rule is a line starting with @c match=
+ * followed by a line starting with @c replace=. Empty lines and lines
+ * starting with a hash are ignored.
+ *
+ * @param inst   The filter instance
+ * @param path   Path to the rules file
+ * @param cflags PCRE2 compilation options
+ * @return True if all the rules in the file were added
+ */
+static bool load_rules(REGEX_INSTANCE *inst, const char *path, int cflags)
+{
+    FILE *file = fopen(path, "r");
+
+    if (file == NULL)
+    {
+        MXS_ERROR("Failed to open rules file '%s'.", path);
+        return false;
+    }
+
+    bool rval = true;
+    char *line = NULL;
+    size_t size = 0;
+    char *match = NULL;
+    int lineno = 0;
+
+    while (rval && getline(&line, &size, file) != -1)
+    {
+        lineno++;
+        line[strcspn(line, "\r\n")] = '\0';
+        char *ptr = line;
+
+        while (isspace((unsigned char)*ptr))
+        {
+            ptr++;
+        }
+
+        if (*ptr == '\0' || *ptr == '#')
+        {
+            continue;
+        }
+
+        if (strncmp(ptr, "match=", 6) == 0 && match == NULL)
+        {
+            if ((match = MXS_STRDUP(ptr + 6)) == NULL)
+            {
+                rval = false;
+            }
+        }
+        else if (strncmp(ptr, "replace=", 8) == 0 && match)
+        {
+            rval = add_rule(inst, match, ptr + 8, cflags);
+            MXS_FREE(match);
+            match = NULL;
+        }
+        else
+        {
+            MXS_ERROR("Syntax error in rules file '%s' on line %d, expected a %s line: %s",
+                      path, lineno, match ? "replace=" : "match=", ptr);
+            rval = false;
+        }
+    }
+
+    if (rval && match)
+    {
+        MXS_ERROR("The last rule in rules file '%s' has no replace line.", path);
+        rval = false;
+    }
+
+    MXS_FREE(match);
+    free(line);
+    fclose(file);
+    return rval;
+}
+
 /**
  * Create an instance of the filter for a particular service
  * within MaxScale.
@@ -186,8 +618,6 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
 
     if (my_instance)
     {
-        my_instance->match = MXS_STRDUP_A(config_get_string(params, "match"));
-        my_instance->replace = MXS_STRDUP_A(config_get_string(params, "replace"));
         my_instance->source = config_copy_string(params, "source");
         my_instance->user = config_copy_string(params, "user");
         my_instance->log_trace = config_get_bool(params, "log_trace");
@@ -207,30 +637,44 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
             fflush(my_instance->logfile);
         }
 
-        int errnumber;
-        PCRE2_SIZE erroffset;
         int cflags = config_get_enum(params, "options", option_values);
+        const char *match = config_get_param(params, "match") ?
+                            config_get_string(params, "match") : NULL;
+        const char *replace = config_get_param(params, "replace") ?
+                              config_get_string(params, "replace") : NULL;
+        const char *rules = config_get_param(params, "rules") ?
+                            config_get_string(params, "rules") : NULL;
+        bool ok = true;
+
+        if ((match == NULL) != (replace == NULL))
+        {
+            MXS_ERROR("Both 'match' and 'replace' must be defined for filter '%s'.", name);
+            ok = false;
+        }
+        else if (match == NULL && rules == NULL)
+        {
+            MXS_ERROR("Filter '%s' requires either 'match' and 'replace' or 'rules'.", name);
+            ok = false;
+        }
 
-        if ((my_instance->re = pcre2_compile((PCRE2_SPTR) my_instance->match,
-                                             PCRE2_ZERO_TERMINATED,
-                                             cflags,
-                                             &errnumber,
-                                             &erroffset,
-                                             NULL)) == NULL)
+        if (ok && match)
         {
-            char errbuffer[1024];
-            pcre2_get_error_message(errnumber, (PCRE2_UCHAR*) & errbuffer, sizeof(errbuffer));
-            MXS_ERROR("Compiling regular expression '%s' failed at %lu: %s",
-                      my_instance->match, erroffset, errbuffer);
-            free_instance(my_instance);
-            return NULL;
+            ok = add_rule(my_instance, match, replace, cflags);
+        }
+
+        if (ok && rules)
+        {
+            ok = load_rules(my_instance, rules, cflags);
+        }
+
+        if (ok && my_instance->n_rules == 0)
+        {
+            MXS_ERROR("Rules file '%s' of filter '%s' does not define any rules.", rules, name);
+            ok = false;
         }
 
-        if ((my_instance->match_data =
-                 pcre2_match_data_create_from_pattern(my_instance->re, NULL)) == NULL)
+        if (!ok)
         {
-            MXS_ERROR("Failure to create PCRE2 matching data. "
-                      "This is most likely caused by a lack of available memory.");
             free_instance(my_instance);
             return NULL;
         }
@@ -331,37 +775,51 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
 {
     REGEX_INSTANCE *my_instance = (REGEX_INSTANCE *) instance;
     REGEX_SESSION *my_session = (REGEX_SESSION *) session;
-    char *sql, *newsql;
+    REGEX_THREAD *thr;
+    char *sql;
 
-    if (my_session->active && modutil_is_SQL(queue))
+    if (my_session->active && modutil_is_SQL(queue) &&
+        (thr = get_thread_data(my_instance)) &&
+        (sql = modutil_get_SQL(queue)) != NULL)
     {
-        if ((sql = modutil_get_SQL(queue)) != NULL)
+        const char *current = sql;
+        int out = 0;
+
+        for (int i = 0; i < my_instance->n_rules; i++)
         {
-            newsql = regex_replace(sql,
-                                   my_instance->re,
-                                   my_instance->match_data,
-                                   my_instance->replace);
+            REGEX_RULE *rule = &my_instance->rules[i];
+            const char *newsql = regex_replace(thr, rule, current, out);
+
+            spinlock_acquire(&my_session->lock);
+
             if (newsql)
             {
-                queue = modutil_replace_SQL(queue, newsql);
-                queue = gwbuf_make_contiguous(queue);
-                spinlock_acquire(&my_session->lock);
-                log_match(my_instance, my_instance->match, sql, newsql);
-                spinlock_release(&my_session->lock);
-                MXS_FREE(newsql);
-                my_session->replacements++;
+                log_match(my_instance, rule->match, current, newsql);
+                current = newsql;
+                out = !out;
             }
             else
             {
-                spinlock_acquire(&my_session->lock);
-                log_nomatch(my_instance, my_instance->match, sql);
-                spinlock_release(&my_session->lock);
-                my_session->no_change++;
+                log_nomatch(my_instance, rule->match, current);
             }
-            MXS_FREE(sql);
+
+            spinlock_release(&my_session->lock);
         }
 
+        if (current != sql)
+        {
+            queue = modutil_replace_SQL(queue, (char*)current);
+            queue = gwbuf_make_contiguous(queue);
+            my_session->replacements++;
+        }
+        else
+        {
+            my_session->no_change++;
+        }
+
+        MXS_FREE(sql);
     }
+
     return my_session->down.routeQuery(my_session->down.instance,
                                        my_session->down.session, queue);
 }
@@ -383,8 +841,19 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
     REGEX_INSTANCE *my_instance = (REGEX_INSTANCE *) instance;
     REGEX_SESSION *my_session = (REGEX_SESSION *) fsession;
 
-    dcb_printf(dcb, "\t\tSearch and replace:            s/%s/%s/\n",
-               my_instance->match, my_instance->replace);
+    for (int i = 0; i < my_instance->n_rules; i++)
+    {
+        REGEX_RULE *rule = &my_instance->rules[i];
+
+        dcb_printf(dcb, "\t\tSearch and replace:            s/%s/%s/\n",
+                   rule->match, rule->replace);
+
+        if (rule->literal)
+        {
+            dcb_printf(dcb, "\t\tRequired literal:              %s\n", rule->literal);
+        }
+    }
+
     if (my_session)
     {
         dcb_printf(dcb, "\t\tNo. of queries unaltered by filter:    %d\n",
@@ -409,43 +878,66 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
 /**
  * Perform a regular expression match and substitution on the SQL
  *
- * @param   sql The original SQL text
- * @param   re  The compiled regular expression
- * @param   match_data The PCRE2 matching data buffer
- * @param   replace The replacement text
+ * Queries that do not contain the literal text of the rule are rejected
+ * without running the regular expression. The result is written into one of
+ * the output buffers of the thread, which are grown as needed and kept for
+ * the following queries.
+ *
+ * @param   thr  The matching state of the thread
+ * @param   rule The rule to apply
+ * @param   sql  The original SQL text
+ * @param   out  The output buffer to use, 0 or 1
  * @return  The replaced text or NULL if no replacement was done.
  */
-static char *
-regex_replace(const char *sql, pcre2_code *re, pcre2_match_data *match_data, const char *replace)
+static const char *
+regex_replace(REGEX_THREAD *thr, const REGEX_RULE *rule, const char *sql, int out)
 {
-    char *result = NULL;
-    size_t result_size;
+    if (rule->literal &&
+        (rule->caseless ? strcasestr(sql, rule->literal) : strstr(sql, rule->literal)) == NULL)
+    {
+        return NULL;
+    }
 
-    /** This should never fail with rc == 0 because we used pcre2_match_data_create_from_pattern() */
-    if (pcre2_match(re, (PCRE2_SPTR) sql, PCRE2_ZERO_TERMINATED, 0, 0, match_data, NULL) > 0)
+    size_t needed = strlen(sql) + strlen(rule->replace) + 1;
+
+    while (true)
     {
-        result_size = strlen(sql) + strlen(replace);
-        result = MXS_MALLOC(result_size);
-
-        size_t result_size_tmp = result_size;
-        while (result &&
-               pcre2_substitute(re, (PCRE2_SPTR) sql, PCRE2_ZERO_TERMINATED, 0,
-                                PCRE2_SUBSTITUTE_GLOBAL, match_data, NULL,
-                                (PCRE2_SPTR) replace, PCRE2_ZERO_TERMINATED,
-                                (PCRE2_UCHAR*) result, (PCRE2_SIZE*) & result_size_tmp) == PCRE2_ERROR_NOMEMORY)
+        if (thr->size[out] < needed)
         {
-            result_size_tmp = 1.5 * result_size;
-            char *tmp;
-            if ((tmp = MXS_REALLOC(result, result_size_tmp)) == NULL)
+            size_t size = thr->size[out] ? thr->size[out] : 1024;
+
+            while (size < needed)
             {
-                MXS_FREE(result);
-                result = NULL;
+                size *= 2;
+            }
+
+            char *buffer = MXS_REALLOC(thr->buffer[out], size);
+
+            if (buffer == NULL)
+            {
+                return NULL;
             }
-            result = tmp;
-            result_size = result_size_tmp;
+
+            thr->buffer[out] = buffer;
+            thr->size[out] = size;
+        }
+
+        PCRE2_SIZE size = thr->size[out];
+        int rc = pcre2_substitute(rule->re, (PCRE2_SPTR) sql, PCRE2_ZERO_TERMINATED, 0,
+                                  PCRE2_SUBSTITUTE_GLOBAL, thr->match_data, thr->mcontext,
+                                  (PCRE2_SPTR) rule->replace, PCRE2_ZERO_TERMINATED,
+                                  (PCRE2_UCHAR*) thr->buffer[out], &size);
+
+        if (rc == PCRE2_ERROR_NOMEMORY)
+        {
+            needed = thr->size[out] * 2;
+        }
+        else
+        {
+            /** The number of substitutions, zero if nothing matched */
+            return rc > 0 ? thr->buffer[out] : NULL;
         }
     }
-    return result;
 }
 
 /**
@@ -456,7 +948,7 @@ regex_replace(const char *sql, pcre2_code *re, pcre2_match_data *match_data, con
  * @param old Old SQL statement
  * @param new New SQL statement
  */
-void log_match(REGEX_INSTANCE* inst, char* re, char* old, char* new)
+void log_match(REGEX_INSTANCE* inst, char* re, const char* old, const char* new)
 {
     if (inst->logfile)
     {
@@ -475,7 +967,7 @@ void log_match(REGEX_INSTANCE* inst, char* re, char* old, char* new)
  * @param re Regular expression
  * @param old SQL statement
  */
-void log_nomatch(REGEX_INSTANCE* inst, char* re, char* old)
+void log_nomatch(REGEX_INSTANCE* inst, char* re, const char* old)
 {
     if (inst->logfile)
     {
@@ -495,5 +987,5 @@ void log_nomatch(REGEX_INSTANCE* inst, char* re, char* old)
  */
 static uint64_t getCapabilities(MXS_FILTER* instance)
 {
-    return RCAP_TYPE_CONTIGUOUS_INPUT;
+    return RCAP_TYPE_CONTIGUOUS_INPUT | FCAP_TYPE_COM_QUERY;
 }
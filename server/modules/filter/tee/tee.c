@@ -29,6 +29,8 @@
  *          of the request (optional)
  * user     A user name to match against. If present only requests that
  *          originate from this user will be duplciated (optional)
+ * async    Queue the duplicates instead of routing them immediately (optional)
+ * async_queue_size  Maximum number of queued duplicates per session (optional)
  *
  * Revision History
  * ================
@@ -122,6 +124,9 @@ typedef struct
     regex_t re; /* Compiled regex text */
     char *nomatch; /* Optional text to match against for exclusion */
     regex_t nore; /* Compiled regex nomatch text */
+    bool async; /* Queue the duplicates and send them one at a time */
+    int max_queued; /* Maximum number of queued duplicates per session */
+    int n_dropped; /* Number of duplicates dropped in all sessions */
 } TEE_INSTANCE;
 
 /**
@@ -150,12 +155,22 @@ typedef struct
     TEE_INSTANCE *instance;
     int n_duped; /* Number of duplicated queries */
     int n_rejected; /* Number of rejected queries */
+    int n_dropped; /* Number of duplicates dropped as the queue was full */
     int residual; /* Any outstanding SQL text */
     GWBUF* tee_replybuf; /* Buffer for reply */
     GWBUF* tee_partials[2];
     GWBUF* queue;
     SPINLOCK tee_lock;
     DCB* client_dcb;
+    GWBUF** branch_queue; /* Duplicates waiting for the branch, a circular buffer */
+    int branch_queue_size; /* Size of branch_queue */
+    int branch_queue_head; /* Index of the oldest queued duplicate */
+    int branch_queue_len; /* Number of queued duplicates */
+    MXS_REPLY_QUEUE branch_replies; /* Replies the branch has not completed yet */
+    MXS_UPSTREAM branch_tail; /* The original tail of the branch session */
+    bool branch_draining; /* Set while the queue is being drained */
+    bool branch_large; /* The last duplicate sent was a 16MB packet */
+    bool drop_large; /* The last duplicate dropped was a 16MB packet */
 
 #ifdef SS_DEBUG
     long d_id;
@@ -187,6 +202,10 @@ int route_single_query(TEE_INSTANCE* my_instance,
                        GWBUF* clone);
 int reset_session_state(TEE_SESSION* my_session, GWBUF* buffer);
 void create_orphan(MXS_SESSION* ses);
+static int32_t branch_reply(void* instance, void* session, GWBUF* reply);
+static void branch_enqueue(TEE_INSTANCE* my_instance, TEE_SESSION* my_session, GWBUF* clone);
+static void branch_drain(TEE_SESSION* my_session);
+static void branch_queue_free(TEE_SESSION* my_session);
 
 static void
 orphan_free(void* data)
@@ -325,7 +344,7 @@ MXS_MODULE* MXS_CREATE_MODULE()
         MXS_MODULE_GA,
         MXS_FILTER_VERSION,
         "A tee piece in the filter plumbing",
-        "V1.0.0",
+        "V1.1.0",
         &MyObject,
         NULL, /* Process init. */
         NULL, /* Process finish. */
@@ -337,6 +356,8 @@ MXS_MODULE* MXS_CREATE_MODULE()
             {"exclude", MXS_MODULE_PARAM_STRING},
             {"source", MXS_MODULE_PARAM_STRING},
             {"user", MXS_MODULE_PARAM_STRING},
+            {"async", MXS_MODULE_PARAM_BOOL, "false"},
+            {"async_queue_size", MXS_MODULE_PARAM_COUNT, "100"},
             {
                 "options",
                 MXS_MODULE_PARAM_ENUM,
@@ -373,6 +394,8 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
         my_instance->userName = config_copy_string(params, "user");
         my_instance->match = config_copy_string(params, "match");
         my_instance->nomatch = config_copy_string(params, "exclude");
+        my_instance->async = config_get_bool(params, "async");
+        my_instance->max_queued = config_get_integer(params, "async_queue_size");
 
         int cflags = config_get_enum(params, "options", option_values);
 
@@ -505,6 +528,16 @@ newSession(MXS_FILTER *instance, MXS_SESSION *session)
 
             my_session->branch_session = ses;
             my_session->branch_dcb = dcb;
+
+            if (my_instance->async)
+            {
+                // Follow the replies of the branch to know when it is ready
+                // for the next duplicate. The original tail still gets them.
+                my_session->branch_tail = ses->tail;
+                ses->tail.instance = my_instance;
+                ses->tail.session = my_session;
+                ses->tail.clientReply = branch_reply;
+            }
         }
     }
 retblock:
@@ -545,6 +578,13 @@ closeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session)
             router_instance = bsession->service->router_instance;
             rsession = bsession->router_session;
 
+            if (my_session->instance->async)
+            {
+                /** The branch session can outlive this session */
+                bsession->tail = my_session->branch_tail;
+                branch_queue_free(my_session);
+            }
+
             /** Close router session and all its connections */
             router->closeSession(router_instance, rsession);
         }
@@ -614,6 +654,8 @@ freeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session)
     {
         gwbuf_free(my_session->tee_replybuf);
     }
+    branch_queue_free(my_session);
+    MXS_FREE(my_session->branch_queue);
     MXS_FREE(session);
 
     orphan_free(NULL);
@@ -739,12 +781,26 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
         dcb_printf(dcb, "\t\tExclude queries that match		%s\n",
                    my_instance->nomatch);
     }
+    if (my_instance->async)
+    {
+        dcb_printf(dcb, "\t\tMaximum queued statements		%d\n",
+                   my_instance->max_queued);
+        dcb_printf(dcb, "\t\tNo. of statements dropped		%d\n",
+                   atomic_add(&my_instance->n_dropped, 0));
+    }
     if (my_session)
     {
         dcb_printf(dcb, "\t\tNo. of statements duplicated:	%d.\n",
                    my_session->n_duped);
         dcb_printf(dcb, "\t\tNo. of statements rejected:	%d.\n",
                    my_session->n_rejected);
+        if (my_instance->async)
+        {
+            dcb_printf(dcb, "\t\tNo. of statements queued:	%d.\n",
+                       my_session->branch_queue_len);
+            dcb_printf(dcb, "\t\tNo. of statements dropped:	%d.\n",
+                       my_session->n_dropped);
+        }
     }
 }
 
@@ -846,12 +902,14 @@ GWBUF* clone_query(TEE_INSTANCE* my_instance, TEE_SESSION* my_session, GWBUF* bu
     }
     else
     {
-        char *ptr = NULL;
+        const char *ptr;
+        size_t len;
         regmatch_t limits[] = {{0, 0}};
-        modutil_extract_SQL(buffer, &ptr, &limits[0].rm_eo);
 
-        if (ptr)
+        if (modutil_get_query_view(buffer, &ptr, &len))
         {
+            limits[0].rm_eo = len;
+
             if ((my_instance->match && regexec(&my_instance->re, ptr, 0, limits, REG_STARTEND) == 0) ||
                 (my_instance->nomatch && regexec(&my_instance->nore, ptr, 0, limits, REG_STARTEND) != 0))
             {
@@ -884,7 +942,12 @@ int route_single_query(TEE_INSTANCE* my_instance, TEE_SESSION* my_session, GWBUF
         rval = my_session->down.routeQuery(my_session->down.instance,
                                            my_session->down.session,
                                            buffer);
-        if (clone)
+        if (clone && my_instance->async)
+        {
+            my_session->n_duped++;
+            branch_enqueue(my_instance, my_session, clone);
+        }
+        else if (clone)
         {
             my_session->n_duped++;
 
@@ -960,3 +1023,181 @@ void create_orphan(MXS_SESSION* ses)
         spinlock_release(&orphanLock);
     }
 }
+
+/**
+ * Check whether a packet has the maximum payload length, which means that
+ * the next packet continues it.
+ *
+ * @param buffer A contiguous packet
+ * @return True if the packet is continued by the next one
+ */
+static bool is_large_packet(GWBUF* buffer)
+{
+    return GWBUF_LENGTH(buffer) >= MYSQL_HEADER_LEN &&
+           MYSQL_GET_PAYLOAD_LEN(GWBUF_DATA(buffer)) == GW_MYSQL_MAX_PACKET_LEN;
+}
+
+/**
+ * Route a duplicate to the branch session and start following its reply.
+ *
+ * @param my_session Tee session
+ * @param clone      The duplicate
+ */
+static void branch_route(TEE_SESSION* my_session, GWBUF* clone)
+{
+    if (!my_session->branch_large && GWBUF_LENGTH(clone) > MYSQL_HEADER_LEN)
+    {
+        modutil_reply_queue_push(&my_session->branch_replies,
+                                 GWBUF_DATA(clone)[MYSQL_HEADER_LEN]);
+    }
+
+    my_session->branch_large = is_large_packet(clone);
+    MXS_SESSION_ROUTE_QUERY(my_session->branch_session, clone);
+}
+
+/**
+ * Check whether the branch can be sent the next duplicate. Only one
+ * statement at a time is sent so that a slow branch service only ever
+ * holds one statement of the session.
+ *
+ * @param my_session Tee session
+ * @return True if the next duplicate can be routed to the branch
+ */
+static bool branch_is_ready(TEE_SESSION* my_session)
+{
+    return my_session->active && my_session->branch_session &&
+           my_session->branch_session->state == SESSION_STATE_ROUTER_READY &&
+           (my_session->branch_large || my_session->branch_replies.count == 0);
+}
+
+/**
+ * Route a duplicate to the branch or queue it if the branch is still busy
+ * with an earlier duplicate. If the queue is full, the duplicate is dropped.
+ * Duplicates that are required for the consistency of the branch session,
+ * like COM_INIT_DB, are queued even when the queue is full.
+ *
+ * @param my_instance Tee instance
+ * @param my_session  Tee session
+ * @param clone       The duplicate
+ */
+static void branch_enqueue(TEE_INSTANCE* my_instance, TEE_SESSION* my_session, GWBUF* clone)
+{
+    bool continues = my_session->drop_large;
+    my_session->drop_large = false;
+
+    if (my_session->branch_queue_len == 0 && branch_is_ready(my_session))
+    {
+        branch_route(my_session, clone);
+        return;
+    }
+
+    if (my_session->branch_queue_len >= my_instance->max_queued &&
+        (continues || !packet_is_required(clone)))
+    {
+        // The rest of a dropped large packet is dropped as well
+        my_session->drop_large = is_large_packet(clone);
+        my_session->n_dropped++;
+        atomic_add(&my_instance->n_dropped, 1);
+        gwbuf_free(clone);
+        return;
+    }
+
+    if (my_session->branch_queue_len == my_session->branch_queue_size)
+    {
+        int size = my_session->branch_queue_size ? my_session->branch_queue_size * 2 : 16;
+        GWBUF** queue = MXS_MALLOC(size * sizeof(GWBUF*));
+
+        if (queue == NULL)
+        {
+            my_session->n_dropped++;
+            atomic_add(&my_instance->n_dropped, 1);
+            gwbuf_free(clone);
+            return;
+        }
+
+        for (int i = 0; i < my_session->branch_queue_len; i++)
+        {
+            queue[i] = my_session->branch_queue[(my_session->branch_queue_head + i) %
+                                                my_session->branch_queue_size];
+        }
+
+        MXS_FREE(my_session->branch_queue);
+        my_session->branch_queue = queue;
+        my_session->branch_queue_size = size;
+        my_session->branch_queue_head = 0;
+    }
+
+    int tail = (my_session->branch_queue_head + my_session->branch_queue_len) %
+               my_session->branch_queue_size;
+    my_session->branch_queue[tail] = clone;
+    my_session->branch_queue_len++;
+}
+
+/**
+ * Route queued duplicates to the branch for as long as it is ready for them.
+ *
+ * @param my_session Tee session
+ */
+static void branch_drain(TEE_SESSION* my_session)
+{
+    if (my_session->branch_draining)
+    {
+        // Routing a duplicate generated a reply right away
+        return;
+    }
+
+    my_session->branch_draining = true;
+
+    while (my_session->branch_queue_len > 0 && branch_is_ready(my_session))
+    {
+        GWBUF* clone = my_session->branch_queue[my_session->branch_queue_head];
+        my_session->branch_queue_head = (my_session->branch_queue_head + 1) %
+                                        my_session->branch_queue_size;
+        my_session->branch_queue_len--;
+        branch_route(my_session, clone);
+    }
+
+    my_session->branch_draining = false;
+}
+
+/**
+ * Discard the queued duplicates.
+ *
+ * @param my_session Tee session
+ */
+static void branch_queue_free(TEE_SESSION* my_session)
+{
+    while (my_session->branch_queue_len > 0)
+    {
+        gwbuf_free(my_session->branch_queue[my_session->branch_queue_head]);
+        my_session->branch_queue_head = (my_session->branch_queue_head + 1) %
+                                        my_session->branch_queue_size;
+        my_session->branch_queue_len--;
+    }
+
+    modutil_reply_queue_free(&my_session->branch_replies);
+}
+
+/**
+ * The tail of the branch session in asynchronous mode. The replies of the
+ * branch are followed and passed on to the original tail, and the next
+ * queued duplicate is routed when the reply to the previous one is complete.
+ *
+ * @param instance Tee instance
+ * @param session  Tee session
+ * @param reply    Reply from the branch
+ * @return The return value of the original tail
+ */
+static int32_t branch_reply(void* instance, void* session, GWBUF* reply)
+{
+    TEE_SESSION* my_session = (TEE_SESSION*) session;
+
+    modutil_reply_queue_process(&my_session->branch_replies, reply);
+
+    int32_t rval = my_session->branch_tail.clientReply(my_session->branch_tail.instance,
+                                                       my_session->branch_tail.session,
+                                                       reply);
+    branch_drain(my_session);
+
+    return rval;
+}
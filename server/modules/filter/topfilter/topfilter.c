@@ -34,11 +34,13 @@
 
 #define MXS_MODULE_NAME "topfilter"
 
+#include <inttypes.h>
 #include <stdio.h>
 #include <fcntl.h>
 #include <maxscale/filter.h>
 #include <maxscale/modinfo.h>
 #include <maxscale/modutil.h>
+#include <maxscale/query_classifier.h>
 #include <maxscale/log_manager.h>
 #include <string.h>
 #include <time.h>
@@ -46,6 +48,9 @@
 #include <regex.h>
 #include <maxscale/atomic.h>
 #include <maxscale/alloc.h>
+#include <maxscale/modulecmd.h>
+#include <maxscale/platform.h>
+#include <maxscale/spinlock.h>
 
 /*
  * The filter entry points
@@ -61,6 +66,46 @@ static int clientReply(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, GWBUF
 static void diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb);
 static uint64_t getCapabilities(MXS_FILTER* instance);
 
+/** Number of statements a sketch tracks for each statement in the report */
+#define TOPN_SKETCH_FACTOR 16
+
+/** Length of the statement sample kept with each tracked statement */
+#define TOPN_SQL_SAMPLE 128
+
+/**
+ * A statement tracked by a sketch. The weight is the total execution time
+ * of the statement. It is an overestimate of at most @c error, which is the
+ * weight the statement inherited when it replaced another statement.
+ */
+typedef struct
+{
+    uint64_t digest;    /* Digest of the canonical query */
+    uint64_t weight;    /* Total execution time in microseconds */
+    uint64_t error;     /* Maximum overestimation of the weight */
+    uint64_t count;     /* Number of executions */
+    uint64_t max;       /* Longest execution time in microseconds */
+    int heap_pos;       /* Position in the heap of the sketch */
+    char sql[TOPN_SQL_SAMPLE]; /* The beginning of the statement */
+} TOPN_COUNTER;
+
+/**
+ * A space-saving sketch of the statements executed by one routing thread.
+ * The sketch tracks a fixed number of statements; a statement that is not
+ * tracked replaces the one with the smallest weight. Only the owning thread
+ * modifies the sketch, the lock is taken by it and by the merge of the
+ * sketches and is therefore practically never contended.
+ */
+typedef struct
+{
+    SPINLOCK lock;
+    int size;               /* Number of counters in use */
+    int capacity;           /* Number of counters */
+    TOPN_COUNTER *counters; /* The counters, they never move */
+    int *heap;              /* Counters in a min-heap ordered by weight */
+    int *index;             /* Counters in a hash table by digest, -1 if empty */
+    uint64_t index_mask;    /* Size of the hash table minus one */
+} TOPN_SKETCH;
+
 /**
  * A instance structure, the assumption is that the option passed
  * to the filter is simply a base for the filename to which the queries
@@ -80,6 +125,9 @@ typedef struct
     regex_t re; /* Compiled regex text */
     char *exclude; /* Optional text to match against for exclusion */
     regex_t exre; /* Compiled regex nomatch text */
+    bool global; /* Collect a report over all sessions */
+    TOPN_SKETCH *sketches; /* One per routing thread */
+    int n_sketches; /* Number of sketches */
 } TOPN_INSTANCE;
 
 /**
@@ -89,6 +137,7 @@ typedef struct topnq
 {
     struct timeval duration;
     char *sql;
+    uint64_t digest;    /* Digest of the canonical query */
 } TOPNQ;
 
 /**
@@ -110,6 +159,7 @@ typedef struct
     int fd;
     struct timeval start;
     char *current;
+    uint64_t current_digest;
     TOPNQ **top;
     int n_statements;
     struct timeval total;
@@ -117,6 +167,18 @@ typedef struct
     struct timeval disconnect;
 } TOPN_SESSION;
 
+static void sketch_init(TOPN_SKETCH *sketch, int capacity);
+static void sketch_add(TOPN_SKETCH *sketch, uint64_t digest, uint64_t weight, const char *sql);
+static int global_top(TOPN_INSTANCE *instance, TOPN_COUNTER *top, int n);
+static void print_global_top(TOPN_INSTANCE *instance, DCB *dcb);
+static bool topn_show_top(const MODULECMD_ARG *argv);
+
+/** Counter used for assigning the routing threads their sketches */
+static int next_thread_slot = 0;
+
+/** Index of the sketch of the current thread */
+static thread_local int thread_slot = -1;
+
 static const MXS_ENUM_VALUE option_values[] =
 {
     {"ignorecase", REG_ICASE},
@@ -135,6 +197,14 @@ static const MXS_ENUM_VALUE option_values[] =
  */
 MXS_MODULE* MXS_CREATE_MODULE()
 {
+    modulecmd_arg_type_t args_top[] =
+    {
+        {MODULECMD_ARG_OUTPUT, "DCB where result is written"},
+        {MODULECMD_ARG_FILTER | MODULECMD_ARG_NAME_MATCHES_DOMAIN, "Filter to inspect"}
+    };
+
+    modulecmd_register_command(MXS_MODULE_NAME, "top", topn_show_top, 2, args_top);
+
     static MXS_FILTER_OBJECT MyObject =
     {
         createInstance,
@@ -156,7 +226,7 @@ MXS_MODULE* MXS_CREATE_MODULE()
         MXS_MODULE_GA,
         MXS_FILTER_VERSION,
         "A top N query logging filter",
-        "V1.0.1",
+        "V1.1.0",
         &MyObject,
         NULL, /* Process init. */
         NULL, /* Process finish. */
@@ -169,6 +239,7 @@ MXS_MODULE* MXS_CREATE_MODULE()
             {"exclude", MXS_MODULE_PARAM_STRING},
             {"source", MXS_MODULE_PARAM_STRING},
             {"user", MXS_MODULE_PARAM_STRING},
+            {"global", MXS_MODULE_PARAM_BOOL, "false"},
             {
                 "options",
                 MXS_MODULE_PARAM_ENUM,
@@ -206,6 +277,9 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
         my_instance->source = config_copy_string(params, "source");
         my_instance->user = config_copy_string(params, "user");
         my_instance->filebase = MXS_STRDUP_A(config_get_string(params, "filebase"));
+        my_instance->global = config_get_bool(params, "global");
+        my_instance->sketches = NULL;
+        my_instance->n_sketches = 0;
 
         int cflags = config_get_enum(params, "options", option_values);
         bool error = false;
@@ -233,6 +307,18 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
             error = true;
         }
 
+        if (!error && my_instance->global)
+        {
+            my_instance->n_sketches = config_threadcount();
+            my_instance->sketches = MXS_CALLOC(my_instance->n_sketches, sizeof(TOPN_SKETCH));
+            MXS_ABORT_IF_NULL(my_instance->sketches);
+
+            for (int i = 0; i < my_instance->n_sketches; i++)
+            {
+                sketch_init(&my_instance->sketches[i], my_instance->topN * TOPN_SKETCH_FACTOR);
+            }
+        }
+
         if (error)
         {
             if (my_instance->exclude)
@@ -360,19 +446,20 @@ closeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session)
         fprintf(fp, "Top %d longest running queries in session.\n",
                 my_instance->topN);
         fprintf(fp, "==========================================\n\n");
-        fprintf(fp, "Time (sec) | Query\n");
-        fprintf(fp, "-----------+-----------------------------------------------------------------\n");
+        fprintf(fp, "Time (sec) | Digest           | Query\n");
+        fprintf(fp, "-----------+------------------+----------------------------------------------\n");
         for (i = 0; i < my_instance->topN; i++)
         {
             if (my_session->top[i]->sql)
             {
-                fprintf(fp, "%10.3f |  %s\n",
+                fprintf(fp, "%10.3f | %016" PRIx64 " |  %s\n",
                         (double) ((my_session->top[i]->duration.tv_sec * 1000)
                                   + (my_session->top[i]->duration.tv_usec / 1000)) / 1000,
+                        my_session->top[i]->digest,
                         my_session->top[i]->sql);
             }
         }
-        fprintf(fp, "-----------+-----------------------------------------------------------------\n");
+        fprintf(fp, "-----------+------------------+----------------------------------------------\n");
         struct tm tm;
         localtime_r(&my_session->connect.tv_sec, &tm);
         char buffer[32]; // asctime_r documentation requires 26
@@ -484,6 +571,8 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
                 }
                 gettimeofday(&my_session->start, NULL);
                 my_session->current = ptr;
+                my_session->current_digest = 0;
+                qc_get_canonical_digest(queue, &my_session->current_digest);
             }
             else
             {
@@ -524,12 +613,26 @@ clientReply(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *reply)
 
         timeradd(&(my_session->total), &diff, &(my_session->total));
 
+        if (my_instance->global && my_session->current_digest)
+        {
+            if (thread_slot == -1)
+            {
+                thread_slot = atomic_add(&next_thread_slot, 1);
+            }
+
+            // Threads without a sketch of their own share the sketches
+            TOPN_SKETCH *sketch = &my_instance->sketches[thread_slot % my_instance->n_sketches];
+            sketch_add(sketch, my_session->current_digest,
+                       diff.tv_sec * 1000000 + diff.tv_usec, my_session->current);
+        }
+
         inserted = 0;
         for (i = 0; i < my_instance->topN; i++)
         {
             if (my_session->top[i]->sql == NULL)
             {
                 my_session->top[i]->sql = my_session->current;
+                my_session->top[i]->digest = my_session->current_digest;
                 my_session->top[i]->duration = diff;
                 inserted = 1;
                 break;
@@ -542,6 +645,7 @@ clientReply(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *reply)
         {
             MXS_FREE(my_session->top[my_instance->topN - 1]->sql);
             my_session->top[my_instance->topN - 1]->sql = my_session->current;
+            my_session->top[my_instance->topN - 1]->digest = my_session->current_digest;
             my_session->top[my_instance->topN - 1]->duration = diff;
             inserted = 1;
         }
@@ -603,6 +707,11 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
         dcb_printf(dcb, "\t\tExclude queries that match     %s\n",
                    my_instance->exclude);
     }
+    if (my_session == NULL && my_instance->global)
+    {
+        dcb_printf(dcb, "\t\tTop %d in all sessions:\n\n", my_instance->topN);
+        print_global_top(my_instance, dcb);
+    }
     if (my_session)
     {
         dcb_printf(dcb, "\t\tLogging to file %s.\n",
@@ -616,6 +725,8 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
                 dcb_printf(dcb, "\t\t\tExecution time: %.3f seconds\n",
                            (double) ((my_session->top[i]->duration.tv_sec * 1000)
                                      + (my_session->top[i]->duration.tv_usec / 1000)) / 1000);
+                dcb_printf(dcb, "\t\t\tDigest: %016" PRIx64 "\n",
+                           my_session->top[i]->digest);
                 dcb_printf(dcb, "\t\t\tSQL: %s\n",
                            my_session->top[i]->sql);
             }
@@ -632,3 +743,379 @@ static uint64_t getCapabilities(MXS_FILTER* instance)
 {
     return RCAP_TYPE_CONTIGUOUS_INPUT;
 }
+
+/**
+ * Initialize a sketch.
+ *
+ * @param sketch    The sketch
+ * @param capacity  Number of statements to track
+ */
+static void sketch_init(TOPN_SKETCH *sketch, int capacity)
+{
+    uint64_t index_size = 1;
+
+    while (index_size < (uint64_t)capacity * 2)
+    {
+        index_size *= 2;
+    }
+
+    spinlock_init(&sketch->lock);
+    sketch->size = 0;
+    sketch->capacity = capacity;
+    sketch->counters = MXS_CALLOC(capacity, sizeof(TOPN_COUNTER));
+    sketch->heap = MXS_CALLOC(capacity, sizeof(int));
+    sketch->index = MXS_MALLOC(index_size * sizeof(int));
+    MXS_ABORT_IF_FALSE(sketch->counters && sketch->heap && sketch->index);
+    sketch->index_mask = index_size - 1;
+
+    for (uint64_t i = 0; i < index_size; i++)
+    {
+        sketch->index[i] = -1;
+    }
+}
+
+static inline uint64_t sketch_hash(const TOPN_SKETCH *sketch, uint64_t digest)
+{
+    return (digest ^ (digest >> 32)) & sketch->index_mask;
+}
+
+/**
+ * Find the slot of a statement in the hash table of a sketch.
+ *
+ * @param sketch  The sketch
+ * @param digest  Digest of the statement
+ *
+ * @return The slot of the statement, or the empty slot where it would be added
+ */
+static uint64_t sketch_find(const TOPN_SKETCH *sketch, uint64_t digest)
+{
+    uint64_t i = sketch_hash(sketch, digest);
+
+    while (sketch->index[i] != -1 && sketch->counters[sketch->index[i]].digest != digest)
+    {
+        i = (i + 1) & sketch->index_mask;
+    }
+
+    return i;
+}
+
+/**
+ * Remove a statement from the hash table of a sketch. The entries that
+ * follow it are moved back so that no lookup is cut short.
+ *
+ * @param sketch  The sketch
+ * @param i       The slot of the statement
+ */
+static void sketch_unindex(TOPN_SKETCH *sketch, uint64_t i)
+{
+    uint64_t j = i;
+
+    while (true)
+    {
+        j = (j + 1) & sketch->index_mask;
+
+        if (sketch->index[j] == -1)
+        {
+            break;
+        }
+
+        uint64_t k = sketch_hash(sketch, sketch->counters[sketch->index[j]].digest);
+
+        // Move the entry if its home slot is not cyclically between i and j
+        if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j))
+        {
+            sketch->index[i] = sketch->index[j];
+            i = j;
+        }
+    }
+
+    sketch->index[i] = -1;
+}
+
+static inline void sketch_heap_set(TOPN_SKETCH *sketch, int pos, int counter)
+{
+    sketch->heap[pos] = counter;
+    sketch->counters[counter].heap_pos = pos;
+}
+
+/**
+ * Restore the heap order after the weight of a counter has grown.
+ *
+ * @param sketch  The sketch
+ * @param pos     The position of the counter in the heap
+ */
+static void sketch_sift_down(TOPN_SKETCH *sketch, int pos)
+{
+    int counter = sketch->heap[pos];
+    uint64_t weight = sketch->counters[counter].weight;
+
+    while (true)
+    {
+        int child = 2 * pos + 1;
+
+        if (child >= sketch->size)
+        {
+            break;
+        }
+
+        if (child + 1 < sketch->size &&
+            sketch->counters[sketch->heap[child + 1]].weight <
+            sketch->counters[sketch->heap[child]].weight)
+        {
+            child++;
+        }
+
+        if (sketch->counters[sketch->heap[child]].weight >= weight)
+        {
+            break;
+        }
+
+        sketch_heap_set(sketch, pos, sketch->heap[child]);
+        pos = child;
+    }
+
+    sketch_heap_set(sketch, pos, counter);
+}
+
+/**
+ * Restore the heap order after a counter has been added to the end.
+ *
+ * @param sketch  The sketch
+ * @param pos     The position of the counter in the heap
+ */
+static void sketch_sift_up(TOPN_SKETCH *sketch, int pos)
+{
+    int counter = sketch->heap[pos];
+    uint64_t weight = sketch->counters[counter].weight;
+
+    while (pos > 0)
+    {
+        int parent = (pos - 1) / 2;
+
+        if (sketch->counters[sketch->heap[parent]].weight <= weight)
+        {
+            break;
+        }
+
+        sketch_heap_set(sketch, pos, sketch->heap[parent]);
+        pos = parent;
+    }
+
+    sketch_heap_set(sketch, pos, counter);
+}
+
+/**
+ * Add an execution of a statement to a sketch.
+ *
+ * @param sketch  The sketch
+ * @param digest  Digest of the statement
+ * @param weight  Execution time in microseconds
+ * @param sql     The statement
+ */
+static void sketch_add(TOPN_SKETCH *sketch, uint64_t digest, uint64_t weight, const char *sql)
+{
+    spinlock_acquire(&sketch->lock);
+
+    uint64_t slot = sketch_find(sketch, digest);
+
+    if (sketch->index[slot] != -1)
+    {
+        TOPN_COUNTER *counter = &sketch->counters[sketch->index[slot]];
+        counter->weight += weight;
+        counter->count++;
+
+        if (weight > counter->max)
+        {
+            counter->max = weight;
+        }
+
+        sketch_sift_down(sketch, counter->heap_pos);
+    }
+    else
+    {
+        int id;
+        uint64_t error = 0;
+
+        if (sketch->size < sketch->capacity)
+        {
+            id = sketch->size++;
+            sketch_heap_set(sketch, id, id);
+        }
+        else
+        {
+            // Replace the statement with the smallest weight
+            id = sketch->heap[0];
+            error = sketch->counters[id].weight;
+            sketch_unindex(sketch, sketch_find(sketch, sketch->counters[id].digest));
+            slot = sketch_find(sketch, digest);
+        }
+
+        TOPN_COUNTER *counter = &sketch->counters[id];
+        counter->digest = digest;
+        counter->weight = error + weight;
+        counter->error = error;
+        counter->count = 1;
+        counter->max = weight;
+        strncpy(counter->sql, sql, sizeof(counter->sql) - 1);
+        counter->sql[sizeof(counter->sql) - 1] = '\0';
+        sketch->index[slot] = id;
+
+        if (error)
+        {
+            sketch_sift_down(sketch, counter->heap_pos);
+        }
+        else
+        {
+            sketch_sift_up(sketch, counter->heap_pos);
+        }
+    }
+
+    spinlock_release(&sketch->lock);
+}
+
+static int cmp_counter_digest(const void *va, const void *vb)
+{
+    const TOPN_COUNTER *a = (const TOPN_COUNTER*)va;
+    const TOPN_COUNTER *b = (const TOPN_COUNTER*)vb;
+
+    return a->digest < b->digest ? -1 : (a->digest > b->digest ? 1 : 0);
+}
+
+static int cmp_counter_weight(const void *va, const void *vb)
+{
+    const TOPN_COUNTER *a = (const TOPN_COUNTER*)va;
+    const TOPN_COUNTER *b = (const TOPN_COUNTER*)vb;
+
+    return a->weight > b->weight ? -1 : (a->weight < b->weight ? 1 : 0);
+}
+
+/**
+ * Merge the sketches of all threads.
+ *
+ * @param instance  The filter instance
+ * @param top       Array where the statements with the largest total
+ *                  execution time are stored
+ * @param n         Size of the array
+ *
+ * @return Number of statements stored in @c top
+ */
+static int global_top(TOPN_INSTANCE *instance, TOPN_COUNTER *top, int n)
+{
+    int total = 0;
+
+    for (int i = 0; i < instance->n_sketches; i++)
+    {
+        total += instance->sketches[i].capacity;
+    }
+
+    TOPN_COUNTER *all = MXS_MALLOC(total * sizeof(TOPN_COUNTER));
+
+    if (all == NULL)
+    {
+        return 0;
+    }
+
+    int n_all = 0;
+
+    for (int i = 0; i < instance->n_sketches; i++)
+    {
+        TOPN_SKETCH *sketch = &instance->sketches[i];
+        spinlock_acquire(&sketch->lock);
+        memcpy(all + n_all, sketch->counters, sketch->size * sizeof(TOPN_COUNTER));
+        n_all += sketch->size;
+        spinlock_release(&sketch->lock);
+    }
+
+    // Combine the counters of the same statement in different threads
+    qsort(all, n_all, sizeof(TOPN_COUNTER), cmp_counter_digest);
+
+    int n_merged = 0;
+
+    for (int i = 0; i < n_all; i++)
+    {
+        if (n_merged > 0 && all[n_merged - 1].digest == all[i].digest)
+        {
+            TOPN_COUNTER *counter = &all[n_merged - 1];
+            counter->weight += all[i].weight;
+            counter->error += all[i].error;
+            counter->count += all[i].count;
+
+            if (all[i].max > counter->max)
+            {
+                counter->max = all[i].max;
+            }
+        }
+        else
+        {
+            all[n_merged++] = all[i];
+        }
+    }
+
+    qsort(all, n_merged, sizeof(TOPN_COUNTER), cmp_counter_weight);
+
+    if (n > n_merged)
+    {
+        n = n_merged;
+    }
+
+    memcpy(top, all, n * sizeof(TOPN_COUNTER));
+    MXS_FREE(all);
+
+    return n;
+}
+
+/**
+ * Print the statements with the largest total execution time in all sessions.
+ *
+ * @param instance  The filter instance
+ * @param dcb       Where to print
+ */
+static void print_global_top(TOPN_INSTANCE *instance, DCB *dcb)
+{
+    TOPN_COUNTER *top = MXS_MALLOC(instance->topN * sizeof(TOPN_COUNTER));
+
+    if (top)
+    {
+        int n = global_top(instance, top, instance->topN);
+
+        dcb_printf(dcb, "Total (sec) | Error (sec) | Count      | Avg (sec)  | Max (sec)  | "
+                   "Digest           | Query\n");
+
+        for (int i = 0; i < n; i++)
+        {
+            // The count of a statement that replaced another one is short
+            // by the executions of the replaced statements.
+            dcb_printf(dcb, "%11.3f | %11.3f | %10" PRIu64 " | %10.3f | %10.3f | %016" PRIx64 " | %s\n",
+                       top[i].weight / 1000000.0, top[i].error / 1000000.0, top[i].count,
+                       (top[i].weight - top[i].error) / 1000000.0 / top[i].count,
+                       top[i].max / 1000000.0, top[i].digest, top[i].sql);
+        }
+
+        MXS_FREE(top);
+    }
+}
+
+/**
+ * Module command for printing the statements with the largest total
+ * execution time in all sessions.
+ *
+ * @param argv  The output DCB and the filter
+ *
+ * @return True if the filter collects a report over all sessions
+ */
+static bool topn_show_top(const MODULECMD_ARG *argv)
+{
+    DCB *dcb = argv->argv[0].value.dcb;
+    MXS_FILTER_DEF *filter = argv->argv[1].value.filter;
+    TOPN_INSTANCE *instance = (TOPN_INSTANCE*)filter_def_get_instance(filter);
+
+    if (!instance->global)
+    {
+        modulecmd_set_error("The filter does not collect a report over all sessions, "
+                            "enable it with global=true.");
+        return false;
+    }
+
+    print_global_top(instance, dcb);
+    return true;
+}
@@ -32,6 +32,14 @@
  *  query_delimiter=<delimiter for query statements in a transaction (default='@@@')>
  *  source=<source address to limit filter>
  *  user=<username to limit filter>
+ *  log_format=<text, csv or binary (default=text)>
+ *  sample_rate=<log one in this many transactions (default=1)>
+ *  buffer_size=<size of the log buffer of each routing thread (default=1M)>
+ *
+ * The routing threads store the transactions in log buffers of their own and
+ * a writer thread of the filter instance writes them to the file, so that the
+ * routing threads never wait for the disk. In the csv and binary formats only
+ * the digests of the canonical forms of the statements are logged.
  *
  * Date         Who             Description
  * 06/12/2015   Dong Young Yoon Initial implementation
@@ -62,7 +70,11 @@
 #include <maxscale/thread.h>
 #include <maxscale/server.h>
 #include <maxscale/atomic.h>
+#include <maxscale/platform.h>
 #include <maxscale/query_classifier.h>
+#include <maxscale/spsc_ring.h>
+#include <maxscale/utils.h>
+#include <unistd.h>
 
 /* The maximum size for query statements in a transaction (64MB) */
 static size_t sql_size_limit = 64 * 1024 * 1024;
@@ -74,6 +86,41 @@ static const int default_sql_size = 4 * 1024;
 #define DEFAULT_FILE_NAME       "tpm.log"
 #define DEFAULT_NAMED_PIPE       "/tmp/tpmfilter"
 
+/* Size of the buffer into which the writer thread formats the log */
+#define TPM_WRITE_BUFFER_SIZE (256 * 1024)
+
+/* The formats of the log file */
+enum tpm_log_format
+{
+    TPM_LOG_TEXT,   // The statements as such, separated with the delimiters
+    TPM_LOG_CSV,    // Comma separated values with the digests of the statements
+    TPM_LOG_BINARY  // Binary records with the digests of the statements
+};
+
+static const MXS_ENUM_VALUE log_format_values[] =
+{
+    {"text", TPM_LOG_TEXT},
+    {"csv", TPM_LOG_CSV},
+    {"binary", TPM_LOG_BINARY},
+    {NULL}
+};
+
+/**
+ * A transaction in a log buffer. The header is followed by the timestamp and
+ * the latency of the transaction as 64-bit integers, the names of the server
+ * and the user and, aligned to 8 bytes, the statements. The statements are
+ * either the digests of the statements or the statements as text separated
+ * with the query delimiter.
+ */
+typedef struct
+{
+    uint32_t n_statements; /* Number of statements */
+    uint16_t server_len;   /* Length of the server name */
+    uint16_t user_len;     /* Length of the user name */
+    uint32_t sql_len;      /* Length of the statement text, 0 if digests are stored */
+    uint32_t reserved;     /* Keeps the timestamp that follows aligned to 8 bytes */
+} TPM_RECORD;
+
 /*
  * The filter entry points
  */
@@ -88,11 +135,26 @@ static  int clientReply(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, GWBU
 static  void    diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb);
 static uint64_t getCapabilities(MXS_FILTER* instance);
 static  void checkNamedPipe(void *args);
+static uint64_t writer_drain(MXS_SPSC_RING *ring, void *data);
+static int writer_flush_all(MXS_SPSC_CONSUMER *consumer, void *data);
+
+/* Number of transactions the current thread has started, used for sampling */
+static thread_local uint64_t thread_trx_count = 0;
 
 /**
- * A instance structure, every instance will write to a same file.
+ * The state of a writer thread.
  */
 typedef struct
+{
+    struct tpm_instance *instance;
+    char *buffer;   /* Formatted log not yet written */
+    size_t len;     /* Length of the formatted log */
+} TPM_WRITER;
+
+/**
+ * A instance structure, every instance will write to a same file.
+ */
+typedef struct tpm_instance
 {
     int sessions;   /* Session count */
     char    *source;    /* The source of the client connection */
@@ -106,6 +168,16 @@ typedef struct
 
     int query_delimiter_size; /* the length of the query delimiter */
     FILE* fp;
+    enum tpm_log_format log_format; /* the format of the log file */
+    int sample_rate; /* log one in this many transactions */
+    MXS_SPSC_RING *rings; /* the log buffers, one per routing thread */
+    int n_rings; /* number of log buffers */
+    int reopen; /* set when the writer thread should reopen the log file */
+    TPM_WRITER writer; /* state of the writer thread */
+    MXS_SPSC_CONSUMER *consumer; /* the writer thread */
+    bool write_error_given; /* whether a write error has been logged */
+    uint64_t records_written; /* transactions written by the writer thread */
+    uint64_t records_dropped; /* transactions dropped as a log buffer was full */
 } TPM_INSTANCE;
 
 /**
@@ -124,17 +196,18 @@ typedef struct
     char        *clientHost;
     char        *userName;
     char* sql;
-    struct timeval  start;
-    char        *current;
     int     n_statements;
-    struct timeval  total;
-    struct timeval  current_start;
+    uint64_t current_start; /* when the transaction started, in microseconds */
     bool query_end;
-    char    *buf;
+    bool sampled;       /* whether the current transaction is logged */
     int sql_index;
     size_t      max_sql_size;
+    uint64_t *digests;  /* digests of the statements of the current transaction */
+    size_t max_digests; /* size of the digest array */
 } TPM_SESSION;
 
+static FILE* open_log_file(TPM_INSTANCE *instance);
+
 /**
  * The module entry point routine. It is this routine that
  * must populate the structure that is referred to as the
@@ -166,7 +239,7 @@ MXS_MODULE* MXS_CREATE_MODULE()
         MXS_MODULE_GA,
         MXS_FILTER_VERSION,
         "Transaction Performance Monitoring filter",
-        "V1.0.1",
+        "V1.1.0",
         &MyObject,
         NULL, /* Process init. */
         NULL, /* Process finish. */
@@ -179,6 +252,9 @@ MXS_MODULE* MXS_CREATE_MODULE()
             {"query_delimiter", MXS_MODULE_PARAM_STRING, DEFAULT_QUERY_DELIMITER},
             {"source", MXS_MODULE_PARAM_STRING},
             {"user", MXS_MODULE_PARAM_STRING},
+            {"log_format", MXS_MODULE_PARAM_ENUM, "text", MXS_MODULE_OPT_NONE, log_format_values},
+            {"sample_rate", MXS_MODULE_PARAM_COUNT, "1"},
+            {"buffer_size", MXS_MODULE_PARAM_SIZE, "1M"},
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -211,6 +287,13 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
         my_instance->named_pipe = MXS_STRDUP_A(config_get_string(params, "named_pipe"));
         my_instance->source = config_copy_string(params, "source");
         my_instance->user = config_copy_string(params, "user");
+        my_instance->log_format = config_get_enum(params, "log_format", log_format_values);
+        my_instance->sample_rate = config_get_integer(params, "sample_rate");
+
+        if (my_instance->sample_rate < 1)
+        {
+            my_instance->sample_rate = 1;
+        }
 
         bool error = false;
 
@@ -248,7 +331,7 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
         }
 
 
-        my_instance->fp = fopen(my_instance->filename, "w");
+        my_instance->fp = open_log_file(my_instance);
 
         if (my_instance->fp == NULL)
         {
@@ -257,18 +340,46 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
             error = true;
         }
 
+        my_instance->n_rings = config_threadcount();
+
+        if (!error && (my_instance->rings = mxs_spsc_rings_alloc(my_instance->n_rings,
+                                                                 config_get_size(params, "buffer_size"))) == NULL)
+        {
+            error = true;
+        }
+
         /*
-         * Launch a thread that checks the named pipe.
+         * Launch the writer thread and a thread that checks the named pipe.
          */
+        my_instance->writer.instance = my_instance;
+
+        if (!error && (my_instance->writer.buffer = MXS_MALLOC(TPM_WRITE_BUFFER_SIZE)) == NULL)
+        {
+            error = true;
+        }
+
+        if (!error && (my_instance->consumer = mxs_spsc_consumer_start(my_instance->rings,
+                                                                       my_instance->n_rings,
+                                                                       writer_drain,
+                                                                       writer_flush_all,
+                                                                       &my_instance->writer)) == NULL)
+        {
+            MXS_ERROR("Couldn't create the writer thread of tpmfilter: %s", strerror(errno));
+            error = true;
+        }
+
         THREAD thread;
         if (!error && thread_start(&thread, checkNamedPipe, (void*)my_instance) == NULL)
         {
             MXS_ERROR("Couldn't create a thread to check the named pipe: %s", strerror(errno));
+            mxs_spsc_consumer_stop(my_instance->consumer);
             error = true;
         }
 
         if (error)
         {
+            mxs_spsc_rings_free(my_instance->rings, my_instance->n_rings);
+            MXS_FREE(my_instance->writer.buffer);
             MXS_FREE(my_instance->delimiter);
             MXS_FREE(my_instance->filename);
             MXS_FREE(my_instance->named_pipe);
@@ -307,14 +418,17 @@ newSession(MXS_FILTER *instance, MXS_SESSION *session)
     {
         atomic_add(&my_instance->sessions, 1);
 
-        my_session->max_sql_size = default_sql_size; // default max query size of 4k.
-        my_session->sql = (char*)MXS_CALLOC(my_session->max_sql_size, sizeof(char));
-        memset(my_session->sql, 0x00, my_session->max_sql_size);
+        if (my_instance->log_format == TPM_LOG_TEXT)
+        {
+            my_session->max_sql_size = default_sql_size; // default max query size of 4k.
+            my_session->sql = (char*)MXS_CALLOC(my_session->max_sql_size, sizeof(char));
+            MXS_ABORT_IF_NULL(my_session->sql);
+        }
+        // The digest array is allocated when the first statement is logged
+        my_session->digests = NULL;
+        my_session->max_digests = 0;
         my_session->sql_index = 0;
         my_session->n_statements = 0;
-        my_session->total.tv_sec = 0;
-        my_session->total.tv_usec = 0;
-        my_session->current = NULL;
         if ((remote = session_get_remote(session)) != NULL)
         {
             my_session->clientHost = MXS_STRDUP_A(remote);
@@ -357,14 +471,6 @@ newSession(MXS_FILTER *instance, MXS_SESSION *session)
 static  void
 closeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session)
 {
-    TPM_SESSION *my_session = (TPM_SESSION *)session;
-    TPM_INSTANCE    *my_instance = (TPM_INSTANCE *)instance;
-    if (my_instance->fp != NULL)
-    {
-        // flush FP when a session is closed.
-        fflush(my_instance->fp);
-    }
-
 }
 
 /**
@@ -381,6 +487,7 @@ freeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session)
     MXS_FREE(my_session->clientHost);
     MXS_FREE(my_session->userName);
     MXS_FREE(my_session->sql);
+    MXS_FREE(my_session->digests);
     MXS_FREE(session);
     return;
 }
@@ -417,12 +524,172 @@ setUpstream(MXS_FILTER *instance, MXS_FILTER_SESSION *session, MXS_UPSTREAM *ups
     my_session->up = *upstream;
 }
 
+/**
+ * Append the text of a statement to the statements of the current transaction.
+ *
+ * @param my_instance  The filter instance
+ * @param my_session   The filter session
+ * @param ptr          The statement, not NULL terminated
+ * @param query_len    The length of the statement
+ * @return True if the statement was added
+ */
+static bool add_statement_text(TPM_INSTANCE *my_instance, TPM_SESSION *my_session,
+                               const char *ptr, size_t query_len)
+{
+    /* check and expand buffer size first. */
+    size_t new_sql_size = my_session->max_sql_size;
+    size_t len = my_session->sql_index + query_len + my_instance->query_delimiter_size + 1;
+
+    /* if the total length of query statements exceeds the maximum limit, print an error and return */
+    if (len > sql_size_limit)
+    {
+        MXS_ERROR("The size of query statements exceeds the maximum buffer limit of 64MB.");
+        return false;
+    }
+
+    /* double buffer size until the buffer fits the query */
+    while (len > new_sql_size)
+    {
+        new_sql_size *= 2;
+    }
+    if (new_sql_size > my_session->max_sql_size)
+    {
+        char* new_sql = (char*)MXS_CALLOC(new_sql_size, sizeof(char));
+        if (new_sql == NULL)
+        {
+            MXS_ERROR("Memory allocation failure.");
+            return false;
+        }
+        memcpy(new_sql, my_session->sql, my_session->sql_index);
+        MXS_FREE(my_session->sql);
+        my_session->sql = new_sql;
+        my_session->max_sql_size = new_sql_size;
+    }
+
+    /* append the statement with a query delimiter unless it is the first statement */
+    if (my_session->sql_index > 0)
+    {
+        memcpy(my_session->sql + my_session->sql_index, my_instance->query_delimiter,
+               my_instance->query_delimiter_size);
+        my_session->sql_index += my_instance->query_delimiter_size;
+    }
+
+    memcpy(my_session->sql + my_session->sql_index, ptr, query_len);
+    my_session->sql_index += query_len;
+    return true;
+}
+
+/**
+ * Append the digest of a statement to the statements of the current transaction.
+ *
+ * @param my_session   The filter session
+ * @param digest       The digest of the statement
+ * @return True if the digest was added
+ */
+static bool add_statement_digest(TPM_SESSION *my_session, uint64_t digest)
+{
+    size_t n_digests = my_session->n_statements - 1;
+
+    if (n_digests == my_session->max_digests)
+    {
+        size_t new_size = my_session->max_digests ? my_session->max_digests * 2 : 64;
+
+        if (new_size * sizeof(uint64_t) > sql_size_limit)
+        {
+            MXS_ERROR("The number of statements exceeds the maximum buffer limit of 64MB.");
+            return false;
+        }
+
+        uint64_t *new_digests = MXS_REALLOC(my_session->digests, new_size * sizeof(uint64_t));
+
+        if (new_digests == NULL)
+        {
+            return false;
+        }
+
+        my_session->digests = new_digests;
+        my_session->max_digests = new_size;
+    }
+
+    my_session->digests[n_digests] = digest;
+    return true;
+}
+
+/**
+ * Round a length up to a multiple of 8 bytes.
+ */
+static inline size_t align8(size_t len)
+{
+    return (len + 7) & ~(size_t)7;
+}
+
+/**
+ * Store the current transaction of a session in the log buffer of the
+ * current thread. If the buffer is full, the transaction is dropped instead
+ * of waiting for the writer thread.
+ *
+ * @param my_instance  The filter instance
+ * @param my_session   The filter session
+ * @param server       The server that executed the transaction, may be NULL
+ */
+static void log_transaction(TPM_INSTANCE *my_instance, TPM_SESSION *my_session, SERVER *server)
+{
+    /* get latency */
+    uint64_t micros = mxs_clock_us() - my_session->current_start;
+
+    const char *server_name = server ? server->unique_name : "";
+    const char *user = my_session->userName ? my_session->userName : "";
+    size_t server_len = strnlen(server_name, UINT16_MAX);
+    size_t user_len = strnlen(user, UINT16_MAX);
+    size_t names_len = align8(server_len + user_len);
+    size_t stmt_len = my_instance->log_format == TPM_LOG_TEXT ?
+                      my_session->sql_index : my_session->n_statements * sizeof(uint64_t);
+    size_t len = sizeof(TPM_RECORD) + 2 * sizeof(uint64_t) + names_len + stmt_len;
+
+    MXS_SPSC_RING *ring = mxs_spsc_rings_get(my_instance->rings, my_instance->n_rings);
+    TPM_RECORD *record = ring ? mxs_spsc_ring_reserve(ring, len) : NULL;
+
+    if (record)
+    {
+        uint64_t *times = (uint64_t*)(record + 1);
+        char *names = (char*)(times + 2);
+
+        /* get timestamp */
+        times[0] = time(NULL);
+        times[1] = micros;
+        memcpy(names, server_name, server_len);
+        memcpy(names + server_len, user, user_len);
+
+        if (my_instance->log_format == TPM_LOG_TEXT)
+        {
+            memcpy(names + names_len, my_session->sql, stmt_len);
+        }
+        else
+        {
+            memcpy(names + names_len, my_session->digests, stmt_len);
+        }
+
+        record->n_statements = my_session->n_statements;
+        record->server_len = server_len;
+        record->user_len = user_len;
+        record->sql_len = my_instance->log_format == TPM_LOG_TEXT ? stmt_len : 0;
+        mxs_spsc_ring_commit(ring, len);
+    }
+    else
+    {
+        atomic_add_uint64(&my_instance->records_dropped, 1);
+    }
+}
+
 /**
  * The routeQuery entry point. This is passed the query buffer
  * to which the filter should be applied. Once applied the
  * query should normally be passed to the downstream component
  * (filter or router) in the filter chain.
  *
+ * Only the transactions that are sampled are stored, the other ones are
+ * only followed to find where they end.
+ *
  * @param instance  The filter instance data
  * @param session   The filter session
  * @param queue     The query data
@@ -432,86 +699,62 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
 {
     TPM_INSTANCE    *my_instance = (TPM_INSTANCE *)instance;
     TPM_SESSION *my_session = (TPM_SESSION *)session;
-    char        *ptr = NULL;
-    size_t i;
 
-    if (my_session->active)
+    if (my_session->active && my_instance->log_enabled && modutil_is_SQL(queue))
     {
-        if ((ptr = modutil_get_SQL(queue)) != NULL)
+        uint32_t query_type = qc_get_type_mask(queue);
+        my_session->query_end = false;
+
+        /* check for commit and rollback */
+        if (query_type & QUERY_TYPE_COMMIT)
+        {
+            my_session->query_end = true;
+        }
+        else if (query_type & QUERY_TYPE_ROLLBACK)
         {
-            uint32_t query_type = qc_get_type_mask(queue);
-            int query_len = strlen(ptr);
-            my_session->query_end = false;
+            my_session->query_end = true;
+            my_session->sql_index = 0;
+            my_session->n_statements = 0;
+        }
 
-            /* check for commit and rollback */
-            if (query_type & QUERY_TYPE_COMMIT)
-            {
-                my_session->query_end = true;
-            }
-            else if (query_type & QUERY_TYPE_ROLLBACK)
+        /* for normal sql statements */
+        if (!my_session->query_end)
+        {
+            /* first statement */
+            if (my_session->n_statements == 0)
             {
-                my_session->query_end = true;
-                my_session->sql_index = 0;
+                my_session->sampled = ++thread_trx_count % my_instance->sample_rate == 0;
+                my_session->current_start = mxs_clock_us();
             }
 
-            /* for normal sql statements */
-            if (!my_session->query_end)
-            {
-                /* check and expand buffer size first. */
-                size_t new_sql_size = my_session->max_sql_size;
-                size_t len = my_session->sql_index + strlen(ptr) + my_instance->query_delimiter_size + 1;
+            my_session->n_statements++;
 
-                /* if the total length of query statements exceeds the maximum limit, print an error and return */
-                if (len > sql_size_limit)
-                {
-                    MXS_ERROR("The size of query statements exceeds the maximum buffer limit of 64MB.");
-                    goto retblock;
-                }
+            if (my_session->sampled)
+            {
+                char *ptr;
+                int query_len;
+                uint64_t digest = 0;
+                bool added;
 
-                /* double buffer size until the buffer fits the query */
-                while (len > new_sql_size)
+                if (my_instance->log_format == TPM_LOG_TEXT)
                 {
-                    new_sql_size *= 2;
+                    added = modutil_extract_SQL(queue, &ptr, &query_len) &&
+                            add_statement_text(my_instance, my_session, ptr, query_len);
                 }
-                if (new_sql_size > my_session->max_sql_size)
+                else
                 {
-                    char* new_sql = (char*)MXS_CALLOC(new_sql_size, sizeof(char));
-                    if (new_sql == NULL)
-                    {
-                        MXS_ERROR("Memory allocation failure.");
-                        goto retblock;
-                    }
-                    memcpy(new_sql, my_session->sql, my_session->sql_index);
-                    MXS_FREE(my_session->sql);
-                    my_session->sql = new_sql;
-                    my_session->max_sql_size = new_sql_size;
+                    modutil_get_canonical_digest(queue, &digest);
+                    added = add_statement_digest(my_session, digest);
                 }
 
-                /* first statement */
-                if (my_session->sql_index == 0)
+                if (!added)
                 {
-                    memcpy(my_session->sql, ptr, strlen(ptr));
-                    my_session->sql_index += strlen(ptr);
-                    gettimeofday(&my_session->current_start, NULL);
-                }
-                /* otherwise, append the statement with semicolon as a statement delimiter */
-                else
-                {
-                    /* append a query delimiter */
-                    memcpy(my_session->sql + my_session->sql_index, my_instance->query_delimiter,
-                           my_instance->query_delimiter_size);
-                    /* append the next query statement */
-                    memcpy(my_session->sql + my_session->sql_index + my_instance->query_delimiter_size, ptr, strlen(ptr));
-                    /* set new pointer for the buffer */
-                    my_session->sql_index += (my_instance->query_delimiter_size + strlen(ptr));
+                    my_session->n_statements--;
                 }
             }
         }
     }
 
-retblock:
-
-    MXS_FREE(ptr);
     /* Pass the query downstream */
     return my_session->down.routeQuery(my_session->down.instance,
                                        my_session->down.session, queue);
@@ -522,39 +765,17 @@ clientReply(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *reply)
 {
     TPM_INSTANCE    *my_instance = (TPM_INSTANCE *)instance;
     TPM_SESSION *my_session = (TPM_SESSION *)session;
-    struct      timeval     tv, diff;
-    int     i, inserted;
 
     /* found 'commit' and sql statements exist. */
-    if (my_session->query_end && my_session->sql_index > 0)
+    if (my_session->query_end && my_session->n_statements > 0)
     {
-        gettimeofday(&tv, NULL);
-        timersub(&tv, &(my_session->current_start), &diff);
-
-        /* get latency */
-        uint64_t millis = (diff.tv_sec * (uint64_t)1000 + diff.tv_usec / 1000);
-        /* get timestamp */
-        uint64_t timestamp = (tv.tv_sec + (tv.tv_usec / (1000 * 1000)));
-
-        *(my_session->sql + my_session->sql_index) = '\0';
-
-        /* print to log. */
-        if (my_instance->log_enabled)
+        if (my_session->sampled && my_instance->log_enabled)
         {
-            /* this prints "timestamp | server_name | user_name | latency | sql_statements" */
-            fprintf(my_instance->fp, "%ld%s%s%s%s%s%ld%s%s\n",
-                    timestamp,
-                    my_instance->delimiter,
-                    reply->server->unique_name,
-                    my_instance->delimiter,
-                    my_session->userName,
-                    my_instance->delimiter,
-                    millis,
-                    my_instance->delimiter,
-                    my_session->sql);
+            log_transaction(my_instance, my_session, reply->server);
         }
 
         my_session->sql_index = 0;
+        my_session->n_statements = 0;
     }
 
     /* Pass the result upstream */
@@ -595,6 +816,14 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
     if (my_instance->query_delimiter)
         dcb_printf(dcb, "\t\tLogging with query delimiter %s.\n",
                    my_instance->query_delimiter);
+    dcb_printf(dcb, "\t\tLog format                     %s\n",
+               log_format_values[my_instance->log_format].name);
+    dcb_printf(dcb, "\t\tLogging one in                 %d transactions\n",
+               my_instance->sample_rate);
+    dcb_printf(dcb, "\t\tTransactions written           %lu\n",
+               atomic_add_uint64(&my_instance->records_written, 0));
+    dcb_printf(dcb, "\t\tTransactions dropped           %lu\n",
+               atomic_add_uint64(&my_instance->records_dropped, 0));
 }
 
 /**
@@ -607,6 +836,231 @@ static uint64_t getCapabilities(MXS_FILTER* instance)
     return RCAP_TYPE_CONTIGUOUS_INPUT;
 }
 
+/**
+ * Open the log file, truncating it. In the csv format a header line
+ * is written at the start of the file.
+ *
+ * @param instance  The filter instance
+ * @return The log file or NULL on error
+ */
+static FILE* open_log_file(TPM_INSTANCE *instance)
+{
+    FILE *fp = fopen(instance->filename, "w");
+
+    if (fp && instance->log_format == TPM_LOG_CSV)
+    {
+        fprintf(fp, "timestamp,server,user,latency_us,statements\n");
+        fflush(fp);
+    }
+
+    return fp;
+}
+
+/**
+ * Write the formatted log to the log file, retrying partial writes.
+ *
+ * @param writer  Writer state
+ * @param data    The data
+ * @param len     Length of the data
+ */
+static void writer_write(TPM_WRITER *writer, const char *data, size_t len)
+{
+    TPM_INSTANCE *instance = writer->instance;
+    int fd = instance->fp ? fileno(instance->fp) : -1;
+
+    while (len > 0)
+    {
+        ssize_t rc = fd == -1 ? -1 : write(fd, data, len);
+
+        if (rc < 0)
+        {
+            if (fd != -1 && errno == EINTR)
+            {
+                continue;
+            }
+
+            if (!instance->write_error_given)
+            {
+                MXS_ERROR("Failed to write to the tpmfilter log file '%s': %d, %s. "
+                          "Suppressing further similar errors.", instance->filename,
+                          errno, strerror(errno));
+                instance->write_error_given = true;
+            }
+            return;
+        }
+
+        data += rc;
+        len -= rc;
+    }
+}
+
+/**
+ * Write the collected log.
+ *
+ * @param writer  Writer state
+ */
+static void writer_flush(TPM_WRITER *writer)
+{
+    if (writer->len > 0)
+    {
+        writer_write(writer, writer->buffer, writer->len);
+        writer->len = 0;
+    }
+}
+
+/**
+ * Add data to the log. Data that is larger than the buffer is written as such.
+ *
+ * @param writer  Writer state
+ * @param data    The data
+ * @param len     Length of the data
+ */
+static void writer_append(TPM_WRITER *writer, const void *data, size_t len)
+{
+    if (writer->len + len > TPM_WRITE_BUFFER_SIZE)
+    {
+        writer_flush(writer);
+    }
+
+    if (len > TPM_WRITE_BUFFER_SIZE)
+    {
+        writer_write(writer, data, len);
+    }
+    else
+    {
+        memcpy(writer->buffer + writer->len, data, len);
+        writer->len += len;
+    }
+}
+
+/**
+ * Format a transaction in the log format of the filter.
+ *
+ * @param writer  Writer state
+ * @param record  The transaction
+ */
+static void writer_format(TPM_WRITER *writer, const TPM_RECORD *record)
+{
+    TPM_INSTANCE *instance = writer->instance;
+    const uint64_t *times = (const uint64_t*)(record + 1);
+    const char *server = (const char*)(times + 2);
+    const char *user = server + record->server_len;
+    const char *stmts = server + align8(record->server_len + record->user_len);
+    char buf[1024];
+    int len;
+
+    switch (instance->log_format)
+    {
+    case TPM_LOG_TEXT:
+        /* this prints "timestamp | server_name | user_name | latency | sql_statements" */
+        len = snprintf(buf, sizeof(buf), "%lu%s%.*s%s%.*s%s%lu%s",
+                       times[0], instance->delimiter,
+                       (int)record->server_len, server, instance->delimiter,
+                       (int)record->user_len, user, instance->delimiter,
+                       times[1] / 1000, instance->delimiter);
+        writer_append(writer, buf, MXS_MIN(len, (int)sizeof(buf) - 1));
+        writer_append(writer, stmts, record->sql_len);
+        writer_append(writer, "\n", 1);
+        break;
+
+    case TPM_LOG_CSV:
+        len = snprintf(buf, sizeof(buf), "%lu,\"%.*s\",\"%.*s\",%lu,",
+                       times[0], (int)record->server_len, server,
+                       (int)record->user_len, user, times[1]);
+        writer_append(writer, buf, MXS_MIN(len, (int)sizeof(buf) - 1));
+
+        for (uint32_t i = 0; i < record->n_statements; i++)
+        {
+            uint64_t digest;
+            memcpy(&digest, stmts + i * sizeof(uint64_t), sizeof(digest));
+            len = sprintf(buf, "%s%016" PRIx64, i > 0 ? ";" : "", digest);
+            writer_append(writer, buf, len);
+        }
+
+        writer_append(writer, "\n", 1);
+        break;
+
+    case TPM_LOG_BINARY:
+        {
+            uint32_t n_statements = record->n_statements;
+            uint16_t server_len = record->server_len;
+            uint16_t user_len = record->user_len;
+
+            writer_append(writer, times, 2 * sizeof(uint64_t));
+            writer_append(writer, &n_statements, sizeof(n_statements));
+            writer_append(writer, &server_len, sizeof(server_len));
+            writer_append(writer, &user_len, sizeof(user_len));
+            writer_append(writer, server, server_len + user_len);
+            writer_append(writer, stmts, n_statements * sizeof(uint64_t));
+        }
+        break;
+    }
+}
+
+/**
+ * Format the transactions of a log buffer.
+ *
+ * @param ring    The log buffer
+ * @param data    Writer state
+ * @return Number of transactions formatted
+ */
+static uint64_t writer_drain(MXS_SPSC_RING *ring, void *data)
+{
+    TPM_WRITER *writer = (TPM_WRITER*)data;
+    uint64_t n_records = 0;
+    TPM_RECORD *record;
+    size_t len;
+
+    while ((record = mxs_spsc_ring_peek(ring, &len)))
+    {
+        writer_format(writer, record);
+        mxs_spsc_ring_consume(ring);
+        n_records++;
+    }
+
+    if (n_records > 0)
+    {
+        atomic_add_uint64(&writer->instance->records_written, n_records);
+    }
+
+    return n_records;
+}
+
+/**
+ * Write the transactions formatted from all routing threads, and reopen the
+ * log file if the named pipe asked for it. The log is written with few large
+ * writes, so that the routing threads never wait for the disk.
+ *
+ * @param consumer  The writer thread
+ * @param data      Writer state
+ * @return -1, the writer thread only wakes up for new transactions
+ */
+static int writer_flush_all(MXS_SPSC_CONSUMER *consumer, void *data)
+{
+    TPM_WRITER *writer = (TPM_WRITER*)data;
+    TPM_INSTANCE *instance = writer->instance;
+    int reopen = 1;
+
+    writer_flush(writer);
+
+    if (atomic_cas_int(&instance->reopen, &reopen, 0))
+    {
+        if (instance->fp)
+        {
+            fclose(instance->fp);
+        }
+
+        if ((instance->fp = open_log_file(instance)) == NULL)
+        {
+            MXS_ERROR("Failed to open a log file for tpmfilter.");
+        }
+
+        instance->write_error_given = false;
+    }
+
+    return -1;
+}
+
 static void checkNamedPipe(void *args)
 {
     int ret;
@@ -623,14 +1077,9 @@ static void checkNamedPipe(void *args)
         {
             if (buffer[0] == '1')
             {
-                // reopens the log file.
-                inst->fp = fopen(inst->filename, "w");
-                if (inst->fp == NULL)
-                {
-                    MXS_ERROR("Failed to open a log file for tpmfilter.");
-                    MXS_FREE(inst);
-                    return;
-                }
+                // the writer thread reopens the log file.
+                atomic_add(&inst->reopen, 1);
+                mxs_spsc_consumer_wake(inst->consumer);
                 inst->log_enabled = true;
             }
             else if (buffer[0] == '0')
@@ -0,0 +1,76 @@
+#pragma once
+#ifndef _BINLOG_FEED_H
+#define _BINLOG_FEED_H
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file binlog_feed.h - The events a binlogrouter writes, for other modules
+ *
+ * Another module of the same process, e.g. the avrorouter, can receive the
+ * events that a binlogrouter instance writes into its binlog files as they
+ * are written. The module looks up the API with the @c BINLOG_FEED_ENTRY_POINT
+ * symbol of the binlogrouter library.
+ */
+
+#include <maxscale/cdefs.h>
+#include <stdint.h>
+#include <maxscale/router.h>
+
+MXS_BEGIN_DECLS
+
+/** The name of the function that returns the BINLOG_FEED_API */
+#define BINLOG_FEED_ENTRY_POINT "BinlogGetFeedAPI"
+
+/**
+ * Called for each event after it has been written into the binlog file
+ *
+ * The function is called in the thread that reads the events from the master
+ * and must not block. The event is only valid during the call.
+ *
+ * @param data   The data given when subscribing
+ * @param binlog Name of the binlog file the event was written to
+ * @param pos    Position of the event in the file
+ * @param event  The event with the replication event header
+ * @param len    Length of the event
+ */
+typedef void (*binlog_feed_cb)(void *data, const char *binlog, uint64_t pos,
+                               const uint8_t *event, uint32_t len);
+
+typedef struct binlog_feed_api
+{
+    /**
+     * Start receiving the events of a binlogrouter instance
+     *
+     * @param instance The binlogrouter instance
+     * @param cb       Function called for each event
+     * @param data     Data passed to @c cb
+     * @return The subscription or NULL on error
+     */
+    void* (*subscribe)(MXS_ROUTER *instance, binlog_feed_cb cb, void *data);
+
+    /**
+     * Stop receiving events. After this returns, the callback of the
+     * subscription is no longer called.
+     *
+     * @param instance     The binlogrouter instance
+     * @param subscription The subscription to remove
+     */
+    void (*unsubscribe)(MXS_ROUTER *instance, void *subscription);
+} BINLOG_FEED_API;
+
+typedef BINLOG_FEED_API* (*BinlogGetFeedAPIFN)();
+
+MXS_END_DECLS
+
+#endif /* _BINLOG_FEED_H */
@@ -24,6 +24,8 @@
 #include <maxscale/alloc.h>
 #include <maxscale/debug.h>
 #include <maxscale/mysql_utils.h>
+#include <limits.h>
+#include <stdlib.h>
 
 typedef struct aurora_monitor
 {
@@ -33,12 +35,29 @@ typedef struct aurora_monitor
     uint64_t   events;          /**< Enabled monitor events */
 } AURORA_MONITOR;
 
+/** The status of all the instances, the row of an instance has its @@aurora_server_id */
+#define AURORA_STATUS_QUERY "SELECT @@aurora_server_id, server_id, session_id, " \
+    "replica_lag_in_milliseconds, cpu FROM information_schema.replica_host_status"
+
+/**
+ * @brief Set the replication lag of a server
+ *
+ * @param server Server to update
+ * @param lag_ms The lag in milliseconds or MAX_RLAG_NOT_AVAILABLE
+ */
+static void set_rlag(SERVER *server, int lag_ms)
+{
+    server->rlag_ms = lag_ms;
+    server->rlag = lag_ms >= 0 ? lag_ms / 1000 : lag_ms;
+}
+
 /**
  * @brief Update the status of a server
  *
  * This function connects to the database and queries it for its status. The
  * status of the server is adjusted accordingly based on the results of the
- * query.
+ * query. The replica lag and the CPU usage that Aurora reports for the
+ * instance are stored in the server.
  *
  * @param monitor  Monitor object
  * @param database Server whose status should be updated
@@ -50,6 +69,8 @@ void update_server_status(MXS_MONITOR *monitor, MXS_MONITOR_SERVERS *database)
         SERVER temp_server = {.status = database->server->status};
         server_clear_status_nolock(&temp_server, SERVER_RUNNING | SERVER_MASTER | SERVER_SLAVE | SERVER_AUTH_ERROR);
         database->mon_prev_status = database->server->status;
+        int lag_ms = MAX_RLAG_NOT_AVAILABLE;
+        int cpu = MXS_LOAD_METRIC_UNDEFINED;
 
         /** Try to connect to or ping the database */
         mxs_connect_result_t rval = mon_connect_to_db(monitor, database);
@@ -60,28 +81,53 @@ void update_server_status(MXS_MONITOR *monitor, MXS_MONITOR_SERVERS *database)
             MYSQL_RES *result;
 
             /** Connection is OK, query for replica status */
-            if (mxs_mysql_query(database->con, "SELECT @@aurora_server_id, server_id FROM "
-                                "information_schema.replica_host_status "
-                                "WHERE session_id = 'MASTER_SESSION_ID'") == 0 &&
+            if (mxs_mysql_query(database->con, AURORA_STATUS_QUERY) == 0 &&
                 (result = mysql_store_result(database->con)))
             {
-                ss_dassert(mysql_field_count(database->con) == 2);
-                MYSQL_ROW row = mysql_fetch_row(result);
+                ss_dassert(mysql_field_count(database->con) == 5);
                 int status = SERVER_SLAVE;
+                MYSQL_ROW row;
 
-                /** The master will return a row with two identical non-NULL fields */
-                if (row[0] && row[1] && strcmp(row[0], row[1]) == 0)
+                while ((row = mysql_fetch_row(result)))
                 {
-                    status = SERVER_MASTER;
+                    if (row[0] == NULL || row[1] == NULL || strcmp(row[0], row[1]) != 0)
+                    {
+                        /** The row of another instance */
+                        continue;
+                    }
+
+                    /** The master has the master session */
+                    if (row[2] && strcmp(row[2], "MASTER_SESSION_ID") == 0)
+                    {
+                        status = SERVER_MASTER;
+                    }
+
+                    if (row[3])
+                    {
+                        lag_ms = MXS_MIN(strtod(row[3], NULL), INT_MAX);
+                    }
+
+                    if (row[4])
+                    {
+                        cpu = strtod(row[4], NULL);
+                    }
                 }
 
                 server_set_status_nolock(&temp_server, status);
                 mysql_free_result(result);
+
+                if (status == SERVER_MASTER)
+                {
+                    lag_ms = 0;
+                }
             }
             else
             {
                 mon_report_query_error(database);
             }
+
+            mon_update_load_metrics(monitor, database);
+            mon_update_server_variables(monitor, database);
         }
         else
         {
@@ -95,6 +141,15 @@ void update_server_status(MXS_MONITOR *monitor, MXS_MONITOR_SERVERS *database)
             {
                 mon_log_connect_error(database, rval);
             }
+
+            mon_reset_load_metrics(database);
+        }
+
+        set_rlag(database->server, lag_ms);
+
+        if (monitor->load_metrics)
+        {
+            database->server->load_metrics.cpu = cpu;
         }
 
         server_transfer_status(database->server, &temp_server);
@@ -200,9 +255,7 @@ startMonitor(MXS_MONITOR *mon, const MXS_CONFIG_PARAMETER *params)
 
         handle->shutdown = false;
 
-        if (!check_monitor_permissions(mon, "SELECT @@aurora_server_id, server_id FROM "
-                                       "information_schema.replica_host_status "
-                                       "WHERE session_id = 'MASTER_SESSION_ID'"))
+        if (!check_monitor_permissions(mon, AURORA_STATUS_QUERY))
         {
             MXS_ERROR("Failed to start monitor. See earlier errors for more information.");
             auroramon_free(handle);
@@ -110,6 +110,8 @@ MXS_MODULE* MXS_CREATE_MODULE()
                 mxs_monitor_event_enum_values
             },
             {"set_donor_nodes", MXS_MODULE_PARAM_BOOL, "false"},
+            {"detect_flow_control", MXS_MODULE_PARAM_BOOL, "false"},
+            {"max_recv_queue", MXS_MODULE_PARAM_COUNT, "16"},
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -117,6 +119,51 @@ MXS_MODULE* MXS_CREATE_MODULE()
     return &info;
 }
 
+/**
+ * Copy the information of a server
+ *
+ * @param val The information to copy
+ * @return A copy or NULL if memory allocation failed
+ */
+static void* info_copy_func(const void *val)
+{
+    GALERA_SERVER_INFO *new_val = MXS_MALLOC(sizeof(GALERA_SERVER_INFO));
+
+    if (new_val)
+    {
+        *new_val = *(const GALERA_SERVER_INFO*)val;
+    }
+
+    return new_val;
+}
+
+/**
+ * Initialize the information of all the servers
+ *
+ * @param handle   Galera monitor handle
+ * @param database List of monitored databases
+ * @return True on success, false if memory allocation failed
+ */
+static bool init_server_info(GALERA_MONITOR *handle, MXS_MONITOR_SERVERS *database)
+{
+    GALERA_SERVER_INFO info = {0, false};
+
+    while (database)
+    {
+        /** Delete any existing structures and replace them with empty ones */
+        hashtable_delete(handle->server_info, database->server->unique_name);
+
+        if (!hashtable_add(handle->server_info, database->server->unique_name, &info))
+        {
+            return false;
+        }
+
+        database = database->next;
+    }
+
+    return true;
+}
+
 /**
  * Start the instance of the monitor, returning a handle on the monitor.
  *
@@ -139,6 +186,18 @@ startMonitor(MXS_MONITOR *mon, const MXS_CONFIG_PARAMETER *params)
         {
             return NULL;
         }
+        HASHTABLE *server_info = hashtable_alloc(MAX_NUM_SLAVES,
+                                                 hashtable_item_strhash, hashtable_item_strcmp);
+
+        if (server_info == NULL)
+        {
+            MXS_FREE(handle);
+            return NULL;
+        }
+
+        hashtable_memory_fns(server_info, hashtable_item_strdup, info_copy_func,
+                             hashtable_item_free, hashtable_item_free);
+        handle->server_info = server_info;
         handle->shutdown = 0;
         handle->id = MXS_MONITOR_DEFAULT_ID;
         handle->master = NULL;
@@ -153,11 +212,22 @@ startMonitor(MXS_MONITOR *mon, const MXS_CONFIG_PARAMETER *params)
     handle->script = config_copy_string(params, "script");
     handle->events = config_get_enum(params, "events", mxs_monitor_event_enum_values);
     handle->set_donor_nodes = config_get_bool(params, "set_donor_nodes");
+    handle->detect_flow_control = config_get_bool(params, "detect_flow_control");
+    handle->max_recv_queue = config_get_integer(params, "max_recv_queue");
 
     /** SHOW STATUS doesn't require any special permissions */
     if (!check_monitor_permissions(mon, "SHOW STATUS LIKE 'wsrep_local_state'"))
     {
         MXS_ERROR("Failed to start monitor. See earlier errors for more information.");
+        hashtable_free(handle->server_info);
+        MXS_FREE(handle->script);
+        MXS_FREE(handle);
+        return NULL;
+    }
+
+    if (!init_server_info(handle, mon->databases))
+    {
+        hashtable_free(handle->server_info);
         MXS_FREE(handle->script);
         MXS_FREE(handle);
         return NULL;
@@ -201,6 +271,92 @@ diagnostics(DCB *dcb, const MXS_MONITOR *mon)
     dcb_printf(dcb, "Master Role Setting Disabled:\t%s\n",
                handle->disableMasterRoleSetting ? "on" : "off");
     dcb_printf(dcb, "Set wsrep_sst_donor node list:\t%s\n", (handle->set_donor_nodes == 1) ? "on" : "off");
+    dcb_printf(dcb, "Detect flow control:\t%s\n", handle->detect_flow_control ? "on" : "off");
+}
+
+/**
+ * Clear the load score of a node that is not in the cluster
+ *
+ * @param handle    The Galera monitor handle
+ * @param database  The node
+ */
+static void reset_load_score(GALERA_MONITOR *handle, MXS_MONITOR_SERVERS *database)
+{
+    GALERA_SERVER_INFO *info = hashtable_fetch(handle->server_info, database->server->unique_name);
+
+    if (info)
+    {
+        info->fc_sent_set = false;
+    }
+
+    server_set_load_score(database->server, 0);
+}
+
+/**
+ * Update the load score of a joined node
+ *
+ * A node that has sent flow control messages since the previous round is
+ * slowing down the writes of the whole cluster and it gets the maximum load
+ * score until it catches up. Otherwise the score is the length of the receive
+ * queue relative to max_recv_queue.
+ *
+ * @param handle    The Galera monitor handle
+ * @param database  The node
+ */
+static void update_load_score(MXS_MONITOR *mon, GALERA_MONITOR *handle,
+                              MXS_MONITOR_SERVERS *database)
+{
+    GALERA_SERVER_INFO *info = hashtable_fetch(handle->server_info, database->server->unique_name);
+    const char *value;
+    long recv_queue = 0;
+    long fc_sent = -1;
+
+    if ((value = mon_get_status(mon, database, "wsrep_local_recv_queue")))
+    {
+        recv_queue = strtol(value, NULL, 10);
+    }
+
+    if ((value = mon_get_status(mon, database, "wsrep_flow_control_sent")))
+    {
+        fc_sent = strtol(value, NULL, 10);
+    }
+
+    int score = 0;
+
+    if (handle->max_recv_queue > 0)
+    {
+        score = recv_queue >= handle->max_recv_queue ? MXS_SERVER_LOAD_MAX :
+                recv_queue * MXS_SERVER_LOAD_MAX / handle->max_recv_queue;
+    }
+
+    if (info && fc_sent >= 0)
+    {
+        if (info->fc_sent_set && fc_sent > info->fc_sent)
+        {
+            score = MXS_SERVER_LOAD_MAX;
+        }
+
+        info->fc_sent = fc_sent;
+        info->fc_sent_set = true;
+    }
+
+    bool was_overloaded = SERVER_IS_OVERLOADED(database->server);
+    server_set_load_score(database->server, score);
+
+    if (was_overloaded != SERVER_IS_OVERLOADED(database->server))
+    {
+        if (was_overloaded)
+        {
+            MXS_NOTICE("Server [%s]:%d has caught up with the cluster and is used again.",
+                       database->server->name, database->server->port);
+        }
+        else
+        {
+            MXS_NOTICE("Server [%s]:%d is under flow control or has a receive queue of %ld "
+                       "transactions, it is used only if no other server is available.",
+                       database->server->name, database->server->port, recv_queue);
+        }
+    }
 }
 
 /**
@@ -216,7 +372,7 @@ monitorDatabase(MXS_MONITOR *mon, MXS_MONITOR_SERVERS *database)
 {
     GALERA_MONITOR* handle = (GALERA_MONITOR*) mon->handle;
     MYSQL_ROW row;
-    MYSQL_RES *result, *result2;
+    MYSQL_RES *result;
     int isjoined = 0;
     char *server_string;
     SERVER temp_server;
@@ -250,6 +406,8 @@ monitorDatabase(MXS_MONITOR *mon, MXS_MONITOR_SERVERS *database)
         database->server->node_id = -1;
 
         server_transfer_status(database->server, &temp_server);
+        reset_load_score(handle, database);
+        mon_reset_load_metrics(database);
 
         if (mon_status_changed(database) && mon_print_fail_status(database))
         {
@@ -269,105 +427,97 @@ monitorDatabase(MXS_MONITOR *mon, MXS_MONITOR_SERVERS *database)
         server_set_version_string(database->server, server_string);
     }
 
+    /** All the status variables of the node are read with one query */
+    const char *status_names[] =
+    {
+        "wsrep_local_state", "wsrep_local_index", "wsrep_local_recv_queue",
+        "wsrep_flow_control_sent", MXS_MON_LOAD_METRICS_STATUS, NULL
+    };
+
+    if (!mon->load_metrics)
+    {
+        status_names[4] = NULL;
+    }
+
+    mon_fetch_status(mon, database, status_names);
+    mon_update_load_metrics(mon, database);
+    mon_update_server_variables(mon, database);
+
     /* Check if the the Galera FSM shows this node is joined to the cluster */
-    if (mxs_mysql_query(database->con, "SHOW STATUS LIKE 'wsrep_local_state'") == 0
-        && (result = mysql_store_result(database->con)) != NULL)
+    const char *local_state = mon_get_status(mon, database, "wsrep_local_state");
+
+    if (local_state)
     {
-        if (mysql_field_count(database->con) < 2)
+        if (strcmp(local_state, "4") == 0)
         {
-            mysql_free_result(result);
-            MXS_ERROR("Unexpected result for \"SHOW STATUS LIKE 'wsrep_local_state'\". "
-                      "Expected 2 columns. MySQL Version: %s", server_string);
-            return;
+            isjoined = 1;
         }
 
-        while ((row = mysql_fetch_row(result)))
+        /* Check if the node is a donor and is using xtrabackup, in this case it can stay alive */
+        else if (strcmp(local_state, "2") == 0 && handle->availableWhenDonor == 1)
         {
-            if (strcmp(row[1], "4") == 0)
+            if (mxs_mysql_query(database->con, "SHOW VARIABLES LIKE 'wsrep_sst_method'") == 0
+                && (result = mysql_store_result(database->con)) != NULL)
             {
-                isjoined = 1;
-            }
-
-            /* Check if the node is a donor and is using xtrabackup, in this case it can stay alive */
-            else if (strcmp(row[1], "2") == 0 && handle->availableWhenDonor == 1)
-            {
-                if (mxs_mysql_query(database->con, "SHOW VARIABLES LIKE 'wsrep_sst_method'") == 0
-                    && (result2 = mysql_store_result(database->con)) != NULL)
+                if (mysql_field_count(database->con) < 2)
                 {
-                    if (mysql_field_count(database->con) < 2)
-                    {
-                        mysql_free_result(result);
-                        mysql_free_result(result2);
-                        MXS_ERROR("Unexpected result for \"SHOW VARIABLES LIKE "
-                                  "'wsrep_sst_method'\". Expected 2 columns."
-                                  " MySQL Version: %s", server_string);
-                        return;
-                    }
-                    while ((row = mysql_fetch_row(result2)))
-                    {
-                        if (strncmp(row[1], "xtrabackup", 10) == 0)
-                        {
-                            isjoined = 1;
-                        }
-                    }
-                    mysql_free_result(result2);
+                    mysql_free_result(result);
+                    MXS_ERROR("Unexpected result for \"SHOW VARIABLES LIKE "
+                              "'wsrep_sst_method'\". Expected 2 columns."
+                              " MySQL Version: %s", server_string);
+                    return;
                 }
-                else
+                while ((row = mysql_fetch_row(result)))
                 {
-                    mon_report_query_error(database);
+                    if (strncmp(row[1], "xtrabackup", 10) == 0)
+                    {
+                        isjoined = 1;
+                    }
                 }
+                mysql_free_result(result);
+            }
+            else
+            {
+                mon_report_query_error(database);
             }
         }
-        mysql_free_result(result);
-    }
-    else
-    {
-        mon_report_query_error(database);
     }
 
     if (isjoined)
     {
         /* Check the the Galera node index in the cluster */
-        if (mxs_mysql_query(database->con, "SHOW STATUS LIKE 'wsrep_local_index'") == 0
-            && (result = mysql_store_result(database->con)) != NULL)
-        {
-            if (mysql_field_count(database->con) < 2)
-            {
-                mysql_free_result(result);
-                MXS_ERROR("Unexpected result for \"SHOW STATUS LIKE 'wsrep_local_index'\". "
-                          "Expected 2 columns. MySQL Version: %s", server_string);
-                return;
-            }
+        const char *local_index_str = mon_get_status(mon, database, "wsrep_local_index");
 
-            while ((row = mysql_fetch_row(result)))
+        if (local_index_str)
+        {
+            char* endchar;
+            errno = 0;
+            long local_index = strtol(local_index_str, &endchar, 10);
+            if (*endchar != '\0' ||
+                (errno == ERANGE && (local_index == LONG_MAX || local_index == LONG_MIN)))
             {
-                char* endchar;
-                long local_index = strtol(row[1], &endchar, 10);
-                if (*endchar != '\0' ||
-                    (errno == ERANGE && (local_index == LONG_MAX || local_index == LONG_MIN)))
+                /** TODO: Create a mechanism to log warnings on a per server basis */
+                if (warn_erange_on_local_index)
                 {
-                    /** TODO: Create a mechanism to log warnings on a per server basis */
-                    if (warn_erange_on_local_index)
-                    {
-                        MXS_WARNING("Invalid 'wsrep_local_index' on server '%s': %s",
-                                    database->server->unique_name, row[1]);
-                        warn_erange_on_local_index = false;
-                    }
-                    local_index = -1;
+                    MXS_WARNING("Invalid 'wsrep_local_index' on server '%s': %s",
+                                database->server->unique_name, local_index_str);
+                    warn_erange_on_local_index = false;
                 }
-                database->server->node_id = local_index;
+                local_index = -1;
             }
-            mysql_free_result(result);
+            database->server->node_id = local_index;
         }
-        else
+        server_set_status_nolock(&temp_server, SERVER_JOINED);
+
+        if (handle->detect_flow_control)
         {
-            mon_report_query_error(database);
+            update_load_score(mon, handle, database);
         }
-        server_set_status_nolock(&temp_server, SERVER_JOINED);
     }
     else
     {
         server_clear_status_nolock(&temp_server, SERVER_JOINED);
+        reset_load_score(handle, database);
     }
 
     /* clear bits for non member nodes */
@@ -454,9 +604,15 @@ monitorMain(void *arg)
         while (ptr)
         {
             ptr->mon_prev_status = ptr->server->status;
+            ptr = ptr->next;
+        }
 
-            monitorDatabase(mon, ptr);
+        /* monitor all nodes at the same time */
+        mon_probe_servers(mon, monitorDatabase);
 
+        ptr = mon->databases;
+        while (ptr)
+        {
             /* Log server status change */
             if (mon_status_changed(ptr))
             {
@@ -39,9 +39,19 @@
 #include <maxscale/dcb.h>
 #include <maxscale/modinfo.h>
 #include <maxscale/config.h>
+#include <maxscale/hashtable.h>
 
 MXS_BEGIN_DECLS
 
+/**
+ * Per server information of the Galera Monitor
+ */
+typedef struct galera_server_info
+{
+    long fc_sent;      /**< The last value of wsrep_flow_control_sent */
+    bool fc_sent_set;  /**< Whether fc_sent has been read */
+} GALERA_SERVER_INFO;
+
 /**
  * The handle for an instance of a Galera Monitor module
  */
@@ -63,6 +73,10 @@ typedef struct
     uint64_t events; /*< enabled events */
     bool set_donor_nodes; /**< set the wrep_sst_donor variable with an
                            * ordered list of nodes */
+    bool detect_flow_control; /**< Set the load scores of the nodes from
+                               * their flow control and receive queue */
+    int max_recv_queue; /**< Receive queue length of a fully loaded node */
+    HASHTABLE *server_info; /**< Contains the GALERA_SERVER_INFO of the servers */
 } GALERA_MONITOR;
 
 MXS_END_DECLS
@@ -52,6 +52,16 @@
 
 MXS_BEGIN_DECLS
 
+/**
+ * A server in the node index of the MySQL Monitor
+ */
+typedef struct mysql_node_ref
+{
+    long node_id;             /**< The server_id of the server */
+    int pos;                  /**< Position of the server in the list of the monitor */
+    MXS_MONITOR_SERVERS *db;  /**< The server */
+} MYSQL_NODE_REF;
+
 /**
  * The handle for an instance of a MySQL Monitor module
  */
@@ -80,6 +90,14 @@ typedef struct
                                    down before failover is initiated */
     bool allow_cluster_recovery; /**< Allow failed servers to rejoin the cluster */
     bool warn_failover; /**< Log a warning when failover happens */
+    int ping_interval; /**< How often running servers are pinged between the
+                        *   monitoring rounds, in milliseconds, 0 for never */
+    int ping_failures; /**< Number of servers whose last ping failed */
+    bool heartbeat_usec; /**< The heartbeat table has the microsecond timestamps */
+    MYSQL_NODE_REF *nodes; /**< The servers ordered by server_id */
+    long *master_ids; /**< The master server ids of the servers in ascending order */
+    int n_nodes; /**< Number of elements in nodes and master_ids */
+    uint64_t links_hash; /**< Hash of the replication links the node index was built from */
 } MYSQL_MONITOR;
 
 MXS_END_DECLS
@@ -53,6 +53,8 @@
 #include <maxscale/alloc.h>
 #include <maxscale/debug.h>
 #include <maxscale/mysql_utils.h>
+#include <maxscale/atomic.h>
+#include <sys/time.h>
 
 /** Column positions for SHOW SLAVE STATUS */
 #define MYSQL55_STATUS_BINLOG_POS 5
@@ -73,15 +75,20 @@
 #define SLAVE_HOSTS_HOSTNAME 1
 #define SLAVE_HOSTS_PORT 2
 
+/** The longest time a server that stays down goes without a connection attempt */
+#define MYSQLMON_MAX_BACKOFF_MS 30000
+
 static void monitorMain(void *);
 
 static void *startMonitor(MXS_MONITOR *, const MXS_CONFIG_PARAMETER*);
 static void stopMonitor(MXS_MONITOR *);
 static void diagnostics(DCB *, const MXS_MONITOR *);
-static MXS_MONITOR_SERVERS *getServerByNodeId(MXS_MONITOR_SERVERS *, long);
-static MXS_MONITOR_SERVERS *getSlaveOfNodeId(MXS_MONITOR_SERVERS *, long);
+static MXS_MONITOR_SERVERS *getServerByNodeId(MYSQL_MONITOR *, long);
+static bool nodeHasSlave(MYSQL_MONITOR *, long);
+static void update_node_index(MXS_MONITOR *, int);
+static MYSQL_NODE_REF *find_node(MYSQL_MONITOR *, long);
 static MXS_MONITOR_SERVERS *get_replication_tree(MXS_MONITOR *, int);
-static void set_master_heartbeat(MYSQL_MONITOR *, MXS_MONITOR_SERVERS *);
+static void set_master_heartbeat(MXS_MONITOR *, MXS_MONITOR_SERVERS *);
 static void set_slave_heartbeat(MXS_MONITOR *, MXS_MONITOR_SERVERS *);
 static int add_slave_to_master(long *, int, long);
 static bool isMySQLEvent(mxs_monitor_event_t event);
@@ -130,6 +137,7 @@ MXS_MODULE* MXS_CREATE_MODULE()
             {"failcount", MXS_MODULE_PARAM_COUNT, "5"},
             {"allow_cluster_recovery", MXS_MODULE_PARAM_BOOL, "true"},
             {"ignore_external_masters", MXS_MODULE_PARAM_BOOL, "false"},
+            {"ping_interval", MXS_MODULE_PARAM_COUNT, "0"},
             {
                 "script",
                 MXS_MODULE_PARAM_PATH,
@@ -271,9 +279,15 @@ startMonitor(MXS_MONITOR *monitor, const MXS_CONFIG_PARAMETER* params)
         handle->shutdown = 0;
         handle->id = config_get_global_options()->id;
         handle->warn_failover = true;
+        handle->nodes = NULL;
+        handle->master_ids = NULL;
+        handle->n_nodes = 0;
         spinlock_init(&handle->lock);
     }
 
+    /** The servers may have changed while the monitor was stopped */
+    handle->links_hash = 0;
+
     /** This should always be reset to NULL */
     handle->master = NULL;
 
@@ -288,6 +302,17 @@ startMonitor(MXS_MONITOR *monitor, const MXS_CONFIG_PARAMETER* params)
     handle->mysql51_replication = config_get_bool(params, "mysql51_replication");
     handle->script = config_copy_string(params, "script");
     handle->events = config_get_enum(params, "events", mxs_monitor_event_enum_values);
+    handle->ping_interval = config_get_integer(params, "ping_interval");
+    handle->ping_failures = 0;
+    handle->heartbeat_usec = false;
+
+    if (handle->ping_interval > 0 && handle->ping_interval < MXS_MON_BASE_INTERVAL_MS)
+    {
+        MXS_WARNING("[%s] The value of 'ping_interval' is smaller than the minimum "
+                    "of %d milliseconds, using the minimum value.",
+                    monitor->name, MXS_MON_BASE_INTERVAL_MS);
+        handle->ping_interval = MXS_MON_BASE_INTERVAL_MS;
+    }
 
     bool error = false;
 
@@ -610,6 +635,103 @@ static MXS_MONITOR_SERVERS *build_mysql51_replication_tree(MXS_MONITOR *mon)
     return rval;
 }
 
+/**
+ * Store the GTID position of a MariaDB 10 server
+ *
+ * The routing modules use it to find the slaves that have replicated a write.
+ *
+ * @param database The server
+ */
+static void update_gtid_pos(MXS_MONITOR_SERVERS *database)
+{
+    MYSQL_RES *result;
+
+    if (mxs_mysql_query(database->con, "SELECT @@gtid_current_pos") == 0
+        && (result = mysql_store_result(database->con)) != NULL)
+    {
+        MYSQL_ROW row = mysql_fetch_row(result);
+        server_set_gtid_pos(database->server, row ? row[0] : NULL);
+        mysql_free_result(result);
+    }
+    else
+    {
+        server_set_gtid_pos(database->server, NULL);
+        mon_report_query_error(database);
+    }
+}
+
+/**
+ * Check whether a server that is down should be connected to on this round
+ *
+ * The longer a server stays down, the fewer rounds it is tried on: the number
+ * of rounds between the attempts doubles until the attempts are
+ * MYSQLMON_MAX_BACKOFF_MS apart. This keeps the servers that are gone for good
+ * from slowing down the rounds with their connection timeouts.
+ *
+ * @param mon       The monitor
+ * @param database  The server
+ * @return True if the server should be connected to
+ */
+static bool connect_attempt_due(MXS_MONITOR *mon, MXS_MONITOR_SERVERS *database)
+{
+    int max_skip = MXS_MAX(MYSQLMON_MAX_BACKOFF_MS / mon->interval, 1);
+    int skip = 1;
+
+    while (skip < max_skip && skip * 2 <= database->mon_err_count)
+    {
+        skip *= 2;
+    }
+
+    return database->mon_err_count % skip == 0;
+}
+
+/**
+ * Ping a running server on its monitor connection
+ *
+ * @param mon       The monitor
+ * @param database  The server to ping
+ */
+static void
+pingDatabase(MXS_MONITOR *mon, MXS_MONITOR_SERVERS *database)
+{
+    MYSQL_MONITOR* handle = mon->handle;
+
+    if (!SERVER_IN_MAINT(database->server) && SERVER_IS_RUNNING(database->server) &&
+        database->con && mysql_ping(database->con) != 0)
+    {
+        MXS_INFO("Ping of server [%s]:%d failed: %s", database->server->name,
+                 database->server->port, mysql_error(database->con));
+        atomic_add(&handle->ping_failures, 1);
+    }
+}
+
+/**
+ * Ping the running servers if it is time for it
+ *
+ * The ping is a lightweight check done between the monitoring rounds so that
+ * a lost server is noticed without waiting for the next round.
+ *
+ * @param mon       The monitor
+ * @param nrounds   Number of base intervals since the monitor was started
+ * @return True if a running server did not respond and a monitoring round
+ * should be done right away
+ */
+static bool ping_servers_failed(MXS_MONITOR *mon, size_t nrounds)
+{
+    MYSQL_MONITOR* handle = mon->handle;
+
+    if (handle->ping_interval == 0 ||
+        ((nrounds * MXS_MON_BASE_INTERVAL_MS) % handle->ping_interval) >= MXS_MON_BASE_INTERVAL_MS)
+    {
+        return false;
+    }
+
+    handle->ping_failures = 0;
+    mon_probe_servers(mon, pingDatabase);
+
+    return handle->ping_failures > 0;
+}
+
 /**
  * Monitor an individual server
  *
@@ -631,60 +753,71 @@ monitorDatabase(MXS_MONITOR *mon, MXS_MONITOR_SERVERS *database)
         return;
     }
 
+    /** With the fast failure detection, the servers that are down are backed off */
+    if (handle->ping_interval > 0 && SERVER_IS_DOWN(database->server) &&
+        !connect_attempt_due(mon, database))
+    {
+        return;
+    }
+
     /** Store previous status */
     database->mon_prev_status = database->server->status;
 
-    if (database->con == NULL || mysql_ping(database->con) != 0)
+    /** mon_connect_to_db pings the existing connection before reconnecting */
+    mxs_connect_result_t rval = mon_connect_to_db(mon, database);
+
+    if (rval == MONITOR_CONN_OK)
+    {
+        server_clear_status_nolock(database->server, SERVER_AUTH_ERROR);
+        monitor_clear_pending_status(database, SERVER_AUTH_ERROR);
+    }
+    else
     {
-        mxs_connect_result_t rval;
-        if ((rval = mon_connect_to_db(mon, database)) == MONITOR_CONN_OK)
+        /* The current server is not running
+         *
+         * Store server NOT running in server and monitor server pending struct
+         *
+         */
+        if (mysql_errno(database->con) == ER_ACCESS_DENIED_ERROR)
         {
-            server_clear_status_nolock(database->server, SERVER_AUTH_ERROR);
-            monitor_clear_pending_status(database, SERVER_AUTH_ERROR);
+            server_set_status_nolock(database->server, SERVER_AUTH_ERROR);
+            monitor_set_pending_status(database, SERVER_AUTH_ERROR);
         }
-        else
-        {
-            /* The current server is not running
-             *
-             * Store server NOT running in server and monitor server pending struct
-             *
-             */
-            if (mysql_errno(database->con) == ER_ACCESS_DENIED_ERROR)
-            {
-                server_set_status_nolock(database->server, SERVER_AUTH_ERROR);
-                monitor_set_pending_status(database, SERVER_AUTH_ERROR);
-            }
-            server_clear_status_nolock(database->server, SERVER_RUNNING);
-            monitor_clear_pending_status(database, SERVER_RUNNING);
-
-            /* Also clear M/S state in both server and monitor server pending struct */
-            server_clear_status_nolock(database->server, SERVER_SLAVE);
-            server_clear_status_nolock(database->server, SERVER_MASTER);
-            server_clear_status_nolock(database->server, SERVER_RELAY_MASTER);
-            monitor_clear_pending_status(database, SERVER_SLAVE);
-            monitor_clear_pending_status(database, SERVER_MASTER);
-            monitor_clear_pending_status(database, SERVER_RELAY_MASTER);
-
-            /* Clean addition status too */
-            server_clear_status_nolock(database->server, SERVER_SLAVE_OF_EXTERNAL_MASTER);
-            server_clear_status_nolock(database->server, SERVER_STALE_STATUS);
-            server_clear_status_nolock(database->server, SERVER_STALE_SLAVE);
-            monitor_clear_pending_status(database, SERVER_SLAVE_OF_EXTERNAL_MASTER);
-            monitor_clear_pending_status(database, SERVER_STALE_STATUS);
-            monitor_clear_pending_status(database, SERVER_STALE_SLAVE);
-
-            /* Log connect failure only once */
-            if (mon_status_changed(database) && mon_print_fail_status(database))
-            {
-                mon_log_connect_error(database, rval);
-            }
+        server_clear_status_nolock(database->server, SERVER_RUNNING);
+        monitor_clear_pending_status(database, SERVER_RUNNING);
 
-            return;
+        /* Also clear M/S state in both server and monitor server pending struct */
+        server_clear_status_nolock(database->server, SERVER_SLAVE);
+        server_clear_status_nolock(database->server, SERVER_MASTER);
+        server_clear_status_nolock(database->server, SERVER_RELAY_MASTER);
+        monitor_clear_pending_status(database, SERVER_SLAVE);
+        monitor_clear_pending_status(database, SERVER_MASTER);
+        monitor_clear_pending_status(database, SERVER_RELAY_MASTER);
+
+        /* Clean addition status too */
+        server_clear_status_nolock(database->server, SERVER_SLAVE_OF_EXTERNAL_MASTER);
+        server_clear_status_nolock(database->server, SERVER_STALE_STATUS);
+        server_clear_status_nolock(database->server, SERVER_STALE_SLAVE);
+        monitor_clear_pending_status(database, SERVER_SLAVE_OF_EXTERNAL_MASTER);
+        monitor_clear_pending_status(database, SERVER_STALE_STATUS);
+        monitor_clear_pending_status(database, SERVER_STALE_SLAVE);
+
+        mon_reset_load_metrics(database);
+        server_set_gtid_pos(database->server, NULL);
+
+        /* Log connect failure only once */
+        if (mon_status_changed(database) && mon_print_fail_status(database))
+        {
+            mon_log_connect_error(database, rval);
         }
+
+        return;
     }
     /* Store current status in both server and monitor server pending struct */
     server_set_status_nolock(database->server, SERVER_RUNNING);
     monitor_set_pending_status(database, SERVER_RUNNING);
+    mon_update_load_metrics(mon, database);
+    mon_update_server_variables(mon, database);
 
     /* get server version from current server */
     server_version = mysql_get_server_version(database->con);
@@ -737,6 +870,7 @@ monitorDatabase(MXS_MONITOR *mon, MXS_MONITOR_SERVERS *database)
     if (server_version >= 100000)
     {
         monitor_mysql_db(database, serv_info, MYSQL_SERVER_VERSION_100);
+        update_gtid_pos(database);
     }
     else if (server_version >= 5 * 10000 + 5 * 100)
     {
@@ -907,13 +1041,11 @@ void find_graph_cycles(MYSQL_MONITOR *handle, MXS_MONITOR_SERVERS *database, int
         if (graph[i].info->master_id > 0)
         {
             /** Found a connected node */
-            for (int k = 0; k < nservers; k++)
+            MYSQL_NODE_REF *ref = find_node(handle, graph[i].info->master_id);
+
+            if (ref)
             {
-                if (graph[k].info->server_id == graph[i].info->master_id)
-                {
-                    graph[i].parent = &graph[k];
-                    break;
-                }
+                graph[i].parent = &graph[ref->pos];
             }
         }
     }
@@ -1115,7 +1247,8 @@ monitorMain(void *arg)
          */
         if (nrounds != 0 &&
             (((nrounds * MXS_MON_BASE_INTERVAL_MS) % mon->interval) >=
-             MXS_MON_BASE_INTERVAL_MS) && (!mon->server_pending_changes))
+             MXS_MON_BASE_INTERVAL_MS) && (!mon->server_pending_changes) &&
+            !ping_servers_failed(mon, nrounds))
         {
             nrounds += 1;
             continue;
@@ -1136,10 +1269,16 @@ monitorMain(void *arg)
 
             /* copy server status into monitor pending_status */
             ptr->pending_status = ptr->server->status;
+            ptr = ptr->next;
+        }
+
+        /* monitor all nodes at the same time */
+        mon_probe_servers(mon, monitorDatabase);
 
-            /* monitor current node */
-            monitorDatabase(mon, ptr);
+        ptr = mon->databases;
 
+        while (ptr)
+        {
             /* reset the slave list of current node */
             memset(&ptr->server->slaves, 0, sizeof(ptr->server->slaves));
 
@@ -1185,6 +1324,8 @@ monitorMain(void *arg)
             ptr = ptr->next;
         }
 
+        update_node_index(mon, num_servers);
+
         ptr = mon->databases;
         /* if only one server is configured, that's is Master */
         if (num_servers == 1)
@@ -1209,6 +1350,9 @@ monitorMain(void *arg)
             if (handle->mysql51_replication)
             {
                 root_master = build_mysql51_replication_tree(mon);
+
+                /** The master ids are only known after the tree is built */
+                update_node_index(mon, num_servers);
             }
             else
             {
@@ -1232,8 +1376,8 @@ monitorMain(void *arg)
             ss_dassert(serv_info);
 
             if (ptr->server->node_id > 0 && ptr->server->master_id > 0 &&
-                getSlaveOfNodeId(mon->databases, ptr->server->node_id) &&
-                getServerByNodeId(mon->databases, ptr->server->master_id) &&
+                nodeHasSlave(handle, ptr->server->node_id) &&
+                getServerByNodeId(handle, ptr->server->master_id) &&
                 (!handle->multimaster || serv_info->group == 0))
             {
                 /** This server is both a slave and a master i.e. a relay master */
@@ -1397,7 +1541,7 @@ monitorMain(void *arg)
             (SERVER_IS_MASTER(root_master->server) ||
              SERVER_IS_RELAY_SERVER(root_master->server)))
         {
-            set_master_heartbeat(handle, root_master);
+            set_master_heartbeat(mon, root_master);
             ptr = mon->databases;
 
             while (ptr)
@@ -1421,50 +1565,223 @@ monitorMain(void *arg)
     } /*< while (1) */
 }
 
+static int node_ref_cmp(const void *a, const void *b)
+{
+    const MYSQL_NODE_REF *n1 = a;
+    const MYSQL_NODE_REF *n2 = b;
+
+    if (n1->node_id != n2->node_id)
+    {
+        return n1->node_id < n2->node_id ? -1 : 1;
+    }
+
+    /** Servers with the same server_id stay in the order of the list */
+    return n1->pos - n2->pos;
+}
+
+static int long_cmp(const void *a, const void *b)
+{
+    long l1 = *(const long*)a;
+    long l2 = *(const long*)b;
+    return l1 < l2 ? -1 : (l1 > l2 ? 1 : 0);
+}
+
 /**
- * Fetch a MySQL node by node_id
+ * @brief Update the index of the servers that the topology is built with
  *
- * @param ptr           The list of servers to monitor
- * @param node_id   The MySQL server_id to fetch
- * @return      The server with the required server_id
+ * The servers are ordered by their server_id and the master server ids are
+ * collected into a sorted array. This makes each lookup done while the
+ * replication tree is built logarithmic instead of a scan over all servers.
+ * The index is only rebuilt when the server ids or the master ids of the
+ * servers have changed since it was last built.
+ *
+ * @param mon         The monitor
+ * @param num_servers Number of servers in the monitor
  */
-static MXS_MONITOR_SERVERS *
-getServerByNodeId(MXS_MONITOR_SERVERS *ptr, long node_id)
+static void update_node_index(MXS_MONITOR *mon, int num_servers)
 {
-    SERVER *current;
-    while (ptr)
+    MYSQL_MONITOR *handle = (MYSQL_MONITOR*)mon->handle;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (MXS_MONITOR_SERVERS *db = mon->databases; db; db = db->next)
     {
-        current = ptr->server;
-        if (current->node_id == node_id)
+        uintptr_t values[] = {(uintptr_t)db, (uintptr_t)db->server->node_id,
+                              (uintptr_t)db->server->master_id
+                             };
+        const unsigned char *bytes = (const unsigned char*)values;
+
+        for (size_t i = 0; i < sizeof(values); i++)
         {
-            return ptr;
+            hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
         }
-        ptr = ptr->next;
     }
-    return NULL;
+
+    if (hash == handle->links_hash && num_servers == handle->n_nodes)
+    {
+        return;
+    }
+
+    if (num_servers > handle->n_nodes)
+    {
+        handle->nodes = MXS_REALLOC(handle->nodes, num_servers * sizeof(MYSQL_NODE_REF));
+        handle->master_ids = MXS_REALLOC(handle->master_ids, num_servers * sizeof(long));
+        MXS_ABORT_IF_NULL(handle->nodes);
+        MXS_ABORT_IF_NULL(handle->master_ids);
+    }
+
+    int n = 0;
+
+    for (MXS_MONITOR_SERVERS *db = mon->databases; db && n < num_servers; db = db->next)
+    {
+        handle->nodes[n].node_id = db->server->node_id;
+        handle->nodes[n].pos = n;
+        handle->nodes[n].db = db;
+        handle->master_ids[n] = db->server->master_id;
+        n++;
+    }
+
+    qsort(handle->nodes, n, sizeof(MYSQL_NODE_REF), node_ref_cmp);
+    qsort(handle->master_ids, n, sizeof(long), long_cmp);
+    handle->n_nodes = n;
+    handle->links_hash = hash;
 }
 
 /**
- * Fetch a MySQL slave node from a node_id
+ * Find the first server in the node index with a server_id
  *
- * @param ptr           The list of servers to monitor
+ * @param handle  The MySQL Monitor object
+ * @param node_id The server_id to find
+ * @return The first server in the list of the monitor with the server_id or NULL
+ */
+static MYSQL_NODE_REF* find_node(MYSQL_MONITOR *handle, long node_id)
+{
+    int low = 0;
+    int high = handle->n_nodes;
+
+    while (low < high)
+    {
+        int mid = low + (high - low) / 2;
+
+        if (handle->nodes[mid].node_id < node_id)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    return low < handle->n_nodes && handle->nodes[low].node_id == node_id ?
+           &handle->nodes[low] : NULL;
+}
+
+/**
+ * Fetch a MySQL node by node_id
+ *
+ * @param handle    The MySQL Monitor object
  * @param node_id   The MySQL server_id to fetch
- * @return      The slave server of this node_id
+ * @return      The server with the required server_id
  */
 static MXS_MONITOR_SERVERS *
-getSlaveOfNodeId(MXS_MONITOR_SERVERS *ptr, long node_id)
+getServerByNodeId(MYSQL_MONITOR *handle, long node_id)
 {
-    SERVER *current;
-    while (ptr)
+    MYSQL_NODE_REF *ref = find_node(handle, node_id);
+    return ref ? ref->db : NULL;
+}
+
+/**
+ * Check whether a MySQL node has a slave
+ *
+ * @param handle    The MySQL Monitor object
+ * @param node_id   The MySQL server_id of the node
+ * @return      True if a server replicates from this node_id
+ */
+static bool
+nodeHasSlave(MYSQL_MONITOR *handle, long node_id)
+{
+    return bsearch(&node_id, handle->master_ids, handle->n_nodes, sizeof(long), long_cmp) != NULL;
+}
+
+/**
+ * Get the current time in microseconds
+ *
+ * @return Microseconds since the epoch
+ */
+static uint64_t heartbeat_now_usec()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/**
+ * Set the replication lag of a server
+ *
+ * The lag in seconds is only set if it is greater than the monitor
+ * interval, the lag in milliseconds is always set.
+ *
+ * @param mon       The monitor
+ * @param server    The server
+ * @param lag_ms    The lag in milliseconds or MAX_RLAG_NOT_AVAILABLE
+ */
+static void set_rlag(MXS_MONITOR *mon, SERVER *server, int lag_ms)
+{
+    if (lag_ms < 0)
     {
-        current = ptr->server;
-        if (current->master_id == node_id)
+        server->rlag = MAX_RLAG_NOT_AVAILABLE;
+        server->rlag_ms = MAX_RLAG_NOT_AVAILABLE;
+    }
+    else
+    {
+        int lag = lag_ms / 1000;
+        server->rlag = (lag > mon->interval / 1000) ? lag : 0;
+        server->rlag_ms = lag_ms;
+    }
+}
+
+/**
+ * Add the microsecond timestamp column to the heartbeat table
+ *
+ * The tables created by older versions of MaxScale only have the timestamps
+ * in seconds.
+ *
+ * @param handle    The monitor handle
+ * @param database  The master server
+ */
+static void check_heartbeat_usec(MYSQL_MONITOR *handle, MXS_MONITOR_SERVERS *database)
+{
+    MYSQL_RES *result;
+
+    if (mxs_mysql_query(database->con, "SELECT column_name FROM information_schema.columns "
+                        "WHERE table_schema = 'maxscale_schema' AND table_name = 'replication_heartbeat' "
+                        "AND column_name = 'master_timestamp_us'") == 0 &&
+        (result = mysql_store_result(database->con)))
+    {
+        bool found = mysql_num_rows(result) > 0;
+        mysql_free_result(result);
+
+        if (found)
         {
-            return ptr;
+            handle->heartbeat_usec = true;
+        }
+        else if (mxs_mysql_query(database->con, "ALTER TABLE maxscale_schema.replication_heartbeat "
+                                 "ADD COLUMN master_timestamp_us BIGINT UNSIGNED NOT NULL DEFAULT 0") == 0)
+        {
+            MXS_NOTICE("Added the microsecond timestamps to %s.", hb_table_name);
+            handle->heartbeat_usec = true;
+        }
+        else
+        {
+            MXS_ERROR("Error adding the microsecond timestamps to %s, the replication lag "
+                      "is measured in seconds: %s", hb_table_name, mysql_error(database->con));
         }
-        ptr = ptr->next;
     }
-    return NULL;
+    else
+    {
+        MXS_ERROR("Error checking the columns of %s in Master server: %s",
+                  hb_table_name, mysql_error(database->con));
+    }
 }
 
 /*******
@@ -1475,10 +1792,12 @@ getSlaveOfNodeId(MXS_MONITOR_SERVERS *ptr, long node_id)
  * @param handle    The monitor handle
  * @param database      The number database server
  */
-static void set_master_heartbeat(MYSQL_MONITOR *handle, MXS_MONITOR_SERVERS *database)
+static void set_master_heartbeat(MXS_MONITOR *mon, MXS_MONITOR_SERVERS *database)
 {
+    MYSQL_MONITOR *handle = (MYSQL_MONITOR*) mon->handle;
     unsigned long id = handle->id;
     time_t heartbeat;
+    uint64_t heartbeat_us;
     time_t purge_time;
     char heartbeat_insert_query[512] = "";
     char heartbeat_purge_query[512] = "";
@@ -1497,7 +1816,7 @@ static void set_master_heartbeat(MYSQL_MONITOR *handle, MXS_MONITOR_SERVERS *dat
     {
         MXS_ERROR( "Error checking for replication_heartbeat in Master server"
                    ": %s", mysql_error(database->con));
-        database->server->rlag = MAX_RLAG_NOT_AVAILABLE;
+        set_rlag(mon, database->server, MAX_RLAG_NOT_AVAILABLE);
     }
 
     result = mysql_store_result(database->con);
@@ -1520,16 +1839,22 @@ static void set_master_heartbeat(MYSQL_MONITOR *handle, MXS_MONITOR_SERVERS *dat
                             "(maxscale_id INT NOT NULL, "
                             "master_server_id INT NOT NULL, "
                             "master_timestamp INT UNSIGNED NOT NULL, "
+                            "master_timestamp_us BIGINT UNSIGNED NOT NULL DEFAULT 0, "
                             "PRIMARY KEY ( master_server_id, maxscale_id ) ) "
                             "ENGINE=MYISAM DEFAULT CHARSET=latin1"))
         {
             MXS_ERROR("Error creating maxscale_schema.replication_heartbeat "
                       "table in Master server: %s", mysql_error(database->con));
 
-            database->server->rlag = MAX_RLAG_NOT_AVAILABLE;
+            set_rlag(mon, database->server, MAX_RLAG_NOT_AVAILABLE);
         }
     }
 
+    if (!handle->heartbeat_usec)
+    {
+        check_heartbeat_usec(handle, database);
+    }
+
     /* auto purge old values after 48 hours*/
     purge_time = time(0) - (3600 * 48);
 
@@ -1544,20 +1869,31 @@ static void set_master_heartbeat(MYSQL_MONITOR *handle, MXS_MONITOR_SERVERS *dat
                   mysql_error(database->con));
     }
 
-    heartbeat = time(0);
+    heartbeat_us = heartbeat_now_usec();
+    heartbeat = heartbeat_us / 1000000;
 
     /* set node_ts for master as time(0) */
     database->server->node_ts = heartbeat;
 
-    sprintf(heartbeat_insert_query,
-            "UPDATE maxscale_schema.replication_heartbeat SET master_timestamp = %lu WHERE master_server_id = %li AND maxscale_id = %lu",
-            heartbeat, handle->master->server->node_id, id);
+    if (handle->heartbeat_usec)
+    {
+        sprintf(heartbeat_insert_query,
+                "UPDATE maxscale_schema.replication_heartbeat SET master_timestamp = %lu, "
+                "master_timestamp_us = %lu WHERE master_server_id = %li AND maxscale_id = %lu",
+                heartbeat, heartbeat_us, handle->master->server->node_id, id);
+    }
+    else
+    {
+        sprintf(heartbeat_insert_query,
+                "UPDATE maxscale_schema.replication_heartbeat SET master_timestamp = %lu WHERE master_server_id = %li AND maxscale_id = %lu",
+                heartbeat, handle->master->server->node_id, id);
+    }
 
     /* Try to insert MaxScale timestamp into master */
     if (mxs_mysql_query(database->con, heartbeat_insert_query))
     {
 
-        database->server->rlag = MAX_RLAG_NOT_AVAILABLE;
+        set_rlag(mon, database->server, MAX_RLAG_NOT_AVAILABLE);
 
         MXS_ERROR("Error updating maxscale_schema.replication_heartbeat table: [%s], %s",
                   heartbeat_insert_query,
@@ -1567,15 +1903,27 @@ static void set_master_heartbeat(MYSQL_MONITOR *handle, MXS_MONITOR_SERVERS *dat
     {
         if (mysql_affected_rows(database->con) == 0)
         {
-            heartbeat = time(0);
-            sprintf(heartbeat_insert_query,
-                    "REPLACE INTO maxscale_schema.replication_heartbeat (master_server_id, maxscale_id, master_timestamp ) VALUES ( %li, %lu, %lu)",
-                    handle->master->server->node_id, id, heartbeat);
+            heartbeat_us = heartbeat_now_usec();
+            heartbeat = heartbeat_us / 1000000;
+
+            if (handle->heartbeat_usec)
+            {
+                sprintf(heartbeat_insert_query,
+                        "REPLACE INTO maxscale_schema.replication_heartbeat (master_server_id, maxscale_id, "
+                        "master_timestamp, master_timestamp_us ) VALUES ( %li, %lu, %lu, %lu)",
+                        handle->master->server->node_id, id, heartbeat, heartbeat_us);
+            }
+            else
+            {
+                sprintf(heartbeat_insert_query,
+                        "REPLACE INTO maxscale_schema.replication_heartbeat (master_server_id, maxscale_id, master_timestamp ) VALUES ( %li, %lu, %lu)",
+                        handle->master->server->node_id, id, heartbeat);
+            }
 
             if (mxs_mysql_query(database->con, heartbeat_insert_query))
             {
 
-                database->server->rlag = MAX_RLAG_NOT_AVAILABLE;
+                set_rlag(mon, database->server, MAX_RLAG_NOT_AVAILABLE);
 
                 MXS_ERROR("Error inserting into "
                           "maxscale_schema.replication_heartbeat table: [%s], %s",
@@ -1585,7 +1933,7 @@ static void set_master_heartbeat(MYSQL_MONITOR *handle, MXS_MONITOR_SERVERS *dat
             else
             {
                 /* Set replication lag to 0 for the master */
-                database->server->rlag = 0;
+                set_rlag(mon, database->server, 0);
 
                 MXS_DEBUG("heartbeat table inserted data for %s:%i",
                           database->server->name, database->server->port);
@@ -1594,7 +1942,7 @@ static void set_master_heartbeat(MYSQL_MONITOR *handle, MXS_MONITOR_SERVERS *dat
         else
         {
             /* Set replication lag as 0 for the master */
-            database->server->rlag = 0;
+            set_rlag(mon, database->server, 0);
 
             MXS_DEBUG("heartbeat table updated for Master %s:%i",
                       database->server->name, database->server->port);
@@ -1614,7 +1962,6 @@ static void set_slave_heartbeat(MXS_MONITOR* mon, MXS_MONITOR_SERVERS *database)
 {
     MYSQL_MONITOR *handle = (MYSQL_MONITOR*) mon->handle;
     unsigned long id = handle->id;
-    time_t heartbeat;
     char select_heartbeat_query[256] = "";
     MYSQL_ROW row;
     MYSQL_RES *result;
@@ -1626,26 +1973,42 @@ static void set_slave_heartbeat(MXS_MONITOR* mon, MXS_MONITOR_SERVERS *database)
     }
 
     /* Get the master_timestamp value from maxscale_schema.replication_heartbeat table */
+    bool usec = handle->heartbeat_usec;
 
-    sprintf(select_heartbeat_query, "SELECT master_timestamp "
+    sprintf(select_heartbeat_query, "SELECT master_timestamp%s "
             "FROM maxscale_schema.replication_heartbeat "
             "WHERE maxscale_id = %lu AND master_server_id = %li",
-            id, handle->master->server->node_id);
+            usec ? ", master_timestamp_us" : "", id, handle->master->server->node_id);
+
+    int rc = mxs_mysql_query(database->con, select_heartbeat_query);
+
+    if (rc != 0 && usec && mysql_errno(database->con) == ER_BAD_FIELD_ERROR)
+    {
+        /** The slave has not yet replicated the microsecond timestamps */
+        usec = false;
+        sprintf(select_heartbeat_query, "SELECT master_timestamp "
+                "FROM maxscale_schema.replication_heartbeat "
+                "WHERE maxscale_id = %lu AND master_server_id = %li",
+                id, handle->master->server->node_id);
+        rc = mxs_mysql_query(database->con, select_heartbeat_query);
+    }
 
     /* if there is a master then send the query to the slave with master_id */
-    if (handle->master != NULL && (mxs_mysql_query(database->con, select_heartbeat_query) == 0
-                                   && (result = mysql_store_result(database->con)) != NULL))
+    if (handle->master != NULL && (rc == 0 && (result = mysql_store_result(database->con)) != NULL))
     {
         int rows_found = 0;
 
         while ((row = mysql_fetch_row(result)))
         {
             int rlag = MAX_RLAG_NOT_AVAILABLE;
+            uint64_t heartbeat_us;
+            uint64_t slave_read_us;
             time_t slave_read;
 
             rows_found = 1;
 
-            heartbeat = time(0);
+            heartbeat_us = heartbeat_now_usec();
+            errno = 0;
             slave_read = strtoul(row[0], NULL, 10);
 
             if ((errno == ERANGE && (slave_read == LONG_MAX || slave_read == LONG_MIN)) || (errno != 0 &&
@@ -1654,33 +2017,35 @@ static void set_slave_heartbeat(MXS_MONITOR* mon, MXS_MONITOR_SERVERS *database)
                 slave_read = 0;
             }
 
-            if (slave_read)
+            slave_read_us = (uint64_t)slave_read * 1000000;
+
+            /** The rows written by older versions of MaxScale have no microseconds */
+            if (usec && row[1] && strtoull(row[1], NULL, 10) > 0)
+            {
+                slave_read_us = strtoull(row[1], NULL, 10);
+                slave_read = slave_read_us / 1000000;
+            }
+
+            if (slave_read && heartbeat_us >= slave_read_us)
             {
                 /* set the replication lag */
-                rlag = heartbeat - slave_read;
+                rlag = MXS_MIN((heartbeat_us - slave_read_us) / 1000, INT_MAX);
             }
 
             /* set this node_ts as master_timestamp read from replication_heartbeat table */
             database->server->node_ts = slave_read;
 
-            if (rlag >= 0)
-            {
-                /* store rlag only if greater than monitor sampling interval */
-                database->server->rlag = ((unsigned int)rlag > (mon->interval / 1000)) ? rlag : 0;
-            }
-            else
-            {
-                database->server->rlag = MAX_RLAG_NOT_AVAILABLE;
-            }
+            /* the lag in seconds is stored only if greater than monitor sampling interval */
+            set_rlag(mon, database->server, rlag);
 
-            MXS_DEBUG("Slave %s:%i has %i seconds lag",
+            MXS_DEBUG("Slave %s:%i has %i milliseconds lag",
                       database->server->name,
                       database->server->port,
-                      database->server->rlag);
+                      database->server->rlag_ms);
         }
         if (!rows_found)
         {
-            database->server->rlag = MAX_RLAG_NOT_AVAILABLE;
+            set_rlag(mon, database->server, MAX_RLAG_NOT_AVAILABLE);
             database->server->node_ts = 0;
         }
 
@@ -1688,7 +2053,7 @@ static void set_slave_heartbeat(MXS_MONITOR* mon, MXS_MONITOR_SERVERS *database)
     }
     else
     {
-        database->server->rlag = MAX_RLAG_NOT_AVAILABLE;
+        set_rlag(mon, database->server, MAX_RLAG_NOT_AVAILABLE);
         database->server->node_ts = 0;
 
         if (handle->master->server->node_id < 0)
@@ -1751,10 +2116,7 @@ static MXS_MONITOR_SERVERS *get_replication_tree(MXS_MONITOR *mon, int num_serve
         node_id = current->master_id;
         if (node_id < 1)
         {
-            MXS_MONITOR_SERVERS *find_slave;
-            find_slave = getSlaveOfNodeId(mon->databases, current->node_id);
-
-            if (find_slave == NULL)
+            if (!nodeHasSlave(handle, current->node_id))
             {
                 current->depth = -1;
                 ptr = ptr->next;
@@ -1779,7 +2141,7 @@ static MXS_MONITOR_SERVERS *get_replication_tree(MXS_MONITOR *mon, int num_serve
                 root_level = current->depth;
                 handle->master = ptr;
             }
-            backend = getServerByNodeId(mon->databases, node_id);
+            backend = getServerByNodeId(handle, node_id);
 
             if (backend)
             {
@@ -1801,10 +2163,10 @@ static MXS_MONITOR_SERVERS *get_replication_tree(MXS_MONITOR *mon, int num_serve
                 MXS_MONITOR_SERVERS *master;
                 current->depth = depth;
 
-                master = getServerByNodeId(mon->databases, current->master_id);
+                master = getServerByNodeId(handle, current->master_id);
                 if (master && master->server && master->server->node_id > 0)
                 {
-                    add_slave_to_master(master->server->slaves, sizeof(master->server->slaves),
+                    add_slave_to_master(master->server->slaves, MAX_NUM_SLAVES,
                                         current->node_id);
                     master->server->depth = current->depth - 1;
 
@@ -44,6 +44,10 @@
 
 #define ISspace(x) isspace((int)(x))
 #define HTTP_SERVER_STRING "MaxScale(c) v.1.0.0"
+#define HTTP_CONTENT_JSON "application/json"
+/** The metrics URI is scraped by monitoring systems that expect OpenMetrics */
+#define HTTP_METRICS_URI "/metrics"
+#define HTTP_CONTENT_METRICS "application/openmetrics-text; version=1.0.0; charset=utf-8"
 
 static int httpd_read_event(DCB* dcb);
 static int httpd_write_event(DCB *dcb);
@@ -54,7 +58,7 @@ static int httpd_accept(DCB *dcb);
 static int httpd_close(DCB *dcb);
 static int httpd_listen(DCB *dcb, char *config);
 static int httpd_get_line(int sock, char *buf, int size);
-static void httpd_send_headers(DCB *dcb, int final, bool auth_ok);
+static void httpd_send_headers(DCB *dcb, int final, bool auth_ok, const char *content_type);
 static char *httpd_default_auth();
 
 /**
@@ -257,7 +261,8 @@ static int httpd_read_event(DCB* dcb)
      */
 
     /* send all the basic headers and close with \r\n */
-    httpd_send_headers(dcb, 1, auth_ok);
+    httpd_send_headers(dcb, 1, auth_ok,
+                       strcmp(url, HTTP_METRICS_URI) == 0 ? HTTP_CONTENT_METRICS : HTTP_CONTENT_JSON);
 
 #if 0
     /**
@@ -456,7 +461,7 @@ static int httpd_get_line(int sock, char *buf, int size)
 /**
  * HTTPD send basic headers with 200 OK
  */
-static void httpd_send_headers(DCB *dcb, int final, bool auth_ok)
+static void httpd_send_headers(DCB *dcb, int final, bool auth_ok, const char *content_type)
 {
     char date[64] = "";
     const char *fmt = "%a, %d %b %Y %H:%M:%S GMT";
@@ -472,8 +477,8 @@ static void httpd_send_headers(DCB *dcb, int final, bool auth_ok)
                "Server: %s\r\n"
                "Connection: close\r\n"
                "WWW-Authenticate: Basic realm=\"MaxInfo\"\r\n"
-               "Content-Type: application/json\r\n",
-               response, date, HTTP_SERVER_STRING);
+               "Content-Type: %s\r\n",
+               response, date, HTTP_SERVER_STRING, content_type);
 
     /* close the headers */
     if (final)
@@ -70,7 +70,10 @@ static void gw_reply_on_error(DCB *dcb, mxs_auth_state_t state);
 static int gw_read_and_write(DCB *dcb);
 static int gw_decode_mysql_server_handshake(MySQLProtocol *conn, uint8_t *payload);
 static int gw_do_connect_to_backend(char *host, int port, int *fd);
+static int gw_do_connect_to_socket(const char *path, int *fd);
 static void inline close_socket(int socket);
+static GWBUF* gw_create_reset_connection_packet(const char *db);
+static bool server_supports_reset_connection(const SERVER *server);
 static GWBUF *gw_create_change_user_packet(MYSQL_session*  mses,
                                            MySQLProtocol*  protocol);
 static int gw_send_change_user_to_backend(char          *dbname,
@@ -104,7 +107,8 @@ MXS_MODULE* MXS_CREATE_MODULE()
         NULL,                       /* Session                       */
         gw_backend_default_auth,    /* Default authenticator         */
         NULL,                       /* Connection limit reached      */
-        gw_connection_established
+        gw_connection_established,  /* Connection established        */
+        mysql_protocol_free         /* Free protocol object          */
     };
 
     static MXS_MODULE info =
@@ -203,7 +207,8 @@ static int gw_create_backend_connection(DCB *backend_dcb,
 
     /*< if succeed, fd > 0, -1 otherwise */
     /* TODO: Better if function returned a protocol auth state */
-    rv = gw_do_connect_to_backend(server->name, server->port, &fd);
+    rv = server->socket ? gw_do_connect_to_socket(server->socket, &fd) :
+         gw_do_connect_to_backend(server->name, server->port, &fd);
     /*< Assign protocol with backend_dcb */
     backend_dcb->protocol = protocol;
 
@@ -311,6 +316,42 @@ static int gw_do_connect_to_backend(char *host, int port, int *fd)
 
 }
 
+/**
+ * Connect to a backend server on the same host through its Unix domain socket
+ *
+ * The connection completes at once or fails, only the TCP connections can be
+ * pending.
+ *
+ * @param path The Unix domain socket of the server
+ * @param fd   Where the connected socket is stored
+ * @return 0 on success and -1 on failure
+ */
+static int gw_do_connect_to_socket(const char *path, int *fd)
+{
+    struct sockaddr_un serv_addr;
+    int so = open_unix_socket(MXS_SOCKET_NETWORK, &serv_addr, path);
+
+    if (so == -1)
+    {
+        MXS_ERROR("Establishing connection to backend server through %s failed.", path);
+        return -1;
+    }
+
+    if (connect(so, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) != 0)
+    {
+        MXS_ERROR("Failed to connect backend server through %s due to: %d, %s.",
+                  path, errno, mxs_strerror(errno));
+        close(so);
+        return -1;
+    }
+
+    *fd = so;
+    MXS_DEBUG("%lu [gw_do_connect_to_socket] Connected to backend server "
+              "through %s, fd %d.", pthread_self(), path, so);
+
+    return 0;
+}
+
 /**
  * @brief Check if the response contain an error
  *
@@ -461,7 +502,11 @@ gw_read_backend_event(DCB *dcb)
     int rc = 0;
     if (proto->protocol_auth_state == MXS_AUTH_STATE_COMPLETE)
     {
+        /** The packets of the reply are routed one by one, the client
+         * gets all of them in one write */
+        dcb_write_batch_begin();
         rc = gw_read_and_write(dcb);
+        dcb_write_batch_end();
     }
     else
     {
@@ -509,11 +554,21 @@ gw_read_backend_event(DCB *dcb)
 
             if (proto->protocol_auth_state == MXS_AUTH_STATE_COMPLETE)
             {
-                /** Authentication completed successfully */
+                /** Authentication completed successfully, the packets after
+                 * the OK packet are compressed if compression was negotiated */
+                proto->compress = mysql_backend_compression(dcb);
                 GWBUF *localq = dcb->delayq;
                 dcb->delayq = NULL;
 
-                if (localq)
+                if (dcb->flags & DCBF_PREWARM)
+                {
+                    /** The connection was opened to refill the persistent
+                     * pool, closing it puts it into the pool */
+                    ss_dassert(localq == NULL);
+                    gwbuf_free(localq);
+                    dcb_close(dcb);
+                }
+                else if (localq)
                 {
                     /** Send the queued commands to the backend */
                     rc = backend_write_delayqueue(dcb, localq);
@@ -551,6 +606,14 @@ gw_reply_on_error(DCB *dcb, mxs_auth_state_t state)
     MXS_SESSION *session = dcb->session;
     CHK_SESSION(session);
 
+    if (dcb->flags & DCBF_PREWARM)
+    {
+        /** The router does not know about connections that refill the pool */
+        dcb->dcb_errhandle_called = true;
+        dcb_close(dcb);
+        return;
+    }
+
     GWBUF* errbuf = mysql_create_custom_error(1, 0, "Authentication with backend "
                                               "failed. Session will be closed.");
 
@@ -638,6 +701,37 @@ static inline bool not_err_packet(const GWBUF* buffer)
     return GWBUF_DATA(buffer)[4] != MYSQL_REPLY_ERR;
 }
 
+/**
+ * Check whether the replies of a backend can be forwarded to the client
+ * without reading them into MaxScale
+ *
+ * This is only done when the router does not need to see the replies, there
+ * are no filters and no reply is expected by the protocol itself. Neither
+ * connection may use the compressed protocol, as the frames would reach the
+ * client unchanged and the compressed sequence numbers would go out of sync.
+ *
+ * @param dcb Backend DCB
+ * @return True if the data can be moved with dcb_splice
+ */
+static bool reply_passthrough_allowed(DCB *dcb)
+{
+    MXS_SESSION *session = dcb->session;
+    MySQLProtocol *proto = (MySQLProtocol*)dcb->protocol;
+    MySQLProtocol *client = (MySQLProtocol*)session->client_dcb->protocol;
+
+    return (service_get_capabilities(session->service) & RCAP_TYPE_PASSTHROUGH) &&
+           session->service->n_filters == 0 &&
+           session->trace == NULL &&
+           !proto->ignore_reply &&
+           !proto->compress &&
+           !client->compress &&
+           dcb->dcb_readqueue == NULL &&
+           client->n_ps_pending == 0 &&
+           protocol_get_srv_command(proto, false) == MYSQL_COM_UNDEFINED &&
+           session_ok_to_route(dcb) &&
+           dcb_can_splice(dcb, session->client_dcb);
+}
+
 /**
  * @brief With authentication completed, read new data and write to backend
  *
@@ -655,8 +749,16 @@ gw_read_and_write(DCB *dcb)
 
     CHK_SESSION(session);
 
-    /* read available backend data */
-    return_code = dcb_read(dcb, &read_buffer, 0);
+    if (reply_passthrough_allowed(dcb))
+    {
+        /** The data goes straight from the backend socket to the client socket */
+        return_code = dcb_splice(dcb, session->client_dcb);
+    }
+    else
+    {
+        /* read available backend data */
+        return_code = mysql_dcb_read(dcb, &read_buffer, 0);
+    }
 
     if (return_code < 0)
     {
@@ -744,7 +846,42 @@ gw_read_and_write(DCB *dcb)
 
     if (proto->ignore_reply)
     {
-        /** The reply to a COM_CHANGE_USER is in packet */
+        /** Discard the reply to the COM_RESET_CONNECTION that precedes the
+         * COM_INIT_DB */
+        while (proto->reset_replies > 0 && read_buffer)
+        {
+            GWBUF *reply = modutil_get_next_MySQL_packet(&read_buffer);
+            uint8_t result = MYSQL_GET_COMMAND(GWBUF_DATA(reply));
+            proto->reset_replies--;
+
+            if (result != MYSQL_REPLY_OK)
+            {
+                if (result == MYSQL_REPLY_ERR)
+                {
+                    handle_error_response(dcb, reply);
+                }
+
+                MXS_ERROR("COM_RESET_CONNECTION failed, closing connection.");
+                gwbuf_free(reply);
+                gwbuf_free(read_buffer);
+                gwbuf_free(proto->stored_query);
+                proto->stored_query = NULL;
+                proto->ignore_reply = false;
+                proto->reset_replies = 0;
+                poll_fake_hangup_event(dcb);
+                return 0;
+            }
+
+            gwbuf_free(reply);
+        }
+
+        if (read_buffer == NULL)
+        {
+            /** Waiting for the reply to the last command */
+            return 0;
+        }
+
+        /** The reply to a COM_CHANGE_USER or COM_INIT_DB is in packet */
         GWBUF *query = proto->stored_query;
         proto->stored_query = NULL;
         proto->ignore_reply = false;
@@ -1006,18 +1143,40 @@ static int gw_MySQLWrite_backend(DCB *dcb, GWBUF *queue)
             return 1;
         }
 
-        GWBUF *buf = gw_create_change_user_packet(dcb->session->client_dcb->data, dcb->protocol);
+        MYSQL_session *mses = (MYSQL_session*)dcb->session->client_dcb->data;
+        MySQLProtocol *client = (MySQLProtocol*)dcb->session->client_dcb->protocol;
+        GWBUF *buf = NULL;
+
+        /**
+         * The pool only returns connections of the same user. If the session
+         * has a default database and uses the same character set as the
+         * connection, resetting the connection and changing the database is
+         * equivalent to a COM_CHANGE_USER but does not authenticate again.
+         */
+        if (*mses->db && client && client->charset == backend_protocol->charset &&
+            server_supports_reset_connection(dcb->server) &&
+            (buf = gw_create_reset_connection_packet(mses->db)))
+        {
+            backend_protocol->reset_replies = 1;
+        }
+        else
+        {
+            buf = gw_create_change_user_packet(mses, dcb->protocol);
+        }
+
         int rc = 0;
 
-        if (dcb_write(dcb, buf))
+        if (mysql_dcb_write(dcb, buf))
         {
-            MXS_INFO("Sent COM_CHANGE_USER");
+            MXS_INFO("Sent %s", backend_protocol->reset_replies ?
+                     "COM_RESET_CONNECTION" : "COM_CHANGE_USER");
             backend_protocol->ignore_reply = true;
             backend_protocol->stored_query = queue;
             rc = 1;
         }
         else
         {
+            backend_protocol->reset_replies = 0;
             gwbuf_free(queue);
         }
 
@@ -1116,7 +1275,7 @@ static int gw_MySQLWrite_backend(DCB *dcb, GWBUF *queue)
             else
             {
                 /** Write to backend */
-                rc = dcb_write(dcb, queue);
+                rc = mysql_dcb_write(dcb, queue);
             }
         }
         break;
@@ -1186,6 +1345,12 @@ static int gw_error_backend_event(DCB *dcb)
         dcb_close(dcb);
         return 1;
     }
+    if (dcb->flags & DCBF_PREWARM)
+    {
+        dcb->dcb_errhandle_called = true;
+        dcb_close(dcb);
+        return 1;
+    }
     rsession = session->router_session;
     router = session->service->router;
     router_instance = session->service->router_instance;
@@ -1297,6 +1462,13 @@ static int gw_backend_hangup(DCB *dcb)
 
     CHK_SESSION(session);
 
+    if (dcb->flags & DCBF_PREWARM)
+    {
+        dcb->dcb_errhandle_called = true;
+        dcb_close(dcb);
+        goto retblock;
+    }
+
     rsession = session->router_session;
     router = session->service->router;
     router_instance = session->service->router_instance;
@@ -1448,7 +1620,7 @@ static int backend_write_delayqueue(DCB *dcb, GWBUF *buffer)
     }
     else
     {
-        rc = dcb_write(dcb, buffer);
+        rc = mysql_dcb_write(dcb, buffer);
     }
 
     if (rc == 0)
@@ -1876,6 +2048,67 @@ static bool sescmd_response_complete(DCB* dcb)
     return succp;
 }
 
+/**
+ * Check whether the server supports COM_RESET_CONNECTION
+ *
+ * The command was added in MySQL 5.7.3 and MariaDB 10.2.4.
+ *
+ * @param server Server to check
+ * @return True if the version of the server is known and it supports the command
+ */
+static bool server_supports_reset_connection(const SERVER *server)
+{
+    const char *version = server->server_string;
+    bool rval = false;
+
+    if (version)
+    {
+        /** MariaDB 10 prefixes the version with 5.5.5- in the handshake */
+        const char *prefix = "5.5.5-";
+
+        if (strncmp(version, prefix, strlen(prefix)) == 0)
+        {
+            version += strlen(prefix);
+        }
+
+        int major = 0, minor = 0, patch = 0;
+        sscanf(version, "%d.%d.%d", &major, &minor, &patch);
+        int number = major * 10000 + minor * 100 + patch;
+
+        rval = strcasestr(version, "mariadb") ? number >= 100204 : number >= 50703;
+    }
+
+    return rval;
+}
+
+/**
+ * Create a COM_RESET_CONNECTION followed by a COM_INIT_DB
+ *
+ * @param db The default database of the session
+ * @return Buffer with both commands or NULL if memory allocation failed
+ */
+static GWBUF* gw_create_reset_connection_packet(const char *db)
+{
+    size_t dblen = strlen(db);
+    GWBUF *buffer = gwbuf_alloc(MYSQL_HEADER_LEN * 2 + 2 + dblen);
+
+    if (buffer)
+    {
+        uint8_t *data = GWBUF_DATA(buffer);
+        gw_mysql_set_byte3(data, 1);
+        data[3] = 0;
+        data[MYSQL_HEADER_LEN] = MYSQL_COM_RESET_CONNECTION;
+
+        data += MYSQL_HEADER_LEN + 1;
+        gw_mysql_set_byte3(data, 1 + dblen);
+        data[3] = 0;
+        data[MYSQL_HEADER_LEN] = MYSQL_COM_INIT_DB;
+        memcpy(data + MYSQL_HEADER_LEN + 1, db, dblen);
+    }
+
+    return buffer;
+}
+
 /**
  * Create COM_CHANGE_USER packet and store it to GWBUF
  *
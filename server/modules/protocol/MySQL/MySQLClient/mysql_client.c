@@ -116,7 +116,8 @@ MXS_MODULE* MXS_CREATE_MODULE()
         NULL,                                   /* Session                       */
         gw_default_auth,                        /* Default authenticator         */
         gw_connection_limit,                    /* Send error connection limit   */
-        NULL
+        NULL,                                   /* Connection established        */
+        mysql_protocol_free                     /* Free protocol object          */
     };
 
     static MXS_MODULE info =
@@ -201,6 +202,63 @@ static char *gw_default_auth()
     return "MySQLAuth";
 }
 
+/**
+ * Check whether a server supports the MariaDB 10.2 extended capabilities
+ *
+ * @param server The server
+ * @return True if the version string of the server is of MariaDB 10.2 or later
+ */
+static bool server_has_extended_capabilities(SERVER *server)
+{
+    const char *version = server->server_string;
+    int major = 0;
+    int minor = 0;
+
+    if (version == NULL)
+    {
+        return false;
+    }
+
+    /** The replication protocol of MariaDB 10 requires the 5.5.5- prefix */
+    if (strncmp(version, "5.5.5-", 6) == 0)
+    {
+        version += 6;
+    }
+
+    return sscanf(version, "%d.%d", &major, &minor) == 2 &&
+           (major > 10 || (major == 10 && minor >= 2));
+}
+
+/**
+ * Check whether the servers of a service support the extended capabilities
+ *
+ * The capabilities are advertised to the client only if all servers with a
+ * known version support them. A statement that uses them, e.g. a
+ * COM_STMT_BULK_EXECUTE, could otherwise be routed to a server that doesn't.
+ *
+ * @param service The service
+ * @return True if the extended capabilities can be advertised
+ */
+static bool service_has_extended_capabilities(SERVICE *service)
+{
+    bool rval = false;
+
+    for (SERVER_REF *ref = service->dbref; ref; ref = ref->next)
+    {
+        if (ref->active && ref->server->server_string)
+        {
+            if (!server_has_extended_capabilities(ref->server))
+            {
+                return false;
+            }
+
+            rval = true;
+        }
+    }
+
+    return rval;
+}
+
 /**
  * MySQLSendHandshake
  *
@@ -237,13 +295,8 @@ int MySQLSendHandshake(DCB* dcb)
     {
         mysql_server_language = dcb->service->dbref->server->charset;
 
-        if (dcb->service->dbref->server->server_string &&
-            (strstr(dcb->service->dbref->server->server_string, "10.2.") ||
-             strstr(dcb->service->dbref->server->server_string, "10.3.")))
-        {
-            /** The backend servers support the extended capabilities */
-            is_maria = true;
-        }
+        /** The backend servers support the extended capabilities */
+        is_maria = service_has_extended_capabilities(dcb->service);
     }
 
     MySQLProtocol *protocol = DCB_PROTOCOL(dcb, MySQLProtocol);
@@ -355,6 +408,11 @@ int MySQLSendHandshake(DCB* dcb)
         mysql_server_capabilities_one[1] |= (int)GW_MYSQL_CAPABILITIES_SSL >> 8;
     }
 
+    if (dcb->listener && dcb->listener->compression)
+    {
+        mysql_server_capabilities_one[0] |= (uint8_t)GW_MYSQL_CAPABILITIES_COMPRESS;
+    }
+
     memcpy(mysql_handshake_payload, mysql_server_capabilities_one, sizeof(mysql_server_capabilities_one));
     mysql_handshake_payload = mysql_handshake_payload + sizeof(mysql_server_capabilities_one);
 
@@ -409,6 +467,57 @@ int MySQLSendHandshake(DCB* dcb)
     return sizeof(mysql_packet_header) + mysql_payload_size;
 }
 
+/**
+ * Store a prepared statement once the server has replied with its ID
+ *
+ * The reply to a COM_STMT_PREPARE is the first packet written to the client
+ * after the statement is routed, see track_prepared_statement().
+ *
+ * @param dcb   The DCB of the client
+ * @param queue The buffers to be written to the client
+ */
+static void store_prepared_statement(DCB *dcb, GWBUF *queue)
+{
+    MySQLProtocol *proto = (MySQLProtocol*)dcb->protocol;
+
+    if (proto->n_ps_pending == 0)
+    {
+        return;
+    }
+
+    uint8_t data[MYSQL_HEADER_LEN + MYSQL_PS_OK_PAYLOAD_LEN];
+    size_t len = gwbuf_copy_data(queue, 0, sizeof(data), data);
+
+    /** The first packet of a reply has the sequence number 1 */
+    if (len <= MYSQL_HEADER_LEN || MYSQL_GET_PACKET_NO(data) != 1)
+    {
+        return;
+    }
+
+    uint8_t cmd = data[MYSQL_HEADER_LEN];
+
+    if (cmd == MYSQL_REPLY_OK && len == sizeof(data) &&
+        MYSQL_GET_PAYLOAD_LEN(data) == MYSQL_PS_OK_PAYLOAD_LEN &&
+        data[MYSQL_HEADER_LEN + 9] == 0)
+    {
+        if (proto->ps_pending &&
+            !qc_ps_store(dcb->session, gw_mysql_get_byte4(data + MYSQL_PS_ID_OFFSET),
+                         proto->ps_pending))
+        {
+            MXS_ERROR("Failed to store a prepared statement, executions of it "
+                      "are classified without it.");
+        }
+    }
+    else if (cmd != MYSQL_REPLY_ERR)
+    {
+        return;
+    }
+
+    gwbuf_free(proto->ps_pending);
+    proto->ps_pending = NULL;
+    proto->n_ps_pending--;
+}
+
 /**
  * Write function for client DCB: writes data from MaxScale to Client
  *
@@ -417,7 +526,8 @@ int MySQLSendHandshake(DCB* dcb)
  */
 int gw_MySQLWrite_client(DCB *dcb, GWBUF *queue)
 {
-    return dcb_write(dcb, queue);
+    store_prepared_statement(dcb, queue);
+    return mysql_dcb_write(dcb, queue);
 }
 
 /**
@@ -472,7 +582,7 @@ int gw_read_client_event(DCB* dcb)
     {
         max_bytes = 36;
     }
-    return_code = dcb_read(dcb, &read_buffer, max_bytes);
+    return_code = mysql_dcb_read(dcb, &read_buffer, max_bytes);
     if (return_code < 0)
     {
         dcb_close(dcb);
@@ -594,7 +704,9 @@ static void store_client_information(DCB *dcb, GWBUF *buffer)
      * there are extra capabilities stored in the last 4 bytes of the 23 byte filler. */
     if ((proto->client_capabilities & GW_MYSQL_CAPABILITIES_CLIENT_MYSQL) == 0)
     {
-        proto->extra_capabilities = gw_mysql_get_byte4(data + MARIADB_CAP_OFFSET);
+        /** Only the capabilities that were advertised to the client are used */
+        proto->extra_capabilities = gw_mysql_get_byte4(data + MARIADB_CAP_OFFSET) &
+                                    MXS_MARIA_CAP_STMT_BULK_OPERATIONS;
     }
 
     if (len > MYSQL_AUTH_PACKET_BASE_SIZE)
@@ -758,6 +870,10 @@ gw_read_do_authentication(DCB *dcb, GWBUF *read_buffer, int nbytes_read)
                        session->state != SESSION_STATE_DUMMY);
             protocol->protocol_auth_state = MXS_AUTH_STATE_COMPLETE;
             mxs_mysql_send_ok(dcb, next_sequence, 0, NULL);
+
+            /** The packets after the OK packet are compressed if the client asked for it */
+            protocol->compress = dcb->listener && dcb->listener->compression &&
+                                 (protocol->client_capabilities & GW_MYSQL_CAPABILITIES_COMPRESS);
         }
         else
         {
@@ -1489,6 +1605,51 @@ retblock:
     return 1;
 }
 
+/**
+ * Track the binary protocol prepared statements of the client
+ *
+ * A COM_STMT_PREPARE is kept until the server replies with the ID of the
+ * statement, see store_prepared_statement(). The reply can be matched with
+ * the statement only if no other COM_STMT_PREPAREs were sent before it.
+ *
+ * @param dcb    Client DCB
+ * @param buffer Buffer containing a single packet
+ */
+static void track_prepared_statement(DCB* dcb, GWBUF* buffer)
+{
+    MySQLProtocol *proto = (MySQLProtocol*)dcb->protocol;
+    uint8_t data[MYSQL_PS_ID_OFFSET + MYSQL_PS_ID_SIZE];
+    size_t len = gwbuf_copy_data(buffer, 0, sizeof(data), data);
+
+    if (len <= MYSQL_HEADER_LEN)
+    {
+        return;
+    }
+
+    switch (data[MYSQL_HEADER_LEN])
+    {
+    case MYSQL_COM_STMT_PREPARE:
+        gwbuf_free(proto->ps_pending);
+        proto->ps_pending = NULL;
+
+        if (proto->n_ps_pending++ == 0)
+        {
+            proto->ps_pending = gwbuf_clone(buffer);
+        }
+        break;
+
+    case MYSQL_COM_STMT_CLOSE:
+        if (len == sizeof(data))
+        {
+            qc_ps_remove(dcb->session, gw_mysql_get_byte4(data + MYSQL_PS_ID_OFFSET));
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
 /**
  * Update protocol tracking information for an individual statement
  *
@@ -1512,6 +1673,8 @@ void update_current_command(DCB* dcb, GWBUF* buffer)
      * can be a candidate for the connection pool.
      */
     check_pool_candidate(dcb);
+
+    track_prepared_statement(dcb, buffer);
 }
 
 /**
@@ -1543,21 +1706,39 @@ static int route_by_statement(MXS_SESSION* session, uint64_t capabilities, GWBUF
         tmpbuf = tmpbuf->next;
     }
 #endif
+
+    /** Send all the packets that were read at once to the backends */
+    dcb_write_batch_begin();
+
     do
     {
         ss_dassert(GWBUF_IS_TYPE_MYSQL((*p_readbuf)));
 
         /**
          * Collect incoming bytes to a buffer until complete packet has
-         * arrived and then return the buffer.
+         * arrived and then return the buffer. The packet is split off the
+         * read buffers without copying it.
          */
-        // TODO: This should be replaced with modutil_get_next_MySQL_packet.
-        packetbuf = gw_MySQL_get_next_packet(p_readbuf);
+        packetbuf = modutil_get_next_MySQL_packet(p_readbuf);
 
         if (packetbuf != NULL)
         {
             CHK_GWBUF(packetbuf);
             ss_dassert(GWBUF_IS_TYPE_MYSQL(packetbuf));
+
+            /**
+             * A packet with a payload of 0xffffff bytes is continued in the
+             * next packet. The statement is classified by its first packet and
+             * the continuation packets are routed after it as they arrive,
+             * without making them contiguous. Only one packet of the statement
+             * is held in memory at a time.
+             */
+            MySQLProtocol *proto = (MySQLProtocol*)session->client_dcb->protocol;
+            bool continued = proto->large_query;
+            uint8_t header[MYSQL_HEADER_LEN];
+
+            gwbuf_copy_data(packetbuf, 0, MYSQL_HEADER_LEN, header);
+            proto->large_query = MYSQL_GET_PAYLOAD_LEN(header) == GW_MYSQL_MAX_PACKET_LEN;
             /**
              * This means that buffer includes exactly one MySQL
              * statement.
@@ -1575,15 +1756,15 @@ static int route_by_statement(MXS_SESSION* session, uint64_t capabilities, GWBUF
             /**
              * Update the currently command being executed.
              */
-            update_current_command(session->client_dcb, packetbuf);
+            if (!continued)
+            {
+                update_current_command(session->client_dcb, packetbuf);
+            }
 
-            if (rcap_type_required(capabilities, RCAP_TYPE_CONTIGUOUS_INPUT))
+            if (!continued && rcap_type_required(capabilities, RCAP_TYPE_CONTIGUOUS_INPUT))
             {
                 if (!GWBUF_IS_CONTIGUOUS(packetbuf))
                 {
-                    // TODO: As long as gw_MySQL_get_next_packet is used above, the buffer
-                    // TODO: will be contiguous. That function should be replaced with
-                    // TODO: modutil_get_next_MySQL_packet.
                     GWBUF* tmp = gwbuf_make_contiguous(packetbuf);
                     if (tmp)
                     {
@@ -1664,5 +1845,6 @@ static int route_by_statement(MXS_SESSION* session, uint64_t capabilities, GWBUF
     while (rc == 1 && *p_readbuf != NULL);
 
 return_rc:
+    dcb_write_batch_end();
     return rc;
 }
@@ -45,14 +45,25 @@
 #include <maxscale/utils.h>
 #include <maxscale/protocol/mysql.h>
 #include <maxscale/alloc.h>
+#include <maxscale/freelist.h>
 #include <maxscale/log_manager.h>
 #include <netinet/tcp.h>
+#include <zlib.h>
 #include <maxscale/modutil.h>
 
 uint8_t null_client_sha1[MYSQL_SCRAMBLE_LEN] = "";
 
 static server_command_t* server_command_init(server_command_t* srvcmd, mysql_server_cmd_t cmd);
 
+/** Per-thread free lists of protocol objects, created on first use */
+static MXS_FREELIST *protocol_freelist = NULL;
+static pthread_once_t protocol_freelist_once = PTHREAD_ONCE_INIT;
+
+static void mysql_protocol_freelist_init()
+{
+    protocol_freelist = mxs_freelist_create(sizeof(MySQLProtocol), MXS_FREELIST_DEFAULT_MAX);
+}
+
 /**
  * @brief Allocate a new MySQL_session
  * @return New MySQL_session or NULL if memory allocation failed
@@ -89,13 +100,25 @@ MySQLProtocol* mysql_protocol_init(DCB* dcb, int fd)
 {
     MySQLProtocol* p;
 
-    p = (MySQLProtocol *) MXS_CALLOC(1, sizeof(MySQLProtocol));
+    pthread_once(&protocol_freelist_once, mysql_protocol_freelist_init);
+
+    if (protocol_freelist)
+    {
+        p = (MySQLProtocol*)mxs_freelist_alloc(protocol_freelist);
+    }
+    else
+    {
+        p = (MySQLProtocol*)MXS_MALLOC(sizeof(MySQLProtocol));
+    }
+
     ss_dassert(p != NULL);
 
     if (p == NULL)
     {
         goto return_p;
     }
+
+    memset(p, 0, sizeof(MySQLProtocol));
     p->protocol_state = MYSQL_PROTOCOL_ALLOC;
     p->protocol_auth_state = MXS_AUTH_STATE_INIT;
     p->current_command = MYSQL_COM_UNDEFINED;
@@ -105,6 +128,8 @@ MySQLProtocol* mysql_protocol_init(DCB* dcb, int fd)
     p->stored_query = NULL;
     p->extra_capabilities = 0;
     p->ignore_reply = false;
+    p->reset_replies = 0;
+    p->large_query = false;
 #if defined(SS_DEBUG)
     p->protocol_chk_top = CHK_NUM_PROTOCOL;
     p->protocol_chk_tail = CHK_NUM_PROTOCOL;
@@ -118,6 +143,23 @@ return_p:
     return p;
 }
 
+/**
+ * Free a protocol object allocated with mysql_protocol_init
+ *
+ * @param protocol Protocol object to free
+ */
+void mysql_protocol_free(void *protocol)
+{
+    if (protocol_freelist)
+    {
+        mxs_freelist_free(protocol_freelist, protocol);
+    }
+    else
+    {
+        MXS_FREE(protocol);
+    }
+}
+
 /**
  * mysql_protocol_done
  *
@@ -146,6 +188,20 @@ void mysql_protocol_done(DCB* dcb)
         }
 
         gwbuf_free(p->stored_query);
+        gwbuf_free(p->compress_readq);
+        gwbuf_free(p->ps_pending);
+
+        if (p->deflater)
+        {
+            deflateEnd(p->deflater);
+            MXS_FREE(p->deflater);
+        }
+
+        if (p->inflater)
+        {
+            inflateEnd(p->inflater);
+            MXS_FREE(p->inflater);
+        }
 
         p->protocol_state = MYSQL_PROTOCOL_DONE;
     }
@@ -1255,13 +1311,13 @@ load_hashed_password(uint8_t *scramble, uint8_t *payload, uint8_t *passwd)
  * We start by taking the default bitmask and removing any bits not set in
  * the bitmask contained in the connection structure. Then add SSL flag if
  * the connection requires SSL (set from the MaxScale configuration). The
- * compression flag may be set, although compression is NOT SUPPORTED. If a
+ * compression flag is set if the compressed protocol is requested. If a
  * database name has been specified in the function call, the relevant flag
  * is set.
  *
  * @param conn  The MySQLProtocol structure for the connection
  * @param db_specified Whether the connection request specified a database
- * @param compress Whether compression is requested - NOT SUPPORTED
+ * @param compress Whether compression is requested
  * @return Bit mask (32 bits)
  * @note Capability bits are defined in maxscale/protocol/mysql.h
  */
@@ -1281,7 +1337,6 @@ create_capabilities(MySQLProtocol *conn, bool db_specified, bool compress)
         /* final_capabilities |= (uint32_t)GW_MYSQL_CAPABILITIES_SSL_VERIFY_SERVER_CERT; */
     }
 
-    /* Compression is not currently supported */
     if (compress)
     {
         final_capabilities |= (uint32_t)GW_MYSQL_CAPABILITIES_COMPRESS;
@@ -1303,6 +1358,14 @@ create_capabilities(MySQLProtocol *conn, bool db_specified, bool compress)
 
     final_capabilities |= (int)GW_MYSQL_CAPABILITIES_PLUGIN_AUTH;
 
+    if (rcap_type_required(service_get_capabilities(conn->owner_dcb->session->service),
+                           RCAP_TYPE_SESSION_STATE_TRACKING))
+    {
+        /** The client never sees this, the router removes the session
+         * state information from the OK packets */
+        final_capabilities |= (uint32_t)GW_MYSQL_CAPABILITIES_SESSION_TRACK;
+    }
+
     return final_capabilities;
 }
 
@@ -1334,7 +1397,8 @@ mxs_auth_state_t gw_send_backend_auth(DCB *dcb)
     }
 
     MySQLProtocol *conn = (MySQLProtocol*)dcb->protocol;
-    uint32_t capabilities = create_capabilities(conn, (local_session.db && strlen(local_session.db)), false);
+    uint32_t capabilities = create_capabilities(conn, (local_session.db && strlen(local_session.db)),
+                                                mysql_backend_compression(dcb));
     gw_mysql_set_byte4(client_capabilities, capabilities);
 
     /**
@@ -1433,7 +1497,7 @@ int send_mysql_native_password_response(DCB* dcb)
     data[3] = 2; // This is the third packet after the COM_CHANGE_USER
     calculate_hash(proto->scramble, curr_passwd, data + MYSQL_HEADER_LEN);
 
-    return dcb_write(dcb, buffer);
+    return mysql_dcb_write(dcb, buffer);
 }
 
 /**
@@ -1500,6 +1564,17 @@ gw_decode_mysql_server_handshake(MySQLProtocol *conn, uint8_t *payload)
     // 2 bytes shift
     payload += 2;
 
+    /** A MariaDB 10.2 server stores its extended capabilities in the last 4
+     * bytes of the 10 byte filler. Only the ones it supports are sent to it. */
+    if ((mysql_server_capabilities_one & GW_MYSQL_CAPABILITIES_CLIENT_MYSQL) == 0)
+    {
+        conn->extra_capabilities &= gw_mysql_get_byte4(payload + 7);
+    }
+    else
+    {
+        conn->extra_capabilities = 0;
+    }
+
     // get scramble len
     if (payload[0] > 0)
     {
@@ -1597,3 +1672,298 @@ bool mxs_mysql_is_result_set(GWBUF *buffer)
 
     return rval;
 }
+
+bool mysql_backend_compression(DCB *dcb)
+{
+    MySQLProtocol *proto = (MySQLProtocol*)dcb->protocol;
+    return dcb->server->compression &&
+           (proto->server_capabilities & GW_MYSQL_CAPABILITIES_COMPRESS);
+}
+
+/**
+ * Write the header of a compressed packet
+ *
+ * @param buffer Buffer where the header is written
+ * @param compressed_len Length of the payload of the compressed packet
+ * @param seq Sequence number of the compressed packet
+ * @param plain_len Length of the uncompressed payload, 0 if it is not compressed
+ */
+static void write_compressed_header(uint8_t *buffer, size_t compressed_len, uint8_t seq, size_t plain_len)
+{
+    gw_mysql_set_byte3(buffer, compressed_len);
+    buffer[3] = seq;
+    gw_mysql_set_byte3(buffer + 4, plain_len);
+}
+
+/**
+ * Create one compressed packet from the start of a buffer chain
+ *
+ * @param proto Protocol of the connection
+ * @param buffer Buffer chain, @c len bytes are consumed from it
+ * @param len Number of bytes to put into the packet
+ * @return The compressed packet or NULL on memory allocation failure
+ */
+static GWBUF* compress_packet(MySQLProtocol *proto, GWBUF **buffer, size_t len)
+{
+    GWBUF *packet = gwbuf_alloc(MYSQL_COMPRESSED_HEADER_LEN + len);
+
+    if (packet == NULL)
+    {
+        return NULL;
+    }
+
+    uint8_t *payload = GWBUF_DATA(packet) + MYSQL_COMPRESSED_HEADER_LEN;
+    size_t compressed_len = 0;
+
+    if (len >= MYSQL_MIN_COMPRESS_LENGTH && deflateReset(proto->deflater) == Z_OK)
+    {
+        z_stream *zs = proto->deflater;
+        GWBUF *buf = *buffer;
+        size_t left = len;
+        int rc = Z_OK;
+
+        zs->next_out = payload;
+        zs->avail_out = len;
+
+        /** Compress directly from the buffers of the chain */
+        while (rc == Z_OK && zs->avail_out > 0)
+        {
+            size_t n = MXS_MIN(left, GWBUF_LENGTH(buf));
+            zs->next_in = GWBUF_DATA(buf);
+            zs->avail_in = n;
+            left -= n;
+            rc = deflate(zs, left ? Z_NO_FLUSH : Z_FINISH);
+
+            if (left && zs->avail_in == 0)
+            {
+                buf = buf->next;
+            }
+        }
+
+        if (rc == Z_STREAM_END && zs->total_out < len)
+        {
+            compressed_len = zs->total_out;
+        }
+    }
+
+    if (compressed_len)
+    {
+        write_compressed_header(GWBUF_DATA(packet), compressed_len, proto->compress_seq++, len);
+        packet = gwbuf_rtrim(packet, len - compressed_len);
+    }
+    else
+    {
+        /** Sending the data uncompressed is cheaper */
+        gwbuf_copy_data(*buffer, 0, len, payload);
+        write_compressed_header(GWBUF_DATA(packet), len, proto->compress_seq++, 0);
+    }
+
+    *buffer = gwbuf_consume(*buffer, len);
+
+    return packet;
+}
+
+GWBUF* mysql_compress(MySQLProtocol *proto, GWBUF *buffer)
+{
+    if (proto->deflater == NULL)
+    {
+        z_stream *zs = (z_stream*)MXS_CALLOC(1, sizeof(z_stream));
+
+        if (zs == NULL || deflateInit(zs, Z_DEFAULT_COMPRESSION) != Z_OK)
+        {
+            MXS_ERROR("Failed to initialize compression.");
+            MXS_FREE(zs);
+            gwbuf_free(buffer);
+            return NULL;
+        }
+
+        proto->deflater = zs;
+    }
+
+    GWBUF *rval = NULL;
+
+    while (buffer)
+    {
+        size_t len = MXS_MIN(gwbuf_length(buffer), GW_MYSQL_MAX_PACKET_LEN);
+        GWBUF *packet = compress_packet(proto, &buffer, len);
+
+        if (packet == NULL)
+        {
+            gwbuf_free(buffer);
+            gwbuf_free(rval);
+            return NULL;
+        }
+
+        rval = gwbuf_append(rval, packet);
+    }
+
+    return rval;
+}
+
+/**
+ * Decompress the payload of one compressed packet
+ *
+ * @param zs Decompression stream
+ * @param buffer Buffer chain starting with the payload, @c compressed_len
+ *               bytes are consumed from it
+ * @param compressed_len Length of the compressed payload
+ * @param plain_len Length of the data after decompression
+ * @return The decompressed data or NULL on error
+ */
+static GWBUF* decompress_packet(z_stream *zs, GWBUF **buffer, size_t compressed_len, size_t plain_len)
+{
+    GWBUF *packet = gwbuf_alloc(plain_len);
+    size_t left = compressed_len;
+    int rc = Z_DATA_ERROR;
+
+    if (packet && inflateReset(zs) == Z_OK)
+    {
+        zs->next_out = GWBUF_DATA(packet);
+        zs->avail_out = plain_len;
+        rc = Z_OK;
+
+        /** Decompress directly from the buffers of the chain */
+        while (rc == Z_OK && left > 0)
+        {
+            size_t n = MXS_MIN(left, GWBUF_LENGTH(*buffer));
+            zs->next_in = GWBUF_DATA(*buffer);
+            zs->avail_in = n;
+            rc = inflate(zs, Z_NO_FLUSH);
+            *buffer = gwbuf_consume(*buffer, n);
+            left -= n;
+        }
+    }
+
+    *buffer = gwbuf_consume(*buffer, left);
+
+    if (rc != Z_STREAM_END || zs->avail_out != 0)
+    {
+        gwbuf_free(packet);
+        packet = NULL;
+    }
+
+    return packet;
+}
+
+bool mysql_decompress(MySQLProtocol *proto, GWBUF **buffer)
+{
+    GWBUF *raw = gwbuf_append(proto->compress_readq, *buffer);
+    GWBUF *plain = NULL;
+    size_t raw_len = gwbuf_length(raw);
+    uint8_t header[MYSQL_COMPRESSED_HEADER_LEN];
+    bool rval = true;
+
+    proto->compress_readq = NULL;
+
+    while (gwbuf_copy_data(raw, 0, sizeof(header), header) == sizeof(header))
+    {
+        size_t compressed_len = gw_mysql_get_byte3(header);
+        size_t plain_len = gw_mysql_get_byte3(header + 4);
+
+        if (raw_len < sizeof(header) + compressed_len)
+        {
+            /** The packet is not complete */
+            break;
+        }
+
+        raw = gwbuf_consume(raw, sizeof(header));
+        raw_len -= sizeof(header) + compressed_len;
+        proto->compress_seq = header[3] + 1;
+        GWBUF *packet;
+
+        if (plain_len == 0)
+        {
+            /** The payload was sent uncompressed */
+            packet = compressed_len ? gwbuf_split(&raw, compressed_len) : NULL;
+        }
+        else
+        {
+            if (proto->inflater == NULL)
+            {
+                z_stream *zs = (z_stream*)MXS_CALLOC(1, sizeof(z_stream));
+
+                if (zs == NULL || inflateInit(zs) != Z_OK)
+                {
+                    MXS_FREE(zs);
+                    rval = false;
+                    break;
+                }
+
+                proto->inflater = zs;
+            }
+
+            if ((packet = decompress_packet(proto->inflater, &raw, compressed_len, plain_len)) == NULL)
+            {
+                MXS_ERROR("Failed to decompress a compressed packet of %lu bytes.", compressed_len);
+                rval = false;
+                break;
+            }
+        }
+
+        plain = gwbuf_append(plain, packet);
+    }
+
+    if (rval)
+    {
+        proto->compress_readq = raw;
+        *buffer = plain;
+    }
+    else
+    {
+        gwbuf_free(raw);
+        gwbuf_free(plain);
+        *buffer = NULL;
+    }
+
+    return rval;
+}
+
+int mysql_dcb_read(DCB *dcb, GWBUF **head, int maxbytes)
+{
+    MySQLProtocol *proto = (MySQLProtocol*)dcb->protocol;
+
+    if (!proto->compress)
+    {
+        return dcb_read(dcb, head, maxbytes);
+    }
+
+    /** The queued data has already been decompressed, keep it out of the way
+     * while the compressed data is read */
+    GWBUF *plain = gwbuf_append(dcb->dcb_readqueue, dcb->dcb_fakequeue);
+    GWBUF *raw = NULL;
+    dcb->dcb_readqueue = NULL;
+    dcb->dcb_fakequeue = NULL;
+
+    int rc = dcb_read(dcb, &raw, maxbytes);
+
+    if (!mysql_decompress(proto, &raw))
+    {
+        rc = -1;
+    }
+
+    *head = gwbuf_append(*head, gwbuf_append(plain, raw));
+
+    return rc;
+}
+
+int mysql_dcb_write(DCB *dcb, GWBUF *buffer)
+{
+    MySQLProtocol *proto = (MySQLProtocol*)dcb->protocol;
+
+    if (proto->compress)
+    {
+        if (dcb->dcb_role == DCB_ROLE_BACKEND_HANDLER &&
+            MYSQL_GET_PACKET_NO(GWBUF_DATA(buffer)) == 0)
+        {
+            /** The sequence of the compressed packets restarts with each command */
+            proto->compress_seq = 0;
+        }
+
+        if ((buffer = mysql_compress(proto, buffer)) == NULL)
+        {
+            return 0;
+        }
+    }
+
+    return dcb_write(dcb, buffer);
+}
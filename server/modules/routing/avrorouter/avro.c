@@ -79,6 +79,7 @@ static void clientReply(MXS_ROUTER *instance, MXS_ROUTER_SESSION *router_session
 static void errorReply(MXS_ROUTER *instance, MXS_ROUTER_SESSION *router_session, GWBUF *message,
                        DCB *backend_dcb, mxs_error_action_t action, bool *succp);
 static uint64_t getCapabilities(MXS_ROUTER* instance);
+static void processFinish(void);
 extern int MaxScaleUptime();
 extern void avro_get_used_tables(AVRO_INSTANCE *router, DCB *dcb);
 void converter_func(void* data);
@@ -91,12 +92,47 @@ static bool ensure_dir_ok(const char* path, int mode);
 bool avro_save_conversion_state(AVRO_INSTANCE *router);
 static void stats_func(void *);
 void avro_index_file(AVRO_INSTANCE *router, const char* path);
-void avro_update_index(AVRO_INSTANCE* router);
 static bool conversion_task_ctl(AVRO_INSTANCE *inst, bool start);
 
 static SPINLOCK instlock;
 static AVRO_INSTANCE *instances;
 
+/** The Avro data block codecs, the names are the ones Avro C uses */
+static const MXS_ENUM_VALUE codec_values[] =
+{
+    {"null",    0},
+    {"deflate", 1},
+    {"snappy",  2},
+    {NULL}
+};
+
+/** The Parquet page codecs, the value tells whether the pages are compressed */
+static const MXS_ENUM_VALUE parquet_codec_values[] =
+{
+    {"uncompressed", 0},
+    {"gzip",         1},
+    {NULL}
+};
+
+/**
+ * @brief Find a codec by name
+ *
+ * @param name Name of the codec
+ * @return The static name of the codec or NULL if the codec is not supported
+ */
+static const char* avro_codec_name(const char *name)
+{
+    for (int i = 0; codec_values[i].name; i++)
+    {
+        if (strcmp(codec_values[i].name, name) == 0)
+        {
+            return codec_values[i].name;
+        }
+    }
+
+    return NULL;
+}
+
 bool avro_handle_convert(const MODULECMD_ARG *args)
 {
     bool rval = false;
@@ -174,11 +210,24 @@ static bool avro_handle_purge(const MODULECMD_ARG *args)
     // First stop the conversion service
     conversion_task_ctl(inst, false);
 
+    // The schemas of the deleted files must not be sent to new clients
+    avro_schema_cache_invalidate(inst, NULL);
+
+    // Nor the data blocks of the deleted files
+    avro_tail_clear(inst);
+    avro_block_cache_clear(inst);
+
+    // The Parquet files are closed so that they can be deleted
+    avro_parquet_close_all(inst);
+
     // Then delete the files
     return do_unlink("%s/%s", inst->avrodir, AVRO_PROGRESS_FILE) && // State file
            do_unlink("/%s/%s", inst->avrodir, avro_index_name) &&   // Index database
+           do_unlink_with_pattern("/%s/%s-*", inst->avrodir, avro_index_name) && // Its write-ahead log
            do_unlink_with_pattern("/%s/*.avro", inst->avrodir) &&   // .avro files
-           do_unlink_with_pattern("/%s/*.avsc", inst->avrodir);     // .avsc files
+           do_unlink_with_pattern("/%s/*.avro"AVRO_BLOCK_INDEX_SUFFIX, inst->avrodir) && // Their block indexes
+           do_unlink_with_pattern("/%s/*.avsc", inst->avrodir) &&   // .avsc files
+           do_unlink_with_pattern("/%s/*.parquet", inst->avrodir);  // .parquet files
 }
 
 /**
@@ -233,7 +282,7 @@ MXS_MODULE* MXS_CREATE_MODULE()
         "V1.0.0",
         &MyObject,
         NULL, /* Process init. */
-        NULL, /* Process finish. */
+        processFinish,
         NULL, /* Thread init. */
         NULL, /* Thread finish. */
         {
@@ -255,6 +304,32 @@ MXS_MODULE* MXS_CREATE_MODULE()
             {"group_trx", MXS_MODULE_PARAM_COUNT, "1"},
             {"start_index", MXS_MODULE_PARAM_COUNT, "1"},
             {"block_size", MXS_MODULE_PARAM_COUNT, "0"},
+            {"conversion_threads", MXS_MODULE_PARAM_COUNT, "0"},
+            {"batch_rows", MXS_MODULE_PARAM_COUNT, "1000"},
+            {"batch_bytes", MXS_MODULE_PARAM_COUNT, "65536"},
+            {"kafka_broker", MXS_MODULE_PARAM_STRING},
+            {"kafka_topic_prefix", MXS_MODULE_PARAM_STRING, ""},
+            {"binlog_feed", MXS_MODULE_PARAM_BOOL, "true"},
+            {"tail_size", MXS_MODULE_PARAM_SIZE, "1M"},
+            {"block_cache_size", MXS_MODULE_PARAM_SIZE, "0"},
+            {"block_cache_ttl", MXS_MODULE_PARAM_COUNT, "0"},
+            {"parquet", MXS_MODULE_PARAM_BOOL, "false"},
+            {"parquet_row_group_rows", MXS_MODULE_PARAM_COUNT, "100000"},
+            {"parquet_row_group_time", MXS_MODULE_PARAM_COUNT, "60"},
+            {
+                "parquet_codec",
+                MXS_MODULE_PARAM_ENUM,
+                "gzip",
+                MXS_MODULE_OPT_NONE,
+                parquet_codec_values
+            },
+            {
+                "codec",
+                MXS_MODULE_PARAM_ENUM,
+                "null",
+                MXS_MODULE_OPT_NONE,
+                codec_values
+            },
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -349,7 +424,13 @@ static bool conversion_task_ctl(AVRO_INSTANCE *inst, bool start)
         /** Remove old task and create a new one */
         hktask_remove(tasknm);
 
-        if (!start || hktask_add(tasknm, converter_func, inst, inst->task_delay))
+        if (inst->feed)
+        {
+            /** The conversion thread of the binlog feed converts the events */
+            avro_feed_ctl(inst, start);
+            rval = true;
+        }
+        else if (!start || hktask_add(tasknm, converter_func, inst, inst->task_delay))
         {
             rval = true;
         }
@@ -477,6 +558,20 @@ createInstance(SERVICE *service, char **options)
     inst->trx_target = config_get_integer(params, "group_trx");
     int first_file = config_get_integer(params, "start_index");
     inst->block_size = config_get_integer(params, "block_size");
+    inst->n_workers = config_get_integer(params, "conversion_threads");
+    inst->codec = avro_codec_name(config_get_string(params, "codec"));
+    inst->batch_rows = config_get_integer(params, "batch_rows");
+    inst->batch_bytes = config_get_integer(params, "batch_bytes");
+    inst->kafka_broker = config_copy_string(params, "kafka_broker");
+    inst->kafka_topic_prefix = MXS_STRDUP_A(config_get_string(params, "kafka_topic_prefix"));
+    inst->use_feed = config_get_bool(params, "binlog_feed");
+    inst->tail_size = config_get_size(params, "tail_size");
+    inst->block_cache_size = config_get_size(params, "block_cache_size");
+    inst->block_cache_ttl = config_get_integer(params, "block_cache_ttl");
+    inst->parquet = config_get_bool(params, "parquet");
+    inst->parquet_group_rows = config_get_integer(params, "parquet_row_group_rows");
+    inst->parquet_group_time = config_get_integer(params, "parquet_row_group_time");
+    inst->parquet_gzip = config_get_enum(params, "parquet_codec", parquet_codec_values);
 
     MXS_CONFIG_PARAMETER *param = config_get_param(params, "source");
     inst->gtid.domain = 0;
@@ -499,6 +594,7 @@ createInstance(SERVICE *service, char **options)
                 MXS_NOTICE("[%s] Using configuration options from service '%s'.",
                            service->name, source->name);
                 read_source_service_options(inst, (const char**)source->routerOptions);
+                inst->source = source;
             }
             else
             {
@@ -561,6 +657,72 @@ createInstance(SERVICE *service, char **options)
                 {
                     inst->block_size = atoi(value);
                 }
+                else if (strcmp(options[i], "conversion_threads") == 0)
+                {
+                    inst->n_workers = atoi(value);
+                }
+                else if (strcmp(options[i], "batch_rows") == 0)
+                {
+                    inst->batch_rows = atoi(value);
+                }
+                else if (strcmp(options[i], "batch_bytes") == 0)
+                {
+                    inst->batch_bytes = atoi(value);
+                }
+                else if (strcmp(options[i], "kafka_broker") == 0)
+                {
+                    MXS_FREE(inst->kafka_broker);
+                    inst->kafka_broker = MXS_STRDUP_A(value);
+                }
+                else if (strcmp(options[i], "kafka_topic_prefix") == 0)
+                {
+                    MXS_FREE(inst->kafka_topic_prefix);
+                    inst->kafka_topic_prefix = MXS_STRDUP_A(value);
+                }
+                else if (strcmp(options[i], "tail_size") == 0)
+                {
+                    inst->tail_size = strtoull(value, NULL, 10);
+                }
+                else if (strcmp(options[i], "block_cache_size") == 0)
+                {
+                    inst->block_cache_size = strtoull(value, NULL, 10);
+                }
+                else if (strcmp(options[i], "block_cache_ttl") == 0)
+                {
+                    inst->block_cache_ttl = atoi(value);
+                }
+                else if (strcmp(options[i], "parquet") == 0)
+                {
+                    inst->parquet = config_truth_value(value);
+                }
+                else if (strcmp(options[i], "parquet_row_group_rows") == 0)
+                {
+                    inst->parquet_group_rows = atoi(value);
+                }
+                else if (strcmp(options[i], "parquet_row_group_time") == 0)
+                {
+                    inst->parquet_group_time = atoi(value);
+                }
+                else if (strcmp(options[i], "parquet_codec") == 0)
+                {
+                    if (strcmp(value, "gzip") == 0 || strcmp(value, "uncompressed") == 0)
+                    {
+                        inst->parquet_gzip = strcmp(value, "gzip") == 0;
+                    }
+                    else
+                    {
+                        MXS_ERROR("Unknown Parquet codec: '%s'", value);
+                        err = true;
+                    }
+                }
+                else if (strcmp(options[i], "codec") == 0)
+                {
+                    if ((inst->codec = avro_codec_name(value)) == NULL)
+                    {
+                        MXS_ERROR("Unknown Avro codec: '%s'", value);
+                        err = true;
+                    }
+                }
                 else
                 {
                     MXS_WARNING("Unknown router option: '%s'", options[i]);
@@ -642,20 +804,31 @@ createInstance(SERVICE *service, char **options)
                   sqlite3_errmsg(inst->sqlite_handle));
         err = true;
     }
-    else if (!create_tables(inst->sqlite_handle))
+    else if (!create_tables(inst->sqlite_handle) || !avro_index_init(inst) ||
+             !avro_schema_cache_init(inst) || !avro_kafka_init(inst) ||
+             !avro_parquet_init(inst) || !avro_tail_init(inst) ||
+             !avro_block_cache_init(inst))
     {
         err = true;
     }
 
     if (err)
     {
+        avro_kafka_free(inst);
+        avro_parquet_close_all(inst);
+        avro_index_free(inst);
         sqlite3_close_v2(inst->sqlite_handle);
         hashtable_free(inst->table_maps);
         hashtable_free(inst->open_tables);
         hashtable_free(inst->created_tables);
+        hashtable_free(inst->schema_cache);
+        avro_tail_free(inst);
+        avro_block_cache_free(inst);
         MXS_FREE(inst->avrodir);
         MXS_FREE(inst->binlogdir);
         MXS_FREE(inst->fileroot);
+        MXS_FREE(inst->kafka_broker);
+        MXS_FREE(inst->kafka_topic_prefix);
         MXS_FREE(inst);
         return NULL;
     }
@@ -681,6 +854,12 @@ createInstance(SERVICE *service, char **options)
     hktask_add(task_name, stats_func, inst, AVRO_STATS_FREQ);
      */
 
+    if (!avro_workers_start(inst))
+    {
+        MXS_WARNING("[%s] No conversion threads could be started, the rows are "
+                    "converted by the conversion task.", service->name);
+    }
+
     /* Start the scan, read, convert AVRO task */
     conversion_task_ctl(inst, true);
 
@@ -732,6 +911,13 @@ newSession(MXS_ROUTER *instance, MXS_SESSION *session)
 
     client->connect_time = time(0);
     client->last_sent_pos = 0;
+    client->flow_control = false;
+    client->credit = 0;
+    memset(&client->frame, 0, sizeof(client->frame));
+    client->columns = NULL;
+    client->where = NULL;
+    client->filter = NULL;
+    client->frame_rows = 0;
     memset(&client->gtid, 0, sizeof(client->gtid));
     memset(&client->gtid_start, 0, sizeof(client->gtid_start));
 
@@ -783,7 +969,13 @@ static void freeSession(MXS_ROUTER* router_instance, MXS_ROUTER_SESSION* router_
     ss_dassert(prev_val > 0);
 
     free(client->uuid);
+    maxavro_text_free(&client->frame);
+    maxavro_filter_free(client->filter);
+    MXS_FREE(client->columns);
+    MXS_FREE(client->where);
     maxavro_file_close(client->file_handle);
+    gwbuf_free(client->tail_block);
+    avro_block_cache_release(client->router, client->cached_block);
     sqlite3_close_v2(client->sqlite_handle);
 
     /*
@@ -927,6 +1119,10 @@ diagnostics(MXS_ROUTER *router, DCB *dcb)
                router_inst->avrodir, AVRO_PROGRESS_FILE);
     dcb_printf(dcb, "\tAVRO files directory:                %s\n",
                router_inst->avrodir);
+    dcb_printf(dcb, "\tAVRO data block codec:               %s\n",
+               router_inst->codec);
+    dcb_printf(dcb, "\tJSON rows per write:                 %lu (max %lu bytes)\n",
+               router_inst->batch_rows, router_inst->batch_bytes);
 
     localtime_r(&router_inst->stats.lastReply, &tm);
     asctime_r(&tm, buf);
@@ -949,6 +1145,25 @@ diagnostics(MXS_ROUTER *router, DCB *dcb)
     avro_get_used_tables(router_inst, dcb);
     dcb_printf(dcb, "\n");
 
+    if (router_inst->n_workers > 0)
+    {
+        dcb_printf(dcb, "\tConversion threads:                  %d\n",
+                   router_inst->n_workers);
+
+        for (int j = 0; j < router_inst->n_workers; j++)
+        {
+            dcb_printf(dcb, "\t\tThread %-3d row events converted: %lu, queued: %d\n",
+                       j, router_inst->workers[j].n_events,
+                       router_inst->workers[j].n_queued);
+        }
+    }
+
+    avro_kafka_diagnostics(router_inst, dcb);
+    avro_parquet_diagnostics(router_inst, dcb);
+    avro_tail_diagnostics(router_inst, dcb);
+    avro_block_cache_diagnostics(router_inst, dcb);
+    avro_feed_diagnostics(router_inst, dcb);
+
     dcb_printf(dcb, "\tNumber of AVRO clients:              %u\n",
                router_inst->stats.n_clients);
 
@@ -995,6 +1210,11 @@ diagnostics(MXS_ROUTER *router, DCB *dcb)
                        session->gtid.domain, session->gtid.server_id,
                        session->gtid.seq);
 
+            if (session->flow_control)
+            {
+                dcb_printf(dcb, "\t\tRow credit:                  %lu\n", session->credit);
+            }
+
             // TODO: Add real value for this
             //dcb_printf(dcb, "\t\tAvro Transaction ID:         %u\n", 0);
             // TODO: Add real value for this
@@ -1081,6 +1301,21 @@ static uint64_t getCapabilities(MXS_ROUTER* instance)
     return RCAP_TYPE_NO_RSESSION;
 }
 
+/**
+ * Called at shutdown, writes the rows that are buffered for the Parquet files
+ */
+static void processFinish(void)
+{
+    spinlock_acquire(&instlock);
+
+    for (AVRO_INSTANCE *inst = instances; inst; inst = inst->next)
+    {
+        avro_parquet_close_all(inst);
+    }
+
+    spinlock_release(&instlock);
+}
+
 /**
  * The stats gathering function called from the housekeeper so that we
  * can get timed averages of binlog records shippped
@@ -1120,14 +1355,19 @@ stats_func(void *inst)
 */
 
 /**
- * Conversion task: MySQL binlogs to AVRO files
+ * @brief Convert the binlog events that have not yet been converted
+ *
+ * @param router    Avro router instance
+ * @param converted Set to true if any events were converted
+ * @return How the last processed binlog file ended
  */
-void converter_func(void* data)
+avro_binlog_end_t avro_convert_binlogs(AVRO_INSTANCE *router, bool *converted)
 {
-    AVRO_INSTANCE* router = (AVRO_INSTANCE*) data;
     bool ok = true;
     avro_binlog_end_t binlog_end = AVRO_OK;
 
+    *converted = false;
+
     while (!router->service->svc_do_shutdown && ok && binlog_end == AVRO_OK)
     {
         uint64_t start_pos = router->current_pos;
@@ -1140,10 +1380,13 @@ void converter_func(void* data)
 
             if (router->current_pos != start_pos || strcmp(binlog_name, router->binlog_name) != 0)
             {
-                /** We processed some data, reset the conversion task delay */
-                router->task_delay = 1;
+                /** We processed some data */
+                *converted = true;
+            }
 
-                /** Update the GTID index */
+            /** Update the GTID index in batches */
+            if (avro_index_due(router))
+            {
                 avro_update_index(router);
             }
 
@@ -1156,10 +1399,40 @@ void converter_func(void* data)
     }
 
     /** We reached end of file, flush unwritten records to disk */
-    if (router->task_delay == 1)
+    if (*converted)
     {
+        avro_workers_drain(router);
         avro_flush_all_tables(router, AVROROUTER_FLUSH);
+        avro_kafka_flush(router);
+        avro_parquet_flush(router);
         avro_save_conversion_state(router);
+        router->index_rows += router->row_count;
+    }
+
+    return binlog_end;
+}
+
+/**
+ * Conversion task: MySQL binlogs to AVRO files
+ */
+void converter_func(void* data)
+{
+    AVRO_INSTANCE* router = (AVRO_INSTANCE*) data;
+
+    if (avro_feed_start(router))
+    {
+        /** The conversion thread of the binlog feed takes over */
+        conversion_task_ctl(router, true);
+        return;
+    }
+
+    bool converted;
+    avro_binlog_end_t binlog_end = avro_convert_binlogs(router, &converted);
+
+    if (converted)
+    {
+        /** Reset the conversion task delay */
+        router->task_delay = 1;
     }
 
     if (binlog_end == AVRO_LAST_FILE)
@@ -0,0 +1,339 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file avro_block_cache.c - Data blocks shared by the clients of a table
+ *
+ * The clients that stream the same table read the same data blocks. A block
+ * that one client has read is kept in the cache with the rows of the block
+ * already converted into JSON so that the other clients only copy the rows
+ * into their frames. The clients that stream native Avro send the block as is.
+ *
+ * The cache holds at most block_cache_size bytes. The least recently used
+ * blocks are evicted first and, if block_cache_ttl is set, a block is evicted
+ * once it has been in the cache for that many seconds. A client holds a
+ * reference to a block while it sends its rows, an evicted block is freed
+ * when the last reference is released.
+ */
+
+#include "avrorouter.h"
+
+#include <maxscale/alloc.h>
+
+static void cached_block_free(AVRO_CACHED_BLOCK *block)
+{
+    gwbuf_free(block->binary);
+    MXS_FREE(block->json);
+    MXS_FREE(block->row_end);
+    MXS_FREE(block->gtid);
+    MXS_FREE(block->key);
+    MXS_FREE(block);
+}
+
+/**
+ * @brief Remove a block from the cache
+ *
+ * The caller must hold the cache lock.
+ *
+ * @param router Avro router instance
+ * @param block  Block to remove
+ */
+static void cache_remove(AVRO_INSTANCE *router, AVRO_CACHED_BLOCK *block)
+{
+    hashtable_delete(router->block_cache, block->key);
+
+    if (block->prev)
+    {
+        block->prev->next = block->next;
+    }
+    else
+    {
+        router->block_cache_newest = block->next;
+    }
+
+    if (block->next)
+    {
+        block->next->prev = block->prev;
+    }
+    else
+    {
+        router->block_cache_oldest = block->prev;
+    }
+
+    block->prev = block->next = NULL;
+    block->cached = false;
+    router->block_cache_used -= block->size;
+
+    if (block->refcount == 0)
+    {
+        cached_block_free(block);
+    }
+}
+
+/**
+ * @brief Make a block the most recently used one
+ *
+ * The caller must hold the cache lock.
+ */
+static void cache_push(AVRO_INSTANCE *router, AVRO_CACHED_BLOCK *block)
+{
+    block->prev = NULL;
+    block->next = router->block_cache_newest;
+
+    if (block->next)
+    {
+        block->next->prev = block;
+    }
+    else
+    {
+        router->block_cache_oldest = block;
+    }
+
+    router->block_cache_newest = block;
+}
+
+static bool is_expired(AVRO_INSTANCE *router, AVRO_CACHED_BLOCK *block, time_t now)
+{
+    return router->block_cache_ttl > 0 && now - block->added >= router->block_cache_ttl;
+}
+
+/**
+ * @brief Evict the expired blocks and the blocks that do not fit
+ *
+ * The caller must hold the cache lock.
+ *
+ * @param router Avro router instance
+ * @param needed Bytes that must fit into the cache
+ */
+static void cache_evict(AVRO_INSTANCE *router, size_t needed)
+{
+    time_t now = time(NULL);
+    AVRO_CACHED_BLOCK *block;
+
+    while ((block = router->block_cache_oldest) &&
+           (router->block_cache_used + needed > router->block_cache_size ||
+            is_expired(router, block, now)))
+    {
+        cache_remove(router, block);
+        router->block_cache_evictions++;
+    }
+}
+
+static HASHTABLE* block_cache_alloc()
+{
+    /** The keys are owned by the blocks */
+    return hashtable_alloc(1000, hashtable_item_strhash, hashtable_item_strcmp);
+}
+
+bool avro_block_cache_init(AVRO_INSTANCE *router)
+{
+    spinlock_init(&router->block_cache_lock);
+
+    if (router->block_cache_size == 0)
+    {
+        return true;
+    }
+
+    return (router->block_cache = block_cache_alloc()) != NULL;
+}
+
+void avro_block_cache_clear(AVRO_INSTANCE *router)
+{
+    if (router->block_cache)
+    {
+        spinlock_acquire(&router->block_cache_lock);
+
+        while (router->block_cache_newest)
+        {
+            cache_remove(router, router->block_cache_newest);
+        }
+
+        spinlock_release(&router->block_cache_lock);
+    }
+}
+
+void avro_block_cache_free(AVRO_INSTANCE *router)
+{
+    avro_block_cache_clear(router);
+    hashtable_free(router->block_cache);
+    router->block_cache = NULL;
+}
+
+AVRO_CACHED_BLOCK* avro_block_cache_alloc(const char *avrofile, long pos, GWBUF *binary)
+{
+    AVRO_CACHED_BLOCK *block = MXS_CALLOC(1, sizeof(AVRO_CACHED_BLOCK));
+    char key[AVRO_MAX_FILENAME_LEN + 32];
+    uint8_t *data = GWBUF_DATA(binary);
+
+    snprintf(key, sizeof(key), "%s:%ld", avrofile, pos);
+
+    if (block == NULL || (block->key = MXS_STRDUP(key)) == NULL ||
+        maxavro_datablock_length(data, data + GWBUF_LENGTH(binary), &block->records) == 0)
+    {
+        if (block)
+        {
+            MXS_FREE(block->key);
+            MXS_FREE(block);
+        }
+        gwbuf_free(binary);
+        return NULL;
+    }
+
+    block->binary = binary;
+    block->size = GWBUF_LENGTH(binary);
+    block->refcount = 1;
+    return block;
+}
+
+AVRO_CACHED_BLOCK* avro_block_cache_get(AVRO_INSTANCE *router, const char *avrofile, long pos)
+{
+    AVRO_CACHED_BLOCK *block = NULL;
+
+    if (router->block_cache)
+    {
+        char key[AVRO_MAX_FILENAME_LEN + 32];
+        snprintf(key, sizeof(key), "%s:%ld", avrofile, pos);
+
+        spinlock_acquire(&router->block_cache_lock);
+
+        if ((block = hashtable_fetch(router->block_cache, key)))
+        {
+            if (is_expired(router, block, time(NULL)))
+            {
+                cache_remove(router, block);
+                router->block_cache_evictions++;
+                block = NULL;
+            }
+            else
+            {
+                block->refcount++;
+
+                if (block != router->block_cache_newest)
+                {
+                    /** Unlinked from its place in the list and moved to the front */
+                    block->prev->next = block->next;
+
+                    if (block->next)
+                    {
+                        block->next->prev = block->prev;
+                    }
+                    else
+                    {
+                        router->block_cache_oldest = block->prev;
+                    }
+
+                    cache_push(router, block);
+                }
+            }
+        }
+
+        if (block)
+        {
+            router->block_cache_hits++;
+        }
+        else
+        {
+            router->block_cache_misses++;
+        }
+
+        spinlock_release(&router->block_cache_lock);
+    }
+
+    return block;
+}
+
+AVRO_CACHED_BLOCK* avro_block_cache_add(AVRO_INSTANCE *router, AVRO_CACHED_BLOCK *block)
+{
+    if (router->block_cache == NULL || block->size > router->block_cache_size)
+    {
+        /** The block is used only by the client that read it */
+        return block;
+    }
+
+    AVRO_CACHED_BLOCK *rval = block;
+
+    spinlock_acquire(&router->block_cache_lock);
+    AVRO_CACHED_BLOCK *old = hashtable_fetch(router->block_cache, block->key);
+
+    if (old && (old->json || block->json == NULL))
+    {
+        /** Another client added the block first */
+        old->refcount++;
+        rval = old;
+    }
+    else
+    {
+        if (old)
+        {
+            /** The rows of the block were converted into JSON */
+            cache_remove(router, old);
+        }
+
+        cache_evict(router, block->size);
+
+        if (hashtable_add(router->block_cache, block->key, block))
+        {
+            block->cached = true;
+            block->added = time(NULL);
+            router->block_cache_used += block->size;
+            cache_push(router, block);
+        }
+    }
+
+    spinlock_release(&router->block_cache_lock);
+
+    if (rval != block)
+    {
+        avro_block_cache_release(router, block);
+    }
+
+    return rval;
+}
+
+void avro_block_cache_release(AVRO_INSTANCE *router, AVRO_CACHED_BLOCK *block)
+{
+    if (block)
+    {
+        spinlock_acquire(&router->block_cache_lock);
+        bool last = --block->refcount == 0 && !block->cached;
+        spinlock_release(&router->block_cache_lock);
+
+        if (last)
+        {
+            cached_block_free(block);
+        }
+    }
+}
+
+void avro_block_cache_drop(AVRO_INSTANCE *router, AVRO_CACHED_BLOCK *block)
+{
+    spinlock_acquire(&router->block_cache_lock);
+
+    if (block->cached)
+    {
+        cache_remove(router, block);
+    }
+
+    spinlock_release(&router->block_cache_lock);
+}
+
+void avro_block_cache_diagnostics(AVRO_INSTANCE *router, DCB *dcb)
+{
+    if (router->block_cache)
+    {
+        dcb_printf(dcb, "\tBytes in the block cache:            %lu\n", router->block_cache_used);
+        dcb_printf(dcb, "\tBlock cache hits:                    %lu\n", router->block_cache_hits);
+        dcb_printf(dcb, "\tBlock cache misses:                  %lu\n", router->block_cache_misses);
+        dcb_printf(dcb, "\tBlocks evicted from the block cache: %lu\n", router->block_cache_evictions);
+    }
+}
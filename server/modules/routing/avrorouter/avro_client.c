@@ -30,6 +30,9 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <maxscale/service.h>
 #include <maxscale/server.h>
 #include <maxscale/router.h>
@@ -49,7 +52,7 @@ extern uint32_t extract_field(uint8_t *src, int bits);
 static int avro_client_do_registration(AVRO_INSTANCE *, AVRO_CLIENT *, GWBUF *);
 int avro_client_callback(DCB *dcb, DCB_REASON reason, void *data);
 static void avro_client_process_command(AVRO_INSTANCE *router, AVRO_CLIENT *client, GWBUF *queue);
-static bool avro_client_stream_data(AVRO_CLIENT *client);
+static bool avro_client_stream_data(AVRO_CLIENT *client, uint64_t *credit);
 void avro_notify_client(AVRO_CLIENT *client);
 void poll_fake_write_event(DCB *dcb);
 GWBUF* read_avro_json_schema(const char *avrofile, const char* dir);
@@ -239,6 +242,252 @@ void extract_gtid_request(gtid_pos_t *gtid, const char *start, int len)
     }
 }
 
+/**
+ * @brief Parse the options of a REQUEST-DATA command
+ *
+ * The options are an optional GTID followed by optional column and row
+ * filters:
+ *
+ *     [GTID] [COLUMNS column[,column...]] [WHERE condition [AND condition...]]
+ *
+ * @param client Client that sent the command
+ * @param options The options after the table or NULL if there are none
+ * @param len Length of @p options
+ * @return True if the options are valid, false if they are not and the client
+ * was sent an error
+ */
+static bool parse_request_options(AVRO_CLIENT *client, const char *options, int len)
+{
+    const char delim[] = " \t\r\n";
+    char buf[len + 1];
+    char where[len + 1];
+    char *saveptr;
+    bool rval = true;
+
+    memcpy(buf, options, len);
+    buf[len] = '\0';
+    where[0] = '\0';
+
+    maxavro_filter_free(client->filter);
+    client->filter = NULL;
+    MXS_FREE(client->columns);
+    client->columns = NULL;
+    MXS_FREE(client->where);
+    client->where = NULL;
+
+    char *tok = strtok_r(buf, delim, &saveptr);
+
+    if (tok && isdigit(*tok))
+    {
+        client->requested_gtid = true;
+        extract_gtid_request(&client->gtid, tok, strlen(tok));
+        memcpy(&client->gtid_start, &client->gtid, sizeof(client->gtid_start));
+        tok = strtok_r(NULL, delim, &saveptr);
+    }
+    else if (tok && strcasecmp(tok, "SINCE") == 0)
+    {
+        char *end = NULL;
+        unsigned long timestamp = 0;
+
+        if ((tok = strtok_r(NULL, delim, &saveptr)) && isdigit(*tok))
+        {
+            timestamp = strtoul(tok, &end, 10);
+        }
+
+        if (end && *end == '\0' && timestamp <= UINT32_MAX)
+        {
+            client->requested_timestamp = true;
+            client->timestamp_start = timestamp;
+            tok = strtok_r(NULL, delim, &saveptr);
+        }
+        else
+        {
+            dcb_printf(client->dcb, "ERR REQUEST-DATA SINCE requires a timestamp");
+            return false;
+        }
+    }
+
+    while (rval && tok)
+    {
+        if (strcasecmp(tok, "COLUMNS") == 0 && (tok = strtok_r(NULL, delim, &saveptr)))
+        {
+            MXS_FREE(client->columns);
+            client->columns = MXS_STRDUP_A(tok);
+            tok = strtok_r(NULL, delim, &saveptr);
+        }
+        else if (strcasecmp(tok, "WHERE") == 0 && (tok = strtok_r(NULL, delim, &saveptr)))
+        {
+            while (tok)
+            {
+                if (*where)
+                {
+                    strcat(where, " ");
+                }
+                strcat(where, tok);
+
+                if ((tok = strtok_r(NULL, delim, &saveptr)) && strcasecmp(tok, "AND") == 0)
+                {
+                    if ((tok = strtok_r(NULL, delim, &saveptr)) == NULL)
+                    {
+                        dcb_printf(client->dcb, "ERR REQUEST-DATA No condition after AND");
+                        rval = false;
+                    }
+                }
+                else
+                {
+                    break;
+                }
+            }
+        }
+        else
+        {
+            dcb_printf(client->dcb, "ERR REQUEST-DATA Unexpected '%s'", tok ? tok : "end of command");
+            rval = false;
+        }
+    }
+
+    if (rval && *where)
+    {
+        client->where = MXS_STRDUP_A(where);
+    }
+
+    return rval;
+}
+
+/**
+ * @brief Create the filter for a file
+ *
+ * @param client Client that requested the columns and the conditions
+ * @param schema Schema of the file
+ * @return The filter or NULL if the requested columns or conditions are not
+ * valid for the schema and the client was sent an error
+ */
+static MAXAVRO_FILTER* create_filter(AVRO_CLIENT *client, MAXAVRO_SCHEMA *schema)
+{
+    MAXAVRO_FILTER *filter = maxavro_filter_alloc(schema);
+    char *saveptr;
+    bool ok = true;
+
+    if (filter == NULL)
+    {
+        dcb_printf(client->dcb, "ERR FILTER Memory allocation failed");
+        return NULL;
+    }
+
+    if (client->columns)
+    {
+        char buf[strlen(client->columns) + 1];
+        strcpy(buf, client->columns);
+
+        for (char *tok = strtok_r(buf, ",", &saveptr); ok && tok; tok = strtok_r(NULL, ",", &saveptr))
+        {
+            if (!maxavro_filter_add_column(filter, tok))
+            {
+                dcb_printf(client->dcb, "ERR FILTER Unknown column '%s'", tok);
+                ok = false;
+            }
+        }
+    }
+
+    if (client->where)
+    {
+        char buf[strlen(client->where) + 1];
+        strcpy(buf, client->where);
+
+        for (char *tok = strtok_r(buf, " ", &saveptr); ok && tok; tok = strtok_r(NULL, " ", &saveptr))
+        {
+            char *op = strpbrk(tok, "=!<>");
+            enum maxavro_compare cmp = MAXAVRO_CMP_EQ;
+            int op_len = 1;
+
+            if (op == NULL || op == tok)
+            {
+                ok = false;
+            }
+            else if (op[0] == '!')
+            {
+                cmp = MAXAVRO_CMP_NE;
+                op_len = 2;
+                ok = op[1] == '=';
+            }
+            else if (op[0] == '<')
+            {
+                cmp = op[1] == '=' ? MAXAVRO_CMP_LE : MAXAVRO_CMP_LT;
+                op_len = op[1] == '=' ? 2 : 1;
+            }
+            else if (op[0] == '>')
+            {
+                cmp = op[1] == '=' ? MAXAVRO_CMP_GE : MAXAVRO_CMP_GT;
+                op_len = op[1] == '=' ? 2 : 1;
+            }
+
+            if (ok)
+            {
+                char *value = op + op_len;
+                *op = '\0';
+                ok = maxavro_filter_add_condition(filter, tok, cmp, value);
+            }
+
+            if (!ok)
+            {
+                dcb_printf(client->dcb, "ERR FILTER Invalid condition '%s'", tok);
+            }
+        }
+    }
+
+    if (!ok)
+    {
+        maxavro_filter_free(filter);
+        filter = NULL;
+    }
+
+    return filter;
+}
+
+/**
+ * @brief Check that the requested columns and conditions are valid
+ *
+ * @param client Client that sent REQUEST-DATA
+ * @return True if the filter is valid or none was requested, false if it is
+ * not valid and the client was sent an error
+ */
+static bool check_filter(AVRO_CLIENT *client)
+{
+    bool rval = true;
+
+    if (client->columns || client->where)
+    {
+        if (client->format != AVRO_FORMAT_JSON)
+        {
+            dcb_printf(client->dcb, "ERR FILTER COLUMNS and WHERE require the JSON format");
+            rval = false;
+        }
+        else
+        {
+            char filename[PATH_MAX + 1];
+            snprintf(filename, sizeof(filename), "%s/%s", client->router->avrodir, client->avro_binfile);
+            MAXAVRO_FILE *file = maxavro_file_open(filename);
+            MAXAVRO_FILTER *filter = NULL;
+
+            if (file == NULL)
+            {
+                dcb_printf(client->dcb, "ERR FILTER Failed to open file '%s'", client->avro_binfile);
+                rval = false;
+            }
+            else if ((filter = create_filter(client, file->schema)) == NULL)
+            {
+                rval = false;
+            }
+
+            /** The filter is created again when the data is streamed */
+            maxavro_filter_free(filter);
+            maxavro_file_close(file);
+        }
+    }
+
+    return rval;
+}
+
 /**
  * Callback for GTID retrieval
  * @param data User data
@@ -388,10 +637,11 @@ void add_timestamp(sqlite3 *handle, json_t* obj, gtid_pos_t* gtid)
 
 /**
  * Send information about the current GTID being processed
- * @param router Router instance
+ * @param handle SQLite handle of the client
+ * @param gtid_pos The GTID
  * @param dcb Client DCB
  */
-void send_gtid_info(AVRO_INSTANCE *router, gtid_pos_t *gtid_pos, DCB *dcb)
+void send_gtid_info(sqlite3 *handle, gtid_pos_t *gtid_pos, DCB *dcb)
 {
     json_t *obj = json_object();
 
@@ -405,8 +655,8 @@ void send_gtid_info(AVRO_INSTANCE *router, gtid_pos_t *gtid_pos, DCB *dcb)
         // TODO: Store number of events in the database
         json_object_set_new(obj, "events", json_integer(gtid_pos->event_num));
 
-        add_timestamp(router->sqlite_handle, obj, gtid_pos);
-        add_used_tables(router->sqlite_handle, obj, gtid_pos);
+        add_timestamp(handle, obj, gtid_pos);
+        add_used_tables(handle, obj, gtid_pos);
 
         char *js = json_dumps(obj, 0);
         size_t size = strlen(js);
@@ -446,6 +696,7 @@ avro_client_process_command(AVRO_INSTANCE *router, AVRO_CLIENT *client, GWBUF *q
     const char req_data[] = "REQUEST-DATA";
     const char req_last_gtid[] = "QUERY-LAST-TRANSACTION";
     const char req_gtid[] = "QUERY-TRANSACTION";
+    const char req_credit[] = "CREDIT";
     const size_t req_data_len = sizeof(req_data) - 1;
     size_t buflen = gwbuf_length(queue);
     uint8_t data[buflen + 1];
@@ -462,14 +713,16 @@ avro_client_process_command(AVRO_INSTANCE *router, AVRO_CLIENT *client, GWBUF *q
         {
             const char *gtid_ptr = get_avrofile_name(file_ptr, data_len, client->avro_binfile);
 
-            if (gtid_ptr)
+            if (!parse_request_options(client, gtid_ptr,
+                                       gtid_ptr ? data_len - (gtid_ptr - file_ptr) : 0))
             {
-                client->requested_gtid = true;
-                extract_gtid_request(&client->gtid, gtid_ptr, data_len - (gtid_ptr - file_ptr));
-                memcpy(&client->gtid_start, &client->gtid, sizeof(client->gtid_start));
+                /** The error was sent to the client */
             }
-
-            if (file_in_dir(router->avrodir, client->avro_binfile))
+            else if (!file_in_dir(router->avrodir, client->avro_binfile))
+            {
+                dcb_printf(client->dcb, "ERR NO-FILE File '%s' not found.", client->avro_binfile);
+            }
+            else if (check_filter(client))
             {
                 /* set callback routine for data sending */
                 dcb_add_callback(client->dcb, DCB_REASON_DRAINED, avro_client_callback, client);
@@ -477,10 +730,6 @@ avro_client_process_command(AVRO_INSTANCE *router, AVRO_CLIENT *client, GWBUF *q
                 /* Add fake event that will call the avro_client_callback() routine */
                 poll_fake_write_event(client->dcb);
             }
-            else
-            {
-                dcb_printf(client->dcb, "ERR NO-FILE File '%s' not found.", client->avro_binfile);
-            }
         }
         else
         {
@@ -490,7 +739,7 @@ avro_client_process_command(AVRO_INSTANCE *router, AVRO_CLIENT *client, GWBUF *q
     /* Return last GTID info */
     else if (strstr((char *)data, req_last_gtid))
     {
-        send_gtid_info(router, &router->gtid, client->dcb);
+        send_gtid_info(client->sqlite_handle, &router->gtid, client->dcb);
     }
     /** Return requested GTID */
     else if (strstr((char *)data, req_gtid))
@@ -498,7 +747,31 @@ avro_client_process_command(AVRO_INSTANCE *router, AVRO_CLIENT *client, GWBUF *q
         gtid_pos_t gtid = {0, 0, 0, 0, 0};
         extract_gtid_request(&gtid, (char*)data + sizeof(req_gtid),
                              GWBUF_LENGTH(queue) - sizeof(req_gtid));
-        send_gtid_info(router, &gtid, client->dcb);
+        send_gtid_info(client->sqlite_handle, &gtid, client->dcb);
+    }
+    /** Allow more rows to be sent */
+    else if ((command_ptr = strstr((char *)data, req_credit)))
+    {
+        char *end;
+        long long credit = strtoll(command_ptr + sizeof(req_credit) - 1, &end, 10);
+
+        if (credit > 0 && (*end == '\0' || isspace(*end)))
+        {
+            spinlock_acquire(&client->catch_lock);
+            client->flow_control = true;
+            client->credit += credit;
+
+            if (client->cstate & AVRO_WAIT_CREDIT)
+            {
+                client->cstate &= ~AVRO_WAIT_CREDIT;
+                avro_notify_client(client);
+            }
+            spinlock_release(&client->catch_lock);
+        }
+        else
+        {
+            dcb_printf(client->dcb, "ERR CREDIT requires a positive number of rows");
+        }
     }
     else
     {
@@ -554,82 +827,374 @@ const char* get_avrofile_name(const char *file_ptr, int data_len, char *dest)
     return rval;
 }
 
-static int send_row(DCB *dcb, json_t* row)
+/**
+ * @brief Send the rows in the frame of a client
+ *
+ * @param client Client whose frame is sent
+ * @return 1 on success, 0 on error
+ */
+static int frame_flush(AVRO_CLIENT *client)
 {
-    char *json = json_dumps(row, JSON_PRESERVE_ORDER);
-    size_t len = strlen(json);
-    GWBUF *buf = gwbuf_alloc(len + 1);
-    int rc = 0;
+    int rc = 1;
 
-    if (json && buf)
+    if (client->frame.len > 0)
     {
-        uint8_t *data = GWBUF_DATA(buf);
-        memcpy(data, json, len);
-        data[len] = '\n';
-        rc = dcb->func.write(dcb, buf);
+        GWBUF *buf = gwbuf_alloc_and_load(client->frame.len, client->frame.data);
+
+        if (buf)
+        {
+            rc = client->dcb->func.write(client->dcb, buf);
+        }
+        else
+        {
+            rc = 0;
+        }
+
+        client->frame.len = 0;
+        client->frame_rows = 0;
     }
-    else
+
+    return rc;
+}
+
+/**
+ * @brief Count a row added to the frame of a client
+ *
+ * The frame is sent once it has router->batch_rows rows or router->batch_bytes
+ * bytes in it.
+ *
+ * @param client Client whose frame the row was added to
+ * @return 1 on success, 0 on error
+ */
+static int frame_add_row(AVRO_CLIENT *client)
+{
+    int rc = 1;
+    client->frame_rows++;
+
+    if (client->frame_rows >= client->router->batch_rows ||
+        client->frame.len >= client->router->batch_bytes)
     {
-        MXS_ERROR("Failed to dump JSON value.");
-        rc = 0;
+        rc = frame_flush(client);
     }
-    MXS_FREE(json);
+
     return rc;
 }
 
-static void set_current_gtid(AVRO_CLIENT *client, json_t *row)
+/**
+ * @brief Find the index of a field in a schema
+ *
+ * @param schema Schema to search
+ * @param name Name of the field
+ * @return Index of the field or -1 if the schema has no such field
+ */
+static int find_field(MAXAVRO_SCHEMA *schema, const char *name)
+{
+    for (size_t i = 0; i < schema->num_fields; i++)
+    {
+        if (strcmp(schema->fields[i].name, name) == 0)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Read the next block of a file from memory
+ *
+ * The latest blocks of a file are kept in memory after they are written, a
+ * client that has read the rest of the file reads them from there.
+ *
+ * @param client Client whose file is read
+ * @return True if the next block was loaded from memory
+ */
+static bool load_tail_block(AVRO_CLIENT *client)
+{
+    MAXAVRO_FILE *file = client->file_handle;
+    GWBUF *block = avro_tail_get(client->router, client->avro_binfile,
+                                 maxavro_next_block_pos(file));
+
+    if (block && maxavro_record_load_block(file, GWBUF_DATA(block), GWBUF_LENGTH(block)))
+    {
+        /** The rows are read from the block until the next one is loaded */
+        gwbuf_free(client->tail_block);
+        client->tail_block = block;
+        return true;
+    }
+
+    gwbuf_free(block);
+    return false;
+}
+
+/**
+ * @brief Move to the next block of a file
+ *
+ * @param client Client whose file is read
+ * @return True if the next block was read
+ */
+static bool next_block(AVRO_CLIENT *client)
+{
+    return load_tail_block(client) || maxavro_next_block(client->file_handle);
+}
+
+/**
+ * @brief Send the rest of the rows of the current block in JSON format
+ *
+ * The records are converted directly into the frame of the client. Only the
+ * rows and columns selected by the filter of the client are sent.
+ *
+ * @param client Client to stream to
+ * @param credit Number of rows that can be sent, decremented for each sent row
+ * @return 1 on success, 0 if writing to the client failed
+ */
+static int send_json_rows(AVRO_CLIENT *client, uint64_t *credit)
 {
-    json_t *obj = json_object_get(row, avro_sequence);
-    ss_dassert(json_is_integer(obj));
-    client->gtid.seq = json_integer_value(obj);
+    MAXAVRO_FILE *file = client->file_handle;
+    int rc = 1;
+
+    /** The GTID fields of the rows */
+    uint64_t values[file->schema->num_fields + 1];
+    int seq = find_field(file->schema, avro_sequence);
+    int server_id = find_field(file->schema, avro_server_id);
+    int domain = find_field(file->schema, avro_domain);
+    size_t len = client->frame.len;
+
+    while (rc > 0 && *credit > 0 &&
+           maxavro_record_read_json_text(file, &client->frame, values, client->filter))
+    {
+        /** Nothing is added for the rows that the filter does not select */
+        if (client->frame.len > len)
+        {
+            rc = frame_add_row(client);
+            (*credit)--;
+        }
+
+        len = client->frame.len;
 
-    obj = json_object_get(row, avro_server_id);
-    ss_dassert(json_is_integer(obj));
-    client->gtid.server_id = json_integer_value(obj);
+        if (seq >= 0 && server_id >= 0 && domain >= 0)
+        {
+            client->gtid.seq = values[seq];
+            client->gtid.server_id = values[server_id];
+            client->gtid.domain = values[domain];
+        }
+    }
 
-    obj = json_object_get(row, avro_domain);
-    ss_dassert(json_is_integer(obj));
-    client->gtid.domain = json_integer_value(obj);
+    return rc;
 }
 
 /**
  * @brief Stream Avro data in JSON format
  *
- * @param file File to stream from
- * @param dcb DCB to stream to
- * @return True if more data is readable, false if all data was sent
+ * @param client Client to stream to
+ * @param credit Number of rows that can be sent, decremented for each sent row
+ * @return True if more data is readable, false if all data was sent or the
+ * credit ran out
  */
-static bool stream_json(AVRO_CLIENT *client)
+static bool stream_json(AVRO_CLIENT *client, uint64_t *credit)
 {
     int bytes = 0;
     MAXAVRO_FILE *file = client->file_handle;
-    DCB *dcb = client->dcb;
+    int rc = 1;
+
+    if (!file->metadata_read)
+    {
+        /** All of the file was read, the new rows may be in memory */
+        load_tail_block(client);
+    }
+
+    do
+    {
+        rc = send_json_rows(client, credit);
+        bytes += file->block_size;
+    }
+    while (rc > 0 && *credit > 0 && next_block(client) && bytes < AVRO_DATA_BURST_SIZE);
+
+    rc = frame_flush(client) && rc;
+
+    return rc > 0 && *credit > 0 && bytes >= AVRO_DATA_BURST_SIZE;
+}
+
+/**
+ * @brief Read a block and convert its rows into JSON
+ *
+ * The block is read from memory if it is among the latest blocks of the file.
+ * The converted block is added to the cache.
+ *
+ * @param client Client whose file is read
+ * @param pos    Offset of the block
+ * @return The block or NULL at the end of the file or on error
+ */
+static AVRO_CACHED_BLOCK* read_json_block(AVRO_CLIENT *client, long pos)
+{
+    MAXAVRO_FILE *file = client->file_handle;
+    GWBUF *binary = avro_tail_get(client->router, client->avro_binfile, pos);
+
+    if (binary && !maxavro_record_load_block(file, GWBUF_DATA(binary), GWBUF_LENGTH(binary)))
+    {
+        gwbuf_free(binary);
+        binary = NULL;
+    }
+
+    if (binary == NULL &&
+        (!maxavro_record_enter_block(file) || (binary = maxavro_record_copy_block(file)) == NULL))
+    {
+        return NULL;
+    }
+
+    AVRO_CACHED_BLOCK *block = avro_block_cache_alloc(client->avro_binfile, pos, binary);
+
+    if (block == NULL)
+    {
+        return NULL;
+    }
+
+    uint64_t values[file->schema->num_fields + 1];
+    int seq = find_field(file->schema, avro_sequence);
+    int server_id = find_field(file->schema, avro_server_id);
+    int domain = find_field(file->schema, avro_domain);
+    bool have_gtid = seq >= 0 && server_id >= 0 && domain >= 0;
+    MAXAVRO_TEXT text = {};
+    bool ok = (block->row_end = MXS_MALLOC(block->records * sizeof(uint32_t) + 1)) &&
+              (!have_gtid || (block->gtid = MXS_CALLOC(block->records + 1, sizeof(gtid_pos_t))));
+
+    for (uint64_t i = 0; ok && i < block->records; i++)
+    {
+        if ((ok = maxavro_record_read_json_text(file, &text, values, NULL)))
+        {
+            block->row_end[i] = text.len;
+
+            if (have_gtid)
+            {
+                block->gtid[i].seq = values[seq];
+                block->gtid[i].server_id = values[server_id];
+                block->gtid[i].domain = values[domain];
+            }
+        }
+    }
+
+    if (!ok)
+    {
+        maxavro_text_free(&text);
+        avro_block_cache_release(client->router, block);
+        return NULL;
+    }
+
+    block->json = text.data ? text.data : MXS_STRDUP_A("");
+    block->size += text.len + block->records * sizeof(uint32_t) +
+                   (have_gtid ? block->records * sizeof(gtid_pos_t) : 0);
+
+    return avro_block_cache_add(client->router, block);
+}
+
+/**
+ * @brief Get the next block with the rows in JSON
+ *
+ * The file is moved past the block.
+ *
+ * @param client Client whose file is read
+ * @return The block or NULL at the end of the file or on error
+ */
+static AVRO_CACHED_BLOCK* get_json_block(AVRO_CLIENT *client)
+{
+    MAXAVRO_FILE *file = client->file_handle;
+    long pos = maxavro_next_block_pos(file);
+    AVRO_CACHED_BLOCK *block = avro_block_cache_get(client->router, client->avro_binfile, pos);
+
+    if (block && block->json)
+    {
+        if (maxavro_record_skip_block(file, GWBUF_DATA(block->binary), GWBUF_LENGTH(block->binary)))
+        {
+            return block;
+        }
+
+        /** The block is from an earlier file of the same name */
+        avro_block_cache_drop(client->router, block);
+    }
+
+    avro_block_cache_release(client->router, block);
+    return read_json_block(client, pos);
+}
+
+/**
+ * @brief Stream Avro data in JSON format from the shared blocks
+ *
+ * The rows of each block are converted into JSON only once, the clients that
+ * stream the same table copy the converted rows into their frames.
+ *
+ * @param client Client to stream to, the client has no filter
+ * @param credit Number of rows that can be sent, decremented for each sent row
+ * @return True if more data is readable, false if all data was sent or the
+ * credit ran out
+ */
+static bool stream_json_cached(AVRO_CLIENT *client, uint64_t *credit)
+{
+    MAXAVRO_FILE *file = client->file_handle;
+    uint64_t bytes = 0;
+    int rc = 1;
+
+    if (client->cached_block == NULL && file->metadata_read &&
+        file->records_read_from_block > 0)
+    {
+        /** The rest of the block where a GTID was found is read from the file */
+        rc = send_json_rows(client, credit);
+    }
+
+    while (rc > 0 && *credit > 0 && bytes < AVRO_DATA_BURST_SIZE &&
+           (client->cached_block || (client->cached_block = get_json_block(client))))
+    {
+        AVRO_CACHED_BLOCK *block = client->cached_block;
+
+        while (rc > 0 && *credit > 0 && client->cached_row < block->records)
+        {
+            uint64_t row = client->cached_row++;
+            uint32_t start = row > 0 ? block->row_end[row - 1] : 0;
+
+            if (maxavro_text_append(&client->frame, block->json + start, block->row_end[row] - start))
+            {
+                rc = frame_add_row(client);
+            }
+            else
+            {
+                rc = 0;
+            }
+
+            (*credit)--;
 
-    do
-    {
-        json_t *row;
-        int rc = 1;
-        while (rc > 0 && (row = maxavro_record_read_json(file)))
+            if (block->gtid)
+            {
+                client->gtid.seq = block->gtid[row].seq;
+                client->gtid.server_id = block->gtid[row].server_id;
+                client->gtid.domain = block->gtid[row].domain;
+            }
+        }
+
+        if (client->cached_row == block->records)
         {
-            rc = send_row(dcb, row);
-            set_current_gtid(client, row);
-            json_decref(row);
+            bytes += GWBUF_LENGTH(block->binary);
+            avro_block_cache_release(client->router, block);
+            client->cached_block = NULL;
+            client->cached_row = 0;
         }
-        bytes += file->block_size;
     }
-    while (maxavro_next_block(file) && bytes < AVRO_DATA_BURST_SIZE);
 
-    return bytes >= AVRO_DATA_BURST_SIZE;
+    rc = frame_flush(client) && rc;
+
+    return rc > 0 && *credit > 0 && bytes >= AVRO_DATA_BURST_SIZE;
 }
 
 /**
  * @brief Stream Avro data in native Avro format
  *
- * @param file File to stream from
- * @param dcb DCB to stream to
- * @return True if streaming was successful, false if an error occurred
+ * Whole data blocks are sent, a block is sent if there is any credit left.
+ *
+ * @param client Client to stream to
+ * @param credit Number of records that can be sent, decremented by the number
+ * of records in each sent block
+ * @return True if more data is readable, false if all data was sent or the
+ * credit ran out
  */
-static bool stream_binary(AVRO_CLIENT *client)
+static bool stream_binary(AVRO_CLIENT *client, uint64_t *credit)
 {
     GWBUF *buffer;
     uint64_t bytes = 0;
@@ -637,11 +1202,54 @@ static bool stream_binary(AVRO_CLIENT *client)
     MAXAVRO_FILE *file = client->file_handle;
     DCB *dcb = client->dcb;
 
-    while (rc > 0 && bytes < AVRO_DATA_BURST_SIZE)
+    while (rc > 0 && *credit > 0 && bytes < AVRO_DATA_BURST_SIZE)
     {
+        long pos = maxavro_next_block_pos(file);
+        AVRO_CACHED_BLOCK *block = avro_block_cache_get(client->router, client->avro_binfile, pos);
+
+        buffer = NULL;
+
+        if (block)
+        {
+            if ((buffer = gwbuf_clone(block->binary)) &&
+                !maxavro_record_skip_block(file, GWBUF_DATA(buffer), GWBUF_LENGTH(buffer)))
+            {
+                /** The block is from an earlier file of the same name */
+                avro_block_cache_drop(client->router, block);
+                gwbuf_free(buffer);
+                buffer = NULL;
+            }
+
+            avro_block_cache_release(client->router, block);
+        }
+        else if (!file->metadata_read &&
+                 (buffer = avro_tail_get(client->router, client->avro_binfile, pos)) &&
+                 !maxavro_record_skip_block(file, GWBUF_DATA(buffer), GWBUF_LENGTH(buffer)))
+        {
+            gwbuf_free(buffer);
+            buffer = NULL;
+        }
+
+        if (buffer)
+        {
+            /** The block was sent from memory */
+            bytes += GWBUF_LENGTH(buffer);
+            *credit -= MXS_MIN(*credit, file->records_in_block);
+            rc = dcb->func.write(dcb, buffer);
+            continue;
+        }
+
         bytes += file->block_size;
         if ((buffer = maxavro_record_read_binary(file)))
         {
+            *credit -= MXS_MIN(*credit, file->records_in_block);
+
+            if (client->router->block_cache &&
+                (block = avro_block_cache_alloc(client->avro_binfile, pos, gwbuf_clone(buffer))))
+            {
+                avro_block_cache_release(client->router, avro_block_cache_add(client->router, block));
+            }
+
             rc = dcb->func.write(dcb, buffer);
         }
         else
@@ -650,7 +1258,7 @@ static bool stream_binary(AVRO_CLIENT *client)
         }
     }
 
-    return bytes >= AVRO_DATA_BURST_SIZE;
+    return rc > 0 && *credit > 0 && bytes >= AVRO_DATA_BURST_SIZE;
 }
 
 static int sqlite_cb(void* data, int rows, char** values, char** names)
@@ -671,6 +1279,12 @@ static const char select_template[] = "SELECT max(position) FROM gtid WHERE doma
 
 static bool seek_to_index_pos(AVRO_CLIENT *client, MAXAVRO_FILE* file)
 {
+    if (client->requested_timestamp)
+    {
+        /** The GTID index has no timestamps */
+        return true;
+    }
+
     char *name = strrchr(client->file_handle->filename, '/');
     ss_dassert(name);
     name++;
@@ -701,11 +1315,222 @@ static bool seek_to_index_pos(AVRO_CLIENT *client, MAXAVRO_FILE* file)
 }
 
 /**
+ * @brief Check if a data block starts before the requested GTID or timestamp
+ *
+ * @param client Client that requested the GTID or the timestamp
+ * @param file File to read from, its position is moved to the block
+ * @param pos Offset of the block
+ * @return True if the first record of the block is from an earlier transaction
+ * of the same domain and server or has an earlier timestamp
+ */
+static bool block_precedes_gtid(AVRO_CLIENT *client, MAXAVRO_FILE* file, long pos)
+{
+    bool rval = false;
+    json_t *row;
+
+    if (maxavro_record_set_pos(file, pos) && (row = maxavro_record_read_json(file)))
+    {
+        json_t *domain = json_object_get(row, avro_domain);
+        json_t *server_id = json_object_get(row, avro_server_id);
+        json_t *seq = json_object_get(row, avro_sequence);
+
+        if (client->requested_timestamp)
+        {
+            json_t *timestamp = json_object_get(row, avro_timestamp);
+            rval = json_integer_value(timestamp) < client->timestamp_start;
+        }
+        else
+        {
+            rval = json_integer_value(domain) == client->gtid.domain &&
+                   json_integer_value(server_id) == client->gtid.server_id &&
+                   json_integer_value(seq) < client->gtid.seq;
+        }
+
+        json_decref(row);
+    }
+
+    return rval;
+}
+
+/**
+ * @brief Check if a block index entry ends before the requested start
+ *
+ * @param client Client that requested a GTID or a timestamp
+ * @param entry The index entry
+ * @return True if all the rows of the entry precede the start. For a GTID only
+ * the rows of the same domain and server are known to precede it.
+ */
+static bool entry_precedes_start(AVRO_CLIENT *client, AVRO_BLOCK_INDEX *entry)
+{
+    if (client->requested_timestamp)
+    {
+        return entry->last.timestamp < client->timestamp_start;
+    }
+
+    return entry->last.domain == client->gtid.domain &&
+           entry->last.server_id == client->gtid.server_id &&
+           entry->last.seq < client->gtid.seq;
+}
+
+/**
+ * @brief Skip the data blocks that the block index shows to precede the start
+ *
+ * The block index of the file is searched with a binary search for the first
+ * entry that does not end before the requested GTID or timestamp. The entries
+ * are used only as long as they continue from the previous one, the rows after
+ * them are searched from the data blocks.
+ *
+ * @param client Client that requested a GTID or a timestamp
+ * @param file File positioned to the start of a data block
+ * @return True, the data blocks are only skipped, if possible
+ */
+static bool seek_to_block_index(AVRO_CLIENT *client, MAXAVRO_FILE* file)
+{
+    char filename[PATH_MAX + 1];
+    snprintf(filename, sizeof(filename), "%s"AVRO_BLOCK_INDEX_SUFFIX, file->filename);
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+
+    if (fd == -1)
+    {
+        /** Files converted before the index was added have no index */
+        return true;
+    }
+
+    char *data = NULL;
+    size_t n_entries = 0;
+
+    if (fstat(fd, &st) == 0 && st.st_size > AVRO_BLOCK_INDEX_MAGIC_LEN &&
+        (data = MXS_MALLOC(st.st_size)))
+    {
+        ssize_t len = pread(fd, data, st.st_size, 0);
+
+        if (len > AVRO_BLOCK_INDEX_MAGIC_LEN &&
+            memcmp(data, AVRO_BLOCK_INDEX_MAGIC, AVRO_BLOCK_INDEX_MAGIC_LEN) == 0)
+        {
+            n_entries = (len - AVRO_BLOCK_INDEX_MAGIC_LEN) / sizeof(AVRO_BLOCK_INDEX);
+        }
+    }
+
+    close(fd);
+
+    AVRO_BLOCK_INDEX *entries = (AVRO_BLOCK_INDEX*)(data + AVRO_BLOCK_INDEX_MAGIC_LEN);
+
+    for (size_t i = 1; i < n_entries; i++)
+    {
+        if (entries[i].start != entries[i - 1].end)
+        {
+            n_entries = i;
+            break;
+        }
+    }
+
+    size_t lo = 0;
+    size_t hi = n_entries;
+
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (entry_precedes_start(client, &entries[mid]))
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    if (n_entries > 0)
+    {
+        /** If all the entries precede the start, it is in the rows written after
+         * them and the search continues from the last entry */
+        uint64_t start = entries[MXS_MIN(lo, n_entries - 1)].start;
+        long pos = file->block_start_pos;
+
+        if (start > (uint64_t)pos && !maxavro_record_set_pos(file, start))
+        {
+            maxavro_record_set_pos(file, pos);
+        }
+    }
+
+    MXS_FREE(data);
+    return true;
+}
+
+/**
+ * @brief Skip the data blocks that precede the requested GTID or timestamp
+ *
+ * The indexes only cover the data blocks that have been indexed. The blocks
+ * after the one where the indexes left the file are searched with a binary
+ * search over the first records of the blocks, relying on the same ordering of
+ * the GTIDs of a domain and a server, and of the timestamps, as the indexes.
+ * The file is positioned to the last block that starts before the GTID or the
+ * timestamp.
+ *
+ * @param client Client that requested the GTID or the timestamp
+ * @param file File positioned to the start of a data block
+ * @return True, the data blocks are only skipped, if possible
+ */
+static bool seek_to_block(AVRO_CLIENT *client, MAXAVRO_FILE* file)
+{
+    size_t n_blocks = maxavro_index_blocks(file);
+    size_t lo = 0;
+    size_t hi = n_blocks;
+
+    /** Find the current block */
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (file->blocks[mid] < file->block_start_pos)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    if (lo + 1 < n_blocks && file->blocks[lo] == file->block_start_pos)
+    {
+        /** The block at lo always starts before the GTID */
+        hi = n_blocks;
+
+        while (hi - lo > 1)
+        {
+            size_t mid = lo + (hi - lo) / 2;
+
+            if (block_precedes_gtid(client, file, file->blocks[mid]))
+            {
+                lo = mid;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+
+        maxavro_record_set_pos(file, file->blocks[lo]);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Find the first row of the requested GTID or timestamp
+ *
+ * The rows are read one by one until the first one with the requested GTID, or
+ * a later GTID of the same domain and server, or the first one whose timestamp
+ * is not before the requested timestamp. The file is positioned to that row.
  *
- * @param client
- * @param file
+ * @param client Client that requested a GTID or a timestamp
+ * @param file File positioned to the start of a data block
+ * @return True if the row was found
  */
-static bool seek_to_gtid(AVRO_CLIENT *client, MAXAVRO_FILE* file)
+static bool seek_to_start(AVRO_CLIENT *client, MAXAVRO_FILE* file)
 {
     bool seeking = true;
 
@@ -714,41 +1539,64 @@ static bool seek_to_gtid(AVRO_CLIENT *client, MAXAVRO_FILE* file)
         json_t *row;
         while ((row = maxavro_record_read_json(file)))
         {
-            json_t *obj = json_object_get(row, avro_sequence);
-            ss_dassert(json_is_integer(obj));
-            uint64_t value = json_integer_value(obj);
+            if (client->requested_timestamp)
+            {
+                json_t *obj = json_object_get(row, avro_timestamp);
+                ss_dassert(json_is_integer(obj));
 
-            /** If a larger GTID is found, use that */
-            if (value >= client->gtid.seq)
+                if (json_integer_value(obj) >= client->timestamp_start)
+                {
+                    MXS_INFO("Found timestamp %u for %s@%s", client->timestamp_start,
+                             client->dcb->user, client->dcb->remote);
+                    seeking = false;
+                }
+            }
+            else
             {
-                obj = json_object_get(row, avro_server_id);
+                json_t *obj = json_object_get(row, avro_sequence);
                 ss_dassert(json_is_integer(obj));
-                value = json_integer_value(obj);
+                uint64_t value = json_integer_value(obj);
 
-                if (value == client->gtid.server_id)
+                /** If a larger GTID is found, use that */
+                if (value >= client->gtid.seq)
                 {
-                    obj = json_object_get(row, avro_domain);
+                    obj = json_object_get(row, avro_server_id);
                     ss_dassert(json_is_integer(obj));
                     value = json_integer_value(obj);
 
-                    if (value == client->gtid.domain)
+                    if (value == client->gtid.server_id)
                     {
-                        MXS_INFO("Found GTID %lu-%lu-%lu for %s@%s",
-                                 client->gtid.domain, client->gtid.server_id,
-                                 client->gtid.seq, client->dcb->user, client->dcb->remote);
-                        seeking = false;
+                        obj = json_object_get(row, avro_domain);
+                        ss_dassert(json_is_integer(obj));
+                        value = json_integer_value(obj);
+
+                        if (value == client->gtid.domain)
+                        {
+                            MXS_INFO("Found GTID %lu-%lu-%lu for %s@%s",
+                                     client->gtid.domain, client->gtid.server_id,
+                                     client->gtid.seq, client->dcb->user, client->dcb->remote);
+                            seeking = false;
+                        }
                     }
                 }
             }
 
-            /** We'll send the first found row immediately since we have already
-             * read the row into memory */
+            json_decref(row);
+
             if (!seeking)
             {
-                send_row(client->dcb, row);
-            }
+                /** Return to the found row so that stream_json() sends it */
+                long block_pos = file->block_start_pos;
+                uint64_t skip = file->records_read_from_block - 1;
+                uint64_t records_read = file->records_read - 1;
 
-            json_decref(row);
+                if (maxavro_record_set_pos(file, block_pos) &&
+                    (skip == 0 || maxavro_record_seek(file, skip)))
+                {
+                    file->records_read = records_read;
+                }
+                break;
+            }
         }
     }
     while (seeking && maxavro_next_block(file));
@@ -761,10 +1609,10 @@ static bool seek_to_gtid(AVRO_CLIENT *client, MAXAVRO_FILE* file)
  *
  * @param router     The router instance
  * @param client     The specific client data
- * @param avro_file  The requested AVRO file
+ * @param credit     Number of rows that can be sent, decremented for the sent rows
  * @return True if more data needs to be read
  */
-static bool avro_client_stream_data(AVRO_CLIENT *client)
+static bool avro_client_stream_data(AVRO_CLIENT *client, uint64_t *credit)
 {
     bool read_more = false;
     AVRO_INSTANCE *router = client->router;
@@ -782,6 +1630,13 @@ static bool avro_client_stream_data(AVRO_CLIENT *client)
         {
             ok = false;
         }
+        else if ((client->columns || client->where) && client->filter == NULL &&
+                 (client->filter = create_filter(client, client->file_handle->schema)) == NULL)
+        {
+            /** A new version of the table no longer has the filtered columns */
+            poll_fake_hangup_event(client->dcb);
+            ok = false;
+        }
         spinlock_release(&client->file_lock);
 
         if (ok)
@@ -789,19 +1644,30 @@ static bool avro_client_stream_data(AVRO_CLIENT *client)
             switch (client->format)
             {
             case AVRO_FORMAT_JSON:
-                /** Currently only JSON format supports seeking to a GTID */
-                if (client->requested_gtid &&
+                /** Currently only JSON format supports seeking to a GTID or a timestamp */
+                if ((client->requested_gtid || client->requested_timestamp) &&
                     seek_to_index_pos(client, client->file_handle) &&
-                    seek_to_gtid(client, client->file_handle))
+                    seek_to_block_index(client, client->file_handle) &&
+                    seek_to_block(client, client->file_handle) &&
+                    seek_to_start(client, client->file_handle))
                 {
+                    /** The file is at the first row that is sent */
                     client->requested_gtid = false;
+                    client->requested_timestamp = false;
                 }
 
-                read_more = stream_json(client);
+                if (client->router->block_cache && client->filter == NULL)
+                {
+                    read_more = stream_json_cached(client, credit);
+                }
+                else
+                {
+                    read_more = stream_json(client, credit);
+                }
                 break;
 
             case AVRO_FORMAT_AVRO:
-                read_more = stream_binary(client);
+                read_more = stream_binary(client, credit);
                 break;
 
             default:
@@ -896,6 +1762,177 @@ GWBUF* read_avro_binary_schema(const char *avrofile, const char* dir)
     return rval;
 }
 
+/**
+ * The schemas of one version of a table, read from the files once and then
+ * shared by all the clients
+ */
+typedef struct
+{
+    GWBUF *json;   /*< The JSON schema from the .avsc file */
+    GWBUF *binary; /*< The header of the .avro file */
+} AVRO_SCHEMA_CACHE;
+
+/**
+ * AVRO_SCHEMA_CACHE free function for use with hashtable.
+ * @param v Pointer to a AVRO_SCHEMA_CACHE
+ */
+static void schema_cache_hfree(void *v)
+{
+    AVRO_SCHEMA_CACHE *cache = (AVRO_SCHEMA_CACHE*)v;
+    gwbuf_free(cache->json);
+    gwbuf_free(cache->binary);
+    MXS_FREE(cache);
+}
+
+/**
+ * @brief Allocate an empty schema cache
+ *
+ * @return The cache or NULL if memory allocation failed
+ */
+static HASHTABLE* schema_cache_alloc()
+{
+    HASHTABLE *cache = hashtable_alloc(1000, hashtable_item_strhash, hashtable_item_strcmp);
+
+    if (cache)
+    {
+        hashtable_memory_fns(cache, hashtable_item_strdup, NULL,
+                             hashtable_item_free, schema_cache_hfree);
+    }
+
+    return cache;
+}
+
+/**
+ * @brief Allocate the schema cache of a router
+ *
+ * @param router Avro router instance
+ * @return True if the cache was allocated
+ */
+bool avro_schema_cache_init(AVRO_INSTANCE *router)
+{
+    spinlock_init(&router->schema_lock);
+    return (router->schema_cache = schema_cache_alloc()) != NULL;
+}
+
+/**
+ * @brief Remove a version of a table from the schema cache
+ *
+ * To be called when the files of the version are written. The clients that
+ * are sending the old schemas keep their own references to them.
+ *
+ * @param router Avro router instance
+ * @param name The name of the files without the suffix, i.e. the database,
+ * table and version separated by dots. NULL removes all versions.
+ */
+void avro_schema_cache_invalidate(AVRO_INSTANCE *router, const char *name)
+{
+    spinlock_acquire(&router->schema_lock);
+
+    if (name)
+    {
+        hashtable_delete(router->schema_cache, (void*)name);
+    }
+    else
+    {
+        HASHTABLE *cache = schema_cache_alloc();
+
+        if (cache)
+        {
+            hashtable_free(router->schema_cache);
+            router->schema_cache = cache;
+        }
+        else
+        {
+            MXS_ERROR("[%s] Failed to clear the schema cache.", router->service->name);
+        }
+    }
+
+    spinlock_release(&router->schema_lock);
+}
+
+/**
+ * @brief Get the schema of an Avro file from the schema cache
+ *
+ * The schema is read from the files only if it is not already cached.
+ *
+ * @param router Avro router instance
+ * @param avrofile Name of the Avro file
+ * @param format The format of the schema
+ * @return A copy of the schema that can be written to a client or NULL on error
+ */
+static GWBUF* get_cached_schema(AVRO_INSTANCE *router, const char *avrofile,
+                                enum avro_data_format format)
+{
+    const char *suffix = strrchr(avrofile, '.');
+
+    if (suffix == NULL)
+    {
+        return NULL;
+    }
+
+    char name[suffix - avrofile + 1];
+    memcpy(name, avrofile, suffix - avrofile);
+    name[suffix - avrofile] = '\0';
+
+    GWBUF *rval = NULL;
+    spinlock_acquire(&router->schema_lock);
+    AVRO_SCHEMA_CACHE *cache = hashtable_fetch(router->schema_cache, name);
+
+    if (cache)
+    {
+        rval = gwbuf_clone(format == AVRO_FORMAT_JSON ? cache->json : cache->binary);
+    }
+
+    spinlock_release(&router->schema_lock);
+
+    if (rval == NULL)
+    {
+        /** Read the schema without holding the lock, the files are not changed
+         * after they have been written */
+        GWBUF *schema = format == AVRO_FORMAT_JSON ?
+                        read_avro_json_schema(avrofile, router->avrodir) :
+                        read_avro_binary_schema(avrofile, router->avrodir);
+
+        if (schema)
+        {
+            spinlock_acquire(&router->schema_lock);
+
+            if ((cache = hashtable_fetch(router->schema_cache, name)) == NULL &&
+                (cache = MXS_CALLOC(1, sizeof(AVRO_SCHEMA_CACHE))) &&
+                hashtable_add(router->schema_cache, name, cache) == 0)
+            {
+                MXS_FREE(cache);
+                cache = NULL;
+            }
+
+            if (cache)
+            {
+                GWBUF **dest = format == AVRO_FORMAT_JSON ? &cache->json : &cache->binary;
+
+                if (*dest == NULL)
+                {
+                    *dest = schema;
+                }
+                else
+                {
+                    /** Another client read it first */
+                    gwbuf_free(schema);
+                }
+
+                rval = gwbuf_clone(*dest);
+            }
+            else
+            {
+                rval = schema;
+            }
+
+            spinlock_release(&router->schema_lock);
+        }
+    }
+
+    return rval;
+}
+
 /**
  * Rotate to a new Avro file
  * @param client Avro client session
@@ -921,6 +1958,13 @@ static void rotate_avro_file(AVRO_CLIENT *client, char *fullname)
 
     spinlock_acquire(&client->file_lock);
     maxavro_file_close(client->file_handle);
+    maxavro_filter_free(client->filter);
+    client->filter = NULL;
+    gwbuf_free(client->tail_block);
+    client->tail_block = NULL;
+    avro_block_cache_release(client->router, client->cached_block);
+    client->cached_block = NULL;
+    client->cached_row = 0;
 
     if ((client->file_handle = maxavro_file_open(fullname)) == NULL)
     {
@@ -984,7 +2028,17 @@ int avro_client_callback(DCB *dcb, DCB_REASON reason, void *userdata)
             return 0;
         }
 
+        if (client->flow_control && client->credit == 0)
+        {
+            /** Continued by the next CREDIT command */
+            client->cstate |= AVRO_WAIT_CREDIT;
+            spinlock_release(&client->catch_lock);
+            return 0;
+        }
+
         client->cstate |= AVRO_CS_BUSY;
+        uint64_t credit = client->flow_control ? client->credit : UINT64_MAX;
+        uint64_t start_credit = credit;
         spinlock_release(&client->catch_lock);
 
         if (client->last_sent_pos == 0)
@@ -995,11 +2049,8 @@ int avro_client_callback(DCB *dcb, DCB_REASON reason, void *userdata)
             switch (client->format)
             {
             case AVRO_FORMAT_JSON:
-                schema = read_avro_json_schema(client->avro_binfile, client->router->avrodir);
-                break;
-
             case AVRO_FORMAT_AVRO:
-                schema = read_avro_binary_schema(client->avro_binfile, client->router->avrodir);
+                schema = get_cached_schema(client->router, client->avro_binfile, client->format);
                 break;
 
             default:
@@ -1013,7 +2064,7 @@ int avro_client_callback(DCB *dcb, DCB_REASON reason, void *userdata)
         }
 
         /** Stream the data to the client */
-        bool read_more = avro_client_stream_data(client);
+        bool read_more = avro_client_stream_data(client, &credit);
 
         char filename[PATH_MAX + 1];
         print_next_filename(client->avro_binfile, client->router->avrodir,
@@ -1030,7 +2081,22 @@ int avro_client_callback(DCB *dcb, DCB_REASON reason, void *userdata)
         client->cstate &= ~AVRO_CS_BUSY;
         client->cstate |= AVRO_WAIT_DATA;
 
-        if (next_file || read_more)
+        if (client->flow_control)
+        {
+            /** More credit may have been given while the data was sent */
+            client->credit -= MXS_MIN(client->credit, start_credit - credit);
+
+            if (credit == 0 && client->credit > 0)
+            {
+                read_more = true;
+            }
+        }
+
+        if (client->flow_control && client->credit == 0)
+        {
+            client->cstate |= AVRO_WAIT_CREDIT;
+        }
+        else if (next_file || read_more)
         {
 #ifdef SS_DEBUG
             if (read_more)
@@ -0,0 +1,338 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file avro_feed.c - Binlog events received in memory from a binlogrouter
+ *
+ * When the source service is a binlogrouter of the same MaxScale, the
+ * avrorouter subscribes to the events that the binlogrouter writes into its
+ * binlog files. The events are queued in memory and a conversion thread,
+ * which then replaces the conversion task of the housekeeper, is woken up
+ * as soon as they arrive.
+ *
+ * The conversion takes the next event from the queue if it is there and reads
+ * it from the binlog file if it is not. The file is used to catch up after a
+ * restart, for the events that the binlogrouter generates itself and for the
+ * events that were dropped because the queue was full.
+ */
+
+#include "avrorouter.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <time.h>
+#include <maxscale/alloc.h>
+#include <maxscale/paths.h>
+
+/**
+ * @brief The number of a binlog file
+ *
+ * @param binlog Name of the binlog file
+ * @return The number in the suffix of the name
+ */
+static int binlog_number(const char *binlog)
+{
+    const char *sfx = strrchr(binlog, '.');
+    return sfx ? atoi(sfx + 1) : 0;
+}
+
+static void feed_event_free(AVRO_FEED_EVENT *event)
+{
+    gwbuf_free(event->data);
+    MXS_FREE(event);
+}
+
+/**
+ * @brief Queue an event written by the binlogrouter
+ *
+ * Called in the thread of the master connection of the binlogrouter.
+ */
+static void feed_event_cb(void *data, const char *binlog, uint64_t pos,
+                          const uint8_t *event, uint32_t len)
+{
+    AVRO_FEED *feed = (AVRO_FEED*)data;
+    AVRO_FEED_EVENT *ev = NULL;
+
+    if (len >= BINLOG_EVENT_HDR_LEN && (ev = MXS_MALLOC(sizeof(AVRO_FEED_EVENT))))
+    {
+        /** The payload is null-terminated like the one read from the file */
+        if ((ev->data = gwbuf_alloc(len - BINLOG_EVENT_HDR_LEN + 1)))
+        {
+            memcpy(GWBUF_DATA(ev->data), event + BINLOG_EVENT_HDR_LEN, len - BINLOG_EVENT_HDR_LEN);
+            GWBUF_DATA(ev->data)[len - BINLOG_EVENT_HDR_LEN] = '\0';
+            memcpy(ev->hdr, event, BINLOG_EVENT_HDR_LEN);
+            snprintf(ev->binlog, sizeof(ev->binlog), "%s", binlog);
+            ev->pos = pos;
+            ev->len = len;
+            ev->next = NULL;
+        }
+        else
+        {
+            MXS_FREE(ev);
+            ev = NULL;
+        }
+    }
+
+    pthread_mutex_lock(&feed->lock);
+
+    if (ev && feed->bytes + len <= AVRO_FEED_MAX_BYTES)
+    {
+        if (feed->tail)
+        {
+            feed->tail->next = ev;
+        }
+        else
+        {
+            feed->head = ev;
+        }
+
+        feed->tail = ev;
+        feed->bytes += len;
+        feed->n_events++;
+        ev = NULL;
+    }
+    else
+    {
+        /** The event is read from the file */
+        feed->n_dropped++;
+    }
+
+    feed->pending = true;
+    pthread_cond_signal(&feed->cond);
+    pthread_mutex_unlock(&feed->lock);
+
+    if (ev)
+    {
+        feed_event_free(ev);
+    }
+}
+
+GWBUF* avro_feed_get_event(AVRO_INSTANCE *router, uint64_t pos, uint8_t *hdr)
+{
+    AVRO_FEED *feed = router->feed;
+
+    if (feed == NULL)
+    {
+        return NULL;
+    }
+
+    int number = binlog_number(router->binlog_name);
+    AVRO_FEED_EVENT *found = NULL;
+    AVRO_FEED_EVENT *old = NULL;
+
+    pthread_mutex_lock(&feed->lock);
+
+    /** Drop the events that were already read from the file */
+    while (feed->head)
+    {
+        AVRO_FEED_EVENT *ev = feed->head;
+        int ev_number = binlog_number(ev->binlog);
+
+        if (ev_number > number || (ev_number == number && ev->pos >= pos))
+        {
+            break;
+        }
+
+        feed->head = ev->next;
+        feed->bytes -= ev->len;
+        ev->next = old;
+        old = ev;
+    }
+
+    if (feed->head && feed->head->pos == pos &&
+        strcmp(feed->head->binlog, router->binlog_name) == 0)
+    {
+        found = feed->head;
+        feed->head = found->next;
+        feed->bytes -= found->len;
+        feed->n_hits++;
+    }
+
+    if (feed->head == NULL)
+    {
+        feed->tail = NULL;
+    }
+
+    pthread_mutex_unlock(&feed->lock);
+
+    while (old)
+    {
+        AVRO_FEED_EVENT *next = old->next;
+        feed_event_free(old);
+        old = next;
+    }
+
+    GWBUF *rval = NULL;
+
+    if (found)
+    {
+        memcpy(hdr, found->hdr, BINLOG_EVENT_HDR_LEN);
+        rval = found->data;
+        MXS_FREE(found);
+    }
+
+    return rval;
+}
+
+/**
+ * @brief Convert the events as they arrive until shutdown
+ *
+ * @param data The feed
+ */
+static void avro_feed_main(void *data)
+{
+    AVRO_FEED *feed = (AVRO_FEED*)data;
+    AVRO_INSTANCE *router = feed->router;
+
+    pthread_mutex_lock(&feed->lock);
+
+    while (!router->service->svc_do_shutdown)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += AVRO_FEED_POLL_INTERVAL;
+
+        /** The binlog files are also checked periodically, the events that the
+         * binlogrouter generates itself do not wake the thread up */
+        while (!feed->pending && !router->service->svc_do_shutdown &&
+               pthread_cond_timedwait(&feed->cond, &feed->lock, &ts) != ETIMEDOUT)
+        {
+            ;
+        }
+
+        feed->pending = false;
+
+        if (feed->active && !router->service->svc_do_shutdown)
+        {
+            pthread_mutex_unlock(&feed->lock);
+            bool converted;
+            avro_convert_binlogs(router, &converted);
+            pthread_mutex_lock(&feed->lock);
+        }
+    }
+
+    pthread_mutex_unlock(&feed->lock);
+    feed->api->unsubscribe(feed->source->router_instance, feed->subscription);
+}
+
+bool avro_feed_start(AVRO_INSTANCE *router)
+{
+    SERVICE *source = router->source;
+
+    if (!router->use_feed || source == NULL || source->router_instance == NULL)
+    {
+        return false;
+    }
+
+    /** Only one attempt is made, the binlog files are always there */
+    router->use_feed = false;
+
+    char path[PATH_MAX + 1];
+    snprintf(path, sizeof(path), "%s/lib%s.so", get_libdir(), source->routerModule);
+
+    /** The library was loaded for the source service */
+    void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL | RTLD_NOLOAD);
+    void *f = handle ? dlsym(handle, BINLOG_FEED_ENTRY_POINT) : NULL;
+    BINLOG_FEED_API *api = f ? ((BinlogGetFeedAPIFN)f)() : NULL;
+
+    if (api == NULL)
+    {
+        const char *err = dlerror();
+        MXS_WARNING("[%s] Could not look up symbol %s from %s: %s. The events "
+                    "are read from the binlog files.", router->service->name,
+                    BINLOG_FEED_ENTRY_POINT, path, err ? err : "");
+
+        if (handle)
+        {
+            dlclose(handle);
+        }
+
+        return false;
+    }
+
+    AVRO_FEED *feed = MXS_CALLOC(1, sizeof(AVRO_FEED));
+
+    if (feed == NULL)
+    {
+        dlclose(handle);
+        return false;
+    }
+
+    feed->router = router;
+    feed->source = source;
+    feed->handle = handle;
+    feed->api = api;
+    feed->active = true;
+    pthread_mutex_init(&feed->lock, NULL);
+    pthread_cond_init(&feed->cond, NULL);
+
+    if ((feed->subscription = api->subscribe(source->router_instance, feed_event_cb, feed)) == NULL)
+    {
+        MXS_FREE(feed);
+        dlclose(handle);
+        return false;
+    }
+
+    /** The events arriving before the thread starts are kept for it */
+    router->feed = feed;
+
+    if (thread_start(&feed->thread, avro_feed_main, feed) == NULL)
+    {
+        MXS_ERROR("[%s] Failed to start the conversion thread for the binlog events "
+                  "of service '%s'.", router->service->name, source->name);
+        router->feed = NULL;
+        api->unsubscribe(source->router_instance, feed->subscription);
+
+        for (AVRO_FEED_EVENT *ev = feed->head; ev;)
+        {
+            AVRO_FEED_EVENT *next = ev->next;
+            feed_event_free(ev);
+            ev = next;
+        }
+
+        MXS_FREE(feed);
+        dlclose(handle);
+        return false;
+    }
+
+    MXS_NOTICE("[%s] Receiving the binlog events of service '%s' in memory.",
+               router->service->name, source->name);
+    return true;
+}
+
+void avro_feed_ctl(AVRO_INSTANCE *router, bool start)
+{
+    AVRO_FEED *feed = router->feed;
+
+    pthread_mutex_lock(&feed->lock);
+    feed->active = start;
+    feed->pending = true;
+    pthread_cond_signal(&feed->cond);
+    pthread_mutex_unlock(&feed->lock);
+}
+
+void avro_feed_diagnostics(AVRO_INSTANCE *router, DCB *dcb)
+{
+    AVRO_FEED *feed = router->feed;
+
+    if (feed)
+    {
+        pthread_mutex_lock(&feed->lock);
+        dcb_printf(dcb, "\tBinlog events from service:          %s\n", feed->source->name);
+        dcb_printf(dcb, "\tBinlog events received in memory:    %lu\n", feed->n_events);
+        dcb_printf(dcb, "\tBinlog events converted from memory: %lu\n", feed->n_hits);
+        dcb_printf(dcb, "\tBinlog events not queued:            %lu\n", feed->n_dropped);
+        dcb_printf(dcb, "\tBinlog events queued:                %lu bytes\n", feed->bytes);
+        pthread_mutex_unlock(&feed->lock);
+    }
+}
@@ -49,7 +49,6 @@ void handle_query_event(AVRO_INSTANCE *router, REP_HEADER *hdr,
                         int *pending_transaction, uint8_t *ptr);
 bool is_create_table_statement(AVRO_INSTANCE *router, char* ptr, size_t len);
 void avro_notify_client(AVRO_CLIENT *client);
-void avro_update_index(AVRO_INSTANCE* router);
 void update_used_tables(AVRO_INSTANCE* router);
 TABLE_CREATE* table_create_from_schema(const char* file, const char* db,
                                        const char* table, int version);
@@ -100,18 +99,116 @@ void avro_close_binlog(int fd)
     close(fd);
 }
 
+/**
+ * @brief Open the block index of an Avro file for appending
+ *
+ * The index is optional, if it cannot be opened the rows are seeked without it.
+ *
+ * @param table The table whose Avro file was opened
+ * @param created Whether the Avro file was created or an existing one opened
+ */
+static void open_block_index(AVRO_TABLE *table, bool created)
+{
+    char filename[PATH_MAX + 1];
+    snprintf(filename, sizeof(filename), "%s"AVRO_BLOCK_INDEX_SUFFIX, table->filename);
+    struct stat st;
+
+    /** The rows appended from now on start a new entry */
+    table->index_entry.start = !created && stat(table->filename, &st) == 0 ? st.st_size : 0;
+    table->index_rows = false;
+
+    FILE *file = fopen(filename, created ? "w+b" : "a+b");
+
+    if (file == NULL)
+    {
+        char err[MXS_STRERROR_BUFLEN];
+        MXS_WARNING("Failed to open block index '%s': %d, %s", filename, errno,
+                    strerror_r(errno, err, sizeof(err)));
+        return;
+    }
+
+    if (fstat(fileno(file), &st) == 0)
+    {
+        if (st.st_size < AVRO_BLOCK_INDEX_MAGIC_LEN)
+        {
+            if (ftruncate(fileno(file), 0) == 0 &&
+                fwrite(AVRO_BLOCK_INDEX_MAGIC, 1, AVRO_BLOCK_INDEX_MAGIC_LEN, file) == AVRO_BLOCK_INDEX_MAGIC_LEN &&
+                fflush(file) == 0)
+            {
+                table->block_index = file;
+            }
+        }
+        else
+        {
+            /** Drop an entry that was only partially written */
+            off_t entries = (st.st_size - AVRO_BLOCK_INDEX_MAGIC_LEN) / sizeof(AVRO_BLOCK_INDEX);
+
+            if (ftruncate(fileno(file), AVRO_BLOCK_INDEX_MAGIC_LEN +
+                          entries * sizeof(AVRO_BLOCK_INDEX)) == 0)
+            {
+                table->block_index = file;
+            }
+        }
+    }
+
+    if (table->block_index == NULL)
+    {
+        MXS_WARNING("Failed to prepare block index '%s', the rows of '%s' are "
+                    "not indexed.", filename, table->filename);
+        fclose(file);
+    }
+}
+
+/**
+ * @brief Add the rows flushed to the Avro file to its block index
+ *
+ * To be called after the Avro file is flushed. If the entry cannot be written,
+ * the file is no longer indexed. The readers only use the entries that
+ * continue from the previous one.
+ *
+ * @param table Table whose Avro file was flushed
+ */
+static void write_block_index(AVRO_TABLE *table)
+{
+    struct stat st;
+
+    if (table->index_rows && stat(table->filename, &st) == 0)
+    {
+        table->index_entry.end = st.st_size;
+
+        if (table->block_index &&
+            (fwrite(&table->index_entry, sizeof(table->index_entry), 1, table->block_index) != 1 ||
+             fflush(table->block_index) != 0))
+        {
+            MXS_ERROR("Failed to write block index of '%s', the rows are no longer "
+                      "indexed.", table->filename);
+            fclose(table->block_index);
+            table->block_index = NULL;
+        }
+
+        table->index_entry.start = table->index_entry.end;
+        table->index_rows = false;
+    }
+}
+
 /**
  * @brief Allocate an Avro table
  *
  * Create an Aro table and prepare it for writing.
  * @param filepath Path to the created file
  * @param json_schema The schema of the table in JSON format
+ * @param codec The compression codec of the data blocks, an existing file
+ * keeps the codec it was created with
+ * @param block_size The Avro datablock size
  */
-AVRO_TABLE* avro_table_alloc(const char* filepath, const char* json_schema, size_t block_size)
+AVRO_TABLE* avro_table_alloc(const char* filepath, const char* json_schema, const char *codec,
+                             size_t block_size)
 {
     AVRO_TABLE *table = MXS_CALLOC(1, sizeof(AVRO_TABLE));
     if (table)
     {
+        table->tail_fd = -1;
+
         if (avro_schema_from_json_length(json_schema, strlen(json_schema),
                                          &table->avro_schema))
         {
@@ -122,14 +219,16 @@ AVRO_TABLE* avro_table_alloc(const char* filepath, const char* json_schema, size
         }
 
         int rc = 0;
+        bool created = access(filepath, F_OK) != 0;
 
-        if (access(filepath, F_OK) == 0)
+        if (!created)
         {
             rc = avro_file_writer_open_bs(filepath, &table->avro_file, block_size);
         }
         else
         {
-            rc = avro_file_writer_create_with_codec(filepath, table->avro_schema, &table->avro_file, "null", block_size);
+            rc = avro_file_writer_create_with_codec(filepath, table->avro_schema,
+                                                    &table->avro_file, codec, block_size);
         }
 
         if (rc)
@@ -151,6 +250,7 @@ AVRO_TABLE* avro_table_alloc(const char* filepath, const char* json_schema, size
 
         table->json_schema = MXS_STRDUP_A(json_schema);
         table->filename = MXS_STRDUP_A(filepath);
+        open_block_index(table, created);
     }
     return table;
 }
@@ -186,6 +286,13 @@ bool avro_save_conversion_state(AVRO_INSTANCE *router)
     fprintf(config_file, "gtid=%lu-%lu-%lu:%lu\n", router->gtid.domain,
             router->gtid.server_id, router->gtid.seq, router->gtid.event_num);
     fprintf(config_file, "file=%s\n", router->binlog_name);
+
+    if (router->kafka_gtid_set)
+    {
+        fprintf(config_file, "kafka_gtid=%lu-%lu-%lu:%lu\n", router->kafka_gtid.domain,
+                router->kafka_gtid.server_id, router->kafka_gtid.seq, router->kafka_gtid.event_num);
+    }
+
     fclose(config_file);
 
     /* rename tmp file to right filename */
@@ -203,6 +310,34 @@ bool avro_save_conversion_state(AVRO_INSTANCE *router)
     return true;
 }
 
+/**
+ * @brief Parse a GTID of the stored conversion state
+ *
+ * @param value The GTID in the domain-server_id-sequence:event_number format
+ * @param gtid Where the GTID is stored
+ * @return True if the GTID was complete
+ */
+static bool parse_state_gtid(const char *value, gtid_pos_t *gtid)
+{
+    char tempval[strlen(value) + 1];
+    memcpy(tempval, value, sizeof(tempval));
+    char *saved, *domain = strtok_r(tempval, ":-\n", &saved);
+    char *serv_id = strtok_r(NULL, ":-\n", &saved);
+    char *seq = strtok_r(NULL, ":-\n", &saved);
+    char *subseq = strtok_r(NULL, ":-\n", &saved);
+
+    if (domain && serv_id && seq && subseq)
+    {
+        gtid->domain = strtol(domain, NULL, 10);
+        gtid->server_id = strtol(serv_id, NULL, 10);
+        gtid->seq = strtol(seq, NULL, 10);
+        gtid->event_num = strtol(subseq, NULL, 10);
+        return true;
+    }
+
+    return false;
+}
+
 /**
  * @brief Callback for the @c ini_parse of the stored conversion position
  *
@@ -220,20 +355,11 @@ static int conv_state_handler(void* data, const char* section, const char* key,
     {
         if (strcmp(key, "gtid") == 0)
         {
-            char tempval[strlen(value) + 1];
-            memcpy(tempval, value, sizeof(tempval));
-            char *saved, *domain = strtok_r(tempval, ":-\n", &saved);
-            char *serv_id = strtok_r(NULL, ":-\n", &saved);
-            char *seq = strtok_r(NULL, ":-\n", &saved);
-            char *subseq = strtok_r(NULL, ":-\n", &saved);
-
-            if (domain && serv_id && seq && subseq)
-            {
-                router->gtid.domain = strtol(domain, NULL, 10);
-                router->gtid.server_id = strtol(serv_id, NULL, 10);
-                router->gtid.seq = strtol(seq, NULL, 10);
-                router->gtid.event_num = strtol(subseq, NULL, 10);
-            }
+            parse_state_gtid(value, &router->gtid);
+        }
+        else if (strcmp(key, "kafka_gtid") == 0)
+        {
+            router->kafka_gtid_set = parse_state_gtid(value, &router->kafka_gtid);
         }
         else if (strcmp(key, "position") == 0)
         {
@@ -291,6 +417,20 @@ bool avro_load_conversion_state(AVRO_INSTANCE *router)
         MXS_NOTICE("Loaded stored binary log conversion state: File: [%s] Position: [%ld] GTID: [%lu-%lu-%lu:%lu]",
                    router->binlog_name, router->current_pos, router->gtid.domain,
                    router->gtid.server_id, router->gtid.seq, router->gtid.event_num);
+
+        if (router->kafka && router->kafka_gtid_set &&
+            (router->kafka_gtid.domain != router->gtid.domain ||
+             router->kafka_gtid.server_id != router->gtid.server_id ||
+             router->kafka_gtid.seq != router->gtid.seq ||
+             router->kafka_gtid.event_num != router->gtid.event_num))
+        {
+            MXS_WARNING("[%s] The rows converted after GTID %lu-%lu-%lu:%lu were not "
+                        "published to Kafka, publishing continues from GTID %lu-%lu-%lu:%lu.",
+                        router->service->name, router->kafka_gtid.domain,
+                        router->kafka_gtid.server_id, router->kafka_gtid.seq,
+                        router->kafka_gtid.event_num, router->gtid.domain,
+                        router->gtid.server_id, router->gtid.seq, router->gtid.event_num);
+        }
         break;
 
     case -1:
@@ -319,8 +459,17 @@ void avro_table_free(AVRO_TABLE *table)
 {
     if (table)
     {
+        avro_kafka_close_topic(table);
+        avro_tail_close(table);
         avro_file_writer_flush(table->avro_file);
+        write_block_index(table);
         avro_file_writer_close(table->avro_file);
+
+        if (table->block_index)
+        {
+            fclose(table->block_index);
+        }
+
         avro_value_iface_decref(table->avro_writer_iface);
         avro_schema_decref(table->avro_schema);
         MXS_FREE(table->json_schema);
@@ -479,10 +628,20 @@ void notify_all_clients(AVRO_INSTANCE *router)
 
 void do_checkpoint(AVRO_INSTANCE *router, uint64_t *total_rows, uint64_t *total_commits)
 {
+    avro_workers_drain(router);
     update_used_tables(router);
     avro_flush_all_tables(router, AVROROUTER_FLUSH);
+    avro_kafka_flush(router);
+    avro_parquet_flush(router);
     avro_save_conversion_state(router);
     notify_all_clients(router);
+    router->index_rows += router->row_count;
+
+    if (avro_index_due(router))
+    {
+        avro_update_index(router);
+    }
+
     *total_rows += router->row_count;
     *total_commits += router->trx_count;
     router->row_count = router->trx_count = 0;
@@ -522,8 +681,12 @@ avro_binlog_end_t avro_read_all_events(AVRO_INSTANCE *router)
     while (!router->service->svc_do_shutdown)
     {
         int n;
+        /* Take the event from the binlog feed if it is there */
+        GWBUF *result = avro_feed_get_event(router, pos, hdbuf);
+
         /* Read the header information from the file */
-        if ((n = pread(router->binlog_fd, hdbuf, BINLOG_EVENT_HDR_LEN, pos)) != BINLOG_EVENT_HDR_LEN)
+        if (result == NULL &&
+            (n = pread(router->binlog_fd, hdbuf, BINLOG_EVENT_HDR_LEN, pos)) != BINLOG_EVENT_HDR_LEN)
         {
             switch (n)
             {
@@ -602,6 +765,7 @@ avro_binlog_end_t avro_read_all_events(AVRO_INSTANCE *router)
                       hdr.event_type, router->binlog_name, pos);
             router->binlog_position = last_known_commit;
             router->current_pos = pos;
+            gwbuf_free(result);
             return AVRO_BINLOG_ERROR;
         }
 
@@ -613,12 +777,11 @@ avro_binlog_end_t avro_read_all_events(AVRO_INSTANCE *router)
 
             router->binlog_position = last_known_commit;
             router->current_pos = pos;
+            gwbuf_free(result);
             return AVRO_BINLOG_ERROR;
         }
 
-        GWBUF *result = read_event_data(router, &hdr, pos);
-
-        if (result == NULL)
+        if (result == NULL && (result = read_event_data(router, &hdr, pos)) == NULL)
         {
             router->binlog_position = last_known_commit;
             router->current_pos = pos;
@@ -671,6 +834,7 @@ avro_binlog_end_t avro_read_all_events(AVRO_INSTANCE *router)
             MXS_INFO("Annotate_rows_event: %.*s", hdr.event_size - BINLOG_EVENT_HDR_LEN, ptr);
             pos += original_size;
             router->current_pos = pos;
+            gwbuf_free(result);
             continue;
         }
         else if (hdr.event_type == TABLE_MAP_EVENT)
@@ -718,6 +882,7 @@ avro_binlog_end_t avro_read_all_events(AVRO_INSTANCE *router)
             router->gtid.seq = n_sequence;
             router->gtid.event_num = 0;
             router->gtid.timestamp = hdr.timestamp;
+            avro_workers_new_trx(router);
 
             /* GTID event flags check, for 10.0 and 10.1 */
             if ((flags & (MARIADB_FL_DDL | MARIADB_FL_STANDALONE)) == 0)
@@ -875,6 +1040,8 @@ void avro_flush_all_tables(AVRO_INSTANCE *router, enum avrorouter_file_op flush)
                 if (flush == AVROROUTER_FLUSH)
                 {
                     avro_file_writer_flush(table->avro_file);
+                    write_block_index(table);
+                    avro_tail_append(table);
                 }
                 else
                 {
@@ -1109,6 +1276,9 @@ void handle_query_event(AVRO_INSTANCE *router, REP_HEADER *hdr, int *pending_tra
     {
         TABLE_CREATE *created = NULL;
 
+        /** The conversion threads may use the table that is replaced */
+        avro_workers_drain(router);
+
         if (is_create_like_statement(sql, len))
         {
             created = table_create_copy(router, sql, len, db);
@@ -1135,6 +1305,7 @@ void handle_query_event(AVRO_INSTANCE *router, REP_HEADER *hdr, int *pending_tra
     else if (is_alter_table_statement(router, sql, len))
     {
         TABLE_CREATE *created = hashtable_fetch(router->created_tables, ident);
+        avro_workers_drain(router);
 
         if (created)
         {
@@ -39,8 +39,18 @@
 
 void* safe_key_free(void *data);
 
-static const char insert_template[] = "INSERT INTO gtid(domain, server_id, "
-                                      "sequence, avrofile, position) values (%lu, %lu, %lu, \"%s\", %ld);";
+/** Statements used by the conversion task. Each statement is prepared once. */
+static const char gtid_insert_sql[] = "INSERT INTO "GTID_TABLE_NAME"(domain, server_id, "
+                                      "sequence, avrofile, position) VALUES (?, ?, ?, ?, ?);";
+static const char index_pos_select_sql[] = "SELECT max(position) FROM "INDEX_TABLE_NAME
+                                           " WHERE filename = ?;";
+static const char index_pos_update_sql[] = "UPDATE "INDEX_TABLE_NAME" SET position = ?"
+                                           " WHERE filename = ?;";
+static const char index_pos_insert_sql[] = "INSERT INTO "INDEX_TABLE_NAME"(position, filename)"
+                                           " VALUES (?, ?);";
+static const char used_table_insert_sql[] = "INSERT OR IGNORE INTO "MEMORY_TABLE_NAME
+                                            "(domain, server_id, sequence, binlog_timestamp, table_name)"
+                                            " VALUES (?, ?, ?, ?, ?);";
 
 static void set_gtid(gtid_pos_t *gtid, json_t *row)
 {
@@ -57,17 +67,141 @@ static void set_gtid(gtid_pos_t *gtid, json_t *row)
     gtid->domain = json_integer_value(obj);
 }
 
-int index_query_cb(void *data, int rows, char** values, char** names)
+/**
+ * @brief Execute a statement that returns no rows
+ *
+ * @param stmt Statement with bound parameters, reset for the next use
+ * @return True if the statement was executed
+ */
+static bool execute_stmt(sqlite3_stmt *stmt)
 {
-    for (int i = 0; i < rows; i++)
+    int rc = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    return rc == SQLITE_DONE;
+}
+
+/**
+ * @brief Prepare the GTID index for the conversion task
+ *
+ * The index database uses a write-ahead log so that the clients reading it
+ * do not block the conversion task and the conversion task does not block
+ * the clients. The write-ahead log is not synced on every commit. The index
+ * can always be rebuilt from the Avro files.
+ *
+ * @param router Avro router instance with an open database
+ * @return True if the statements were prepared
+ */
+bool avro_index_init(AVRO_INSTANCE *router)
+{
+    char *errmsg = NULL;
+
+    if (sqlite3_exec(router->sqlite_handle, "PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;",
+                     NULL, NULL, &errmsg) != SQLITE_OK)
+    {
+        MXS_WARNING("Failed to enable the write-ahead log of the GTID index: %s", errmsg);
+    }
+    sqlite3_free(errmsg);
+
+    struct
+    {
+        const char *sql;
+        sqlite3_stmt **stmt;
+    } statements[] =
     {
-        if (values[i])
+        {gtid_insert_sql, &router->gtid_insert},
+        {index_pos_select_sql, &router->index_pos_select},
+        {index_pos_update_sql, &router->index_pos_update},
+        {index_pos_insert_sql, &router->index_pos_insert},
+        {used_table_insert_sql, &router->used_table_insert}
+    };
+
+    for (size_t i = 0; i < sizeof(statements) / sizeof(statements[0]); i++)
+    {
+        if (sqlite3_prepare_v2(router->sqlite_handle, statements[i].sql, -1,
+                               statements[i].stmt, NULL) != SQLITE_OK)
         {
-            *((long*)data) = strtol(values[i], NULL, 10);
-            return 0;
+            MXS_ERROR("Failed to prepare statement '%s': %s", statements[i].sql,
+                      sqlite3_errmsg(router->sqlite_handle));
+            avro_index_free(router);
+            return false;
         }
     }
-    return 0;
+
+    router->index_time = time(NULL);
+    return true;
+}
+
+/**
+ * @brief Free the prepared statements of the GTID index
+ *
+ * @param router Avro router instance
+ */
+void avro_index_free(AVRO_INSTANCE *router)
+{
+    sqlite3_finalize(router->gtid_insert);
+    sqlite3_finalize(router->index_pos_select);
+    sqlite3_finalize(router->index_pos_update);
+    sqlite3_finalize(router->index_pos_insert);
+    sqlite3_finalize(router->used_table_insert);
+    router->gtid_insert = NULL;
+    router->index_pos_select = NULL;
+    router->index_pos_update = NULL;
+    router->index_pos_insert = NULL;
+    router->used_table_insert = NULL;
+}
+
+/**
+ * @brief Read the last indexed position of a file
+ *
+ * @param router Avro router instance
+ * @param name Name of the file
+ * @param pos The position is stored here, -1 if the file is not yet indexed
+ * @return True if the position was read
+ */
+static bool get_index_pos(AVRO_INSTANCE *router, const char *name, long *pos)
+{
+    sqlite3_stmt *stmt = router->index_pos_select;
+    sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+
+    int rc = sqlite3_step(stmt);
+
+    if (rc == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL)
+    {
+        *pos = sqlite3_column_int64(stmt, 0);
+    }
+
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    return rc == SQLITE_ROW || rc == SQLITE_DONE;
+}
+
+/**
+ * @brief Store the last indexed position of a file
+ *
+ * @param router Avro router instance
+ * @param name Name of the file
+ * @param pos The new position
+ * @return True if the position was stored
+ */
+static bool set_index_pos(AVRO_INSTANCE *router, const char *name, long pos)
+{
+    sqlite3_bind_int64(router->index_pos_update, 1, pos);
+    sqlite3_bind_text(router->index_pos_update, 2, name, -1, SQLITE_STATIC);
+
+    if (!execute_stmt(router->index_pos_update))
+    {
+        return false;
+    }
+
+    if (sqlite3_changes(router->sqlite_handle) == 0)
+    {
+        sqlite3_bind_int64(router->index_pos_insert, 1, pos);
+        sqlite3_bind_text(router->index_pos_insert, 2, name, -1, SQLITE_STATIC);
+        return execute_stmt(router->index_pos_insert);
+    }
+
+    return true;
 }
 
 void avro_index_file(AVRO_INSTANCE *router, const char* filename)
@@ -81,19 +215,13 @@ void avro_index_file(AVRO_INSTANCE *router, const char* filename)
 
         if (name)
         {
-            char sql[AVRO_SQL_BUFFER_SIZE];
-            char *errmsg;
             long pos = -1;
             name++;
 
-            snprintf(sql, sizeof(sql), "SELECT position FROM "INDEX_TABLE_NAME
-                     " WHERE filename=\"%s\";", name);
-
-            if (sqlite3_exec(router->sqlite_handle, sql, index_query_cb, &pos, &errmsg) != SQLITE_OK)
+            if (!get_index_pos(router, name, &pos))
             {
                 MXS_ERROR("Failed to read last indexed position of file '%s': %s",
-                          name, errmsg);
-                sqlite3_free(errmsg);
+                          name, sqlite3_errmsg(router->sqlite_handle));
                 maxavro_file_close(file);
                 return;
             }
@@ -107,12 +235,6 @@ void avro_index_file(AVRO_INSTANCE *router, const char* filename)
 
             gtid_pos_t prev_gtid = {0, 0, 0, 0, 0};
 
-            if (sqlite3_exec(router->sqlite_handle, "BEGIN", NULL, NULL, &errmsg) != SQLITE_OK)
-            {
-                MXS_ERROR("Failed to start transaction: %s", errmsg);
-            }
-            sqlite3_free(errmsg);
-
             do
             {
                 json_t *row = maxavro_record_read_json(file);
@@ -126,18 +248,20 @@ void avro_index_file(AVRO_INSTANCE *router, const char* filename)
                         prev_gtid.server_id != gtid.server_id ||
                         prev_gtid.seq != gtid.seq)
                     {
-                        snprintf(sql, sizeof(sql), insert_template, gtid.domain,
-                                 gtid.server_id, gtid.seq, name, file->block_start_pos);
-                        if (sqlite3_exec(router->sqlite_handle, sql, NULL, NULL,
-                                         &errmsg) != SQLITE_OK)
+                        sqlite3_stmt *stmt = router->gtid_insert;
+                        sqlite3_bind_int64(stmt, 1, gtid.domain);
+                        sqlite3_bind_int64(stmt, 2, gtid.server_id);
+                        sqlite3_bind_int64(stmt, 3, gtid.seq);
+                        sqlite3_bind_text(stmt, 4, name, -1, SQLITE_STATIC);
+                        sqlite3_bind_int64(stmt, 5, file->block_start_pos);
+
+                        if (!execute_stmt(stmt))
                         {
                             MXS_ERROR("Failed to insert GTID %lu-%lu-%lu for %s "
                                       "into index database: %s", gtid.domain,
-                                      gtid.server_id, gtid.seq, name, errmsg);
-
+                                      gtid.server_id, gtid.seq, name,
+                                      sqlite3_errmsg(router->sqlite_handle));
                         }
-                        sqlite3_free(errmsg);
-                        errmsg = NULL;
                         prev_gtid = gtid;
                     }
                     json_decref(row);
@@ -149,21 +273,11 @@ void avro_index_file(AVRO_INSTANCE *router, const char* filename)
             }
             while (maxavro_next_block(file));
 
-            if (sqlite3_exec(router->sqlite_handle, "COMMIT", NULL, NULL, &errmsg) != SQLITE_OK)
-            {
-                MXS_ERROR("Failed to commit transaction: %s", errmsg);
-            }
-            sqlite3_free(errmsg);
-
-            snprintf(sql, sizeof(sql), "INSERT OR REPLACE INTO "INDEX_TABLE_NAME
-                     " values (%lu, \"%s\");", file->block_start_pos, name);
-            if (sqlite3_exec(router->sqlite_handle, sql, NULL, NULL,
-                             &errmsg) != SQLITE_OK)
+            if (!set_index_pos(router, name, file->block_start_pos))
             {
-                MXS_ERROR("Failed to update indexing progress: %s", errmsg);
+                MXS_ERROR("Failed to update indexing progress: %s",
+                          sqlite3_errmsg(router->sqlite_handle));
             }
-            sqlite3_free(errmsg);
-            errmsg = NULL;
         }
         else
         {
@@ -178,12 +292,27 @@ void avro_index_file(AVRO_INSTANCE *router, const char* filename)
     }
 }
 
+/**
+ * @brief Check if the GTID index should be updated
+ *
+ * The index is updated in batches, once enough rows have been converted or
+ * some time has passed since the last update.
+ *
+ * @param router Avro router instance
+ * @return True if avro_update_index() should be called
+ */
+bool avro_index_due(AVRO_INSTANCE *router)
+{
+    return router->index_rows >= AVRO_INDEX_BATCH_ROWS ||
+           (router->index_rows > 0 && time(NULL) - router->index_time >= AVRO_INDEX_INTERVAL);
+}
+
 /**
  * @brief Avro file indexing task
  *
  * Builds an index of filenames, GTIDs and positions in the Avro file.
  * This allows all tables that contain a GTID to be fetched in an effiecent
- * manner.
+ * manner. All files are indexed in one transaction.
  * @param data The router instance
  */
 void avro_update_index(AVRO_INSTANCE* router)
@@ -191,6 +320,14 @@ void avro_update_index(AVRO_INSTANCE* router)
     char path[PATH_MAX + 1];
     snprintf(path, sizeof(path), "%s/*.avro", router->avrodir);
     glob_t files;
+    char *errmsg = NULL;
+
+    if (sqlite3_exec(router->sqlite_handle, "BEGIN", NULL, NULL, &errmsg) != SQLITE_OK)
+    {
+        MXS_ERROR("Failed to start transaction: %s", errmsg);
+    }
+    sqlite3_free(errmsg);
+    errmsg = NULL;
 
     if (glob(path, 0, NULL, &files) != GLOB_NOMATCH)
     {
@@ -201,12 +338,16 @@ void avro_update_index(AVRO_INSTANCE* router)
     }
 
     globfree(&files);
-}
 
-/** The SQL for the in-memory used_tables table */
-static const char *insert_sql = "INSERT OR IGNORE INTO "MEMORY_TABLE_NAME
-                                "(domain, server_id, sequence, binlog_timestamp, table_name)"
-                                " VALUES (%lu, %lu, %lu, %u, \"%s\")";
+    if (sqlite3_exec(router->sqlite_handle, "COMMIT", NULL, NULL, &errmsg) != SQLITE_OK)
+    {
+        MXS_ERROR("Failed to commit transaction: %s", errmsg);
+    }
+    sqlite3_free(errmsg);
+
+    router->index_rows = 0;
+    router->index_time = time(NULL);
+}
 
 /**
  * @brief Add a used table to the current transaction
@@ -217,26 +358,29 @@ static const char *insert_sql = "INSERT OR IGNORE INTO "MEMORY_TABLE_NAME
  * @param router Avro router instance
  * @param table Table to add
  */
-void add_used_table(AVRO_INSTANCE* router, char* table)
+void add_used_table(AVRO_INSTANCE* router, const char* table)
 {
-    char sql[AVRO_SQL_BUFFER_SIZE], *errmsg;
-    snprintf(sql, sizeof(sql), insert_sql, router->gtid.domain, router->gtid.server_id,
-             router->gtid.seq, router->gtid.timestamp, table);
-
-    if (sqlite3_exec(router->sqlite_handle, sql, NULL, NULL, &errmsg) != SQLITE_OK)
+    sqlite3_stmt *stmt = router->used_table_insert;
+    sqlite3_bind_int64(stmt, 1, router->gtid.domain);
+    sqlite3_bind_int64(stmt, 2, router->gtid.server_id);
+    sqlite3_bind_int64(stmt, 3, router->gtid.seq);
+    sqlite3_bind_int64(stmt, 4, router->gtid.timestamp);
+    sqlite3_bind_text(stmt, 5, table, -1, SQLITE_STATIC);
+
+    if (!execute_stmt(stmt))
     {
         MXS_ERROR("Failed to add used table %s for GTID %lu-%lu-%lu: %s",
                   table, router->gtid.domain, router->gtid.server_id,
-                  router->gtid.seq, errmsg);
+                  router->gtid.seq, sqlite3_errmsg(router->sqlite_handle));
     }
-    sqlite3_free(errmsg);
 }
 
 /**
  * @brief Update the tables used in a transaction
  *
  * This flushes the in-memory table to disk and should be called after the
- * Avro records have been flushed to disk.
+ * Avro records have been flushed to disk. Both statements are executed in
+ * one transaction.
  *
  * @param router Avro router instance
  */
@@ -244,17 +388,18 @@ void update_used_tables(AVRO_INSTANCE* router)
 {
     char *errmsg;
 
-    if (sqlite3_exec(router->sqlite_handle, "INSERT INTO "USED_TABLES_TABLE_NAME
-                     " SELECT * FROM "MEMORY_TABLE_NAME, NULL, NULL, &errmsg) != SQLITE_OK)
+    if (sqlite3_exec(router->sqlite_handle, "BEGIN; INSERT INTO "USED_TABLES_TABLE_NAME
+                     " SELECT * FROM "MEMORY_TABLE_NAME"; DELETE FROM "MEMORY_TABLE_NAME
+                     "; COMMIT;", NULL, NULL, &errmsg) != SQLITE_OK)
     {
         MXS_ERROR("Failed to transfer used table data from memory to disk: %s", errmsg);
-    }
-    sqlite3_free(errmsg);
+        sqlite3_free(errmsg);
+        errmsg = NULL;
 
-    if (sqlite3_exec(router->sqlite_handle, "DELETE FROM "MEMORY_TABLE_NAME,
-                     NULL, NULL, &errmsg) != SQLITE_OK)
-    {
-        MXS_ERROR("Failed to transfer used table data from memory to disk: %s", errmsg);
+        if (sqlite3_exec(router->sqlite_handle, "ROLLBACK", NULL, NULL, &errmsg) != SQLITE_OK)
+        {
+            MXS_ERROR("Failed to roll back used table transfer: %s", errmsg);
+        }
     }
     sqlite3_free(errmsg);
 }
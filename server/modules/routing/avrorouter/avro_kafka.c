@@ -0,0 +1,339 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file avro_kafka.c - Publishing the converted rows to Kafka
+ *
+ * Each converted row is also sent as a JSON object to the Kafka topic of its
+ * table. The messages are batched and sent asynchronously by librdkafka, all
+ * the rows of a table go to the first partition of its topic so that they stay
+ * in binlog order.
+ *
+ * The delivery of the messages is not given up on. Before the conversion state
+ * is saved, the conversion waits until Kafka has acknowledged all the queued
+ * rows and the GTID up to which they were delivered is saved with the state.
+ * After a restart, the rows that follow the saved state are converted and
+ * published again, so a row is delivered at least once.
+ */
+
+#include "avrorouter.h"
+
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+
+#ifdef HAVE_RDKAFKA
+
+#include <librdkafka/rdkafka.h>
+
+/** How often a warning is logged while Kafka does not acknowledge the rows */
+#define AVRO_KAFKA_WARN_INTERVAL 60
+
+/**
+ * @brief Delivery report callback of the producer
+ *
+ * @param rk The producer
+ * @param msg The delivered or failed message
+ * @param opaque The router instance
+ */
+static void delivery_cb(rd_kafka_t *rk, const rd_kafka_message_t *msg, void *opaque)
+{
+    AVRO_INSTANCE *router = (AVRO_INSTANCE*)opaque;
+
+    if (msg->err)
+    {
+        atomic_add_uint64(&router->kafka_failed, 1);
+        MXS_ERROR("[%s] Failed to publish a row to Kafka topic '%s': %s",
+                  router->service->name, rd_kafka_topic_name(msg->rkt),
+                  rd_kafka_err2str(msg->err));
+    }
+    else
+    {
+        atomic_add_uint64(&router->kafka_delivered, 1);
+    }
+}
+
+/**
+ * @brief Set a configuration value of the producer
+ *
+ * @param router Avro router instance
+ * @param conf The configuration
+ * @param name Name of the value
+ * @param value The value
+ * @return True if the value was set
+ */
+static bool set_conf(AVRO_INSTANCE *router, rd_kafka_conf_t *conf, const char *name, const char *value)
+{
+    char errstr[512];
+
+    if (rd_kafka_conf_set(conf, name, value, errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK)
+    {
+        MXS_ERROR("[%s] Failed to set Kafka option '%s': %s", router->service->name, name, errstr);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Create the Kafka producer
+ *
+ * Does nothing if no Kafka brokers are configured.
+ *
+ * @param router Avro router instance
+ * @return True if the producer was created or Kafka is not used
+ */
+bool avro_kafka_init(AVRO_INSTANCE *router)
+{
+    if (router->kafka_broker == NULL || *router->kafka_broker == '\0')
+    {
+        return true;
+    }
+
+    rd_kafka_conf_t *conf = rd_kafka_conf_new();
+    char errstr[512];
+
+    /** The rows are retried until they are delivered, the conversion waits
+     * for them before the conversion state is saved */
+    if (!set_conf(router, conf, "bootstrap.servers", router->kafka_broker) ||
+        !set_conf(router, conf, "message.timeout.ms", "0"))
+    {
+        rd_kafka_conf_destroy(conf);
+        return false;
+    }
+
+    rd_kafka_conf_set_opaque(conf, router);
+    rd_kafka_conf_set_dr_msg_cb(conf, delivery_cb);
+
+    rd_kafka_t *rk = rd_kafka_new(RD_KAFKA_PRODUCER, conf, errstr, sizeof(errstr));
+
+    if (rk == NULL)
+    {
+        MXS_ERROR("[%s] Failed to create Kafka producer: %s", router->service->name, errstr);
+        rd_kafka_conf_destroy(conf);
+        return false;
+    }
+
+    router->kafka = rk;
+    MXS_NOTICE("[%s] Publishing the converted rows to Kafka brokers: %s",
+               router->service->name, router->kafka_broker);
+    return true;
+}
+
+/**
+ * @brief Destroy the Kafka producer
+ *
+ * The rows that have not been delivered are discarded.
+ *
+ * @param router Avro router instance
+ */
+void avro_kafka_free(AVRO_INSTANCE *router)
+{
+    if (router->kafka)
+    {
+        rd_kafka_destroy(router->kafka);
+        router->kafka = NULL;
+    }
+}
+
+/**
+ * @brief Open the Kafka topic of a table
+ *
+ * The topic is the configured prefix followed by the table identifier.
+ *
+ * @param router Avro router instance
+ * @param table The Avro file of the table
+ * @param table_ident The table identifier, the database and table names
+ * separated by a dot
+ */
+void avro_kafka_open_topic(AVRO_INSTANCE *router, AVRO_TABLE *table, const char *table_ident)
+{
+    if (router->kafka)
+    {
+        const char *prefix = router->kafka_topic_prefix ? router->kafka_topic_prefix : "";
+        char name[strlen(prefix) + strlen(table_ident) + 1];
+        sprintf(name, "%s%s", prefix, table_ident);
+
+        if ((table->kafka_topic = rd_kafka_topic_new(router->kafka, name, NULL)) == NULL)
+        {
+            MXS_ERROR("[%s] Failed to open Kafka topic '%s', the rows of the table are not "
+                      "published: %s", router->service->name, name,
+                      rd_kafka_err2str(rd_kafka_last_error()));
+        }
+        else
+        {
+            table->kafka_router = router;
+        }
+    }
+}
+
+/**
+ * @brief Close the Kafka topic of a table
+ *
+ * The queued rows of the table are delivered even after the topic is closed.
+ *
+ * @param table The Avro file of the table
+ */
+void avro_kafka_close_topic(AVRO_TABLE *table)
+{
+    if (table->kafka_topic)
+    {
+        rd_kafka_topic_destroy(table->kafka_topic);
+        table->kafka_topic = NULL;
+    }
+}
+
+/**
+ * @brief Publish a row to the Kafka topic of its table
+ *
+ * If the queue of the producer is full, this waits until there is room in it.
+ *
+ * @param table The Avro file of the table
+ * @param record The converted row
+ */
+void avro_kafka_produce(AVRO_TABLE *table, avro_value_t *record)
+{
+    if (table->kafka_topic == NULL)
+    {
+        return;
+    }
+
+    AVRO_INSTANCE *router = table->kafka_router;
+    char *json;
+
+    if (avro_value_to_json(record, 1, &json))
+    {
+        MXS_ERROR("[%s] Failed to convert a row to JSON for Kafka: %s",
+                  router->service->name, avro_strerror());
+        atomic_add_uint64(&router->kafka_failed, 1);
+        return;
+    }
+
+    /** The message owns the JSON, it is freed once the row is delivered */
+    while (rd_kafka_produce(table->kafka_topic, 0, RD_KAFKA_MSG_F_FREE, json,
+                            strlen(json), NULL, 0, NULL) == -1)
+    {
+        if (rd_kafka_last_error() != RD_KAFKA_RESP_ERR__QUEUE_FULL)
+        {
+            MXS_ERROR("[%s] Failed to publish a row to Kafka topic '%s': %s",
+                      router->service->name, rd_kafka_topic_name(table->kafka_topic),
+                      rd_kafka_err2str(rd_kafka_last_error()));
+            atomic_add_uint64(&router->kafka_failed, 1);
+            free(json);
+            return;
+        }
+
+        /** Let the producer deliver some of the queued rows */
+        rd_kafka_poll(router->kafka, 100);
+    }
+
+    atomic_add_uint64(&router->kafka_produced, 1);
+    rd_kafka_poll(router->kafka, 0);
+}
+
+/**
+ * @brief Wait until Kafka has acknowledged all the queued rows
+ *
+ * To be called by the conversion task after the conversion threads have been
+ * drained and before the conversion state is saved. The GTID up to which the
+ * rows have been delivered is updated to the current GTID.
+ *
+ * @param router Avro router instance
+ */
+void avro_kafka_flush(AVRO_INSTANCE *router)
+{
+    if (router->kafka == NULL)
+    {
+        return;
+    }
+
+    time_t start = time(NULL);
+    time_t warned = start;
+
+    while (rd_kafka_flush(router->kafka, 1000) != RD_KAFKA_RESP_ERR_NO_ERROR)
+    {
+        time_t now = time(NULL);
+
+        if (now - warned >= AVRO_KAFKA_WARN_INTERVAL)
+        {
+            MXS_WARNING("[%s] Kafka has not acknowledged %d rows in %ld seconds, "
+                        "the conversion is waiting for them.", router->service->name,
+                        rd_kafka_outq_len(router->kafka), (long)(now - start));
+            warned = now;
+        }
+    }
+
+    router->kafka_gtid = router->gtid;
+    router->kafka_gtid_set = true;
+}
+
+/**
+ * @brief Print the Kafka statistics
+ *
+ * @param router Avro router instance
+ * @param dcb DCB where the statistics are printed
+ */
+void avro_kafka_diagnostics(AVRO_INSTANCE *router, DCB *dcb)
+{
+    if (router->kafka)
+    {
+        dcb_printf(dcb, "\tKafka brokers:                       %s\n", router->kafka_broker);
+        dcb_printf(dcb, "\tKafka rows queued:                   %lu\n", router->kafka_produced);
+        dcb_printf(dcb, "\tKafka rows delivered:                %lu\n", router->kafka_delivered);
+        dcb_printf(dcb, "\tKafka rows failed:                   %lu\n", router->kafka_failed);
+        dcb_printf(dcb, "\tKafka rows waiting for delivery:     %d\n",
+                   rd_kafka_outq_len(router->kafka));
+        dcb_printf(dcb, "\tKafka delivered up to GTID:          %lu-%lu-%lu:%lu\n",
+                   router->kafka_gtid.domain, router->kafka_gtid.server_id,
+                   router->kafka_gtid.seq, router->kafka_gtid.event_num);
+    }
+}
+
+#else
+
+bool avro_kafka_init(AVRO_INSTANCE *router)
+{
+    if (router->kafka_broker && *router->kafka_broker)
+    {
+        MXS_ERROR("[%s] 'kafka_broker' is defined but MaxScale was built without "
+                  "Kafka support.", router->service->name);
+        return false;
+    }
+
+    return true;
+}
+
+void avro_kafka_free(AVRO_INSTANCE *router)
+{
+}
+
+void avro_kafka_open_topic(AVRO_INSTANCE *router, AVRO_TABLE *table, const char *table_ident)
+{
+}
+
+void avro_kafka_close_topic(AVRO_TABLE *table)
+{
+}
+
+void avro_kafka_produce(AVRO_TABLE *table, avro_value_t *record)
+{
+}
+
+void avro_kafka_flush(AVRO_INSTANCE *router)
+{
+}
+
+void avro_kafka_diagnostics(AVRO_INSTANCE *router, DCB *dcb)
+{
+}
+
+#endif
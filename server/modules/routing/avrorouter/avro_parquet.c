@@ -0,0 +1,1282 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file avro_parquet.c - Writing the converted rows to Parquet files
+ *
+ * The rows appended to the Avro file of a table are also written to a Parquet
+ * file with the same columns. The rows are buffered in memory column by column
+ * and written as a row group once parquet_row_group_rows rows are buffered, or
+ * at a checkpoint once the oldest buffered row is parquet_row_group_time seconds
+ * old. A new Parquet file is started when a new Avro file is started for the
+ * table after an ALTER TABLE.
+ *
+ * Each column chunk has one data page. The values are dictionary encoded unless
+ * the plain values take less space, the pages are compressed with gzip if
+ * parquet_codec is gzip. The file metadata is written after each row group so
+ * that the file can be read by analytics engines while it is being written.
+ *
+ * The file metadata is serialized with the Thrift compact protocol as defined
+ * by parquet.thrift, only the fields that are needed are written.
+ */
+
+#include "avrorouter.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+
+#define PARQUET_MAGIC     "PAR1"
+#define PARQUET_MAGIC_LEN 4
+
+/** Parquet physical types */
+#define PQ_TYPE_INT32      1
+#define PQ_TYPE_INT64      2
+#define PQ_TYPE_FLOAT      4
+#define PQ_TYPE_DOUBLE     5
+#define PQ_TYPE_BYTE_ARRAY 6
+
+/** Parquet converted type of UTF-8 strings */
+#define PQ_CONVERTED_UTF8 0
+
+/** Parquet repetition types */
+#define PQ_REQUIRED 0
+#define PQ_OPTIONAL 1
+
+/** Parquet encodings */
+#define PQ_ENC_PLAIN            0
+#define PQ_ENC_PLAIN_DICTIONARY 2
+#define PQ_ENC_RLE              3
+
+/** Parquet compression codecs */
+#define PQ_CODEC_UNCOMPRESSED 0
+#define PQ_CODEC_GZIP         2
+
+/** Parquet page types */
+#define PQ_PAGE_DATA       0
+#define PQ_PAGE_DICTIONARY 2
+
+/** Thrift compact protocol types */
+#define TH_I32    5
+#define TH_I64    6
+#define TH_BINARY 8
+#define TH_LIST   9
+#define TH_STRUCT 12
+
+/** Maximum depth of nested Thrift structures */
+#define TH_MAX_DEPTH 8
+
+/** Buffered row data of a table that causes a row group to be written */
+#define PARQUET_MAX_BUFFERED (64 * 1024 * 1024)
+
+/** A growing byte buffer */
+typedef struct
+{
+    uint8_t *data;
+    size_t  len;
+    size_t  size;
+    bool    failed; /*< An allocation failed */
+} PQ_BUF;
+
+/** The Thrift compact protocol serialization state */
+typedef struct
+{
+    PQ_BUF  *buf;
+    int16_t last_id[TH_MAX_DEPTH]; /*< The last field ID of each structure level */
+    int     depth;
+} THRIFT;
+
+/** The buffered values of a column */
+typedef struct
+{
+    char     *name;        /*< The column name */
+    int      avro_type;    /*< The Avro type of the column */
+    avro_schema_t schema;  /*< The Avro schema of the column */
+    int      type;         /*< The Parquet physical type */
+    bool     utf8;         /*< Whether the values are strings */
+    PQ_BUF   dict;         /*< The plain encoded distinct values */
+    uint32_t *offsets;     /*< The offsets of the distinct values in dict */
+    uint32_t n_entries;    /*< The number of distinct values */
+    uint32_t *slots;       /*< Hash table of the distinct values, entry index + 1 */
+    uint32_t n_slots;      /*< Size of the hash table, a power of two */
+    uint32_t *indices;     /*< The distinct value of each buffered row */
+    size_t   plain_size;   /*< The size of the plain encoded values of the rows */
+} PQ_COLUMN;
+
+/** A Parquet file of a table */
+typedef struct parquet_file
+{
+    char      *avro_filename; /*< The Avro file whose rows are written here */
+    char      *filename;      /*< The Parquet file */
+    int       fd;
+    bool      gzip;           /*< Whether the pages are compressed */
+    int       n_columns;
+    PQ_COLUMN *columns;
+    uint32_t  n_rows;         /*< Number of buffered rows */
+    uint32_t  rows_size;      /*< Size of the index arrays */
+    time_t    first_row;      /*< When the oldest buffered row was appended */
+    uint64_t  total_rows;     /*< Rows in the row groups of the file */
+    uint64_t  data_end;       /*< The end of the last row group */
+    PQ_BUF    row_groups;     /*< The serialized RowGroup structures */
+    int       n_row_groups;
+    struct avro_instance *router;
+} PARQUET_FILE;
+
+static bool buf_reserve(PQ_BUF *buf, size_t len)
+{
+    if (buf->failed)
+    {
+        return false;
+    }
+
+    if (buf->len + len > buf->size)
+    {
+        size_t size = buf->size ? buf->size : 256;
+
+        while (size < buf->len + len)
+        {
+            size *= 2;
+        }
+
+        uint8_t *data = MXS_REALLOC(buf->data, size);
+
+        if (data == NULL)
+        {
+            buf->failed = true;
+            return false;
+        }
+
+        buf->data = data;
+        buf->size = size;
+    }
+
+    return true;
+}
+
+static void buf_append(PQ_BUF *buf, const void *data, size_t len)
+{
+    if (len && buf_reserve(buf, len))
+    {
+        memcpy(buf->data + buf->len, data, len);
+        buf->len += len;
+    }
+}
+
+static void buf_byte(PQ_BUF *buf, uint8_t byte)
+{
+    buf_append(buf, &byte, 1);
+}
+
+static void buf_varint(PQ_BUF *buf, uint64_t value)
+{
+    uint8_t bytes[10];
+    int n = 0;
+
+    do
+    {
+        bytes[n] = value & 0x7f;
+        value >>= 7;
+
+        if (value)
+        {
+            bytes[n] |= 0x80;
+        }
+
+        n++;
+    }
+    while (value);
+
+    buf_append(buf, bytes, n);
+}
+
+static void buf_le32(PQ_BUF *buf, uint32_t value)
+{
+    uint8_t bytes[4] = {value, value >> 8, value >> 16, value >> 24};
+    buf_append(buf, bytes, sizeof(bytes));
+}
+
+static void buf_free(PQ_BUF *buf)
+{
+    MXS_FREE(buf->data);
+    memset(buf, 0, sizeof(*buf));
+}
+
+static void th_init(THRIFT *th, PQ_BUF *buf)
+{
+    memset(th, 0, sizeof(*th));
+    th->buf = buf;
+}
+
+static uint64_t zigzag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static void th_field(THRIFT *th, int16_t id, uint8_t type)
+{
+    int16_t delta = id - th->last_id[th->depth];
+
+    if (delta > 0 && delta <= 15)
+    {
+        buf_byte(th->buf, (delta << 4) | type);
+    }
+    else
+    {
+        buf_byte(th->buf, type);
+        buf_varint(th->buf, zigzag(id));
+    }
+
+    th->last_id[th->depth] = id;
+}
+
+static void th_i32(THRIFT *th, int16_t id, int32_t value)
+{
+    th_field(th, id, TH_I32);
+    buf_varint(th->buf, zigzag(value));
+}
+
+static void th_i64(THRIFT *th, int16_t id, int64_t value)
+{
+    th_field(th, id, TH_I64);
+    buf_varint(th->buf, zigzag(value));
+}
+
+static void th_string(THRIFT *th, int16_t id, const char *value)
+{
+    size_t len = strlen(value);
+    th_field(th, id, TH_BINARY);
+    buf_varint(th->buf, len);
+    buf_append(th->buf, value, len);
+}
+
+static void th_list(THRIFT *th, int16_t id, uint8_t type, uint32_t n)
+{
+    th_field(th, id, TH_LIST);
+
+    if (n < 15)
+    {
+        buf_byte(th->buf, (n << 4) | type);
+    }
+    else
+    {
+        buf_byte(th->buf, 0xf0 | type);
+        buf_varint(th->buf, n);
+    }
+}
+
+/** Start a structure that is an element of a list */
+static void th_begin(THRIFT *th)
+{
+    ss_dassert(th->depth < TH_MAX_DEPTH - 1);
+    th->last_id[++th->depth] = 0;
+}
+
+/** Start a structure that is a field */
+static void th_struct(THRIFT *th, int16_t id)
+{
+    th_field(th, id, TH_STRUCT);
+    th_begin(th);
+}
+
+/** End a structure, also writes the stop field of the top level structure */
+static void th_end(THRIFT *th)
+{
+    buf_byte(th->buf, 0);
+
+    if (th->depth > 0)
+    {
+        th->depth--;
+    }
+}
+
+/**
+ * @brief Encode values with the RLE and bit-packing hybrid encoding
+ *
+ * Runs of at least eight equal values are run length encoded, the other
+ * values are bit-packed in groups of eight.
+ *
+ * @param buf The buffer to write to
+ * @param values The values
+ * @param n Number of values
+ * @param width Bit width of the values
+ */
+static void rle_encode(PQ_BUF *buf, const uint32_t *values, size_t n, int width)
+{
+    size_t lit_start = 0;
+    size_t i = 0;
+    int value_bytes = (width + 7) / 8;
+
+    while (i <= n)
+    {
+        size_t run = 1;
+
+        while (i < n && i + run < n && values[i + run] == values[i])
+        {
+            run++;
+        }
+
+        if (i == n || run >= 8)
+        {
+            /** Write the pending literals, the last group is padded with zeros */
+            if (i > lit_start)
+            {
+                size_t n_groups = (i - lit_start + 7) / 8;
+                size_t start = buf->len;
+                buf_varint(buf, (n_groups << 1) | 1);
+
+                if (!buf_reserve(buf, n_groups * width))
+                {
+                    return;
+                }
+
+                memset(buf->data + buf->len, 0, n_groups * width);
+                size_t bit = 0;
+
+                for (size_t j = lit_start; j < i; j++)
+                {
+                    for (int b = 0; b < width; b++, bit++)
+                    {
+                        if (values[j] & (1U << b))
+                        {
+                            buf->data[buf->len + bit / 8] |= 1 << (bit % 8);
+                        }
+                    }
+                }
+
+                buf->len += n_groups * width;
+                ss_dassert(buf->len > start);
+            }
+
+            if (i == n)
+            {
+                break;
+            }
+
+            buf_varint(buf, run << 1);
+            uint32_t value = values[i];
+
+            for (int b = 0; b < value_bytes; b++)
+            {
+                buf_byte(buf, value >> (8 * b));
+            }
+
+            i += run;
+            lit_start = i;
+        }
+        else
+        {
+            /** Literals are added in groups of eight so that only the last
+             * group of the page is padded */
+            i += MXS_MIN(8, n - i);
+        }
+    }
+}
+
+/** The number of bits needed for the indices of a dictionary */
+static int bit_width(uint32_t n_entries)
+{
+    int width = 1;
+
+    while (width < 32 && n_entries > (1ULL << width))
+    {
+        width++;
+    }
+
+    return width;
+}
+
+/**
+ * @brief Write a page
+ *
+ * @param file The Parquet file
+ * @param out The row group buffer
+ * @param page_type PQ_PAGE_DATA or PQ_PAGE_DICTIONARY
+ * @param body The uncompressed page data
+ * @param n_values Number of values in the page
+ * @param encoding Encoding of the values
+ * @param uncompressed Incremented by the uncompressed size of the page
+ * @return True on success
+ */
+static bool write_page(PARQUET_FILE *file, PQ_BUF *out, int page_type, PQ_BUF *body,
+                       uint32_t n_values, int encoding, uint64_t *uncompressed)
+{
+    PQ_BUF compressed = {};
+    PQ_BUF *data = body;
+
+    if (body->failed)
+    {
+        return false;
+    }
+
+    if (file->gzip)
+    {
+        z_stream zs = {};
+
+        if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            return false;
+        }
+
+        size_t bound = deflateBound(&zs, body->len);
+
+        if (!buf_reserve(&compressed, bound))
+        {
+            deflateEnd(&zs);
+            return false;
+        }
+
+        zs.next_in = body->data;
+        zs.avail_in = body->len;
+        zs.next_out = compressed.data;
+        zs.avail_out = bound;
+        int rc = deflate(&zs, Z_FINISH);
+        compressed.len = zs.total_out;
+        deflateEnd(&zs);
+
+        if (rc != Z_STREAM_END)
+        {
+            buf_free(&compressed);
+            return false;
+        }
+
+        data = &compressed;
+    }
+
+    size_t start = out->len;
+    THRIFT th;
+    th_init(&th, out);
+    th_i32(&th, 1, page_type);
+    th_i32(&th, 2, body->len);
+    th_i32(&th, 3, data->len);
+
+    if (page_type == PQ_PAGE_DICTIONARY)
+    {
+        th_struct(&th, 7);
+        th_i32(&th, 1, n_values);
+        th_i32(&th, 2, encoding);
+        th_end(&th);
+    }
+    else
+    {
+        th_struct(&th, 5);
+        th_i32(&th, 1, n_values);
+        th_i32(&th, 2, encoding);
+        th_i32(&th, 3, PQ_ENC_RLE);
+        th_i32(&th, 4, PQ_ENC_RLE);
+        th_end(&th);
+    }
+
+    th_end(&th);
+    *uncompressed += out->len - start + body->len;
+    buf_append(out, data->data, data->len);
+    buf_free(&compressed);
+
+    return !out->failed;
+}
+
+/**
+ * @brief Write the column chunk of a column
+ *
+ * @param file The Parquet file
+ * @param col The column
+ * @param out The row group buffer, the chunk is appended to it
+ * @param meta The RowGroup being serialized, the ColumnChunk is added to it
+ * @param total_size Incremented with the uncompressed size of the chunk
+ * @return True on success
+ */
+static bool write_column(PARQUET_FILE *file, PQ_COLUMN *col, PQ_BUF *out, THRIFT *meta,
+                         uint64_t *total_size)
+{
+    uint64_t chunk_start = file->data_end + out->len;
+    uint64_t uncompressed = 0;
+    uint64_t data_offset;
+    PQ_BUF body = {};
+    bool use_dict = false;
+    bool ok = true;
+
+    if (col->avro_type == AVRO_NULL)
+    {
+        /** All values are null, only the definition levels are written */
+        PQ_BUF levels = {};
+        buf_varint(&levels, (uint64_t)file->n_rows << 1);
+        buf_byte(&levels, 0);
+        buf_le32(&body, levels.len);
+        buf_append(&body, levels.data, levels.len);
+        ok = !levels.failed;
+        buf_free(&levels);
+    }
+    else
+    {
+        int width = bit_width(col->n_entries);
+        use_dict = col->dict.len + ((uint64_t)file->n_rows * width + 7) / 8 < col->plain_size;
+
+        if (use_dict)
+        {
+            ok = write_page(file, out, PQ_PAGE_DICTIONARY, &col->dict, col->n_entries,
+                            PQ_ENC_PLAIN_DICTIONARY, &uncompressed);
+            buf_byte(&body, width);
+            rle_encode(&body, col->indices, file->n_rows, width);
+        }
+        else if (buf_reserve(&body, col->plain_size))
+        {
+            for (uint32_t i = 0; i < file->n_rows; i++)
+            {
+                uint32_t e = col->indices[i];
+                uint32_t end = e + 1 < col->n_entries ? col->offsets[e + 1] : col->dict.len;
+                buf_append(&body, col->dict.data + col->offsets[e], end - col->offsets[e]);
+            }
+        }
+    }
+
+    data_offset = file->data_end + out->len;
+    ok = ok && write_page(file, out, PQ_PAGE_DATA, &body, file->n_rows,
+                          use_dict ? PQ_ENC_PLAIN_DICTIONARY : PQ_ENC_PLAIN, &uncompressed);
+    buf_free(&body);
+
+    if (ok)
+    {
+        size_t name_len = strlen(col->name);
+
+        th_begin(meta);
+        th_i64(meta, 2, chunk_start);
+        th_struct(meta, 3);
+        th_i32(meta, 1, col->type);
+        th_list(meta, 2, TH_I32, 2);
+        buf_varint(meta->buf, zigzag(use_dict ? PQ_ENC_PLAIN_DICTIONARY : PQ_ENC_PLAIN));
+        buf_varint(meta->buf, zigzag(PQ_ENC_RLE));
+        th_list(meta, 3, TH_BINARY, 1);
+        buf_varint(meta->buf, name_len);
+        buf_append(meta->buf, col->name, name_len);
+        th_i32(meta, 4, file->gzip ? PQ_CODEC_GZIP : PQ_CODEC_UNCOMPRESSED);
+        th_i64(meta, 5, file->n_rows);
+        th_i64(meta, 6, uncompressed);
+        th_i64(meta, 7, file->data_end + out->len - chunk_start);
+        th_i64(meta, 9, data_offset);
+
+        if (use_dict)
+        {
+            th_i64(meta, 11, chunk_start);
+        }
+
+        th_end(meta);
+        th_end(meta);
+        *total_size += uncompressed;
+    }
+
+    return ok;
+}
+
+/**
+ * @brief Write the file metadata after the last row group
+ *
+ * @param file The Parquet file
+ * @return True on success
+ */
+static bool write_footer(PARQUET_FILE *file)
+{
+    PQ_BUF footer = {};
+    THRIFT th;
+    th_init(&th, &footer);
+
+    th_i32(&th, 1, 1);
+    th_list(&th, 2, TH_STRUCT, file->n_columns + 1);
+    th_begin(&th);
+    th_string(&th, 4, "schema");
+    th_i32(&th, 5, file->n_columns);
+    th_end(&th);
+
+    for (int i = 0; i < file->n_columns; i++)
+    {
+        PQ_COLUMN *col = &file->columns[i];
+        th_begin(&th);
+        th_i32(&th, 1, col->type);
+        th_i32(&th, 3, col->avro_type == AVRO_NULL ? PQ_OPTIONAL : PQ_REQUIRED);
+        th_string(&th, 4, col->name);
+
+        if (col->utf8)
+        {
+            th_i32(&th, 6, PQ_CONVERTED_UTF8);
+        }
+
+        th_end(&th);
+    }
+
+    th_i64(&th, 3, file->total_rows);
+    th_list(&th, 4, TH_STRUCT, file->n_row_groups);
+    buf_append(&footer, file->row_groups.data, file->row_groups.len);
+    th_string(&th, 6, "MaxScale avrorouter");
+    th_end(&th);
+
+    uint32_t len = footer.len;
+    buf_le32(&footer, len);
+    buf_append(&footer, PARQUET_MAGIC, PARQUET_MAGIC_LEN);
+
+    bool rval = false;
+
+    if (footer.failed || file->row_groups.failed)
+    {
+        MXS_OOM();
+    }
+    else if (pwrite(file->fd, footer.data, footer.len, file->data_end) != (ssize_t)footer.len ||
+             ftruncate(file->fd, file->data_end + footer.len) != 0)
+    {
+        MXS_ERROR("Failed to write the metadata of Parquet file '%s': %d, %s",
+                  file->filename, errno, mxs_strerror(errno));
+    }
+    else
+    {
+        rval = true;
+    }
+
+    buf_free(&footer);
+    return rval;
+}
+
+/**
+ * @brief Clear the buffered rows
+ *
+ * @param file The Parquet file
+ */
+static void clear_rows(PARQUET_FILE *file)
+{
+    for (int i = 0; i < file->n_columns; i++)
+    {
+        PQ_COLUMN *col = &file->columns[i];
+        col->dict.len = 0;
+        col->dict.failed = false;
+        col->n_entries = 0;
+        col->plain_size = 0;
+
+        if (col->slots)
+        {
+            memset(col->slots, 0, col->n_slots * sizeof(uint32_t));
+        }
+    }
+
+    file->n_rows = 0;
+}
+
+/**
+ * @brief Write the buffered rows as a row group
+ *
+ * @param file The Parquet file
+ */
+static void write_row_group(PARQUET_FILE *file)
+{
+    if (file->n_rows == 0)
+    {
+        return;
+    }
+
+    PQ_BUF data = {};
+    size_t meta_start = file->row_groups.len;
+    uint64_t total_size = 0;
+    bool ok = true;
+    THRIFT meta;
+    th_init(&meta, &file->row_groups);
+
+    th_begin(&meta);
+    th_list(&meta, 1, TH_STRUCT, file->n_columns);
+
+    for (int i = 0; i < file->n_columns && ok; i++)
+    {
+        ok = write_column(file, &file->columns[i], &data, &meta, &total_size);
+    }
+
+    th_i64(&meta, 2, total_size);
+    th_i64(&meta, 3, file->n_rows);
+    th_end(&meta);
+
+    if (!ok || data.failed || file->row_groups.failed)
+    {
+        MXS_ERROR("Failed to encode a row group of %u rows for Parquet file '%s', "
+                  "the rows are only in the Avro file.", file->n_rows, file->filename);
+        file->row_groups.len = meta_start;
+        file->row_groups.failed = false;
+    }
+    else if (pwrite(file->fd, data.data, data.len, file->data_end) != (ssize_t)data.len)
+    {
+        MXS_ERROR("Failed to write to Parquet file '%s', the rows are only in the "
+                  "Avro file: %d, %s", file->filename, errno, mxs_strerror(errno));
+        file->row_groups.len = meta_start;
+    }
+    else
+    {
+        uint64_t old_end = file->data_end;
+        file->data_end += data.len;
+        file->total_rows += file->n_rows;
+        file->n_row_groups++;
+
+        if (write_footer(file))
+        {
+            atomic_add_uint64(&file->router->parquet_rows, file->n_rows);
+            atomic_add_uint64(&file->router->parquet_row_groups, 1);
+            atomic_add_uint64(&file->router->parquet_bytes, data.len);
+        }
+        else
+        {
+            /** The previous metadata is written back so that the file stays valid */
+            file->data_end = old_end;
+            file->total_rows -= file->n_rows;
+            file->n_row_groups--;
+            file->row_groups.len = meta_start;
+            write_footer(file);
+        }
+    }
+
+    buf_free(&data);
+    clear_rows(file);
+}
+
+/** FNV-1a hash of a plain encoded value */
+static uint32_t value_hash(const uint8_t *value, size_t len)
+{
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        hash = (hash ^ value[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief Find or add the distinct value of a row
+ *
+ * @param col The column
+ * @param value The plain encoded value
+ * @param len Length of the value
+ * @return The index of the value in the dictionary or -1 on error
+ */
+static int64_t dict_add(PQ_COLUMN *col, const uint8_t *value, size_t len)
+{
+    if (col->n_entries * 2 >= col->n_slots)
+    {
+        uint32_t n_slots = col->n_slots ? col->n_slots * 2 : 64;
+        uint32_t *slots = MXS_CALLOC(n_slots, sizeof(uint32_t));
+        uint32_t *offsets = MXS_REALLOC(col->offsets, n_slots / 2 * sizeof(uint32_t));
+
+        if (offsets)
+        {
+            col->offsets = offsets;
+        }
+
+        if (slots == NULL || offsets == NULL)
+        {
+            MXS_FREE(slots);
+            return -1;
+        }
+
+        for (uint32_t e = 0; e < col->n_entries; e++)
+        {
+            uint32_t end = e + 1 < col->n_entries ? col->offsets[e + 1] : col->dict.len;
+            uint32_t h = value_hash(col->dict.data + col->offsets[e], end - col->offsets[e]);
+            uint32_t s = h & (n_slots - 1);
+
+            while (slots[s])
+            {
+                s = (s + 1) & (n_slots - 1);
+            }
+
+            slots[s] = e + 1;
+        }
+
+        MXS_FREE(col->slots);
+        col->slots = slots;
+        col->n_slots = n_slots;
+    }
+
+    uint32_t s = value_hash(value, len) & (col->n_slots - 1);
+
+    while (col->slots[s])
+    {
+        uint32_t e = col->slots[s] - 1;
+        uint32_t end = e + 1 < col->n_entries ? col->offsets[e + 1] : col->dict.len;
+
+        if (end - col->offsets[e] == len && memcmp(col->dict.data + col->offsets[e], value, len) == 0)
+        {
+            return e;
+        }
+
+        s = (s + 1) & (col->n_slots - 1);
+    }
+
+    if (col->dict.len + len > UINT32_MAX)
+    {
+        return -1;
+    }
+
+    col->offsets[col->n_entries] = col->dict.len;
+    buf_append(&col->dict, value, len);
+
+    if (col->dict.failed)
+    {
+        return -1;
+    }
+
+    col->slots[s] = col->n_entries + 1;
+    return col->n_entries++;
+}
+
+/**
+ * @brief Encode the value of a field in the plain encoding
+ *
+ * @param col The column of the field
+ * @param field The field
+ * @param buf The encoded value is stored here
+ * @return True if the value was encoded
+ */
+static bool encode_value(PQ_COLUMN *col, avro_value_t *field, PQ_BUF *buf)
+{
+    int32_t i32;
+    int64_t i64;
+    float f;
+    double d;
+    const char *str;
+    const void *bytes = NULL;
+    size_t size;
+
+    switch (col->avro_type)
+    {
+    case AVRO_INT32:
+        avro_value_get_int(field, &i32);
+        buf_le32(buf, i32);
+        break;
+
+    case AVRO_INT64:
+        avro_value_get_long(field, &i64);
+        buf_le32(buf, (uint64_t)i64);
+        buf_le32(buf, (uint64_t)i64 >> 32);
+        break;
+
+    case AVRO_FLOAT:
+        avro_value_get_float(field, &f);
+        buf_append(buf, &f, sizeof(f));
+        break;
+
+    case AVRO_DOUBLE:
+        avro_value_get_double(field, &d);
+        buf_append(buf, &d, sizeof(d));
+        break;
+
+    case AVRO_STRING:
+        if (avro_value_get_string(field, &str, &size) || str == NULL)
+        {
+            str = "";
+            size = 1;
+        }
+        /** The size includes the terminating null character */
+        size = size ? size - 1 : 0;
+        buf_le32(buf, size);
+        buf_append(buf, str, size);
+        break;
+
+    case AVRO_BYTES:
+        if (avro_value_get_bytes(field, &bytes, &size))
+        {
+            size = 0;
+        }
+        buf_le32(buf, size);
+        buf_append(buf, bytes, size);
+        break;
+
+    case AVRO_ENUM:
+        avro_value_get_enum(field, &i32);
+        str = avro_schema_enum_get(col->schema, i32);
+        size = str ? strlen(str) : 0;
+        buf_le32(buf, size);
+        buf_append(buf, str, size);
+        break;
+
+    default:
+        return false;
+    }
+
+    return !buf->failed;
+}
+
+void avro_parquet_append(AVRO_TABLE *table, avro_value_t *record)
+{
+    PARQUET_FILE *file = (PARQUET_FILE*)table->parquet;
+
+    if (file == NULL)
+    {
+        return;
+    }
+
+    if (file->n_rows == file->rows_size)
+    {
+        uint32_t rows_size = file->rows_size ? file->rows_size * 2 : 1024;
+
+        for (int i = 0; i < file->n_columns; i++)
+        {
+            uint32_t *indices = MXS_REALLOC(file->columns[i].indices, rows_size * sizeof(uint32_t));
+
+            if (indices == NULL)
+            {
+                MXS_ERROR("Failed to add a row to Parquet file '%s'.", file->filename);
+                return;
+            }
+
+            file->columns[i].indices = indices;
+        }
+
+        file->rows_size = rows_size;
+    }
+
+    PQ_BUF value = {};
+    size_t buffered = 0;
+
+    for (int i = 0; i < file->n_columns; i++)
+    {
+        PQ_COLUMN *col = &file->columns[i];
+        avro_value_t field;
+
+        if (col->avro_type == AVRO_NULL)
+        {
+            continue;
+        }
+
+        value.len = 0;
+        int64_t entry;
+
+        if (avro_value_get_by_index(record, i, &field, NULL) ||
+            !encode_value(col, &field, &value) ||
+            (entry = dict_add(col, value.data, value.len)) < 0)
+        {
+            MXS_ERROR("Failed to add a row to Parquet file '%s', the rows that are "
+                      "buffered for it are discarded.", file->filename);
+            clear_rows(file);
+            buf_free(&value);
+            return;
+        }
+
+        col->indices[file->n_rows] = entry;
+        col->plain_size += value.len;
+        buffered += col->dict.len + file->n_rows * sizeof(uint32_t);
+    }
+
+    buf_free(&value);
+
+    if (file->n_rows++ == 0)
+    {
+        file->first_row = time(NULL);
+    }
+
+    if (file->n_rows >= file->router->parquet_group_rows || buffered >= PARQUET_MAX_BUFFERED)
+    {
+        write_row_group(file);
+    }
+}
+
+/**
+ * @brief Close a Parquet file
+ *
+ * The buffered rows are written as the last row group.
+ *
+ * @param data The Parquet file
+ */
+static void parquet_file_free(void *data)
+{
+    PARQUET_FILE *file = (PARQUET_FILE*)data;
+
+    if (file)
+    {
+        write_row_group(file);
+
+        if (file->fd != -1)
+        {
+            close(file->fd);
+        }
+
+        for (int i = 0; i < file->n_columns; i++)
+        {
+            PQ_COLUMN *col = &file->columns[i];
+            MXS_FREE(col->name);
+            buf_free(&col->dict);
+            MXS_FREE(col->offsets);
+            MXS_FREE(col->slots);
+            MXS_FREE(col->indices);
+        }
+
+        atomic_add(&file->router->parquet_files, -1);
+        MXS_FREE(file->columns);
+        buf_free(&file->row_groups);
+        MXS_FREE(file->avro_filename);
+        MXS_FREE(file->filename);
+        MXS_FREE(file);
+    }
+}
+
+/**
+ * @brief Create the columns of a Parquet file from the Avro schema
+ *
+ * @param file The Parquet file
+ * @param schema The Avro schema of the table
+ * @return True on success
+ */
+static bool create_columns(PARQUET_FILE *file, avro_schema_t schema)
+{
+    file->n_columns = avro_schema_record_size(schema);
+
+    if ((file->columns = MXS_CALLOC(file->n_columns, sizeof(PQ_COLUMN))) == NULL)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < file->n_columns; i++)
+    {
+        PQ_COLUMN *col = &file->columns[i];
+        col->schema = avro_schema_record_field_get_by_index(schema, i);
+        col->avro_type = avro_typeof(col->schema);
+
+        if ((col->name = MXS_STRDUP(avro_schema_record_field_name(schema, i))) == NULL)
+        {
+            return false;
+        }
+
+        switch (col->avro_type)
+        {
+        case AVRO_INT32:
+        case AVRO_NULL:
+            col->type = PQ_TYPE_INT32;
+            break;
+
+        case AVRO_INT64:
+            col->type = PQ_TYPE_INT64;
+            break;
+
+        case AVRO_FLOAT:
+            col->type = PQ_TYPE_FLOAT;
+            break;
+
+        case AVRO_DOUBLE:
+            col->type = PQ_TYPE_DOUBLE;
+            break;
+
+        case AVRO_STRING:
+        case AVRO_ENUM:
+            col->utf8 = true;
+            col->type = PQ_TYPE_BYTE_ARRAY;
+            break;
+
+        case AVRO_BYTES:
+            col->type = PQ_TYPE_BYTE_ARRAY;
+            break;
+
+        default:
+            MXS_ERROR("Column '%s' has an Avro type that can't be written to Parquet files.",
+                      col->name);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Create the Parquet file of an Avro file
+ *
+ * The Parquet file has the name of the Avro file with the .avro suffix replaced
+ * with a part number and the .parquet suffix. A new part is started each time
+ * MaxScale starts writing to the Avro file.
+ *
+ * @param router Avro router instance
+ * @param table The Avro file
+ * @return The new Parquet file or NULL on error
+ */
+static PARQUET_FILE* parquet_file_create(AVRO_INSTANCE *router, AVRO_TABLE *table)
+{
+    PARQUET_FILE *file = MXS_CALLOC(1, sizeof(PARQUET_FILE));
+
+    if (file == NULL)
+    {
+        return NULL;
+    }
+
+    file->fd = -1;
+    file->router = router;
+    file->gzip = router->parquet_gzip;
+    atomic_add(&router->parquet_files, 1);
+
+    size_t base_len = strlen(table->filename);
+
+    if (base_len > 5 && strcmp(table->filename + base_len - 5, ".avro") == 0)
+    {
+        base_len -= 5;
+    }
+
+    char path[base_len + 32];
+
+    for (int part = 1; file->fd == -1 && part < 1000000; part++)
+    {
+        snprintf(path, sizeof(path), "%.*s.%06d.parquet", (int)base_len, table->filename, part);
+        file->fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP);
+
+        if (file->fd == -1 && errno != EEXIST)
+        {
+            break;
+        }
+    }
+
+    if (file->fd == -1)
+    {
+        MXS_ERROR("[%s] Failed to create a Parquet file for '%s': %d, %s", router->service->name,
+                  table->filename, errno, mxs_strerror(errno));
+        parquet_file_free(file);
+        return NULL;
+    }
+
+    if ((file->filename = MXS_STRDUP(path)) == NULL ||
+        (file->avro_filename = MXS_STRDUP(table->filename)) == NULL ||
+        !create_columns(file, table->avro_schema))
+    {
+        parquet_file_free(file);
+        return NULL;
+    }
+
+    if (write(file->fd, PARQUET_MAGIC, PARQUET_MAGIC_LEN) != PARQUET_MAGIC_LEN)
+    {
+        MXS_ERROR("Failed to write to Parquet file '%s': %d, %s", path, errno, mxs_strerror(errno));
+        parquet_file_free(file);
+        return NULL;
+    }
+
+    file->data_end = PARQUET_MAGIC_LEN;
+
+    if (!write_footer(file))
+    {
+        parquet_file_free(file);
+        return NULL;
+    }
+
+    MXS_INFO("[%s] Writing the rows of '%s' also to '%s'.", router->service->name,
+             table->filename, path);
+    return file;
+}
+
+bool avro_parquet_init(AVRO_INSTANCE *router)
+{
+    if (router->parquet)
+    {
+        if ((router->parquet_tables = hashtable_alloc(1000, hashtable_item_strhash,
+                                                      hashtable_item_strcmp)) == NULL)
+        {
+            return false;
+        }
+
+        hashtable_memory_fns(router->parquet_tables, hashtable_item_strdup, NULL,
+                             hashtable_item_free, parquet_file_free);
+    }
+
+    return true;
+}
+
+void avro_parquet_open(AVRO_INSTANCE *router, AVRO_TABLE *table, const char *table_ident)
+{
+    if (router->parquet_tables == NULL)
+    {
+        return;
+    }
+
+    PARQUET_FILE *file = hashtable_fetch(router->parquet_tables, (void*)table_ident);
+
+    if (file && strcmp(file->avro_filename, table->filename) != 0)
+    {
+        /** A new Avro file was started for the table */
+        hashtable_delete(router->parquet_tables, (void*)table_ident);
+        file = NULL;
+    }
+
+    if (file == NULL && (file = parquet_file_create(router, table)))
+    {
+        hashtable_add(router->parquet_tables, (void*)table_ident, file);
+    }
+
+    table->parquet = file;
+}
+
+void avro_parquet_flush(AVRO_INSTANCE *router)
+{
+    if (router->parquet_tables == NULL)
+    {
+        return;
+    }
+
+    HASHITERATOR *iter = hashtable_iterator(router->parquet_tables);
+
+    if (iter)
+    {
+        time_t now = time(NULL);
+        void *key;
+
+        while ((key = hashtable_next(iter)))
+        {
+            PARQUET_FILE *file = hashtable_fetch(router->parquet_tables, key);
+
+            if (file && file->n_rows && now - file->first_row >= router->parquet_group_time)
+            {
+                write_row_group(file);
+            }
+        }
+
+        hashtable_iterator_free(iter);
+    }
+}
+
+void avro_parquet_close_all(AVRO_INSTANCE *router)
+{
+    if (router->parquet_tables)
+    {
+        HASHITERATOR *iter = router->open_tables ? hashtable_iterator(router->open_tables) : NULL;
+
+        if (iter)
+        {
+            void *key;
+
+            while ((key = hashtable_next(iter)))
+            {
+                AVRO_TABLE *table = hashtable_fetch(router->open_tables, key);
+
+                if (table)
+                {
+                    table->parquet = NULL;
+                }
+            }
+
+            hashtable_iterator_free(iter);
+        }
+
+        /** The buffered rows are written when the files are closed */
+        hashtable_free(router->parquet_tables);
+        router->parquet_tables = NULL;
+    }
+}
+
+void avro_parquet_diagnostics(AVRO_INSTANCE *router, DCB *dcb)
+{
+    if (router->parquet)
+    {
+        dcb_printf(dcb, "\tParquet files open:                  %d\n", router->parquet_files);
+        dcb_printf(dcb, "\tParquet rows written:                %lu\n", router->parquet_rows);
+        dcb_printf(dcb, "\tParquet row groups written:          %lu (%lu bytes)\n",
+                   router->parquet_row_groups, router->parquet_bytes);
+    }
+}
@@ -100,6 +100,9 @@ bool handle_table_map_event(AVRO_INSTANCE *router, REP_HEADER *hdr, uint8_t *ptr
             return true;
         }
 
+        /** The conversion threads may be writing to the Avro file that is closed */
+        avro_workers_drain(router);
+
         char* json_schema = json_new_schema_from_table(map);
 
         if (json_schema)
@@ -110,11 +113,15 @@ bool handle_table_map_event(AVRO_INSTANCE *router, REP_HEADER *hdr, uint8_t *ptr
 
             /** Close the file and open a new one */
             hashtable_delete(router->open_tables, table_ident);
-            AVRO_TABLE *avro_table = avro_table_alloc(filepath, json_schema, router->block_size);
+            AVRO_TABLE *avro_table = avro_table_alloc(filepath, json_schema, router->codec,
+                                                      router->block_size);
 
             if (avro_table)
             {
                 bool notify = old != NULL;
+                avro_kafka_open_topic(router, avro_table, table_ident);
+                avro_parquet_open(router, avro_table, table_ident);
+                avro_tail_open(router, avro_table);
 
                 if (old)
                 {
@@ -123,7 +130,15 @@ bool handle_table_map_event(AVRO_INSTANCE *router, REP_HEADER *hdr, uint8_t *ptr
                 hashtable_delete(router->table_maps, table_ident);
                 hashtable_add(router->table_maps, (void*)table_ident, map);
                 hashtable_add(router->open_tables, table_ident, avro_table);
-                save_avro_schema(router->avrodir, json_schema, map);
+
+                if (save_avro_schema(router->avrodir, json_schema, map))
+                {
+                    /** The clients are sent the new schema of this version */
+                    char name[PATH_MAX + 1];
+                    snprintf(name, sizeof(name), "%s.%06d", table_ident, map->version);
+                    avro_schema_cache_invalidate(router, name);
+                }
+
                 router->active_maps[map->id % MAX_MAPPED_TABLES] = map;
                 ss_dassert(router->active_maps[id % MAX_MAPPED_TABLES] == map);
                 MXS_DEBUG("Table %s mapped to %lu", table_ident, map->id);
@@ -166,27 +181,27 @@ bool handle_table_map_event(AVRO_INSTANCE *router, REP_HEADER *hdr, uint8_t *ptr
  * This sets the domain, server ID, sequence and event position fields of
  * the GTID. It also sets the event timestamp and event type fields.
  *
- * @param router Avro router instance
+ * @param gtid The GTID of the record, its subsequence counter is updated
  * @param hdr Replication header
  * @param event_type Event type
  * @param record Record to prepare
  */
-static void prepare_record(AVRO_INSTANCE *router, REP_HEADER *hdr,
+static void prepare_record(gtid_pos_t *gtid, REP_HEADER *hdr,
                            int event_type, avro_value_t *record)
 {
     avro_value_t field;
     avro_value_get_by_name(record, avro_domain, &field, NULL);
-    avro_value_set_int(&field, router->gtid.domain);
+    avro_value_set_int(&field, gtid->domain);
 
     avro_value_get_by_name(record, avro_server_id, &field, NULL);
-    avro_value_set_int(&field, router->gtid.server_id);
+    avro_value_set_int(&field, gtid->server_id);
 
     avro_value_get_by_name(record, avro_sequence, &field, NULL);
-    avro_value_set_int(&field, router->gtid.seq);
+    avro_value_set_int(&field, gtid->seq);
 
-    router->gtid.event_num++;
+    gtid->event_num++;
     avro_value_get_by_name(record, avro_event_number, &field, NULL);
-    avro_value_set_int(&field, router->gtid.event_num);
+    avro_value_set_int(&field, gtid->event_num);
 
     avro_value_get_by_name(record, avro_timestamp, &field, NULL);
     avro_value_set_int(&field, hdr->timestamp);
@@ -195,6 +210,90 @@ static void prepare_record(AVRO_INSTANCE *router, REP_HEADER *hdr,
     avro_value_set_enum(&field, event_type);
 }
 
+/**
+ * @brief Add an appended row to the current block index entry of a table
+ *
+ * @param table Avro file of the table
+ * @param gtid GTID of the row
+ * @param hdr Replication header of the row event
+ */
+static void update_block_index(AVRO_TABLE *table, gtid_pos_t *gtid, REP_HEADER *hdr)
+{
+    table->index_entry.last = *gtid;
+    table->index_entry.last.timestamp = hdr->timestamp;
+
+    if (!table->index_rows)
+    {
+        table->index_entry.first = table->index_entry.last;
+        table->index_rows = true;
+    }
+}
+
+/**
+ * @brief Convert the rows of a row event into Avro records
+ *
+ * The records are appended to the Avro file of the table and published to its
+ * Kafka topic. This is done either by the conversion task or by the conversion
+ * thread that handles the table.
+ *
+ * @param table Avro file of the table
+ * @param map Table map of the rows
+ * @param create Definition of the table
+ * @param hdr Replication header of the row event
+ * @param pos Position of the row event in the binlog
+ * @param gtid GTID of the rows, its subsequence counter is updated
+ * @param ptr Start of the row data
+ * @param end End of the row data
+ * @param col_present The bitfield of the columns present in the rows
+ */
+void avro_convert_rows(AVRO_TABLE *table, TABLE_MAP *map, TABLE_CREATE *create,
+                       REP_HEADER *hdr, uint64_t pos, gtid_pos_t *gtid,
+                       uint8_t *ptr, uint8_t *end, uint8_t *col_present)
+{
+    avro_value_t record;
+    avro_generic_value_new(table->avro_writer_iface, &record);
+
+    /** Each event has one or more rows in it. The number of rows is not known
+     * beforehand so we must continue processing them until we reach the end
+     * of the event. */
+    while (ptr < end)
+    {
+        /** Add the current GTID and timestamp */
+        int event_type = get_event_type(hdr->event_type);
+        prepare_record(gtid, hdr, event_type, &record);
+        ptr = process_row_event_data(map, create, &record, ptr, col_present, end);
+        if (avro_file_writer_append_value(table->avro_file, &record))
+        {
+            MXS_ERROR("Failed to write value at position %ld: %s",
+                      pos, avro_strerror());
+        }
+
+        update_block_index(table, gtid, hdr);
+        avro_kafka_produce(table, &record);
+        avro_parquet_append(table, &record);
+
+        /** Update rows events have the before and after images of the
+         * affected rows so we'll process them as another record with
+         * a different type */
+        if (event_type == UPDATE_EVENT)
+        {
+            prepare_record(gtid, hdr, UPDATE_EVENT_AFTER, &record);
+            ptr = process_row_event_data(map, create, &record, ptr, col_present, end);
+            if (avro_file_writer_append_value(table->avro_file, &record))
+            {
+                MXS_ERROR("Failed to write value at position %ld: %s",
+                          pos, avro_strerror());
+            }
+
+            update_block_index(table, gtid, hdr);
+            avro_kafka_produce(table, &record);
+            avro_parquet_append(table, &record);
+        }
+    }
+
+    avro_value_decref(&record);
+}
+
 /**
  * @brief Handle a single RBR row event
  *
@@ -279,49 +378,36 @@ bool handle_row_event(AVRO_INSTANCE *router, REP_HEADER *hdr, uint8_t *ptr)
 
         if (table && create && ncolumns == map->columns && create->columns == map->columns)
         {
-            avro_value_t record;
-            avro_generic_value_new(table->avro_writer_iface, &record);
-
-            /** Each event has one or more rows in it. The number of rows is not known
-             * beforehand so we must continue processing them until we reach the end
-             * of the event. */
-            int rows = 0;
             MXS_INFO("Row Event for '%s' at %lu", table_ident, router->current_pos);
 
-            while (ptr < end)
+            if (router->n_workers > 0)
             {
-                static uint64_t total_row_count = 1;
-                MXS_INFO("Row %lu", total_row_count++);
-
-                /** Add the current GTID and timestamp */
-                int event_type = get_event_type(hdr->event_type);
-                prepare_record(router, hdr, event_type, &record);
-                ptr = process_row_event_data(map, create, &record, ptr, col_present, end);
-                if (avro_file_writer_append_value(table->avro_file, &record))
-                {
-                    MXS_ERROR("Failed to write value at position %ld: %s",
-                              router->current_pos, avro_strerror());
-                }
-
-                /** Update rows events have the before and after images of the
-                 * affected rows so we'll process them as another record with
-                 * a different type */
-                if (event_type == UPDATE_EVENT)
-                {
-                    prepare_record(router, hdr, UPDATE_EVENT_AFTER, &record);
-                    ptr = process_row_event_data(map, create, &record, ptr, col_present, end);
-                    if (avro_file_writer_append_value(table->avro_file, &record))
-                    {
-                        MXS_ERROR("Failed to write value at position %ld: %s",
-                                  router->current_pos, avro_strerror());
-                    }
-                }
-
-                rows++;
+                /** The bitmap and the rows are copied, the event is freed
+                 * when this returns */
+                size_t len = coldata_size + (end - ptr);
+                AVRO_ROW_TASK *task = MXS_MALLOC(sizeof(AVRO_ROW_TASK) + len);
+                MXS_ABORT_IF_NULL(task);
+
+                task->hdr = *hdr;
+                task->pos = router->current_pos;
+                task->map = map;
+                task->create = create;
+                task->table = table;
+                task->col_present = task->data;
+                task->rows = task->data + coldata_size;
+                task->end = task->data + len;
+                memcpy(task->col_present, col_present, coldata_size);
+                memcpy(task->rows, ptr, end - ptr);
+
+                avro_workers_queue(router, table_ident, task);
+            }
+            else
+            {
+                avro_convert_rows(table, map, create, hdr, router->current_pos,
+                                  &router->gtid, ptr, end, col_present);
             }
 
             add_used_table(router, table_ident);
-            avro_value_decref(&record);
             rval = true;
         }
         else if (table == NULL)
@@ -291,10 +291,12 @@ bool json_extract_field_names(const char* filename, TABLE_CREATE *table)
  * @param path Schema directory
  * @param schema Schema in JSON format
  * @param map Table map that @p schema represents
+ * @return True if a new schema file was written
  */
-void save_avro_schema(const char *path, const char* schema, TABLE_MAP *map)
+bool save_avro_schema(const char *path, const char* schema, TABLE_MAP *map)
 {
     char filepath[PATH_MAX];
+    bool rval = false;
     snprintf(filepath, sizeof(filepath), "%s/%s.%s.%06d.avsc", path, map->database,
              map->table, map->version);
 
@@ -308,9 +310,12 @@ void save_avro_schema(const char *path, const char* schema, TABLE_MAP *map)
                 fprintf(file, "%s\n", schema);
                 map->table_create->was_used = true;
                 fclose(file);
+                rval = true;
             }
         }
     }
+
+    return rval;
 }
 
 /**
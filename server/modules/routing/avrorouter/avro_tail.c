@@ -0,0 +1,340 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file avro_tail.c - The latest data blocks of the Avro files kept in memory
+ *
+ * When a table is flushed, the data blocks that were appended to its Avro file
+ * are read back once and kept in memory. The clients that have sent all of the
+ * file are then sent the new blocks from memory instead of each of them reading
+ * the blocks from the file. The blocks are shared by the clients, a client holds
+ * a reference to a block while the block is being sent.
+ *
+ * Only the latest blocks of each file, at most tail_size bytes, are kept. The
+ * clients that are further behind read the file.
+ */
+
+#include "avrorouter.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+
+/** The blocks of one Avro file, oldest first */
+typedef struct avro_tail_block
+{
+    long                    pos;  /*< Offset of the block in the file */
+    GWBUF                   *data; /*< The block with its header and sync marker */
+    struct avro_tail_block  *next;
+} AVRO_TAIL_BLOCK;
+
+typedef struct
+{
+    AVRO_TAIL_BLOCK *head;  /*< The oldest block */
+    AVRO_TAIL_BLOCK *last;  /*< The newest block */
+    uint64_t        end;    /*< Offset after the newest block */
+    uint64_t        bytes;  /*< Length of the blocks */
+} AVRO_TAIL;
+
+/**
+ * AVRO_TAIL free function for use with hashtable.
+ * @param v Pointer to a AVRO_TAIL
+ */
+static void tail_hfree(void *v)
+{
+    AVRO_TAIL *tail = (AVRO_TAIL*)v;
+
+    while (tail->head)
+    {
+        AVRO_TAIL_BLOCK *block = tail->head;
+        tail->head = block->next;
+        gwbuf_free(block->data);
+        MXS_FREE(block);
+    }
+
+    MXS_FREE(tail);
+}
+
+/**
+ * @brief Allocate an empty table of tails
+ *
+ * @return The table or NULL if memory allocation failed
+ */
+static HASHTABLE* tails_alloc()
+{
+    HASHTABLE *tails = hashtable_alloc(100, hashtable_item_strhash, hashtable_item_strcmp);
+
+    if (tails)
+    {
+        hashtable_memory_fns(tails, hashtable_item_strdup, NULL,
+                             hashtable_item_free, tail_hfree);
+    }
+
+    return tails;
+}
+
+/**
+ * @brief Get the name of an Avro file that the clients request it with
+ *
+ * @param table The table of the file
+ * @return The name of the file without the directory
+ */
+static const char* tail_name(AVRO_TABLE *table)
+{
+    const char *name = strrchr(table->filename, '/');
+    return name ? name + 1 : table->filename;
+}
+
+bool avro_tail_init(AVRO_INSTANCE *router)
+{
+    spinlock_init(&router->tail_lock);
+
+    if (router->tail_size == 0)
+    {
+        return true;
+    }
+
+    return (router->tails = tails_alloc()) != NULL;
+}
+
+void avro_tail_free(AVRO_INSTANCE *router)
+{
+    hashtable_free(router->tails);
+    router->tails = NULL;
+}
+
+void avro_tail_open(AVRO_INSTANCE *router, AVRO_TABLE *table)
+{
+    struct stat st;
+
+    if (router->tails == NULL)
+    {
+        return;
+    }
+
+    /** The header of a new file must be in the file before its size is taken */
+    avro_file_writer_flush(table->avro_file);
+
+    if ((table->tail_fd = open(table->filename, O_RDONLY)) == -1 ||
+        fstat(table->tail_fd, &st) != 0)
+    {
+        char err[MXS_STRERROR_BUFLEN];
+        MXS_WARNING("Failed to open '%s' for reading, its new rows are read from "
+                    "the file by every client: %d, %s", table->filename, errno,
+                    strerror_r(errno, err, sizeof(err)));
+
+        if (table->tail_fd != -1)
+        {
+            close(table->tail_fd);
+            table->tail_fd = -1;
+        }
+        return;
+    }
+
+    table->tail_end = st.st_size;
+    table->tail_router = router;
+
+    /** The blocks of an earlier file of the same name are no longer valid */
+    spinlock_acquire(&router->tail_lock);
+    hashtable_delete(router->tails, (void*)tail_name(table));
+    spinlock_release(&router->tail_lock);
+}
+
+void avro_tail_close(AVRO_TABLE *table)
+{
+    AVRO_INSTANCE *router = table->tail_router;
+
+    if (router)
+    {
+        /** The clients read the rest of the file once it is no longer written */
+        spinlock_acquire(&router->tail_lock);
+        hashtable_delete(router->tails, (void*)tail_name(table));
+        spinlock_release(&router->tail_lock);
+        close(table->tail_fd);
+        table->tail_fd = -1;
+        table->tail_router = NULL;
+    }
+}
+
+/**
+ * @brief Add blocks to the tail of a file
+ *
+ * @param router Avro router instance
+ * @param table  The table of the file
+ * @param pos    Offset of the blocks
+ * @param blocks The blocks that were read back from the file, NULL if they
+ *               could not be read and the tail must be dropped
+ */
+static void tail_add(AVRO_INSTANCE *router, AVRO_TABLE *table, uint64_t pos, GWBUF *blocks)
+{
+    const char *name = tail_name(table);
+    size_t len = blocks ? GWBUF_LENGTH(blocks) : 0;
+
+    spinlock_acquire(&router->tail_lock);
+    AVRO_TAIL *tail = hashtable_fetch(router->tails, (void*)name);
+
+    if (tail && tail->end != pos)
+    {
+        /** The blocks would not continue the tail */
+        hashtable_delete(router->tails, (void*)name);
+        tail = NULL;
+    }
+
+    if (blocks && tail == NULL && (tail = MXS_CALLOC(1, sizeof(AVRO_TAIL))) &&
+        hashtable_add(router->tails, (void*)name, tail) == 0)
+    {
+        MXS_FREE(tail);
+        tail = NULL;
+    }
+
+    size_t offset = 0;
+
+    while (tail && offset < len)
+    {
+        uint8_t *ptr = GWBUF_DATA(blocks) + offset;
+        uint64_t records;
+        size_t block_len = maxavro_datablock_length(ptr, ptr + (len - offset), &records);
+        AVRO_TAIL_BLOCK *block = NULL;
+        /** The blocks share the data that was read */
+        GWBUF *data = block_len ? gwbuf_clone(blocks) : NULL;
+
+        if (data == NULL || (block = MXS_MALLOC(sizeof(AVRO_TAIL_BLOCK))) == NULL)
+        {
+            /** The clients read the rest from the file */
+            gwbuf_free(data);
+            hashtable_delete(router->tails, (void*)name);
+            tail = NULL;
+            break;
+        }
+
+        block->data = gwbuf_rtrim(gwbuf_consume(data, offset), len - offset - block_len);
+        block->pos = pos + offset;
+        block->next = NULL;
+
+        if (tail->last)
+        {
+            tail->last->next = block;
+        }
+        else
+        {
+            tail->head = block;
+        }
+
+        tail->last = block;
+        tail->bytes += block_len;
+        tail->end = block->pos + block_len;
+        offset += block_len;
+        router->tail_blocks++;
+    }
+
+    while (tail && tail->bytes > router->tail_size && tail->head != tail->last)
+    {
+        AVRO_TAIL_BLOCK *block = tail->head;
+        tail->head = block->next;
+        tail->bytes -= GWBUF_LENGTH(block->data);
+        gwbuf_free(block->data);
+        MXS_FREE(block);
+    }
+
+    spinlock_release(&router->tail_lock);
+}
+
+void avro_tail_append(AVRO_TABLE *table)
+{
+    AVRO_INSTANCE *router = table->tail_router;
+    struct stat st;
+
+    if (router == NULL || fstat(table->tail_fd, &st) != 0 || st.st_size <= table->tail_end)
+    {
+        return;
+    }
+
+    uint64_t pos = table->tail_end;
+    size_t len = st.st_size - pos;
+    GWBUF *blocks = NULL;
+
+    /** A flush that wrote more than the tail holds is read from the file */
+    if (len <= router->tail_size && (blocks = gwbuf_alloc(len)) &&
+        pread(table->tail_fd, GWBUF_DATA(blocks), len, pos) != len)
+    {
+        char err[MXS_STRERROR_BUFLEN];
+        MXS_ERROR("Failed to read the data blocks written to '%s': %d, %s",
+                  table->filename, errno, strerror_r(errno, err, sizeof(err)));
+        gwbuf_free(blocks);
+        blocks = NULL;
+    }
+
+    tail_add(router, table, pos, blocks);
+    gwbuf_free(blocks);
+    table->tail_end = st.st_size;
+}
+
+GWBUF* avro_tail_get(AVRO_INSTANCE *router, const char *avrofile, long pos)
+{
+    GWBUF *rval = NULL;
+
+    if (router->tails)
+    {
+        spinlock_acquire(&router->tail_lock);
+        AVRO_TAIL *tail = hashtable_fetch(router->tails, (void*)avrofile);
+
+        if (tail && tail->head && pos >= tail->head->pos && (uint64_t)pos < tail->end)
+        {
+            for (AVRO_TAIL_BLOCK *block = tail->head; block; block = block->next)
+            {
+                if (block->pos == pos)
+                {
+                    rval = gwbuf_clone(block->data);
+                    break;
+                }
+            }
+        }
+
+        spinlock_release(&router->tail_lock);
+    }
+
+    if (rval)
+    {
+        atomic_add_uint64(&router->tail_hits, 1);
+    }
+
+    return rval;
+}
+
+void avro_tail_clear(AVRO_INSTANCE *router)
+{
+    if (router->tails)
+    {
+        HASHTABLE *tails = tails_alloc();
+
+        if (tails)
+        {
+            spinlock_acquire(&router->tail_lock);
+            HASHTABLE *old = router->tails;
+            router->tails = tails;
+            spinlock_release(&router->tail_lock);
+            hashtable_free(old);
+        }
+    }
+}
+
+void avro_tail_diagnostics(AVRO_INSTANCE *router, DCB *dcb)
+{
+    if (router->tails)
+    {
+        dcb_printf(dcb, "\tData blocks read back into memory:   %lu\n", router->tail_blocks);
+        dcb_printf(dcb, "\tData blocks sent from memory:        %lu\n", router->tail_hits);
+    }
+}
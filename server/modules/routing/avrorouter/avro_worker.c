@@ -0,0 +1,258 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file avro_worker.c - Conversion threads for the row events
+ *
+ * The conversion task reads the binlog and handles all the events that change
+ * the state of the conversion: table maps, DDL, GTIDs and commits. The rows of
+ * the row events are converted into Avro records by a pool of conversion
+ * threads. Each table is converted by one thread, so the records of a table
+ * are appended in binlog order.
+ *
+ * The event numbers of the records of a transaction must increase in binlog
+ * order over all tables. The row events of a transaction take turns: a row
+ * event is converted once the previous row event of the transaction has been
+ * converted, and it continues the numbering where that one left off. The
+ * transactions themselves are converted in parallel.
+ *
+ * Before the table definitions, the Avro files or the conversion state are
+ * changed or saved, the conversion task waits until all the queued row events
+ * have been converted.
+ */
+
+#include "avrorouter.h"
+
+#include <maxscale/alloc.h>
+#include <maxscale/hashtable.h>
+
+/**
+ * @brief Release a reference to a transaction numbering
+ *
+ * The caller must hold router->worker_lock.
+ *
+ * @param seq The numbering to release
+ */
+static void trx_seq_release(AVRO_TRX_SEQ *seq)
+{
+    if (seq && --seq->refcount == 0)
+    {
+        MXS_FREE(seq);
+    }
+}
+
+/**
+ * @brief Convert the row events queued for one thread until shutdown
+ *
+ * @param data The worker
+ */
+static void avro_worker_main(void *data)
+{
+    AVRO_WORKER *worker = (AVRO_WORKER*)data;
+    AVRO_INSTANCE *router = worker->router;
+
+    pthread_mutex_lock(&router->worker_lock);
+
+    while (true)
+    {
+        AVRO_ROW_TASK *task = worker->head;
+
+        /** Wait for a row event whose turn it is in its transaction */
+        if (task == NULL || task->seq->n_done != task->seq_index)
+        {
+            pthread_cond_wait(&router->worker_cond, &router->worker_lock);
+            continue;
+        }
+
+        worker->head = task->next;
+
+        if (worker->head == NULL)
+        {
+            worker->tail = NULL;
+        }
+
+        worker->n_queued--;
+        worker->busy = true;
+        task->gtid.event_num = task->seq->event_num;
+        pthread_mutex_unlock(&router->worker_lock);
+
+        avro_convert_rows(task->table, task->map, task->create, &task->hdr, task->pos,
+                          &task->gtid, task->rows, task->end, task->col_present);
+
+        pthread_mutex_lock(&router->worker_lock);
+        task->seq->event_num = task->gtid.event_num;
+        task->seq->n_done++;
+        trx_seq_release(task->seq);
+        worker->busy = false;
+        worker->n_events++;
+        MXS_FREE(task);
+
+        /** The next row event of the transaction may be queued for another thread */
+        pthread_cond_broadcast(&router->worker_cond);
+        pthread_cond_signal(&router->reader_cond);
+    }
+}
+
+/**
+ * @brief Start the conversion threads
+ *
+ * @param router Avro router instance, with n_workers set
+ * @return True if the threads were started or none were configured
+ */
+bool avro_workers_start(AVRO_INSTANCE *router)
+{
+    if (router->n_workers == 0)
+    {
+        return true;
+    }
+
+    pthread_mutex_init(&router->worker_lock, NULL);
+    pthread_cond_init(&router->worker_cond, NULL);
+    pthread_cond_init(&router->reader_cond, NULL);
+
+    if ((router->workers = MXS_CALLOC(router->n_workers, sizeof(AVRO_WORKER))) == NULL)
+    {
+        router->n_workers = 0;
+        return false;
+    }
+
+    for (int i = 0; i < router->n_workers; i++)
+    {
+        router->workers[i].router = router;
+
+        if (thread_start(&router->workers[i].thread, avro_worker_main, &router->workers[i]) == NULL)
+        {
+            MXS_ERROR("Failed to start conversion thread %d of %d, the remaining "
+                      "ones are not used.", i + 1, router->n_workers);
+
+            if (i == 0)
+            {
+                MXS_FREE(router->workers);
+                router->workers = NULL;
+            }
+
+            router->n_workers = i;
+            break;
+        }
+    }
+
+    return router->n_workers > 0;
+}
+
+/**
+ * @brief Start the numbering of the records of a new transaction
+ *
+ * To be called by the conversion task for each GTID event, after the router's
+ * GTID has been updated.
+ *
+ * @param router Avro router instance
+ */
+void avro_workers_new_trx(AVRO_INSTANCE *router)
+{
+    if (router->n_workers > 0)
+    {
+        pthread_mutex_lock(&router->worker_lock);
+        trx_seq_release(router->trx_seq);
+        router->trx_seq = NULL;
+        pthread_mutex_unlock(&router->worker_lock);
+    }
+}
+
+/**
+ * @brief Queue a row event for the thread that converts a table
+ *
+ * The task gets the current GTID and its turn in the transaction. If the queue
+ * of the thread is full, this waits until there is room in it.
+ *
+ * @param router Avro router instance
+ * @param table_ident The table of the rows
+ * @param task The row event, the thread frees it
+ */
+void avro_workers_queue(AVRO_INSTANCE *router, const char *table_ident, AVRO_ROW_TASK *task)
+{
+    unsigned int hash = hashtable_item_strhash(table_ident);
+    AVRO_WORKER *worker = &router->workers[hash % router->n_workers];
+
+    task->gtid = router->gtid;
+    task->next = NULL;
+
+    pthread_mutex_lock(&router->worker_lock);
+
+    if (router->trx_seq == NULL)
+    {
+        /** Without GTIDs, all the row events are numbered as one transaction */
+        router->trx_seq = MXS_CALLOC(1, sizeof(AVRO_TRX_SEQ));
+        MXS_ABORT_IF_NULL(router->trx_seq);
+        router->trx_seq->refcount = 1;
+        router->trx_seq->event_num = router->gtid.event_num;
+        router->trx_seq_index = 0;
+    }
+
+    task->seq = router->trx_seq;
+    task->seq_index = router->trx_seq_index++;
+    task->seq->refcount++;
+
+    while (worker->n_queued >= AVRO_WORKER_QUEUE_MAX)
+    {
+        pthread_cond_wait(&router->reader_cond, &router->worker_lock);
+    }
+
+    if (worker->tail)
+    {
+        worker->tail->next = task;
+    }
+    else
+    {
+        worker->head = task;
+    }
+
+    worker->tail = task;
+    worker->n_queued++;
+
+    pthread_cond_broadcast(&router->worker_cond);
+    pthread_mutex_unlock(&router->worker_lock);
+}
+
+/**
+ * @brief Wait until all the queued row events have been converted
+ *
+ * After this, the conversion task can change the tables and the Avro files and
+ * save the conversion state. The event number of the router's GTID is updated
+ * to the last one that was used.
+ *
+ * @param router Avro router instance
+ */
+void avro_workers_drain(AVRO_INSTANCE *router)
+{
+    if (router->n_workers == 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&router->worker_lock);
+
+    for (int i = 0; i < router->n_workers; i++)
+    {
+        while (router->workers[i].n_queued > 0 || router->workers[i].busy)
+        {
+            pthread_cond_wait(&router->reader_cond, &router->worker_lock);
+        }
+    }
+
+    if (router->trx_seq)
+    {
+        router->gtid.event_num = router->trx_seq->event_num;
+    }
+
+    pthread_mutex_unlock(&router->worker_lock);
+}
@@ -24,10 +24,12 @@
 #include <maxscale/cdefs.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <pthread.h>
 #include <blr_constants.h>
 #include <maxscale/dcb.h>
 #include <maxscale/service.h>
 #include <maxscale/spinlock.h>
+#include <maxscale/thread.h>
 #include <maxscale/mysql_binlog.h>
 #include <maxscale/users.h>
 #include <avro.h>
@@ -35,6 +37,7 @@
 #include <maxscale/pcre2.h>
 #include <maxavro.h>
 #include <binlog_common.h>
+#include <binlog_feed.h>
 #include <maxscale/sqlite3.h>
 #include <maxscale/protocol/mysql.h>
 
@@ -60,6 +63,13 @@ MXS_BEGIN_DECLS
 #define MEMORY_TABLE_NAME      MEMORY_DATABASE_NAME".mem_used_tables"
 #define INDEX_TABLE_NAME       "indexing_progress"
 
+/**
+ * The GTID index is updated once this many rows have been converted or after
+ * this many seconds if less rows were converted
+ */
+#define AVRO_INDEX_BATCH_ROWS 10000
+#define AVRO_INDEX_INTERVAL   5
+
 /** Name of the file where the binlog to Avro conversion progress is stored */
 #define AVRO_PROGRESS_FILE "avro-conversion.ini"
 
@@ -123,6 +133,18 @@ typedef enum avro_binlog_end
 /** How many bytes each thread tries to send */
 #define AVRO_DATA_BURST_SIZE (32 * 1024)
 
+/** How many row events can wait for a conversion thread before the binlog
+ * reading waits for the thread */
+#define AVRO_WORKER_QUEUE_MAX 256
+
+/** How many bytes of binlog events received from a binlogrouter can wait
+ * for the conversion before the events are read from the binlog files */
+#define AVRO_FEED_MAX_BYTES (16 * 1024 * 1024)
+
+/** How often the conversion thread of the binlog events checks the binlog
+ * files if no events are received (seconds) */
+#define AVRO_FEED_POLL_INTERVAL 1
+
 /** A CREATE TABLE abstraction */
 typedef struct table_create
 {
@@ -188,15 +210,6 @@ typedef struct
     int             minavgs[AVRO_NSTATS_MINUTES];
 } AVRO_CLIENT_STATS;
 
-typedef struct avro_table_t
-{
-    char* filename; /*< Absolute filename */
-    char* json_schema; /*< JSON representation of the schema */
-    avro_file_writer_t avro_file; /*< Current Avro data file */
-    avro_value_iface_t *avro_writer_iface; /*< Avro C API writer interface */
-    avro_schema_t avro_schema; /*< Native Avro schema of the table */
-} AVRO_TABLE;
-
 /** Data format used when streaming data to the clients */
 enum avro_data_format
 {
@@ -217,6 +230,139 @@ typedef struct gtid_pos
                          * rebuild GTID events in the correct order. */
 } gtid_pos_t;
 
+/** A data block shared by the clients that stream the same table */
+typedef struct avro_cached_block
+{
+    char            *key;      /*< The file name and the offset of the block */
+    int             refcount;  /*< The clients that send the block and the cache */
+    bool            cached;    /*< Whether the block is in the cache */
+    GWBUF           *binary;   /*< The block in native Avro format */
+    uint64_t        records;   /*< Number of rows in the block */
+    char            *json;     /*< The rows in JSON, NULL if they were not converted */
+    uint32_t        *row_end;  /*< Offset in json after each row */
+    gtid_pos_t      *gtid;     /*< GTID of each row, NULL if the table has no GTID fields */
+    size_t          size;      /*< Memory used by the block */
+    time_t          added;     /*< When the block was added to the cache */
+    struct avro_cached_block *prev; /*< The more recently used block */
+    struct avro_cached_block *next; /*< The less recently used block */
+} AVRO_CACHED_BLOCK;
+
+/** The block index of an Avro file is stored in a file with this suffix
+ * appended to the name of the Avro file */
+#define AVRO_BLOCK_INDEX_SUFFIX ".idx"
+
+/** The block index file starts with this */
+#define AVRO_BLOCK_INDEX_MAGIC "MXSAVIX1"
+#define AVRO_BLOCK_INDEX_MAGIC_LEN 8
+
+/**
+ * An entry of the block index of an Avro file. Each entry covers the data blocks
+ * written by one flush of the file, the entries follow the magic in file order.
+ */
+typedef struct
+{
+    uint64_t   start; /*< Offset of the first data block, 0 if it is the first
+                       * data block of the file */
+    uint64_t   end;   /*< Offset after the last data block */
+    gtid_pos_t first; /*< GTID and timestamp of the first row */
+    gtid_pos_t last;  /*< GTID and timestamp of the last row */
+} AVRO_BLOCK_INDEX;
+
+typedef struct avro_table_t
+{
+    char* filename; /*< Absolute filename */
+    char* json_schema; /*< JSON representation of the schema */
+    avro_file_writer_t avro_file; /*< Current Avro data file */
+    avro_value_iface_t *avro_writer_iface; /*< Avro C API writer interface */
+    avro_schema_t avro_schema; /*< Native Avro schema of the table */
+    void *kafka_topic; /*< Kafka topic the rows are published to, NULL if
+                        * the rows are not published */
+    struct avro_instance *kafka_router; /*< The router that publishes the rows */
+    void *parquet; /*< Parquet file the rows are also written to, NULL if none */
+    FILE *block_index; /*< The block index of the Avro file */
+    AVRO_BLOCK_INDEX index_entry; /*< The rows appended since the last flush */
+    bool index_rows; /*< Whether rows have been appended since the last flush */
+    struct avro_instance *tail_router; /*< The router that keeps the latest blocks
+                                        * of the file in memory, NULL if none */
+    int tail_fd; /*< The file opened for reading the flushed blocks */
+    uint64_t tail_end; /*< Offset after the blocks that were read */
+} AVRO_TABLE;
+
+/**
+ * The numbering of the records of a transaction whose row events are converted
+ * by the conversion threads. The row events take turns, in binlog order, so
+ * that the event numbers increase in the same order as without the threads.
+ */
+typedef struct avro_trx_seq
+{
+    int      refcount;  /*< The row tasks and the reader that use this */
+    uint64_t n_done;    /*< The number of converted row events */
+    uint64_t event_num; /*< The last event number used */
+} AVRO_TRX_SEQ;
+
+/** A row event waiting for a conversion thread */
+typedef struct avro_row_task
+{
+    REP_HEADER     hdr;         /*< Replication header of the event */
+    uint64_t       pos;         /*< Position of the event in the binlog */
+    gtid_pos_t     gtid;        /*< The GTID of the transaction */
+    AVRO_TRX_SEQ   *seq;        /*< The record numbering of the transaction */
+    uint64_t       seq_index;   /*< The index of the event in the transaction */
+    TABLE_MAP      *map;        /*< The table map of the rows */
+    TABLE_CREATE   *create;     /*< The definition of the table */
+    AVRO_TABLE     *table;      /*< The Avro file the rows are appended to */
+    uint8_t        *col_present; /*< The columns present in the rows */
+    uint8_t        *rows;       /*< The row data of the event */
+    uint8_t        *end;        /*< The end of the row data */
+    struct avro_row_task *next;
+    uint8_t        data[];      /*< The bitmap and the rows point here */
+} AVRO_ROW_TASK;
+
+/** A binlog to Avro conversion thread */
+typedef struct avro_worker
+{
+    struct avro_instance *router;
+    THREAD          thread;
+    AVRO_ROW_TASK   *head;      /*< The row events to convert, in binlog order */
+    AVRO_ROW_TASK   *tail;
+    int             n_queued;   /*< Number of queued row events */
+    bool            busy;       /*< Whether a row event is being converted */
+    uint64_t        n_events;   /*< Number of row events converted */
+} AVRO_WORKER;
+
+/** A binlog event received from a binlogrouter */
+typedef struct avro_feed_event
+{
+    char            binlog[BINLOG_FNAMELEN + 1]; /*< The binlog file of the event */
+    uint64_t        pos;        /*< Position of the event in the file */
+    uint32_t        len;        /*< Length of the event */
+    uint8_t         hdr[BINLOG_EVENT_HDR_LEN]; /*< The replication event header */
+    GWBUF           *data;      /*< The rest of the event, null-terminated */
+    struct avro_feed_event *next;
+} AVRO_FEED_EVENT;
+
+/** The binlog events of a binlogrouter of the same process */
+typedef struct avro_feed
+{
+    struct avro_instance *router;
+    SERVICE         *source;    /*< The binlogrouter service */
+    void            *handle;    /*< The library of the binlogrouter */
+    BINLOG_FEED_API *api;       /*< The feed API of the binlogrouter */
+    void            *subscription; /*< The subscription to the events */
+    THREAD          thread;     /*< The conversion thread */
+    pthread_mutex_t lock;       /*< Protects the queue and the flags */
+    pthread_cond_t  cond;       /*< Signalled when events are received */
+    AVRO_FEED_EVENT *head;      /*< The received events, in binlog order */
+    AVRO_FEED_EVENT *tail;
+    size_t          bytes;      /*< Length of the queued events */
+    bool            active;     /*< Whether the conversion is started */
+    bool            pending;    /*< Whether events were received since the
+                                 * conversion last ran */
+    uint64_t        n_events;   /*< Number of queued events */
+    uint64_t        n_hits;     /*< Number of events converted from the queue */
+    uint64_t        n_dropped;  /*< Number of events not queued */
+} AVRO_FEED;
+
 /**
  * The client structure used within this router.
  * This represents the clients that are requesting AVRO files from MaxScale.
@@ -241,10 +387,23 @@ typedef struct avro_client
     MAXAVRO_FILE    avro_file;     /*< Avro file struct */
     char avro_binfile[AVRO_MAX_FILENAME_LEN + 1];
     bool            requested_gtid; /*< If the client requested */
+    bool            requested_timestamp; /*< If the client requested a start timestamp */
+    uint32_t        timestamp_start; /*< The requested start timestamp */
     gtid_pos_t      gtid; /*< Current/requested GTID */
     gtid_pos_t      gtid_start; /*< First sent GTID */
     unsigned int    cstate;         /*< Catch up state */
     sqlite3       *sqlite_handle;
+    bool            flow_control;   /*< Rows are only sent for credit */
+    uint64_t        credit;         /*< Rows the client is ready to receive */
+    MAXAVRO_TEXT    frame;          /*< JSON rows waiting to be sent */
+    char            *columns;       /*< Requested columns, separated by commas */
+    char            *where;         /*< Requested row conditions, separated by spaces */
+    MAXAVRO_FILTER  *filter;        /*< The columns and the conditions for the
+                                     * current file */
+    uint64_t        frame_rows;     /*< Number of rows in the frame */
+    GWBUF           *tail_block;    /*< The block in memory the rows are read from */
+    AVRO_CACHED_BLOCK *cached_block; /*< The shared block the rows are sent from */
+    uint64_t        cached_row;     /*< The next row of cached_block that is sent */
 #if defined(SS_DEBUG)
     skygw_chk_t     rses_chk_tail;
 #endif
@@ -283,6 +442,13 @@ typedef struct avro_instance
     HASHTABLE     *open_tables;
     HASHTABLE     *created_tables;
     sqlite3       *sqlite_handle;
+    sqlite3_stmt  *gtid_insert;       /*< Adds a GTID to the index */
+    sqlite3_stmt  *index_pos_select;  /*< Reads the indexing position of a file */
+    sqlite3_stmt  *index_pos_update;  /*< Updates the indexing position of a file */
+    sqlite3_stmt  *index_pos_insert;  /*< Adds the indexing position of a file */
+    sqlite3_stmt  *used_table_insert; /*< Adds a table used by the current transaction */
+    uint64_t       index_rows; /*< Rows flushed since the GTID index was updated */
+    time_t         index_time; /*< When the GTID index was updated */
     char              prevbinlog[BINLOG_FNAMELEN + 1];
     int               rotating;     /*< Rotation in progress flag */
     SPINLOCK          fileslock;    /*< Lock for the files queue above */
@@ -295,6 +461,61 @@ typedef struct avro_instance
     uint64_t        row_target; /*< Minimum about of row events that will trigger
                                  * a flush of all tables */
     uint64_t        block_size; /**< Avro datablock size */
+    const char      *codec;     /*< Compression codec of new Avro files */
+    uint64_t        batch_rows; /*< Maximum number of JSON rows sent in one write */
+    uint64_t        batch_bytes; /*< Size of a frame of JSON rows that is sent
+                                  * even if it has fewer rows */
+    int             n_workers;  /*< Number of conversion threads, 0 if the
+                                 * conversion task converts the rows itself */
+    AVRO_WORKER     *workers;   /*< The conversion threads */
+    pthread_mutex_t worker_lock; /*< Protects the queues and the numberings */
+    pthread_cond_t  worker_cond; /*< Signalled when work is queued or done */
+    pthread_cond_t  reader_cond; /*< Signalled when a conversion thread is done */
+    AVRO_TRX_SEQ    *trx_seq;   /*< The numbering of the current transaction */
+    uint64_t        trx_seq_index; /*< The index of the next row event in it */
+    char            *kafka_broker; /*< Kafka brokers the rows are published to */
+    char            *kafka_topic_prefix; /*< Prefix of the per-table topic names */
+    void            *kafka;     /*< Kafka producer, NULL if the rows are not published */
+    gtid_pos_t      kafka_gtid; /*< GTID up to which the rows have been delivered to Kafka */
+    bool            kafka_gtid_set; /*< Whether kafka_gtid is known */
+    uint64_t        kafka_produced; /*< Rows queued for Kafka */
+    uint64_t        kafka_delivered; /*< Rows acknowledged by Kafka */
+    uint64_t        kafka_failed; /*< Rows that Kafka failed to accept */
+    bool            parquet;    /*< Whether the rows are also written to Parquet files */
+    uint64_t        parquet_group_rows; /*< Rows in a Parquet row group */
+    int             parquet_group_time; /*< Seconds after which buffered rows are
+                                         * written as a row group at a checkpoint */
+    bool            parquet_gzip; /*< Whether the Parquet pages are compressed */
+    HASHTABLE       *parquet_tables; /*< The open Parquet files by table */
+    int             parquet_files; /*< Number of open Parquet files */
+    uint64_t        parquet_rows; /*< Rows written to Parquet files */
+    uint64_t        parquet_row_groups; /*< Row groups written to Parquet files */
+    uint64_t        parquet_bytes; /*< Bytes of row groups written to Parquet files */
+    SERVICE         *source;    /*< The binlogrouter service the binlog files
+                                 * come from, NULL if not configured */
+    bool            use_feed;   /*< Whether to receive the events of the source
+                                 * service in memory */
+    AVRO_FEED       *feed;      /*< The events of the source service, NULL if
+                                 * the events are only read from the files */
+    HASHTABLE       *schema_cache; /*< The schemas sent to the clients */
+    SPINLOCK        schema_lock; /*< Protects the schema cache */
+    uint64_t        tail_size; /*< Bytes of the latest blocks of each file kept
+                                * in memory, 0 if the clients read the files */
+    HASHTABLE       *tails;    /*< The latest blocks by file name */
+    SPINLOCK        tail_lock; /*< Protects the latest blocks */
+    uint64_t        tail_blocks; /*< Blocks read back into memory */
+    uint64_t        tail_hits; /*< Blocks sent to the clients from memory */
+    uint64_t        block_cache_size; /*< Bytes of shared data blocks, 0 if the
+                                       * blocks are not shared */
+    int             block_cache_ttl; /*< Seconds a block is kept, 0 for no limit */
+    HASHTABLE       *block_cache; /*< The shared blocks by file name and offset */
+    SPINLOCK        block_cache_lock; /*< Protects the shared blocks */
+    AVRO_CACHED_BLOCK *block_cache_newest; /*< The most recently used block */
+    AVRO_CACHED_BLOCK *block_cache_oldest; /*< The least recently used block */
+    uint64_t        block_cache_used; /*< Bytes of the blocks in the cache */
+    uint64_t        block_cache_hits; /*< Blocks found in the cache */
+    uint64_t        block_cache_misses; /*< Blocks that were not in the cache */
+    uint64_t        block_cache_evictions; /*< Blocks evicted from the cache */
     struct avro_instance  *next;
 } AVRO_INSTANCE;
 
@@ -313,12 +534,61 @@ extern void avro_client_rotate(AVRO_INSTANCE *router, AVRO_CLIENT *client, uint8
 extern bool avro_open_binlog(const char *binlogdir, const char *file, int *fd);
 extern void avro_close_binlog(int fd);
 extern avro_binlog_end_t avro_read_all_events(AVRO_INSTANCE *router);
-extern AVRO_TABLE* avro_table_alloc(const char* filepath, const char* json_schema, size_t block_size);
+extern avro_binlog_end_t avro_convert_binlogs(AVRO_INSTANCE *router, bool *converted);
+extern AVRO_TABLE* avro_table_alloc(const char* filepath, const char* json_schema,
+                                    const char *codec, size_t block_size);
 extern void avro_table_free(AVRO_TABLE *table);
 extern char* json_new_schema_from_table(TABLE_MAP *map);
-extern void save_avro_schema(const char *path, const char* schema, TABLE_MAP *map);
+extern bool save_avro_schema(const char *path, const char* schema, TABLE_MAP *map);
 extern bool handle_table_map_event(AVRO_INSTANCE *router, REP_HEADER *hdr, uint8_t *ptr);
 extern bool handle_row_event(AVRO_INSTANCE *router, REP_HEADER *hdr, uint8_t *ptr);
+extern void avro_convert_rows(AVRO_TABLE *table, TABLE_MAP *map, TABLE_CREATE *create,
+                              REP_HEADER *hdr, uint64_t pos, gtid_pos_t *gtid,
+                              uint8_t *ptr, uint8_t *end, uint8_t *col_present);
+extern bool avro_workers_start(AVRO_INSTANCE *router);
+extern void avro_workers_new_trx(AVRO_INSTANCE *router);
+extern void avro_workers_queue(AVRO_INSTANCE *router, const char *table_ident, AVRO_ROW_TASK *task);
+extern void avro_workers_drain(AVRO_INSTANCE *router);
+extern bool avro_index_init(AVRO_INSTANCE *router);
+extern void avro_index_free(AVRO_INSTANCE *router);
+extern bool avro_index_due(AVRO_INSTANCE *router);
+extern void avro_update_index(AVRO_INSTANCE *router);
+extern bool avro_schema_cache_init(AVRO_INSTANCE *router);
+extern void avro_schema_cache_invalidate(AVRO_INSTANCE *router, const char *name);
+extern bool avro_kafka_init(AVRO_INSTANCE *router);
+extern void avro_kafka_free(AVRO_INSTANCE *router);
+extern void avro_kafka_open_topic(AVRO_INSTANCE *router, AVRO_TABLE *table, const char *table_ident);
+extern void avro_kafka_close_topic(AVRO_TABLE *table);
+extern void avro_kafka_produce(AVRO_TABLE *table, avro_value_t *record);
+extern void avro_kafka_flush(AVRO_INSTANCE *router);
+extern void avro_kafka_diagnostics(AVRO_INSTANCE *router, DCB *dcb);
+extern bool avro_parquet_init(AVRO_INSTANCE *router);
+extern void avro_parquet_open(AVRO_INSTANCE *router, AVRO_TABLE *table, const char *table_ident);
+extern void avro_parquet_append(AVRO_TABLE *table, avro_value_t *record);
+extern void avro_parquet_flush(AVRO_INSTANCE *router);
+extern void avro_parquet_close_all(AVRO_INSTANCE *router);
+extern void avro_parquet_diagnostics(AVRO_INSTANCE *router, DCB *dcb);
+extern bool avro_tail_init(AVRO_INSTANCE *router);
+extern void avro_tail_free(AVRO_INSTANCE *router);
+extern void avro_tail_open(AVRO_INSTANCE *router, AVRO_TABLE *table);
+extern void avro_tail_close(AVRO_TABLE *table);
+extern void avro_tail_append(AVRO_TABLE *table);
+extern GWBUF* avro_tail_get(AVRO_INSTANCE *router, const char *avrofile, long pos);
+extern void avro_tail_clear(AVRO_INSTANCE *router);
+extern void avro_tail_diagnostics(AVRO_INSTANCE *router, DCB *dcb);
+extern bool avro_block_cache_init(AVRO_INSTANCE *router);
+extern void avro_block_cache_free(AVRO_INSTANCE *router);
+extern AVRO_CACHED_BLOCK* avro_block_cache_alloc(const char *avrofile, long pos, GWBUF *binary);
+extern AVRO_CACHED_BLOCK* avro_block_cache_get(AVRO_INSTANCE *router, const char *avrofile, long pos);
+extern AVRO_CACHED_BLOCK* avro_block_cache_add(AVRO_INSTANCE *router, AVRO_CACHED_BLOCK *block);
+extern void avro_block_cache_release(AVRO_INSTANCE *router, AVRO_CACHED_BLOCK *block);
+extern void avro_block_cache_drop(AVRO_INSTANCE *router, AVRO_CACHED_BLOCK *block);
+extern void avro_block_cache_clear(AVRO_INSTANCE *router);
+extern void avro_block_cache_diagnostics(AVRO_INSTANCE *router, DCB *dcb);
+extern bool avro_feed_start(AVRO_INSTANCE *router);
+extern void avro_feed_ctl(AVRO_INSTANCE *router, bool start);
+extern GWBUF* avro_feed_get_event(AVRO_INSTANCE *router, uint64_t pos, uint8_t *hdr);
+extern void avro_feed_diagnostics(AVRO_INSTANCE *router, DCB *dcb);
 
 enum avrorouter_file_op
 {
@@ -345,6 +615,7 @@ extern void avro_flush_all_tables(AVRO_INSTANCE *router, enum avrorouter_file_op
  */
 #define AVRO_CS_BUSY             0x0001
 #define AVRO_WAIT_DATA           0x0002
+#define AVRO_WAIT_CREDIT         0x0004
 
 MXS_END_DECLS
 
@@ -0,0 +1,896 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * Tests for the Parquet writer of the avrorouter
+ *
+ * The encoders are checked against known bytes and the written files are
+ * read back with a minimal Thrift compact protocol and Parquet page reader.
+ */
+
+#include "../avro_parquet.c"
+
+#include <stdio.h>
+
+#define TEST_AVRO_FILE    "test_parquet.avro"
+#define TEST_PARQUET_FILE "test_parquet.000001.parquet"
+
+/** Number of rows in each written row group */
+#define N_ROWS 64
+
+/** Number of columns in the test table */
+#define N_COLUMNS 8
+
+static int errors = 0;
+
+#define CHECK(cond, ...) do { if (!(cond)) { printf(__VA_ARGS__); printf("\n"); errors++; } } while (false)
+
+static const char *test_schema =
+    "{\"type\": \"record\", \"name\": \"t1\", \"fields\": ["
+    "{\"name\": \"i\", \"type\": \"int\"},"
+    "{\"name\": \"l\", \"type\": \"long\"},"
+    "{\"name\": \"f\", \"type\": \"float\"},"
+    "{\"name\": \"d\", \"type\": \"double\"},"
+    "{\"name\": \"s\", \"type\": \"string\"},"
+    "{\"name\": \"b\", \"type\": \"bytes\"},"
+    "{\"name\": \"e\", \"type\": {\"type\": \"enum\", \"name\": \"e1\", \"symbols\": [\"x\", \"yy\", \"zzz\"]}},"
+    "{\"name\": \"n\", \"type\": \"null\"}]}";
+
+static const char *column_names[N_COLUMNS] = {"i", "l", "f", "d", "s", "b", "e", "n"};
+static const int column_types[N_COLUMNS] =
+{
+    PQ_TYPE_INT32, PQ_TYPE_INT64, PQ_TYPE_FLOAT, PQ_TYPE_DOUBLE,
+    PQ_TYPE_BYTE_ARRAY, PQ_TYPE_BYTE_ARRAY, PQ_TYPE_BYTE_ARRAY, PQ_TYPE_INT32
+};
+static const char *enum_symbols[] = {"x", "yy", "zzz"};
+
+/** Known bytes for the encoders */
+
+static bool check_buf(const char *what, PQ_BUF *buf, const uint8_t *expected, size_t len)
+{
+    bool ok = !buf->failed && buf->len == len && memcmp(buf->data, expected, len) == 0;
+    CHECK(ok, "%s: the encoded bytes are wrong", what);
+    buf->len = 0;
+    return ok;
+}
+
+static void test_encoders()
+{
+    PQ_BUF buf = {};
+    THRIFT th;
+
+    buf_varint(&buf, 300);
+    check_buf("varint", &buf, (uint8_t[]){0xac, 0x02}, 2);
+
+    CHECK(zigzag(0) == 0 && zigzag(-1) == 1 && zigzag(1) == 2 && zigzag(-64) == 127 &&
+          zigzag(INT64_MIN) == UINT64_MAX, "zigzag: wrong values");
+
+    /** Short and long field headers, a long list header and a nested struct */
+    th_init(&th, &buf);
+    th_i32(&th, 1, 1);
+    th_i32(&th, 20, -1);
+    th_list(&th, 21, TH_STRUCT, 20);
+    th_struct(&th, 22);
+    th_i64(&th, 1, 150);
+    th_end(&th);
+    th_string(&th, 23, "ab");
+    th_end(&th);
+    check_buf("thrift", &buf, (uint8_t[])
+    {
+        0x15, 0x02, 0x05, 0x28, 0x01, 0x19, 0xfc, 0x14, 0x1c, 0x16, 0xac, 0x02, 0x00,
+        0x18, 0x02, 'a', 'b', 0x00
+    }, 18);
+
+    /** A run with one byte per value */
+    uint32_t run[10] = {5, 5, 5, 5, 5, 5, 5, 5, 5, 5};
+    rle_encode(&buf, run, 10, 3);
+    check_buf("rle run", &buf, (uint8_t[]){0x14, 0x05}, 2);
+
+    /** Literals padded to a group of eight */
+    uint32_t literals[3] = {1, 2, 3};
+    rle_encode(&buf, literals, 3, 2);
+    check_buf("rle literals", &buf, (uint8_t[]){0x03, 0x39, 0x00}, 3);
+
+    /** Literals followed by a run, the run values take two bytes */
+    uint32_t mixed[17] = {0, 1, 0, 1, 0, 1, 0, 1, 300, 300, 300, 300, 300, 300, 300, 300, 300};
+    rle_encode(&buf, mixed, 17, 9);
+    check_buf("rle mixed", &buf, (uint8_t[])
+    {
+        0x03, 0x00, 0x02, 0x00, 0x08, 0x00, 0x20, 0x00, 0x80, 0x00, 0x12, 0x2c, 0x01
+    }, 13);
+
+    CHECK(bit_width(1) == 1 && bit_width(2) == 1 && bit_width(3) == 2 &&
+          bit_width(256) == 8 && bit_width(257) == 9, "bit_width: wrong values");
+
+    buf_free(&buf);
+}
+
+/** A minimal reader for the Thrift compact protocol */
+
+typedef struct th_node
+{
+    int16_t        id;         /*< Field ID, 0 for the elements of a list */
+    uint8_t        type;
+    int64_t        value;      /*< Value of an integer */
+    const uint8_t  *data;      /*< Value of a binary */
+    size_t         len;
+    int            n_children;
+    struct th_node *children;  /*< Fields of a struct or elements of a list */
+} TH_NODE;
+
+typedef struct
+{
+    const uint8_t *ptr;
+    const uint8_t *end;
+    bool          error;
+} TH_READER;
+
+static uint8_t rd_byte(TH_READER *rd)
+{
+    if (rd->ptr >= rd->end)
+    {
+        rd->error = true;
+        return 0;
+    }
+
+    return *rd->ptr++;
+}
+
+static uint64_t rd_varint(TH_READER *rd)
+{
+    uint64_t value = 0;
+
+    for (int shift = 0; shift < 64 && !rd->error; shift += 7)
+    {
+        uint8_t byte = rd_byte(rd);
+        value |= (uint64_t)(byte & 0x7f) << shift;
+
+        if ((byte & 0x80) == 0)
+        {
+            break;
+        }
+    }
+
+    return value;
+}
+
+static int64_t rd_zigzag(TH_READER *rd)
+{
+    uint64_t value = rd_varint(rd);
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static TH_NODE* node_add(TH_NODE *node)
+{
+    node->children = realloc(node->children, (node->n_children + 1) * sizeof(TH_NODE));
+    TH_NODE *child = &node->children[node->n_children++];
+    memset(child, 0, sizeof(*child));
+    return child;
+}
+
+static void rd_value(TH_READER *rd, TH_NODE *node, uint8_t type)
+{
+    node->type = type;
+
+    switch (type)
+    {
+    case TH_I32:
+    case TH_I64:
+        node->value = rd_zigzag(rd);
+        break;
+
+    case TH_BINARY:
+        node->len = rd_varint(rd);
+        node->data = rd->ptr;
+
+        if (node->len > (size_t)(rd->end - rd->ptr))
+        {
+            rd->error = true;
+        }
+        else
+        {
+            rd->ptr += node->len;
+        }
+        break;
+
+    case TH_LIST:
+        {
+            uint8_t header = rd_byte(rd);
+            uint64_t n = header >> 4;
+
+            if (n == 15)
+            {
+                n = rd_varint(rd);
+            }
+
+            for (uint64_t i = 0; i < n && !rd->error; i++)
+            {
+                rd_value(rd, node_add(node), header & 0x0f);
+            }
+        }
+        break;
+
+    case TH_STRUCT:
+        {
+            int16_t last_id = 0;
+            uint8_t header;
+
+            while (!rd->error && (header = rd_byte(rd)) != 0)
+            {
+                TH_NODE *child = node_add(node);
+                int16_t delta = header >> 4;
+                child->id = delta ? last_id + delta : (int16_t)rd_zigzag(rd);
+                last_id = child->id;
+                rd_value(rd, child, header & 0x0f);
+            }
+        }
+        break;
+
+    default:
+        rd->error = true;
+        break;
+    }
+}
+
+static void node_free(TH_NODE *node)
+{
+    for (int i = 0; i < node->n_children; i++)
+    {
+        node_free(&node->children[i]);
+    }
+
+    free(node->children);
+    memset(node, 0, sizeof(*node));
+}
+
+/** Read a structure, returns the number of bytes read or 0 on error */
+static size_t rd_struct(const uint8_t *data, size_t len, TH_NODE *node)
+{
+    TH_READER rd = {data, data + len, false};
+    memset(node, 0, sizeof(*node));
+    rd_value(&rd, node, TH_STRUCT);
+    return rd.error ? 0 : rd.ptr - data;
+}
+
+static TH_NODE* node_field(TH_NODE *node, int16_t id, uint8_t type)
+{
+    for (int i = 0; node && i < node->n_children; i++)
+    {
+        if (node->children[i].id == id && node->children[i].type == type)
+        {
+            return &node->children[i];
+        }
+    }
+
+    return NULL;
+}
+
+/** The value of an integer field, -1 if the field is missing */
+static int64_t node_int(TH_NODE *node, int16_t id)
+{
+    TH_NODE *field = node_field(node, id, TH_I32);
+
+    if (field == NULL)
+    {
+        field = node_field(node, id, TH_I64);
+    }
+
+    return field ? field->value : -1;
+}
+
+static bool node_string(TH_NODE *node, int16_t id, const char *expected)
+{
+    TH_NODE *field = node_field(node, id, TH_BINARY);
+    return field && field->len == strlen(expected) && memcmp(field->data, expected, field->len) == 0;
+}
+
+/** The values written to the test table */
+
+static int32_t value_int(int group, int row)
+{
+    return group ? row * 1000 + 7 : row % 2;
+}
+
+static int64_t value_long(int group, int row)
+{
+    return group ? -((int64_t)row << 33) - 1 : row % 3;
+}
+
+static float value_float(int group, int row)
+{
+    /** Runs of sixteen equal values are run length encoded */
+    return group ? row + 0.5f : (row / 16) % 2 * 1.5f;
+}
+
+static double value_double(int group, int row)
+{
+    return group ? row * 0.25 : (row % 2 ? -2.0 : 8.0);
+}
+
+static void value_string(int group, int row, char *dest, size_t size)
+{
+    snprintf(dest, size, group ? "distinct-%d" : "v%d", group ? row : row % 2);
+}
+
+static size_t value_bytes(int group, int row, uint8_t *dest)
+{
+    dest[0] = group ? row : 1;
+    dest[1] = group ? row >> 8 : 2;
+    dest[2] = group ? 0xff : row % 2;
+    dest[3] = 0;
+    return group ? 4 : 3;
+}
+
+static int value_enum(int group, int row)
+{
+    return group ? row % 3 : 0;
+}
+
+static void put_le(uint8_t **ptr, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+    {
+        *(*ptr)++ = value >> (8 * i);
+    }
+}
+
+/**
+ * The plain encoding of the value of a column, written here without the
+ * encoders of the writer
+ */
+static size_t expected_plain(int group, int row, int column, uint8_t *dest)
+{
+    uint8_t *ptr = dest;
+    char str[32];
+    uint8_t bytes[4];
+    float f;
+    double d;
+    size_t len;
+
+    switch (column)
+    {
+    case 0:
+        put_le(&ptr, (uint32_t)value_int(group, row), 4);
+        break;
+
+    case 1:
+        put_le(&ptr, (uint64_t)value_long(group, row), 8);
+        break;
+
+    case 2:
+        f = value_float(group, row);
+        memcpy(ptr, &f, sizeof(f));
+        ptr += sizeof(f);
+        break;
+
+    case 3:
+        d = value_double(group, row);
+        memcpy(ptr, &d, sizeof(d));
+        ptr += sizeof(d);
+        break;
+
+    case 4:
+        value_string(group, row, str, sizeof(str));
+        put_le(&ptr, strlen(str), 4);
+        memcpy(ptr, str, strlen(str));
+        ptr += strlen(str);
+        break;
+
+    case 5:
+        len = value_bytes(group, row, bytes);
+        put_le(&ptr, len, 4);
+        memcpy(ptr, bytes, len);
+        ptr += len;
+        break;
+
+    case 6:
+        len = strlen(enum_symbols[value_enum(group, row)]);
+        put_le(&ptr, len, 4);
+        memcpy(ptr, enum_symbols[value_enum(group, row)], len);
+        ptr += len;
+        break;
+    }
+
+    return ptr - dest;
+}
+
+/** Whether a column of a row group is expected to be dictionary encoded */
+static bool expect_dictionary(int group, int column)
+{
+    /** The null column has no values and the enum has only three symbols */
+    return column != 7 && (group == 0 || column == 6);
+}
+
+static void append_rows(AVRO_TABLE *table, avro_value_iface_t *iface, int group)
+{
+    avro_value_t record;
+    avro_value_t field;
+    char str[32];
+    uint8_t bytes[4];
+
+    avro_generic_value_new(iface, &record);
+
+    for (int row = 0; row < N_ROWS; row++)
+    {
+        avro_value_get_by_name(&record, "i", &field, NULL);
+        avro_value_set_int(&field, value_int(group, row));
+        avro_value_get_by_name(&record, "l", &field, NULL);
+        avro_value_set_long(&field, value_long(group, row));
+        avro_value_get_by_name(&record, "f", &field, NULL);
+        avro_value_set_float(&field, value_float(group, row));
+        avro_value_get_by_name(&record, "d", &field, NULL);
+        avro_value_set_double(&field, value_double(group, row));
+        avro_value_get_by_name(&record, "s", &field, NULL);
+        value_string(group, row, str, sizeof(str));
+        avro_value_set_string(&field, str);
+        avro_value_get_by_name(&record, "b", &field, NULL);
+        avro_value_set_bytes(&field, bytes, value_bytes(group, row, bytes));
+        avro_value_get_by_name(&record, "e", &field, NULL);
+        avro_value_set_enum(&field, value_enum(group, row));
+        avro_value_get_by_name(&record, "n", &field, NULL);
+        avro_value_set_null(&field);
+        avro_parquet_append(table, &record);
+    }
+
+    avro_value_decref(&record);
+}
+
+static uint8_t* read_file(const char *path, size_t *len)
+{
+    FILE *file = fopen(path, "rb");
+    uint8_t *data = NULL;
+
+    if (file)
+    {
+        fseek(file, 0, SEEK_END);
+        *len = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        data = malloc(*len ? *len : 1);
+
+        if (fread(data, 1, *len, file) != *len)
+        {
+            free(data);
+            data = NULL;
+        }
+
+        fclose(file);
+    }
+
+    return data;
+}
+
+static PARQUET_FILE* create_file(AVRO_INSTANCE *router, AVRO_TABLE *table, const char *json)
+{
+    unlink(TEST_PARQUET_FILE);
+
+    if (avro_schema_from_json_length(json, strlen(json), &table->avro_schema))
+    {
+        printf("Failed to parse the Avro schema: %s\n", avro_strerror());
+        errors++;
+        return NULL;
+    }
+
+    PARQUET_FILE *file = parquet_file_create(router, table);
+    CHECK(file, "Failed to create the Parquet file");
+    return file;
+}
+
+/** An empty file must match the known metadata bytes */
+static void test_empty_file(AVRO_INSTANCE *router, AVRO_TABLE *table)
+{
+    static const char json[] =
+        "{\"type\": \"record\", \"name\": \"t1\", \"fields\": [{\"name\": \"a\", \"type\": \"int\"}]}";
+    static const uint8_t expected[] =
+    {
+        'P', 'A', 'R', '1',
+        0x15, 0x02,                                     /* version: 1 */
+        0x19, 0x2c,                                     /* schema: list of 2 structs */
+        0x48, 0x06, 's', 'c', 'h', 'e', 'm', 'a',       /*   name: schema */
+        0x15, 0x02, 0x00,                               /*   num_children: 1 */
+        0x15, 0x02,                                     /*   type: INT32 */
+        0x25, 0x00,                                     /*   repetition_type: REQUIRED */
+        0x18, 0x01, 'a', 0x00,                          /*   name: a */
+        0x16, 0x00,                                     /* num_rows: 0 */
+        0x19, 0x0c,                                     /* row_groups: empty list */
+        0x28, 0x13, 'M', 'a', 'x', 'S', 'c', 'a', 'l', 'e', ' ',
+        'a', 'v', 'r', 'o', 'r', 'o', 'u', 't', 'e', 'r', 0x00,
+        0x31, 0x00, 0x00, 0x00,                         /* footer length: 49 */
+        'P', 'A', 'R', '1'
+    };
+
+    PARQUET_FILE *file = create_file(router, table, json);
+
+    if (file)
+    {
+        size_t len = 0;
+        uint8_t *data = read_file(TEST_PARQUET_FILE, &len);
+        CHECK(data && len == sizeof(expected) && memcmp(data, expected, len) == 0,
+              "The empty Parquet file has the wrong bytes");
+        free(data);
+        parquet_file_free(file);
+    }
+
+    avro_schema_decref(table->avro_schema);
+    unlink(TEST_PARQUET_FILE);
+}
+
+/**
+ * Decode values in the RLE and bit-packing hybrid encoding
+ *
+ * @return Number of bytes read or 0 on error
+ */
+static size_t rle_decode(const uint8_t *data, size_t len, int width, uint32_t *values, size_t n)
+{
+    TH_READER rd = {data, data + len, false};
+    size_t i = 0;
+
+    while (i < n && !rd.error)
+    {
+        uint64_t header = rd_varint(&rd);
+
+        if (header & 1)
+        {
+            size_t n_bytes = (header >> 1) * width;
+
+            if (n_bytes > (size_t)(rd.end - rd.ptr))
+            {
+                return 0;
+            }
+
+            for (size_t bit = 0; bit + width <= n_bytes * 8 && i < n; i++)
+            {
+                values[i] = 0;
+
+                for (int b = 0; b < width; b++, bit++)
+                {
+                    if (rd.ptr[bit / 8] & (1 << (bit % 8)))
+                    {
+                        values[i] |= 1U << b;
+                    }
+                }
+            }
+
+            rd.ptr += n_bytes;
+        }
+        else
+        {
+            uint32_t value = 0;
+
+            for (int b = 0; b < (width + 7) / 8; b++)
+            {
+                value |= (uint32_t)rd_byte(&rd) << (8 * b);
+            }
+
+            for (uint64_t run = header >> 1; run > 0 && i < n; run--)
+            {
+                values[i++] = value;
+            }
+        }
+    }
+
+    return rd.error || i < n ? 0 : rd.ptr - data;
+}
+
+/** Split plain encoded values into the offsets of the values */
+static int split_plain(int type, const uint8_t *data, size_t len, uint32_t *offsets, int max)
+{
+    size_t pos = 0;
+    int n = 0;
+
+    while (pos < len && n < max)
+    {
+        size_t size;
+
+        switch (type)
+        {
+        case PQ_TYPE_INT32:
+        case PQ_TYPE_FLOAT:
+            size = 4;
+            break;
+
+        case PQ_TYPE_INT64:
+        case PQ_TYPE_DOUBLE:
+            size = 8;
+            break;
+
+        default:
+            size = pos + 4 <= len ? 4 + (data[pos] | data[pos + 1] << 8 |
+                                         data[pos + 2] << 16 | (uint32_t)data[pos + 3] << 24) : len;
+            break;
+        }
+
+        if (size > len - pos)
+        {
+            return -1;
+        }
+
+        offsets[n++] = pos;
+        pos += size;
+    }
+
+    offsets[n] = pos;
+    return pos == len ? n : -1;
+}
+
+/**
+ * Read a page and return its header and body
+ *
+ * @return Offset after the page or 0 on error
+ */
+static size_t read_page(const uint8_t *data, size_t len, size_t offset, bool gzip,
+                        TH_NODE *header, uint8_t **body, size_t *body_len)
+{
+    size_t header_len = rd_struct(data + offset, len - offset, header);
+
+    if (header_len == 0)
+    {
+        return 0;
+    }
+
+    size_t uncompressed = node_int(header, 2);
+    size_t compressed = node_int(header, 3);
+    const uint8_t *page = data + offset + header_len;
+
+    if (compressed > len - offset - header_len || (!gzip && compressed != uncompressed))
+    {
+        return 0;
+    }
+
+    *body = malloc(uncompressed + 1);
+    *body_len = uncompressed;
+
+    if (gzip)
+    {
+        z_stream zs = {};
+        int rc = Z_DATA_ERROR;
+
+        if (inflateInit2(&zs, 15 + 16) == Z_OK)
+        {
+            zs.next_in = (uint8_t*)page;
+            zs.avail_in = compressed;
+            zs.next_out = *body;
+            zs.avail_out = uncompressed + 1;
+            rc = inflate(&zs, Z_FINISH);
+            inflateEnd(&zs);
+        }
+
+        if (rc != Z_STREAM_END || zs.total_out != uncompressed)
+        {
+            free(*body);
+            *body = NULL;
+            return 0;
+        }
+    }
+    else
+    {
+        memcpy(*body, page, uncompressed);
+    }
+
+    return offset + header_len + compressed;
+}
+
+/** Check the pages of a column chunk against the written values */
+static void check_column(const uint8_t *data, size_t len, bool gzip, int group, int column,
+                         TH_NODE *meta)
+{
+    const char *name = column_names[column];
+    bool dict = expect_dictionary(group, column);
+    int encoding = dict ? PQ_ENC_PLAIN_DICTIONARY : PQ_ENC_PLAIN;
+    int64_t dict_offset = node_int(meta, 11);
+    int64_t data_offset = node_int(meta, 9);
+    TH_NODE *encodings = node_field(meta, 2, TH_LIST);
+    TH_NODE *path = node_field(meta, 3, TH_LIST);
+
+    CHECK(node_int(meta, 1) == column_types[column], "%s: wrong type", name);
+    CHECK(encodings && encodings->n_children == 2 && encodings->children[0].value == encoding &&
+          encodings->children[1].value == PQ_ENC_RLE, "%s: wrong encodings", name);
+    CHECK(path && path->n_children == 1 && path->children[0].len == strlen(name) &&
+          memcmp(path->children[0].data, name, strlen(name)) == 0, "%s: wrong path", name);
+    CHECK(node_int(meta, 4) == (gzip ? PQ_CODEC_GZIP : PQ_CODEC_UNCOMPRESSED), "%s: wrong codec", name);
+    CHECK(node_int(meta, 5) == N_ROWS, "%s: wrong number of values", name);
+    CHECK(dict == (dict_offset != -1), "%s: group %d should %sbe dictionary encoded",
+          name, group, dict ? "" : "not ");
+
+    uint8_t *dict_body = NULL;
+    size_t dict_len = 0;
+    uint32_t dict_offsets[N_ROWS + 1];
+    int n_entries = 0;
+    size_t chunk_end = 0;
+    TH_NODE header;
+
+    if (dict && dict_offset != -1)
+    {
+        chunk_end = read_page(data, len, dict_offset, gzip, &header, &dict_body, &dict_len);
+        TH_NODE *dict_header = node_field(&header, 7, TH_STRUCT);
+        CHECK(chunk_end == (size_t)data_offset, "%s: the data page does not follow the dictionary", name);
+        CHECK(node_int(&header, 1) == PQ_PAGE_DICTIONARY && dict_header &&
+              node_int(dict_header, 2) == PQ_ENC_PLAIN_DICTIONARY, "%s: wrong dictionary page header", name);
+        n_entries = dict_body ? split_plain(column_types[column], dict_body, dict_len,
+                                            dict_offsets, N_ROWS) : -1;
+        CHECK(n_entries > 0 && n_entries == node_int(dict_header, 1),
+              "%s: wrong number of dictionary entries", name);
+        node_free(&header);
+    }
+
+    uint8_t *body = NULL;
+    size_t body_len = 0;
+    size_t page_end = read_page(data, len, data_offset, gzip, &header, &body, &body_len);
+    TH_NODE *data_header = node_field(&header, 5, TH_STRUCT);
+
+    CHECK(page_end > 0 && body, "%s: failed to read the data page", name);
+    CHECK(node_int(&header, 1) == PQ_PAGE_DATA && data_header &&
+          node_int(data_header, 1) == N_ROWS && node_int(data_header, 2) == encoding &&
+          node_int(data_header, 3) == PQ_ENC_RLE && node_int(data_header, 4) == PQ_ENC_RLE,
+          "%s: wrong data page header", name);
+    CHECK(node_int(&header, 2) == (int64_t)body_len, "%s: wrong uncompressed size", name);
+    CHECK(node_int(meta, 7) == (int64_t)page_end - (dict ? dict_offset : data_offset),
+          "%s: wrong compressed chunk size", name);
+    node_free(&header);
+
+    uint8_t expected[64];
+    uint32_t values[N_ROWS] = {0};
+
+    if (body == NULL)
+    {
+        /** Reported above */
+    }
+    else if (column == 7)
+    {
+        /** The definition levels of the null values */
+        uint32_t levels_len = body_len >= 4 ? body[0] | body[1] << 8 | body[2] << 16 | body[3] << 24 : 0;
+        CHECK(body_len >= 4 && levels_len == body_len - 4 &&
+              rle_decode(body + 4, levels_len, 1, values, N_ROWS) == levels_len,
+              "%s: wrong definition levels", name);
+
+        for (int row = 0; row < N_ROWS && levels_len == body_len - 4; row++)
+        {
+            CHECK(values[row] == 0, "%s: row %d is not null", name, row);
+        }
+    }
+    else if (dict)
+    {
+        int width = body_len > 0 ? body[0] : 0;
+        CHECK(width == bit_width(n_entries), "%s: wrong bit width %d", name, width);
+        CHECK(body_len > 1 && rle_decode(body + 1, body_len - 1, width, values, N_ROWS) == body_len - 1,
+              "%s: failed to decode the indices", name);
+
+        for (int row = 0; row < N_ROWS && n_entries > 0; row++)
+        {
+            size_t size = expected_plain(group, row, column, expected);
+            uint32_t e = values[row];
+            CHECK(e < (uint32_t)n_entries && dict_offsets[e + 1] - dict_offsets[e] == size &&
+                  memcmp(dict_body + dict_offsets[e], expected, size) == 0,
+                  "%s: wrong value in row %d of group %d", name, row, group);
+        }
+    }
+    else
+    {
+        uint32_t offsets[N_ROWS + 1];
+        int n = split_plain(column_types[column], body, body_len, offsets, N_ROWS);
+        CHECK(n == N_ROWS, "%s: wrong number of plain values", name);
+
+        for (int row = 0; row < n; row++)
+        {
+            size_t size = expected_plain(group, row, column, expected);
+            CHECK(offsets[row + 1] - offsets[row] == size && memcmp(body + offsets[row], expected, size) == 0,
+                  "%s: wrong value in row %d of group %d", name, row, group);
+        }
+    }
+
+    free(body);
+    free(dict_body);
+}
+
+/** Write two row groups, one dictionary encoded and one plain, and read them back */
+static void test_row_groups(AVRO_INSTANCE *router, AVRO_TABLE *table, bool gzip)
+{
+    router->parquet_gzip = gzip;
+    PARQUET_FILE *file = create_file(router, table, test_schema);
+
+    if (file == NULL)
+    {
+        return;
+    }
+
+    avro_value_iface_t *iface = avro_generic_class_from_schema(table->avro_schema);
+    table->parquet = file;
+    append_rows(table, iface, 0);
+    append_rows(table, iface, 1);
+    CHECK(file->n_row_groups == 2 && file->n_rows == 0, "Expected two written row groups");
+    parquet_file_free(file);
+    table->parquet = NULL;
+    avro_value_iface_decref(iface);
+    avro_schema_decref(table->avro_schema);
+
+    size_t len = 0;
+    uint8_t *data = read_file(TEST_PARQUET_FILE, &len);
+    CHECK(data && len > 12 && memcmp(data, PARQUET_MAGIC, 4) == 0 &&
+          memcmp(data + len - 4, PARQUET_MAGIC, 4) == 0, "Missing Parquet magic");
+
+    if (data == NULL || len <= 12)
+    {
+        free(data);
+        return;
+    }
+
+    uint32_t footer_len = data[len - 8] | data[len - 7] << 8 | data[len - 6] << 16 | data[len - 5] << 24;
+    TH_NODE footer = {};
+    CHECK(footer_len <= len - 12 && rd_struct(data + len - 8 - footer_len, footer_len, &footer) == footer_len,
+          "Failed to read the Parquet metadata");
+
+    TH_NODE *schema = node_field(&footer, 2, TH_LIST);
+    TH_NODE *row_groups = node_field(&footer, 4, TH_LIST);
+
+    CHECK(node_int(&footer, 1) == 1, "Wrong format version");
+    CHECK(node_int(&footer, 3) == 2 * N_ROWS, "Wrong number of rows");
+    CHECK(node_string(&footer, 6, "MaxScale avrorouter"), "Wrong created_by");
+    CHECK(schema && schema->n_children == N_COLUMNS + 1 &&
+          node_string(&schema->children[0], 4, "schema") &&
+          node_int(&schema->children[0], 5) == N_COLUMNS, "Wrong schema root");
+
+    for (int i = 0; schema && i < N_COLUMNS && i + 1 < schema->n_children; i++)
+    {
+        TH_NODE *element = &schema->children[i + 1];
+        bool utf8 = i == 4 || i == 6;
+        CHECK(node_int(element, 1) == column_types[i] && node_string(element, 4, column_names[i]) &&
+              node_int(element, 3) == (i == 7 ? PQ_OPTIONAL : PQ_REQUIRED) &&
+              node_int(element, 6) == (utf8 ? PQ_CONVERTED_UTF8 : -1),
+              "Wrong schema element for column %s", column_names[i]);
+    }
+
+    CHECK(row_groups && row_groups->n_children == 2, "Expected two row groups in the metadata");
+
+    for (int g = 0; row_groups && g < row_groups->n_children; g++)
+    {
+        TH_NODE *row_group = &row_groups->children[g];
+        TH_NODE *columns = node_field(row_group, 1, TH_LIST);
+        CHECK(node_int(row_group, 3) == N_ROWS, "Wrong number of rows in group %d", g);
+        CHECK(columns && columns->n_children == N_COLUMNS, "Wrong number of column chunks in group %d", g);
+
+        for (int c = 0; columns && c < columns->n_children && c < N_COLUMNS; c++)
+        {
+            TH_NODE *chunk = &columns->children[c];
+            TH_NODE *meta = node_field(chunk, 3, TH_STRUCT);
+            int64_t first_page = expect_dictionary(g, c) ? node_int(meta, 11) : node_int(meta, 9);
+            CHECK(meta && node_int(chunk, 2) == first_page, "%s: wrong chunk offset", column_names[c]);
+
+            if (meta)
+            {
+                check_column(data, len - 8 - footer_len, gzip, g, c, meta);
+            }
+        }
+    }
+
+    node_free(&footer);
+    free(data);
+    unlink(TEST_PARQUET_FILE);
+}
+
+int main(int argc, char** argv)
+{
+    SERVICE service = {};
+    AVRO_INSTANCE router = {};
+    AVRO_TABLE table = {};
+
+    service.name = "test";
+    router.service = &service;
+    router.parquet_group_rows = N_ROWS;
+    table.filename = TEST_AVRO_FILE;
+
+    test_encoders();
+    test_empty_file(&router, &table);
+    test_row_groups(&router, &table, false);
+    test_row_groups(&router, &table, true);
+
+    return errors;
+}
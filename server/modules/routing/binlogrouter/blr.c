@@ -67,6 +67,7 @@
 #include <string.h>
 #include <ctype.h>
 #include <time.h>
+#include <inttypes.h>
 #include <maxscale/service.h>
 #include <maxscale/server.h>
 #include <maxscale/router.h>
@@ -120,6 +121,7 @@ bool blr_get_encryption_key(ROUTER_INSTANCE *router);
 int blr_parse_key_file(ROUTER_INSTANCE *router);
 
 static void stats_func(void *);
+static void checkpoint_func(void *);
 
 static bool rses_begin_locked_router_action(ROUTER_SLAVE *);
 static void rses_end_locked_router_action(ROUTER_SLAVE *);
@@ -129,6 +131,14 @@ GWBUF *blr_cache_read_response(ROUTER_INSTANCE *router, char *response);
 static SPINLOCK instlock;
 static ROUTER_INSTANCE *instances;
 
+static const MXS_ENUM_VALUE binlog_sync_values[] =
+{
+    {"read", BLR_SYNC_READ},
+    {"group", BLR_SYNC_GROUP},
+    {"none", BLR_SYNC_NONE},
+    {NULL}
+};
+
 static const MXS_ENUM_VALUE enc_algo_values[] =
 {
     {"aes_cbc", BLR_AES_CBC},
@@ -191,6 +201,7 @@ MXS_MODULE* MXS_CREATE_MODULE()
             {"file", MXS_MODULE_PARAM_COUNT, "1"},
             {"transaction_safety", MXS_MODULE_PARAM_BOOL, "false"},
             {"semisync", MXS_MODULE_PARAM_BOOL, "false"},
+            {"semisync_ack_interval", MXS_MODULE_PARAM_COUNT, DEF_SEMISYNC_ACK_INTERVAL},
             {"encrypt_binlog", MXS_MODULE_PARAM_BOOL, "false"},
             {"encryption_algorithm", MXS_MODULE_PARAM_ENUM, "aes_cbc", MXS_MODULE_OPT_NONE, enc_algo_values},
             {"encryption_key_file", MXS_MODULE_PARAM_PATH, NULL, MXS_MODULE_OPT_PATH_R_OK},
@@ -199,10 +210,20 @@ MXS_MODULE* MXS_CREATE_MODULE()
             {"shortburst", MXS_MODULE_PARAM_COUNT, DEF_SHORT_BURST},
             {"longburst", MXS_MODULE_PARAM_COUNT, DEF_LONG_BURST},
             {"burstsize", MXS_MODULE_PARAM_SIZE, DEF_BURST_SIZE},
+            {"catchup_budget", MXS_MODULE_PARAM_SIZE, DEF_CATCHUP_BUDGET},
             {"heartbeat", MXS_MODULE_PARAM_COUNT, BLR_HEARTBEAT_DEFAULT_INTERVAL},
+            {"event_cache", MXS_MODULE_PARAM_COUNT, DEF_EVENT_CACHE},
+            {"gtid_index_interval", MXS_MODULE_PARAM_COUNT, DEF_GTID_INDEX_INTERVAL},
+            {"checkpoint_interval", MXS_MODULE_PARAM_COUNT, DEF_CHECKPOINT_INTERVAL},
+            {"compress_binlogs", MXS_MODULE_PARAM_BOOL, "false"},
+            {"compress_keep", MXS_MODULE_PARAM_COUNT, DEF_COMPRESS_KEEP},
+            {"binlog_sync", MXS_MODULE_PARAM_ENUM, "read", MXS_MODULE_OPT_NONE, binlog_sync_values},
+            {"binlog_sync_interval", MXS_MODULE_PARAM_COUNT, DEF_BINLOG_SYNC_INTERVAL},
+            {"binlog_sync_size", MXS_MODULE_PARAM_SIZE, DEF_BINLOG_SYNC_SIZE},
             {"send_slave_heartbeat", MXS_MODULE_PARAM_BOOL, "false"},
             {"binlogdir", MXS_MODULE_PARAM_PATH, NULL, MXS_MODULE_OPT_PATH_W_OK},
             {"ssl_cert_verification_depth", MXS_MODULE_PARAM_COUNT, "9"},
+            {"slave_filter", MXS_MODULE_PARAM_STRING},
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -272,6 +293,7 @@ createInstance(SERVICE *service, char **options)
     inst->files = NULL;
     spinlock_init(&inst->fileslock);
     spinlock_init(&inst->binlog_lock);
+    spinlock_init(&inst->feed_lock);
 
     inst->binlog_fd = -1;
     inst->master_chksum = true;
@@ -310,6 +332,14 @@ createInstance(SERVICE *service, char **options)
     inst->current_safe_event = 0;
     inst->master_event_state = BLR_EVENT_DONE;
 
+    /* The lagging slaves are counted per thread, to share the catchup budget */
+    inst->n_threads = config_threadcount();
+    if ((inst->lagging_slaves = MXS_CALLOC(inst->n_threads, sizeof(int))) == NULL)
+    {
+        free_instance(inst);
+        return NULL;
+    }
+
     strcpy(inst->binlog_name, "");
     strcpy(inst->prevbinlog, "");
 
@@ -322,8 +352,17 @@ createInstance(SERVICE *service, char **options)
     inst->short_burst = config_get_integer(params, "shortburst");
     inst->long_burst = config_get_integer(params, "longburst");
     inst->burst_size = config_get_size(params, "burstsize");
+    inst->catchup_budget = config_get_size(params, "catchup_budget");
     inst->binlogdir = config_copy_string(params, "binlogdir");
     inst->heartbeat = config_get_integer(params, "heartbeat");
+    inst->event_cache_size = config_get_integer(params, "event_cache");
+    inst->gtid_index_interval = config_get_integer(params, "gtid_index_interval");
+    inst->checkpoint_interval = config_get_integer(params, "checkpoint_interval");
+    inst->compress_binlogs = config_get_bool(params, "compress_binlogs");
+    inst->compress_keep = config_get_integer(params, "compress_keep");
+    inst->binlog_sync = config_get_enum(params, "binlog_sync", binlog_sync_values);
+    inst->sync_interval = config_get_integer(params, "binlog_sync_interval");
+    inst->sync_size = config_get_size(params, "binlog_sync_size");
     inst->ssl_cert_verification_depth = config_get_integer(params, "ssl_cert_verification_depth");
     inst->mariadb10_compat = config_get_bool(params, "mariadb10-compatibility");
     inst->trx_safe = config_get_bool(params, "transaction_safety");
@@ -342,8 +381,18 @@ createInstance(SERVICE *service, char **options)
 
     inst->send_slave_heartbeat = config_get_bool(params, "send_slave_heartbeat");
 
+    const char *slave_filter = config_get_string(params, "slave_filter");
+
+    if (*slave_filter && !blr_filter_parse(slave_filter, &inst->slave_filters))
+    {
+        MXS_ERROR("Service %s, invalid slave_filter '%s'.", service->name, slave_filter);
+        free_instance(inst);
+        return NULL;
+    }
+
     /* Semi-Sync support */
     inst->request_semi_sync = config_get_bool(params, "semisync");
+    inst->semisync_ack_interval = config_get_integer(params, "semisync_ack_interval");
     inst->master_semi_sync = 0;
 
     /* Binlog encryption */
@@ -502,6 +551,10 @@ createInstance(SERVICE *service, char **options)
                 {
                     inst->request_semi_sync = config_truth_value(value);
                 }
+                else if (strcmp(options[i], "semisync_ack_interval") == 0)
+                {
+                    inst->semisync_ack_interval = atoi(value);
+                }
                 else if (strcmp(options[i], "encrypt_binlog") == 0)
                 {
                     inst->encryption.enabled = config_truth_value(value);
@@ -570,6 +623,59 @@ createInstance(SERVICE *service, char **options)
                     inst->burst_size = size;
 
                 }
+                else if (strcmp(options[i], "catchup_budget") == 0)
+                {
+                    inst->catchup_budget = strtoul(value, NULL, 10);
+                }
+                else if (strcmp(options[i], "event_cache") == 0)
+                {
+                    inst->event_cache_size = atoi(value);
+                }
+                else if (strcmp(options[i], "gtid_index_interval") == 0)
+                {
+                    inst->gtid_index_interval = atoi(value);
+                }
+                else if (strcmp(options[i], "checkpoint_interval") == 0)
+                {
+                    inst->checkpoint_interval = atoi(value);
+                }
+                else if (strcmp(options[i], "compress_binlogs") == 0)
+                {
+                    inst->compress_binlogs = config_truth_value(value);
+                }
+                else if (strcmp(options[i], "compress_keep") == 0)
+                {
+                    inst->compress_keep = atoi(value);
+                }
+                else if (strcmp(options[i], "binlog_sync") == 0)
+                {
+                    if (strcasecmp(value, "read") == 0)
+                    {
+                        inst->binlog_sync = BLR_SYNC_READ;
+                    }
+                    else if (strcasecmp(value, "group") == 0)
+                    {
+                        inst->binlog_sync = BLR_SYNC_GROUP;
+                    }
+                    else if (strcasecmp(value, "none") == 0)
+                    {
+                        inst->binlog_sync = BLR_SYNC_NONE;
+                    }
+                    else
+                    {
+                        MXS_WARNING("%s: Unsupported binlog_sync value '%s', "
+                                    "supported values are read, group and none.",
+                                    service->name, value);
+                    }
+                }
+                else if (strcmp(options[i], "binlog_sync_interval") == 0)
+                {
+                    inst->sync_interval = atoi(value);
+                }
+                else if (strcmp(options[i], "binlog_sync_size") == 0)
+                {
+                    inst->sync_size = strtoul(value, NULL, 10);
+                }
                 else if (strcmp(options[i], "heartbeat") == 0)
                 {
                     int h_val = (int)strtol(value, NULL, 10);
@@ -594,6 +700,15 @@ createInstance(SERVICE *service, char **options)
                     MXS_FREE(inst->binlogdir);
                     inst->binlogdir = MXS_STRDUP_A(value);
                 }
+                else if (strcmp(options[i], "slave_filter") == 0)
+                {
+                    if (!blr_filter_parse(value, &inst->slave_filters))
+                    {
+                        MXS_ERROR("Service %s, invalid slave_filter '%s'.", service->name, value);
+                        free_instance(inst);
+                        return NULL;
+                    }
+                }
                 else if (strcmp(options[i], "ssl_cert_verification_depth") == 0)
                 {
                     int new_depth =  atoi(value);
@@ -868,12 +983,45 @@ createInstance(SERVICE *service, char **options)
      */
     blr_init_cache(inst);
 
+    /*
+     * Load the index of the MariaDB 10 GTIDs in the binlog files
+     */
+    blr_gtid_index_init(inst);
+
+    /*
+     * Start syncing the binlog files in groups, if so configured
+     */
+    if (!blr_file_start_sync(inst))
+    {
+        MXS_WARNING("%s: The binlog files are synced after each read from the master.",
+                    service->name);
+        inst->binlog_sync = BLR_SYNC_READ;
+    }
+
+    /*
+     * Start compressing the old binlog files, if so configured
+     */
+    if (!blr_compress_start(inst))
+    {
+        MXS_WARNING("%s: The old binlog files are not compressed.", service->name);
+    }
+
     /*
      * Add tasks for statistic computation
      */
     snprintf(task_name, BLRM_TASK_NAME_LEN, "%s stats", service->name);
     hktask_add(task_name, stats_func, inst, BLR_STATS_FREQ);
 
+    /*
+     * With transaction safety the safe position is always a transaction
+     * boundary, from where the validation of the binlog file can continue
+     */
+    if (inst->trx_safe && inst->checkpoint_interval > 0)
+    {
+        snprintf(task_name, BLRM_TASK_NAME_LEN, "%s checkpoint", service->name);
+        hktask_add(task_name, checkpoint_func, inst, inst->checkpoint_interval);
+    }
+
     /* Log whether the transaction safety option value is on */
     if (inst->trx_safe)
     {
@@ -926,7 +1074,7 @@ createInstance(SERVICE *service, char **options)
             inst->master_state = BLRM_SLAVE_STOPPED;
             /* Set mysql_errno and error message */
             inst->m_errno = BINLOG_FATAL_ERROR_READING;
-            inst->m_errmsg = mxs_strdup("HY000 Binlog encryption is Off but binlog file has "
+            inst->m_errmsg = MXS_STRDUP("HY000 Binlog encryption is Off but binlog file has "
                                         "the START_ENCRYPTION_EVENT");
 
             return (MXS_ROUTER *)inst;
@@ -955,11 +1103,13 @@ free_instance(ROUTER_INSTANCE *instance)
     MXS_FREE(instance->set_slave_hostname);
     MXS_FREE(instance->fileroot);
     MXS_FREE(instance->binlogdir);
+    MXS_FREE(instance->lagging_slaves);
     /* SSL options */
     MXS_FREE(instance->ssl_ca);
     MXS_FREE(instance->ssl_cert);
     MXS_FREE(instance->ssl_key);
     MXS_FREE(instance->ssl_version);
+    blr_filter_free(instance->slave_filters);
 
     MXS_FREE(instance);
 }
@@ -1004,6 +1154,8 @@ newSession(MXS_ROUTER *instance, MXS_SESSION *session)
     slave->pthread = 0;
     slave->overrun = 0;
     slave->uuid = NULL;
+    slave->gtid_requested = false;
+    slave->lagging_thread = -1;
     slave->hostname = NULL;
     spinlock_init(&slave->catch_lock);
     slave->dcb = session->client_dcb;
@@ -1078,6 +1230,8 @@ static void freeSession(MXS_ROUTER* router_instance,
     }
     spinlock_release(&router->lock);
 
+    blr_slave_set_lagging(router, slave, false);
+
     MXS_DEBUG("%lu [freeSession] Unlinked router_client_session %p from "
               "router %p. Connections : %d. ",
               pthread_self(),
@@ -1097,6 +1251,7 @@ static void freeSession(MXS_ROUTER* router_instance,
     {
         MXS_FREE(slave->passwd);
     }
+    blr_filter_reset(slave);
     if (slave->encryption_ctx)
     {
         MXS_FREE(slave->encryption_ctx);
@@ -1248,6 +1403,21 @@ spin_reporter(void *dcb, char *desc, int value)
 }
 #endif
 
+/**
+ * Print a row of the semi-sync latency table of the diagnostics
+ *
+ * @param   dcb     The DCB to print to
+ * @param   name    Name of the measured interval
+ * @param   hist    The latencies, in microseconds
+ */
+static void
+blr_print_semisync_latency(DCB *dcb, const char *name, const HISTOGRAM *hist)
+{
+    dcb_printf(dcb, "\t%-16s %-10lu %-10lu %-10lu %lu\n", name,
+               histogram_percentile(hist, 50), histogram_percentile(hist, 99),
+               histogram_percentile(hist, 99.9), hist->max);
+}
+
 /**
  * Display router diagnostics
  *
@@ -1372,6 +1542,12 @@ diagnostics(MXS_ROUTER *router, DCB *dcb)
     }
     dcb_printf(dcb, "\tNumber of slave servers:                     %u\n",
                router_inst->stats.n_slaves);
+    int n_lagging = 0;
+    for (int i = 0; i < router_inst->n_threads; i++)
+    {
+        n_lagging += router_inst->lagging_slaves[i];
+    }
+    dcb_printf(dcb, "\tNumber of lagging slave servers:             %d\n", n_lagging);
     dcb_printf(dcb, "\tNo. of binlog events received this session:  %lu\n",
                router_inst->stats.n_binlogs_ses);
     dcb_printf(dcb, "\tTotal no. of binlog events received:         %lu\n",
@@ -1401,6 +1577,37 @@ diagnostics(MXS_ROUTER *router, DCB *dcb)
                router_inst->stats.n_reads);
     dcb_printf(dcb, "\tNumber of residual data packets:             %u\n",
                router_inst->stats.n_residuals);
+    dcb_printf(dcb, "\tNumber of binlog cache hits:                 %lu\n",
+               router_inst->stats.n_cachehits);
+    dcb_printf(dcb, "\tNumber of binlog cache misses:               %lu\n",
+               router_inst->stats.n_cachemisses);
+    if (router_inst->gtid_index)
+    {
+        dcb_printf(dcb, "\tNumber of GTID index entries:                %d\n",
+                   router_inst->gtid_index->n_entries);
+    }
+    if (router_inst->binlog_sync == BLR_SYNC_GROUP)
+    {
+        dcb_printf(dcb, "\tNumber of binlog file group syncs:           %lu\n",
+                   router_inst->stats.n_syncs);
+    }
+    if (router_inst->request_semi_sync)
+    {
+        dcb_printf(dcb, "\tNumber of semi-sync ACK requests:            %lu\n",
+                   router_inst->stats.n_semisync_reqs);
+        dcb_printf(dcb, "\tNumber of semi-sync ACKs sent:               %lu\n",
+                   router_inst->stats.n_semisync_acks);
+        dcb_printf(dcb, "\tSemi-sync ACK latency (us)\n");
+        dcb_printf(dcb, "\t                 p50        p99        p99.9      max\n");
+        blr_print_semisync_latency(dcb, "Receive-durable", &router_inst->semisync_durable_latency);
+        blr_print_semisync_latency(dcb, "Durable-ACK", &router_inst->semisync_ack_latency);
+        blr_print_semisync_latency(dcb, "Receive-ACK", &router_inst->semisync_total_latency);
+    }
+    if (router_inst->compress_binlogs)
+    {
+        dcb_printf(dcb, "\tNumber of binlog files compressed:           %lu\n",
+                   router_inst->stats.n_compressed);
+    }
     dcb_printf(dcb, "\tAverage events per packet:                   %.1f\n",
                router_inst->stats.n_reads != 0 ?
                ((double)router_inst->stats.n_binlogs / router_inst->stats.n_reads) : 0);
@@ -1546,6 +1753,14 @@ diagnostics(MXS_ROUTER *router, DCB *dcb)
             {
                 dcb_printf(dcb, "\t\tSlave UUID:                              %s\n", session->uuid);
             }
+            if (session->filter)
+            {
+                dcb_printf(dcb, "\t\tReplicated databases and tables:         ");
+                blr_filter_print(dcb, session->filter);
+                dcb_printf(dcb, "\n");
+                dcb_printf(dcb, "\t\tNo. events replaced by the filter:       %" PRIu64 "\n",
+                           session->stats.n_filtered);
+            }
             dcb_printf(dcb,
                        "\t\tSlave_host_port:                         [%s]:%d\n",
                        session->dcb->remote, dcb_get_port(session->dcb));
@@ -1775,7 +1990,7 @@ errorReply(MXS_ROUTER *instance,
                 {
                     free(router->m_errmsg);
                 }
-                router->m_errmsg = mxs_strdup("#28000 Authentication with master server failed");
+                router->m_errmsg = MXS_STRDUP("#28000 Authentication with master server failed");
                 /* set mysql_errno */
                 router->m_errno = 1045;
 
@@ -1954,6 +2169,18 @@ stats_func(void *inst)
     spinlock_release(&router->lock);
 }
 
+/**
+ * The checkpoint function called from the housekeeper, so that a restart
+ * only validates the end of the current binlog file
+ *
+ * @param inst  The router instance
+ */
+static void
+checkpoint_func(void *inst)
+{
+    blr_file_write_checkpoint((ROUTER_INSTANCE *)inst);
+}
+
 /**
  * Return some basic statistics from the router in response to a COM_STATISTICS
  * request.
@@ -2307,9 +2534,9 @@ static int blr_check_binlog(ROUTER_INSTANCE *router)
      * router->current_pos is the last event found.
      */
 
-    n = blr_read_events_all_events(router, 0, 0);
+    n = blr_file_verify(router);
 
-    MXS_DEBUG("blr_read_events_all_events() ret = %i\n", n);
+    MXS_DEBUG("blr_file_verify() ret = %i\n", n);
 
     if (n != 0)
     {
@@ -2458,6 +2685,18 @@ destroyInstance(MXS_ROUTER *instance)
     MXS_DEBUG("Destroying instance of router %s for service %s",
               inst->service->routerModule, inst->service->name);
 
+    /* Sync what has been written so far and stop the sync thread */
+    blr_file_stop_sync(inst);
+
+    /* Leave a file being compressed uncompressed */
+    blr_compress_stop(inst);
+
+    /* After a clean shutdown, the current binlog file needs no validation */
+    if (inst->trx_safe && inst->checkpoint_interval > 0)
+    {
+        blr_file_write_checkpoint(inst);
+    }
+
     /* Check whether master connection is active */
     if (inst->master)
     {
@@ -57,6 +57,9 @@
 #include <maxscale/thread.h>
 #include <maxscale/protocol/mysql.h>
 #include <maxscale/secrets.h>
+#include <maxscale/histogram.h>
+#include <maxscale/crc32.h>
+#include <binlog_feed.h>
 
 MXS_BEGIN_DECLS
 
@@ -198,6 +201,58 @@ enum blr_aes_mode
 #define DEF_LONG_BURST          "500"
 #define DEF_BURST_SIZE          "1024000" /* 1 Mb */
 
+/*
+ * The default number of bytes a thread sends in one round to all the lagging
+ * slaves it serves, and the least that is sent to each of them per round
+ */
+#define DEF_CATCHUP_BUDGET      "1024000"
+#define BLR_MIN_CATCHUP_BUDGET  (16 * 1024)
+
+/*
+ * The default minimum number of milliseconds between two semi-sync ACKs,
+ * 0 sends one as soon as the requested event has been synced
+ */
+#define DEF_SEMISYNC_ACK_INTERVAL "0"
+
+/**
+ * Default number of events in the binlog cache, and the size of the largest
+ * event that is cached. Larger events are always read from the binlog file.
+ */
+#define DEF_EVENT_CACHE         "1000"
+#define BLR_CACHE_MAX_EVENT_SIZE (64 * 1024)
+
+/**
+ * Defaults for group sync of the binlog file: the interval in milliseconds
+ * and the amount of written data that triggers a sync
+ */
+#define DEF_BINLOG_SYNC_INTERVAL "10"
+#define DEF_BINLOG_SYNC_SIZE     "1048576"
+
+/**
+ * Default number of MariaDB 10 transactions per domain between two entries
+ * of the GTID index, and the size of an entry in the index file
+ */
+#define DEF_GTID_INDEX_INTERVAL  "1000"
+#define BLR_GTID_ENTRY_LEN       28
+
+/**
+ * Default interval in seconds between two checkpoints of the current binlog
+ * file, and the number of bytes before the checkpoint whose CRC32 is saved
+ */
+#define DEF_CHECKPOINT_INTERVAL  "60"
+#define BLR_CHECKPOINT_CRC_LEN   4096
+
+/**
+ * Compressed binlog files: the suffix of a compressed file, the amount of
+ * binlog data compressed into one block, the default number of the most
+ * recent closed binlog files that are kept uncompressed and how often the
+ * binlog directory is checked for files to compress, in seconds.
+ */
+#define BLR_COMPRESSED_SUFFIX    ".z"
+#define BLR_COMPRESS_BLOCK_SIZE  (64 * 1024)
+#define DEF_COMPRESS_KEEP        "2"
+#define BLR_COMPRESS_FREQ        60
+
 /**
  * master reconnect backoff constants
  * BLR_MASTER_BACKOFF_TIME      The increments of the back off time (seconds)
@@ -334,23 +389,98 @@ typedef struct
 } BLCACHE_RECORD;
 
 /**
- * The binlog cache. A cache exists for each file that hold cached bin log records.
- * Caches will be used for all files being read by more than 1 slave.
+ * The binlog cache. A ring of the most recent events written to the current
+ * binlog file, from which the slaves that are close to the master are served
+ * without reading the file. The slaves get clones of the cached buffers, so
+ * an event stays valid for a slave even if it is dropped from the ring.
  */
 typedef struct
 {
-    BLCACHE_RECORD  **records;      /*< The actual binlog records */
-    int             current;        /*< The next record that will be inserted */
+    char            binlogname[BINLOG_FNAMELEN + 1]; /*< The binlog file of the records */
+    BLCACHE_RECORD  *records;       /*< The actual binlog records */
+    int             size;           /*< The number of records the cache can hold */
+    int             first;          /*< The oldest record in the cache */
     int             cnt;            /*< The number of records in the cache */
     SPINLOCK        lock;           /*< The spinlock for the cache */
 } BLCACHE;
 
+/**
+ * A module that receives the events written into the binlog files
+ */
+typedef struct blr_feed_subscriber
+{
+    binlog_feed_cb  cb;             /*< Called for each written event */
+    void            *data;          /*< Data passed to cb */
+    struct blr_feed_subscriber *next;
+} BLR_FEED_SUBSCRIBER;
+
+/**
+ * An entry of the GTID index: the location of a MariaDB 10 GTID event
+ */
+typedef struct
+{
+    uint32_t        domain;         /*< The GTID domain id */
+    uint32_t        server_id;      /*< The GTID server id */
+    uint64_t        seq;            /*< The GTID sequence number */
+    uint32_t        file_no;        /*< The number of the binlog file of the event */
+    uint64_t        pos;            /*< The position of the event in the file */
+} BLR_GTID_ENTRY;
+
+/**
+ * The indexing state of a GTID domain
+ */
+typedef struct
+{
+    uint32_t        domain;         /*< The GTID domain id */
+    uint32_t        file_no;        /*< The binlog file of the latest entry */
+    unsigned int    skipped;        /*< Transactions since the latest entry */
+} BLR_GTID_DOMAIN;
+
+/**
+ * The GTID index. A sparse, append-only index of the locations of the
+ * MariaDB 10 GTID events: the first transaction of each domain in each
+ * binlog file and every Nth one after it. A GTID is located by looking up
+ * the closest preceding entry and scanning the binlog forward from there.
+ *
+ * The entries are kept in memory in binlog order, and so, for a domain, in
+ * sequence number order, and appended to the index file as they are added.
+ */
+typedef struct
+{
+    int             fd;             /*< The index file */
+    unsigned int    interval;       /*< Transactions between two entries of a domain */
+    BLR_GTID_ENTRY  *entries;       /*< The entries, in binlog order */
+    int             n_entries;      /*< The number of entries */
+    int             max_entries;    /*< The number of allocated entries */
+    BLR_GTID_DOMAIN *domains;       /*< The indexed domains */
+    int             n_domains;      /*< The number of indexed domains */
+    SPINLOCK        lock;           /*< Protects the entries */
+} BLR_GTID_INDEX;
+
+/**
+ * An open compressed binlog file. The binlog data is compressed with zlib
+ * in blocks of block_size bytes, so that any position can be read by
+ * decompressing only the block it is in. The most recently read block is
+ * kept decompressed.
+ */
+typedef struct
+{
+    uint64_t        size;           /*< The size of the uncompressed binlog file */
+    uint32_t        block_size;     /*< The uncompressed size of a block */
+    uint32_t        n_blocks;       /*< The number of blocks */
+    uint64_t        *offsets;       /*< Offsets of the blocks, n_blocks + 1 of them */
+    int64_t         cached_block;   /*< The decompressed block, or -1 */
+    uint8_t         *cache;         /*< The data of the decompressed block */
+    uint32_t        cached_len;     /*< The length of the decompressed block */
+} BLR_ZFILE;
+
 typedef struct blfile
 {
     char            binlogname[BINLOG_FNAMELEN + 1]; /*< Name of the binlog file */
     int             fd;                             /*< Actual file descriptor */
     int             refcnt;                         /*< Reference count for file */
     BLCACHE         *cache;                         /*< Record cache for this file */
+    BLR_ZFILE       *zfile;                         /*< The compressed file, or NULL */
     SPINLOCK        lock;                           /*< The file lock */
     struct blfile   *next;                          /*< Next file in list */
 } BLFILE;
@@ -374,6 +504,7 @@ typedef struct
     int             n_failed_read;
     int             n_overrun;
     int             n_caughtup;
+    uint64_t        n_filtered;     /*< Number of events replaced by the slave filter */
     int             n_actions[3];
     uint64_t        lastsample;
     int             minno;
@@ -388,10 +519,33 @@ typedef enum blr_thread_role
     BLR_THREAD_ROLE_SLAVE
 } blr_thread_role_t;
 
+/**
+ * When the binlog file is synced to disk
+ */
+typedef enum
+{
+    BLR_SYNC_READ,  /*< After the events of each read from the master are written */
+    BLR_SYNC_GROUP, /*< By a thread, after an interval or an amount of data */
+    BLR_SYNC_NONE   /*< Left to the operating system */
+} blr_sync_mode_t;
+
 #define ROLETOSTR(r) r == BLR_THREAD_ROLE_MASTER_LARGE_NOTRX ? "master (large event, no trx)" : \
 r == BLR_THREAD_ROLE_MASTER_NOTRX ? "master (no trx)" : \
 r == BLR_THREAD_ROLE_MASTER_TRX ? "master (trx)" : "slave"
 
+/**
+ * The databases and tables replicated to a slave, from the slave_filter
+ * parameter. A table of NULL stands for all the tables of the database.
+ */
+typedef struct blr_slave_filter
+{
+    int             server_id;      /*< Server id of the slave */
+    char            **dbs;          /*< The databases */
+    char            **tables;       /*< The table of each database, or NULL */
+    int             n_names;        /*< The number of databases and tables */
+    struct blr_slave_filter *next;  /*< The filter of the next slave */
+} BLR_SLAVE_FILTER;
+
 /**
  * The client session structure used within this router. This represents
  * the slaves that are replicating binlogs from MaxScale.
@@ -423,6 +577,11 @@ typedef struct router_slave
     SPINLOCK        catch_lock;     /*< Event catchup lock */
     unsigned int    cstate;         /*< Catch up state */
     bool            mariadb10_compat;/*< MariaDB 10.0 compatibility */
+    bool            gtid_requested; /*< Registering with a MariaDB 10 GTID */
+    uint32_t        gtid_domain;    /*< Domain of the requested GTID */
+    uint32_t        gtid_server_id; /*< Server id of the requested GTID */
+    uint64_t        gtid_seq;       /*< Sequence number of the requested GTID */
+    int             lagging_thread; /*< The thread counting the slave as lagging, or -1 */
     SPINLOCK        rses_lock;      /*< Protects rses_deleted */
     pthread_t       pthread;
     struct router_instance
@@ -441,6 +600,9 @@ typedef struct router_slave
     uint32_t          lsi_binlog_pos; /*< What position */
     void              *encryption_ctx;      /*< Encryption context */
     bool              annotate_rows;  /*< MariaDB 10 Slave requests ANNOTATE_ROWS */
+    BLR_SLAVE_FILTER  *filter;        /*< The replicated databases and tables, or NULL */
+    uint64_t          *filtered_tables; /*< Table ids of the statement that are filtered */
+    int               n_filtered_tables; /*< Number of filtered table ids */
 #if defined(SS_DEBUG)
     skygw_chk_t     rses_chk_tail;
 #endif
@@ -468,6 +630,10 @@ typedef struct
     time_t          lastReply;
     uint64_t        n_fakeevents;   /*< Fake events not written to disk */
     uint64_t        n_artificial;   /*< Artificial events not written to disk */
+    uint64_t        n_syncs;        /*< Number of binlog file syncs by the sync thread */
+    uint64_t        n_compressed;   /*< Number of binlog files compressed */
+    uint64_t        n_semisync_reqs; /*< Number of semi-sync ACK requests from master */
+    uint64_t        n_semisync_acks; /*< Number of semi-sync ACKs sent to master */
     int             n_badcrc;       /*< No. of bad CRC's from master */
     uint64_t        events[MAX_EVENT_TYPE_END + 1]; /*< Per event counters */
     uint64_t        lastsample;
@@ -554,6 +720,9 @@ typedef struct router_instance
     int                     binlog_fd;      /*< File descriptor of the binlog
                                              *  file being written
                                              */
+    const uint8_t     *binlog_map;  /*< The binlog file mapped for checking, or NULL */
+    size_t            binlog_map_len; /*< The length of binlog_map */
+    bool              verify_checksums; /*< Whether the event checksums are checked */
     uint64_t          last_written; /*< Position of the last write operation */
     uint64_t          last_event_pos;       /*< Position of last event written */
     uint64_t          current_safe_event;
@@ -567,7 +736,43 @@ typedef struct router_instance
     unsigned int      short_burst;  /*< Short burst for slave catchup */
     unsigned int      long_burst;   /*< Long burst for slave catchup */
     unsigned long     burst_size;   /*< Maximum size of burst to send */
+    unsigned long     catchup_budget; /*< Bytes per round for the lagging slaves of a thread */
+    int               n_threads;    /*< The number of entries in lagging_slaves */
+    int               *lagging_slaves; /*< The number of lagging slaves of each thread */
     unsigned long     heartbeat;    /*< Configured heartbeat value */
+    unsigned int      event_cache_size; /*< Number of events in the binlog cache */
+    BLCACHE           *event_cache; /*< Recent events of the current binlog file */
+    unsigned long     checkpoint_interval; /*< Seconds between binlog file checkpoints */
+    unsigned int      gtid_index_interval; /*< Transactions between GTID index entries */
+    BLR_GTID_INDEX    *gtid_index;  /*< Index of the MariaDB 10 GTIDs, or NULL */
+    BLR_FEED_SUBSCRIBER *feed_subscribers; /*< Receivers of the written events */
+    SPINLOCK          feed_lock;    /*< Protects feed_subscribers */
+    blr_sync_mode_t   binlog_sync;  /*< When the binlog file is synced */
+    unsigned long     sync_interval; /*< Group sync interval in milliseconds */
+    unsigned long     sync_size;    /*< Written bytes that trigger a group sync */
+    unsigned long     synced_pos;   /*< Synced end of the current binlog file */
+    unsigned long     unsynced_bytes; /*< Bytes written since the last sync */
+    uint64_t          semisync_ack_pos; /*< Position waiting for a semi-sync ACK, or 0 */
+    unsigned long     semisync_ack_interval; /*< Minimum milliseconds between semi-sync ACKs */
+    uint64_t          semisync_req_us; /*< When the oldest unacknowledged request arrived */
+    uint64_t          semisync_durable_us; /*< When that request was synced, or 0 */
+    uint64_t          semisync_ack_us; /*< When the last semi-sync ACK was sent */
+    HISTOGRAM         semisync_durable_latency; /*< Request to sync, in microseconds */
+    HISTOGRAM         semisync_ack_latency; /*< Sync to ACK, in microseconds */
+    HISTOGRAM         semisync_total_latency; /*< Request to ACK, in microseconds */
+    int               sync_fd;      /*< Duplicate of binlog_fd for the sync thread */
+    pthread_mutex_t   sync_lock;    /*< Serializes the syncs of the binlog file */
+    pthread_cond_t    sync_cond;    /*< Signalled when a sync is needed */
+    THREAD            sync_thread;  /*< The group sync thread */
+    bool              sync_running; /*< Whether the sync thread is running */
+    bool              sync_stop;    /*< Tells the sync thread to stop */
+    bool              compress_binlogs; /*< Whether old binlog files are compressed */
+    unsigned int      compress_keep; /*< Closed binlog files kept uncompressed */
+    pthread_mutex_t   compress_lock; /*< Protects compress_stop */
+    pthread_cond_t    compress_cond; /*< Signalled when the compression is to stop */
+    THREAD            compress_thread; /*< The compression thread */
+    bool              compress_running; /*< Whether the compression thread is running */
+    bool              compress_stop; /*< Tells the compression thread to stop */
     ROUTER_STATS      stats;        /*< Statistics for this router */
     int               active_logs;
     int               reconnect_pending;
@@ -594,6 +799,7 @@ typedef struct router_instance
     BINLOG_ENCRYPTION_SETUP encryption;     /*< Binlog encryption setup */
     void              *encryption_ctx;      /*< Encryption context */
     char              *set_slave_hostname;  /*< Send custom Hostname to Master */
+    BLR_SLAVE_FILTER  *slave_filters;       /*< The filters of the slaves */
     struct router_instance  *next;
 } ROUTER_INSTANCE;
 
@@ -628,6 +834,25 @@ typedef struct binlog_encryption_ctx
     char     *binlog_file;           /**< Current binlog file being encrypted */
 } BINLOG_ENCRYPTION_CTX;
 
+/**
+ * A checkpoint of the current binlog file: the file has been verified up
+ * to a transaction boundary and the state needed for verifying the rest
+ * of the file. The CRC32 of the bytes before the position tells whether
+ * the file still is what it was when the checkpoint was made.
+ */
+typedef struct
+{
+    char     binlog[BINLOG_FNAMELEN + 1]; /**< The binlog file */
+    uint64_t pos;                    /**< The verified position, a transaction boundary */
+    bool     checksum;               /**< Whether the events have a CRC32 checksum */
+    uint32_t crc;                    /**< CRC32 of the crc_len bytes before pos */
+    uint32_t crc_len;                /**< The number of bytes in the CRC32 */
+    bool     encrypted;              /**< Whether the events after pos are encrypted */
+    uint8_t  binlog_crypto_scheme;   /**< Encryption scheme */
+    uint32_t binlog_key_version;     /**< Encryption key version */
+    uint8_t  nonce[AES_BLOCK_SIZE];  /**< nonce of the binlog file */
+} BLR_CHECKPOINT;
+
 /**
  * Defines and offsets for binlog encryption
  *
@@ -753,17 +978,45 @@ extern int blr_master_connected(ROUTER_INSTANCE *);
 extern int blr_slave_request(ROUTER_INSTANCE *, ROUTER_SLAVE *, GWBUF *);
 extern void blr_slave_rotate(ROUTER_INSTANCE *, ROUTER_SLAVE *, uint8_t *);
 extern int blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large);
+extern void blr_slave_set_lagging(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool lagging);
 extern void blr_init_cache(ROUTER_INSTANCE *);
-
+extern void blr_cache_add_event(ROUTER_INSTANCE *, const REP_HEADER *, unsigned long, uint8_t *);
+extern GWBUF *blr_cache_get_event(ROUTER_INSTANCE *, const char *, unsigned long, REP_HEADER *);
+
+extern void blr_feed_publish(ROUTER_INSTANCE *, unsigned long, uint8_t *, uint32_t);
+
+extern void blr_gtid_index_init(ROUTER_INSTANCE *);
+extern void blr_gtid_index_add(ROUTER_INSTANCE *, const REP_HEADER *, unsigned long, uint8_t *);
+extern bool blr_gtid_index_find(ROUTER_INSTANCE *, uint32_t, uint64_t, BLR_GTID_ENTRY *);
+extern bool blr_filter_parse(const char *, BLR_SLAVE_FILTER **);
+extern void blr_filter_free(BLR_SLAVE_FILTER *);
+extern BLR_SLAVE_FILTER *blr_filter_find(ROUTER_INSTANCE *, int);
+extern void blr_filter_print(DCB *, const BLR_SLAVE_FILTER *);
+extern void blr_filter_reset(ROUTER_SLAVE *);
+extern bool blr_filter_skip(ROUTER_INSTANCE *, ROUTER_SLAVE *, const uint8_t *);
+extern void blr_filter_replace(ROUTER_INSTANCE *, uint8_t *);
 extern int  blr_file_init(ROUTER_INSTANCE *);
 extern int  blr_write_binlog_record(ROUTER_INSTANCE *, REP_HEADER *, uint32_t pos, uint8_t *);
 extern int  blr_file_rotate(ROUTER_INSTANCE *, char *, uint64_t);
 extern void blr_file_flush(ROUTER_INSTANCE *);
+extern void blr_notify_all_slaves(ROUTER_INSTANCE *);
+extern int blr_send_semisync_ack(ROUTER_INSTANCE *, uint64_t);
+extern bool blr_file_start_sync(ROUTER_INSTANCE *);
+extern void blr_file_stop_sync(ROUTER_INSTANCE *);
+extern void blr_file_sync_switch(ROUTER_INSTANCE *, int);
+extern void blr_file_semisync_request(ROUTER_INSTANCE *, uint64_t);
+extern unsigned long blr_file_safe_position(ROUTER_INSTANCE *);
 extern BLFILE *blr_open_binlog(ROUTER_INSTANCE *, char *);
 extern GWBUF *blr_read_binlog(ROUTER_INSTANCE *, BLFILE *, unsigned long, REP_HEADER *, char *,
                               const SLAVE_ENCRYPTION_CTX *);
 extern void blr_close_binlog(ROUTER_INSTANCE *, BLFILE *);
 extern unsigned long blr_file_size(BLFILE *);
+extern ssize_t blr_file_pread(BLFILE *, void *, size_t, uint64_t);
+extern BLR_ZFILE *blr_zfile_open(int);
+extern void blr_zfile_free(BLR_ZFILE *);
+extern bool blr_zfile_decompress(int, int);
+extern bool blr_compress_start(ROUTER_INSTANCE *);
+extern void blr_compress_stop(ROUTER_INSTANCE *);
 extern int blr_statistics(ROUTER_INSTANCE *, ROUTER_SLAVE *, GWBUF *);
 extern int blr_ping(ROUTER_INSTANCE *, ROUTER_SLAVE *, GWBUF *);
 extern int blr_send_custom_error(DCB *, int, int, char *, char *, unsigned int);
@@ -771,6 +1024,8 @@ extern int blr_file_next_exists(ROUTER_INSTANCE *, ROUTER_SLAVE *);
 uint32_t extract_field(uint8_t *src, int bits);
 void blr_cache_read_master_data(ROUTER_INSTANCE *router);
 int blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug);
+extern int blr_file_verify(ROUTER_INSTANCE *router);
+extern void blr_file_write_checkpoint(ROUTER_INSTANCE *router);
 int blr_save_dbusers(const ROUTER_INSTANCE *router);
 char    *blr_get_event_description(ROUTER_INSTANCE *router, uint8_t event);
 void blr_file_append(ROUTER_INSTANCE *router, char *file);
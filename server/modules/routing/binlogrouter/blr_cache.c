@@ -46,16 +46,204 @@
 #include <maxscale/spinlock.h>
 
 #include <maxscale/log_manager.h>
+#include <maxscale/alloc.h>
+#include <maxscale/buffer.h>
 
 
 /**
- * Initialise the cache for this instanceof the binlog router. As a side
- * effect also determine the binlog file to read and the position to read
- * from.
+ * Initialise the cache for this instanceof the binlog router.
+ *
+ * The cache holds the most recent events written to the current binlog file,
+ * so that the slaves that are close to the master can be served without
+ * reading the events back from the file. If the cache size is 0 or the
+ * binlog is encrypted, there is no cache.
  *
  * @param   router      The router instance
  */
 void
 blr_init_cache(ROUTER_INSTANCE *router)
 {
+    router->event_cache = NULL;
+
+    if (router->event_cache_size == 0 || router->encryption.enabled)
+    {
+        return;
+    }
+
+    BLCACHE *cache = MXS_CALLOC(1, sizeof(BLCACHE));
+    BLCACHE_RECORD *records = MXS_CALLOC(router->event_cache_size, sizeof(BLCACHE_RECORD));
+
+    if (cache && records)
+    {
+        strcpy(cache->binlogname, "");
+        cache->records = records;
+        cache->size = router->event_cache_size;
+        cache->first = 0;
+        cache->cnt = 0;
+        spinlock_init(&cache->lock);
+
+        router->event_cache = cache;
+    }
+    else
+    {
+        MXS_ERROR("%s: Failed to allocate the binlog cache of %u events, "
+                  "all events will be read from the binlog files.",
+                  router->service->name, router->event_cache_size);
+        MXS_FREE(records);
+        MXS_FREE(cache);
+    }
+}
+
+/**
+ * Drop all records from the cache. The cache must be locked by the caller.
+ *
+ * @param cache The binlog cache
+ */
+static void
+blr_cache_clear(BLCACHE *cache)
+{
+    for (int i = 0; i < cache->cnt; i++)
+    {
+        BLCACHE_RECORD *record = &cache->records[(cache->first + i) % cache->size];
+
+        gwbuf_free(record->pkt);
+        record->pkt = NULL;
+    }
+
+    cache->first = 0;
+    cache->cnt = 0;
+}
+
+/**
+ * Add an event that has been written to the current binlog file to the cache.
+ * If the cache is full, the oldest event is dropped.
+ *
+ * The events must be added in the order they are written. If the binlog file
+ * has changed or the position does not follow the previous event, e.g. when the
+ * file has been truncated, the events currently in the cache are dropped.
+ *
+ * @param router    The router instance
+ * @param hdr       The header of the event
+ * @param pos       The position of the event in the current binlog file
+ * @param buf       The event, hdr->event_size bytes
+ */
+void
+blr_cache_add_event(ROUTER_INSTANCE *router, const REP_HEADER *hdr, unsigned long pos, uint8_t *buf)
+{
+    BLCACHE *cache = router->event_cache;
+
+    if (cache == NULL)
+    {
+        return;
+    }
+
+    /* The copy is made outside the lock, a big event is not worth caching */
+    GWBUF *pkt = NULL;
+
+    if (hdr->event_size <= BLR_CACHE_MAX_EVENT_SIZE)
+    {
+        pkt = gwbuf_alloc_and_load(hdr->event_size, buf);
+    }
+
+    spinlock_acquire(&cache->lock);
+
+    if (strcmp(cache->binlogname, router->binlog_name) != 0)
+    {
+        blr_cache_clear(cache);
+        strcpy(cache->binlogname, router->binlog_name);
+    }
+    else if (cache->cnt > 0 &&
+             cache->records[(cache->first + cache->cnt - 1) % cache->size].position >= pos)
+    {
+        blr_cache_clear(cache);
+    }
+
+    if (pkt)
+    {
+        if (cache->cnt == cache->size)
+        {
+            gwbuf_free(cache->records[cache->first].pkt);
+            cache->records[cache->first].pkt = NULL;
+            cache->first = (cache->first + 1) % cache->size;
+            cache->cnt--;
+        }
+
+        BLCACHE_RECORD *record = &cache->records[(cache->first + cache->cnt) % cache->size];
+
+        record->position = pos;
+        record->pkt = pkt;
+        record->hdr = *hdr;
+        cache->cnt++;
+    }
+
+    spinlock_release(&cache->lock);
+}
+
+/**
+ * Look up an event from the cache.
+ *
+ * The caller must have checked that the position is safe to be sent to
+ * the slave, i.e. that the event belongs to a complete transaction.
+ *
+ * @param router    The router instance
+ * @param binlog    The binlog file of the event
+ * @param pos       The position of the event
+ * @param hdr       The header to populate, if the event is found
+ * @return          A clone of the cached event or NULL if it is not in the cache
+ */
+GWBUF *
+blr_cache_get_event(ROUTER_INSTANCE *router, const char *binlog, unsigned long pos, REP_HEADER *hdr)
+{
+    BLCACHE *cache = router->event_cache;
+    GWBUF *rval = NULL;
+
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+
+    spinlock_acquire(&cache->lock);
+
+    if (cache->cnt > 0 && strcmp(cache->binlogname, binlog) == 0)
+    {
+        /* The positions of the records are ascending */
+        int low = 0;
+        int high = cache->cnt - 1;
+
+        while (low <= high)
+        {
+            int mid = low + (high - low) / 2;
+            BLCACHE_RECORD *record = &cache->records[(cache->first + mid) % cache->size];
+
+            if (record->position < pos)
+            {
+                low = mid + 1;
+            }
+            else if (record->position > pos)
+            {
+                high = mid - 1;
+            }
+            else
+            {
+                if ((rval = gwbuf_clone(record->pkt)) != NULL)
+                {
+                    *hdr = record->hdr;
+                }
+                break;
+            }
+        }
+    }
+
+    spinlock_release(&cache->lock);
+
+    if (rval)
+    {
+        atomic_add_uint64(&router->stats.n_cachehits, 1);
+    }
+    else
+    {
+        atomic_add_uint64(&router->stats.n_cachemisses, 1);
+    }
+
+    return rval;
 }
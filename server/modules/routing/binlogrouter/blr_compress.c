@@ -0,0 +1,584 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file blr_compress.c - binlog router compressed binlog files
+ *
+ * The closed binlog files, except for the compress_keep most recent ones,
+ * can be compressed by a background thread. A file <binlog> is replaced
+ * with <binlog>.z, which the slaves read transparently.
+ *
+ * The binlog data is compressed with zlib in blocks of block_size bytes,
+ * so that an event at any position can be read by decompressing only the
+ * blocks it is in. The layout of a compressed file is:
+ *
+ * @verbatim
+ * header    magic "MXSBLZ01" 8 bytes, block size 4 bytes, reserved 4 bytes
+ * blocks    the compressed blocks, one after the other
+ * index     the file offset of each block, 8 bytes each
+ * trailer   index offset 8 bytes, uncompressed size 8 bytes,
+ *           number of blocks 4 bytes, magic "MXSZ" 4 bytes
+ * @endverbatim
+ *
+ * All the values are little endian. A file is compressed into
+ * <binlog>.z.tmp, which is synced and renamed before the original
+ * file is removed, so that a crash never leaves the binlog file
+ * without a complete copy.
+ */
+
+#include "blr.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/spinlock.h>
+
+#define BLR_ZFILE_MAGIC       "MXSBLZ01"
+#define BLR_ZFILE_MAGIC_LEN   8
+#define BLR_ZFILE_HDR_LEN     16
+#define BLR_ZFILE_TRAILER     "MXSZ"
+#define BLR_ZFILE_TRAILER_LEN 24
+#define BLR_ZFILE_TMP_SUFFIX  ".tmp"
+
+static uint8_t *blr_zfile_read_block(BLR_ZFILE *zfile, int fd, uint32_t block, uint32_t *len);
+static bool blr_compress_file(ROUTER_INSTANCE *router, const char *binlog);
+static void blr_compress_old_files(ROUTER_INSTANCE *router);
+
+/**
+ * Open a compressed binlog file: check the header and the trailer and
+ * read the block index.
+ *
+ * @param fd  The file descriptor, open for reading
+ * @return    The compressed file or NULL if the file is not a valid
+ *            compressed binlog file
+ */
+BLR_ZFILE *
+blr_zfile_open(int fd)
+{
+    struct stat statb;
+    uint8_t hdr[BLR_ZFILE_HDR_LEN];
+    uint8_t trailer[BLR_ZFILE_TRAILER_LEN];
+
+    if (fstat(fd, &statb) == -1 ||
+        statb.st_size < BLR_ZFILE_HDR_LEN + BLR_ZFILE_TRAILER_LEN ||
+        pread(fd, hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+        memcmp(hdr, BLR_ZFILE_MAGIC, BLR_ZFILE_MAGIC_LEN) != 0 ||
+        pread(fd, trailer, sizeof(trailer), statb.st_size - sizeof(trailer)) != sizeof(trailer) ||
+        memcmp(trailer + 20, BLR_ZFILE_TRAILER, 4) != 0)
+    {
+        return NULL;
+    }
+
+    uint64_t index_offset = gw_mysql_get_byte8(trailer);
+    uint32_t n_blocks = gw_mysql_get_byte4(trailer + 16);
+    uint32_t block_size = gw_mysql_get_byte4(hdr + BLR_ZFILE_MAGIC_LEN);
+
+    if (block_size == 0 ||
+        index_offset + (uint64_t)n_blocks * 8 + sizeof(trailer) != (uint64_t)statb.st_size)
+    {
+        return NULL;
+    }
+
+    BLR_ZFILE *zfile = MXS_CALLOC(1, sizeof(BLR_ZFILE));
+    uint8_t *index = MXS_MALLOC((size_t)n_blocks * 8 + 1);
+
+    if (zfile == NULL || index == NULL ||
+        (zfile->offsets = MXS_MALLOC(((size_t)n_blocks + 1) * sizeof(uint64_t))) == NULL)
+    {
+        MXS_FREE(index);
+        blr_zfile_free(zfile);
+        return NULL;
+    }
+
+    bool valid = pread(fd, index, (size_t)n_blocks * 8, index_offset) == (ssize_t)n_blocks * 8;
+    uint64_t prev = BLR_ZFILE_HDR_LEN;
+
+    for (uint32_t i = 0; valid && i < n_blocks; i++)
+    {
+        zfile->offsets[i] = gw_mysql_get_byte8(index + i * 8);
+        valid = zfile->offsets[i] >= prev && zfile->offsets[i] <= index_offset;
+        prev = zfile->offsets[i];
+    }
+
+    MXS_FREE(index);
+
+    if (!valid)
+    {
+        blr_zfile_free(zfile);
+        return NULL;
+    }
+
+    /* The end of the last block */
+    zfile->offsets[n_blocks] = index_offset;
+    zfile->size = gw_mysql_get_byte8(trailer + 8);
+    zfile->block_size = block_size;
+    zfile->n_blocks = n_blocks;
+    zfile->cached_block = -1;
+    zfile->cache = NULL;
+    zfile->cached_len = 0;
+
+    return zfile;
+}
+
+/**
+ * Free a compressed binlog file
+ *
+ * @param zfile  The compressed file, may be NULL
+ */
+void
+blr_zfile_free(BLR_ZFILE *zfile)
+{
+    if (zfile)
+    {
+        MXS_FREE(zfile->offsets);
+        MXS_FREE(zfile->cache);
+        MXS_FREE(zfile);
+    }
+}
+
+/**
+ * Read and decompress a block of a compressed binlog file
+ *
+ * @param zfile  The compressed file
+ * @param fd     Its file descriptor
+ * @param block  The block to read
+ * @param len    On return, the length of the decompressed block
+ * @return       The decompressed block or NULL on error
+ */
+static uint8_t *
+blr_zfile_read_block(BLR_ZFILE *zfile, int fd, uint32_t block, uint32_t *len)
+{
+    size_t clen = zfile->offsets[block + 1] - zfile->offsets[block];
+    uint8_t *cdata = MXS_MALLOC(clen + 1);
+    uint8_t *data = MXS_MALLOC(zfile->block_size);
+    uLongf dlen = zfile->block_size;
+
+    if (cdata == NULL || data == NULL ||
+        pread(fd, cdata, clen, zfile->offsets[block]) != (ssize_t)clen ||
+        uncompress(data, &dlen, cdata, clen) != Z_OK)
+    {
+        MXS_FREE(data);
+        data = NULL;
+    }
+
+    MXS_FREE(cdata);
+    *len = dlen;
+
+    return data;
+}
+
+/**
+ * Read from a binlog file, which may be compressed
+ *
+ * @param file  The binlog file
+ * @param buf   The buffer to read into
+ * @param len   The number of bytes to read
+ * @param pos   The position to read from
+ * @return      The number of bytes read, less than len only at
+ *              the end of the file, or -1 on error
+ */
+ssize_t
+blr_file_pread(BLFILE *file, void *buf, size_t len, uint64_t pos)
+{
+    BLR_ZFILE *zfile = file->zfile;
+
+    if (zfile == NULL)
+    {
+        return pread(file->fd, buf, len, pos);
+    }
+
+    size_t done = 0;
+
+    while (done < len && pos + done < zfile->size)
+    {
+        uint32_t block = (pos + done) / zfile->block_size;
+        uint32_t offset = (pos + done) % zfile->block_size;
+        size_t n = 0;
+
+        spinlock_acquire(&file->lock);
+        if (zfile->cached_block == block)
+        {
+            if (offset < zfile->cached_len)
+            {
+                n = MXS_MIN(zfile->cached_len - offset, len - done);
+                memcpy((uint8_t *)buf + done, zfile->cache + offset, n);
+            }
+            spinlock_release(&file->lock);
+
+            if (n == 0)
+            {
+                /* A short block before the end of the file */
+                errno = EIO;
+                return -1;
+            }
+
+            done += n;
+            continue;
+        }
+        spinlock_release(&file->lock);
+
+        uint32_t data_len;
+        uint8_t *data;
+
+        if (block >= zfile->n_blocks ||
+            (data = blr_zfile_read_block(zfile, file->fd, block, &data_len)) == NULL)
+        {
+            MXS_ERROR("Failed to decompress block %u of binlog file %s.",
+                      block, file->binlogname);
+            errno = EIO;
+            return -1;
+        }
+
+        spinlock_acquire(&file->lock);
+        MXS_FREE(zfile->cache);
+        zfile->cache = data;
+        zfile->cached_len = data_len;
+        zfile->cached_block = block;
+        spinlock_release(&file->lock);
+    }
+
+    return done;
+}
+
+/**
+ * Decompress a compressed binlog file into another file, for the tools
+ * that read the binlog files sequentially.
+ *
+ * @param fd      The compressed file
+ * @param out_fd  The file to write the binlog data to
+ * @return        True on success
+ */
+bool
+blr_zfile_decompress(int fd, int out_fd)
+{
+    BLR_ZFILE *zfile = blr_zfile_open(fd);
+
+    if (zfile == NULL)
+    {
+        return false;
+    }
+
+    bool rval = true;
+
+    for (uint32_t i = 0; rval && i < zfile->n_blocks; i++)
+    {
+        uint32_t len;
+        uint8_t *data = blr_zfile_read_block(zfile, fd, i, &len);
+
+        rval = data && write(out_fd, data, len) == (ssize_t)len;
+        MXS_FREE(data);
+    }
+
+    blr_zfile_free(zfile);
+
+    return rval;
+}
+
+/**
+ * Compress a closed binlog file and remove the original one.
+ *
+ * @param router  The router instance
+ * @param binlog  The name of the binlog file
+ * @return        True if the file was compressed
+ */
+static bool
+blr_compress_file(ROUTER_INSTANCE *router, const char *binlog)
+{
+    char path[PATH_MAX + 1];
+    char zpath[PATH_MAX + 1];
+    char tmp_path[PATH_MAX + 1];
+    char err_msg[MXS_STRERROR_BUFLEN];
+
+    snprintf(path, sizeof(path), "%s/%s", router->binlogdir, binlog);
+    snprintf(zpath, sizeof(zpath), "%s" BLR_COMPRESSED_SUFFIX, path);
+    snprintf(tmp_path, sizeof(tmp_path), "%s" BLR_ZFILE_TMP_SUFFIX, zpath);
+
+    int fd = open(path, O_RDONLY);
+
+    if (fd == -1)
+    {
+        MXS_ERROR("%s: Failed to open binlog file %s for compression, %s.",
+                  router->service->name, path, strerror_r(errno, err_msg, sizeof(err_msg)));
+        return false;
+    }
+
+    int out_fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+    if (out_fd == -1)
+    {
+        MXS_ERROR("%s: Failed to create %s, %s.",
+                  router->service->name, tmp_path, strerror_r(errno, err_msg, sizeof(err_msg)));
+        close(fd);
+        return false;
+    }
+
+    uLong bound = compressBound(BLR_COMPRESS_BLOCK_SIZE);
+    uint8_t *data = MXS_MALLOC(BLR_COMPRESS_BLOCK_SIZE);
+    uint8_t *cdata = MXS_MALLOC(bound);
+    uint8_t *index = NULL;
+    uint32_t n_blocks = 0;
+    uint32_t n_alloc = 0;
+    uint64_t size = 0;
+    uint64_t offset = BLR_ZFILE_HDR_LEN;
+    uint8_t hdr[BLR_ZFILE_HDR_LEN] = BLR_ZFILE_MAGIC;
+    bool ok = data && cdata;
+
+    gw_mysql_set_byte4(hdr + BLR_ZFILE_MAGIC_LEN, BLR_COMPRESS_BLOCK_SIZE);
+    ok = ok && write(out_fd, hdr, sizeof(hdr)) == sizeof(hdr);
+
+    while (ok && !router->compress_stop)
+    {
+        ssize_t n = pread(fd, data, BLR_COMPRESS_BLOCK_SIZE, size);
+
+        if (n <= 0)
+        {
+            ok = n == 0;
+            break;
+        }
+
+        if (n_blocks == n_alloc)
+        {
+            n_alloc = n_alloc ? n_alloc * 2 : 1024;
+            uint8_t *new_index = MXS_REALLOC(index, (size_t)n_alloc * 8);
+
+            if (new_index == NULL)
+            {
+                ok = false;
+                break;
+            }
+            index = new_index;
+        }
+
+        uLongf clen = bound;
+
+        if (compress2(cdata, &clen, data, n, Z_DEFAULT_COMPRESSION) != Z_OK ||
+            write(out_fd, cdata, clen) != (ssize_t)clen)
+        {
+            ok = false;
+            break;
+        }
+
+        gw_mysql_set_byte4(index + n_blocks * 8, offset & 0xffffffff);
+        gw_mysql_set_byte4(index + n_blocks * 8 + 4, offset >> 32);
+        n_blocks++;
+        offset += clen;
+        size += n;
+    }
+
+    if (ok && !router->compress_stop)
+    {
+        uint8_t trailer[BLR_ZFILE_TRAILER_LEN];
+
+        gw_mysql_set_byte4(trailer, offset & 0xffffffff);
+        gw_mysql_set_byte4(trailer + 4, offset >> 32);
+        gw_mysql_set_byte4(trailer + 8, size & 0xffffffff);
+        gw_mysql_set_byte4(trailer + 12, size >> 32);
+        gw_mysql_set_byte4(trailer + 16, n_blocks);
+        memcpy(trailer + 20, BLR_ZFILE_TRAILER, 4);
+
+        ok = (n_blocks == 0 ||
+              write(out_fd, index, (size_t)n_blocks * 8) == (ssize_t)n_blocks * 8) &&
+             write(out_fd, trailer, sizeof(trailer)) == sizeof(trailer) &&
+             fsync(out_fd) == 0;
+
+        if (!ok)
+        {
+            MXS_ERROR("%s: Failed to write %s, %s.",
+                      router->service->name, tmp_path, strerror_r(errno, err_msg, sizeof(err_msg)));
+        }
+    }
+    else if (!router->compress_stop)
+    {
+        MXS_ERROR("%s: Failed to compress binlog file %s.", router->service->name, path);
+    }
+
+    MXS_FREE(data);
+    MXS_FREE(cdata);
+    MXS_FREE(index);
+    close(fd);
+    close(out_fd);
+
+    if (ok && !router->compress_stop)
+    {
+        /* The open BLFILEs keep reading the removed original */
+        if (rename(tmp_path, zpath) == 0)
+        {
+            unlink(path);
+
+            atomic_add_uint64(&router->stats.n_compressed, 1);
+
+            MXS_INFO("%s: Compressed binlog file %s, %lu bytes into %lu bytes.",
+                     router->service->name, path, size, offset + n_blocks * 8 + BLR_ZFILE_TRAILER_LEN);
+            return true;
+        }
+
+        MXS_ERROR("%s: Failed to rename %s to %s, %s.", router->service->name,
+                  tmp_path, zpath, strerror_r(errno, err_msg, sizeof(err_msg)));
+    }
+
+    unlink(tmp_path);
+    return false;
+}
+
+/**
+ * Compress the closed binlog files that are older than the compress_keep
+ * most recent ones.
+ *
+ * @param router  The router instance
+ */
+static void
+blr_compress_old_files(ROUTER_INSTANCE *router)
+{
+    char *sptr;
+    unsigned long current;
+
+    spinlock_acquire(&router->binlog_lock);
+    sptr = strrchr(router->binlog_name, '.');
+    current = sptr ? strtoul(sptr + 1, NULL, 10) : 0;
+    spinlock_release(&router->binlog_lock);
+
+    if (current <= router->compress_keep + 1)
+    {
+        return;
+    }
+
+    DIR *dirp = opendir(router->binlogdir);
+
+    if (dirp == NULL)
+    {
+        char err_msg[MXS_STRERROR_BUFLEN];
+        MXS_ERROR("%s: Unable to read the binlog directory %s, %s.",
+                  router->service->name, router->binlogdir,
+                  strerror_r(errno, err_msg, sizeof(err_msg)));
+        return;
+    }
+
+    size_t root_len = strlen(router->fileroot);
+    struct dirent *dp;
+
+    while (!router->compress_stop && (dp = readdir(dirp)) != NULL)
+    {
+        const char *num = dp->d_name + root_len + 1;
+
+        /* Only the plain <fileroot>.NNNNNN files */
+        if (strncmp(dp->d_name, router->fileroot, root_len) == 0 &&
+            dp->d_name[root_len] == '.' &&
+            *num && strspn(num, "0123456789") == strlen(num) &&
+            strtoul(num, NULL, 10) + router->compress_keep < current)
+        {
+            blr_compress_file(router, dp->d_name);
+        }
+    }
+
+    closedir(dirp);
+}
+
+/**
+ * The compression thread: checks the binlog directory for files
+ * to compress every BLR_COMPRESS_FREQ seconds.
+ *
+ * @param   data    The router instance
+ */
+static void
+blr_compress_thread(void *data)
+{
+    ROUTER_INSTANCE *router = (ROUTER_INSTANCE *)data;
+
+    pthread_mutex_lock(&router->compress_lock);
+
+    while (!router->compress_stop)
+    {
+        pthread_mutex_unlock(&router->compress_lock);
+        blr_compress_old_files(router);
+        pthread_mutex_lock(&router->compress_lock);
+
+        if (!router->compress_stop)
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += BLR_COMPRESS_FREQ;
+
+            pthread_cond_timedwait(&router->compress_cond, &router->compress_lock, &ts);
+        }
+    }
+
+    pthread_mutex_unlock(&router->compress_lock);
+}
+
+/**
+ * Start the compression thread, if old binlog files are to be compressed.
+ *
+ * @param   router  The binlog router
+ * @return  True on success, false if the thread could not be started
+ */
+bool
+blr_compress_start(ROUTER_INSTANCE *router)
+{
+    pthread_mutex_init(&router->compress_lock, NULL);
+    pthread_cond_init(&router->compress_cond, NULL);
+    router->compress_running = false;
+    router->compress_stop = false;
+
+    if (!router->compress_binlogs)
+    {
+        return true;
+    }
+
+    if (router->encryption.enabled)
+    {
+        MXS_WARNING("%s: Binlog encryption is enabled, the binlog files are not compressed.",
+                    router->service->name);
+        return true;
+    }
+
+    router->compress_running = true;
+
+    if (thread_start(&router->compress_thread, blr_compress_thread, router) == NULL)
+    {
+        MXS_ERROR("%s: Failed to start the binlog compression thread.", router->service->name);
+        router->compress_running = false;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Stop the compression thread. A file being compressed is left as it is.
+ *
+ * @param   router  The binlog router
+ */
+void
+blr_compress_stop(ROUTER_INSTANCE *router)
+{
+    if (router->compress_running)
+    {
+        pthread_mutex_lock(&router->compress_lock);
+        router->compress_stop = true;
+        pthread_cond_signal(&router->compress_cond);
+        pthread_mutex_unlock(&router->compress_lock);
+
+        thread_wait(router->compress_thread);
+        router->compress_running = false;
+    }
+}
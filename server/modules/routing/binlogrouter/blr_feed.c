@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file blr_feed.c - binlog router event feed
+ *
+ * Other modules of the process can subscribe to the events that a binlog
+ * router instance writes into its binlog files, see binlog_feed.h. The
+ * events are passed to the subscribers right after they have been written,
+ * so a subscriber that misses an event can always read it from the file.
+ * The events that the router generates itself, e.g. the ignorable events
+ * that fill the holes in the binlog, are only in the file.
+ */
+
+#include "blr.h"
+
+#include <maxscale/alloc.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/spinlock.h>
+
+/**
+ * Pass a written event to the subscribers of the router
+ *
+ * @param router    The router instance
+ * @param pos       The position of the event in the current binlog file
+ * @param buf       The event
+ * @param len       The length of the event
+ */
+void
+blr_feed_publish(ROUTER_INSTANCE *router, unsigned long pos, uint8_t *buf, uint32_t len)
+{
+    if (router->feed_subscribers)
+    {
+        spinlock_acquire(&router->feed_lock);
+
+        for (BLR_FEED_SUBSCRIBER *sub = router->feed_subscribers; sub; sub = sub->next)
+        {
+            sub->cb(sub->data, router->binlog_name, pos, buf, len);
+        }
+
+        spinlock_release(&router->feed_lock);
+    }
+}
+
+static void* blr_feed_subscribe(MXS_ROUTER *instance, binlog_feed_cb cb, void *data)
+{
+    ROUTER_INSTANCE *router = (ROUTER_INSTANCE*)instance;
+    BLR_FEED_SUBSCRIBER *sub = MXS_MALLOC(sizeof(BLR_FEED_SUBSCRIBER));
+
+    if (sub)
+    {
+        sub->cb = cb;
+        sub->data = data;
+
+        spinlock_acquire(&router->feed_lock);
+        sub->next = router->feed_subscribers;
+        router->feed_subscribers = sub;
+        spinlock_release(&router->feed_lock);
+
+        MXS_NOTICE("%s: Passing the binlog events to a new subscriber.", router->service->name);
+    }
+
+    return sub;
+}
+
+static void blr_feed_unsubscribe(MXS_ROUTER *instance, void *subscription)
+{
+    ROUTER_INSTANCE *router = (ROUTER_INSTANCE*)instance;
+
+    spinlock_acquire(&router->feed_lock);
+
+    for (BLR_FEED_SUBSCRIBER **sub = &router->feed_subscribers; *sub; sub = &(*sub)->next)
+    {
+        if (*sub == subscription)
+        {
+            *sub = (*sub)->next;
+            break;
+        }
+    }
+
+    spinlock_release(&router->feed_lock);
+    MXS_FREE(subscription);
+}
+
+/**
+ * The entry point of the feed API, looked up by the subscribing modules
+ *
+ * @return The feed API
+ */
+BINLOG_FEED_API* BinlogGetFeedAPI()
+{
+    static BINLOG_FEED_API api =
+    {
+        blr_feed_subscribe,
+        blr_feed_unsubscribe
+    };
+
+    return &api;
+}
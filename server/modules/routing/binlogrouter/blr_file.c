@@ -70,9 +70,13 @@
 #include <maxscale/paths.h>
 #include <maxscale/log_manager.h>
 #include <maxscale/alloc.h>
+#include <maxscale/platform.h>
 #include <inttypes.h>
+#include <time.h>
 #include <maxscale/secrets.h>
 #include <maxscale/encryption.h>
+#include <maxscale/utils.h>
+#include <ini.h>
 
 /**
  * AES_CTR handling
@@ -202,17 +206,24 @@ static GWBUF *blr_prepare_encrypted_event(ROUTER_INSTANCE *router,
                                           uint32_t pos,
                                           const uint8_t *nonce,
                                           int action);
-static GWBUF *blr_aes_crypt(ROUTER_INSTANCE *router,
-                            uint8_t *event,
-                            uint32_t event_size,
-                            uint8_t *iv,
-                            int action);
-static int blr_aes_create_tail_for_cbc(uint8_t *output,
+static int blr_crypt_event(ROUTER_INSTANCE *router,
+                           uint8_t *event,
+                           uint8_t *output,
+                           uint32_t event_size,
+                           uint32_t pos,
+                           const uint8_t *nonce,
+                           int action);
+static int blr_aes_crypt(ROUTER_INSTANCE *router,
+                         uint8_t *event,
+                         uint32_t event_size,
+                         uint8_t *iv,
+                         int action,
+                         uint8_t *output);
+static int blr_aes_create_tail_for_cbc(ROUTER_INSTANCE *router,
+                                       uint8_t *output,
                                        uint8_t *input,
                                        uint32_t in_size,
-                                       uint8_t *iv,
-                                       uint8_t *key,
-                                       unsigned int key_len);
+                                       uint8_t *iv);
 static int blr_binlog_event_check(ROUTER_INSTANCE *router,
                                   unsigned long pos,
                                   REP_HEADER *hdr,
@@ -220,6 +231,14 @@ static int blr_binlog_event_check(ROUTER_INSTANCE *router,
                                   char *errmsg);
 
 static void blr_report_checksum(REP_HEADER hdr, const uint8_t *buffer, char *output);
+static int blr_read_events(ROUTER_INSTANCE *router,
+                           int fix,
+                           int debug,
+                           const BLR_CHECKPOINT *checkpoint);
+static ssize_t blr_read_events_pread(ROUTER_INSTANCE *router, void *buf, size_t len, uint64_t pos);
+static bool blr_file_read_checkpoint(ROUTER_INSTANCE *router, BLR_CHECKPOINT *checkpoint);
+static bool blr_file_checkpoint_crc(const char *path, uint64_t pos, uint32_t *crc, uint32_t *crc_len);
+static int blr_handler_checkpoint(void *userdata, const char *section, const char *name, const char *value);
 
 /** MaxScale generated events */
 typedef enum
@@ -419,6 +438,7 @@ blr_file_create(ROUTER_INSTANCE *router, char *file)
     {
         if (blr_file_add_magic(fd))
         {
+            blr_file_sync_switch(router, fd);
             close(router->binlog_fd);
             spinlock_acquire(&router->binlog_lock);
 
@@ -432,6 +452,8 @@ blr_file_create(ROUTER_INSTANCE *router, char *file)
             router->binlog_position = BINLOG_MAGIC_SIZE;
             router->current_safe_event = BINLOG_MAGIC_SIZE;
             router->last_written = BINLOG_MAGIC_SIZE;
+            router->synced_pos = BINLOG_MAGIC_SIZE;
+            router->unsynced_bytes = 0;
             spinlock_release(&router->binlog_lock);
 
             created = 1;
@@ -481,6 +503,7 @@ blr_file_append(ROUTER_INSTANCE *router, char *file)
         return;
     }
     fsync(fd);
+    blr_file_sync_switch(router, fd);
     close(router->binlog_fd);
     spinlock_acquire(&router->binlog_lock);
     memmove(router->binlog_name, file, BINLOG_FNAMELEN);
@@ -513,6 +536,8 @@ blr_file_append(ROUTER_INSTANCE *router, char *file)
         }
     }
     router->binlog_fd = fd;
+    router->synced_pos = router->current_pos;
+    router->unsynced_bytes = 0;
     spinlock_release(&router->binlog_lock);
 }
 
@@ -553,6 +578,9 @@ blr_write_binlog_record(ROUTER_INSTANCE *router, REP_HEADER *hdr, uint32_t size,
         n = hole_size;
     }
 
+    /* The position of the event, after the possible hole */
+    unsigned long event_pos = router->last_written;
+
     if (router->encryption.enabled && router->encryption_ctx != NULL)
     {
         GWBUF *encrypted;
@@ -605,8 +633,28 @@ blr_write_binlog_record(ROUTER_INSTANCE *router, REP_HEADER *hdr, uint32_t size,
     router->current_pos = hdr->next_pos;
     router->last_written += size;
     router->last_event_pos = hdr->next_pos - hdr->event_size;
+    router->unsynced_bytes += size;
+    bool sync = router->binlog_sync == BLR_SYNC_GROUP && router->unsynced_bytes >= router->sync_size;
     spinlock_release(&router->binlog_lock);
 
+    if (sync)
+    {
+        pthread_cond_signal(&router->sync_cond);
+    }
+
+    /* Keep the event in memory for the slaves that are close to the master */
+    if (size == hdr->event_size)
+    {
+        blr_cache_add_event(router, hdr, event_pos, buf);
+        blr_feed_publish(router, event_pos, buf, size);
+    }
+
+    /* Index the GTIDs for the MariaDB 10 slaves that register with one */
+    if (hdr->event_type == MARIADB10_GTID_EVENT && router->gtid_index)
+    {
+        blr_gtid_index_add(router, hdr, event_pos, buf);
+    }
+
     /* Check whether adding the Start Encryption event into current binlog */
     if (router->encryption.enabled && write_start_encryption_event)
     {
@@ -632,14 +680,369 @@ blr_write_binlog_record(ROUTER_INSTANCE *router, REP_HEADER *hdr, uint32_t size,
 }
 
 /**
- * Flush the content of the binlog file to disk.
+ * Flush the content of the binlog file to disk, if the binlog file
+ * is synced after each read from the master.
  *
  * @param   router  The binlog router
  */
 void
 blr_file_flush(ROUTER_INSTANCE *router)
 {
-    fsync(router->binlog_fd);
+    if (router->binlog_sync == BLR_SYNC_READ)
+    {
+        fsync(router->binlog_fd);
+    }
+}
+
+/**
+ * Return the position up to which the events of the current binlog file
+ * can be sent to the slaves. With group sync, only the events that have
+ * been synced to disk are sent. The caller must hold router->binlog_lock.
+ *
+ * @param   router  The binlog router
+ * @return  The safe position in the current binlog file
+ */
+unsigned long
+blr_file_safe_position(ROUTER_INSTANCE *router)
+{
+    unsigned long pos = router->binlog_position;
+
+    if (router->sync_running && router->synced_pos < pos)
+    {
+        pos = router->synced_pos;
+    }
+
+    return pos;
+}
+
+/**
+ * Check whether the pending semi-sync ACK may be sent, i.e. whether
+ * semisync_ack_interval milliseconds have passed since the last one.
+ * The caller must hold router->binlog_lock.
+ *
+ * @param   router  The binlog router
+ * @param   now     The current time, from mxs_clock_us()
+ * @return  Microseconds until the ACK may be sent, 0 if it may be sent now
+ */
+static uint64_t
+blr_file_semisync_wait(ROUTER_INSTANCE *router, uint64_t now)
+{
+    uint64_t due = router->semisync_ack_us + (uint64_t)router->semisync_ack_interval * 1000;
+
+    return router->semisync_ack_us == 0 || now >= due ? 0 : due - now;
+}
+
+/**
+ * Sync the binlog file with the sync thread's descriptor and make the synced
+ * events available: advance the synced position, send the pending semi-sync
+ * ACK if it is covered and due, and notify the slaves. The caller must hold
+ * router->sync_lock.
+ *
+ * The semi-sync ACKs are coalesced: one ACK, for the latest requested
+ * position, is sent at most every semisync_ack_interval milliseconds.
+ *
+ * @param   router  The binlog router
+ * @param   force   Send a covered semi-sync ACK even if it is not due
+ */
+static void
+blr_file_do_sync(ROUTER_INSTANCE *router, bool force)
+{
+    char binlog_name[BINLOG_FNAMELEN + 1];
+    unsigned long pos;
+    unsigned long bytes;
+    uint64_t ack_pos = 0;
+    uint64_t req_us = 0;
+    uint64_t durable_us = 0;
+
+    if (router->sync_fd == -1)
+    {
+        return;
+    }
+
+    spinlock_acquire(&router->binlog_lock);
+    strcpy(binlog_name, router->binlog_name);
+    pos = router->last_written;
+    bytes = router->unsynced_bytes;
+    bool unsynced = pos != router->synced_pos;
+    bool pending = unsynced || router->semisync_ack_pos != 0;
+    spinlock_release(&router->binlog_lock);
+
+    if (!pending)
+    {
+        return;
+    }
+
+    if (unsynced && fdatasync(router->sync_fd) != 0)
+    {
+        char err_msg[MXS_STRERROR_BUFLEN];
+        MXS_ERROR("%s: Failed to sync binlog file %s, %s.",
+                  router->service->name, binlog_name,
+                  strerror_r(errno, err_msg, sizeof(err_msg)));
+        return;
+    }
+
+    uint64_t now = mxs_clock_us();
+
+    spinlock_acquire(&router->binlog_lock);
+    if (strcmp(binlog_name, router->binlog_name) == 0)
+    {
+        router->synced_pos = pos;
+        router->unsynced_bytes -= MXS_MIN(bytes, router->unsynced_bytes);
+
+        if (router->semisync_ack_pos != 0 && router->semisync_ack_pos <= pos)
+        {
+            if (router->semisync_durable_us == 0)
+            {
+                router->semisync_durable_us = now;
+                histogram_add(&router->semisync_durable_latency, now - router->semisync_req_us);
+            }
+
+            if (force || blr_file_semisync_wait(router, now) == 0)
+            {
+                ack_pos = router->semisync_ack_pos;
+                req_us = router->semisync_req_us;
+                durable_us = router->semisync_durable_us;
+                router->semisync_ack_pos = 0;
+                router->semisync_req_us = 0;
+                router->semisync_durable_us = 0;
+                router->semisync_ack_us = now;
+            }
+        }
+    }
+    spinlock_release(&router->binlog_lock);
+
+    if (unsynced)
+    {
+        atomic_add_uint64(&router->stats.n_syncs, 1);
+    }
+
+    if (ack_pos)
+    {
+        bool sent = false;
+
+        spinlock_acquire(&router->lock);
+        if (router->master && router->master_state == BLRM_BINLOGDUMP)
+        {
+            sent = blr_send_semisync_ack(router, ack_pos);
+        }
+        spinlock_release(&router->lock);
+
+        if (sent)
+        {
+            now = mxs_clock_us();
+            histogram_add(&router->semisync_ack_latency, now - durable_us);
+            histogram_add(&router->semisync_total_latency, now - req_us);
+            atomic_add_uint64(&router->stats.n_semisync_acks, 1);
+        }
+    }
+
+    /* Slaves waiting for data can read the synced events */
+    if (unsynced)
+    {
+        blr_notify_all_slaves(router);
+    }
+}
+
+/**
+ * The group sync thread: syncs the binlog file every sync_interval
+ * milliseconds, or sooner when sync_size bytes have been written
+ * or a semi-sync ACK is requested, and sends the pending semi-sync
+ * ACK when it is due.
+ *
+ * @param   data    The router instance
+ */
+static void
+blr_file_sync_thread(void *data)
+{
+    ROUTER_INSTANCE *router = (ROUTER_INSTANCE *)data;
+
+    pthread_mutex_lock(&router->sync_lock);
+
+    while (!router->sync_stop)
+    {
+        uint64_t wait_us = (uint64_t)router->sync_interval * 1000;
+
+        /**
+         * A requested ACK that is not synced yet needs a sync now, as it may
+         * have been requested during the last one. A synced one waits only
+         * for the ACK to be due.
+         */
+        spinlock_acquire(&router->binlog_lock);
+        if (router->semisync_ack_pos != 0 && router->sync_fd != -1)
+        {
+            wait_us = router->semisync_durable_us == 0 ? 0 :
+                      MXS_MIN(wait_us, blr_file_semisync_wait(router, mxs_clock_us()));
+        }
+        spinlock_release(&router->binlog_lock);
+
+        if (wait_us > 0)
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+
+            uint64_t ns = ts.tv_nsec + wait_us * 1000;
+            ts.tv_sec += ns / 1000000000;
+            ts.tv_nsec = ns % 1000000000;
+
+            pthread_cond_timedwait(&router->sync_cond, &router->sync_lock, &ts);
+        }
+
+        blr_file_do_sync(router, false);
+    }
+
+    blr_file_do_sync(router, true);
+
+    pthread_mutex_unlock(&router->sync_lock);
+}
+
+/**
+ * Hand a semi-sync ACK request of the master over to the sync thread,
+ * which sends the ACK once the event is on disk. A request that arrives
+ * while an earlier one is still pending replaces it, so that both are
+ * acknowledged by one ACK.
+ *
+ * @param   router  The binlog router
+ * @param   pos     The position to acknowledge
+ */
+void
+blr_file_semisync_request(ROUTER_INSTANCE *router, uint64_t pos)
+{
+    uint64_t now = mxs_clock_us();
+    bool first;
+
+    spinlock_acquire(&router->binlog_lock);
+    first = router->semisync_ack_pos == 0;
+    router->semisync_ack_pos = pos;
+
+    if (first)
+    {
+        router->semisync_req_us = now;
+        router->semisync_durable_us = 0;
+    }
+    spinlock_release(&router->binlog_lock);
+
+    atomic_add_uint64(&router->stats.n_semisync_reqs, 1);
+
+    /**
+     * A coalesced request is synced and acknowledged with the pending one.
+     * If the sync lock is busy, the sync thread is not waiting and it checks
+     * for the request before it waits again.
+     */
+    if (first && pthread_mutex_trylock(&router->sync_lock) == 0)
+    {
+        pthread_cond_signal(&router->sync_cond);
+        pthread_mutex_unlock(&router->sync_lock);
+    }
+}
+
+/**
+ * Start the group sync thread, if the binlog file is to be synced that way.
+ * To be called after the current binlog file, if any, has been opened.
+ *
+ * @param   router  The binlog router
+ * @return  True on success, false if the thread could not be started
+ */
+bool
+blr_file_start_sync(ROUTER_INSTANCE *router)
+{
+    pthread_mutex_init(&router->sync_lock, NULL);
+    pthread_cond_init(&router->sync_cond, NULL);
+    router->sync_running = false;
+    router->sync_stop = false;
+    router->sync_fd = -1;
+    router->semisync_ack_pos = 0;
+    router->semisync_req_us = 0;
+    router->semisync_durable_us = 0;
+    router->semisync_ack_us = 0;
+    router->unsynced_bytes = 0;
+    router->synced_pos = router->current_pos;
+
+    if (router->binlog_sync != BLR_SYNC_GROUP)
+    {
+        return true;
+    }
+
+    if (router->binlog_fd != -1 && (router->sync_fd = dup(router->binlog_fd)) == -1)
+    {
+        char err_msg[MXS_STRERROR_BUFLEN];
+        MXS_ERROR("%s: Failed to duplicate the binlog file descriptor, %s.",
+                  router->service->name, strerror_r(errno, err_msg, sizeof(err_msg)));
+        return false;
+    }
+
+    /* Set before the start, as the readers check it without the sync lock */
+    router->sync_running = true;
+
+    if (thread_start(&router->sync_thread, blr_file_sync_thread, router) == NULL)
+    {
+        MXS_ERROR("%s: Failed to start the binlog sync thread.", router->service->name);
+        router->sync_running = false;
+        close(router->sync_fd);
+        router->sync_fd = -1;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Stop the group sync thread, after a final sync.
+ *
+ * @param   router  The binlog router
+ */
+void
+blr_file_stop_sync(ROUTER_INSTANCE *router)
+{
+    if (router->sync_running)
+    {
+        pthread_mutex_lock(&router->sync_lock);
+        router->sync_stop = true;
+        pthread_cond_signal(&router->sync_cond);
+        pthread_mutex_unlock(&router->sync_lock);
+
+        thread_wait(router->sync_thread);
+
+        spinlock_acquire(&router->binlog_lock);
+        router->sync_running = false;
+        spinlock_release(&router->binlog_lock);
+
+        if (router->sync_fd != -1)
+        {
+            close(router->sync_fd);
+            router->sync_fd = -1;
+        }
+    }
+}
+
+/**
+ * Switch the group sync to another binlog file descriptor. The current
+ * binlog file is synced first, so that its remaining events, and the
+ * pending semi-sync ACK, are made available before the file is closed.
+ * To be called by the thread that writes the binlog, before the current
+ * binlog file descriptor is closed.
+ *
+ * @param   router  The binlog router
+ * @param   fd      The new binlog file descriptor, or -1 if there is none
+ */
+void
+blr_file_sync_switch(ROUTER_INSTANCE *router, int fd)
+{
+    if (router->sync_running)
+    {
+        pthread_mutex_lock(&router->sync_lock);
+
+        /* The ACK carries the name of the current file, so it can not wait */
+        blr_file_do_sync(router, true);
+
+        if (router->sync_fd != -1)
+        {
+            close(router->sync_fd);
+        }
+
+        router->sync_fd = fd != -1 ? dup(fd) : -1;
+
+        pthread_mutex_unlock(&router->sync_lock);
+    }
 }
 
 /**
@@ -693,6 +1096,7 @@ blr_open_binlog(ROUTER_INSTANCE *router, char *binlog)
     strcpy(file->binlogname, binlog);
     file->refcnt = 1;
     file->cache = 0;
+    file->zfile = NULL;
     spinlock_init(&file->lock);
 
     strcpy(path, router->binlogdir);
@@ -701,7 +1105,21 @@ blr_open_binlog(ROUTER_INSTANCE *router, char *binlog)
 
     if ((file->fd = open(path, O_RDONLY, 0666)) == -1)
     {
-        MXS_ERROR("Failed to open binlog file %s", path);
+        /* The file may have been compressed */
+        strcat(path, BLR_COMPRESSED_SUFFIX);
+
+        if ((file->fd = open(path, O_RDONLY, 0666)) != -1 &&
+            (file->zfile = blr_zfile_open(file->fd)) == NULL)
+        {
+            MXS_ERROR("%s is not a valid compressed binlog file.", path);
+            close(file->fd);
+            file->fd = -1;
+        }
+    }
+
+    if (file->fd == -1)
+    {
+        MXS_ERROR("Failed to open binlog file %s/%s", router->binlogdir, binlog);
         MXS_FREE(file);
         spinlock_release(&router->fileslock);
         return NULL;
@@ -753,7 +1171,11 @@ blr_read_binlog(ROUTER_INSTANCE *router,
     }
 
     spinlock_acquire(&file->lock);
-    if (fstat(file->fd, &statb) == 0)
+    if (file->zfile)
+    {
+        filelen = file->zfile->size;
+    }
+    else if (fstat(file->fd, &statb) == 0)
     {
         filelen = statb.st_size;
     }
@@ -801,14 +1223,16 @@ blr_read_binlog(ROUTER_INSTANCE *router,
     spinlock_acquire(&router->binlog_lock);
     spinlock_acquire(&file->lock);
 
+    unsigned long safe_pos = blr_file_safe_position(router);
+
     if (strcmp(router->binlog_name, file->binlogname) == 0 &&
-        pos >= router->binlog_position)
+        pos >= safe_pos)
     {
-        if (pos > router->binlog_position)
+        if (pos > safe_pos)
         {
             snprintf(errmsg, BINLOG_ERROR_MSG_LEN, "Requested binlog position %lu is unsafe. "
                      "Latest safe position %lu, end of binlog file %lu",
-                     pos, router->binlog_position, router->current_pos);
+                     pos, safe_pos, router->current_pos);
 
             hdr->ok = SLAVE_POS_READ_UNSAFE;
         }
@@ -827,8 +1251,18 @@ blr_read_binlog(ROUTER_INSTANCE *router,
     spinlock_release(&file->lock);
     spinlock_release(&router->binlog_lock);
 
+    /* Recent events are served from the cache, unless they need to be decrypted */
+    if (enc_ctx == NULL && router->event_cache &&
+        (result = blr_cache_get_event(router, file->binlogname, pos, hdr)) != NULL)
+    {
+        /* set OK indicator */
+        hdr->ok = SLAVE_POS_READ_OK;
+
+        return result;
+    }
+
     /* Read the header information from the file */
-    if ((n = pread(file->fd, hdbuf, BINLOG_EVENT_HDR_LEN, pos)) != BINLOG_EVENT_HDR_LEN)
+    if ((n = blr_file_pread(file, hdbuf, BINLOG_EVENT_HDR_LEN, pos)) != BINLOG_EVENT_HDR_LEN)
     {
         switch (n)
         {
@@ -892,7 +1326,7 @@ blr_read_binlog(ROUTER_INSTANCE *router,
                       pos, file->binlogname, filelen, router->binlog_position,
                       router->binlog_name);
 
-            if ((n = pread(file->fd, hdbuf, BINLOG_EVENT_HDR_LEN, pos)) != BINLOG_EVENT_HDR_LEN)
+            if ((n = blr_file_pread(file, hdbuf, BINLOG_EVENT_HDR_LEN, pos)) != BINLOG_EVENT_HDR_LEN)
             {
                 switch (n)
                 {
@@ -972,8 +1406,8 @@ blr_read_binlog(ROUTER_INSTANCE *router,
 
     memcpy(data, hdbuf, BINLOG_EVENT_HDR_LEN);  // Copy the header in the buffer
 
-    if ((n = pread(file->fd, &data[BINLOG_EVENT_HDR_LEN], hdr->event_size - BINLOG_EVENT_HDR_LEN,
-                   pos + BINLOG_EVENT_HDR_LEN))
+    if ((n = blr_file_pread(file, &data[BINLOG_EVENT_HDR_LEN], hdr->event_size - BINLOG_EVENT_HDR_LEN,
+                            pos + BINLOG_EVENT_HDR_LEN))
         != hdr->event_size - BINLOG_EVENT_HDR_LEN)  // Read the balance
     {
         if (n ==  0)
@@ -1024,15 +1458,16 @@ blr_read_binlog(ROUTER_INSTANCE *router,
      */
     if (enc_ctx && pos >= enc_ctx->first_enc_event_pos)
     {
-        GWBUF *decrypted_event;
-        uint8_t *decrypt_ptr;
-        /* prepare and decrypt the event */
-        if ((decrypted_event = blr_prepare_encrypted_event(router,
-                                                           data,
-                                                           hdr->event_size,
-                                                           pos,
-                                                           enc_ctx->nonce,
-                                                           BINLOG_FLAG_DECRYPT)) == NULL)
+        uint8_t *decrypt_ptr = data;
+
+        /* decrypt the event in place */
+        if (!blr_crypt_event(router,
+                             data,
+                             decrypt_ptr,
+                             hdr->event_size,
+                             pos,
+                             enc_ctx->nonce,
+                             BINLOG_FLAG_DECRYPT))
         {
             snprintf(errmsg, BINLOG_ERROR_MSG_LEN, "Binlog event decryption error: "
                      "file size is %lu, event at %lu in binlog file '%s'",
@@ -1041,8 +1476,6 @@ blr_read_binlog(ROUTER_INSTANCE *router,
             return NULL;
         }
 
-        decrypt_ptr = GWBUF_DATA(decrypted_event);
-
         /* Fill replication header struct */
         hdr->timestamp = EXTRACT32(decrypt_ptr);
         hdr->event_type = decrypt_ptr[4];
@@ -1051,20 +1484,14 @@ blr_read_binlog(ROUTER_INSTANCE *router,
         hdr->next_pos = EXTRACT32(&decrypt_ptr[13]);
         hdr->flags = EXTRACT16(&decrypt_ptr[17]);
 
-        /* Free data read from disk */
-        gwbuf_free(result);
-
         /**
          * Binlog event check based on Replication Header content and pos
          */
         if (!blr_binlog_event_check(router, pos, hdr, file->binlogname, errmsg))
         {
-            gwbuf_free(decrypted_event);
+            gwbuf_free(result);
             return NULL;
         }
-
-        /* Set the decrypted event as result*/
-        result = decrypted_event;
     }
 
     /* set OK indicator */
@@ -1116,6 +1543,7 @@ blr_close_binlog(ROUTER_INSTANCE *router, BLFILE *file)
     {
         close(file->fd);
         file->fd = -1;
+        blr_zfile_free(file->zfile);
         MXS_FREE(file);
     }
 }
@@ -1153,6 +1581,10 @@ blr_file_size(BLFILE *file)
 {
     struct stat statb;
 
+    if (file->zfile)
+    {
+        return file->zfile->size;
+    }
     if (fstat(file->fd, &statb) == 0)
     {
         return statb.st_size;
@@ -1293,7 +1725,11 @@ blr_file_next_exists(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave)
     sprintf(bigbuf, "%s/%s", router->binlogdir, buf);
     if (access(bigbuf, R_OK) == -1)
     {
-        return 0;
+        strcat(bigbuf, BLR_COMPRESSED_SUFFIX);
+        if (access(bigbuf, R_OK) == -1)
+        {
+            return 0;
+        }
     }
     return 1;
 }
@@ -1310,6 +1746,52 @@ blr_file_next_exists(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave)
  */
 int
 blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug)
+{
+    return blr_read_events(router, fix, debug, NULL);
+}
+
+/**
+ * Read from the binlog file being checked, from its mapping if it is mapped
+ *
+ * @param router  The router instance
+ * @param buf     The buffer to read into
+ * @param len     The number of bytes to read
+ * @param pos     The position to read from
+ * @return        The number of bytes read or -1 on error
+ */
+static ssize_t
+blr_read_events_pread(ROUTER_INSTANCE *router, void *buf, size_t len, uint64_t pos)
+{
+    if (router->binlog_map == NULL)
+    {
+        return pread(router->binlog_fd, buf, len, pos);
+    }
+
+    if (pos >= router->binlog_map_len)
+    {
+        return 0;
+    }
+
+    len = MXS_MIN(len, router->binlog_map_len - pos);
+    memcpy(buf, router->binlog_map + pos, len);
+
+    return len;
+}
+
+/**
+ * Read the replication events from a binlog file, from the beginning or
+ * from a checkpoint.
+ *
+ * Routine detects errors and pending transactions
+ *
+ * @param router      The router instance
+ * @param fix         Whether to fix or not errors
+ * @param debug       Whether to enable or not the debug for events
+ * @param checkpoint  The checkpoint to start from or NULL for the beginning
+ * @return            0 on success, >0 on failure
+ */
+static int
+blr_read_events(ROUTER_INSTANCE *router, int fix, int debug, const BLR_CHECKPOINT *checkpoint)
 {
     unsigned long filelen = 0;
     struct stat statb;
@@ -1360,15 +1842,50 @@ blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug)
         filelen = statb.st_size;
     }
 
-    router->current_pos = 4;
-    router->binlog_position = 4;
-    router->current_safe_event = 4;
+    if (checkpoint)
+    {
+        pos = checkpoint->pos;
+        last_known_commit = pos;
+        found_chksum = checkpoint->checksum;
+
+        if (checkpoint->encrypted)
+        {
+            BINLOG_ENCRYPTION_CTX *new_encryption_ctx = MXS_CALLOC(1, sizeof(BINLOG_ENCRYPTION_CTX));
+
+            if (new_encryption_ctx == NULL)
+            {
+                router->m_errno = BINLOG_FATAL_ERROR_READING;
+                return 1;
+            }
+
+            if (router->encryption.key_len == 0)
+            {
+                MXS_FREE(new_encryption_ctx);
+                router->m_errno = BINLOG_FATAL_ERROR_READING;
+                MXS_ERROR("*** The binlog is encrypted. No KEY/Algo found for decryption. ***");
+                return 1;
+            }
+
+            memcpy(new_encryption_ctx->nonce, checkpoint->nonce, BLRM_NONCE_LENGTH);
+            new_encryption_ctx->binlog_crypto_scheme = checkpoint->binlog_crypto_scheme;
+            new_encryption_ctx->binlog_key_version = checkpoint->binlog_key_version;
+
+            start_encryption_seen = 1;
+
+            MXS_FREE(router->encryption_ctx);
+            router->encryption_ctx = new_encryption_ctx;
+        }
+    }
+
+    router->current_pos = pos;
+    router->binlog_position = pos;
+    router->current_safe_event = pos;
 
     while (1)
     {
 
         /* Read the header information from the file */
-        if ((n = pread(router->binlog_fd, hdbuf, BINLOG_EVENT_HDR_LEN, pos)) != BINLOG_EVENT_HDR_LEN)
+        if ((n = blr_read_events_pread(router, hdbuf, BINLOG_EVENT_HDR_LEN, pos)) != BINLOG_EVENT_HDR_LEN)
         {
             switch (n)
             {
@@ -1390,7 +1907,10 @@ blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug)
                 {
                     if (first_event.event_type == 0)
                     {
-                        blr_print_binlog_details(router, fde_event, last_event);
+                        /* Without an FDE, when starting from a checkpoint */
+                        blr_print_binlog_details(router,
+                                                 fde_event.event_type ? fde_event : last_event,
+                                                 last_event);
                     }
                     else
                     {
@@ -1651,9 +2171,9 @@ blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug)
         memcpy(data, hdbuf, BINLOG_EVENT_HDR_LEN);// Copy the header in
 
         /* Read event data */
-        if ((n = pread(router->binlog_fd, &data[BINLOG_EVENT_HDR_LEN],
-                       hdr.event_size - BINLOG_EVENT_HDR_LEN,
-                       pos + BINLOG_EVENT_HDR_LEN)) != hdr.event_size - BINLOG_EVENT_HDR_LEN)
+        if ((n = blr_read_events_pread(router, &data[BINLOG_EVENT_HDR_LEN],
+                                       hdr.event_size - BINLOG_EVENT_HDR_LEN,
+                                       pos + BINLOG_EVENT_HDR_LEN)) != hdr.event_size - BINLOG_EVENT_HDR_LEN)
         {
             if (n == -1)
             {
@@ -1870,7 +2390,45 @@ blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug)
             }
             else
             {
-                found_chksum = 0;
+                found_chksum = 0;
+            }
+        }
+
+        /* The checksum of an encrypted event is not checked */
+        if (router->verify_checksums && found_chksum && !start_encryption_seen &&
+            hdr.event_size >= BINLOG_EVENT_HDR_LEN + BINLOG_EVENT_CRC_SIZE)
+        {
+            uint32_t event_crc = EXTRACT32(data + hdr.event_size - BINLOG_EVENT_CRC_SIZE);
+            uint32_t crc = mxs_crc32(0, data, hdr.event_size - BINLOG_EVENT_CRC_SIZE);
+
+            if (crc != event_crc)
+            {
+                MXS_ERROR("Checksum mismatch in event [%s] at %llu in %s: "
+                          "the event has 0x%08x, the computed value is 0x%08x.",
+                          blr_get_event_description(router, hdr.event_type),
+                          pos, router->binlog_name, event_crc, crc);
+
+                gwbuf_free(result);
+
+                router->binlog_position = last_known_commit;
+                router->current_safe_event = last_known_commit;
+                router->current_pos = pos;
+
+                MXS_WARNING("an error has been found. "
+                            "Setting safe pos to %lu, current pos %lu",
+                            router->binlog_position, router->current_pos);
+                if (fix)
+                {
+                    if (ftruncate(router->binlog_fd, router->binlog_position) == 0)
+                    {
+                        MXS_NOTICE("Binlog file %s has been truncated at %lu",
+                                   router->binlog_name,
+                                   router->binlog_position);
+                        fsync(router->binlog_fd);
+                    }
+                }
+
+                return 1;
             }
         }
 
@@ -2464,6 +3022,282 @@ blr_file_write_master_config(ROUTER_INSTANCE *router, char *error)
     return 0;
 }
 
+/**
+ * Verify the current binlog file at startup, as blr_read_events_all_events()
+ * does, but only from the checkpoint onwards if there is a valid one for the
+ * file. If the verification from the checkpoint fails, the whole file is
+ * verified.
+ *
+ * @param router    The router instance
+ * @return          0 on success, >0 on failure
+ */
+int
+blr_file_verify(ROUTER_INSTANCE *router)
+{
+    BLR_CHECKPOINT checkpoint;
+
+    if (blr_file_read_checkpoint(router, &checkpoint))
+    {
+        MXS_NOTICE("%s: Validating binlog file '%s' from the checkpoint at %lu.",
+                   router->service->name, router->binlog_name,
+                   (unsigned long)checkpoint.pos);
+
+        if (blr_read_events(router, 0, 0, &checkpoint) == 0)
+        {
+            return 0;
+        }
+
+        MXS_WARNING("%s: Validating binlog file '%s' from the checkpoint failed, "
+                    "validating the whole file.", router->service->name, router->binlog_name);
+
+        router->m_errno = 0;
+        router->pending_transaction = 0;
+        MXS_FREE(router->encryption_ctx);
+        router->encryption_ctx = NULL;
+    }
+
+    return blr_read_events(router, 0, 0, NULL);
+}
+
+/**
+ * Save a checkpoint of the current binlog file, so that a restart only needs
+ * to verify the file from the checkpoint onwards.
+ *
+ * The checkpoint is the safe position, a transaction boundary with
+ * transaction_safety, and is written to 'binlogdir/checkpoint.ini'.
+ *
+ * @param router    The router instance
+ */
+void
+blr_file_write_checkpoint(ROUTER_INSTANCE *router)
+{
+    static const char CHECKPOINT_INI[] = "checkpoint.ini";
+    static const char TMP[] = "tmp";
+    BLR_CHECKPOINT checkpoint;
+    bool skip;
+
+    if (router->binlogdir == NULL)
+    {
+        return;
+    }
+
+    memset(&checkpoint, 0, sizeof(checkpoint));
+
+    spinlock_acquire(&router->binlog_lock);
+
+    strcpy(checkpoint.binlog, router->binlog_name);
+    checkpoint.pos = blr_file_safe_position(router);
+    checkpoint.checksum = router->master_chksum;
+
+    BINLOG_ENCRYPTION_CTX *enc_ctx = router->encryption_ctx;
+
+    if (enc_ctx)
+    {
+        checkpoint.encrypted = true;
+        checkpoint.binlog_crypto_scheme = enc_ctx->binlog_crypto_scheme;
+        checkpoint.binlog_key_version = enc_ctx->binlog_key_version;
+        memcpy(checkpoint.nonce, enc_ctx->nonce, BLRM_NONCE_LENGTH);
+    }
+
+    /* While rotating, the encryption context may be that of the previous file */
+    skip = checkpoint.pos <= 4 || router->rotating ||
+           (router->encryption.enabled && enc_ctx == NULL);
+
+    spinlock_release(&router->binlog_lock);
+
+    if (skip || checkpoint.binlog[0] == '\0')
+    {
+        return;
+    }
+
+    size_t len = strlen(router->binlogdir);
+    char path[len + 1 + BINLOG_FNAMELEN + 1];
+    char filename[len + sizeof('/') + sizeof(CHECKPOINT_INI)];
+    char tmp_file[len + sizeof('/') + sizeof(CHECKPOINT_INI) + sizeof('.') + sizeof(TMP)];
+    char err_msg[MXS_STRERROR_BUFLEN];
+    char nonce_hex[AES_BLOCK_SIZE * 2 + 1] = "";
+    FILE *checkpoint_file;
+
+    sprintf(path, "%s/%s", router->binlogdir, checkpoint.binlog);
+    sprintf(filename, "%s/%s", router->binlogdir, CHECKPOINT_INI);
+    sprintf(tmp_file, "%s/%s.%s", router->binlogdir, CHECKPOINT_INI, TMP);
+
+    if (!blr_file_checkpoint_crc(path, checkpoint.pos, &checkpoint.crc, &checkpoint.crc_len))
+    {
+        return;
+    }
+
+    if ((checkpoint_file = fopen(tmp_file, "wb")) == NULL)
+    {
+        MXS_ERROR("%s: Failed to write binlog checkpoint '%s': %s", router->service->name,
+                  tmp_file, strerror_r(errno, err_msg, sizeof(err_msg)));
+        return;
+    }
+
+    fprintf(checkpoint_file, "[checkpoint]\n");
+    fprintf(checkpoint_file, "binlog=%s\n", checkpoint.binlog);
+    fprintf(checkpoint_file, "pos=%lu\n", (unsigned long)checkpoint.pos);
+    fprintf(checkpoint_file, "checksum=%d\n", checkpoint.checksum);
+    fprintf(checkpoint_file, "crc=%u\n", checkpoint.crc);
+    fprintf(checkpoint_file, "crc_len=%u\n", checkpoint.crc_len);
+
+    if (checkpoint.encrypted)
+    {
+        gw_bin2hex(nonce_hex, checkpoint.nonce, BLRM_NONCE_LENGTH);
+
+        fprintf(checkpoint_file, "encryption_scheme=%u\n", checkpoint.binlog_crypto_scheme);
+        fprintf(checkpoint_file, "encryption_key_version=%u\n", checkpoint.binlog_key_version);
+        fprintf(checkpoint_file, "encryption_nonce=%s\n", nonce_hex);
+    }
+
+    if (fclose(checkpoint_file) != 0 || rename(tmp_file, filename) == -1)
+    {
+        MXS_ERROR("%s: Failed to write binlog checkpoint '%s': %s", router->service->name,
+                  filename, strerror_r(errno, err_msg, sizeof(err_msg)));
+    }
+}
+
+/**
+ * Read the checkpoint of the current binlog file
+ *
+ * @param router        The router instance
+ * @param checkpoint    The checkpoint to fill
+ * @return              True if there is a checkpoint for the current binlog
+ *                      file and the file has not changed before it
+ */
+static bool
+blr_file_read_checkpoint(ROUTER_INSTANCE *router, BLR_CHECKPOINT *checkpoint)
+{
+    size_t len = strlen(router->binlogdir);
+    char filename[len + sizeof("/checkpoint.ini")];
+    char path[len + 1 + BINLOG_FNAMELEN + 1];
+    uint32_t crc;
+    uint32_t crc_len;
+
+    memset(checkpoint, 0, sizeof(*checkpoint));
+
+    sprintf(filename, "%s/checkpoint.ini", router->binlogdir);
+
+    if (access(filename, R_OK) == -1 ||
+        ini_parse(filename, blr_handler_checkpoint, checkpoint) != 0 ||
+        strcmp(checkpoint->binlog, router->binlog_name) != 0 ||
+        checkpoint->pos <= 4)
+    {
+        return false;
+    }
+
+    sprintf(path, "%s/%s", router->binlogdir, checkpoint->binlog);
+
+    if (!blr_file_checkpoint_crc(path, checkpoint->pos, &crc, &crc_len) ||
+        crc != checkpoint->crc || crc_len != checkpoint->crc_len)
+    {
+        MXS_WARNING("%s: Binlog file '%s' does not match its checkpoint at %lu, "
+                    "validating the whole file.", router->service->name,
+                    checkpoint->binlog, (unsigned long)checkpoint->pos);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Compute the CRC32 of the BLR_CHECKPOINT_CRC_LEN bytes, or the bytes after
+ * the magic if there are fewer, before a position of a binlog file
+ *
+ * @param path      The binlog file
+ * @param pos       The position
+ * @param crc       The CRC32
+ * @param crc_len   The number of bytes included in the CRC32
+ * @return          True if the bytes could be read
+ */
+static bool
+blr_file_checkpoint_crc(const char *path, uint64_t pos, uint32_t *crc, uint32_t *crc_len)
+{
+    uint8_t buf[BLR_CHECKPOINT_CRC_LEN];
+    uint32_t n = MXS_MIN(pos - BINLOG_MAGIC_SIZE, BLR_CHECKPOINT_CRC_LEN);
+    bool rval = false;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) != -1)
+    {
+        if (pread(fd, buf, n, pos - n) == (ssize_t)n)
+        {
+            *crc = mxs_crc32(0, buf, n);
+            *crc_len = n;
+            rval = true;
+        }
+
+        close(fd);
+    }
+
+    return rval;
+}
+
+/**
+ * Configuration handler for the items of the checkpoint file
+ *
+ * @param userdata  The checkpoint to fill
+ * @param section   Section name
+ * @param name      Item name
+ * @param value     Item value
+ * @return          0 on error
+ */
+static int
+blr_handler_checkpoint(void *userdata, const char *section, const char *name, const char *value)
+{
+    BLR_CHECKPOINT *checkpoint = (BLR_CHECKPOINT *)userdata;
+
+    if (strcmp(section, "checkpoint") != 0)
+    {
+        return 0;
+    }
+
+    if (strcmp(name, "binlog") == 0)
+    {
+        snprintf(checkpoint->binlog, sizeof(checkpoint->binlog), "%s", value);
+    }
+    else if (strcmp(name, "pos") == 0)
+    {
+        checkpoint->pos = strtoull(value, NULL, 10);
+    }
+    else if (strcmp(name, "checksum") == 0)
+    {
+        checkpoint->checksum = atoi(value);
+    }
+    else if (strcmp(name, "crc") == 0)
+    {
+        checkpoint->crc = strtoul(value, NULL, 10);
+    }
+    else if (strcmp(name, "crc_len") == 0)
+    {
+        checkpoint->crc_len = strtoul(value, NULL, 10);
+    }
+    else if (strcmp(name, "encryption_scheme") == 0)
+    {
+        checkpoint->encrypted = true;
+        checkpoint->binlog_crypto_scheme = atoi(value);
+    }
+    else if (strcmp(name, "encryption_key_version") == 0)
+    {
+        checkpoint->binlog_key_version = strtoul(value, NULL, 10);
+    }
+    else if (strcmp(name, "encryption_nonce") == 0)
+    {
+        if (strlen(value) != BLRM_NONCE_LENGTH * 2)
+        {
+            return 0;
+        }
+
+        gw_hex2bin(checkpoint->nonce, value, BLRM_NONCE_LENGTH * 2);
+    }
+    else
+    {
+        return 0;
+    }
+
+    return 1;
+}
+
 /** Print Binlog Details
  *
  * @param router        The router instance
@@ -2559,8 +3393,7 @@ blr_create_ignorable_event(uint32_t event_size,
          * and then the checksum of the real event: 4 byte less than event_size
          */
         uint32_t chksum;
-        chksum = crc32(0L, NULL, 0);
-        chksum = crc32(chksum, new_event, event_size - BINLOG_EVENT_CRC_SIZE);
+        chksum = mxs_crc32(0, new_event, event_size - BINLOG_EVENT_CRC_SIZE);
 
         // checksum is stored after current event data using 4 bytes
         encode_value(new_event + event_size - BINLOG_EVENT_CRC_SIZE, chksum, 32);
@@ -2758,8 +3591,7 @@ blr_create_start_encryption_event(ROUTER_INSTANCE *router, uint32_t event_pos, b
          * and then the checksum of the event.
          */
         uint32_t chksum;
-        chksum = crc32(0L, NULL, 0);
-        chksum = crc32(chksum, new_event, event_size - BINLOG_EVENT_CRC_SIZE);
+        chksum = mxs_crc32(0, new_event, event_size - BINLOG_EVENT_CRC_SIZE);
 
         // checksum is stored at the end of current event data: 4 less bytes than event size
         encode_value(new_event + event_size - BINLOG_EVENT_CRC_SIZE, chksum, 32);
@@ -2785,77 +3617,128 @@ blr_create_start_encryption_event(ROUTER_INSTANCE *router, uint32_t event_pos, b
 }
 
 /**
- * Encrypt/Decrypt an array of bytes
- *
- * Note: The output buffer is 4 bytes larger than input
- * Encrypted bytes start at offset 4
+ * The cipher contexts of a thread. A context is set up for a key once and
+ * then only given a new IV for each event, so that neither the context
+ * allocation nor the key schedule is repeated per event.
+ */
+typedef struct
+{
+    EVP_CIPHER_CTX *ctx;                          /*< The context */
+    int             algorithm;                    /*< The algorithm of the key */
+    unsigned int    key_len;                      /*< The length of the key */
+    uint8_t         key[BINLOG_AES_MAX_KEY_LEN];  /*< The key the context is set up for */
+} BLR_CIPHER_CTX;
+
+/** Contexts for decryption and encryption, indexed by action, and for the CBC tail */
+static thread_local BLR_CIPHER_CTX blr_cipher_ctx[2];
+static thread_local BLR_CIPHER_CTX blr_cipher_tail_ctx;
+
+/**
+ * Return a cipher context of the calling thread, set up for the key of
+ * the router.
  *
  * @param router    The router instance
- * @param buffer    The buffer to encrypt/decrypt
- * @param size      The buffer size
- * @param iv        The AES initialisation Vector
- * @action          Crypt action: 1 encrypt, 1 decrypt
- * @return          A new allocated, encrypted, GWBUF buffer
- *
+ * @param cctx      The context of the thread
+ * @param algorithm The encryption algorithm
+ * @param action    Crypt action: 1 encrypt, 0 decrypt
+ * @return          The context, or NULL on error
  */
-static GWBUF *blr_aes_crypt(ROUTER_INSTANCE *router,
-                            uint8_t *buffer,
-                            uint32_t size,
-                            uint8_t *iv,
-                            int action)
+static EVP_CIPHER_CTX *blr_aes_get_ctx(ROUTER_INSTANCE *router,
+                                       BLR_CIPHER_CTX *cctx,
+                                       int algorithm,
+                                       int action)
 {
     uint8_t *key = router->encryption.key_value;
     unsigned int key_len = router->encryption.key_len;
-    int outlen;
-    int flen;
-    uint32_t encrypted_size = size + 4;
-    int total_len;
-    GWBUF *outbuf;
-    uint8_t *out_ptr;
 
-    if (key_len == 0)
+    if (cctx->ctx &&
+        cctx->algorithm == algorithm &&
+        cctx->key_len == key_len &&
+        memcmp(cctx->key, key, key_len) == 0)
     {
-        MXS_ERROR("The encrytion key len is 0");
-        return NULL;
+        return cctx->ctx;
     }
 
-    if ((outbuf = gwbuf_alloc(encrypted_size)) == NULL)
+    if (cctx->ctx == NULL && (cctx->ctx = mxs_evp_cipher_ctx_alloc()) == NULL)
     {
         return NULL;
     }
 
-    out_ptr = GWBUF_DATA(outbuf);
-
-    EVP_CIPHER_CTX *ctx = mxs_evp_cipher_ctx_alloc();
-
     /* Set the encryption algorithm accordingly to key_len and encryption mode */
-    if (!EVP_CipherInit_ex(ctx,
-                           ciphers[router->encryption.encryption_algorithm](router->encryption.key_len),
+    if (!EVP_CipherInit_ex(cctx->ctx,
+                           ciphers[algorithm](key_len),
                            NULL,
                            key,
-                           iv,
+                           NULL,
                            action))
     {
-        MXS_ERROR("Error in EVP_CipherInit_ex for algo %d", router->encryption.encryption_algorithm);
-        mxs_evp_cipher_ctx_free(ctx);
-        MXS_FREE(outbuf);
+        MXS_ERROR("Error in EVP_CipherInit_ex for algo %d", algorithm);
+        mxs_evp_cipher_ctx_free(cctx->ctx);
+        cctx->ctx = NULL;
         return NULL;
     }
 
     /* Set no padding */
-    EVP_CIPHER_CTX_set_padding(ctx, 0);
+    EVP_CIPHER_CTX_set_padding(cctx->ctx, 0);
+
+    cctx->algorithm = algorithm;
+    cctx->key_len = key_len;
+    memcpy(cctx->key, key, key_len);
+
+    return cctx->ctx;
+}
+
+/**
+ * Encrypt/Decrypt an array of bytes
+ *
+ * The output may be the same as the input.
+ *
+ * @param router    The router instance
+ * @param buffer    The buffer to encrypt/decrypt
+ * @param size      The buffer size
+ * @param iv        The AES initialisation Vector
+ * @action          Crypt action: 1 encrypt, 0 decrypt
+ * @param output    The buffer of size bytes for the result
+ * @return          1 on success, 0 on error
+ *
+ */
+static int blr_aes_crypt(ROUTER_INSTANCE *router,
+                         uint8_t *buffer,
+                         uint32_t size,
+                         uint8_t *iv,
+                         int action,
+                         uint8_t *output)
+{
+    int outlen;
+    int flen;
+
+    if (router->encryption.key_len == 0)
+    {
+        MXS_ERROR("The encrytion key len is 0");
+        return 0;
+    }
+
+    EVP_CIPHER_CTX *ctx = blr_aes_get_ctx(router,
+                                          &blr_cipher_ctx[action],
+                                          router->encryption.encryption_algorithm,
+                                          action);
+
+    /* Only the IV changes, the key is kept */
+    if (ctx == NULL || !EVP_CipherInit_ex(ctx, NULL, NULL, NULL, iv, action))
+    {
+        MXS_ERROR("Error in EVP_CipherInit_ex for algo %d", router->encryption.encryption_algorithm);
+        return 0;
+    }
 
     /* Encryt/Decrypt the input data */
     if (!EVP_CipherUpdate(ctx,
-                          out_ptr + 4,
+                          output,
                           &outlen,
                           buffer,
                           size))
     {
         MXS_ERROR("Error in EVP_CipherUpdate");
-        mxs_evp_cipher_ctx_free(ctx);
-        MXS_FREE(outbuf);
-        return NULL;
+        return 0;
     }
 
     int finale_ret = 1;
@@ -2865,7 +3748,7 @@ static GWBUF *blr_aes_crypt(ROUTER_INSTANCE *router,
     {
         /* Call Final_ex */
         if (!EVP_CipherFinal_ex(ctx,
-                                (out_ptr + 4 + outlen),
+                                (output + outlen),
                                 (int*)&flen))
         {
             MXS_ERROR("Error in EVP_CipherFinal_ex");
@@ -2880,12 +3763,11 @@ static GWBUF *blr_aes_crypt(ROUTER_INSTANCE *router,
          */
         if (size - outlen > 0)
         {
-            if (!blr_aes_create_tail_for_cbc(out_ptr + 4 + outlen,
+            if (!blr_aes_create_tail_for_cbc(router,
+                                             output + outlen,
                                              mxs_evp_cipher_ctx_buf(ctx),
                                              size - outlen,
-                                             mxs_evp_cipher_ctx_oiv(ctx),
-                                             router->encryption.key_value,
-                                             router->encryption.key_len))
+                                             mxs_evp_cipher_ctx_oiv(ctx)))
             {
                 MXS_ERROR("Error in blr_aes_create_tail_for_cbc");
                 finale_ret = 0;
@@ -2893,15 +3775,7 @@ static GWBUF *blr_aes_crypt(ROUTER_INSTANCE *router,
         }
     }
 
-    if (!finale_ret)
-    {
-        MXS_FREE(outbuf);
-        outbuf = NULL;
-    }
-
-    mxs_evp_cipher_ctx_free(ctx);
-
-    return outbuf;
+    return finale_ret;
 }
 
 /**
@@ -2923,14 +3797,52 @@ static GWBUF *blr_prepare_encrypted_event(ROUTER_INSTANCE *router,
                                           uint32_t pos,
                                           const uint8_t *nonce,
                                           int action)
+{
+    GWBUF *encrypted;
+
+    if ((encrypted = gwbuf_alloc(size)) == NULL)
+    {
+        return NULL;
+    }
+
+    if (!blr_crypt_event(router, buf, GWBUF_DATA(encrypted), size, pos, nonce, action))
+    {
+        gwbuf_free(encrypted);
+        return NULL;
+    }
+
+    return encrypted;
+}
+
+/**
+ * Encrypt or decrypt a binlog event
+ *
+ * Note: The first 4 bytes of buf are modified.
+ *
+ * @param router    The ruter instance
+ * @buf             The binlog event
+ * @output          The buffer of size bytes for the result, may be buf
+ * @size            The event size (CRC32 four bytes included)
+ * @pos             The position of the event in binlog file
+ * @nonce           The binlog nonce 12 bytes as in START_ENCRYPTION_EVENT
+ *                  of requested or current binlog file
+ *                  If nonce is NULL the one from current binlog file is used.
+ * @action          Encryption action: 1 Encryp, 0 Decryot
+ * @return          1 on success, 0 on error
+ */
+static int blr_crypt_event(ROUTER_INSTANCE *router,
+                           uint8_t *buf,
+                           uint8_t *output,
+                           uint32_t size,
+                           uint32_t pos,
+                           const uint8_t *nonce,
+                           int action)
 {
     uint8_t iv[BLRM_IV_LENGTH];
     uint32_t file_offset = pos;
     uint8_t event_size[4];
     const uint8_t *nonce_ptr = nonce;
-    GWBUF *encrypted;
-    uint8_t *enc_ptr;
-
+    uint8_t *enc_ptr = output;
     /* If nonce is NULL use the router current binlog file */
     if (nonce_ptr == NULL)
     {
@@ -2975,26 +3887,24 @@ static GWBUF *blr_prepare_encrypted_event(ROUTER_INSTANCE *router,
      * (3): encrypt the event stored in buf starting from (buf + 4):
      * with len (event_size - 4)
      *
-     * NOTE: the encrypted_data buffer returned by blr_aes_encrypt() contains:
+     * NOTE: the output buffer then contains:
      * (size - 4) encrypted bytes + (4) bytes event size in clear
      *
      * The encrypted buffer has same size of the original event (size variable)
      */
 
-    if ((encrypted = blr_aes_crypt(router, buf + 4, size - 4, iv, action)) == NULL)
+    if (!blr_aes_crypt(router, buf + 4, size - 4, iv, action, enc_ptr + 4))
     {
-        return NULL;
+        return 0;
     }
 
-    enc_ptr = GWBUF_DATA(encrypted);
-
     /* (4): move encrypted_data + 9 (4 bytes) to  encrypted_data[0] */
     memmove(enc_ptr, enc_ptr + BINLOG_EVENT_LEN_OFFSET, 4);
 
     /* (5): Copy saved_event_size 4 bytes into encrypted_data + 9 */
     memcpy(enc_ptr + BINLOG_EVENT_LEN_OFFSET, &event_size, 4);
 
-    return encrypted;
+    return 1;
 }
 
 /**
@@ -3062,42 +3972,34 @@ const char *blr_encryption_algorithm_list(void)
  * 2) the remaing data from previous stage are XORed with thant buffer
  *    and the the ouput buffer contains the result
  *
+ * @param router    The router instance, with the encryption key
  * @param output    The outut buffer to fill
  * @param input     The input buffere 8remaining bytes from previous stage)
  * @param in_size   The inout data size
  * @param iv        The IV used in previous stage
- * @param key       The encryption key
- * @param key_len   The lenght of encrytion key
  * @return          Return 1 on success, 0 otherwise
  */
-static int blr_aes_create_tail_for_cbc(uint8_t *output,
+static int blr_aes_create_tail_for_cbc(ROUTER_INSTANCE *router,
+                                       uint8_t *output,
                                        uint8_t *input,
                                        uint32_t in_size,
-                                       uint8_t *iv,
-                                       uint8_t *key,
-                                       unsigned int key_len)
+                                       uint8_t *iv)
 {
     uint8_t mask[AES_BLOCK_SIZE];
     int mlen = 0;
 
-    EVP_CIPHER_CTX* t_ctx = mxs_evp_cipher_ctx_alloc();
+    /* AES_ECB, which needs no iv */
+    EVP_CIPHER_CTX* t_ctx = blr_aes_get_ctx(router,
+                                            &blr_cipher_tail_ctx,
+                                            BLR_AES_ECB,
+                                            BINLOG_FLAG_ENCRYPT);
 
-    /* Initialise with AES_ECB and NULL iv */
-    if (!EVP_CipherInit_ex(t_ctx,
-                           ciphers[BLR_AES_ECB](key_len),
-                           NULL,
-                           key,
-                           NULL, /* NULL iv */
-                           BINLOG_FLAG_ENCRYPT))
+    if (t_ctx == NULL)
     {
         MXS_ERROR("Error in EVP_CipherInit_ex CBC for last block (ECB)");
-        mxs_evp_cipher_ctx_free(t_ctx);
         return 0;
     }
 
-    /* Set no padding */
-    EVP_CIPHER_CTX_set_padding(t_ctx, 0);
-
     /* Do the enc/dec of the IV (the one from previous stage) */
     if (!EVP_CipherUpdate(t_ctx,
                           mask,
@@ -3106,7 +4008,6 @@ static int blr_aes_create_tail_for_cbc(uint8_t *output,
                           sizeof(mask)))
     {
         MXS_ERROR("Error in EVP_CipherUpdate ECB");
-        mxs_evp_cipher_ctx_free(t_ctx);
         return 0;
     }
 
@@ -3121,8 +4022,6 @@ static int blr_aes_create_tail_for_cbc(uint8_t *output,
         output[i] = input[i] ^ mask[i];
     }
 
-    mxs_evp_cipher_ctx_free(t_ctx);
-
     return 1;
 }
 
@@ -0,0 +1,610 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file blr_filter.c - binlog router slave filters
+ *
+ * A slave with a filter is only sent the changes of the databases and tables
+ * of the filter. The filters are given with the slave_filter parameter:
+ *
+ * @verbatim
+ * slave_filter=<server id>:<db>[.<table>][|<db>[.<table>]...][;<server id>:...]
+ * @endverbatim
+ *
+ * The events of the other databases and tables are not left out, as the
+ * slaves compute the positions from the sizes of the events they are sent.
+ * They are replaced with events of the same size that change nothing:
+ *
+ * - A table map event of another table is replaced with an ignorable event
+ *   and its table id is remembered until the end of the statement.
+ * - A rows event of a remembered table id is replaced with an ignorable event,
+ *   unless it ends the statement. The slave then skips its rows, as the table
+ *   id is not mapped, but still ends the statement.
+ * - A query event of which the default database is another database is
+ *   replaced with a query event with a comment as the statement, as MariaDB does
+ *   for the events a slave does not support. The statements that start and
+ *   end transactions are always sent.
+ *
+ * The GTID, XID and the other events are sent as they are, so the slave sees
+ * the same transactions and positions as the slaves without a filter.
+ */
+
+#include "blr.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <zlib.h>
+#include <maxscale/alloc.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/utils.h>
+
+/** Size of the table id in the table map and rows events */
+#define BLR_FILTER_TABLE_ID_LEN  6
+/** Size of the post-header of a query event */
+#define BLR_FILTER_QUERY_POST_LEN 13
+/** The rows event ends the statement */
+#define BLR_FILTER_STMT_END_F     0x0001
+
+/** The statement of the query events that replace the filtered ones */
+static const char blr_filter_dummy_query[] = "# Dummy event replacing an event the slave does not replicate";
+
+extern void encode_value(unsigned char *data, unsigned int value, int len);
+
+/**
+ * Free a filter list
+ *
+ * @param filter The first filter of the list
+ */
+void blr_filter_free(BLR_SLAVE_FILTER *filter)
+{
+    while (filter)
+    {
+        BLR_SLAVE_FILTER *next = filter->next;
+
+        for (int i = 0; i < filter->n_names; i++)
+        {
+            MXS_FREE(filter->dbs[i]);
+            MXS_FREE(filter->tables[i]);
+        }
+
+        MXS_FREE(filter->dbs);
+        MXS_FREE(filter->tables);
+        MXS_FREE(filter);
+        filter = next;
+    }
+}
+
+/**
+ * Add a database or a table to a filter
+ *
+ * @param filter The filter
+ * @param name   The name, db or db.table
+ * @return True on success
+ */
+static bool blr_filter_add_name(BLR_SLAVE_FILTER *filter, const char *name)
+{
+    const char *dot = strchr(name, '.');
+    size_t db_len = dot ? (size_t)(dot - name) : strlen(name);
+
+    if (db_len == 0 || (dot && (dot[1] == '\0' || strchr(dot + 1, '.'))))
+    {
+        MXS_ERROR("Invalid database or table '%s' in slave_filter.", name);
+        return false;
+    }
+
+    char **dbs = MXS_REALLOC(filter->dbs, (filter->n_names + 1) * sizeof(char*));
+
+    if (dbs == NULL)
+    {
+        return false;
+    }
+
+    filter->dbs = dbs;
+
+    char **tables = MXS_REALLOC(filter->tables, (filter->n_names + 1) * sizeof(char*));
+
+    if (tables == NULL)
+    {
+        return false;
+    }
+
+    filter->tables = tables;
+
+    char *db = MXS_STRNDUP(name, db_len);
+    /** A table of '*' is the same as the whole database */
+    char *table = dot && strcmp(dot + 1, "*") != 0 ? MXS_STRDUP(dot + 1) : NULL;
+
+    if (db == NULL || (dot && strcmp(dot + 1, "*") != 0 && table == NULL))
+    {
+        MXS_FREE(db);
+        MXS_FREE(table);
+        return false;
+    }
+
+    filter->dbs[filter->n_names] = db;
+    filter->tables[filter->n_names] = table;
+    filter->n_names++;
+    return true;
+}
+
+/**
+ * Parse the filter of one slave
+ *
+ * @param value The filter, <server id>:<names>
+ * @return The filter or NULL on error
+ */
+static BLR_SLAVE_FILTER* blr_filter_parse_one(char *value)
+{
+    char *names = strchr(value, ':');
+    char *end;
+
+    if (names == NULL)
+    {
+        MXS_ERROR("Invalid slave_filter '%s', expected <server id>:<db>[.<table>].", value);
+        return NULL;
+    }
+
+    *names++ = '\0';
+    long server_id = strtol(value, &end, 10);
+
+    if (end == value || *end || server_id <= 0)
+    {
+        MXS_ERROR("Invalid server id '%s' in slave_filter.", value);
+        return NULL;
+    }
+
+    BLR_SLAVE_FILTER *filter = MXS_CALLOC(1, sizeof(BLR_SLAVE_FILTER));
+
+    if (filter == NULL)
+    {
+        return NULL;
+    }
+
+    filter->server_id = server_id;
+
+    char *saveptr;
+
+    for (char *tok = strtok_r(names, "|", &saveptr); tok; tok = strtok_r(NULL, "|", &saveptr))
+    {
+        char *name = trim(tok);
+
+        if (*name && !blr_filter_add_name(filter, name))
+        {
+            blr_filter_free(filter);
+            return NULL;
+        }
+    }
+
+    if (filter->n_names == 0)
+    {
+        MXS_ERROR("No databases given for the slave with server id %d in slave_filter.",
+                  filter->server_id);
+        blr_filter_free(filter);
+        return NULL;
+    }
+
+    return filter;
+}
+
+bool blr_filter_parse(const char *value, BLR_SLAVE_FILTER **filters)
+{
+    char *copy = MXS_STRDUP(value);
+
+    if (copy == NULL)
+    {
+        return false;
+    }
+
+    BLR_SLAVE_FILTER *head = NULL;
+    BLR_SLAVE_FILTER **tail = &head;
+    bool rval = true;
+    char *saveptr;
+
+    for (char *tok = strtok_r(copy, ";", &saveptr); tok; tok = strtok_r(NULL, ";", &saveptr))
+    {
+        char *entry = trim(tok);
+
+        if (*entry == '\0')
+        {
+            continue;
+        }
+
+        BLR_SLAVE_FILTER *filter = blr_filter_parse_one(entry);
+
+        if (filter == NULL)
+        {
+            rval = false;
+            break;
+        }
+
+        *tail = filter;
+        tail = &filter->next;
+    }
+
+    MXS_FREE(copy);
+
+    if (rval)
+    {
+        blr_filter_free(*filters);
+        *filters = head;
+    }
+    else
+    {
+        blr_filter_free(head);
+    }
+
+    return rval;
+}
+
+BLR_SLAVE_FILTER* blr_filter_find(ROUTER_INSTANCE *router, int server_id)
+{
+    for (BLR_SLAVE_FILTER *filter = router->slave_filters; filter; filter = filter->next)
+    {
+        if (filter->server_id == server_id)
+        {
+            return filter;
+        }
+    }
+
+    return NULL;
+}
+
+void blr_filter_print(DCB *dcb, const BLR_SLAVE_FILTER *filter)
+{
+    for (int i = 0; i < filter->n_names; i++)
+    {
+        dcb_printf(dcb, "%s%s%s%s", i > 0 ? "|" : "", filter->dbs[i],
+                   filter->tables[i] ? "." : "", filter->tables[i] ? filter->tables[i] : "");
+    }
+}
+
+void blr_filter_reset(ROUTER_SLAVE *slave)
+{
+    MXS_FREE(slave->filtered_tables);
+    slave->filtered_tables = NULL;
+    slave->n_filtered_tables = 0;
+}
+
+/**
+ * Check whether a database is replicated to a slave
+ *
+ * @param filter The filter of the slave
+ * @param db     The database
+ * @param len    Length of @c db
+ * @return True if some or all of the tables of the database are replicated
+ */
+static bool blr_filter_match_db(const BLR_SLAVE_FILTER *filter, const char *db, size_t len)
+{
+    for (int i = 0; i < filter->n_names; i++)
+    {
+        if (strlen(filter->dbs[i]) == len && memcmp(filter->dbs[i], db, len) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Check whether a table is replicated to a slave
+ *
+ * @param filter    The filter of the slave
+ * @param db        The database
+ * @param db_len    Length of @c db
+ * @param table     The table
+ * @param table_len Length of @c table
+ * @return True if the table is replicated
+ */
+static bool blr_filter_match_table(const BLR_SLAVE_FILTER *filter, const char *db, size_t db_len,
+                                   const char *table, size_t table_len)
+{
+    for (int i = 0; i < filter->n_names; i++)
+    {
+        if (strlen(filter->dbs[i]) == db_len && memcmp(filter->dbs[i], db, db_len) == 0 &&
+            (filter->tables[i] == NULL ||
+             (strlen(filter->tables[i]) == table_len &&
+              memcmp(filter->tables[i], table, table_len) == 0)))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Check whether a table id was mapped to a table that is not replicated
+ *
+ * @param slave    The slave
+ * @param table_id The table id
+ * @return True if the table of the id is not replicated
+ */
+static bool blr_filter_table_is_filtered(ROUTER_SLAVE *slave, uint64_t table_id)
+{
+    for (int i = 0; i < slave->n_filtered_tables; i++)
+    {
+        if (slave->filtered_tables[i] == table_id)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Remember a table id that was mapped to a table that is not replicated
+ *
+ * @param slave    The slave
+ * @param table_id The table id
+ * @return True if the id was stored
+ */
+static bool blr_filter_add_table(ROUTER_SLAVE *slave, uint64_t table_id)
+{
+    if (blr_filter_table_is_filtered(slave, table_id))
+    {
+        return true;
+    }
+
+    uint64_t *ids = MXS_REALLOC(slave->filtered_tables,
+                                (slave->n_filtered_tables + 1) * sizeof(uint64_t));
+
+    if (ids == NULL)
+    {
+        return false;
+    }
+
+    ids[slave->n_filtered_tables++] = table_id;
+    slave->filtered_tables = ids;
+    return true;
+}
+
+/**
+ * Check whether a statement starts or ends a transaction
+ *
+ * @param query The statement
+ * @param len   Length of @c query
+ * @return True if the statement must be sent to every slave
+ */
+static bool blr_filter_is_trx_statement(const char *query, size_t len)
+{
+    static const char *statements[] =
+    {
+        "BEGIN", "COMMIT", "ROLLBACK", "XA ", "SAVEPOINT", "RELEASE SAVEPOINT", NULL
+    };
+
+    while (len > 0 && isspace(*query))
+    {
+        query++;
+        len--;
+    }
+
+    for (int i = 0; statements[i]; i++)
+    {
+        size_t n = strlen(statements[i]);
+
+        if (len >= n && strncasecmp(query, statements[i], n) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Check a table map event
+ *
+ * @param slave The slave
+ * @param body  The event after the header
+ * @param len   Length of @c body without the checksum
+ * @return True if the event is to be replaced
+ */
+static bool blr_filter_table_map(ROUTER_SLAVE *slave, const uint8_t *body, uint32_t len)
+{
+    /** Table id, flags, database length, database, NUL, table length */
+    if (len < BLR_FILTER_TABLE_ID_LEN + 2 + 1)
+    {
+        return false;
+    }
+
+    uint64_t table_id = extract_field((uint8_t*)body, 48);
+    const uint8_t *ptr = body + BLR_FILTER_TABLE_ID_LEN + 2;
+    const uint8_t *end = body + len;
+    size_t db_len = *ptr++;
+    const char *db = (const char*)ptr;
+
+    if (ptr + db_len + 2 > end)
+    {
+        return false;
+    }
+
+    ptr += db_len + 1;
+    size_t table_len = *ptr++;
+    const char *table = (const char*)ptr;
+
+    if (ptr + table_len > end)
+    {
+        return false;
+    }
+
+    if (blr_filter_match_table(slave->filter, db, db_len, table, table_len))
+    {
+        return false;
+    }
+
+    /** If the id can't be stored, the rows are sent but not applied by the slave */
+    blr_filter_add_table(slave, table_id);
+    return true;
+}
+
+/**
+ * Check a rows event
+ *
+ * @param slave The slave
+ * @param body  The event after the header
+ * @param len   Length of @c body without the checksum
+ * @return True if the event is to be replaced
+ */
+static bool blr_filter_rows(ROUTER_SLAVE *slave, const uint8_t *body, uint32_t len)
+{
+    if (len < BLR_FILTER_TABLE_ID_LEN + 2)
+    {
+        return false;
+    }
+
+    uint64_t table_id = extract_field((uint8_t*)body, 48);
+    uint16_t flags = EXTRACT16(body + BLR_FILTER_TABLE_ID_LEN);
+
+    if (flags & BLR_FILTER_STMT_END_F)
+    {
+        /**
+         * The slave skips the rows of a table id that is not mapped but it
+         * must see the end of the statement. The table ids are mapped again
+         * for the next statement.
+         */
+        blr_filter_reset(slave);
+        return false;
+    }
+
+    return blr_filter_table_is_filtered(slave, table_id);
+}
+
+/**
+ * Check a query event
+ *
+ * @param slave The slave
+ * @param body  The event after the header
+ * @param len   Length of @c body without the checksum
+ * @return True if the event is to be replaced
+ */
+static bool blr_filter_query(ROUTER_SLAVE *slave, const uint8_t *body, uint32_t len)
+{
+    if (len < BLR_FILTER_QUERY_POST_LEN)
+    {
+        return false;
+    }
+
+    size_t db_len = body[8];
+    size_t status_len = EXTRACT16(body + 11);
+    size_t offset = BLR_FILTER_QUERY_POST_LEN + status_len;
+
+    if (db_len == 0 || offset + db_len + 1 > len)
+    {
+        /** A statement without a default database is sent to every slave */
+        return false;
+    }
+
+    const char *db = (const char*)body + offset;
+    const char *query = db + db_len + 1;
+    size_t query_len = len - (offset + db_len + 1);
+
+    return !blr_filter_match_db(slave->filter, db, db_len) &&
+           !blr_filter_is_trx_statement(query, query_len);
+}
+
+bool blr_filter_skip(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, const uint8_t *event)
+{
+    if (slave->filter == NULL)
+    {
+        return false;
+    }
+
+    uint8_t event_type = event[4];
+    uint32_t event_size = extract_field((uint8_t*)&event[9], 32);
+    uint32_t crc_len = router->master_chksum ? BINLOG_EVENT_CRC_SIZE : 0;
+
+    if (event_size < BINLOG_EVENT_HDR_LEN + crc_len)
+    {
+        return false;
+    }
+
+    const uint8_t *body = event + BINLOG_EVENT_HDR_LEN;
+    uint32_t len = event_size - BINLOG_EVENT_HDR_LEN - crc_len;
+    bool skip = false;
+
+    switch (event_type)
+    {
+    case FORMAT_DESCRIPTION_EVENT:
+        /** A new binlog file, the slave forgets the table ids */
+        blr_filter_reset(slave);
+        break;
+
+    case TABLE_MAP_EVENT:
+        skip = blr_filter_table_map(slave, body, len);
+        break;
+
+    case WRITE_ROWS_EVENTv0:
+    case UPDATE_ROWS_EVENTv0:
+    case DELETE_ROWS_EVENTv0:
+    case WRITE_ROWS_EVENTv1:
+    case UPDATE_ROWS_EVENTv1:
+    case DELETE_ROWS_EVENTv1:
+    case WRITE_ROWS_EVENTv2:
+    case UPDATE_ROWS_EVENTv2:
+    case DELETE_ROWS_EVENTv2:
+        skip = blr_filter_rows(slave, body, len);
+        break;
+
+    case QUERY_EVENT:
+        skip = blr_filter_query(slave, body, len);
+        break;
+
+    default:
+        break;
+    }
+
+    if (skip)
+    {
+        slave->stats.n_filtered++;
+    }
+
+    return skip;
+}
+
+void blr_filter_replace(ROUTER_INSTANCE *router, uint8_t *event)
+{
+    uint32_t event_size = extract_field(&event[9], 32);
+    uint32_t crc_len = router->master_chksum ? BINLOG_EVENT_CRC_SIZE : 0;
+    uint8_t *body = event + BINLOG_EVENT_HDR_LEN;
+    uint32_t len = event_size - BINLOG_EVENT_HDR_LEN - crc_len;
+
+    /** The timestamp, the server id, the size and the position are kept */
+    memset(body, 0, len);
+
+    if (event[4] == QUERY_EVENT)
+    {
+        /** Thread id, execution time, error code and the empty database */
+        size_t offset = BLR_FILTER_QUERY_POST_LEN + 1;
+        size_t query_len = len - offset;
+
+        memset(body + offset, ' ', query_len);
+        memcpy(body + offset, blr_filter_dummy_query,
+               MXS_MIN(query_len, sizeof(blr_filter_dummy_query) - 1));
+    }
+    else
+    {
+        event[4] = IGNORABLE_EVENT;
+        encode_value(&event[17], LOG_EVENT_IGNORABLE_F, 16);
+    }
+
+    if (crc_len)
+    {
+        uint32_t chksum = mxs_crc32(0, event, event_size - BINLOG_EVENT_CRC_SIZE);
+        encode_value(event + event_size - BINLOG_EVENT_CRC_SIZE, chksum, 32);
+    }
+}
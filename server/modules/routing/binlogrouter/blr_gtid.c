@@ -0,0 +1,398 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file blr_gtid.c - binlog router GTID index
+ *
+ * The GTID index tells where in the binlog files a MariaDB 10 GTID is, so
+ * that a slave registering with MASTER_USE_GTID=slave_pos can be started
+ * without reading the binlog files from the beginning.
+ *
+ * The index is sparse: it contains the first transaction of each domain in
+ * each binlog file and every Nth transaction of the domain after it. The
+ * index file, <fileroot>.gtid_index in the binlog directory, is only ever
+ * appended to. Each entry is BLR_GTID_ENTRY_LEN bytes:
+ *
+ * @verbatim
+ * domain id       4 bytes
+ * server id       4 bytes
+ * sequence number 8 bytes
+ * binlog file no  4 bytes
+ * position        8 bytes
+ * @endverbatim
+ *
+ * All the values are little endian. As the index only points to a place
+ * from where to scan the binlog, it is not synced; whatever is lost in a
+ * crash only makes the scans longer.
+ */
+
+#include "blr.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <maxscale/alloc.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/spinlock.h>
+
+#define BLR_GTID_INDEX_SUFFIX ".gtid_index"
+
+static void blr_gtid_encode(uint8_t *data, const BLR_GTID_ENTRY *entry);
+static void blr_gtid_decode(const uint8_t *data, BLR_GTID_ENTRY *entry);
+static uint32_t blr_gtid_file_no(const char *binlog);
+static BLR_GTID_DOMAIN *blr_gtid_get_domain(BLR_GTID_INDEX *index, uint32_t domain);
+static bool blr_gtid_append(BLR_GTID_INDEX *index, const BLR_GTID_ENTRY *entry);
+
+/**
+ * Open the GTID index of the binlog files and load its entries.
+ *
+ * The entries pointing beyond the end of the current binlog file, which
+ * blr_file_init() may have truncated, are dropped from the index. There is
+ * no index if the router is not MariaDB 10 compatible or if the index
+ * interval is 0.
+ *
+ * @param router    The router instance, after blr_file_init()
+ */
+void
+blr_gtid_index_init(ROUTER_INSTANCE *router)
+{
+    router->gtid_index = NULL;
+
+    if (!router->mariadb10_compat || router->gtid_index_interval == 0 ||
+        router->binlogdir == NULL || router->binlog_name[0] == '\0')
+    {
+        return;
+    }
+
+    char path[PATH_MAX + 1];
+    snprintf(path, sizeof(path), "%s/%s" BLR_GTID_INDEX_SUFFIX, router->binlogdir, router->fileroot);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0666);
+
+    if (fd == -1)
+    {
+        char err_msg[MXS_STRERROR_BUFLEN];
+        MXS_ERROR("%s: Failed to open GTID index '%s', MariaDB 10 slaves cannot "
+                  "register with a GTID: %s", router->service->name, path,
+                  strerror_r(errno, err_msg, sizeof(err_msg)));
+        return;
+    }
+
+    BLR_GTID_INDEX *index = (BLR_GTID_INDEX *)MXS_CALLOC(1, sizeof(BLR_GTID_INDEX));
+    struct stat statb;
+    uint8_t *data = NULL;
+    int n = 0;
+
+    if (index == NULL || fstat(fd, &statb) == -1)
+    {
+        MXS_FREE(index);
+        close(fd);
+        return;
+    }
+
+    n = statb.st_size / BLR_GTID_ENTRY_LEN;
+
+    if (n > 0)
+    {
+        size_t size = n * BLR_GTID_ENTRY_LEN;
+
+        data = (uint8_t *)MXS_MALLOC(size);
+        index->entries = (BLR_GTID_ENTRY *)MXS_MALLOC(n * sizeof(BLR_GTID_ENTRY));
+
+        if (data == NULL || index->entries == NULL || pread(fd, data, size, 0) != (ssize_t)size)
+        {
+            MXS_ERROR("%s: Failed to read GTID index '%s'.", router->service->name, path);
+            MXS_FREE(data);
+            MXS_FREE(index->entries);
+            MXS_FREE(index);
+            close(fd);
+            return;
+        }
+
+        index->max_entries = n;
+    }
+
+    uint32_t current = blr_gtid_file_no(router->binlog_name);
+
+    for (int i = 0; i < n; i++)
+    {
+        BLR_GTID_ENTRY *entry = &index->entries[i];
+
+        blr_gtid_decode(data + i * BLR_GTID_ENTRY_LEN, entry);
+
+        if (entry->file_no > current ||
+            (entry->file_no == current && entry->pos >= router->current_pos))
+        {
+            MXS_WARNING("%s: GTID index entries from %u-%u-%lu onwards point beyond the "
+                        "end of binlog file '%s' and are removed.",
+                        router->service->name, entry->domain, entry->server_id,
+                        entry->seq, router->binlog_name);
+            break;
+        }
+
+        index->n_entries++;
+    }
+
+    MXS_FREE(data);
+
+    if (statb.st_size != index->n_entries * BLR_GTID_ENTRY_LEN &&
+        ftruncate(fd, index->n_entries * BLR_GTID_ENTRY_LEN) == -1)
+    {
+        char err_msg[MXS_STRERROR_BUFLEN];
+        MXS_ERROR("%s: Failed to truncate GTID index '%s': %s", router->service->name,
+                  path, strerror_r(errno, err_msg, sizeof(err_msg)));
+        MXS_FREE(index->entries);
+        MXS_FREE(index);
+        close(fd);
+        return;
+    }
+
+    /* Continue the indexing of the domains from their latest entries */
+    for (int i = 0; i < index->n_entries; i++)
+    {
+        BLR_GTID_DOMAIN *domain = blr_gtid_get_domain(index, index->entries[i].domain);
+
+        if (domain)
+        {
+            domain->file_no = index->entries[i].file_no;
+            domain->skipped = 0;
+        }
+    }
+
+    index->fd = fd;
+    index->interval = router->gtid_index_interval;
+    spinlock_init(&index->lock);
+
+    router->gtid_index = index;
+
+    MXS_NOTICE("%s: Loaded %d entries of GTID index '%s'.",
+               router->service->name, index->n_entries, path);
+}
+
+/**
+ * Index a MariaDB 10 GTID event written to the current binlog file.
+ *
+ * Called by the master thread only, after the event has been written.
+ *
+ * @param router    The router instance
+ * @param hdr       The header of the event
+ * @param pos       The position of the event in the current binlog file
+ * @param buf       The event, header included
+ */
+void
+blr_gtid_index_add(ROUTER_INSTANCE *router, const REP_HEADER *hdr, unsigned long pos, uint8_t *buf)
+{
+    BLR_GTID_INDEX *index = router->gtid_index;
+    uint8_t *ptr = buf + BINLOG_EVENT_HDR_LEN;
+    BLR_GTID_ENTRY entry;
+
+    if (index == NULL || hdr->event_size < BINLOG_EVENT_HDR_LEN + 8 + 4)
+    {
+        return;
+    }
+
+    entry.seq = gw_mysql_get_byte8(ptr);
+    entry.domain = gw_mysql_get_byte4(ptr + 8);
+    entry.server_id = hdr->serverid;
+    entry.file_no = blr_gtid_file_no(router->binlog_name);
+    entry.pos = pos;
+
+    BLR_GTID_DOMAIN *domain = blr_gtid_get_domain(index, entry.domain);
+
+    if (domain == NULL)
+    {
+        return;
+    }
+
+    if (domain->file_no == entry.file_no && ++domain->skipped < index->interval)
+    {
+        return;
+    }
+
+    if (blr_gtid_append(index, &entry))
+    {
+        domain->file_no = entry.file_no;
+        domain->skipped = 0;
+    }
+}
+
+/**
+ * Find the GTID index entry from where to scan the binlog files for a GTID.
+ *
+ * @param router    The router instance
+ * @param domain    The domain of the GTID
+ * @param seq       The sequence number of the GTID
+ * @param entry     On success, the last entry of the domain with a
+ *                  sequence number not greater than seq
+ * @return          True if such an entry exists
+ */
+bool
+blr_gtid_index_find(ROUTER_INSTANCE *router, uint32_t domain, uint64_t seq, BLR_GTID_ENTRY *entry)
+{
+    BLR_GTID_INDEX *index = router->gtid_index;
+    bool found = false;
+
+    if (index == NULL)
+    {
+        return false;
+    }
+
+    spinlock_acquire(&index->lock);
+
+    /* The slaves are usually not far behind, so search from the end */
+    for (int i = index->n_entries - 1; i >= 0; i--)
+    {
+        if (index->entries[i].domain == domain && index->entries[i].seq <= seq)
+        {
+            *entry = index->entries[i];
+            found = true;
+            break;
+        }
+    }
+
+    spinlock_release(&index->lock);
+
+    return found;
+}
+
+/**
+ * Append an entry to the GTID index
+ *
+ * @param index     The GTID index
+ * @param entry     The entry to add
+ * @return          True if the entry was added
+ */
+static bool
+blr_gtid_append(BLR_GTID_INDEX *index, const BLR_GTID_ENTRY *entry)
+{
+    uint8_t data[BLR_GTID_ENTRY_LEN];
+
+    if (index->n_entries == index->max_entries)
+    {
+        int max_entries = index->max_entries ? 2 * index->max_entries : 1024;
+        BLR_GTID_ENTRY *entries = (BLR_GTID_ENTRY *)MXS_MALLOC(max_entries * sizeof(BLR_GTID_ENTRY));
+
+        if (entries == NULL)
+        {
+            return false;
+        }
+
+        /* The lookups only copy entries, so a new array is swapped in */
+        spinlock_acquire(&index->lock);
+        memcpy(entries, index->entries, index->n_entries * sizeof(BLR_GTID_ENTRY));
+        BLR_GTID_ENTRY *old_entries = index->entries;
+        index->entries = entries;
+        index->max_entries = max_entries;
+        spinlock_release(&index->lock);
+
+        MXS_FREE(old_entries);
+    }
+
+    if (index->fd != -1)
+    {
+        blr_gtid_encode(data, entry);
+
+        if (write(index->fd, data, BLR_GTID_ENTRY_LEN) != BLR_GTID_ENTRY_LEN)
+        {
+            char err_msg[MXS_STRERROR_BUFLEN];
+            MXS_ERROR("Failed to write to the GTID index, the index is no longer "
+                      "updated on disk: %s", strerror_r(errno, err_msg, sizeof(err_msg)));
+            close(index->fd);
+            index->fd = -1;
+        }
+    }
+
+    spinlock_acquire(&index->lock);
+    index->entries[index->n_entries++] = *entry;
+    spinlock_release(&index->lock);
+
+    return true;
+}
+
+/**
+ * Get the indexing state of a domain, adding the domain if it is new
+ *
+ * @param index     The GTID index
+ * @param domain    The domain id
+ * @return          The state of the domain or NULL if memory allocation fails
+ */
+static BLR_GTID_DOMAIN *
+blr_gtid_get_domain(BLR_GTID_INDEX *index, uint32_t domain)
+{
+    for (int i = 0; i < index->n_domains; i++)
+    {
+        if (index->domains[i].domain == domain)
+        {
+            return &index->domains[i];
+        }
+    }
+
+    BLR_GTID_DOMAIN *domains = (BLR_GTID_DOMAIN *)MXS_REALLOC(index->domains,
+                                                               (index->n_domains + 1) *
+                                                               sizeof(BLR_GTID_DOMAIN));
+
+    if (domains == NULL)
+    {
+        return NULL;
+    }
+
+    index->domains = domains;
+
+    BLR_GTID_DOMAIN *rval = &domains[index->n_domains++];
+    rval->domain = domain;
+    /* No binlog file has number 0, so the first transaction gets an entry */
+    rval->file_no = 0;
+    rval->skipped = 0;
+
+    return rval;
+}
+
+/**
+ * Get the number of a binlog file from its name, e.g. 12 for mysql-bin.000012
+ *
+ * @param binlog    The name of the binlog file
+ * @return          The number of the file
+ */
+static uint32_t
+blr_gtid_file_no(const char *binlog)
+{
+    const char *dot = strrchr(binlog, '.');
+
+    return dot ? strtoul(dot + 1, NULL, 10) : 0;
+}
+
+static void
+blr_gtid_encode(uint8_t *data, const BLR_GTID_ENTRY *entry)
+{
+    gw_mysql_set_byte4(data, entry->domain);
+    gw_mysql_set_byte4(data + 4, entry->server_id);
+    gw_mysql_set_byte4(data + 8, (uint32_t)entry->seq);
+    gw_mysql_set_byte4(data + 12, (uint32_t)(entry->seq >> 32));
+    gw_mysql_set_byte4(data + 16, entry->file_no);
+    gw_mysql_set_byte4(data + 20, (uint32_t)entry->pos);
+    gw_mysql_set_byte4(data + 24, (uint32_t)(entry->pos >> 32));
+}
+
+static void
+blr_gtid_decode(const uint8_t *data, BLR_GTID_ENTRY *entry)
+{
+    entry->domain = gw_mysql_get_byte4(data);
+    entry->server_id = gw_mysql_get_byte4(data + 4);
+    entry->seq = gw_mysql_get_byte8(data + 8);
+    entry->file_no = gw_mysql_get_byte4(data + 16);
+    entry->pos = gw_mysql_get_byte8(data + 20);
+}
@@ -81,6 +81,7 @@
 /* Temporary requirement for auth data */
 #include <maxscale/protocol/mysql.h>
 #include <maxscale/alloc.h>
+#include <maxscale/utils.h>
 
 
 
@@ -102,8 +103,8 @@ static void blr_check_last_master_event(void *inst);
 extern int blr_check_heartbeat(ROUTER_INSTANCE *router);
 static void blr_log_identity(ROUTER_INSTANCE *router);
 static void blr_extract_header_semisync(uint8_t *pkt, REP_HEADER *hdr);
-static int blr_send_semisync_ack (ROUTER_INSTANCE *router, uint64_t pos);
 static int blr_get_master_semisync(GWBUF *buf);
+static void blr_master_semisync_ack(ROUTER_INSTANCE *router, uint64_t *ack_pos, uint64_t req_us);
 
 static void blr_terminate_master_replication(ROUTER_INSTANCE *router, uint8_t* ptr, int len);
 void blr_notify_all_slaves(ROUTER_INSTANCE *router);
@@ -1017,7 +1018,7 @@ static bool verify_checksum(ROUTER_INSTANCE *router, size_t len, uint8_t *ptr)
     uint32_t offset = MYSQL_HEADER_LEN + 1;
     uint32_t size = len - (offset + MYSQL_CHECKSUM_LEN);
 
-    uint32_t checksum = crc32(0L, ptr + offset, size);
+    uint32_t checksum = mxs_crc32(0, ptr + offset, size);
     uint32_t pktsum = EXTRACT32(ptr + offset + size);
 
     if (pktsum != checksum)
@@ -1083,6 +1084,8 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
     int check_packet_len;
     int semisync_bytes;
     int semi_sync_send_ack = 0;
+    uint64_t ack_pos = 0;
+    uint64_t ack_req_us = 0;
 
     /*
      * Loop over all the packets while we still have some data
@@ -1555,6 +1558,9 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
                         /* Check for rotate event */
                         if (hdr.event_type == ROTATE_EVENT)
                         {
+                            /* The ACK names the binlog file, send it before the rotation */
+                            blr_master_semisync_ack(router, &ack_pos, ack_req_us);
+
                             if (!blr_rotate_event(router, ptr + offset, &hdr))
                             {
                                 gwbuf_free(pkt);
@@ -1577,8 +1583,21 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
                                       router->service->dbref->server->name,
                                       router->service->dbref->server->port);
 
-                            /* Send Semi-Sync ACK packet to master server */
-                            blr_send_semisync_ack(router, hdr.next_pos);
+                            if (router->sync_running)
+                            {
+                                /* The sync thread sends it, when the event is on disk */
+                                blr_file_semisync_request(router, hdr.next_pos);
+                            }
+                            else
+                            {
+                                /* One ACK, for the last requested event, is sent after the read */
+                                if (ack_pos == 0)
+                                {
+                                    ack_req_us = mxs_clock_us();
+                                }
+                                ack_pos = hdr.next_pos;
+                                atomic_add_uint64(&router->stats.n_semisync_reqs, 1);
+                            }
 
                             /* Reset ACK sending */
                             semi_sync_send_ack = 0;
@@ -1598,8 +1617,11 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
 
                             spinlock_release(&router->binlog_lock);
 
-                            /* Notify clients events can be read */
-                            blr_notify_all_slaves(router);
+                            /* Notify clients events can be read, unless they wait for a sync */
+                            if (!router->sync_running)
+                            {
+                                blr_notify_all_slaves(router);
+                            }
                         }
                         else
                         {
@@ -1616,8 +1638,11 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
                             {
                                 spinlock_release(&router->binlog_lock);
 
-                                /* Notify clients events can be read */
-                                blr_notify_all_slaves(router);
+                                /* Notify clients events can be read, unless they wait for a sync */
+                                if (!router->sync_running)
+                                {
+                                    blr_notify_all_slaves(router);
+                                }
 
                                 /* update binlog_position and set pending to 0 */
                                 spinlock_acquire(&router->binlog_lock);
@@ -1647,6 +1672,8 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
                         ptr += MYSQL_HEADER_LEN + 1;
                         if (hdr.event_type == ROTATE_EVENT)
                         {
+                            blr_master_semisync_ack(router, &ack_pos, ack_req_us);
+
                             spinlock_acquire(&router->binlog_lock);
                             router->rotating = 1;
                             spinlock_release(&router->binlog_lock);
@@ -1678,7 +1705,14 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
         }
     }
 
-    blr_file_flush(router);
+    if (ack_pos)
+    {
+        blr_master_semisync_ack(router, &ack_pos, ack_req_us);
+    }
+    else
+    {
+        blr_file_flush(router);
+    }
 }
 
 /**
@@ -2542,8 +2576,7 @@ blr_extract_header_semisync(register uint8_t *ptr, register REP_HEADER *hdr)
  * @param pos The binlog position for the ACK reply.
  * @return 1 if the packect is sent, 0 on errors
  */
-
-static int
+int
 blr_send_semisync_ack(ROUTER_INSTANCE *router, uint64_t pos)
 {
     int seqno = 0;
@@ -2583,6 +2616,41 @@ blr_send_semisync_ack(ROUTER_INSTANCE *router, uint64_t pos)
     return 1;
 }
 
+/**
+ * Send the semi-sync ACK that was requested during a read from the master,
+ * when there is no sync thread to send it. The binlog file is flushed first,
+ * so that with binlog_sync=read the ACK is sent only for synced events.
+ *
+ * @param router  The router instance
+ * @param ack_pos The position to acknowledge, or 0 if there is none; reset
+ * @param req_us  When the first of the coalesced requests arrived
+ */
+static void
+blr_master_semisync_ack(ROUTER_INSTANCE *router, uint64_t *ack_pos, uint64_t req_us)
+{
+    if (*ack_pos)
+    {
+        blr_file_flush(router);
+
+        uint64_t durable_us = mxs_clock_us();
+
+        if (router->binlog_sync == BLR_SYNC_READ)
+        {
+            histogram_add(&router->semisync_durable_latency, durable_us - req_us);
+        }
+
+        if (blr_send_semisync_ack(router, *ack_pos))
+        {
+            uint64_t now = mxs_clock_us();
+            histogram_add(&router->semisync_ack_latency, now - durable_us);
+            histogram_add(&router->semisync_total_latency, now - req_us);
+            atomic_add_uint64(&router->stats.n_semisync_acks, 1);
+        }
+
+        *ack_pos = 0;
+    }
+}
+
 /**
  * Check the master semisync capability.
  *
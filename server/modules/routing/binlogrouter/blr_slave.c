@@ -104,7 +104,10 @@ static void blr_slave_send_error(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, c
 static int blr_slave_send_timestamp(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave);
 static int blr_slave_register(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, GWBUF *queue);
 static int blr_slave_binlog_dump(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, GWBUF *queue);
+static bool blr_slave_set_gtid(ROUTER_SLAVE *slave, char *value);
+static bool blr_slave_gtid_start(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, char *errmsg);
 int blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large);
+static long blr_slave_catchup_budget(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave);
 uint8_t *blr_build_header(GWBUF *pkt, REP_HEADER *hdr);
 int blr_slave_callback(DCB *dcb, DCB_REASON reason, void *data);
 static int blr_slave_fake_rotate(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, BLFILE** filep);
@@ -165,6 +168,8 @@ static int blr_slave_send_heartbeat(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave
 static int blr_set_master_ssl(ROUTER_INSTANCE *router, CHANGE_MASTER_OPTIONS config, char *error_message);
 static int blr_slave_read_ste(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, uint32_t fde_end_pos);
 static GWBUF *blr_slave_read_fde(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave);
+static void blr_slave_catchup_bulk(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, BLFILE *file,
+                                   int *burst, long *burst_size, REP_HEADER *hdr);
 
 void poll_fake_write_event(DCB *dcb);
 
@@ -784,6 +789,31 @@ blr_slave_query(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, GWBUF *queue)
             MXS_FREE(query_text);
             return blr_slave_replay(router, slave, router->saved_master.chksum1);
         }
+        else if (strcasecmp(word, "@slave_connect_state") == 0)
+        {
+            /* The GTID position of a MariaDB 10 slave using MASTER_USE_GTID */
+            char *value = strtok_r(NULL, sep, &brkb);
+            bool single = value && strtok_r(NULL, sep, &brkb) == NULL;
+            bool rval = single && blr_slave_set_gtid(slave, value);
+
+            MXS_FREE(query_text);
+
+            if (!rval)
+            {
+                blr_slave_send_error(router, slave,
+                                     "Only a single GTID, one domain, is supported "
+                                     "in @slave_connect_state by the MaxScale binlog router.");
+                return 1;
+            }
+
+            return blr_slave_send_ok(router, slave);
+        }
+        else if ((strcasecmp(word, "@slave_gtid_strict_mode") == 0) ||
+                 (strcasecmp(word, "@slave_gtid_ignore_duplicates") == 0))
+        {
+            MXS_FREE(query_text);
+            return blr_slave_send_ok(router, slave);
+        }
         else if (strcasecmp(word, "@slave_uuid") == 0)
         {
             if ((word = strtok_r(NULL, sep, &brkb)) != NULL)
@@ -1947,6 +1977,7 @@ blr_slave_register(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, GWBUF *queue)
         return 0;
     }
     slave->serverid = extract_field(ptr, 32);
+    slave->filter = blr_filter_find(router, slave->serverid);
     ptr += 4;
     slen = *ptr++;
     if (slen != 0)
@@ -1990,6 +2021,160 @@ blr_slave_register(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, GWBUF *queue)
     return blr_slave_send_ok(router, slave);
 }
 
+/**
+ * Set the GTID a MariaDB 10 slave registers with, from @slave_connect_state
+ *
+ * @param slave     The slave server
+ * @param value     The quoted GTID, e.g. '0-1-100', or '' if the slave
+ *                  has no GTID position
+ * @return          True if the value is a single GTID or empty
+ */
+static bool
+blr_slave_set_gtid(ROUTER_SLAVE *slave, char *value)
+{
+    unsigned int domain, server_id;
+    unsigned long seq;
+    char end;
+    int len = strlen(value);
+
+    if (len >= 2 && value[0] == '\'' && value[len - 1] == '\'')
+    {
+        value[len - 1] = '\0';
+        value++;
+    }
+
+    if (*value == '\0')
+    {
+        slave->gtid_requested = false;
+        return true;
+    }
+
+    if (sscanf(value, "%u-%u-%lu%c", &domain, &server_id, &seq, &end) != 3)
+    {
+        return false;
+    }
+
+    slave->gtid_requested = true;
+    slave->gtid_domain = domain;
+    slave->gtid_server_id = server_id;
+    slave->gtid_seq = seq;
+
+    return true;
+}
+
+/**
+ * Find where a slave registering with a MariaDB 10 GTID starts: the GTID
+ * event of the next transaction of the domain of the GTID.
+ *
+ * The binlog is scanned from the closest preceding entry of the GTID
+ * index. If the transaction of the GTID is the last one of its binlog
+ * file, the slave starts from the beginning of the next file, or from the
+ * end of the current file.
+ *
+ * @param router    The router instance
+ * @param slave     The slave server, whose binlog file and position are set
+ * @param errmsg    BINLOG_ERROR_MSG_LEN + 1 bytes for the error message
+ * @return          True if the start position was found
+ */
+static bool
+blr_slave_gtid_start(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, char *errmsg)
+{
+    BLR_GTID_ENTRY entry;
+    char binlog[BINLOG_FNAMELEN + 1];
+    BLFILE *file;
+    unsigned long pos;
+    bool found = false;
+    bool rval = false;
+
+    if (router->encryption.enabled)
+    {
+        snprintf(errmsg, BINLOG_ERROR_MSG_LEN,
+                 "Registering with a GTID is not supported with encrypted binlogs");
+        return false;
+    }
+
+    if (!blr_gtid_index_find(router, slave->gtid_domain, slave->gtid_seq, &entry))
+    {
+        snprintf(errmsg, BINLOG_ERROR_MSG_LEN,
+                 "GTID %u-%u-%lu is not in the GTID index of the binlog files",
+                 slave->gtid_domain, slave->gtid_server_id, slave->gtid_seq);
+        return false;
+    }
+
+    snprintf(binlog, sizeof(binlog), BINLOG_NAMEFMT, router->fileroot, entry.file_no);
+
+    if ((file = blr_open_binlog(router, binlog)) == NULL)
+    {
+        snprintf(errmsg, BINLOG_ERROR_MSG_LEN, "Failed to open binlog file '%s'", binlog);
+        return false;
+    }
+
+    pos = entry.pos;
+
+    while (!found)
+    {
+        REP_HEADER hdr;
+        char read_errmsg[BINLOG_ERROR_MSG_LEN + 1];
+        GWBUF *record;
+
+        read_errmsg[BINLOG_ERROR_MSG_LEN] = '\0';
+
+        if ((record = blr_read_binlog(router, file, pos, &hdr, read_errmsg, NULL)) == NULL)
+        {
+            if (hdr.ok != SLAVE_POS_READ_OK && hdr.ok != SLAVE_POS_READ_UNSAFE)
+            {
+                strcpy(errmsg, read_errmsg);
+                break;
+            }
+
+            /**
+             * The end of the file. If the file has been rotated, the next
+             * transaction is in the next file. Starting from an unsafe
+             * position of the current file is dealt with as usual.
+             */
+            found = true;
+
+            spinlock_acquire(&router->binlog_lock);
+            if (strcmp(router->binlog_name, binlog) != 0)
+            {
+                snprintf(binlog, sizeof(binlog), BINLOG_NAMEFMT,
+                         router->fileroot, entry.file_no + 1);
+                pos = 4;
+            }
+            spinlock_release(&router->binlog_lock);
+        }
+        else
+        {
+            if (hdr.event_type == MARIADB10_GTID_EVENT &&
+                hdr.event_size >= BINLOG_EVENT_HDR_LEN + 8 + 4)
+            {
+                uint8_t *ptr = GWBUF_DATA(record) + BINLOG_EVENT_HDR_LEN;
+
+                found = gw_mysql_get_byte4(ptr + 8) == slave->gtid_domain &&
+                        gw_mysql_get_byte8(ptr) > slave->gtid_seq;
+            }
+
+            gwbuf_free(record);
+
+            if (!found)
+            {
+                pos += hdr.event_size;
+            }
+        }
+    }
+
+    blr_close_binlog(router, file);
+
+    if (found)
+    {
+        strcpy(slave->binlogfile, binlog);
+        slave->binlog_pos = pos;
+        rval = true;
+    }
+
+    return rval;
+}
+
 /**
  * Process a COM_BINLOG_DUMP message from the slave. This is the
  * final step in the process of registration. The new master, MaxScale
@@ -2053,6 +2238,42 @@ blr_slave_binlog_dump(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, GWBUF *queue
     memcpy(slave->binlogfile, (char *)ptr, binlognamelen);
     slave->binlogfile[binlognamelen] = 0;
 
+    /* A MariaDB 10 slave using its GTID sends no binlog file name */
+    if (slave->gtid_requested && binlognamelen == 0)
+    {
+        char errmsg[BINLOG_ERROR_MSG_LEN + 1];
+
+        if (!blr_slave_gtid_start(router, slave, errmsg))
+        {
+            MXS_ERROR("%s: Slave %s:%i, server-id %d, cannot register with GTID %u-%u-%lu: %s",
+                      router->service->name,
+                      slave->dcb->remote,
+                      dcb_get_port(slave->dcb),
+                      slave->serverid,
+                      slave->gtid_domain,
+                      slave->gtid_server_id,
+                      slave->gtid_seq,
+                      errmsg);
+
+            blr_send_custom_error(slave->dcb, slave->seqno++, 0, errmsg, "HY000", 1236);
+            return 1;
+        }
+
+        binlognamelen = strlen(slave->binlogfile);
+
+        MXS_INFO("%s: Slave %s:%i, server-id %d, registering with GTID %u-%u-%lu, "
+                 "starts from binlog '%s' at %lu.",
+                 router->service->name,
+                 slave->dcb->remote,
+                 dcb_get_port(slave->dcb),
+                 slave->serverid,
+                 slave->gtid_domain,
+                 slave->gtid_server_id,
+                 slave->gtid_seq,
+                 slave->binlogfile,
+                 (unsigned long)slave->binlog_pos);
+    }
+
     if (router->trx_safe)
     {
         /**
@@ -2138,8 +2359,7 @@ blr_slave_binlog_dump(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, GWBUF *queue
          * include the length, sequence number and ok byte that makes up the first
          * 5 bytes of the message. We also do not include the 4 byte checksum itself.
          */
-        chksum = crc32(0L, NULL, 0);
-        chksum = crc32(chksum, GWBUF_DATA(resp) + 5, hdr.event_size - 4);
+        chksum = mxs_crc32(0, GWBUF_DATA(resp) + 5, hdr.event_size - 4);
         encode_value(ptr, chksum, 32);
     }
 
@@ -2260,6 +2480,255 @@ blr_build_header(GWBUF  *pkt, REP_HEADER *hdr)
     return ptr;
 }
 
+/**
+ * Send a range of complete events of an unencrypted binlog file to a slave
+ * that is lagging behind, with a single read and a single write.
+ *
+ * The events are read from the file with one blr_file_pread() of at most burst_size
+ * bytes and sent as they are on disk, each in its own MySQL packet, in one
+ * buffer. Events the slave does not want are skipped. Whatever needs more
+ * than passing the bytes through, i.e. rotate and start encryption events,
+ * events that do not fit in one packet or do not look valid, is left to the
+ * event by event processing in blr_slave_catchup(), which is also what is
+ * done if anything fails here.
+ *
+ * @param router        The binlog router
+ * @param slave         The slave that is behind
+ * @param file          The binlog file the slave is reading
+ * @param burst         The number of events that can still be sent, updated
+ * @param burst_size    The number of bytes that can still be sent, updated
+ * @param hdr           Replication header, ok is set if events are sent
+ */
+static void
+blr_slave_catchup_bulk(ROUTER_INSTANCE *router,
+                       ROUTER_SLAVE *slave,
+                       BLFILE *file,
+                       int *burst,
+                       long *burst_size,
+                       REP_HEADER *hdr)
+{
+    unsigned long pos = slave->binlog_pos;
+    unsigned long end;
+
+    /* Only complete transactions of the current binlog file can be sent */
+    spinlock_acquire(&router->binlog_lock);
+    if (strcmp(router->binlog_name, slave->binlogfile) == 0)
+    {
+        end = blr_file_safe_position(router);
+    }
+    else
+    {
+        end = blr_file_size(file);
+    }
+    spinlock_release(&router->binlog_lock);
+
+    if (end <= pos + BINLOG_EVENT_HDR_LEN || *burst_size <= 0)
+    {
+        return;
+    }
+
+    size_t len = MXS_MIN(end - pos, (unsigned long)*burst_size);
+    uint8_t *data = MXS_MALLOC(len);
+
+    if (data == NULL)
+    {
+        return;
+    }
+
+    ssize_t n = blr_file_pread(file, data, len, pos);
+
+    if (n <= 0)
+    {
+        MXS_FREE(data);
+        return;
+    }
+
+    len = n;
+
+    /* Find the events that can be sent and the size of the packets */
+    size_t offset = 0;
+    size_t out_len = 0;
+    int n_events = 0;
+    int n_skipped = 0;
+    uint32_t last_pos = pos;
+
+    while (n_events < *burst && offset + BINLOG_EVENT_HDR_LEN <= len)
+    {
+        uint8_t *ev = data + offset;
+        uint8_t event_type = ev[4];
+        uint32_t event_size = extract_field(&ev[9], 32);
+        uint32_t next_pos = EXTRACT32(&ev[13]);
+
+        if (event_size < BINLOG_EVENT_HDR_LEN ||
+            offset + event_size > len ||
+            next_pos != pos + offset + event_size ||
+            event_size + 1 >= MYSQL_PACKET_LENGTH_MAX ||
+            event_type > (router->mariadb10_compat ? MAX_EVENT_TYPE_MARIADB10 : MAX_EVENT_TYPE) ||
+            event_type == ROTATE_EVENT ||
+            event_type == MARIADB10_START_ENCRYPTION_EVENT)
+        {
+            break;
+        }
+
+        if (event_type != IGNORABLE_EVENT &&
+            (slave->annotate_rows || event_type != MARIADB_ANNOTATE_ROWS_EVENT))
+        {
+            out_len += MYSQL_HEADER_LEN + 1 + event_size;
+            last_pos = pos + offset;
+            n_events++;
+        }
+        else
+        {
+            n_skipped++;
+        }
+
+        offset += event_size;
+    }
+
+    GWBUF *buffer = NULL;
+
+    if (n_events > 0 && (buffer = gwbuf_alloc(out_len)) == NULL)
+    {
+        MXS_FREE(data);
+        return;
+    }
+
+    if (buffer)
+    {
+        uint8_t *ptr = GWBUF_DATA(buffer);
+        size_t i = 0;
+
+        while (i < offset)
+        {
+            uint8_t *ev = data + i;
+            uint8_t event_type = ev[4];
+            uint32_t event_size = extract_field(&ev[9], 32);
+
+            if (event_type != IGNORABLE_EVENT &&
+                (slave->annotate_rows || event_type != MARIADB_ANNOTATE_ROWS_EVENT))
+            {
+                encode_value(ptr, event_size + 1, 24);
+                ptr += 3;
+                *ptr++ = slave->seqno++;
+                *ptr++ = 0; // OK byte
+
+                /* The data was read for this slave only, it can be changed */
+                if (blr_filter_skip(router, slave, ev))
+                {
+                    blr_filter_replace(router, ev);
+                }
+
+                memcpy(ptr, ev, event_size);
+                ptr += event_size;
+            }
+
+            i += event_size;
+        }
+
+        ss_dassert(ptr == GWBUF_DATA(buffer) + out_len);
+
+        slave->stats.n_bytes += out_len;
+        slave->dcb->func.write(slave->dcb, buffer);
+
+        slave->stats.n_events += n_events;
+        *burst -= n_events;
+        *burst_size -= out_len;
+
+        /* What blr_send_event() records, for the last event sent */
+        strcpy(slave->lsi_binlog_name, slave->binlogfile);
+        slave->lsi_binlog_pos = last_pos;
+        slave->lsi_sender_role = BLR_THREAD_ROLE_SLAVE;
+        slave->lsi_sender_tid = thread_self();
+
+        /* set lastReply for slave heartbeat check */
+        if (router->send_slave_heartbeat)
+        {
+            slave->lastReply = time(0);
+        }
+    }
+
+    MXS_FREE(data);
+
+    if (n_events > 0 || n_skipped > 0)
+    {
+        slave->binlog_pos = pos + offset;
+        hdr->ok = SLAVE_POS_READ_OK;
+    }
+}
+
+/**
+ * Update whether a slave is lagging, i.e. whether its last catchup burst
+ * ended before it had been sent all the events there are. The lagging
+ * slaves are counted for the thread that first found the slave lagging.
+ *
+ * Only called by the thread that is doing the catchup of the slave, or
+ * when the slave session is freed.
+ *
+ * @param router    The binlog router
+ * @param slave     The slave
+ * @param lagging   Whether the slave is lagging
+ */
+void
+blr_slave_set_lagging(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool lagging)
+{
+    if (router->lagging_slaves == NULL)
+    {
+        return;
+    }
+
+    if (lagging && slave->lagging_thread == -1)
+    {
+        slave->lagging_thread = slave->dcb->thread.id < router->n_threads ?
+                                slave->dcb->thread.id : 0;
+        atomic_add(&router->lagging_slaves[slave->lagging_thread], 1);
+    }
+    else if (!lagging && slave->lagging_thread != -1)
+    {
+        atomic_add(&router->lagging_slaves[slave->lagging_thread], -1);
+        slave->lagging_thread = -1;
+    }
+}
+
+/**
+ * The number of bytes a slave may be sent in a catchup burst. A thread
+ * sends at most catchup_budget bytes in one round to all the lagging slaves
+ * it serves, but at least BLR_MIN_CATCHUP_BUDGET bytes to each of them and
+ * at most burstsize bytes to any one of them. As the catchups are done one
+ * burst at a time from the queue of the thread, the slaves that are not
+ * lagging are never kept waiting for longer than roughly one round.
+ *
+ * @param router    The binlog router
+ * @param slave     The slave that is behind
+ * @return          The number of bytes the slave may be sent
+ */
+static long
+blr_slave_catchup_budget(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave)
+{
+    long budget = router->burst_size;
+
+    if (router->catchup_budget > 0 && router->n_threads > 0)
+    {
+        int thread = slave->lagging_thread;
+        int n_lagging;
+
+        if (thread == -1)
+        {
+            /* A slave starting a catchup is counted as lagging */
+            thread = slave->dcb->thread.id < router->n_threads ? slave->dcb->thread.id : 0;
+            n_lagging = router->lagging_slaves[thread] + 1;
+        }
+        else
+        {
+            n_lagging = MXS_MAX(router->lagging_slaves[thread], 1);
+        }
+
+        budget = MXS_MIN(budget, (long)(router->catchup_budget / n_lagging));
+        budget = MXS_MAX(budget, MXS_MIN(BLR_MIN_CATCHUP_BUDGET, (long)router->burst_size));
+    }
+
+    return budget;
+}
+
 /**
  * We have a registered slave that is behind the current leading edge of the
  * binlog. We must replay the log entries to bring this node up to speed.
@@ -2289,7 +2758,7 @@ blr_build_header(GWBUF  *pkt, REP_HEADER *hdr)
 int
 blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large)
 {
-    GWBUF *record;
+    GWBUF *record = NULL;
     REP_HEADER hdr;
     int rval = 1, burst;
     int rotating = 0;
@@ -2307,7 +2776,7 @@ blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large)
         burst = router->short_burst;
     }
 
-    burst_size = router->burst_size;
+    burst_size = large ? blr_slave_catchup_budget(router, slave) : router->burst_size;
 
     int do_return;
 
@@ -2326,6 +2795,9 @@ blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large)
 
     if (do_return)
     {
+        /* The slave has all that can be sent */
+        blr_slave_set_lagging(router, slave, false);
+
         spinlock_acquire(&slave->catch_lock);
         slave->cstate &= ~CS_BUSY;
         slave->cstate |= CS_EXPECTCB;
@@ -2385,6 +2857,12 @@ blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large)
 #endif
     int events_before = slave->stats.n_events;
 
+    /* A slave far behind is first sent as many events as possible at once */
+    if (large && slave->encryption_ctx == NULL && !router->encryption.enabled)
+    {
+        blr_slave_catchup_bulk(router, slave, file, &burst, &burst_size, &hdr);
+    }
+
     while (burst-- && burst_size > 0 &&
            (record = blr_read_binlog(router, file, slave->binlog_pos, &hdr, read_errmsg, slave->encryption_ctx)) != NULL)
     {
@@ -2523,8 +3001,23 @@ blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large)
             }
         }
 
-        if (blr_send_event(BLR_THREAD_ROLE_SLAVE, binlog_name, binlog_pos,
-                           slave, &hdr, (uint8_t*) record->start))
+        uint8_t *event = GWBUF_DATA(record);
+        uint8_t *replaced = NULL;
+
+        /* The record may be shared with the event cache, the replacement is a copy */
+        if (blr_filter_skip(router, slave, event) &&
+            (replaced = MXS_MALLOC(hdr.event_size)) != NULL)
+        {
+            memcpy(replaced, event, hdr.event_size);
+            blr_filter_replace(router, replaced);
+            event = replaced;
+        }
+
+        bool sent = blr_send_event(BLR_THREAD_ROLE_SLAVE, binlog_name, binlog_pos,
+                                   slave, &hdr, event);
+        MXS_FREE(replaced);
+
+        if (sent)
         {
             if (hdr.event_type != ROTATE_EVENT)
             {
@@ -2560,6 +3053,12 @@ blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large)
         }
     }
 
+    /*
+     * A slave that used up its budget has more to read: it shares the
+     * budget of its thread with the other lagging slaves from now on.
+     */
+    blr_slave_set_lagging(router, slave, burst < 0 || burst_size <= 0);
+
     /**
      * End of while reading
      * Checking last buffer first
@@ -2658,7 +3157,7 @@ blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large)
         /* force slave to read events via catchup routine */
         poll_fake_write_event(slave->dcb);
     }
-    else if (slave->binlog_pos == router->binlog_position &&
+    else if (slave->binlog_pos == blr_file_safe_position(router) &&
              strcmp(slave->binlogfile, router->binlog_name) == 0)
     {
         spinlock_acquire(&router->binlog_lock);
@@ -2668,7 +3167,7 @@ blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large)
          * Now check again since we hold the router->binlog_lock
          * and slave->catch_lock.
          */
-        if (slave->binlog_pos != router->binlog_position ||
+        if (slave->binlog_pos != blr_file_safe_position(router) ||
             strcmp(slave->binlogfile, router->binlog_name) != 0)
         {
             slave->cstate |= CS_EXPECTCB;
@@ -2915,8 +3414,7 @@ blr_slave_fake_rotate(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, BLFILE** fil
          * include the length, sequence number and ok byte that makes up the first
          * 5 bytes of the message. We also do not include the 4 byte checksum itself.
          */
-        chksum = crc32(0L, NULL, 0);
-        chksum = crc32(chksum, GWBUF_DATA(resp) + 5, hdr.event_size - 4);
+        chksum = mxs_crc32(0, GWBUF_DATA(resp) + 5, hdr.event_size - 4);
         encode_value(ptr, chksum, 32);
     }
 
@@ -3019,8 +3517,7 @@ blr_slave_send_fde(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, GWBUF *fde)
      * and write it into the header
      */
     ptr = GWBUF_DATA(fde) + event_size - BINLOG_EVENT_CRC_SIZE;
-    chksum = crc32(0L, NULL, 0);
-    chksum = crc32(chksum, GWBUF_DATA(fde), event_size - BINLOG_EVENT_CRC_SIZE);
+    chksum = mxs_crc32(0, GWBUF_DATA(fde), event_size - BINLOG_EVENT_CRC_SIZE);
     encode_value(ptr, chksum, 32);
 
     return slave->dcb->func.write(slave->dcb, head);
@@ -3990,6 +4487,7 @@ int blr_handle_change_master(ROUTER_INSTANCE* router, char *command, char *error
 
             /* close current file binlog file, next start slave will create the new one */
             fsync(router->binlog_fd);
+            blr_file_sync_switch(router, -1);
             close(router->binlog_fd);
             router->binlog_fd = -1;
 
@@ -5697,8 +6195,7 @@ blr_slave_send_heartbeat(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave)
     /* Add the CRC32 */
     if (!slave->nocrc)
     {
-        chksum = crc32(0L, NULL, 0);
-        chksum = crc32(chksum, GWBUF_DATA(resp) + 5, hdr.event_size - 4);
+        chksum = mxs_crc32(0, GWBUF_DATA(resp) + 5, hdr.event_size - 4);
         encode_value(ptr, chksum, 32);
     }
 
@@ -17,6 +17,7 @@
  * This utility checks a MySQL 5.6 and MariaDB 10.0.X binlog file and reports
  * any found error or an incomplete transaction.
  * It suggests the pos the file should be trucatetd at.
+ * Several files can be given, which are checked in parallel with -j.
  *
  * @verbatim
  * Revision History
@@ -46,15 +47,41 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
 #include <maxscale/log_manager.h>
+#include <maxscale/thread.h>
 
+/** The options that apply to all the binlog files checked */
+typedef struct
+{
+    int  debug_out;
+    int  fix_file;
+    int  mariadb10_compat;
+    char *key_file;
+    char *aes_algo;
+    int  report_header;
+} CHECK_OPTIONS;
+
+/** The binlog files to check, shared by the checking threads */
+typedef struct
+{
+    const CHECK_OPTIONS *options;
+    char **files;
+    int  n_files;
+    int  next;      /*< The next file to check */
+    int  n_failed;  /*< The number of files that failed the check */
+} CHECK_QUEUE;
 
 static void printVersion(const char *progname);
 static void printUsage(const char *progname);
 static int set_encryption_options(ROUTER_INSTANCE *inst, char *key_file, char *aes_algo);
+static int check_file(const char *file, const CHECK_OPTIONS *options);
+static void check_thread(void *data);
 
 static struct option long_options[] =
 {
@@ -65,6 +92,7 @@ static struct option long_options[] =
     {"header",    no_argument, 0, 'H'},
     {"key_file",  required_argument, 0, 'K'},
     {"aes_algo",  required_argument, 0, 'A'},
+    {"jobs",      required_argument, 0, 'j'},
     {"help",      no_argument, 0, '?'},
     {0, 0, 0, 0}
 };
@@ -80,39 +108,43 @@ maxscale_uptime()
 int main(int argc, char **argv)
 {
     int option_index = 0;
-    int debug_out = 0;
-    int fix_file = 0;
-    int mariadb10_compat = 0;
-    char *key_file = NULL;
-    char *aes_algo = NULL;
-    int report_header = 0;
+    CHECK_OPTIONS options = {0};
+    int n_jobs = 1;
     int c;
 
-    while ((c = getopt_long(argc, argv, "dVfMHK:A:?", long_options, &option_index)) >= 0)
+    while ((c = getopt_long(argc, argv, "dVfMHK:A:j:?", long_options, &option_index)) >= 0)
     {
         switch (c)
         {
         case 'd':
-            debug_out = 1;
+            options.debug_out = 1;
             break;
         case 'H':
-            report_header = BLR_REPORT_REP_HEADER;
+            options.report_header = BLR_REPORT_REP_HEADER;
             break;
         case 'V':
             printVersion(*argv);
             exit(EXIT_SUCCESS);
             break;
         case 'f':
-            fix_file = 1;
+            options.fix_file = 1;
             break;
         case 'M':
-            mariadb10_compat = 1;
+            options.mariadb10_compat = 1;
             break;
         case 'K':
-            key_file = optarg;
+            options.key_file = optarg;
             break;
         case 'A':
-            aes_algo = optarg;
+            options.aes_algo = optarg;
+            break;
+        case 'j':
+            n_jobs = atoi(optarg);
+            if (n_jobs <= 0)
+            {
+                printf("ERROR: The number of jobs must be a positive number.\n");
+                exit(EXIT_FAILURE);
+            }
             break;
         case '?':
             printUsage(*argv);
@@ -128,15 +160,104 @@ int main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
-    size_t len = strlen(argv[num_args]);
+    // We ignore potential errors.
+    mxs_log_init(NULL, NULL, MXS_LOG_TARGET_DEFAULT);
+    mxs_log_set_augmentation(0);
+    mxs_log_set_priority_enabled(LOG_DEBUG, options.debug_out);
+
+    MXS_NOTICE("maxbinlogcheck %s", binlog_check_version);
+
+    CHECK_QUEUE queue;
+    queue.options = &options;
+    queue.files = argv + num_args;
+    queue.n_files = argc - num_args;
+    queue.next = 0;
+    queue.n_failed = 0;
+
+    n_jobs = MXS_MIN(n_jobs, queue.n_files);
+
+    if (n_jobs == 1)
+    {
+        check_thread(&queue);
+    }
+    else
+    {
+        THREAD threads[n_jobs];
+        int n_started = 0;
+
+        for (int i = 0; i < n_jobs; i++)
+        {
+            if (thread_start(&threads[n_started], check_thread, &queue) != NULL)
+            {
+                n_started++;
+            }
+        }
+
+        if (n_started == 0)
+        {
+            /* Check in this thread instead */
+            check_thread(&queue);
+        }
+
+        for (int i = 0; i < n_started; i++)
+        {
+            thread_wait(threads[i]);
+        }
+    }
+
+    if (queue.n_files > 1)
+    {
+        MXS_NOTICE("Checked %d binlog files, %d failed.", queue.n_files, queue.n_failed);
+    }
+
+    mxs_log_flush_sync();
+    mxs_log_finish();
+
+    return queue.n_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/**
+ * A checking thread: checks the binlog files of the queue until there
+ * are no more left.
+ *
+ * @param data  The queue of files
+ */
+static void
+check_thread(void *data)
+{
+    CHECK_QUEUE *queue = (CHECK_QUEUE *)data;
+    int i;
+
+    while ((i = atomic_add(&queue->next, 1)) < queue->n_files)
+    {
+        if (check_file(queue->files[i], queue->options))
+        {
+            atomic_add(&queue->n_failed, 1);
+        }
+    }
+}
+
+/**
+ * Check a binlog file. Unless the file is to be fixed, it is read through
+ * a read-only mapping of the whole file, so that the events are copied
+ * from memory instead of being read with one system call each.
+ *
+ * @param file     The binlog file
+ * @param options  The options of the check
+ * @return         0 if the file is fine, 1 if not or if it could not be checked
+ */
+static int
+check_file(const char *file, const CHECK_OPTIONS *options)
+{
+    size_t len = strlen(file);
     if (len > PATH_MAX)
     {
         printf("ERROR: The length of the provided path exceeds %d characters.\n", PATH_MAX);
-        exit(EXIT_FAILURE);
+        return 1;
     }
 
     char path[PATH_MAX + 1];
-    strcpy(path, argv[num_args]);
+    strcpy(path, file);
 
     char *name = strrchr(path, '/');
     if (name)
@@ -153,36 +274,67 @@ int main(int argc, char **argv)
     {
         printf("ERROR: The length of the binlog filename is 0 or exceeds %d characters.\n",
                BINLOG_FNAMELEN);
-        exit(EXIT_FAILURE);
+        return 1;
     }
 
     ROUTER_INSTANCE *inst = (ROUTER_INSTANCE*)MXS_CALLOC(1, sizeof(ROUTER_INSTANCE));
     if (!inst)
     {
-        exit(EXIT_FAILURE);
+        return 1;
     }
 
-    int fd = open(path, fix_file ? O_RDWR : O_RDONLY, 0666);
+    int fd = open(path, options->fix_file ? O_RDWR : O_RDONLY, 0666);
     if (fd == -1)
     {
         printf("ERROR: Failed to open binlog file %s: %s.\n",
                path, strerror(errno));
         MXS_FREE(inst);
-        mxs_log_flush_sync();
-        mxs_log_finish();
-        exit(EXIT_FAILURE);
+        return 1;
+    }
+
+    /* A compressed binlog file is checked as a decompressed temporary copy */
+    BLR_ZFILE *zfile = blr_zfile_open(fd);
+    bool compressed = zfile != NULL;
+    if (compressed)
+    {
+        blr_zfile_free(zfile);
+
+        FILE *tmp = NULL;
+        if (options->fix_file)
+        {
+            printf("ERROR: The compressed binlog file %s cannot be fixed.\n", path);
+        }
+        else if ((tmp = tmpfile()) == NULL || !blr_zfile_decompress(fd, fileno(tmp)))
+        {
+            printf("ERROR: Failed to decompress binlog file %s.\n", path);
+        }
+
+        close(fd);
+        fd = tmp && !options->fix_file ? dup(fileno(tmp)) : -1;
+
+        if (tmp)
+        {
+            fclose(tmp);
+        }
+
+        if (fd == -1)
+        {
+            MXS_FREE(inst);
+            return 1;
+        }
     }
 
     inst->binlog_fd = fd;
-    inst->mariadb10_compat = mariadb10_compat;
+    inst->mariadb10_compat = options->mariadb10_compat;
+    inst->verify_checksums = true;
     strcpy(inst->binlog_name, name);
 
-    // We ignore potential errors.
-    mxs_log_init(NULL, NULL, MXS_LOG_TARGET_DEFAULT);
-    mxs_log_set_augmentation(0);
-    mxs_log_set_priority_enabled(LOG_DEBUG, debug_out);
-
-    MXS_NOTICE("maxbinlogcheck %s", binlog_check_version);
+    /* The binlog file name is without the suffix of a compressed file */
+    char *suffix = strrchr(inst->binlog_name, '.');
+    if (compressed && suffix && strcmp(suffix, BLR_COMPRESSED_SUFFIX) == 0)
+    {
+        *suffix = '\0';
+    }
 
     unsigned long filelen = 0;
     struct stat statb;
@@ -192,30 +344,43 @@ int main(int argc, char **argv)
     }
 
     /* If encryption options are in use check  and use them */
-    if (set_encryption_options(inst, key_file, aes_algo))
+    if (set_encryption_options(inst, options->key_file, options->aes_algo))
     {
+        close(inst->binlog_fd);
         MXS_FREE(inst);
-        mxs_log_flush_sync();
-        mxs_log_finish();
-        exit(EXIT_FAILURE);
+        return 1;
+    }
+
+    /* A file that is fixed may be truncated while it is read */
+    if (!options->fix_file && filelen > 0)
+    {
+        void *map = mmap(NULL, filelen, PROT_READ, MAP_PRIVATE, inst->binlog_fd, 0);
+
+        if (map != MAP_FAILED)
+        {
+            madvise(map, filelen, MADV_SEQUENTIAL);
+            inst->binlog_map = map;
+            inst->binlog_map_len = filelen;
+        }
     }
 
     MXS_NOTICE("Checking %s (%s), size %lu bytes", path, inst->binlog_name, filelen);
 
     /* read binary log */
-    int ret = blr_read_events_all_events(inst, fix_file, debug_out | report_header);
-
-    mxs_log_flush_sync();
+    int ret = blr_read_events_all_events(inst, options->fix_file,
+                                         options->debug_out | options->report_header);
 
     MXS_NOTICE("Check retcode: %i, Binlog Pos = %lu", ret, inst->binlog_position);
 
+    if (inst->binlog_map)
+    {
+        munmap((void *)inst->binlog_map, inst->binlog_map_len);
+    }
     close(inst->binlog_fd);
+    MXS_FREE(inst->encryption_ctx);
     MXS_FREE(inst);
 
-    mxs_log_flush_sync();
-    mxs_log_finish();
-
-    return 0;
+    return ret ? 1 : 0;
 }
 
 /**
@@ -236,14 +401,16 @@ printUsage(const char *progname)
     printVersion(progname);
 
     printf("The MaxScale binlog check utility.\n\n");
-    printf("Usage: %s [-f] [-d] [-v] [<binlog file>]\n\n", progname);
+    printf("Usage: %s [-f] [-d] [-v] [-j N] <binlog file> [<binlog file>...]\n\n", progname);
     printf("  -f|--fix          Fix binlog file, require write permissions (truncate)\n");
+    printf("                    Compressed binlog files are checked, but cannot be fixed\n");
     printf("  -d|--debug        Print debug messages\n");
     printf("  -M|--mariadb10    MariaDB 10 binlog compatibility\n");
     printf("  -V|--version      Print version information and exit\n");
     printf("  -K|--key_file     AES Key file for MariaDB 10.1 binlog file decryption\n");
     printf("  -A|--aes_algo     AES Algorithm for MariaDB 10.1 binlog file decryption (default=AES_CBC, AES_CTR)\n");
     printf("  -H|--header       Print content of binlog event header\n");
+    printf("  -j|--jobs         Number of binlog files checked in parallel (default=1)\n");
     printf("  -?|--help         Print this help text\n");
 }
 
@@ -55,12 +55,14 @@
 #include <maxscale/version.h>
 #include <debugcli.h>
 
+#include "../../../core/maxscale/alloc.h"
 #include "../../../core/maxscale/config_runtime.h"
 #include "../../../core/maxscale/maxscale.h"
 #include "../../../core/maxscale/modules.h"
 #include "../../../core/maxscale/monitor.h"
 #include "../../../core/maxscale/poll.h"
 #include "../../../core/maxscale/session.h"
+#include "../../../core/maxscale/trace.h"
 
 #define MAXARGS 14
 
@@ -102,6 +104,25 @@ static void showVersion(DCB *dcb)
     dcb_printf(dcb, "%s\n", MAXSCALE_VERSION);
 }
 
+static bool show_spinlock_cb(const char *name, const SPINLOCK *lock, void *data)
+{
+    uint64_t acquired = lock->acquired;
+    uint64_t contended = lock->contended;
+
+    dcb_printf((DCB*)data, " %-20s | %15lu | %15lu | %6.2f%% | %15lu\n", name,
+               acquired, contended, acquired ? contended * 100.0 / acquired : 0.0,
+               lock->wait_ns / 1000);
+    return true;
+}
+
+static void showSpinlocks(DCB *dcb)
+{
+    dcb_printf(dcb, " %-20s | %15s | %15s | %7s | %15s\n",
+               "Lock", "Acquired", "Contended", "Ratio", "Wait time (us)");
+    dcb_printf(dcb, "----------------------+-----------------+-----------------+---------+----------------\n");
+    spinlock_foreach_registered(show_spinlock_cb, dcb);
+}
+
 /**
  * The subcommands of the show command
  */
@@ -179,6 +200,12 @@ struct subcommand showoptions[] =
         "Usage: show log_throttling",
         {0}
     },
+    {
+        "memory", 0, 0, dprintMemory,
+        "Show the memory allocator statistics and the memory used by each module",
+        "Usage: show memory",
+        {0}
+    },
     {
         "modules", 0, 0, dprintAllModules,
         "Show all currently loaded modules",
@@ -270,6 +297,12 @@ struct subcommand showoptions[] =
         "Usage: show sessions",
         {0}
     },
+    {
+        "spinlocks", 0, 0, showSpinlocks,
+        "Show the contention statistics of the registered spinlocks",
+        "Usage: show spinlocks",
+        {0}
+    },
     {
         "tasks", 0, 0, hkshow_tasks,
         "Show all active housekeeper tasks in MaxScale",
@@ -282,6 +315,12 @@ struct subcommand showoptions[] =
         "Usage: show threads",
         {0}
     },
+    {
+        "traces", 0, 0, dprintTraces,
+        "Show the most recent traced statements",
+        "Usage: show traces",
+        {0}
+    },
     {
         "users", 0, 0, telnetdShowUsers,
         "Show enabled Linux accounts",
@@ -596,6 +635,7 @@ struct subcommand restartoptions[] =
 static void set_server(DCB *dcb, SERVER *server, char *bit);
 static void set_pollsleep(DCB *dcb, int);
 static void set_nbpoll(DCB *dcb, int);
+static void set_threads(DCB *dcb, int);
 static void set_log_throttling(DCB *dcb, int count, int window_ms, int suppress_ms);
 /**
  * The subcommands of the set command
@@ -640,6 +680,21 @@ struct subcommand setoptions[] =
         "Example: set nbpolls 5",
         {ARG_TYPE_NUMERIC}
     },
+    {
+        "threads", 1, 1, set_threads,
+        "Set the number of active polling threads",
+        "Usage: set threads VALUE\n"
+        "\n"
+        "Parameters:\n"
+        "VALUE  Number of active polling threads\n"
+        "\n"
+        "Sets the number of polling threads that sessions are placed on. The value\n"
+        "can be at most the value of threads_max. The sessions of the threads that\n"
+        "are deactivated are moved to the active threads when they are idle.\n"
+        "\n"
+        "Example: set threads 4",
+        {ARG_TYPE_NUMERIC}
+    },
     {
         "log_throttling", 3, 3, set_log_throttling,
         "Set the log throttling configuration",
@@ -1495,6 +1550,9 @@ struct subcommand alteroptions[] =
         "ssl_verify_peer_certificate Peer certificate verification\n"
         "persistpoolmax              Persisted connection pool size\n"
         "persistmaxtime              Persisted connection maximum idle time\n"
+        "persistpoolmin              Persisted connections kept per thread\n"
+        "max_concurrent_queries      Maximum number of concurrent queries\n"
+        "max_queue_time              Milliseconds a query may wait for a free slot\n"
         "\n"
         "To configure SSL for a newly created server, the 'ssl', 'ssl_cert',\n"
         "'ssl_key' and 'ssl_ca_cert' parameters must be given at the same time.\n"
@@ -1523,6 +1581,8 @@ struct subcommand alteroptions[] =
         "backend_connect_timeout Server coneection timeout in seconds\n"
         "backend_write_timeout   Server write timeout in seconds\n"
         "backend_read_timeout    Server read timeout in seconds\n"
+        "load_metrics            Sample the load of the servers (true or false)\n"
+        "journal_max_age         Maximum age of the monitor journal in seconds\n"
         "\n"
         "This will alter an existing parameter of a monitor. To remove parameters,\n"
         "pass an empty value for a key e.g. 'maxadmin alter monitor my-monitor my-key='\n"
@@ -2397,6 +2457,22 @@ set_nbpoll(DCB *dcb, int nb)
     poll_set_nonblocking_polls(nb);
 }
 
+/**
+ * Set the number of active polling threads
+ *
+ * @param       dcb             DCB for output
+ * @param       nthr            Number of threads
+ */
+static void
+set_threads(DCB *dcb, int nthr)
+{
+    if (!poll_set_active_threads(nthr))
+    {
+        dcb_printf(dcb, "Invalid number of threads: %d. The value must be between 1 and %d.\n",
+                   nthr, config_threadcount());
+    }
+}
+
 static void
 set_log_throttling(DCB *dcb, int count, int window_ms, int suppress_ms)
 {
@@ -50,10 +50,13 @@
 #include <maxscale/secrets.h>
 #include <maxscale/users.h>
 
+#include "../../../core/maxscale/alloc.h"
+#include "../../../core/maxscale/metrics.h"
 #include "../../../core/maxscale/modules.h"
 #include "../../../core/maxscale/monitor.h"
 #include "../../../core/maxscale/session.h"
 #include "../../../core/maxscale/poll.h"
+#include "../../../core/maxscale/trace.h"
 
 extern char *create_hex_sha1_sha1_passwd(char *passwd);
 
@@ -193,6 +196,8 @@ newSession(MXS_ROUTER *instance, MXS_SESSION *session)
     client->session = session;
     client->dcb = session->client_dcb;
     client->queue = NULL;
+    client->stream = NULL;
+    client->streaming = false;
 
     spinlock_acquire(&inst->lock);
     client->next = inst->sessions;
@@ -217,6 +222,7 @@ closeSession(MXS_ROUTER *instance, MXS_ROUTER_SESSION *router_session)
     INFO_INSTANCE *inst = (INFO_INSTANCE *)instance;
     INFO_SESSION *session = (INFO_SESSION *)router_session;
 
+    maxinfo_stream_end(session, false);
 
     spinlock_acquire(&inst->lock);
     if (inst->sessions == session)
@@ -328,6 +334,10 @@ execute(MXS_ROUTER *rinstance, MXS_ROUTER_SESSION *router_session, GWBUF *queue)
     {
         return handle_url(instance, session, queue);
     }
+
+    /** The result of the previous command is completed before the next one */
+    maxinfo_stream_end(session, true);
+
     if (session->queue)
     {
         queue = gwbuf_append(session->queue, queue);
@@ -693,6 +703,9 @@ static struct uri_table
     { "/variables", maxinfo_variables },
     { "/status", maxinfo_status },
     { "/event/times", eventTimesGetList },
+    { "/event/latency", eventLatencyGetList },
+    { "/traces", traceGetList },
+    { "/memory", memoryGetList },
     { NULL, NULL }
 };
 
@@ -712,6 +725,18 @@ handle_url(INFO_INSTANCE *instance, INFO_SESSION *session, GWBUF *queue)
     RESULTSET *set;
 
     uri = (char *)GWBUF_DATA(queue);
+
+    if (strcmp(uri, "/metrics") == 0)
+    {
+        /** The metrics are not a resultset, they are sent in one write */
+        GWBUF *metrics = metrics_collect();
+
+        if (metrics)
+        {
+            session->dcb->func.write(session->dcb, metrics);
+        }
+    }
+
     for (i = 0; supported_uri[i].uri; i++)
     {
         if (strcmp(uri, supported_uri[i].uri) == 0)
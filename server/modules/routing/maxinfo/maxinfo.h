@@ -31,6 +31,7 @@
 #include <maxscale/cdefs.h>
 #include <maxscale/service.h>
 #include <maxscale/session.h>
+#include <maxscale/resultset.h>
 #include <maxscale/spinlock.h>
 
 MXS_BEGIN_DECLS
@@ -61,6 +62,8 @@ typedef struct maxinfo_session
     MXS_SESSION    *session;   /*< The MaxScale session */
     DCB            *dcb;       /*< DCB of the client side */
     GWBUF          *queue;     /*< Queue for building contiguous requests */
+    RESULTSET      *stream;    /*< Result set that is being streamed to the client */
+    bool           streaming;  /*< A chunk of the result set is being sent */
     struct maxinfo_session
         *next;      /*< The next pointer for the list of sessions */
 } INFO_SESSION;
@@ -83,7 +86,10 @@ typedef enum
     MAXOP_SET,
     MAXOP_CLEAR,
     MAXOP_SHUTDOWN,
-    MAXOP_RESTART
+    MAXOP_RESTART,
+    MAXOP_WHERE,
+    MAXOP_ORDER,
+    MAXOP_LIMIT
 } MAXINFO_OPERATOR;
 
 /**
@@ -125,6 +131,12 @@ typedef struct maxinfo_tree
 #define LT_CLEAR        12
 #define LT_SHUTDOWN     13
 #define LT_RESTART      14
+#define LT_WHERE        15
+#define LT_ORDER        16
+#define LT_BY           17
+#define LT_ASC          18
+#define LT_DESC         19
+#define LT_LIMIT        20
 
 
 /**
@@ -135,6 +147,7 @@ typedef enum
     PARSE_NOERROR,
     PARSE_MALFORMED_SHOW,
     PARSE_EXPECTED_LIKE,
+    PARSE_MALFORMED_CLAUSE,
     PARSE_SYNTAX_ERROR
 } PARSE_ERROR;
 
@@ -147,6 +160,7 @@ extern void         maxinfo_send_parse_error(DCB *, char *, PARSE_ERROR);
 extern void     maxinfo_send_error(DCB *, int, char  *);
 extern RESULTSET    *maxinfo_variables();
 extern RESULTSET    *maxinfo_status();
+extern void         maxinfo_stream_end(INFO_SESSION *, bool);
 
 MXS_END_DECLS
 
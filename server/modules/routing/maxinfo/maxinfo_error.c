@@ -63,6 +63,10 @@ maxinfo_send_parse_error(DCB *dcb, char *sql, PARSE_ERROR err)
     case PARSE_MALFORMED_SHOW:
         desc = "Expected show <command> [like <pattern>]";
         break;
+    case PARSE_MALFORMED_CLAUSE:
+        desc = "Expected show <command> [like <pattern>] [where <column> = <value>] "
+               "[order by <column> [asc|desc]] [limit <count>]";
+        break;
     case PARSE_EXPECTED_LIKE:
         desc = "Expected LIKE <pattern>";
         break;
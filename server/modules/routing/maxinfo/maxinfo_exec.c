@@ -30,6 +30,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+#include <limits.h>
 
 #include <maxscale/alloc.h>
 #include <maxscale/atomic.h>
@@ -39,22 +40,25 @@
 #include <maxscale/maxscale.h>
 #include <maxscale/modinfo.h>
 #include <maxscale/modutil.h>
+#include <maxscale/poll.h>
 #include <maxscale/resultset.h>
 #include <maxscale/router.h>
 #include <maxscale/service.h>
 #include <maxscale/spinlock.h>
 #include <maxscale/version.h>
 
+#include "../../../core/maxscale/alloc.h"
 #include "../../../core/maxscale/maxscale.h"
 #include "../../../core/maxscale/modules.h"
 #include "../../../core/maxscale/monitor.h"
 #include "../../../core/maxscale/poll.h"
 #include "../../../core/maxscale/session.h"
+#include "../../../core/maxscale/trace.h"
 
 static void exec_show(DCB *dcb, MAXINFO_TREE *tree);
 static void exec_select(DCB *dcb, MAXINFO_TREE *tree);
-static void exec_show_variables(DCB *dcb, MAXINFO_TREE *filter);
-static void exec_show_status(DCB *dcb, MAXINFO_TREE *filter);
+static void exec_show_variables(DCB *dcb, MAXINFO_TREE *tree);
+static void exec_show_status(DCB *dcb, MAXINFO_TREE *tree);
 static int maxinfo_pattern_match(char *pattern, char *str);
 static void exec_flush(DCB *dcb, MAXINFO_TREE *tree);
 static void exec_set(DCB *dcb, MAXINFO_TREE *tree);
@@ -107,11 +111,174 @@ maxinfo_execute(DCB *dcb, MAXINFO_TREE *tree)
     }
 }
 
+/**
+ * Write queue size above which the next chunk of a result set is not
+ * sent until the client has read some of the data
+ */
+#define MAXINFO_STREAM_QUEUE_MAX (64 * 1024)
+
+/**
+ * Apply the where, order by and limit clauses of a show command to a
+ * result set
+ *
+ * @param dcb   The client DCB, errors are sent to it
+ * @param set   The result set
+ * @param tree  The show command
+ * @return True if the clauses were valid
+ */
+static bool
+maxinfo_apply_clauses(DCB *dcb, RESULTSET *set, MAXINFO_TREE *tree)
+{
+    char errmsg[120];
+
+    for (MAXINFO_TREE *clause = tree->left; clause; clause = clause->left)
+    {
+        int col = -1;
+
+        if (clause->op != MAXOP_LIMIT && (col = resultset_column_index(set, clause->value)) == -1)
+        {
+            snprintf(errmsg, sizeof(errmsg), "Unknown column '%.80s'", clause->value);
+            maxinfo_send_error(dcb, 0, errmsg);
+            return false;
+        }
+
+        switch (clause->op)
+        {
+        case MAXOP_WHERE:
+            if (!resultset_set_where(set, col, clause->right->value))
+            {
+                maxinfo_send_error(dcb, 0, "No resources available");
+                return false;
+            }
+            break;
+
+        case MAXOP_ORDER:
+            resultset_set_order(set, col, clause->right &&
+                                strcasecmp(clause->right->value, "desc") == 0);
+            break;
+
+        case MAXOP_LIMIT:
+            {
+                char *end;
+                long limit = strtol(clause->value, &end, 10);
+
+                if (*end || limit < 0 || limit > INT_MAX)
+                {
+                    snprintf(errmsg, sizeof(errmsg), "Invalid limit '%.80s'", clause->value);
+                    maxinfo_send_error(dcb, 0, errmsg);
+                    return false;
+                }
+                resultset_set_limit(set, limit);
+            }
+            break;
+
+        default:
+            ss_dassert(!true);
+            break;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * DCB callback that sends the next chunk of the result set being streamed
+ * once the client has read the previous ones
+ */
+static int
+maxinfo_stream_cb(DCB *dcb, DCB_REASON reason, void *userdata)
+{
+    INFO_SESSION *session = (INFO_SESSION *)userdata;
+
+    /** The chunk is written from within the callback, which calls it again */
+    if (!session->streaming && session->stream && dcb->writeqlen < MAXINFO_STREAM_QUEUE_MAX)
+    {
+        session->streaming = true;
+
+        if (resultset_stream_mysql_chunk(session->stream, dcb, RESULTSET_CHUNK_ROWS))
+        {
+            maxinfo_stream_end(session, false);
+        }
+        else if (dcb->writeqlen == 0)
+        {
+            poll_fake_write_event(dcb);
+        }
+
+        session->streaming = false;
+    }
+
+    return 1;
+}
+
+/**
+ * Stream a result set of a show command to the client. Large result sets
+ * are sent in chunks from the event loop so that the other clients of the
+ * thread are served in between.
+ *
+ * @param dcb   The client DCB
+ * @param set   The result set, freed once it has been sent
+ * @param tree  The show command
+ */
+static void
+maxinfo_stream(DCB *dcb, RESULTSET *set, MAXINFO_TREE *tree)
+{
+    INFO_SESSION *session = dcb->session ? dcb->session->router_session : NULL;
+
+    if (!maxinfo_apply_clauses(dcb, set, tree))
+    {
+        resultset_free(set);
+    }
+    else if (session == NULL || session->stream)
+    {
+        resultset_stream_mysql(set, dcb);
+        resultset_free(set);
+    }
+    else if (resultset_stream_mysql_chunk(set, dcb, RESULTSET_CHUNK_ROWS))
+    {
+        resultset_free(set);
+    }
+    else if (dcb_add_callback(dcb, DCB_REASON_DRAINED, maxinfo_stream_cb, session))
+    {
+        session->stream = set;
+        poll_fake_write_event(dcb);
+    }
+    else
+    {
+        resultset_stream_mysql(set, dcb);
+        resultset_free(set);
+    }
+}
+
+/**
+ * Stop streaming a result set to the client
+ *
+ * @param session  The maxinfo session
+ * @param send     Whether the rest of the result set is sent before
+ *                 the next command is executed
+ */
+void
+maxinfo_stream_end(INFO_SESSION *session, bool send)
+{
+    if (session->stream)
+    {
+        RESULTSET *set = session->stream;
+        session->stream = NULL;
+
+        if (send)
+        {
+            resultset_stream_mysql(set, session->dcb);
+        }
+
+        dcb_remove_callback(session->dcb, DCB_REASON_DRAINED, maxinfo_stream_cb, session);
+        resultset_free(set);
+    }
+}
+
 /**
  * Fetch the list of services and stream as a result set
  *
  * @param dcb   DCB to which to stream result set
- * @param tree  Potential like clause (currently unused)
+ * @param tree  The show command with its optional clauses
  */
 static void
 exec_show_services(DCB *dcb, MAXINFO_TREE *tree)
@@ -123,15 +290,14 @@ exec_show_services(DCB *dcb, MAXINFO_TREE *tree)
         return;
     }
 
-    resultset_stream_mysql(set, dcb);
-    resultset_free(set);
+    maxinfo_stream(dcb, set, tree);
 }
 
 /**
  * Fetch the list of listeners and stream as a result set
  *
  * @param dcb   DCB to which to stream result set
- * @param tree  Potential like clause (currently unused)
+ * @param tree  The show command with its optional clauses
  */
 static void
 exec_show_listeners(DCB *dcb, MAXINFO_TREE *tree)
@@ -143,15 +309,14 @@ exec_show_listeners(DCB *dcb, MAXINFO_TREE *tree)
         return;
     }
 
-    resultset_stream_mysql(set, dcb);
-    resultset_free(set);
+    maxinfo_stream(dcb, set, tree);
 }
 
 /**
  * Fetch the list of sessions and stream as a result set
  *
  * @param dcb   DCB to which to stream result set
- * @param tree  Potential like clause (currently unused)
+ * @param tree  The show command with its optional clauses
  */
 static void
 exec_show_sessions(DCB *dcb, MAXINFO_TREE *tree)
@@ -163,15 +328,14 @@ exec_show_sessions(DCB *dcb, MAXINFO_TREE *tree)
         return;
     }
 
-    resultset_stream_mysql(set, dcb);
-    resultset_free(set);
+    maxinfo_stream(dcb, set, tree);
 }
 
 /**
  * Fetch the list of client sessions and stream as a result set
  *
  * @param dcb   DCB to which to stream result set
- * @param tree  Potential like clause (currently unused)
+ * @param tree  The show command with its optional clauses
  */
 static void
 exec_show_clients(DCB *dcb, MAXINFO_TREE *tree)
@@ -183,15 +347,14 @@ exec_show_clients(DCB *dcb, MAXINFO_TREE *tree)
         return;
     }
 
-    resultset_stream_mysql(set, dcb);
-    resultset_free(set);
+    maxinfo_stream(dcb, set, tree);
 }
 
 /**
  * Fetch the list of servers and stream as a result set
  *
  * @param dcb   DCB to which to stream result set
- * @param tree  Potential like clause (currently unused)
+ * @param tree  The show command with its optional clauses
  */
 static void
 exec_show_servers(DCB *dcb, MAXINFO_TREE *tree)
@@ -203,15 +366,14 @@ exec_show_servers(DCB *dcb, MAXINFO_TREE *tree)
         return;
     }
 
-    resultset_stream_mysql(set, dcb);
-    resultset_free(set);
+    maxinfo_stream(dcb, set, tree);
 }
 
 /**
  * Fetch the list of modules and stream as a result set
  *
  * @param dcb   DCB to which to stream result set
- * @param tree  Potential like clause (currently unused)
+ * @param tree  The show command with its optional clauses
  */
 static void
 exec_show_modules(DCB *dcb, MAXINFO_TREE *tree)
@@ -223,15 +385,14 @@ exec_show_modules(DCB *dcb, MAXINFO_TREE *tree)
         return;
     }
 
-    resultset_stream_mysql(set, dcb);
-    resultset_free(set);
+    maxinfo_stream(dcb, set, tree);
 }
 
 /**
  * Fetch the list of monitors and stream as a result set
  *
  * @param dcb   DCB to which to stream result set
- * @param tree  Potential like clause (currently unused)
+ * @param tree  The show command with its optional clauses
  */
 static void
 exec_show_monitors(DCB *dcb, MAXINFO_TREE *tree)
@@ -243,15 +404,52 @@ exec_show_monitors(DCB *dcb, MAXINFO_TREE *tree)
         return;
     }
 
-    resultset_stream_mysql(set, dcb);
-    resultset_free(set);
+    maxinfo_stream(dcb, set, tree);
+}
+
+/**
+ * Fetch the most recent traced statements
+ *
+ * @param dcb   DCB to which to stream result set
+ * @param tree  The show command with its optional clauses
+ */
+static void
+exec_show_traces(DCB *dcb, MAXINFO_TREE *tree)
+{
+    RESULTSET *set;
+
+    if ((set = traceGetList()) == NULL)
+    {
+        return;
+    }
+
+    maxinfo_stream(dcb, set, tree);
+}
+
+/**
+ * Fetch the memory accounted to each allocation tag
+ *
+ * @param dcb   DCB to which to stream result set
+ * @param tree  The show command with its optional clauses
+ */
+static void
+exec_show_memory(DCB *dcb, MAXINFO_TREE *tree)
+{
+    RESULTSET *set;
+
+    if ((set = memoryGetList()) == NULL)
+    {
+        return;
+    }
+
+    maxinfo_stream(dcb, set, tree);
 }
 
 /**
  * Fetch the event times data
  *
  * @param dcb   DCB to which to stream result set
- * @param tree  Potential like clause (currently unused)
+ * @param tree  The show command with its optional clauses
  */
 static void
 exec_show_eventTimes(DCB *dcb, MAXINFO_TREE *tree)
@@ -263,8 +461,127 @@ exec_show_eventTimes(DCB *dcb, MAXINFO_TREE *tree)
         return;
     }
 
-    resultset_stream_mysql(set, dcb);
-    resultset_free(set);
+    maxinfo_stream(dcb, set, tree);
+}
+
+/** A snapshot of the statistics of the registered spinlocks */
+typedef struct
+{
+    const char *name;
+    uint64_t    acquired;
+    uint64_t    contended;
+    uint64_t    wait_ns;
+} SPINLOCK_ROW;
+
+typedef struct
+{
+    SPINLOCK_ROW *rows;
+    int           n_rows;
+    int           rowno;
+} SPINLOCK_LIST;
+
+static bool spinlock_list_cb(const char *name, const SPINLOCK *lock, void *data)
+{
+    SPINLOCK_LIST *list = (SPINLOCK_LIST *)data;
+    SPINLOCK_ROW *rows = MXS_REALLOC(list->rows, (list->n_rows + 1) * sizeof(SPINLOCK_ROW));
+
+    if (rows == NULL)
+    {
+        return false;
+    }
+
+    rows[list->n_rows].name = name;
+    rows[list->n_rows].acquired = lock->acquired;
+    rows[list->n_rows].contended = lock->contended;
+    rows[list->n_rows].wait_ns = lock->wait_ns;
+    list->rows = rows;
+    list->n_rows++;
+    return true;
+}
+
+/**
+ * Provide a row to the result set that defines the statistics of one spinlock
+ *
+ * @param set   The result set
+ * @param data  The snapshot of the spinlocks
+ * @return The next row or NULL
+ */
+static RESULT_ROW *
+spinlockRowCallback(RESULTSET *set, void *data)
+{
+    SPINLOCK_LIST *list = (SPINLOCK_LIST *)data;
+    char buf[40];
+    RESULT_ROW *row;
+
+    if (list->rowno >= list->n_rows)
+    {
+        MXS_FREE(list->rows);
+        MXS_FREE(list);
+        return NULL;
+    }
+
+    SPINLOCK_ROW *lock = &list->rows[list->rowno++];
+    row = resultset_make_row(set);
+    resultset_row_set(row, 0, lock->name);
+    snprintf(buf, sizeof(buf), "%" PRIu64, lock->acquired);
+    resultset_row_set(row, 1, buf);
+    snprintf(buf, sizeof(buf), "%" PRIu64, lock->contended);
+    resultset_row_set(row, 2, buf);
+    snprintf(buf, sizeof(buf), "%" PRIu64, lock->wait_ns / 1000);
+    resultset_row_set(row, 3, buf);
+    return row;
+}
+
+/**
+ * Fetch the contention statistics of the registered spinlocks
+ *
+ * @param dcb   DCB to which to stream result set
+ * @param tree  The show command with its optional clauses
+ */
+static void
+exec_show_spinlocks(DCB *dcb, MAXINFO_TREE *tree)
+{
+    SPINLOCK_LIST *list = (SPINLOCK_LIST *)MXS_CALLOC(1, sizeof(SPINLOCK_LIST));
+    RESULTSET *set;
+
+    if (list == NULL)
+    {
+        return;
+    }
+
+    spinlock_foreach_registered(spinlock_list_cb, list);
+
+    if ((set = resultset_create(spinlockRowCallback, list)) == NULL)
+    {
+        MXS_FREE(list->rows);
+        MXS_FREE(list);
+        return;
+    }
+
+    resultset_add_column(set, "Lock", 20, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Acquired", 20, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Contended", 20, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Wait_time_us", 20, COL_TYPE_VARCHAR);
+    maxinfo_stream(dcb, set, tree);
+}
+
+/**
+ * Fetch the event latency percentiles of each thread
+ *
+ * @param dcb   DCB to which to stream result set
+ * @param tree  The show command with its optional clauses
+ */
+static void
+exec_show_eventLatency(DCB *dcb, MAXINFO_TREE *tree)
+{
+    RESULTSET *set;
+
+    if ((set = eventLatencyGetList()) == NULL)
+    {
+        return;
+    }
+
+    maxinfo_stream(dcb, set, tree);
 }
 
 /**
@@ -286,6 +603,10 @@ static struct
     { "modules", exec_show_modules },
     { "monitors", exec_show_monitors },
     { "eventTimes", exec_show_eventTimes },
+    { "eventLatency", exec_show_eventLatency },
+    { "spinlocks", exec_show_spinlocks },
+    { "traces", exec_show_traces },
+    { "memory", exec_show_memory },
     { NULL, NULL }
 };
 
@@ -305,7 +626,7 @@ exec_show(DCB *dcb, MAXINFO_TREE *tree)
     {
         if (strcasecmp(show_commands[i].name, tree->value) == 0)
         {
-            (*show_commands[i].func)(dcb, tree->right);
+            (*show_commands[i].func)(dcb, tree);
             return;
         }
     }
@@ -878,6 +1199,7 @@ variable_row(RESULTSET *result, void *data)
         return row;
     }
     // We only get to this point once all variables have been printed
+    MXS_FREE(context->like);
     MXS_FREE(data);
     return NULL;
 }
@@ -886,11 +1208,12 @@ variable_row(RESULTSET *result, void *data)
  * Execute a show variables command applying an optional filter
  *
  * @param dcb     The DCB connected to the client
- * @param filter  A potential like clause or NULL
+ * @param tree    The show command with a potential like clause
  */
 static void
-exec_show_variables(DCB *dcb, MAXINFO_TREE *filter)
+exec_show_variables(DCB *dcb, MAXINFO_TREE *tree)
 {
+    MAXINFO_TREE *filter = tree->right;
     RESULTSET *result;
     VARCONTEXT *context;
 
@@ -901,7 +1224,12 @@ exec_show_variables(DCB *dcb, MAXINFO_TREE *filter)
 
     if (filter)
     {
-        context->like = filter->value;
+        /** The rows may be generated after the parse tree is freed */
+        if ((context->like = MXS_STRDUP(filter->value)) == NULL)
+        {
+            MXS_FREE(context);
+            return;
+        }
     }
     else
     {
@@ -912,13 +1240,13 @@ exec_show_variables(DCB *dcb, MAXINFO_TREE *filter)
     if ((result = resultset_create(variable_row, context)) == NULL)
     {
         maxinfo_send_error(dcb, 0, "No resources available");
+        MXS_FREE(context->like);
         MXS_FREE(context);
         return;
     }
     resultset_add_column(result, "Variable_name", 40, COL_TYPE_VARCHAR);
     resultset_add_column(result, "Value", 40, COL_TYPE_VARCHAR);
-    resultset_stream_mysql(result, dcb);
-    resultset_free(result);
+    maxinfo_stream(dcb, result, tree);
 }
 
 /**
@@ -1114,6 +1442,9 @@ static struct
     { "Max_event_queue_length", VT_INT, (STATSFUNC)maxinfo_max_event_queue_length },
     { "Max_event_queue_time", VT_INT, (STATSFUNC)maxinfo_max_event_queue_time },
     { "Max_event_execution_time", VT_INT, (STATSFUNC)maxinfo_max_event_exec_time },
+    { "Memory_allocator", VT_STRING, (STATSFUNC)mxs_allocator_name },
+    { "Memory_allocated", VT_INT, (STATSFUNC)mxs_allocator_allocated },
+    { "Memory_resident", VT_INT, (STATSFUNC)mxs_allocator_resident },
     { NULL, 0,  NULL }
 };
 
@@ -1160,6 +1491,7 @@ status_row(RESULTSET *result, void *data)
         return row;
     }
     // We only get to this point once all status elements have been printed
+    MXS_FREE(context->like);
     MXS_FREE(data);
     return NULL;
 }
@@ -1168,11 +1500,12 @@ status_row(RESULTSET *result, void *data)
  * Execute a show status command applying an optional filter
  *
  * @param dcb       The DCB connected to the client
- * @param filter    A potential like clause or NULL
+ * @param tree      The show command with a potential like clause
  */
 static void
-exec_show_status(DCB *dcb, MAXINFO_TREE *filter)
+exec_show_status(DCB *dcb, MAXINFO_TREE *tree)
 {
+    MAXINFO_TREE *filter = tree->right;
     RESULTSET *result;
     VARCONTEXT *context;
 
@@ -1183,7 +1516,12 @@ exec_show_status(DCB *dcb, MAXINFO_TREE *filter)
 
     if (filter)
     {
-        context->like = filter->value;
+        /** The rows may be generated after the parse tree is freed */
+        if ((context->like = MXS_STRDUP(filter->value)) == NULL)
+        {
+            MXS_FREE(context);
+            return;
+        }
     }
     else
     {
@@ -1194,13 +1532,13 @@ exec_show_status(DCB *dcb, MAXINFO_TREE *filter)
     if ((result = resultset_create(status_row, context)) == NULL)
     {
         maxinfo_send_error(dcb, 0, "No resources available");
+        MXS_FREE(context->like);
         MXS_FREE(context);
         return;
     }
     resultset_add_column(result, "Variable_name", 40, COL_TYPE_VARCHAR);
     resultset_add_column(result, "Value", 40, COL_TYPE_VARCHAR);
-    resultset_stream_mysql(result, dcb);
-    resultset_free(result);
+    maxinfo_stream(dcb, result, tree);
 }
 
 /**
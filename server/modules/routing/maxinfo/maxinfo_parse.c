@@ -47,6 +47,8 @@ void maxinfo_free_tree(MAXINFO_TREE *); // This function is needed by maxinfo.c
 static char *fetch_token(char *, int *, char **);
 static MAXINFO_TREE *parse_column_list(char **sql);
 static MAXINFO_TREE *parse_table_name(char **sql);
+static MAXINFO_TREE *parse_show_clauses(MAXINFO_TREE *tree, char *ptr, int token, char *text,
+                                        PARSE_ERROR *parse_error);
 MAXINFO_TREE* maxinfo_parse_literals(MAXINFO_TREE *tree, int min_args, char *ptr,
                                      PARSE_ERROR *parse_error);
 
@@ -89,7 +91,10 @@ maxinfo_parse(char *sql, PARSE_ERROR *parse_error)
                 {
                     tree->right = make_tree_node(MAXOP_LIKE,
                                                  text, NULL, NULL);
-                    return tree;
+                    if ((ptr = fetch_token(ptr, &token, &text)) == NULL)
+                    {
+                        return tree;
+                    }
                 }
                 else
                 {
@@ -99,6 +104,10 @@ maxinfo_parse(char *sql, PARSE_ERROR *parse_error)
                     return NULL;
                 }
             }
+            if (token == LT_WHERE || token == LT_ORDER || token == LT_LIMIT)
+            {
+                return parse_show_clauses(tree, ptr, token, text, parse_error);
+            }
             // Malformed show
             MXS_FREE(text);
             maxinfo_free_tree(tree);
@@ -182,6 +191,95 @@ maxinfo_parse(char *sql, PARSE_ERROR *parse_error)
     return NULL;
 }
 
+/**
+ * Parse the WHERE, ORDER BY and LIMIT clauses of a show command. The
+ * clauses are chained to the left of the show node:
+ *
+ *     show <command> [like <pattern>] [where <column> = <value>]
+ *         [order by <column> [asc|desc]] [limit <count>]
+ *
+ * @param tree          The show node, freed on error
+ * @param ptr           The position after the first clause keyword
+ * @param token         The first clause keyword
+ * @param text          The text of the keyword
+ * @param parse_error   Set on error
+ * @return  The show node or NULL on error
+ */
+static MAXINFO_TREE *
+parse_show_clauses(MAXINFO_TREE *tree, char *ptr, int token, char *text, PARSE_ERROR *parse_error)
+{
+    MAXINFO_TREE **next = &tree->left;
+    char *column = NULL;
+    char *value = NULL;
+
+    while (ptr)
+    {
+        MAXINFO_TREE *node = NULL;
+        int clause = token;
+        MXS_FREE(text);
+        text = NULL;
+
+        switch (clause)
+        {
+        case LT_WHERE:
+            if ((ptr = fetch_token(ptr, &token, &column)) && token == LT_STRING &&
+                (ptr = fetch_token(ptr, &token, &text)) && token == LT_EQUAL &&
+                (ptr = fetch_token(ptr, &token, &value)))
+            {
+                node = make_tree_node(MAXOP_WHERE, column,
+                                      NULL, make_tree_node(MAXOP_LITERAL, value, NULL, NULL));
+                column = value = NULL;
+                MXS_FREE(text);
+                ptr = fetch_token(ptr, &token, &text);
+            }
+            break;
+
+        case LT_ORDER:
+            if ((ptr = fetch_token(ptr, &token, &text)) && token == LT_BY &&
+                (ptr = fetch_token(ptr, &token, &column)) && token == LT_STRING)
+            {
+                node = make_tree_node(MAXOP_ORDER, column, NULL, NULL);
+                column = NULL;
+                MXS_FREE(text);
+
+                if ((ptr = fetch_token(ptr, &token, &text)) && (token == LT_ASC || token == LT_DESC))
+                {
+                    node->right = make_tree_node(MAXOP_LITERAL, text, NULL, NULL);
+                    ptr = fetch_token(ptr, &token, &text);
+                }
+            }
+            break;
+
+        case LT_LIMIT:
+            if ((ptr = fetch_token(ptr, &token, &value)) && token == LT_STRING)
+            {
+                node = make_tree_node(MAXOP_LIMIT, value, NULL, NULL);
+                value = NULL;
+                ptr = fetch_token(ptr, &token, &text);
+            }
+            break;
+
+        default:
+            break;
+        }
+
+        if (node == NULL)
+        {
+            MXS_FREE(column);
+            MXS_FREE(value);
+            MXS_FREE(text);
+            maxinfo_free_tree(tree);
+            *parse_error = PARSE_MALFORMED_CLAUSE;
+            return NULL;
+        }
+
+        *next = node;
+        next = &node->left;
+    }
+
+    return tree;
+}
+
 /**
  * Parse a column list, may be a * or a valid list of string name
  * separated by a comma
@@ -321,6 +419,12 @@ static struct
     { "clear",      LT_CLEAR},
     { "shutdown",   LT_SHUTDOWN},
     { "restart",    LT_RESTART},
+    { "where",      LT_WHERE},
+    { "order",      LT_ORDER},
+    { "by",         LT_BY},
+    { "asc",        LT_ASC},
+    { "desc",       LT_DESC},
+    { "limit",      LT_LIMIT},
     { NULL, 0}
 };
 
@@ -371,18 +475,26 @@ fetch_token(char *sql, int *token, char **text)
         }
     }
     s2 = s1;
-    while (*s2)
+    if (quote == '\0' && (*s1 == ',' || *s1 == '='))
     {
-        if (quote == '\0' && (isspace(*s2)
-                              || *s2 == ',' || *s2 == '='))
-        {
-            break;
-        }
-        else if (quote == *s2)
+        // The separators are tokens of their own
+        s2++;
+    }
+    else
+    {
+        while (*s2)
         {
-            break;
+            if (quote == '\0' && (isspace(*s2)
+                                  || *s2 == ',' || *s2 == '='))
+            {
+                break;
+            }
+            else if (quote == *s2)
+            {
+                break;
+            }
+            s2++;
         }
-        s2++;
     }
 
     if (*s1 == '@' && *(s1 + 1) == '@')
@@ -392,13 +504,21 @@ fetch_token(char *sql, int *token, char **text)
         return s2;
     }
 
-    if (s1 == s2)
+    if (s1 == s2 && quote == '\0')
     {
         *text = NULL;
         return NULL;
     }
 
     *text = strndup(s1, s2 - s1);
+
+    if (quote != '\0')
+    {
+        // Quoted text is never a keyword, skip the closing quote
+        *token = LT_STRING;
+        return *s2 ? s2 + 1 : s2;
+    }
+
     for (i = 0; keywords[i].text; i++)
     {
         if (strcasecmp(keywords[i].text, *text) == 0)
@@ -35,6 +35,55 @@
 
 MXS_BEGIN_DECLS
 
+/** The session attributes that can be used as the consistent hashing key */
+enum readconn_hash_key
+{
+    READCONN_HASH_USER     = 0x01,
+    READCONN_HASH_DATABASE = 0x02,
+    READCONN_HASH_ADDRESS  = 0x04
+};
+
+struct readconn_thread;
+
+/**
+ * A server as seen by one routing thread. The slots of a thread are only
+ * modified by that thread except for the connection count which is
+ * decremented atomically by whichever thread frees the session.
+ */
+typedef struct readconn_slot
+{
+    SERVER_REF *ref;                     /*< The server this slot is for                  */
+    int connections;                     /*< Open sessions placed here by the thread      */
+    int total;                           /*< Sessions placed here by the thread           */
+    int weight;                          /*< Weight used when the heap was built          */
+    int load;                            /*< Threads running when the heap was built      */
+    uint64_t name_hash;                  /*< Hash of the server name                      */
+    int heap_pos;                        /*< Position in the heap, -1 if not eligible     */
+    void *queued;                        /*< Non-NULL while in the release list           */
+    struct readconn_slot *next_release;  /*< Next slot in the release list                */
+    struct readconn_thread *thread;      /*< The thread that owns this slot               */
+    struct readconn_slot *next;          /*< Next slot of the thread                      */
+} READCONN_SLOT;
+
+/**
+ * The per-thread server selection state. The eligible servers are kept in
+ * a binary heap ordered by weighted connection count and the heap is
+ * rebuilt when the server status version changes.
+ */
+typedef struct readconn_thread
+{
+    bool valid;                /*< Whether the heap has been built           */
+    int version;               /*< Server status version the heap is for     */
+    int64_t snapshot_version;  /*< Server snapshot version the heap is for   */
+    READCONN_SLOT *slots;      /*< All slots of this thread                  */
+    READCONN_SLOT **heap;      /*< Eligible servers, least loaded first      */
+    int n_heap;                /*< Number of servers in the heap             */
+    int heap_size;             /*< Allocated size of the heap                */
+    READCONN_SLOT *fixed;      /*< Server to use when the heap is empty      */
+    READCONN_SLOT *released;   /*< Slots with connections freed since the
+                                *  last selection, pushed by any thread      */
+} READCONN_THREAD;
+
 /**
  * The client session structure used within this router.
  */
@@ -47,8 +96,10 @@ typedef struct router_client_session
     int rses_versno; /*< even = no active update, else odd  */
     bool rses_closed; /*< true when closeSession is called   */
     SERVER_REF *backend; /*< Backend used by the client session */
+    READCONN_SLOT *slot; /*< Selection slot the backend was taken from */
     DCB *backend_dcb; /*< DCB Connection to the backend      */
     DCB *client_dcb; /**< Client DCB */
+    bool answer_vars; /*< Variable queries are still answered from the cache */
     struct router_client_session *next;
 #if defined(SS_DEBUG)
     skygw_chk_t rses_chk_tail;
@@ -61,7 +112,7 @@ typedef struct router_client_session
 typedef struct
 {
     int n_sessions; /*< Number sessions created     */
-    int n_queries; /*< Number of queries forwarded */
+    ts_stats_t n_queries; /*< Number of queries forwarded, per thread */
 } ROUTER_STATS;
 
 /**
@@ -73,7 +124,13 @@ typedef struct router_instance
     SPINLOCK lock; /*< Spinlock for the instance data           */
     unsigned int bitmask; /*< Bitmask to apply to server->status       */
     unsigned int bitvalue; /*< Required value of server->status         */
+    int hash_key; /*< Session attributes to hash, 0 if not hashing */
+    bool least_load; /*< Whether the load sampled by the monitor is used */
+    bool passthrough; /*< Whether replies are forwarded with splice() */
+    bool answer_vars; /*< Whether variable queries are answered from the cache */
     ROUTER_STATS stats; /*< Statistics for this router               */
+    READCONN_THREAD *threads; /*< Per-thread server selection state   */
+    int n_threads; /*< Number of elements in threads             */
     struct router_instance
         *next;
 } ROUTER_INSTANCE;
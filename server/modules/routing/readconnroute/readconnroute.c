@@ -76,6 +76,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <math.h>
 #include <maxscale/alloc.h>
 #include <maxscale/server.h>
 #include <maxscale/router.h>
@@ -83,9 +84,11 @@
 #include <maxscale/spinlock.h>
 #include <maxscale/dcb.h>
 #include <maxscale/modinfo.h>
+#include <maxscale/probes.h>
 #include <maxscale/log_manager.h>
 #include <maxscale/protocol/mysql.h>
 #include <maxscale/modutil.h>
+#include <maxscale/config.h>
 
 /* The router entry points */
 static MXS_ROUTER *createInstance(SERVICE *service, char **options);
@@ -101,7 +104,7 @@ static void handleError(MXS_ROUTER *instance, MXS_ROUTER_SESSION *router_session
 static uint64_t getCapabilities(MXS_ROUTER* instance);
 static bool rses_begin_locked_router_action(ROUTER_CLIENT_SES* rses);
 static void rses_end_locked_router_action(ROUTER_CLIENT_SES* rses);
-static SERVER_REF *get_root_master(SERVER_REF *servers);
+static SERVER_REF *get_root_master(SERVER_REF *servers, const MXS_SERVER_SNAPSHOT *snapshot);
 static int handle_state_switch(DCB* dcb, DCB_REASON reason, void * routersession);
 
 /**
@@ -112,6 +115,14 @@ static int handle_state_switch(DCB* dcb, DCB_REASON reason, void * routersession
  *
  * @return The module object
  */
+static const MXS_ENUM_VALUE hash_key_values[] =
+{
+    {"user",     READCONN_HASH_USER},
+    {"database", READCONN_HASH_DATABASE},
+    {"address",  READCONN_HASH_ADDRESS},
+    {NULL}
+};
+
 MXS_MODULE* MXS_CREATE_MODULE()
 {
     MXS_NOTICE("Initialise readconnroute router module.");
@@ -143,6 +154,14 @@ MXS_MODULE* MXS_CREATE_MODULE()
         NULL, /* Thread init. */
         NULL, /* Thread finish. */
         {
+            {
+                "hash_key",
+                MXS_MODULE_PARAM_ENUM,
+                "user",
+                MXS_MODULE_OPT_NONE,
+                hash_key_values
+            },
+            {"answer_variable_queries", MXS_MODULE_PARAM_BOOL, "false"},
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -154,10 +173,538 @@ static inline void free_readconn_instance(ROUTER_INSTANCE *router)
 {
     if (router)
     {
+        for (int i = 0; router->threads && i < router->n_threads; i++)
+        {
+            READCONN_SLOT *slot = router->threads[i].slots;
+
+            while (slot)
+            {
+                READCONN_SLOT *next = slot->next;
+                MXS_FREE(slot);
+                slot = next;
+            }
+
+            MXS_FREE(router->threads[i].heap);
+        }
+
+        MXS_FREE(router->threads);
+        ts_stats_free(router->stats.n_queries);
         MXS_FREE(router);
     }
 }
 
+/**
+ * The server selection
+ *
+ * Each routing thread keeps the eligible servers of the service in a binary
+ * heap ordered by ((connections + 1) * 1000) / weight where the connection
+ * count is the number of open sessions the thread has placed on the server.
+ * The thread with the new session always picks the root of its own heap,
+ * which keeps the choice at O(log n) and lets the threads select servers
+ * without sharing any lock. As each thread balances its own sessions, the
+ * total load stays balanced across the threads.
+ *
+ * The heap only contains the servers that pass the status checks. It is
+ * rebuilt when server_status_version() shows that the status of a server
+ * has changed. Sessions can be freed by any thread: the connection count is
+ * decremented atomically and the slot is pushed to a lock-free list from
+ * which the owning thread restores the heap order on its next selection.
+ */
+
+/** The FNV-1a hash parameters */
+#define HASH_OFFSET 0xcbf29ce484222325ULL
+#define HASH_PRIME  0x100000001b3ULL
+
+/**
+ * Add a string to an FNV-1a hash
+ *
+ * The terminating null byte is hashed as well so that the concatenation of
+ * several strings does not depend on where one ends and the next begins.
+ *
+ * @param hash The hash to add to
+ * @param str  The string to add, NULL is hashed as an empty string
+ * @return The new hash
+ */
+static uint64_t hash_string(uint64_t hash, const char *str)
+{
+    if (str)
+    {
+        for (; *str; str++)
+        {
+            hash = (hash ^ (uint8_t)*str) * HASH_PRIME;
+        }
+    }
+
+    return hash * HASH_PRIME;
+}
+
+/**
+ * Find the slot of a server, creating it if it does not yet exist
+ *
+ * @param thr The thread whose slot is looked up
+ * @param ref The server reference
+ * @return The slot or NULL if memory allocation failed
+ */
+static READCONN_SLOT* thread_get_slot(READCONN_THREAD *thr, SERVER_REF *ref)
+{
+    READCONN_SLOT *slot;
+
+    for (slot = thr->slots; slot; slot = slot->next)
+    {
+        if (slot->ref == ref)
+        {
+            return slot;
+        }
+    }
+
+    if ((slot = MXS_CALLOC(1, sizeof(READCONN_SLOT))))
+    {
+        slot->ref = ref;
+        slot->name_hash = hash_string(HASH_OFFSET, ref->server->unique_name);
+        slot->heap_pos = -1;
+        slot->thread = thr;
+        slot->next = thr->slots;
+        thr->slots = slot;
+    }
+
+    return slot;
+}
+
+/**
+ * Check whether a slot should be preferred over another one
+ *
+ * With the least_load router option, the threads that were running on the
+ * server when the heap was built are counted as connections.
+ *
+ * If the weighted connection counts are equal, the server that has received
+ * fewer sessions over time is preferred. This spreads the sessions over the
+ * servers during periods of very low load.
+ */
+static inline bool slot_is_less(const READCONN_SLOT *a, const READCONN_SLOT *b)
+{
+    int a_score = ((a->connections + a->load + 1) * 1000) / a->weight;
+    int b_score = ((b->connections + b->load + 1) * 1000) / b->weight;
+
+    return a_score < b_score || (a_score == b_score && a->total < b->total);
+}
+
+static inline void heap_swap(READCONN_THREAD *thr, int i, int j)
+{
+    READCONN_SLOT *tmp = thr->heap[i];
+    thr->heap[i] = thr->heap[j];
+    thr->heap[j] = tmp;
+    thr->heap[i]->heap_pos = i;
+    thr->heap[j]->heap_pos = j;
+}
+
+static void heap_sift_up(READCONN_THREAD *thr, int pos)
+{
+    while (pos > 0)
+    {
+        int parent = (pos - 1) / 2;
+
+        if (!slot_is_less(thr->heap[pos], thr->heap[parent]))
+        {
+            break;
+        }
+
+        heap_swap(thr, pos, parent);
+        pos = parent;
+    }
+}
+
+static void heap_sift_down(READCONN_THREAD *thr, int pos)
+{
+    while (true)
+    {
+        int child = pos * 2 + 1;
+
+        if (child >= thr->n_heap)
+        {
+            break;
+        }
+
+        if (child + 1 < thr->n_heap && slot_is_less(thr->heap[child + 1], thr->heap[child]))
+        {
+            child++;
+        }
+
+        if (!slot_is_less(thr->heap[child], thr->heap[pos]))
+        {
+            break;
+        }
+
+        heap_swap(thr, pos, child);
+        pos = child;
+    }
+}
+
+/**
+ * Rebuild the heap of a thread from the current state of the servers
+ *
+ * The servers are checked with the same rules that the router has always
+ * used. Servers with a zero weight or that the monitor reports as overloaded
+ * are only used if no other server is available and the root master is used
+ * as the last resort.
+ *
+ * The state of the servers is read from the server snapshot so that the
+ * heap is built from the state the monitors left the servers in at the end
+ * of their rounds.
+ *
+ * @param inst     The router instance
+ * @param thr      The thread to rebuild
+ * @param snapshot The server snapshot or NULL if none has been published
+ * @return True if the heap was rebuilt, false on memory allocation failure
+ */
+static bool thread_build(ROUTER_INSTANCE *inst, READCONN_THREAD *thr,
+                         const MXS_SERVER_SNAPSHOT *snapshot)
+{
+    int version = server_status_version();
+    int64_t snapshot_version = snapshot ? snapshot->version : 0;
+    int n_refs = 0;
+
+    for (SERVER_REF *ref = inst->service->dbref; ref; ref = ref->next)
+    {
+        n_refs++;
+    }
+
+    if (n_refs > thr->heap_size)
+    {
+        READCONN_SLOT **heap = MXS_REALLOC(thr->heap, n_refs * sizeof(READCONN_SLOT*));
+
+        if (heap == NULL)
+        {
+            return false;
+        }
+
+        thr->heap = heap;
+        thr->heap_size = n_refs;
+    }
+
+    for (READCONN_SLOT *slot = thr->slots; slot; slot = slot->next)
+    {
+        slot->heap_pos = -1;
+    }
+
+    thr->n_heap = 0;
+    thr->fixed = NULL;
+
+    SERVER_REF *master_host = get_root_master(inst->service->dbref, snapshot);
+    SERVER_REF *fixed = NULL;
+    bool only_fixed = false;
+
+    for (SERVER_REF *ref = inst->service->dbref; ref && thr->n_heap < thr->heap_size; ref = ref->next)
+    {
+        MXS_SERVER_SNAPSHOT_ENTRY state = server_snapshot_state(snapshot, ref->server);
+
+        if (!SERVER_REF_IS_ACTIVE(ref) || SERVER_IN_MAINT(&state))
+        {
+            continue;
+        }
+
+        MXS_DEBUG("Examine server in port %d. Status is %s, inst->bitvalue is %d",
+                  ref->server->port, STRSRVSTATUS(&state), inst->bitvalue);
+
+        /* Check server status bits against bitvalue from router_options */
+        if (SERVER_IS_RUNNING(&state) &&
+            (state.status & inst->bitmask & inst->bitvalue))
+        {
+            if (master_host)
+            {
+                if (ref == master_host && (inst->bitvalue & SERVER_SLAVE))
+                {
+                    /* Skip root master here, as it could also be slave of an external server that
+                     * is not in the configuration.  Intermediate masters (Relay Servers) are also
+                     * slave and will be selected as Slave(s)
+                     */
+                    continue;
+                }
+                if (ref == master_host && (inst->bitvalue & SERVER_MASTER))
+                {
+                    /* If option is "master" return only the root Master as there could be
+                     * intermediate masters (Relay Servers) and they must not be selected.
+                     */
+                    fixed = master_host;
+                    only_fixed = true;
+                    break;
+                }
+            }
+            else if (inst->bitvalue & SERVER_MASTER)
+            {
+                /* Master_host is NULL, no master server. If requested router_option is 'master'
+                 * there is no candidate.
+                 */
+                only_fixed = true;
+                break;
+            }
+
+            if (ref->weight == 0 || SERVER_IS_OVERLOADED(&state))
+            {
+                if (fixed == NULL)
+                {
+                    fixed = ref;
+                }
+            }
+            else
+            {
+                READCONN_SLOT *slot = thread_get_slot(thr, ref);
+
+                if (slot == NULL)
+                {
+                    return false;
+                }
+
+                slot->weight = ref->weight;
+                slot->load = inst->least_load ? MXS_MAX(state.load_metrics.threads_running, 0) : 0;
+                slot->heap_pos = thr->n_heap;
+                thr->heap[thr->n_heap++] = slot;
+            }
+        }
+    }
+
+    if (only_fixed)
+    {
+        for (int i = 0; i < thr->n_heap; i++)
+        {
+            thr->heap[i]->heap_pos = -1;
+        }
+
+        thr->n_heap = 0;
+    }
+    else if (fixed == NULL)
+    {
+        /* If we don't find a proper candidate but a master server is available, we'll pick that
+         * with the assumption that it is "better" than a slave.
+         */
+        fixed = master_host;
+    }
+
+    if (fixed && (thr->fixed = thread_get_slot(thr, fixed)) == NULL)
+    {
+        return false;
+    }
+
+    for (int i = thr->n_heap / 2 - 1; i >= 0; i--)
+    {
+        heap_sift_down(thr, i);
+    }
+
+    thr->version = version;
+    thr->snapshot_version = snapshot_version;
+    thr->valid = true;
+
+    return true;
+}
+
+/**
+ * Rebuild the heap of a thread from the current server snapshot
+ *
+ * @param inst The router instance
+ * @param thr  The thread to rebuild
+ * @return True if the heap was rebuilt, false on memory allocation failure
+ */
+static bool thread_rebuild(ROUTER_INSTANCE *inst, READCONN_THREAD *thr)
+{
+    const MXS_SERVER_SNAPSHOT *snapshot = server_snapshot_acquire();
+    bool rval = thread_build(inst, thr, snapshot);
+    server_snapshot_release(snapshot);
+    return rval;
+}
+
+/**
+ * Restore the heap order of the slots whose connections were released
+ *
+ * @param thr The thread that owns the slots
+ */
+static void thread_process_releases(READCONN_THREAD *thr)
+{
+    READCONN_SLOT *slot = atomic_exchange_ptr((void**)&thr->released, NULL);
+
+    while (slot)
+    {
+        /** Read the next pointer before the slot can be pushed again */
+        READCONN_SLOT *next = slot->next_release;
+        atomic_exchange_ptr(&slot->queued, NULL);
+
+        if (slot->heap_pos >= 0)
+        {
+            heap_sift_up(thr, slot->heap_pos);
+        }
+
+        slot = next;
+    }
+}
+
+/**
+ * Select the server for a new session
+ *
+ * @param inst The router instance
+ * @param thr  The thread where the session is created
+ * @return The slot of the selected server or NULL if no server is available
+ */
+static READCONN_SLOT* thread_select_slot(ROUTER_INSTANCE *inst, READCONN_THREAD *thr)
+{
+    thread_process_releases(thr);
+
+    if ((!thr->valid || thr->version != server_status_version() ||
+         thr->snapshot_version != server_snapshot_version()) &&
+        !thread_rebuild(inst, thr))
+    {
+        thr->valid = false;
+        return NULL;
+    }
+
+    return thr->n_heap > 0 ? thr->heap[0] : thr->fixed;
+}
+
+/**
+ * Calculate the consistent hashing key of a session
+ *
+ * @param inst    The router instance
+ * @param session The session being created
+ * @param key     The hashed key is stored here
+ * @return True if at least one of the configured attributes is set
+ */
+static bool session_hash_key(ROUTER_INSTANCE *inst, MXS_SESSION *session, uint64_t *key)
+{
+    uint64_t hash = HASH_OFFSET;
+    bool found = false;
+
+    if (inst->hash_key & READCONN_HASH_USER)
+    {
+        const char *user = session_get_user(session);
+        found = found || (user && *user);
+        hash = hash_string(hash, user);
+    }
+
+    if (inst->hash_key & READCONN_HASH_DATABASE)
+    {
+        MYSQL_session *data = (MYSQL_session*)session->client_dcb->data;
+        const char *db = data ? data->db : NULL;
+        found = found || (db && *db);
+        hash = hash_string(hash, db);
+    }
+
+    if (inst->hash_key & READCONN_HASH_ADDRESS)
+    {
+        const char *remote = session_get_remote(session);
+        found = found || (remote && *remote);
+        hash = hash_string(hash, remote);
+    }
+
+    *key = hash;
+    return found;
+}
+
+/**
+ * Calculate the weighted rendezvous hashing score of a server
+ *
+ * The key and the server name are mixed into a uniformly distributed number
+ * u in the range (0, 1) and the score is -weight / ln(u). The server with the
+ * highest score owns the key, which gives each server a share of the keys
+ * proportional to its weight. When a server is removed, only the keys it
+ * owned move and they are spread over the remaining servers.
+ *
+ * @param key  The hashed session key
+ * @param slot The server
+ * @return The score of the server for this key
+ */
+static double slot_hash_score(uint64_t key, const READCONN_SLOT *slot)
+{
+    /** The 64-bit finalizer of MurmurHash3 */
+    uint64_t h = key ^ slot->name_hash;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    double u = ((h >> 11) + 0.5) / (double)(1ULL << 53);
+    return -slot->weight / log(u);
+}
+
+/**
+ * Select the server for a new session with consistent hashing
+ *
+ * The same servers as for the least connections selection are eligible. If
+ * none of the configured session attributes is set, the session is placed on
+ * the server with the fewest connections.
+ *
+ * @param inst    The router instance
+ * @param thr     The thread where the session is created
+ * @param session The session being created
+ * @return The slot of the selected server or NULL if no server is available
+ */
+static READCONN_SLOT* thread_hash_slot(ROUTER_INSTANCE *inst, READCONN_THREAD *thr,
+                                       MXS_SESSION *session)
+{
+    READCONN_SLOT *best = thread_select_slot(inst, thr);
+    uint64_t key;
+
+    if (best && thr->n_heap > 1 && session_hash_key(inst, session, &key))
+    {
+        double best_score = 0;
+
+        for (int i = 0; i < thr->n_heap; i++)
+        {
+            double score = slot_hash_score(key, thr->heap[i]);
+
+            if (score > best_score)
+            {
+                best_score = score;
+                best = thr->heap[i];
+            }
+        }
+    }
+
+    return best;
+}
+
+/**
+ * Add a session to the slot it was placed on
+ *
+ * This is only called by the thread that owns the slot.
+ *
+ * @param slot The selected slot
+ */
+static void slot_acquire(READCONN_SLOT *slot)
+{
+    atomic_add(&slot->connections, 1);
+    slot->total++;
+
+    if (slot->heap_pos >= 0)
+    {
+        heap_sift_down(slot->thread, slot->heap_pos);
+    }
+}
+
+/**
+ * Remove a session from the slot it was placed on
+ *
+ * This can be called by any thread. The owner of the slot is notified
+ * through its list of released slots.
+ *
+ * @param slot The slot of the session
+ */
+static void slot_release(READCONN_SLOT *slot)
+{
+    void *expected = NULL;
+
+    atomic_add(&slot->connections, -1);
+
+    if (atomic_cas_ptr(&slot->queued, &expected, slot))
+    {
+        READCONN_THREAD *thr = slot->thread;
+        void *head = thr->released;
+
+        do
+        {
+            slot->next_release = head;
+        }
+        while (!atomic_cas_ptr((void**)&thr->released, &head, slot));
+    }
+}
+
 /**
  * Create an instance of the router for a particular service
  * within the gateway.
@@ -181,6 +728,14 @@ createInstance(SERVICE *service, char **options)
 
     inst->service = service;
     spinlock_init(&inst->lock);
+    inst->n_threads = config_threadcount();
+
+    if ((inst->threads = MXS_CALLOC(inst->n_threads, sizeof(READCONN_THREAD))) == NULL ||
+        (inst->stats.n_queries = ts_stats_alloc()) == NULL)
+    {
+        free_readconn_instance(inst);
+        return NULL;
+    }
 
     /*
      * Process the options
@@ -188,6 +743,7 @@ createInstance(SERVICE *service, char **options)
     bool error = false;
     inst->bitmask = 0;
     inst->bitvalue = 0;
+    inst->answer_vars = config_get_bool(service->svc_config_param, "answer_variable_queries");
     if (options)
     {
         for (i = 0; options[i]; i++)
@@ -217,12 +773,25 @@ createInstance(SERVICE *service, char **options)
                 inst->bitmask |= (SERVER_NDB);
                 inst->bitvalue |= SERVER_NDB;
             }
+            else if (!strcasecmp(options[i], "least_load"))
+            {
+                inst->least_load = true;
+            }
+            else if (!strcasecmp(options[i], "hash"))
+            {
+                inst->hash_key = config_get_enum(service->svc_config_param, "hash_key",
+                                                 hash_key_values);
+            }
+            else if (!strcasecmp(options[i], "passthrough"))
+            {
+                inst->passthrough = true;
+            }
             else
             {
                 MXS_WARNING("Unsupported router "
                             "option \'%s\' for readconnroute. "
                             "Expected router options are "
-                            "[slave|master|synced|ndb|running]",
+                            "[slave|master|synced|ndb|running|hash|least_load|passthrough]",
                             options[i]);
                 error = true;
             }
@@ -262,9 +831,9 @@ newSession(MXS_ROUTER *instance, MXS_SESSION *session)
 {
     ROUTER_INSTANCE *inst = (ROUTER_INSTANCE *) instance;
     ROUTER_CLIENT_SES *client_rses;
-    SERVER_REF *candidate = NULL;
-    int i;
-    SERVER_REF *master_host = NULL;
+    SERVER_REF *candidate;
+    READCONN_SLOT *slot;
+    int thread_id = session->client_dcb->thread.id;
 
     MXS_DEBUG("%lu [newSession] new router session with session "
               "%p, and inst %p.",
@@ -285,134 +854,31 @@ newSession(MXS_ROUTER *instance, MXS_SESSION *session)
 #endif
     client_rses->client_dcb = session->client_dcb;
 
-    /**
-     * Find the Master host from available servers
-     */
-    master_host = get_root_master(inst->service->dbref);
-
     /**
      * Find a backend server to connect to. This is the extent of the
      * load balancing algorithm we need to implement for this simple
-     * connection router.
+     * connection router. The server with the fewest connections relative
+     * to its weight is taken from the heap of this thread.
      */
-
-    /*
-     * Loop over all the servers and find any that have fewer connections
-     * than the candidate server.
-     *
-     * If a server has less connections than the current candidate we mark this
-     * as the new candidate to connect to.
-     *
-     * If a server has the same number of connections currently as the candidate
-     * and has had less connections over time than the candidate it will also
-     * become the new candidate. This has the effect of spreading the
-     * connections over different servers during periods of very low load.
-     */
-    for (SERVER_REF *ref = inst->service->dbref; ref; ref = ref->next)
+    if (thread_id < 0 || thread_id >= inst->n_threads ||
+        (slot = inst->hash_key ?
+                 thread_hash_slot(inst, &inst->threads[thread_id], session) :
+                 thread_select_slot(inst, &inst->threads[thread_id])) == NULL)
     {
-        if (!SERVER_REF_IS_ACTIVE(ref) || SERVER_IN_MAINT(ref->server))
-        {
-            continue;
-        }
-        else
-        {
-            MXS_DEBUG("%lu [newSession] Examine server in port %d with "
-                      "%d connections. Status is %s, "
-                      "inst->bitvalue is %d",
-                      pthread_self(),
-                      ref->server->port,
-                      ref->connections,
-                      STRSRVSTATUS(ref->server),
-                      inst->bitmask);
-        }
-
-        /* Check server status bits against bitvalue from router_options */
-        if (ref && SERVER_IS_RUNNING(ref->server) &&
-            (ref->server->status & inst->bitmask & inst->bitvalue))
-        {
-            if (master_host)
-            {
-                if (ref == master_host && (inst->bitvalue & SERVER_SLAVE))
-                {
-                    /* Skip root master here, as it could also be slave of an external server that
-                     * is not in the configuration.  Intermediate masters (Relay Servers) are also
-                     * slave and will be selected as Slave(s)
-                     */
-
-                    continue;
-                }
-                if (ref == master_host && (inst->bitvalue & SERVER_MASTER))
-                {
-                    /* If option is "master" return only the root Master as there could be
-                     * intermediate masters (Relay Servers) and they must not be selected.
-                     */
-
-                    candidate = master_host;
-                    break;
-                }
-            }
-            else
-            {
-                /* Master_host is NULL, no master server.  If requested router_option is 'master'
-                 * candidate wll be NULL.
-                 */
-                if (inst->bitvalue & SERVER_MASTER)
-                {
-                    candidate = NULL;
-                    break;
-                }
-            }
-
-            /* If no candidate set, set first running server as our initial candidate server */
-            if (candidate == NULL)
-            {
-                candidate = ref;
-            }
-            else if (ref->weight == 0 || candidate->weight == 0)
-            {
-                candidate = ref->weight ? ref : candidate;
-            }
-            else if (((ref->connections + 1) * 1000) / ref->weight <
-                     ((candidate->connections + 1) * 1000) / candidate->weight)
-            {
-                /* This running server has fewer connections, set it as a new candidate */
-                candidate = ref;
-            }
-            else if (((ref->connections + 1) * 1000) / ref->weight ==
-                     ((candidate->connections + 1) * 1000) / candidate->weight &&
-                     ref->server->stats.n_connections < candidate->server->stats.n_connections)
-            {
-                /* This running server has the same number of connections currently as the candidate
-                but has had fewer connections over time than candidate, set this server to
-                candidate*/
-                candidate = ref;
-            }
-        }
+        MXS_ERROR("Failed to create new routing session. Couldn't find eligible"
+                  " candidate server. Freeing allocated resources.");
+        MXS_FREE(client_rses);
+        return NULL;
     }
 
-    /* If we haven't found a proper candidate yet but a master server is available, we'll pick that
-     * with the assumption that it is "better" than a slave.
-     */
-    if (!candidate)
-    {
-        if (master_host)
-        {
-            candidate = master_host;
-        }
-        else
-        {
-            MXS_ERROR("Failed to create new routing session. Couldn't find eligible"
-                      " candidate server. Freeing allocated resources.");
-            MXS_FREE(client_rses);
-            return NULL;
-        }
-    }
+    candidate = slot->ref;
 
     /*
      * We now have the server with the least connections.
      * Bump the connection count for this server
      */
     client_rses->backend = candidate;
+    client_rses->answer_vars = inst->answer_vars;
 
     /** Open the backend connection */
     client_rses->backend_dcb = dcb_connect(candidate->server, session,
@@ -426,6 +892,8 @@ newSession(MXS_ROUTER *instance, MXS_SESSION *session)
     }
 
     atomic_add(&candidate->connections, 1);
+    slot_acquire(slot);
+    client_rses->slot = slot;
 
     // TODO: Remove this as it is never called
     dcb_add_callback(client_rses->backend_dcb,
@@ -466,6 +934,7 @@ static void freeSession(MXS_ROUTER* router_instance, MXS_ROUTER_SESSION* router_
 
     ss_debug(int prev_val = ) atomic_add(&router_cli_ses->backend->connections, -1);
     ss_dassert(prev_val > 0);
+    slot_release(router_cli_ses->slot);
 
     MXS_FREE(router_cli_ses);
 }
@@ -554,7 +1023,7 @@ static inline bool connection_is_valid(ROUTER_INSTANCE* inst, ROUTER_CLIENT_SES*
         if ((inst->bitvalue & SERVER_MASTER) && router_cli_ses->backend->active)
         {
             // If we're using an active master server, verify that it is still a master
-            rval = router_cli_ses->backend == get_root_master(inst->service->dbref);
+            rval = router_cli_ses->backend == get_root_master(inst->service->dbref, NULL);
         }
         else
         {
@@ -593,7 +1062,7 @@ routeQuery(MXS_ROUTER *instance, MXS_ROUTER_SESSION *router_session, GWBUF *queu
     mysql_server_cmd_t mysql_command = proto->current_command;
     bool rses_is_closed;
 
-    inst->stats.n_queries++;
+    ts_stats_add(inst->stats.n_queries, 1);
 
     /** Dirty read for quick check if router is closed. */
     if (router_cli_ses->rses_closed)
@@ -626,6 +1095,26 @@ routeQuery(MXS_ROUTER *instance, MXS_ROUTER_SESSION *router_session, GWBUF *queu
 
     }
 
+    if (router_cli_ses->answer_vars)
+    {
+        /** Only one complete query is answered and only before anything has
+         * been routed, the connection has the global values then */
+        if (mysql_command == MYSQL_COM_QUERY && GWBUF_IS_CONTIGUOUS(queue) &&
+            gwbuf_length(queue) == MYSQL_GET_PAYLOAD_LEN(GWBUF_DATA(queue)) + MYSQL_HEADER_LEN &&
+            modutil_answer_variable_query(router_cli_ses->client_dcb,
+                                          router_cli_ses->backend->server, queue))
+        {
+            gwbuf_free(queue);
+            rc = 1;
+            goto return_rc;
+        }
+
+        router_cli_ses->answer_vars = false;
+    }
+
+    MXS_PROBE2(readconn_route, router_cli_ses->client_dcb->session->ses_id,
+               router_cli_ses->backend->server->unique_name);
+
     char* trc = NULL;
 
     switch (mysql_command)
@@ -670,10 +1159,17 @@ diagnostics(MXS_ROUTER *router, DCB *dcb)
 
     dcb_printf(dcb, "\tNumber of router sessions:   	%d\n",
                router_inst->stats.n_sessions);
-    dcb_printf(dcb, "\tCurrent no. of router sessions:	%d\n",
-               router_inst->service->stats.n_current);
-    dcb_printf(dcb, "\tNumber of queries forwarded:   	%d\n",
-               router_inst->stats.n_queries);
+    dcb_printf(dcb, "\tCurrent no. of router sessions:	%ld\n",
+               ts_stats_sum(router_inst->service->stats.n_current));
+    dcb_printf(dcb, "\tNumber of queries forwarded:   	%ld\n",
+               ts_stats_sum(router_inst->stats.n_queries));
+    if (router_inst->hash_key)
+    {
+        dcb_printf(dcb, "\tConsistent hashing key:      	%s%s%s\n",
+                   router_inst->hash_key & READCONN_HASH_USER ? "user " : "",
+                   router_inst->hash_key & READCONN_HASH_DATABASE ? "database " : "",
+                   router_inst->hash_key & READCONN_HASH_ADDRESS ? "address " : "");
+    }
     if ((weightby = serviceGetWeightingParameter(router_inst->service))
         != NULL)
     {
@@ -829,7 +1325,10 @@ static void rses_end_locked_router_action(ROUTER_CLIENT_SES* rses)
 
 static uint64_t getCapabilities(MXS_ROUTER* instance)
 {
-    return RCAP_TYPE_NONE;
+    ROUTER_INSTANCE *inst = (ROUTER_INSTANCE*)instance;
+
+    /** The replies are not inspected so they can be forwarded directly */
+    return inst && inst->passthrough ? RCAP_TYPE_PASSTHROUGH : RCAP_TYPE_NONE;
 }
 
 /********************************
@@ -841,25 +1340,30 @@ static uint64_t getCapabilities(MXS_ROUTER* instance)
  * Servers are checked even if they are in 'maintenance'
  *
  * @param servers   The list of servers
+ * @param snapshot  The server snapshot to read the state from, NULL for the
+ *                  current state of the servers
  * @return      The Master found
  *
  */
 
-static SERVER_REF *get_root_master(SERVER_REF *servers)
+static SERVER_REF *get_root_master(SERVER_REF *servers, const MXS_SERVER_SNAPSHOT *snapshot)
 {
-    int i = 0;
     SERVER_REF *master_host = NULL;
+    int master_depth = 0;
 
     for (SERVER_REF *ref = servers; ref; ref = ref->next)
     {
-        if (ref->active && SERVER_IS_MASTER(ref->server))
+        MXS_SERVER_SNAPSHOT_ENTRY state = server_snapshot_state(snapshot, ref->server);
+
+        if (ref->active && SERVER_IS_MASTER(&state))
         {
             if (master_host == NULL)
             {
                 master_host = ref;
+                master_depth = state.depth;
             }
-            else if (ref->server->depth < master_host->server->depth ||
-                     (ref->server->depth == master_host->server->depth &&
+            else if (state.depth < master_depth ||
+                     (state.depth == master_depth &&
                       ref->weight > master_host->weight))
             {
                 /**
@@ -867,6 +1371,7 @@ static SERVER_REF *get_root_master(SERVER_REF *servers)
                  * the depths are equal but this master has a higher weight
                  */
                 master_host = ref;
+                master_depth = state.depth;
             }
         }
     }
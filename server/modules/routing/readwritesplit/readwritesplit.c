@@ -19,6 +19,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <time.h>
 
 #include <maxscale/router.h>
 #include "rwsplit_internal.h"
@@ -30,6 +31,8 @@
 #include <maxscale/modinfo.h>
 #include <maxscale/modutil.h>
 #include <maxscale/alloc.h>
+#include <maxscale/probes.h>
+#include <maxscale/utils.h>
 
 /**
  * @file readwritesplit.c   The entry points for the read/write query splitting
@@ -105,6 +108,8 @@ static bool handle_error_new_connection(ROUTER_INSTANCE *inst,
 static bool have_enough_servers(ROUTER_CLIENT_SES *rses, const int min_nsrv,
                                 int router_nsrv, ROUTER_INSTANCE *router);
 static bool create_backends(ROUTER_CLIENT_SES *rses, backend_ref_t** dest, int* n_backend);
+static void detach_idle_backend(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
+                                backend_ref_t *bref);
 
 /**
  * Enum values for router parameters
@@ -122,6 +127,8 @@ static const MXS_ENUM_VALUE slave_selection_criteria_values[] =
     {"LEAST_ROUTER_CONNECTIONS", LEAST_ROUTER_CONNECTIONS},
     {"LEAST_BEHIND_MASTER",      LEAST_BEHIND_MASTER},
     {"LEAST_CURRENT_OPERATIONS", LEAST_CURRENT_OPERATIONS},
+    {"ADAPTIVE_ROUTING",         ADAPTIVE_ROUTING},
+    {"LEAST_SERVER_LOAD",        LEAST_SERVER_LOAD},
     {NULL}
 };
 
@@ -194,9 +201,24 @@ MXS_MODULE *MXS_CREATE_MODULE()
             {"retry_failed_reads", MXS_MODULE_PARAM_BOOL, "true"},
             {"disable_sescmd_history", MXS_MODULE_PARAM_BOOL, "true"},
             {"max_sescmd_history", MXS_MODULE_PARAM_COUNT, "0"},
+            {"max_sescmd_history_size", MXS_MODULE_PARAM_SIZE, "0"},
             {"strict_multi_stmt",  MXS_MODULE_PARAM_BOOL, "true"},
             {"strict_sp_calls",  MXS_MODULE_PARAM_BOOL, "false"},
             {"master_accept_reads", MXS_MODULE_PARAM_BOOL, "false"},
+            {"connection_multiplexing", MXS_MODULE_PARAM_BOOL, "false"},
+            {"lazy_connect", MXS_MODULE_PARAM_BOOL, "false"},
+            {"causal_reads", MXS_MODULE_PARAM_BOOL, "false"},
+            {"causal_reads_timeout", MXS_MODULE_PARAM_COUNT, "10"},
+            {"track_session_state", MXS_MODULE_PARAM_BOOL, "false"},
+            {"hedged_reads", MXS_MODULE_PARAM_BOOL, "false"},
+            {"hedged_reads_delay", MXS_MODULE_PARAM_COUNT, "0"},
+            {"split_multi_statements", MXS_MODULE_PARAM_BOOL, "false"},
+            {"galera_write_affinity", MXS_MODULE_PARAM_BOOL, "false"},
+            {"coalesce_replies", MXS_MODULE_PARAM_BOOL, "false"},
+            {"answer_variable_queries", MXS_MODULE_PARAM_BOOL, "false"},
+            {"defer_session_commands", MXS_MODULE_PARAM_BOOL, "false"},
+            {"analytic_threshold", MXS_MODULE_PARAM_COUNT, "0"},
+            {"analytic_class", MXS_MODULE_PARAM_STRING, "analytics"},
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -253,6 +275,17 @@ static MXS_ROUTER *createInstance(SERVICE *service, char **options)
     }
     router->service = service;
 
+    /** The per-statement counters are updated by every thread */
+    if ((router->stats.n_queries = ts_stats_alloc()) == NULL ||
+        (router->stats.n_master = ts_stats_alloc()) == NULL ||
+        (router->stats.n_slave = ts_stats_alloc()) == NULL ||
+        (router->stats.n_all = ts_stats_alloc()) == NULL ||
+        (router->stats.n_ro_trx = ts_stats_alloc()) == NULL)
+    {
+        free_rwsplit_instance(router);
+        return NULL;
+    }
+
     /*
      * Until we know otherwise assume we have some available slaves.
      */
@@ -279,20 +312,68 @@ static MXS_ROUTER *createInstance(SERVICE *service, char **options)
     router->rwsplit_config.strict_sp_calls = config_get_bool(params, "strict_sp_calls");
     router->rwsplit_config.disable_sescmd_history = config_get_bool(params, "disable_sescmd_history");
     router->rwsplit_config.max_sescmd_history = config_get_integer(params, "max_sescmd_history");
+    router->rwsplit_config.max_sescmd_history_size = config_get_size(params, "max_sescmd_history_size");
     router->rwsplit_config.master_accept_reads = config_get_bool(params, "master_accept_reads");
-
-    if (!handle_max_slaves(router, config_get_string(params, "max_slave_connections")) ||
-        (options && !rwsplit_process_router_options(router, options)))
+    router->rwsplit_config.connection_multiplexing = config_get_bool(params, "connection_multiplexing");
+    router->rwsplit_config.lazy_connect = config_get_bool(params, "lazy_connect");
+    router->rwsplit_config.causal_reads = config_get_bool(params, "causal_reads");
+    router->rwsplit_config.causal_reads_timeout = config_get_integer(params, "causal_reads_timeout");
+    router->rwsplit_config.track_session_state = config_get_bool(params, "track_session_state");
+    router->rwsplit_config.hedged_reads = config_get_bool(params, "hedged_reads");
+    router->rwsplit_config.hedged_reads_delay = config_get_integer(params, "hedged_reads_delay");
+    router->rwsplit_config.split_multi_statements = config_get_bool(params, "split_multi_statements");
+    router->rwsplit_config.galera_write_affinity = config_get_bool(params, "galera_write_affinity");
+    router->rwsplit_config.coalesce_replies = config_get_bool(params, "coalesce_replies");
+    router->rwsplit_config.answer_variable_queries = config_get_bool(params, "answer_variable_queries");
+    router->rwsplit_config.defer_session_commands = config_get_bool(params, "defer_session_commands");
+    router->rwsplit_config.analytic_threshold = config_get_integer(params, "analytic_threshold");
+    router->rwsplit_config.analytic_class = MXS_STRDUP(config_get_string(params, "analytic_class"));
+
+    if (router->rwsplit_config.analytic_class == NULL ||
+        !handle_max_slaves(router, config_get_string(params, "max_slave_connections")) ||
+        (options && !rwsplit_process_router_options(router, options)) ||
+        !rwsplit_workload_init(router))
     {
         free_rwsplit_instance(router);
         return NULL;
     }
 
     /** These options cancel each other out */
-    if (router->rwsplit_config.disable_sescmd_history &&
-        router->rwsplit_config.max_sescmd_history > 0)
+    if (router->rwsplit_config.disable_sescmd_history)
     {
         router->rwsplit_config.max_sescmd_history = 0;
+        router->rwsplit_config.max_sescmd_history_size = 0;
+    }
+
+    /** The session state of reattached connections is restored from the
+     * session command history */
+    if (router->rwsplit_config.connection_multiplexing &&
+        router->rwsplit_config.disable_sescmd_history)
+    {
+        MXS_WARNING("Service '%s' has 'connection_multiplexing' enabled but it "
+                    "requires 'disable_sescmd_history=false'. Connection "
+                    "multiplexing is disabled.", service->name);
+        router->rwsplit_config.connection_multiplexing = false;
+    }
+
+    /** The slaves that are connected later must be brought to the same state
+     * as the master */
+    if (router->rwsplit_config.lazy_connect &&
+        router->rwsplit_config.disable_sescmd_history)
+    {
+        MXS_WARNING("Service '%s' has 'lazy_connect' enabled but it requires "
+                    "'disable_sescmd_history=false'. The slaves are connected "
+                    "when the session is created.", service->name);
+        router->rwsplit_config.lazy_connect = false;
+    }
+
+    /** A copy of a read on another slave could miss the latest write */
+    if (router->rwsplit_config.hedged_reads &&
+        router->rwsplit_config.causal_reads)
+    {
+        MXS_WARNING("Service '%s' has both 'hedged_reads' and 'causal_reads' "
+                    "enabled. Reads are not hedged.", service->name);
+        router->rwsplit_config.hedged_reads = false;
     }
 
     return (MXS_ROUTER *)router;
@@ -361,9 +442,15 @@ static MXS_ROUTER_SESSION *newSession(MXS_ROUTER *router_inst, MXS_SESSION *sess
     client_rses->rses_backend_ref = backend_ref;
     client_rses->rses_nbackends = router_nservers; /*< # of backend servers */
 
+    /** With lazy_connect only the master is connected here, the slaves are
+     * connected when the first read is routed */
+    bool lazy = client_rses->rses_config.lazy_connect;
+    client_rses->rses_slaves_connected = !lazy;
+    client_rses->rses_answer_vars = client_rses->rses_config.answer_variable_queries;
+
     backend_ref_t *master_ref = NULL; /*< pointer to selected master */
     if (!select_connect_backend_servers(&master_ref, backend_ref, router_nservers,
-                                        max_nslaves, max_slave_rlag,
+                                        lazy ? 0 : max_nslaves, max_slave_rlag,
                                         client_rses->rses_config.slave_selection_criteria,
                                         session, router, false))
     {
@@ -388,6 +475,12 @@ static MXS_ROUTER_SESSION *newSession(MXS_ROUTER *router_inst, MXS_SESSION *sess
         client_rses->rses_config.max_slave_connections = n_conn;
     }
 
+    if (lazy && master_ref == NULL)
+    {
+        /** Without a master the session can only be served by the slaves */
+        rwsplit_lazy_connect_slaves(client_rses);
+    }
+
     router->stats.n_sessions += 1;
 
     return (void *)client_rses;
@@ -418,6 +511,8 @@ static void closeSession(MXS_ROUTER *instance, MXS_ROUTER_SESSION *router_sessio
          */
         router_cli_ses->rses_closed = true;
 
+        rwsplit_admission_cancel(router_cli_ses);
+
         for (int i = 0; i < router_cli_ses->rses_nbackends; i++)
         {
             backend_ref_t *bref = &router_cli_ses->rses_backend_ref[i];
@@ -500,6 +595,18 @@ static void freeSession(MXS_ROUTER *router_instance, MXS_ROUTER_SESSION *router_
         }
     }
 
+    for (int i = 0; i < router_cli_ses->rses_nbackends; i++)
+    {
+        modutil_reply_queue_free(&router_cli_ses->rses_backend_ref[i].bref_replies);
+        rwsplit_causal_bref_free(&router_cli_ses->rses_backend_ref[i]);
+    }
+
+    sescmd_history_free(router_cli_ses);
+    rwsplit_ps_free(router_cli_ses);
+    rwsplit_hedge_free(router_cli_ses);
+    rwsplit_split_free(router_cli_ses);
+    rwsplit_admission_free(router_cli_ses);
+    MXS_FREE(router_cli_ses->rses_gtid_pos);
     MXS_FREE(router_cli_ses->rses_backend_ref);
     MXS_FREE(router_cli_ses);
     return;
@@ -519,6 +626,7 @@ void close_failed_bref(backend_ref_t *bref, bool fatal)
     }
 
     bref_clear_state(bref, BREF_QUERY_ACTIVE);
+    bref_clear_state(bref, BREF_DISCARD_REPLY);
     bref_clear_state(bref, BREF_IN_USE);
     bref_set_state(bref, BREF_CLOSED);
 
@@ -537,6 +645,49 @@ void close_failed_bref(backend_ref_t *bref, bool fatal)
         gwbuf_free(bref->bref_pending_cmd);
         bref->bref_pending_cmd = NULL;
     }
+
+    modutil_reply_queue_free(&bref->bref_replies);
+    rwsplit_causal_bref_free(bref);
+}
+
+/**
+ * @brief Answer a variable query of a connector without routing it
+ *
+ * Only the queries sent before the first routed statement are answered. The
+ * session has no pending replies then and its state is that of a new
+ * connection, for which the global values are valid.
+ *
+ * @param rses  Router client session
+ * @param query The query
+ * @return True if the query was answered and freed
+ */
+static bool answer_variable_query(ROUTER_CLIENT_SES *rses, GWBUF *query)
+{
+    SERVER *server = NULL;
+
+    if (rses->rses_master_ref && BREF_IS_IN_USE(rses->rses_master_ref))
+    {
+        server = rses->rses_master_ref->ref->server;
+    }
+
+    for (int i = 0; server == NULL && i < rses->rses_nbackends; i++)
+    {
+        SERVER *srv = rses->rses_backend_ref[i].ref->server;
+
+        if (SERVER_IS_RUNNING(srv) && srv->n_variables > 0)
+        {
+            server = srv;
+        }
+    }
+
+    if (server && modutil_answer_variable_query(rses->client_dcb, server, query))
+    {
+        gwbuf_free(query);
+        return true;
+    }
+
+    rses->rses_answer_vars = false;
+    return false;
 }
 
 /**
@@ -566,8 +717,33 @@ static int routeQuery(MXS_ROUTER *instance, MXS_ROUTER_SESSION *router_session,
     }
     else
     {
+        bool succp;
         live_session_reply(&querybuf, rses);
-        if (route_single_stmt(inst, rses, querybuf))
+
+        if (rses->rses_answer_vars && answer_variable_query(rses, querybuf))
+        {
+            /** Answered from the variables cached by the monitor */
+            querybuf = NULL;
+            rval = 1;
+        }
+        else if (rwsplit_admission_hold(rses, querybuf))
+        {
+            /** Routed after the statement that waits for a free slot */
+            querybuf = NULL;
+            rval = 1;
+        }
+        else if (rwsplit_split_handle_query(inst, rses, querybuf, &succp))
+        {
+            /** The query was split or queued behind a split query */
+            querybuf = NULL;
+            rval = succp ? 1 : 0;
+        }
+        else if (!rwsplit_reattach_backends(rses) &&
+                 rses->rses_config.master_failure_mode == RW_FAIL_INSTANTLY)
+        {
+            MXS_ERROR("Failed to reconnect to the master of the session.");
+        }
+        else if (route_single_stmt(inst, rses, querybuf))
         {
             rval = 1;
         }
@@ -614,29 +790,106 @@ static void diagnostics(MXS_ROUTER *instance, DCB *dcb)
                router->rwsplit_config.disable_sescmd_history ? "true" : "false");
     dcb_printf(dcb, "\tmax_sescmd_history:        %d\n",
                router->rwsplit_config.max_sescmd_history);
+    dcb_printf(dcb, "\tmax_sescmd_history_size:   %" PRIu64 "\n",
+               router->rwsplit_config.max_sescmd_history_size);
     dcb_printf(dcb, "\tmaster_accept_reads:       %s\n",
                router->rwsplit_config.master_accept_reads ? "true" : "false");
+    dcb_printf(dcb, "\tconnection_multiplexing:   %s\n",
+               router->rwsplit_config.connection_multiplexing ? "true" : "false");
+    dcb_printf(dcb, "\tlazy_connect:              %s\n",
+               router->rwsplit_config.lazy_connect ? "true" : "false");
+    dcb_printf(dcb, "\tcausal_reads:              %s\n",
+               router->rwsplit_config.causal_reads ? "true" : "false");
+    dcb_printf(dcb, "\tcausal_reads_timeout:      %d\n",
+               router->rwsplit_config.causal_reads_timeout);
+    dcb_printf(dcb, "\ttrack_session_state:       %s\n",
+               router->rwsplit_config.track_session_state ? "true" : "false");
+    dcb_printf(dcb, "\tcoalesce_replies:          %s\n",
+               router->rwsplit_config.coalesce_replies ? "true" : "false");
+    dcb_printf(dcb, "\thedged_reads:              %s\n",
+               router->rwsplit_config.hedged_reads ? "true" : "false");
+    dcb_printf(dcb, "\thedged_reads_delay:        %d\n",
+               router->rwsplit_config.hedged_reads_delay);
+    dcb_printf(dcb, "\tsplit_multi_statements:    %s\n",
+               router->rwsplit_config.split_multi_statements ? "true" : "false");
+    dcb_printf(dcb, "\tgalera_write_affinity:     %s\n",
+               router->rwsplit_config.galera_write_affinity ? "true" : "false");
+    dcb_printf(dcb, "\tanswer_variable_queries:   %s\n",
+               router->rwsplit_config.answer_variable_queries ? "true" : "false");
+    dcb_printf(dcb, "\tdefer_session_commands:    %s\n",
+               router->rwsplit_config.defer_session_commands ? "true" : "false");
+    dcb_printf(dcb, "\tanalytic_threshold:        %d\n",
+               router->rwsplit_config.analytic_threshold);
+    dcb_printf(dcb, "\tanalytic_class:            %s\n",
+               router->rwsplit_config.analytic_class);
     dcb_printf(dcb, "\n");
 
-    if (router->stats.n_queries > 0)
+    int64_t n_queries = ts_stats_sum(router->stats.n_queries);
+    int64_t n_master = ts_stats_sum(router->stats.n_master);
+    int64_t n_slave = ts_stats_sum(router->stats.n_slave);
+    int64_t n_all = ts_stats_sum(router->stats.n_all);
+
+    if (n_queries > 0)
     {
-        master_pct = ((double)router->stats.n_master / (double)router->stats.n_queries) * 100.0;
-        slave_pct = ((double)router->stats.n_slave / (double)router->stats.n_queries) * 100.0;
-        all_pct = ((double)router->stats.n_all / (double)router->stats.n_queries) * 100.0;
+        master_pct = ((double)n_master / (double)n_queries) * 100.0;
+        slave_pct = ((double)n_slave / (double)n_queries) * 100.0;
+        all_pct = ((double)n_all / (double)n_queries) * 100.0;
     }
 
     dcb_printf(dcb, "\tNumber of router sessions:           	%" PRIu64 "\n",
                router->stats.n_sessions);
-    dcb_printf(dcb, "\tCurrent no. of router sessions:      	%d\n",
-               router->service->stats.n_current);
-    dcb_printf(dcb, "\tNumber of queries forwarded:          	%" PRIu64 "\n",
-               router->stats.n_queries);
-    dcb_printf(dcb, "\tNumber of queries forwarded to master:	%" PRIu64 " (%.2f%%)\n",
-               router->stats.n_master, master_pct);
-    dcb_printf(dcb, "\tNumber of queries forwarded to slave: 	%" PRIu64 " (%.2f%%)\n",
-               router->stats.n_slave, slave_pct);
-    dcb_printf(dcb, "\tNumber of queries forwarded to all:   	%" PRIu64 " (%.2f%%)\n",
-               router->stats.n_all, all_pct);
+    dcb_printf(dcb, "\tCurrent no. of router sessions:      	%" PRId64 "\n",
+               ts_stats_sum(router->service->stats.n_current));
+    dcb_printf(dcb, "\tNumber of queries forwarded:          	%" PRId64 "\n",
+               n_queries);
+    dcb_printf(dcb, "\tNumber of queries forwarded to master:	%" PRId64 " (%.2f%%)\n",
+               n_master, master_pct);
+    dcb_printf(dcb, "\tNumber of queries forwarded to slave: 	%" PRId64 " (%.2f%%)\n",
+               n_slave, slave_pct);
+    dcb_printf(dcb, "\tNumber of queries forwarded to all:   	%" PRId64 " (%.2f%%)\n",
+               n_all, all_pct);
+    dcb_printf(dcb, "\tNumber of read-only transactions on slaves:	%" PRId64 "\n",
+               ts_stats_sum(router->stats.n_ro_trx));
+
+    if (router->rwsplit_config.connection_multiplexing)
+    {
+        dcb_printf(dcb, "\tNumber of idle connections detached:  	%" PRIu64 "\n",
+                   router->stats.n_detached);
+    }
+
+    if (router->rwsplit_config.causal_reads)
+    {
+        dcb_printf(dcb, "\tNumber of causal reads retried on master:	%" PRIu64 "\n",
+                   router->stats.n_causal_retries);
+    }
+
+    if (router->rwsplit_config.track_session_state)
+    {
+        dcb_printf(dcb, "\tNumber of session states corrected by the master:	%" PRIu64 "\n",
+                   router->stats.n_trx_corrections);
+    }
+
+    if (router->rwsplit_config.hedged_reads)
+    {
+        dcb_printf(dcb, "\tNumber of reads sent to a second slave:	%" PRIu64 "\n",
+                   router->stats.n_hedged);
+        dcb_printf(dcb, "\tNumber of reads replied by the second slave:	%" PRIu64 "\n",
+                   router->stats.n_hedge_wins);
+    }
+
+    if (router->rwsplit_config.split_multi_statements)
+    {
+        dcb_printf(dcb, "\tNumber of multi-statement queries split:	%" PRIu64 "\n",
+                   router->stats.n_split);
+    }
+
+    if (router->rwsplit_config.galera_write_affinity)
+    {
+        dcb_printf(dcb, "\tNumber of writes routed to other nodes by table:	%" PRIu64 "\n",
+                   router->stats.n_affinity_writes);
+    }
+
+    rwsplit_workload_diagnostic(router, dcb);
 
     if ((weightby = serviceGetWeightingParameter(router->service)) != NULL)
     {
@@ -701,6 +954,32 @@ static void clientReply(MXS_ROUTER *instance,
     CHK_BACKEND_REF(bref);
     sescmd_cursor_t *scur = &bref->bref_sescmd_cur;
 
+    if (rwsplit_hedge_process_reply(router_cli_ses, bref, writebuf))
+    {
+        /** The other slave already replied to the hedged read */
+        return;
+    }
+
+    /** Several commands can be pipelined to one backend, follow the replies
+     * so that the query is only considered done when all of them are read */
+    if (router_cli_ses->rses_config.causal_reads ||
+        router_cli_ses->rses_config.track_session_state)
+    {
+        /** The session state information is removed from the reply and the
+         * reply to the wait of a causal read is not sent to the client */
+        if ((writebuf = rwsplit_causal_process_reply(router_inst, router_cli_ses,
+                                                     bref, writebuf)) == NULL)
+        {
+            return;
+        }
+    }
+    else
+    {
+        modutil_reply_queue_process(&bref->bref_replies, writebuf);
+    }
+
+    rwsplit_workload_reply(bref, writebuf);
+
     /** Statement was successfully executed, free the stored statement */
     session_clear_stmt(backend_dcb->session);
 
@@ -730,7 +1009,7 @@ static void clientReply(MXS_ROUTER *instance,
                     router_cli_ses->rses_config.max_slave_connections,
                     router_cli_ses->rses_config.max_slave_replication_lag,
                     router_cli_ses->rses_config.slave_selection_criteria,
-                    router_cli_ses->rses_master_ref->bref_dcb->session,
+                    backend_dcb->session,
                     router_cli_ses->router,
                     true);
             }
@@ -741,28 +1020,63 @@ static void clientReply(MXS_ROUTER *instance,
          * for other type of queries is done outside this block.
          */
 
-        /** Set response status as replied */
-        bref_clear_state(bref, BREF_WAITING_RESULT);
+        /** Set response status as replied, unless a statement that was
+         * pipelined after the commands is still executing */
+        if (!BREF_IS_PIPELINED(bref))
+        {
+            bref_clear_state(bref, BREF_WAITING_RESULT);
+        }
     }
     /**
      * Clear BREF_QUERY_ACTIVE flag and decrease waiter counter.
      * This applies for queries  other than session commands.
      */
-    else if (BREF_IS_QUERY_ACTIVE(bref))
-    {
-        bref_clear_state(bref, BREF_QUERY_ACTIVE);
+    else if (BREF_IS_QUERY_ACTIVE(bref) && bref->bref_replies.count == 0)
+    {
+        int64_t usecs = mxs_clock_us() - bref->bref_query_started;
+        server_add_response_time(bref->ref->server, usecs);
+        MXS_PROBE3(backend_reply, backend_dcb->session->ses_id,
+                   bref->ref->server->unique_name, usecs);
+        service_add_response_time(router_inst->service, usecs);
+        rwsplit_workload_record(router_inst, bref, usecs);
+        bref_clear_state(bref, BREF_QUERY_ACTIVE | BREF_PIPELINED);
         /** Set response status as replied */
         bref_clear_state(bref, BREF_WAITING_RESULT);
     }
 
+    if (writebuf != NULL)
+    {
+        /** The replies to the statements of a split query are sent as one */
+        writebuf = rwsplit_split_process_reply(router_cli_ses, writebuf);
+    }
+
     if (writebuf != NULL && client_dcb != NULL)
     {
+        /** The partial frames of a result that is still being read wait for
+         * the rest of it, the frame with the last packet is sent at once */
+        bool more = BREF_IS_QUERY_ACTIVE(bref) && bref->bref_replies.count > 0;
+
+        if (router_cli_ses->rses_config.coalesce_replies && more)
+        {
+            dcb_set_cork(client_dcb, true);
+        }
+
         /** Write reply to client DCB */
         MXS_SESSION_ROUTE_REPLY(backend_dcb->session, writebuf);
+
+        if (!more)
+        {
+            dcb_set_cork(client_dcb, false);
+        }
     }
 
     /** There is one pending session command to be executed. */
-    if (sescmd_cursor_is_active(scur))
+    if (sescmd_cursor_is_active(scur) && scur->scmd_cur_index < scur->scmd_cur_sent)
+    {
+        MXS_INFO("Backend [%s]:%d processed reply, the next session command was already sent.",
+                 bref->ref->server->name, bref->ref->server->port);
+    }
+    else if (sescmd_cursor_is_active(scur))
     {
         bool succp;
 
@@ -783,11 +1097,13 @@ static void clientReply(MXS_ROUTER *instance,
 
         CHK_GWBUF(bref->bref_pending_cmd);
 
-        if ((ret = bref->bref_dcb->func.write(bref->bref_dcb,
-                                              gwbuf_clone(bref->bref_pending_cmd))) == 1)
+        GWBUF *buffer = rwsplit_ps_map(router_cli_ses, bref, gwbuf_clone(bref->bref_pending_cmd));
+
+        if (buffer && (ret = bref->bref_dcb->func.write(bref->bref_dcb, buffer)) == 1)
         {
+            bref_expect_replies(bref, bref->bref_pending_cmd);
             ROUTER_INSTANCE* inst = (ROUTER_INSTANCE *)instance;
-            atomic_add_uint64(&inst->stats.n_queries, 1);
+            ts_stats_add(inst->stats.n_queries, 1);
             /**
              * Add one query response waiter to backend reference
              */
@@ -811,6 +1127,15 @@ static void clientReply(MXS_ROUTER *instance,
         gwbuf_free(bref->bref_pending_cmd);
         bref->bref_pending_cmd = NULL;
     }
+
+    if (router_cli_ses->rses_config.connection_multiplexing)
+    {
+        detach_idle_backend(router_inst, router_cli_ses, bref);
+    }
+
+    /** The next statement of a split query is routed once the reply to
+     * the previous one has been sent */
+    rwsplit_split_continue(router_inst, router_cli_ses);
 }
 
 
@@ -825,7 +1150,17 @@ static void clientReply(MXS_ROUTER *instance,
  */
 static uint64_t getCapabilities(MXS_ROUTER* instance)
 {
-    return RCAP_TYPE_STMT_INPUT | RCAP_TYPE_TRANSACTION_TRACKING;
+    uint64_t rval = RCAP_TYPE_STMT_INPUT | RCAP_TYPE_TRANSACTION_TRACKING;
+
+    /** The GTIDs of the writes and the state of the session are read from
+     * the session state information */
+    if (instance && (((ROUTER_INSTANCE*)instance)->rwsplit_config.causal_reads ||
+                     ((ROUTER_INSTANCE*)instance)->rwsplit_config.track_session_state))
+    {
+        rval |= RCAP_TYPE_SESSION_STATE_TRACKING;
+    }
+
+    return rval;
 }
 
 /*
@@ -858,7 +1193,6 @@ void bref_clear_state(backend_ref_t *bref, bref_state_t state)
     if ((state & BREF_WAITING_RESULT) && (bref->bref_state & BREF_WAITING_RESULT))
     {
         int prev1;
-        int prev2;
 
         /** Decrease waiter count */
         prev1 = atomic_add(&bref->bref_num_result_wait, -1);
@@ -869,21 +1203,41 @@ void bref_clear_state(backend_ref_t *bref, bref_state_t state)
         }
         else
         {
-            /** Decrease global operation count */
-            prev2 = atomic_add(&bref->ref->server->stats.n_current_ops, -1);
-            ss_dassert(prev2 > 0);
-            if (prev2 <= 0)
-            {
-                MXS_ERROR("[%s] Error: negative current operation count in backend %s:%u",
-                          __FUNCTION__, bref->ref->server->name,
-                          bref->ref->server->port);
-            }
+            /** Decrease global operation count, a waiting query may take the slot */
+            server_end_op(bref->ref->server);
         }
     }
 
     bref->bref_state &= ~state;
 }
 
+/**
+ * @brief Record the commands that were written to a backend
+ *
+ * Only the first packet of a command has the sequence number zero. The other
+ * packets, e.g. the data of a LOAD DATA LOCAL INFILE, generate no replies of
+ * their own and are skipped.
+ *
+ * @param bref   The backend reference that was written to
+ * @param buffer The packets that were written
+ */
+void bref_expect_replies(backend_ref_t *bref, GWBUF *buffer)
+{
+    uint8_t header[MYSQL_HEADER_LEN + 1];
+
+    for (size_t offset = 0;
+         gwbuf_copy_data(buffer, offset, sizeof(header), header) == sizeof(header);
+         offset += MYSQL_HEADER_LEN + gw_mysql_get_byte3(header))
+    {
+        /** On allocation failure the reply is considered complete at the
+         * first reply packet, which is how all replies used to be handled */
+        if (header[3] == 0)
+        {
+            modutil_reply_queue_push(&bref->bref_replies, header[4]);
+        }
+    }
+}
+
 /*
  * @brief Set one or more bits in the backend reference state
  *
@@ -907,7 +1261,6 @@ void bref_set_state(backend_ref_t *bref, bref_state_t state)
     if ((state & BREF_WAITING_RESULT) && (bref->bref_state & BREF_WAITING_RESULT) == 0)
     {
         int prev1;
-        int prev2;
 
         /** Increase waiter count */
         prev1 = atomic_add(&bref->bref_num_result_wait, 1);
@@ -918,16 +1271,23 @@ void bref_set_state(backend_ref_t *bref, bref_state_t state)
                       "results in backend %s:%u", __FUNCTION__,
                       bref->ref->server->name, bref->ref->server->port);
         }
-        /** Increase global operation count */
-        prev2 = atomic_add(&bref->ref->server->stats.n_current_ops, 1);
-        ss_dassert(prev2 >= 0);
-        if (prev2 < 0)
+        /** Increase global operation count unless a slot was reserved for the query */
+        if (bref->bref_op_reserved)
+        {
+            bref->bref_op_reserved = false;
+        }
+        else
         {
-            MXS_ERROR("[%s] Error: negative current operation count in backend %s:%u",
-                      __FUNCTION__, bref->ref->server->name, bref->ref->server->port);
+            server_start_op(bref->ref->server);
         }
     }
 
+    if ((state & BREF_QUERY_ACTIVE) && (bref->bref_state & BREF_QUERY_ACTIVE) == 0)
+    {
+        /** The response time is measured from the first of the pipelined queries */
+        bref->bref_query_started = mxs_clock_us();
+    }
+
     bref->bref_state |= state;
 }
 
@@ -949,10 +1309,6 @@ void rses_property_done(rses_property_t *prop)
 
     switch (prop->rses_prop_type)
     {
-    case RSES_PROP_TYPE_SESCMD:
-        mysql_sescmd_done(&prop->rses_prop_data.sescmd);
-        break;
-
     case RSES_PROP_TYPE_TMPTABLES:
         hashtable_free(prop->rses_prop_data.temp_tables);
         break;
@@ -1159,14 +1515,16 @@ static bool rwsplit_process_router_options(ROUTER_INSTANCE *router,
                 c = GET_SELECT_CRITERIA(value);
                 ss_dassert(c == LEAST_GLOBAL_CONNECTIONS ||
                            c == LEAST_ROUTER_CONNECTIONS || c == LEAST_BEHIND_MASTER ||
-                           c == LEAST_CURRENT_OPERATIONS || c == UNDEFINED_CRITERIA);
+                           c == LEAST_CURRENT_OPERATIONS || c == ADAPTIVE_ROUTING ||
+                           c == LEAST_SERVER_LOAD || c == UNDEFINED_CRITERIA);
 
                 if (c == UNDEFINED_CRITERIA)
                 {
                     MXS_ERROR("Unknown slave selection criteria \"%s\". "
                               "Allowed values are LEAST_GLOBAL_CONNECTIONS, "
-                              "LEAST_ROUTER_CONNECTIONS, LEAST_BEHIND_MASTER,"
-                              "and LEAST_CURRENT_OPERATIONS.",
+                              "LEAST_ROUTER_CONNECTIONS, LEAST_BEHIND_MASTER, "
+                              "LEAST_CURRENT_OPERATIONS, ADAPTIVE_ROUTING and "
+                              "LEAST_SERVER_LOAD.",
                               STRCRITERIA(router->rwsplit_config.slave_selection_criteria));
                     success = false;
                 }
@@ -1179,6 +1537,10 @@ static bool rwsplit_process_router_options(ROUTER_INSTANCE *router,
             {
                 router->rwsplit_config.max_sescmd_history = atoi(value);
             }
+            else if (strcmp(options[i], "max_sescmd_history_size") == 0)
+            {
+                router->rwsplit_config.max_sescmd_history_size = strtoull(value, NULL, 10);
+            }
             else if (strcmp(options[i], "disable_sescmd_history") == 0)
             {
                 router->rwsplit_config.disable_sescmd_history = config_truth_value(value);
@@ -1195,6 +1557,63 @@ static bool rwsplit_process_router_options(ROUTER_INSTANCE *router,
             {
                 router->rwsplit_config.strict_sp_calls = config_truth_value(value);
             }
+            else if (strcmp(options[i], "connection_multiplexing") == 0)
+            {
+                router->rwsplit_config.connection_multiplexing = config_truth_value(value);
+            }
+            else if (strcmp(options[i], "lazy_connect") == 0)
+            {
+                router->rwsplit_config.lazy_connect = config_truth_value(value);
+            }
+            else if (strcmp(options[i], "causal_reads") == 0)
+            {
+                router->rwsplit_config.causal_reads = config_truth_value(value);
+            }
+            else if (strcmp(options[i], "causal_reads_timeout") == 0)
+            {
+                router->rwsplit_config.causal_reads_timeout = atoi(value);
+            }
+            else if (strcmp(options[i], "track_session_state") == 0)
+            {
+                router->rwsplit_config.track_session_state = config_truth_value(value);
+            }
+            else if (strcmp(options[i], "coalesce_replies") == 0)
+            {
+                router->rwsplit_config.coalesce_replies = config_truth_value(value);
+            }
+            else if (strcmp(options[i], "hedged_reads") == 0)
+            {
+                router->rwsplit_config.hedged_reads = config_truth_value(value);
+            }
+            else if (strcmp(options[i], "hedged_reads_delay") == 0)
+            {
+                router->rwsplit_config.hedged_reads_delay = atoi(value);
+            }
+            else if (strcmp(options[i], "split_multi_statements") == 0)
+            {
+                router->rwsplit_config.split_multi_statements = config_truth_value(value);
+            }
+            else if (strcmp(options[i], "galera_write_affinity") == 0)
+            {
+                router->rwsplit_config.galera_write_affinity = config_truth_value(value);
+            }
+            else if (strcmp(options[i], "answer_variable_queries") == 0)
+            {
+                router->rwsplit_config.answer_variable_queries = config_truth_value(value);
+            }
+            else if (strcmp(options[i], "defer_session_commands") == 0)
+            {
+                router->rwsplit_config.defer_session_commands = config_truth_value(value);
+            }
+            else if (strcmp(options[i], "analytic_threshold") == 0)
+            {
+                router->rwsplit_config.analytic_threshold = atoi(value);
+            }
+            else if (strcmp(options[i], "analytic_class") == 0)
+            {
+                MXS_FREE(router->rwsplit_config.analytic_class);
+                router->rwsplit_config.analytic_class = MXS_STRDUP_A(value);
+            }
             else if (strcmp(options[i], "retry_failed_reads") == 0)
             {
                 router->rwsplit_config.retry_failed_reads = config_truth_value(value);
@@ -1288,6 +1707,12 @@ static void handleError(MXS_ROUTER *instance,
     MXS_SESSION *session = problem_dcb->session;
     ss_dassert(session);
 
+    if (session->client_dcb)
+    {
+        /** The error is sent to the client without delay */
+        dcb_set_cork(session->client_dcb, false);
+    }
+
     if (problem_dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER)
     {
         dcb_close(problem_dcb);
@@ -1453,6 +1878,28 @@ static void handle_error_reply_client(MXS_SESSION *ses, ROUTER_CLIENT_SES *rses,
     }
 }
 
+/**
+ * Write a copy of a stored statement to a backend
+ *
+ * @param rses   Router session
+ * @param bref   The backend to write to
+ * @param stored The stored statement, not consumed
+ * @return True if the statement was written
+ */
+static bool reroute_to_backend(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *stored)
+{
+    GWBUF *buffer = rwsplit_ps_map(rses, bref, gwbuf_clone(stored));
+
+    if (buffer && bref->bref_dcb->func.write(bref->bref_dcb, buffer))
+    {
+        bref_expect_replies(bref, stored);
+        MXS_INFO("Retrying failed read at '%s'.", bref->ref->server->unique_name);
+        return true;
+    }
+
+    return false;
+}
+
 static bool reroute_stored_statement(ROUTER_CLIENT_SES *rses, backend_ref_t *old, GWBUF *stored)
 {
     bool success = false;
@@ -1469,31 +1916,28 @@ static bool reroute_stored_statement(ROUTER_CLIENT_SES *rses, backend_ref_t *old
 
             if (BREF_IS_IN_USE(bref) && bref != old &&
                 !SERVER_IS_MASTER(bref->ref->server) &&
-                SERVER_IS_SLAVE(bref->ref->server))
+                SERVER_IS_SLAVE(bref->ref->server) &&
+                reroute_to_backend(rses, bref, stored))
             {
                 /** Found a valid candidate; a non-master slave that's in use */
-                if (bref->bref_dcb->func.write(bref->bref_dcb, stored))
-                {
-                    MXS_INFO("Retrying failed read at '%s'.", bref->ref->server->unique_name);
-                    success = true;
-                    break;
-                }
+                success = true;
+                break;
             }
         }
 
-        if (!success && rses->rses_master_ref && BREF_IS_IN_USE(rses->rses_master_ref))
+        /**
+         * Either we failed to write to the slave or no valid slave was found.
+         * Try to retry the read on the master.
+         */
+        if (!success && rses->rses_master_ref && BREF_IS_IN_USE(rses->rses_master_ref) &&
+            reroute_to_backend(rses, rses->rses_master_ref, stored))
         {
-            /**
-             * Either we failed to write to the slave or no valid slave was found.
-             * Try to retry the read on the master.
-             */
-            backend_ref_t *bref = rses->rses_master_ref;
+            success = true;
+        }
 
-            if (bref->bref_dcb->func.write(bref->bref_dcb, stored))
-            {
-                MXS_INFO("Retrying failed read at '%s'.", bref->ref->server->unique_name);
-                success = true;
-            }
+        if (success)
+        {
+            gwbuf_free(stored);
         }
     }
 
@@ -1545,9 +1989,15 @@ static bool handle_error_new_connection(ROUTER_INSTANCE *inst,
     /**
      * If query was sent through the bref and it is waiting for reply from
      * the backend server it is necessary to send an error to the client
-     * because it is waiting for reply.
+     * because it is waiting for reply. With hedged reads the other slave can
+     * reply instead.
      */
-    if (BREF_IS_WAITING_RESULT(bref))
+    if (rwsplit_hedge_handle_error(myrses, bref))
+    {
+        MXS_INFO("Hedged read failed on [%s]:%d, the other slave replies to it.",
+                 bref->ref->server->name, bref->ref->server->port);
+    }
+    else if (BREF_IS_WAITING_RESULT(bref))
     {
         GWBUF *stored = NULL;
         const SERVER *target = NULL;
@@ -1600,6 +2050,55 @@ static bool handle_error_new_connection(ROUTER_INSTANCE *inst,
     return succp;
 }
 
+/**
+ * @brief Return an idle backend connection to the connection pool
+ *
+ * The connection is detached only when the session is between transactions
+ * and all of its state can be restored by executing the session command
+ * history. The connection that executed the latest statement is kept if the
+ * statement was a write as the next statement may read its results. The
+ * backend is reattached when the next statement is routed and the reused
+ * connection is reset by the backend protocol with COM_CHANGE_USER.
+ *
+ * @param inst Router instance
+ * @param rses Router session
+ * @param bref The backend that replied
+ */
+static void detach_idle_backend(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
+                                backend_ref_t *bref)
+{
+    MXS_SESSION *session = rses->client_dcb->session;
+    DCB *dcb = bref->bref_dcb;
+
+    if (!BREF_IS_IN_USE(bref) || BREF_IS_QUERY_ACTIVE(bref) ||
+        BREF_IS_WAITING_RESULT(bref) || bref->bref_replies.count > 0 ||
+        bref->bref_pending_cmd || sescmd_cursor_is_active(&bref->bref_sescmd_cur) ||
+        rses->rses_pinned || rses->rses_after_write ||
+        rses->have_tmp_tables || rses->rses_load_active ||
+        rses->rses_config.disable_sescmd_history ||
+        session_trx_is_active(session) || !session_is_autocommit(session) ||
+        dcb->server->persistpoolmax == 0 || dcb->state != DCB_STATE_POLLING)
+    {
+        return;
+    }
+
+    MXS_INFO("Detaching idle connection to [%s]:%d from the session.",
+             bref->ref->server->name, bref->ref->server->port);
+
+    bref_clear_state(bref, BREF_IN_USE);
+    bref_set_state(bref, BREF_CLOSED | BREF_DETACHED);
+    modutil_reply_queue_free(&bref->bref_replies);
+
+    /** The session is still open so the pool must be told to take the DCB */
+    dcb->flags |= DCBF_REUSABLE;
+    dcb_close(dcb);
+    RW_CLOSE_BREF(bref);
+    bref->bref_dcb = NULL;
+
+    atomic_add(&bref->ref->connections, -1);
+    atomic_add_uint64(&inst->stats.n_detached, 1);
+}
+
 /**
  * @brief Calculate whether we have enough servers to route a query
  *
@@ -1673,6 +2172,12 @@ static void free_rwsplit_instance(ROUTER_INSTANCE *router)
 {
     if (router)
     {
+        ts_stats_free(router->stats.n_queries);
+        ts_stats_free(router->stats.n_master);
+        ts_stats_free(router->stats.n_slave);
+        ts_stats_free(router->stats.n_all);
+        ts_stats_free(router->stats.n_ro_trx);
+        rwsplit_workload_free(router);
         MXS_FREE(router);
     }
 }
@@ -1712,12 +2217,7 @@ static bool create_backends(ROUTER_CLIENT_SES *rses, backend_ref_t** dest, int*
 #endif
             backend_ref[i].bref_state = 0;
             backend_ref[i].ref = sref;
-            /** store pointers to sescmd list to both cursors */
-            backend_ref[i].bref_sescmd_cur.scmd_cur_rses = rses;
-            backend_ref[i].bref_sescmd_cur.scmd_cur_active = false;
-            backend_ref[i].bref_sescmd_cur.scmd_cur_ptr_property =
-                &rses->rses_properties[RSES_PROP_TYPE_SESCMD];
-            backend_ref[i].bref_sescmd_cur.scmd_cur_cmd = NULL;
+            sescmd_cursor_init(&backend_ref[i].bref_sescmd_cur, rses);
             i++;
         }
     }
@@ -33,6 +33,8 @@
 
 #include <maxscale/dcb.h>
 #include <maxscale/hashtable.h>
+#include <maxscale/modutil.h>
+#include <maxscale/query_classifier.h>
 #include <maxscale/router.h>
 #include <maxscale/service.h>
 
@@ -44,7 +46,10 @@ typedef enum bref_state
     BREF_WAITING_RESULT   = 0x02, /*< for session commands only */
     BREF_QUERY_ACTIVE     = 0x04, /*< for other queries */
     BREF_CLOSED           = 0x08,
-    BREF_FATAL_FAILURE    = 0x10 /*< Backend references that should be dropped */
+    BREF_FATAL_FAILURE    = 0x10, /*< Backend references that should be dropped */
+    BREF_DETACHED         = 0x20, /*< Idle connection was returned to the pool */
+    BREF_DISCARD_REPLY    = 0x40, /*< The other copy of a hedged read replied first */
+    BREF_PIPELINED        = 0x80 /*< A statement follows the pipelined session commands */
 } bref_state_t;
 
 #define BREF_IS_NOT_USED(s)         ((s)->bref_state & ~BREF_IN_USE)
@@ -53,6 +58,9 @@ typedef enum bref_state
 #define BREF_IS_QUERY_ACTIVE(s)     ((s)->bref_state & BREF_QUERY_ACTIVE)
 #define BREF_IS_CLOSED(s)           ((s)->bref_state & BREF_CLOSED)
 #define BREF_HAS_FAILED(s)          ((s)->bref_state & BREF_FATAL_FAILURE)
+#define BREF_IS_DETACHED(s)         ((s)->bref_state & BREF_DETACHED)
+#define BREF_IS_DISCARDING(s)       ((s)->bref_state & BREF_DISCARD_REPLY)
+#define BREF_IS_PIPELINED(s)        ((s)->bref_state & BREF_PIPELINED)
 
 typedef enum backend_type_t
 {
@@ -87,9 +95,8 @@ typedef struct router_client_session ROUTER_CLIENT_SES;
 typedef enum rses_property_type_t
 {
     RSES_PROP_TYPE_UNDEFINED = -1,
-    RSES_PROP_TYPE_SESCMD    = 0,
-    RSES_PROP_TYPE_FIRST     = RSES_PROP_TYPE_SESCMD,
-    RSES_PROP_TYPE_TMPTABLES,
+    RSES_PROP_TYPE_TMPTABLES = 0,
+    RSES_PROP_TYPE_FIRST     = RSES_PROP_TYPE_TMPTABLES,
     RSES_PROP_TYPE_LAST      = RSES_PROP_TYPE_TMPTABLES,
     RSES_PROP_TYPE_COUNT     = RSES_PROP_TYPE_LAST + 1
 } rses_property_type_t;
@@ -106,8 +113,10 @@ typedef enum select_criteria
     LEAST_ROUTER_CONNECTIONS,   /*< connections established by this router */
     LEAST_BEHIND_MASTER,
     LEAST_CURRENT_OPERATIONS,
-    DEFAULT_CRITERIA   = LEAST_CURRENT_OPERATIONS,
-    LAST_CRITERIA               /*< not used except for an index */
+    ADAPTIVE_ROUTING,           /*< expected response time of the server */
+    LEAST_SERVER_LOAD,          /*< threads running as reported by the monitor */
+    LAST_CRITERIA,              /*< not used except for an index */
+    DEFAULT_CRITERIA   = LEAST_CURRENT_OPERATIONS
 } select_criteria_t;
 
 static inline const char* select_criteria_to_str(select_criteria_t type)
@@ -126,6 +135,12 @@ static inline const char* select_criteria_to_str(select_criteria_t type)
     case LEAST_CURRENT_OPERATIONS:
         return "LEAST_CURRENT_OPERATIONS";
 
+    case ADAPTIVE_ROUTING:
+        return "ADAPTIVE_ROUTING";
+
+    case LEAST_SERVER_LOAD:
+        return "LEAST_SERVER_LOAD";
+
     default:
         return "UNDEFINED_CRITERIA";
     }
@@ -173,7 +188,45 @@ static inline const char* failure_mode_to_str(enum failure_mode type)
         strncmp(s,"LEAST_ROUTER_CONNECTIONS", strlen("LEAST_ROUTER_CONNECTIONS")) == 0 ?        \
         LEAST_ROUTER_CONNECTIONS : (                                                            \
         strncmp(s,"LEAST_CURRENT_OPERATIONS", strlen("LEAST_CURRENT_OPERATIONS")) == 0 ?        \
-        LEAST_CURRENT_OPERATIONS : UNDEFINED_CRITERIA))))
+        LEAST_CURRENT_OPERATIONS : (                                                            \
+        strncmp(s,"ADAPTIVE_ROUTING", strlen("ADAPTIVE_ROUTING")) == 0 ?                        \
+        ADAPTIVE_ROUTING : (                                                                    \
+        strncmp(s,"LEAST_SERVER_LOAD", strlen("LEAST_SERVER_LOAD")) == 0 ?                      \
+        LEAST_SERVER_LOAD : UNDEFINED_CRITERIA))))))
+
+/**
+ * The servers a read can be routed to
+ */
+typedef enum rwsplit_workload
+{
+    RWSPLIT_WORKLOAD_ANY,      /**< Any server */
+    RWSPLIT_WORKLOAD_OLTP,     /**< Preferably not an analytic server */
+    RWSPLIT_WORKLOAD_ANALYTIC  /**< Preferably an analytic server */
+} rwsplit_workload_t;
+
+/** Number of log2 millisecond buckets in the execution time histogram */
+#define RWSPLIT_COST_BUCKETS 20
+/** Number of digests whose cost is profiled */
+#define RWSPLIT_COST_SLOTS   4096
+/** Number of locks the profiles are divided between */
+#define RWSPLIT_COST_STRIPES 64
+
+/**
+ * The running cost of the reads with one canonical digest
+ *
+ * The totals are halved when the count gets large so that the profile
+ * follows the recent executions.
+ */
+typedef struct rwsplit_cost_st
+{
+    uint64_t digest;   /**< Canonical digest, zero if the slot is free */
+    uint64_t count;    /**< Number of executions */
+    uint64_t time_us;  /**< Total backend time in microseconds */
+    uint64_t rows;     /**< Total rows returned */
+    uint64_t bytes;    /**< Total bytes returned */
+    uint32_t hist[RWSPLIT_COST_BUCKETS]; /**< Executions by backend time, bucket N
+                                           * is below 2^N milliseconds */
+} rwsplit_cost_t;
 
 /**
  * Session variable command
@@ -183,7 +236,6 @@ typedef struct mysql_sescmd_st
 #if defined(SS_DEBUG)
     skygw_chk_t        my_sescmd_chk_top;
 #endif
-    rses_property_t*   my_sescmd_prop;       /*< parent property */
     GWBUF*             my_sescmd_buf;        /*< query buffer */
     unsigned char      my_sescmd_packet_type; /*< packet type */
     bool               my_sescmd_is_replied; /*< is cmd replied to client */
@@ -191,11 +243,28 @@ typedef struct mysql_sescmd_st
                                    *  LOCAL_INFILE. Slave servers are compared to this
                                    *  when they return session command replies.*/
     int      position; /*< Position of this command */
+    char*    my_sescmd_key; /*< What the command sets, NULL if it can't be
+                             *  replaced by a later command */
 #if defined(SS_DEBUG)
     skygw_chk_t        my_sescmd_chk_tail;
 #endif
 } mysql_sescmd_t;
 
+/**
+ * The session command history
+ *
+ * The commands are stored in a ring buffer whose size is a power of two. Each
+ * command has an index that is one larger than the index of the previous
+ * command and the slot of the command is its index modulo the capacity.
+ */
+typedef struct sescmd_history_st
+{
+    mysql_sescmd_t* cmds;     /*< The slots of the ring */
+    uint64_t        capacity; /*< Number of slots, zero or a power of two */
+    uint64_t        first;    /*< Index of the oldest stored command */
+    uint64_t        end;      /*< Index that the next command gets */
+} sescmd_history_t;
+
 /**
  * Property structure
  */
@@ -210,7 +279,6 @@ struct rses_property_st
 
     union rses_prop_data
     {
-        mysql_sescmd_t   sescmd;
         HASHTABLE*       temp_tables;
     } rses_prop_data;
     rses_property_t*     rses_prop_next; /*< next property of same type */
@@ -225,9 +293,12 @@ typedef struct sescmd_cursor_st
     skygw_chk_t        scmd_cur_chk_top;
 #endif
     ROUTER_CLIENT_SES* scmd_cur_rses;         /*< pointer to owning router session */
-    rses_property_t**  scmd_cur_ptr_property; /*< address of pointer to owner property */
-    mysql_sescmd_t*    scmd_cur_cmd;          /*< pointer to current session command */
+    uint64_t           scmd_cur_index;        /*< history index of the current command,
+                                               *  the end of the history if none */
     bool               scmd_cur_active;       /*< true if command is being executed */
+    uint64_t           scmd_cur_sent;         /*< history index after the commands that
+                                               *  were written without waiting for the
+                                               *  replies */
     int                position; /*< Position of this cursor */
 #if defined(SS_DEBUG)
     skygw_chk_t        scmd_cur_chk_tail;
@@ -250,8 +321,21 @@ typedef struct backend_ref_st
     int             bref_num_result_wait;
     sescmd_cursor_t bref_sescmd_cur;
     GWBUF*          bref_pending_cmd; /**< For stmt which can't be routed due active sescmd execution */
+    MXS_REPLY_QUEUE bref_replies; /**< The commands whose replies have not yet been read */
     unsigned char   reply_cmd;  /**< The reply the backend server sent to a session command.
                                  * Used to detect slaves that fail to execute session command. */
+    uint64_t        bref_query_started; /**< When the oldest unanswered query was sent,
+                                         * in microseconds */
+    GWBUF*          bref_causal_read;  /**< A read whose wait for the GTID of the
+                                        * session is being executed */
+    GWBUF*          bref_reply_residue; /**< Start of a reply packet that is not
+                                         * yet complete, for causal reads */
+    bool            bref_op_reserved; /**< A slot on the server was reserved
+                                       * for the next query */
+    uint64_t        bref_cost_digest; /**< Digest of the read whose cost is measured,
+                                       * zero if none */
+    uint64_t        bref_cost_rows;   /**< Rows of the reply queue when the read was sent */
+    uint64_t        bref_cost_bytes;  /**< Bytes of the reply read so far */
 #if defined(SS_DEBUG)
     skygw_chk_t     bref_chk_tail;
 #endif
@@ -268,6 +352,7 @@ typedef struct rwsplit_config_st
     mxs_target_t      use_sql_variables_in; /**< Whether to send user variables
                                                 * to master or all nodes */
     int               max_sescmd_history; /**< Maximum amount of session commands to store */
+    uint64_t          max_sescmd_history_size; /**< Maximum size of the stored session commands */
     bool              disable_sescmd_history; /**< Disable session command history */
     bool              master_accept_reads; /**< Use master for reads */
     bool              strict_multi_stmt; /**< Force non-multistatement queries to be routed
@@ -276,29 +361,66 @@ typedef struct rwsplit_config_st
     enum failure_mode master_failure_mode; /**< Master server failure handling mode.
                                                * @see enum failure_mode */
     bool              retry_failed_reads; /**< Retry failed reads on other servers */
+    bool              lazy_connect; /**< Connect to the slaves when the first
+                                     * read is routed */
+    bool              causal_reads; /**< Make reads on slaves wait for the
+                                      * preceding writes of the session */
+    int               causal_reads_timeout; /**< Seconds a slave may wait for a write */
+    bool              track_session_state; /**< Correct the session state with the
+                                             * state the master reports */
+    bool              coalesce_replies; /**< Send the partial frames of a result
+                                         * with the rest of it */
+    bool              hedged_reads; /**< Send slow reads to a second slave */
+    int               hedged_reads_delay; /**< Milliseconds to wait before the second
+                                           * copy is sent, zero for automatic */
+    bool              split_multi_statements; /**< Route the statements of a
+                                              * multi-statement query separately */
+    bool              connection_multiplexing; /**< Return idle backend connections
+                                                 * to the connection pool */
+    bool              galera_write_affinity; /**< Spread the writes over the Galera
+                                               * nodes by table */
+    bool              answer_variable_queries; /**< Answer the variable queries of
+                                                 * connectors from the cache */
+    bool              defer_session_commands; /**< Send the session commands to a
+                                                * slave with the next statement
+                                                * routed to it */
+    int               analytic_threshold; /**< Average milliseconds above which reads
+                                          * of a digest are analytic, zero to disable */
+    char*             analytic_class; /**< The workload_class of the servers that
+                                       * execute the analytic reads */
 } rwsplit_config_t;
 
-#if defined(PREP_STMT_CACHING)
-
-typedef struct prep_stmt_st
+/**
+ * A statement that waits for a free slot on a server whose number of
+ * concurrent queries is limited. The statements that the client sends
+ * meanwhile are held and routed once the statement has been sent.
+ */
+typedef struct rwsplit_admission_st
 {
-#if defined(SS_DEBUG)
-    skygw_chk_t       pstmt_chk_top;
-#endif
+    SERVER_WAITER  waiter;  /**< The entry in the queue of the server */
+    MXS_SESSION   *session; /**< Reference to the session, held while queued */
+    backend_ref_t *bref;    /**< The target, NULL if nothing is queued */
+    GWBUF         *query;   /**< The queued statement */
+    GWBUF         *held;    /**< Statements received while one is queued */
+    bool           store;   /**< Whether the statement is stored for retrying */
+    uint32_t       seq;     /**< Identifies the queued statement to its timer */
+} rwsplit_admission_t;
 
-    union id
-    {
-        int   seq;
-        char* name;
-    } pstmt_id;
-    prep_stmt_state_t pstmt_state;
-    prep_stmt_type_t  pstmt_type;
-#if defined(SS_DEBUG)
-    skygw_chk_t       pstmt_chk_tail;
-#endif
-} prep_stmt_t;
-
-#endif /*< PREP_STMT_CACHING */
+/**
+ * A prepared statement of the binary protocol
+ *
+ * Read-only statements are prepared on all backends. Each backend assigns its
+ * own ID to the statement and the ID the client sees is the one in the reply
+ * that was sent to the client.
+ */
+typedef struct rwsplit_ps_st
+{
+    uint32_t        id;          /**< The ID used by the client, zero until known */
+    int             position;    /**< Position of the session command that prepared it */
+    qc_query_type_t type;        /**< Type of the prepared statement */
+    bool            long_data;   /**< Whether COM_STMT_SEND_LONG_DATA was sent to the master */
+    uint32_t        backend_ids[]; /**< The IDs indexed by backend reference, zero if unknown */
+} rwsplit_ps_t;
 
 /**
  * The client session structure used within this router.
@@ -310,20 +432,47 @@ struct router_client_session
 #endif
     bool             rses_closed;    /*< true when closeSession is called */
     rses_property_t* rses_properties[RSES_PROP_TYPE_COUNT]; /*< Properties listed by their type */
+    sescmd_history_t rses_sescmd_history; /*< The session commands */
     backend_ref_t*   rses_master_ref;
     backend_ref_t*   rses_backend_ref; /*< Pointer to backend reference array */
     rwsplit_config_t rses_config;    /*< copied config info from router instance */
     int              rses_nbackends;
-    int              rses_nsescmd;  /*< Number of executed session commands */
+    int              rses_nsescmd;  /*< Number of stored session commands */
+    uint64_t         rses_sescmd_size; /*< Size of the stored session commands */
     bool             rses_load_active; /*< If LOAD DATA LOCAL INFILE is being currently executed */
+    bool             rses_slaves_connected; /*< Whether the slaves have been connected */
     bool             have_tmp_tables;
+    bool             rses_pinned; /*< Session state that is not in the session command
+                                   * history prevents detaching backends */
+    bool             rses_after_write; /*< The latest statement was a write */
     uint64_t         rses_load_data_sent; /*< How much data has been sent */
     DCB*             client_dcb;
     int              pos_generator;
     backend_ref_t    *forced_node; /*< Current server where all queries should be sent */
-#if defined(PREP_STMT_CACHING)
-    HASHTABLE*       rses_prep_stmt[2];
-#endif
+    HASHTABLE*       rses_ps_pos; /*< Prepared statements by session command position */
+    HASHTABLE*       rses_ps_ids; /*< Prepared statements by client ID */
+    char*            rses_gtid_pos; /*< GTID of the latest write, for causal reads */
+    GWBUF*           rses_hedge_query; /*< The read that is hedged, NULL if none */
+    backend_ref_t*   rses_hedge_bref; /*< The slave the hedged read was first sent to */
+    backend_ref_t*   rses_hedge_second; /*< The slave the second copy was sent to */
+    uint32_t         rses_hedge_seq; /*< Identifies the hedged read to its timer */
+    GWBUF*           rses_split_stmts; /*< Statements of a split query that are not routed yet */
+    GWBUF*           rses_split_queued; /*< Queries sent while a split query is executed */
+    GWBUF*           rses_split_residue; /*< Partial packet of the reply to a split query */
+    MXS_REPLY_QUEUE  rses_split_replies; /*< Follows the replies to the split statements */
+    uint8_t          rses_split_seq; /*< Sequence number of the next reply packet */
+    bool             rses_split_active; /*< A split query is being executed */
+    bool             rses_split_next; /*< The reply to a split statement is complete */
+    rwsplit_admission_t rses_admission; /*< The statement waiting for a free slot */
+    backend_ref_t*   rses_affinity_bref; /*< The node of the latest write routed by
+                                          * table affinity */
+    backend_ref_t*   rses_large_bref; /*< The server that receives the rest of a packet
+                                       * larger than 16MB, NULL if none */
+    bool             rses_answer_vars; /*< Variable queries are still answered from the
+                                        * cache, until the first routed statement */
+    uint64_t         rses_cost_digest; /*< Digest of the read being routed, zero if
+                                        * its cost is not measured */
+    rwsplit_workload_t rses_workload; /*< The servers the read being routed can use */
     struct router_instance *router;   /*< The router instance */
     struct router_client_session *next;
 #if defined(SS_DEBUG)
@@ -337,10 +486,19 @@ struct router_client_session
 typedef struct
 {
     uint64_t n_sessions; /*< Number sessions created */
-    uint64_t n_queries;  /*< Number of queries forwarded */
-    uint64_t n_master;   /*< Number of stmts sent to master */
-    uint64_t n_slave;    /*< Number of stmts sent to slave */
-    uint64_t n_all;      /*< Number of stmts sent to all */
+    ts_stats_t n_queries; /*< Number of queries forwarded */
+    ts_stats_t n_master;  /*< Number of stmts sent to master */
+    ts_stats_t n_slave;   /*< Number of stmts sent to slave */
+    ts_stats_t n_all;     /*< Number of stmts sent to all */
+    uint64_t n_detached; /*< Number of idle connections returned to the pool */
+    uint64_t n_causal_retries; /*< Causal reads that timed out on a slave */
+    uint64_t n_trx_corrections; /*< Session states corrected by the state the master reported */
+    ts_stats_t n_ro_trx; /*< Read-only transactions routed to a slave */
+    uint64_t n_hedged; /*< Reads that were sent to a second slave */
+    uint64_t n_hedge_wins; /*< Hedged reads where the second slave replied first */
+    uint64_t n_split; /*< Multi-statement queries that were split */
+    uint64_t n_affinity_writes; /*< Writes routed by table to a node other than the master */
+    uint64_t n_analytic; /*< Reads routed to the analytic servers by their cost */
 } ROUTER_STATS;
 
 /**
@@ -353,6 +511,10 @@ typedef struct router_instance
     int                     rwsplit_version; /*< version number for router's config */
     ROUTER_STATS            stats;       /*< Statistics for this router */
     bool                    available_slaves; /*< The router has some slaves avialable */
+    rwsplit_cost_t*         cost_profiles; /*< Costs of the reads by digest, NULL if
+                                            * the reads are not classified */
+    SPINLOCK                cost_locks[RWSPLIT_COST_STRIPES]; /*< Locks of the stripes
+                                                                * of cost_profiles */
 } ROUTER_INSTANCE;
 
 #define BACKEND_TYPE(b) (SERVER_IS_MASTER((b)->backend_server) ? BE_MASTER :    \
@@ -0,0 +1,362 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include "readwritesplit.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <mysqld_error.h>
+
+#include <maxscale/alloc.h>
+#include <maxscale/modutil.h>
+#include <maxscale/poll.h>
+#include <maxscale/router.h>
+#include "rwsplit_internal.h"
+
+/**
+ * @file rwsplit_admission.c   Queries that wait for a free slot on a server
+ * whose number of concurrent queries is limited.
+ *
+ * A query is queued when its target server already executes
+ * max_concurrent_queries queries. The server hands the slot of a completed
+ * query over to the oldest waiting query and the session of the query is
+ * then called in its own thread to send it. The statements that the client
+ * sends while a query waits are held and routed in order after it. A query
+ * that waits longer than max_queue_time is answered with an error.
+ *
+ * Queries that are pipelined behind an unanswered query on the same backend
+ * and the statements of split multi-statement queries do not wait as they
+ * do not increase the number of operations the server counts.
+ */
+
+/** The queued query a timer was started for */
+typedef struct admission_timer
+{
+    MXS_SESSION       *session; /*< Reference to the session */
+    ROUTER_CLIENT_SES *rses;    /*< The router session */
+    uint32_t           seq;     /*< Which queued query the timer is for */
+    int                thread;  /*< The polling thread that owns the session */
+} admission_timer_t;
+
+/**
+ * Stop tracking the queued query of a session
+ *
+ * @param adm The admission state of the session
+ */
+static void admission_clear(rwsplit_admission_t *adm)
+{
+    adm->bref = NULL;
+    adm->query = NULL;
+    adm->session = NULL;
+    adm->seq++;
+}
+
+/**
+ * Pop the first buffer of a list of held statements
+ *
+ * @param list The list
+ * @return The first statement
+ */
+static GWBUF* admission_pop(GWBUF **list)
+{
+    GWBUF *buf = *list;
+
+    *list = buf->next;
+
+    if (*list)
+    {
+        (*list)->tail = buf->tail;
+    }
+
+    buf->next = NULL;
+    buf->tail = buf;
+    return buf;
+}
+
+/**
+ * Route the statements that were held while a query waited
+ *
+ * The routing stops if one of them has to wait for a free slot.
+ *
+ * @param rses Router session
+ */
+static void admission_route_held(ROUTER_CLIENT_SES *rses)
+{
+    rwsplit_admission_t *adm = &rses->rses_admission;
+    MXS_ROUTER_OBJECT *router = rses->router->service->router;
+
+    while (adm->bref == NULL && adm->held && !rses->rses_closed)
+    {
+        GWBUF *querybuf = admission_pop(&adm->held);
+
+        if (router->routeQuery((MXS_ROUTER*)rses->router, (MXS_ROUTER_SESSION*)rses, querybuf) == 0)
+        {
+            MXS_ERROR("Failed to route a statement that was held behind a queued "
+                      "query, closing the session.");
+            poll_fake_hangup_event(rses->client_dcb);
+            break;
+        }
+    }
+}
+
+/**
+ * Check whether the session was moved to another thread
+ *
+ * @param session The session
+ * @param thread  The thread that owned the session
+ * @return The thread that now owns the session or -1 if it was not moved
+ */
+static int admission_new_thread(MXS_SESSION *session, int thread)
+{
+    DCB *client = session->client_dcb;
+
+    return client && client->thread.id != thread ? client->thread.id : -1;
+}
+
+/**
+ * Called in the thread of the session when its queued query got a slot
+ *
+ * @param data The router session
+ */
+static void admission_ready(void *data)
+{
+    ROUTER_CLIENT_SES *rses = (ROUTER_CLIENT_SES*)data;
+    rwsplit_admission_t *adm = &rses->rses_admission;
+    MXS_SESSION *session = adm->session;
+    int thread = admission_new_thread(session, adm->waiter.thread);
+
+    /** Nothing else can touch the queued query while the slot is passed on
+     * to the thread that now owns the session */
+    if (thread != -1)
+    {
+        adm->waiter.thread = thread;
+
+        if (poll_call_in_thread(thread, admission_ready, rses))
+        {
+            return;
+        }
+    }
+
+    backend_ref_t *bref = adm->bref;
+    GWBUF *query = adm->query;
+    bool store = adm->store;
+
+    admission_clear(adm);
+    bref->bref_op_reserved = true;
+
+    if (rses->rses_closed)
+    {
+        rwsplit_admission_release(bref);
+    }
+    else if (!BREF_IS_IN_USE(bref) ||
+             !handle_got_target(rses->router, rses, query, bref->bref_dcb, store))
+    {
+        MXS_ERROR("Failed to route a query that waited for a free slot on [%s]:%d, "
+                  "closing the session.", bref->ref->server->name, bref->ref->server->port);
+        rwsplit_admission_release(bref);
+        poll_fake_hangup_event(rses->client_dcb);
+    }
+    else
+    {
+        /** The slot is still reserved if the query was stored behind an
+         * active session command */
+        rwsplit_admission_release(bref);
+        admission_route_held(rses);
+    }
+
+    gwbuf_free(query);
+    session_put_ref(session);
+}
+
+/**
+ * Reject a queued query with an error
+ *
+ * @param rses   Router session
+ * @param server The server the query waited for
+ */
+static void admission_reject(ROUTER_CLIENT_SES *rses, SERVER *server)
+{
+    char msg[MAX_SERVER_NAME_LEN + 100];
+    snprintf(msg, sizeof(msg), "Query was not sent to server '%s' as it had no free "
+             "slots for %d milliseconds", server->unique_name, server->max_queue_time);
+
+    MXS_INFO("%s.", msg);
+
+    GWBUF *err = modutil_create_mysql_err_msg(1, 0, ER_QUERY_INTERRUPTED, "70100", msg);
+
+    if (err == NULL || !rses->client_dcb->func.write(rses->client_dcb, err))
+    {
+        MXS_ERROR("Failed to send an error for a query that waited too long, "
+                  "closing the session.");
+        poll_fake_hangup_event(rses->client_dcb);
+    }
+}
+
+/**
+ * Called when a queued query has waited too long
+ *
+ * @param data The admission_timer_t of the query
+ */
+static void admission_timeout(void *data)
+{
+    admission_timer_t *timer = (admission_timer_t*)data;
+    ROUTER_CLIENT_SES *rses = timer->rses;
+    rwsplit_admission_t *adm = &rses->rses_admission;
+    int thread = admission_new_thread(timer->session, timer->thread);
+
+    if (thread != -1)
+    {
+        /** The timeout is handled by the thread that now owns the session */
+        timer->thread = thread;
+
+        if (poll_call_in_thread(thread, admission_timeout, timer))
+        {
+            return;
+        }
+    }
+    else if (!rses->rses_closed && adm->bref && adm->seq == timer->seq &&
+             server_cancel_op(adm->bref->ref->server, &adm->waiter, true))
+    {
+        SERVER *server = adm->bref->ref->server;
+        MXS_SESSION *session = adm->session;
+
+        gwbuf_free(adm->query);
+        admission_clear(adm);
+        admission_reject(rses, server);
+        admission_route_held(rses);
+        session_put_ref(session);
+    }
+
+    session_put_ref(timer->session);
+    MXS_FREE(timer);
+}
+
+/**
+ * Start the timer that limits how long a queued query waits
+ *
+ * @param rses   Router session
+ * @param server The server the query waits for
+ */
+static void admission_start_timer(ROUTER_CLIENT_SES *rses, SERVER *server)
+{
+    admission_timer_t *timer = MXS_MALLOC(sizeof(*timer));
+
+    if (timer)
+    {
+        MXS_SESSION *session = rses->client_dcb->session;
+
+        timer->session = session_get_ref(session);
+        timer->rses = rses;
+        timer->seq = rses->rses_admission.seq;
+        timer->thread = rses->client_dcb->thread.id;
+
+        if (!poll_add_delayed_call(server->max_queue_time, admission_timeout, timer))
+        {
+            session_put_ref(session);
+            MXS_FREE(timer);
+        }
+    }
+}
+
+bool rwsplit_admission_reserve(ROUTER_CLIENT_SES *rses, backend_ref_t *bref,
+                               GWBUF *querybuf, bool store)
+{
+    rwsplit_admission_t *adm = &rses->rses_admission;
+    SERVER *server = bref->ref->server;
+    GWBUF *query;
+
+    if (server->max_concurrent_queries <= 0 || bref->bref_op_reserved ||
+        BREF_IS_WAITING_RESULT(bref) || rses->rses_split_active ||
+        (query = gwbuf_clone(querybuf)) == NULL)
+    {
+        /** The query is counted when it is sent */
+        return true;
+    }
+
+    adm->waiter.thread = rses->client_dcb->thread.id;
+    adm->waiter.admit = admission_ready;
+    adm->waiter.data = rses;
+
+    if (server_reserve_op(server, &adm->waiter))
+    {
+        bref->bref_op_reserved = true;
+        gwbuf_free(query);
+        return true;
+    }
+
+    /** The slot can only be handed over once this thread has finished
+     * processing the current event */
+    adm->session = session_get_ref(rses->client_dcb->session);
+    adm->bref = bref;
+    adm->query = query;
+    adm->store = store;
+    adm->seq++;
+
+    MXS_INFO("Server [%s]:%d is executing %d queries, waiting for a free slot.",
+             server->name, server->port, server->stats.n_current_ops);
+
+    if (server->max_queue_time > 0)
+    {
+        admission_start_timer(rses, server);
+    }
+
+    return false;
+}
+
+void rwsplit_admission_release(backend_ref_t *bref)
+{
+    if (bref->bref_op_reserved)
+    {
+        bref->bref_op_reserved = false;
+        server_end_op(bref->ref->server);
+    }
+}
+
+bool rwsplit_admission_hold(ROUTER_CLIENT_SES *rses, GWBUF *querybuf)
+{
+    rwsplit_admission_t *adm = &rses->rses_admission;
+
+    if (adm->bref == NULL)
+    {
+        return false;
+    }
+
+    adm->held = gwbuf_append(adm->held, querybuf);
+    return true;
+}
+
+void rwsplit_admission_cancel(ROUTER_CLIENT_SES *rses)
+{
+    rwsplit_admission_t *adm = &rses->rses_admission;
+
+    /** If the slot was already handed over, it is released once the
+     * session is called and sees that it is closed */
+    if (adm->bref && server_cancel_op(adm->bref->ref->server, &adm->waiter, false))
+    {
+        MXS_SESSION *session = adm->session;
+
+        gwbuf_free(adm->query);
+        admission_clear(adm);
+        session_put_ref(session);
+    }
+}
+
+void rwsplit_admission_free(ROUTER_CLIENT_SES *rses)
+{
+    gwbuf_free(rses->rses_admission.query);
+    gwbuf_free(rses->rses_admission.held);
+    rses->rses_admission.query = NULL;
+    rses->rses_admission.held = NULL;
+}
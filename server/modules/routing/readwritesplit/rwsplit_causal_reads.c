@@ -0,0 +1,321 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include "readwritesplit.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/modutil.h>
+#include <maxscale/protocol/mysql.h>
+#include <maxscale/query_classifier.h>
+#include "rwsplit_internal.h"
+
+/**
+ * @file rwsplit_causal_reads.c   Reads on slaves that see the preceding writes
+ * of the session.
+ *
+ * The backends are asked to send session state information in their OK
+ * packets. The GTID of the latest write is taken from the value of the
+ * @c last_gtid system variable in the OK packets of the master. A read that is
+ * routed to a slave after a write is prefixed with a statement that waits
+ * until the slave has replicated that GTID. If the wait times out, the
+ * prefix fails and the read is executed on the master instead.
+ *
+ * The session state information is removed from all OK packets before they
+ * are sent to the client, which has not asked for it.
+ */
+
+/** The system variable that contains the GTID of the latest transaction */
+#define CAUSAL_LAST_GTID "last_gtid"
+
+/** The system variable that tells whether autocommit is enabled */
+#define CAUSAL_AUTOCOMMIT "autocommit"
+
+/** Waits for the GTID and fails with "Subquery returns more than 1 row" on timeout */
+#define CAUSAL_READ_PREFIX "SET @maxscale_causal_read=(SELECT CASE WHEN " \
+    "MASTER_GTID_WAIT('%s', %d) = 0 THEN 1 ELSE (SELECT 1 UNION SELECT 2) END);"
+
+/**
+ * Store the GTID of a write
+ *
+ * Only digits, dashes and commas are accepted as the GTID is later
+ * embedded in SQL.
+ */
+static void causal_store_gtid(ROUTER_CLIENT_SES *rses, char *gtid)
+{
+    if (*gtid == '\0' || gtid[strspn(gtid, "0123456789-,")] != '\0')
+    {
+        MXS_FREE(gtid);
+        return;
+    }
+
+    MXS_FREE(rses->rses_gtid_pos);
+    rses->rses_gtid_pos = gtid;
+}
+
+/**
+ * Process an OK packet
+ *
+ * If the packet came from the master, the GTID is stored and the session state
+ * is corrected with the state the master reported. The session state
+ * information is removed.
+ *
+ * @param inst   Router instance
+ * @param rses   Router session
+ * @param bref   Backend that sent the packet
+ * @param packet A complete OK packet
+ * @return The packet in the format the client expects
+ */
+static GWBUF *causal_process_ok(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
+                                backend_ref_t *bref, GWBUF *packet)
+{
+    MySQLProtocol *proto = (MySQLProtocol*)bref->bref_dcb->protocol;
+
+    if ((proto->server_capabilities & GW_MYSQL_CAPABILITIES_SESSION_TRACK) == 0)
+    {
+        return packet;
+    }
+
+    bool master = bref == rses->rses_master_ref;
+    const char *variables[] = {CAUSAL_LAST_GTID, CAUSAL_AUTOCOMMIT};
+    char *values[2] = {};
+    MXS_SESSION_TRACK track = {variables, values, master ? 2 : 0, NULL, NULL};
+
+    packet = modutil_ok_take_session_state(packet, &track);
+
+    if (values[0] && rses->rses_config.causal_reads)
+    {
+        causal_store_gtid(rses, values[0]);
+    }
+    else
+    {
+        MXS_FREE(values[0]);
+    }
+
+    if (master && rses->rses_config.track_session_state)
+    {
+        rwsplit_session_track_apply(inst, rses, bref, values[1], track.schema, track.trx_state);
+    }
+
+    MXS_FREE(values[1]);
+    MXS_FREE(track.schema);
+    MXS_FREE(track.trx_state);
+
+    return packet;
+}
+
+/**
+ * Execute a read on the master after it timed out on a slave
+ *
+ * @param inst  Router instance
+ * @param rses  Router session
+ * @param query The original read
+ * @return True if the read was sent to the master
+ */
+static bool causal_retry_on_master(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses, GWBUF *query)
+{
+    backend_ref_t *master = rses->rses_master_ref;
+    bool rval = false;
+
+    if (master && BREF_IS_IN_USE(master) && master->bref_dcb)
+    {
+        GWBUF *buffer = rwsplit_ps_map(rses, master, gwbuf_clone(query));
+
+        if (buffer && master->bref_dcb->func.write(master->bref_dcb, buffer) == 1)
+        {
+            bref_expect_replies(master, query);
+            ts_stats_add(inst->stats.n_queries, 1);
+            atomic_add_uint64(&inst->stats.n_causal_retries, 1);
+            bref_set_state(master, BREF_QUERY_ACTIVE);
+            bref_set_state(master, BREF_WAITING_RESULT);
+            rval = true;
+        }
+    }
+
+    return rval;
+}
+
+bool rwsplit_causal_read_needs_master(ROUTER_CLIENT_SES *rses, backend_ref_t *bref,
+                                      GWBUF *querybuf)
+{
+    MXS_SESSION *session = rses->client_dcb->session;
+
+    if (!rses->rses_config.causal_reads || rses->rses_gtid_pos == NULL ||
+        bref == rses->rses_master_ref ||
+        (session_trx_is_read_only(session) && bref == rses->forced_node))
+    {
+        /** A read-only transaction waited for the GTID when it was started */
+        return false;
+    }
+
+    MySQLProtocol *proto = (MySQLProtocol*)rses->client_dcb->protocol;
+
+    /** The wait is prepended as a separate statement, which is only possible
+     * for text protocol queries of clients that allow multi-statements. The
+     * replies of the slave must not be pipelined so that the reply to the wait
+     * is known to be the first one. Read-only transactions are executed on
+     * the slave as a whole so the wait is prepended to their first statement. */
+    return MYSQL_GET_COMMAND(GWBUF_DATA(querybuf)) != MYSQL_COM_QUERY ||
+           (proto->client_capabilities & GW_MYSQL_CAPABILITIES_MULTI_STATEMENTS) == 0 ||
+           gwbuf_length(querybuf) + sizeof(CAUSAL_READ_PREFIX) + strlen(rses->rses_gtid_pos) +
+           MYSQL_HEADER_LEN >= GW_MYSQL_MAX_PACKET_LEN ||
+           bref->bref_replies.count > 0 ||
+           (session_trx_is_active(session) && !session_trx_is_read_only(session));
+}
+
+GWBUF *rwsplit_causal_read_wrap(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *buffer)
+{
+    if (!rses->rses_config.causal_reads || rses->rses_gtid_pos == NULL ||
+        bref == rses->rses_master_ref || buffer == NULL ||
+        MYSQL_GET_COMMAND(GWBUF_DATA(buffer)) != MYSQL_COM_QUERY ||
+        bref->bref_replies.count > 0 ||
+        (session_trx_is_active(rses->client_dcb->session) &&
+         !qc_query_is_type(qc_get_trx_type_mask(buffer), QUERY_TYPE_BEGIN_TRX)))
+    {
+        /** Inside a transaction only the statement that starts it waits */
+        return buffer;
+    }
+
+    size_t prefix_size = sizeof(CAUSAL_READ_PREFIX) + strlen(rses->rses_gtid_pos) + 20;
+    char *prefix = MXS_MALLOC(prefix_size);
+    int prefix_len = prefix ? snprintf(prefix, prefix_size, CAUSAL_READ_PREFIX, rses->rses_gtid_pos,
+                                       rses->rses_config.causal_reads_timeout) : 0;
+    size_t sql_len = gwbuf_length(buffer) - MYSQL_HEADER_LEN - 1;
+    GWBUF *wrapped = prefix ? gwbuf_alloc(MYSQL_HEADER_LEN + 1 + prefix_len + sql_len) : NULL;
+    GWBUF *original = wrapped ? gwbuf_clone(buffer) : NULL;
+
+    if (original)
+    {
+        uint8_t *data = GWBUF_DATA(wrapped);
+        gw_mysql_set_byte3(data, 1 + prefix_len + sql_len);
+        data[3] = 0;
+        data[MYSQL_HEADER_LEN] = MYSQL_COM_QUERY;
+        memcpy(data + MYSQL_HEADER_LEN + 1, prefix, prefix_len);
+        gwbuf_copy_data(buffer, MYSQL_HEADER_LEN + 1, sql_len,
+                        data + MYSQL_HEADER_LEN + 1 + prefix_len);
+        wrapped->gwbuf_type = buffer->gwbuf_type;
+
+        gwbuf_free(bref->bref_causal_read);
+        bref->bref_causal_read = original;
+        gwbuf_free(buffer);
+        buffer = wrapped;
+    }
+    else
+    {
+        /** Without the wait the read could miss the latest write */
+        gwbuf_free(wrapped);
+        gwbuf_free(buffer);
+        buffer = NULL;
+    }
+
+    MXS_FREE(prefix);
+    return buffer;
+}
+
+GWBUF *rwsplit_causal_process_reply(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
+                                    backend_ref_t *bref, GWBUF *reply)
+{
+    MXS_REPLY_QUEUE *queue = &bref->bref_replies;
+    uint32_t type = reply->gwbuf_type;
+    GWBUF *rval = NULL;
+
+    if (bref->bref_reply_residue)
+    {
+        reply = gwbuf_append(bref->bref_reply_residue, reply);
+        bref->bref_reply_residue = NULL;
+    }
+
+    while (reply)
+    {
+        size_t n = modutil_reply_queue_process_to_ok(queue, reply);
+
+        if (n > 0)
+        {
+            /** Rows and other packets that are passed as such */
+            rval = gwbuf_append(rval, gwbuf_split(&reply, n));
+            continue;
+        }
+
+        uint8_t header[MYSQL_HEADER_LEN + 1];
+
+        if (gwbuf_copy_data(reply, 0, sizeof(header), header) != sizeof(header) ||
+            gwbuf_length(reply) < MYSQL_HEADER_LEN + gw_mysql_get_byte3(header))
+        {
+            /** Wait for the rest of the packet */
+            bref->bref_reply_residue = reply;
+            break;
+        }
+
+        GWBUF *packet = modutil_get_next_MySQL_packet(&reply);
+        uint8_t result = header[MYSQL_HEADER_LEN];
+
+        modutil_reply_queue_process(queue, packet);
+
+        if (bref->bref_causal_read && (result == MYSQL_REPLY_OK || result == MYSQL_REPLY_ERR))
+        {
+            /** The reply to the wait, the result of the read follows an OK */
+            GWBUF *query = bref->bref_causal_read;
+            bref->bref_causal_read = NULL;
+
+            if (result == MYSQL_REPLY_ERR)
+            {
+                MXS_INFO("Causal read timed out on [%s]:%d, retrying on the master.",
+                         bref->ref->server->name, bref->ref->server->port);
+
+                if (causal_retry_on_master(inst, rses, query))
+                {
+                    bref_clear_state(bref, BREF_QUERY_ACTIVE);
+                    bref_clear_state(bref, BREF_WAITING_RESULT);
+                }
+                else
+                {
+                    /** The client gets the error */
+                    rval = gwbuf_append(rval, packet);
+                    packet = NULL;
+                }
+            }
+
+            gwbuf_free(query);
+            gwbuf_free(packet);
+        }
+        else if (result == MYSQL_REPLY_OK)
+        {
+            rval = gwbuf_append(rval, causal_process_ok(inst, rses, bref, packet));
+        }
+        else
+        {
+            rval = gwbuf_append(rval, packet);
+        }
+    }
+
+    if (rval)
+    {
+        /** The type tells e.g. whether this is a reply to a session command */
+        rval->gwbuf_type = type;
+    }
+
+    return rval;
+}
+
+void rwsplit_causal_bref_free(backend_ref_t *bref)
+{
+    gwbuf_free(bref->bref_causal_read);
+    bref->bref_causal_read = NULL;
+    gwbuf_free(bref->bref_reply_residue);
+    bref->bref_reply_residue = NULL;
+}
@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include "readwritesplit.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/modutil.h>
+#include <maxscale/poll.h>
+#include <maxscale/protocol/mysql.h>
+#include "rwsplit_internal.h"
+
+/**
+ * @file rwsplit_hedged_reads.c   Reads that are sent to a second slave if
+ * the first one is slow to reply.
+ *
+ * When a read has not been replied to within a delay, a copy of it is sent
+ * to another idle slave. The slave that starts replying first wins and
+ * the reply of the other one is discarded. No new queries are routed to a
+ * slave while it is discarding and the session commands routed to it are
+ * executed once the discarded reply has been read.
+ */
+
+/** The minimum automatic delay in milliseconds */
+#define HEDGE_MIN_DELAY 1
+
+extern int (*criteria_cmpfun[LAST_CRITERIA])(const void *, const void *);
+
+/** The hedged read a timer was started for */
+typedef struct hedge_timer
+{
+    MXS_SESSION       *session; /*< Reference to the session */
+    ROUTER_CLIENT_SES *rses;    /*< The router session */
+    uint32_t           seq;     /*< Which hedged read the timer is for */
+    int                thread;  /*< The polling thread that owns the session */
+} hedge_timer_t;
+
+/**
+ * Stop tracking the hedged read of a session
+ *
+ * @param rses Router session
+ */
+static void hedge_clear(ROUTER_CLIENT_SES *rses)
+{
+    gwbuf_free(rses->rses_hedge_query);
+    rses->rses_hedge_query = NULL;
+    rses->rses_hedge_bref = NULL;
+    rses->rses_hedge_second = NULL;
+    rses->rses_hedge_seq++;
+}
+
+/**
+ * Check whether a slave can execute the second copy of a read
+ *
+ * @param rses Router session
+ * @param bref The slave
+ * @param max_rlag Maximum allowed replication lag
+ * @return True if the slave is idle and up to date
+ */
+static bool hedge_bref_is_usable(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, int max_rlag)
+{
+    SERVER *server = bref->ref->server;
+
+    return BREF_IS_IN_USE(bref) && !BREF_IS_DISCARDING(bref) &&
+           bref != rses->rses_master_ref && bref != rses->rses_hedge_bref &&
+           SERVER_IS_SLAVE(server) &&
+           (bref->bref_dcb->func.established == NULL ||
+            bref->bref_dcb->func.established(bref->bref_dcb)) &&
+           bref->bref_replies.count == 0 && !BREF_IS_WAITING_RESULT(bref) &&
+           bref->bref_pending_cmd == NULL && !sescmd_cursor_is_active(&bref->bref_sescmd_cur) &&
+           sescmd_cursor_get_command(&bref->bref_sescmd_cur) == NULL &&
+           (max_rlag == MAX_RLAG_UNDEFINED ||
+            (server->rlag != MAX_RLAG_NOT_AVAILABLE && server->rlag <= max_rlag));
+}
+
+/**
+ * Send the second copy of a hedged read
+ *
+ * @param rses Router session
+ */
+static void hedge_send(ROUTER_CLIENT_SES *rses)
+{
+    ROUTER_INSTANCE *inst = rses->router;
+    int (*cmpfun)(const void *, const void *) =
+        criteria_cmpfun[rses->rses_config.slave_selection_criteria];
+    int max_rlag = rses_get_max_replication_lag(rses);
+    backend_ref_t *candidate = NULL;
+
+    for (int i = 0; i < rses->rses_nbackends; i++)
+    {
+        backend_ref_t *bref = &rses->rses_backend_ref[i];
+
+        if (hedge_bref_is_usable(rses, bref, max_rlag) &&
+            (candidate == NULL || cmpfun(candidate, bref) > 0))
+        {
+            candidate = bref;
+        }
+    }
+
+    if (candidate == NULL)
+    {
+        return;
+    }
+
+    GWBUF *buffer = rwsplit_ps_map(rses, candidate, gwbuf_clone(rses->rses_hedge_query));
+
+    if (buffer && candidate->bref_dcb->func.write(candidate->bref_dcb, buffer) == 1)
+    {
+        MXS_INFO("Read on [%s]:%d is slow, sending it also to [%s]:%d.",
+                 rses->rses_hedge_bref->ref->server->name,
+                 rses->rses_hedge_bref->ref->server->port,
+                 candidate->ref->server->name, candidate->ref->server->port);
+
+        bref_expect_replies(candidate, rses->rses_hedge_query);
+        bref_set_state(candidate, BREF_QUERY_ACTIVE);
+        bref_set_state(candidate, BREF_WAITING_RESULT);
+        ts_stats_add(inst->stats.n_queries, 1);
+        atomic_add_uint64(&inst->stats.n_hedged, 1);
+        rses->rses_hedge_second = candidate;
+
+        /** The read is no longer retried as the other slave can reply */
+        session_clear_stmt(rses->client_dcb->session);
+    }
+}
+
+/**
+ * Called when the delay of a hedged read has passed
+ *
+ * @param data The hedge_timer_t of the read
+ */
+static void hedge_timeout(void *data)
+{
+    hedge_timer_t *timer = (hedge_timer_t*)data;
+    ROUTER_CLIENT_SES *rses = timer->rses;
+
+    /** The read has not been replied to if the sequence number is unchanged. The
+     * session is left alone if it was moved to another thread. */
+    if (!rses->rses_closed && rses->rses_hedge_seq == timer->seq &&
+        rses->rses_hedge_query && rses->rses_hedge_second == NULL &&
+        timer->session->client_dcb && timer->session->client_dcb->thread.id == timer->thread)
+    {
+        hedge_send(rses);
+    }
+
+    session_put_ref(timer->session);
+    MXS_FREE(timer);
+}
+
+/**
+ * Get the delay after which a read on a slave is sent to another slave
+ *
+ * @param rses Router session
+ * @param bref The slave
+ * @return The delay in milliseconds or zero if the read must not be hedged
+ */
+static int hedge_delay(ROUTER_CLIENT_SES *rses, backend_ref_t *bref)
+{
+    int delay = rses->rses_config.hedged_reads_delay;
+
+    if (delay == 0)
+    {
+        /** Twice the average response time, nothing is known until it has
+         * been sampled */
+        int64_t avg = bref->ref->server->stats.response_time;
+        delay = avg > 0 ? MXS_MAX(avg * 2 / 1000, HEDGE_MIN_DELAY) : 0;
+    }
+
+    return delay;
+}
+
+void rwsplit_hedge_start(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *querybuf)
+{
+    MXS_SESSION *session = rses->client_dcb->session;
+    int delay;
+
+    if (!rses->rses_config.hedged_reads || rses->rses_config.causal_reads ||
+        rses->rses_hedge_query || bref == rses->rses_master_ref ||
+        MYSQL_GET_COMMAND(GWBUF_DATA(querybuf)) != MYSQL_COM_QUERY ||
+        session_trx_is_active(session) ||
+        bref->bref_pending_cmd || sescmd_cursor_is_active(&bref->bref_sescmd_cur) ||
+        bref->bref_replies.count != 1 || (delay = hedge_delay(rses, bref)) == 0)
+    {
+        /** Only single reads that are executed in autocommit mode are hedged */
+        return;
+    }
+
+    hedge_timer_t *timer = MXS_MALLOC(sizeof(*timer));
+    GWBUF *query = timer ? gwbuf_clone(querybuf) : NULL;
+
+    if (query)
+    {
+        timer->session = session_get_ref(session);
+        timer->rses = rses;
+        timer->seq = ++rses->rses_hedge_seq;
+        timer->thread = rses->client_dcb->thread.id;
+
+        if (poll_add_delayed_call(delay, hedge_timeout, timer))
+        {
+            rses->rses_hedge_query = query;
+            rses->rses_hedge_bref = bref;
+            rses->rses_hedge_second = NULL;
+            query = NULL;
+            timer = NULL;
+        }
+        else
+        {
+            session_put_ref(session);
+        }
+    }
+
+    gwbuf_free(query);
+    MXS_FREE(timer);
+}
+
+void rwsplit_hedge_cancel(ROUTER_CLIENT_SES *rses)
+{
+    if (rses->rses_hedge_query)
+    {
+        /** The first slave is kept as the other one may not have seen the
+         * read yet */
+        if (rses->rses_hedge_second)
+        {
+            bref_set_state(rses->rses_hedge_second, BREF_DISCARD_REPLY);
+        }
+
+        hedge_clear(rses);
+    }
+}
+
+bool rwsplit_hedge_process_reply(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *reply)
+{
+    if (BREF_IS_DISCARDING(bref))
+    {
+        /** Nothing else was sent to the slave so the whole buffer belongs
+         * to the reply that is discarded */
+        modutil_reply_queue_process(&bref->bref_replies, reply);
+        gwbuf_free(reply);
+
+        if (bref->bref_replies.count == 0)
+        {
+            bref_clear_state(bref, BREF_DISCARD_REPLY);
+            bref_clear_state(bref, BREF_QUERY_ACTIVE);
+            bref_clear_state(bref, BREF_WAITING_RESULT);
+
+            sescmd_cursor_t *scur = &bref->bref_sescmd_cur;
+
+            if (!sescmd_cursor_is_active(scur) && sescmd_cursor_get_command(scur) &&
+                !rses->rses_config.defer_session_commands)
+            {
+                /** Session commands were routed while the reply was read */
+                execute_sescmd_in_backend(bref);
+            }
+        }
+
+        return true;
+    }
+
+    if (rses->rses_hedge_query && (bref == rses->rses_hedge_bref || bref == rses->rses_hedge_second))
+    {
+        if (rses->rses_hedge_second)
+        {
+            backend_ref_t *loser = bref == rses->rses_hedge_bref ?
+                                   rses->rses_hedge_second : rses->rses_hedge_bref;
+            bref_set_state(loser, BREF_DISCARD_REPLY);
+
+            if (bref == rses->rses_hedge_second)
+            {
+                atomic_add_uint64(&rses->router->stats.n_hedge_wins, 1);
+            }
+        }
+
+        hedge_clear(rses);
+    }
+
+    return false;
+}
+
+bool rwsplit_hedge_handle_error(ROUTER_CLIENT_SES *rses, backend_ref_t *bref)
+{
+    if (BREF_IS_DISCARDING(bref))
+    {
+        /** The client already got the reply from the other slave */
+        bref_clear_state(bref, BREF_DISCARD_REPLY);
+        return true;
+    }
+
+    bool rval = false;
+
+    if (rses->rses_hedge_query && (bref == rses->rses_hedge_bref || bref == rses->rses_hedge_second))
+    {
+        /** The other slave replies if the read was sent to it */
+        rval = rses->rses_hedge_second != NULL;
+        hedge_clear(rses);
+    }
+
+    return rval;
+}
+
+void rwsplit_hedge_free(ROUTER_CLIENT_SES *rses)
+{
+    gwbuf_free(rses->rses_hedge_query);
+    rses->rses_hedge_query = NULL;
+}
@@ -66,12 +66,90 @@ bool send_readonly_error(DCB *dcb);
  */
 void bref_clear_state(backend_ref_t *bref, bref_state_t state);
 void bref_set_state(backend_ref_t *bref, bref_state_t state);
+void bref_expect_replies(backend_ref_t *bref, GWBUF *buffer);
 int router_handle_state_switch(DCB *dcb, DCB_REASON reason, void *data);
 backend_ref_t *get_bref_from_dcb(ROUTER_CLIENT_SES *rses, DCB *dcb);
 void rses_property_done(rses_property_t *prop);
 int rses_get_max_slavecount(ROUTER_CLIENT_SES *rses, int router_nservers);
 int rses_get_max_replication_lag(ROUTER_CLIENT_SES *rses);
 
+/*
+ * The following are implemented in rwsplit_ps.c
+ */
+bool rwsplit_ps_is_routable(ROUTER_CLIENT_SES *rses, qc_query_type_t type);
+bool rwsplit_ps_add(ROUTER_CLIENT_SES *rses, int position, qc_query_type_t type);
+void rwsplit_ps_store_reply(ROUTER_CLIENT_SES *rses, backend_ref_t *bref,
+                            int position, GWBUF *reply, bool to_client);
+bool rwsplit_ps_track(ROUTER_CLIENT_SES *rses, GWBUF *querybuf,
+                      int packet_type, qc_query_type_t *qtype);
+bool rwsplit_ps_is_prepared(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *buffer);
+GWBUF *rwsplit_ps_map(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *buffer);
+void rwsplit_ps_free(ROUTER_CLIENT_SES *rses);
+
+/*
+ * The following are implemented in rwsplit_causal_reads.c
+ */
+bool rwsplit_causal_read_needs_master(ROUTER_CLIENT_SES *rses, backend_ref_t *bref,
+                                      GWBUF *querybuf);
+GWBUF *rwsplit_causal_read_wrap(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *buffer);
+GWBUF *rwsplit_causal_process_reply(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
+                                    backend_ref_t *bref, GWBUF *reply);
+void rwsplit_causal_bref_free(backend_ref_t *bref);
+
+/*
+ * The following are implemented in rwsplit_session_track.c
+ */
+void rwsplit_session_track_apply(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
+                                 backend_ref_t *bref, const char *autocommit,
+                                 const char *schema, const char *trx_state);
+
+/*
+ * The following are implemented in rwsplit_hedged_reads.c
+ */
+void rwsplit_hedge_start(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *querybuf);
+void rwsplit_hedge_cancel(ROUTER_CLIENT_SES *rses);
+bool rwsplit_hedge_process_reply(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *reply);
+bool rwsplit_hedge_handle_error(ROUTER_CLIENT_SES *rses, backend_ref_t *bref);
+void rwsplit_hedge_free(ROUTER_CLIENT_SES *rses);
+
+/*
+ * The following are implemented in rwsplit_admission.c
+ */
+bool rwsplit_admission_reserve(ROUTER_CLIENT_SES *rses, backend_ref_t *bref,
+                               GWBUF *querybuf, bool store);
+void rwsplit_admission_release(backend_ref_t *bref);
+bool rwsplit_admission_hold(ROUTER_CLIENT_SES *rses, GWBUF *querybuf);
+void rwsplit_admission_cancel(ROUTER_CLIENT_SES *rses);
+void rwsplit_admission_free(ROUTER_CLIENT_SES *rses);
+
+/*
+ * The following are implemented in rwsplit_write_affinity.c
+ */
+backend_ref_t* rwsplit_write_affinity_target(ROUTER_CLIENT_SES *rses, GWBUF *querybuf,
+                                             int packet_type, qc_query_type_t qtype);
+
+/*
+ * The following are implemented in rwsplit_workload.c
+ */
+bool rwsplit_workload_init(ROUTER_INSTANCE *inst);
+void rwsplit_workload_free(ROUTER_INSTANCE *inst);
+void rwsplit_workload_classify(ROUTER_CLIENT_SES *rses, GWBUF *querybuf, int packet_type);
+void rwsplit_workload_clear(ROUTER_CLIENT_SES *rses);
+bool rwsplit_workload_accepts(ROUTER_CLIENT_SES *rses, backend_ref_t *bref);
+void rwsplit_workload_start(ROUTER_CLIENT_SES *rses, backend_ref_t *bref);
+void rwsplit_workload_reply(backend_ref_t *bref, GWBUF *reply);
+void rwsplit_workload_record(ROUTER_INSTANCE *inst, backend_ref_t *bref, int64_t usecs);
+void rwsplit_workload_diagnostic(ROUTER_INSTANCE *inst, DCB *dcb);
+
+/*
+ * The following are implemented in rwsplit_split_stmt.c
+ */
+bool rwsplit_split_handle_query(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
+                                GWBUF *querybuf, bool *succp);
+GWBUF *rwsplit_split_process_reply(ROUTER_CLIENT_SES *rses, GWBUF *reply);
+void rwsplit_split_continue(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses);
+void rwsplit_split_free(ROUTER_CLIENT_SES *rses);
+
 /*
  * The following are implemented in rwsplit_route_stmt.c
  */
@@ -86,8 +164,6 @@ bool rwsplit_get_dcb(DCB **p_dcb, ROUTER_CLIENT_SES *rses, backend_type_t btype,
                      char *name, int max_rlag);
 route_target_t get_route_target(ROUTER_CLIENT_SES *rses,
                                 qc_query_type_t qtype, HINT *hint);
-rses_property_t *rses_property_init(rses_property_type_t prop_type);
-int rses_property_add(ROUTER_CLIENT_SES *rses, rses_property_t *prop);
 void handle_multi_temp_and_load(ROUTER_CLIENT_SES *rses, GWBUF *querybuf,
                                 int packet_type, int *qtype);
 bool handle_hinted_target(ROUTER_CLIENT_SES *rses, GWBUF *querybuf,
@@ -106,17 +182,19 @@ bool route_session_write(ROUTER_CLIENT_SES *router_cli_ses,
 /*
  * The following are implemented in rwsplit_session_cmd.c
 */
-mysql_sescmd_t *rses_property_get_sescmd(rses_property_t *prop);
-mysql_sescmd_t *mysql_sescmd_init(rses_property_t *rses_prop,
-                                  GWBUF *sescmd_buf,
-                                  unsigned char packet_type,
-                                  ROUTER_CLIENT_SES *rses);
-void mysql_sescmd_done(mysql_sescmd_t *sescmd);
+mysql_sescmd_t *sescmd_history_add(ROUTER_CLIENT_SES *rses,
+                                   GWBUF *sescmd_buf,
+                                   unsigned char packet_type);
+void sescmd_history_trim(ROUTER_CLIENT_SES *rses);
+void sescmd_history_free(ROUTER_CLIENT_SES *rses);
+void sescmd_cursor_init(sescmd_cursor_t *scur, ROUTER_CLIENT_SES *rses);
 mysql_sescmd_t *sescmd_cursor_get_command(sescmd_cursor_t *scur);
 bool sescmd_cursor_is_active(sescmd_cursor_t *sescmd_cursor);
 void sescmd_cursor_set_active(sescmd_cursor_t *sescmd_cursor,
                               bool value);
 bool execute_sescmd_history(backend_ref_t *bref);
+bool sescmd_cursor_pipeline(backend_ref_t *bref);
+void sescmd_history_compact(ROUTER_CLIENT_SES *rses);
 GWBUF *sescmd_cursor_clone_querybuf(sescmd_cursor_t *scur);
 GWBUF *sescmd_cursor_process_replies(GWBUF *replybuf,
                                      backend_ref_t *bref,
@@ -133,6 +211,8 @@ bool select_connect_backend_servers(backend_ref_t **p_master_ref,
                                     MXS_SESSION *session,
                                     ROUTER_INSTANCE *router,
                                     bool active_session);
+bool rwsplit_reattach_backends(ROUTER_CLIENT_SES *rses);
+void rwsplit_lazy_connect_slaves(ROUTER_CLIENT_SES *rses);
 
 /*
  * The following are implemented in rwsplit_tmp_table_multi.c
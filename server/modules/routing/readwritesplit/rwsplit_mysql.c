@@ -283,7 +283,7 @@ handle_target_is_all(route_target_t route_target,
 
     if (result)
     {
-        atomic_add_uint64(&inst->stats.n_all, 1);
+        ts_stats_add(inst->stats.n_all, 1);
     }
     return result;
 }
@@ -361,14 +361,15 @@ void check_session_command_reply(GWBUF *writebuf, sescmd_cursor_t *scur, backend
     if (MXS_LOG_PRIORITY_IS_ENABLED(LOG_ERR) &&
         MYSQL_IS_ERROR_PACKET(((uint8_t *)GWBUF_DATA(writebuf))))
     {
-        uint8_t *buf = (uint8_t *)GWBUF_DATA((scur->scmd_cur_cmd->my_sescmd_buf));
+        mysql_sescmd_t *scmd = sescmd_cursor_get_command(scur);
+        uint8_t *buf = (uint8_t *)GWBUF_DATA((scmd->my_sescmd_buf));
         uint8_t *replybuf = (uint8_t *)GWBUF_DATA(writebuf);
         size_t len = MYSQL_GET_PAYLOAD_LEN(buf);
         size_t replylen = MYSQL_GET_PAYLOAD_LEN(replybuf);
         char *err = strndup(&((char *)replybuf)[8], 5);
         char *replystr = strndup(&((char *)replybuf)[13], replylen - 4 - 5);
 
-        ss_dassert(len + 4 == GWBUF_LENGTH(scur->scmd_cur_cmd->my_sescmd_buf));
+        ss_dassert(len + 4 == GWBUF_LENGTH(scmd->my_sescmd_buf));
 
         MXS_ERROR("Failed to execute session command in [%s]:%d. Error was: %s %s",
                   bref->ref->server->name,
@@ -401,6 +402,7 @@ bool execute_sescmd_in_backend(backend_ref_t *backend_ref)
     bool succp;
     int rc = 0;
     sescmd_cursor_t *scur;
+    mysql_sescmd_t *scmd;
     GWBUF *buf;
     if (backend_ref == NULL)
     {
@@ -423,7 +425,7 @@ bool execute_sescmd_in_backend(backend_ref_t *backend_ref)
     scur = &backend_ref->bref_sescmd_cur;
 
     /** Return if there are no pending ses commands */
-    if (sescmd_cursor_get_command(scur) == NULL)
+    if ((scmd = sescmd_cursor_get_command(scur)) == NULL)
     {
         succp = true;
         MXS_INFO("Cursor had no pending session commands.");
@@ -437,11 +439,11 @@ bool execute_sescmd_in_backend(backend_ref_t *backend_ref)
         sescmd_cursor_set_active(scur, true);
     }
 
-    switch (scur->scmd_cur_cmd->my_sescmd_packet_type)
+    switch (scmd->my_sescmd_packet_type)
     {
     case MYSQL_COM_CHANGE_USER:
         /** This makes it possible to handle replies correctly */
-        gwbuf_set_type(scur->scmd_cur_cmd->my_sescmd_buf, GWBUF_TYPE_SESCMD);
+        gwbuf_set_type(scmd->my_sescmd_buf, GWBUF_TYPE_SESCMD);
         buf = sescmd_cursor_clone_querybuf(scur);
         rc = dcb->func.auth(dcb, NULL, dcb->session, buf);
         break;
@@ -457,7 +459,7 @@ bool execute_sescmd_in_backend(backend_ref_t *backend_ref)
 
             data = dcb->session->client_dcb->data;
             *data->db = 0;
-            tmpbuf = scur->scmd_cur_cmd->my_sescmd_buf;
+            tmpbuf = scmd->my_sescmd_buf;
             qlen = MYSQL_GET_PAYLOAD_LEN((unsigned char *) GWBUF_DATA(tmpbuf));
             if (qlen)
             {
@@ -481,7 +483,7 @@ bool execute_sescmd_in_backend(backend_ref_t *backend_ref)
          * MySQL command to protocol
          */
 
-        gwbuf_set_type(scur->scmd_cur_cmd->my_sescmd_buf, GWBUF_TYPE_SESCMD);
+        gwbuf_set_type(scmd->my_sescmd_buf, GWBUF_TYPE_SESCMD);
         buf = sescmd_cursor_clone_querybuf(scur);
         rc = dcb->func.write(dcb, buf);
         break;
@@ -489,6 +491,7 @@ bool execute_sescmd_in_backend(backend_ref_t *backend_ref)
 
     if (rc == 1)
     {
+        bref_expect_replies(backend_ref, scmd->my_sescmd_buf);
         succp = true;
     }
     else
@@ -0,0 +1,356 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include "readwritesplit.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <maxscale/alloc.h>
+#include <maxscale/protocol/mysql.h>
+#include "rwsplit_internal.h"
+
+/**
+ * @file rwsplit_ps.c   The functions that map the IDs of binary protocol
+ * prepared statements between the client and the backends.
+ *
+ * A COM_STMT_PREPARE of a read-only statement is executed as a session command
+ * on all backends. The ID of the statement in the reply that is sent to the
+ * client is the ID the client uses and the IDs the other backends replied
+ * with are stored so that COM_STMT_EXECUTE can be routed to any of them.
+ */
+
+/** Offset of the statement ID in the binary protocol commands and in the
+ * reply to COM_STMT_PREPARE */
+#define PS_ID_OFFSET (MYSQL_HEADER_LEN + 1)
+
+/** The COM_STMT_EXECUTE flags, non-zero if a cursor is opened */
+#define PS_EXECUTE_FLAGS_OFFSET (PS_ID_OFFSET + 4)
+
+static int ps_id_hash(const void *key)
+{
+    return *(const uint32_t*)key;
+}
+
+static int ps_id_cmp(const void *v1, const void *v2)
+{
+    uint32_t i1 = *(const uint32_t*)v1;
+    uint32_t i2 = *(const uint32_t*)v2;
+
+    return i1 < i2 ? -1 : i1 > i2;
+}
+
+static int ps_pos_hash(const void *key)
+{
+    return *(const int*)key;
+}
+
+static int ps_pos_cmp(const void *v1, const void *v2)
+{
+    return *(const int*)v1 - *(const int*)v2;
+}
+
+/** Whether the command refers to a prepared statement by its ID */
+static bool ps_is_id_command(uint8_t command)
+{
+    return command == MYSQL_COM_STMT_EXECUTE ||
+           command == MXS_COM_STMT_BULK_EXECUTE ||
+           command == MYSQL_COM_STMT_CLOSE ||
+           command == MYSQL_COM_STMT_RESET ||
+           command == MYSQL_COM_STMT_SEND_LONG_DATA ||
+           command == MYSQL_COM_STMT_FETCH;
+}
+
+/** Index of the backend reference in the session */
+static int ps_bref_index(ROUTER_CLIENT_SES *rses, backend_ref_t *bref)
+{
+    ss_dassert(bref >= rses->rses_backend_ref &&
+               bref < rses->rses_backend_ref + rses->rses_nbackends);
+    return bref - rses->rses_backend_ref;
+}
+
+/** Find the prepared statement a binary protocol command refers to */
+static rwsplit_ps_t* ps_find(ROUTER_CLIENT_SES *rses, GWBUF *buffer)
+{
+    uint8_t data[PS_ID_OFFSET + 4];
+    rwsplit_ps_t *ps = NULL;
+
+    if (rses->rses_ps_ids &&
+        gwbuf_copy_data(buffer, 0, sizeof(data), data) == sizeof(data) &&
+        ps_is_id_command(data[MYSQL_HEADER_LEN]))
+    {
+        uint32_t id = gw_mysql_get_byte4(data + PS_ID_OFFSET);
+        ps = hashtable_fetch(rses->rses_ps_ids, &id);
+    }
+
+    return ps;
+}
+
+/** Send a COM_STMT_CLOSE for a statement that the client no longer uses */
+static void ps_close_in_backend(backend_ref_t *bref, uint32_t id)
+{
+    GWBUF *buffer = gwbuf_alloc(PS_ID_OFFSET + 4);
+
+    if (buffer)
+    {
+        uint8_t *data = GWBUF_DATA(buffer);
+        gw_mysql_set_byte3(data, 5);
+        data[3] = 0;
+        data[MYSQL_HEADER_LEN] = MYSQL_COM_STMT_CLOSE;
+        gw_mysql_set_byte4(data + PS_ID_OFFSET, id);
+        gwbuf_set_type(buffer, GWBUF_TYPE_MYSQL | GWBUF_TYPE_SINGLE_STMT);
+        bref->bref_dcb->func.write(bref->bref_dcb, buffer);
+    }
+}
+
+bool rwsplit_ps_is_routable(ROUTER_CLIENT_SES *rses, qc_query_type_t type)
+{
+    /** These all need the master or a consistent session state */
+    const uint32_t master_only = QUERY_TYPE_WRITE | QUERY_TYPE_MASTER_READ |
+                                 QUERY_TYPE_SESSION_WRITE | QUERY_TYPE_USERVAR_WRITE |
+                                 QUERY_TYPE_USERVAR_READ | QUERY_TYPE_GSYSVAR_WRITE |
+                                 QUERY_TYPE_BEGIN_TRX | QUERY_TYPE_COMMIT |
+                                 QUERY_TYPE_ROLLBACK | QUERY_TYPE_ENABLE_AUTOCOMMIT |
+                                 QUERY_TYPE_DISABLE_AUTOCOMMIT | QUERY_TYPE_CREATE_TMP_TABLE |
+                                 QUERY_TYPE_READ_TMP_TABLE | QUERY_TYPE_PREPARE_NAMED_STMT;
+
+    /** Temporary tables only exist on the master and are not detected
+     * in prepared statements */
+    return !rses->have_tmp_tables &&
+           qc_query_is_type(type, QUERY_TYPE_READ) &&
+           (type & master_only) == 0;
+}
+
+bool rwsplit_ps_add(ROUTER_CLIENT_SES *rses, int position, qc_query_type_t type)
+{
+    if (rses->rses_ps_pos == NULL)
+    {
+        rses->rses_ps_pos = hashtable_alloc(16, ps_pos_hash, ps_pos_cmp);
+        rses->rses_ps_ids = hashtable_alloc(16, ps_id_hash, ps_id_cmp);
+
+        if (rses->rses_ps_pos == NULL || rses->rses_ps_ids == NULL)
+        {
+            hashtable_free(rses->rses_ps_pos);
+            hashtable_free(rses->rses_ps_ids);
+            rses->rses_ps_pos = NULL;
+            rses->rses_ps_ids = NULL;
+            return false;
+        }
+
+        /** The position table owns the statements */
+        hashtable_memory_fns(rses->rses_ps_pos, NULL, NULL, NULL, rwsplit_hfree);
+    }
+
+    rwsplit_ps_t *ps = MXS_CALLOC(1, sizeof(*ps) + rses->rses_nbackends * sizeof(uint32_t));
+
+    if (ps == NULL)
+    {
+        return false;
+    }
+
+    ps->position = position;
+    ps->type = type & ~QUERY_TYPE_PREPARE_STMT;
+
+    if (hashtable_add(rses->rses_ps_pos, &ps->position, ps) == 0)
+    {
+        MXS_FREE(ps);
+        return false;
+    }
+
+    return true;
+}
+
+void rwsplit_ps_store_reply(ROUTER_CLIENT_SES *rses, backend_ref_t *bref,
+                            int position, GWBUF *reply, bool to_client)
+{
+    uint8_t data[PS_ID_OFFSET + 4];
+
+    if (rses->rses_ps_pos == NULL ||
+        gwbuf_copy_data(reply, 0, sizeof(data), data) != sizeof(data) ||
+        data[MYSQL_HEADER_LEN] != MYSQL_REPLY_OK)
+    {
+        return;
+    }
+
+    uint32_t id = gw_mysql_get_byte4(data + PS_ID_OFFSET);
+    rwsplit_ps_t *ps = hashtable_fetch(rses->rses_ps_pos, &position);
+
+    if (ps == NULL)
+    {
+        /** The client closed the statement before this backend prepared it */
+        if (BREF_IS_IN_USE(bref))
+        {
+            ps_close_in_backend(bref, id);
+        }
+    }
+    else
+    {
+        ps->backend_ids[ps_bref_index(rses, bref)] = id;
+
+        if (to_client && ps->id == 0)
+        {
+            ps->id = id;
+
+            if (hashtable_add(rses->rses_ps_ids, &ps->id, ps) == 0)
+            {
+                MXS_ERROR("Prepared statement ID %u is already in use, "
+                          "executions of it are routed to the master.", id);
+            }
+        }
+    }
+}
+
+bool rwsplit_ps_track(ROUTER_CLIENT_SES *rses, GWBUF *querybuf,
+                      int packet_type, qc_query_type_t *qtype)
+{
+    rwsplit_ps_t *ps = ps_find(rses, querybuf);
+    bool handled = false;
+
+    if (ps == NULL)
+    {
+        return false;
+    }
+
+    switch (packet_type)
+    {
+    case MYSQL_COM_STMT_EXECUTE:
+        {
+            uint8_t flags = 0;
+            gwbuf_copy_data(querybuf, PS_EXECUTE_FLAGS_OFFSET, 1, &flags);
+
+            /** Long data is sent only to the master and rows of cursors are
+             * fetched from the master */
+            if (!ps->long_data && flags == 0)
+            {
+                *qtype = ps->type;
+            }
+
+            /** The server discards the long data after the execution */
+            ps->long_data = false;
+        }
+        break;
+
+    case MXS_COM_STMT_BULK_EXECUTE:
+        /** Array binding is always routed to the master as a write */
+        ps->long_data = false;
+        break;
+
+    case MYSQL_COM_STMT_SEND_LONG_DATA:
+        ps->long_data = true;
+        break;
+
+    case MYSQL_COM_STMT_RESET:
+        ps->long_data = false;
+        break;
+
+    case MYSQL_COM_STMT_CLOSE:
+        /** The command has no reply so it is not routed at all. Every backend,
+         * the master included, is sent the command with its own ID and the
+         * ones that have not yet prepared the statement close it when they
+         * reply. The ID of the client can belong to a different statement on
+         * the master if a slave replied to the client first. */
+        for (int i = 0; i < rses->rses_nbackends; i++)
+        {
+            backend_ref_t *bref = &rses->rses_backend_ref[i];
+
+            if (BREF_IS_IN_USE(bref) && ps->backend_ids[i])
+            {
+                ps_close_in_backend(bref, ps->backend_ids[i]);
+            }
+        }
+
+        hashtable_delete(rses->rses_ps_ids, &ps->id);
+        hashtable_delete(rses->rses_ps_pos, &ps->position);
+        handled = true;
+        break;
+
+    default:
+        break;
+    }
+
+    return handled;
+}
+
+bool rwsplit_ps_is_prepared(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *buffer)
+{
+    rwsplit_ps_t *ps = ps_find(rses, buffer);
+
+    /** A backend that is still executing session commands gets the command
+     * once the statement is prepared */
+    return ps == NULL || ps->backend_ids[ps_bref_index(rses, bref)] ||
+           sescmd_cursor_is_active(&bref->bref_sescmd_cur);
+}
+
+GWBUF* rwsplit_ps_map(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *buffer)
+{
+    GWBUF *rval = NULL;
+
+    /** Each buffer in the chain is one command */
+    while (buffer)
+    {
+        GWBUF *packet = buffer;
+        buffer = buffer->next;
+        packet->next = NULL;
+        packet->tail = packet;
+
+        rwsplit_ps_t *ps = ps_find(rses, packet);
+
+        if (ps)
+        {
+            uint32_t id = ps->backend_ids[ps_bref_index(rses, bref)];
+
+            if (id == 0)
+            {
+                MXS_ERROR("Statement %u is not prepared on '%s'.", ps->id,
+                          bref->ref->server->unique_name);
+                gwbuf_free(packet);
+                gwbuf_free(buffer);
+                gwbuf_free(rval);
+                return NULL;
+            }
+
+            if (id != ps->id)
+            {
+                /** The data is shared with the stored copy of the command */
+                GWBUF *copy = gwbuf_alloc_and_load(GWBUF_LENGTH(packet), GWBUF_DATA(packet));
+
+                if (copy == NULL)
+                {
+                    gwbuf_free(packet);
+                    gwbuf_free(buffer);
+                    gwbuf_free(rval);
+                    return NULL;
+                }
+
+                copy->gwbuf_type = packet->gwbuf_type;
+                gw_mysql_set_byte4(GWBUF_DATA(copy) + PS_ID_OFFSET, id);
+                gwbuf_free(packet);
+                packet = copy;
+            }
+        }
+
+        rval = gwbuf_append(rval, packet);
+    }
+
+    return rval;
+}
+
+void rwsplit_ps_free(ROUTER_CLIENT_SES *rses)
+{
+    hashtable_free(rses->rses_ps_ids);
+    hashtable_free(rses->rses_ps_pos);
+    rses->rses_ps_ids = NULL;
+    rses->rses_ps_pos = NULL;
+}
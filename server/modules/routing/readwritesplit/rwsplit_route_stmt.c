@@ -20,7 +20,9 @@
 #include <stdint.h>
 #include <maxscale/alloc.h>
 
+#include <maxscale/probes.h>
 #include <maxscale/router.h>
+#include <maxscale/trace.h>
 #include "rwsplit_internal.h"
 /**
  * @file rwsplit_route_stmt.c   The functions that support the routing of
@@ -44,6 +46,101 @@ static backend_ref_t *check_candidate_bref(backend_ref_t *cand,
                                            select_criteria_t sc);
 static backend_ref_t *get_root_master_bref(ROUTER_CLIENT_SES *rses);
 
+/** Check whether the connection to the backend is ready for queries */
+static inline bool bref_is_established(backend_ref_t *bref)
+{
+    DCB *dcb = bref->bref_dcb;
+    return dcb->func.established == NULL || dcb->func.established(dcb);
+}
+
+/** Check whether the packet is continued in the next packet */
+static inline bool is_large_packet(GWBUF *querybuf)
+{
+    uint8_t header[MYSQL_HEADER_LEN];
+    return gwbuf_copy_data(querybuf, 0, sizeof(header), header) == sizeof(header) &&
+           MYSQL_GET_PAYLOAD_LEN(header) == GW_MYSQL_MAX_PACKET_LEN;
+}
+
+/**
+ * Check whether a query uses state of the connection that a reused backend
+ * connection would not have
+ *
+ * The result of these functions depends on the earlier statements executed on
+ * the same connection and the named locks are released when the connection is
+ * reset.
+ *
+ * @param querybuf    The query
+ * @param packet_type Type of the packet
+ * @return True if the query uses the state of the connection
+ */
+static bool uses_connection_state(GWBUF *querybuf, int packet_type)
+{
+    static const char *functions[] =
+    {
+        "last_insert_id", "found_rows", "row_count", "get_lock"
+    };
+
+    if (packet_type != MYSQL_COM_QUERY)
+    {
+        return false;
+    }
+
+    const QC_FUNCTION_INFO *infos;
+    size_t n_infos;
+    qc_get_function_info(querybuf, &infos, &n_infos);
+
+    for (size_t i = 0; i < n_infos; i++)
+    {
+        for (size_t j = 0; j < sizeof(functions) / sizeof(functions[0]); j++)
+        {
+            if (strcasecmp(infos[i].name, functions[j]) == 0)
+            {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Route a continuation packet of a packet larger than 16MB
+ *
+ * The continuation packets were not classified. They are sent to the server
+ * that received the first packet, behind it if that one is still waiting for
+ * a session command to complete.
+ *
+ * @param rses     Router session
+ * @param querybuf The continuation packet
+ * @return True if the packet was routed
+ */
+static bool route_large_packet(ROUTER_CLIENT_SES *rses, GWBUF *querybuf)
+{
+    backend_ref_t *bref = rses->rses_large_bref;
+
+    if (!is_large_packet(querybuf))
+    {
+        /** This is the last packet */
+        rses->rses_large_bref = NULL;
+    }
+
+    if (!BREF_IS_IN_USE(bref))
+    {
+        MXS_ERROR("The server [%s]:%d that received the start of a large packet "
+                  "is no longer in use.", bref->ref->server->name, bref->ref->server->port);
+        return false;
+    }
+
+    if (bref->bref_pending_cmd)
+    {
+        bref->bref_pending_cmd = gwbuf_append(bref->bref_pending_cmd, gwbuf_clone(querybuf));
+        return true;
+    }
+
+    DCB *target_dcb = bref->bref_dcb;
+    return target_dcb->func.write(target_dcb, gwbuf_clone(querybuf)) == 1;
+}
+
 /**
  * Routing function. Find out query type, backend type, and target DCB(s).
  * Then route query to found target(s).
@@ -64,17 +161,49 @@ bool route_single_stmt(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
     bool succp = false;
     bool non_empty_packet;
 
+    if (rses->rses_large_bref)
+    {
+        /** The continuation packets are not contiguous */
+        return route_large_packet(rses, querybuf);
+    }
+
     ss_dassert(querybuf->next == NULL); // The buffer must be contiguous.
     ss_dassert(!GWBUF_IS_TYPE_UNDEFINED(querybuf));
 
+    /** A client that doesn't wait for the replies is not hedged */
+    rwsplit_hedge_cancel(rses);
+
     /* packet_type is a problem as it is MySQL specific */
     packet_type = determine_packet_type(querybuf, &non_empty_packet);
     qtype = determine_query_type(querybuf, packet_type, non_empty_packet);
 
     if (non_empty_packet)
     {
+        /** Executions of read-only prepared statements are routed like reads
+         * and the statements are closed in the backends by the tracking */
+        if (rwsplit_ps_track(rses, querybuf, packet_type, &qtype))
+        {
+            return true;
+        }
+
         handle_multi_temp_and_load(rses, querybuf, packet_type, (int *)&qtype);
 
+        /** User variables, prepared statements, named locks and the results
+         * of the earlier statements are not restored when a detached
+         * connection is reattached */
+        if (packet_type == MYSQL_COM_STMT_PREPARE ||
+            qc_query_is_type(qtype, QUERY_TYPE_USERVAR_WRITE) ||
+            qc_query_is_type(qtype, QUERY_TYPE_PREPARE_NAMED_STMT) ||
+            (rses->rses_config.connection_multiplexing &&
+             uses_connection_state(querybuf, packet_type)))
+        {
+            rses->rses_pinned = true;
+        }
+
+        /** The connection that executed a write is kept until the next
+         * statement so that it can read e.g. LAST_INSERT_ID() */
+        rses->rses_after_write = qc_query_is_type(qtype, QUERY_TYPE_WRITE);
+
         if (MXS_LOG_PRIORITY_IS_ENABLED(LOG_INFO))
         {
             log_transaction_status(rses, querybuf, qtype);
@@ -106,6 +235,19 @@ bool route_single_stmt(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
         MXS_INFO("> LOAD DATA LOCAL INFILE finished: %lu bytes sent.",
                  rses->rses_load_data_sent + gwbuf_length(querybuf));
     }
+
+    bool large_packet = is_large_packet(querybuf);
+
+    if (large_packet && TARGET_IS_ALL(route_target))
+    {
+        /** The rest of the packet can only follow it to one server */
+        MXS_INFO("Routing a session command larger than 16MB only to the master.");
+        route_target = TARGET_MASTER;
+    }
+
+    /** The statement is classified and the kind of target is known */
+    mxs_trace_mark(querybuf, MXS_TRACE_ROUTED);
+
     if (TARGET_IS_ALL(route_target))
     {
         succp = handle_target_is_all(route_target, inst, rses, querybuf, packet_type, qtype);
@@ -114,6 +256,7 @@ bool route_single_stmt(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
     {
         /* Now we have a lock on the router session */
         bool store_stmt = false;
+        bool slave_read = false;
         /**
          * There is a hint which either names the target backend or
          * hint which sets maximum allowed replication lag for the
@@ -126,12 +269,42 @@ bool route_single_stmt(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
         }
         else if (TARGET_IS_SLAVE(route_target))
         {
+            /** Expensive reads go to the analytic servers */
+            rwsplit_workload_classify(rses, querybuf, packet_type);
             succp = handle_slave_is_target(inst, rses, &target_dcb);
-            store_stmt = rses->rses_config.retry_failed_reads;
+            /** Only the first packet of a large read would be retried or hedged */
+            store_stmt = rses->rses_config.retry_failed_reads && !large_packet;
+            slave_read = !large_packet;
+
+            if (succp && !rwsplit_ps_is_prepared(rses, get_bref_from_dcb(rses, target_dcb), querybuf))
+            {
+                /** The slave joined the session after the statement was prepared */
+                succp = handle_master_is_target(inst, rses, &target_dcb);
+                store_stmt = false;
+                slave_read = false;
+            }
+            else if (succp && rwsplit_causal_read_needs_master(rses, get_bref_from_dcb(rses, target_dcb),
+                                                               querybuf))
+            {
+                /** The read can't wait for the latest write on the slave */
+                succp = handle_master_is_target(inst, rses, &target_dcb);
+                store_stmt = false;
+                slave_read = false;
+            }
         }
         else if (TARGET_IS_MASTER(route_target))
         {
-            succp = handle_master_is_target(inst, rses, &target_dcb);
+            backend_ref_t *node = rwsplit_write_affinity_target(rses, querybuf, packet_type, qtype);
+
+            if (node)
+            {
+                target_dcb = node->bref_dcb;
+                succp = true;
+            }
+            else
+            {
+                succp = handle_master_is_target(inst, rses, &target_dcb);
+            }
 
             if (!rses->rses_config.strict_multi_stmt &&
                 !rses->rses_config.strict_sp_calls &&
@@ -146,8 +319,14 @@ bool route_single_stmt(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
         if (target_dcb && succp) /*< Have DCB of the target backend */
         {
             ss_dassert(!store_stmt || TARGET_IS_SLAVE(route_target));
-            handle_got_target(inst, rses, querybuf, target_dcb, store_stmt);
+
+            if (handle_got_target(inst, rses, querybuf, target_dcb, store_stmt) && slave_read)
+            {
+                rwsplit_hedge_start(rses, get_bref_from_dcb(rses, target_dcb), querybuf);
+            }
         }
+
+        rwsplit_workload_clear(rses);
     }
 
     return succp;
@@ -179,7 +358,6 @@ bool route_session_write(ROUTER_CLIENT_SES *router_cli_ses,
                          qc_query_type_t qtype)
 {
     bool succp;
-    rses_property_t *prop;
     backend_ref_t *backend_ref;
     int i;
     int max_nslaves;
@@ -238,9 +416,24 @@ bool route_session_write(ROUTER_CLIENT_SES *router_cli_ses,
         goto return_succp;
     }
 
-    if (router_cli_ses->rses_config.max_sescmd_history > 0 &&
-        router_cli_ses->rses_nsescmd >=
-        router_cli_ses->rses_config.max_sescmd_history)
+    /** The slaves only execute the deferred commands when a statement is
+     * routed to them */
+    bool defer = router_cli_ses->rses_config.defer_session_commands &&
+                 router_cli_ses->rses_master_ref &&
+                 BREF_IS_IN_USE(router_cli_ses->rses_master_ref);
+
+    if (!router_cli_ses->rses_config.disable_sescmd_history || defer)
+    {
+        /** Only the latest of the commands that set the same thing is kept */
+        sescmd_history_compact(router_cli_ses);
+    }
+
+    if ((router_cli_ses->rses_config.max_sescmd_history > 0 &&
+         router_cli_ses->rses_nsescmd >=
+         router_cli_ses->rses_config.max_sescmd_history) ||
+        (router_cli_ses->rses_config.max_sescmd_history_size > 0 &&
+         router_cli_ses->rses_sescmd_size + gwbuf_length(querybuf) >
+         router_cli_ses->rses_config.max_sescmd_history_size))
     {
         MXS_WARNING("Router session exceeded session command history limit. "
                     "Slave recovery is disabled and only slave servers with "
@@ -248,68 +441,42 @@ bool route_session_write(ROUTER_CLIENT_SES *router_cli_ses,
                     "for the duration of the session.");
         router_cli_ses->rses_config.disable_sescmd_history = true;
         router_cli_ses->rses_config.max_sescmd_history = 0;
+        router_cli_ses->rses_config.max_sescmd_history_size = 0;
     }
 
     if (router_cli_ses->rses_config.disable_sescmd_history)
     {
-        rses_property_t *prop, *tmp;
-        backend_ref_t *bref;
-        bool conflict;
-
-        prop = router_cli_ses->rses_properties[RSES_PROP_TYPE_SESCMD];
-        while (prop)
-        {
-            conflict = false;
-
-            for (i = 0; i < router_cli_ses->rses_nbackends; i++)
-            {
-                bref = &backend_ref[i];
-                if (BREF_IS_IN_USE(bref))
-                {
-
-                    if (bref->bref_sescmd_cur.position <=
-                        prop->rses_prop_data.sescmd.position + 1)
-                    {
-                        conflict = true;
-                        break;
-                    }
-                }
-            }
-
-            if (conflict)
-            {
-                break;
-            }
-
-            tmp = prop;
-            router_cli_ses->rses_properties[RSES_PROP_TYPE_SESCMD] = prop->rses_prop_next;
-            rses_property_done(tmp);
-            prop = router_cli_ses->rses_properties[RSES_PROP_TYPE_SESCMD];
-        }
+        /** The commands that all backends have executed are no longer needed */
+        sescmd_history_trim(router_cli_ses);
     }
 
     /**
-     * Additional reference is created to querybuf to
-     * prevent it from being released before properties
-     * are cleaned up as a part of router sessionclean-up.
+     * The history takes the ownership of querybuf, it is released when the
+     * command is removed from the history or the router session is freed.
      */
-    if ((prop = rses_property_init(RSES_PROP_TYPE_SESCMD)) == NULL)
+    mysql_sescmd_t *sescmd = sescmd_history_add(router_cli_ses, querybuf, packet_type);
+
+    if (sescmd == NULL)
     {
-        MXS_ERROR("Router session property initialization failed");
+        MXS_ERROR("Failed to add session command to the history.");
         return false;
     }
 
-    mysql_sescmd_init(prop, querybuf, packet_type, router_cli_ses);
+    router_cli_ses->rses_sescmd_size += gwbuf_length(querybuf);
 
-    /** Add sescmd property to router client session */
-    if (rses_property_add(router_cli_ses, prop) != 0)
+    if (packet_type == MYSQL_COM_STMT_PREPARE &&
+        !rwsplit_ps_add(router_cli_ses, sescmd->position, qtype))
     {
-        MXS_ERROR("Session property addition failed.");
-        return false;
+        MXS_ERROR("Failed to store prepared statement, its executions are routed to the master.");
     }
 
     for (i = 0; i < router_cli_ses->rses_nbackends; i++)
     {
+        if (defer && &backend_ref[i] != router_cli_ses->rses_master_ref)
+        {
+            continue;
+        }
+
         if (BREF_IS_IN_USE((&backend_ref[i])))
         {
             sescmd_cursor_t *scur;
@@ -345,6 +512,14 @@ bool route_session_write(ROUTER_CLIENT_SES *router_cli_ses,
                          backend_ref[i].ref->server->name,
                          backend_ref[i].ref->server->port);
             }
+            else if (BREF_IS_DISCARDING(&backend_ref[i]))
+            {
+                /** Executed when the reply of the hedged read has been read */
+                nsucc += 1;
+                MXS_INFO("Backend [%s]:%d is reading the reply of a hedged read.",
+                         backend_ref[i].ref->server->name,
+                         backend_ref[i].ref->server->port);
+            }
             else
             {
                 if (execute_sescmd_in_backend(&backend_ref[i]))
@@ -503,7 +678,7 @@ bool rwsplit_get_dcb(DCB **p_dcb, ROUTER_CLIENT_SES *rses, backend_type_t btype,
              * backend's role must be either slave, relay
              * server, or master.
              */
-            if (BREF_IS_IN_USE((&backend_ref[i])) &&
+            if (BREF_IS_IN_USE((&backend_ref[i])) && !BREF_IS_DISCARDING(&backend_ref[i]) &&
                 (strncasecmp(name, b->server->unique_name, PATH_MAX) == 0) &&
                 (SERVER_IS_SLAVE(&server) || SERVER_IS_RELAY_SERVER(&server) ||
                  SERVER_IS_MASTER(&server)))
@@ -536,10 +711,12 @@ bool rwsplit_get_dcb(DCB **p_dcb, ROUTER_CLIENT_SES *rses, backend_type_t btype,
             server.status = b->server->status;
             /**
              * Unused backend or backend which is not master nor
-             * slave can't be used
+             * slave can't be used. A slave that is reading the reply
+             * of a hedged read that lost is not used either.
              */
-            if (!BREF_IS_IN_USE(&backend_ref[i]) ||
-                (!SERVER_IS_MASTER(&server) && !SERVER_IS_SLAVE(&server)))
+            if (!BREF_IS_IN_USE(&backend_ref[i]) || BREF_IS_DISCARDING(&backend_ref[i]) ||
+                (!SERVER_IS_MASTER(&server) && !SERVER_IS_SLAVE(&server)) ||
+                !rwsplit_workload_accepts(rses, &backend_ref[i]))
             {
                 continue;
             }
@@ -703,6 +880,9 @@ route_target_t get_route_target(ROUTER_CLIENT_SES *rses,
      */
     else if (!load_active &&
              (qc_query_is_type(qtype, QUERY_TYPE_SESSION_WRITE) ||
+              /** Read-only prepared statements can be executed on any node */
+              (qc_query_is_type(qtype, QUERY_TYPE_PREPARE_STMT) &&
+               rwsplit_ps_is_routable(rses, qtype)) ||
               /** Configured to allow writing user variables to all nodes */
               (use_sql_variables_in == TYPE_ALL &&
                qc_query_is_type(qtype, QUERY_TYPE_USERVAR_WRITE)) ||
@@ -722,9 +902,8 @@ route_target_t get_route_target(ROUTER_CLIENT_SES *rses,
          * They can be safely routed to all backends since the execution
          * is done later.
          *
-         * With prepared statement caching the task of routing
-         * the execution of the prepared statements to the right server would be
-         * an easy one. Currently this is not supported.
+         * The statement IDs of the backends are mapped to the one the client
+         * sees so that the executions can be routed to any of them.
          */
         if (qc_query_is_type(qtype, QUERY_TYPE_READ) &&
             !(qc_query_is_type(qtype, QUERY_TYPE_PREPARE_STMT) ||
@@ -990,6 +1169,9 @@ bool handle_hinted_target(ROUTER_CLIENT_SES *rses, GWBUF *querybuf,
     int rlag_max = MAX_RLAG_UNDEFINED;
     bool succp;
 
+    /** The hint can name any of the servers */
+    rwsplit_lazy_connect_slaves(rses);
+
     hint = querybuf->hint;
 
     while (hint != NULL)
@@ -1067,12 +1249,29 @@ bool handle_slave_is_target(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
 {
     int rlag_max = rses_get_max_replication_lag(rses);
 
+    rwsplit_lazy_connect_slaves(rses);
+
     /**
      * Search suitable backend server, get DCB in target_dcb
      */
-    if (rwsplit_get_dcb(target_dcb, rses, BE_SLAVE, NULL, rlag_max))
+    bool found = rwsplit_get_dcb(target_dcb, rses, BE_SLAVE, NULL, rlag_max);
+
+    if (!found && rses->rses_workload != RWSPLIT_WORKLOAD_ANY)
     {
-        atomic_add_uint64(&inst->stats.n_slave, 1);
+        /** No slave of the workload class is available, use any slave */
+        rses->rses_workload = RWSPLIT_WORKLOAD_ANY;
+        *target_dcb = NULL;
+        found = rwsplit_get_dcb(target_dcb, rses, BE_SLAVE, NULL, rlag_max);
+    }
+
+    if (found)
+    {
+        if (rses->rses_workload == RWSPLIT_WORKLOAD_ANALYTIC)
+        {
+            atomic_add_uint64(&inst->stats.n_analytic, 1);
+        }
+
+        ts_stats_add(inst->stats.n_slave, 1);
         return true;
     }
     else
@@ -1164,14 +1363,14 @@ bool handle_master_is_target(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
 
     if (succp && master_dcb == curr_master_dcb)
     {
-        atomic_add_uint64(&inst->stats.n_master, 1);
+        ts_stats_add(inst->stats.n_master, 1);
         *target_dcb = master_dcb;
     }
     else
     {
         if (succp && master_dcb == curr_master_dcb)
         {
-            atomic_add_uint64(&inst->stats.n_master, 1);
+            ts_stats_add(inst->stats.n_master, 1);
             *target_dcb = master_dcb;
         }
         else
@@ -1221,6 +1420,12 @@ handle_got_target(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
 
     bref = get_bref_from_dcb(rses, target_dcb);
 
+    if (is_large_packet(querybuf))
+    {
+        /** The continuation packets are routed to the same server */
+        rses->rses_large_bref = bref;
+    }
+
     /**
      * If the transaction is READ ONLY set forced_node to bref
      * That SLAVE backend will be used until COMMIT is seen
@@ -1229,6 +1434,12 @@ handle_got_target(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
         session_trx_is_read_only(rses->client_dcb->session))
     {
         rses->forced_node = bref;
+
+        if (bref != rses->rses_master_ref)
+        {
+            ts_stats_add(inst->stats.n_ro_trx, 1);
+        }
+
         MXS_DEBUG("Setting forced_node SLAVE to %s within an opened READ ONLY transaction\n",
                   target_dcb->server->unique_name);
     }
@@ -1240,18 +1451,40 @@ handle_got_target(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
     MXS_INFO("Route query to %s \t[%s]:%d <",
              (SERVER_IS_MASTER(bref->ref->server) ? "master"
               : "slave"), bref->ref->server->name, bref->ref->server->port);
+    MXS_PROBE3(rwsplit_route, rses->client_dcb->session->ses_id,
+               bref->ref->server->unique_name, SERVER_IS_MASTER(bref->ref->server));
+    bool pipelined = false;
+
+    if (rses->rses_config.defer_session_commands &&
+        !sescmd_cursor_is_active(scur) && sescmd_cursor_get_command(scur))
+    {
+        /** The deferred session commands are sent in front of the statement.
+         * The replies to a causal read are only followed for the statement. */
+        pipelined = sescmd_cursor_pipeline(bref) && !rses->rses_config.causal_reads;
+    }
+
     /**
      * Store current statement if execution of previous session command is still
      * active. Since the master server's response is always used, we can safely
      * write session commands to the master even if it is already executing.
      */
-    if (sescmd_cursor_is_active(scur) && bref != rses->rses_master_ref)
+    if (sescmd_cursor_is_active(scur) && bref != rses->rses_master_ref && !pipelined)
     {
         bref->bref_pending_cmd = gwbuf_append(bref->bref_pending_cmd, gwbuf_clone(querybuf));
+        bref->bref_cost_digest = 0;
         return true;
     }
 
-    if (target_dcb->func.write(target_dcb, gwbuf_clone(querybuf)) == 1)
+    if (!rwsplit_admission_reserve(rses, bref, querybuf, store))
+    {
+        /** Routed when the server has a free slot */
+        return true;
+    }
+
+    GWBUF *buffer = rwsplit_ps_map(rses, bref, gwbuf_clone(querybuf));
+    buffer = rwsplit_causal_read_wrap(rses, bref, buffer);
+
+    if (buffer && target_dcb->func.write(target_dcb, buffer) == 1)
     {
         if (store && !session_store_stmt(rses->client_dcb->session, querybuf, target_dcb->server))
         {
@@ -1260,14 +1493,21 @@ handle_got_target(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
 
         backend_ref_t *bref;
 
-        atomic_add_uint64(&inst->stats.n_queries, 1);
+        ts_stats_add(inst->stats.n_queries, 1);
         /**
          * Add one query response waiter to backend reference
          */
         bref = get_bref_from_dcb(rses, target_dcb);
+        bref_expect_replies(bref, querybuf);
+        rwsplit_workload_start(rses, bref);
         bref_set_state(bref, BREF_QUERY_ACTIVE);
         bref_set_state(bref, BREF_WAITING_RESULT);
 
+        if (pipelined)
+        {
+            bref_set_state(bref, BREF_PIPELINED);
+        }
+
         /**
          * If a READ ONLYtransaction is ending set forced_node to NULL
          */
@@ -1283,85 +1523,12 @@ handle_got_target(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
     else
     {
         MXS_ERROR("Routing query failed.");
+        rwsplit_admission_release(bref);
+        rwsplit_causal_bref_free(bref);
         return false;
     }
 }
 
-/**
- * @brief Create a generic router session property structure.
- *
- * @param prop_type     Property type
- *
- * @return property structure of requested type, or NULL if failed
- */
-rses_property_t *rses_property_init(rses_property_type_t prop_type)
-{
-    rses_property_t *prop;
-
-    prop = (rses_property_t *)MXS_CALLOC(1, sizeof(rses_property_t));
-    if (prop == NULL)
-    {
-        return NULL;
-    }
-    prop->rses_prop_type = prop_type;
-#if defined(SS_DEBUG)
-    prop->rses_prop_chk_top = CHK_NUM_ROUTER_PROPERTY;
-    prop->rses_prop_chk_tail = CHK_NUM_ROUTER_PROPERTY;
-#endif
-
-    CHK_RSES_PROP(prop);
-    return prop;
-}
-
-/**
- * @brief Add property to the router client session
- *
- * Add property to the router_client_ses structure's rses_properties
- * array. The slot is determined by the type of property.
- * In each slot there is a list of properties of similar type.
- *
- * Router client session must be locked.
- *
- * @param rses      Router session
- * @param prop      Router session property to be added
- *
- * @return -1 on failure, 0 on success
- */
-int rses_property_add(ROUTER_CLIENT_SES *rses, rses_property_t *prop)
-{
-    if (rses == NULL)
-    {
-        MXS_ERROR("Router client session is NULL. (%s:%d)", __FILE__, __LINE__);
-        return -1;
-    }
-    if (prop == NULL)
-    {
-        MXS_ERROR("Router client session property is NULL. (%s:%d)", __FILE__, __LINE__);
-        return -1;
-    }
-    rses_property_t *p;
-
-    CHK_CLIENT_RSES(rses);
-    CHK_RSES_PROP(prop);
-
-    prop->rses_prop_rsession = rses;
-    p = rses->rses_properties[prop->rses_prop_type];
-
-    if (p == NULL)
-    {
-        rses->rses_properties[prop->rses_prop_type] = prop;
-    }
-    else
-    {
-        while (p->rses_prop_next != NULL)
-        {
-            p = p->rses_prop_next;
-        }
-        p->rses_prop_next = prop;
-    }
-    return 0;
-}
-
 /**
  * Find out which of the two backend servers has smaller value for select
  * criteria property.
@@ -1370,6 +1537,11 @@ int rses_property_add(ROUTER_CLIENT_SES *rses, rses_property_t *prop)
  * @param new   challenger
  * @param sc    select criteria
  *
+ * A backend whose connection is ready is always preferred over one that is
+ * still connecting or authenticating. The backends are connected to
+ * concurrently and this lets reads start on the first slave that is ready
+ * instead of waiting for the one with the best criteria value.
+ *
  * @return pointer to backend reference of that backend server which has smaller
  * value in selection criteria. If either reference pointer is NULL then the
  * other reference pointer value is returned.
@@ -1386,7 +1558,19 @@ static backend_ref_t *check_candidate_bref(backend_ref_t *cand,
     {
         return cand;
     }
-    else if (cand == NULL || (p((void *)cand, (void *)new) > 0))
+    else if (cand == NULL)
+    {
+        return new;
+    }
+    else if (bref_is_established(cand) != bref_is_established(new))
+    {
+        return bref_is_established(new) ? new : cand;
+    }
+    else if (SERVER_IS_OVERLOADED(cand->ref->server) != SERVER_IS_OVERLOADED(new->ref->server))
+    {
+        return SERVER_IS_OVERLOADED(new->ref->server) ? cand : new;
+    }
+    else if (p((void *)cand, (void *)new) > 0)
     {
         return new;
     }
@@ -50,6 +50,10 @@ static int bref_cmp_behind_master(const void *bref1, const void *bref2);
 
 static int bref_cmp_current_load(const void *bref1, const void *bref2);
 
+static int bref_cmp_response_time(const void *bref1, const void *bref2);
+
+static int bref_cmp_server_load(const void *bref1, const void *bref2);
+
 /**
  * The order of functions _must_ match with the order the select criteria are
  * listed in select_criteria_t definition in readwritesplit.h
@@ -60,7 +64,9 @@ int (*criteria_cmpfun[LAST_CRITERIA])(const void *, const void *) =
     bref_cmp_global_conn,
     bref_cmp_router_conn,
     bref_cmp_behind_master,
-    bref_cmp_current_load
+    bref_cmp_current_load,
+    bref_cmp_response_time,
+    bref_cmp_server_load
 };
 
 /**
@@ -114,7 +120,17 @@ backend_ref_t* get_slave_candidate(backend_ref_t *bref, int n, const SERVER *mas
         {
             if (candidate)
             {
-                if (cmpfun(candidate, &bref[i]) > 0)
+                /** Servers that the monitor reports as overloaded are used last */
+                bool overloaded = SERVER_IS_OVERLOADED(bref[i].ref->server);
+
+                if (overloaded != SERVER_IS_OVERLOADED(candidate->ref->server))
+                {
+                    if (!overloaded)
+                    {
+                        candidate = &bref[i];
+                    }
+                }
+                else if (cmpfun(candidate, &bref[i]) > 0)
                 {
                     candidate = &bref[i];
                 }
@@ -313,6 +329,72 @@ bool select_connect_backend_servers(backend_ref_t **p_master_ref,
     return succp;
 }
 
+/**
+ * @brief Reconnect the backends that were detached from the session
+ *
+ * The connections are taken from the connection pool if possible and the
+ * session command history is executed on them to restore the session state.
+ *
+ * @param rses Router client session
+ * @return False if the master was detached and it could not be reconnected
+ */
+bool rwsplit_reattach_backends(ROUTER_CLIENT_SES *rses)
+{
+    MXS_SESSION *session = rses->client_dcb->session;
+    bool rval = true;
+
+    for (int i = 0; i < rses->rses_nbackends; i++)
+    {
+        backend_ref_t *bref = &rses->rses_backend_ref[i];
+
+        if (BREF_IS_DETACHED(bref))
+        {
+            bref_clear_state(bref, BREF_DETACHED);
+
+            if (!bref_valid_for_connect(bref) || !connect_server(bref, session, true))
+            {
+                MXS_INFO("Failed to reattach [%s]:%d to the session.",
+                         bref->ref->server->name, bref->ref->server->port);
+
+                if (bref == rses->rses_master_ref)
+                {
+                    rval = false;
+                }
+            }
+        }
+    }
+
+    return rval;
+}
+
+/**
+ * @brief Connect the slaves of a session that was created with lazy_connect
+ *
+ * The slaves are connected when the first statement that can be routed to a
+ * slave is seen. The session command history is executed on them to bring
+ * them to the same state as the master.
+ *
+ * @param rses Router client session
+ */
+void rwsplit_lazy_connect_slaves(ROUTER_CLIENT_SES *rses)
+{
+    if (rses->rses_slaves_connected)
+    {
+        return;
+    }
+
+    rses->rses_slaves_connected = true;
+
+    MXS_INFO("Connecting to the slaves of a session that was created with lazy_connect.");
+
+    select_connect_backend_servers(&rses->rses_master_ref, rses->rses_backend_ref,
+                                   rses->rses_nbackends,
+                                   rses_get_max_slavecount(rses, rses->rses_nbackends),
+                                   rses_get_max_replication_lag(rses),
+                                   rses->rses_config.slave_selection_criteria,
+                                   rses->client_dcb->session, rses->router, true);
+}
+
 /** Compare number of connections from this router in backend servers */
 static int bref_cmp_router_conn(const void *bref1, const void *bref2)
 {
@@ -368,8 +450,8 @@ static int bref_cmp_behind_master(const void *bref1, const void *bref2)
 
     if (b1->weight == 0 && b2->weight == 0)
     {
-        return b1->server->rlag -
-               b2->server->rlag;
+        return b1->server->rlag_ms -
+               b2->server->rlag_ms;
     }
     else if (b1->weight == 0)
     {
@@ -380,8 +462,8 @@ static int bref_cmp_behind_master(const void *bref1, const void *bref2)
         return -1;
     }
 
-    return ((1000 + 1000 * b1->server->rlag) / b1->weight) -
-           ((1000 + 1000 * b2->server->rlag) / b2->weight);
+    return ((1000 + b1->server->rlag_ms) / b1->weight) -
+           ((1000 + b2->server->rlag_ms) / b2->weight);
 }
 
 /** Compare number of current operations in backend servers */
@@ -407,6 +489,94 @@ static int bref_cmp_current_load(const void *bref1, const void *bref2)
            ((1000 + 1000 * b2->server->stats.n_current_ops) / b2->weight);
 }
 
+/**
+ * Compare the expected response times of backend servers
+ *
+ * The expected response time is the average response time of the server
+ * multiplied by the number of operations that will be active once the new one
+ * is added. A server without samples is expected to be the fastest so that
+ * it gets measured.
+ */
+static int bref_cmp_response_time(const void *bref1, const void *bref2)
+{
+    SERVER_REF *b1 = ((backend_ref_t *)bref1)->ref;
+    SERVER_REF *b2 = ((backend_ref_t *)bref2)->ref;
+
+    if (b1->weight == 0 && b2->weight != 0)
+    {
+        return 1;
+    }
+    else if (b2->weight == 0 && b1->weight != 0)
+    {
+        return -1;
+    }
+
+    int64_t t1 = b1->server->stats.response_time * (b1->server->stats.n_current_ops + 1);
+    int64_t t2 = b2->server->stats.response_time * (b2->server->stats.n_current_ops + 1);
+
+    if (b1->weight != 0)
+    {
+        t1 = 1000 * t1 / b1->weight;
+        t2 = 1000 * t2 / b2->weight;
+    }
+
+    return t1 < t2 ? -1 : (t1 > t2 ? 1 : 0);
+}
+
+/**
+ * Compare the load of backend servers as sampled by the monitor
+ *
+ * The load of a server is the number of its running threads plus the current
+ * operations of MaxScale on it, which keeps the choice moving between the
+ * samples of the monitor. The queries per second break ties. If the monitor
+ * does not sample the load of both servers, only the current operations are
+ * compared.
+ */
+static int bref_cmp_server_load(const void *bref1, const void *bref2)
+{
+    SERVER_REF *b1 = ((backend_ref_t *)bref1)->ref;
+    SERVER_REF *b2 = ((backend_ref_t *)bref2)->ref;
+    SERVER_LOAD_METRICS *m1 = &b1->server->load_metrics;
+    SERVER_LOAD_METRICS *m2 = &b2->server->load_metrics;
+
+    if (m1->threads_running < 0 || m2->threads_running < 0)
+    {
+        return bref_cmp_current_load(bref1, bref2);
+    }
+
+    if (b1->weight == 0 && b2->weight != 0)
+    {
+        return 1;
+    }
+    else if (b2->weight == 0 && b1->weight != 0)
+    {
+        return -1;
+    }
+
+    int64_t l1 = m1->threads_running + b1->server->stats.n_current_ops + 1;
+    int64_t l2 = m2->threads_running + b2->server->stats.n_current_ops + 1;
+
+    if (b1->weight != 0)
+    {
+        l1 = 1000 * l1 / b1->weight;
+        l2 = 1000 * l2 / b2->weight;
+    }
+
+    if (l1 == l2 && m1->cpu >= 0 && m2->cpu >= 0)
+    {
+        l1 = m1->cpu;
+        l2 = m2->cpu;
+    }
+
+    if (l1 == l2)
+    {
+        l1 = m1->qps;
+        l2 = m2->qps;
+    }
+
+    return l1 < l2 ? -1 : (l1 > l2 ? 1 : 0);
+}
+
 /**
  * @brief Connect a server
  *
@@ -476,7 +646,9 @@ static void log_server_connections(select_criteria_t select_criteria,
     if (select_criteria == LEAST_GLOBAL_CONNECTIONS ||
         select_criteria == LEAST_ROUTER_CONNECTIONS ||
         select_criteria == LEAST_BEHIND_MASTER ||
-        select_criteria == LEAST_CURRENT_OPERATIONS)
+        select_criteria == LEAST_CURRENT_OPERATIONS ||
+        select_criteria == ADAPTIVE_ROUTING ||
+        select_criteria == LEAST_SERVER_LOAD)
     {
         MXS_INFO("Servers and %s connection counts:",
                  select_criteria == LEAST_GLOBAL_CONNECTIONS ? "all MaxScale"
@@ -511,6 +683,24 @@ static void log_server_connections(select_criteria_t select_criteria,
                 MXS_INFO("replication lag : %d in \t[%s]:%d %s",
                          b->server->rlag, b->server->name,
                          b->server->port, STRSRVSTATUS(b->server));
+                break;
+
+            case ADAPTIVE_ROUTING:
+                MXS_INFO("response time : %ld us and %d operations in \t[%s]:%d %s",
+                         b->server->stats.response_time,
+                         b->server->stats.n_current_ops,
+                         b->server->name, b->server->port,
+                         STRSRVSTATUS(b->server));
+                break;
+
+            case LEAST_SERVER_LOAD:
+                MXS_INFO("threads running : %d and %d queries per second in \t[%s]:%d %s",
+                         b->server->load_metrics.threads_running,
+                         b->server->load_metrics.qps,
+                         b->server->name, b->server->port,
+                         STRSRVSTATUS(b->server));
+                break;
+
             default:
                 break;
             }
@@ -18,7 +18,10 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <ctype.h>
 
+#include <maxscale/alloc.h>
+#include <maxscale/modutil.h>
 #include <maxscale/router.h>
 #include "rwsplit_internal.h"
 
@@ -38,52 +41,87 @@
 static bool sescmd_cursor_history_empty(sescmd_cursor_t *scur);
 static void sescmd_cursor_reset(sescmd_cursor_t *scur);
 static bool sescmd_cursor_next(sescmd_cursor_t *scur);
-static rses_property_t *mysql_sescmd_get_property(mysql_sescmd_t *scmd);
+static char *mysql_sescmd_get_key(GWBUF *buf, unsigned char packet_type);
 
-/*
- * The following functions, all to do with the handling of session commands,
- * are called from other modules of the read write split router:
+/** Initial number of slots in the session command history */
+#define SESCMD_HISTORY_INITIAL_SIZE 8
+
+/**
+ * Get a stored session command
+ *
+ * @param hist  The history
+ * @param index Index of the command, must be between the first and the end
+ * @return The command
  */
+static inline mysql_sescmd_t *sescmd_history_get(sescmd_history_t *hist, uint64_t index)
+{
+    ss_dassert(index >= hist->first && index < hist->end);
+    return &hist->cmds[index & (hist->capacity - 1)];
+}
 
 /**
- * Router session must be locked.
- * Return session command pointer if succeed, NULL if failed.
+ * Double the size of the history
+ *
+ * @param hist The history
+ * @return False if memory allocation failed
  */
-mysql_sescmd_t *rses_property_get_sescmd(rses_property_t *prop)
+static bool sescmd_history_grow(sescmd_history_t *hist)
 {
-    mysql_sescmd_t *sescmd;
+    uint64_t capacity = hist->capacity ? hist->capacity * 2 : SESCMD_HISTORY_INITIAL_SIZE;
+    mysql_sescmd_t *cmds = MXS_MALLOC(capacity * sizeof(mysql_sescmd_t));
 
-    if (prop == NULL)
+    if (cmds == NULL)
     {
-        MXS_ERROR("[%s] Error: NULL parameter.", __FUNCTION__);
-        return NULL;
+        return false;
     }
 
-    CHK_RSES_PROP(prop);
-
-    sescmd = &prop->rses_prop_data.sescmd;
-
-    if (sescmd != NULL)
+    for (uint64_t i = hist->first; i < hist->end; i++)
     {
-        CHK_MYSQL_SESCMD(sescmd);
+        cmds[i & (capacity - 1)] = *sescmd_history_get(hist, i);
     }
-    return sescmd;
+
+    MXS_FREE(hist->cmds);
+    hist->cmds = cmds;
+    hist->capacity = capacity;
+    return true;
+}
+
+/**
+ * Free the resources of a session command
+ */
+static void mysql_sescmd_done(mysql_sescmd_t *sescmd)
+{
+    CHK_MYSQL_SESCMD(sescmd);
+    gwbuf_free(sescmd->my_sescmd_buf);
+    MXS_FREE(sescmd->my_sescmd_key);
+    memset(sescmd, 0, sizeof(mysql_sescmd_t));
 }
 
+/*
+ * The following functions, all to do with the handling of session commands,
+ * are called from other modules of the read write split router:
+ */
+
 /**
- * Create session command property.
+ * Add a session command to the end of the history.
+ *
+ * The returned pointer is valid until the next command is added.
  */
-mysql_sescmd_t *mysql_sescmd_init(rses_property_t *rses_prop,
-                                  GWBUF *sescmd_buf,
-                                  unsigned char packet_type,
-                                  ROUTER_CLIENT_SES *rses)
+mysql_sescmd_t *sescmd_history_add(ROUTER_CLIENT_SES *rses,
+                                   GWBUF *sescmd_buf,
+                                   unsigned char packet_type)
 {
-    mysql_sescmd_t *sescmd;
+    sescmd_history_t *hist = &rses->rses_sescmd_history;
 
-    CHK_RSES_PROP(rses_prop);
-    /** Can't call rses_property_get_sescmd with uninitialized sescmd */
-    sescmd = &rses_prop->rses_prop_data.sescmd;
-    sescmd->my_sescmd_prop = rses_prop; /*< reference to owning property */
+    if (hist->end - hist->first == hist->capacity && !sescmd_history_grow(hist))
+    {
+        return NULL;
+    }
+
+    mysql_sescmd_t *sescmd = &hist->cmds[hist->end & (hist->capacity - 1)];
+    hist->end++;
+
+    memset(sescmd, 0, sizeof(*sescmd));
 #if defined(SS_DEBUG)
     sescmd->my_sescmd_chk_top = CHK_NUM_MY_SESCMD;
     sescmd->my_sescmd_chk_tail = CHK_NUM_MY_SESCMD;
@@ -92,20 +130,70 @@ mysql_sescmd_t *mysql_sescmd_init(rses_property_t *rses_prop,
     sescmd->my_sescmd_buf = sescmd_buf;
     sescmd->my_sescmd_packet_type = packet_type;
     sescmd->position = atomic_add(&rses->pos_generator, 1);
+    sescmd->my_sescmd_key = mysql_sescmd_get_key(sescmd_buf, packet_type);
 
     return sescmd;
 }
 
-void mysql_sescmd_done(mysql_sescmd_t *sescmd)
+/**
+ * Check that none of the backends in use is still executing a session command
+ */
+static bool sescmd_is_executed(ROUTER_CLIENT_SES *rses, mysql_sescmd_t *scmd)
 {
-    if (sescmd == NULL)
+    for (int i = 0; i < rses->rses_nbackends; i++)
     {
-        MXS_ERROR("[%s] Error: NULL parameter.", __FUNCTION__);
-        return;
+        backend_ref_t *bref = &rses->rses_backend_ref[i];
+
+        if (BREF_IS_IN_USE(bref) && bref->bref_sescmd_cur.position <= scmd->position + 1)
+        {
+            return false;
+        }
     }
-    CHK_RSES_PROP(sescmd->my_sescmd_prop);
-    gwbuf_free(sescmd->my_sescmd_buf);
-    memset(sescmd, 0, sizeof(mysql_sescmd_t));
+
+    return true;
+}
+
+/**
+ * Remove the oldest session commands that all backends in use have executed.
+ */
+void sescmd_history_trim(ROUTER_CLIENT_SES *rses)
+{
+    sescmd_history_t *hist = &rses->rses_sescmd_history;
+
+    while (hist->first < hist->end)
+    {
+        mysql_sescmd_t *scmd = sescmd_history_get(hist, hist->first);
+
+        if (!sescmd_is_executed(rses, scmd))
+        {
+            break;
+        }
+
+        rses->rses_sescmd_size -= gwbuf_length(scmd->my_sescmd_buf);
+        mysql_sescmd_done(scmd);
+        hist->first++;
+    }
+}
+
+void sescmd_history_free(ROUTER_CLIENT_SES *rses)
+{
+    sescmd_history_t *hist = &rses->rses_sescmd_history;
+
+    for (uint64_t i = hist->first; i < hist->end; i++)
+    {
+        mysql_sescmd_done(sescmd_history_get(hist, i));
+    }
+
+    MXS_FREE(hist->cmds);
+    memset(hist, 0, sizeof(*hist));
+}
+
+void sescmd_cursor_init(sescmd_cursor_t *scur, ROUTER_CLIENT_SES *rses)
+{
+    scur->scmd_cur_rses = rses;
+    scur->scmd_cur_active = false;
+    scur->scmd_cur_index = rses->rses_sescmd_history.first;
+    scur->scmd_cur_sent = 0;
 }
 
 /**
@@ -134,7 +222,7 @@ GWBUF *sescmd_cursor_process_replies(GWBUF *replybuf,
 {
     sescmd_cursor_t *scur = &bref->bref_sescmd_cur;
     mysql_sescmd_t *scmd = sescmd_cursor_get_command(scur);
-    ROUTER_CLIENT_SES *ses = (*scur->scmd_cur_ptr_property)->rses_prop_rsession;
+    ROUTER_CLIENT_SES *ses = scur->scmd_cur_rses;
     CHK_GWBUF(replybuf);
 
     /**
@@ -145,6 +233,8 @@ GWBUF *sescmd_cursor_process_replies(GWBUF *replybuf,
     {
         bref->reply_cmd = *((unsigned char *)replybuf->start + 4);
         scur->position = scmd->position;
+        bool is_prepare = scmd->my_sescmd_packet_type == MYSQL_COM_STMT_PREPARE;
+
         /** Faster backend has already responded to client : discard */
         if (scmd->my_sescmd_is_replied)
         {
@@ -152,6 +242,11 @@ GWBUF *sescmd_cursor_process_replies(GWBUF *replybuf,
 
             CHK_GWBUF(replybuf);
 
+            if (is_prepare)
+            {
+                rwsplit_ps_store_reply(ses, bref, scmd->position, replybuf, false);
+            }
+
             while (!last_packet)
             {
                 int buflen;
@@ -161,8 +256,12 @@ GWBUF *sescmd_cursor_process_replies(GWBUF *replybuf,
                 /** discard packet */
                 replybuf = gwbuf_consume(replybuf, buflen);
             }
-            /** Set response status received */
-            bref_clear_state(bref, BREF_WAITING_RESULT);
+            /** Set response status received, a pipelined statement may
+             * still be executing */
+            if (!BREF_IS_PIPELINED(bref))
+            {
+                bref_clear_state(bref, BREF_WAITING_RESULT);
+            }
 
             if (bref->reply_cmd != scmd->reply_cmd && BREF_IS_IN_USE(bref))
             {
@@ -195,6 +294,12 @@ GWBUF *sescmd_cursor_process_replies(GWBUF *replybuf,
             scmd->my_sescmd_is_replied = true;
             scmd->reply_cmd = *((unsigned char *)replybuf->start + 4);
 
+            if (is_prepare)
+            {
+                /** The client uses the ID of the statement in this reply */
+                rwsplit_ps_store_reply(ses, bref, scmd->position, replybuf, true);
+            }
+
             MXS_INFO("Server '%s' responded to a session command, sending the response "
                      "to the client.", bref->ref->server->unique_name);
 
@@ -237,6 +342,10 @@ GWBUF *sescmd_cursor_process_replies(GWBUF *replybuf,
                 MXS_ERROR("Slave '%s' (%s:%u) failed to execute session command.",
                           serv->unique_name, serv->name, serv->port);
             }
+            else if (is_prepare)
+            {
+                rwsplit_ps_store_reply(ses, bref, scmd->position, replybuf, false);
+            }
 
             gwbuf_free(replybuf);
             replybuf = NULL;
@@ -253,24 +362,26 @@ GWBUF *sescmd_cursor_process_replies(GWBUF *replybuf,
             scur->scmd_cur_active = false;
         }
     }
-    ss_dassert(replybuf == NULL || *scur->scmd_cur_ptr_property == NULL);
+    ss_dassert(replybuf == NULL || scur->scmd_cur_index == ses->rses_sescmd_history.end);
 
     return replybuf;
 }
 
 /**
- * Get the address of current session command.
+ * Get the current session command of a cursor.
  *
- * Router session must be locked */
+ * @return The command or NULL if the cursor has no command to execute
+ */
 mysql_sescmd_t *sescmd_cursor_get_command(sescmd_cursor_t *scur)
 {
-    mysql_sescmd_t *scmd;
-
-    scur->scmd_cur_cmd = rses_property_get_sescmd(*scur->scmd_cur_ptr_property);
+    sescmd_history_t *hist = &scur->scmd_cur_rses->rses_sescmd_history;
+    mysql_sescmd_t *scmd = NULL;
 
-    CHK_MYSQL_SESCMD(scur->scmd_cur_cmd);
-
-    scmd = scur->scmd_cur_cmd;
+    if (scur->scmd_cur_index >= hist->first && scur->scmd_cur_index < hist->end)
+    {
+        scmd = sescmd_history_get(hist, scur->scmd_cur_index);
+        CHK_MYSQL_SESCMD(scmd);
+    }
 
     return scmd;
 }
@@ -311,9 +422,10 @@ GWBUF *sescmd_cursor_clone_querybuf(sescmd_cursor_t *scur)
         MXS_ERROR("[%s] Error: NULL parameter.", __FUNCTION__);
         return NULL;
     }
-    ss_dassert(scur->scmd_cur_cmd != NULL);
+    mysql_sescmd_t *scmd = sescmd_cursor_get_command(scur);
+    ss_dassert(scmd != NULL);
 
-    buf = gwbuf_clone(scur->scmd_cur_cmd->my_sescmd_buf);
+    buf = gwbuf_clone(scmd->my_sescmd_buf);
 
     CHK_GWBUF(buf);
     return buf;
@@ -342,27 +454,194 @@ bool execute_sescmd_history(backend_ref_t *bref)
     return succp;
 }
 
-static bool sescmd_cursor_history_empty(sescmd_cursor_t *scur)
+/**
+ * Write the session commands that a backend has not yet executed in one go
+ *
+ * The commands are written without waiting for the replies, which are then
+ * processed one by one as they arrive. A COM_CHANGE_USER is only written when
+ * nothing else is executing, so the pipeline stops in front of it.
+ *
+ * @param bref Backend reference whose cursor is not active
+ * @return True if the statement being routed can be written right after the
+ * commands, false if it has to wait until they are executed
+ */
+bool sescmd_cursor_pipeline(backend_ref_t *bref)
 {
-    bool succp;
+    sescmd_cursor_t *scur = &bref->bref_sescmd_cur;
+    uint64_t index = scur->scmd_cur_index;
+    mysql_sescmd_t *scmd;
+    bool rval = true;
 
-    if (scur == NULL)
+    ss_dassert(!sescmd_cursor_is_active(scur));
+    bref_set_state(bref, BREF_WAITING_RESULT);
+
+    while ((scmd = sescmd_cursor_get_command(scur)))
     {
-        MXS_ERROR("[%s] Error: NULL parameter.", __FUNCTION__);
-        return true;
+        bool change_user = scmd->my_sescmd_packet_type == MYSQL_COM_CHANGE_USER;
+
+        if (change_user && scur->scmd_cur_index > index)
+        {
+            rval = false;
+            break;
+        }
+
+        if (!execute_sescmd_in_backend(bref))
+        {
+            MXS_ERROR("Failed to execute session command in [%s]:%d",
+                      bref->ref->server->name, bref->ref->server->port);
+            rval = false;
+            break;
+        }
+
+        scur->scmd_cur_index++;
+
+        /** The statement can use the ID of a prepared statement only after
+         * the server has replied with it */
+        if (change_user || scmd->my_sescmd_packet_type == MYSQL_COM_STMT_PREPARE)
+        {
+            rval = false;
+
+            if (change_user)
+            {
+                break;
+            }
+        }
     }
-    CHK_SESCMD_CUR(scur);
 
-    if (scur->scmd_cur_rses->rses_properties[RSES_PROP_TYPE_SESCMD] == NULL)
+    MXS_INFO("Sent %d session commands to [%s]:%d in one go.",
+             (int)(scur->scmd_cur_index - index), bref->ref->server->name,
+             bref->ref->server->port);
+
+    scur->scmd_cur_sent = scur->scmd_cur_index;
+    scur->scmd_cur_index = index;
+    return rval;
+}
+
+/**
+ * Check whether a later session command replaces this one
+ *
+ * Only the commands up to the next one without a key are checked. The commands
+ * with a key assign literal values so they do not depend on the earlier state
+ * but e.g. a prepared statement depends on the default database.
+ */
+static bool sescmd_is_replaced(sescmd_history_t *hist, uint64_t index)
+{
+    const char *key = sescmd_history_get(hist, index)->my_sescmd_key;
+
+    for (uint64_t i = index + 1; i < hist->end; i++)
     {
-        succp = true;
+        const char *next = sescmd_history_get(hist, i)->my_sescmd_key;
+
+        if (next == NULL)
+        {
+            break;
+        }
+        else if (strcmp(next, key) == 0)
+        {
+            return true;
+        }
     }
-    else
+
+    return false;
+}
+
+/**
+ * Remove a session command from the middle of the history
+ *
+ * The later commands are moved one slot back and so are the cursors that
+ * point to them.
+ */
+static void sescmd_history_remove(ROUTER_CLIENT_SES *rses, uint64_t index)
+{
+    sescmd_history_t *hist = &rses->rses_sescmd_history;
+
+    mysql_sescmd_done(sescmd_history_get(hist, index));
+
+    for (uint64_t i = index + 1; i < hist->end; i++)
     {
-        succp = false;
+        *sescmd_history_get(hist, i - 1) = *sescmd_history_get(hist, i);
     }
 
-    return succp;
+    hist->end--;
+
+    for (int i = 0; i < rses->rses_nbackends; i++)
+    {
+        sescmd_cursor_t *scur = &rses->rses_backend_ref[i].bref_sescmd_cur;
+
+        if (scur->scmd_cur_index > index)
+        {
+            scur->scmd_cur_index--;
+        }
+
+        if (scur->scmd_cur_sent > index)
+        {
+            scur->scmd_cur_sent--;
+        }
+    }
+}
+
+/**
+ * Check that no backend in use needs a session command that a later one
+ * replaces. A backend needs it if it is executing it. A backend that has not
+ * yet reached it, which is how the slaves are left with
+ * defer_session_commands, can skip it.
+ */
+static bool sescmd_is_removable(ROUTER_CLIENT_SES *rses, uint64_t index)
+{
+    mysql_sescmd_t *scmd = sescmd_history_get(&rses->rses_sescmd_history, index);
+
+    for (int i = 0; i < rses->rses_nbackends; i++)
+    {
+        backend_ref_t *bref = &rses->rses_backend_ref[i];
+        sescmd_cursor_t *scur = &bref->bref_sescmd_cur;
+        bool executed = bref->bref_sescmd_cur.position > scmd->position + 1;
+        bool executing = scur->scmd_cur_active && index >= scur->scmd_cur_index &&
+                         index < MXS_MAX(scur->scmd_cur_index + 1, scur->scmd_cur_sent);
+        bool pending = index >= scur->scmd_cur_index && !executing;
+
+        if (BREF_IS_IN_USE(bref) && !executed && !pending)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void sescmd_history_compact(ROUTER_CLIENT_SES *rses)
+{
+    sescmd_history_t *hist = &rses->rses_sescmd_history;
+    uint64_t i = hist->first;
+
+    while (i < hist->end)
+    {
+        mysql_sescmd_t *scmd = sescmd_history_get(hist, i);
+
+        if (scmd->my_sescmd_key && sescmd_is_replaced(hist, i) && sescmd_is_removable(rses, i))
+        {
+            rses->rses_sescmd_size -= gwbuf_length(scmd->my_sescmd_buf);
+            atomic_add(&rses->rses_nsescmd, -1);
+            sescmd_history_remove(rses, i);
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+static bool sescmd_cursor_history_empty(sescmd_cursor_t *scur)
+{
+    if (scur == NULL)
+    {
+        MXS_ERROR("[%s] Error: NULL parameter.", __FUNCTION__);
+        return true;
+    }
+    CHK_SESCMD_CUR(scur);
+
+    sescmd_history_t *hist = &scur->scmd_cur_rses->rses_sescmd_history;
+
+    return hist->first == hist->end;
 }
 
 /*
@@ -372,7 +651,6 @@ static bool sescmd_cursor_history_empty(sescmd_cursor_t *scur)
 
 static void sescmd_cursor_reset(sescmd_cursor_t *scur)
 {
-    ROUTER_CLIENT_SES *rses;
     if (scur == NULL)
     {
         MXS_ERROR("[%s] Error: NULL parameter.", __FUNCTION__);
@@ -380,88 +658,288 @@ static void sescmd_cursor_reset(sescmd_cursor_t *scur)
     }
     CHK_SESCMD_CUR(scur);
     CHK_CLIENT_RSES(scur->scmd_cur_rses);
-    rses = scur->scmd_cur_rses;
-
-    scur->scmd_cur_ptr_property = &rses->rses_properties[RSES_PROP_TYPE_SESCMD];
 
-    CHK_RSES_PROP((*scur->scmd_cur_ptr_property));
+    scur->scmd_cur_index = scur->scmd_cur_rses->rses_sescmd_history.first;
     scur->scmd_cur_active = false;
-    scur->scmd_cur_cmd = &(*scur->scmd_cur_ptr_property)->rses_prop_data.sescmd;
+    scur->scmd_cur_sent = 0;
 }
 
 /**
- * Moves cursor to next property and copied address of its sescmd to cursor.
- * Current propery must be non-null.
- * If current property is the last on the list, *scur->scmd_ptr_property == NULL
+ * Moves cursor to the next session command.
  *
- * Router session must be locked
+ * If the current command is the last one, the cursor is left at the end of the
+ * history and false is returned.
  */
 static bool sescmd_cursor_next(sescmd_cursor_t *scur)
 {
-    bool succp = false;
-    rses_property_t *prop_curr;
-    rses_property_t *prop_next;
-
     if (scur == NULL)
     {
         MXS_ERROR("[%s] Error: NULL parameter.", __FUNCTION__);
         return false;
     }
 
-    ss_dassert(scur != NULL);
-    ss_dassert(*(scur->scmd_cur_ptr_property) != NULL);
+    sescmd_history_t *hist = &scur->scmd_cur_rses->rses_sescmd_history;
+    ss_dassert(scur->scmd_cur_index < hist->end);
+
+    if (scur->scmd_cur_index < hist->end)
+    {
+        scur->scmd_cur_index++;
+    }
+
+    return scur->scmd_cur_index < hist->end;
+}
+
+static bool sescmd_is_ident_char(char c)
+{
+    return isalnum(c) || c == '_' || c == '$';
+}
 
-    /** Illegal situation */
-    if (scur == NULL || *scur->scmd_cur_ptr_property == NULL ||
-        scur->scmd_cur_cmd == NULL)
+static const char *sescmd_skip_space(const char *ptr, const char *end)
+{
+    while (ptr < end && isspace(*ptr))
     {
-        /** Log error */
-        goto return_succp;
+        ptr++;
     }
-    prop_curr = *(scur->scmd_cur_ptr_property);
 
-    CHK_MYSQL_SESCMD(scur->scmd_cur_cmd);
-    ss_dassert(prop_curr == mysql_sescmd_get_property(scur->scmd_cur_cmd));
-    CHK_RSES_PROP(prop_curr);
+    return ptr;
+}
 
-    /** Copy address of pointer to next property */
-    scur->scmd_cur_ptr_property = &(prop_curr->rses_prop_next);
-    prop_next = *scur->scmd_cur_ptr_property;
-    ss_dassert(prop_next == *(scur->scmd_cur_ptr_property));
+/** Match a keyword and skip the whitespace after it */
+static bool sescmd_match_word(const char **ptr, const char *end, const char *word)
+{
+    size_t len = strlen(word);
+    const char *p = *ptr;
 
-    /** If there is a next property move forward */
-    if (prop_next != NULL)
+    if ((size_t)(end - p) >= len && strncasecmp(p, word, len) == 0 &&
+        (p + len == end || !sescmd_is_ident_char(p[len])))
     {
-        CHK_RSES_PROP(prop_next);
-        CHK_RSES_PROP((*(scur->scmd_cur_ptr_property)));
+        *ptr = sescmd_skip_space(p + len, end);
+        return true;
+    }
 
-        /** Get pointer to next property's sescmd */
-        scur->scmd_cur_cmd = rses_property_get_sescmd(prop_next);
+    return false;
+}
 
-        ss_dassert(prop_next == scur->scmd_cur_cmd->my_sescmd_prop);
-        CHK_MYSQL_SESCMD(scur->scmd_cur_cmd);
-        CHK_RSES_PROP(scur->scmd_cur_cmd->my_sescmd_prop);
+/** Read an identifier that is optionally quoted with backticks */
+static bool sescmd_read_ident(const char **ptr, const char *end,
+                              const char **name, size_t *len)
+{
+    const char *p = *ptr;
+    bool quoted = p < end && *p == '`';
+    const char *start = quoted ? ++p : p;
+
+    while (p < end && (quoted ? *p != '`' : sescmd_is_ident_char(*p)))
+    {
+        p++;
     }
-    else
+
+    if (p == start || (quoted && p == end))
+    {
+        return false;
+    }
+
+    *name = start;
+    *len = p - start;
+    *ptr = quoted ? p + 1 : p;
+    return true;
+}
+
+/** Skip a quoted string, a number or a keyword like ON or DEFAULT */
+static bool sescmd_skip_literal(const char **ptr, const char *end)
+{
+    const char *p = *ptr;
+
+    if (p < end && (*p == '\'' || *p == '"'))
     {
-        /** No more properties, can't proceed. */
-        goto return_succp;
+        char quote = *p++;
+
+        while (p < end && *p != quote)
+        {
+            p += *p == '\\' ? 2 : 1;
+        }
+
+        if (p >= end)
+        {
+            return false;
+        }
+
+        /** A doubled quote would continue the string */
+        *ptr = ++p;
+        return p == end || *p != quote;
     }
 
-    if (scur->scmd_cur_cmd != NULL)
+    if (p < end && (*p == '-' || *p == '+'))
     {
-        succp = true;
+        p++;
     }
-    else
+
+    const char *start = p;
+
+    while (p < end && (sescmd_is_ident_char(*p) || *p == '.'))
     {
-        ss_dassert(false); /*< Log error, sescmd shouldn't be NULL */
+        p++;
     }
-return_succp:
-    return succp;
+
+    *ptr = p;
+    return p > start;
 }
 
-static rses_property_t *mysql_sescmd_get_property(mysql_sescmd_t *scmd)
+/**
+ * Get the key of a session command that assigns a literal value
+ *
+ * Two commands with the same key set the same part of the session state, so
+ * only the latest one needs to be kept in the history. Default database
+ * changes have the key @c use, @c SET NAMES has the key @c names and variable
+ * assignments have the name of the variable as the key, prefixed with @c @ for
+ * user variables.
+ *
+ * @param buf         Session command
+ * @param packet_type Command byte of the packet
+ * @return The key or NULL if the command may depend on the earlier state or
+ * sets more than one thing
+ */
+static char *mysql_sescmd_get_key(GWBUF *buf, unsigned char packet_type)
 {
-    CHK_MYSQL_SESCMD(scmd);
-    return scmd->my_sescmd_prop;
+    char *sql;
+    int len;
+
+    if (packet_type == MYSQL_COM_INIT_DB)
+    {
+        return MXS_STRDUP("use");
+    }
+    else if (packet_type != MYSQL_COM_QUERY || !modutil_extract_SQL(buf, &sql, &len))
+    {
+        return NULL;
+    }
+
+    const char *end = sql + len;
+    const char *ptr = sescmd_skip_space(sql, end);
+    const char *name = NULL;
+    size_t name_len = 0;
+    bool user_var = false;
+
+    if (sescmd_match_word(&ptr, end, "USE"))
+    {
+        if (!sescmd_read_ident(&ptr, end, &name, &name_len))
+        {
+            return NULL;
+        }
+
+        name = "use";
+        name_len = 3;
+    }
+    else if (!sescmd_match_word(&ptr, end, "SET"))
+    {
+        return NULL;
+    }
+    else if (sescmd_match_word(&ptr, end, "NAMES"))
+    {
+        if (!sescmd_skip_literal(&ptr, end))
+        {
+            return NULL;
+        }
+
+        ptr = sescmd_skip_space(ptr, end);
+
+        if (sescmd_match_word(&ptr, end, "COLLATE") && !sescmd_skip_literal(&ptr, end))
+        {
+            return NULL;
+        }
+
+        name = "names";
+        name_len = 5;
+    }
+    else
+    {
+        if (end - ptr > 2 && ptr[0] == '@' && ptr[1] == '@')
+        {
+            ptr += 2;
+
+            if (!sescmd_read_ident(&ptr, end, &name, &name_len))
+            {
+                return NULL;
+            }
+
+            if (ptr < end && *ptr == '.')
+            {
+                /** Only the session scope is a part of the session state */
+                if ((name_len != 7 || strncasecmp(name, "session", 7) != 0) &&
+                    (name_len != 5 || strncasecmp(name, "local", 5) != 0))
+                {
+                    return NULL;
+                }
+
+                ptr++;
+                name = NULL;
+            }
+        }
+        else if (ptr < end && *ptr == '@')
+        {
+            ptr++;
+            user_var = true;
+        }
+        else if (!sescmd_match_word(&ptr, end, "SESSION"))
+        {
+            sescmd_match_word(&ptr, end, "LOCAL");
+        }
+
+        if ((name == NULL && !sescmd_read_ident(&ptr, end, &name, &name_len)) ||
+            (!user_var && name_len == 8 && strncasecmp(name, "password", 8) == 0))
+        {
+            return NULL;
+        }
+
+        ptr = sescmd_skip_space(ptr, end);
+
+        if (ptr < end && *ptr == ':')
+        {
+            ptr++;
+        }
+
+        if (ptr == end || *ptr != '=')
+        {
+            return NULL;
+        }
+
+        ptr = sescmd_skip_space(ptr + 1, end);
+
+        if (!sescmd_skip_literal(&ptr, end))
+        {
+            return NULL;
+        }
+    }
+
+    ptr = sescmd_skip_space(ptr, end);
+
+    if (ptr < end && *ptr == ';')
+    {
+        ptr = sescmd_skip_space(ptr + 1, end);
+    }
+
+    if (ptr != end)
+    {
+        /** Something else than a single assignment */
+        return NULL;
+    }
+
+    char *key = MXS_MALLOC(name_len + 2);
+
+    if (key)
+    {
+        char *dest = key;
+
+        if (user_var)
+        {
+            *dest++ = '@';
+        }
+
+        for (size_t i = 0; i < name_len; i++)
+        {
+            *dest++ = tolower(name[i]);
+        }
+
+        *dest = '\0';
+    }
+
+    return key;
 }
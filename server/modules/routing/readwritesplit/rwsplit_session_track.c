@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include "readwritesplit.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/protocol/mysql.h>
+#include "rwsplit_internal.h"
+
+/**
+ * @file rwsplit_session_track.c   The session state reported by the master.
+ *
+ * The client protocol derives the transaction state and the autocommit mode of
+ * the session by parsing the statements, and the default database is only
+ * known when it is changed with COM_INIT_DB. With track_session_state, the
+ * backends send session state information in their OK packets and the state
+ * reported by the master is taken as the truth. This catches the statements
+ * the parser can't tell apart, e.g. the implicit commit of DDL, transactions
+ * ended inside stored procedures and USE statements.
+ *
+ * The state is only taken from a reply that leaves the master idle. With
+ * pipelined statements, the state the parser derived from the later
+ * statements is newer than that of the reply.
+ */
+
+/**
+ * Correct the transaction state of the session
+ *
+ * @param session   The session
+ * @param trx_state The transaction state sent by the master
+ * @return True if the state of the session was changed
+ */
+static bool track_trx_state(MXS_SESSION *session, const char *trx_state)
+{
+    /** An explicit or an implicit transaction is open */
+    bool server_active = *trx_state == 'T' || *trx_state == 'I';
+    bool active = session_trx_is_active(session) && !session_trx_is_ending(session);
+
+    if (session_trx_is_read_only(session))
+    {
+        /** A read-only transaction is executed on a slave */
+        return false;
+    }
+    else if (server_active && !active)
+    {
+        session_set_trx_state(session, SESSION_TRX_READ_WRITE);
+        return true;
+    }
+    else if (!server_active && active)
+    {
+        session_set_trx_state(session, SESSION_TRX_INACTIVE);
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * Correct the autocommit mode of the session
+ *
+ * @param session    The session
+ * @param autocommit The value of the autocommit variable sent by the master
+ * @return True if the mode of the session was changed
+ */
+static bool track_autocommit(MXS_SESSION *session, const char *autocommit)
+{
+    bool enabled = strcasecmp(autocommit, "ON") == 0 || strcmp(autocommit, "1") == 0;
+
+    if (enabled != session_is_autocommit(session))
+    {
+        session_set_autocommit(session, enabled);
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * Store the default database of the session
+ *
+ * The database is used when new backend connections are created for the session.
+ *
+ * @param rses   Router session
+ * @param schema The default database sent by the master
+ */
+static void track_schema(ROUTER_CLIENT_SES *rses, const char *schema)
+{
+    MYSQL_session *data = (MYSQL_session*)rses->client_dcb->data;
+
+    if (data && strlen(schema) <= MYSQL_DATABASE_MAXLEN && strcmp(data->db, schema) != 0)
+    {
+        MXS_INFO("Default database changed from '%s' to '%s'.", data->db, schema);
+        strcpy(data->db, schema);
+    }
+}
+
+void rwsplit_session_track_apply(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
+                                 backend_ref_t *bref, const char *autocommit,
+                                 const char *schema, const char *trx_state)
+{
+    MXS_SESSION *session = rses->client_dcb->session;
+
+    if (bref != rses->rses_master_ref || bref->bref_replies.count > 0 || bref->bref_pending_cmd)
+    {
+        return;
+    }
+
+    if (schema)
+    {
+        track_schema(rses, schema);
+    }
+
+    bool corrected = false;
+
+    if (autocommit && track_autocommit(session, autocommit))
+    {
+        MXS_INFO("The master reported autocommit=%s.", autocommit);
+        corrected = true;
+    }
+
+    if (trx_state && *trx_state && track_trx_state(session, trx_state))
+    {
+        MXS_INFO("The master reported the transaction state '%s'.", trx_state);
+        corrected = true;
+    }
+
+    if (corrected)
+    {
+        atomic_add_uint64(&inst->stats.n_trx_corrections, 1);
+    }
+}
@@ -0,0 +1,443 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include "readwritesplit.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/modutil.h>
+#include <maxscale/poll.h>
+#include <maxscale/protocol/mysql.h>
+#include "rwsplit_internal.h"
+
+/**
+ * @file rwsplit_split_stmt.c   Multi-statement queries that are split into
+ * individual statements.
+ *
+ * Each statement of a split query is routed on its own once the reply to the
+ * previous one has been read. The replies are sent to the client as one
+ * multi-result reply: the sequence numbers run over all of them and the
+ * replies of all but the last statement have the more results flag set.
+ * An error ends the query like it does on the server. Queries the client
+ * sends before the reply is complete are routed after it.
+ */
+
+/** The more results flag in the status of OK and EOF packets */
+#define SPLIT_MORE_RESULTS 0x0008
+
+/**
+ * Pop the first buffer of a list of packets
+ *
+ * @param list The list
+ * @return The first packet
+ */
+static GWBUF* split_list_pop(GWBUF **list)
+{
+    GWBUF *buf = *list;
+
+    *list = buf->next;
+
+    if (*list)
+    {
+        (*list)->tail = buf->tail;
+    }
+
+    buf->next = NULL;
+    buf->tail = buf;
+    return buf;
+}
+
+/**
+ * Create a COM_QUERY packet of one statement
+ *
+ * @param sql The statement
+ * @param len Length of the statement
+ * @return The packet or NULL on memory allocation failure
+ */
+static GWBUF* split_create_stmt(const char *sql, int len)
+{
+    GWBUF *buf = gwbuf_alloc(MYSQL_HEADER_LEN + 1 + len);
+
+    if (buf)
+    {
+        uint8_t *data = GWBUF_DATA(buf);
+        gw_mysql_set_byte3(data, len + 1);
+        data[3] = 0;
+        data[4] = MYSQL_COM_QUERY;
+        memcpy(data + MYSQL_HEADER_LEN + 1, sql, len);
+        gwbuf_set_type(buf, GWBUF_TYPE_MYSQL);
+        gwbuf_set_type(buf, GWBUF_TYPE_SINGLE_STMT);
+    }
+
+    return buf;
+}
+
+/**
+ * Check whether a statement can be executed as a part of a split query
+ *
+ * The transaction state of the session is tracked from the whole query so
+ * statements that change it are not split out. LOAD DATA LOCAL INFILE
+ * needs the client to reply in the middle of the result.
+ *
+ * @param stmt The statement
+ * @return True if the statement can be routed on its own
+ */
+static bool split_stmt_is_routable(GWBUF *stmt)
+{
+    return qc_get_trx_type_mask(stmt) == 0 && qc_get_operation(stmt) != QUERY_OP_LOAD;
+}
+
+/**
+ * Split a multi-statement query
+ *
+ * @param querybuf The query
+ * @param n_stmts The number of statements is stored here
+ * @return The statements as a list of packets or NULL if the query is not split
+ */
+static GWBUF* split_query(GWBUF *querybuf, int *n_stmts)
+{
+    char *sql = (char*)GWBUF_DATA(querybuf) + MYSQL_HEADER_LEN + 1;
+    int len = gw_mysql_get_byte3(GWBUF_DATA(querybuf)) - 1;
+    char *end = sql + len;
+    GWBUF *stmts = NULL;
+    bool ok = true;
+    char *ptr;
+
+    *n_stmts = 0;
+
+    while (ok && sql < end)
+    {
+        ptr = find_mysql_statement_end(sql, end - sql);
+
+        if (ptr == NULL || is_mysql_statement_end(ptr, end - ptr))
+        {
+            /** The rest of the string is the last statement */
+            ptr = end;
+        }
+        else if (is_mysql_sp_end(ptr, end - ptr))
+        {
+            /** The semicolons are inside a compound statement */
+            ok = false;
+            break;
+        }
+
+        while (sql < ptr && isspace(*sql))
+        {
+            sql++;
+        }
+
+        if (sql < ptr)
+        {
+            GWBUF *stmt = split_create_stmt(sql, ptr - sql);
+
+            if (stmt && split_stmt_is_routable(stmt))
+            {
+                stmts = gwbuf_append(stmts, stmt);
+                (*n_stmts)++;
+            }
+            else
+            {
+                gwbuf_free(stmt);
+                ok = false;
+            }
+        }
+
+        sql = ptr + 1;
+    }
+
+    if (!ok || *n_stmts < 2)
+    {
+        gwbuf_free(stmts);
+        stmts = NULL;
+    }
+
+    return stmts;
+}
+
+/**
+ * Check whether a query should be split
+ *
+ * The replies to the statements are sent to the client as if they were
+ * the only reply so nothing else may be waiting for a reply.
+ *
+ * @param rses Router session
+ * @param querybuf The query
+ * @return True if the query can be split
+ */
+static bool split_is_possible(ROUTER_CLIENT_SES *rses, GWBUF *querybuf)
+{
+    MySQLProtocol *proto = (MySQLProtocol*)rses->client_dcb->protocol;
+    uint8_t *data = GWBUF_DATA(querybuf);
+
+    if (!rses->rses_config.split_multi_statements || rses->rses_load_active ||
+        rses->rses_large_bref || querybuf->hint || MYSQL_GET_COMMAND(data) != MYSQL_COM_QUERY ||
+        MYSQL_GET_PAYLOAD_LEN(data) == GW_MYSQL_MAX_PACKET_LEN ||
+        gwbuf_length(querybuf) != MYSQL_GET_PAYLOAD_LEN(data) + MYSQL_HEADER_LEN ||
+        (proto->client_capabilities & GW_MYSQL_CAPABILITIES_MULTI_STATEMENTS) == 0 ||
+        rses->forced_node || session_trx_is_active(rses->client_dcb->session))
+    {
+        return false;
+    }
+
+    for (int i = 0; i < rses->rses_nbackends; i++)
+    {
+        backend_ref_t *bref = &rses->rses_backend_ref[i];
+
+        if (BREF_IS_IN_USE(bref) && (BREF_IS_WAITING_RESULT(bref) || BREF_IS_DISCARDING(bref)))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Route a query or a statement of a split query
+ *
+ * @param inst Router instance
+ * @param rses Router session
+ * @param querybuf The query, freed by this function
+ * @return True if the query was routed
+ */
+static bool split_route(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses, GWBUF *querybuf)
+{
+    bool rval = false;
+
+    if (!rwsplit_reattach_backends(rses) &&
+        rses->rses_config.master_failure_mode == RW_FAIL_INSTANTLY)
+    {
+        MXS_ERROR("Failed to reconnect to the master of the session.");
+    }
+    else
+    {
+        rval = route_single_stmt(inst, rses, querybuf);
+    }
+
+    gwbuf_free(querybuf);
+    return rval;
+}
+
+/**
+ * Route the next statement of a split query
+ *
+ * @param inst Router instance
+ * @param rses Router session
+ * @return True if the statement was routed
+ */
+static bool split_route_next(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses)
+{
+    GWBUF *stmt = split_list_pop(&rses->rses_split_stmts);
+
+    if (!modutil_reply_queue_push(&rses->rses_split_replies, MYSQL_COM_QUERY))
+    {
+        gwbuf_free(stmt);
+        return false;
+    }
+
+    return split_route(inst, rses, stmt);
+}
+
+/**
+ * Stop executing a split query
+ *
+ * @param rses Router session
+ */
+static void split_end(ROUTER_CLIENT_SES *rses)
+{
+    gwbuf_free(rses->rses_split_stmts);
+    gwbuf_free(rses->rses_split_residue);
+    modutil_reply_queue_free(&rses->rses_split_replies);
+    rses->rses_split_stmts = NULL;
+    rses->rses_split_residue = NULL;
+    rses->rses_split_active = false;
+}
+
+/**
+ * Set the more results flag of the last packet of a reply
+ *
+ * @param payload Payload of an OK or an EOF packet
+ * @param len Length of the payload
+ */
+static void split_set_more_results(uint8_t *payload, uint32_t len)
+{
+    uint8_t *status = NULL;
+
+    if (len == 0)
+    {
+        return;
+    }
+    else if (payload[0] == MYSQL_REPLY_EOF && len < MYSQL_EOF_PACKET_LEN)
+    {
+        status = payload + 3;
+    }
+    else if (payload[0] == MYSQL_REPLY_OK || payload[0] == MYSQL_REPLY_EOF)
+    {
+        status = payload + 1;
+
+        /** Skip the affected rows and the last insert ID */
+        for (int i = 0; i < 2 && status < payload + len; i++)
+        {
+            status += *status < 0xfb ? 1 : *status == 0xfc ? 3 : *status == 0xfd ? 4 : 9;
+        }
+    }
+
+    if (status && status + 2 <= payload + len)
+    {
+        gw_mysql_set_byte2(status, gw_mysql_get_byte2(status) | SPLIT_MORE_RESULTS);
+    }
+}
+
+bool rwsplit_split_handle_query(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
+                                GWBUF *querybuf, bool *succp)
+{
+    if (rses->rses_split_active)
+    {
+        /** Routed when the split query is complete */
+        rses->rses_split_queued = gwbuf_append(rses->rses_split_queued, querybuf);
+        *succp = true;
+        return true;
+    }
+
+    int n_stmts;
+    GWBUF *stmts;
+
+    if (!split_is_possible(rses, querybuf) || (stmts = split_query(querybuf, &n_stmts)) == NULL)
+    {
+        return false;
+    }
+
+    MXS_INFO("Splitting a query of %d statements.", n_stmts);
+    atomic_add_uint64(&inst->stats.n_split, 1);
+    gwbuf_free(querybuf);
+
+    rses->rses_split_stmts = stmts;
+    rses->rses_split_seq = 1;
+    rses->rses_split_next = false;
+    rses->rses_split_active = true;
+
+    if (!(*succp = split_route_next(inst, rses)))
+    {
+        split_end(rses);
+    }
+
+    return true;
+}
+
+GWBUF* rwsplit_split_process_reply(ROUTER_CLIENT_SES *rses, GWBUF *reply)
+{
+    if (!rses->rses_split_active)
+    {
+        return reply;
+    }
+
+    if (rses->rses_split_residue)
+    {
+        reply = gwbuf_append(rses->rses_split_residue, reply);
+        rses->rses_split_residue = NULL;
+    }
+
+    if ((reply = gwbuf_make_contiguous(reply)) == NULL)
+    {
+        return NULL;
+    }
+
+    uint8_t *data = GWBUF_DATA(reply);
+    size_t len = GWBUF_LENGTH(reply);
+    size_t pos = 0;
+    size_t last = 0;
+
+    /** The replies are renumbered as one */
+    while (pos + MYSQL_HEADER_LEN <= len &&
+           pos + MYSQL_GET_PAYLOAD_LEN(data + pos) + MYSQL_HEADER_LEN <= len)
+    {
+        data[pos + 3] = rses->rses_split_seq++;
+        last = pos;
+        pos += MYSQL_GET_PAYLOAD_LEN(data + pos) + MYSQL_HEADER_LEN;
+    }
+
+    if (pos < len)
+    {
+        GWBUF *complete = pos > 0 ? gwbuf_split(&reply, pos) : NULL;
+        rses->rses_split_residue = reply;
+        reply = complete;
+    }
+
+    if (reply && modutil_reply_queue_process(&rses->rses_split_replies, reply) > 0)
+    {
+        /** Only one statement is executed at a time so the last packet ends its reply */
+        uint8_t *payload = data + last + MYSQL_HEADER_LEN;
+        rses->rses_split_next = true;
+
+        if (payload[0] == MYSQL_REPLY_ERR)
+        {
+            gwbuf_free(rses->rses_split_stmts);
+            rses->rses_split_stmts = NULL;
+        }
+        else if (rses->rses_split_stmts)
+        {
+            split_set_more_results(payload, MYSQL_GET_PAYLOAD_LEN(data + last));
+        }
+    }
+
+    return reply;
+}
+
+void rwsplit_split_continue(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses)
+{
+    if (!rses->rses_split_next || rses->rses_closed)
+    {
+        return;
+    }
+
+    bool ok = true;
+    rses->rses_split_next = false;
+
+    if (rses->rses_split_stmts)
+    {
+        ok = split_route_next(inst, rses);
+    }
+    else
+    {
+        split_end(rses);
+
+        while (ok && !rses->rses_split_active && rses->rses_split_queued)
+        {
+            GWBUF *querybuf = split_list_pop(&rses->rses_split_queued);
+
+            if (!rwsplit_split_handle_query(inst, rses, querybuf, &ok))
+            {
+                ok = split_route(inst, rses, querybuf);
+            }
+        }
+    }
+
+    if (!ok)
+    {
+        MXS_ERROR("Failed to route the next statement of a split query, closing the session.");
+        poll_fake_hangup_event(rses->client_dcb);
+    }
+}
+
+void rwsplit_split_free(ROUTER_CLIENT_SES *rses)
+{
+    split_end(rses);
+    gwbuf_free(rses->rses_split_queued);
+    rses->rses_split_queued = NULL;
+}
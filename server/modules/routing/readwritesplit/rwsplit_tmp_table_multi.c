@@ -374,7 +374,13 @@ determine_query_type(GWBUF *querybuf, int packet_type, bool non_empty_packet)
 {
     qc_query_type_t qtype = QUERY_TYPE_UNKNOWN;
 
-    if (non_empty_packet)
+    if (packet_type == MXS_COM_STMT_BULK_EXECUTE)
+    {
+        /** Array binding is only used for writes and it may not be in the
+         * enum_server_command of the connector */
+        qtype = QUERY_TYPE_WRITE;
+    }
+    else if (non_empty_packet)
     {
         mysql_server_cmd_t my_packet_type = (mysql_server_cmd_t)packet_type;
         switch (my_packet_type)
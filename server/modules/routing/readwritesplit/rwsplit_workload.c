@@ -0,0 +1,360 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include "readwritesplit.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/modutil.h>
+#include <maxscale/protocol/mysql.h>
+#include "rwsplit_internal.h"
+
+/**
+ * @file rwsplit_workload.c   Reads that are routed by their historical cost.
+ *
+ * The backend time, rows and bytes of the replies to slave reads are recorded
+ * by the canonical digest of the statement. A read whose digest has an average
+ * backend time above analytic_threshold is routed to a slave whose server
+ * parameter workload_class matches analytic_class. The other reads avoid those
+ * slaves. If no slave of the preferred kind is connected, any slave is used.
+ *
+ * The profiles are kept in a fixed size table shared by all sessions of the
+ * service. A digest is stored in one of a few slots of its stripe and replaces
+ * the least executed digest when they are all taken.
+ */
+
+/** Reads of a digest that are recorded before it is classified */
+#define COST_MIN_SAMPLES 3
+/** The totals are halved when a digest has this many executions */
+#define COST_MAX_COUNT   1024
+/** Number of slots a digest can be stored in */
+#define COST_PROBES      8
+/** Number of the most expensive digests shown in the diagnostics */
+#define COST_TOP         5
+
+#define COST_STRIPE_SLOTS (RWSPLIT_COST_SLOTS / RWSPLIT_COST_STRIPES)
+
+bool rwsplit_workload_init(ROUTER_INSTANCE *inst)
+{
+    if (inst->rwsplit_config.analytic_threshold > 0)
+    {
+        if ((inst->cost_profiles = MXS_CALLOC(RWSPLIT_COST_SLOTS, sizeof(rwsplit_cost_t))) == NULL)
+        {
+            return false;
+        }
+
+        for (int i = 0; i < RWSPLIT_COST_STRIPES; i++)
+        {
+            spinlock_init(&inst->cost_locks[i]);
+        }
+    }
+
+    return true;
+}
+
+void rwsplit_workload_free(ROUTER_INSTANCE *inst)
+{
+    MXS_FREE(inst->cost_profiles);
+    MXS_FREE(inst->rwsplit_config.analytic_class);
+}
+
+/**
+ * Find the profile of a digest
+ *
+ * The lock of the stripe of the digest must be held.
+ *
+ * @param inst   Router instance
+ * @param digest The digest
+ * @param add    Whether a slot is taken for the digest if it has none
+ * @return The profile or NULL if the digest has none and @c add is false
+ */
+static rwsplit_cost_t* cost_find(ROUTER_INSTANCE *inst, uint64_t digest, bool add)
+{
+    rwsplit_cost_t *stripe = &inst->cost_profiles[(digest % RWSPLIT_COST_STRIPES) * COST_STRIPE_SLOTS];
+    uint64_t start = digest / RWSPLIT_COST_STRIPES;
+    rwsplit_cost_t *victim = NULL;
+
+    for (int i = 0; i < COST_PROBES; i++)
+    {
+        rwsplit_cost_t *cost = &stripe[(start + i) % COST_STRIPE_SLOTS];
+
+        if (cost->digest == digest)
+        {
+            return cost;
+        }
+        else if (victim == NULL || cost->digest == 0 ||
+                 (victim->digest && cost->count < victim->count))
+        {
+            victim = cost;
+        }
+    }
+
+    if (add)
+    {
+        memset(victim, 0, sizeof(*victim));
+        victim->digest = digest;
+        return victim;
+    }
+
+    return NULL;
+}
+
+/**
+ * Get the lock of the stripe of a digest
+ *
+ * @param inst   Router instance
+ * @param digest The digest
+ * @return The lock
+ */
+static SPINLOCK* cost_lock(ROUTER_INSTANCE *inst, uint64_t digest)
+{
+    return &inst->cost_locks[digest % RWSPLIT_COST_STRIPES];
+}
+
+/**
+ * Estimate the 95th percentile of the backend time of a digest
+ *
+ * @param cost The profile
+ * @return The upper limit of the histogram bucket of the percentile in milliseconds
+ */
+static uint64_t cost_p95_ms(const rwsplit_cost_t *cost)
+{
+    uint64_t total = 0;
+
+    for (int i = 0; i < RWSPLIT_COST_BUCKETS; i++)
+    {
+        total += cost->hist[i];
+    }
+
+    uint64_t seen = 0;
+
+    for (int i = 0; i < RWSPLIT_COST_BUCKETS; i++)
+    {
+        seen += cost->hist[i];
+
+        if (seen * 100 >= total * 95)
+        {
+            return 1ULL << i;
+        }
+    }
+
+    return 1ULL << (RWSPLIT_COST_BUCKETS - 1);
+}
+
+void rwsplit_workload_classify(ROUTER_CLIENT_SES *rses, GWBUF *querybuf, int packet_type)
+{
+    ROUTER_INSTANCE *inst = rses->router;
+    uint64_t digest;
+
+    if (inst->cost_profiles == NULL || packet_type != MYSQL_COM_QUERY ||
+        !modutil_get_canonical_digest(querybuf, &digest) || digest == 0)
+    {
+        return;
+    }
+
+    bool analytic = false;
+    SPINLOCK *lock = cost_lock(inst, digest);
+
+    spinlock_acquire(lock);
+    rwsplit_cost_t *cost = cost_find(inst, digest, false);
+
+    if (cost && cost->count >= COST_MIN_SAMPLES)
+    {
+        analytic = cost->time_us / cost->count >=
+                   (uint64_t)rses->rses_config.analytic_threshold * 1000;
+    }
+
+    spinlock_release(lock);
+
+    rses->rses_cost_digest = digest;
+    rses->rses_workload = analytic ? RWSPLIT_WORKLOAD_ANALYTIC : RWSPLIT_WORKLOAD_OLTP;
+
+    if (analytic)
+    {
+        MXS_INFO("Read with digest %016" PRIx64 " is analytic.", digest);
+    }
+}
+
+void rwsplit_workload_clear(ROUTER_CLIENT_SES *rses)
+{
+    rses->rses_cost_digest = 0;
+    rses->rses_workload = RWSPLIT_WORKLOAD_ANY;
+}
+
+/**
+ * Check whether a server executes the analytic reads
+ *
+ * @param rses   Router session
+ * @param server The server
+ * @return True if the workload_class parameter of the server is analytic_class
+ */
+static bool server_is_analytic(ROUTER_CLIENT_SES *rses, SERVER *server)
+{
+    const char *value = server_get_parameter(server, "workload_class");
+    return value && strcasecmp(value, rses->rses_config.analytic_class) == 0;
+}
+
+bool rwsplit_workload_accepts(ROUTER_CLIENT_SES *rses, backend_ref_t *bref)
+{
+    switch (rses->rses_workload)
+    {
+    case RWSPLIT_WORKLOAD_OLTP:
+        return !server_is_analytic(rses, bref->ref->server);
+
+    case RWSPLIT_WORKLOAD_ANALYTIC:
+        return server_is_analytic(rses, bref->ref->server);
+
+    default:
+        return true;
+    }
+}
+
+void rwsplit_workload_start(ROUTER_CLIENT_SES *rses, backend_ref_t *bref)
+{
+    if (BREF_IS_QUERY_ACTIVE(bref))
+    {
+        /** The backend time of a pipelined read can't be told apart */
+        bref->bref_cost_digest = 0;
+    }
+    else
+    {
+        bref->bref_cost_digest = rses->rses_cost_digest;
+        bref->bref_cost_rows = bref->bref_replies.rows;
+        bref->bref_cost_bytes = 0;
+    }
+}
+
+void rwsplit_workload_reply(backend_ref_t *bref, GWBUF *reply)
+{
+    if (bref->bref_cost_digest && reply)
+    {
+        bref->bref_cost_bytes += gwbuf_length(reply);
+    }
+}
+
+void rwsplit_workload_record(ROUTER_INSTANCE *inst, backend_ref_t *bref, int64_t usecs)
+{
+    uint64_t digest = bref->bref_cost_digest;
+
+    if (digest == 0 || inst->cost_profiles == NULL)
+    {
+        return;
+    }
+
+    bref->bref_cost_digest = 0;
+
+    uint64_t rows = bref->bref_replies.rows >= bref->bref_cost_rows ?
+                    bref->bref_replies.rows - bref->bref_cost_rows : 0;
+    uint64_t ms = usecs > 0 ? usecs / 1000 : 0;
+    int bucket = 0;
+
+    while (bucket < RWSPLIT_COST_BUCKETS - 1 && ms >= (1ULL << bucket))
+    {
+        bucket++;
+    }
+
+    SPINLOCK *lock = cost_lock(inst, digest);
+    spinlock_acquire(lock);
+    rwsplit_cost_t *cost = cost_find(inst, digest, true);
+
+    if (cost->count >= COST_MAX_COUNT)
+    {
+        cost->count /= 2;
+        cost->time_us /= 2;
+        cost->rows /= 2;
+        cost->bytes /= 2;
+
+        for (int i = 0; i < RWSPLIT_COST_BUCKETS; i++)
+        {
+            cost->hist[i] /= 2;
+        }
+    }
+
+    cost->count++;
+    cost->time_us += usecs > 0 ? usecs : 0;
+    cost->rows += rows;
+    cost->bytes += bref->bref_cost_bytes;
+    cost->hist[bucket]++;
+    spinlock_release(lock);
+}
+
+void rwsplit_workload_diagnostic(ROUTER_INSTANCE *inst, DCB *dcb)
+{
+    if (inst->cost_profiles == NULL)
+    {
+        return;
+    }
+
+    rwsplit_cost_t top[COST_TOP];
+    int n_top = 0;
+    int n_digests = 0;
+
+    for (int s = 0; s < RWSPLIT_COST_STRIPES; s++)
+    {
+        spinlock_acquire(&inst->cost_locks[s]);
+
+        for (int i = s * COST_STRIPE_SLOTS; i < (s + 1) * COST_STRIPE_SLOTS; i++)
+        {
+            rwsplit_cost_t *cost = &inst->cost_profiles[i];
+
+            if (cost->digest == 0 || cost->count == 0)
+            {
+                continue;
+            }
+
+            n_digests++;
+
+            /** Keep the most expensive digests sorted by their average time */
+            int pos = n_top;
+
+            while (pos > 0 && top[pos - 1].time_us / top[pos - 1].count < cost->time_us / cost->count)
+            {
+                pos--;
+            }
+
+            if (pos < COST_TOP)
+            {
+                int n_move = (n_top < COST_TOP ? n_top : COST_TOP - 1) - pos;
+                memmove(&top[pos + 1], &top[pos], n_move * sizeof(top[0]));
+                top[pos] = *cost;
+                n_top = n_top < COST_TOP ? n_top + 1 : COST_TOP;
+            }
+        }
+
+        spinlock_release(&inst->cost_locks[s]);
+    }
+
+    dcb_printf(dcb, "\tNumber of reads routed as analytic:	%" PRIu64 "\n",
+               inst->stats.n_analytic);
+    dcb_printf(dcb, "\tNumber of profiled statement digests:	%d\n", n_digests);
+
+    if (n_top > 0)
+    {
+        dcb_printf(dcb, "\t\tDigest            Count   Avg ms    P95 ms  Avg rows  Avg bytes\n");
+
+        for (int i = 0; i < n_top; i++)
+        {
+            rwsplit_cost_t *cost = &top[i];
+            dcb_printf(dcb, "\t\t%016" PRIx64 "  %-6" PRIu64 "  %-8.1f  %-6" PRIu64
+                       "  %-8" PRIu64 "  %" PRIu64 "\n",
+                       cost->digest, cost->count, (double)cost->time_us / cost->count / 1000,
+                       cost_p95_ms(cost), cost->rows / cost->count, cost->bytes / cost->count);
+        }
+    }
+}
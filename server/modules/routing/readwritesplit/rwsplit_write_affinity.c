@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include "readwritesplit.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/protocol/mysql.h>
+#include "rwsplit_internal.h"
+
+/**
+ * @file rwsplit_write_affinity.c   Writes that are spread over the nodes
+ * of a Galera cluster by the table they modify.
+ *
+ * Each autocommit write is sent to the joined node that has the highest
+ * rendezvous hash for the first table of the statement. All writes to a
+ * table go to the same node, which avoids certification conflicts between
+ * nodes, while different tables are written on different nodes. When a node
+ * leaves the cluster only the tables that were mapped to it move to other
+ * nodes. Reads that must see the writes of the session, e.g. LAST_INSERT_ID(),
+ * are sent to the node that executed the latest write.
+ */
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME  1099511628211ULL
+
+/**
+ * Add a string to a case-insensitive FNV-1a hash
+ *
+ * @param hash The hash so far
+ * @param str  The string
+ * @return The new hash
+ */
+static uint64_t affinity_hash_str(uint64_t hash, const char *str)
+{
+    for (const char *p = str; *p; p++)
+    {
+        hash ^= (unsigned char)tolower(*p);
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+/**
+ * Mix the bits of a hash so that similar inputs get unrelated scores
+ *
+ * @param x The hash
+ * @return The mixed hash
+ */
+static uint64_t affinity_mix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/**
+ * Hash the qualified name of the first table of a statement
+ *
+ * @param rses     Router session
+ * @param querybuf The statement
+ * @param hash     On return, the hash of the table name
+ * @return True if the statement refers to a table
+ */
+static bool affinity_table_hash(ROUTER_CLIENT_SES *rses, GWBUF *querybuf, uint64_t *hash)
+{
+    int n_tables = 0;
+    char **tables = qc_get_table_names(querybuf, &n_tables, true);
+    bool rval = false;
+
+    if (tables)
+    {
+        if (n_tables > 0)
+        {
+            uint64_t h = FNV_OFFSET;
+
+            if (strchr(tables[0], '.') == NULL)
+            {
+                MYSQL_session *data = (MYSQL_session*)rses->client_dcb->data;
+                h = affinity_hash_str(h, data->db);
+                h = affinity_hash_str(h, ".");
+            }
+
+            *hash = affinity_hash_str(h, tables[0]);
+            rval = true;
+        }
+
+        for (int i = 0; i < n_tables; i++)
+        {
+            MXS_FREE(tables[i]);
+        }
+
+        MXS_FREE(tables);
+    }
+
+    return rval;
+}
+
+/**
+ * Find the backend of the session that is connected to a server
+ *
+ * @param rses   Router session
+ * @param server The server
+ * @return The backend or NULL if the session does not use the server
+ */
+static backend_ref_t* affinity_find_bref(ROUTER_CLIENT_SES *rses, SERVER *server)
+{
+    for (int i = 0; i < rses->rses_nbackends; i++)
+    {
+        backend_ref_t *bref = &rses->rses_backend_ref[i];
+
+        if (bref->ref->server == server)
+        {
+            return bref;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Check whether a backend can execute a write
+ *
+ * @param bref The backend
+ * @return True if the backend is in use and its server is a joined node
+ */
+static bool affinity_bref_is_usable(backend_ref_t *bref)
+{
+    return bref && BREF_IS_IN_USE(bref) && !BREF_IS_DISCARDING(bref) &&
+           SERVER_IS_JOINED(bref->ref->server);
+}
+
+/**
+ * Choose the node of a table
+ *
+ * The nodes are ranked by the hash of the table and the node name, so the
+ * choice only depends on the set of joined nodes of the service and is the
+ * same in all sessions.
+ *
+ * @param rses Router session
+ * @param hash Hash of the table name
+ * @return The server or NULL if the service has no joined nodes
+ */
+static SERVER* affinity_choose_node(ROUTER_CLIENT_SES *rses, uint64_t hash)
+{
+    SERVER *best = NULL;
+    uint64_t best_score = 0;
+
+    for (SERVER_REF *ref = rses->router->service->dbref; ref; ref = ref->next)
+    {
+        if (ref->active && SERVER_IS_JOINED(ref->server))
+        {
+            uint64_t score = affinity_mix(affinity_hash_str(hash, ref->server->unique_name));
+
+            if (best == NULL || score > best_score)
+            {
+                best = ref->server;
+                best_score = score;
+            }
+        }
+    }
+
+    return best;
+}
+
+backend_ref_t* rwsplit_write_affinity_target(ROUTER_CLIENT_SES *rses, GWBUF *querybuf,
+                                             int packet_type, qc_query_type_t qtype)
+{
+    if (!rses->rses_config.galera_write_affinity || packet_type != MYSQL_COM_QUERY ||
+        session_trx_is_active(rses->client_dcb->session) || rses->forced_node ||
+        rses->have_tmp_tables || rses->rses_load_active)
+    {
+        /** Transactions, LOAD DATA LOCAL INFILE and sessions that are locked
+         * to the master stay on the master */
+        return NULL;
+    }
+
+    backend_ref_t *rval = NULL;
+    uint64_t hash;
+
+    if (qc_query_is_type(qtype, QUERY_TYPE_WRITE))
+    {
+        SERVER *node;
+
+        if (affinity_table_hash(rses, querybuf, &hash) &&
+            (node = affinity_choose_node(rses, hash)))
+        {
+            rval = affinity_find_bref(rses, node);
+
+            if (!affinity_bref_is_usable(rval))
+            {
+                /** The session is not connected to the node */
+                rval = NULL;
+            }
+        }
+
+        rses->rses_affinity_bref = rval;
+
+        if (rval && rval != rses->rses_master_ref)
+        {
+            atomic_add_uint64(&rses->router->stats.n_affinity_writes, 1);
+        }
+    }
+    else if (qc_query_is_type(qtype, QUERY_TYPE_MASTER_READ) &&
+             affinity_bref_is_usable(rses->rses_affinity_bref))
+    {
+        rval = rses->rses_affinity_bref;
+    }
+
+    if (rval)
+    {
+        MXS_INFO("Routing statement to [%s]:%d by table affinity.",
+                 rval->ref->server->name, rval->ref->server->port);
+    }
+
+    return rval;
+}
@@ -0,0 +1,1416 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include "schemarouter.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/modutil.h>
+#include <maxscale/mysql_utils.h>
+#include <maxscale/poll.h>
+
+/**
+ * @file scatter_gather.c   Reads that are executed on all the shards of a table
+ *
+ * With scatter_gather, a read that only uses tables found on several servers
+ * is sent to all of these servers at the same time. The column definitions of
+ * the first shard that replies are sent to the client and the rows of all shards
+ * are sent as they arrive. If the query has an ORDER BY, the sorted rows of the
+ * shards are merged and if it only selects COUNT and SUM aggregates, the values
+ * of the shards are added together. A LIMIT is applied to the merged rows.
+ *
+ * Queries whose results can't be merged this way, for example ones with GROUP BY,
+ * DISTINCT or subqueries, are routed like any other query.
+ */
+
+/** Maximum number of ORDER BY columns */
+#define SG_MAX_KEYS 8
+
+/** Maximum length of a value that is compared or added as a number */
+#define SG_VALUE_MAXLEN 64
+
+/** Where a shard is in its reply */
+typedef enum
+{
+    SG_COLCOUNT, /*< Waiting for the column count, an OK or an ERR */
+    SG_COLDEFS, /*< Reading the column definitions */
+    SG_COLEOF, /*< Waiting for the EOF of the column definitions */
+    SG_ROWS, /*< Reading rows */
+    SG_DONE /*< The reply is complete */
+} sg_phase_t;
+
+/** One of the servers the read is executed on */
+typedef struct scatter_shard
+{
+    backend_ref_t *bref; /*< The backend */
+    sg_phase_t     phase; /*< What is expected next */
+    uint64_t       columns_left; /*< Column definitions left to read */
+    bool           failed; /*< The reply is not used */
+    GWBUF         *residue; /*< Incomplete packet */
+    GWBUF         *rows; /*< Rows that wait to be merged, one packet per buffer */
+} scatter_shard_t;
+
+/** An ORDER BY column */
+typedef struct scatter_key
+{
+    char name[MYSQL_DATABASE_MAXLEN + 1]; /*< Column name or alias */
+    int  position; /*< Position of the column if given as a number, otherwise 0 */
+    int  column; /*< Index of the column in the result, -1 if not found */
+    bool desc; /*< Descending order */
+    bool numeric; /*< Compared as numbers */
+} scatter_key_t;
+
+/** The sum of one column of COUNT and SUM aggregates */
+typedef struct scatter_sum
+{
+    bool        is_null; /*< No values have been added */
+    bool        is_int; /*< All values have been integers */
+    int64_t     ival; /*< Sum of integers */
+    long double dval; /*< Sum of all values */
+    int         scale; /*< Largest number of decimals */
+} scatter_sum_t;
+
+struct scatter_gather
+{
+    scatter_shard_t *shards; /*< The shards the read was sent to */
+    int              nshards; /*< Number of shards */
+    int              ndone; /*< Shards that have replied */
+    scatter_shard_t *lead; /*< Shard whose column definitions are sent */
+    uint64_t         ncolumns; /*< Number of columns in the result */
+    bool             header_sent; /*< Column definitions have been sent */
+    uint8_t          seq; /*< Sequence number of the next packet to the client */
+    scatter_key_t    keys[SG_MAX_KEYS]; /*< ORDER BY columns */
+    int              nkeys; /*< Number of ORDER BY columns */
+    int64_t          limit; /*< Maximum number of rows, -1 for no limit */
+    int64_t          rows_sent; /*< Rows sent to the client */
+    bool             aggregate; /*< Only COUNT and SUM are selected */
+    scatter_sum_t   *sums; /*< Sums of the columns */
+    GWBUF           *error; /*< The first error */
+    GWBUF           *ok; /*< The first OK */
+    GWBUF           *eof; /*< The last EOF of the rows */
+    GWBUF           *queue; /*< Queries from the client that wait for the read */
+};
+
+/** A token of an SQL statement */
+typedef struct sg_token
+{
+    const char *str; /*< Start of the token */
+    int         len; /*< Length of the token */
+    int         depth; /*< Parenthesis depth of the token */
+} sg_token_t;
+
+/** Functions whose values can't be merged from many shards */
+static const char *sg_aggregates[] =
+{
+    "avg", "bit_and", "bit_or", "bit_xor", "group_concat", "json_arrayagg",
+    "json_objectagg", "max", "min", "std", "stddev", "stddev_pop", "stddev_samp",
+    "var_pop", "var_samp", "variance", NULL
+};
+
+/** Keywords that make the rows of the shards unmergeable */
+static const char *sg_unsupported[] =
+{
+    "distinct", "distinctrow", "for", "group", "having", "into", "lock", "over",
+    "procedure", "select", "sql_calc_found_rows", "union", "window", NULL
+};
+
+static bool tok_is(const sg_token_t *tok, const char *word)
+{
+    return tok->len == (int)strlen(word) && strncasecmp(tok->str, word, tok->len) == 0;
+}
+
+static bool tok_is_word(const sg_token_t *tok)
+{
+    return isalnum(*tok->str) || *tok->str == '_' || *tok->str == '$' || *tok->str == '`';
+}
+
+static bool tok_in(const sg_token_t *tok, const char **words)
+{
+    for (int i = 0; words[i]; i++)
+    {
+        if (tok_is(tok, words[i]))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Split an SQL statement into tokens
+ *
+ * @param sql The statement
+ * @param tokens Array of at least strlen(sql) tokens
+ * @return Number of tokens
+ */
+static int sg_tokenize(const char *sql, sg_token_t *tokens)
+{
+    const char *ptr = sql;
+    int n = 0;
+    int depth = 0;
+
+    while (*ptr)
+    {
+        if (isspace(*ptr))
+        {
+            ptr++;
+            continue;
+        }
+        else if (*ptr == '#' || (ptr[0] == '-' && ptr[1] == '-' &&
+                                 (isspace(ptr[2]) || ptr[2] == '\0')))
+        {
+            while (*ptr && *ptr != '\n')
+            {
+                ptr++;
+            }
+            continue;
+        }
+        else if (ptr[0] == '/' && ptr[1] == '*')
+        {
+            const char *end = strstr(ptr + 2, "*/");
+            ptr = end ? end + 2 : ptr + strlen(ptr);
+            continue;
+        }
+
+        const char *start = ptr;
+        int tokdepth = depth;
+
+        if (*ptr == '\'' || *ptr == '"' || *ptr == '`')
+        {
+            char quote = *ptr++;
+
+            while (*ptr && *ptr != quote)
+            {
+                if (*ptr == '\\' && quote != '`' && ptr[1])
+                {
+                    ptr++;
+                }
+                ptr++;
+            }
+
+            if (*ptr)
+            {
+                ptr++;
+            }
+        }
+        else if (isalnum(*ptr) || *ptr == '_' || *ptr == '$' || *ptr == '@')
+        {
+            while (isalnum(*ptr) || *ptr == '_' || *ptr == '$' || *ptr == '@')
+            {
+                ptr++;
+            }
+        }
+        else
+        {
+            if (*ptr == '(')
+            {
+                depth++;
+            }
+            else if (*ptr == ')')
+            {
+                tokdepth = --depth;
+            }
+            ptr++;
+        }
+
+        tokens[n].str = start;
+        tokens[n].len = ptr - start;
+        tokens[n].depth = tokdepth;
+        n++;
+    }
+
+    return n;
+}
+
+/**
+ * Check one item of the select list
+ *
+ * @param tok First token of the item
+ * @param n Number of tokens in the item
+ * @return 1 for COUNT and SUM, 0 for other values and -1 if the values of
+ *         the shards can't be merged
+ */
+static int sg_parse_item(const sg_token_t *tok, int n)
+{
+    for (int i = 0; i + 1 < n; i++)
+    {
+        if (tok_is_word(&tok[i]) && tok_is(&tok[i + 1], "(") &&
+            (tok_in(&tok[i], sg_aggregates) || tok_is(&tok[i], "count") ||
+             tok_is(&tok[i], "sum")))
+        {
+            if (i > 0 || tok_in(&tok[i], sg_aggregates))
+            {
+                return -1;
+            }
+
+            /** COUNT(...) or SUM(...) with an optional alias */
+            int end = 2;
+
+            while (end < n && !(tok_is(&tok[end], ")") && tok[end].depth == tok[1].depth))
+            {
+                end++;
+            }
+
+            if (end == n || (n > 2 && tok_is(&tok[2], "distinct")))
+            {
+                return -1;
+            }
+
+            int rest = n - end - 1;
+            bool alias = rest == 0 || (rest == 1 && tok_is_word(&tok[end + 1])) ||
+                         (rest == 2 && tok_is(&tok[end + 1], "as") && tok_is_word(&tok[end + 2]));
+
+            return alias ? 1 : -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Copy a token into a buffer without quotes
+ *
+ * @param tok The token
+ * @param dest Destination buffer
+ * @param size Size of the buffer
+ */
+static void sg_copy_name(const sg_token_t *tok, char *dest, size_t size)
+{
+    const char *str = tok->str;
+    int len = tok->len;
+
+    if (*str == '`' && len >= 2)
+    {
+        str++;
+        len -= 2;
+    }
+
+    snprintf(dest, size, "%.*s", len, str);
+}
+
+/**
+ * Parse the ORDER BY columns
+ *
+ * @param sg The read
+ * @param tok Tokens of the query
+ * @param i First token after ORDER BY
+ * @param n Number of tokens
+ * @return Index of the first token after the ORDER BY or -1 if it is not supported
+ */
+static int sg_parse_order(scatter_gather_t *sg, const sg_token_t *tok, int i, int n)
+{
+    while (i < n)
+    {
+        /** Only column names, qualified or not, and column positions are supported */
+        int name = i;
+
+        if (!tok_is_word(&tok[i]) || sg->nkeys == SG_MAX_KEYS)
+        {
+            return -1;
+        }
+
+        while (i + 2 < n && tok_is(&tok[i + 1], ".") && tok_is_word(&tok[i + 2]))
+        {
+            i += 2;
+            name = i;
+        }
+
+        scatter_key_t *key = &sg->keys[sg->nkeys++];
+        sg_copy_name(&tok[name], key->name, sizeof(key->name));
+        key->position = isdigit(*key->name) ? atoi(key->name) : 0;
+        key->column = -1;
+        i++;
+
+        if (i < n && (tok_is(&tok[i], "asc") || tok_is(&tok[i], "desc")))
+        {
+            key->desc = tok_is(&tok[i], "desc");
+            i++;
+        }
+
+        if (i < n && tok_is(&tok[i], ","))
+        {
+            i++;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    /** Only a LIMIT can follow the columns */
+    return i == n || tok_is(&tok[i], ";") || tok_is(&tok[i], "limit") ? i : -1;
+}
+
+/**
+ * Parse the LIMIT clause
+ *
+ * @param sg The read
+ * @param tok Tokens of the query
+ * @param i First token after LIMIT
+ * @param n Number of tokens
+ * @return Index of the first token after the LIMIT or -1 if it has an offset
+ */
+static int sg_parse_limit(scatter_gather_t *sg, const sg_token_t *tok, int i, int n)
+{
+    int64_t values[2];
+    int nvalues = 0;
+    bool offset_last = false;
+
+    while (i < n && nvalues < 2 && isdigit(*tok[i].str))
+    {
+        values[nvalues++] = strtoll(tok[i].str, NULL, 10);
+        i++;
+
+        if (i < n && (tok_is(&tok[i], ",") || tok_is(&tok[i], "offset")))
+        {
+            offset_last = tok_is(&tok[i], "offset");
+            i++;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if (nvalues == 0)
+    {
+        return -1;
+    }
+
+    int64_t offset = nvalues == 1 ? 0 : offset_last ? values[1] : values[0];
+    sg->limit = nvalues == 1 || offset_last ? values[0] : values[1];
+
+    /** Each shard would skip its own rows */
+    return offset == 0 ? i : -1;
+}
+
+/**
+ * Check that the rows of the shards can be merged and find the ORDER BY,
+ * LIMIT and aggregates of the query
+ *
+ * @param sg The read
+ * @param sql The query
+ * @return True if the query can be scattered
+ */
+static bool sg_parse_query(scatter_gather_t *sg, const char *sql)
+{
+    sg_token_t *tok = MXS_MALLOC((strlen(sql) + 1) * sizeof(sg_token_t));
+
+    if (tok == NULL)
+    {
+        return false;
+    }
+
+    int n = sg_tokenize(sql, tok);
+    bool ok = n > 0 && tok_is(&tok[0], "select");
+    int from = -1;
+
+    for (int i = 1; ok && i < n; i++)
+    {
+        if (tok_in(&tok[i], sg_unsupported))
+        {
+            ok = false;
+        }
+        else if (from == -1 && tok[i].depth == 0 && tok_is(&tok[i], "from"))
+        {
+            from = i;
+        }
+    }
+
+    ok = ok && from > 1;
+
+    /** The select list */
+    int nitems = 0;
+    int naggr = 0;
+
+    for (int i = 1; ok && i < from; i++)
+    {
+        int end = i;
+
+        while (end < from && !(tok[end].depth == 0 && tok_is(&tok[end], ",")))
+        {
+            end++;
+        }
+
+        int rc = sg_parse_item(&tok[i], end - i);
+        ok = rc >= 0;
+        naggr += rc > 0;
+        nitems++;
+        i = end;
+    }
+
+    /** Aggregated and plain values can't be mixed without a GROUP BY */
+    ok = ok && (naggr == 0 || naggr == nitems);
+    sg->aggregate = naggr > 0;
+
+    for (int i = from + 1; ok && i < n; i++)
+    {
+        if (tok[i].depth != 0)
+        {
+            continue;
+        }
+        else if (tok_is(&tok[i], "order") && i + 1 < n && tok_is(&tok[i + 1], "by"))
+        {
+            i = sg_parse_order(sg, tok, i + 2, n) - 1;
+            ok = i >= 0;
+        }
+        else if (tok_is(&tok[i], "limit"))
+        {
+            i = sg_parse_limit(sg, tok, i + 1, n) - 1;
+            ok = i >= 0;
+        }
+    }
+
+    MXS_FREE(tok);
+
+    return ok;
+}
+
+/**
+ * Get a value of a row
+ *
+ * @param row Row packet
+ * @param column Index of the column
+ * @param value Pointer to the value
+ * @param len Length of the value
+ * @return False if the value is NULL
+ */
+static bool sg_get_value(GWBUF *row, int column, const uint8_t **value, size_t *len)
+{
+    uint8_t *ptr = GWBUF_DATA(row) + MYSQL_HEADER_LEN;
+    uint8_t *end = GWBUF_DATA(row) + GWBUF_LENGTH(row);
+
+    for (int i = 0; ptr < end; i++)
+    {
+        if (*ptr == 0xfb)
+        {
+            if (i == column)
+            {
+                return false;
+            }
+            ptr++;
+        }
+        else
+        {
+            uint64_t size = mxs_leint_value(ptr);
+            ptr += mxs_leint_bytes(ptr);
+
+            if (i == column)
+            {
+                *value = ptr;
+                *len = size;
+                return ptr + size <= end;
+            }
+
+            ptr += size;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Convert a value to a C string
+ *
+ * @param value The value
+ * @param len Length of the value
+ * @param dest Buffer of SG_VALUE_MAXLEN bytes
+ */
+static void sg_value_to_str(const uint8_t *value, size_t len, char *dest)
+{
+    len = MXS_MIN(len, SG_VALUE_MAXLEN - 1);
+    memcpy(dest, value, len);
+    dest[len] = '\0';
+}
+
+/**
+ * Compare two rows by the ORDER BY columns
+ *
+ * @param sg The read
+ * @param a First row
+ * @param b Second row
+ * @return Negative if @c a comes before @c b, positive if after and zero if equal
+ */
+static int sg_compare_rows(scatter_gather_t *sg, GWBUF *a, GWBUF *b)
+{
+    for (int i = 0; i < sg->nkeys; i++)
+    {
+        scatter_key_t *key = &sg->keys[i];
+        const uint8_t *va, *vb;
+        size_t la, lb;
+        bool a_null = !sg_get_value(a, key->column, &va, &la);
+        bool b_null = !sg_get_value(b, key->column, &vb, &lb);
+        int rc;
+
+        /** NULL is smaller than any value */
+        if (a_null || b_null)
+        {
+            rc = b_null && !a_null ? 1 : a_null && !b_null ? -1 : 0;
+        }
+        else if (key->numeric)
+        {
+            char sa[SG_VALUE_MAXLEN], sb[SG_VALUE_MAXLEN];
+            sg_value_to_str(va, la, sa);
+            sg_value_to_str(vb, lb, sb);
+            long double da = strtold(sa, NULL);
+            long double db = strtold(sb, NULL);
+            rc = da < db ? -1 : da > db ? 1 : 0;
+        }
+        else
+        {
+            rc = memcmp(va, vb, MXS_MIN(la, lb));
+
+            if (rc == 0)
+            {
+                rc = la < lb ? -1 : la > lb ? 1 : 0;
+            }
+        }
+
+        if (rc != 0)
+        {
+            return key->desc ? -rc : rc;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Add the values of a row to the sums
+ *
+ * @param sg The read
+ * @param row Row packet
+ */
+static void sg_add_row(scatter_gather_t *sg, GWBUF *row)
+{
+    for (uint64_t i = 0; i < sg->ncolumns; i++)
+    {
+        scatter_sum_t *sum = &sg->sums[i];
+        const uint8_t *value;
+        size_t len;
+
+        if (sg_get_value(row, i, &value, &len))
+        {
+            char str[SG_VALUE_MAXLEN];
+            char *end;
+            sg_value_to_str(value, len, str);
+
+            errno = 0;
+            long long ival = strtoll(str, &end, 10);
+
+            if (*end != '\0' || errno != 0)
+            {
+                char *dot = strchr(str, '.');
+                sum->is_int = false;
+                sum->scale = MXS_MAX(sum->scale, dot ? (int)strspn(dot + 1, "0123456789") : 0);
+            }
+
+            sum->ival += ival;
+            sum->dval += strtold(str, NULL);
+            sum->is_null = false;
+        }
+    }
+}
+
+/**
+ * Create the row of the sums
+ *
+ * @param sg The read
+ * @return The row packet or NULL if memory allocation failed
+ */
+static GWBUF* sg_create_sum_row(scatter_gather_t *sg)
+{
+    char (*values)[SG_VALUE_MAXLEN] = MXS_MALLOC(sg->ncolumns * SG_VALUE_MAXLEN);
+    GWBUF *rval = NULL;
+
+    if (values)
+    {
+        size_t payload = 0;
+
+        for (uint64_t i = 0; i < sg->ncolumns; i++)
+        {
+            scatter_sum_t *sum = &sg->sums[i];
+
+            if (sum->is_null)
+            {
+                payload++;
+            }
+            else
+            {
+                if (sum->is_int)
+                {
+                    snprintf(values[i], SG_VALUE_MAXLEN, "%lld", (long long)sum->ival);
+                }
+                else
+                {
+                    snprintf(values[i], SG_VALUE_MAXLEN, "%.*Lf", sum->scale, sum->dval);
+                }
+
+                payload += strlen(values[i]) + 1;
+            }
+        }
+
+        if ((rval = gwbuf_alloc(payload + MYSQL_HEADER_LEN)))
+        {
+            uint8_t *ptr = GWBUF_DATA(rval);
+            gw_mysql_set_byte3(ptr, payload);
+            ptr += MYSQL_HEADER_LEN;
+
+            for (uint64_t i = 0; i < sg->ncolumns; i++)
+            {
+                if (sg->sums[i].is_null)
+                {
+                    *ptr++ = 0xfb;
+                }
+                else
+                {
+                    size_t len = strlen(values[i]);
+                    *ptr++ = len;
+                    memcpy(ptr, values[i], len);
+                    ptr += len;
+                }
+            }
+        }
+
+        MXS_FREE(values);
+    }
+
+    return rval;
+}
+
+/**
+ * Check whether a column type is compared as a number
+ *
+ * @param type The column type
+ * @return True for numeric types
+ */
+static bool sg_type_is_numeric(uint8_t type)
+{
+    switch (type)
+    {
+    case 0x00: /*< DECIMAL */
+    case 0x01: /*< TINY */
+    case 0x02: /*< SHORT */
+    case 0x03: /*< LONG */
+    case 0x04: /*< FLOAT */
+    case 0x05: /*< DOUBLE */
+    case 0x08: /*< LONGLONG */
+    case 0x09: /*< INT24 */
+    case 0x0d: /*< YEAR */
+    case 0xf6: /*< NEWDECIMAL */
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+/**
+ * Find the ORDER BY columns in a column definition
+ *
+ * @param sg The read
+ * @param coldef Column definition packet
+ * @param column Index of the column
+ */
+static void sg_resolve_keys(scatter_gather_t *sg, GWBUF *coldef, int column)
+{
+    uint8_t *ptr = GWBUF_DATA(coldef) + MYSQL_HEADER_LEN;
+    uint8_t *end = GWBUF_DATA(coldef) + GWBUF_LENGTH(coldef);
+    char name[MYSQL_DATABASE_MAXLEN + 1] = "";
+    char org_name[MYSQL_DATABASE_MAXLEN + 1] = "";
+
+    /** Catalog, schema, table, original table, name and original name */
+    for (int i = 0; i < 6 && ptr < end; i++)
+    {
+        uint64_t len = mxs_leint_value(ptr);
+        ptr += mxs_leint_bytes(ptr);
+
+        if (i == 4 || i == 5)
+        {
+            snprintf(i == 4 ? name : org_name, sizeof(name), "%.*s",
+                     (int)MXS_MIN(len, (uint64_t)(end - ptr)), (char*)ptr);
+        }
+
+        ptr += len;
+    }
+
+    /** Length of the fixed fields, character set and column length */
+    ptr += 1 + 2 + 4;
+    bool numeric = ptr < end && sg_type_is_numeric(*ptr);
+
+    for (int i = 0; i < sg->nkeys; i++)
+    {
+        scatter_key_t *key = &sg->keys[i];
+
+        if (key->column == -1 &&
+            (key->position ? key->position == column + 1 :
+             strcasecmp(key->name, name) == 0 || strcasecmp(key->name, org_name) == 0))
+        {
+            key->column = column;
+            key->numeric = numeric;
+        }
+    }
+}
+
+/**
+ * Remove the first packet of a list of packets
+ *
+ * @param list List of packets, one packet per buffer
+ * @return The first packet
+ */
+static GWBUF* sg_pop(GWBUF **list)
+{
+    GWBUF *head = *list;
+    GWBUF *next = head->next;
+
+    if (next)
+    {
+        next->tail = head->tail;
+    }
+
+    head->next = NULL;
+    head->tail = head;
+    *list = next;
+
+    return head;
+}
+
+/**
+ * Add a packet to the reply to the client
+ *
+ * @param sg The read
+ * @param out The reply
+ * @param packet The packet
+ */
+static void sg_send(scatter_gather_t *sg, GWBUF **out, GWBUF *packet)
+{
+    GWBUF_DATA(packet)[3] = sg->seq++;
+    *out = gwbuf_append(*out, packet);
+}
+
+/**
+ * Send a row unless the LIMIT has been reached
+ *
+ * @param sg The read
+ * @param out The reply
+ * @param row The row
+ */
+static void sg_send_row(scatter_gather_t *sg, GWBUF **out, GWBUF *row)
+{
+    if (sg->limit < 0 || sg->rows_sent < sg->limit)
+    {
+        sg->rows_sent++;
+        sg_send(sg, out, row);
+    }
+    else
+    {
+        gwbuf_free(row);
+    }
+}
+
+/**
+ * Send the rows that can be sent
+ *
+ * Without an ORDER BY, all rows are sent. With it, rows are sent as long as
+ * all shards that are still replying have a row to compare.
+ *
+ * @param sg The read
+ * @param out The reply
+ */
+static void sg_send_rows(scatter_gather_t *sg, GWBUF **out)
+{
+    if (!sg->header_sent)
+    {
+        return;
+    }
+
+    if (sg->nkeys == 0)
+    {
+        for (int i = 0; i < sg->nshards; i++)
+        {
+            while (sg->shards[i].rows)
+            {
+                sg_send_row(sg, out, sg_pop(&sg->shards[i].rows));
+            }
+        }
+
+        return;
+    }
+
+    while (true)
+    {
+        scatter_shard_t *best = NULL;
+
+        for (int i = 0; i < sg->nshards; i++)
+        {
+            scatter_shard_t *shard = &sg->shards[i];
+
+            if (shard->rows == NULL)
+            {
+                if (shard->phase != SG_DONE)
+                {
+                    /** The next row of this shard may come first */
+                    return;
+                }
+            }
+            else if (best == NULL || sg_compare_rows(sg, shard->rows, best->rows) < 0)
+            {
+                best = shard;
+            }
+        }
+
+        if (best == NULL)
+        {
+            break;
+        }
+
+        sg_send_row(sg, out, sg_pop(&best->rows));
+    }
+}
+
+/**
+ * Called when the column definitions have been sent
+ *
+ * @param sg The read
+ */
+static void sg_header_done(scatter_gather_t *sg)
+{
+    sg->header_sent = true;
+
+    for (int i = 0; i < sg->nkeys; i++)
+    {
+        if (sg->keys[i].column == -1)
+        {
+            MXS_WARNING("ORDER BY column '%s' is not in the result, the rows of "
+                        "the shards are not merged in order.", sg->keys[i].name);
+            sg->nkeys = 0;
+            break;
+        }
+    }
+
+    if (sg->aggregate && (sg->sums = MXS_CALLOC(sg->ncolumns, sizeof(scatter_sum_t))))
+    {
+        for (uint64_t i = 0; i < sg->ncolumns; i++)
+        {
+            sg->sums[i].is_null = true;
+            sg->sums[i].is_int = true;
+        }
+    }
+    else
+    {
+        sg->aggregate = false;
+    }
+}
+
+/**
+ * Called when a shard has replied
+ *
+ * @param sg The read
+ * @param shard The shard
+ */
+static void sg_shard_done(scatter_gather_t *sg, scatter_shard_t *shard)
+{
+    shard->phase = SG_DONE;
+    sg->ndone++;
+    bref_clear_state(shard->bref, BREF_QUERY_ACTIVE);
+    bref_clear_state(shard->bref, BREF_WAITING_RESULT);
+}
+
+/**
+ * Store the error of a shard
+ *
+ * @param sg The read
+ * @param shard The shard
+ * @param error The error packet, the first error is sent to the client
+ */
+static void sg_shard_error(scatter_gather_t *sg, scatter_shard_t *shard, GWBUF *error)
+{
+    if (sg->error == NULL)
+    {
+        sg->error = error;
+    }
+    else
+    {
+        gwbuf_free(error);
+    }
+
+    shard->failed = true;
+    gwbuf_free(shard->rows);
+    shard->rows = NULL;
+}
+
+/**
+ * Process one packet of a shard
+ *
+ * @param sg The read
+ * @param shard The shard
+ * @param packet Contiguous packet
+ * @param out The reply to the client
+ */
+static void sg_process_packet(scatter_gather_t *sg, scatter_shard_t *shard,
+                              GWBUF *packet, GWBUF **out)
+{
+    uint8_t *data = GWBUF_DATA(packet);
+    uint8_t cmd = data[MYSQL_HEADER_LEN];
+    bool is_eof = cmd == MYSQL_REPLY_EOF && MYSQL_GET_PAYLOAD_LEN(data) < MYSQL_EOF_PACKET_LEN;
+
+    if (cmd == MYSQL_REPLY_ERR && shard->phase != SG_DONE)
+    {
+        sg_shard_error(sg, shard, packet);
+        sg_shard_done(sg, shard);
+        return;
+    }
+
+    switch (shard->phase)
+    {
+    case SG_COLCOUNT:
+        if (cmd == MYSQL_REPLY_OK)
+        {
+            if (sg->ok == NULL)
+            {
+                sg->ok = packet;
+                packet = NULL;
+            }
+            sg_shard_done(sg, shard);
+        }
+        else
+        {
+            shard->columns_left = mxs_leint_value(data + MYSQL_HEADER_LEN);
+            shard->phase = shard->columns_left ? SG_COLDEFS : SG_COLEOF;
+
+            if (sg->lead == NULL)
+            {
+                sg->lead = shard;
+                sg->ncolumns = shard->columns_left;
+                sg_send(sg, out, packet);
+                packet = NULL;
+            }
+            else if (shard->columns_left != sg->ncolumns)
+            {
+                sg_shard_error(sg, shard, modutil_create_mysql_err_msg(1, 0, 1222, "21000",
+                               "The shards returned different numbers of columns"));
+            }
+        }
+        break;
+
+    case SG_COLDEFS:
+        if (shard == sg->lead)
+        {
+            sg_resolve_keys(sg, packet, sg->ncolumns - shard->columns_left);
+            sg_send(sg, out, packet);
+            packet = NULL;
+        }
+
+        if (--shard->columns_left == 0)
+        {
+            shard->phase = SG_COLEOF;
+        }
+        break;
+
+    case SG_COLEOF:
+        if (shard == sg->lead)
+        {
+            sg_send(sg, out, packet);
+            packet = NULL;
+            sg_header_done(sg);
+        }
+        shard->phase = SG_ROWS;
+        break;
+
+    case SG_ROWS:
+        if (is_eof)
+        {
+            gwbuf_free(sg->eof);
+            sg->eof = packet;
+            packet = NULL;
+            sg_shard_done(sg, shard);
+        }
+        else if (shard->failed)
+        {
+            /** The rows are discarded */
+        }
+        else if (sg->aggregate)
+        {
+            sg_add_row(sg, packet);
+        }
+        else
+        {
+            shard->rows = gwbuf_append(shard->rows, packet);
+            packet = NULL;
+        }
+        break;
+
+    case SG_DONE:
+        MXS_ERROR("Unexpected packet from '%s' after its reply to a scattered read.",
+                  shard->bref->bref_backend->server->unique_name);
+        break;
+    }
+
+    gwbuf_free(packet);
+}
+
+/**
+ * Free a read
+ *
+ * @param sg The read
+ */
+static void sg_free(scatter_gather_t *sg)
+{
+    for (int i = 0; i < sg->nshards; i++)
+    {
+        gwbuf_free(sg->shards[i].residue);
+        gwbuf_free(sg->shards[i].rows);
+    }
+
+    while (sg->queue)
+    {
+        GWBUF *next = sg->queue->next;
+        gwbuf_free(sg->queue);
+        sg->queue = next;
+    }
+
+    gwbuf_free(sg->error);
+    gwbuf_free(sg->ok);
+    gwbuf_free(sg->eof);
+    MXS_FREE(sg->sums);
+    MXS_FREE(sg->shards);
+    MXS_FREE(sg);
+}
+
+/**
+ * Send the end of the reply once all shards have replied and route the
+ * queries that were received in the meantime
+ *
+ * @param rses Router session
+ * @param out The reply
+ */
+static void sg_complete(ROUTER_CLIENT_SES *rses, GWBUF **out)
+{
+    scatter_gather_t *sg = rses->scatter;
+
+    sg_send_rows(sg, out);
+
+    if (sg->error)
+    {
+        sg_send(sg, out, sg->error);
+        sg->error = NULL;
+    }
+    else if (sg->header_sent)
+    {
+        GWBUF *row;
+
+        if (sg->aggregate && (row = sg_create_sum_row(sg)))
+        {
+            sg_send_row(sg, out, row);
+        }
+
+        if (sg->eof == NULL)
+        {
+            uint8_t eof[] = {0x5, 0x0, 0x0, 0x0, MYSQL_REPLY_EOF, 0x0, 0x0, 0x2, 0x0};
+            sg->eof = gwbuf_alloc_and_load(sizeof(eof), eof);
+        }
+
+        if (sg->eof)
+        {
+            sg_send(sg, out, sg->eof);
+            sg->eof = NULL;
+        }
+    }
+    else if (sg->ok)
+    {
+        sg_send(sg, out, sg->ok);
+        sg->ok = NULL;
+    }
+
+    GWBUF *queue = sg->queue;
+    sg->queue = NULL;
+    rses->scatter = NULL;
+    sg_free(sg);
+
+    while (queue)
+    {
+        GWBUF *next = queue->next;
+        queue->next = NULL;
+        poll_add_epollin_event_to_dcb(rses->rses_client_dcb, queue);
+        queue = next;
+    }
+}
+
+/**
+ * Check whether a backend can execute a scattered read right away
+ *
+ * @param bref The backend
+ * @return True if nothing is being executed on the backend
+ */
+static bool sg_bref_is_idle(backend_ref_t *bref)
+{
+    return BREF_IS_IN_USE(bref) && !BREF_IS_QUERY_ACTIVE(bref) &&
+           !BREF_IS_WAITING_RESULT(bref) && bref->bref_pending_cmd == NULL &&
+           !bref->bref_sescmd_cur.scmd_cur_active && bref->bref_n_discard == 0;
+}
+
+/**
+ * Find the backends of the servers a read is sent to
+ *
+ * @param sg The read
+ * @param rses Router session
+ * @param servers Comma-separated list of servers, modified
+ * @return True if all servers can execute the read
+ */
+static bool sg_add_shards(scatter_gather_t *sg, ROUTER_CLIENT_SES *rses, char *servers)
+{
+    int n = 1;
+
+    for (char *ptr = servers; (ptr = strchr(ptr, ',')); ptr++)
+    {
+        n++;
+    }
+
+    if ((sg->shards = MXS_CALLOC(n, sizeof(scatter_shard_t))) == NULL)
+    {
+        return false;
+    }
+
+    char *saved;
+
+    for (char *name = strtok_r(servers, ",", &saved); name; name = strtok_r(NULL, ",", &saved))
+    {
+        DCB *dcb = NULL;
+        backend_ref_t *bref;
+
+        if (!get_shard_dcb(&dcb, rses, name) ||
+            (bref = get_bref_from_dcb(rses, dcb)) == NULL || !sg_bref_is_idle(bref))
+        {
+            MXS_INFO("Server '%s' can't execute the read right now, it is not scattered.", name);
+            return false;
+        }
+
+        sg->shards[sg->nshards++].bref = bref;
+    }
+
+    return sg->nshards > 1;
+}
+
+bool scatter_route_query(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
+                         GWBUF *querybuf, qc_query_type_t qtype)
+{
+    if (!rses->rses_config.scatter_gather || rses->rses_closed ||
+        MYSQL_GET_COMMAND(GWBUF_DATA(querybuf)) != MYSQL_COM_QUERY ||
+        !qc_query_is_type(qtype, QUERY_TYPE_READ) ||
+        (qtype & (QUERY_TYPE_WRITE | QUERY_TYPE_SESSION_WRITE |
+                  QUERY_TYPE_USERVAR_WRITE | QUERY_TYPE_GSYSVAR_WRITE)) ||
+        rses->rses_transaction_active || session_trx_is_active(rses->rses_client_dcb->session))
+    {
+        return false;
+    }
+
+    spinlock_acquire(&rses->shardmap->lock);
+    char *servers = shard_map_get_scatter_targets(rses, querybuf);
+    spinlock_release(&rses->shardmap->lock);
+
+    if (servers == NULL)
+    {
+        return false;
+    }
+
+    bool rval = false;
+    scatter_gather_t *sg = MXS_CALLOC(1, sizeof(scatter_gather_t));
+    char *sql = modutil_get_SQL(querybuf);
+
+    if (sg && sql)
+    {
+        sg->limit = -1;
+        sg->seq = 1;
+
+        if (!sg_parse_query(sg, sql))
+        {
+            MXS_INFO("The results of the shards can't be merged, the read is not scattered.");
+        }
+        else if (sg_add_shards(sg, rses, servers))
+        {
+            rval = true;
+        }
+    }
+
+    MXS_FREE(sql);
+    MXS_FREE(servers);
+
+    if (!rval)
+    {
+        if (sg)
+        {
+            sg_free(sg);
+        }
+        return false;
+    }
+
+    rses->scatter = sg;
+    atomic_add(&inst->stats.n_scatter, 1);
+
+    for (int i = 0; i < sg->nshards; i++)
+    {
+        scatter_shard_t *shard = &sg->shards[i];
+        backend_ref_t *bref = shard->bref;
+        GWBUF *buffer = shard_map_use_table_db(rses, bref, gwbuf_clone(querybuf));
+
+        if (bref->bref_dcb->func.write(bref->bref_dcb, buffer) == 1)
+        {
+            MXS_INFO("Scattered read sent to [%s]:%d",
+                     bref->bref_backend->server->name, bref->bref_backend->server->port);
+            atomic_add(&inst->stats.n_queries, 1);
+            bref_set_state(bref, BREF_QUERY_ACTIVE);
+            bref_set_state(bref, BREF_WAITING_RESULT);
+        }
+        else
+        {
+            MXS_ERROR("Routing the scattered read to '%s' failed.",
+                      bref->bref_backend->server->unique_name);
+            sg_shard_error(sg, shard, modutil_create_mysql_err_msg(1, 0, 2013, "HY000",
+                           "Lost connection to a shard during the query"));
+            shard->phase = SG_DONE;
+            sg->ndone++;
+        }
+    }
+
+    if (sg->ndone == sg->nshards)
+    {
+        GWBUF *out = NULL;
+        sg_complete(rses, &out);
+
+        if (out)
+        {
+            MXS_SESSION_ROUTE_REPLY(rses->rses_client_dcb->session, out);
+        }
+    }
+
+    return true;
+}
+
+bool scatter_queue_query(ROUTER_CLIENT_SES *rses, GWBUF *querybuf)
+{
+    scatter_gather_t *sg = rses->scatter;
+
+    if (sg == NULL)
+    {
+        return false;
+    }
+
+    querybuf = gwbuf_make_contiguous(querybuf);
+    GWBUF **ptr = &sg->queue;
+
+    while (*ptr)
+    {
+        ptr = &(*ptr)->next;
+    }
+
+    *ptr = querybuf;
+    return true;
+}
+
+bool scatter_process_reply(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *reply)
+{
+    scatter_gather_t *sg = rses->scatter;
+    scatter_shard_t *shard = NULL;
+
+    for (int i = 0; sg && i < sg->nshards && shard == NULL; i++)
+    {
+        if (sg->shards[i].bref == bref)
+        {
+            shard = &sg->shards[i];
+        }
+    }
+
+    if (shard == NULL)
+    {
+        return false;
+    }
+
+    GWBUF *out = NULL;
+    GWBUF *packet;
+    shard->residue = gwbuf_append(shard->residue, reply);
+
+    while ((packet = modutil_get_next_MySQL_packet(&shard->residue)))
+    {
+        sg_process_packet(sg, shard, gwbuf_make_contiguous(packet), &out);
+    }
+
+    if (sg->ndone == sg->nshards)
+    {
+        sg_complete(rses, &out);
+    }
+    else
+    {
+        sg_send_rows(sg, &out);
+    }
+
+    if (out)
+    {
+        MXS_SESSION_ROUTE_REPLY(rses->rses_client_dcb->session, out);
+    }
+
+    return true;
+}
+
+bool scatter_handle_error(ROUTER_CLIENT_SES *rses, backend_ref_t *bref)
+{
+    scatter_gather_t *sg = rses->scatter;
+
+    for (int i = 0; sg && i < sg->nshards; i++)
+    {
+        scatter_shard_t *shard = &sg->shards[i];
+
+        if (shard->bref == bref && shard->phase != SG_DONE)
+        {
+            sg_shard_error(sg, shard, modutil_create_mysql_err_msg(1, 0, 2013, "HY000",
+                           "Lost connection to a shard during the query"));
+            sg_shard_done(sg, shard);
+
+            GWBUF *out = NULL;
+
+            if (sg->ndone == sg->nshards)
+            {
+                sg_complete(rses, &out);
+            }
+            else
+            {
+                sg_send_rows(sg, &out);
+            }
+
+            if (out)
+            {
+                MXS_SESSION_ROUTE_REPLY(rses->rses_client_dcb->session, out);
+            }
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void scatter_free(ROUTER_CLIENT_SES *rses)
+{
+    if (rses->scatter)
+    {
+        sg_free(rses->scatter);
+        rses->scatter = NULL;
+    }
+}
@@ -74,7 +74,6 @@ static void handleError(MXS_ROUTER* instance,
                         DCB* backend_dcb,
                         mxs_error_action_t action,
                         bool* succp);
-static backend_ref_t* get_bref_from_dcb(ROUTER_CLIENT_SES* rses, DCB* dcb);
 
 static route_target_t get_shard_route_target(qc_query_type_t qtype,
                                              bool            trx_active,
@@ -86,10 +85,10 @@ static bool connect_backend_servers(backend_ref_t*   backend_ref,
                                     int              router_nservers,
                                     MXS_SESSION*     session,
                                     ROUTER_INSTANCE* router);
-
-static bool get_shard_dcb(DCB**              dcb,
-                          ROUTER_CLIENT_SES* rses,
-                          char*              name);
+static bool connect_backend(backend_ref_t* bref, MXS_SESSION* session, bool replay);
+static bool connect_shard(ROUTER_CLIENT_SES* rses, backend_ref_t* bref);
+static void replay_delayed_history(ROUTER_CLIENT_SES* rses);
+static bool connect_default_shard(ROUTER_CLIENT_SES* rses);
 
 static bool rses_begin_locked_router_action(ROUTER_CLIENT_SES* rses);
 static void rses_end_locked_router_action(ROUTER_CLIENT_SES* rses);
@@ -124,8 +123,6 @@ static bool route_session_write(ROUTER_CLIENT_SES* router_client_ses,
                                 ROUTER_INSTANCE*   inst,
                                 unsigned char      packet_type,
                                 qc_query_type_t    qtype);
-static void bref_clear_state(backend_ref_t* bref, bref_state_t state);
-static void bref_set_state(backend_ref_t*   bref, bref_state_t state);
 static sescmd_cursor_t* backend_ref_get_sescmd_cursor (backend_ref_t* bref);
 static int  router_handle_state_switch(DCB* dcb, DCB_REASON reason, void* data);
 static bool handle_error_new_connection(ROUTER_INSTANCE*   inst,
@@ -150,6 +147,7 @@ int inspect_backend_mapping_states(ROUTER_CLIENT_SES *router_cli_ses,
                                    backend_ref_t *bref,
                                    GWBUF** wbuf);
 bool handle_default_db(ROUTER_CLIENT_SES *router_cli_ses);
+bool have_servers(ROUTER_CLIENT_SES* rses);
 void route_queued_query(ROUTER_CLIENT_SES *router_cli_ses);
 void synchronize_shard_map(ROUTER_CLIENT_SES *client);
 
@@ -192,16 +190,25 @@ shard_map_t* shard_map_alloc()
 
     if (rval)
     {
-        if ((rval->hash = hashtable_alloc(SCHEMAROUTER_HASHSIZE, hashkeyfun, hashcmpfun)))
+        rval->hash = hashtable_alloc(SCHEMAROUTER_HASHSIZE, hashkeyfun, hashcmpfun);
+        rval->tables = hashtable_alloc(SCHEMAROUTER_HASHSIZE, hashkeyfun, hashcmpfun);
+        rval->scattered = hashtable_alloc(SCHEMAROUTER_HASHSIZE, hashkeyfun, hashcmpfun);
+
+        if (rval->hash && rval->tables && rval->scattered)
         {
             HASHCOPYFN kcopy = (HASHCOPYFN)strdup;
             hashtable_memory_fns(rval->hash, kcopy, kcopy, keyfreefun, keyfreefun);
+            hashtable_memory_fns(rval->tables, kcopy, kcopy, keyfreefun, keyfreefun);
+            hashtable_memory_fns(rval->scattered, kcopy, kcopy, keyfreefun, keyfreefun);
             spinlock_init(&rval->lock);
             rval->last_updated = 0;
             rval->state = SHMAP_UNINIT;
         }
         else
         {
+            hashtable_free(rval->hash);
+            hashtable_free(rval->tables);
+            hashtable_free(rval->scattered);
             MXS_FREE(rval);
             rval = NULL;
         }
@@ -338,36 +345,10 @@ showdb_response_t parse_showdb_response(ROUTER_CLIENT_SES* rses, backend_ref_t*
 
         if (data)
         {
-            if (hashtable_add(rses->shardmap->hash, data, target))
-            {
-                MXS_INFO("<%s, %s>", target, data);
-            }
-            else
+            if (!shard_map_add_database(rses->router, rses->shardmap, data, target,
+                                        rses->rses_client_dcb->user))
             {
-                if (!(hashtable_fetch(rses->router->ignored_dbs, data) ||
-                      (rses->router->ignore_regex &&
-                       pcre2_match(rses->router->ignore_regex, (PCRE2_SPTR)data,
-                                   PCRE2_ZERO_TERMINATED, 0, 0,
-                                   rses->router->ignore_match_data, NULL) >= 0)))
-                {
-                    duplicate_found = true;
-                    MXS_ERROR("Database '%s' found on servers '%s' and '%s' for user %s@%s.",
-                              data, target,
-                              (char*)hashtable_fetch(rses->shardmap->hash, data),
-                              rses->rses_client_dcb->user,
-                              rses->rses_client_dcb->remote);
-                }
-                else if (rses->router->preferred_server &&
-                         strcmp(target, rses->router->preferred_server->unique_name) == 0)
-                {
-                    /** In conflict situations, use the preferred server */
-                    MXS_INFO("Forcing location of '%s' from '%s' to ''%s",
-                             data, (char*)hashtable_fetch(rses->shardmap->hash,
-                                                          data), target);
-
-                    hashtable_delete(rses->shardmap->hash, data);
-                    hashtable_add(rses->shardmap->hash, data, target);
-                }
+                duplicate_found = true;
             }
             MXS_FREE(data);
         }
@@ -426,6 +407,21 @@ int gen_databaselist(ROUTER_INSTANCE* inst, ROUTER_CLIENT_SES* session)
 
     session->init |= INIT_MAPPING;
     session->init &= ~INIT_UNINT;
+
+    if (session->rses_config.lazy_connect)
+    {
+        /** All shards are needed for the mapping */
+        for (i = 0; i < session->rses_nbackends; i++)
+        {
+            backend_ref_t* bref = &session->rses_backend_ref[i];
+
+            if (!BREF_IS_IN_USE(bref) && SERVER_IS_RUNNING(bref->bref_backend->server))
+            {
+                connect_shard(session, bref);
+            }
+        }
+    }
+
     len = strlen(query) + 1;
     buffer = gwbuf_alloc(len + 4);
     *((unsigned char*)buffer->start) = len;
@@ -472,6 +468,12 @@ char* get_shard_target_name(ROUTER_INSTANCE* router,
     bool has_dbs = false; /**If the query targets any database other than the current one*/
     bool uses_implicit_databases = false;
 
+    /** Tables of databases that are on many servers are routed by name */
+    if ((rval = shard_map_get_table_target(client, buffer)))
+    {
+        return rval;
+    }
+
     dbnms = qc_get_table_names(buffer, &sz, true);
 
     for (i = 0; i < sz; i++)
@@ -672,6 +674,10 @@ MXS_MODULE* MXS_CREATE_MODULE()
             {"refresh_interval", MXS_MODULE_PARAM_COUNT, DEFAULT_REFRESH_INTERVAL},
             {"debug", MXS_MODULE_PARAM_BOOL, "false"},
             {"preferred_server", MXS_MODULE_PARAM_SERVER},
+            {"background_refresh", MXS_MODULE_PARAM_BOOL, "false"},
+            {"table_sharding", MXS_MODULE_PARAM_BOOL, "false"},
+            {"scatter_gather", MXS_MODULE_PARAM_BOOL, "false"},
+            {"lazy_connect", MXS_MODULE_PARAM_BOOL, "false"},
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -741,6 +747,10 @@ static MXS_ROUTER* createInstance(SERVICE *service, char **options)
     router->schemarouter_config.disable_sescmd_hist = config_get_bool(conf, "disable_sescmd_history");
     router->schemarouter_config.debug = config_get_bool(conf, "debug");
     router->preferred_server = config_get_server(conf, "preferred_server");
+    router->schemarouter_config.background_refresh = config_get_bool(conf, "background_refresh");
+    router->schemarouter_config.table_sharding = config_get_bool(conf, "table_sharding");
+    router->schemarouter_config.scatter_gather = config_get_bool(conf, "scatter_gather");
+    router->schemarouter_config.lazy_connect = config_get_bool(conf, "lazy_connect");
 
     if ((config_get_param(conf, "auth_all_servers")) == NULL)
     {
@@ -835,6 +845,22 @@ static MXS_ROUTER* createInstance(SERVICE *service, char **options)
         {
             router->schemarouter_config.debug = config_truth_value(value);
         }
+        else if (strcmp(options[i], "background_refresh") == 0)
+        {
+            router->schemarouter_config.background_refresh = config_truth_value(value);
+        }
+        else if (strcmp(options[i], "table_sharding") == 0)
+        {
+            router->schemarouter_config.table_sharding = config_truth_value(value);
+        }
+        else if (strcmp(options[i], "scatter_gather") == 0)
+        {
+            router->schemarouter_config.scatter_gather = config_truth_value(value);
+        }
+        else if (strcmp(options[i], "lazy_connect") == 0)
+        {
+            router->schemarouter_config.lazy_connect = config_truth_value(value);
+        }
         else
         {
             MXS_ERROR("Unknown router options for %s", options[i]);
@@ -849,6 +875,36 @@ static MXS_ROUTER* createInstance(SERVICE *service, char **options)
         router->schemarouter_config.max_sescmd_hist = 0;
     }
 
+    if (router->schemarouter_config.lazy_connect &&
+        router->schemarouter_config.disable_sescmd_hist)
+    {
+        MXS_WARNING("Service '%s': lazy_connect requires the session command history, "
+                    "connecting to all servers at the start of the session.", service->name);
+        router->schemarouter_config.lazy_connect = false;
+    }
+
+    if (router->schemarouter_config.table_sharding &&
+        !router->schemarouter_config.background_refresh)
+    {
+        MXS_WARNING("Service '%s': table_sharding requires background_refresh, "
+                    "table sharding is disabled.", service->name);
+        router->schemarouter_config.table_sharding = false;
+    }
+
+    if (router->schemarouter_config.scatter_gather &&
+        !router->schemarouter_config.table_sharding)
+    {
+        MXS_WARNING("Service '%s': scatter_gather requires table_sharding, "
+                    "scatter-gather is disabled.", service->name);
+        router->schemarouter_config.scatter_gather = false;
+    }
+
+    if (!failure && router->schemarouter_config.background_refresh &&
+        !shard_map_start_refresh(router))
+    {
+        failure = true;
+    }
+
     if (failure)
     {
         MXS_FREE(router);
@@ -933,17 +989,26 @@ static MXS_ROUTER_SESSION* newSession(MXS_ROUTER* router_inst, MXS_SESSION* sess
     client_rses->rses_mysql_session = (MYSQL_session*)session->client_dcb->data;
     client_rses->rses_client_dcb = (DCB*)session->client_dcb;
 
-    spinlock_acquire(&router->lock);
-
-    shard_map_t *map = hashtable_fetch(router->shard_maps, session->client_dcb->user);
-    enum shard_map_state state;
+    shard_map_t *map = NULL;
+    enum shard_map_state state = SHMAP_UNINIT;
 
-    if (map)
+    if (router->schemarouter_config.background_refresh && shard_map_acquire_global(client_rses))
     {
-        state = shard_map_update_state(map, router);
+        /** The shard map shared by all users is kept up to date by the housekeeper */
+        map = client_rses->shardmap;
+        state = SHMAP_READY;
     }
+    else
+    {
+        spinlock_acquire(&router->lock);
 
-    spinlock_release(&router->lock);
+        if ((map = hashtable_fetch(router->shard_maps, session->client_dcb->user)))
+        {
+            state = shard_map_update_state(map, router);
+        }
+
+        spinlock_release(&router->lock);
+    }
 
     if (map == NULL || state != SHMAP_READY)
     {
@@ -991,6 +1056,7 @@ static MXS_ROUTER_SESSION* newSession(MXS_ROUTER* router_inst, MXS_SESSION* sess
 
     if (backend_ref == NULL)
     {
+        shard_map_release_session(client_rses);
         MXS_FREE(client_rses);
         return NULL;
     }
@@ -1040,19 +1106,32 @@ static MXS_ROUTER_SESSION* newSession(MXS_ROUTER* router_inst, MXS_SESSION* sess
      */
     if (!(succp = rses_begin_locked_router_action(client_rses)))
     {
+        shard_map_release_session(client_rses);
         MXS_FREE(client_rses->rses_backend_ref);
         MXS_FREE(client_rses);
         return NULL;
     }
-    /**
-     * Connect to all backend servers
-     */
-    succp = connect_backend_servers(backend_ref, router_nservers, session, router);
+    if (client_rses->rses_config.lazy_connect && !(client_rses->init & INIT_UNINT))
+    {
+        /**
+         * The shard map is already known, the servers are connected when
+         * the first query is routed to them.
+         */
+        succp = true;
+    }
+    else
+    {
+        /**
+         * Connect to all backend servers
+         */
+        succp = connect_backend_servers(backend_ref, router_nservers, session, router);
+    }
 
     rses_end_locked_router_action(client_rses);
 
     if (!succp || !(succp = rses_begin_locked_router_action(client_rses)))
     {
+        shard_map_release_session(client_rses);
         MXS_FREE(client_rses->rses_backend_ref);
         MXS_FREE(client_rses);
         return NULL;
@@ -1184,6 +1263,8 @@ static void freeSession(MXS_ROUTER* router_instance, MXS_ROUTER_SESSION* router_
         gwbuf_free(router_cli_ses->rses_backend_ref[i].bref_pending_cmd);
     }
 
+    scatter_free(router_cli_ses);
+
     /**
      * For each property type, walk through the list, finalize properties
      * and free the allocated memory.
@@ -1205,6 +1286,7 @@ static void freeSession(MXS_ROUTER* router_instance, MXS_ROUTER_SESSION* router_
      * all the memory and other resources associated
      * to the client session.
      */
+    shard_map_release_session(router_cli_ses);
     MXS_FREE(router_cli_ses->rses_backend_ref);
     MXS_FREE(router_cli_ses);
     return;
@@ -1225,9 +1307,9 @@ static void freeSession(MXS_ROUTER* router_instance, MXS_ROUTER_SESSION* router_
  *
  * @return True if proper DCB was found, false otherwise.
  */
-static bool get_shard_dcb(DCB**              p_dcb,
-                          ROUTER_CLIENT_SES* rses,
-                          char*              name)
+bool get_shard_dcb(DCB**              p_dcb,
+                   ROUTER_CLIENT_SES* rses,
+                   char*              name)
 {
     backend_ref_t* backend_ref;
     int i;
@@ -1261,6 +1343,25 @@ static bool get_shard_dcb(DCB**              p_dcb,
         }
     }
 
+    if (rses->rses_config.lazy_connect)
+    {
+        /** The session hasn't used the shard yet, connect to it now */
+        for (i = 0; i < rses->rses_nbackends; i++)
+        {
+            SERVER_REF* b = backend_ref[i].bref_backend;
+
+            if (!BREF_IS_IN_USE((&backend_ref[i])) &&
+                (strncasecmp(name, b->server->unique_name, PATH_MAX) == 0) &&
+                SERVER_IS_RUNNING(b->server) &&
+                connect_shard(rses, &backend_ref[i]))
+            {
+                *p_dcb = backend_ref[i].bref_dcb;
+                succp = true;
+                goto return_succp;
+            }
+        }
+    }
+
 return_succp:
     return succp;
 }
@@ -1684,6 +1785,9 @@ static int routeQuery(MXS_ROUTER* instance,
 
     if (!(rses_is_closed = router_cli_ses->rses_closed))
     {
+        /** Switch to the latest shard map if the housekeeper has replaced it */
+        shard_map_update_session(router_cli_ses);
+
         if (router_cli_ses->init & INIT_UNINT)
         {
             /* Generate database list */
@@ -1738,6 +1842,12 @@ static int routeQuery(MXS_ROUTER* instance,
             return init_rval;
         }
 
+        /** Queries are routed only after the shards have replied to a scattered read */
+        if (scatter_queue_query(router_cli_ses, querybuf))
+        {
+            rses_end_locked_router_action(router_cli_ses);
+            return 1;
+        }
     }
 
     rses_end_locked_router_action(router_cli_ses);
@@ -1864,9 +1974,21 @@ static int routeQuery(MXS_ROUTER* instance,
         if (!change_successful)
         {
             time_t now = time(NULL);
-            if (router_cli_ses->rses_config.refresh_databases &&
-                difftime(now, router_cli_ses->rses_config.last_refresh) >
-                router_cli_ses->rses_config.refresh_min_interval)
+            if (router_cli_ses->shardmap_version)
+            {
+                /** The database may have been created after the last refresh.
+                 * The session isn't made to wait for the refresh to finish. */
+                if (router_cli_ses->rses_config.refresh_databases &&
+                    difftime(now, router_cli_ses->rses_config.last_refresh) >
+                    router_cli_ses->rses_config.refresh_min_interval)
+                {
+                    router_cli_ses->rses_config.last_refresh = now;
+                    shard_map_request_refresh(inst);
+                }
+            }
+            else if (router_cli_ses->rses_config.refresh_databases &&
+                     difftime(now, router_cli_ses->rses_config.last_refresh) >
+                     router_cli_ses->rses_config.refresh_min_interval)
             {
                 spinlock_acquire(&router_cli_ses->shardmap->lock);
                 router_cli_ses->shardmap->state = SHMAP_STALE;
@@ -1919,6 +2041,19 @@ static int routeQuery(MXS_ROUTER* instance,
         goto retblock;
     }
 
+    if (router_cli_ses->rses_config.scatter_gather &&
+        rses_begin_locked_router_action(router_cli_ses))
+    {
+        bool scattered = scatter_route_query(inst, router_cli_ses, querybuf, qtype);
+        rses_end_locked_router_action(router_cli_ses);
+
+        if (scattered)
+        {
+            ret = 1;
+            goto retblock;
+        }
+    }
+
     route_target = get_shard_route_target(qtype,
                                           router_cli_ses->rses_transaction_active,
                                           querybuf->hint);
@@ -2052,6 +2187,21 @@ static int routeQuery(MXS_ROUTER* instance,
         goto retblock;
     }
 
+    if (TARGET_IS_ANY(route_target) && router_cli_ses->rses_config.lazy_connect)
+    {
+        /** Prefer a shard that is already connected */
+        for (int i = 0; i < router_cli_ses->rses_nbackends; i++)
+        {
+            backend_ref_t *bref = &router_cli_ses->rses_backend_ref[i];
+            if (BREF_IS_IN_USE(bref) && SERVER_IS_RUNNING(bref->bref_backend->server))
+            {
+                route_target = TARGET_NAMED_SERVER;
+                targetserver = MXS_STRDUP_A(bref->bref_backend->server->unique_name);
+                break;
+            }
+        }
+    }
+
     if (TARGET_IS_ANY(route_target))
     {
         for (int i = 0; i < router_cli_ses->rses_nbackends; i++)
@@ -2117,14 +2267,17 @@ static int routeQuery(MXS_ROUTER* instance,
         {
             ss_dassert((bref->bref_pending_cmd == NULL ||
                         router_cli_ses->rses_closed));
-            bref->bref_pending_cmd = gwbuf_clone(querybuf);
+            bref->bref_pending_cmd = shard_map_use_table_db(router_cli_ses, bref,
+                                                            gwbuf_clone(querybuf));
 
             rses_end_locked_router_action(router_cli_ses);
             ret = 1;
             goto retblock;
         }
 
-        if ((ret = target_dcb->func.write(target_dcb, gwbuf_clone(querybuf))) == 1)
+        GWBUF* buffer = shard_map_use_table_db(router_cli_ses, bref, gwbuf_clone(querybuf));
+
+        if ((ret = target_dcb->func.write(target_dcb, buffer)) == 1)
         {
             backend_ref_t* bref;
 
@@ -2136,6 +2289,12 @@ static int routeQuery(MXS_ROUTER* instance,
             bref = get_bref_from_dcb(router_cli_ses, target_dcb);
             bref_set_state(bref, BREF_QUERY_ACTIVE);
             bref_set_state(bref, BREF_WAITING_RESULT);
+            shard_map_track_ddl(router_cli_ses, bref, querybuf, op);
+
+            if (packet_type == MYSQL_COM_INIT_DB || op == QUERY_OP_CHANGE_DB)
+            {
+                strcpy(bref->bref_db, router_cli_ses->current_db);
+            }
         }
         else
         {
@@ -2264,6 +2423,21 @@ static void diagnostic(MXS_ROUTER *instance, DCB *dcb)
     }
     dcb_printf(dcb, "Shard map cache hits: %d\n", router->stats.shmap_cache_hit);
     dcb_printf(dcb, "Shard map cache misses: %d\n", router->stats.shmap_cache_miss);
+
+    if (router->schemarouter_config.background_refresh)
+    {
+        dcb_printf(dcb, "Background shard map refreshes: %d\n", router->stats.shmap_refreshes);
+    }
+
+    if (router->schemarouter_config.scatter_gather)
+    {
+        dcb_printf(dcb, "Scatter-gather queries: %d\n", router->stats.n_scatter);
+    }
+
+    if (router->schemarouter_config.lazy_connect)
+    {
+        dcb_printf(dcb, "Shard connections created on demand: %d\n", router->stats.n_lazy_connects);
+    }
     dcb_printf(dcb, "\n");
 }
 
@@ -2368,6 +2542,7 @@ static void clientReply(MXS_ROUTER* instance,
              * then close the session.
              */
             router_cli_ses->init &= ~INIT_MAPPING;
+            replay_delayed_history(router_cli_ses);
 
             if (router_cli_ses->init & INIT_USE_DB)
             {
@@ -2433,6 +2608,35 @@ static void clientReply(MXS_ROUTER* instance,
 
     CHK_BACKEND_REF(bref);
     scur = &bref->bref_sescmd_cur;
+
+    /** Replies to the COM_INIT_DBs sent before queries on other tables are
+     * not sent to the client */
+    while (bref->bref_n_discard > 0 && !sescmd_cursor_is_active(scur) && writebuf)
+    {
+        GWBUF* reply = modutil_get_next_MySQL_packet(&writebuf);
+
+        if (reply == NULL)
+        {
+            break;
+        }
+
+        if (MYSQL_IS_ERROR_PACKET(GWBUF_DATA(reply)))
+        {
+            MXS_WARNING("Failed to change the default database of '%s'.",
+                        bref->bref_backend->server->unique_name);
+            bref->bref_db[0] = '\0';
+        }
+
+        bref->bref_n_discard--;
+        gwbuf_free(reply);
+    }
+
+    if (writebuf == NULL || scatter_process_reply(router_cli_ses, bref, writebuf))
+    {
+        rses_end_locked_router_action(router_cli_ses);
+        return;
+    }
+
     /**
      * Active cursor means that reply is from session command
      * execution.
@@ -2506,6 +2710,9 @@ static void clientReply(MXS_ROUTER* instance,
                  PTR_IS_ERR(cmd) ? "ERR" : PTR_IS_OK(cmd) ? "OK" : "RSET",
                  state & INIT_UNINT ? "UNINIT" : state & INIT_MAPPING ? "MAPPING" : "READY",
                  router_cli_ses->rses_client_dcb->session);
+
+        /** Databases created and dropped by the client are updated to the shard map */
+        shard_map_apply_ddl(router_cli_ses, bref, writebuf);
         MXS_SESSION_ROUTE_REPLY(backend_dcb->session, writebuf);
     }
     /** Unlock router session */
@@ -2595,7 +2802,7 @@ int bref_cmp_behind_master(const void* bref1, const void* bref2)
     SERVER_REF* b1 = ((backend_ref_t *)bref1)->bref_backend;
     SERVER_REF* b2 = ((backend_ref_t *)bref2)->bref_backend;
 
-    return b1->server->rlag - b2->server->rlag;
+    return b1->server->rlag_ms - b2->server->rlag_ms;
 }
 
 /** Compare number of current operations in backend servers */
@@ -2608,7 +2815,7 @@ int bref_cmp_current_load(const void* bref1, const void* bref2)
            - ((1000 * b2->server->stats.n_current_ops) - b2->weight);
 }
 
-static void bref_clear_state(backend_ref_t* bref, bref_state_t state)
+void bref_clear_state(backend_ref_t* bref, bref_state_t state)
 {
     if (bref == NULL)
     {
@@ -2622,7 +2829,6 @@ static void bref_clear_state(backend_ref_t* bref, bref_state_t state)
     else
     {
         int prev1;
-        int prev2;
 
         /** Decrease waiter count */
         prev1 = atomic_add(&bref->bref_num_result_wait, -1);
@@ -2633,21 +2839,13 @@ static void bref_clear_state(backend_ref_t* bref, bref_state_t state)
         }
         else
         {
-            /** Decrease global operation count */
-            prev2 = atomic_add(&bref->bref_backend->server->stats.n_current_ops, -1);
-            ss_dassert(prev2 > 0);
-            if (prev2 <= 0)
-            {
-                MXS_ERROR("[%s] Error: negative current operation count in backend %s:%u",
-                          __FUNCTION__,
-                          bref->bref_backend->server->name,
-                          bref->bref_backend->server->port);
-            }
+            /** Decrease global operation count, a waiting query may take the slot */
+            server_end_op(bref->bref_backend->server);
         }
     }
 }
 
-static void bref_set_state(backend_ref_t* bref, bref_state_t state)
+void bref_set_state(backend_ref_t* bref, bref_state_t state)
 {
     if (bref == NULL)
     {
@@ -2661,7 +2859,6 @@ static void bref_set_state(backend_ref_t* bref, bref_state_t state)
     else
     {
         int prev1;
-        int prev2;
 
         /** Increase waiter count */
         prev1 = atomic_add(&bref->bref_num_result_wait, 1);
@@ -2675,16 +2872,156 @@ static void bref_set_state(backend_ref_t* bref, bref_state_t state)
                       bref->bref_backend->server->port);
         }
         /** Increase global operation count */
-        prev2 = atomic_add(&bref->bref_backend->server->stats.n_current_ops, 1);
-        ss_dassert(prev2 >= 0);
-        if (prev2 < 0)
+        server_start_op(bref->bref_backend->server);
+    }
+}
+
+/**
+ * Connect a backend reference to its server
+ *
+ * @param bref    Backend reference which is not in use
+ * @param session The session of the client
+ * @param replay  Execute the session command history on the new connection
+ *                before any other commands are routed to it
+ * @return True if the connection was created
+ */
+static bool connect_backend(backend_ref_t* bref, MXS_SESSION* session, bool replay)
+{
+    SERVER_REF* b = bref->bref_backend;
+
+    ss_dassert(!BREF_IS_IN_USE(bref));
+
+    if ((bref->bref_dcb = dcb_connect(b->server, session, b->server->protocol)) == NULL)
+    {
+        MXS_ERROR("Unable to establish connection with slave [%s]:%d",
+                  b->server->name, b->server->port);
+        return false;
+    }
+
+    bref->bref_db[0] = '\0';
+    bref->bref_n_discard = 0;
+    bref->bref_state = 0;
+    bref_set_state(bref, BREF_IN_USE);
+
+    if (replay)
+    {
+        /**
+         * Start executing session command history. The state is reset
+         * first, the history isn't executed on a closed backend.
+         */
+        execute_sescmd_history(bref);
+    }
+
+    /**
+     * Increase backend connection counter. Server's stats are _increased_ in
+     * dcb.c:dcb_alloc ! But decreased in the calling function of dcb_close.
+     */
+    atomic_add(&b->connections, 1);
+
+    /** When server fails, this callback is called. */
+    dcb_add_callback(bref->bref_dcb, DCB_REASON_NOT_RESPONDING,
+                     &router_handle_state_switch, (void *)bref);
+    return true;
+}
+
+/**
+ * Connect to a shard the session hasn't used yet
+ *
+ * With lazy_connect, the session is connected to a shard only when a query
+ * is routed to it. The session command history is replayed only to the new
+ * connection. While the shard map is being generated, the replay is delayed
+ * until the SHOW DATABASES reply has been processed.
+ *
+ * This must be called with router lock.
+ *
+ * @param rses Router client session
+ * @param bref Backend reference which is not in use
+ * @return True if the connection was created
+ */
+static bool connect_shard(ROUTER_CLIENT_SES* rses, backend_ref_t* bref)
+{
+    bool replay = (rses->init & INIT_MAPPING) == 0;
+
+    if (!connect_backend(bref, rses->rses_client_dcb->session, replay))
+    {
+        return false;
+    }
+
+    bref->bref_replay_history = !replay;
+    atomic_add(&rses->router->stats.n_lazy_connects, 1);
+    MXS_INFO("Connected to '%s' on demand.", bref->bref_backend->server->unique_name);
+    return true;
+}
+
+/**
+ * Replay the session command history to the shards connected while the
+ * shard map was being generated
+ *
+ * This must be called with router lock.
+ *
+ * @param rses Router client session
+ */
+static void replay_delayed_history(ROUTER_CLIENT_SES* rses)
+{
+    for (int i = 0; i < rses->rses_nbackends; i++)
+    {
+        backend_ref_t* bref = &rses->rses_backend_ref[i];
+
+        if (bref->bref_replay_history)
         {
-            MXS_ERROR("[%s] Error: negative current operation count in backend %s:%u",
-                      __FUNCTION__,
-                      bref->bref_backend->server->name,
-                      bref->bref_backend->server->port);
+            bref->bref_replay_history = false;
+
+            if (BREF_IS_IN_USE(bref))
+            {
+                execute_sescmd_history(bref);
+            }
+        }
+    }
+}
+
+/**
+ * Connect to a shard that replies to a session command when the session has
+ * no connections
+ *
+ * The shard of the current database is preferred, otherwise the first running
+ * server is used. This must be called with router lock.
+ *
+ * @param rses Router client session
+ * @return True if a shard was connected
+ */
+static bool connect_default_shard(ROUTER_CLIENT_SES* rses)
+{
+    char name[PATH_MAX + 1] = "";
+
+    if (rses->current_db[0])
+    {
+        spinlock_acquire(&rses->shardmap->lock);
+        char* tname = hashtable_fetch(rses->shardmap->hash, rses->current_db);
+
+        if (tname)
+        {
+            snprintf(name, sizeof(name), "%s", tname);
+        }
+        spinlock_release(&rses->shardmap->lock);
+    }
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (int i = 0; i < rses->rses_nbackends; i++)
+        {
+            backend_ref_t* bref = &rses->rses_backend_ref[i];
+            SERVER* server = bref->bref_backend->server;
+
+            if (!BREF_IS_IN_USE(bref) && SERVER_IS_RUNNING(server) &&
+                (pass > 0 || strcmp(name, server->unique_name) == 0) &&
+                connect_shard(rses, bref))
+            {
+                return true;
+            }
         }
     }
+
+    return false;
 }
 
 /**
@@ -2782,52 +3119,14 @@ static bool connect_backend_servers(backend_ref_t*   backend_ref,
             /** New server connection */
             else
             {
-                backend_ref[i].bref_dcb = dcb_connect(b->server,
-                                                      session,
-                                                      b->server->protocol);
-
-                if (backend_ref[i].bref_dcb != NULL)
-                {
-                    servers_connected += 1;
-                    /**
-                     * Start executing session command
-                     * history.
-                     */
-                    execute_sescmd_history(&backend_ref[i]);
-                    /**
-                     * When server fails, this callback
-                     * is called.
-                     * !!! Todo, routine which removes
-                     * corresponding entries from the hash
-                     * table.
-                     */
-
-                    backend_ref[i].bref_state = 0;
-                    bref_set_state(&backend_ref[i], BREF_IN_USE);
-                    /**
-                     * Increase backend connection counter.
-                     * Server's stats are _increased_ in
-                     * dcb.c:dcb_alloc !
-                     * But decreased in the calling function
-                     * of dcb_close.
-                     */
-                    atomic_add(&b->connections, 1);
-
-                    dcb_add_callback(backend_ref[i].bref_dcb,
-                                     DCB_REASON_NOT_RESPONDING,
-                                     &router_handle_state_switch,
-                                     (void *)&backend_ref[i]);
-                }
-                else
+                if (!connect_backend(&backend_ref[i], session, true))
                 {
                     succp = false;
-                    MXS_ERROR("Unable to establish "
-                              "connection with slave [%s]:%d",
-                              b->server->name,
-                              b->server->port);
                     /* handle connect error */
                     break;
                 }
+
+                servers_connected += 1;
             }
         }
     } /*< for */
@@ -3506,6 +3805,15 @@ static bool route_session_write(ROUTER_CLIENT_SES* router_cli_ses,
         }
     }
 
+    if (router_cli_ses->rses_config.lazy_connect && !have_servers(router_cli_ses) &&
+        !connect_default_shard(router_cli_ses))
+    {
+        MXS_ERROR("Failed to route session command, no backends are available.");
+        gwbuf_free(querybuf);
+        rses_end_locked_router_action(router_cli_ses);
+        goto return_succp;
+    }
+
     /**
      *
      * Additional reference is created to querybuf to
@@ -3570,7 +3878,7 @@ static bool route_session_write(ROUTER_CLIENT_SES* router_cli_ses,
                 }
             }
         }
-        else
+        else if (!router_cli_ses->rses_config.lazy_connect)
         {
             succp = false;
         }
@@ -3772,7 +4080,11 @@ static bool handle_error_new_connection(ROUTER_INSTANCE*   inst,
      * the backend server it is necessary to send an error to the client
      * because it is waiting for reply.
      */
-    if (BREF_IS_WAITING_RESULT(bref))
+    if (scatter_handle_error(rses, bref))
+    {
+        /** The client gets the error once the other shards have replied */
+    }
+    else if (BREF_IS_WAITING_RESULT(bref))
     {
         DCB* client_dcb;
         client_dcb = ses->client_dcb;
@@ -3802,6 +4114,27 @@ static bool handle_error_new_connection(ROUTER_INSTANCE*   inst,
                         &router_handle_state_switch,
                         (void *)bref);
 
+    if (rses->rses_config.lazy_connect)
+    {
+        /**
+         * The failed shard is connected again when the next query is
+         * routed to it, the session can continue as long as some server
+         * is running.
+         */
+        for (int i = 0; i < rses->rses_nbackends; i++)
+        {
+            if (SERVER_IS_RUNNING(rses->rses_backend_ref[i].bref_backend->server))
+            {
+                succp = true;
+                goto return_succp;
+            }
+        }
+
+        MXS_ERROR("No more valid servers, closing session");
+        succp = false;
+        goto return_succp;
+    }
+
     /**
      * Try to get replacement slave or at least the minimum
      * number of slave connections for router session.
@@ -3830,8 +4163,8 @@ return_succp:
  *
  * @return backend reference pointer if succeed or NULL
  */
-static backend_ref_t* get_bref_from_dcb(ROUTER_CLIENT_SES* rses,
-                                        DCB*               dcb)
+backend_ref_t* get_bref_from_dcb(ROUTER_CLIENT_SES* rses,
+                                 DCB*               dcb)
 {
     backend_ref_t* bref;
     int i = 0;
@@ -4092,6 +4425,8 @@ bool handle_default_db(ROUTER_CLIENT_SES *router_cli_ses)
 
             if (get_shard_dcb(&dcb, router_cli_ses, target))
             {
+                backend_ref_t* bref = get_bref_from_dcb(router_cli_ses, dcb);
+                strcpy(bref->bref_db, router_cli_ses->connect_db);
                 dcb->func.write(dcb, buffer);
                 MXS_DEBUG("USE '%s' sent to %s for session %p",
                           router_cli_ses->connect_db,
@@ -4257,6 +4592,8 @@ void replace_shard_map(shard_map_t **target, shard_map_t **source)
     tgt->state = src->state;
     hashtable_free(tgt->hash);
     tgt->hash = src->hash;
+    hashtable_free(src->tables);
+    hashtable_free(src->scattered);
     MXS_FREE(src);
     *source = NULL;
 }
@@ -4298,8 +4635,7 @@ void synchronize_shard_map(ROUTER_CLIENT_SES *client)
             /**
              * Another thread has already updated the shard map for this user
              */
-            hashtable_free(client->shardmap->hash);
-            MXS_FREE(client->shardmap);
+            shard_map_free(client->shardmap);
         }
         spinlock_release(&map->lock);
         client->shardmap = map;
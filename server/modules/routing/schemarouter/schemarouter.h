@@ -32,6 +32,7 @@
 #include <maxscale/hashtable.h>
 #include <maxscale/protocol/mysql.h>
 #include <maxscale/pcre2.h>
+#include <maxscale/query_classifier.h>
 
 MXS_BEGIN_DECLS
 
@@ -70,9 +71,14 @@ typedef struct shard_map
 {
     HASHTABLE *hash; /*< A hashtable of database names and the servers which
                        * have these databases. */
+    HASHTABLE *tables; /*< Fully qualified table names and the servers which
+                        * have these tables, only filled with table_sharding */
+    HASHTABLE *scattered; /*< Tables found on many servers and comma-separated lists
+                           * of these servers, only filled with scatter_gather */
     SPINLOCK lock;
     time_t last_updated;
     enum shard_map_state state; /*< State of the shard map */
+    int refcount; /*< Number of sessions using a shared shard map */
 } shard_map_t;
 
 /**
@@ -133,6 +139,7 @@ typedef enum
 
 typedef struct rses_property_st rses_property_t;
 typedef struct router_client_session ROUTER_CLIENT_SES;
+typedef struct scatter_gather scatter_gather_t;
 
 /**
  * Router session properties
@@ -271,6 +278,10 @@ typedef struct backend_ref_st
     int             bref_num_result_wait; /*< Number of not yet received results */
     sescmd_cursor_t bref_sescmd_cur; /*< Session command cursor */
     GWBUF*          bref_pending_cmd; /*< For stmt which can't be routed due active sescmd execution */
+    char            bref_db[MYSQL_DATABASE_MAXLEN + 1]; /*< Default database of the connection */
+    int             bref_n_discard; /*< Replies to internal COM_INIT_DBs that are discarded */
+    bool            bref_replay_history; /*< Session command history is replayed once the
+                                          * shard map has been generated */
 #if defined(SS_DEBUG)
     skygw_chk_t     bref_chk_tail;
 #endif
@@ -290,6 +301,10 @@ typedef struct schemarouter_config_st
     double refresh_min_interval; /*< Minimum required interval between refreshes of databases */
     bool refresh_databases; /*< Are databases refreshed when they are not found in the hashtable */
     bool debug; /*< Enable verbose debug messages to clients */
+    bool background_refresh; /*< Refresh one shard map for all users in the housekeeper */
+    bool table_sharding; /*< Route the tables of databases found on many servers by name */
+    bool scatter_gather; /*< Execute reads of tables found on many servers on all of them */
+    bool lazy_connect; /*< Connect to a shard when the session first routes a query to it */
 } schemarouter_config_t;
 
 /**
@@ -308,6 +323,9 @@ typedef struct
     double          ses_average; /*< Average session length */
     int             shmap_cache_hit; /*< Shard map was found from the cache */
     int             shmap_cache_miss;/*< No shard map found from the cache */
+    int             shmap_refreshes; /*< Background refreshes of the shard map */
+    int             n_scatter; /*< Reads executed on many shards */
+    int             n_lazy_connects; /*< Shard connections created on demand */
 } ROUTER_STATS;
 
 /**
@@ -337,6 +355,12 @@ struct router_client_session
     shardmap; /*< Database hash containing names of the databases mapped to the servers that contain them */
     char            connect_db[MYSQL_DATABASE_MAXLEN + 1]; /*< Database the user was trying to connect to */
     char            current_db[MYSQL_DATABASE_MAXLEN + 1]; /*< Current active database */
+    int             shardmap_version; /*< Version of the global shard map in use, zero
+                                       * if the session uses a shard map of its own */
+    backend_ref_t*  ddl_bref; /*< Backend that executes a CREATE or DROP DATABASE */
+    bool            ddl_create; /*< Whether the database is created or dropped */
+    char            ddl_db[MYSQL_DATABASE_MAXLEN + 1]; /*< The created or dropped database */
+    scatter_gather_t* scatter; /*< Read that is being executed on many shards */
     init_mask_t    init; /*< Initialization state bitmask */
     GWBUF*          queue; /*< Query that was received before the session was ready */
     DCB*            dcb_route; /*< Internal DCB used to trigger re-routing of buffers */
@@ -374,12 +398,53 @@ typedef struct router_instance
                                            * if they are found on more than one server. */
     pcre2_match_data*       ignore_match_data;
     SERVER*                 preferred_server; /**< Server to prefer in conflict situations */
+    shard_map_t*            global_map; /**< Shard map of all users with background_refresh,
+                                         * NULL until it has been built */
+    int                     global_map_version; /**< Incremented when the global map is replaced */
+    bool                    refresh_pending; /**< An immediate refresh has been requested */
 
 } ROUTER_INSTANCE;
 
 #define BACKEND_TYPE(b) (SERVER_IS_MASTER((b)->backend_server) ? BE_MASTER :    \
         (SERVER_IS_SLAVE((b)->backend_server) ? BE_SLAVE :  BE_UNDEFINED));
 
+/*
+ * The following are implemented in schemarouter.c
+ */
+shard_map_t* shard_map_alloc();
+bool get_shard_dcb(DCB** dcb, ROUTER_CLIENT_SES* rses, char* name);
+backend_ref_t* get_bref_from_dcb(ROUTER_CLIENT_SES* rses, DCB* dcb);
+void bref_clear_state(backend_ref_t* bref, bref_state_t state);
+void bref_set_state(backend_ref_t* bref, bref_state_t state);
+
+/*
+ * The following are implemented in shard_map.c
+ */
+bool shard_map_add_database(ROUTER_INSTANCE *router, shard_map_t *map,
+                            const char *db, char *target, const char *user);
+void shard_map_free(shard_map_t *map);
+bool shard_map_acquire_global(ROUTER_CLIENT_SES *rses);
+void shard_map_update_session(ROUTER_CLIENT_SES *rses);
+void shard_map_release_session(ROUTER_CLIENT_SES *rses);
+bool shard_map_start_refresh(ROUTER_INSTANCE *router);
+void shard_map_request_refresh(ROUTER_INSTANCE *router);
+void shard_map_track_ddl(ROUTER_CLIENT_SES *rses, backend_ref_t *bref,
+                         GWBUF *querybuf, qc_query_op_t op);
+void shard_map_apply_ddl(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *reply);
+char* shard_map_get_table_target(ROUTER_CLIENT_SES *rses, GWBUF *buffer);
+GWBUF* shard_map_use_table_db(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *querybuf);
+char* shard_map_get_scatter_targets(ROUTER_CLIENT_SES *rses, GWBUF *buffer);
+
+/*
+ * The following are implemented in scatter_gather.c
+ */
+bool scatter_route_query(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
+                         GWBUF *querybuf, qc_query_type_t qtype);
+bool scatter_queue_query(ROUTER_CLIENT_SES *rses, GWBUF *querybuf);
+bool scatter_process_reply(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *reply);
+bool scatter_handle_error(ROUTER_CLIENT_SES *rses, backend_ref_t *bref);
+void scatter_free(ROUTER_CLIENT_SES *rses);
+
 MXS_END_DECLS
 
 #endif /*< _SCHEMAROUTER_H */
@@ -0,0 +1,753 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include "schemarouter.h"
+
+#include <stdio.h>
+#include <strings.h>
+#include <string.h>
+#include <mysql.h>
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/housekeeper.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/modutil.h>
+#include <maxscale/mysql_utils.h>
+#include <maxscale/secrets.h>
+#include <maxscale/service.h>
+
+/**
+ * @file shard_map.c   The shard map that is shared by all sessions of a service
+ *
+ * With background_refresh, the housekeeper builds one shard map of the databases
+ * that the service user sees and swaps it in place of the previous one. The
+ * sessions hold a reference to the map they use and switch to the newest one
+ * before routing a query, so sessions never wait for the databases to be mapped.
+ * Databases created and dropped through the router are added to and removed
+ * from the map in use as soon as the server has executed the statement.
+ *
+ * With table_sharding, a database may be on many servers and the map also has
+ * the server of each table. Queries are routed to the server that has the tables
+ * they use and the default database of that connection is changed to the current
+ * database of the client before queries that use unqualified table names.
+ */
+
+/** Minimum interval between background refreshes in seconds */
+#define SHARD_MAP_MIN_INTERVAL 1
+
+/** The tables that are added to the shard map with table_sharding */
+#define SHARD_MAP_TABLES_QUERY "SELECT TABLE_SCHEMA, TABLE_NAME FROM information_schema.TABLES " \
+    "WHERE TABLE_SCHEMA NOT IN ('mysql', 'information_schema', 'performance_schema')"
+
+/**
+ * Check whether a database may be found on more than one server
+ *
+ * @param router Router instance
+ * @param db Database name
+ * @return True if the database is ignored
+ */
+static bool shard_map_is_ignored(ROUTER_INSTANCE *router, const char *db)
+{
+    return hashtable_fetch(router->ignored_dbs, (void*)db) ||
+           (router->ignore_regex &&
+            pcre2_match(router->ignore_regex, (PCRE2_SPTR)db,
+                        PCRE2_ZERO_TERMINATED, 0, 0,
+                        router->ignore_match_data, NULL) >= 0);
+}
+
+bool shard_map_add_database(ROUTER_INSTANCE *router, shard_map_t *map,
+                            const char *db, char *target, const char *user)
+{
+    bool rval = true;
+
+    if (hashtable_add(map->hash, (void*)db, target))
+    {
+        MXS_INFO("<%s, %s>", target, db);
+    }
+    else if (!router->schemarouter_config.table_sharding && !shard_map_is_ignored(router, db))
+    {
+        MXS_ERROR("Database '%s' found on servers '%s' and '%s' for user %s.",
+                  db, target, (char*)hashtable_fetch(map->hash, (void*)db), user);
+        rval = false;
+    }
+    else if (router->preferred_server &&
+             strcmp(target, router->preferred_server->unique_name) == 0)
+    {
+        /** In conflict situations, use the preferred server */
+        MXS_INFO("Forcing location of '%s' from '%s' to '%s'",
+                 db, (char*)hashtable_fetch(map->hash, (void*)db), target);
+        hashtable_delete(map->hash, (void*)db);
+        hashtable_add(map->hash, (void*)db, target);
+    }
+
+    return rval;
+}
+
+/**
+ * Add a server to the servers of a table that is found on many servers
+ *
+ * @param map The shard map being built
+ * @param key Fully qualified table name
+ * @param servers Servers that already have the table
+ * @param target Server to add
+ */
+static void shard_map_scatter_table(shard_map_t *map, const char *key,
+                                    const char *servers, const char *target)
+{
+    /** Server names can't contain commas as they are listed in comma-separated
+     * lists in the configuration */
+    char list[strlen(servers) + strlen(target) + 2];
+    sprintf(list, "%s,%s", servers, target);
+
+    hashtable_delete(map->tables, (void*)key);
+    hashtable_delete(map->scattered, (void*)key);
+    hashtable_add(map->scattered, (void*)key, list);
+}
+
+/**
+ * Add a table to a shard map
+ *
+ * @param router Router instance
+ * @param map The shard map being built
+ * @param db Database of the table
+ * @param table Table name
+ * @param target Server that has the table
+ * @return False if the table was found on another server
+ */
+static bool shard_map_add_table(ROUTER_INSTANCE *router, shard_map_t *map,
+                                const char *db, const char *table, char *target)
+{
+    bool rval = true;
+    char key[strlen(db) + strlen(table) + 2];
+    sprintf(key, "%s.%s", db, table);
+
+    char *servers = hashtable_fetch(map->scattered, key);
+
+    if (servers == NULL && hashtable_add(map->tables, key, target))
+    {
+        return true;
+    }
+
+    if (servers == NULL)
+    {
+        servers = hashtable_fetch(map->tables, key);
+    }
+
+    if (shard_map_is_ignored(router, db))
+    {
+        /** The table stays on the first server */
+    }
+    else if (router->schemarouter_config.scatter_gather)
+    {
+        char current[strlen(servers) + 1];
+        strcpy(current, servers);
+        shard_map_scatter_table(map, key, current, target);
+    }
+    else
+    {
+        MXS_ERROR("Table '%s' found on servers '%s' and '%s'.", key, target, servers);
+        rval = false;
+    }
+
+    return rval;
+}
+
+void shard_map_free(shard_map_t *map)
+{
+    if (map)
+    {
+        hashtable_free(map->hash);
+        hashtable_free(map->tables);
+        hashtable_free(map->scattered);
+        MXS_FREE(map);
+    }
+}
+
+/**
+ * Release a reference to a shared shard map
+ *
+ * @param map The shard map, freed when the last reference is released
+ */
+static void shard_map_release(shard_map_t *map)
+{
+    if (atomic_add(&map->refcount, -1) == 1)
+    {
+        shard_map_free(map);
+    }
+}
+
+bool shard_map_acquire_global(ROUTER_CLIENT_SES *rses)
+{
+    ROUTER_INSTANCE *router = rses->router;
+
+    spinlock_acquire(&router->lock);
+    shard_map_t *map = router->global_map;
+
+    if (map)
+    {
+        atomic_add(&map->refcount, 1);
+        rses->shardmap = map;
+        rses->shardmap_version = router->global_map_version;
+    }
+
+    spinlock_release(&router->lock);
+
+    return map != NULL;
+}
+
+void shard_map_update_session(ROUTER_CLIENT_SES *rses)
+{
+    if (rses->shardmap_version && rses->shardmap_version != rses->router->global_map_version)
+    {
+        shard_map_t *old = rses->shardmap;
+
+        if (shard_map_acquire_global(rses))
+        {
+            shard_map_release(old);
+        }
+    }
+}
+
+void shard_map_release_session(ROUTER_CLIENT_SES *rses)
+{
+    if (rses->shardmap_version)
+    {
+        shard_map_release(rses->shardmap);
+        rses->shardmap = NULL;
+        rses->shardmap_version = 0;
+    }
+}
+
+/**
+ * Add the tables of one server to a shard map
+ *
+ * @param router Router instance
+ * @param map The shard map being built
+ * @param mysql Connection to the server
+ * @param server The server
+ * @return True if the tables were read and none of them was on another server
+ */
+static bool shard_map_load_tables(ROUTER_INSTANCE *router, shard_map_t *map,
+                                  MYSQL *mysql, SERVER *server)
+{
+    bool rval = false;
+
+    if (mxs_mysql_query(mysql, SHARD_MAP_TABLES_QUERY) != 0)
+    {
+        MXS_ERROR("Failed to list the tables of '%s': %s",
+                  server->unique_name, mysql_error(mysql));
+    }
+    else
+    {
+        MYSQL_RES *result = mysql_store_result(mysql);
+
+        if (result)
+        {
+            MYSQL_ROW row;
+            rval = true;
+
+            while ((row = mysql_fetch_row(result)))
+            {
+                if (row[0] && row[1] &&
+                    !shard_map_add_table(router, map, row[0], row[1], server->unique_name))
+                {
+                    rval = false;
+                }
+            }
+
+            mysql_free_result(result);
+        }
+    }
+
+    return rval;
+}
+
+/**
+ * Add the databases of one server to a shard map
+ *
+ * With table_sharding, the tables of the databases are added as well.
+ *
+ * @param router Router instance
+ * @param map The shard map being built
+ * @param server The server
+ * @param user User name
+ * @param password Decrypted password
+ * @return True if the databases were read and none of them was on another server
+ */
+static bool shard_map_load_server(ROUTER_INSTANCE *router, shard_map_t *map, SERVER *server,
+                                  const char *user, const char *password)
+{
+    bool rval = false;
+    MYSQL *mysql = mysql_init(NULL);
+
+    if (mysql == NULL)
+    {
+        MXS_ERROR("Failed to initialize a connection to '%s'.", server->unique_name);
+    }
+    else if (mxs_mysql_real_connect(mysql, server, user, password) == NULL)
+    {
+        MXS_ERROR("Failed to connect to '%s' to refresh the shard map of service '%s': %s",
+                  server->unique_name, router->service->name, mysql_error(mysql));
+    }
+    else if (mxs_mysql_query(mysql, "SHOW DATABASES") != 0)
+    {
+        MXS_ERROR("Failed to list the databases of '%s': %s",
+                  server->unique_name, mysql_error(mysql));
+    }
+    else
+    {
+        MYSQL_RES *result = mysql_store_result(mysql);
+
+        if (result)
+        {
+            MYSQL_ROW row;
+            rval = true;
+
+            while ((row = mysql_fetch_row(result)))
+            {
+                if (row[0] && !shard_map_add_database(router, map, row[0],
+                                                      server->unique_name, user))
+                {
+                    rval = false;
+                }
+            }
+
+            mysql_free_result(result);
+        }
+
+        if (rval && router->schemarouter_config.table_sharding)
+        {
+            rval = shard_map_load_tables(router, map, mysql, server);
+        }
+    }
+
+    if (mysql)
+    {
+        mysql_close(mysql);
+    }
+
+    return rval;
+}
+
+/**
+ * Build a new global shard map and swap it in place of the old one
+ *
+ * The old map is kept if any of the running servers could not be read from
+ * or if a database was found on two servers.
+ *
+ * @param data The router instance
+ */
+static void shard_map_refresh(void *data)
+{
+    ROUTER_INSTANCE *router = (ROUTER_INSTANCE*)data;
+    char *user, *password;
+    bool ok = false;
+
+    /** Requests made from now on need another refresh */
+    spinlock_acquire(&router->lock);
+    router->refresh_pending = false;
+    spinlock_release(&router->lock);
+
+    shard_map_t *map = shard_map_alloc();
+
+    if (map && serviceGetUser(router->service, &user, &password))
+    {
+        char *dpwd = decrypt_password(password);
+
+        if (dpwd)
+        {
+            mysql_thread_init();
+            ok = true;
+
+            for (SERVER_REF *ref = router->service->dbref; ref && ok; ref = ref->next)
+            {
+                if (SERVER_REF_IS_ACTIVE(ref) && SERVER_IS_RUNNING(ref->server))
+                {
+                    ok = shard_map_load_server(router, map, ref->server, user, dpwd);
+                }
+            }
+
+            mysql_thread_end();
+            MXS_FREE(dpwd);
+        }
+    }
+
+    if (ok)
+    {
+        map->state = SHMAP_READY;
+        map->last_updated = time(NULL);
+        map->refcount = 1;
+
+        spinlock_acquire(&router->lock);
+        shard_map_t *old = router->global_map;
+        router->global_map = map;
+        router->global_map_version++;
+        router->stats.shmap_refreshes++;
+        spinlock_release(&router->lock);
+
+        MXS_INFO("Refreshed the shard map of service '%s': %d databases, %d tables, "
+                 "%d scattered tables.", router->service->name, hashtable_size(map->hash),
+                 hashtable_size(map->tables), hashtable_size(map->scattered));
+
+        if (old)
+        {
+            shard_map_release(old);
+        }
+    }
+    else
+    {
+        MXS_ERROR("Refreshing the shard map of service '%s' failed, the previous "
+                  "shard map is used.", router->service->name);
+        shard_map_free(map);
+    }
+}
+
+bool shard_map_start_refresh(ROUTER_INSTANCE *router)
+{
+    char name[strlen(router->service->name) + sizeof("-shard-map")];
+    int interval = MXS_MAX((int)router->schemarouter_config.refresh_min_interval,
+                           SHARD_MAP_MIN_INTERVAL);
+
+    sprintf(name, "%s-shard-map", router->service->name);
+
+    if (hktask_add(name, shard_map_refresh, router, interval) == 0)
+    {
+        MXS_ERROR("Failed to add the shard map refresh of service '%s' "
+                  "to the housekeeper.", router->service->name);
+        return false;
+    }
+
+    /** The first map is built right away */
+    shard_map_request_refresh(router);
+    return true;
+}
+
+void shard_map_request_refresh(ROUTER_INSTANCE *router)
+{
+    spinlock_acquire(&router->lock);
+    bool pending = router->refresh_pending;
+    router->refresh_pending = true;
+    spinlock_release(&router->lock);
+
+    if (!pending)
+    {
+        char name[strlen(router->service->name) + sizeof("-shard-map-now")];
+        sprintf(name, "%s-shard-map-now", router->service->name);
+
+        if (hktask_oneshot(name, shard_map_refresh, router, 0) == 0)
+        {
+            spinlock_acquire(&router->lock);
+            router->refresh_pending = false;
+            spinlock_release(&router->lock);
+        }
+    }
+}
+
+/**
+ * Get the database a CREATE DATABASE or DROP DATABASE statement targets
+ *
+ * @param querybuf The statement
+ * @param db Buffer of MYSQL_DATABASE_MAXLEN + 1 bytes where the name is stored
+ * @param create Set to true for CREATE and false for DROP
+ * @return True if the statement creates or drops a database
+ */
+static bool get_ddl_database(GWBUF *querybuf, char *db, bool *create)
+{
+    bool rval = false;
+    char *sql = modutil_get_SQL(querybuf);
+
+    if (sql)
+    {
+        const char *delim = "` \n\t;";
+        char *saved;
+        char *tok = strtok_r(sql, delim, &saved);
+
+        if (tok && (strcasecmp(tok, "create") == 0 || strcasecmp(tok, "drop") == 0))
+        {
+            *create = strcasecmp(tok, "create") == 0;
+            tok = strtok_r(NULL, delim, &saved);
+
+            if (tok && (strcasecmp(tok, "database") == 0 || strcasecmp(tok, "schema") == 0))
+            {
+                tok = strtok_r(NULL, delim, &saved);
+
+                /** Skip IF [NOT] EXISTS */
+                if (tok && strcasecmp(tok, "if") == 0)
+                {
+                    tok = strtok_r(NULL, delim, &saved);
+
+                    if (tok && strcasecmp(tok, "not") == 0)
+                    {
+                        tok = strtok_r(NULL, delim, &saved);
+                    }
+
+                    tok = tok ? strtok_r(NULL, delim, &saved) : NULL;
+                }
+
+                if (tok)
+                {
+                    snprintf(db, MYSQL_DATABASE_MAXLEN + 1, "%s", tok);
+                    rval = true;
+                }
+            }
+        }
+
+        MXS_FREE(sql);
+    }
+
+    return rval;
+}
+
+void shard_map_track_ddl(ROUTER_CLIENT_SES *rses, backend_ref_t *bref,
+                         GWBUF *querybuf, qc_query_op_t op)
+{
+    rses->ddl_bref = NULL;
+
+    if (rses->shardmap_version && (op == QUERY_OP_CREATE || op == QUERY_OP_DROP) &&
+        get_ddl_database(querybuf, rses->ddl_db, &rses->ddl_create))
+    {
+        rses->ddl_bref = bref;
+    }
+}
+
+void shard_map_apply_ddl(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *reply)
+{
+    if (rses->ddl_bref != bref)
+    {
+        return;
+    }
+
+    rses->ddl_bref = NULL;
+
+    if (PTR_IS_OK(GWBUF_DATA(reply)))
+    {
+        char *target = bref->bref_backend->server->unique_name;
+        shard_map_t *map = rses->shardmap;
+
+        spinlock_acquire(&map->lock);
+        char *current = hashtable_fetch(map->hash, rses->ddl_db);
+
+        if (rses->ddl_create && current == NULL)
+        {
+            hashtable_add(map->hash, rses->ddl_db, target);
+            MXS_INFO("Database '%s' was created on '%s'.", rses->ddl_db, target);
+        }
+        else if (!rses->ddl_create && current && strcmp(current, target) == 0)
+        {
+            hashtable_delete(map->hash, rses->ddl_db);
+            MXS_INFO("Database '%s' was dropped from '%s'.", rses->ddl_db, target);
+        }
+
+        spinlock_release(&map->lock);
+    }
+}
+
+/**
+ * Get the key of a table name in the table map
+ *
+ * @param rses Router session
+ * @param name Table name, qualified or not
+ * @param key Buffer where the key is stored
+ * @param size Size of @c key
+ * @return True if the key fits in the buffer
+ */
+static bool get_table_key(ROUTER_CLIENT_SES *rses, const char *name, char *key, size_t size)
+{
+    int n = strchr(name, '.') ? snprintf(key, size, "%s", name) :
+            snprintf(key, size, "%s.%s", rses->current_db, name);
+
+    return n > 0 && (size_t)n < size;
+}
+
+/**
+ * Check whether a server is in a comma-separated list of servers
+ *
+ * @param list The list
+ * @param name Server name
+ * @return True if the server is in the list
+ */
+static bool server_in_list(const char *list, const char *name)
+{
+    size_t len = strlen(name);
+
+    for (const char *ptr = list; ptr; ptr = strchr(ptr, ','))
+    {
+        if (*ptr == ',')
+        {
+            ptr++;
+        }
+
+        if (strncmp(ptr, name, len) == 0 && (ptr[len] == ',' || ptr[len] == '\0'))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+char* shard_map_get_table_target(ROUTER_CLIENT_SES *rses, GWBUF *buffer)
+{
+    HASHTABLE *tables = rses->shardmap->tables;
+    char *rval = NULL;
+
+    if (!rses->rses_config.table_sharding || hashtable_size(tables) == 0)
+    {
+        return NULL;
+    }
+
+    int sz = 0;
+    char **names = qc_get_table_names(buffer, &sz, true);
+    bool conflict = false;
+
+    for (int i = 0; i < sz; i++)
+    {
+        char key[MYSQL_DATABASE_MAXLEN * 2 + 2];
+        char *target;
+
+        if ((strchr(names[i], '.') || rses->current_db[0]) &&
+            get_table_key(rses, names[i], key, sizeof(key)) &&
+            (target = hashtable_fetch(tables, key)))
+        {
+            if (rval && strcmp(rval, target) != 0)
+            {
+                MXS_WARNING("Query uses tables on servers '%s' and '%s'. Joins across "
+                            "servers are not supported, routing the query by database.",
+                            rval, target);
+                conflict = true;
+            }
+            else if (rval == NULL)
+            {
+                MXS_INFO("Query uses table '%s' on server '%s'", key, target);
+                rval = target;
+            }
+        }
+
+        MXS_FREE(names[i]);
+    }
+
+    MXS_FREE(names);
+
+    return conflict ? NULL : rval;
+}
+
+GWBUF* shard_map_use_table_db(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *querybuf)
+{
+    if (!rses->rses_config.table_sharding || rses->current_db[0] == '\0' ||
+        strcmp(bref->bref_db, rses->current_db) == 0)
+    {
+        return querybuf;
+    }
+
+    /** The query needs the current database if it has an unqualified table name
+     * that was found on this server */
+    bool needs_db = false;
+    int sz = 0;
+    char **names = qc_get_table_names(querybuf, &sz, true);
+
+    spinlock_acquire(&rses->shardmap->lock);
+
+    for (int i = 0; i < sz; i++)
+    {
+        char key[MYSQL_DATABASE_MAXLEN * 2 + 2];
+        char *target;
+
+        if (!needs_db && strchr(names[i], '.') == NULL &&
+            get_table_key(rses, names[i], key, sizeof(key)))
+        {
+            if ((target = hashtable_fetch(rses->shardmap->tables, key)))
+            {
+                needs_db = strcmp(target, bref->bref_backend->server->unique_name) == 0;
+            }
+            else if ((target = hashtable_fetch(rses->shardmap->scattered, key)))
+            {
+                needs_db = server_in_list(target, bref->bref_backend->server->unique_name);
+            }
+        }
+
+        MXS_FREE(names[i]);
+    }
+
+    spinlock_release(&rses->shardmap->lock);
+    MXS_FREE(names);
+
+    if (needs_db)
+    {
+        unsigned int len = strlen(rses->current_db);
+        GWBUF *buffer = gwbuf_alloc(len + 5);
+
+        if (buffer)
+        {
+            uint8_t *ptr = GWBUF_DATA(buffer);
+            gw_mysql_set_byte3(ptr, len + 1);
+            gwbuf_set_type(buffer, GWBUF_TYPE_MYSQL);
+            ptr[3] = 0x0;
+            ptr[4] = MYSQL_COM_INIT_DB;
+            memcpy(ptr + 5, rses->current_db, len);
+
+            MXS_INFO("Changing the default database of '%s' to '%s'.",
+                     bref->bref_backend->server->unique_name, rses->current_db);
+            strcpy(bref->bref_db, rses->current_db);
+            bref->bref_n_discard++;
+            querybuf = gwbuf_append(buffer, querybuf);
+        }
+    }
+
+    return querybuf;
+}
+
+char* shard_map_get_scatter_targets(ROUTER_CLIENT_SES *rses, GWBUF *buffer)
+{
+    HASHTABLE *scattered = rses->shardmap->scattered;
+
+    if (hashtable_size(scattered) == 0)
+    {
+        return NULL;
+    }
+
+    /** All tables must be found on the same servers */
+    char *servers = NULL;
+    bool ok = true;
+    int sz = 0;
+    char **names = qc_get_table_names(buffer, &sz, true);
+
+    for (int i = 0; i < sz; i++)
+    {
+        char key[MYSQL_DATABASE_MAXLEN * 2 + 2];
+        char *list;
+
+        if (ok && (strchr(names[i], '.') || rses->current_db[0]) &&
+            get_table_key(rses, names[i], key, sizeof(key)) &&
+            (list = hashtable_fetch(scattered, key)))
+        {
+            if (servers == NULL)
+            {
+                servers = list;
+            }
+            else if (strcmp(servers, list) != 0)
+            {
+                ok = false;
+            }
+        }
+        else
+        {
+            ok = false;
+        }
+
+        MXS_FREE(names[i]);
+    }
+
+    MXS_FREE(names);
+
+    return ok && servers ? MXS_STRDUP(servers) : NULL;
+}